@@ -9,6 +9,7 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <arch/x86/acpi/acpi.h>
+#include <infos/mm/numa.h>
 #include <infos/util/string.h>
 
 using namespace infos::arch::x86::acpi;
@@ -49,6 +50,98 @@ struct RSDT {
 #define RSDP_SIGNATURE	0x2052545020445352
 
 #define MADT_SIGNATURE	SIG32('A', 'P', 'I', 'C')
+#define HPET_SIGNATURE	SIG32('H', 'P', 'E', 'T')
+#define MCFG_SIGNATURE	SIG32('M', 'C', 'F', 'G')
+#define SRAT_SIGNATURE	SIG32('S', 'R', 'A', 'T')
+#define SLIT_SIGNATURE	SIG32('S', 'L', 'I', 'T')
+
+// A generic address structure, as used by the HPET table.
+struct GenericAddress {
+	uint8_t address_space;		// Zero for memory
+	uint8_t bit_width;
+	uint8_t bit_offset;
+	uint8_t access_size;
+	uint64_t address;
+} __packed;
+
+struct HPETTable {
+	SDTHeader header;
+	uint32_t event_timer_block_id;
+	GenericAddress base_address;
+	uint8_t hpet_number;
+	uint16_t minimum_tick;
+	uint8_t page_protection;
+} __packed;
+
+// Where a PCI segment's memory-mapped configuration space is, and which buses it spans.
+struct MCFGAllocation {
+	uint64_t base_address;
+	uint16_t segment;
+	uint8_t start_bus;
+	uint8_t end_bus;
+	uint32_t reserved;
+} __packed;
+
+struct MCFGTable {
+	SDTHeader header;
+	uint64_t reserved;
+	MCFGAllocation allocations[];
+} __packed;
+
+// The static resource affinity table: which proximity domain (NUMA node) each processor
+// and range of memory is in.
+struct SRATTable {
+	SDTHeader header;
+	uint32_t reserved1;
+	uint64_t reserved2;
+} __packed;
+
+struct SRATRecordHeader {
+	uint8_t type, length;
+} __packed;
+
+#define SRAT_LAPIC		0
+#define SRAT_MEMORY		1
+#define SRAT_X2APIC		2
+
+struct SRATRecordLAPIC {
+	SRATRecordHeader header;
+	uint8_t proximity_domain_lo;
+	uint8_t apic_id;
+	uint32_t flags;				// bit 0: enabled
+	uint8_t sapic_eid;
+	uint8_t proximity_domain_hi[3];
+	uint32_t clock_domain;
+} __packed;
+
+struct SRATRecordMemory {
+	SRATRecordHeader header;
+	uint32_t proximity_domain;
+	uint16_t reserved1;
+	uint64_t base_address;
+	uint64_t length;
+	uint32_t reserved2;
+	uint32_t flags;				// bit 0: enabled
+	uint64_t reserved3;
+} __packed;
+
+struct SRATRecordX2APIC {
+	SRATRecordHeader header;
+	uint16_t reserved1;
+	uint32_t proximity_domain;
+	uint32_t x2apic_id;
+	uint32_t flags;				// bit 0: enabled
+	uint32_t clock_domain;
+	uint32_t reserved2;
+} __packed;
+
+// The system locality information table: the distance from each proximity domain to
+// each other, as a matrix of bytes.
+struct SLITTable {
+	SDTHeader header;
+	uint64_t nr_localities;
+	uint8_t distances[];
+} __packed;
 
 struct MADTRecordHeader {
 	uint8_t type, length;
@@ -86,6 +179,22 @@ struct MADT {
 
 static RSDPDescriptor *__rsdp;
 static uint32_t __ioapic_base;
+static uint64_t __hpet_base;
+static uint64_t __pci_ecam_base;
+static uint8_t __pci_ecam_start_bus, __pci_ecam_end_bus;
+
+// The local APIC IDs of the enabled processors, in the order the MADT lists them.
+#define MAX_LAPICS 64
+static uint8_t __lapic_ids[MAX_LAPICS];
+static unsigned int __nr_lapics;
+
+// The proximity domains that the SRAT mentions, in order, are numbered as NUMA nodes.
+// The SLIT is indexed by proximity domain, so it is only looked at once the SRAT has
+// been, whichever comes first.
+static uint32_t __numa_domains[MAX_NUMA_NODES];
+static unsigned int __nr_numa_domains;
+static uint8_t __lapic_nodes[256];
+static const SLITTable *__slit;
 
 /**
  * Scans memory for the RSDP by looking for the RSDP signature.  Returns a pointer to the RSDP descriptor, if it's
@@ -150,6 +259,12 @@ static bool is_structure_valid(const void *structure_base, size_t structure_size
 static bool parse_madt_lapic(const MADTRecordLAPIC *lapic)
 {
 	acpi_log.messagef(infos::kernel::LogLevel::DEBUG, "madt: lapic: id=%u, procid=%u, flags=%x", lapic->apic_id, lapic->acpi_processor_id, lapic->flags);
+
+	// Bit zero of the flags says whether the processor is enabled.
+	if ((lapic->flags & 1) && __nr_lapics < MAX_LAPICS) {
+		__lapic_ids[__nr_lapics++] = lapic->apic_id;
+	}
+
 	return true;
 }
 
@@ -221,6 +336,141 @@ static bool parse_madt(const MADT *madt)
 	return true;
 }
 
+/**
+ * Parses the HPET table.  Only the first HPET is used, and only if it is memory-mapped.
+ */
+static bool parse_hpet(const HPETTable *hpet)
+{
+	acpi_log.messagef(infos::kernel::LogLevel::DEBUG, "hpet: number=%u, address-space=%u, base=%llx, min-tick=%u",
+		hpet->hpet_number, hpet->base_address.address_space, hpet->base_address.address, hpet->minimum_tick);
+
+	if (hpet->base_address.address_space == 0 && !__hpet_base) {
+		__hpet_base = hpet->base_address.address;
+	}
+
+	return true;
+}
+
+/**
+ * Parses the MCFG table.  Only segment zero is used, as that is the only one reached through
+ * the legacy configuration ports, and so the only one the PCI code knows about.
+ */
+static bool parse_mcfg(const MCFGTable *mcfg)
+{
+	unsigned int nr_allocations = (mcfg->header.length - sizeof(*mcfg)) / sizeof(MCFGAllocation);
+
+	for (unsigned int i = 0; i < nr_allocations; i++) {
+		const MCFGAllocation *alloc = &mcfg->allocations[i];
+
+		acpi_log.messagef(infos::kernel::LogLevel::DEBUG, "mcfg: segment=%u, buses=%u-%u, base=%llx",
+			alloc->segment, alloc->start_bus, alloc->end_bus, alloc->base_address);
+
+		if (alloc->segment == 0 && !__pci_ecam_base) {
+			__pci_ecam_base = alloc->base_address;
+			__pci_ecam_start_bus = alloc->start_bus;
+			__pci_ecam_end_bus = alloc->end_bus;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Returns the NUMA node of a proximity domain, numbering it if it hasn't been seen yet.
+ */
+static bool numa_node_of_domain(uint32_t domain, unsigned int& node)
+{
+	for (node = 0; node < __nr_numa_domains; node++) {
+		if (__numa_domains[node] == domain) return true;
+	}
+
+	if (__nr_numa_domains >= MAX_NUMA_NODES) return false;
+
+	__numa_domains[__nr_numa_domains++] = domain;
+	infos::mm::numa_add_node(node);
+	return true;
+}
+
+/**
+ * Parses the SRAT.
+ */
+static bool parse_srat(const SRATTable *srat)
+{
+	const SRATRecordHeader *rhs = (const SRATRecordHeader *)(srat + 1);
+	const SRATRecordHeader *rhe = (const SRATRecordHeader *)((uintptr_t)srat + srat->header.length);
+
+	while (rhs < rhe && rhs->length) {
+		unsigned int node;
+
+		switch (rhs->type) {
+		case SRAT_LAPIC: {
+			const SRATRecordLAPIC *lapic = (const SRATRecordLAPIC *)rhs;
+			uint32_t domain = lapic->proximity_domain_lo | (uint32_t)lapic->proximity_domain_hi[0] << 8 |
+				(uint32_t)lapic->proximity_domain_hi[1] << 16 | (uint32_t)lapic->proximity_domain_hi[2] << 24;
+
+			if ((lapic->flags & 1) && numa_node_of_domain(domain, node)) {
+				acpi_log.messagef(infos::kernel::LogLevel::DEBUG, "srat: lapic: id=%u, domain=%u", lapic->apic_id, domain);
+				__lapic_nodes[lapic->apic_id] = node;
+			}
+
+			break;
+		}
+
+		case SRAT_X2APIC: {
+			const SRATRecordX2APIC *x2apic = (const SRATRecordX2APIC *)rhs;
+
+			// Only the IDs that fit in a local APIC ID are used.
+			if ((x2apic->flags & 1) && x2apic->x2apic_id < 0x100 && numa_node_of_domain(x2apic->proximity_domain, node)) {
+				__lapic_nodes[x2apic->x2apic_id] = node;
+			}
+
+			break;
+		}
+
+		case SRAT_MEMORY: {
+			const SRATRecordMemory *memory = (const SRATRecordMemory *)rhs;
+
+			if ((memory->flags & 1) && memory->length && numa_node_of_domain(memory->proximity_domain, node)) {
+				acpi_log.messagef(infos::kernel::LogLevel::DEBUG, "srat: memory: base=%llx, length=%llx, domain=%u",
+					memory->base_address, memory->length, memory->proximity_domain);
+				infos::mm::numa_add_memory(node, memory->base_address, memory->length);
+			}
+
+			break;
+		}
+
+		default:
+			break;
+		}
+
+		rhs = (const SRATRecordHeader *)((uintptr_t)rhs + rhs->length);
+	}
+
+	return true;
+}
+
+/**
+ * Passes on the distances in the SLIT between the proximity domains that the SRAT
+ * numbered as nodes.
+ */
+static void apply_slit(const SLITTable *slit)
+{
+	uint64_t n = slit->nr_localities;
+	if (sizeof(*slit) + n * n > slit->header.length) {
+		acpi_log.messagef(infos::kernel::LogLevel::WARNING, "slit: truncated");
+		return;
+	}
+
+	for (unsigned int from = 0; from < __nr_numa_domains; from++) {
+		for (unsigned int to = 0; to < __nr_numa_domains; to++) {
+			uint32_t i = __numa_domains[from], j = __numa_domains[to];
+			if (i >= n || j >= n) continue;
+
+			infos::mm::numa_set_distance(from, to, slit->distances[i * n + j]);
+		}
+	}
+}
+
 /**
  * Parses the ACPI tables.
  */
@@ -254,12 +504,35 @@ static bool acpi_parse()
 				return false;
 			}
 			
+			break;
+		case HPET_SIGNATURE:
+			if (!parse_hpet((const HPETTable *)hdr)) {
+				return false;
+			}
+
+			break;
+		case MCFG_SIGNATURE:
+			if (!parse_mcfg((const MCFGTable *)hdr)) {
+				return false;
+			}
+
+			break;
+		case SRAT_SIGNATURE:
+			if (!parse_srat((const SRATTable *)hdr)) {
+				return false;
+			}
+
+			break;
+		case SLIT_SIGNATURE:
+			__slit = (const SLITTable *)hdr;
 			break;
 		default:
 			acpi_log.messagef(infos::kernel::LogLevel::WARNING, "unsupported acpi table: %08x", hdr->signature);
 			break;
 		}
 	}
+
+	if (__slit) apply_slit(__slit);
 	
 	return true;
 }
@@ -299,3 +572,51 @@ uint32_t infos::arch::x86::acpi::acpi_get_ioapic_base()
 {
 	return __ioapic_base;
 }
+
+/**
+ * Returns the physical base address of the HPET, or zero if there isn't one.
+ */
+uint64_t infos::arch::x86::acpi::acpi_get_hpet_base()
+{
+	return __hpet_base;
+}
+
+/**
+ * Returns the physical base address of PCI segment zero's memory-mapped configuration space,
+ * and the buses it spans, or false if there isn't one.
+ */
+bool infos::arch::x86::acpi::acpi_get_pci_ecam(uint64_t& base, uint8_t& start_bus, uint8_t& end_bus)
+{
+	if (!__pci_ecam_base) return false;
+
+	base = __pci_ecam_base;
+	start_bus = __pci_ecam_start_bus;
+	end_bus = __pci_ecam_end_bus;
+	return true;
+}
+
+/**
+ * Returns the number of enabled processors listed in the MADT.
+ */
+unsigned int infos::arch::x86::acpi::acpi_get_nr_lapics()
+{
+	return __nr_lapics;
+}
+
+/**
+ * Returns the NUMA node of the processor with the given local APIC ID, which is zero if
+ * the SRAT doesn't say.
+ */
+unsigned int infos::arch::x86::acpi::acpi_get_lapic_node(uint8_t apic_id)
+{
+	return __lapic_nodes[apic_id];
+}
+
+/**
+ * Returns the local APIC ID of an enabled processor listed in the MADT.
+ */
+uint8_t infos::arch::x86::acpi::acpi_get_lapic_id(unsigned int index)
+{
+	assert(index < __nr_lapics);
+	return __lapic_ids[index];
+}
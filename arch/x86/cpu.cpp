@@ -23,16 +23,16 @@ using namespace infos::arch::x86;
  */
 bool infos::arch::x86::cpu_init()
 {
-	// This doesn't do anything, because we currently only support
-	// a uniprocessor machine.  In the future, this would involve getting the CPU
-	// online and configured.
-	return true;
+	// Only the boot CPU's FPU and PMU are configured here.  The other CPUs are brought
+	// up later, once the timers are available (see smp_init()), and configure their own.
+	pmu_init();
+	return fpu_init();
 }
 
 /**
  * Constructs a new X86CPU object.
  */
-X86CPU::X86CPU()
+X86CPU::X86CPU() : current_thread(NULL), fpu_owner(NULL), in_kernel_fpu(false), pmu_start(), tss_sel(0), index(0), apic_id(0), online(false), idle_wake(0), active_pgt(0)
 {
 
 }
@@ -13,17 +13,22 @@
 #include <arch/x86/msr.h>
 #include <arch/x86/cpuid.h>
 #include <arch/x86/acpi/acpi.h>
+#include <arch/x86/tsc.h>
 #include <arch/x86/qemu-stream.h>
 
 #include <infos/kernel/log.h>
+#include <infos/kernel/boot-phase.h>
 #include <infos/kernel/kernel.h>
+#include <infos/mm/vma.h>
 
 #include <infos/drivers/console/virtual-console.h>
 #include <infos/drivers/terminal/terminal.h>
 #include <infos/drivers/video/vga-console.h>
+#include <infos/drivers/video/fb-console.h>
 #include <infos/drivers/input/keyboard.h>
 #include <infos/drivers/timer/lapic-timer.h>
 #include <infos/drivers/timer/pit.h>
+#include <infos/drivers/timer/hpet.h>
 #include <infos/drivers/pci/pci-bus.h>
 #include <infos/drivers/irq/lapic.h>
 #include <infos/drivers/irq/ioapic.h>
@@ -56,6 +61,13 @@ RegisterCmdLineArgument(SysLogDestination, "syslog") {
 	}
 }
 
+// And one for reading the kernel's clock from the HPET, rather than the TSC.
+static bool clocksource_hpet = false;
+
+RegisterCmdLineArgument(ClockSource, "clocksource") {
+	clocksource_hpet = (infos::util::strncmp(value, "hpet", 4) == 0);
+}
+
 RegisterCmdLineArgument(Tty0IsSerial, "tty0") {
 	if (infos::util::strncmp(value, "serial", 6) == 0) {
 		syslog.message(LogLevel::INFO, "will create first tty on serial port");
@@ -75,6 +87,7 @@ using namespace infos::drivers::pci;
 using namespace infos::drivers::video;
 using namespace infos::drivers::timer;
 using namespace infos::drivers::irq;
+using namespace infos::mm;
 using namespace infos::kernel;
 
 /**
@@ -106,6 +119,11 @@ bool infos::arch::x86::timer_init()
 	// structures.
 	syslog.messagef(LogLevel::DEBUG, "LAPIC base=%llx, IOAPIC base=%x", lapic_base, ioapic_base);
 
+	// The firmware's MTRRs should already make the registers uncached, but it
+	// doesn't hurt to be sure.
+	set_physical_cache_type(lapic_base, __page_size, PTE_CACHE_UC);
+	set_physical_cache_type(ioapic_base, __page_size, PTE_CACHE_UC);
+
 	// Create and register an LAPIC object.
 	LAPIC *lapic = new LAPIC(pa_to_vpa(lapic_base));
 	if (!sys.device_manager().register_device(*lapic))
@@ -123,6 +141,19 @@ bool infos::arch::x86::timer_init()
 	if (!sys.device_manager().register_device(*pit))
 		return false;
 
+	// The HPET, if there is one, is a better reference than the PIT, and can be the
+	// kernel's clock instead of the TSC.
+	HPET *hpet = NULL;
+	uint64_t hpet_base = infos::arch::x86::acpi::acpi_get_hpet_base();
+	if (hpet_base) {
+		set_physical_cache_type(hpet_base, __page_size, PTE_CACHE_UC);
+		hpet = new HPET(pa_to_vpa(hpet_base));
+		if (!sys.device_manager().register_device(*hpet)) {
+			delete hpet;
+			hpet = NULL;
+		}
+	}
+
 	// Finally, create a register the LAPIC timer.  The LAPIC timer will
 	// calibrate itself as part of its initialisation, and so the PIT
 	// must be registered beforehand.
@@ -130,6 +161,55 @@ bool infos::arch::x86::timer_init()
 	if (!sys.device_manager().register_device(*lapic_timer))
 		return false;
 
+	if (clocksource_hpet) {
+		if (!hpet || !hpet->use_as_clocksource()) {
+			syslog.message(LogLevel::WARNING, "HPET clocksource unavailable: using the TSC");
+		}
+	} else if (hpet && !tsc_invariant()) {
+		syslog.message(LogLevel::INFO, "TSC may be unreliable: boot with clocksource=hpet to use the HPET instead");
+	}
+
+	return true;
+}
+
+/**
+ * Finds out from the boot loader whether there is a linear framebuffer that the console
+ * can be drawn on, and if so makes it write-combining.
+ */
+static bool framebuffer_info(FramebufferInfo& fb)
+{
+	const multiboot_info *mbi = multiboot_info_structure;
+
+	if (!(mbi->flags & MULTIBOOT_INFO_FRAMEBUFFER) || mbi->framebuffer_type != MULTIBOOT_FRAMEBUFFER_TYPE_RGB) {
+		return false;
+	}
+
+	size_t size = (size_t)mbi->framebuffer_pitch * mbi->framebuffer_height;
+	if (mbi->framebuffer_addr + size > PMEM_VA_SIZE) {
+		syslog.messagef(LogLevel::WARNING, "Framebuffer at 0x%llx is out of reach", mbi->framebuffer_addr);
+		return false;
+	}
+
+	fb.base = pa_to_vpa(mbi->framebuffer_addr);
+	fb.width = mbi->framebuffer_width;
+	fb.height = mbi->framebuffer_height;
+	fb.pitch = mbi->framebuffer_pitch;
+	fb.bpp = mbi->framebuffer_bpp;
+	fb.red_position = mbi->framebuffer_red_field_position;
+	fb.red_size = mbi->framebuffer_red_mask_size;
+	fb.green_position = mbi->framebuffer_green_field_position;
+	fb.green_size = mbi->framebuffer_green_mask_size;
+	fb.blue_position = mbi->framebuffer_blue_field_position;
+	fb.blue_size = mbi->framebuffer_blue_mask_size;
+
+	if (!FramebufferConsoleDevice::supported(fb)) {
+		syslog.messagef(LogLevel::WARNING, "Framebuffer of %ux%u at %u bpp is unsupported", fb.width, fb.height, fb.bpp);
+		return false;
+	}
+
+	bool wc = set_physical_cache_type(mbi->framebuffer_addr, size, PTE_CACHE_WC);
+	syslog.messagef(LogLevel::INFO, "Framebuffer console: %ux%u at 0x%llx%s", fb.width, fb.height,
+		mbi->framebuffer_addr, wc ? ", write-combining" : "");
 	return true;
 }
 
@@ -141,10 +221,17 @@ bool infos::arch::x86::timer_init()
  */
 bool infos::arch::x86::console_init()
 {
-	// Create a new VGA console device (which will be the /physical/ console), and
-	// register it with the system.
-	if (!sys.device_manager().register_device(*new VGAConsoleDevice(pa_to_vpa(0xb8000))))
-		return false;
+	// Create the /physical/ console, and register it with the system: on the boot
+	// loader's framebuffer, if it set one up that can be drawn on, or else the VGA
+	// text console.
+	FramebufferInfo fb;
+	if (framebuffer_info(fb)) {
+		if (!sys.device_manager().register_device(*new FramebufferConsoleDevice(fb)))
+			return false;
+	} else {
+		if (!sys.device_manager().register_device(*new VGAConsoleDevice(pa_to_vpa(0xb8000))))
+			return false;
+	}
 
 	// Create and register a keyboard device.
 	if (!sys.device_manager().register_device(*new Keyboard()))
@@ -253,18 +340,10 @@ bool infos::arch::x86::activate_console()
 extern char _DEVICE_PTR_START, _DEVICE_PTR_END;
 
 /**
- * Initialises main system devices.
- * @return Returns TRUE if the devices were successfully initialised, or FALSE otherwise.
+ * Creates and registers the devices in the device list (see RegisterDevice).
  */
-bool infos::arch::x86::devices_init()
+static bool register_pseudo_devices(void *arg)
 {
-	// Create a new PCI bus object, with bus ID 0 and probe the bus for devices.
-	PCIBus *bus = new PCIBus(0);
-	if (!bus->probe(sys.device_manager())) {
-		return false;
-	}
-
-	// Initialise other platform devices.
 	device_ctor_fn *devices = (device_ctor_fn *)&_DEVICE_PTR_START;
 
 	syslog.messagef(LogLevel::INFO, "registering additional devices...");
@@ -278,3 +357,24 @@ bool infos::arch::x86::devices_init()
 
 	return true;
 }
+
+/**
+ * Initialises main system devices.
+ * @return Returns TRUE if the devices were successfully initialised, or FALSE otherwise.
+ */
+bool infos::arch::x86::devices_init()
+{
+	// Probe the PCI buses for devices, starting from the host controllers.
+	{
+		BootPhase phase("pci.probe");
+		if (!PCIBus::probe_all(sys.device_manager())) {
+			return false;
+		}
+	}
+
+	// The other platform devices are only statistics and traces, which nothing during
+	// the boot needs.
+	sys.device_manager().init_async(DeviceInitGroup::PSEUDO, register_pseudo_devices, NULL);
+
+	return true;
+}
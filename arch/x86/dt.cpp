@@ -14,10 +14,10 @@
 
 using namespace infos::arch::x86;
 
-// GDT, IDT and TSS instantiation -- make sure they're aligned nicely.
+// GDT and IDT instantiation -- make sure they're aligned nicely.  Each CPU has its
+// own TSS (see X86CPU).
 __aligned(16) GDT infos::arch::x86::gdt;
 __aligned(16) IDT infos::arch::x86::idt;
-__aligned(16) TSS infos::arch::x86::tss;
 
 /**
  * Initialises the Global Descriptor Table
@@ -35,12 +35,13 @@ bool GDT::init()
 	if (!add_code_segment(0)) return false;			// 8
 	if (!add_data_segment(0)) return false;			// 10
 
-	// User code and data segments.
-	if (!add_code_segment(3)) return false;			// 18
-	if (!add_data_segment(3)) return false;			// 20
+	// User data and code segments.  They are this way round because 'sysret'
+	// expects the code segment to follow the data segment.
+	if (!add_data_segment(3)) return false;			// 18
+	if (!add_code_segment(3)) return false;			// 20
 	
-	// TSS
-	if (!add_tss((void *)tss.__tss, sizeof(tss.__tss))) return false;	// 28
+	// The TSS descriptors are added as the CPUs are brought up (see X86Arch::add_cpu()),
+	// starting at 28.
 	
 	return reload();
 }
@@ -150,6 +151,18 @@ bool GDT::add_tss(void* ptr, size_t size)
 	return true;
 }
 
+/**
+ * Inserts a descriptor for a TSS into the GDT.
+ * @param tss The TSS.
+ * @param sel Set to the selector of the new descriptor.
+ * @return Returns true if the insertion was successful, false otherwise.
+ */
+bool GDT::add_tss(TSS& tss, uint16_t& sel)
+{
+	sel = _current * 8;
+	return add_tss((void *)tss.__tss, sizeof(tss.__tss));
+}
+
 /**
  * Initialises the Interrupt Descriptor Table.
  * @return Returns true if initialisation was successful, false otherwise.
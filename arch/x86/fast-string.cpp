@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * arch/x86/fast-string.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <arch/x86/init.h>
+#include <arch/x86/cpuid.h>
+#include <arch/x86/msr.h>
+#include <infos/kernel/log.h>
+#include <infos/kernel/benchmark.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::arch::x86;
+using namespace infos::util;
+
+// Must match arch/x86/util/fast-string.S
+#define FAST_STRING_ERMS	(1 << 0)
+#define FAST_STRING_FSRM	(1 << 1)
+
+// CPUID_GET_STRUCT_FEATURES
+#define CPUID_ERMS_RBX		(1 << 9)
+#define CPUID_FSRM_RDX		(1 << 4)
+
+extern "C" uint64_t fast_string_flags;
+
+// The number of calls timed, for each function at each size.
+#define BENCHMARK_CALLS		256
+#define BENCHMARK_MAX_SIZE	4096
+
+static bool do_benchmark;
+
+RegisterCmdLineArgument(StringBenchmark, "string.benchmark")
+{
+	do_benchmark = strncmp(value, "1", 2) == 0;
+}
+
+static uint8_t benchmark_buffer[BENCHMARK_MAX_SIZE * 2 + 64];
+
+static void report(const char *fn, size_t size, uint64_t cycles)
+{
+	x86_log.messagef(LogLevel::INFO, "%s: flags=%llx: n=%lu: cycles/call=%llu", fn, fast_string_flags, size, cycles / BENCHMARK_CALLS);
+}
+
+/**
+ * Times memcpy, memmove each way over an overlap, and memset, at a spread of sizes, with
+ * the flags that the CPU has.  Called once with them all clear, to compare.
+ */
+static void benchmark()
+{
+	static const size_t sizes[] = { 7, 16, 32, 64, 256, 1024, BENCHMARK_MAX_SIZE };
+
+	uint8_t *a = benchmark_buffer;
+	uint8_t *b = benchmark_buffer + BENCHMARK_MAX_SIZE + 64;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(sizes); i++) {
+		size_t size = sizes[i];
+		uint64_t start;
+
+		start = __rdtsc();
+		for (unsigned int n = 0; n < BENCHMARK_CALLS; n++) memcpy(b, a, size);
+		report("memcpy", size, __rdtsc() - start);
+
+		start = __rdtsc();
+		for (unsigned int n = 0; n < BENCHMARK_CALLS; n++) memmove(a + 8, a, size);
+		report("memmove-backward", size, __rdtsc() - start);
+
+		start = __rdtsc();
+		for (unsigned int n = 0; n < BENCHMARK_CALLS; n++) memmove(a, a + 8, size);
+		report("memmove-forward", size, __rdtsc() - start);
+
+		start = __rdtsc();
+		for (unsigned int n = 0; n < BENCHMARK_CALLS; n++) memset(b, n, size);
+		report("memset", size, __rdtsc() - start);
+	}
+}
+
+RegisterBenchmark(Memcpy64, "string.memcpy-64", 1024)
+{
+	for (unsigned int i = 0; i < iterations; i++) memcpy(benchmark_buffer + BENCHMARK_MAX_SIZE + 64, benchmark_buffer, 64);
+}
+
+RegisterBenchmark(Memcpy4096, "string.memcpy-4096", 64)
+{
+	for (unsigned int i = 0; i < iterations; i++) memcpy(benchmark_buffer + BENCHMARK_MAX_SIZE + 64, benchmark_buffer, BENCHMARK_MAX_SIZE);
+}
+
+RegisterBenchmark(Memmove4096, "string.memmove-4096", 64)
+{
+	for (unsigned int i = 0; i < iterations; i++) memmove(benchmark_buffer + 8, benchmark_buffer, BENCHMARK_MAX_SIZE);
+}
+
+RegisterBenchmark(Memset4096, "string.memset-4096", 64)
+{
+	for (unsigned int i = 0; i < iterations; i++) memset(benchmark_buffer, i, BENCHMARK_MAX_SIZE);
+}
+
+/**
+ * Works out which of the string instructions' fast paths the CPU has, which the large
+ * copies and fills pick between.
+ */
+void infos::arch::x86::fast_string_init()
+{
+	uint64_t flags = 0;
+
+	if (__cpuid(CPUID_GETVENDOR).rax >= CPUID_GET_STRUCT_FEATURES) {
+		CPUID features = __cpuid(CPUID_GET_STRUCT_FEATURES, 0);
+
+		if (features.rbx & CPUID_ERMS_RBX) flags |= FAST_STRING_ERMS;
+		if (features.rdx & CPUID_FSRM_RDX) flags |= FAST_STRING_FSRM;
+	}
+
+	x86_log.messagef(LogLevel::INFO, "Fast strings:%s%s", (flags & FAST_STRING_ERMS) ? " erms" : "", (flags & FAST_STRING_FSRM) ? " fsrm" : "");
+
+	if (do_benchmark) {
+		x86_log.messagef(LogLevel::IMPORTANT, "STRING BENCHMARK - BEGIN");
+
+		benchmark();
+		if (flags) {
+			fast_string_flags = flags;
+			benchmark();
+		}
+
+		x86_log.messagef(LogLevel::IMPORTANT, "STRING BENCHMARK - END");
+	}
+
+	fast_string_flags = flags;
+}
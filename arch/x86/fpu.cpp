@@ -0,0 +1,229 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * arch/x86/fpu.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <arch/x86/init.h>
+#include <arch/x86/fpu.h>
+#include <arch/x86/cpu.h>
+#include <arch/x86/irq.h>
+#include <arch/x86/x86-arch.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/process.h>
+#include <infos/kernel/log.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::arch::x86;
+using namespace infos::util;
+
+/*
+ * The FPU (x87 and SSE) state is saved when its owner is switched out, and loaded when a
+ * thread that has FPU state is switched to, so that the FPU only ever holds the state of
+ * the thread running on the CPU.  A thread's state is only allocated (and initialised)
+ * the first time it uses the FPU: until then, CR0.TS is set while it runs, so that its
+ * first FPU instruction raises #NM.  Threads that never touch the FPU -- which includes
+ * all kernel threads -- never pay for it, and the interrupt and system call paths don't
+ * touch the FPU at all.
+ *
+ * With fpu.lazy=1, the state is also loaded lazily: TS is set whenever the thread being
+ * switched to isn't the one whose state is in the FPU, and its state is only loaded at
+ * its first FPU instruction.  The CPU keeps ownership after its owner is switched out
+ * (whose state is still saved then, because it may next run on another CPU), so a
+ * thread that comes back to the same CPU, with nothing else having used the FPU,
+ * doesn't trap.  A thread owns the FPU of at most one CPU: taking it on one CPU, or
+ * going away, takes it off every other, whose registers then hold nothing that isn't
+ * saved.
+ *
+ * The state is saved with FXSAVE, which covers x87 and SSE.  The kernel doesn't turn on
+ * CR4.OSXSAVE, so there are no other state components to save, and no AVX.
+ *
+ * The kernel can borrow the FPU in a KernelFPUSection.  The owner's state is saved, and
+ * the FPU is left unowned, so that the owner's next FPU instruction loads it back.
+ */
+
+#define CR0_MP		(1ull << 1)
+#define CR0_EM		(1ull << 2)
+#define CR0_TS		(1ull << 3)
+
+// The size of the FXSAVE area, which must be 16-byte aligned.
+#define FPU_STATE_SIZE	512
+
+// The power-on MXCSR: all SIMD floating-point exceptions masked.
+#define MXCSR_DEFAULT	0x1f80
+
+// Whether FPU state is loaded lazily, which is off unless asked for (fpu.lazy=1) until it
+// has been run on a booted system.
+static bool lazy_fpu;
+
+RegisterCmdLineArgument(FPULazy, "fpu.lazy") {
+	lazy_fpu = strncmp(value, "1", 2) == 0;
+}
+
+static inline X86CPU& this_cpu()
+{
+	return (X86CPU&)x86arch.get_current_cpu();
+}
+
+static inline void set_ts()
+{
+	uint64_t cr0;
+	asm volatile("mov %%cr0, %0" : "=r"(cr0));
+	if (!(cr0 & CR0_TS)) {
+		asm volatile("mov %0, %%cr0" :: "r"(cr0 | CR0_TS));
+	}
+}
+
+/**
+ * Makes sure no CPU, other than the given one (if any), thinks the thread owns its FPU.
+ */
+static void disown_fpu(Thread& thread, X86CPU *keep)
+{
+	for (unsigned int i = 0; i < x86arch.nr_cpus(); i++) {
+		X86CPU& cpu = x86arch.cpu(i);
+		if (&cpu == keep) continue;
+
+		Thread *owner = &thread;
+		__atomic_compare_exchange_n(&cpu.fpu_owner, &owner, (Thread *)NULL, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Handles #NM: the running thread has used the FPU, but doesn't own it.
+ */
+static void handle_device_not_available(const IRQ *irq, void *priv)
+{
+	X86CPU& cpu = this_cpu();
+	Thread& current = Thread::current();
+
+	asm volatile("clts");
+	if (cpu.fpu_owner == &current) return;
+
+	// The previous owner isn't running, so its state was saved when it was switched out.
+	// Another CPU that the thread last used the FPU on still has its older state, and
+	// mustn't keep it, or the thread would pick those registers up again back there.
+	disown_fpu(current, &cpu);
+
+	if (current.context().xsave_area) {
+		asm volatile("fxrstor64 (%0)" :: "r"(current.context().xsave_area) : "memory");
+	} else {
+		uint8_t *area = new uint8_t[FPU_STATE_SIZE];
+		if (!area) {
+			syslog.messagef(LogLevel::ERROR, "Unable to allocate FPU state for thread %s", current.name().c_str());
+			cpu.fpu_owner = NULL;
+			set_ts();
+
+			current.owner().terminate(-1);
+			return;
+		}
+
+		assert(((uintptr_t)area & 15) == 0);
+		current.context().xsave_area = (uintptr_t)area;
+
+		// Give the thread a clean FPU.
+		uint32_t mxcsr = MXCSR_DEFAULT;
+		asm volatile("fninit; ldmxcsr %0" :: "m"(mxcsr));
+	}
+
+	cpu.fpu_owner = &current;
+}
+
+void infos::arch::x86::fpu_switch_to(Thread& thread)
+{
+	X86CPU& cpu = this_cpu();
+	Thread *prev = cpu.current_thread;
+
+	// The outgoing thread owns the FPU, so TS is clear, and its state is in the registers.
+	if (prev && prev != &thread && cpu.fpu_owner == prev) {
+		asm volatile("fxsave64 (%0)" :: "r"(prev->context().xsave_area) : "memory");
+	}
+
+	if (cpu.fpu_owner == &thread) {
+		asm volatile("clts");
+	} else if (!lazy_fpu && thread.context().xsave_area) {
+		asm volatile("clts");
+		asm volatile("fxrstor64 (%0)" :: "r"(thread.context().xsave_area) : "memory");
+		cpu.fpu_owner = &thread;
+	} else {
+		// Without lazy loading, nothing is left owning the FPU that isn't running.
+		if (!lazy_fpu) cpu.fpu_owner = NULL;
+		set_ts();
+	}
+}
+
+void infos::arch::x86::fpu_release(Thread& thread)
+{
+	disown_fpu(thread, NULL);
+
+	if (thread.context().xsave_area) {
+		delete[] (uint8_t *)thread.context().xsave_area;
+		thread.context().xsave_area = 0;
+	}
+}
+
+void infos::arch::x86::kernel_fpu_begin()
+{
+	assert(!sys.arch().interrupts_enabled());
+
+	X86CPU& cpu = this_cpu();
+	assert(!cpu.in_kernel_fpu);
+	cpu.in_kernel_fpu = true;
+
+	asm volatile("clts");
+
+	if (cpu.fpu_owner) {
+		asm volatile("fxsave64 (%0)" :: "r"(cpu.fpu_owner->context().xsave_area) : "memory");
+		cpu.fpu_owner = NULL;
+	}
+
+	uint32_t mxcsr = MXCSR_DEFAULT;
+	asm volatile("fninit; ldmxcsr %0" :: "m"(mxcsr) : "memory");
+}
+
+void infos::arch::x86::kernel_fpu_end()
+{
+	X86CPU& cpu = this_cpu();
+	assert(cpu.in_kernel_fpu);
+	cpu.in_kernel_fpu = false;
+
+	// Nothing owns the FPU now, so whichever thread uses it next traps, and loads its
+	// own state.
+	set_ts();
+}
+
+/**
+ * Turns on the calling CPU's FPU.
+ */
+void infos::arch::x86::fpu_init_cpu()
+{
+	// Stop emulating the FPU, and make WAIT/FWAIT respect TS, then set TS so that
+	// the first thread to use the FPU takes ownership of it.
+	uint64_t cr0;
+	asm volatile("mov %%cr0, %0" : "=r"(cr0));
+	cr0 &= ~CR0_EM;
+	cr0 |= CR0_MP | CR0_TS;
+	asm volatile("mov %0, %%cr0" :: "r"(cr0));
+}
+
+/**
+ * Turns on the FPU.
+ * @return Returns true if the FPU was initialised, or false otherwise.
+ */
+bool infos::arch::x86::fpu_init()
+{
+	if (!x86arch.irq_manager().install_exception_handler(IRQ_DEVICE_NOT_AVAILABLE, handle_device_not_available, NULL)) {
+		return false;
+	}
+
+	fpu_init_cpu();
+
+	x86_log.messagef(LogLevel::INFO, "FPU enabled, with %s switching", lazy_fpu ? "lazy" : "eager");
+	return true;
+}
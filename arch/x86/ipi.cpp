@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * arch/x86/ipi.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <arch/x86/ipi.h>
+#include <arch/x86/init.h>
+#include <arch/x86/irq.h>
+#include <arch/x86/cpu.h>
+#include <arch/x86/x86-arch.h>
+#include <infos/drivers/irq/lapic.h>
+#include <infos/drivers/device.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
+#include <infos/kernel/softirq.h>
+#include <infos/fs/text-file.h>
+#include <infos/util/lock.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::irq;
+using namespace infos::arch::x86;
+using namespace infos::fs;
+using namespace infos::util;
+
+/**
+ * A call that has been sent to several CPUs.  It lives on the sender's stack, until every
+ * CPU has run it.
+ */
+struct IPICall
+{
+	ipi_fn_t fn;
+	void *arg;
+	IPIType::IPIType type;
+	volatile unsigned int remaining;
+};
+
+/* What is queued on one CPU for one call. */
+struct IPICallEntry
+{
+	IPICall *call;
+	IPICallEntry *next;
+};
+
+/* The calls waiting to be run on each CPU, newest first.  It is pushed to by any CPU, and
+ * taken all at once, so it needs no lock. */
+static IPICallEntry *volatile call_queues[X86_MAX_CPUS];
+
+static IPIStats stats[IPIType::NR_TYPES];
+
+class IPIIRQ final : public IRQ
+{
+public:
+	IPIIRQ() : IRQ(IRQFlags::EOI | IRQFlags::NO_KERNEL_LOCK) { }
+
+	void enable() override { }
+	void disable() override { }
+};
+
+static LAPIC *ipi_lapic;
+static IPIIRQ *ipi_irqs[IPIType::NR_TYPES];
+
+void infos::arch::x86::ipi_run_queued_calls()
+{
+	IPICallEntry *entry = __atomic_exchange_n(&call_queues[x86arch.current_x86_cpu().index], NULL, __ATOMIC_ACQUIRE);
+
+	while (entry) {
+		// Neither the entry nor the call can be touched once the sender has been told it
+		// is done, as they are on its stack.
+		IPICallEntry *next = entry->next;
+		IPICall *call = entry->call;
+
+		call->fn(call->arg);
+		__atomic_fetch_add(&stats[call->type].received, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_sub(&call->remaining, 1, __ATOMIC_RELEASE);
+
+		entry = next;
+	}
+}
+
+static void reschedule_ipi_handler(const IRQ *irq, void *priv)
+{
+	__atomic_fetch_add(&stats[IPIType::RESCHEDULE].received, 1, __ATOMIC_RELAXED);
+	SoftIRQ::request_resched();
+}
+
+/**
+ * Both kinds of call share the queue, so whichever interrupt comes first runs them all,
+ * and the other finds nothing to do.
+ */
+static void call_ipi_handler(const IRQ *irq, void *priv)
+{
+	ipi_run_queued_calls();
+}
+
+static void send_ipi(X86CPU& cpu, IPIType::IPIType type)
+{
+	__atomic_fetch_add(&stats[type].sent, 1, __ATOMIC_RELAXED);
+	ipi_lapic->send_fixed(cpu.apic_id, ipi_irqs[type]->nr());
+}
+
+bool infos::arch::x86::ipi_init(LAPIC& lapic)
+{
+	ipi_lapic = &lapic;
+
+	for (unsigned int type = 0; type < IPIType::NR_TYPES; type++) {
+		IPIIRQ *irq = new IPIIRQ();
+		if (!x86arch.irq_manager().attach_irq(irq)) {
+			x86_log.messagef(LogLevel::WARNING, "Unable to allocate the IPI vectors");
+			delete irq;
+			return false;
+		}
+
+		irq->attach(type == IPIType::RESCHEDULE ? reschedule_ipi_handler : call_ipi_handler, NULL);
+		ipi_irqs[type] = irq;
+	}
+
+	return true;
+}
+
+void infos::arch::x86::ipi_send_reschedule(X86CPU& cpu)
+{
+	if (!ipi_irqs[IPIType::RESCHEDULE] || !cpu.online) return;
+
+	send_ipi(cpu, IPIType::RESCHEDULE);
+}
+
+CPUMask infos::arch::x86::ipi_other_cpus()
+{
+	unsigned int self = x86arch.current_x86_cpu().index;
+
+	CPUMask mask = 0;
+	for (unsigned int i = 0; i < x86arch.nr_cpus(); i++) {
+		if (i != self && x86arch.cpu(i).takes_interrupts()) mask |= 1ull << i;
+	}
+
+	return mask;
+}
+
+void infos::arch::x86::ipi_call_function(CPUMask cpus, ipi_fn_t fn, void *arg, IPIType::IPIType type)
+{
+	UniqueIRQLock l;
+
+	unsigned int self = x86arch.current_x86_cpu().index;
+
+	IPICall call;
+	call.fn = fn;
+	call.arg = arg;
+	call.type = type;
+	call.remaining = 0;
+
+	IPICallEntry entries[X86_MAX_CPUS];
+
+	if (ipi_irqs[type]) {
+		for (unsigned int i = 0; i < x86arch.nr_cpus(); i++) {
+			if (i == self || !((cpus >> i) & 1) || !x86arch.cpu(i).takes_interrupts()) continue;
+
+			entries[i].call = &call;
+			__atomic_fetch_add(&call.remaining, 1, __ATOMIC_RELAXED);
+
+			IPICallEntry *head = call_queues[i];
+			do {
+				entries[i].next = head;
+			} while (!__atomic_compare_exchange_n(&call_queues[i], &head, &entries[i], false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+			send_ipi(x86arch.cpu(i), type);
+		}
+	}
+
+	if ((cpus >> self) & 1) {
+		fn(arg);
+	}
+
+	// Another CPU may be waiting on a call to this one, with interrupts disabled, so this
+	// CPU's calls are run while it waits for its own.
+	while (__atomic_load_n(&call.remaining, __ATOMIC_ACQUIRE)) {
+		ipi_run_queued_calls();
+		asm volatile("pause");
+	}
+}
+
+IPIStats infos::arch::x86::ipi_stats(IPIType::IPIType type)
+{
+	IPIStats s;
+	s.sent = __atomic_load_n(&stats[type].sent, __ATOMIC_RELAXED);
+	s.received = __atomic_load_n(&stats[type].received, __ATOMIC_RELAXED);
+	return s;
+}
+
+/**
+ * A per-type summary of the IPIs sent and handled, as /dev/ipi0.
+ */
+class IPIStatsDevice : public Device
+{
+public:
+	static const DeviceClass IPIStatsDeviceClass;
+
+	const DeviceClass& device_class() const override { return IPIStatsDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass IPIStatsDevice::IPIStatsDeviceClass(Device::RootDeviceClass, "ipi");
+
+class IPIStatsFile : public TextFile
+{
+public:
+	IPIStatsFile()
+	{
+		static const char *names[IPIType::NR_TYPES] = { "reschedule", "tlb-shootdown", "call-function" };
+
+		append("type sent received\n");
+		for (unsigned int type = 0; type < IPIType::NR_TYPES; type++) {
+			IPIStats s = ipi_stats((IPIType::IPIType)type);
+			append("%s %llu %llu\n", names[type], s.sent, s.received);
+		}
+	}
+};
+
+File *IPIStatsDevice::open_as_file()
+{
+	return new IPIStatsFile();
+}
+
+RegisterDevice(IPIStatsDevice);
@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * arch/x86/irq-balance.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <arch/x86/init.h>
+#include <arch/x86/irq.h>
+#include <arch/x86/cpu.h>
+#include <arch/x86/x86-arch.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/log.h>
+#include <infos/kernel/timer-wheel.h>
+#include <infos/kernel/workqueue.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::arch::x86;
+using namespace infos::util;
+
+// How often the interrupt load is looked at.
+#define IRQ_BALANCE_INTERVAL_NS	1000000000ull
+
+static bool balance_enabled = true;
+static IRQ::AffinityMask isolated_cpus;
+
+RegisterCmdLineArgument(IRQBalance, "irq.balance") {
+	balance_enabled = !(strncmp(value, "0", 1) == 0 || strncmp(value, "off", 3) == 0);
+}
+
+/* A list of CPU indices, e.g. "1,3", that are kept clear of device interrupts, so that
+ * what runs on them isn't disturbed. */
+RegisterCmdLineArgument(IRQIsolate, "irq.isolate") {
+	unsigned int cpu = 0;
+	bool have_digits = false;
+
+	for (const char *p = value;; p++) {
+		if (*p >= '0' && *p <= '9') {
+			cpu = cpu * 10 + (*p - '0');
+			have_digits = true;
+			continue;
+		}
+
+		if (have_digits && cpu < 64) isolated_cpus |= 1ull << cpu;
+
+		cpu = 0;
+		have_digits = false;
+		if (!*p) break;
+	}
+}
+
+static uint64_t last_counts[MAX_IRQS];
+
+static void balance_timer_expired(Timer& timer, void *arg);
+static void balance_irqs(void *arg);
+static void rearm_balance_timer();
+
+static Timer balance_timer(balance_timer_expired, NULL);
+static WorkItem balance_work(balance_irqs, NULL);
+
+/**
+ * The balancing is done by a worker, as it reprograms devices, and the timer's callback
+ * runs with its wheel locked.
+ */
+static void balance_timer_expired(Timer& timer, void *arg)
+{
+	system_workqueue().queue(balance_work);
+}
+
+/**
+ * Spreads the steerable interrupts over the CPUs that take them, by how often each was
+ * raised since the last time round: the busiest goes first, each to whichever CPU has the
+ * least load so far.  An interrupt stays where it is if that is where it would go, so
+ * that a steady load doesn't move around.
+ */
+static void rebalance()
+{
+	struct Load { uint8_t nr; uint64_t delta; };
+	static Load loads[MAX_IRQS];
+	unsigned int nr_loads = 0;
+
+	for (unsigned int nr = 0; nr < MAX_IRQS; nr++) {
+		const IRQVector& v = x86arch.irq_manager().vector(nr);
+		if (!v.irq || !(v.flags & IRQFlags::STEERABLE)) continue;
+
+		uint64_t count = __atomic_load_n(&v.count, __ATOMIC_RELAXED);
+		uint64_t delta = count - last_counts[nr];
+		last_counts[nr] = count;
+
+		// Insertion sort, heaviest first.  There are few enough that it doesn't matter.
+		unsigned int i = nr_loads++;
+		while (i > 0 && loads[i - 1].delta < delta) {
+			loads[i] = loads[i - 1];
+			i--;
+		}
+
+		loads[i].nr = nr;
+		loads[i].delta = delta;
+	}
+
+	uint64_t cpu_load[64];
+	unsigned int nr_cpus = x86arch.nr_cpus() < 64 ? x86arch.nr_cpus() : 64;
+	IRQ::AffinityMask eligible = 0;
+
+	for (unsigned int cpu = 0; cpu < nr_cpus; cpu++) {
+		cpu_load[cpu] = 0;
+		if (x86arch.cpu(cpu).takes_interrupts() && !((isolated_cpus >> cpu) & 1)) eligible |= 1ull << cpu;
+	}
+
+	// If every CPU is isolated, the isolation can't be honoured.  With one CPU left,
+	// everything goes there, which only matters if it isn't the only one.
+	if (!eligible) return;
+	if (!(eligible & (eligible - 1)) && !isolated_cpus) return;
+
+	for (unsigned int i = 0; i < nr_loads; i++) {
+		IRQ *irq = x86arch.irq_manager().vector(loads[i].nr).irq;
+
+		unsigned int target = nr_cpus;
+		for (unsigned int cpu = 0; cpu < nr_cpus; cpu++) {
+			if (!((eligible >> cpu) & 1)) continue;
+
+			// Ties go to where the interrupt already is.
+			if (target == nr_cpus || cpu_load[cpu] < cpu_load[target] ||
+					(cpu_load[cpu] == cpu_load[target] && irq->affinity() == (1ull << cpu))) {
+				target = cpu;
+			}
+		}
+
+		cpu_load[target] += loads[i].delta;
+
+		if (irq->affinity() != (1ull << target)) {
+			irq->set_affinity(1ull << target);
+		}
+	}
+}
+
+static void balance_irqs(void *arg)
+{
+	rebalance();
+	rearm_balance_timer();
+}
+
+static void rearm_balance_timer()
+{
+	UniqueIRQLock l;
+	CPU::current().timers().add(balance_timer, sys.runtime().time_since_epoch().count() + IRQ_BALANCE_INTERVAL_NS);
+}
+
+/**
+ * Starts balancing device interrupts over the CPUs.  Called once the other CPUs have
+ * been started.
+ */
+bool infos::arch::x86::irq_balance_init()
+{
+	if (!balance_enabled) {
+		x86_log.messagef(LogLevel::INFO, "IRQ balancing is disabled");
+		return true;
+	}
+
+	if (isolated_cpus) {
+		x86_log.messagef(LogLevel::INFO, "CPUs isolated from device interrupts: %llx", isolated_cpus);
+	}
+
+	rearm_balance_timer();
+	return true;
+}
@@ -13,11 +13,23 @@
 #include <arch/x86/dt.h>
 #include <arch/x86/init.h>
 #include <arch/x86/x86-arch.h>
+#include <arch/x86/context.h>
+#include <arch/x86/cpu.h>
+#include <arch/x86/msr.h>
 #include <infos/kernel/log.h>
+#include <infos/kernel/softirq.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/trace.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/stats.h>
+#include <infos/util/lock.h>
 
 using namespace infos::arch;
 using namespace infos::arch::x86;
 using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::fs;
+using namespace infos::util;
 
 // An array containing pointers to the IRQ entry-point functions
 static irq_entry_point_t irq_entry_points[] = {
@@ -81,6 +93,10 @@ static irq_entry_point_t irq_entry_points[] = {
  */
 bool IRQManager::init()
 {
+	bzero(_vectors, sizeof(_vectors));
+	_eoi_register = NULL;
+	_x2apic = false;
+
 	// Initialise all IDT entries to their corresponding entry points
 	for (unsigned int i = 0; i < MAX_NR_IDT_ENTRIES && i < MAX_IRQS; i++) {
 		idt.register_interrupt_gate(i, (uintptr_t)irq_entry_points[i], 0x08, 0);
@@ -94,27 +110,47 @@ bool IRQManager::init()
 	// Reload the IDT
 	idt.reload();
 	
-	// Now, each logical IRQ vector has an associated "handler" object, depending on what
-	// type of IRQ that particular vector is.  When the IRQ vector is invoked (by whatever)
-	// the associated IRQ descriptor is looked up, and that contains the associated
-	// handler object, that knows how to dispatch the behaviour.
+	// Now, each logical IRQ vector has an associated IRQ object, depending on what type of
+	// IRQ that particular vector is.  When the IRQ vector is invoked (by whatever) its
+	// entry in the vector table is looked up, and that has the handlers of the IRQ object.
 	
-	// The first 32 IRQs are actually exception vectors, so initialise the IRQ handler with an
-	// ExceptionIRQ handler object.
+	// The first 32 IRQs are actually exception vectors, so initialise them with
+	// ExceptionIRQ objects.
 	for (unsigned int i = 0; i < 32; i++) {
-		// Create the ExceptionIRQ handler object
-		IRQ *irq = new ExceptionIRQ();
-		
-		// Associate the object with the IRQ descriptor, and assign the number.
-		irq_descriptors[i].irq(irq);
-		irq->assign(i);
+		assign_vector(i, new ExceptionIRQ());
 	}
 	
 	return true;
 }
 
 /**
- * Installs a particular handler function into an IRQ descriptor, representing the given IRQ
+ * Connects an IRQ object to a vector.
+ */
+void IRQManager::assign_vector(uint8_t nr, kernel::IRQ *irq)
+{
+	irq->assign(nr);
+
+	IRQVector& v = _vectors[nr];
+	v.flags = irq->flags();
+	v.irq = irq;
+
+	update_vector(*irq);
+}
+
+void IRQManager::update_vector(const kernel::IRQ& irq)
+{
+	IRQVector& v = _vectors[irq.nr()];
+	if (v.irq != &irq) return;
+
+	// As in the IRQ itself, the handler's data goes in before the handler, so that an
+	// interrupt on another CPU never sees one without the other.
+	v.priv = irq.priv();
+	__atomic_store_n(&v.shared, irq.shared(), __ATOMIC_RELEASE);
+	__atomic_store_n(&v.handler, irq.handler(), __ATOMIC_RELEASE);
+}
+
+/**
+ * Installs a particular handler function into the vector table, for the given IRQ
  * vector, associated with a particular handler type.
  * @param nr The IRQ vector number
  * @param handler The handler function
@@ -127,16 +163,14 @@ bool IRQManager::install_handler(uint8_t nr, IRQ::irq_handler_t handler, void *p
 	// Make sure the IRQ vector number is in range.
 	if (nr >= MAX_IRQS) return false;
 
-	// Take a look at the IRQ handler object associated with this vector number.  If
-	// it is NULL, then create a new handler object, and connect it up.
-	if (irq_descriptors[nr].irq() == NULL) {
-		IRQ *irq = new T();
-		irq_descriptors[nr].irq(irq);
-		irq->assign(nr);
+	// Take a look at the IRQ object associated with this vector number.  If there isn't
+	// one, then create a new one, and connect it up.
+	if (_vectors[nr].irq == NULL) {
+		assign_vector(nr, new T());
 	}
 	
 	// Attach the handler function to the IRQ object.
-	irq_descriptors[nr].irq()->attach(handler, priv);
+	_vectors[nr].irq->attach(handler, priv);
 	return true;
 }
 
@@ -174,15 +208,14 @@ bool IRQManager::attach_irq(kernel::IRQ* irq)
 	// The caller MUST supply an IRQ object.
 	if (!irq) return false;
 
+	UniqueIRQLock l_irq;
+	UniqueLock<SpinLock> l(_attach_lock);
+
 	// Starting at 32, and onwards, try to find a free IRQ vector by
-	// finding a descriptor that doesn't have an associated IRQ object.
+	// finding one that doesn't have an associated IRQ object.
 	for (unsigned int i = 0x20; i < 0x100; i++) {
-		if (irq_descriptors[i].irq() == NULL) {
-			// If one is found, connect the IRQ object to the descriptor,
-			// and assign its number.
-			irq_descriptors[i].irq(irq);
-			irq->assign(i);
-
+		if (_vectors[i].irq == NULL) {
+			assign_vector(i, irq);
 			return true;
 		}
 	}
@@ -190,16 +223,58 @@ bool IRQManager::attach_irq(kernel::IRQ* irq)
 	return false;
 }
 
-/**
- * Handles an exception IRQ.
- */
-void ExceptionIRQ::handle() const
+bool IRQManager::attach_irq_block(kernel::IRQ **irqs, unsigned int count)
 {
-	// Invoke the handler function, but if it failed to invoke, halt the system.
-	if (!invoke()) {
-		x86_log.messagef(LogLevel::FATAL, "Unhandled Exception %u", nr());
-		arch_abort();
+	if (!count || (count & (count - 1))) return false;
+
+	UniqueIRQLock l_irq;
+	UniqueLock<SpinLock> l(_attach_lock);
+
+	for (unsigned int base = 0x20; base + count <= 0x100; base += count) {
+		unsigned int i;
+		for (i = 0; i < count; i++) {
+			if (_vectors[base + i].irq != NULL) break;
+		}
+
+		if (i < count) continue;
+
+		for (i = 0; i < count; i++) {
+			assign_vector(base + i, irqs[i]);
+		}
+
+		return true;
 	}
+
+	return false;
+}
+
+bool infos::arch::x86::irq_destination(IRQ::AffinityMask mask, IRQDestination& dest)
+{
+	IRQ::AffinityMask usable = 0;
+	unsigned int first = 0;
+
+	for (unsigned int i = x86arch.nr_cpus(); i > 0; i--) {
+		unsigned int cpu = i - 1;
+		if (cpu >= 64 || !((mask >> cpu) & 1) || !x86arch.cpu(cpu).takes_interrupts()) continue;
+
+		usable |= 1ull << cpu;
+		first = cpu;
+	}
+
+	if (!usable) return false;
+
+	// Several CPUs can only be named at once by their logical IDs.  Otherwise, it goes
+	// to one of them, by its APIC ID.  x2APIC logical IDs are clustered, and don't fit
+	// in the IOAPIC's or MSI's eight bits, so then it is always by APIC ID.
+	if ((usable & (usable - 1)) && usable < (1ull << MAX_LOGICAL_CPUS) && !x86arch.irq_manager().x2apic()) {
+		dest.logical = true;
+		dest.destination = (uint8_t)usable;
+	} else {
+		dest.logical = false;
+		dest.destination = x86arch.cpu(first).apic_id;
+	}
+
+	return true;
 }
 
 /**
@@ -218,18 +293,6 @@ void ExceptionIRQ::disable()
 	// Exception IRQs cannot be enabled/disabled.
 }
 
-/**
- * Handles a software IRQ.
- */
-void SoftwareIRQ::handle() const
-{
-	// Invoke the handler function, but if it failed to invoke, halt the system.
-	if (!invoke()) {
-		x86_log.messagef(LogLevel::FATAL, "Unhandled Software IRQ %u", nr());
-		arch_abort();
-	}
-}
-
 /**
  * Enables the software IRQ.
  */
@@ -248,25 +311,132 @@ void SoftwareIRQ::disable()
 	// (TODO: Maybe they can by modifying the IDT -- but do we really want to support this?)
 }
 
+/**
+ * Deals with a vector that has no handler.
+ */
+static void __attribute__((noinline)) unhandled_irq(const IRQVector& v, uint32_t irq_nr)
+{
+	if (v.flags & IRQFlags::MUST_HANDLE) {
+		if (irq_nr < 32) {
+			x86_log.messagef(LogLevel::FATAL, "Unhandled Exception %u", irq_nr);
+		} else {
+			x86_log.messagef(LogLevel::FATAL, "Unhandled IRQ %u", irq_nr);
+		}
+
+		arch_abort();
+	}
+
+	if (!v.irq) {
+		x86_log.messagef(LogLevel::WARNING, "IRQ %u -- but nobody cared", irq_nr);
+	}
+}
+
 /**
  * This is the native IRQ handling function, called after the current context has been saved.
- * It is responsible for dispatching handling functionality to the associated handler object.
+ * It is responsible for dispatching to the handlers in the vector's entry of the table.
  * @param irq_nr
  */
 extern "C" void __handle_raw_irq(uint32_t irq_nr)
 {
 	// Sanity checking.
 	assert(irq_nr < MAX_IRQS);
-	
-	// Lookup the IRQ descriptor for the IRQ vector number, and retrieve the IRQ
-	// handler object.
-	IRQ *irq = x86arch.irq_manager().get_irq_descriptor(irq_nr)->irq();
-	
-	// If there was an object... handle the IRQ.
-	if (irq) {
-		irq->handle();
+
+	IRQManager& mgr = x86arch.irq_manager();
+	IRQVector& v = mgr.vector(irq_nr);
+
+	// The bottom halves are only run over code that could have been interrupted anyway,
+	// and only if the handler hasn't switched to another thread: they run on this
+	// thread's stack.
+	Thread *current = x86arch.current_x86_cpu().current_thread;
+	const X86Context *ctx = current ? (const X86Context *)current->context().native_context : NULL;
+	bool can_run_softirqs = ctx && (ctx->rflags & (1 << 9));
+
+	// Interrupts were on, so whatever section was being timed as having them off has
+	// ended, e.g. by sleeping and switching to a thread that had them on.
+	if (can_run_softirqs) irqoff_reset();
+
+	__atomic_fetch_add(&v.count, 1, __ATOMIC_RELAXED);
+	uint64_t start = __rdtsc();
+
+	// A handler shares its data with threads that disable interrupts to keep it away, so
+	// it excludes the other CPUs as they do.  System calls enable interrupts, and take the
+	// lock where they need it, and an IPI may be what the holder of the lock is waiting for.
+	bool kernel_locked = !(v.flags & IRQFlags::NO_KERNEL_LOCK) && KernelLock::lock();
+
+	IRQ::irq_handler_t handler = __atomic_load_n(&v.handler, __ATOMIC_ACQUIRE);
+	if (__builtin_expect(handler != NULL, 1)) {
+		handler(v.irq, v.priv);
+
+		for (const IRQ::SharedHandler *shared = __atomic_load_n(&v.shared, __ATOMIC_ACQUIRE); shared; shared = shared->next) {
+			shared->handler(v.irq, shared->priv);
+		}
 	} else {
-		// No object?  Print out a warning.
-		x86_log.messagef(LogLevel::WARNING, "IRQ %u -- but nobody cared", irq_nr);
+		unhandled_irq(v, irq_nr);
+	}
+
+	if (kernel_locked) KernelLock::unlock();
+
+	// A handler that switched threads (e.g. a system call that slept) hasn't run for all
+	// that time, so isn't timed.
+	if (x86arch.current_x86_cpu().current_thread == current) {
+		uint64_t cycles = __rdtsc() - start;
+
+		__atomic_fetch_add(&v.cycles, cycles, __ATOMIC_RELAXED);
+
+		// A vector is only raised on one CPU at a time, unless it is an IPI, and then
+		// the most may be slightly out.
+		if (cycles > v.max_cycles) v.max_cycles = cycles;
+
+		trace_event(TraceEvent::IRQ, irq_nr, cycles);
 	}
+
+	if (v.flags & IRQFlags::EOI) {
+		mgr.eoi();
+	}
+
+	SoftIRQ::irq_exit(can_run_softirqs && x86arch.current_x86_cpu().current_thread == current);
+}
+
+/**
+ * A pseudo-device (/dev/interrupts0) that reports how many times each vector that has
+ * been raised has been, and how long its handlers took, in TSC cycles, as text.
+ */
+class InterruptStatsDevice : public Device
+{
+public:
+	static const DeviceClass InterruptStatsDeviceClass;
+
+	const DeviceClass& device_class() const override { return InterruptStatsDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass InterruptStatsDevice::InterruptStatsDeviceClass(Device::RootDeviceClass, "interrupts");
+
+RegisterStatistics(interrupts, "interrupts")
+{
+	const IRQManager& mgr = x86arch.irq_manager();
+
+	out.append("vector count handlers total-cycles mean-cycles max-cycles\n");
+	for (unsigned int nr = 0; nr < MAX_IRQS; nr++) {
+		const IRQVector& v = mgr.vector(nr);
+
+		uint64_t count = __atomic_load_n(&v.count, __ATOMIC_RELAXED);
+		if (!count) continue;
+
+		unsigned int nr_handlers = v.handler ? 1 : 0;
+		for (const IRQ::SharedHandler *shared = v.shared; shared; shared = shared->next) {
+			nr_handlers++;
+		}
+
+		uint64_t cycles = __atomic_load_n(&v.cycles, __ATOMIC_RELAXED);
+		out.append("%u %llu %u %llu %llu %llu\n", nr, count, nr_handlers, cycles, cycles / count, v.max_cycles);
+	}
+}
+
+File *InterruptStatsDevice::open_as_file()
+{
+	return new StatisticsFile(__stats_reginterrupts);
 }
+
+RegisterDevice(InterruptStatsDevice);
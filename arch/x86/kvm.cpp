@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * arch/x86/kvm.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <arch/x86/kvm.h>
+#include <arch/x86/init.h>
+#include <arch/x86/cpu.h>
+#include <arch/x86/cpuid.h>
+#include <arch/x86/msr.h>
+#include <arch/x86/x86-arch.h>
+#include <infos/kernel/log.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::arch::x86;
+using namespace infos::util;
+
+#define KVM_SIGNATURE_EBX			0x4b4d564b	// "KVMK"
+#define KVM_SIGNATURE_ECX			0x564b4d56	// "VMKV"
+#define KVM_SIGNATURE_EDX			0x0000004d	// "M"
+#define CPUID_KVM_FEATURES			0x40000001
+
+#define KVM_FEATURE_CLOCKSOURCE2	(1 << 3)
+#define KVM_FEATURE_STEAL_TIME		(1 << 5)
+
+#define MSR_KVM_SYSTEM_TIME_NEW		0x4b564d01
+#define MSR_KVM_STEAL_TIME			0x4b564d03
+
+#define KVM_MSR_ENABLED				1
+
+/* Written by the host, with an odd version while it is changing it. */
+struct PVClockTimeInfo
+{
+	uint32_t version;
+	uint32_t pad0;
+	uint64_t tsc_timestamp;
+	uint64_t system_time;
+	uint32_t tsc_to_system_mul;
+	int8_t tsc_shift;
+	uint8_t flags;
+	uint8_t pad[2];
+} __packed __aligned(64);
+
+struct KVMStealTime
+{
+	uint64_t steal;				// In ns
+	uint32_t version;
+	uint32_t flags;
+	uint8_t preempted;
+	uint8_t pad0[3];
+	uint32_t pad1[11];
+} __packed __aligned(64);
+
+static bool use_steal_time = true;
+
+RegisterCmdLineArgument(KVMStealTime, "kvm.steal") {
+	use_steal_time = (strncmp(value, "0", 1) != 0);
+}
+
+static bool detected, have_pvclock, have_steal_time;
+
+static PVClockTimeInfo pvclocks[X86_MAX_CPUS];
+static KVMStealTime steal_times[X86_MAX_CPUS];
+
+static void detect()
+{
+	static bool done;
+	if (done) return;
+	done = true;
+
+	if (!(__cpuid(CPUID_GET_FEATURES).rcx & CPUIDFeatures::HYPERVISOR)) return;
+
+	CPUID base = __cpuid(CPUID_HYPERVISOR_BASE);
+	if (base.rbx != KVM_SIGNATURE_EBX || base.rcx != KVM_SIGNATURE_ECX || base.rdx != KVM_SIGNATURE_EDX) return;
+
+	detected = true;
+	if (base.rax < CPUID_KVM_FEATURES) return;
+
+	uint32_t features = __cpuid(CPUID_KVM_FEATURES).rax;
+	have_pvclock = !!(features & KVM_FEATURE_CLOCKSOURCE2);
+	have_steal_time = use_steal_time && (features & KVM_FEATURE_STEAL_TIME);
+
+	x86_log.messagef(LogLevel::INFO, "kvm: features=%x, pvclock=%s, steal-time=%s",
+		features, have_pvclock ? "yes" : "no", have_steal_time ? "yes" : "no");
+}
+
+bool infos::arch::x86::kvm_detected()
+{
+	detect();
+	return detected;
+}
+
+void infos::arch::x86::kvm_init_cpu(X86CPU& cpu)
+{
+	detect();
+
+	if (cpu.index >= X86_MAX_CPUS) return;
+
+	if (have_pvclock) {
+		__wrmsr(MSR_KVM_SYSTEM_TIME_NEW, kva_to_pa((virt_addr_t)&pvclocks[cpu.index]) | KVM_MSR_ENABLED);
+	}
+
+	if (have_steal_time) {
+		__wrmsr(MSR_KVM_STEAL_TIME, kva_to_pa((virt_addr_t)&steal_times[cpu.index]) | KVM_MSR_ENABLED);
+	}
+}
+
+/**
+ * Works the TSC frequency out from how the host scales it into the paravirtual clock:
+ * ns = ((tsc << shift) * mul) >> 32, where a negative shift is to the right.
+ */
+uint64_t infos::arch::x86::kvm_tsc_frequency()
+{
+	detect();
+	if (!have_pvclock) return 0;
+
+	const volatile PVClockTimeInfo& pvclock = pvclocks[0];
+
+	uint32_t version, mul;
+	int8_t shift;
+	do {
+		version = __atomic_load_n(&pvclock.version, __ATOMIC_ACQUIRE);
+		mul = pvclock.tsc_to_system_mul;
+		shift = pvclock.tsc_shift;
+		asm volatile("" ::: "memory");
+	} while ((version & 1) || version != __atomic_load_n(&pvclock.version, __ATOMIC_ACQUIRE));
+
+	if (!mul) return 0;
+
+	uint64_t hz = (1000000000ull << 32) / mul;
+	return shift >= 0 ? hz >> shift : hz << -shift;
+}
+
+uint64_t infos::arch::x86::kvm_steal_time(X86CPU& cpu)
+{
+	if (!have_steal_time || cpu.index >= X86_MAX_CPUS) return 0;
+
+	const volatile KVMStealTime& st = steal_times[cpu.index];
+
+	uint32_t version;
+	uint64_t steal;
+	do {
+		version = __atomic_load_n(&st.version, __ATOMIC_ACQUIRE);
+		steal = st.steal;
+		asm volatile("" ::: "memory");
+	} while ((version & 1) || version != __atomic_load_n(&st.version, __ATOMIC_ACQUIRE));
+
+	return steal;
+}
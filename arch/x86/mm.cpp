@@ -11,27 +11,458 @@
 #include <arch/x86/init.h>
 #include <arch/x86/multiboot.h>
 #include <arch/x86/cpuid.h>
+#include <arch/x86/msr.h>
 #include <arch/x86/irq.h>
 #include <arch/x86/context.h>
+#include <arch/x86/extable.h>
 #include <arch/x86/vma.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/thread.h>
 #include <infos/kernel/process.h>
 #include <infos/kernel/log.h>
+#include <infos/kernel/trace.h>
 #include <infos/mm/mm.h>
 #include <infos/mm/page-allocator.h>
+#include <infos/mm/swap.h>
 #include <infos/util/string.h>
 #include <arch/arch.h>
 #include <arch/x86/x86-arch.h>
+#include <arch/x86/cpu.h>
+#include <arch/x86/ipi.h>
 #include <infos/fs/exec/elf-loader.h>
 #include <infos/fs/file.h>
+#include <infos/util/cmdline.h>
 
 using namespace infos::arch::x86;
 using namespace infos::kernel;
 using namespace infos::mm;
 using namespace infos::util;
 
-extern "C" infos::kernel::Thread *current_thread;
+
+static inline void flush_tlb_page(virt_addr_t va)
+{
+	asm volatile("invlpg (%0)" :: "r"(va) : "memory");
+}
+
+// CR4.PCIDE: tag TLB entries with the PCID in the low 12 bits of CR3.
+#define CR4_PCIDE		(1ull << 17)
+// When PCIDs are enabled, loading CR3 with this bit set keeps the new PCID's TLB entries.
+#define CR3_NOFLUSH		(1ull << 63)
+#define NR_PCIDS		4096
+
+/**
+ * Drops every translation of the active address space: reloading CR3 without the no-flush
+ * bit drops those tagged with its PCID, and all of them if PCIDs are off.
+ */
+static inline void flush_tlb_all()
+{
+	uint64_t cr3;
+	asm volatile("mov %%cr3, %0" : "=r"(cr3));
+	asm volatile("mov %0, %%cr3" :: "r"(cr3 & ~CR3_NOFLUSH) : "memory");
+}
+
+// Past this many pages, it is cheaper to flush the whole TLB than to invlpg each page.
+#define TLB_FLUSH_MAX_PAGES	32
+
+// Tagging TLB entries with PCIDs, so that a switch needn't flush them, is off unless asked
+// for (mm.pcid=1) until it has been run on a booted system: a missed invalidation would
+// let one process see another's memory.
+static bool use_pcids;
+
+RegisterCmdLineArgument(MMPCID, "mm.pcid") {
+	use_pcids = strncmp(value, "1", 2) == 0;
+}
+
+static bool pcids_enabled;
+
+// The PCIDs in use.  PCID 0 is shared by every VMA that can't have one of its own,
+// and is always flushed when it is loaded.
+static uint64_t pcid_map[NR_PCIDS / 64] = { 1 };
+
+static uint16_t allocate_pcid()
+{
+	for (unsigned int i = 0; i < NR_PCIDS / 64; i++) {
+		if (~pcid_map[i]) {
+			unsigned int bit = __builtin_ctzll(~pcid_map[i]);
+			pcid_map[i] |= 1ull << bit;
+
+			return (i * 64) + bit;
+		}
+	}
+
+	return 0;
+}
+
+static void enable_pcids()
+{
+	if (!use_pcids) return;
+
+	if (!(cpuid_get_features().rcx & CPUIDFeatures::PCID)) {
+		x86_log.messagef(LogLevel::INFO, "PCIDs are not supported");
+		return;
+	}
+
+	// CR3 currently holds PCID 0, as it must when PCIDs are enabled.
+	uint64_t cr4;
+	asm volatile("mov %%cr4, %0" : "=r"(cr4));
+	asm volatile("mov %0, %%cr4" :: "r"(cr4 | CR4_PCIDE) : "memory");
+
+	pcids_enabled = true;
+	x86_log.messagef(LogLevel::INFO, "PCIDs enabled");
+}
+
+// The largest fault-around window, in pages, that can be configured.
+#define FAULT_AROUND_MAX_ORDER	5
+#define FAULT_AROUND_MAX_PAGES	(1u << FAULT_AROUND_MAX_ORDER)
+
+// The number of pages, around a demand-paging fault, that are read in together.  Until
+// reading in more than the faulting page has been run on a booted system, it is just
+// the one unless asked for (e.g. mm.fault-around=16).
+static unsigned int fault_around_pages = 1;
+
+RegisterCmdLineArgument(MMFaultAround, "mm.fault-around") {
+	unsigned int pages = 0;
+	for (const char *c = value; *c >= '0' && *c <= '9'; c++) {
+		pages = (pages * 10) + (*c - '0');
+		if (pages > FAULT_AROUND_MAX_PAGES) break;
+	}
+
+	if (pages < 1) pages = 1;
+	if (pages > FAULT_AROUND_MAX_PAGES) pages = FAULT_AROUND_MAX_PAGES;
+
+	fault_around_pages = pages;
+}
+
+/* Synchronous batched reads land in a buffer, before being copied into each page's frame.
+ * Faults are taken on every CPU at once, so each CPU has its own, allocated the first time
+ * it is needed.  The reads are done with interrupts disabled, so only one fault on a CPU
+ * can be using its buffer. */
+static uint8_t *fault_around_buffers[X86_MAX_CPUS];
+
+static uint8_t *fault_around_buffer()
+{
+	uint8_t *&buffer = fault_around_buffers[x86arch.current_x86_cpu().index];
+
+	if (!buffer) {
+		FrameDescriptor *pfdescr = sys.mm().pgalloc().allocate(FAULT_AROUND_MAX_ORDER);
+		if (pfdescr) buffer = (uint8_t *)sys.mm().pgalloc().pfdescr_to_vpa(pfdescr);
+	}
+
+	return buffer;
+}
+
+/**
+ * Tests whether a page is still waiting to be demand-paged in from the given file offset.
+ */
+static bool is_deferred_file_page(VMA& vma, virt_addr_t va, uint64_t file_offset)
+{
+	uint32_t cookie;
+	if (!vma.get_pte_cookie(va, cookie)) return false;
+	if (!(cookie & DPC_DEMAND) || (cookie & DPC_ZERO)) return false;
+
+	return (cookie & ~(__page_size - 1)) == file_offset;
+}
+
+/**
+ * Maps a frame in place of a demand-paging cookie, with the permissions that the
+ * cookie asks for, and returns the frame's address in the physical memory window.
+ */
+static void *map_deferred_page(VMA& vma, virt_addr_t va, uint32_t cookie)
+{
+	if (!vma.allocate_virt(va, 1, (cookie & DPC_WRITABLE) ? PTE_WRITABLE : 0)) return NULL;
+
+	phys_addr_t pa;
+	bool mapped = vma.get_mapping(va, pa);
+	assert(mapped);
+
+	return (void *)pa_to_vpa(pa);
+}
+
+/* A run of deferred pages, contiguous in both the address space and the file. */
+struct DeferredRun
+{
+	virt_addr_t first;
+	uint64_t nr_pages;
+	uint64_t file_offset;
+	infos::fs::File *file;	// The file mapped with map_file(), or NULL for the program image
+};
+
+/**
+ * Finds the run of deferred pages in the fault-around window that the faulting page,
+ * with the given cookie, is part of.  Neighbouring pages are only included if they
+ * come from the adjacent part of the file, so that the run can be read in with a
+ * single file read.
+ */
+static void find_deferred_run(VMA& vma, virt_addr_t va, uint32_t cookie, DeferredRun& run)
+{
+	uint64_t file_offset = cookie & ~(__page_size - 1);
+
+	virt_addr_t window_base = __align_down(va, (virt_addr_t)fault_around_pages << __page_bits);
+	virt_addr_t window_end = window_base + ((virt_addr_t)fault_around_pages << __page_bits);
+	
+	// Offsets in different files can line up, so don't let the run stray into pages
+	// that come from somewhere else.
+	run.file = vma.file_mapping_bounds(va, window_base, window_end);
+
+	virt_addr_t first = va;
+	while (first > window_base && file_offset >= (va - first) + __page_size
+			&& is_deferred_file_page(vma, first - __page_size, file_offset - (va - first) - __page_size)) {
+		first -= __page_size;
+	}
+
+	virt_addr_t last = va + __page_size;
+	while (last < window_end && is_deferred_file_page(vma, last, file_offset + (last - va))) {
+		last += __page_size;
+	}
+
+	run.first = first;
+	run.nr_pages = (last - first) >> __page_bits;
+	run.file_offset = file_offset - (va - first);
+}
+
+/**
+ * Reads the file data for a run of deferred pages into a buffer, zeroing whatever
+ * the read came up short by.
+ */
+static void read_deferred_run(infos::fs::File& image, const DeferredRun& run, uint8_t *buffer)
+{
+	size_t size = run.nr_pages << __page_bits;
+
+	infos::fs::File& file = run.file ? *run.file : image;
+	int n = file.pread(buffer, size, run.file_offset);
+	syslog.messagef(LogLevel::DEBUG, "page-in: read %d bytes (%llu pages) from file offset 0x%llx",
+		n, run.nr_pages, run.file_offset);
+
+	size_t valid = (n > 0) ? (size_t)n : 0;
+	if (valid < size) {
+		bzero(&buffer[valid], size - valid);
+	}
+}
+
+/**
+ * Maps and fills in the pages of a run, from the data read in for it.  Pages that
+ * are no longer deferred (because something else got to them in the meantime) are
+ * left alone.
+ * @return Returns false if the faulting page could not be mapped.
+ */
+static bool install_deferred_run(VMA& vma, const DeferredRun& run, const uint8_t *data, virt_addr_t fault_va)
+{
+	for (uint64_t i = 0; i < run.nr_pages; i++) {
+		virt_addr_t page_va = run.first + (i << __page_bits);
+
+		uint32_t page_cookie;
+		if (!is_deferred_file_page(vma, page_va, run.file_offset + (i << __page_bits))) continue;
+
+		bool ok = vma.get_pte_cookie(page_va, page_cookie);
+		assert(ok);
+
+		// Read-only pages of the program are shared by every process running it.
+		if (!run.file && !(page_cookie & DPC_WRITABLE) && vma.add_text_page(page_va, &data[i << __page_bits])) continue;
+
+		void *page = map_deferred_page(vma, page_va, page_cookie);
+		if (!page) {
+			// The neighbours are only opportunistic: leave them to fault later.
+			if (page_va == fault_va) return false;
+			continue;
+		}
+
+		memcpy(page, &data[i << __page_bits], __page_size);
+	}
+
+	return true;
+}
+
+/* A run of swapped-out pages, contiguous in both the address space and the swap area. */
+struct SwapRun
+{
+	virt_addr_t first;
+	uint64_t nr_pages;
+	uint32_t first_slot;
+};
+
+/**
+ * Tests whether a page is swapped out to the given slot.
+ */
+static bool is_swapped_page(VMA& vma, virt_addr_t va, uint32_t slot)
+{
+	uint32_t cookie;
+	if (!vma.get_pte_cookie(va, cookie) || !is_swap_cookie(cookie)) return false;
+
+	return swap_cookie_slot(cookie) == slot;
+}
+
+/**
+ * Finds the run of swapped-out pages in the fault-around window that the faulting page
+ * is part of, so that they can all be read in with a single transfer.  Pages that were
+ * swapped out together are usually in consecutive slots.
+ */
+static void find_swap_run(VMA& vma, virt_addr_t va, uint32_t cookie, SwapRun& run)
+{
+	uint32_t slot = swap_cookie_slot(cookie);
+
+	virt_addr_t window_base = __align_down(va, (virt_addr_t)fault_around_pages << __page_bits);
+	virt_addr_t window_end = window_base + ((virt_addr_t)fault_around_pages << __page_bits);
+
+	virt_addr_t first = va;
+	while (first > window_base && slot >= ((va - first) >> __page_bits) + 1
+			&& is_swapped_page(vma, first - __page_size, slot - ((va - first) >> __page_bits) - 1)) {
+		first -= __page_size;
+	}
+
+	virt_addr_t last = va + __page_size;
+	while (last < window_end && is_swapped_page(vma, last, slot + ((last - va) >> __page_bits))) {
+		last += __page_size;
+	}
+
+	run.first = first;
+	run.nr_pages = (last - first) >> __page_bits;
+	run.first_slot = slot - ((va - first) >> __page_bits);
+}
+
+/**
+ * Maps and fills in the pages of a run, from the data read in for it, and lets go of
+ * their slots.  Pages that aren't in the same slot any more are left alone.
+ * @return Returns false if the faulting page could not be mapped.
+ */
+static bool install_swap_run(VMA& vma, const SwapRun& run, const uint8_t *data, virt_addr_t fault_va)
+{
+	for (uint64_t i = 0; i < run.nr_pages; i++) {
+		virt_addr_t page_va = run.first + (i << __page_bits);
+		if (!is_swapped_page(vma, page_va, run.first_slot + i)) continue;
+
+		uint32_t page_cookie;
+		bool ok = vma.get_pte_cookie(page_va, page_cookie);
+		assert(ok);
+
+		void *page = map_deferred_page(vma, page_va, page_cookie);
+		if (!page) {
+			if (page_va == fault_va) return false;
+			continue;
+		}
+
+		memcpy(page, &data[i << __page_bits], __page_size);
+		swap_release(page_cookie);
+	}
+
+	return true;
+}
+
+// The maximum number of page-in requests that can be waiting for the pager.
+#define PAGER_QUEUE_SIZE	64
+
+/* A request for the pager to read in the page that a sleeping thread faulted on. */
+struct PageInRequest
+{
+	Thread *thread;
+	virt_addr_t va;
+	uint32_t cookie;
+};
+
+/* The queue of page-in requests.  It is only touched with interrupts disabled. */
+static PageInRequest pager_queue[PAGER_QUEUE_SIZE];
+static unsigned int pager_head, pager_tail;
+
+static Thread *pager_thread;
+static uint8_t *pager_buffer;
+
+/**
+ * Queues a page-in request for the pager, and wakes it up.  Called from the page
+ * fault handler, with interrupts disabled.
+ * @return Returns false if the request could not be queued.
+ */
+static bool submit_page_in(Thread& thread, virt_addr_t va, uint32_t cookie)
+{
+	if (!pager_thread || pager_tail - pager_head == PAGER_QUEUE_SIZE) return false;
+
+	PageInRequest& req = pager_queue[pager_tail++ % PAGER_QUEUE_SIZE];
+	req.thread = &thread;
+	req.va = va;
+	req.cookie = cookie;
+
+	pager_thread->wake_up();
+	return true;
+}
+
+/**
+ * The pager thread proc.  It reads in the pages that threads have faulted on, and
+ * then wakes them up again.  The file read happens with interrupts enabled, so other
+ * threads keep running while the disk transfer is in progress; only finding the run
+ * of pages, and mapping them, are done with interrupts disabled, as the page fault
+ * handler may be changing the same address space.
+ */
+static void pager_threadproc()
+{
+	for (;;) {
+		PageInRequest req;
+		DeferredRun run;
+		SwapRun swap_run;
+		bool swapped = false;
+
+		{
+			UniqueIRQLock l;
+
+			while (pager_head == pager_tail) {
+				Thread::current().sleep();
+			}
+
+			req = pager_queue[pager_head++ % PAGER_QUEUE_SIZE];
+
+			// The process may have been terminated while the request was queued.
+			if (req.thread->owner().terminated()) continue;
+
+			swapped = is_swap_cookie(req.cookie);
+			if (swapped) {
+				find_swap_run(req.thread->owner().vma(), req.va, req.cookie, swap_run);
+			} else {
+				find_deferred_run(req.thread->owner().vma(), req.va, req.cookie, run);
+			}
+		}
+
+		Process& owner = req.thread->owner();
+
+		bool read = true;
+		if (swapped) {
+			read = swap_read(swap_run.first_slot, swap_run.nr_pages, pager_buffer);
+		} else {
+			read_deferred_run(owner.file(), run, pager_buffer);
+		}
+
+		UniqueIRQLock l;
+		if (owner.terminated()) continue;
+
+		bool installed;
+		if (swapped) {
+			installed = read && install_swap_run(owner.vma(), swap_run, pager_buffer, req.va);
+		} else {
+			installed = install_deferred_run(owner.vma(), run, pager_buffer, req.va);
+		}
+
+		if (installed) {
+			req.thread->wake_up();
+		} else {
+			syslog.messagef(LogLevel::ERROR, "%s handling a demand-paging fault @ vaddr=0x%lx",
+				read ? "Out of memory" : "Unable to read from swap", req.va);
+			owner.terminate(-1);
+		}
+	}
+}
+
+/**
+ * Starts the kernel thread that services demand-paging faults.  Until it is running,
+ * faults are serviced synchronously in the fault handler.
+ */
+bool infos::mm::start_demand_pager()
+{
+	if (pager_thread) return true;
+
+	pager_buffer = new uint8_t[FAULT_AROUND_MAX_PAGES << __page_bits];
+	if (!pager_buffer) return false;
+
+	pager_thread = &sys.create_kernel_thread((Thread::thread_proc_t)pager_threadproc, "pager");
+	pager_thread->start();
+
+	return true;
+}
 
 /**
  * Page fault handler
@@ -44,6 +475,7 @@ static void handle_page_fault(const IRQ *irq, void *priv)
 	uint64_t fault_address;
 	asm volatile("mov %%cr2, %0" : "=r"(fault_address));
 
+	Thread *current_thread = x86arch.current_x86_cpu().current_thread;
 	if (current_thread == NULL) {
 		// If there is no current_thread, then this page fault happened REALLY
 		// early.  We must abort.
@@ -52,78 +484,122 @@ static void handle_page_fault(const IRQ *irq, void *priv)
 		arch_abort();
 	}
 
-	syslog.messagef(LogLevel::WARNING, "*** PAGE FAULT @ vaddr=0x%llx rip=0x%llx proc=%s", fault_address, current_thread->context().native_context->rip, current_thread->owner().name().c_str());
-	/* Is there a non-zero cookie in that PTE? */
+	trace_event(TraceEvent::PAGE_FAULT, fault_address, (uint64_t)current_thread);
+
 	VMA& vma = current_thread->owner().vma();
+
+	/* Is the page being collapsed into (or split out of) a huge page?  The access is
+	 * just made again until it is done: the fault handler can't wait for it here, with
+	 * interrupts disabled, as that takes a TLB shootdown. */
+	if (vma.collapse_in_progress(fault_address)) return;
+
+	/* Is it a write to a copy-on-write page? */
+	if (vma.handle_cow_fault(fault_address)) return;
+
+	/* Is there a non-zero cookie in that PTE? */
 	uint32_t cookie;
 	bool success = vma.get_pte_cookie(fault_address, cookie);
-	if (success && cookie)
+
+	/* Has the page been swapped out?  It is read back in (with whichever of its
+	 * neighbours were swapped out along with it) by the pager, like a file page, or
+	 * here if the pager can't take it. */
+	if (success && is_swap_cookie(cookie)) {
+		uint64_t fault_address_page_base = fault_address & ~(__page_size - 1);
+
+		if (submit_page_in(*current_thread, fault_address_page_base, cookie)) {
+			sys.scheduler().set_entity_state(*current_thread, SchedulingEntityState::SLEEPING);
+			sys.scheduler().schedule();
+			return;
+		}
+
+		SwapRun run;
+		find_swap_run(vma, fault_address_page_base, cookie, run);
+
+		uint8_t *buffer = fault_around_buffer();
+		if (!buffer) {
+			syslog.messagef(LogLevel::ERROR, "Out of memory handling a page fault @ vaddr=0x%llx", fault_address);
+			current_thread->owner().terminate(-1);
+		} else if (!swap_read(run.first_slot, run.nr_pages, buffer)) {
+			syslog.messagef(LogLevel::ERROR, "Unable to read from swap handling a page fault @ vaddr=0x%llx", fault_address);
+			current_thread->owner().terminate(-1);
+		} else if (!install_swap_run(vma, run, buffer, fault_address_page_base)) {
+			syslog.messagef(LogLevel::ERROR, "Out of memory handling a page fault @ vaddr=0x%llx", fault_address);
+			current_thread->owner().terminate(-1);
+		}
+
+		return;
+	}
+
+	if (success && (cookie & DPC_DEMAND))
 	{
-		syslog.messagef(LogLevel::DEBUG, "page fault looks like a demand-paging event, cookie 0x%x", (unsigned) cookie);
-		/* We assume the cookie is a file offset, ORed with the mapping flags
-		 * in its low-order bits (12 bits are free, because offsets are always
-		 * a multiple of the page size).
+		syslog.messagef(LogLevel::DEBUG, "page fault @ vaddr=0x%llx looks like a demand-paging event, cookie 0x%x",
+			fault_address, (unsigned) cookie);
+		/* The cookie is a file offset, ORed with the mapping flags in its
+		 * low-order bits (see make_demand_page_cookie()).
 		 *
-		 * If we find a cookie entry, we map some memory, populate it by doing the
-		 * file read, and resume the program. Since we never leave the memory
-		 * at the faulting address in the same state as it was initially, we are
-		 * not setting up a fault loop.
+		 * Zero-fill pages need no I/O, so they are mapped straight away: frames
+		 * from allocate_virt() are zeroed.  The page can be mapped with its final
+		 * permissions, because the kernel fills pages in through the physical
+		 * memory window.
 		 *
-		 * Normally it is not OK to do file I/O in an interrupt handler! Even worse
-		 * is that the file I/O we do is synchronous... the interrupt handler will
-		 * spin waiting for it to come in. So what we are doing will tank system
-		 * responsiveness and waste a lot of CPU cycles. A more realistic version
-		 * would start the I/O here, and set the process state to waiting on that
-		 * I/O... then, later, when the I/O has completed, the interrupt handler
-		 * will make the process runnable again. Instead we are blocking the whole
-		 * CPU while we synchronously do the programmed I/O.
+		 * Read-only file pages are shared between the processes running the
+		 * same program, through the VMA's text source: if another process has
+		 * read the page in already, it is just mapped.
 		 *
-		 * Note that pread() is implemented in the obfuscated fs driver, but
-		 * basically it does read_blocks() which does an ATA PIO command transfer
-		 * and then a spinning ('pause'-based) poll loop (no interrupts!). To make
-		 * that work in an interrupt handler context, when other interrupts are
-		 * disabled -- including the timer interrupt -- I have written a special
-		 * spin loop that doesn't rely on the timer advancing... instead we use
-		 * a pre-calibrated busy-wait loop.
+		 * Other file-backed pages are handed to the pager thread, and the faulting
+		 * thread is put to sleep until the pager has read the page (and its
+		 * fault-around neighbours) in.  We never leave the memory at the
+		 * faulting address in the same state as it was initially, so when the
+		 * thread resumes at the faulting instruction, it doesn't fault again.
+		 *
+		 * The disk transfer itself is still programmed I/O -- pread() ends up
+		 * in an ATA PIO command and a polling loop -- but it happens in the
+		 * pager's thread context, with interrupts enabled, so the timer keeps
+		 * ticking and other threads get to run while it is in progress.  Before
+		 * the pager is running (and if its queue is full), we fall back to
+		 * doing the read synchronously, here in the interrupt handler, relying
+		 * on the pre-calibrated busy-wait loop to not need the timer.
 		 */
 		uint64_t fault_address_page_base = fault_address & ~(__page_size - 1);
-		/* We must always make it writable initially! Because we are going to write to it.  */
-		vma.allocate_virt(fault_address_page_base, 1, /* default flags */ -1);
-		/* The file offset is stored in the cookie. */
-		uint32_t file_offset = cookie & ~(__page_size - 1);
-		syslog.messagef(LogLevel::DEBUG, "we will synchronously read from file offset 0x%x",
-			(unsigned) file_offset);
-		for (int i = 0; i < 8; ++i) /* a 4096-byte page is eight 512-byte disk blocks */
-		{
-			unsigned char buffer[512];
-			current_thread->owner().file().pread(buffer, sizeof buffer,
-				file_offset + i*sizeof buffer);
-			vma.copy_to(fault_address_page_base + i*sizeof buffer, buffer, sizeof buffer);
-			if (i == 0)
-			{
-				syslog.messagef(LogLevel::DEBUG, "synchronously read a block, "
-					"first bytes %02x %02x %02x %02x", (unsigned int) buffer[0], (unsigned int) buffer[1],
-					(unsigned int) buffer[2], (unsigned int) buffer[3]);
-			}
+
+		// Only the program's pages are shared through the text source.
+		virt_addr_t mapping_start = 0, mapping_end = USER_VA_END;
+		bool from_image = vma.file_mapping_bounds(fault_address_page_base, mapping_start, mapping_end) == NULL;
+
+		bool mapped;
+		if (cookie & DPC_ZERO) {
+			mapped = map_deferred_page(vma, fault_address_page_base, cookie) != NULL;
+		} else if (from_image && !(cookie & DPC_WRITABLE) && vma.map_text_page(fault_address_page_base)) {
+			// Another process running the same program has read this page in already.
+			return;
+		} else if (submit_page_in(*current_thread, fault_address_page_base, cookie)) {
+			// Switch away from the faulting thread: the pager will wake it up.
+			sys.scheduler().set_entity_state(*current_thread, SchedulingEntityState::SLEEPING);
+			sys.scheduler().schedule();
+			return;
+		} else if (uint8_t *buffer = fault_around_buffer()) {
+			DeferredRun run;
+			find_deferred_run(vma, fault_address_page_base, cookie, run);
+			read_deferred_run(current_thread->owner().file(), run, buffer);
+			mapped = install_deferred_run(vma, run, buffer, fault_address_page_base);
+		} else {
+			mapped = false;
 		}
-		syslog.messagef(LogLevel::DEBUG, "finished synchronous read of one page from file offset 0x%x",
-			(unsigned) file_offset);
-		// FIXME: you should fix up the mapping flags, e.g. to make
-		// the page read-only if it wasn't supposed to be writable.
-		// (Notice that in the code above, we made the
-		// memory writable no matter what the flags. Also,
-		// note that the cookie is not allowed to be zero,
-		// otherwise we wouldn't be running this block, so
-		// it should include the flags... re-read the comment
-		// at the top of this block to understand how to do this.
-
-		// OK, let's hope that worked...
+
+		if (!mapped) {
+			syslog.messagef(LogLevel::ERROR, "Out of memory handling a demand-paging fault @ vaddr=0x%llx", fault_address);
+			current_thread->owner().terminate(-1);
+		}
+
 		return;
 	}
-	else
-	{
-		syslog.messagef(LogLevel::DEBUG, "not a demand-paging event (cookie API call succeeded? %d)", (int) success);
-	}
+
+	// The kernel may have faulted on a bad user pointer, copying to or from user memory.
+	if (fixup_exception(*current_thread->context().native_context)) return;
+
+	syslog.messagef(LogLevel::WARNING, "*** PAGE FAULT @ vaddr=0x%llx rip=0x%llx proc=%s", fault_address, current_thread->context().native_context->rip, current_thread->owner().name().c_str());
+	syslog.messagef(LogLevel::DEBUG, "not a demand-paging event (cookie API call succeeded? %d)", (int) success);
+
 	// If we got here, it means we couldn't get the cookie or it was zero
 	current_thread->owner().terminate(-1);
 }
@@ -188,6 +664,28 @@ uint64_t *infos::arch::x86::__template_pml4;
  * Each PDP entry maps 1GB of address space, i.e. 2^(2*9 + 12) bytes.
  */
 
+static bool gb_pages_supported()
+{
+	return cpuid_get_ex_features().rdx & CPUIDFeatures::PDPE1GB;
+}
+
+/**
+ * Switches to the kernel page tables that reinitialise_pgt() has built, whose PML4 is
+ * the first of 'frames'.
+ */
+static bool load_kernel_pgt(const FrameDescriptor *frames)
+{
+	// Welp, here we go.  Reload the page tables
+	asm volatile ("mov %0, %%cr3" :: "r"(sys.mm().pgalloc().pfdescr_to_pa(&frames[0])));
+
+	// Grab a pointer to the PML4, to use as a template when creating process page tables
+	__template_pml4 = (uint64_t *)sys.mm().pgalloc().pfdescr_to_vpa(&frames[0]);
+
+	enable_pcids();
+
+	return true;
+}
+
 /**
  * Usurps the initial page tables, and introduces new ones for the
  * higher mapping.
@@ -242,6 +740,20 @@ static bool reinitialise_pgt()
 	pml4[0x1ff] = kva_to_pa((virt_addr_t)pdp0) | PTE_PRESENT | PTE_WRITABLE;
 	pml4[0x100] = kva_to_pa((virt_addr_t)pdp1) | PTE_PRESENT | PTE_WRITABLE;
 
+	// If the CPU has 1GB pages, each PDP entry maps its 1GB itself, and there are no PDs
+	// to fill in: that is six entries rather than 3072, and a TLB entry covers 1GB.
+	if (gb_pages_supported()) {
+		for (unsigned int i = 0; i < 4; i++) {
+			pdp1[i] = ((uintptr_t)i << 30) | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE | PTE_GLOBAL;
+		}
+
+		pdp0[0x1fe] = pdp1[0];
+		pdp0[0x1ff] = pdp1[1];
+
+		x86_log.message(LogLevel::DEBUG, "Mapping the kernel and physical memory with 1GB pages");
+		return load_kernel_pgt(frames);
+	}
+
 	pdp0[0x1fe] = kva_to_pa((virt_addr_t)pdp0_pd0) | PTE_PRESENT | PTE_WRITABLE;
 	pdp0[0x1ff] = kva_to_pa((virt_addr_t)pdp0_pd1) | PTE_PRESENT | PTE_WRITABLE;
 
@@ -255,42 +767,38 @@ static bool reinitialise_pgt()
 	// They are 1GB i.e. 0x40000000 i.e. 2^30 bytes apart, and
 	// each PD entry covers 2^(9+12) i.e. 0x200000 bytes (2MB).
 	// We use a HUGE (2GB) mapping to save creating bottom-level PTs.
+	// The kernel half is the same in every address space, so its mappings are
+	// GLOBAL: they stay in the TLB when CR3 is reloaded.
 	uintptr_t addr = 0;
 	for (unsigned int i = 0; i < 1<<9; i++) {
-		pdp0_pd0[i] = addr | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE;
-		pdp0_pd1[i] = (addr + (1<<30)) | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE;
+		pdp0_pd0[i] = addr | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE | PTE_GLOBAL;
+		pdp0_pd1[i] = (addr + (1<<30)) | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE | PTE_GLOBAL;
 		addr += 1<<21;
 	}
 
 	// Now, fill in the PHYSMEM PDs for a 4G mapping, similarly.
 	addr = 0;
 	for (unsigned int i = 0; i < 1<<9; i++) {
-		pdp1_pd0[i] = addr | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE;
+		pdp1_pd0[i] = addr | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE | PTE_GLOBAL;
 		addr += 1<<21;
 	}
 
 	for (unsigned int i = 0; i < 1<<9; i++) {
-		pdp1_pd1[i] = addr | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE;
+		pdp1_pd1[i] = addr | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE | PTE_GLOBAL;
 		addr += 1<<21;
 	}
 
 	for (unsigned int i = 0; i < 1<<9; i++) {
-		pdp1_pd2[i] = addr | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE;
+		pdp1_pd2[i] = addr | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE | PTE_GLOBAL;
 		addr += 1<<21;
 	}
 
 	for (unsigned int i = 0; i < 1<<9; i++) {
-		pdp1_pd3[i] = addr | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE;
+		pdp1_pd3[i] = addr | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE | PTE_GLOBAL;
 		addr += 1<<21;
 	}
 
-	// Welp, here we go.  Reload the page tables
-	asm volatile ("mov %0, %%cr3" :: "r"(kva_to_pa((virt_addr_t)pml4)));
-
-	// Grab a pointer to the PML4, to use as a template when creating process page tables
-	__template_pml4 = (uint64_t *)sys.mm().pgalloc().pfdescr_to_vpa(&frames[0]);
-
-	return true;
+	return load_kernel_pgt(frames);
 }
 
 /**
@@ -321,6 +829,14 @@ bool infos::arch::x86::mm_init()
 		}
 	}
 
+	// The boot modules stay where the boot loader put them until modules_init() loads them.
+	for (unsigned int i = 0; i < multiboot_info_structure->mods_count; i++) {
+		struct multiboot_module_entry *module_entry = (struct multiboot_module_entry *)pa_to_kva(multiboot_info_structure->mods_addr + (sizeof(struct multiboot_module_entry) * i));
+
+		if (!sys.mm().pgalloc().reserve_at_boot(module_entry->mod_start >> 12, (module_entry->mod_end + 0xfff) >> 12, "boot module"))
+			return false;
+	}
+
 	if (!sys.mm().initialise_allocators())
 		return false;
 
@@ -333,30 +849,129 @@ bool infos::arch::x86::mm_pf_init()
 	return x86arch.irq_manager().install_exception_handler(IRQ_PAGE_FAULT, handle_page_fault, NULL);
 }
 
-/* Ths following is pasted from vma.cpp, to eliminate its x86-specificity.
- * It's better now that the arch-dep code is in a sane place in the tree,
- * but ideally these definitions would not be members of the global VMA
- * class, but instead something x86-specific that slots in. */
+/* The PAT entries, in the order the PAT, PCD and PWT bits of an entry index them (see
+ * PageCacheTypes).  The first four are the power-on defaults, which PCD and PWT select
+ * between as if there were no PAT.  The fifth, selected by the PAT bit alone, is
+ * write-combining. */
+#define PAT_UC			0x00ull
+#define PAT_WC			0x01ull
+#define PAT_WT			0x04ull
+#define PAT_WB			0x06ull
+#define PAT_UC_MINUS	0x07ull
 
-void VMA::install_default_kernel_mapping()
+#define PAT_VALUE		(PAT_WB | (PAT_WT << 8) | (PAT_UC_MINUS << 16) | (PAT_UC << 24) | \
+						 (PAT_WC << 32) | (PAT_WT << 40) | (PAT_UC_MINUS << 48) | (PAT_UC << 56))
+
+static bool pat_supported()
 {
-	assert(__template_pml4);
-	
-	uint64_t *pml4 = (uint64_t *)_pgt_virt_base;
-	
-	pml4[0x1ff] = __template_pml4[0x1ff];
-	pml4[0x100] = __template_pml4[0x100];
+	return cpuid_get_features().rdx & CPUIDFeatures::PAT;
 }
 
-void infos::mm::VMA::insert_mapping(virt_addr_t va, phys_addr_t pa, unsigned long flags)
+/**
+ * Programs the PAT on the current CPU.  Every CPU must have the same PAT, so this is
+ * called as each starts.
+ */
+void infos::arch::x86::pat_init_cpu()
 {
-	table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
-	va_table_indices(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
-	
-	PML4TableEntry *pml4e = &((PML4TableEntry *)_pgt_virt_base)[pml4_idx];
+	if (pat_supported()) {
+		__wrmsr(MSR_PAT, PAT_VALUE);
+	}
+}
+
+/**
+ * The window is mapped with 1GB or 2MB pages, so each one the range touches is split, into
+ * 2MB and then 4KB pages, and only those in the range are changed.  The other CPUs aren't told to flush
+ * their TLBs, which is why they mustn't have been started.
+ *
+ * The low 2GB is also mapped by the kernel's own mapping, which would then disagree with
+ * the window about how to cache it, so only ranges above that can be changed.
+ */
+bool infos::mm::set_physical_cache_type(phys_addr_t pa, size_t size, unsigned long type)
+{
+	type &= PTE_CACHE_MASK;
+
+	if (size == 0 || ((type & PTE_PT_PAT) && !pat_supported())) return false;
+	if (pa < (1ull << 31) || pa + size > PMEM_VA_SIZE) return false;
+
+	phys_addr_t start = __align_down_page(pa);
+	phys_addr_t end = __align_up_page(pa + size);
+
+	uint64_t *pdp = (uint64_t *)pa_to_vpa(__template_pml4[0x100] & ~0xfffull);
+
+	for (phys_addr_t region = start & ~((1ull << 21) - 1); region < end; region += 1ull << 21) {
+		uint64_t& pdpe = pdp[region >> 30];
+
+		if (pdpe & PTE_HUGE) {
+			FrameDescriptor *frame = sys.mm().pgalloc().allocate(0);
+			if (!frame) return false;
+
+			uint64_t *pd = (uint64_t *)sys.mm().pgalloc().pfdescr_to_vpa(frame);
+			for (unsigned int i = 0; i < 512; i++) {
+				pd[i] = ((region & ~((1ull << 30) - 1)) + ((phys_addr_t)i << 21)) | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE | PTE_GLOBAL;
+			}
+
+			pdpe = sys.mm().pgalloc().pfdescr_to_pa(frame) | PTE_PRESENT | PTE_WRITABLE;
+		}
+
+		uint64_t *pd = (uint64_t *)pa_to_vpa(pdpe & ~0xfffull);
+		uint64_t& pde = pd[(region >> 21) & 0x1ff];
+
+		if (pde & PTE_HUGE) {
+			FrameDescriptor *frame = sys.mm().pgalloc().allocate(0);
+			if (!frame) return false;
+
+			uint64_t *pt = (uint64_t *)sys.mm().pgalloc().pfdescr_to_vpa(frame);
+			for (unsigned int i = 0; i < 512; i++) {
+				pt[i] = (region + ((phys_addr_t)i << __page_bits)) | PTE_PRESENT | PTE_WRITABLE | PTE_GLOBAL;
+			}
+
+			pde = sys.mm().pgalloc().pfdescr_to_pa(frame) | PTE_PRESENT | PTE_WRITABLE;
+		}
+
+		uint64_t *pt = (uint64_t *)pa_to_vpa(pde & ~0xfffull);
+		for (unsigned int i = 0; i < 512; i++) {
+			phys_addr_t page = region + ((phys_addr_t)i << __page_bits);
+			if (page >= start && page < end) pt[i] = (pt[i] & ~(uint64_t)PTE_CACHE_MASK) | type;
+		}
+	}
+
+	// The window's mappings are global, so are flushed a page at a time.
+	for (phys_addr_t page = start & ~((1ull << 21) - 1); page < end; page += __page_size) {
+		flush_tlb_page(pa_to_vpa(page));
+	}
+
+	x86_log.messagef(LogLevel::DEBUG, "Cache type %lx for pa=0x%lx, size=0x%lx", type, pa, size);
+	return true;
+}
+
+/* Ths following is pasted from vma.cpp, to eliminate its x86-specificity.
+ * It's better now that the arch-dep code is in a sane place in the tree,
+ * but ideally these definitions would not be members of the global VMA
+ * class, but instead something x86-specific that slots in. */
+
+void VMA::install_default_kernel_mapping()
+{
+	assert(__template_pml4);
+	
+	uint64_t *pml4 = (uint64_t *)_pgt_virt_base;
+	
+	pml4[0x1ff] = __template_pml4[0x1ff];
+	pml4[0x100] = __template_pml4[0x100];
+}
+
+/**
+ * Finds the page directory entry that covers a virtual address, creating the intermediate
+ * page tables if necessary.
+ */
+static PDTableEntry *get_or_create_pde(VMA& vma, virt_addr_t pgt_virt_base, virt_addr_t va)
+{
+	table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
+	va_table_indices(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
+	
+	PML4TableEntry *pml4e = &((PML4TableEntry *)pgt_virt_base)[pml4_idx];
 	
 	if (pml4e->base_address() == 0) {
-		auto pdp = allocate_phys(0);
+		auto pdp = vma.allocate_pgt();
 		assert(pdp);
 		
 		pml4e->base_address(sys.mm().pgalloc().pfdescr_to_pa(pdp));
@@ -368,7 +983,7 @@ void infos::mm::VMA::insert_mapping(virt_addr_t va, phys_addr_t pa, unsigned lon
 	PDPTableEntry *pdpe = &((PDPTableEntry *)pa_to_vpa(pml4e->base_address()))[pdp_idx];
 	
 	if (pdpe->base_address() == 0) {
-		auto pd = allocate_phys(0);
+		auto pd = vma.allocate_pgt();
 		assert(pd);
 		
 		pdpe->base_address(sys.mm().pgalloc().pfdescr_to_pa(pd));
@@ -377,10 +992,24 @@ void infos::mm::VMA::insert_mapping(virt_addr_t va, phys_addr_t pa, unsigned lon
 		pdpe->user(true);
 	}
 	
-	PDTableEntry *pde = &((PDTableEntry *)pa_to_vpa(pdpe->base_address()))[pd_idx];
+	return &((PDTableEntry *)pa_to_vpa(pdpe->base_address()))[pd_idx];
+}
+
+/**
+ * Finds the page table entry for a virtual address, creating the page tables on the way
+ * if necessary.
+ * @return Returns the entry, or NULL if the address is covered by a huge page.
+ */
+static PTTableEntry *get_or_create_pte(VMA& vma, virt_addr_t pgt_virt_base, virt_addr_t va)
+{
+	table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
+	va_table_indices(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
+	
+	PDTableEntry *pde = get_or_create_pde(vma, pgt_virt_base, va);
+	if (pde->huge()) return NULL;
 	
 	if (pde->base_address() == 0) {
-		auto pt = allocate_phys(0);
+		auto pt = vma.allocate_pgt();
 		assert(pt);
 		
 		pde->base_address(sys.mm().pgalloc().pfdescr_to_pa(pt));
@@ -389,27 +1018,202 @@ void infos::mm::VMA::insert_mapping(virt_addr_t va, phys_addr_t pa, unsigned lon
 		pde->user(true);
 	}
 	
-	PTTableEntry *pte = &((PTTableEntry *)pa_to_vpa(pde->base_address()))[pt_idx];
+	return &((PTTableEntry *)pa_to_vpa(pde->base_address()))[pt_idx];
+}
+
+/**
+ * Finds the page directory entry for a virtual address, without creating anything.
+ * @return Returns the entry, or NULL if there is no page directory for the address.
+ */
+static PDTableEntry *find_pde(virt_addr_t pgt_virt_base, virt_addr_t va)
+{
+	if (!pgt_virt_base) return NULL;
+	
+	table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
+	va_table_indices(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
+	
+	PML4TableEntry *pml4e = &((PML4TableEntry *)pgt_virt_base)[pml4_idx];
+	if (!pml4e->present()) return NULL;
+	
+	PDPTableEntry *pdpe = &((PDPTableEntry *)pa_to_vpa(pml4e->base_address()))[pdp_idx];
+	if (!pdpe->present() || pdpe->huge()) return NULL;
+	
+	return &((PDTableEntry *)pa_to_vpa(pdpe->base_address()))[pd_idx];
+}
+
+/**
+ * Finds the page table entry for a virtual address, without creating anything.
+ * @return Returns the entry, or NULL if there is no page table for the address (or it is
+ * covered by a huge page).
+ */
+static PTTableEntry *find_pte(virt_addr_t pgt_virt_base, virt_addr_t va)
+{
+	PDTableEntry *pde = find_pde(pgt_virt_base, va);
+	if (!pde || !pde->present() || pde->huge()) return NULL;
 	
-	pte->base_address(pa); // this is the only place we use 'pa'
+	return &((PTTableEntry *)pa_to_vpa(pde->base_address()))[(va >> __page_bits) & 0x1ff];
+}
+
+/*
+ * While collapse_huge_page() (or split_huge_page()) copies the pages under a page
+ * directory entry, the entry is left not present, so that nothing can reach them, and
+ * holds this, so that a fault on them knows to try again once the copy is done.
+ */
+#define PDE_COLLAPSING		((uint64_t)(PTE_HUGE | PTE_COW))
+
+/**
+ * Finds the page table entries for a run of pages, creating the page tables on the way if
+ * necessary.  The run is cut short at the end of the page table that holds the first entry,
+ * so that the caller can fill in consecutive entries, and only walk the hierarchy again
+ * when it moves on to the next page table.
+ * @param nr_pages The number of pages wanted, updated with the number of entries in the run.
+ * @return Returns the first entry, or NULL if the address is covered by a huge page.
+ */
+static PTTableEntry *get_or_create_pte_run(VMA& vma, virt_addr_t pgt_virt_base, virt_addr_t va, int& nr_pages)
+{
+	PTTableEntry *pte = get_or_create_pte(vma, pgt_virt_base, va);
+	if (!pte) return NULL;
+	
+	int nr_left_in_table = 0x200 - (int)((va >> __page_bits) & 0x1ff);
+	if (nr_pages > nr_left_in_table) nr_pages = nr_left_in_table;
+	
+	return pte;
+}
+
+static inline void fill_pte(PTTableEntry *pte, phys_addr_t pa, unsigned long flags)
+{
+	// The entry may hold a cookie, which must not leak into the mapping.
+	pte->bits = 0;
+	pte->base_address(pa);
 	
 	if (flags & PTE_PRESENT) pte->present(true);
 	if (flags & PTE_WRITABLE) pte->writable(true);
 	if (flags & PTE_ALLOW_USER) pte->user(true);
 	
-	mm_log.messagef(LogLevel::DEBUG, "vma: mapping va=0x%lx -> pa=0x%lx", va, pa);
+	pte->bits |= flags & PTE_CACHE_MASK;
+}
+
+void infos::mm::VMA::insert_mapping(virt_addr_t va, phys_addr_t pa, unsigned long flags)
+{
+	PTTableEntry *pte = get_or_create_pte(*this, _pgt_virt_base, va);
+	
+	// A huge page can't be partially remapped.
+	assert(pte);
+	
+	fill_pte(pte, pa, flags);
+	
+	LOG_MESSAGEF(mm_log, LogLevel::DEBUG, "vma: mapping va=0x%lx -> pa=0x%lx", va, pa);
+}
+
+void infos::mm::VMA::map_range(virt_addr_t va, phys_addr_t pa, int nr_pages, unsigned long flags)
+{
+	LOG_MESSAGEF(mm_log, LogLevel::DEBUG, "vma: mapping va=0x%lx -> pa=0x%lx (%d pages)", va, pa, nr_pages);
+	
+	if (nr_pages > 0) _free_ranges.reserve(va, va + ((virt_addr_t)nr_pages << __page_bits));
+	
+	while (nr_pages > 0) {
+		int nr_run = nr_pages;
+		PTTableEntry *pte = get_or_create_pte_run(*this, _pgt_virt_base, va, nr_run);
+		
+		// A huge page can't be partially remapped.
+		assert(pte);
+		
+		for (int i = 0; i < nr_run; i++) {
+			fill_pte(&pte[i], pa + ((phys_addr_t)i << __page_bits), flags);
+		}
+		
+		va += (virt_addr_t)nr_run << __page_bits;
+		pa += (phys_addr_t)nr_run << __page_bits;
+		nr_pages -= nr_run;
+	}
+}
+
+bool infos::mm::VMA::map_range_any(phys_addr_t pa, int nr_pages, unsigned long flags, virt_addr_t& va)
+{
+	if (nr_pages <= 0) return false;
+	
+	if (!_free_ranges.allocate((size_t)nr_pages << __page_bits, __page_size, va)) {
+		mm_log.messagef(LogLevel::WARNING, "vma: no free virtual range for %d pages", nr_pages);
+		return false;
+	}
+	
+	map_range(va, pa, nr_pages, flags);
+	return true;
+}
+
+bool infos::mm::VMA::map_shared_any(FrameDescriptor *const *frames, int nr_pages, bool writable, virt_addr_t& va)
+{
+	if (nr_pages <= 0) return false;
+	
+	if (!_free_ranges.allocate((size_t)nr_pages << __page_bits, __page_size, va)) {
+		mm_log.messagef(LogLevel::WARNING, "vma: no free virtual range for %d pages", nr_pages);
+		return false;
+	}
+	
+	unsigned long flags = PTE_PRESENT | PTE_ALLOW_USER | (writable ? PTE_WRITABLE : 0);
+	
+	virt_addr_t page_va = va;
+	int done = 0;
+	while (done < nr_pages) {
+		int nr_run = nr_pages - done;
+		PTTableEntry *pte = get_or_create_pte_run(*this, _pgt_virt_base, page_va, nr_run);
+		assert(pte);
+		
+		for (int i = 0; i < nr_run; i++) {
+			FrameDescriptor *pfdescr = frames[done + i];
+			
+			// The holder of the frames has a hold on them already, so the count is
+			// never zero here, and unmapping will know that the frame is shared.
+			assert(__atomic_load_n(&pfdescr->refcount, __ATOMIC_RELAXED) > 0);
+			__atomic_add_fetch(&pfdescr->refcount, 1, __ATOMIC_RELAXED);
+			
+			fill_pte(&pte[i], sys.mm().pgalloc().pfdescr_to_pa(pfdescr), flags);
+		}
+		
+		_nr_shared_frames += nr_run;
+		page_va += (virt_addr_t)nr_run << __page_bits;
+		done += nr_run;
+	}
+	
+	return true;
+}
+
+void infos::mm::VMA::insert_huge_mapping(virt_addr_t va, phys_addr_t pa, unsigned long flags)
+{
+	assert(__huge_page_offset(va) == 0 && __huge_page_offset(pa) == 0);
+	
+	PDTableEntry *pde = get_or_create_pde(*this, _pgt_virt_base, va);
+	
+	// The entry must not already map a huge page, or point to a page table.
+	assert(pde->base_address() == 0);
+	
+	pde->base_address(pa);
+	pde->huge(true);
+	
+	if (flags & PTE_PRESENT) pde->present(true);
+	if (flags & PTE_WRITABLE) pde->writable(true);
+	if (flags & PTE_ALLOW_USER) pde->user(true);
+	
+	// In a huge page's entry, the PAT bit is moved up, as bit 7 says it is huge.
+	pde->bits |= flags & (PTE_CACHE_DISABLED | PTE_WRITE_THROUGH);
+	if (flags & PTE_PT_PAT) pde->bits |= PTE_NONPT_PAT;
+	
+	LOG_MESSAGEF(mm_log, LogLevel::DEBUG, "vma: mapping huge va=0x%lx -> pa=0x%lx", va, pa);
 }
+
 bool infos::mm::VMA::set_pte_cookie(virt_addr_t va, uint32_t cookie)
 {
-	// FIXME: add implementation (see comments in include/infos/mm/vma.h)
-	// Check that your implementation is well-matched with 'get_pte_cookie'
-	// (elsewhere in this file)
-	return false;
+	PTTableEntry *pte = find_pte(_pgt_virt_base, va);
+	if (!pte || pte->present()) return false;
+	
+	// The cookie lives in bits 12..43, leaving the present bit (and every other flag) clear.
+	pte->bits = (uint64_t)cookie << 12;
+	return true;
 }
 
 FrameDescriptor *infos::mm::VMA::allocate_phys(int order)
 {
-	auto pfdescr = sys.mm().pgalloc().allocate(order);
+	auto pfdescr = sys.mm().pgalloc().allocate(order, PageAllocFlags::ZERO);
 	if (!pfdescr) return NULL;
 	
 	FrameAllocation pa;
@@ -417,125 +1221,1508 @@ FrameDescriptor *infos::mm::VMA::allocate_phys(int order)
 	pa.allocation_order = order;
 	
 	_frame_allocations.append(pa);
-	pnzero((void *)sys.mm().pgalloc().pfdescr_to_vpa(pa.descriptor_base), 1 << order);
+	_nr_unmapped_frames += 1u << order;
 	
 	return pfdescr;
 }
 
-bool infos::mm::VMA::allocate_virt_any(int nr_pages, int perm /* = -1 */)
+FrameDescriptor *infos::mm::VMA::allocate_pgt()
 {
-	return false;
+	auto pfdescr = sys.mm().pgalloc().allocate(0, PageAllocFlags::ZERO);
+	if (pfdescr) _nr_pgt_frames++;
+	
+	return pfdescr;
 }
 
-bool infos::mm::VMA::allocate_virt(virt_addr_t va, int nr_pages, int perm /* = -1 */)
+void infos::mm::VMA::free_pgt(FrameDescriptor *pfdescr)
+{
+	sys.mm().pgalloc().free(pfdescr, 0);
+	_nr_pgt_frames--;
+}
+
+/**
+ * Records that a block of frames was allocated to back the pages at the given virtual address.
+ */
+void infos::mm::VMA::record_mapped_frames(virt_addr_t va, FrameDescriptor *pfdescr, int order)
 {
-	if (nr_pages == 0) return false;
+	FrameAllocation fa;
+	fa.descriptor_base = pfdescr;
+	fa.allocation_order = order;
 	
-	int order = __log2ceil(nr_pages);
+	_mapped_frames.insert(va, va + ((virt_addr_t)__page_size << order), fa);
+	_nr_private_frames += 1u << order;
+}
+
+/**
+ * Drops this VMA's hold on the block of frames that was mapped at the given virtual address,
+ * and frees it if nothing else holds it.  Frames that were neither allocated for this VMA
+ * nor shared into it (e.g. mapped with map_range()) are not freed.
+ */
+void infos::mm::VMA::release_mapped_frames(virt_addr_t va, phys_addr_t pa, int order)
+{
+	FrameDescriptor *pfdescr = sys.mm().pgalloc().vpa_to_pfdescr(pa_to_vpa(pa));
 	
-	const FrameDescriptor *pfdescr = allocate_phys(order);
-	if (!pfdescr) {
-		return false;
+	auto node = _mapped_frames.find(va);
+	bool owned = node != NULL;
+	if (owned) {
+		assert(node->value.descriptor_base == pfdescr && node->value.allocation_order == order);
+		_mapped_frames.remove(va);
+		_nr_private_frames -= 1u << order;
 	}
 	
-	virt_addr_t vbase = va;
-	phys_addr_t pbase = sys.mm().pgalloc().pfdescr_to_pa(pfdescr);
-	unsigned long always_mapping_flags = PTE_PRESENT | PTE_ALLOW_USER;
-	unsigned long default_mapping_flags = always_mapping_flags | PTE_WRITABLE;
-	for (unsigned int i = 0; i < (1u << order); i++) {
-		insert_mapping(vbase, pbase,
-			(perm == -1) ? default_mapping_flags : (always_mapping_flags | perm)
-		);
+	if (__atomic_load_n(&pfdescr->refcount, __ATOMIC_RELAXED) > 0) {
+		if (!owned) _nr_shared_frames--;
 		
-		vbase += 0x1000;
-		pbase += 0x1000;
+		// The frame is shared: whoever drops the last hold on it frees it.
+		if (__atomic_sub_fetch(&pfdescr->refcount, 1, __ATOMIC_RELAXED) > 0) return;
+	} else if (!owned) {
+		return;
 	}
 	
-	return true;
+	sys.mm().pgalloc().free(pfdescr, order);
 }
 
-bool infos::mm::VMA::create_unused_ptes(virt_addr_t va, int nr_pages)
+bool infos::mm::VMA::allocate_virt_any(int nr_pages, virt_addr_t& va, int perm /* = -1 */)
 {
-	// FIXME: add implementation (see comments in include/infos/mm/vma.h)
-	// HINT: what we want to achieve is almost identical to what
-	// 'insert_mapping' does, except that in our case we have no physical
-	// address to map to -- we're "unused". So a good solution might be
-	// to refactor 'insert_mapping' so it works in two stages:
-	//     - firstly, ensure the page table entry has been created
-	//     - secondly, install in it the mapping to the physical address.
-	// The 'firstly' part is us!
-	return false;
+	if (nr_pages <= 0) return false;
+	
+	size_t size = (size_t)nr_pages << __page_bits;
+	
+	// Prefer a huge page boundary for big runs, but don't fail just because there
+	// isn't room for one.
+	bool placed = false;
+	if (size >= __huge_page_size) {
+		placed = _free_ranges.allocate(size, __huge_page_size, va);
+	}
+	
+	if (!placed && !_free_ranges.allocate(size, __page_size, va)) {
+		mm_log.messagef(LogLevel::WARNING, "vma: no free virtual range for %d pages", nr_pages);
+		return false;
+	}
+	
+	if (!allocate_virt(va, nr_pages, perm)) {
+		_free_ranges.release(va, va + size);
+		return false;
+	}
+	
+	return true;
 }
 
-bool infos::mm::VMA::is_mapped(virt_addr_t va)
+bool infos::mm::VMA::allocate_virt(virt_addr_t va, int nr_pages, int perm /* = -1 */)
 {
-	phys_addr_t pa;
-	return get_mapping(va, pa);
+	if (nr_pages <= 0) return false;
+	
+	unsigned long always_mapping_flags = PTE_PRESENT | PTE_ALLOW_USER;
+	unsigned long default_mapping_flags = always_mapping_flags | PTE_WRITABLE;
+	unsigned long flags = (perm == -1) ? default_mapping_flags : (always_mapping_flags | perm);
+	
+	const int nr_huge_page_pages = 1 << __huge_page_order;
+	
+	virt_addr_t vbase = va;
+	while (nr_pages > 0) {
+		// Map each whole, aligned huge page in the range with a single page directory
+		// entry, if an aligned block of frames is available for it.
+		if (__huge_page_offset(vbase) == 0 && nr_pages >= nr_huge_page_pages) {
+			if (allocate_virt_huge(vbase, flags)) {
+				vbase += __huge_page_size;
+				nr_pages -= nr_huge_page_pages;
+				continue;
+			}
+		}
+		
+		// Otherwise, map small pages up to the next huge page boundary.
+		int nr_small_pages = (__huge_page_size - __huge_page_offset(vbase)) >> __page_bits;
+		if (nr_small_pages > nr_pages) nr_small_pages = nr_pages;
+		
+		if (!allocate_virt_small(vbase, nr_small_pages, flags)) {
+			return false;
+		}
+		
+		vbase += (virt_addr_t)nr_small_pages << __page_bits;
+		nr_pages -= nr_small_pages;
+	}
+	
+	_free_ranges.reserve(va, vbase);
+	return true;
 }
 
-bool infos::mm::VMA::get_mapping(virt_addr_t va, phys_addr_t& pa)
+/**
+ * Maps a huge page at the given (huge-page aligned) virtual address, backed by a naturally
+ * aligned block of frames.
+ * @return Returns false (having allocated nothing) if there is no suitable block of frames,
+ * or if part of the huge page is already mapped.
+ */
+bool infos::mm::VMA::allocate_virt_huge(virt_addr_t va, unsigned long flags)
 {
-	if (!_pgt_virt_base) return false;
-	
+	// Don't create page tables just to find out that a page table is in the way.
 	table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
 	va_table_indices(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
 	
 	PML4TableEntry *pml4e = &((PML4TableEntry *)_pgt_virt_base)[pml4_idx];
-	
-	if (!pml4e->present()) {
-		return false;
+	if (pml4e->base_address() != 0) {
+		PDPTableEntry *pdpe = &((PDPTableEntry *)pa_to_vpa(pml4e->base_address()))[pdp_idx];
+		if (pdpe->base_address() != 0) {
+			PDTableEntry *pde = &((PDTableEntry *)pa_to_vpa(pdpe->base_address()))[pd_idx];
+			if (pde->base_address() != 0) return false;
+		}
 	}
 	
-	PDPTableEntry *pdpe = &((PDPTableEntry *)pa_to_vpa(pml4e->base_address()))[pdp_idx];
+	FrameDescriptor *pfdescr = sys.mm().pgalloc().allocate(__huge_page_order, PageAllocFlags::ZERO);
+	if (!pfdescr) return false;
 	
-	if (!pdpe->present()) {
+	// The algorithm need not return aligned blocks (although the buddy allocator does).
+	phys_addr_t pa = sys.mm().pgalloc().pfdescr_to_pa(pfdescr);
+	if (__huge_page_offset(pa) != 0) {
+		sys.mm().pgalloc().free(pfdescr, __huge_page_order);
 		return false;
 	}
 	
-	PDTableEntry *pde = &((PDTableEntry *)pa_to_vpa(pdpe->base_address()))[pd_idx];
+	record_mapped_frames(va, pfdescr, __huge_page_order);
 	
-	if (!pde->present()) {
+	insert_huge_mapping(va, pa, flags);
+	return true;
+}
+
+/**
+ * Maps a number of small pages at the given virtual address, backed by frames that
+ * need not be contiguous.
+ */
+bool infos::mm::VMA::allocate_virt_small(virt_addr_t va, int nr_pages, unsigned long flags)
+{
+	// The pages don't need to be backed by contiguous frames, so ask for exactly
+	// as many frames as there are pages, in one call.
+	FrameDescriptor **frames = new FrameDescriptor *[nr_pages];
+	if (!sys.mm().pgalloc().allocate_bulk(nr_pages, frames, PageAllocFlags::ZERO)) {
+		delete[] frames;
 		return false;
 	}
 	
-	PTTableEntry *pte = &((PTTableEntry *)pa_to_vpa(pde->base_address()))[pt_idx];
+	for (int i = 0; i < nr_pages; i++) {
+		record_mapped_frames(va + ((virt_addr_t)i << __page_bits), frames[i], 0);
+	}
 	
-	if (!pte->present()) {
-		return false;
+	LOG_MESSAGEF(mm_log, LogLevel::DEBUG, "vma: mapping va=0x%lx (%d pages)", va, nr_pages);
+	
+	// Fill in the entries a page table at a time, rather than walking the hierarchy
+	// for every page.
+	virt_addr_t vbase = va;
+	int i = 0;
+	while (i < nr_pages) {
+		int nr_run = nr_pages - i;
+		PTTableEntry *pte = get_or_create_pte_run(*this, _pgt_virt_base, vbase, nr_run);
+		assert(pte);
+		
+		for (int j = 0; j < nr_run; j++) {
+			fill_pte(&pte[j], sys.mm().pgalloc().pfdescr_to_pa(frames[i + j]), flags);
+		}
+		
+		vbase += (virt_addr_t)nr_run << __page_bits;
+		i += nr_run;
 	}
 	
-	pa = pte->base_address() | __page_offset(va);
+	delete[] frames;
 	return true;
 }
-bool infos::mm::VMA::get_pte_cookie(virt_addr_t va, uint32_t& cookie)
+
+static bool pgt_empty(const GenericX86PageTableEntry *table)
 {
-	// FIXME: add implementation (see comments in include/infos/mm/vma.h)
-	// A partial implementation is provided here. Ensure that your
-	// final implementation is compatible with 'set_pte_cookie'
-	// (elsewhere in this file).
-        PTTableEntry *pte = /* REPLACE THIS */ nullptr;
-	if (!pte) return false; // failed!
-        assert(!pte->present());
-        // extract bits 12..43 inclusive -- this is where the cookie should be stored
-        uint64_t mask_12_43 = ((1ul<<44) - 1) & ~((1ul<<12) - 1);
-	// what we just made is the following 64-bit number (shown in binary):
-	// 0000000000000000000011111111111111111111111111111111000000000000
-	// NOTE: here 'cookie' is being returned by reference back to the caller
-        cookie = (uint32_t)((pte->bits & mask_12_43) >> 12);
-        return true;
+	for (unsigned int i = 0; i < 0x200; i++) {
+		if (table[i].bits) return false;
+	}
+	
+	return true;
+}
 
+static void free_pgt_entry(VMA& vma, GenericX86PageTableEntry *entry)
+{
+	vma.free_pgt(sys.mm().pgalloc().vpa_to_pfdescr(pa_to_vpa(entry->base_address())));
+	entry->bits = 0;
 }
-bool infos::mm::VMA::copy_to(virt_addr_t dest_va, const void* src, size_t size)
+
+bool infos::mm::VMA::is_active() const
 {
-	phys_addr_t pa;
-	if (!get_mapping(dest_va, pa))
-		return false;
-	
-	void *dest = (void *)pa_to_vpa(pa);
-	
-	//mm_log.messagef(LogLevel::DEBUG, "vma: copy-to dst=va=%p:pa=%p:vpa=%p src=%p size=%p", dest_va, pa, dest, src, size);
-	memcpy(dest, src, size);
-	
+	uint64_t cr3;
+	asm volatile("mov %%cr3, %0" : "=r"(cr3));
+
+	return (cr3 & ~0xfffull) == _pgt_phys_base;
+}
+
+void infos::mm::VMA::activate()
+{
+	X86CPU& cpu = x86arch.current_x86_cpu();
+	cpu.active_pgt = _pgt_phys_base;
+
+	uint64_t self = 1ull << cpu.index;
+	bool stale = __atomic_load_n(&_tlb_stale, __ATOMIC_RELAXED) & self;
+
+	// Switching back from a kernel thread that borrowed the page table needn't reload it.
+	if (!stale && is_active()) return;
+
+	if (!pcids_enabled) {
+		asm volatile("mov %0, %%cr3" :: "r"(_pgt_phys_base) : "memory");
+		__atomic_and_fetch(&_tlb_stale, ~self, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (_pcid == 0) {
+		_pcid = allocate_pcid();
+	}
+
+	// The TLB entries tagged with the PCID can be kept if they are still up to date.
+	// PCID 0 is shared, so its entries never are.
+	uint64_t cr3 = _pgt_phys_base | _pcid;
+	if (!stale && _pcid != 0) cr3 |= CR3_NOFLUSH;
+
+	asm volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+	__atomic_and_fetch(&_tlb_stale, ~self, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns the CPUs that have a page table loaded, whether for a thread of its VMA, or a
+ * kernel thread borrowing it.
+ */
+static CPUMask cpus_using(phys_addr_t pgt_phys_base)
+{
+	CPUMask cpus = 0;
+	for (unsigned int i = 0; i < x86arch.nr_cpus(); i++) {
+		if (x86arch.cpu(i).active_pgt == pgt_phys_base) cpus |= 1ull << i;
+	}
+
+	return cpus;
+}
+
+/**
+ * Drops any translation of the given page from the TLB: straight away if the VMA is active,
+ * otherwise the next time it is activated.
+ */
+void infos::mm::VMA::invalidate_page(virt_addr_t va)
+{
+	invalidate_range(va, 1);
+}
+
+/**
+ * Drops the translations of a range of pages from the TLBs of every CPU that is using the
+ * VMA, and the TLB of any other CPU the next time it is activated there.
+ */
+void infos::mm::VMA::invalidate_range(virt_addr_t va, unsigned int nr_pages)
+{
+	UniqueIRQLock l;
+
+	// Translations tagged with the VMA's PCID outlive switching away from it, so a CPU
+	// that isn't using the VMA now flushes them when it next does.
+	__atomic_or_fetch(&_tlb_stale, ~cpus_using(_pgt_phys_base), __ATOMIC_RELAXED);
+
+	flush_tlb_local(va, nr_pages);
+	shootdown_remote(va, nr_pages);
+}
+
+void infos::mm::VMA::flush_tlb_local(virt_addr_t va, unsigned int nr_pages)
+{
+	if (!is_active()) {
+		__atomic_or_fetch(&_tlb_stale, 1ull << x86arch.current_x86_cpu().index, __ATOMIC_RELAXED);
+	} else if (nr_pages > TLB_FLUSH_MAX_PAGES) {
+		flush_tlb_all();
+	} else {
+		for (unsigned int i = 0; i < nr_pages; i++) {
+			flush_tlb_page(va + ((virt_addr_t)i << __page_bits));
+		}
+	}
+}
+
+struct TLBShootdown
+{
+	infos::mm::VMA *vma;
+	virt_addr_t va;
+	unsigned int nr_pages;
+};
+
+void infos::mm::VMA::shootdown_ipi(void *arg)
+{
+	TLBShootdown *sd = (TLBShootdown *)arg;
+	sd->vma->flush_tlb_local(sd->va, sd->nr_pages);
+}
+
+/**
+ * Sends the range to the other CPUs that have the VMA loaded, and waits for them to drop
+ * it.  A CPU that has switched away since is told too, but only marks the VMA stale.
+ */
+void infos::mm::VMA::shootdown_remote(virt_addr_t va, unsigned int nr_pages)
+{
+	CPUMask cpus = cpus_using(_pgt_phys_base) & ~(1ull << x86arch.current_x86_cpu().index);
+	if (!cpus) return;
+
+	TLBShootdown sd;
+	sd.vma = this;
+	sd.va = va;
+	sd.nr_pages = nr_pages;
+
+	ipi_call_function(cpus, shootdown_ipi, &sd, IPIType::TLB_SHOOTDOWN);
+}
+
+void infos::mm::VMA::release_cpus_ipi(void *arg)
+{
+	infos::mm::VMA *vma = (infos::mm::VMA *)arg;
+	X86CPU& cpu = x86arch.current_x86_cpu();
+
+	if (cpu.active_pgt != vma->_pgt_phys_base) return;
+
+	asm volatile("mov %0, %%cr3" :: "r"(vpa_to_pa((virt_addr_t)__template_pml4)) : "memory");
+	cpu.active_pgt = 0;
+}
+
+/**
+ * Moves any CPU that still has the VMA loaded, because a kernel thread borrowed it after
+ * the VMA's last thread ran there, on to the kernel page tables, so that the VMA's page
+ * tables can be freed.
+ */
+void infos::mm::VMA::release_cpus()
+{
+	UniqueIRQLock l;
+
+	CPUMask cpus = cpus_using(_pgt_phys_base);
+	if (cpus) ipi_call_function(cpus, release_cpus_ipi, this, IPIType::TLB_SHOOTDOWN);
+}
+
+void infos::mm::VMA::release_pcid()
+{
+	if (_pcid == 0) return;
+
+	// Whichever VMA gets the PCID next starts with a flush, as VMAs always do, so the
+	// translations left behind don't matter.
+	UniqueIRQLock l;
+	pcid_map[_pcid / 64] &= ~(1ull << (_pcid % 64));
+	_pcid = 0;
+}
+
+void infos::mm::VMA::unmap_range(virt_addr_t va, int nr_pages)
+{
+	if (nr_pages <= 0) return;
+	
+	unmap_between(__page_base(va), __page_base(va) + ((virt_addr_t)nr_pages << __page_bits));
+}
+
+/**
+ * Unmaps the whole user half of the address space.
+ */
+void infos::mm::VMA::unmap_all()
+{
+	unmap_between(0, USER_VA_END);
+}
+
+/**
+ * Unmaps everything in [start, end), skipping over the parts of the range that have no page
+ * tables, and frees the page tables that are left empty.
+ */
+void infos::mm::VMA::unmap_between(virt_addr_t start, virt_addr_t end)
+{
+	assert(end <= USER_VA_END);
+	
+	// The TLBs are flushed once, at the end, over the span of what was unmapped, so that
+	// the other CPUs using the VMA are interrupted once, not for each page.
+	virt_addr_t flush_start = end, flush_end = start;
+
+	virt_addr_t va = start;
+	while (va < end) {
+		table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
+		va_table_indices(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
+		
+		PML4TableEntry *pml4e = &((PML4TableEntry *)_pgt_virt_base)[pml4_idx];
+		if (!pml4e->present()) {
+			va = __align_down(va, 1ull << 39) + (1ull << 39);
+			continue;
+		}
+		
+		PDPTableEntry *pdp = (PDPTableEntry *)pa_to_vpa(pml4e->base_address());
+		PDPTableEntry *pdpe = &pdp[pdp_idx];
+		if (!pdpe->present()) {
+			va = __align_down(va, 1ull << 30) + (1ull << 30);
+			continue;
+		}
+		
+		PDTableEntry *pd = (PDTableEntry *)pa_to_vpa(pdpe->base_address());
+		PDTableEntry *pde = &pd[pd_idx];
+		
+		virt_addr_t pd_end = __align_down(va, __huge_page_size) + __huge_page_size;
+		virt_addr_t stop = pd_end < end ? pd_end : end;
+		
+		bool freed_pgt = false;
+		if (!pde->present()) {
+			// Nothing to do.
+		} else if (pde->huge()) {
+			if (__huge_page_offset(va) == 0 && stop == pd_end) {
+				release_mapped_frames(va, pde->base_address(), __huge_page_order);
+				pde->bits = 0;
+				freed_pgt = true;
+				
+				if (va < flush_start) flush_start = va;
+				flush_end = pd_end;
+			} else if (split_huge_page(va)) {
+				// Go round again, to unmap the small pages.
+				continue;
+			} else {
+				mm_log.messagef(LogLevel::WARNING, "vma: not unmapping part of the huge page at 0x%lx", __align_down(va, __huge_page_size));
+			}
+		} else {
+			PTTableEntry *pt = (PTTableEntry *)pa_to_vpa(pde->base_address());
+			
+			for (virt_addr_t page_va = va; page_va < stop; page_va += __page_size) {
+				PTTableEntry *pte = &pt[(page_va >> __page_bits) & 0x1ff];
+				if (pte->bits == 0) continue;
+				
+				if (pte->present()) {
+					release_mapped_frames(page_va, pte->base_address(), 0);
+
+					if (page_va < flush_start) flush_start = page_va;
+					flush_end = page_va + __page_size;
+				} else if (is_swap_cookie((uint32_t)(pte->bits >> 12))) {
+					swap_release((uint32_t)(pte->bits >> 12));
+				}
+				
+				// This also clears out demand-paging cookies.
+				pte->bits = 0;
+			}
+			
+			if (pgt_empty(pt)) {
+				free_pgt_entry(*this, pde);
+				freed_pgt = true;
+			}
+		}
+		
+		// Give back the page directory and PDP table, if they have been left empty too.
+		if (freed_pgt && pgt_empty(pd)) {
+			free_pgt_entry(*this, pdpe);
+			
+			if (pgt_empty(pdp)) {
+				free_pgt_entry(*this, pml4e);
+			}
+		}
+		
+		va = stop;
+	}
+	
+	if (flush_end > flush_start) {
+		invalidate_range(flush_start, (flush_end - flush_start) >> __page_bits);
+	}
+
+	// Forget the files that were mapped in the range, keeping the parts of the
+	// mappings either side of it.
+	util::IntervalTree<infos::fs::File *>::Node *fm;
+	while ((fm = _file_mappings.lowest_overlapping(start, end)) != NULL) {
+		virt_addr_t fm_start = fm->start, fm_end = fm->end;
+		infos::fs::File *file = fm->value;
+		
+		_file_mappings.remove(fm_start);
+		if (fm_start < start) _file_mappings.insert(fm_start, start, file);
+		if (fm_end > end) _file_mappings.insert(end, fm_end, file);
+	}
+	
+	_free_ranges.release(start, end);
+}
+
+bool infos::mm::VMA::map_file(virt_addr_t va, int nr_pages, infos::fs::File& file, uint64_t offset, bool writable)
+{
+	if (nr_pages <= 0 || __page_offset(va) || __page_offset(offset)) return false;
+	
+	virt_addr_t size = (virt_addr_t)nr_pages << __page_bits;
+	if (va + size > USER_VA_END || offset + size - __page_size > 0xfffff000ull) return false;
+	
+	if (!create_unused_ptes(va, nr_pages)) return false;
+	
+	for (int i = 0; i < nr_pages; i++) {
+		virt_addr_t page_va = va + ((virt_addr_t)i << __page_bits);
+		uint32_t cookie = make_demand_page_cookie(offset + ((uint64_t)i << __page_bits), DPC_DEMAND | (writable ? DPC_WRITABLE : 0));
+		
+		if (!set_pte_cookie(page_va, cookie)) return false;
+	}
+	
+	_file_mappings.insert(va, va + size, &file);
+	return true;
+}
+
+bool infos::mm::VMA::map_file_any(int nr_pages, infos::fs::File& file, uint64_t offset, bool writable, virt_addr_t& va)
+{
+	if (nr_pages <= 0) return false;
+	
+	if (!_free_ranges.allocate((size_t)nr_pages << __page_bits, __page_size, va)) {
+		mm_log.messagef(LogLevel::WARNING, "vma: no free virtual range for %d pages", nr_pages);
+		return false;
+	}
+	
+	if (!map_file(va, nr_pages, file, offset, writable)) {
+		unmap_range(va, nr_pages);
+		return false;
+	}
+	
+	return true;
+}
+
+bool infos::mm::VMA::map_zero_fill(virt_addr_t va, int nr_pages, bool writable)
+{
+	if (nr_pages <= 0 || __page_offset(va)) return false;
+	if (va + ((virt_addr_t)nr_pages << __page_bits) > USER_VA_END) return false;
+	
+	if (!create_unused_ptes(va, nr_pages)) return false;
+	
+	uint32_t cookie = make_demand_page_cookie(0, DPC_ZERO | (writable ? DPC_WRITABLE : 0));
+	for (int i = 0; i < nr_pages; i++) {
+		if (!set_pte_cookie(va + ((virt_addr_t)i << __page_bits), cookie)) return false;
+	}
+	
+	return true;
+}
+
+bool infos::mm::VMA::map_zero_fill_any(int nr_pages, bool writable, virt_addr_t& va)
+{
+	if (nr_pages <= 0) return false;
+	
+	if (!_free_ranges.allocate((size_t)nr_pages << __page_bits, __page_size, va)) {
+		mm_log.messagef(LogLevel::WARNING, "vma: no free virtual range for %d pages", nr_pages);
+		return false;
+	}
+	
+	if (!map_zero_fill(va, nr_pages, writable)) {
+		unmap_range(va, nr_pages);
+		return false;
+	}
+	
+	return true;
+}
+
+infos::fs::File *infos::mm::VMA::file_mapping_bounds(virt_addr_t va, virt_addr_t& start, virt_addr_t& end) const
+{
+	// Is the address in a file mapping?  If so, that's where the pages stop.
+	auto fm = _file_mappings.lowest_overlapping(va, va + 1);
+	if (fm) {
+		if (fm->start > start) start = fm->start;
+		if (fm->end < end) end = fm->end;
+		return fm->value;
+	}
+	
+	// Otherwise, the pages stop at the file mappings either side.
+	virt_addr_t min_start = 0;
+	while ((fm = _file_mappings.lowest_overlapping(start, end, min_start)) != NULL) {
+		if (fm->end <= va) {
+			start = fm->end;
+		} else {
+			end = fm->start;
+			break;
+		}
+		
+		min_start = fm->start + 1;
+	}
+	
+	return NULL;
+}
+
+bool infos::mm::VMA::create_unused_ptes(virt_addr_t va, int nr_pages)
+{
+	if (nr_pages > 0) _free_ranges.reserve(va, va + ((virt_addr_t)nr_pages << __page_bits));
+	
+	while (nr_pages > 0) {
+		int nr_run = nr_pages;
+		PTTableEntry *pte = get_or_create_pte_run(*this, _pgt_virt_base, va, nr_run);
+		if (!pte) return false;
+		
+		for (int i = 0; i < nr_run; i++) {
+			if (pte[i].present()) return false;
+		}
+		
+		va += (virt_addr_t)nr_run << __page_bits;
+		nr_pages -= nr_run;
+	}
+	
+	return true;
+}
+
+bool infos::mm::VMA::is_mapped(virt_addr_t va)
+{
+	phys_addr_t pa;
+	return get_mapping(va, pa);
+}
+
+bool infos::mm::VMA::get_mapping(virt_addr_t va, phys_addr_t& pa)
+{
+	if (!_pgt_virt_base) return false;
+	
+	table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
+	va_table_indices(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
+	
+	PML4TableEntry *pml4e = &((PML4TableEntry *)_pgt_virt_base)[pml4_idx];
+	
+	if (!pml4e->present()) {
+		return false;
+	}
+	
+	PDPTableEntry *pdpe = &((PDPTableEntry *)pa_to_vpa(pml4e->base_address()))[pdp_idx];
+	
+	if (!pdpe->present()) {
+		return false;
+	}
+	
+	// The kernel's mappings may be 1GB pages.
+	if (pdpe->huge()) {
+		pa = (pdpe->base_address() & ~((1ull << 30) - 1)) | (va & ((1ull << 30) - 1));
+		return true;
+	}
+	
+	PDTableEntry *pde = &((PDTableEntry *)pa_to_vpa(pdpe->base_address()))[pd_idx];
+	
+	if (!pde->present()) {
+		return false;
+	}
+	
+	if (pde->huge()) {
+		pa = pde->base_address() | __huge_page_offset(va);
+		return true;
+	}
+	
+	PTTableEntry *pte = &((PTTableEntry *)pa_to_vpa(pde->base_address()))[pt_idx];
+	
+	if (!pte->present()) {
+		return false;
+	}
+	
+	pa = pte->base_address() | __page_offset(va);
+	return true;
+}
+
+bool infos::mm::VMA::get_user_mapping(virt_addr_t va, phys_addr_t& pa, bool write)
+{
+	if (va >= USER_VA_END) return false;
+	
+	// Zero-fill pages need no I/O, so they are filled in here, as a fault would.
+	uint32_t cookie;
+	if (get_pte_cookie(va, cookie) && (cookie & DPC_DEMAND) && (cookie & DPC_ZERO)) {
+		if (!allocate_virt(__align_down_page(va), 1, (cookie & DPC_WRITABLE) ? PTE_WRITABLE : 0)) return false;
+	}
+	
+	table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
+	va_table_indices(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
+	
+	PML4TableEntry *pml4e = &((PML4TableEntry *)_pgt_virt_base)[pml4_idx];
+	if (!pml4e->present()) return false;
+	
+	PDPTableEntry *pdpe = &((PDPTableEntry *)pa_to_vpa(pml4e->base_address()))[pdp_idx];
+	if (!pdpe->present()) return false;
+	
+	// A page that is being collapsed into a huge page can't be waited for with
+	// interrupts disabled, so it counts as not resident.
+	PDTableEntry *pde = &((PDTableEntry *)pa_to_vpa(pdpe->base_address()))[pd_idx];
+	if (!pde->present()) return false;
+	
+	if (pde->huge()) {
+		if (!pde->user() || (write && !pde->writable())) return false;
+		
+		pa = pde->base_address() | __huge_page_offset(va);
+		return true;
+	}
+	
+	PTTableEntry *pte = &((PTTableEntry *)pa_to_vpa(pde->base_address()))[pt_idx];
+	if (!pte->present() || !pte->user()) return false;
+	
+	// Break the sharing of a copy-on-write page, as a write to it would.
+	if (write && !pte->writable()) {
+		if (!pte->cow() || !handle_cow_fault(va)) return false;
+	}
+	
+	pa = pte->base_address() | __page_offset(va);
+	return true;
+}
+
+bool infos::mm::VMA::get_pte_cookie(virt_addr_t va, uint32_t& cookie)
+{
+	PTTableEntry *pte = find_pte(_pgt_virt_base, va);
+	if (!pte || pte->present()) return false;
+	
+	// extract bits 12..43 inclusive -- this is where the cookie is stored
+	uint64_t mask_12_43 = ((1ul<<44) - 1) & ~((1ul<<12) - 1);
+	// what we just made is the following 64-bit number (shown in binary):
+	// 0000000000000000000011111111111111111111111111111111000000000000
+	// NOTE: here 'cookie' is being returned by reference back to the caller
+	cookie = (uint32_t)((pte->bits & mask_12_43) >> 12);
+	return true;
+
+}
+bool infos::mm::VMA::copy_to(virt_addr_t dest_va, const void* src, size_t size)
+{
+	phys_addr_t pa;
+	if (!get_mapping(dest_va, pa))
+		return false;
+	
+	void *dest = (void *)pa_to_vpa(pa);
+	
+	//mm_log.messagef(LogLevel::DEBUG, "vma: copy-to dst=va=%p:pa=%p:vpa=%p src=%p size=%p", dest_va, pa, dest, src, size);
+	memcpy(dest, src, size);
+	
+	return true;
+}
+
+/**
+ * Shares a present (small) page with another VMA.  Writable pages become read-only and
+ * copy-on-write in both VMAs.
+ */
+static void share_cow_page(PTTableEntry *src, PTTableEntry *dest)
+{
+	FrameDescriptor *pfdescr = sys.mm().pgalloc().vpa_to_pfdescr(pa_to_vpa(src->base_address()));
+
+	// A frame that isn't shared yet is mapped by the source VMA alone.
+	if (__atomic_load_n(&pfdescr->refcount, __ATOMIC_RELAXED) == 0) {
+		pfdescr->refcount = 1;
+	}
+	__atomic_add_fetch(&pfdescr->refcount, 1, __ATOMIC_RELAXED);
+
+	if (src->writable() || src->cow()) {
+		src->writable(false);
+		src->cow(true);
+	}
+
+	dest->bits = src->bits;
+}
+
+bool infos::mm::VMA::clone_into(VMA& dest)
+{
+	bool source_active = false;
+	{
+		source_active = is_active();
+	}
+
+	PML4TableEntry *pml4 = (PML4TableEntry *)_pgt_virt_base;
+
+	// Only the user half of the address space is cloned: the kernel half is shared anyway.
+	for (unsigned int pml4_idx = 0; pml4_idx < 0x100; pml4_idx++) {
+		if (!pml4[pml4_idx].present()) continue;
+
+		PDPTableEntry *pdp = (PDPTableEntry *)pa_to_vpa(pml4[pml4_idx].base_address());
+		for (unsigned int pdp_idx = 0; pdp_idx < 0x200; pdp_idx++) {
+			if (!pdp[pdp_idx].present()) continue;
+			assert(!pdp[pdp_idx].huge());
+
+			PDTableEntry *pd = (PDTableEntry *)pa_to_vpa(pdp[pdp_idx].base_address());
+			for (unsigned int pd_idx = 0; pd_idx < 0x200; pd_idx++) {
+				// A huge page that is being collapsed (or split) is waited for,
+				// rather than left out of the clone.
+				while (__atomic_load_n(&pd[pd_idx].bits, __ATOMIC_ACQUIRE) == PDE_COLLAPSING) {
+					asm volatile("pause");
+				}
+
+				if (!pd[pd_idx].present()) continue;
+
+				virt_addr_t pd_va = (virt_addr_t)pml4_idx << 39 | (virt_addr_t)pdp_idx << 30 | (virt_addr_t)pd_idx << 21;
+
+				if (pd[pd_idx].huge()) {
+					// Huge pages are copied straight away, rather than shared.
+					if (!dest.allocate_virt(pd_va, 1 << __huge_page_order, pd[pd_idx].writable() ? PTE_WRITABLE : 0)) {
+						return false;
+					}
+
+					for (unsigned int i = 0; i < (1u << __huge_page_order); i++) {
+						virt_addr_t va = pd_va + ((virt_addr_t)i << __page_bits);
+						dest.copy_to(va, (const void *)pa_to_vpa(pd[pd_idx].base_address() + ((phys_addr_t)i << __page_bits)), __page_size);
+					}
+
+					continue;
+				}
+
+				PTTableEntry *pt = (PTTableEntry *)pa_to_vpa(pd[pd_idx].base_address());
+				for (unsigned int pt_idx = 0; pt_idx < 0x200; pt_idx++) {
+					// Entries that are neither present nor hold a cookie are unused.
+					if (pt[pt_idx].bits == 0) continue;
+
+					virt_addr_t va = pd_va | (virt_addr_t)pt_idx << 12;
+
+					PTTableEntry *dest_pte = get_or_create_pte(dest, dest._pgt_virt_base, va);
+					if (!dest_pte) return false;
+					assert(dest_pte->bits == 0);
+
+					if (pt[pt_idx].present()) {
+						share_cow_page(&pt[pt_idx], dest_pte);
+						dest._nr_shared_frames++;
+					} else {
+						// The clone holds on to the swap slot, too.
+						if (is_swap_cookie((uint32_t)(pt[pt_idx].bits >> 12))) {
+							swap_duplicate((uint32_t)(pt[pt_idx].bits >> 12));
+						}
+
+						dest_pte->bits = pt[pt_idx].bits;
+					}
+				}
+			}
+		}
+	}
+
+	// Writable pages in this VMA have just become read-only, on every CPU that has used it.
+	__atomic_store_n(&_tlb_stale, ~0ull, __ATOMIC_RELAXED);
+	if (source_active) activate();
+	shootdown_remote(0, ~0u);
+
+	// The clone uses exactly the same parts of the address space, mapped from the
+	// same files.
+	dest._free_ranges.copy_from(_free_ranges);
+
+	util::IntervalTree<infos::fs::File *>::Node *fm = NULL;
+	while ((fm = _file_mappings.lowest_overlapping(0, USER_VA_END, fm ? fm->start + 1 : 0)) != NULL) {
+		dest._file_mappings.insert(fm->start, fm->end, fm->value);
+	}
+
+	return true;
+}
+
+bool infos::mm::VMA::map_text_page(virt_addr_t va)
+{
+	if (!_text_source) return false;
+
+	PTTableEntry *src = find_pte(_text_source->_pgt_virt_base, va);
+	if (!src || !src->present()) return false;
+
+	PTTableEntry *dest = get_or_create_pte(*this, _pgt_virt_base, va);
+	if (!dest) return false;
+
+	share_cow_page(src, dest);
+	_nr_shared_frames++;
+	return true;
+}
+
+bool infos::mm::VMA::add_text_page(virt_addr_t va, const void *data)
+{
+	if (!_text_source) return false;
+
+	va = __page_base(va);
+	if (!_text_source->is_mapped(va)) {
+		if (!_text_source->allocate_virt(va, 1, 0)) return false;
+		_text_source->copy_to(va, data, __page_size);
+	}
+
+	return map_text_page(va);
+}
+
+bool infos::mm::VMA::handle_cow_fault(virt_addr_t va)
+{
+	PTTableEntry *pte = find_pte(_pgt_virt_base, va);
+	if (!pte || !pte->present() || !pte->cow()) return false;
+
+	virt_addr_t page_va = __page_base(va);
+	FrameDescriptor *pfdescr = sys.mm().pgalloc().vpa_to_pfdescr(pa_to_vpa(pte->base_address()));
+
+	auto node = _mapped_frames.find(page_va);
+
+	// The other holders may be letting go of the frame, or copying it, at the same time,
+	// so whether this VMA has it to itself is decided by taking the count from one to
+	// zero in one step.
+	uint32_t refs = __atomic_load_n(&pfdescr->refcount, __ATOMIC_RELAXED);
+	while (refs == 1 && !__atomic_compare_exchange_n(&pfdescr->refcount, &refs, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	if (refs > 1) {
+		// Something else still maps the frame, so take a private copy of it.
+		FrameDescriptor *copy = sys.mm().pgalloc().allocate(0);
+		if (!copy) return false;
+
+		pcopy_nt((void *)sys.mm().pgalloc().pfdescr_to_vpa(copy), (const void *)pa_to_vpa(pte->base_address()));
+		pte->base_address(sys.mm().pgalloc().pfdescr_to_pa(copy));
+
+		// The others may all have let go while it was copied, in which case this was
+		// the last hold, and the frame is freed.
+		if (__atomic_sub_fetch(&pfdescr->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+			sys.mm().pgalloc().free(pfdescr, 0);
+		}
+
+		if (node) {
+			node->value.descriptor_base = copy;
+		} else {
+			_nr_shared_frames--;
+			record_mapped_frames(page_va, copy, 0);
+		}
+	} else {
+		// Everything else that shared the frame has let go of it already, so it
+		// belongs to this VMA now.
+		if (!node) {
+			_nr_shared_frames--;
+			record_mapped_frames(page_va, pfdescr, 0);
+		}
+	}
+
+	pte->cow(false);
+	pte->writable(true);
+	flush_tlb_page(page_va);
+
+	return true;
+}
+
+/**
+ * Calls fn(va, pte) for the 4 KiB pages of the user half of the address space, going round
+ * it like the hand of a clock: from 'hand', at most once, and over at most 'scan' pages,
+ * leaving 'hand' where the walk stopped.  Parts of it with no page tables are skipped,
+ * without counting towards 'scan', and huge pages are passed over.  The walk stops early
+ * if fn returns false.
+ */
+template<typename Fn>
+void infos::mm::VMA::walk_from_hand(virt_addr_t& hand, unsigned int scan, Fn fn)
+{
+	virt_addr_t va = hand;
+	virt_addr_t stop_at = va;
+	bool wrapped = false, more = true;
+
+	while (more && scan > 0) {
+		if (va >= USER_VA_END) {
+			va = 0;
+			wrapped = true;
+		}
+
+		if (wrapped && va >= stop_at) break;
+
+		table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
+		va_table_indices(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
+
+		PML4TableEntry *pml4e = &((PML4TableEntry *)_pgt_virt_base)[pml4_idx];
+		if (!pml4e->present()) {
+			va = __align_down(va, 1ull << 39) + (1ull << 39);
+			continue;
+		}
+
+		PDPTableEntry *pdpe = &((PDPTableEntry *)pa_to_vpa(pml4e->base_address()))[pdp_idx];
+		if (!pdpe->present()) {
+			va = __align_down(va, 1ull << 30) + (1ull << 30);
+			continue;
+		}
+
+		virt_addr_t pd_end = __align_down(va, __huge_page_size) + __huge_page_size;
+
+		PDTableEntry *pde = &((PDTableEntry *)pa_to_vpa(pdpe->base_address()))[pd_idx];
+		if (!pde->present() || pde->huge()) {
+			va = pd_end;
+			continue;
+		}
+
+		PTTableEntry *pt = (PTTableEntry *)pa_to_vpa(pde->base_address());
+		if (wrapped && pd_end > stop_at) pd_end = stop_at;
+
+		for (; va < pd_end && more && scan > 0; va += __page_size, scan--) {
+			more = fn(va, &pt[(va >> __page_bits) & 0x1ff]);
+		}
+	}
+
+	hand = va;
+}
+
+unsigned int infos::mm::VMA::unmap_for_swap(SwapOutPage *pages, unsigned int max, uint32_t first_slot, unsigned int scan, unsigned int min_age)
+{
+	unsigned int nr = 0;
+	if (!max) return 0;
+
+	// Huge pages stay where they are.
+	walk_from_hand(_swap_hand, scan, [&](virt_addr_t va, PTTableEntry *pte) {
+		if (!pte->present() || !pte->user() || pte->cow()) return true;
+
+		if (pte->get_flag(PTE_ACCESSED)) {
+			pte->set_flag(PTE_ACCESSED, false);
+			pte->age(0);
+			return true;
+		}
+
+		if (pte->age() < min_age) return true;
+
+		// Only frames that were allocated for this VMA, and that nothing else
+		// shares, can go.
+		FrameDescriptor *pfdescr = sys.mm().pgalloc().vpa_to_pfdescr(pa_to_vpa(pte->base_address()));
+		if (__atomic_load_n(&pfdescr->refcount, __ATOMIC_RELAXED) > 0) return true;
+
+		auto node = _mapped_frames.find(va);
+		if (!node || node->value.allocation_order != 0) return true;
+
+		_mapped_frames.remove(va);
+		_nr_private_frames--;
+
+		SwapOutPage& page = pages[nr];
+		page.va = va;
+		page.frame = pfdescr;
+		page.cookie = make_swap_cookie(first_slot + nr, pte->writable());
+		nr++;
+
+		pte->bits = (uint64_t)page.cookie << 12;
+		return nr < max;
+	});
+
+	return nr;
+}
+
+void infos::mm::VMA::age_pages(unsigned int scan)
+{
+	virt_addr_t flush_start = ~0ull, flush_end = 0;
+	virt_addr_t last_va = _age_hand;
+
+	walk_from_hand(_age_hand, scan, [&](virt_addr_t va, PTTableEntry *pte) {
+		// The hand has gone round to the start again, so the pass is over.
+		if (va < last_va) {
+			uint64_t nr_passes = _ages.nr_passes + 1;
+
+			_ages = _pass_ages;
+			_ages.nr_passes = nr_passes;
+			bzero(&_pass_ages, sizeof(_pass_ages));
+		}
+
+		last_va = va;
+
+		PTTableEntry aged;
+		aged.bits = __atomic_load_n(&pte->bits, __ATOMIC_RELAXED);
+		if (!aged.present() || !aged.user()) return true;
+
+		uint64_t expected = aged.bits;
+		if (aged.get_flag(PTE_ACCESSED)) {
+			aged.set_flag(PTE_ACCESSED, false);
+			aged.age(0);
+
+			flush_start = __min(flush_start, va);
+			flush_end = __max(flush_end, va);
+		} else if (aged.age() < PTE_MAX_AGE) {
+			aged.age(aged.age() + 1);
+		}
+
+		// Whatever else changes the PTE meanwhile (e.g. a copy-on-write fault) wins,
+		// and the page is aged again next time round.
+		if (aged.bits != expected) {
+			__atomic_compare_exchange_n(&pte->bits, &expected, aged.bits, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+		}
+
+		_pass_ages.nr_pages[aged.age()]++;
+		return true;
+	});
+
+	if (flush_start > flush_end) return;
+
+	uint64_t nr_flush = ((flush_end - flush_start) >> __page_bits) + 1;
+	invalidate_range(flush_start, (unsigned int)__min(nr_flush, ~0u));
+}
+
+bool infos::mm::VMA::remap_swapped_page(const SwapOutPage& page)
+{
+	uint32_t cookie;
+	if (!get_pte_cookie(page.va, cookie) || cookie != page.cookie) return false;
+
+	PTTableEntry *pte = find_pte(_pgt_virt_base, page.va);
+	fill_pte(pte, sys.mm().pgalloc().pfdescr_to_pa(page.frame), PTE_PRESENT | PTE_ALLOW_USER | ((cookie & DPC_WRITABLE) ? PTE_WRITABLE : 0));
+	record_mapped_frames(page.va, page.frame, 0);
+
+	return true;
+}
+
+/**
+ * Calls fn(va, pte, frame) for each of the VMA's pages that compaction can move: 4 KiB
+ * user pages whose frames were allocated for this VMA, that nothing else shares, and
+ * that aren't copy-on-write.  The walk stops if fn returns false.
+ */
+template<typename Fn>
+void infos::mm::VMA::for_each_movable_page(Fn fn)
+{
+	virt_addr_t va = 0;
+
+	while (va < USER_VA_END) {
+		table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
+		va_table_indices(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
+
+		PML4TableEntry *pml4e = &((PML4TableEntry *)_pgt_virt_base)[pml4_idx];
+		if (!pml4e->present()) {
+			va = __align_down(va, 1ull << 39) + (1ull << 39);
+			continue;
+		}
+
+		PDPTableEntry *pdpe = &((PDPTableEntry *)pa_to_vpa(pml4e->base_address()))[pdp_idx];
+		if (!pdpe->present()) {
+			va = __align_down(va, 1ull << 30) + (1ull << 30);
+			continue;
+		}
+
+		virt_addr_t pd_end = __align_down(va, __huge_page_size) + __huge_page_size;
+
+		PDTableEntry *pde = &((PDTableEntry *)pa_to_vpa(pdpe->base_address()))[pd_idx];
+		if (!pde->present() || pde->huge()) {
+			va = pd_end;
+			continue;
+		}
+
+		PTTableEntry *pt = (PTTableEntry *)pa_to_vpa(pde->base_address());
+
+		for (; va < pd_end; va += __page_size) {
+			PTTableEntry *pte = &pt[(va >> __page_bits) & 0x1ff];
+			if (!pte->present() || !pte->user() || pte->cow()) continue;
+
+			FrameDescriptor *pfdescr = sys.mm().pgalloc().vpa_to_pfdescr(pa_to_vpa(pte->base_address()));
+			if (__atomic_load_n(&pfdescr->refcount, __ATOMIC_RELAXED) > 0) continue;
+
+			auto node = _mapped_frames.find(va);
+			if (!node || node->value.allocation_order != 0) continue;
+
+			if (!fn(va, pte, pfdescr)) return;
+		}
+	}
+}
+
+void infos::mm::VMA::mark_movable_frames(uint64_t *map, uint64_t nr_frames)
+{
+	for_each_movable_page([&](virt_addr_t va, PTTableEntry *pte, FrameDescriptor *pfdescr) {
+		pfn_t pfn = sys.mm().pgalloc().pfdescr_to_pfn(pfdescr);
+		if (pfn < nr_frames) map[pfn / 64] |= 1ull << (pfn % 64);
+
+		return true;
+	});
+}
+
+unsigned int infos::mm::VMA::find_pages_to_migrate(pfn_t start, pfn_t end, MigratePage *pages, unsigned int max)
+{
+	unsigned int nr = 0;
+	if (!max) return 0;
+
+	for_each_movable_page([&](virt_addr_t va, PTTableEntry *pte, FrameDescriptor *pfdescr) {
+		pfn_t pfn = sys.mm().pgalloc().pfdescr_to_pfn(pfdescr);
+		if (pfn < start || pfn >= end) return true;
+
+		pages[nr].va = va;
+		pages[nr].from = pfdescr;
+		pages[nr].to = NULL;
+		pages[nr].moved = false;
+
+		return ++nr < max;
+	});
+
+	return nr;
+}
+
+unsigned int infos::mm::VMA::migrate_pages(MigratePage *pages, unsigned int nr)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	virt_addr_t flush_start = ~0ull, flush_end = 0;
+
+	// First, check that each page is still where it was found, and write-protect it.
+	// The accessed bit is set now, so that the hardware has no reason to change the PTE.
+	for (unsigned int i = 0; i < nr; i++) {
+		MigratePage& page = pages[i];
+		page.moved = false;
+		page.pte_bits = 0;
+
+		PTTableEntry *pte = find_pte(_pgt_virt_base, page.va);
+		if (!pte || !pte->present() || pte->cow() || pte->base_address() != pgalloc.pfdescr_to_pa(page.from)) continue;
+		if (__atomic_load_n(&page.from->refcount, __ATOMIC_RELAXED) > 0) continue;
+
+		auto node = _mapped_frames.find(page.va);
+		if (!node || node->value.descriptor_base != page.from || node->value.allocation_order != 0) continue;
+
+		PTTableEntry protect = *pte;
+		protect.set_flag(PTE_ACCESSED, true);
+		if (protect.writable()) {
+			protect.writable(false);
+			protect.cow(true);
+		}
+
+		page.pte_bits = protect.bits;
+		__atomic_store_n(&pte->bits, protect.bits, __ATOMIC_RELEASE);
+
+		flush_start = __min(flush_start, page.va);
+		flush_end = __max(flush_end, page.va);
+	}
+
+	if (flush_start > flush_end) return 0;
+
+	// Once the TLBs have been flushed, nothing can write to the old frames.
+	uint64_t nr_flush = ((flush_end - flush_start) >> __page_bits) + 1;
+	invalidate_range(flush_start, (unsigned int)__min(nr_flush, ~0u));
+
+	unsigned int nr_moved = 0;
+	for (unsigned int i = 0; i < nr; i++) {
+		MigratePage& page = pages[i];
+		if (!page.pte_bits) continue;
+
+		pcopy_nt((void *)pgalloc.pfdescr_to_vpa(page.to), (const void *)pgalloc.pfdescr_to_vpa(page.from));
+
+		// A write fault meanwhile will have made the PTE writable again, in place.
+		PTTableEntry moved;
+		moved.bits = page.pte_bits;
+		moved.base_address(pgalloc.pfdescr_to_pa(page.to));
+		if (moved.cow()) {
+			moved.cow(false);
+			moved.writable(true);
+		}
+
+		PTTableEntry *pte = find_pte(_pgt_virt_base, page.va);
+		uint64_t expected = page.pte_bits;
+		if (!__atomic_compare_exchange_n(&pte->bits, &expected, moved.bits, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) continue;
+
+		_mapped_frames.find(page.va)->value.descriptor_base = page.to;
+		page.moved = true;
+		nr_moved++;
+	}
+
+	// The old translations must be gone before the old frames are freed.
+	invalidate_range(flush_start, (unsigned int)__min(nr_flush, ~0u));
+
+	return nr_moved;
+}
+
+unsigned int infos::mm::VMA::find_merge_candidates(MergePage *pages, unsigned int max, unsigned int scan)
+{
+	unsigned int nr = 0;
+	if (!max) return 0;
+
+	walk_from_hand(_merge_hand, scan, [&](virt_addr_t va, PTTableEntry *pte) {
+		if (!pte->present() || !pte->user() || pte->cow()) return true;
+
+		FrameDescriptor *pfdescr = sys.mm().pgalloc().vpa_to_pfdescr(pa_to_vpa(pte->base_address()));
+		if (__atomic_load_n(&pfdescr->refcount, __ATOMIC_RELAXED) > 0) return true;
+
+		auto node = _mapped_frames.find(va);
+		if (!node || node->value.allocation_order != 0) return true;
+
+		pages[nr].va = va;
+		pages[nr].frame = pfdescr;
+
+		return ++nr < max;
+	});
+
+	return nr;
+}
+
+static bool frames_equal(const void *a, const void *b)
+{
+	const uint64_t *pa = (const uint64_t *)a, *pb = (const uint64_t *)b;
+
+	for (unsigned int i = 0; i < __page_size / sizeof(uint64_t); i++) {
+		if (pa[i] != pb[i]) return false;
+	}
+
+	return true;
+}
+
+bool infos::mm::VMA::merge_page(const MergePage& page, FrameDescriptor *into, bool fill)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	// As with migrate_pages(), the page is write-protected first, so that once the TLBs
+	// are flushed its frame can't change under the copy or the comparison.
+	PTTableEntry *pte = find_pte(_pgt_virt_base, page.va);
+	if (!pte || !pte->present() || pte->cow() || pte->base_address() != pgalloc.pfdescr_to_pa(page.frame)) return false;
+	if (__atomic_load_n(&page.frame->refcount, __ATOMIC_RELAXED) > 0) return false;
+
+	auto node = _mapped_frames.find(page.va);
+	if (!node || node->value.descriptor_base != page.frame || node->value.allocation_order != 0) return false;
+
+	uint64_t original = pte->bits;
+
+	PTTableEntry protect = *pte;
+	protect.set_flag(PTE_ACCESSED, true);
+	if (protect.writable()) {
+		protect.writable(false);
+		protect.cow(true);
+	}
+
+	__atomic_store_n(&pte->bits, protect.bits, __ATOMIC_RELEASE);
+	invalidate_range(page.va, 1);
+
+	if (fill) {
+		pcopy_nt((void *)pgalloc.pfdescr_to_vpa(into), (const void *)pgalloc.pfdescr_to_vpa(page.frame));
+	} else if (!frames_equal((const void *)pgalloc.pfdescr_to_vpa(into), (const void *)pgalloc.pfdescr_to_vpa(page.frame))) {
+		// A write fault meanwhile will have made the page writable again already.
+		uint64_t expected = protect.bits;
+		__atomic_compare_exchange_n(&pte->bits, &expected, original, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	// The page stays copy-on-write (if it was writable), now that the frame is shared.
+	PTTableEntry merged = protect;
+	merged.base_address(pgalloc.pfdescr_to_pa(into));
+
+	__atomic_add_fetch(&into->refcount, 1, __ATOMIC_RELAXED);
+
+	uint64_t expected = protect.bits;
+	if (!__atomic_compare_exchange_n(&pte->bits, &expected, merged.bits, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+		__atomic_sub_fetch(&into->refcount, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	_mapped_frames.remove(page.va);
+	_nr_private_frames--;
+	_nr_shared_frames++;
+
+	// The old translation must be gone before the old frame is freed.
+	invalidate_range(page.va, 1);
+
+	return true;
+}
+
+bool infos::mm::VMA::collapse_in_progress(virt_addr_t va)
+{
+	PDTableEntry *pde = find_pde(_pgt_virt_base, va);
+	return pde && __atomic_load_n(&pde->bits, __ATOMIC_ACQUIRE) == PDE_COLLAPSING;
+}
+
+/**
+ * Returns true if the pages under a page table can be collapsed into a huge page at 'va':
+ * all of them are present, with the same permissions, and are backed by frames that were
+ * allocated for this VMA, and that nothing else shares.
+ */
+bool infos::mm::VMA::can_collapse(phys_addr_t pt_pa, virt_addr_t va)
+{
+	const PTTableEntry *pt = (const PTTableEntry *)pa_to_vpa(pt_pa);
+	bool writable = pt[0].writable();
+
+	for (unsigned int i = 0; i < 0x200; i++) {
+		const PTTableEntry *pte = &pt[i];
+		if (!pte->present() || !pte->user() || pte->cow() || pte->writable() != writable) return false;
+		if (pte->bits & PTE_CACHE_MASK) return false;
+
+		FrameDescriptor *pfdescr = sys.mm().pgalloc().vpa_to_pfdescr(pa_to_vpa(pte->base_address()));
+		if (__atomic_load_n(&pfdescr->refcount, __ATOMIC_RELAXED) > 0) return false;
+
+		auto node = _mapped_frames.find(va + ((virt_addr_t)i << __page_bits));
+		if (!node || node->value.descriptor_base != pfdescr || node->value.allocation_order != 0) return false;
+	}
+
+	return true;
+}
+
+bool infos::mm::VMA::find_collapsible_range(unsigned int scan, virt_addr_t& va)
+{
+	// Like walk_from_hand(), but a page directory entry at a time.
+	virt_addr_t hand = _collapse_hand;
+	virt_addr_t stop_at = hand;
+	bool wrapped = false, found = false;
+
+	while (!found && scan > 0) {
+		if (hand >= USER_VA_END) {
+			hand = 0;
+			wrapped = true;
+		}
+
+		if (wrapped && hand >= stop_at) break;
+
+		table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
+		va_table_indices(hand, pml4_idx, pdp_idx, pd_idx, pt_idx);
+
+		PML4TableEntry *pml4e = &((PML4TableEntry *)_pgt_virt_base)[pml4_idx];
+		if (!pml4e->present()) {
+			hand = __align_down(hand, 1ull << 39) + (1ull << 39);
+			continue;
+		}
+
+		PDPTableEntry *pdpe = &((PDPTableEntry *)pa_to_vpa(pml4e->base_address()))[pdp_idx];
+		if (!pdpe->present()) {
+			hand = __align_down(hand, 1ull << 30) + (1ull << 30);
+			continue;
+		}
+
+		PDTableEntry *pde = &((PDTableEntry *)pa_to_vpa(pdpe->base_address()))[pd_idx];
+		if (pde->present() && !pde->huge() && can_collapse(pde->base_address(), hand)) {
+			va = hand;
+			found = true;
+		}
+
+		hand += __huge_page_size;
+		scan--;
+	}
+
+	_collapse_hand = hand;
+	return found;
+}
+
+bool infos::mm::VMA::collapse_huge_page(virt_addr_t va, FrameDescriptor *block)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	PDTableEntry *pde = find_pde(_pgt_virt_base, va);
+	if (!pde || !pde->present() || pde->huge()) return false;
+
+	phys_addr_t pt_pa = pde->base_address();
+	if (!can_collapse(pt_pa, va)) return false;
+
+	const PTTableEntry *pt = (const PTTableEntry *)pa_to_vpa(pt_pa);
+
+	bool writable = pt[0].writable();
+
+	// Once the TLBs have been flushed, nothing can reach the pages, so the copy can't
+	// miss a write.
+	__atomic_store_n(&pde->bits, PDE_COLLAPSING, __ATOMIC_RELEASE);
+	invalidate_range(va, 0x200);
+
+	uint8_t *dest = (uint8_t *)pgalloc.pfdescr_to_vpa(block);
+	for (unsigned int i = 0; i < 0x200; i++) {
+		FrameDescriptor *pfdescr = pgalloc.vpa_to_pfdescr(pa_to_vpa(pt[i].base_address()));
+		pcopy_nt(dest + ((size_t)i << __page_bits), (const void *)pgalloc.pfdescr_to_vpa(pfdescr));
+
+		_mapped_frames.remove(va + ((virt_addr_t)i << __page_bits));
+		_nr_private_frames--;
+		pgalloc.free_one(pfdescr);
+	}
+
+	record_mapped_frames(va, block, __huge_page_order);
+
+	PDTableEntry huge;
+	huge.bits = 0;
+	huge.base_address(pgalloc.pfdescr_to_pa(block));
+	huge.present(true);
+	huge.user(true);
+	huge.huge(true);
+	if (writable) huge.writable(true);
+
+	__atomic_store_n(&pde->bits, huge.bits, __ATOMIC_RELEASE);
+	free_pgt(pgalloc.vpa_to_pfdescr(pa_to_vpa(pt_pa)));
+
+	return true;
+}
+
+/**
+ * Breaks a huge page that was allocated for this VMA into small pages, each with a frame
+ * of its own, so that part of it can be unmapped.
+ * @return Returns false, leaving the huge page as it is, if memory runs out.
+ */
+bool infos::mm::VMA::split_huge_page(virt_addr_t va)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	va = __align_down(va, __huge_page_size);
+
+	PDTableEntry *pde = find_pde(_pgt_virt_base, va);
+	assert(pde && pde->present() && pde->huge());
+
+	auto node = _mapped_frames.find(va);
+	if (!node || node->value.allocation_order != __huge_page_order) return false;
+
+	FrameDescriptor *block = node->value.descriptor_base;
+
+	FrameDescriptor *pt_pfdescr = allocate_pgt();
+	if (!pt_pfdescr) return false;
+
+	FrameDescriptor **frames = new FrameDescriptor *[0x200];
+	if (!frames || !pgalloc.allocate_bulk(0x200, frames, PageAllocFlags::NONE)) {
+		delete[] frames;
+		free_pgt(pt_pfdescr);
+		return false;
+	}
+
+	unsigned long flags = PTE_PRESENT | PTE_ALLOW_USER | (pde->writable() ? PTE_WRITABLE : 0);
+
+	// As with a collapse, the copy is made while nothing can reach the huge page.
+	__atomic_store_n(&pde->bits, PDE_COLLAPSING, __ATOMIC_RELEASE);
+	invalidate_range(va, 0x200);
+
+	_mapped_frames.remove(va);
+	_nr_private_frames -= 1u << __huge_page_order;
+
+	const uint8_t *src = (const uint8_t *)pgalloc.pfdescr_to_vpa(block);
+	PTTableEntry *pt = (PTTableEntry *)pgalloc.pfdescr_to_vpa(pt_pfdescr);
+
+	for (unsigned int i = 0; i < 0x200; i++) {
+		pcopy_nt((void *)pgalloc.pfdescr_to_vpa(frames[i]), src + ((size_t)i << __page_bits));
+		fill_pte(&pt[i], pgalloc.pfdescr_to_pa(frames[i]), flags);
+		record_mapped_frames(va + ((virt_addr_t)i << __page_bits), frames[i], 0);
+	}
+
+	delete[] frames;
+
+	PDTableEntry table;
+	table.bits = 0;
+	table.base_address(pgalloc.pfdescr_to_pa(pt_pfdescr));
+	table.present(true);
+	table.writable(true);
+	table.user(true);
+
+	__atomic_store_n(&pde->bits, table.bits, __ATOMIC_RELEASE);
+	pgalloc.free(block, __huge_page_order);
+
 	return true;
 }
 
@@ -546,7 +2733,7 @@ void infos::mm::VMA::dump()
 		if (!te[i].present()) continue;
 		if (te[i].huge()) {
 			uintptr_t va = (uint64_t)i << 36;
-			mm_log.messagef(LogLevel::DEBUG, "VMA: MAP VA=0x%lx -> PA=0x%lx", va, te[i].base_address());
+			LOG_MESSAGEF(mm_log, LogLevel::DEBUG, "VMA: MAP VA=0x%lx -> PA=0x%lx", va, te[i].base_address());
 		} else {
 			dump_pdp(i, pa_to_vpa(te[i].base_address()));
 		}
@@ -560,7 +2747,7 @@ void infos::mm::VMA::dump_pdp(int pml4, virt_addr_t pdp_va)
 		if (!te[i].present()) continue;
 		if (te[i].huge()) {
 			uintptr_t va = (uint64_t)pml4 << 36 | (uint64_t)i << 28;
-			mm_log.messagef(LogLevel::DEBUG, "VMA: MAP VA=0x%lx -> PA=0x%lx", va, te[i].base_address());	
+			LOG_MESSAGEF(mm_log, LogLevel::DEBUG, "VMA: MAP VA=0x%lx -> PA=0x%lx", va, te[i].base_address());	
 		} else {
 			dump_pd(pml4, i, pa_to_vpa(te[i].base_address()));
 		}
@@ -574,7 +2761,7 @@ void infos::mm::VMA::dump_pd(int pml4, int pdp, virt_addr_t pd_va)
 		if (!te[i].present()) continue;
 		if (te[i].huge()) {
 			uintptr_t va = (uint64_t)pml4 << 36 | (uint64_t)pdp << 28 | (uint64_t)i << 20;
-			mm_log.messagef(LogLevel::DEBUG, "VMA: MAP VA=0x%lx -> PA=0x%lx", va, te[i].base_address());
+			LOG_MESSAGEF(mm_log, LogLevel::DEBUG, "VMA: MAP VA=0x%lx -> PA=0x%lx", va, te[i].base_address());
 		} else {
 			dump_pt(pml4, pdp, i, pa_to_vpa(te[i].base_address()));
 		}
@@ -588,6 +2775,6 @@ void VMA::dump_pt(int pml4, int pdp, int pd, virt_addr_t pt_va)
 		if (!te[i].present()) continue;
 		
 		uintptr_t va = (uint64_t)pml4 << 36 | (uint64_t)pdp << 28 | (uint64_t)pd << 20 | (uint64_t)i << 12;
-		mm_log.messagef(LogLevel::DEBUG, "VMA: MAP VA=0x%lx -> PA=0x%lx", va, te[i].base_address());
+		LOG_MESSAGEF(mm_log, LogLevel::DEBUG, "VMA: MAP VA=0x%lx -> PA=0x%lx", va, te[i].base_address());
 	}
 }
@@ -12,9 +12,39 @@
 #include <arch/x86/multiboot.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/log.h>
+#include <infos/fs/initramfs.h>
+#include <infos/util/string.h>
 
 using namespace infos::arch::x86;
 using namespace infos::kernel;
+using namespace infos::util;
+
+/**
+ * Whether a module's command line has the given word in it (after the module's file
+ * name, which boot loaders usually put first).
+ */
+static bool has_tag(const char *cmdline, const char *tag)
+{
+	size_t tag_len = strlen(tag);
+
+	while (*cmdline) {
+		while (*cmdline == ' ') cmdline++;
+
+		const char *end = cmdline;
+		while (*end && *end != ' ') end++;
+
+		if ((size_t)(end - cmdline) == tag_len) {
+			size_t i = 0;
+			while (i < tag_len && cmdline[i] == tag[i]) i++;
+
+			if (i == tag_len) return true;
+		}
+
+		cmdline = end;
+	}
+
+	return false;
+}
 
 bool infos::arch::x86::modules_init()
 {
@@ -25,8 +55,20 @@ bool infos::arch::x86::modules_init()
 		uintptr_t module_end_va = pa_to_vpa(module_entry->mod_end);
 		size_t module_size = module_end_va - module_start_va;
 		
-		x86_log.messagef(LogLevel::INFO, "Loading module: %s @ 0x%lx", (char*)(uintptr_t)module_entry->cmdline, module_start_va);
-		if (!sys.module_manager().LoadModule((void *)module_start_va, module_size)) {
+		const char *module_name = (const char *)pa_to_vpa(module_entry->cmdline);
+
+		// The initramfs is kept where it is, and mounted later, rather than loaded.
+		if (has_tag(module_name, "initramfs")) {
+			x86_log.messagef(LogLevel::INFO, "Initramfs: %s @ 0x%lx (%lu bytes)", module_name, module_start_va, module_size);
+			if (!infos::fs::initramfs_set_image((const void *)module_start_va, module_size)) {
+				x86_log.message(LogLevel::WARNING, "There is already an initramfs: ignoring this one");
+			}
+
+			continue;
+		}
+		
+		x86_log.messagef(LogLevel::INFO, "Loading module: %s @ 0x%lx", module_name, module_start_va);
+		if (!sys.module_manager().LoadModule((void *)module_start_va, module_size, module_name)) {
 			x86_log.message(LogLevel::ERROR, "Error loading module");
 			return false;
 		}
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * arch/x86/percpu.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <arch/x86/percpu.h>
+#include <arch/x86/msr.h>
+#include <infos/util/string.h>
+
+using namespace infos::arch::x86;
+using namespace infos::util;
+
+extern X86CPU bsp;
+
+static_assert(__builtin_offsetof(PerCPUHeader, cpu) == 8, "syscall-trap.S and percpu_current_cpu() assume the CPU is at %gs:8");
+static_assert(__builtin_offsetof(PerCPUHeader, syscall_user_stack) == 16, "syscall-trap.S assumes the user stack is at %gs:16");
+static_assert(__builtin_offsetof(PerCPUHeader, syscall_kernel_stack) == 24, "syscall-trap.S assumes the kernel stack is at %gs:24");
+static_assert(__builtin_offsetof(PerCPUHeader, preempt_count) == 32, "trap.S and preempt.h assume the preemption count is at %gs:32");
+static_assert(__builtin_offsetof(PerCPUHeader, need_resched) == 36, "preempt.h assumes the reschedule flag is at %gs:36");
+
+// The boot CPU's header is there from the start, so that the current CPU can be found
+// before anything has been initialised.
+__section(".percpu.header") __attribute__((used)) static PerCPUHeader boot_percpu_header = { &boot_percpu_header, &bsp, 0, 0, 0, 0 };
+
+bool infos::arch::x86::percpu_init(X86CPU& cpu)
+{
+	if (&cpu == &bsp) {
+		cpu.percpu_area = (uintptr_t)__percpu_start;
+		return true;
+	}
+
+	uintptr_t size = __percpu_end - __percpu_start;
+
+	// The section is cache-line aligned, and so are the copies, so that two CPUs'
+	// variables are never in the same line.
+	char *area = new char[size + 64];
+	if (!area) return false;
+
+	area = (char *)(((uintptr_t)area + 63) & ~63ull);
+	bzero(area, size);
+
+	PerCPUHeader *header = (PerCPUHeader *)area;
+	header->self = header;
+	header->cpu = &cpu;
+
+	cpu.percpu_area = (uintptr_t)area;
+	return true;
+}
+
+void infos::arch::x86::percpu_load(X86CPU& cpu)
+{
+	__wrmsr(MSR_GS_BASE, cpu.percpu_area);
+	__wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+void infos::arch::x86::percpu_load_boot()
+{
+	__wrmsr(MSR_GS_BASE, (uintptr_t)__percpu_start);
+	__wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * arch/x86/pmu.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <arch/x86/init.h>
+#include <arch/x86/pmu.h>
+#include <arch/x86/cpu.h>
+#include <arch/x86/cpuid.h>
+#include <arch/x86/msr.h>
+#include <arch/x86/x86-arch.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/log.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/util/lock.h>
+
+using namespace infos::kernel;
+using namespace infos::arch::x86;
+using namespace infos::util;
+
+/*
+ * Counting hardware events per thread, with the architectural performance monitoring that
+ * CPUID leaf 0xA describes.  A general-purpose counter is given to each of the events in
+ * PMUEvent, counting in both user and kernel mode, and the counters are left running.  When
+ * a CPU switches threads, what they have counted since the last switch is added to the
+ * counts of the thread that was running, so switching costs a read of each counter, and
+ * nothing is written to them.
+ *
+ * Counting is off unless it is asked for with pmu=1, since reading a counter in a virtual
+ * machine can mean an exit to the hypervisor on every switch.  There is no architectural
+ * event for TLB misses, so the fourth counter can be given a model-specific event instead,
+ * with pmu.raw=<umask><event>, in hex, e.g. pmu.raw=0x0108 for event 0x08, umask 0x01.
+ */
+
+#define IA32_PMC0				0xc1
+#define IA32_PERFEVTSEL0		0x186
+#define IA32_PERF_GLOBAL_CTRL	0x38f
+
+#define PERFEVTSEL_USR			(1ull << 16)
+#define PERFEVTSEL_OS			(1ull << 17)
+#define PERFEVTSEL_EN			(1ull << 22)
+
+#define CPUID_GET_PERF_MON		0x0000000a
+
+// The events that are counted, as their event numbers and unit masks, and which bit of
+// CPUID.0xA:EBX says each isn't available.
+struct PMUEventSelect
+{
+	uint16_t select;
+	int unavailable_bit;
+};
+
+static PMUEventSelect events[PMU_NR_EVENTS] = {
+	{ 0x003c, 0 },		// UnHalted Core Cycles
+	{ 0x00c0, 1 },		// Instruction Retired
+	{ 0x412e, 4 },		// LLC Misses
+	{ 0x00c5, 6 },		// Branch Misses Retired
+};
+
+static bool pmu_requested;
+
+// Which of the events are counted, and the mask of the bits in a counter.
+static unsigned int counted;
+static uint64_t counter_mask;
+
+RegisterCmdLineArgument(PMU, "pmu")
+{
+	pmu_requested = strncmp(value, "1", 2) == 0;
+}
+
+RegisterCmdLineArgument(PMURaw, "pmu.raw")
+{
+	if (value[0] == '0' && (value[1] == 'x' || value[1] == 'X')) value += 2;
+
+	unsigned int select = 0;
+	for (const char *p = value; *p; p++) {
+		unsigned int digit;
+		if (*p >= '0' && *p <= '9') digit = *p - '0';
+		else if (*p >= 'a' && *p <= 'f') digit = *p - 'a' + 10;
+		else if (*p >= 'A' && *p <= 'F') digit = *p - 'A' + 10;
+		else break;
+
+		select = (select << 4) | digit;
+	}
+
+	if (select && select <= 0xffff) {
+		events[PMUEvent::BRANCH_MISSES].select = select;
+		events[PMUEvent::BRANCH_MISSES].unavailable_bit = -1;
+	}
+}
+
+static inline X86CPU& this_cpu()
+{
+	return (X86CPU&)x86arch.get_current_cpu();
+}
+
+static inline uint64_t rdpmc(unsigned int counter)
+{
+	uint32_t low, high;
+
+	asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+	return (uint64_t) low | (((uint64_t) high) << 32);
+}
+
+static void read_counters(uint64_t *values)
+{
+	for (unsigned int i = 0; i < PMU_NR_EVENTS; i++) {
+		values[i] = (counted & (1u << i)) ? rdpmc(i) : 0;
+	}
+}
+
+/**
+ * Programs this CPU's counters with the events that the boot CPU found, and starts them.
+ */
+void infos::arch::x86::pmu_init_cpu()
+{
+	if (!counted) return;
+
+	X86CPU& cpu = this_cpu();
+
+	for (unsigned int i = 0; i < PMU_NR_EVENTS; i++) {
+		__wrmsr(IA32_PERFEVTSEL0 + i, 0);
+		if (!(counted & (1u << i))) continue;
+
+		__wrmsr(IA32_PMC0 + i, 0);
+		__wrmsr(IA32_PERFEVTSEL0 + i, events[i].select | PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_EN);
+	}
+
+	// From version 2, the counters also have to be enabled globally.
+	if ((__cpuid(CPUID_GET_PERF_MON).rax & 0xff) >= 2) {
+		__wrmsr(IA32_PERF_GLOBAL_CTRL, (__rdmsr(IA32_PERF_GLOBAL_CTRL) & ~0xfull) | counted);
+	}
+
+	read_counters(cpu.pmu_start);
+}
+
+/**
+ * Finds out whether the CPU has enough architectural performance counters, and starts
+ * counting on the boot CPU if it does, and pmu=1 was given.
+ */
+void infos::arch::x86::pmu_init()
+{
+	if (!pmu_requested) return;
+
+	if (__cpuid(CPUID_GETVENDOR).rax < CPUID_GET_PERF_MON) {
+		x86_log.message(LogLevel::WARNING, "PMU: no architectural performance monitoring");
+		return;
+	}
+
+	CPUID perf = __cpuid(CPUID_GET_PERF_MON);
+	unsigned int version = perf.rax & 0xff;
+	unsigned int nr_counters = (perf.rax >> 8) & 0xff;
+	unsigned int width = (perf.rax >> 16) & 0xff;
+	unsigned int nr_event_bits = (perf.rax >> 24) & 0xff;
+
+	if (version == 0 || nr_counters == 0 || width == 0) {
+		x86_log.message(LogLevel::WARNING, "PMU: no architectural performance monitoring");
+		return;
+	}
+
+	for (unsigned int i = 0; i < PMU_NR_EVENTS && i < nr_counters; i++) {
+		int bit = events[i].unavailable_bit;
+
+		// An event that is past the end of the bit vector isn't supported either.
+		if (bit >= 0 && ((unsigned int)bit >= nr_event_bits || (perf.rbx & (1u << bit)))) continue;
+		counted |= 1u << i;
+	}
+
+	if (!counted) {
+		x86_log.message(LogLevel::WARNING, "PMU: none of the events can be counted");
+		return;
+	}
+
+	counter_mask = width >= 64 ? ~0ull : (1ull << width) - 1;
+
+	pmu_init_cpu();
+
+	x86_log.messagef(LogLevel::INFO, "PMU: version %u, %u counters of %u bits, counting events %x per thread",
+			version, nr_counters, width, counted);
+}
+
+void infos::arch::x86::pmu_switch_to(Thread *prev, Thread& next)
+{
+	if (!counted) return;
+
+	X86CPU& cpu = this_cpu();
+
+	uint64_t now[PMU_NR_EVENTS];
+	read_counters(now);
+
+	if (prev) {
+		ThreadContext& context = prev->context();
+		for (unsigned int i = 0; i < PMU_NR_EVENTS; i++) {
+			context.pmu_counts[i] += (now[i] - cpu.pmu_start[i]) & counter_mask;
+		}
+	}
+
+	for (unsigned int i = 0; i < PMU_NR_EVENTS; i++) {
+		cpu.pmu_start[i] = now[i];
+	}
+}
+
+unsigned int infos::arch::x86::pmu_read(Thread& thread, uint64_t *counts)
+{
+	UniqueIRQLock irq;
+
+	for (unsigned int i = 0; i < PMU_NR_EVENTS; i++) {
+		counts[i] = thread.context().pmu_counts[i];
+	}
+
+	if (!counted) return 0;
+
+	// A thread that is running on another CPU only has what it counted up to when it
+	// was last switched to.
+	X86CPU& cpu = this_cpu();
+	if (cpu.current_thread == &thread) {
+		uint64_t now[PMU_NR_EVENTS];
+		read_counters(now);
+
+		for (unsigned int i = 0; i < PMU_NR_EVENTS; i++) {
+			counts[i] += (now[i] - cpu.pmu_start[i]) & counter_mask;
+		}
+	}
+
+	return counted;
+}
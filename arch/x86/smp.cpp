@@ -0,0 +1,243 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * arch/x86/smp.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <arch/x86/init.h>
+#include <arch/x86/ipi.h>
+#include <arch/x86/irq.h>
+#include <arch/x86/cpu.h>
+#include <arch/x86/x86-arch.h>
+#include <arch/x86/acpi/acpi.h>
+#include <infos/drivers/irq/lapic.h>
+#include <infos/drivers/timer/lapic-timer.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/process.h>
+#include <infos/kernel/workqueue.h>
+#include <infos/kernel/trace.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+#include <infos/util/time.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers::irq;
+using namespace infos::drivers::timer;
+using namespace infos::arch::x86;
+using namespace infos::util;
+
+// Where the startup code is copied to (see arch/x86/smp-trampoline.S).  The page is
+// reserved by the page allocator.
+#define AP_TRAMPOLINE_PA	0x7000
+
+// The initial page tables, built by start32 and still in place.
+#define AP_BOOT_PML4_PA		0x1000
+#define AP_BOOT_PDP_ENTRY	0x2003
+
+// How long to wait for a CPU to come online after it has been sent a startup IPI.
+#define AP_ONLINE_TIMEOUT_MS	100
+
+// Scheduling on the other CPUs, under the kernel lock, is off unless asked for (smp=1)
+// until it has been run on a booted system.
+static bool smp_enabled;
+
+RegisterCmdLineArgument(SMPEnable, "smp") {
+	smp_enabled = (strncmp(value, "1", 2) == 0);
+}
+
+extern "C" {
+	extern char ap_trampoline_start, ap_trampoline_end;
+
+	// What a starting CPU picks up in ap_entry64.  The CPUs are started one at a time,
+	// so there is only one of each.
+	uint64_t ap_boot_cr3, ap_boot_cr4, ap_boot_stack;
+	X86CPU *ap_booting_cpu;
+}
+
+static LAPIC *lapic;
+static LAPICTimer *lapic_timer;
+
+// What the boot CPU tells a CPU that has come online: whether it has a runqueue to
+// schedule on.  As with the rest, there is only one CPU starting at a time.
+#define AP_WAITING		0
+#define AP_SCHEDULE		1
+#define AP_PARK			2
+
+static volatile int ap_schedule_state;
+
+/**
+ * The C++ entry point of a secondary CPU, running on the kernel stack of its idle thread,
+ * with interrupts disabled.
+ */
+extern "C" void __noreturn x86_ap_main()
+{
+	X86CPU& cpu = *ap_booting_cpu;
+
+	if (x86arch.init_secondary_cpu(cpu)) {
+		fpu_init_cpu();
+		pmu_init_cpu();
+		lapic->init_local();
+
+		__sync_synchronize();
+		cpu.online = true;
+
+		// The boot CPU makes the runqueue (see start_ap()), as that allocates memory,
+		// which the idle thread mustn't wait for.
+		int state;
+		while ((state = __atomic_load_n(&ap_schedule_state, __ATOMIC_ACQUIRE)) == AP_WAITING) {
+			asm volatile("pause");
+		}
+
+		if (state == AP_SCHEDULE) {
+			lapic_timer->init_cpu();
+			sys.scheduler().run_secondary();
+		}
+	}
+
+	// A CPU that can't schedule stays parked in its idle thread, with interrupts
+	// disabled.  Without a runqueue, it isn't sent interrupts, or calls.
+	for (;;) {
+		asm volatile("cli; hlt");
+	}
+}
+
+/**
+ * Starts one secondary CPU, with the INIT-SIPI-SIPI sequence.
+ * @param apic_id The local APIC ID of the CPU.
+ * @return Returns true if the CPU came online, or false otherwise.
+ */
+static bool start_ap(uint8_t apic_id)
+{
+	X86CPU *cpu = new X86CPU();
+	cpu->apic_id = apic_id;
+	cpu->numa_node(acpi::acpi_get_lapic_node(apic_id));
+
+	if (!x86arch.add_cpu(*cpu)) {
+		x86_log.messagef(LogLevel::WARNING, "Too many CPUs: not starting apic-id=%u", apic_id);
+		delete cpu;
+		return false;
+	}
+
+	// Each CPU has its own idle thread, which is what it is running whenever it isn't
+	// running anything else.  It is never put on a runqueue.
+	Thread& idle = sys.create_kernel_thread((Thread::thread_proc_t)x86_ap_main, "idle");
+
+	cpu->current_thread = &idle;
+
+	ap_booting_cpu = cpu;
+	ap_boot_stack = idle.context().kernel_stack;
+	ap_schedule_state = AP_WAITING;
+	__sync_synchronize();
+
+	lapic->send_init(apic_id);
+	sys.spin_delay(DurationCast<Nanoseconds>(Milliseconds(10)));
+
+	// The second startup IPI is ignored if the CPU has already started.
+	for (int i = 0; i < 2 && !cpu->online; i++) {
+		lapic->send_startup(apic_id, AP_TRAMPOLINE_PA >> 12);
+		sys.spin_delay(DurationCast<Nanoseconds>(Microseconds(200)));
+	}
+
+	auto deadline = sys.runtime() + DurationCast<Nanoseconds>(Milliseconds(AP_ONLINE_TIMEOUT_MS));
+	while (!cpu->online && sys.runtime() < deadline) {
+		asm volatile("pause");
+	}
+
+	if (!cpu->online) {
+		x86_log.messagef(LogLevel::WARNING, "CPU %u (apic-id=%u) did not come online", cpu->index, apic_id);
+		__atomic_store_n(&ap_schedule_state, AP_PARK, __ATOMIC_RELEASE);
+		return false;
+	}
+
+	bool scheduling = sys.scheduler().init_cpu(*cpu, idle);
+	__atomic_store_n(&ap_schedule_state, scheduling ? AP_SCHEDULE : AP_PARK, __ATOMIC_RELEASE);
+
+	if (!scheduling) {
+		x86_log.messagef(LogLevel::WARNING, "CPU %u (apic-id=%u) online, but can't run the scheduler", cpu->index, apic_id);
+		return true;
+	}
+
+	x86_log.messagef(LogLevel::INFO, "CPU %u (apic-id=%u) online", cpu->index, apic_id);
+	return true;
+}
+
+/**
+ * Brings up the other CPUs listed in the ACPI MADT.  This needs the local APIC, and a
+ * working clock for the delays in the startup sequence.  A CPU that doesn't start is
+ * reported, and left out.
+ * @return Returns TRUE if the CPUs were brought up, or FALSE if the local APIC is missing.
+ */
+bool infos::arch::x86::smp_init()
+{
+	if (!sys.device_manager().try_get_device_by_class(LAPIC::LAPICDeviceClass, lapic)) {
+		return false;
+	}
+
+	// Each CPU's runqueue is driven by its own local APIC timer.
+	if (!sys.device_manager().try_get_device_by_class(LAPICTimer::LAPICTimerDeviceClass, lapic_timer)) {
+		smp_enabled = false;
+	}
+
+	X86CPU& bsp = x86arch.cpu(0);
+	bsp.apic_id = lapic->id();
+	bsp.numa_node(acpi::acpi_get_lapic_node(bsp.apic_id));
+	bsp.online = true;
+
+	// Without the IPIs, the other CPUs can still be started, but can't be woken.
+	ipi_init(*lapic);
+
+	unsigned int nr_lapics = acpi::acpi_get_nr_lapics();
+	if (nr_lapics <= 1 || !smp_enabled) {
+		x86_log.messagef(LogLevel::INFO, "Running on one CPU (%u present)", nr_lapics);
+		return true;
+	}
+
+	// Copy the startup code into place, and put back the identity mapping of low memory
+	// in the initial page tables, so that the startup code can turn paging on.
+	size_t size = &ap_trampoline_end - &ap_trampoline_start;
+	assert(size <= 0x1000);
+	memcpy((void *)pa_to_vpa(AP_TRAMPOLINE_PA), &ap_trampoline_start, size);
+
+	uint64_t *boot_pml4 = (uint64_t *)pa_to_vpa(AP_BOOT_PML4_PA);
+	boot_pml4[0] = AP_BOOT_PDP_ENTRY;
+
+	// The other CPUs use the same kernel page tables and paging features as this one.
+	uint64_t cr3, cr4;
+	asm volatile("mov %%cr3, %0" : "=r"(cr3));
+	asm volatile("mov %%cr4, %0" : "=r"(cr4));
+	ap_boot_cr3 = cr3 & ~0xfffull;
+	ap_boot_cr4 = cr4;
+
+	// From here on, a section that disables interrupts has to keep the other CPUs out too.
+	KernelLock::enable();
+
+	for (unsigned int i = 0; i < nr_lapics; i++) {
+		uint8_t apic_id = acpi::acpi_get_lapic_id(i);
+		if (apic_id == bsp.apic_id) continue;
+
+		start_ap(apic_id);
+	}
+
+	// The workers of each workqueue, and the trace buffers, are per runqueue, and were
+	// set up before there was more than one.
+	WorkQueue::runqueues_added();
+	if (!trace_init()) {
+		x86_log.messagef(LogLevel::WARNING, "Unable to allocate the trace buffers of the other CPUs");
+	}
+
+	unsigned int nr_online = 0;
+	for (unsigned int i = 0; i < x86arch.nr_cpus(); i++) {
+		if (x86arch.cpu(i).online) nr_online++;
+	}
+
+	x86_log.messagef(LogLevel::INFO, "%u of %u CPUs online", nr_online, nr_lapics);
+	return true;
+}
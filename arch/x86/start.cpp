@@ -15,8 +15,12 @@
 #include <arch/x86/qemu-stream.h>
 #include <arch/x86/context.h>
 #include <arch/x86/acpi/acpi.h>
+#include <arch/x86/msr.h>
 #include <infos/kernel/log.h>
 #include <infos/kernel/kernel.h>
+#include <infos/kernel/device-manager.h>
+#include <infos/kernel/trace.h>
+#include <infos/kernel/boot-phase.h>
 #include <infos/util/string.h>
 #include <infos/util/map.h>
 #include <infos/util/printf.h>
@@ -82,25 +86,52 @@ static void eliminate_lower_mapping()
 }
 
 /**
- * Post-generic initialisation for the x86 architecture.
+ * Brings up the console, in the background (see DeviceInitGroup::CONSOLE).
  */
-static bool x86_init_bottom()
+static bool console_init_fn(void *arg)
 {
 	x86_log.message(LogLevel::DEBUG, "Initialising and activating console");
 	if (!console_init()) {
 		syslog.message(LogLevel::ERROR, "Unable to initialise console");
-		goto init_error;
+		return false;
 	}
-	
+
 	if (!activate_console()) {
 		syslog.message(LogLevel::ERROR, "Unable to activate console");
-		goto init_error;
+		return false;
 	}
-	
+
+	return true;
+}
+
+/**
+ * Post-generic initialisation for the x86 architecture.
+ */
+static bool x86_init_bottom()
+{
+	// The console, the disks and the rest come up alongside one another, and the boot
+	// only waits for each where it needs it (see Kernel::start_kernel_threadproc()).
+	sys.device_manager().init_async(DeviceInitGroup::CONSOLE, console_init_fn, NULL);
+
+	boot_phase_begin("x86.devices");
 	if (!devices_init()) {
 		syslog.message(LogLevel::ERROR, "Unable to initialise platform devices");
 		goto init_error;
 	}
+	boot_phase_end();
+
+	boot_phase_begin("x86.smp");
+	x86_log.message(LogLevel::DEBUG, "Starting secondary CPUs");
+	if (!smp_init()) {
+		syslog.message(LogLevel::ERROR, "Unable to start secondary CPUs");
+		goto init_error;
+	}
+	boot_phase_end();
+
+	if (!irq_balance_init()) {
+		syslog.message(LogLevel::ERROR, "Unable to start IRQ balancing");
+		goto init_error;
+	}
 
 	return true;
 	
@@ -117,8 +148,15 @@ static void zero_bss()
 
 extern "C" void __noreturn x86_init_top()
 {
+	// The boot is timed from here, but nothing can be recorded until the BSS is clear.
+	uint64_t entry_tsc = __rdtsc();
+
+	// The current CPU is found through its per-CPU variables.
+	percpu_load_boot();
+
 	// Zero-out the BSS section, so that uninitialised static/global variables are zero.
 	zero_bss();
+	boot_phase_begin_at("x86.early", entry_tsc);
 	
 	// Fix-up the multiboot info structure BEFORE we eliminate the lower mapping
 	multiboot_info_structure = (struct multiboot_info *)pa_to_kva(__multiboot_ebx);
@@ -130,6 +168,9 @@ extern "C" void __noreturn x86_init_top()
 	//syslog.set_stream(early_screen);
 	syslog.colour(true);
 
+	// The trace can be dumped, as binary, alongside the log.
+	trace_set_dump_stream(qemu_stream);
+
 	syslog.message(LogLevel::INFO, "-----------------------------------------------------------------");
 	syslog.message(LogLevel::INFO, "Starting InfOS!");
 	syslog.message(LogLevel::INFO, "-----------------------------------------------------------------");
@@ -141,55 +182,80 @@ extern "C" void __noreturn x86_init_top()
 		
 	sys.early_init((const char *)(pa_to_kva((uint64_t)multiboot_info_structure->cmdline)));
 	
+	boot_phase_end();
+
+	boot_phase_begin("x86.platform");
 	x86_log.message(LogLevel::DEBUG, "Initialising platform");
 	if (!x86arch.init()) {
 		syslog.message(LogLevel::ERROR, "Unable to initialise the platform");
 		goto init_error;
 	}
+	boot_phase_end();
 	
+	boot_phase_begin("x86.mm");
 	x86_log.message(LogLevel::DEBUG, "Initialising memory management");
 	if (!mm_init()) {
 		syslog.message(LogLevel::ERROR, "Unable to initialise the memory manager");
 		goto init_error;
 	}
+	boot_phase_end();
 	
+	boot_phase_begin("x86.irq");
 	x86_log.message(LogLevel::DEBUG, "Initialising IRQs");
 	if (!x86arch.init_irq()) {
 		syslog.message(LogLevel::ERROR, "Unable to initialise IRQs");
 		goto init_error;
 	}
+	boot_phase_end();
 	
 	mm_pf_init();
 	
+	boot_phase_begin("x86.acpi");
 	x86_log.message(LogLevel::DEBUG, "Configuring platform with ACPI");
 	if (!acpi_init()) {
 		syslog.message(LogLevel::ERROR, "Unable to configure with ACPI");
 		goto init_error;
 	}
+	boot_phase_end();
+
+	boot_phase_begin("mm.numa");
+	if (!sys.mm().pgalloc().init_numa()) {
+		syslog.message(LogLevel::ERROR, "Unable to set up NUMA nodes");
+		goto init_error;
+	}
+	boot_phase_end();
 
+	boot_phase_begin("x86.cpu");
 	x86_log.message(LogLevel::DEBUG, "Initialising CPU");
 	if (!cpu_init()) {
 		syslog.message(LogLevel::ERROR, "Unable to initialise the CPU");
 		goto init_error;
 	}
+	boot_phase_end();
 		
+	boot_phase_begin("x86.modules");
 	x86_log.message(LogLevel::DEBUG, "Initialising boot modules");
 	if (!modules_init()) {
 		syslog.message(LogLevel::ERROR, "Unable to initialise boot modules");
 		goto init_error;
 	}
+	boot_phase_end();
 	
+	boot_phase_begin("x86.timer");
 	x86_log.message(LogLevel::DEBUG, "Initialising timer");
 	if (!timer_init()) {
 		syslog.message(LogLevel::ERROR, "Unable to initialise timer");
 		goto init_error;
 	}
+	boot_phase_end();
 		
+	boot_phase_begin("x86.sched");
 	x86_log.message(LogLevel::DEBUG, "Initialising scheduler");
 	if (!sched_init()) {
 		syslog.message(LogLevel::ERROR, "Unable to initialise scheduler");
 		goto init_error;
 	}
+	boot_phase_end();
 	
 	// Start the system, and begin executing the second-half of the
 	// arch specific initialisation.
@@ -40,6 +40,36 @@ void user_syscall_handler(const IRQ *irq, void *priv)
 	sys.arch().disable_interrupts();
 }
 
+/**
+ * Handle a system call that came in through the 'syscall' instruction (see
+ * arch/x86/syscall-trap.S).  There is no trap frame: the arguments come straight from
+ * the entry stub, and the result goes straight back to it.
+ */
+extern "C" unsigned long fast_syscall_handler(unsigned long nr, unsigned long arg0, unsigned long arg1,
+		unsigned long arg2, unsigned long arg3, unsigned long arg4, unsigned long arg5)
+{
+	sys.arch().enable_interrupts();
+
+	unsigned long rc = sys.syscalls().InvokeSyscall(nr, arg0, arg1, arg2, arg3, arg4, arg5);
+
+	sys.arch().disable_interrupts();
+	return rc;
+}
+
+/**
+ * Called instead of returning from a 'syscall', if the return address can't be returned
+ * to with 'sysret'.  This only happens if the process ran a 'syscall' instruction right
+ * at the top of the user half, so the process is killed.
+ */
+extern "C" void fast_syscall_bad_return()
+{
+	syslog.messagef(LogLevel::ERROR, "Bad system call return address in process %s", Thread::current().owner().name().c_str());
+	Thread::current().owner().terminate(-1);
+
+	// Terminating the process switched away from this thread for good.
+	arch_abort();
+}
+
 /**
  * Handle a system call that came from the kernel.
  */
@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * arch/x86/tsc.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <arch/x86/tsc.h>
+#include <arch/x86/init.h>
+#include <arch/x86/cpuid.h>
+#include <arch/x86/msr.h>
+#include <arch/x86/kvm.h>
+#include <infos/kernel/log.h>
+#include <infos/util/time.h>
+
+using namespace infos::kernel;
+using namespace infos::arch::x86;
+using namespace infos::util;
+
+// The TSC runs at a constant rate, whatever the processor's power state.
+#define CPUID_POWER_INVARIANT_TSC	(1 << 8)
+
+/*
+ * Nanoseconds are computed as tsc_scale.scale(tsc - base), so that reading the clock
+ * doesn't need a division.
+ */
+static uint64_t tsc_base;
+static ClockScale tsc_scale;
+
+// If the HPET is the clocksource, the clock is read from its main counter instead, and
+// carries on from 'hpet_offset' ns.
+static volatile const uint64_t *hpet_counter;
+static uint64_t hpet_base, hpet_offset;
+static ClockScale hpet_scale;
+
+uint64_t infos::arch::x86::tsc_known_frequency(uint64_t& lapic_hz)
+{
+	lapic_hz = 0;
+
+	uint64_t max_leaf = __cpuid(CPUID_GETVENDOR).rax;
+
+	// The crystal clock, and how the TSC is derived from it.  The crystal also drives the
+	// local APIC timer.
+	if (max_leaf >= CPUID_GET_TSC_FREQ) {
+		CPUID tsc = __cpuid(CPUID_GET_TSC_FREQ);
+		uint64_t denominator = tsc.rax, numerator = tsc.rbx, crystal_hz = tsc.rcx;
+
+		// Some processors leave the crystal out, but give the base frequency, which is
+		// the TSC frequency.
+		if (numerator && denominator && !crystal_hz && max_leaf >= CPUID_GET_PROC_FREQ) {
+			uint64_t base_mhz = __cpuid(CPUID_GET_PROC_FREQ).rax & 0xffff;
+			crystal_hz = (base_mhz * 1000000ull * denominator) / numerator;
+		}
+
+		if (numerator && denominator && crystal_hz) {
+			lapic_hz = crystal_hz;
+			return (crystal_hz * numerator) / denominator;
+		}
+	}
+
+	if (__cpuid(CPUID_GET_FEATURES).rcx & CPUIDFeatures::HYPERVISOR) {
+		// The timing leaf, which VMware and KVM can provide, gives both in kHz.
+		if (__cpuid(CPUID_HYPERVISOR_BASE).rax >= CPUID_HYPERVISOR_TIMING) {
+			CPUID timing = __cpuid(CPUID_HYPERVISOR_TIMING);
+			if (timing.rax) {
+				lapic_hz = (timing.rbx & 0xffffffff) * 1000;
+				return (timing.rax & 0xffffffff) * 1000;
+			}
+		}
+
+		uint64_t hz = kvm_tsc_frequency();
+		if (hz) return hz;
+	}
+
+	// The base frequency alone is only a nominal figure, but the TSC runs at it.
+	if (max_leaf >= CPUID_GET_PROC_FREQ) {
+		uint64_t base_mhz = __cpuid(CPUID_GET_PROC_FREQ).rax & 0xffff;
+		if (base_mhz) return base_mhz * 1000000ull;
+	}
+
+	return 0;
+}
+
+bool infos::arch::x86::tsc_invariant()
+{
+	return __cpuid(CPUID_GET_EX_MAX).rax >= CPUID_GET_POWER_MGMT
+		&& (__cpuid(CPUID_GET_POWER_MGMT).rdx & CPUID_POWER_INVARIANT_TSC);
+}
+
+void infos::arch::x86::tsc_clock_init(uint64_t tsc_hz)
+{
+	if (!tsc_invariant()) {
+		x86_log.message(LogLevel::WARNING, "TSC is not invariant: the kernel clock may drift if the processor changes speed");
+	}
+
+	tsc_scale = ClockScale::from_ratio(1000000000ull, tsc_hz);
+	tsc_base = __rdtsc();
+
+	x86_log.messagef(LogLevel::DEBUG, "tsc clock: %llu Hz, mult=%llu, shift=%u", tsc_hz, tsc_scale.mult, tsc_scale.shift);
+}
+
+void infos::arch::x86::hpet_clock_init(volatile const uint64_t *counter, uint32_t period_fs)
+{
+	// ns = (ticks * period_fs) / 10^6.
+	ClockScale scale = ClockScale::from_ratio(period_fs, 1000000);
+	uint64_t offset = KernelRuntimeClock::now().time_since_epoch().count();
+
+	hpet_base = *counter;
+	hpet_scale = scale;
+	hpet_offset = offset;
+
+	__sync_synchronize();
+	hpet_counter = counter;
+
+	x86_log.messagef(LogLevel::INFO, "clocksource: hpet, period=%u fs, mult=%llu, shift=%u", period_fs, hpet_scale.mult, hpet_scale.shift);
+}
+
+bool infos::arch::x86::tsc_clock_params(uint64_t& base, uint64_t& mult, unsigned int& shift)
+{
+	// User code can't read the HPET, so it has to ask the kernel.
+	if (!tsc_scale.valid() || hpet_counter) return false;
+
+	base = tsc_base;
+	mult = tsc_scale.mult;
+	shift = tsc_scale.shift;
+	return true;
+}
+
+KernelRuntimeClock::Timepoint KernelRuntimeClock::now()
+{
+	if (hpet_counter) {
+		return Timepoint(hpet_offset + hpet_scale.scale(*hpet_counter - hpet_base));
+	}
+
+	// Until the clock starts, the scale is zero, so it reads zero.
+	return Timepoint(tsc_scale.scale(__rdtsc() - tsc_base));
+}
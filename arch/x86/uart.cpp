@@ -16,74 +16,127 @@
 #include <arch/x86/uart.h>
 #include <infos/drivers/terminal/terminal.h>
 #include <arch/x86/pio.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/util/lock.h>
 
 using namespace infos::kernel;
 using namespace infos::drivers;
 using namespace infos::drivers::irq;
 using namespace infos::arch::x86;
+using namespace infos::util;
 
 const uint16_t UART::COM1 = 0x3f8;
 const int UART::IRQ_COM1 = 4;
 
+// The UART's clock, as the divisor divides it.
+#define UART_CLOCK_HZ	115200
+
+#define IER_RX_AVAILABLE	0x01
+#define IER_TX_EMPTY		0x02
+
+#define FCR_ENABLE			0x01
+#define FCR_CLEAR_RX		0x02
+#define FCR_CLEAR_TX		0x04
+#define FCR_RX_TRIGGER_14	0xc0
+
+#define IIR_NO_INTERRUPT	0x01
+#define IIR_ID(__v)			((__v) & 0x0e)
+#define IIR_MODEM_STATUS	0x00
+#define IIR_TX_EMPTY		0x02
+#define IIR_RX_AVAILABLE	0x04
+#define IIR_LINE_STATUS		0x06
+#define IIR_RX_TIMEOUT		0x0c
+#define IIR_FIFO_ENABLED	0xc0	// Both set on a 16550A, whose FIFO works
+
+#define LSR_DATA_READY		0x01
+#define LSR_TX_EMPTY		0x20
+
+static unsigned int uart_baud = 115200;
+
+RegisterCmdLineArgument(UARTBaud, "uart.baud") {
+	unsigned int baud = 0;
+	for (const char *p = value; *p >= '0' && *p <= '9'; p++) {
+		baud = baud * 10 + (*p - '0');
+	}
+
+	if (baud && baud <= UART_CLOCK_HZ && !(UART_CLOCK_HZ % baud)) {
+		uart_baud = baud;
+	} else {
+		syslog.messagef(LogLevel::WARNING, "Unsupported UART baud rate '%s'", value);
+	}
+}
+
 const DeviceClass UART::UARTDeviceClass(Device::RootDeviceClass, "uart");
 
 int UART::read(void* buffer, size_t size)
 {
-	for (unsigned int i = 0; i < size; i++) {
-		((char *)buffer)[i] = getc();
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	size_t n = 0;
+	while (n < size && _rx_tail != _rx_head) {
+		((uint8_t *)buffer)[n++] = _rx_ring[_rx_tail++ % RX_RING_SIZE];
 	}
-	return size;
+
+	return n;
 }
 
 int UART::write(const void* buffer, size_t size)
 {
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
 	for (unsigned int i = 0; i < size; i++) {
 		char c = ((char *)buffer)[i];
-#if 0
-		syslog.message(LogLevel::INFO, "UART putting a character: ");
-		char cs[] = { c, 0 };
-		if (c >= 32 && c < 128) syslog.message(LogLevel::INFO, cs);
-		else if (c < 32) syslog.message(LogLevel::INFO, "(control code)");
-		else syslog.message(LogLevel::INFO, "(high byte)");
-#endif
+
 		/* HACK: this translation doesn't belong in the UART code,
 		 * but in a 'serial console' translation layer or possibly
 		 * just in SerialTerminal. */
-		if (c == '\n') { putc('\r'); putc('\n'); }
-		else putc(c);
+		if (c == '\n') queue_byte('\r');
+		queue_byte(c);
 	}
+
+	fill_transmitter();
 	return size;
 }
 
-UART::UART() : _attached_terminal(nullptr)
+UART::UART() : present(false), _irq(NULL), _attached_terminal(nullptr), _tx_head(0), _tx_tail(0), _rx_head(0), _rx_tail(0), _fifo_size(1), _tx_irq_enabled(false)
 {
 	syslog.message(LogLevel::INFO, "created a UART");
-	//init();
-	assert(present);
-	// Announce that we're here.
-#define write_string(s) write((s), sizeof (s) - 1)
-	write_string("Hello from the InfOS serial console\n");
 }
 
 bool UART::init(kernel::DeviceManager& dm)
 {
 	syslog.message(LogLevel::INFO, "initing a UART");
-	__outb(COM1 + FCR, 0);           // turn off the on-chip FIFO (we want a plain old 8250)
+	__outb(COM1 + IER, 0);           // no interrupts until the handler is attached
 	__outb(COM1 + LCR, 0x80);        // unlock divisor
-	__outb(COM1 + DLL, 115200/9600); // divide the clock by 12 to get 9600 baud
-	__outb(COM1 + DLH, 0);           // high bit of 12 is 0
+	__outb(COM1 + DLL, (UART_CLOCK_HZ / uart_baud) & 0xff);
+	__outb(COM1 + DLH, (UART_CLOCK_HZ / uart_baud) >> 8);
 	__outb(COM1 + LCR, 0x03);        // lock divisor and set 8 data bits, 1 stop bit, no parity
-	__outb(COM1 + MCR, 0);           // clear the modem control register
-	__outb(COM1 + IER, 0x01);        // enable receive interrupts.
+	__outb(COM1 + MCR, 0x08);        // OUT2, which lets the UART's interrupt out
 
 	// If status is 0xFF, no serial port.
 	if (__inb(COM1 + LSR) == 0xFF) { this->present = false; return false; }
-	this->present = true;
+
+	// A 16550A has 16-byte FIFOs, which let the transmitter be given 16 bytes per
+	// interrupt, and the receiver hold on to some while the kernel is busy.  Anything
+	// older has no FIFO, or one that doesn't work.
+	__outb(COM1 + FCR, FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX | FCR_RX_TRIGGER_14);
+	if ((__inb(COM1 + IIR) & IIR_FIFO_ENABLED) == IIR_FIFO_ENABLED) {
+		_fifo_size = 16;
+	} else {
+		__outb(COM1 + FCR, 0);
+		_fifo_size = 1;
+	}
 
 	// acknowledge any pre-existing interrupt and 'consume' data to re-enable.
 	__inb(COM1 + IIR);
 	__inb(COM1 + RBR);
 
+	// Until the interrupt is hooked up, output is polled.
+	this->present = true;
+
 	// Find the LAPIC.
 	LAPIC *lapic;
 	if (!dm.try_get_device_by_class(LAPIC::LAPICDeviceClass, lapic)) {
@@ -98,66 +151,165 @@ bool UART::init(kernel::DeviceManager& dm)
 
 	// Hook-up IRQ 4 on the IOAPIC to the IRQ handler object, and register
 	// the IRQ callback function.
-	_irq = ioapic->request_physical_irq(lapic, IRQ_COM1);
-	_irq->attach(UART::irq_handler, this);
+	IRQ *irq = ioapic->request_physical_irq(lapic, IRQ_COM1);
+	irq->attach(UART::irq_handler, this);
+
+	{
+		UniqueIRQLock l;
+		UniqueLock<SpinLock> ul(_lock);
+
+		_irq = irq;
+		__outb(COM1 + IER, IER_RX_AVAILABLE);
+	}
+
+	syslog.messagef(LogLevel::INFO, "uart: %u baud, %u-byte fifo", uart_baud, _fifo_size);
+
+	// Announce that we're here.
+#define write_string(s) write((s), sizeof (s) - 1)
+	write_string("Hello from the InfOS serial console\n");
 
 	// success
 	return true;
 }
 
+/**
+ * Puts a byte in the transmit ring.  If the ring is full, the transmitter is waited for,
+ * rather than the byte being lost, as this may be the console.  Called with the lock held.
+ */
+void UART::queue_byte(uint8_t c)
+{
+	while (_tx_head - _tx_tail == TX_RING_SIZE) {
+		if (!present) return;
+
+		// Wait at most 1280 us for the transmitter, as before.
+		int i;
+		for (i = 0; i < 128 && !(__inb(COM1 + LSR) & LSR_TX_EMPTY); i++) sys.spin_delay(util::Microseconds(10));
+
+		if (i == 128) {
+			// Nothing is going out, so make room by throwing away the oldest byte.
+			_tx_tail++;
+		} else {
+			fill_transmitter();
+		}
+	}
+
+	_tx_ring[_tx_head++ % TX_RING_SIZE] = c;
+}
+
+/**
+ * Gives the transmitter as much of the ring as it can take, if it is empty, and arms the
+ * transmit interrupt if there is more to go.  Called with the lock held.
+ */
+void UART::fill_transmitter()
+{
+	if (!present) {
+		_tx_tail = _tx_head;
+		return;
+	}
+
+	// Without the interrupt, the ring is emptied here and now, by polling.
+	if (!_irq) {
+		while (_tx_tail != _tx_head) {
+			int i;
+			for (i = 0; i < 128 && !(__inb(COM1 + LSR) & LSR_TX_EMPTY); i++) sys.spin_delay(util::Microseconds(10));
+
+			for (unsigned int n = 0; n < _fifo_size && _tx_tail != _tx_head; n++) {
+				__outb(COM1 + THR, _tx_ring[_tx_tail++ % TX_RING_SIZE]);
+			}
+		}
+
+		return;
+	}
+
+	if (__inb(COM1 + LSR) & LSR_TX_EMPTY) {
+		for (unsigned int n = 0; n < _fifo_size && _tx_tail != _tx_head; n++) {
+			__outb(COM1 + THR, _tx_ring[_tx_tail++ % TX_RING_SIZE]);
+		}
+	}
+
+	bool want_irq = _tx_tail != _tx_head;
+	if (want_irq != _tx_irq_enabled) {
+		_tx_irq_enabled = want_irq;
+		__outb(COM1 + IER, IER_RX_AVAILABLE | (want_irq ? IER_TX_EMPTY : 0));
+	}
+}
+
 void
 UART::putc(int c)
 {
-	if (!present) return;
-	// Test for THR empty (=> ready to send), but wait at most 1280 us
-	int i;
-	uint8_t lsr;
-	for (i = 0; i < 128 && !((lsr = __inb(COM1 + LSR)) & 0x20); i++) sys.spin_delay(util::Microseconds(10));
-	if (i == 128) syslog.message(LogLevel::WARNING, "outputting to a UART with non-empty THR");
-	if (lsr & /* break interrupt, framing, parity, overrun error? */ 0x1e)
-	{
-		syslog.message(LogLevel::WARNING, "error on UART putc, but proceeding");
-		// continue
-	}
-	__outb(COM1 + THR, c);
+	char ch = c;
+	write(&ch, 1);
 }
 
+/**
+ * Takes a byte from the receive ring, or returns -1 if there isn't one.
+ */
 int UART::getc()
 {
-	if (!present) return -1;
-	uint8_t lsr = __inb(COM1 + LSR);
-	if (!(lsr & /* data ready? */ 0x1))
-	{
-		syslog.message(LogLevel::WARNING, "getc from a UART with no data ready");
-		return -1; // not ready
+	uint8_t c;
+	return read(&c, 1) == 1 ? c : -1;
+}
+
+/**
+ * Takes everything the receiver has into the receive ring, whose oldest bytes are lost if
+ * it is full.  A byte with an error is kept, as it always was.  Called with the lock held.
+ */
+void UART::receive()
+{
+	while (__inb(COM1 + LSR) & LSR_DATA_READY) {
+		uint8_t c = __inb(COM1 + RBR);
+
+		if (_rx_head - _rx_tail == RX_RING_SIZE) _rx_tail++;
+		_rx_ring[_rx_head++ % RX_RING_SIZE] = c;
 	}
-	if (lsr & /* framing error? */ 0x1<<3)
+}
+
+void UART::irq_handler(const kernel::IRQ *irq, void *priv)
+{
+	UART *uart = (UART *)priv;
 	{
-		syslog.message(LogLevel::WARNING, "framing error on UART getc, but proceeding");
-		// continue
+		UniqueLock<SpinLock> l(uart->_lock);
+		handle_interrupts(*uart);
+	}
+
+	// The terminal is given what came in once the lock has gone, as it wakes readers.
+	if (uart->_attached_terminal) {
+		int c;
+		while ((c = uart->getc()) >= 0) {
+			uart->_attached_terminal->buffer_raw_character(c);
+		}
 	}
-	return __inb(COM1 + RBR);
 }
 
-void UART::irq_handler(const kernel::IRQ *irq, void *priv)
+/**
+ * Deals with whatever the UART is interrupting for.  Called with the lock held.
+ */
+void UART::handle_interrupts(UART& uart)
 {
-// xv6 calls uartintr from trap()
-// which is called from 'alltraps' in trapasm.S
-// which is called with args (trapno, 0) from a trampoline in vectors.S (one for each of 256 trapnos)
-// which also defines the 256-entry vector table, each pointing to its trampoline
+	// With FIFOs, one interrupt may stand for several reasons, which are reported one
+	// at a time, most important first, until there are none left.
+	for (;;) {
+		uint8_t iir = __inb(COM1 + IIR);
+		if (iir & IIR_NO_INTERRUPT) break;
 
-	/* This asks the console subsystem to buffer our pending data if there is any. */
-	/* XXX */ // consoleintr(uartgetc);
+		switch (IIR_ID(iir)) {
+		case IIR_LINE_STATUS:
+			__inb(COM1 + LSR);
+			break;
 
-	UART *uart = (UART *)priv;
-	int c = uart->getc();
-#if 0 /* This is just for testing */
-	if (c != -1) {
-		syslog.message(LogLevel::INFO, "UART interrupt yielded a character"/*, (char) c*/);
-	} else {
-		syslog.message(LogLevel::INFO, "UART interrupt yielded -1");
+		case IIR_RX_AVAILABLE:
+		case IIR_RX_TIMEOUT:
+			uart.receive();
+			break;
+
+		case IIR_TX_EMPTY:
+			uart.fill_transmitter();
+			break;
+
+		case IIR_MODEM_STATUS:
+		default:
+			__inb(COM1 + MSR);
+			break;
+		}
 	}
-#endif
-	// buffer this as pending data
-	if (uart->_attached_terminal) uart->_attached_terminal->buffer_raw_character(c);
 }
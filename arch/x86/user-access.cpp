@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * arch/x86/user-access.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/user-access.h>
+#include <infos/mm/vma.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/process.h>
+#include <infos/util/string.h>
+#include <arch/x86/extable.h>
+#include <arch/x86/vma.h>
+#include <arch/arch.h>
+
+using namespace infos::arch::x86;
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::util;
+
+extern "C" size_t __copy_user(void *dst, const void *src, size_t n);
+extern "C" long __copy_string_user(char *dst, const char *src, size_t max);
+
+extern char _EXTABLE_START, _EXTABLE_END;
+
+bool infos::arch::x86::fixup_exception(X86Context& context)
+{
+	// Only kernel code has fixups.
+	if (context.cs & 3) return false;
+
+	const ExceptionTableEntry *entry = (const ExceptionTableEntry *)&_EXTABLE_START;
+	const ExceptionTableEntry *end = (const ExceptionTableEntry *)&_EXTABLE_END;
+
+	for (; entry < end; entry++) {
+		if (entry->fault_rip == context.rip) {
+			context.rip = entry->fixup_rip;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static inline bool is_user_range(uintptr_t va, size_t size)
+{
+	return va + size >= va && va + size <= USER_VA_END;
+}
+
+/**
+ * Copies between the kernel and user memory a page at a time, looking each user page up
+ * in the page tables rather than touching it.  This is for when the copy can't take page
+ * faults -- with interrupts disabled, the fault handler can't put the thread to sleep to
+ * page memory in -- so pages that aren't resident make the copy fail.
+ */
+static bool copy_user_slow(uintptr_t user_va, void *kernel_buffer, size_t size, bool to_user)
+{
+	VMA& vma = Thread::current().owner().vma();
+	uint8_t *buffer = (uint8_t *)kernel_buffer;
+
+	while (size > 0) {
+		size_t chunk = __page_size - __page_offset(user_va);
+		if (chunk > size) chunk = size;
+
+		phys_addr_t pa;
+		if (!vma.get_user_mapping(user_va, pa, to_user)) return false;
+
+		if (to_user) {
+			memcpy((void *)pa_to_vpa(pa), buffer, chunk);
+		} else {
+			memcpy(buffer, (const void *)pa_to_vpa(pa), chunk);
+		}
+
+		user_va += chunk;
+		buffer += chunk;
+		size -= chunk;
+	}
+
+	return true;
+}
+
+bool infos::mm::copy_from_user(void *dst, uintptr_t src, size_t size)
+{
+	if (!is_user_range(src, size)) return false;
+
+	if (!sys.arch().interrupts_enabled()) {
+		return copy_user_slow(src, dst, size, false);
+	}
+
+	return __copy_user(dst, (const void *)src, size) == 0;
+}
+
+bool infos::mm::copy_to_user(uintptr_t dst, const void *src, size_t size)
+{
+	if (!is_user_range(dst, size)) return false;
+
+	if (!sys.arch().interrupts_enabled()) {
+		return copy_user_slow(dst, (void *)src, size, true);
+	}
+
+	return __copy_user((void *)dst, src, size) == 0;
+}
+
+bool infos::mm::copy_string_from_user(char *dst, uintptr_t src, size_t size)
+{
+	if (size == 0 || src >= USER_VA_END) return false;
+
+	// Don't let the string run off the end of the user half.
+	if (size > USER_VA_END - src) size = USER_VA_END - src;
+
+	if (!sys.arch().interrupts_enabled()) {
+		for (size_t i = 0; i < size; i++) {
+			if (!copy_user_slow(src + i, &dst[i], 1, false)) return false;
+			if (dst[i] == 0) return true;
+		}
+
+		return false;
+	}
+
+	long len = __copy_string_user(dst, (const char *)src, size);
+	return len >= 0 && (size_t)len < size;
+}
@@ -16,16 +16,21 @@
 #include <arch/x86/dt.h>
 #include <arch/x86/msr.h>
 #include <arch/x86/context.h>
+#include <arch/x86/fpu.h>
+#include <arch/x86/pmu.h>
+#include <arch/x86/tsc.h>
+#include <arch/x86/percpu.h>
 #include <infos/kernel/log.h>
 #include <infos/kernel/thread.h>
 #include <infos/kernel/process.h>
+#include <infos/kernel/profile.h>
 #include <infos/util/string.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/lock.h>
+#include <arch/x86/ipi.h>
+#include <arch/x86/kvm.h>
 #include <infos/drivers/timer/lapic-timer.h>
 
-extern "C" {
-	infos::kernel::Thread *current_thread;
-}
-
 using namespace infos::arch;
 using namespace infos::arch::x86;
 using namespace infos::kernel;
@@ -53,8 +58,34 @@ static void trap_interrupt(const IRQ *irq, void *priv)
 	arch_abort();
 }
 
-X86Arch::X86Arch()
+static_assert(GDT_TSS_BASE_SEL / 8 + X86_MAX_CPUS * (GDT_TSS_SEL_STRIDE / 8) <= MAX_NR_GDT_ENTRIES, "GDT too small for a TSS per CPU");
+
+static void init_syscall_msrs()
+{
+	// 'syscall' loads CS=0x08 and SS=0x10; 'sysret' loads SS=0x10+8 and CS=0x10+16,
+	// i.e. the user data and code segments (see GDT::init()).
+	__wrmsr(MSR_STAR, 0x0010000800000000ULL);     // CS Bases for User-Mode/Kernel-Mode
+	__wrmsr(MSR_LSTAR, (uint64_t)__syscall_trap); // RIP for 'syscall' entry
+	__wrmsr(MSR_SFMASK, (1 << 8) | (1 << 9) | (1 << 10) | (1 << 18));	// Clear TF, IF, DF and AC on entry
+}
+
+static bool mwait_allowed = true;
+
+// Kernel threads borrowing the loaded page table (see set_current_thread()) is off unless
+// asked for (mm.lazy-tlb=1) until it has been run on a booted system.
+static bool lazy_tlb;
+
+RegisterCmdLineArgument(MMLazyTLB, "mm.lazy-tlb") {
+	lazy_tlb = strncmp(value, "1", 2) == 0;
+}
+
+RegisterCmdLineArgument(IdleMethod, "idle") {
+	mwait_allowed = (strncmp(value, "hlt", 3) != 0);
+}
+
+X86Arch::X86Arch() : _nr_cpus(0), _mwait_idle(false), _timer(NULL)
 {
+	// The boot CPU is the current CPU from the start, even before it has a TSS.
 	_cpus[0] = &bsp;
 }
 
@@ -68,18 +99,28 @@ bool X86Arch::init()
 		return false;
 	}
 
-	if (!tss.init(0x28)) {
+	if (!add_cpu(bsp) || !gdt.reload()) {
+		return false;
+	}
+
+	if (!bsp.tss.init(bsp.tss_sel)) {
 		return false;
 	}
 
 	uint64_t rsp;
 	asm volatile("mov %%rsp, %0" : "=r"(rsp));
 
-	x86_log.messagef(LogLevel::DEBUG, "GDTR = 0x%lx, IDTR = 0x%lx, TR = 0x%llx, RSP = 0x%llx", gdt.get_ptr(), idt.get_ptr(), (uint64_t) tss.get_sel(), rsp);
+	x86_log.messagef(LogLevel::DEBUG, "GDTR = 0x%lx, IDTR = 0x%lx, TR = 0x%llx, RSP = 0x%llx", gdt.get_ptr(), idt.get_ptr(), (uint64_t) bsp.tss.get_sel(), rsp);
+
+	init_syscall_msrs();
+	pat_init_cpu();
+	fast_string_init();
+	kvm_init_cpu(bsp);
 
-	__wrmsr(MSR_STAR, 0x18000800000000ULL);       // CS Bases for User-Mode/Kernel-Mode
-	__wrmsr(MSR_LSTAR, (uint64_t)__syscall_trap); // RIP for 'syscall' entry -- we don't use this
-	__wrmsr(MSR_SFMASK, (1 << 9));
+	// Idle CPUs wait with mwait if they can, which lets hypervisors and the CPU itself
+	// do more with an idle CPU than hlt, and lets other CPUs wake them without an IPI.
+	_mwait_idle = mwait_allowed && (cpuid_get_features().rcx & CPUIDFeatures::MONITOR);
+	x86_log.messagef(LogLevel::INFO, "Idle with %s", _mwait_idle ? "mwait" : "hlt");
 
 //	auto feat = cpuid_get_features();
 //	if (!(feat.rcx & (uint64_t)CPUIDFeatures::OSXSAVE)) {
@@ -91,6 +132,125 @@ bool X86Arch::init()
 	return true;
 }
 
+/**
+ * Adds a CPU to the list of CPUs, and gives it a TSS descriptor in the GDT, and its
+ * copy of the per-CPU variables (see percpu.h).  The
+ * descriptors are allocated in the same order as the list, so the CPU's position in
+ * the list can be worked out from its task register.  The CPU must load the GDT again
+ * before it can use the descriptor.
+ * @param cpu The CPU to add.
+ * @return Returns true if the CPU was added, or false if there is no room for it.
+ */
+bool X86Arch::add_cpu(X86CPU& cpu)
+{
+	if (_nr_cpus >= X86_MAX_CPUS) {
+		return false;
+	}
+
+	uint16_t sel;
+	if (!gdt.add_tss(cpu.tss, sel)) {
+		return false;
+	}
+
+	assert(sel == GDT_TSS_BASE_SEL + _nr_cpus * GDT_TSS_SEL_STRIDE);
+
+	cpu.tss_sel = sel;
+	cpu.index = _nr_cpus;
+
+	if (!percpu_init(cpu)) {
+		return false;
+	}
+
+	_cpus[_nr_cpus++] = &cpu;
+
+	return true;
+}
+
+/**
+ * Loads the per-CPU variables, the descriptor tables and the task register of a
+ * secondary CPU, which must be the calling CPU.  After this, current_x86_cpu() returns the CPU.
+ * @param cpu The calling CPU.
+ * @return Returns true if the CPU was initialised, or false otherwise.
+ */
+bool X86Arch::init_secondary_cpu(X86CPU& cpu)
+{
+	percpu_load(cpu);
+
+	if (!gdt.reload()) {
+		return false;
+	}
+
+	if (!idt.reload()) {
+		return false;
+	}
+
+	if (!cpu.tss.init(cpu.tss_sel)) {
+		return false;
+	}
+
+	init_syscall_msrs();
+	pat_init_cpu();
+	kvm_init_cpu(cpu);
+	return true;
+}
+
+void X86Arch::idle()
+{
+	if (!_mwait_idle) {
+		// 'sti' holds off interrupts until after the next instruction, so an interrupt
+		// can't slip in between enabling them and halting, and then not wake us.
+		asm volatile("sti; hlt");
+		return;
+	}
+
+	// A wake-up that arrives before the monitor is armed would be missed by mwait, so
+	// check for one afterwards.
+	volatile uint32_t *wake = &current_x86_cpu().idle_wake;
+	asm volatile("monitor" :: "a"(wake), "c"(0), "d"(0));
+
+	if (!*wake) {
+		asm volatile("sti; mwait" :: "a"(0), "c"(0));
+	}
+
+	*wake = 0;
+}
+
+void X86Arch::wake_cpu(CPU& cpu)
+{
+	X86CPU& target = (X86CPU&)cpu;
+	if (&target == &current_x86_cpu()) return;
+
+	if (_mwait_idle) {
+		target.idle_wake = 1;
+	} else {
+		ipi_send_reschedule(target);
+	}
+}
+
+void X86Arch::reschedule_cpu(CPU& cpu)
+{
+	X86CPU& target = (X86CPU&)cpu;
+	if (&target == &current_x86_cpu()) return;
+
+	ipi_send_reschedule(target);
+}
+
+void X86Arch::relax()
+{
+	ipi_run_queued_calls();
+	asm volatile("pause");
+}
+
+CPU& X86Arch::get_current_cpu()
+{
+	return current_x86_cpu();
+}
+
+CPU& X86Arch::get_cpu(unsigned int index) const
+{
+	return cpu(index);
+}
+
 bool X86Arch::init_irq()
 {
 	if (!_irq_manager.init()) {
@@ -158,25 +318,59 @@ void X86Arch::dump_native_context(const X86Context& native_context) const
 			native_context.rflags,
 			native_context.extra);
 
-	syslog.messagef(LogLevel::DEBUG, "prev=0x%llx", native_context.previous_context);
+	syslog.messagef(LogLevel::DEBUG, "prev=0x%llx, preempt-count=%llu", native_context.previous_context, native_context.preempt_count);
 }
 
 void X86Arch::invoke_kernel_syscall(int nr)
 {
+	// A thread that yields in a section lets the other CPUs have the kernel lock until
+	// it runs again, on whichever CPU that is.
+	unsigned int depth = KernelLock::release();
 	asm volatile("int $0x80" :: "a"((uint64_t)nr));
+	KernelLock::reacquire(depth);
 }
 
 infos::kernel::Thread& X86Arch::get_current_thread() const
 {
-	return *current_thread;
+	return *current_x86_cpu().current_thread;
 }
 
 void X86Arch::set_current_thread(kernel::Thread& thread)
 {
-	asm volatile("mov %0, %%cr3" :: "r"(thread.owner().vma().pgt_base()) : "memory");
+	X86CPU& cpu = current_x86_cpu();
+	mm::VMA& vma = thread.owner().vma();
+
+	// Lazy TLB (with mm.lazy-tlb=1): the kernel half of every address space is the same,
+	// so a kernel thread (or the idle thread) borrows whatever page table the CPU has
+	// loaded, rather than loading its own, and the TLB survives a switch to a kernel
+	// thread and back.  The borrowed VMA is still the CPU's active_pgt, so its shootdowns
+	// still come here.  A kernel process that has mapped something of its own in the user
+	// half needs it.
+	if (!lazy_tlb || !thread.owner().kernel_process() || !cpu.active_pgt || vma.maps_user_space()) {
+		vma.activate();
+	}
+
+	fpu_switch_to(thread);
+	pmu_switch_to(cpu.current_thread, thread);
 
-	tss.set_kernel_stack(thread.context().kernel_stack);
-	current_thread = &thread;
+	cpu.tss.set_kernel_stack(thread.context().kernel_stack);
+	percpu_header().syscall_kernel_stack = thread.context().kernel_stack;
+	cpu.current_thread = &thread;
+}
+
+void X86Arch::release_thread_state(kernel::Thread& thread)
+{
+	fpu_release(thread);
+}
+
+bool X86Arch::runtime_clock_source(uint64_t& base, uint64_t& mult, unsigned int& shift) const
+{
+	return tsc_clock_params(base, mult, shift);
+}
+
+uint64_t X86Arch::steal_time()
+{
+	return kvm_steal_time(current_x86_cpu());
 }
 
 IRQ *X86Arch::request_irq()
@@ -185,6 +379,11 @@ IRQ *X86Arch::request_irq()
 	return NULL; //_irq_manager.request_irq();
 }
 
+void X86Arch::irq_handlers_changed(const kernel::IRQ& irq)
+{
+	_irq_manager.update_vector(irq);
+}
+
 extern "C"
 {
 uint64_t busywait_doing_calibration;
@@ -209,18 +408,39 @@ void X86Arch::calibrate_busywait_loop(kernel::DeviceManager& dm)
 	busywait_cmploops_per_us = cmploops_per_us;
 	syslog.messagef(LogLevel::DEBUG, "busywait calibration loop count reached %lld", busywait_cmploops_per_us);
 }
-void X86Arch::set_periodic_timer_interrupt(kernel::DeviceManager& dm)
+void X86Arch::start_timer_interrupt(kernel::DeviceManager& dm)
 {
-	infos::drivers::timer::LAPICTimer *lapic_timer;
-	if (!dm.try_get_device_by_class(infos::drivers::timer::LAPICTimer::LAPICTimerDeviceClass, lapic_timer))
+	if (!dm.try_get_device_by_class(infos::drivers::timer::LAPICTimer::LAPICTimerDeviceClass, _timer))
 		arch_abort();
-	lapic_timer->init_periodic((lapic_timer->frequency() >> 4) / 100);
-	lapic_timer->start();
+
+	_timer->set_deadline(util::DurationCast<util::Nanoseconds>(util::Milliseconds(10)));
+}
+
+void X86Arch::set_next_timer_interrupt(util::Nanoseconds delay)
+{
+	// While profiling, a CPU is interrupted at least every sample period.
+	uint64_t period = __atomic_load_n(&profile_period, __ATOMIC_RELAXED);
+	if (period && (uint64_t)delay.count() > period) delay = util::Nanoseconds(period);
+
+	if (_timer) _timer->set_deadline(delay);
+}
+
+void X86Arch::stop_timer_interrupt()
+{
+	uint64_t period = __atomic_load_n(&profile_period, __ATOMIC_RELAXED);
+	if (period) {
+		// An idle CPU is sampled too, so that the profile shows where the time went.
+		if (_timer) _timer->set_deadline(util::Nanoseconds(period));
+		return;
+	}
+
+	if (_timer) _timer->reset();
 }
 
 extern "C" {
 	void *get_current_thread_context()
 	{
+		Thread *current_thread = x86arch.current_x86_cpu().current_thread;
 		if (!current_thread) return NULL;
 		//assert(current_thread);
 		return &current_thread->context();
@@ -228,12 +448,14 @@ extern "C" {
 
 	void __debug_save_context()
 	{
+		Thread *current_thread = x86arch.current_x86_cpu().current_thread;
 		assert(current_thread);
 		syslog.messagef(LogLevel::DEBUG, "Save Context %p"/*" 0x%lx"*/, current_thread /*, current_thread->context()*/);
 	}
 
 	void __debug_restore_context()
 	{
+		Thread *current_thread = x86arch.current_x86_cpu().current_thread;
 		assert(current_thread);
 		syslog.messagef(LogLevel::DEBUG, "Restore Context %p" /*" 0x%lx"*/, current_thread /*, current_thread->context()*/);
 	}
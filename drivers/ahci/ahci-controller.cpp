@@ -0,0 +1,766 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/ahci/ahci-controller.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/ahci/ahci-controller.h>
+#include <infos/drivers/ahci/ahci-device.h>
+#include <infos/drivers/ata/ata-controller.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/irq.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/vma.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+#include <infos/util/time.h>
+#include <arch/arch.h>
+
+using namespace infos::drivers;
+using namespace infos::drivers::ahci;
+using namespace infos::drivers::block;
+using namespace infos::kernel;
+using namespace infos::util;
+using namespace infos::mm;
+
+ComponentLog infos::drivers::ahci::ahci_log(syslog, "ahci");
+
+const DeviceClass AHCIController::AHCIControllerDeviceClass(Device::RootDeviceClass, "ahcictl");
+
+// A 48-bit (or queued) command transfers at most this many sectors, and a 28-bit one this many.
+#define AHCI_MAX_SECTORS_PER_COMMAND	65536
+#define AHCI_MAX_SECTORS_PER_COMMAND28	256
+
+// A descriptor table entry covers at most this many bytes.
+#define AHCI_PRD_MAX_SIZE				0x400000
+
+// How long the port's engines, and the drive, are given to stop or become ready.
+#define AHCI_PORT_TIMEOUT_MS			500
+
+// The same as for the ATA queue: how long a request can be passed over in favour of ones
+// nearer the drive's heads.
+#define AHCI_READ_EXPIRY_MS				500
+#define AHCI_WRITE_EXPIRY_MS			5000
+
+static uint64_t now_ns()
+{
+	return sys.runtime().time_since_epoch().count();
+}
+
+/**
+ * Spins until the given bits of a register are clear.
+ * @return Returns false if they were still set after the timeout.
+ */
+static bool wait_clear(volatile uint32_t *reg, uint32_t bits, unsigned int timeout_ms)
+{
+	auto deadline = sys.runtime() + DurationCast<Nanoseconds>(Milliseconds(timeout_ms));
+	while (*reg & bits) {
+		if (!(sys.runtime() < deadline)) return false;
+		asm volatile("pause");
+	}
+
+	return true;
+}
+
+AHCIController::AHCIController(const AHCIControllerConfiguration& cfg) : _abar(cfg.abar), _regs(NULL), _irq(cfg.irq), _cap(0)
+{
+	for (unsigned int i = 0; i < MAX_PORTS; i++) {
+		_ports[i] = NULL;
+	}
+}
+
+/**
+ * Puts the HBA in AHCI mode, starts every implemented port that has a disk on it, and then
+ * creates the disks, which are probed with interrupts already on (if there are any).
+ */
+bool AHCIController::init(kernel::DeviceManager& dm)
+{
+	// The registers are reached through the physical memory map, which covers 4 GiB.
+	if (_abar == 0 || _abar + AHCI_PORT_BASE(MAX_PORTS) > 0x100000000ull) {
+		ahci_log.messagef(LogLevel::ERROR, "HBA registers at %lx are out of reach", _abar);
+		return false;
+	}
+
+	set_physical_cache_type(_abar, AHCI_PORT_BASE(MAX_PORTS), PTE_CACHE_UC);
+	_regs = (volatile uint32_t *)pa_to_vpa(_abar);
+
+	write(AHCI_REG_GHC, read(AHCI_REG_GHC) | AHCI_GHC_AE);
+	write(AHCI_REG_GHC, read(AHCI_REG_GHC) & ~AHCI_GHC_IE);
+
+	_cap = read(AHCI_REG_CAP);
+	uint32_t implemented = read(AHCI_REG_PI);
+
+	ahci_log.messagef(LogLevel::INFO, "Initialising AHCI HBA version=%x, ports=%x, slots=%u, ncq=%d, irq=%s",
+			read(AHCI_REG_VS), implemented, AHCI_CAP_NCS(_cap), !!(_cap & AHCI_CAP_SNCQ), _irq ? "msi" : "polled");
+
+	for (unsigned int i = 0; i < MAX_PORTS; i++) {
+		if (implemented & (1u << i)) init_port(dm, i);
+	}
+
+	write(AHCI_REG_IS, read(AHCI_REG_IS));
+	if (_irq) {
+		_irq->attach(irq_handler, this);
+		write(AHCI_REG_GHC, read(AHCI_REG_GHC) | AHCI_GHC_IE);
+	}
+
+	bool success = true;
+	for (unsigned int i = 0; i < MAX_PORTS; i++) {
+		Port *port = _ports[i];
+		if (!port) continue;
+
+		port->device = new (HeapArena::DRIVERS) AHCIDevice(*this, *port);
+		if (!dm.register_device(*port->device)) {
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+/**
+ * Sets up a port's command list, and the table of its first slot, and starts the port if
+ * there is a disk on it.  Ports with nothing (or something other than a disk) on them are
+ * left alone.
+ */
+bool AHCIController::init_port(kernel::DeviceManager& dm, unsigned int index)
+{
+	volatile uint32_t *regs = _regs + AHCI_PORT_BASE(index) / 4;
+
+	if (AHCI_PxSSTS_DET(regs[AHCI_PxSSTS / 4]) != AHCI_DET_PRESENT) return false;
+
+	FrameDescriptor *cmd_list = sys.mm().pgalloc().allocate_contiguous(1);
+	FrameDescriptor *table = sys.mm().pgalloc().allocate_contiguous(1);
+	if (!cmd_list || !table) {
+		ahci_log.messagef(LogLevel::WARNING, "No memory for the command list of port %u", index);
+		return false;
+	}
+
+	Port *port = new (HeapArena::DRIVERS) Port();
+	port->controller = this;
+	port->index = index;
+	port->regs = regs;
+
+	// The command list takes the first 1 KiB of the page, and the received FISes the next 256 bytes.
+	port->cmd_list = (CommandHeader *)sys.mm().pgalloc().pfdescr_to_vpa(cmd_list);
+	port->cmd_list_pa = sys.mm().pgalloc().pfdescr_to_pa(cmd_list);
+	port->fis_pa = port->cmd_list_pa + 0x400;
+	bzero(port->cmd_list, 0x1000);
+
+	port->device = NULL;
+	port->lba48 = false;
+	port->ncq = false;
+	port->nr_slots = 1;
+	port->busy = 0;
+
+	for (unsigned int n = 0; n < MAX_SLOTS; n++) {
+		port->slots[n].table = NULL;
+		port->slots[n].table_pa = 0;
+		port->slots[n].requests = NULL;
+	}
+
+	port->slots[0].table = (CommandTable *)sys.mm().pgalloc().pfdescr_to_vpa(table);
+	port->slots[0].table_pa = sys.mm().pgalloc().pfdescr_to_pa(table);
+	bzero(port->slots[0].table, 0x1000);
+	port->cmd_list[0].ctba = (uint32_t)port->slots[0].table_pa;
+	port->cmd_list[0].ctbau = (uint32_t)(port->slots[0].table_pa >> 32);
+
+	port->plugged = 0;
+	port->exclusive = false;
+	port->exclusive_success = false;
+
+	if (!stop_port(*port)) {
+		ahci_log.messagef(LogLevel::WARNING, "Port %u: would not stop", index);
+		return false;
+	}
+
+	port_write(*port, AHCI_PxCLB, (uint32_t)port->cmd_list_pa);
+	port_write(*port, AHCI_PxCLBU, (uint32_t)(port->cmd_list_pa >> 32));
+	port_write(*port, AHCI_PxFB, (uint32_t)port->fis_pa);
+	port_write(*port, AHCI_PxFBU, (uint32_t)(port->fis_pa >> 32));
+
+	port_write(*port, AHCI_PxSERR, 0xffffffff);
+	port_write(*port, AHCI_PxIS, 0xffffffff);
+
+	if (!start_port(*port)) {
+		ahci_log.messagef(LogLevel::WARNING, "Port %u: drive not ready, tfd=%x", index, port_read(*port, AHCI_PxTFD));
+		return false;
+	}
+
+	uint32_t signature = port_read(*port, AHCI_PxSIG);
+	if (signature != AHCI_SIG_ATA) {
+		ahci_log.messagef(LogLevel::INFO, "Port %u: not a disk (signature=%x)", index, signature);
+		stop_port(*port);
+		return false;
+	}
+
+	port_write(*port, AHCI_PxIE, AHCI_PxIS_ERRORS | AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_DSS | AHCI_PxIS_SDBS);
+
+	ahci_log.messagef(LogLevel::INFO, "Port %u: disk", index);
+	_ports[index] = port;
+
+	return true;
+}
+
+/**
+ * Stops the port's command list and FIS receive engines, which must be stopped before the
+ * port's memory is changed.
+ */
+bool AHCIController::stop_port(Port& port)
+{
+	port_write(port, AHCI_PxCMD, port_read(port, AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+	if (!wait_clear(&port.regs[AHCI_PxCMD / 4], AHCI_PxCMD_CR, AHCI_PORT_TIMEOUT_MS)) return false;
+
+	port_write(port, AHCI_PxCMD, port_read(port, AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+	return wait_clear(&port.regs[AHCI_PxCMD / 4], AHCI_PxCMD_FR, AHCI_PORT_TIMEOUT_MS);
+}
+
+/**
+ * Starts the port's engines, once the drive is ready for commands.
+ */
+bool AHCIController::start_port(Port& port)
+{
+	port_write(port, AHCI_PxCMD, port_read(port, AHCI_PxCMD) | AHCI_PxCMD_FRE);
+	if (!wait_clear(&port.regs[AHCI_PxTFD / 4], AHCI_PxTFD_BSY | AHCI_PxTFD_DRQ, AHCI_PORT_TIMEOUT_MS)) return false;
+
+	port_write(port, AHCI_PxCMD, port_read(port, AHCI_PxCMD) | AHCI_PxCMD_ST);
+	return true;
+}
+
+/**
+ * Lets the port have up to 'depth' commands in progress at once, which is only more than
+ * one with NCQ, by giving the slots their tables.
+ * @return Returns false if there was no memory for them, in which case fewer slots are used.
+ */
+bool AHCIController::set_queue_depth(Port& port, unsigned int depth)
+{
+	if (depth > AHCI_CAP_NCS(_cap)) depth = AHCI_CAP_NCS(_cap);
+	if (depth > MAX_SLOTS) depth = MAX_SLOTS;
+
+	for (unsigned int n = port.nr_slots; n < depth; n++) {
+		FrameDescriptor *table = sys.mm().pgalloc().allocate_contiguous(1);
+		if (!table) return false;
+
+		port.slots[n].table = (CommandTable *)sys.mm().pgalloc().pfdescr_to_vpa(table);
+		port.slots[n].table_pa = sys.mm().pgalloc().pfdescr_to_pa(table);
+		bzero(port.slots[n].table, 0x1000);
+
+		port.cmd_list[n].ctba = (uint32_t)port.slots[n].table_pa;
+		port.cmd_list[n].ctbau = (uint32_t)(port.slots[n].table_pa >> 32);
+
+		port.nr_slots = n + 1;
+	}
+
+	return true;
+}
+
+/**
+ * Returns the physical address of a kernel buffer, if the HBA can get at it.
+ */
+static bool dma_address(const void *buffer, size_t size, bool s64a, phys_addr_t& pa)
+{
+	uintptr_t va = (uintptr_t)buffer;
+
+	if (va >= PMEM_VA_START && va < PMEM_VA_END) {
+		pa = vpa_to_pa(va);
+	} else if (va >= KERNEL_VMEM_START) {
+		pa = kva_to_pa(va);
+	} else {
+		return false;
+	}
+
+	// The HBA only moves whole words, and, without 64-bit addressing, to 32-bit addresses.
+	return !(pa & 1) && (s64a || pa + size <= 0x100000000ull);
+}
+
+/**
+ * Returns true if the HBA can reach all of the buffers.
+ */
+bool AHCIController::dma_can_map(const IOVec *vec, unsigned int nr_vec) const
+{
+	for (unsigned int i = 0; i < nr_vec; i++) {
+		phys_addr_t pa;
+		if (!dma_address(vec[i].base, vec[i].size, _cap & AHCI_CAP_S64A, pa)) return false;
+	}
+
+	return true;
+}
+
+/**
+ * Fills in the slot's descriptor table for the buffers, from the given position in them,
+ * for up to 'size' bytes.  The table can run out of entries, or reach a buffer that the
+ * HBA can't get at, before then.
+ * @return Returns the number of entries, and sets 'size' to how many bytes they cover,
+ * which is a whole number of sectors.
+ */
+unsigned int AHCIController::dma_map(Slot& slot, const IOVec *vec, unsigned int nr_vec, unsigned int cur_vec, size_t vec_offset, size_t& size)
+{
+	PRDEntry *prdt = slot.table->prdt;
+	unsigned int nr_entries = 0;
+	size_t mapped = 0;
+
+	while (mapped < size && cur_vec < nr_vec && nr_entries < MAX_PRD_ENTRIES) {
+		if (vec_offset == vec[cur_vec].size) {
+			cur_vec++;
+			vec_offset = 0;
+			continue;
+		}
+
+		size_t region = __min(__min(vec[cur_vec].size - vec_offset, size - mapped), AHCI_PRD_MAX_SIZE);
+		uintptr_t buffer = (uintptr_t)vec[cur_vec].base + vec_offset;
+
+		phys_addr_t pa;
+		if (!dma_address((const void *)buffer, region, _cap & AHCI_CAP_S64A, pa)) break;
+
+		prdt[nr_entries].dba = (uint32_t)pa;
+		prdt[nr_entries].dbau = (uint32_t)(pa >> 32);
+		prdt[nr_entries].reserved = 0;
+		prdt[nr_entries].dbc = (uint32_t)(region - 1);
+		nr_entries++;
+
+		mapped += region;
+		vec_offset += region;
+	}
+
+	// Drop any part of a sector at the end: every transfer is a whole number of them.
+	size_t excess = mapped % 512;
+	mapped -= excess;
+
+	while (excess) {
+		PRDEntry& last = prdt[nr_entries - 1];
+		size_t region = (last.dbc & (AHCI_PRD_MAX_SIZE - 1)) + 1;
+
+		if (region <= excess) {
+			excess -= region;
+			nr_entries--;
+		} else {
+			last.dbc = (uint32_t)(region - excess - 1);
+			excess = 0;
+		}
+	}
+
+	size = mapped;
+	return nr_entries;
+}
+
+/**
+ * A synchronous transfer: a request on the caller's stack, which is queued like any other,
+ * and waited for.
+ */
+struct SyncRequest
+{
+	BlockRequest request;
+	WakeQueue *waiters;
+	volatile bool done;
+	bool success;
+};
+
+static void sync_complete(BlockRequest& request, bool success)
+{
+	SyncRequest *sync = (SyncRequest *)request.priv;
+
+	UniqueLock<SpinLock> l(sync->waiters->lock());
+	sync->success = success;
+	sync->done = true;
+
+	WakeQueue::Key key = { sync, 0 };
+	sync->waiters->wake_key_locked(key, 1);
+}
+
+/**
+ * Transfers a run of sectors, to or from buffers that the HBA can reach, and waits for it
+ * to finish.  The transfer goes through the port's queue, so it can be merged with, and is
+ * sorted among, the asynchronous requests.
+ */
+bool AHCIController::transfer(Port& port, bool write, size_t offset, const IOVec *vec, unsigned int nr_vec, size_t nr_blocks)
+{
+	SyncRequest sync;
+	sync.request.write = write;
+	sync.request.offset = offset;
+	sync.request.vec = vec;
+	sync.request.nr_vec = nr_vec;
+	sync.request.completion = sync_complete;
+	sync.request.priv = &sync;
+	sync.request.driver = port.device;
+	sync.request.nr_blocks = nr_blocks;
+	sync.waiters = &port.waiters;
+	sync.done = false;
+	sync.success = false;
+
+	queue_request(port, sync.request);
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(port.waiters.lock());
+
+	WakeQueue::Key key = { &sync, 0 };
+	while (!sync.done) wait_locked(port, key);
+
+	return sync.success;
+}
+
+/**
+ * Adds a request to the port's queue, and starts it, if there is a free slot and the port
+ * isn't plugged.  The request must be for buffers the HBA can reach (see dma_can_map()).
+ */
+void AHCIController::queue_request(Port& port, BlockRequest& request)
+{
+	port.device->stats().queued(request);
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(port.waiters.lock());
+
+	uint64_t expiry = DurationCast<Nanoseconds>(Milliseconds(request.write ? AHCI_WRITE_EXPIRY_MS : AHCI_READ_EXPIRY_MS)).count();
+	port.queue.add(request, now_ns(), expiry);
+
+	start_requests(port);
+}
+
+void AHCIController::plug(Port& port)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(port.waiters.lock());
+
+	port.plugged++;
+}
+
+void AHCIController::unplug(Port& port)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(port.waiters.lock());
+
+	assert(port.plugged);
+	if (--port.plugged == 0) {
+		start_requests(port);
+	}
+}
+
+/**
+ * Starts batches of queued requests in the port's free slots, until it runs out of one or
+ * the other.  With NCQ, that is up to the drive's queue depth of commands at once, which
+ * the drive itself can reorder; requests are only merged once they back up.  Called with
+ * the port's lock held.
+ */
+void AHCIController::start_requests(Port& port)
+{
+	uint32_t slot_mask = port.nr_slots == 32 ? 0xffffffff : (1u << port.nr_slots) - 1;
+
+	while (!port.plugged && !port.exclusive && !port.queue.empty()) {
+		uint32_t free = ~port.busy & slot_mask;
+		if (!free) break;
+
+		unsigned int n = __builtin_ctz(free);
+		Slot& slot = port.slots[n];
+
+		BlockRequest *requests = port.queue.take_batch(now_ns(), MAX_BATCH_BLOCKS, MAX_BATCH_VEC);
+
+		slot.requests = requests;
+		slot.write = requests->write;
+		slot.offset = requests->offset;
+		slot.nr_blocks = 0;
+		slot.nr_done = 0;
+		slot.nr_in_flight = 0;
+		slot.nr_vec = 0;
+
+		for (BlockRequest *r = requests; r; r = r->next) {
+			for (unsigned int i = 0; i < r->nr_vec && slot.nr_vec < MAX_BATCH_VEC; i++) {
+				slot.vec[slot.nr_vec++] = r->vec[i];
+			}
+
+			slot.nr_blocks += r->nr_blocks;
+			port.device->stats().started(*r);
+			if (r != requests) port.device->stats().merged(1);
+		}
+
+		// The first request is taken whatever its size, so it may have too many buffers.
+		if (iovec_size(slot.vec, slot.nr_vec) == slot.nr_blocks * 512 && start_slot(port, n)) {
+			continue;
+		}
+
+		complete_slot(port, n, false);
+	}
+}
+
+/**
+ * Issues the command for the next part of the slot's batch: as much of it as one command
+ * (and descriptor table) can take.
+ * @return Returns false if the command couldn't be issued.
+ */
+bool AHCIController::start_slot(Port& port, unsigned int n)
+{
+	Slot& slot = port.slots[n];
+
+	unsigned int cur_vec = 0;
+	size_t vec_offset = 0;
+	iovec_advance(slot.vec, slot.nr_vec, cur_vec, vec_offset, slot.nr_done * 512);
+
+	size_t max_sectors = port.lba48 ? AHCI_MAX_SECTORS_PER_COMMAND : AHCI_MAX_SECTORS_PER_COMMAND28;
+	size_t size = __min(slot.nr_blocks - slot.nr_done, max_sectors) * 512;
+
+	unsigned int nr_entries = dma_map(slot, slot.vec, slot.nr_vec, cur_vec, vec_offset, size);
+	if (!nr_entries) return false;
+
+	uint8_t command;
+	if (port.ncq) {
+		command = slot.write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+	} else if (port.lba48) {
+		command = slot.write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+	} else {
+		command = slot.write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+	}
+
+	slot.nr_in_flight = size / 512;
+	issue(port, n, command, slot.offset + slot.nr_done, slot.nr_in_flight, nr_entries, slot.write);
+
+	return true;
+}
+
+/**
+ * Completes every request of the slot's batch, and frees the slot.  Called with the port's
+ * lock held, which is dropped while the requests are completed, so that their completions
+ * can submit more.
+ */
+void AHCIController::complete_slot(Port& port, unsigned int n, bool success)
+{
+	BlockRequest *request = port.slots[n].requests;
+	port.slots[n].requests = NULL;
+	port.busy &= ~(1u << n);
+
+	port.waiters.lock().unlock();
+
+	while (request) {
+		// The completion may reuse the request.
+		BlockRequest *next = request->next;
+		port.device->stats().completed(*request, success);
+		request->complete(success);
+		request = next;
+	}
+
+	port.waiters.lock().lock();
+}
+
+/**
+ * Builds the command FIS and header of a slot, whose descriptor table is filled in, and
+ * issues it.  A queued (NCQ) command is tagged with its slot, and has its sector count
+ * in the features register.
+ */
+void AHCIController::issue(Port& port, unsigned int n, uint8_t command, uint64_t lba, size_t count, unsigned int nr_entries, bool write)
+{
+	Slot& slot = port.slots[n];
+	uint8_t *fis = slot.table->cfis;
+
+	bool queued = command == ATA_CMD_READ_FPDMA_QUEUED || command == ATA_CMD_WRITE_FPDMA_QUEUED;
+	bool lba28 = command == ATA_CMD_READ_DMA || command == ATA_CMD_WRITE_DMA;
+
+	bzero(fis, 20);
+	fis[0] = AHCI_FIS_REG_H2D;
+	fis[1] = AHCI_FIS_C;
+	fis[2] = command;
+
+	fis[4] = (uint8_t)lba;
+	fis[5] = (uint8_t)(lba >> 8);
+	fis[6] = (uint8_t)(lba >> 16);
+	fis[7] = count ? 0x40 : 0;		// LBA mode, for the commands with an address.
+
+	if (lba28) {
+		fis[7] |= (uint8_t)((lba >> 24) & 0x0f);
+	} else {
+		fis[8] = (uint8_t)(lba >> 24);
+		fis[9] = (uint8_t)(lba >> 32);
+		fis[10] = (uint8_t)(lba >> 40);
+	}
+
+	// A count of zero is the most the command takes.
+	if (queued) {
+		fis[3] = (uint8_t)count;
+		fis[11] = (uint8_t)(count >> 8);
+		fis[12] = (uint8_t)(n << 3);
+	} else {
+		fis[12] = (uint8_t)count;
+		fis[13] = (uint8_t)(count >> 8);
+	}
+
+	CommandHeader& header = port.cmd_list[n];
+	header.flags = AHCI_CMDH_FIS_LEN | (write ? AHCI_CMDH_WRITE : 0);
+	header.prdtl = (uint16_t)nr_entries;
+	header.prdbc = 0;
+
+	__sync_synchronize();
+
+	port.busy |= 1u << n;
+	if (queued) port_write(port, AHCI_PxSACT, 1u << n);
+	port_write(port, AHCI_PxCI, 1u << n);
+}
+
+/**
+ * Carries out a command that can't be queued alongside others (e.g. IDENTIFY, or a cache
+ * flush), with the port to itself: the port stops starting requests, waits for the ones
+ * in progress to finish, and starts them again afterwards.
+ * @param buffer Where the data the command reads goes, if it reads any.
+ */
+bool AHCIController::execute(Port& port, uint8_t command, void *buffer, size_t size)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(port.waiters.lock());
+
+	WakeQueue::Key key = { &port, 0 };
+
+	while (port.exclusive) wait_locked(port, key);
+	port.exclusive = true;
+
+	while (port.busy) wait_locked(port, key);
+
+	bool success = false;
+
+	unsigned int nr_entries = 0;
+	size_t mapped = size;
+	if (size) {
+		IOVec vec = { buffer, size };
+		nr_entries = dma_map(port.slots[0], &vec, 1, 0, 0, mapped);
+	}
+
+	if (mapped == size) {
+		port.exclusive_success = true;
+		issue(port, 0, command, 0, 0, nr_entries, false);
+
+		while (port.busy & 1) wait_locked(port, key);
+		success = port.exclusive_success;
+	}
+
+	port.exclusive = false;
+	port.waiters.wake_key_locked(key, ~0u);
+
+	start_requests(port);
+	return success;
+}
+
+/**
+ * Returns true if requests can be left to the interrupt to complete.
+ */
+bool AHCIController::can_wait_for_irq() const
+{
+	return _irq && sys.scheduler().active() && sys.arch().interrupts_enabled();
+}
+
+/**
+ * Waits for something to happen on the port, with its lock held: for the interrupt, or,
+ * on a polled controller (or before there is a scheduler to sleep in), by checking the
+ * port.  Callers check what they are waiting for again afterwards.
+ */
+void AHCIController::wait_locked(Port& port, const WakeQueue::Key& key)
+{
+	if (_irq && sys.scheduler().active()) {
+		port.waiters.sleep_locked(Thread::current(), key);
+		return;
+	}
+
+	service_port(port);
+
+	port.waiters.lock().unlock();
+	asm volatile("pause");
+	port.waiters.lock().lock();
+}
+
+/**
+ * Handles whatever has happened on the port: finished commands, whose slots carry on with
+ * the rest of their batches, or are completed and reused, and errors, which fail every
+ * command in progress.  Called with the port's lock held.
+ */
+void AHCIController::service_port(Port& port)
+{
+	uint32_t status = port_read(port, AHCI_PxIS);
+	port_write(port, AHCI_PxIS, status);
+
+	if (status & AHCI_PxIS_ERRORS) {
+		ahci_log.messagef(LogLevel::ERROR, "Port %u: error is=%x, tfd=%x, serr=%x", port.index, status,
+				port_read(port, AHCI_PxTFD), port_read(port, AHCI_PxSERR));
+		recover_port(port);
+	} else {
+		// A queued command has finished once the drive clears its bit of SACT, and any
+		// other when the HBA clears its bit of CI.
+		uint32_t active = port_read(port, AHCI_PxSACT) | port_read(port, AHCI_PxCI);
+		uint32_t done = port.busy & ~active;
+
+		while (done) {
+			unsigned int n = __builtin_ctz(done);
+			done &= ~(1u << n);
+
+			Slot& slot = port.slots[n];
+			if (!slot.requests) {
+				port.busy &= ~(1u << n);
+				continue;
+			}
+
+			slot.nr_done += slot.nr_in_flight;
+			slot.nr_in_flight = 0;
+
+			if (slot.nr_done < slot.nr_blocks) {
+				if (start_slot(port, n)) continue;
+				complete_slot(port, n, false);
+			} else {
+				complete_slot(port, n, true);
+			}
+		}
+	}
+
+	start_requests(port);
+
+	if (port.exclusive) {
+		WakeQueue::Key key = { &port, 0 };
+		port.waiters.wake_key_locked(key, ~0u);
+	}
+}
+
+/**
+ * Restarts a port after an error, which throws away every command in progress, and fails
+ * them.
+ */
+void AHCIController::recover_port(Port& port)
+{
+	stop_port(port);
+
+	port_write(port, AHCI_PxSERR, 0xffffffff);
+	port_write(port, AHCI_PxIS, 0xffffffff);
+
+	if (!start_port(port)) {
+		ahci_log.messagef(LogLevel::ERROR, "Port %u: drive not ready after error, tfd=%x", port.index, port_read(port, AHCI_PxTFD));
+	}
+
+	uint32_t busy = port.busy;
+	while (busy) {
+		unsigned int n = __builtin_ctz(busy);
+		busy &= ~(1u << n);
+
+		if (port.slots[n].requests) {
+			complete_slot(port, n, false);
+		} else {
+			port.busy &= ~(1u << n);
+			port.exclusive_success = false;
+		}
+	}
+}
+
+/**
+ * Handles the HBA's interrupt, which is raised for any port with something to report.
+ * Each port's status is cleared before the HBA's, so that nothing newer is lost.
+ */
+void AHCIController::irq_handler(const IRQ *irq, void *priv)
+{
+	AHCIController& ctrl = *(AHCIController *)priv;
+
+	uint32_t pending = ctrl.read(AHCI_REG_IS);
+
+	for (unsigned int i = 0; i < MAX_PORTS; i++) {
+		Port *port = ctrl._ports[i];
+		if (!port || !(pending & (1u << i))) continue;
+
+		UniqueLock<SpinLock> l(port->waiters.lock());
+		ctrl.service_port(*port);
+	}
+
+	ctrl.write(AHCI_REG_IS, pending);
+}
@@ -0,0 +1,319 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/ahci/ahci-device.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/ahci/ahci-device.h>
+#include <infos/drivers/ahci/ahci-controller.h>
+#include <infos/drivers/ata/ata-controller.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::ahci;
+using namespace infos::drivers::block;
+using namespace infos::util;
+using namespace infos::mm;
+
+const DeviceClass AHCIDevice::AHCIDeviceClass(BlockDevice::BlockDeviceClass, "sata");
+
+AHCIDevice::AHCIDevice(AHCIController& controller, AHCIController::Port& port)
+: _ctrl(controller),
+_port(port),
+_cmdsets(0),
+_size(0)
+{
+
+}
+
+/**
+ * Identifies the drive, and sets the port up to queue as many commands as the drive can
+ * take, if it (and the HBA) can do NCQ.
+ */
+bool AHCIDevice::init(kernel::DeviceManager& dm)
+{
+	uint8_t *buffer = new (HeapArena::DRIVERS) uint8_t[512];
+	if (!buffer)
+		return false;
+
+	if (!_ctrl.execute(_port, ATA_CMD_IDENTIFY, buffer, 512)) {
+		ahci_log.messagef(LogLevel::ERROR, "Port %u: IDENTIFY failed", _port.index);
+		sys.mm().objalloc().free(buffer);
+		return false;
+	}
+
+	uint16_t caps = *(uint16_t *) (buffer + ATA_IDENT_CAPABILITIES);
+	uint16_t sata_caps = *(uint16_t *) (buffer + ATA_IDENT_SATA_CAPS);
+	unsigned int queue_depth = (*(uint16_t *) (buffer + ATA_IDENT_QUEUE_DEPTH) & 0x1f) + 1;
+	_cmdsets = *(uint32_t *) (buffer + ATA_IDENT_COMMANDSETS);
+
+	_port.lba48 = (_cmdsets & (1 << 26)) != 0;
+	if (_port.lba48) {
+		_size = *(uint64_t *) (buffer + ATA_IDENT_MAX_LBA_EXT);
+	} else {
+		_size = *(uint32_t *) (buffer + ATA_IDENT_MAX_LBA);
+	}
+
+	char model[41];
+	for (int i = 0; i < 40; i += 2) {
+		model[i] = buffer[ATA_IDENT_MODEL + i + 1];
+		model[i + 1] = buffer[ATA_IDENT_MODEL + i];
+	}
+
+	for (int i = 40; i > 0; i--) {
+		model[i] = 0;
+		if (model[i - 1] != ' ') break;
+	}
+
+	sys.mm().objalloc().free(buffer);
+
+	if ((caps & 0x200) == 0) {
+		ahci_log.messagef(LogLevel::ERROR, "drive does not support lba addressing mode");
+		return false;
+	}
+
+	// Queued commands are 48-bit, so NCQ needs LBA48 as well.  Nothing else is using the
+	// port yet.
+	if ((sata_caps & ATA_SATA_CAP_NCQ) && _port.lba48 && (_ctrl._cap & AHCI_CAP_SNCQ) && _ctrl.has_irq()) {
+		_ctrl.set_queue_depth(_port, queue_depth);
+		_port.ncq = true;
+	}
+
+	ahci_log.messagef(LogLevel::INFO, "model=%s, size=%llu, lba48=%d, ncq=%d, slots=%u", model, _size, _port.lba48, _port.ncq, _port.nr_slots);
+
+	return check_for_partitions();
+}
+
+bool AHCIDevice::check_for_partitions()
+{
+	uint8_t *buffer = new (HeapArena::DRIVERS) uint8_t[512];
+	if (!buffer)
+		return false;
+
+	if (!read_blocks(buffer, 0, 1)) {
+		sys.mm().objalloc().free(buffer);
+		return false;
+	}
+
+	bool result = true;
+	if (buffer[0x1fe] == 0x55 && buffer[0x1ff] == 0xaa) {
+		ahci_log.messagef(LogLevel::INFO, "disk has partitions!");
+		result = create_partitions(buffer);
+	}
+
+	sys.mm().objalloc().free(buffer);
+	return result;
+}
+
+bool AHCIDevice::create_partitions(const uint8_t* partition_table)
+{
+	struct partition_table_entry {
+		uint8_t status;
+		uint8_t first_absolute_sector[3];
+		uint8_t type;
+		uint8_t last_absolute_sector[3];
+		uint32_t first_absolute_sector_lba;
+		uint32_t nr_sectors;
+	} __packed;
+
+	for (int partition_table_index = 0; partition_table_index < 4; partition_table_index++) {
+		const struct partition_table_entry *pte = (const partition_table_entry *)&partition_table[0x1be + (16 * partition_table_index)];
+
+		if (pte->type == 0) {
+			continue;
+		}
+
+		ahci_log.messagef(LogLevel::INFO, "partition %u active @ lba=%x, sz=%x", partition_table_index, pte->first_absolute_sector_lba, pte->nr_sectors);
+
+		auto partition_device = new (HeapArena::DRIVERS) BlockDevicePartition(*this, pte->first_absolute_sector_lba, pte->nr_sectors);
+		_partitions.append(partition_device);
+
+		sys.device_manager().register_device(*partition_device);
+
+		String partition_name = name() + "p" + ToString(partition_table_index);
+		sys.device_manager().add_device_alias(partition_name, *partition_device);
+	}
+
+	return true;
+}
+
+size_t AHCIDevice::block_count() const
+{
+	return _size;
+}
+
+size_t AHCIDevice::block_size() const
+{
+	return 512;
+}
+
+bool AHCIDevice::read_blocks(void* buffer, size_t offset, size_t count)
+{
+	IOVec vec = { buffer, count * 512 };
+	return transfer(false, offset, &vec, 1, count);
+}
+
+bool AHCIDevice::write_blocks(const void* buffer, size_t offset, size_t count)
+{
+	IOVec vec = { (void *) buffer, count * 512 };
+	return transfer(true, offset, &vec, 1, count);
+}
+
+/**
+ * Returns the number of sectors in the buffers, or zero if one of them isn't a whole
+ * number of sectors.
+ */
+static size_t vec_sectors(const IOVec *vec, unsigned int nr_vec)
+{
+	size_t count = 0;
+	for (unsigned int i = 0; i < nr_vec; i++) {
+		if (vec[i].size % 512) return 0;
+		count += vec[i].size / 512;
+	}
+
+	return count;
+}
+
+bool AHCIDevice::read_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	size_t count = vec_sectors(vec, nr_vec);
+	if (!count) return false;
+
+	return transfer(false, offset, vec, nr_vec, count);
+}
+
+bool AHCIDevice::write_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	size_t count = vec_sectors(vec, nr_vec);
+	if (!count) return false;
+
+	return transfer(true, offset, vec, nr_vec, count);
+}
+
+/**
+ * Transfers a run of sectors, and waits for it.  Buffers the HBA can't get at go through
+ * a bounce buffer instead.
+ */
+bool AHCIDevice::transfer(bool write, uint64_t lba, const IOVec *vec, unsigned int nr_vec, size_t nr_blocks)
+{
+	if (lba > _size || nr_blocks > _size - lba) {
+		return false;
+	}
+
+	if (!_ctrl.dma_can_map(vec, nr_vec)) {
+		return transfer_bounced(write, lba, vec, nr_vec, nr_blocks);
+	}
+
+	return _ctrl.transfer(_port, write, lba, vec, nr_vec, nr_blocks);
+}
+
+/**
+ * Transfers a run of sectors a page at a time, through a page the HBA can reach.
+ */
+bool AHCIDevice::transfer_bounced(bool write, uint64_t lba, const IOVec *vec, unsigned int nr_vec, size_t nr_blocks)
+{
+	FrameDescriptor *page = sys.mm().pgalloc().allocate_contiguous(1);
+	if (!page) return false;
+
+	uint8_t *bounce = (uint8_t *)sys.mm().pgalloc().pfdescr_to_vpa(page);
+
+	unsigned int cur_vec = 0;
+	size_t vec_offset = 0;
+	bool success = true;
+
+	while (nr_blocks && success) {
+		size_t nr_chunk = __min(nr_blocks, __page_size / 512);
+		IOVec chunk = { bounce, nr_chunk * 512 };
+
+		// Copies between the bounce page and the buffers, from the current position.
+		unsigned int copy_vec = cur_vec;
+		size_t copy_offset = vec_offset;
+
+		if (write) {
+			for (size_t done = 0; done < chunk.size; ) {
+				size_t n = __min(vec[copy_vec].size - copy_offset, chunk.size - done);
+				memcpy(bounce + done, (uint8_t *)vec[copy_vec].base + copy_offset, n);
+				done += n;
+				iovec_advance(vec, nr_vec, copy_vec, copy_offset, n);
+			}
+		}
+
+		success = _ctrl.transfer(_port, write, lba, &chunk, 1, nr_chunk);
+
+		if (success && !write) {
+			for (size_t done = 0; done < chunk.size; ) {
+				size_t n = __min(vec[copy_vec].size - copy_offset, chunk.size - done);
+				memcpy((uint8_t *)vec[copy_vec].base + copy_offset, bounce + done, n);
+				done += n;
+				iovec_advance(vec, nr_vec, copy_vec, copy_offset, n);
+			}
+		}
+
+		iovec_advance(vec, nr_vec, cur_vec, vec_offset, chunk.size);
+		lba += nr_chunk;
+		nr_blocks -= nr_chunk;
+	}
+
+	sys.mm().pgalloc().free_contiguous(page, 1);
+	return success;
+}
+
+/**
+ * Writes the drive's write cache out to the disk, if it has one.  A flush can't be queued,
+ * so it waits for the commands in progress to finish first.
+ */
+bool AHCIDevice::flush()
+{
+	uint8_t command;
+	if (_cmdsets & (ATA_CMDSET_FLUSH_EXT << 16)) {
+		command = ATA_CMD_CACHE_FLUSH_EXT;
+	} else if (_cmdsets & (ATA_CMDSET_FLUSH << 16)) {
+		command = ATA_CMD_CACHE_FLUSH;
+	} else {
+		return true;
+	}
+
+	return _ctrl.execute(_port, command, NULL, 0);
+}
+
+/**
+ * Requests for buffers the HBA can reach are queued on the port, and go straight to the
+ * drive while it has free command slots (up to 32 of them with NCQ), in the order of the
+ * queue's elevator.  Each is completed from the interrupt at the end of its last command.
+ * Without an interrupt, or for other buffers, the request is done synchronously.
+ */
+void AHCIDevice::submit(BlockRequest& request)
+{
+	size_t count = vec_sectors(request.vec, request.nr_vec);
+	if (!count || request.offset > _size || count > _size - request.offset) {
+		request.complete(false);
+		return;
+	}
+
+	if (!_ctrl.can_wait_for_irq() || !_ctrl.dma_can_map(request.vec, request.nr_vec)) {
+		BlockDevice::submit(request);
+		return;
+	}
+
+	request.driver = this;
+	request.nr_blocks = count;
+
+	_ctrl.queue_request(_port, request);
+}
+
+void AHCIDevice::plug()
+{
+	_ctrl.plug(_port);
+}
+
+void AHCIDevice::unplug()
+{
+	_ctrl.unplug(_port);
+}
@@ -11,14 +11,26 @@
 #include <infos/drivers/ata/ata-controller.h>
 #include <infos/drivers/ata/ata-device.h>
 #include <infos/util/lock.h>
+#include <infos/drivers/irq/ioapic.h>
+#include <infos/drivers/irq/lapic.h>
 #include <infos/kernel/kernel.h>
+#include <infos/kernel/async-group.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/irq.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <arch/arch.h>
 #include <arch/x86/pio.h>
 
 using namespace infos::drivers;
 using namespace infos::drivers::ata;
+using namespace infos::drivers::irq;
 using namespace infos::kernel;
 using namespace infos::arch::x86;
 using namespace infos::util;
+using namespace infos::mm;
 
 ComponentLog infos::drivers::ata::ata_log(syslog, "ata");
 
@@ -26,7 +38,33 @@ DeviceClass ATAController::ATAControllerDeviceClass(Device::RootDeviceClass, "at
 
 #define PORT_OR_BASE_ADDRESS(__v, __p) ((__v == 0) ? (__p) : (__v & ~3))
 
-ATAController::ATAController(IRQ& irq, const ATAControllerConfiguration& cfg) : _irq(irq)
+// How long an asynchronous request can be passed over in favour of ones nearer the
+// drive's heads.  Reads are usually waited for, so they are let wait less.
+#define ATA_READ_EXPIRY_MS		500
+#define ATA_WRITE_EXPIRY_MS		5000
+
+// Bus-master DMA is only used if asked for (ata.dma=1), until it has been run on a booted
+// system: a bad PRD table would have the drive write wherever it points.
+static bool dma_enabled;
+
+RegisterCmdLineArgument(ATADMAEnable, "ata.dma") {
+	dma_enabled = (strncmp(value, "1", 2) == 0);
+}
+
+// How long a drive has to answer IDENTIFY, when the channel is probed, before it is taken
+// to be missing.
+static unsigned int probe_timeout_ms = 1000;
+
+RegisterCmdLineArgument(ATAProbeTimeout, "ata.probe_timeout") {
+	unsigned int ms = 0;
+	for (const char *c = value; *c >= '0' && *c <= '9'; c++) {
+		ms = (ms * 10) + (*c - '0');
+	}
+
+	probe_timeout_ms = ms;
+}
+
+ATAController::ATAController(const ATAControllerConfiguration& cfg) : _bus_master(cfg.bus_master)
 {
 	channels[ATA_PRIMARY].base = PORT_OR_BASE_ADDRESS(cfg.BAR[0], 0x1F0);
 	channels[ATA_PRIMARY].ctrl = PORT_OR_BASE_ADDRESS(cfg.BAR[1], 0x3F6);
@@ -38,6 +76,25 @@ ATAController::ATAController(IRQ& irq, const ATAControllerConfiguration& cfg) :
 
 	channels[ATA_PRIMARY].nIEN = 2;
 	channels[ATA_SECONDARY].nIEN = 2;
+
+	// A channel in compatibility mode (with no I/O ports of its own) has the ISA IRQ.
+	channels[ATA_PRIMARY].legacy_irq = cfg.BAR[0] == 0 ? 14 : -1;
+	channels[ATA_SECONDARY].legacy_irq = cfg.BAR[2] == 0 ? 15 : -1;
+
+	for (int channel = 0; channel < 2; channel++) {
+		channels[channel].controller = this;
+		channels[channel].index = channel;
+
+		channels[channel].owned = false;
+		channels[channel].batch.requests = NULL;
+		channels[channel].plugged = 0;
+
+		channels[channel].prdt = NULL;
+		channels[channel].prdt_pa = 0;
+		channels[channel].irq = NULL;
+		channels[channel].irq_pending = false;
+	}
+
 }
 
 bool ATAController::init(kernel::DeviceManager& dm)
@@ -50,25 +107,510 @@ bool ATAController::init(kernel::DeviceManager& dm)
 
 	//UniqueLock<IRQLock> l(IRQLock::Instance);
 
+	for (int channel = 0; channel < 2; channel++) {
+		init_irq(dm, channel);
+		if (_bus_master && dma_enabled) init_dma(channel);
+	}
+
+	// Each channel can only ask one of its drives at a time whether it is there, and a
+	// missing one may only be given up on once it has timed out, so the channels are
+	// probed alongside one another.
+	{
+		AsyncGroup probes("ata-probe");
+		probes.run(probe_channel_threadproc, &channels[ATA_SECONDARY]);
+		probe_channel(ATA_PRIMARY);
+	}
+
+	// The drives are attached afterwards, in order, so that their names don't depend on
+	// which channel answered first.
 	bool success = true;
 	for (int channel = 0; channel < 2; channel++) {
-		success &= probe_channel(dm, channel);
+		for (int device = 0; device < 2; device++) {
+			switch (channels[channel].probe_result[device]) {
+			case PROBE_PRESENT:
+				success &= attach_device(dm, channel, device);
+				break;
+
+			case PROBE_ERROR:
+				success = false;
+				break;
+
+			default:
+				break;
+			}
+		}
 	}
 
 	return success;
 }
 
-bool ATAController::probe_channel(kernel::DeviceManager& dm, int channel)
+/**
+ * Hooks up the interrupt of a channel in compatibility mode, which has the ISA IRQ, so that
+ * a thread waiting for the drive sleeps rather than polls.  Other channels are polled.
+ */
+void ATAController::init_irq(kernel::DeviceManager& dm, int channel)
 {
-	bool success = true;
-	for (int slave = 0; slave < 2; slave++) {
-		success &= probe_device(dm, channel, slave);
+	ChannelRegisters& ch = channels[channel];
+
+	LAPIC *lapic;
+	IOAPIC *ioapic;
+	if (ch.legacy_irq >= 0 && dm.try_get_device_by_class(LAPIC::LAPICDeviceClass, lapic) &&
+			dm.try_get_device_by_class(IOAPIC::IOAPICDeviceClass, ioapic)) {
+		ch.irq = ioapic->request_physical_irq(lapic, ch.legacy_irq);
+	}
+
+	if (!ch.irq) {
+		ata_log.messagef(LogLevel::INFO, "Channel %d: polled", channel);
+		return;
+	}
+
+	ch.irq->attach(irq_handler, &ch);
+
+	// Let the devices on the channel raise interrupts.
+	ch.nIEN = 0;
+	ata_write(channel, ATA_REG_CONTROL, ch.nIEN);
+
+	ata_log.messagef(LogLevel::INFO, "Channel %d: irq %d", channel, ch.legacy_irq);
+}
+
+/**
+ * Sets a channel up for bus-master DMA, with a descriptor table in memory the controller
+ * can reach.  If there is no table, the channel stays PIO-only.
+ */
+void ATAController::init_dma(int channel)
+{
+	ChannelRegisters& ch = channels[channel];
+
+	FrameDescriptor *prdt = sys.mm().pgalloc().allocate_contiguous(1);
+	if (!prdt) {
+		ata_log.messagef(LogLevel::WARNING, "No memory for the DMA descriptors of channel %d", channel);
+		return;
+	}
+
+	ch.prdt = (PRDEntry *)sys.mm().pgalloc().pfdescr_to_vpa(prdt);
+	ch.prdt_pa = (uint32_t)sys.mm().pgalloc().pfdescr_to_pa(prdt);
+
+	// Clear out anything left over from the firmware.
+	ata_write(channel, ATA_REG_BMCOMMAND, 0);
+	ata_write(channel, ATA_REG_BMSTATUS, ATA_BMSR_ERR | ATA_BMSR_IRQ);
+
+	ata_log.messagef(LogLevel::INFO, "Channel %d: bus-master DMA", channel);
+}
+
+/**
+ * Takes ownership of the channel, for a synchronous transfer, waiting until any
+ * asynchronous requests already queued on it have finished.
+ */
+void ATAController::acquire_channel(int channel)
+{
+	ChannelRegisters& ch = channels[channel];
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(ch.owner_waiters.lock());
+
+	while (ch.owned) {
+		ch.owner_waiters.sleep_locked(Thread::current());
+	}
+
+	ch.owned = true;
+}
+
+/**
+ * Gives up ownership of the channel, to the queue of asynchronous requests if there are
+ * any, or to a thread waiting for it.
+ */
+void ATAController::release_channel(int channel)
+{
+	ChannelRegisters& ch = channels[channel];
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(ch.owner_waiters.lock());
+
+	start_next_request(channel);
+}
+
+static uint64_t now_ns()
+{
+	return sys.runtime().time_since_epoch().count();
+}
+
+/**
+ * Adds an asynchronous request to the channel's queue, and starts the queue if the channel
+ * is idle, and not plugged.  The request must be for buffers the controller can reach (see
+ * dma_can_map()), on a channel with an interrupt, which is where requests are completed,
+ * and the next ones started.
+ */
+void ATAController::queue_request(int channel, block::BlockRequest& request)
+{
+	ChannelRegisters& ch = channels[channel];
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(ch.owner_waiters.lock());
+
+	uint64_t expiry = DurationCast<Nanoseconds>(Milliseconds(request.write ? ATA_WRITE_EXPIRY_MS : ATA_READ_EXPIRY_MS)).count();
+	ch.queue.add(request, now_ns(), expiry);
+
+	if (!ch.owned && !ch.plugged) {
+		ch.owned = true;
+		start_next_request(channel);
+	}
+}
+
+/**
+ * Holds back the channel's queue, so that requests submitted in the meantime can be
+ * merged and sorted, rather than the first being started on its own.
+ */
+void ATAController::plug(int channel)
+{
+	ChannelRegisters& ch = channels[channel];
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(ch.owner_waiters.lock());
+
+	ch.plugged++;
+}
+
+void ATAController::unplug(int channel)
+{
+	ChannelRegisters& ch = channels[channel];
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(ch.owner_waiters.lock());
+
+	assert(ch.plugged);
+	if (--ch.plugged == 0 && !ch.owned && !ch.queue.empty()) {
+		ch.owned = true;
+		start_next_request(channel);
+	}
+}
+
+/**
+ * Starts the next batch of queued requests, on a channel that the caller owns, or, if there
+ * isn't one (or the channel is plugged), gives up ownership of the channel.  Called with the
+ * owner lock held, which is dropped while a batch that couldn't be started is completed.
+ */
+void ATAController::start_next_request(int channel)
+{
+	ChannelRegisters& ch = channels[channel];
+	RequestBatch& batch = ch.batch;
+
+	while (!ch.plugged && !ch.queue.empty()) {
+		block::BlockRequest *requests = ch.queue.take_batch(now_ns(), MAX_BATCH_BLOCKS, MAX_BATCH_VEC);
+
+		batch.requests = requests;
+		batch.write = requests->write;
+		batch.offset = requests->offset;
+		batch.nr_blocks = 0;
+		batch.nr_done = 0;
+		batch.nr_in_flight = 0;
+		batch.nr_vec = 0;
+
+		block::BlockDeviceStats& stats = ((ATADevice *)requests->driver)->stats();
+		for (block::BlockRequest *r = requests; r; r = r->next) {
+			for (unsigned int i = 0; i < r->nr_vec && batch.nr_vec < MAX_BATCH_VEC; i++) {
+				batch.vec[batch.nr_vec++] = r->vec[i];
+			}
+
+			batch.nr_blocks += r->nr_blocks;
+			stats.started(*r);
+			if (r != requests) stats.merged(1);
+		}
+
+		// The first request is taken whatever its size, so it may have too many buffers.
+		if (iovec_size(batch.vec, batch.nr_vec) == batch.nr_blocks * 512 &&
+				((ATADevice *)requests->driver)->start_batch(batch)) {
+			return;
+		}
+
+		complete_batch(channel, false);
+	}
+
+	ch.owned = false;
+	ch.owner_waiters.wake_one_locked();
+}
+
+/**
+ * Completes every request of the batch in progress.  Called with the owner lock held, which
+ * is dropped while the requests are completed, so that their completions can submit more.
+ */
+void ATAController::complete_batch(int channel, bool success)
+{
+	ChannelRegisters& ch = channels[channel];
+
+	block::BlockRequest *request = ch.batch.requests;
+	ch.batch.requests = NULL;
+
+	ch.owner_waiters.lock().unlock();
+
+	while (request) {
+		// The completion may reuse the request.
+		block::BlockRequest *next = request->next;
+		((ATADevice *)request->driver)->stats().completed(*request, success);
+		request->complete(success);
+		request = next;
+	}
+
+	ch.owner_waiters.lock().lock();
+}
+
+/**
+ * Returns the physical address of a kernel buffer, if it is in one of the linear mappings
+ * of physical memory (so is physically contiguous), and is somewhere the controller can
+ * reach.
+ */
+static bool dma_address(const void *buffer, size_t size, phys_addr_t& pa)
+{
+	uintptr_t va = (uintptr_t)buffer;
+
+	if (va >= PMEM_VA_START && va < PMEM_VA_END) {
+		pa = vpa_to_pa(va);
+	} else if (va >= KERNEL_VMEM_START) {
+		pa = kva_to_pa(va);
+	} else {
+		return false;
+	}
+
+	// The controller only moves whole words, to 32-bit addresses.
+	return !(pa & 1) && pa + size <= 0x100000000ull;
+}
+
+/**
+ * Returns true if the controller can reach all of the buffers, so that they can be moved
+ * by DMA alone.
+ */
+bool ATAController::dma_can_map(const IOVec *vec, unsigned int nr_vec) const
+{
+	for (unsigned int i = 0; i < nr_vec; i++) {
+		phys_addr_t pa;
+		if (!dma_address(vec[i].base, vec[i].size, pa)) return false;
 	}
 
 	return true;
 }
 
-bool ATAController::probe_device(kernel::DeviceManager& dm, int channel, int device)
+/**
+ * Fills in the channel's descriptor table for the buffers, from the given position in them,
+ * for up to 'size' bytes.  The table can run out of entries, or reach a buffer that the
+ * controller can't get at, before then.
+ * @return Returns how many bytes the table covers, which is a whole number of sectors, and
+ * zero if DMA can't be used for even one sector.
+ */
+size_t ATAController::dma_map(int channel, const IOVec *vec, unsigned int nr_vec, unsigned int cur_vec, size_t vec_offset, size_t size)
+{
+	ChannelRegisters& ch = channels[channel];
+
+	unsigned int nr_entries = 0;
+	size_t mapped = 0;
+
+	while (mapped < size && cur_vec < nr_vec) {
+		if (vec_offset == vec[cur_vec].size) {
+			cur_vec++;
+			vec_offset = 0;
+			continue;
+		}
+
+		size_t remaining = __min(vec[cur_vec].size - vec_offset, size - mapped);
+		uintptr_t buffer = (uintptr_t)vec[cur_vec].base + vec_offset;
+
+		phys_addr_t pa;
+		if (!dma_address((const void *)buffer, remaining, pa)) break;
+
+		while (remaining && nr_entries < MAX_PRD_ENTRIES) {
+			// A region can't cross a 64 KiB boundary.
+			size_t region = __min(remaining, 0x10000 - (pa & 0xffff));
+
+			ch.prdt[nr_entries].base = (uint32_t)pa;
+			ch.prdt[nr_entries].size = (uint16_t)(region & 0xffff);
+			ch.prdt[nr_entries].flags = 0;
+			nr_entries++;
+
+			pa += region;
+			mapped += region;
+			vec_offset += region;
+			remaining -= region;
+		}
+
+		if (remaining) break;
+	}
+
+	// Drop any part of a sector at the end: every transfer is a whole number of them.
+	size_t excess = mapped % 512;
+	mapped -= excess;
+
+	while (excess) {
+		PRDEntry& last = ch.prdt[nr_entries - 1];
+		size_t region = last.size ? last.size : 0x10000;
+
+		if (region <= excess) {
+			excess -= region;
+			nr_entries--;
+		} else {
+			last.size = (uint16_t)((region - excess) & 0xffff);
+			excess = 0;
+		}
+	}
+
+	if (!nr_entries) return 0;
+
+	ch.prdt[nr_entries - 1].flags = ATA_PRD_EOT;
+	return mapped;
+}
+
+/**
+ * Points the channel at its descriptor table, ready for a command to be issued.  Called
+ * with the channel lock held.
+ */
+void ATAController::dma_prepare(int channel, bool to_memory)
+{
+	ChannelRegisters& ch = channels[channel];
+
+	__outl(ch.bmide + (ATA_REG_BMPRDT - ATA_REG_BMCOMMAND), ch.prdt_pa);
+	ata_write(channel, ATA_REG_BMCOMMAND, to_memory ? ATA_BMCMD_READ : 0);
+	ata_write(channel, ATA_REG_BMSTATUS, ATA_BMSR_ERR | ATA_BMSR_IRQ);
+}
+
+/**
+ * Starts the transfer of the command that has just been issued, and waits for it to
+ * finish, sleeping until the channel's interrupt where it can, or polling the controller.
+ * @return Returns true if the transfer succeeded.
+ */
+bool ATAController::dma_run(int channel)
+{
+	dma_start(channel);
+
+	if (can_wait_for_irq(channel)) {
+		wait_for_irq(channel);
+	} else {
+		while (!(ata_read(channel, ATA_REG_BMSTATUS) & (ATA_BMSR_IRQ | ATA_BMSR_ERR))) {
+			asm volatile("pause");
+		}
+	}
+
+	return dma_finish(channel);
+}
+
+/**
+ * Starts the controller moving the data of the command that has just been issued.
+ */
+void ATAController::dma_start(int channel)
+{
+	uint8_t cmd = ata_read(channel, ATA_REG_BMCOMMAND);
+	ata_write(channel, ATA_REG_BMCOMMAND, cmd | ATA_BMCMD_START);
+}
+
+/**
+ * Stops the controller, once the drive has said the transfer is over, and checks how it
+ * went.
+ * @return Returns true if the transfer succeeded.
+ */
+bool ATAController::dma_finish(int channel)
+{
+	uint8_t cmd = ata_read(channel, ATA_REG_BMCOMMAND);
+	ata_write(channel, ATA_REG_BMCOMMAND, cmd & ~ATA_BMCMD_START);
+
+	uint8_t bm_status = ata_read(channel, ATA_REG_BMSTATUS);
+	ata_write(channel, ATA_REG_BMSTATUS, ATA_BMSR_ERR | ATA_BMSR_IRQ);
+
+	// Reading the status also acknowledges the device's interrupt.
+	uint8_t status = ata_read(channel, ATA_REG_STATUS);
+
+	if ((bm_status & ATA_BMSR_ERR) || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+		ata_log.messagef(LogLevel::ERROR, "DMA transfer failed: bm-status=%x, status=%x", bm_status, status);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Returns true if the calling thread can sleep until the channel's interrupt: the channel
+ * has one, and the scheduler is running.  Before then, e.g. while the disks are probed,
+ * the drive is polled.
+ */
+bool ATAController::can_wait_for_irq(int channel) const
+{
+	return channels[channel].irq && sys.scheduler().active() && sys.arch().interrupts_enabled();
+}
+
+/**
+ * Sleeps until the channel's interrupt, if it hasn't already arrived since arm_irq() was
+ * called (which is done just before a command is issued), and consumes it.
+ */
+void ATAController::wait_for_irq(int channel)
+{
+	ChannelRegisters& ch = channels[channel];
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(ch.irq_waiters.lock());
+
+	while (!ch.irq_pending) {
+		ch.irq_waiters.sleep_locked(Thread::current());
+	}
+
+	ch.irq_pending = false;
+}
+
+/**
+ * The interrupt of a channel: a drive has finished a command, or is ready for the next
+ * sector of one.  Reading the status acknowledges it.  If a batch of asynchronous requests
+ * is in progress, its transfer has finished, and the batch is carried on with, or completed
+ * (in which case the next one is started).  Otherwise, the thread waiting for the drive is
+ * woken.
+ */
+void ATAController::irq_handler(const IRQ *irq, void *priv)
+{
+	ChannelRegisters& ch = *(ChannelRegisters *)priv;
+	ATAController& ctrl = *ch.controller;
+
+	__inb(ch.base + ATA_REG_STATUS);
+
+	UniqueLock<SpinLock> l(ch.owner_waiters.lock());
+
+	RequestBatch& batch = ch.batch;
+	if (!batch.requests) {
+		UniqueLock<SpinLock> il(ch.irq_waiters.lock());
+		ch.irq_pending = true;
+		ch.irq_waiters.wake_one_locked();
+		return;
+	}
+
+	ATADevice& dev = *(ATADevice *)batch.requests->driver;
+
+	bool success = ctrl.dma_finish(ch.index);
+	if (success) {
+		batch.nr_done += batch.nr_in_flight;
+		batch.nr_in_flight = 0;
+
+		// A batch too big for one command carries on with the next.
+		if (batch.nr_done < batch.nr_blocks) {
+			if (dev.start_batch(batch)) return;
+			success = false;
+		}
+	}
+
+	ctrl.complete_batch(ch.index, success);
+	ctrl.start_next_request(ch.index);
+}
+
+void ATAController::probe_channel_threadproc(void *arg)
+{
+	ChannelRegisters *ch = (ChannelRegisters *)arg;
+	ch->controller->probe_channel(ch->index);
+}
+
+void ATAController::probe_channel(int channel)
+{
+	for (int device = 0; device < 2; device++) {
+		channels[channel].probe_result[device] = probe_device(channel, device);
+	}
+}
+
+/**
+ * Finds out whether there is a drive at a position on a channel, by asking it to identify
+ * itself.  Nothing answers for a missing drive (or the bus floats), so one that hasn't
+ * answered within ata.probe_timeout ms is taken to be missing.
+ */
+ATAController::ProbeResult ATAController::probe_device(int channel, int device)
 {
 	ata_log.messagef(LogLevel::DEBUG, "Probing device %d:%d", channel, device);
 
@@ -78,23 +620,34 @@ bool ATAController::probe_device(kernel::DeviceManager& dm, int channel, int dev
 	ata_write(channel, ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
 	sys.spin_delay(Milliseconds(1));
 
-	if (ata_read(channel, ATA_REG_STATUS) == 0) return true;
+	uint8_t status = ata_read(channel, ATA_REG_STATUS);
+	if (status == 0 || status == 0xff) return PROBE_ABSENT;
 
+	auto deadline = sys.runtime() + DurationCast<Nanoseconds>(Milliseconds(probe_timeout_ms));
 	while (true) {
-		uint8_t status = ata_read(channel, ATA_REG_STATUS);
+		status = ata_read(channel, ATA_REG_STATUS);
 		if (status & ATA_SR_ERR) {
-			ata_log.message(LogLevel::ERROR, "ATA device error");
-			return false;
+			ata_log.messagef(LogLevel::ERROR, "ATA device %d:%d error", channel, device);
+			return PROBE_ERROR;
 		}
 
 		if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRQ)) {
 			break;
 		}
+
+		if (!(sys.runtime() < deadline)) {
+			ata_log.messagef(LogLevel::WARNING, "ATA device %d:%d didn't answer, status=%02x", channel, device, status);
+			return PROBE_ABSENT;
+		}
 	}
 
-	ata_log.messagef(LogLevel::INFO, "Found ATA device");
+	ata_log.messagef(LogLevel::INFO, "Found ATA device %d:%d", channel, device);
+	return PROBE_PRESENT;
+}
 
-	ATADevice *dev = new ATADevice(*this, channel, device);
+bool ATAController::attach_device(kernel::DeviceManager& dm, int channel, int device)
+{
+	ATADevice *dev = new (HeapArena::DRIVERS) ATADevice(*this, channel, device);
 	if (!dm.register_device(*dev)) {
 		delete dev;
 		return false;
@@ -190,3 +743,16 @@ int ATAController::ata_poll(int channel, bool error_check)
 
 	return 0; // No Error.
 }
+
+/**
+ * Waits for a drive on the channel to raise its interrupt, after a command has been issued
+ * or a sector moved, then checks the status as ata_poll() does.  The calling thread sleeps
+ * whilst the drive works, if it can, and otherwise polls.
+ */
+int ATAController::ata_wait(int channel, bool error_check)
+{
+	if (!can_wait_for_irq(channel)) return ata_poll(channel, error_check);
+
+	wait_for_irq(channel);
+	return ata_poll(channel, error_check);
+}
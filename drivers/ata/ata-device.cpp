@@ -21,20 +21,27 @@ using namespace infos::drivers::ata;
 using namespace infos::drivers::block;
 using namespace infos::util;
 using namespace infos::arch::x86;
+using namespace infos::mm;
+
+// A 48-bit command transfers at most this many sectors, and a 28-bit one this many.
+#define ATA_MAX_SECTORS_PER_COMMAND		65536
+#define ATA_MAX_SECTORS_PER_COMMAND28	256
 
 const DeviceClass ATADevice::ATADeviceClass(BlockDevice::BlockDeviceClass, "ata");
 
 ATADevice::ATADevice(ATAController& controller, int channel, int drive)
 : _ctrl(controller),
 _channel(channel & 1),
-_drive(drive & 1)
+_drive(drive & 1),
+_lba48(false),
+_dma(false)
 {
 
 }
 
 bool ATADevice::init(kernel::DeviceManager& dm)
 {
-	uint8_t *buffer = new uint8_t[128 * 4];
+	uint8_t *buffer = new (HeapArena::DRIVERS) uint8_t[128 * 4];
 	if (!buffer)
 		return false;
 
@@ -44,8 +51,9 @@ bool ATADevice::init(kernel::DeviceManager& dm)
 	_caps = *(uint16_t *) (buffer + ATA_IDENT_CAPABILITIES);
 	_cmdsets = *(uint32_t *) (buffer + ATA_IDENT_COMMANDSETS);
 
-	if (_cmdsets & (1 << 26)) {
-		_size = *(uint32_t *) (buffer + ATA_IDENT_MAX_LBA_EXT);
+	_lba48 = (_cmdsets & (1 << 26)) != 0;
+	if (_lba48) {
+		_size = *(uint64_t *) (buffer + ATA_IDENT_MAX_LBA_EXT);
 	} else {
 		_size = *(uint32_t *) (buffer + ATA_IDENT_MAX_LBA);
 	}
@@ -61,7 +69,7 @@ bool ATADevice::init(kernel::DeviceManager& dm)
 		if (model[i - 1] != ' ') break;
 	}
 
-	ata_log.messagef(LogLevel::DEBUG, "model=%s, size=%u, caps=%x", model, _size, _caps);
+	ata_log.messagef(LogLevel::DEBUG, "model=%s, size=%llu, caps=%x, lba48=%d", model, _size, _caps, _lba48);
 
 	sys.mm().objalloc().free(buffer);
 
@@ -69,13 +77,17 @@ bool ATADevice::init(kernel::DeviceManager& dm)
 		ata_log.messagef(LogLevel::ERROR, "drive does not support lba addressing mode");
 		return false;
 	}
+
+	// DMA needs the drive to support it, and the channel to be set up for it.
+	_dma = (_caps & 0x100) && _ctrl.dma_available(_channel);
+	ata_log.messagef(LogLevel::DEBUG, "transfers by %s", _dma ? "dma" : "pio");
 	
 	return check_for_partitions();
 }
 
 bool ATADevice::check_for_partitions()
 {
-	uint8_t *buffer = new uint8_t[512];
+	uint8_t *buffer = new (HeapArena::DRIVERS) uint8_t[512];
 	if (!buffer)
 		return false;
 	
@@ -118,7 +130,7 @@ bool ATADevice::create_partitions(const uint8_t* partition_table)
 		memcpy(&first_sector, pte->first_absolute_sector, sizeof pte->first_absolute_sector);
 		ata_log.messagef(LogLevel::INFO, "partition %u active @ off=%x, sz=%x", partition_table_index, (unsigned) first_sector, pte->nr_sectors);
 		
-		auto partition_device = new infos::drivers::block::BlockDevicePartition(*this, pte->first_absolute_sector_lba, pte->nr_sectors);
+		auto partition_device = new (HeapArena::DRIVERS) infos::drivers::block::BlockDevicePartition(*this, pte->first_absolute_sector_lba, pte->nr_sectors);
 		_partitions.append(partition_device);
 
 		sys.device_manager().register_device(*partition_device);
@@ -142,12 +154,118 @@ size_t ATADevice::block_size() const
 
 bool ATADevice::read_blocks(void* buffer, size_t offset, size_t count)
 {
-	return transfer(0, offset, buffer, count);
+	IOVec vec = { buffer, count * 512 };
+	return transfer(ATA_READ, offset, &vec, 1, count);
 }
 
 bool ATADevice::write_blocks(const void* buffer, size_t offset, size_t count)
 {
-	return transfer(1, offset, (void *) buffer, count);
+	IOVec vec = { (void *) buffer, count * 512 };
+	return transfer(ATA_WRITE, offset, &vec, 1, count);
+}
+
+/**
+ * Returns the number of sectors in the buffers, or zero if one of them isn't a whole
+ * number of sectors.
+ */
+static size_t vec_sectors(const IOVec *vec, unsigned int nr_vec)
+{
+	size_t count = 0;
+	for (unsigned int i = 0; i < nr_vec; i++) {
+		if (vec[i].size % 512) return 0;
+		count += vec[i].size / 512;
+	}
+
+	return count;
+}
+
+/**
+ * Reads into all of the buffers with one command (or as few as the sector count allows),
+ * moving from one buffer to the next as each sector comes in.
+ */
+bool ATADevice::read_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	size_t count = vec_sectors(vec, nr_vec);
+	if (!count) return false;
+
+	return transfer(ATA_READ, offset, vec, nr_vec, count);
+}
+
+/**
+ * Writes all of the buffers with one command (or as few as the sector count allows).
+ */
+bool ATADevice::write_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	size_t count = vec_sectors(vec, nr_vec);
+	if (!count) return false;
+
+	return transfer(ATA_WRITE, offset, vec, nr_vec, count);
+}
+
+/**
+ * Writes the drive's write cache out to the disk, if it has one.
+ */
+bool ATADevice::flush()
+{
+	uint8_t command;
+	if (_cmdsets & (ATA_CMDSET_FLUSH_EXT << 16)) {
+		command = ATA_CMD_CACHE_FLUSH_EXT;
+	} else if (_cmdsets & (ATA_CMDSET_FLUSH << 16)) {
+		command = ATA_CMD_CACHE_FLUSH;
+	} else {
+		return true;
+	}
+
+	_ctrl.acquire_channel(_channel);
+
+	while (ata_read(ATA_REG_STATUS) & ATA_SR_BSY) asm volatile("pause");
+
+	ata_write(ATA_REG_HDDEVSEL, 0xA0 | (_drive << 4));
+
+	_ctrl.arm_irq(_channel);
+	ata_write(ATA_REG_COMMAND, command);
+
+	ata_wait();
+	bool success = !(ata_read(ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF));
+
+	_ctrl.release_channel(_channel);
+	return success;
+}
+
+/**
+ * Requests for buffers the controller can reach, on a channel that has its interrupt, are
+ * queued on the channel, where requests that follow on from one another are merged, and
+ * carried out by DMA: each batch is completed, and the next started, by the interrupt at
+ * the end of its last command.  Anything else is done synchronously.
+ */
+void ATADevice::submit(BlockRequest& request)
+{
+	size_t count = vec_sectors(request.vec, request.nr_vec);
+	if (!count || request.offset > _size || count > _size - request.offset) {
+		request.complete(false);
+		return;
+	}
+
+	if (!_dma || !_ctrl.can_wait_for_irq(_channel) || !_ctrl.dma_can_map(request.vec, request.nr_vec)) {
+		BlockDevice::submit(request);
+		return;
+	}
+
+	request.driver = this;
+	request.nr_blocks = count;
+	stats().queued(request);
+
+	_ctrl.queue_request(_channel, request);
+}
+
+void ATADevice::plug()
+{
+	_ctrl.plug(_channel);
+}
+
+void ATADevice::unplug()
+{
+	_ctrl.unplug(_channel);
 }
 
 uint8_t ATADevice::ata_read(int reg)
@@ -170,38 +288,200 @@ int ATADevice::ata_poll(bool error_check)
 	return _ctrl.ata_poll(_channel, error_check);
 }
 
-bool ATADevice::transfer(int direction, uint64_t lba, void* buffer, size_t nr_blocks)
+int ATADevice::ata_wait(bool error_check)
+{
+	return _ctrl.ata_wait(_channel, error_check);
+}
+
+size_t ATADevice::max_sectors_per_command() const
+{
+	return _lba48 ? ATA_MAX_SECTORS_PER_COMMAND : ATA_MAX_SECTORS_PER_COMMAND28;
+}
+
+/**
+ * Transfers a run of sectors, of any length, splitting it into the largest commands the
+ * drive takes.  A DMA command is cut short where its descriptor table ends (e.g. because
+ * the buffers are fragmented), and the next command carries on from there.
+ */
+bool ATADevice::transfer(int direction, uint64_t lba, const IOVec *vec, unsigned int nr_vec, size_t nr_blocks)
 {
-	UniqueLock<Mutex> l(_ctrl._mtx[_channel]);
+	if (lba > _size || nr_blocks > _size - lba) {
+		return false;
+	}
+
+	// Waiting for the channel is queue time.
+	uint64_t queued_at = stats().begin();
+	_ctrl.acquire_channel(_channel);
+
+	uint64_t started_at = BlockDeviceStats::now();
+	bool success = transfer_locked(direction, lba, vec, nr_vec, nr_blocks);
+	_ctrl.release_channel(_channel);
+
+	stats().end(direction == ATA_WRITE, nr_blocks, queued_at, started_at, success);
+
+	return success;
+}
+
+/**
+ * Carries out a transfer on the channel, which the caller owns.
+ */
+bool ATADevice::transfer_locked(int direction, uint64_t lba, const IOVec *vec, unsigned int nr_vec, size_t nr_blocks)
+{
+	unsigned int cur_vec = 0;
+	size_t vec_offset = 0;
+
+	while (nr_blocks > 0) {
+		size_t nr_command_blocks = __min(nr_blocks, max_sectors_per_command());
+
+		// As much as the descriptor table covers goes by DMA.  Buffers the controller
+		// can't get at are moved by PIO instead.
+		size_t nr_dma_blocks = 0;
+		if (_dma) {
+			nr_dma_blocks = _ctrl.dma_map(_channel, vec, nr_vec, cur_vec, vec_offset, nr_command_blocks * 512) / 512;
+		}
+
+		if (nr_dma_blocks) {
+			if (!transfer_dma(direction, lba, nr_dma_blocks)) {
+				return false;
+			}
+
+			iovec_advance(vec, nr_vec, cur_vec, vec_offset, nr_dma_blocks * 512);
+			nr_command_blocks = nr_dma_blocks;
+		} else if (!transfer_pio(direction, lba, vec, nr_vec, cur_vec, vec_offset, nr_command_blocks)) {
+			return false;
+		}
+
+		lba += nr_command_blocks;
+		nr_blocks -= nr_command_blocks;
+	}
+
+	return true;
+}
+
+/**
+ * Issues the DMA command for the next part of a batch of asynchronous requests, as much of
+ * it as one command (and descriptor table) can take, and returns without waiting for it.
+ * Called by the controller, on the channel the batch owns, with interrupts disabled.
+ * @return Returns false if the command couldn't be issued.
+ */
+bool ATADevice::start_batch(ATAController::RequestBatch& batch)
+{
+	unsigned int cur_vec = 0;
+	size_t vec_offset = 0;
+	iovec_advance(batch.vec, batch.nr_vec, cur_vec, vec_offset, batch.nr_done * 512);
+
+	size_t nr_blocks = __min(batch.nr_blocks - batch.nr_done, max_sectors_per_command());
+	nr_blocks = _ctrl.dma_map(_channel, batch.vec, batch.nr_vec, cur_vec, vec_offset, nr_blocks * 512) / 512;
+	if (!nr_blocks) return false;
+
+	int direction = batch.write ? ATA_WRITE : ATA_READ;
+
+	batch.nr_in_flight = nr_blocks;
+
+	_ctrl.dma_prepare(_channel, direction == ATA_READ);
+	issue_command(direction, true, batch.offset + batch.nr_done, nr_blocks);
+	_ctrl.dma_start(_channel);
+
+	return true;
+}
+
+/**
+ * Selects the drive, and issues a read or write command for a run of sectors: a 48-bit
+ * command, if the drive has them, or a 28-bit one.  Called with the channel lock held.
+ */
+void ATADevice::issue_command(int direction, bool dma, uint64_t lba, size_t nr_blocks)
+{
+	uint8_t command;
 
 	while (ata_read(ATA_REG_STATUS) & ATA_SR_BSY) asm volatile("pause");
 
-	ata_write(ATA_REG_HDDEVSEL, 0xE0 | (_drive << 4));
+	if (_lba48) {
+		ata_write(ATA_REG_HDDEVSEL, 0xE0 | (_drive << 4));
+
+		// A count of zero means 65536 sectors.
+		ata_write(ATA_REG_SECCOUNT1, (nr_blocks >> 8) & 0xff);
+		ata_write(ATA_REG_LBA3, (lba >> 24) & 0xff);
+		ata_write(ATA_REG_LBA4, (lba >> 32) & 0xff);
+		ata_write(ATA_REG_LBA5, (lba >> 40) & 0xff);
+
+		if (dma) {
+			command = direction ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+		} else {
+			command = direction ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_READ_PIO_EXT;
+		}
+	} else {
+		// The top four bits of a 28-bit address go in with the drive.
+		ata_write(ATA_REG_HDDEVSEL, 0xE0 | (_drive << 4) | ((lba >> 24) & 0x0f));
 
-	ata_write(ATA_REG_SECCOUNT1, 0);
-	ata_write(ATA_REG_LBA3, (lba >> 24) & 0xff);
-	ata_write(ATA_REG_LBA4, (lba >> 32) & 0xff);
-	ata_write(ATA_REG_LBA5, (lba >> 40) & 0xff);
+		if (dma) {
+			command = direction ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+		} else {
+			command = direction ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO;
+		}
+	}
 
-	ata_write(ATA_REG_SECCOUNT0, nr_blocks);
+	// A count of zero means 256 sectors, or 65536 with the high byte.
+	ata_write(ATA_REG_SECCOUNT0, nr_blocks & 0xff);
 	ata_write(ATA_REG_LBA0, (lba >> 0) & 0xff);
 	ata_write(ATA_REG_LBA1, (lba >> 8) & 0xff);
 	ata_write(ATA_REG_LBA2, (lba >> 16) & 0xff);
 
-	if (direction) {
-		ata_write(ATA_REG_COMMAND, ATA_CMD_WRITE_PIO_EXT);
-	} else {
-		ata_write(ATA_REG_COMMAND, ATA_CMD_READ_PIO_EXT);
+	_ctrl.arm_irq(_channel);
+	ata_write(ATA_REG_COMMAND, command);
+}
 
-		uint8_t *p = (uint8_t *) buffer;
-		for (size_t cur_block = 0; cur_block < nr_blocks; cur_block++) {
-			if (ata_poll(true)) {
-				return false;
-			}
-			
+/**
+ * Moves up to max_sectors_per_command() sectors with one DMA command, using the
+ * descriptor table that has just been filled in for them.  The CPU is free while the
+ * controller moves the data.  Called with the channel lock held.
+ */
+bool ATADevice::transfer_dma(int direction, uint64_t lba, size_t nr_blocks)
+{
+	_ctrl.dma_prepare(_channel, direction == ATA_READ);
+	issue_command(direction, true, lba, nr_blocks);
+
+	return _ctrl.dma_run(_channel);
+}
+
+/**
+ * Issues one PIO command, for up to max_sectors_per_command() sectors, and moves each
+ * sector through the data port, moving the position in the buffers on past them.  The
+ * drive raises its interrupt when each sector is ready to be read, or (after the first)
+ * written, and the calling thread sleeps until then.  Called with the channel lock held.
+ */
+bool ATADevice::transfer_pio(int direction, uint64_t lba, const IOVec *vec, unsigned int nr_vec, unsigned int& cur_vec, size_t& vec_offset, size_t nr_blocks)
+{
+	issue_command(direction, false, lba, nr_blocks);
+
+	for (size_t cur_block = 0; cur_block < nr_blocks; cur_block++) {
+		// The drive asks for the first sector of a write without an interrupt.
+		int rc = (direction && cur_block == 0) ? ata_poll(true) : ata_wait(true);
+		if (rc) {
+			return false;
+		}
+
+		while (cur_vec < nr_vec && vec_offset == vec[cur_vec].size) {
+			cur_vec++;
+			vec_offset = 0;
+		}
+
+		if (cur_vec == nr_vec) return false;
+
+		uint8_t *p = (uint8_t *) vec[cur_vec].base + vec_offset;
+		if (direction) {
+			__outsw(_ctrl.channels[_channel].base, (uintptr_t)p, (512 / 2));
+		} else {
 			__insw(_ctrl.channels[_channel].base, (uintptr_t)p, (512 / 2));
+		}
 
-			p += 512;
+		vec_offset += 512;
+	}
+
+	// Wait for the last sector to be written.  It may only have reached the drive's
+	// cache: see flush().
+	if (direction) {
+		if (ata_wait() || (ata_read(ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF))) {
+			return false;
 		}
 	}
 
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/block/block-benchmark.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/benchmark.h>
+#include <infos/kernel/kernel.h>
+#include <infos/drivers/block/block-device.h>
+#include <infos/drivers/ata/ata-device.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::block;
+using namespace infos::drivers::ata;
+using namespace infos::util;
+
+/*
+ * Reads straight from a block device, with no cache in front of it, at a spread of request
+ * sizes.  Each iteration is one request, carrying on from where the last one stopped, so the
+ * results are in cycles per request.  The device is the one given by bench.blockdev=, or the
+ * first ATA disk.
+ */
+
+#define MAX_REQUEST_BLOCKS	256
+
+static char bench_blockdev[16];
+
+RegisterCmdLineArgument(BenchBlockDevice, "bench.blockdev")
+{
+	strncpy(bench_blockdev, value, sizeof(bench_blockdev) - 1);
+}
+
+static uint8_t *request_buffer;
+
+static void read_blocks(unsigned int iterations, size_t nr_blocks)
+{
+	BlockDevice *bdev;
+
+	if (bench_blockdev[0]) {
+		if (!sys.device_manager().try_get_device_by_name(bench_blockdev, bdev)) {
+			benchmark_skip("the device given with bench.blockdev= doesn't exist");
+			return;
+		}
+	} else if (!sys.device_manager().try_get_device_by_class(ATADevice::ATADeviceClass, bdev)) {
+		benchmark_skip("there is no ATA disk");
+		return;
+	}
+
+	if (bdev->block_size() * nr_blocks > MAX_REQUEST_BLOCKS * 512 || bdev->block_count() < nr_blocks) {
+		benchmark_skip("the device's blocks are too big, or there are too few of them");
+		return;
+	}
+
+	if (!request_buffer) {
+		request_buffer = new uint8_t[MAX_REQUEST_BLOCKS * 512];
+		if (!request_buffer) {
+			benchmark_skip("no memory for the buffer");
+			return;
+		}
+	}
+
+	size_t nr_requests = bdev->block_count() / nr_blocks;
+	for (unsigned int i = 0; i < iterations; i++) {
+		if (!bdev->read_blocks(request_buffer, (i % nr_requests) * nr_blocks, nr_blocks)) {
+			benchmark_skip("a read failed");
+			return;
+		}
+	}
+}
+
+RegisterBenchmark(BlockRead1, "block.read-1", 64)
+{
+	read_blocks(iterations, 1);
+}
+
+RegisterBenchmark(BlockRead8, "block.read-8", 64)
+{
+	read_blocks(iterations, 8);
+}
+
+RegisterBenchmark(BlockRead64, "block.read-64", 16)
+{
+	read_blocks(iterations, 64);
+}
+
+RegisterBenchmark(BlockRead256, "block.read-256", 4)
+{
+	read_blocks(iterations, 256);
+}
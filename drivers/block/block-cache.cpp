@@ -0,0 +1,325 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/block/block-cache.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/block/block-cache.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::drivers;
+using namespace infos::drivers::block;
+using namespace infos::util;
+using namespace infos::mm;
+
+// How many blocks each cache keeps, by default: 512 KiB of 512-byte blocks.
+#define BLOCK_CACHE_DEFAULT_BLOCKS		1024
+
+// The read-ahead window when a sequential read is first spotted.  It doubles from here.
+#define BLOCK_CACHE_MIN_READAHEAD		8
+
+static unsigned int block_cache_max_blocks = BLOCK_CACHE_DEFAULT_BLOCKS;
+
+// Every cache there is, for drop_all().
+static BlockCache *block_caches;
+static Mutex block_caches_lock;
+
+RegisterCmdLineArgument(BlockCacheSize, "blockcache.blocks") {
+	unsigned int blocks = 0;
+	for (const char *c = value; *c >= '0' && *c <= '9'; c++) {
+		blocks = (blocks * 10) + (*c - '0');
+	}
+
+	BlockCache::max_blocks(blocks);
+}
+
+const DeviceClass BlockCache::BlockCacheClass(BlockDevice::BlockDeviceClass, "block-cache");
+
+void BlockCache::max_blocks(unsigned int max_blocks)
+{
+	block_cache_max_blocks = max_blocks;
+}
+
+BlockCache::BlockCache(BlockDevice& underlying_block_device)
+	: _underlying_block_device(underlying_block_device), _lru_head(NULL), _lru_tail(NULL), _nr_buffers(0),
+	_next_sequential(0), _readahead(0), _transfer(NULL), _next_cache(NULL)
+{
+	for (unsigned int i = 0; i < NR_BUCKETS; i++) {
+		_buckets[i] = NULL;
+	}
+
+	_mtx.set_name("blockcache");
+
+	UniqueLock<Mutex> l(block_caches_lock);
+	_next_cache = block_caches;
+	block_caches = this;
+}
+
+BlockCache::~BlockCache()
+{
+	{
+		UniqueLock<Mutex> l(block_caches_lock);
+
+		BlockCache **link = &block_caches;
+		while (*link != this) {
+			link = &(*link)->_next_cache;
+		}
+		*link = _next_cache;
+	}
+
+	while (_lru_head) {
+		Buffer *buffer = _lru_head;
+		_lru_head = buffer->lru_next;
+
+		delete[] (uint8_t *)buffer;
+	}
+
+	delete[] _transfer;
+}
+
+void BlockCache::drop_all()
+{
+	UniqueLock<Mutex> l(block_caches_lock);
+
+	for (BlockCache *cache = block_caches; cache; cache = cache->_next_cache) {
+		cache->drop();
+	}
+}
+
+void BlockCache::drop()
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	while (_lru_head) {
+		Buffer *buffer = _lru_head;
+		_lru_head = buffer->lru_next;
+
+		delete[] (uint8_t *)buffer;
+	}
+
+	for (unsigned int i = 0; i < NR_BUCKETS; i++) {
+		_buckets[i] = NULL;
+	}
+
+	_lru_tail = NULL;
+	_nr_buffers = 0;
+	_next_sequential = 0;
+	_readahead = 0;
+}
+
+BlockCache::Buffer *BlockCache::find(size_t block) const
+{
+	for (Buffer *buffer = _buckets[block % NR_BUCKETS]; buffer; buffer = buffer->hash_next) {
+		if (buffer->block == block) return buffer;
+	}
+
+	return NULL;
+}
+
+void BlockCache::lru_unlink(Buffer *buffer)
+{
+	if (buffer->lru_prev) {
+		buffer->lru_prev->lru_next = buffer->lru_next;
+	} else {
+		_lru_head = buffer->lru_next;
+	}
+
+	if (buffer->lru_next) {
+		buffer->lru_next->lru_prev = buffer->lru_prev;
+	} else {
+		_lru_tail = buffer->lru_prev;
+	}
+}
+
+void BlockCache::lru_push(Buffer *buffer)
+{
+	buffer->lru_prev = NULL;
+	buffer->lru_next = _lru_head;
+
+	if (_lru_head) {
+		_lru_head->lru_prev = buffer;
+	} else {
+		_lru_tail = buffer;
+	}
+
+	_lru_head = buffer;
+}
+
+void BlockCache::touch(Buffer *buffer)
+{
+	lru_unlink(buffer);
+	lru_push(buffer);
+}
+
+/**
+ * Caches a copy of a block that has just been read, reusing the least recently used
+ * buffer if the cache is full.  Called with the lock held.
+ */
+void BlockCache::insert(size_t block, const void *data)
+{
+	Buffer *buffer = find(block);
+	if (buffer) {
+		touch(buffer);
+		return;
+	}
+
+	if (_nr_buffers >= block_cache_max_blocks) {
+		buffer = _lru_tail;
+		if (!buffer) return;
+
+		lru_unlink(buffer);
+
+		Buffer **link = &_buckets[buffer->block % NR_BUCKETS];
+		while (*link != buffer) {
+			link = &(*link)->hash_next;
+		}
+		*link = buffer->hash_next;
+	} else {
+		buffer = (Buffer *)new (HeapArena::DRIVERS) uint8_t[sizeof(Buffer) + block_size()];
+		if (!buffer) return;
+
+		_nr_buffers++;
+	}
+
+	buffer->block = block;
+	memcpy(buffer->data, data, block_size());
+
+	buffer->hash_next = _buckets[block % NR_BUCKETS];
+	_buckets[block % NR_BUCKETS] = buffer;
+	lru_push(buffer);
+}
+
+bool BlockCache::read_blocks(void *buffer, size_t offset, size_t count)
+{
+	IOVec vec = { buffer, count * block_size() };
+	return read_blocks_vec(&vec, 1, offset);
+}
+
+/**
+ * Copies the blocks out of the cache, reading the ones that aren't cached in with as few
+ * device transfers as possible: a run of missing blocks is read in one go, along with the
+ * read-ahead window, even if it spans more than one of the buffers.
+ */
+bool BlockCache::read_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	if (!block_cache_max_blocks) {
+		return _underlying_block_device.read_blocks_vec(vec, nr_vec, offset);
+	}
+
+	size_t bs = block_size();
+
+	size_t count = 0;
+	for (unsigned int i = 0; i < nr_vec; i++) {
+		if (vec[i].size % bs) return false;
+		count += vec[i].size / bs;
+	}
+
+	if (offset + count > block_count()) return false;
+
+	UniqueLock<Mutex> l(_mtx);
+
+	if (!_transfer) {
+		_transfer = new (HeapArena::DRIVERS) uint8_t[MAX_READAHEAD * bs];
+		if (!_transfer) return _underlying_block_device.read_blocks_vec(vec, nr_vec, offset);
+	}
+
+	// Spot reads that carry on from where the last one stopped.
+	if (offset == _next_sequential) {
+		_readahead = _readahead ? __min(_readahead * 2, MAX_READAHEAD) : BLOCK_CACHE_MIN_READAHEAD;
+	} else {
+		_readahead = 0;
+	}
+
+	_next_sequential = offset + count;
+
+	size_t done = 0;
+	for (unsigned int i = 0; i < nr_vec; i++) {
+		size_t vec_blocks = vec[i].size / bs;
+
+		for (size_t j = 0; j < vec_blocks;) {
+			size_t block = offset + done;
+			uint8_t *dst = (uint8_t *)vec[i].base + (j * bs);
+
+			Buffer *cached = find(block);
+			if (cached) {
+				memcpy(dst, cached->data, bs);
+				touch(cached);
+
+				j++;
+				done++;
+				continue;
+			}
+
+			// Read the blocks that were asked for and aren't cached, in one go, along
+			// with the read-ahead window.  The ones that belong to the later buffers
+			// are found in the cache when their turn comes.
+			size_t nr_missing = 1;
+			while (done + nr_missing < count && nr_missing < MAX_READAHEAD && !find(block + nr_missing)) {
+				nr_missing++;
+			}
+
+			size_t nr_blocks = __max(nr_missing, _readahead);
+			nr_blocks = __min(nr_blocks, MAX_READAHEAD);
+			nr_blocks = __min(nr_blocks, block_count() - block);
+
+			if (!_underlying_block_device.read_blocks(_transfer, block, nr_blocks)) {
+				return false;
+			}
+
+			for (size_t k = 0; k < nr_blocks; k++) {
+				insert(block + k, _transfer + (k * bs));
+			}
+
+			size_t nr_copied = __min(nr_missing, vec_blocks - j);
+			memcpy(dst, _transfer, nr_copied * bs);
+
+			j += nr_copied;
+			done += nr_copied;
+		}
+	}
+
+	return true;
+}
+
+bool BlockCache::write_blocks(const void *buffer, size_t offset, size_t count)
+{
+	IOVec vec = { (void *)buffer, count * block_size() };
+	return write_blocks_vec(&vec, 1, offset);
+}
+
+/**
+ * Writes the blocks through to the device, as one request, and updates any cached copies
+ * of them.
+ */
+bool BlockCache::write_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	if (!block_cache_max_blocks) {
+		return _underlying_block_device.write_blocks_vec(vec, nr_vec, offset);
+	}
+
+	UniqueLock<Mutex> l(_mtx);
+
+	if (!_underlying_block_device.write_blocks_vec(vec, nr_vec, offset)) {
+		return false;
+	}
+
+	size_t bs = block_size();
+	size_t block = offset;
+
+	for (unsigned int i = 0; i < nr_vec; i++) {
+		for (size_t j = 0; j < vec[i].size / bs; j++, block++) {
+			Buffer *cached = find(block);
+			if (cached) {
+				memcpy(cached->data, (const uint8_t *)vec[i].base + (j * bs), bs);
+				touch(cached);
+			}
+		}
+	}
+
+	return true;
+}
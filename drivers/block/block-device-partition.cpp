@@ -25,12 +25,55 @@ BlockDevicePartition::~BlockDevicePartition()
 
 }
 
+/**
+ * A partition's statistics are of the transfers as the partition sees them, so a
+ * synchronous one is all service time, however long it waited in the device's queue.
+ */
 bool BlockDevicePartition::read_blocks(void* buffer, size_t offset, size_t count)
 {
-	return _underlying_block_device.read_blocks(buffer, _block_offset + offset, count);
+	uint64_t start = stats().begin();
+	bool success = _underlying_block_device.read_blocks(buffer, _block_offset + offset, count);
+	stats().end(false, count, start, start, success);
+
+	return success;
 }
 
 bool BlockDevicePartition::write_blocks(const void* buffer, size_t offset, size_t count)
 {
-	return _underlying_block_device.write_blocks(buffer, _block_offset + offset, count);
+	uint64_t start = stats().begin();
+	bool success = _underlying_block_device.write_blocks(buffer, _block_offset + offset, count);
+	stats().end(true, count, start, start, success);
+
+	return success;
+}
+
+bool BlockDevicePartition::read_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	uint64_t start = stats().begin();
+	bool success = _underlying_block_device.read_blocks_vec(vec, nr_vec, _block_offset + offset);
+	stats().end(false, util::iovec_size(vec, nr_vec) / block_size(), start, start, success);
+
+	return success;
+}
+
+bool BlockDevicePartition::write_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	uint64_t start = stats().begin();
+	bool success = _underlying_block_device.write_blocks_vec(vec, nr_vec, _block_offset + offset);
+	stats().end(true, util::iovec_size(vec, nr_vec) / block_size(), start, start, success);
+
+	return success;
+}
+
+void BlockDevicePartition::submit(BlockRequest& request)
+{
+	size_t count = util::iovec_size(request.vec, request.nr_vec) / block_size();
+	if (request.offset > _block_count || count > _block_count - request.offset) {
+		request.complete(false);
+		return;
+	}
+
+	request.offset += _block_offset;
+	request.partition_stats = &stats();
+	_underlying_block_device.submit(request);
 }
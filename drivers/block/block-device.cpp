@@ -9,8 +9,163 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/drivers/block/block-device.h>
+#include <infos/fs/file.h>
+#include <infos/util/string.h>
 
 using namespace infos::drivers;
 using namespace infos::drivers::block;
+using namespace infos::fs;
+using namespace infos::util;
 
 const DeviceClass BlockDevice::BlockDeviceClass(Device::RootDeviceClass, "block");
+
+bool BlockDevice::read_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	for (unsigned int i = 0; i < nr_vec; i++) {
+		size_t count = vec[i].size / block_size();
+		if (vec[i].size % block_size()) return false;
+
+		if (!read_blocks(vec[i].base, offset, count)) return false;
+		offset += count;
+	}
+
+	return true;
+}
+
+bool BlockDevice::write_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	for (unsigned int i = 0; i < nr_vec; i++) {
+		size_t count = vec[i].size / block_size();
+		if (vec[i].size % block_size()) return false;
+
+		if (!write_blocks(vec[i].base, offset, count)) return false;
+		offset += count;
+	}
+
+	return true;
+}
+
+void BlockDevice::submit(BlockRequest& request)
+{
+	// The transfer is accounted for by the device, but, done this way, not for the partition
+	// the request came through.
+	BlockDeviceStats *partition_stats = request.partition_stats;
+	uint64_t queued_at = partition_stats ? partition_stats->begin() : 0;
+
+	bool success;
+	if (request.write) {
+		success = write_blocks_vec(request.vec, request.nr_vec, request.offset);
+	} else {
+		success = read_blocks_vec(request.vec, request.nr_vec, request.offset);
+	}
+
+	if (partition_stats) {
+		partition_stats->end(request.write, iovec_size(request.vec, request.nr_vec) / block_size(), queued_at, queued_at, success);
+	}
+
+	request.complete(success);
+}
+
+// The most buffers a read of a block device file hands to the device in one request.
+#define BLOCK_FILE_MAX_VEC		16
+
+/**
+ * A block device, opened as a file, for reading.  A read that starts on a block boundary
+ * and is for whole blocks goes to the device as one request, straight into the buffers;
+ * anything else is read a block at a time, through a bounce buffer.
+ */
+class BlockDeviceFile : public File
+{
+public:
+	BlockDeviceFile(BlockDevice& bdev) : _bdev(bdev), _pos(0) { }
+
+	int read(void *buffer, size_t size) override
+	{
+		int n = pread(buffer, size, _pos);
+		if (n > 0) _pos += n;
+
+		return n;
+	}
+
+	int pread(void *buffer, size_t size, off_t off) override;
+
+	int readv(const IOVec *vec, unsigned int count) override
+	{
+		int n = preadv(vec, count, _pos);
+		if (n > 0) _pos += n;
+
+		return n;
+	}
+
+	int preadv(const IOVec *vec, unsigned int count, off_t off) override
+	{
+		size_t bs = _bdev.block_size();
+		uint64_t device_size = (uint64_t)_bdev.block_count() * bs;
+
+		if (off >= device_size) return 0;
+
+		size_t size = iovec_size(vec, count);
+		bool whole_blocks = (off % bs) == 0 && count <= BLOCK_FILE_MAX_VEC && off + size <= device_size;
+		for (unsigned int i = 0; i < count && whole_blocks; i++) {
+			if (vec[i].size % bs) whole_blocks = false;
+		}
+
+		if (whole_blocks) {
+			if (!_bdev.read_blocks_vec(vec, count, off / bs)) return -1;
+			return (int)size;
+		}
+
+		return File::preadv(vec, count, off);
+	}
+
+	void seek(off_t offset, SeekType type) override
+	{
+		if (type == SeekAbsolute) {
+			_pos = offset;
+		} else if (type == SeekRelative) {
+			_pos += offset;
+		}
+	}
+
+private:
+	BlockDevice& _bdev;
+	off_t _pos;
+};
+
+int BlockDeviceFile::pread(void *buffer, size_t size, off_t off)
+{
+	size_t bs = _bdev.block_size();
+	uint64_t device_size = (uint64_t)_bdev.block_count() * bs;
+
+	if (off >= device_size) return 0;
+	size = __min(size, device_size - off);
+	if (!size) return 0;
+
+	if ((off % bs) == 0 && (size % bs) == 0) {
+		if (!_bdev.read_blocks(buffer, off / bs, size / bs)) return -1;
+		return (int)size;
+	}
+
+	uint8_t *bounce = new uint8_t[bs];
+	if (!bounce) return -1;
+
+	size_t done = 0;
+	while (done < size) {
+		size_t block_offset = off % bs;
+		size_t chunk = __min(bs - block_offset, size - done);
+
+		if (!_bdev.read_blocks(bounce, off / bs, 1)) break;
+		memcpy((uint8_t *)buffer + done, bounce + block_offset, chunk);
+
+		done += chunk;
+		off += chunk;
+	}
+
+	delete[] bounce;
+	return done ? (int)done : -1;
+}
+
+File *BlockDevice::open_as_file()
+{
+	return new BlockDeviceFile(*this);
+}
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/block/block-request-queue.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/block/block-request-queue.h>
+
+using namespace infos::drivers::block;
+
+void BlockRequestQueue::add(BlockRequest& request, uint64_t now, uint64_t expiry)
+{
+	request.deadline = now + expiry;
+
+	// Requests at the same offset stay in the order they came in.
+	BlockRequest **link = &_sorted;
+	while (*link && (*link)->offset <= request.offset) {
+		link = &(*link)->next;
+	}
+
+	request.next = *link;
+	*link = &request;
+
+	// Every request has the same expiry for its direction, but not across directions, so
+	// the FIFO is kept in deadline order.
+	if (!_fifo_tail || _fifo_tail->deadline <= request.deadline) {
+		request.fifo_next = NULL;
+		if (_fifo_tail) {
+			_fifo_tail->fifo_next = &request;
+		} else {
+			_fifo_head = &request;
+		}
+		_fifo_tail = &request;
+	} else {
+		BlockRequest **fifo_link = &_fifo_head;
+		while ((*fifo_link)->deadline <= request.deadline) {
+			fifo_link = &(*fifo_link)->fifo_next;
+		}
+
+		request.fifo_next = *fifo_link;
+		*fifo_link = &request;
+	}
+}
+
+void BlockRequestQueue::remove(BlockRequest& request)
+{
+	BlockRequest **link = &_sorted;
+	while (*link != &request) {
+		link = &(*link)->next;
+	}
+	*link = request.next;
+
+	BlockRequest *prev = NULL;
+	for (BlockRequest *r = _fifo_head; r != &request; r = r->fifo_next) {
+		prev = r;
+	}
+
+	if (prev) {
+		prev->fifo_next = request.fifo_next;
+	} else {
+		_fifo_head = request.fifo_next;
+	}
+
+	if (_fifo_tail == &request) _fifo_tail = prev;
+}
+
+BlockRequest *BlockRequestQueue::take_batch(uint64_t now, size_t max_blocks, unsigned int max_vec)
+{
+	if (!_sorted) return NULL;
+
+	BlockRequest *first;
+	if (_fifo_head->deadline <= now) {
+		first = _fifo_head;
+	} else {
+		first = _sorted;
+		while (first && first->offset < _position) {
+			first = first->next;
+		}
+
+		if (!first) first = _sorted;
+	}
+
+	// The requests after the first, in offset order, that carry on from it.
+	BlockRequest *candidate = first->next;
+	remove(*first);
+
+	BlockRequest *last = first;
+	size_t nr_blocks = first->nr_blocks;
+	unsigned int nr_vec = first->nr_vec;
+
+	while (candidate && candidate->offset == last->offset + last->nr_blocks && candidate->write == first->write &&
+			candidate->driver == first->driver && nr_blocks + candidate->nr_blocks <= max_blocks &&
+			nr_vec + candidate->nr_vec <= max_vec) {
+		BlockRequest *next = candidate->next;
+		remove(*candidate);
+
+		last->next = candidate;
+		last = candidate;
+
+		nr_blocks += candidate->nr_blocks;
+		nr_vec += candidate->nr_vec;
+
+		candidate = next;
+	}
+
+	last->next = NULL;
+	_position = last->offset + last->nr_blocks;
+
+	return first;
+}
@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/block/block-stats.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/block/block-stats.h>
+#include <infos/drivers/block/block-request.h>
+#include <infos/drivers/block/block-device.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/trace.h>
+#include <infos/fs/text-file.h>
+#include <infos/fs/stats.h>
+#include <infos/util/math.h>
+#include <infos/util/string.h>
+
+using namespace infos::drivers;
+using namespace infos::drivers::block;
+using namespace infos::kernel;
+using namespace infos::fs;
+using namespace infos::util;
+
+BlockDeviceStats::BlockDeviceStats()
+	: _nr_reads(0), _nr_writes(0), _nr_blocks_read(0), _nr_blocks_written(0), _nr_errors(0), _nr_merges(0),
+	_nr_in_flight(0), _total_queue_time(0), _total_service_time(0)
+{
+	bzero(_queue_time, sizeof(_queue_time));
+	bzero(_service_time, sizeof(_service_time));
+}
+
+uint64_t BlockDeviceStats::now()
+{
+	return sys.runtime().time_since_epoch().count();
+}
+
+/**
+ * Returns the latency histogram bucket for a duration: log2 of the duration in ns, rounded
+ * down, as the other latency histograms are, so bucket N counts [2^N, 2^(N+1)) ns.
+ */
+int BlockDeviceStats::latency_bucket(uint64_t ns)
+{
+	if (ns <= 1) return 0;
+
+	int bucket;
+	if (ns > 0xffffffffull) {
+		bucket = 32 + ilog2_floor((uint32_t)(ns >> 32));
+	} else {
+		bucket = ilog2_floor((uint32_t)ns);
+	}
+
+	return bucket < NR_LATENCY_BUCKETS ? bucket : NR_LATENCY_BUCKETS - 1;
+}
+
+uint64_t BlockDeviceStats::begin()
+{
+	__sync_fetch_and_add(&_nr_in_flight, 1);
+	return now();
+}
+
+void BlockDeviceStats::end(bool write, size_t nr_blocks, uint64_t queued_at, uint64_t started_at, bool success)
+{
+	uint64_t finished_at = now();
+	uint64_t queue_time = started_at - queued_at;
+	uint64_t service_time = finished_at - started_at;
+
+	if (write) {
+		__sync_fetch_and_add(&_nr_writes, 1);
+		if (success) __sync_fetch_and_add(&_nr_blocks_written, nr_blocks);
+	} else {
+		__sync_fetch_and_add(&_nr_reads, 1);
+		if (success) __sync_fetch_and_add(&_nr_blocks_read, nr_blocks);
+	}
+
+	if (!success) __sync_fetch_and_add(&_nr_errors, 1);
+
+	__sync_fetch_and_add(&_total_queue_time, queue_time);
+	__sync_fetch_and_add(&_total_service_time, service_time);
+	__sync_fetch_and_add(&_queue_time[latency_bucket(queue_time)], 1);
+	__sync_fetch_and_add(&_service_time[latency_bucket(service_time)], 1);
+
+	__sync_fetch_and_sub(&_nr_in_flight, 1);
+}
+
+void BlockDeviceStats::queued(BlockRequest& request)
+{
+	trace_event(TraceEvent::BLOCK_QUEUE, (uint64_t)&request, request.offset, request.write);
+
+	request.queued_at = begin();
+	request.started_at = request.queued_at;
+
+	if (request.partition_stats) request.partition_stats->begin();
+}
+
+void BlockDeviceStats::started(BlockRequest& request)
+{
+	request.started_at = now();
+}
+
+void BlockDeviceStats::completed(const BlockRequest& request, bool success)
+{
+	trace_event(TraceEvent::BLOCK_COMPLETE, (uint64_t)&request, request.nr_blocks, success);
+
+	end(request.write, request.nr_blocks, request.queued_at, request.started_at, success);
+
+	if (request.partition_stats) {
+		request.partition_stats->end(request.write, request.nr_blocks, request.queued_at, request.started_at, success);
+	}
+}
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace block
+		{
+			/**
+			 * An open statistics file: a line per counter, as name and value, then a line
+			 * per histogram, as its non-empty buckets, log2(ns):count.  The file is a
+			 * snapshot, so sampling it at intervals, and taking differences, gives rates.
+			 */
+			class BlockDeviceStatsFile : public TextFile
+			{
+			public:
+				BlockDeviceStatsFile(const BlockDeviceStats& stats)
+				{
+					append("reads %llu\n", stats._nr_reads);
+					append("writes %llu\n", stats._nr_writes);
+					append("blocks-read %llu\n", stats._nr_blocks_read);
+					append("blocks-written %llu\n", stats._nr_blocks_written);
+					append("errors %llu\n", stats._nr_errors);
+					append("merges %llu\n", stats._nr_merges);
+					append("in-flight %lld\n", stats._nr_in_flight);
+					append("queue-time-ns %llu\n", stats._total_queue_time);
+					append("service-time-ns %llu\n", stats._total_service_time);
+
+					append_histogram("queue-latency", stats._queue_time);
+					append_histogram("service-latency", stats._service_time);
+				}
+
+			private:
+				void append_histogram(const char *name, const uint64_t *buckets)
+				{
+					append("%s", name);
+					for (int bucket = 0; bucket < BlockDeviceStats::NR_LATENCY_BUCKETS; bucket++) {
+						if (!buckets[bucket]) continue;
+
+						append(" %d:%llu", bucket, buckets[bucket]);
+					}
+
+					append("\n");
+				}
+			};
+		}
+	}
+}
+
+File *BlockDeviceStats::open_as_file() const
+{
+	return new BlockDeviceStatsFile(*this);
+}
+
+void BlockDeviceStats::append_summary(StatisticsWriter& out, const char *name) const
+{
+	out.append("%s %llu %llu %llu %llu %llu %lld\n", name, _nr_reads, _nr_writes,
+			_nr_blocks_read, _nr_blocks_written, _nr_errors, _nr_in_flight);
+}
+
+/**
+ * The main counters of every block device (partitions included), a line each, so that
+ * they can all be sampled with one read.  Each device's own file has the rest.
+ */
+RegisterStatistics(block, "block")
+{
+	out.append("device reads writes blocks-read blocks-written errors in-flight\n");
+	for (auto device : sys.device_manager().devices_of_class(BlockDevice::BlockDeviceClass)) {
+		((BlockDevice *)device)->stats().append_summary(out, device->name().c_str());
+	}
+}
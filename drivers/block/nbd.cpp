@@ -0,0 +1,479 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/block/nbd.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/block/nbd.h>
+#include <infos/net/net.h>
+#include <infos/net/socket.h>
+#include <infos/net/protocols.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/device-manager.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/log.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::block;
+using namespace infos::net;
+using namespace infos::util;
+
+const DeviceClass NbdDevice::NbdDeviceClass(BlockDevice::BlockDeviceClass, "nbd");
+
+static ComponentLog nbd_log(syslog, "nbd");
+
+static uint32_t nbd_address;
+static uint16_t nbd_port;
+static char nbd_export[64];
+
+/**
+ * nbd=a.b.c.d:port/export, where the port is 10809 if it is left out, and the export is
+ * the server's default if that is.
+ */
+RegisterCmdLineArgument(NbdServer, "nbd")
+{
+	const char *p = value;
+
+	char address[16];
+	unsigned int n = 0;
+	while (*p && *p != ':' && *p != '/' && n < sizeof(address) - 1) address[n++] = *p++;
+	address[n] = 0;
+
+	unsigned int port = 10809;
+	if (*p == ':') {
+		port = 0;
+		for (p++; *p >= '0' && *p <= '9' && port <= 0xffff; p++) port = (port * 10) + (*p - '0');
+	}
+
+	bool valid = (!*p || *p == '/') && port && port <= 0xffff;
+	if (!valid || !parse_ipv4(address, nbd_address, NULL)) {
+		nbd_log.messagef(LogLevel::WARNING, "invalid server '%s'", value);
+		nbd_address = 0;
+		return;
+	}
+
+	nbd_port = port;
+	if (*p == '/') strncpy(nbd_export, p + 1, sizeof(nbd_export) - 1);
+}
+
+static inline uint64_t be64(uint64_t v) { return __builtin_bswap64(v); }
+
+struct NbdRequest {
+	uint32_t magic;
+	uint16_t flags;
+	uint16_t type;
+	uint64_t handle;
+	uint64_t offset;
+	uint32_t length;
+} __packed;
+
+struct NbdReply {
+	uint32_t magic;
+	uint32_t error;
+	uint64_t handle;
+} __packed;
+
+static bool attach_fn(void *arg)
+{
+	return sys.device_manager().register_device(*(NbdDevice *)arg);
+}
+
+bool NbdDevice::attach(DeviceManager& dm)
+{
+	if (!nbd_address) return true;
+
+	NbdDevice *device = new NbdDevice(nbd_address, nbd_port, nbd_export);
+	if (!device) return false;
+
+	// As storage, so that the boot device is looked for after it, but once the stack is up.
+	dm.init_async(DeviceInitGroup::STORAGE, attach_fn, device, DeviceInitGroup::PROTOCOLS);
+	return true;
+}
+
+NbdDevice::NbdDevice(uint32_t address, uint16_t port, const char *export_name)
+	: _address(address), _port(port), _socket(NULL), _size(0), _transmission_flags(0), _nr_busy(0), _failed(false)
+{
+	strncpy(_export_name, export_name, sizeof(_export_name) - 1);
+	_export_name[sizeof(_export_name) - 1] = 0;
+
+	for (unsigned int n = 0; n < MAX_IN_FLIGHT; n++) {
+		_slots[n].request = NULL;
+		_slots[n].in_use = false;
+	}
+}
+
+bool NbdDevice::read_full(void *buffer, size_t size)
+{
+	size_t done = 0;
+	while (done < size) {
+		int n = _socket->read((uint8_t *)buffer + done, size - done);
+		if (n <= 0) return false;
+
+		done += n;
+	}
+
+	return true;
+}
+
+bool NbdDevice::write_full(const void *buffer, size_t size)
+{
+	size_t done = 0;
+	while (done < size) {
+		int n = _socket->write((const uint8_t *)buffer + done, size - done);
+		if (n <= 0) return false;
+
+		done += n;
+	}
+
+	return true;
+}
+
+/**
+ * Negotiates the export, with the fixed newstyle handshake, and the oldest way of choosing
+ * an export (NBD_OPT_EXPORT_NAME), which every server has.
+ */
+bool NbdDevice::handshake()
+{
+	struct {
+		uint64_t magic;
+		uint64_t option_magic;
+		uint16_t flags;
+	} __packed greeting;
+
+	if (!read_full(&greeting, sizeof(greeting))) return false;
+	if (be64(greeting.magic) != NBD_MAGIC || be64(greeting.option_magic) != NBD_OPTION_MAGIC) {
+		nbd_log.message(LogLevel::ERROR, "the server doesn't speak the newstyle protocol");
+		return false;
+	}
+
+	uint16_t server_flags = ntohs(greeting.flags);
+	uint32_t client_flags = htonl(server_flags & (NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES));
+	if (!write_full(&client_flags, sizeof(client_flags))) return false;
+
+	size_t name_length = strlen(_export_name);
+
+	struct {
+		uint64_t magic;
+		uint32_t option;
+		uint32_t length;
+	} __packed option;
+
+	option.magic = be64(NBD_OPTION_MAGIC);
+	option.option = htonl(NBD_OPT_EXPORT_NAME);
+	option.length = htonl(name_length);
+
+	if (!write_full(&option, sizeof(option)) || !write_full(_export_name, name_length)) return false;
+
+	struct {
+		uint64_t size;
+		uint16_t flags;
+	} __packed export_info;
+
+	if (!read_full(&export_info, sizeof(export_info))) {
+		nbd_log.messagef(LogLevel::ERROR, "the server has no export '%s'", _export_name);
+		return false;
+	}
+
+	if (!(server_flags & NBD_FLAG_NO_ZEROES)) {
+		uint8_t zeroes[124];
+		if (!read_full(zeroes, sizeof(zeroes))) return false;
+	}
+
+	_size = be64(export_info.size);
+	_transmission_flags = ntohs(export_info.flags);
+	return true;
+}
+
+bool NbdDevice::init(DeviceManager& dm)
+{
+	if (!netstack.interface()) {
+		nbd_log.message(LogLevel::ERROR, "the network isn't up");
+		return false;
+	}
+
+	_socket = Socket::create(SocketType::STREAM);
+	if (!_socket) return false;
+
+	SocketAddress server = { _address, _port, 0 };
+	if (!_socket->connect(server)) {
+		nbd_log.messagef(LogLevel::ERROR, "unable to connect to %u.%u.%u.%u:%u",
+			_address >> 24, (_address >> 16) & 0xff, (_address >> 8) & 0xff, _address & 0xff, _port);
+		_socket->close();
+		return false;
+	}
+
+	if (!handshake()) {
+		_socket->close();
+		return false;
+	}
+
+	Thread& receiver = sys.create_kernel_thread(receiver_threadproc, name() + "-rx", SchedulingEntityPriority::REALTIME);
+	receiver.add_entry_argument(this);
+	receiver.start();
+
+	nbd_log.messagef(LogLevel::INFO, "%s: export '%s', %lu blocks%s", name().c_str(), _export_name,
+		block_count(), (_transmission_flags & NBD_FLAG_READ_ONLY) ? ", read-only" : "");
+
+	return true;
+}
+
+struct SyncRequest
+{
+	BlockRequest request;
+	WakeQueue *waiters;
+	volatile bool done;
+	bool success;
+};
+
+static void sync_complete(BlockRequest& request, bool success)
+{
+	SyncRequest *sync = (SyncRequest *)request.priv;
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(sync->waiters->lock());
+	sync->success = success;
+	sync->done = true;
+
+	WakeQueue::Key key = { sync, 0 };
+	sync->waiters->wake_key_locked(key, 1);
+}
+
+/**
+ * Sends a request, and waits for its reply.
+ */
+bool NbdDevice::transfer(uint16_t type, size_t offset, const IOVec *vec, unsigned int nr_vec)
+{
+	SyncRequest sync;
+	sync.request.write = type == NBD_CMD_WRITE;
+	sync.request.offset = offset;
+	sync.request.vec = vec;
+	sync.request.nr_vec = nr_vec;
+	sync.request.completion = sync_complete;
+	sync.request.priv = &sync;
+	sync.waiters = &_waiters;
+	sync.done = false;
+	sync.success = false;
+
+	start(type, sync.request);
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_waiters.lock());
+
+	WakeQueue::Key key = { &sync, 0 };
+	while (!sync.done) _waiters.sleep_locked(Thread::current(), key);
+
+	return sync.success;
+}
+
+bool NbdDevice::read_blocks(void *buffer, size_t offset, size_t count)
+{
+	IOVec vec = { buffer, count * block_size() };
+	return transfer(NBD_CMD_READ, offset, &vec, 1);
+}
+
+bool NbdDevice::write_blocks(const void *buffer, size_t offset, size_t count)
+{
+	IOVec vec = { (void *)buffer, count * block_size() };
+	return transfer(NBD_CMD_WRITE, offset, &vec, 1);
+}
+
+bool NbdDevice::read_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	return transfer(NBD_CMD_READ, offset, vec, nr_vec);
+}
+
+bool NbdDevice::write_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	return transfer(NBD_CMD_WRITE, offset, vec, nr_vec);
+}
+
+void NbdDevice::submit(BlockRequest& request)
+{
+	start(request.write ? NBD_CMD_WRITE : NBD_CMD_READ, request);
+}
+
+bool NbdDevice::flush()
+{
+	if (!(_transmission_flags & NBD_FLAG_SEND_FLUSH)) return true;
+	return transfer(NBD_CMD_FLUSH, 0, NULL, 0);
+}
+
+/**
+ * Takes a slot for the request, waiting for one if they are all in flight, and sends it,
+ * with its data if it is a write.  Its handle is its slot, which is how the receiver finds
+ * it again.
+ */
+void NbdDevice::start(uint16_t type, BlockRequest& request)
+{
+	size_t size = iovec_size(request.vec, request.nr_vec);
+	bool valid = type == NBD_CMD_FLUSH || (size && !(size % block_size()) && size <= MAX_REQUEST_SIZE &&
+		request.offset <= block_count() && size / block_size() <= block_count() - request.offset &&
+		!(type == NBD_CMD_WRITE && (_transmission_flags & NBD_FLAG_READ_ONLY)));
+
+	if (!valid) {
+		request.complete(false);
+		return;
+	}
+
+	request.driver = this;
+	request.nr_blocks = size / block_size();
+	if (type != NBD_CMD_FLUSH) stats().queued(request);
+
+	unsigned int n = 0;
+	bool failed;
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_waiters.lock());
+
+		WakeQueue::Key key = { this, 0 };
+		while (!_failed && _nr_busy == MAX_IN_FLIGHT) _waiters.sleep_locked(Thread::current(), key);
+
+		failed = _failed;
+		if (!failed) {
+			for (n = 0; _slots[n].in_use; n++);
+
+			_slots[n].request = &request;
+			_slots[n].type = type;
+			_slots[n].in_use = true;
+			_nr_busy++;
+		}
+	}
+
+	if (failed) {
+		if (type != NBD_CMD_FLUSH) stats().completed(request, false);
+		request.complete(false);
+		return;
+	}
+
+	if (type != NBD_CMD_FLUSH) stats().started(request);
+
+	NbdRequest header;
+	header.magic = htonl(NBD_REQUEST_MAGIC);
+	header.flags = 0;
+	header.type = htons(type);
+	header.handle = n;
+	header.offset = be64((uint64_t)request.offset * block_size());
+	header.length = htonl(size);
+
+	bool sent;
+	{
+		UniqueLock<Mutex> l(_send_lock);
+
+		sent = !_failed && write_full(&header, sizeof(header));
+		if (type == NBD_CMD_WRITE) {
+			for (unsigned int i = 0; sent && i < request.nr_vec; i++) {
+				sent = write_full(request.vec[i].base, request.vec[i].size);
+			}
+		}
+	}
+
+	// A failed send leaves the stream in pieces, so the connection is given up on, and the
+	// request fails with the others.
+	if (!sent) fail_all();
+}
+
+/**
+ * Fails every request in flight, and every one after it.
+ */
+void NbdDevice::fail_all()
+{
+	BlockRequest *failed[MAX_IN_FLIGHT];
+	uint16_t types[MAX_IN_FLIGHT];
+	unsigned int nr_failed = 0;
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_waiters.lock());
+
+		if (!_failed) nbd_log.messagef(LogLevel::ERROR, "%s: the connection has been lost", name().c_str());
+		_failed = true;
+
+		for (unsigned int n = 0; n < MAX_IN_FLIGHT; n++) {
+			if (!_slots[n].in_use) continue;
+
+			failed[nr_failed] = _slots[n].request;
+			types[nr_failed++] = _slots[n].type;
+
+			_slots[n].request = NULL;
+			_slots[n].in_use = false;
+		}
+
+		_nr_busy = 0;
+
+		WakeQueue::Key key = { this, 0 };
+		_waiters.wake_key_locked(key, ~0u);
+	}
+
+	for (unsigned int i = 0; i < nr_failed; i++) {
+		if (types[i] != NBD_CMD_FLUSH) stats().completed(*failed[i], false);
+		failed[i]->complete(false);
+	}
+}
+
+/**
+ * Reads replies as they come, in whatever order the server sends them, and completes the
+ * requests they are for.
+ */
+void NbdDevice::receive_replies()
+{
+	for (;;) {
+		NbdReply reply;
+		if (!read_full(&reply, sizeof(reply)) || ntohl(reply.magic) != NBD_REPLY_MAGIC || reply.handle >= MAX_IN_FLIGHT) break;
+
+		Slot& slot = _slots[reply.handle];
+
+		BlockRequest *request;
+		uint16_t type;
+		{
+			UniqueIRQLock irq;
+			UniqueLock<SpinLock> l(_waiters.lock());
+
+			if (!slot.in_use) break;
+
+			request = slot.request;
+			type = slot.type;
+		}
+
+		// The data of a read comes straight after its reply, so it has to be read even if
+		// the read failed.
+		bool success = !reply.error;
+		if (type == NBD_CMD_READ && success) {
+			bool received = true;
+			for (unsigned int i = 0; received && i < request->nr_vec; i++) {
+				received = read_full(request->vec[i].base, request->vec[i].size);
+			}
+
+			if (!received) break;
+		}
+
+		{
+			UniqueIRQLock irq;
+			UniqueLock<SpinLock> l(_waiters.lock());
+
+			slot.request = NULL;
+			slot.in_use = false;
+			_nr_busy--;
+
+			WakeQueue::Key key = { this, 0 };
+			_waiters.wake_key_locked(key, 1);
+		}
+
+		if (type != NBD_CMD_FLUSH) stats().completed(*request, success);
+		request->complete(success);
+	}
+
+	fail_all();
+}
+
+void NbdDevice::receiver_threadproc(void *arg)
+{
+	((NbdDevice *)arg)->receive_replies();
+	Thread::current().stop();
+}
@@ -18,13 +18,14 @@ using namespace infos::drivers::console;
 using namespace infos::drivers::input;
 using namespace infos::util;
 using namespace infos::fs;
+using namespace infos::mm;
 
 const DeviceClass VirtualConsole::VirtualConsoleDeviceClass(Console::ConsoleDeviceClass, "vc");
 
 VirtualConsole::VirtualConsole() : _current_mod_mask(None), _current_pos(0),
-	_escape_nchars(0), _attr_byte(0x07), _buffer(NULL), _ucb(NULL)
+	_escape_nchars(0), _attr_byte(0x07), _buffer(NULL), _origin(0), _dirty_rows(0), _output(NULL), _ucb(NULL)
 {
-	_buffer = new uint16_t[_width * _height];
+	_buffer = new (HeapArena::DRIVERS) uint16_t[_width * _height];
 	for (int i = 0; i < _width * _height; i++)
 	{
 		_buffer[i] = 0x0700;
@@ -34,7 +35,7 @@ VirtualConsole::VirtualConsole() : _current_mod_mask(None), _current_pos(0),
 
 VirtualConsole::~VirtualConsole()
 {
-	delete _buffer;
+	delete[] _buffer;
 }
 
 void VirtualConsole::attach_terminal(terminal::ConsoleTerminal *terminal)
@@ -229,14 +230,71 @@ void VirtualConsole::parse_escape_buffer()
 		}
 	}
 }
+/**
+ * Whether a character is drawn as it is, rather than moving the cursor or starting an
+ * escape sequence.
+ */
+static inline bool is_plain(uint8_t c)
+{
+	return c != '\n' && c != '\r' && c != '\33' && c != '\b';
+}
+
+/**
+ * Draws a run of plain characters, a row at a time, as each row is contiguous in the
+ * buffer.
+ */
+void VirtualConsole::put_run(const uint8_t *chars, unsigned int count)
+{
+	uint16_t attr = ((uint16_t) _attr_byte) << 8;
+
+	while (count)
+	{
+		unsigned int x = _current_pos % _width;
+		unsigned int n = _width - x;
+		if (n > count) n = count;
+
+		uint16_t *dst = &cell(_current_pos);
+		for (unsigned int i = 0; i < n; i++)
+		{
+			dst[i] = attr | chars[i];
+		}
+
+		_dirty_rows |= 1u << (_current_pos / _width);
+		_current_pos += n;
+		chars += n;
+		count -= n;
+
+		if (_current_pos >= _width * _height)
+		{
+			scroll_one_line();
+			_current_pos = _width * (_height - 1);
+		}
+	}
+}
+
 int VirtualConsole::write(const void *buffer, size_t size)
 {
 	if (!_buffer)
 		return 0;
 
+	const uint8_t *chars = (const uint8_t *)buffer;
+
 	for (unsigned int i = 0; i < size; i++)
 	{
-		char c = ((uint8_t *)buffer)[i];
+		// Outside an escape sequence, a run of plain characters is drawn in one go, and
+		// only the bytes that end it go through the state machine below.
+		if (!_escape_nchars && is_plain(chars[i]))
+		{
+			unsigned int end = i + 1;
+			while (end < size && is_plain(chars[end])) end++;
+
+			put_run(&chars[i], end - i);
+
+			i = end - 1;
+			continue;
+		}
+
+		char c = chars[i];
 
 		/* Invariant: if in the escaped state, it means we've seen a \033 followed by
 		 * zero or more other characters that do NOT (yet) make a parseable supported
@@ -298,13 +356,8 @@ int VirtualConsole::write(const void *buffer, size_t size)
 			}
 			else if (c == '\b')
 			{
-				_current_pos--;
-				_buffer[_current_pos] = (((uint16_t) this->_attr_byte) << 8) | ' ';
-			}
-			else
-			{
-				_buffer[_current_pos] = (((uint16_t) this->_attr_byte) << 8) | c;
-				_current_pos++;
+				if (_current_pos > 0) _current_pos--;
+				put(_current_pos, (((uint16_t) this->_attr_byte) << 8) | ' ');
 			}
 
 			if (_current_pos >= _width * _height)
@@ -315,27 +368,72 @@ int VirtualConsole::write(const void *buffer, size_t size)
 		}
 	}
 
-	if (_ucb)
+	flush();
+	return size;
+}
+
+/**
+ * Scrolls the screen up a line: the top row becomes the bottom, cleared.  Every row has
+ * moved, as far as the screen is concerned.
+ */
+void VirtualConsole::scroll_one_line()
+{
+	uint16_t *row = &_buffer[_origin * _width];
+	for (int x = 0; x < _width; x++)
 	{
-		_ucb(*this);
+		row[x] = 0x0700;
 	}
 
-	return size;
+	_origin = (_origin + 1) % _height;
+	_dirty_rows = (1u << _height) - 1;
 }
 
-void VirtualConsole::scroll_one_line()
+void VirtualConsole::set_output(volatile uint16_t *output, UpdateCallbackFn ucb)
 {
-	memcpy(_buffer, &_buffer[_width], _width * (_height - 1) * 2);
+	_output = output;
+	_ucb = ucb;
 
-	for (int x = 0; x < _width; x++)
+	// The whole screen is shown afresh.
+	_dirty_rows = (1u << _height) - 1;
+	flush();
+}
+
+/**
+ * Copies the rows that have changed since the last time to the output, in one go, so that
+ * video memory is written once per row per write, however often it changed.
+ */
+void VirtualConsole::flush()
+{
+	if (_output)
 	{
-		_buffer[x + (_width * (_height - 1))] = 0x0700;
+		while (_dirty_rows)
+		{
+			unsigned int y = __builtin_ctz(_dirty_rows);
+			_dirty_rows &= _dirty_rows - 1;
+
+			const uint16_t *src = &_buffer[((_origin + y) % _height) * _width];
+			volatile uint16_t *dst = &_output[y * _width];
+
+			for (int x = 0; x < _width; x++)
+			{
+				dst[x] = src[x];
+			}
+		}
+	}
+	else
+	{
+		_dirty_rows = 0;
+	}
+
+	if (_ucb)
+	{
+		_ucb(*this);
 	}
 }
 
 File *VirtualConsole::open_as_file()
 {
-	return new VirtualConsoleFile(*this);
+	return new (HeapArena::DRIVERS) VirtualConsoleFile(*this);
 }
 
 int VirtualConsoleFile::pwrite(const void *buffer, size_t size, off_t offset)
@@ -345,6 +443,12 @@ int VirtualConsoleFile::pwrite(const void *buffer, size_t size, off_t offset)
 		return 0;
 	}
 
-	vc_._buffer[offset] = *(uint16_t *)buffer;
+	if (offset < 0 || offset >= VirtualConsole::_width * VirtualConsole::_height)
+	{
+		return 0;
+	}
+
+	vc_.put(offset, *(uint16_t *)buffer);
+	vc_.flush();
 	return 2;
 }
@@ -12,6 +12,7 @@
 #include <infos/kernel/device-manager.h>
 #include <infos/kernel/irq.h>
 #include <infos/kernel/log.h>
+#include <infos/kernel/softirq.h>
 #include <infos/drivers/irq/ioapic.h>
 #include <infos/drivers/irq/lapic.h>
 #include <arch/x86/pio.h>
@@ -62,6 +63,9 @@ static Keys::Keys scancode_map[] = {
 
 const DeviceClass Keyboard::KeyboardDeviceClass(Device::RootDeviceClass, "kbd");
 
+// The sink's handlers are run as a softirq, which has nothing to hand them but this.
+static Keyboard *softirq_keyboard;
+
 Keyboard::Keyboard() : _irq(NULL), _sink(NULL)
 {
 
@@ -89,6 +93,9 @@ bool Keyboard::init(kernel::DeviceManager& dm)
 	
 	// Hook-up IRQ 1 on the IOAPIC to the IRQ handler object, and register
 	// the IRQ callback function.
+	softirq_keyboard = this;
+	SoftIRQ::register_handler(SoftIRQVector::INPUT, keyboard_softirq);
+
 	_irq = ioapic->request_physical_irq(lapic, 1);
 	_irq->attach(keyboard_irq_handler, this);
 	
@@ -139,9 +146,27 @@ Keys::Keys Keyboard::scancode_to_key(int8_t scancode)
  */
 void Keyboard::keyboard_irq_handler(const kernel::IRQ *irq, void *priv)
 {
-	// Read the scancode in from the keyboard buffer.
+	Keyboard *kbd = (Keyboard *)priv;
+
+	// Read the scancode in from the keyboard buffer, which acknowledges it.  The sink
+	// is given it once the interrupt is over, and if the buffer is full, it is lost.
 	int8_t scancode = (int8_t)__inb(0x60);
-	
-	// Post the event into the keyboard device.
-	((Keyboard *)priv)->handle_key_event(scancode);
+
+	kbd->_scancodes.push(scancode);
+
+	SoftIRQ::raise(SoftIRQVector::INPUT);
+}
+
+/**
+ * Posts the buffered scancodes into the keyboard device.
+ */
+void Keyboard::keyboard_softirq()
+{
+	Keyboard *kbd = softirq_keyboard;
+	if (!kbd) return;
+
+	int8_t scancode;
+	while (kbd->_scancodes.pop(scancode)) {
+		kbd->handle_key_event(scancode);
+	}
 }
@@ -12,6 +12,8 @@
 #include <infos/drivers/irq/lapic.h>
 #include <infos/kernel/log.h>
 #include <infos/util/string.h>
+#include <infos/util/lock.h>
+#include <infos/mm/object-allocator.h>
 #include <arch/x86/x86-arch.h>
 
 using namespace infos::drivers;
@@ -19,6 +21,7 @@ using namespace infos::drivers::irq;
 using namespace infos::kernel;
 using namespace infos::util;
 using namespace infos::arch::x86;
+using namespace infos::mm;
 
 const DeviceClass infos::drivers::irq::IOAPIC::IOAPICDeviceClass(RootDeviceClass, "ioapic");
 
@@ -27,7 +30,7 @@ const DeviceClass infos::drivers::irq::IOAPIC::IOAPICDeviceClass(RootDeviceClass
 
 IOAPIC::IOAPIC(virt_addr_t base_address) : _base_address((volatile uint32_t *)base_address), _nr_irqs(0)
 {
-
+	bzero(_pin_irqs, sizeof(_pin_irqs));
 }
 
 bool IOAPIC::init(kernel::DeviceManager& dm)
@@ -54,8 +57,20 @@ void IOAPIC::store_redir_entry(uint8_t irq_index, RedirectionEntry& e)
 	
 	uint8_t configuration_register = 0x10 + (irq_index * 2);
 	
-	write(configuration_register, e.low);
+	// The destination goes in first, so that the pin is never pointed somewhere
+	// half-changed.
 	write(configuration_register + 1, e.high);
+	write(configuration_register, e.low);
+}
+
+void IOAPIC::load_redir_entry(uint8_t irq_index, RedirectionEntry& e)
+{
+	assert(irq_index < _nr_irqs);
+
+	uint8_t configuration_register = 0x10 + (irq_index * 2);
+
+	e.low = read(configuration_register);
+	e.high = read(configuration_register + 1);
 }
 
 IRQ *IOAPIC::request_physical_irq(LAPIC *lapic, uint32_t phys_irq_nr)
@@ -68,17 +83,26 @@ IRQ *IOAPIC::request_physical_irq(LAPIC *lapic, uint32_t phys_irq_nr)
 		return NULL;
 	}
 	
-	IRQ *irq = new IOAPICIRQ(*lapic);
+	if (_pin_irqs[phys_irq_nr]) {
+		return _pin_irqs[phys_irq_nr];
+	}
+
+	IOAPICIRQ *irq = new (HeapArena::DRIVERS) IOAPICIRQ(*this, phys_irq_nr);
 	if (!x86arch.irq_manager().attach_irq(irq)) {
+		delete irq;
 		return NULL;
 	}
+
+	_pin_irqs[phys_irq_nr] = irq;
 	
 	RedirectionEntry re;
 	bzero(&re, sizeof(re));
 	
+	// Until it is steered elsewhere, the pin's interrupts go to the LAPIC that asked for
+	// it.
 	re.delivery_mode = 0;
 	re.delivery_status = 0;
-	re.destination = 0;					// TODO: USE LAPIC ID
+	re.destination = lapic->id();
 	re.destination_mode = 0;
 	re.mask = 0;
 	re.pin_polarity = 0;
@@ -91,18 +115,32 @@ IRQ *IOAPIC::request_physical_irq(LAPIC *lapic, uint32_t phys_irq_nr)
 	return irq;
 }
 
-void IOAPIC::IOAPICIRQ::handle() const
+void IOAPIC::IOAPICIRQ::enable()
 {
-	invoke();
-	_lapic.eoi();
+
 }
 
-void IOAPIC::IOAPICIRQ::enable()
+void IOAPIC::IOAPICIRQ::disable()
 {
 
 }
 
-void IOAPIC::IOAPICIRQ::disable()
+bool IOAPIC::IOAPICIRQ::set_affinity(AffinityMask mask)
 {
+	IRQDestination dest;
+	if (!irq_destination(mask, dest)) return false;
 
+	UniqueIRQLock l;
+
+	RedirectionEntry re;
+	_ioapic.load_redir_entry(_pin, re);
+
+	re.delivery_mode = dest.logical ? 1 : 0;		// Lowest-priority, or fixed
+	re.destination_mode = dest.logical ? 1 : 0;
+	re.destination = dest.destination;
+
+	_ioapic.store_redir_entry(_pin, re);
+
+	_affinity = mask;
+	return true;
 }
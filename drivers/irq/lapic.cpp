@@ -9,7 +9,14 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/drivers/irq/lapic.h>
+#include <infos/mm/object-allocator.h>
 #include <arch/x86/x86-arch.h>
+#include <arch/x86/cpu.h>
+#include <arch/x86/cpuid.h>
+#include <arch/x86/msr.h>
+#include <infos/kernel/log.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
 
 #define MASKED     0x00010000   // Interrupt masked
 
@@ -29,16 +36,74 @@
 using namespace infos::drivers;
 using namespace infos::drivers::irq;
 using namespace infos::arch::x86;
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
 
 const DeviceClass infos::drivers::irq::LAPIC::LAPICDeviceClass(RootDeviceClass, "lapic");
 
-LAPIC::LAPIC(virt_addr_t base_address) : _apic_base((volatile uint32_t *)base_address)
+// Switching the local APICs into x2APIC mode is off unless asked for (lapic.x2apic=1)
+// until it has been run on a booted system.
+static bool do_x2apic;
+
+RegisterCmdLineArgument(LAPICX2APIC, "lapic.x2apic")
+{
+	if (strncmp(value, "1", 2) == 0)
+	{
+		do_x2apic = true;
+	}
+	else
+	{
+		do_x2apic = false;
+	}
+}
+
+LAPIC::LAPIC(virt_addr_t base_address) : _apic_base((volatile uint32_t *)base_address), _x2apic(false)
 {
 
 }
 
 bool LAPIC::init(kernel::DeviceManager& dm)
 {
+	// The firmware may have left the APIC in x2APIC mode already, and then there is no
+	// going back to xAPIC mode without turning it off.
+	bool firmware_x2apic = (__rdmsr(MSR_APIC_BASE) & MSR_APIC_BASE_EXTD) != 0;
+	_x2apic = firmware_x2apic || (do_x2apic && (cpuid_get_features().rcx & CPUIDFeatures::x2APIC));
+	if (_x2apic) {
+		x86arch.irq_manager().set_x2apic();
+		syslog.message(LogLevel::INFO, "lapic: using x2APIC mode");
+	}
+
+	init_local();
+
+	// Interrupts are acknowledged straight from the IRQ entry path (see __handle_raw_irq).
+	x86arch.irq_manager().set_eoi_register(&_apic_base[LAPICRegisters::EOI >> 2]);
+
+	// Initialise the timer IRQ
+	_timer_irq = new (HeapArena::DRIVERS) LAPICIRQ(*this, Timer);
+	if (!x86arch.irq_manager().attach_irq(_timer_irq)) {
+		return false;
+	}
+	
+	set_timer_irq(_timer_irq->nr());
+	return true;
+}
+
+/**
+ * Enables and configures the local APIC of the calling CPU, with all of its interrupt
+ * sources masked.  Every CPU's local APIC is at the same address, so this is also
+ * how the other CPUs set up their own.
+ */
+void LAPIC::init_local()
+{
+	// x2APIC mode is per-CPU, and has to be switched on before any register is touched.
+	if (_x2apic) {
+		uint64_t base = __rdmsr(MSR_APIC_BASE);
+		if (!(base & MSR_APIC_BASE_EXTD)) {
+			__wrmsr(MSR_APIC_BASE, base | MSR_APIC_BASE_EN | MSR_APIC_BASE_EXTD);
+		}
+	}
+
 	// Specify the spurious interrupt vector, and enable the device.
 	write(LAPICRegisters::SVR, 0x1ff);
 
@@ -53,6 +118,15 @@ bool LAPIC::init(kernel::DeviceManager& dm)
 		write(LAPICRegisters::PCINT, MASKED);
 	}
 
+	// The flat model gives each of the first CPUs a bit of the logical ID, so that an
+	// interrupt can be sent to any of a set of them (see irq_destination()).  In x2APIC
+	// mode, the logical ID is fixed, and there is no flat model.
+	if (!_x2apic) {
+		unsigned int index = x86arch.current_x86_cpu().index;
+		write(LAPICRegisters::DFR, 0xffffffff);
+		write(LAPICRegisters::LDR, index < MAX_LOGICAL_CPUS ? (1u << (24 + index)) : 0);
+	}
+
 	// Clear-out the ESR
 	write(LAPICRegisters::ESR, 0);
 	write(LAPICRegisters::ESR, 0);
@@ -60,23 +134,66 @@ bool LAPIC::init(kernel::DeviceManager& dm)
 	// Acknowledge any pending interrupts
 	write(LAPICRegisters::EOI, 0);
 
-	// Set-up the interrupt control register
-	write(LAPICRegisters::ICRHI, 0);
-	write(LAPICRegisters::ICRLO, BCAST | INIT | LEVEL);
+	// Synchronise the arbitration IDs, which x2APIC mode doesn't need (or allow).
+	if (!_x2apic) {
+		write(LAPICRegisters::ICRHI, 0);
+		write(LAPICRegisters::ICRLO, BCAST | INIT | LEVEL);
 
-	// Wait for pending deliveries to complete
-	while (read(LAPICRegisters::ICRLO) & DELIVS);
+		// Wait for pending deliveries to complete
+		while (read(LAPICRegisters::ICRLO) & DELIVS);
+	}
 	
 	write(LAPICRegisters::TPR, 0);
-	
-	// Initialise the timer IRQ
-	_timer_irq = new LAPICIRQ(*this, Timer);
-	if (!x86arch.irq_manager().attach_irq(_timer_irq)) {
-		return false;
+}
+
+/**
+ * Sends an interprocessor interrupt, and waits for it to be delivered.  In x2APIC mode,
+ * the command is a single MSR write, and there is no delivery status to wait on.
+ */
+void LAPIC::send_ipi(uint8_t apic_id, uint32_t command)
+{
+	if (_x2apic) {
+		__wrmsr(MSR_X2APIC_ICR, ((uint64_t)apic_id << 32) | command);
+		return;
 	}
-	
-	set_timer_irq(_timer_irq->nr());
-	return true;
+
+	write(LAPICRegisters::ICRHI, (uint32_t)apic_id << 24);
+	write(LAPICRegisters::ICRLO, command);
+
+	while (read(LAPICRegisters::ICRLO) & DELIVS) {
+		asm volatile("pause");
+	}
+}
+
+/**
+ * Resets another CPU, leaving it waiting for a startup IPI.
+ * @param apic_id The local APIC ID of the CPU.
+ */
+void LAPIC::send_init(uint8_t apic_id)
+{
+	send_ipi(apic_id, INIT | LEVEL | ASSERT);
+	send_ipi(apic_id, INIT | LEVEL | DEASSERT);
+}
+
+/**
+ * Starts another CPU, which must have been reset with send_init(), running real-mode
+ * code at the start of the given physical page.
+ * @param apic_id The local APIC ID of the CPU.
+ * @param vector The number of the page the CPU starts at (i.e. the address >> 12).
+ */
+void LAPIC::send_startup(uint8_t apic_id, uint8_t vector)
+{
+	send_ipi(apic_id, STARTUP | vector);
+}
+
+/**
+ * Raises an interrupt on another CPU.
+ * @param apic_id The local APIC ID of the CPU.
+ * @param vector The interrupt vector to raise.
+ */
+void LAPIC::send_fixed(uint8_t apic_id, uint8_t vector)
+{
+	send_ipi(apic_id, FIXED | vector);
 }
 
 void LAPIC::eoi()
@@ -168,12 +285,3 @@ void LAPIC::LAPICIRQ::disable()
 {
 	_lapic.mask_interrupts(_lvt);
 }
-
-void LAPIC::LAPICIRQ::handle() const
-{
-	if (!invoke()) {
-		arch_abort();
-	} else {
-		_lapic.eoi();
-	}
-}
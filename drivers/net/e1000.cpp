@@ -0,0 +1,423 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/net/e1000.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/net/e1000.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/irq.h>
+#include <infos/kernel/log.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/vma.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+#include <infos/util/time.h>
+#include <infos/util/cmdline.h>
+#include <arch/arch.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::net;
+using namespace infos::util;
+using namespace infos::mm;
+
+static ComponentLog e1000_log(syslog, "e1000");
+
+const DeviceClass E1000Device::E1000DeviceClass(NetworkDevice::NetworkDeviceClass, "eth");
+
+// How long the controller is given to come out of reset.
+#define E1000_RESET_TIMEOUT_MS		100
+
+// The most interrupts a second the controller raises (zero for no limit), which the
+// interrupt throttling register takes as an interval, in units of 256ns.
+static unsigned int itr_rate = 8000;
+
+RegisterCmdLineArgument(E1000ITR, "e1000.itr") {
+	unsigned int rate = 0;
+	for (const char *c = value; *c >= '0' && *c <= '9'; c++) {
+		rate = (rate * 10) + (*c - '0');
+	}
+
+	itr_rate = rate;
+}
+
+E1000Device::E1000Device(const E1000Configuration& cfg)
+	: _mmio_base(cfg.mmio_base), _regs(NULL), _irq(cfg.irq),
+	_rx_ring(NULL), _tx_ring(NULL), _tx_tail(0), _tx_clean(0), _tx_waiting(false), _rx_next(0), _rx_unposted(0)
+{
+	bzero(_mac, sizeof(_mac));
+
+	for (unsigned int i = 0; i < NR_TX_DESCRIPTORS; i++) _tx_packets[i] = NULL;
+	for (unsigned int i = 0; i < NR_RX_DESCRIPTORS; i++) _rx_packets[i] = NULL;
+}
+
+/**
+ * Resets the controller, with every interrupt masked, and brings the link up.
+ */
+bool E1000Device::reset()
+{
+	write(E1000_REG_IMC, ~0u);
+	write(E1000_REG_CTRL, read(E1000_REG_CTRL) | E1000_CTRL_RST);
+
+	auto deadline = sys.runtime() + DurationCast<Nanoseconds>(Milliseconds(E1000_RESET_TIMEOUT_MS));
+	while (read(E1000_REG_CTRL) & E1000_CTRL_RST) {
+		if (!(sys.runtime() < deadline)) return false;
+		asm volatile("pause");
+	}
+
+	write(E1000_REG_IMC, ~0u);
+	read(E1000_REG_ICR);
+
+	write(E1000_REG_CTRL, read(E1000_REG_CTRL) | E1000_CTRL_SLU | E1000_CTRL_ASDE);
+	return true;
+}
+
+/**
+ * The controller loads its address from the EEPROM into the first receive address
+ * register when it is reset.  If it hasn't one, it is given a locally administered one.
+ */
+void E1000Device::read_mac_address()
+{
+	uint32_t ral = read(E1000_REG_RAL0), rah = read(E1000_REG_RAH0);
+
+	if (rah & E1000_RAH_AV) {
+		for (unsigned int i = 0; i < 4; i++) _mac[i] = ral >> (i * 8);
+		for (unsigned int i = 0; i < 2; i++) _mac[4 + i] = rah >> (i * 8);
+		return;
+	}
+
+	_mac[0] = 0x02;
+	_mac[5] = 0x01;
+
+	write(E1000_REG_RAL0, _mac[0] | (_mac[1] << 8) | (_mac[2] << 16) | ((uint32_t)_mac[3] << 24));
+	write(E1000_REG_RAH0, _mac[4] | (_mac[5] << 8) | E1000_RAH_AV);
+}
+
+/**
+ * Allocates both rings, as one physically contiguous allocation that the controller can
+ * reach, and fills the receive ring with packet buffers.
+ */
+bool E1000Device::init_rings()
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	// The receive ring is refilled by atomic allocations.
+	FrameDescriptor *rings = pgalloc.allocate_contiguous(2);
+	if (!rings || !sys.mm().pktalloc().reserve(NR_RX_DESCRIPTORS + RX_REFILL_BATCH)) return false;
+
+	phys_addr_t rings_pa = pgalloc.pfdescr_to_pa(rings);
+	bzero((void *)pgalloc.pfdescr_to_vpa(rings), 2 * __page_size);
+
+	_rx_ring = (RxDescriptor *)pgalloc.pfdescr_to_vpa(rings);
+	_tx_ring = (TxDescriptor *)(pgalloc.pfdescr_to_vpa(rings) + __page_size);
+
+	for (unsigned int i = 0; i < NR_RX_DESCRIPTORS; i++) {
+		_rx_packets[i] = sys.mm().pktalloc().allocate();
+		if (!_rx_packets[i]) return false;
+
+		_rx_ring[i].address = _rx_packets[i]->data_pa();
+	}
+
+	// Every receive descriptor but the one at the tail is the controller's.
+	write(E1000_REG_RDBAL, (uint32_t)rings_pa);
+	write(E1000_REG_RDBAH, (uint32_t)(rings_pa >> 32));
+	write(E1000_REG_RDLEN, NR_RX_DESCRIPTORS * sizeof(RxDescriptor));
+	write(E1000_REG_RDH, 0);
+	write(E1000_REG_RDT, NR_RX_DESCRIPTORS - 1);
+
+	write(E1000_REG_TDBAL, (uint32_t)(rings_pa + __page_size));
+	write(E1000_REG_TDBAH, (uint32_t)((rings_pa + __page_size) >> 32));
+	write(E1000_REG_TDLEN, NR_TX_DESCRIPTORS * sizeof(TxDescriptor));
+	write(E1000_REG_TDH, 0);
+	write(E1000_REG_TDT, 0);
+
+	return true;
+}
+
+/**
+ * Resets the controller, sets up its rings, and turns receiving and transmitting on.
+ * Frames for the controller's address, and broadcasts, are received, with 2 KiB buffers
+ * and the CRC stripped.
+ */
+bool E1000Device::init(kernel::DeviceManager& dm)
+{
+	// The registers are reached through the physical memory map, which covers 4 GiB.
+	if (_mmio_base == 0 || _mmio_base + E1000_MMIO_SIZE > 0x100000000ull) {
+		e1000_log.messagef(LogLevel::ERROR, "registers at %lx are out of reach", _mmio_base);
+		return false;
+	}
+
+	set_physical_cache_type(_mmio_base, E1000_MMIO_SIZE, PTE_CACHE_UC);
+	_regs = (volatile uint32_t *)pa_to_vpa(_mmio_base);
+
+	if (!reset()) {
+		e1000_log.message(LogLevel::ERROR, "controller did not come out of reset");
+		return false;
+	}
+
+	read_mac_address();
+
+	for (unsigned int i = 0; i < 128; i++) {
+		write(E1000_REG_MTA + i * 4, 0);
+	}
+
+	if (!init_rings()) {
+		e1000_log.message(LogLevel::ERROR, "unable to allocate the rings");
+		return false;
+	}
+
+	write(E1000_REG_ITR, itr_rate ? 1000000000 / (itr_rate * 256) : 0);
+
+	write(E1000_REG_RCTL, E1000_RCTL_EN | E1000_RCTL_BAM | E1000_RCTL_SECRC);
+	write(E1000_REG_TIPG, E1000_TIPG_DEFAULT);
+	write(E1000_REG_TCTL, E1000_TCTL_EN | E1000_TCTL_PSP | E1000_TCTL_CT(0x0f) | E1000_TCTL_COLD(0x40));
+
+	// Received frames, and the link changing, interrupt; finished transmits only do while
+	// a transmitter is waiting.
+	if (_irq) {
+		_irq->attach(irq_handler, this);
+		write(E1000_REG_IMS, E1000_INT_RXT0 | E1000_INT_RXO | E1000_INT_RXDMT0 | E1000_INT_LSC);
+	}
+
+	e1000_log.messagef(LogLevel::INFO, "mac=%02x:%02x:%02x:%02x:%02x:%02x, itr=%u/s, irq=%s, link=%s",
+			_mac[0], _mac[1], _mac[2], _mac[3], _mac[4], _mac[5], itr_rate,
+			_irq ? "msi" : "polled", (read(E1000_REG_STATUS) & E1000_STATUS_LU) ? "up" : "down");
+
+	return true;
+}
+
+void E1000Device::mac_address(uint8_t *mac) const
+{
+	memcpy(mac, _mac, sizeof(_mac));
+}
+
+bool E1000Device::can_wait_for_irq() const
+{
+	return _irq && sys.scheduler().active() && sys.arch().interrupts_enabled();
+}
+
+bool E1000Device::has_received() const
+{
+	return _rx_ring && (_rx_ring[_rx_next].status & E1000_RXD_STAT_DD);
+}
+
+/**
+ * Takes the packet buffer of the next received frame out of its ring slot, replacing it
+ * with a new one, and gives the slots that have been taken back to the controller, a
+ * batch at a time.  Frames that didn't fit in one buffer, or were received with errors,
+ * or can't be replaced, are dropped, and their buffers left in the ring.
+ */
+PacketBuffer *E1000Device::receive_packet(bool wait)
+{
+	PacketBufferAllocator& pktalloc = sys.mm().pktalloc();
+	bool polled = !can_wait_for_irq();
+
+	// The replacements are allocated atomically, under the lock, so they're made here,
+	// if the pool is running out.
+	pktalloc.reserve(RX_REFILL_BATCH);
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_rx_waiters.lock());
+
+	for (;;) {
+		RxDescriptor& desc = _rx_ring[_rx_next];
+
+		if (!(desc.status & E1000_RXD_STAT_DD)) {
+			// Whatever has been taken goes back before waiting, so that the controller
+			// has every slot while nothing is being received.
+			if (_rx_unposted) {
+				write(E1000_REG_RDT, (_rx_next + NR_RX_DESCRIPTORS - 1) % NR_RX_DESCRIPTORS);
+				_rx_unposted = 0;
+			}
+
+			if (!wait) return NULL;
+
+			if (polled) {
+				_rx_waiters.lock().unlock();
+				asm volatile("pause");
+				_rx_waiters.lock().lock();
+			} else {
+				_rx_waiters.sleep_locked(Thread::current());
+			}
+
+			continue;
+		}
+
+		PacketBuffer *packet = NULL;
+		if ((desc.status & E1000_RXD_STAT_EOP) && !desc.errors) {
+			PacketBuffer *replacement = pktalloc.allocate(true);
+
+			if (replacement) {
+				packet = _rx_packets[_rx_next];
+				packet->length = desc.length;
+
+				_rx_packets[_rx_next] = replacement;
+				desc.address = replacement->data_pa();
+			}
+		}
+
+		desc.status = 0;
+		_rx_next = (_rx_next + 1) % NR_RX_DESCRIPTORS;
+
+		if (++_rx_unposted >= RX_REFILL_BATCH) {
+			write(E1000_REG_RDT, (_rx_next + NR_RX_DESCRIPTORS - 1) % NR_RX_DESCRIPTORS);
+			_rx_unposted = 0;
+		}
+
+		if (packet) return packet;
+	}
+}
+
+/**
+ * Steps past the transmit descriptors the controller has finished with, releasing their
+ * packets.  Called with the transmit lock held.
+ */
+void E1000Device::reclaim_tx()
+{
+	while (_tx_clean != _tx_tail && (_tx_ring[_tx_clean].status & E1000_TXD_STAT_DD)) {
+		if (_tx_packets[_tx_clean]) {
+			sys.mm().pktalloc().release(_tx_packets[_tx_clean]);
+			_tx_packets[_tx_clean] = NULL;
+		}
+
+		_tx_clean = (_tx_clean + 1) % NR_TX_DESCRIPTORS;
+	}
+}
+
+/**
+ * The descriptors that can be filled: one is always left empty, so that a full ring
+ * isn't taken for an empty one.
+ */
+unsigned int E1000Device::tx_free() const
+{
+	return (_tx_clean + NR_TX_DESCRIPTORS - _tx_tail - 1) % NR_TX_DESCRIPTORS;
+}
+
+/**
+ * Puts the packets in the transmit ring, a descriptor for each of their buffers, and
+ * hands them to the controller with one write of the tail.  If the ring fills, what has
+ * been added so far is handed over, and, if 'wait' is set, the transmit interrupt
+ * unmasked until there is room.
+ */
+unsigned int E1000Device::transmit_packets(PacketBuffer **packets, unsigned int count, bool wait)
+{
+	bool can_sleep = can_wait_for_irq();
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_tx_waiters.lock());
+
+	unsigned int start = _tx_tail;
+	unsigned int sent = 0;
+
+	while (sent < count) {
+		PacketBuffer *packet = packets[sent];
+
+		size_t length = packet->packet_length();
+		if (!length || length > NET_MAX_FRAME_SIZE) break;
+
+		unsigned int nr_buffers = 0;
+		for (PacketBuffer *b = packet; b; b = b->next) {
+			if (b->length) nr_buffers++;
+		}
+
+		if (nr_buffers >= NR_TX_DESCRIPTORS) break;
+
+		if (tx_free() < nr_buffers) reclaim_tx();
+
+		if (tx_free() < nr_buffers) {
+			if (_tx_tail != start) {
+				write(E1000_REG_TDT, _tx_tail);
+				start = _tx_tail;
+			}
+
+			if (!wait) break;
+
+			if (can_sleep) {
+				_tx_waiting = true;
+				write(E1000_REG_IMS, E1000_INT_TXDW);
+
+				// It may have finished with some before the interrupt was unmasked.
+				reclaim_tx();
+				if (tx_free() < nr_buffers) _tx_waiters.sleep_locked(Thread::current());
+
+				_tx_waiting = false;
+				write(E1000_REG_IMC, E1000_INT_TXDW);
+			} else {
+				_tx_waiters.lock().unlock();
+				asm volatile("pause");
+				_tx_waiters.lock().lock();
+			}
+
+			continue;
+		}
+
+		// The packet is released once the descriptor of its last buffer is done with.
+		unsigned int last = _tx_tail;
+		for (PacketBuffer *b = packet; b; b = b->next) {
+			if (!b->length) continue;
+
+			TxDescriptor& desc = _tx_ring[_tx_tail];
+			desc.address = b->data_pa();
+			desc.length = b->length;
+			desc.cso = 0;
+			desc.command = E1000_TXD_CMD_IFCS | E1000_TXD_CMD_RS;
+			desc.status = 0;
+			desc.css = 0;
+			desc.special = 0;
+
+			last = _tx_tail;
+			_tx_tail = (_tx_tail + 1) % NR_TX_DESCRIPTORS;
+		}
+
+		_tx_ring[last].command |= E1000_TXD_CMD_EOP;
+		_tx_packets[last] = packet;
+		sent++;
+	}
+
+	if (_tx_tail != start) {
+		write(E1000_REG_TDT, _tx_tail);
+	}
+
+	return sent;
+}
+
+/**
+ * Handles the controller's interrupt.  Reading the cause register acknowledges it.
+ */
+void E1000Device::irq_handler(const IRQ *irq, void *priv)
+{
+	E1000Device& dev = *(E1000Device *)priv;
+
+	uint32_t cause = dev.read(E1000_REG_ICR);
+
+	if (cause & E1000_INT_TXDW) {
+		UniqueLock<SpinLock> l(dev._tx_waiters.lock());
+
+		dev.write(E1000_REG_IMC, E1000_INT_TXDW);
+		dev.reclaim_tx();
+
+		if (dev._tx_waiting) {
+			while (dev._tx_waiters.wake_one_locked());
+		}
+	}
+
+	if (cause & (E1000_INT_RXT0 | E1000_INT_RXO | E1000_INT_RXDMT0)) {
+		{
+			UniqueLock<SpinLock> l(dev._rx_waiters.lock());
+			while (dev._rx_waiters.wake_one_locked());
+		}
+
+		dev.frames_received();
+	}
+
+	if (cause & E1000_INT_LSC) {
+		e1000_log.messagef(LogLevel::INFO, "link %s", (dev.read(E1000_REG_STATUS) & E1000_STATUS_LU) ? "up" : "down");
+	}
+}
@@ -0,0 +1,131 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/net/network-device.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/net/network-device.h>
+#include <infos/fs/file.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/mm.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::net;
+using namespace infos::fs;
+using namespace infos::util;
+using namespace infos::mm;
+
+const DeviceClass NetworkDevice::NetworkDeviceClass(Device::RootDeviceClass, "net");
+
+// Frames copied in by transmit() are handed to the device this many at a time.
+#define NET_TRANSMIT_BATCH		16
+
+class NetworkDeviceFile : public File
+{
+public:
+	NetworkDeviceFile(NetworkDevice& dev) : _dev(dev), _nonblocking(false) { }
+
+	int read(void *buffer, size_t size) override
+	{
+		return _dev.receive(buffer, size, !_nonblocking);
+	}
+
+	int write(const void *buffer, size_t size) override
+	{
+		IOVec frame = { (void *)buffer, size };
+		return _dev.transmit(&frame, 1, !_nonblocking) ? (int)size : -1;
+	}
+
+	/* Each buffer is a frame, and they all go to the device together.  The buffers are
+	 * handed over as the system call's bounce buffer holds them, so a writev of more
+	 * than that (16 KiB) may have a frame split. */
+	int writev(const IOVec *vec, unsigned int count) override
+	{
+		unsigned int nr_sent = _dev.transmit(vec, count, !_nonblocking);
+		if (!nr_sent && count) return -1;
+
+		size_t size = 0;
+		for (unsigned int i = 0; i < nr_sent; i++) size += vec[i].size;
+
+		return size;
+	}
+
+	unsigned int poll() override
+	{
+		return PollEvents::WRITABLE | (_dev.has_received() ? PollEvents::READABLE : 0);
+	}
+
+	const void *poll_source() const override { return &_dev; }
+	void set_nonblocking(bool nonblocking) override { _nonblocking = nonblocking; }
+
+private:
+	NetworkDevice& _dev;
+	bool _nonblocking;
+};
+
+unsigned int NetworkDevice::transmit(const IOVec *frames, unsigned int count, bool wait)
+{
+	PacketBufferAllocator& pktalloc = sys.mm().pktalloc();
+	unsigned int sent = 0;
+
+	while (sent < count) {
+		PacketBuffer *packets[NET_TRANSMIT_BATCH];
+		unsigned int nr_packets = 0;
+
+		while (nr_packets < NET_TRANSMIT_BATCH && sent + nr_packets < count) {
+			const IOVec& frame = frames[sent + nr_packets];
+			if (!frame.size || frame.size > NET_MAX_FRAME_SIZE) break;
+
+			PacketBuffer *packet = pktalloc.allocate();
+			if (!packet) break;
+
+			memcpy(packet->put(frame.size), frame.base, frame.size);
+			packets[nr_packets++] = packet;
+		}
+
+		unsigned int nr_sent = nr_packets ? transmit_packets(packets, nr_packets, wait) : 0;
+		for (unsigned int i = nr_sent; i < nr_packets; i++) {
+			pktalloc.release(packets[i]);
+		}
+
+		sent += nr_sent;
+		if (nr_sent < NET_TRANSMIT_BATCH) break;
+	}
+
+	return sent;
+}
+
+int NetworkDevice::receive(void *buffer, size_t size, bool wait)
+{
+	PacketBuffer *packet = receive_packet(wait);
+	if (!packet) return 0;
+
+	size_t copied = packet->copy_out(0, buffer, size);
+	sys.mm().pktalloc().release(packet);
+	return (int)copied;
+}
+
+File *NetworkDevice::open_as_file()
+{
+	return new (infos::mm::HeapArena::DRIVERS) NetworkDeviceFile(*this);
+}
+
+void NetworkDevice::set_receive_notifier(receive_notifier_t fn, void *priv)
+{
+	_rx_notifier_priv = priv;
+	__atomic_store_n(&_rx_notifier, fn, __ATOMIC_RELEASE);
+}
+
+void NetworkDevice::frames_received()
+{
+	receive_notifier_t notifier = __atomic_load_n(&_rx_notifier, __ATOMIC_ACQUIRE);
+	if (notifier) notifier(*this, _rx_notifier_priv);
+
+	File::wake_pollers(this);
+}
@@ -10,12 +10,14 @@
  */
 #include <infos/drivers/pci/bridge.h>
 #include <infos/drivers/pci/pci-bus.h>
+#include <infos/mm/object-allocator.h>
 
 using namespace infos::drivers;
 using namespace infos::drivers::pci;
 using namespace infos::kernel;
+using namespace infos::mm;
 
-Bridge::Bridge(PCIBus& bus, unsigned int slot, unsigned int func) : PCIDevice(bus, slot, func)
+Bridge::Bridge(PCIBus& bus, unsigned int slot, unsigned int func) : PCIDevice(bus, slot, func), _secondary(NULL)
 {
 
 }
@@ -24,6 +26,7 @@ bool Bridge::init(kernel::DeviceManager& dm)
 {
 	switch (subclass()) {
 	case PCI_TO_PCI_BRIDGE:
+	case PCI_TO_PCI_SEMITRANSPARENT:
 	{
 		unsigned int header_type = PCI_CONFIG_HDRTYPE(read_config(PCI_REG_CONFIG));
 		
@@ -32,10 +35,20 @@ bool Bridge::init(kernel::DeviceManager& dm)
 			return false;
 		}
 		
-		unsigned int secondary_bus_id = PCI_CONFIG_SECONDARY_BUS(read_config(PCI_REG_BUSINFO));
-		pci_log.messagef(LogLevel::DEBUG, "PCI-to-PCI Bridge secondary=%d", /* subclass(), */ secondary_bus_id);
+		uint32_t businfo = read_config(PCI_REG_BUSINFO);
+		unsigned int primary_bus_id = PCI_CONFIG_PRIMARY_BUS(businfo);
+		unsigned int secondary_bus_id = PCI_CONFIG_SECONDARY_BUS(businfo);
+		pci_log.messagef(LogLevel::DEBUG, "PCI-to-PCI Bridge primary=%d secondary=%d", primary_bus_id, secondary_bus_id);
+
+		// A bridge the firmware hasn't given a bus number would lead back to a bus above it.
+		if (secondary_bus_id <= primary_bus_id) {
+			pci_log.messagef(LogLevel::WARNING, "PCI-to-PCI Bridge has not been configured, skipping");
+			return true;
+		}
 		
-		_secondary = new PCIBus(secondary_bus_id);
+		// The secondary bus is probed now, and any bridges on it in turn, so everything
+		// below this bridge has been found by the time it is registered.
+		_secondary = new (HeapArena::DRIVERS) PCIBus(secondary_bus_id);
 		return _secondary->probe(dm);
 	}
 	
@@ -9,11 +9,114 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/drivers/pci/network.h>
+#include <infos/drivers/virtio/virtio-net.h>
+#include <infos/drivers/net/e1000.h>
+#include <infos/kernel/device-manager.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
+#include <arch/arch.h>
 
+using namespace infos::kernel;
 using namespace infos::drivers;
 using namespace infos::drivers::pci;
+using namespace infos::drivers::net;
+using namespace infos::drivers::virtio;
+using namespace infos::mm;
+
+const DeviceClass Network::NetworkDeviceClass(PCIDevice::PCIDeviceClass, "network");
+
+// The e1000 family members that are driven: the 82540EM and 82545EM, and the 82574L
+// (e1000e), which are the ones hypervisors emulate.
+static const uint16_t e1000_device_ids[] = { 0x100e, 0x100f, 0x10d3 };
 
 Network::Network(PCIBus& bus, unsigned int slot, unsigned int func) : PCIDevice(bus, slot, func)
 {
 
 }
+
+bool Network::init(kernel::DeviceManager& dm)
+{
+	uint32_t id = read_config(PCI_REG_VENDOR);
+	if (PCI_CONFIG_VENDOR(id) == VIRTIO_PCI_VENDOR && PCI_CONFIG_DEVICE(id) == VIRTIO_PCI_DEVICE_NET) {
+		return init_virtio_net(dm);
+	}
+
+	if (PCI_CONFIG_VENDOR(id) == E1000_PCI_VENDOR) {
+		for (unsigned int i = 0; i < ARRAY_SIZE(e1000_device_ids); i++) {
+			if (PCI_CONFIG_DEVICE(id) == e1000_device_ids[i]) return init_e1000(dm);
+		}
+	}
+
+	pci_log.messagef(LogLevel::WARNING, "Unsupported network controller %04x:%04x", PCI_CONFIG_VENDOR(id), PCI_CONFIG_DEVICE(id));
+	return true;
+}
+
+/**
+ * Brings up a virtio network device, through its legacy interface, with an MSI-X
+ * interrupt for each of its queues, as far as the table goes.  Queue pair n's interrupts
+ * are aimed at CPU n, which is the CPU that transmits on it.
+ */
+bool Network::init_virtio_net(kernel::DeviceManager& dm)
+{
+	uint32_t bar0 = read_config(PCI_REG_BAR0);
+	if (!(bar0 & 1)) {
+		pci_log.messagef(LogLevel::ERROR, "virtio device without a legacy interface");
+		return false;
+	}
+
+	write_config(PCI_REG_COMMAND, read_config(PCI_REG_COMMAND) | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+	VirtioNetConfiguration cfg;
+	cfg.io_base = bar0 & ~3;
+	cfg.nr_irqs = 0;
+
+	unsigned int nr_entries = __min(msix_table_size(), (unsigned int)(VIRTIO_NET_MAX_QUEUE_PAIRS * 2));
+	unsigned int nr_cpus = sys.arch().nr_cpus();
+
+	while (cfg.nr_irqs < nr_entries) {
+		IRQ *irq = request_msix(dm, cfg.nr_irqs, (cfg.nr_irqs / 2) % nr_cpus);
+		if (!irq) break;
+
+		cfg.irqs[cfg.nr_irqs++] = irq;
+	}
+
+	VirtioNetDevice *dev = new (HeapArena::DRIVERS) VirtioNetDevice(cfg);
+	if (!dm.register_device(*dev)) {
+		delete dev;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Brings up an e1000 controller, whose registers are memory-mapped at BAR0.  Only the
+ * 82574 has MSI: the others are polled.
+ */
+bool Network::init_e1000(kernel::DeviceManager& dm)
+{
+	uint32_t bar0 = read_config(PCI_REG_BAR0);
+	if (bar0 & 1) {
+		pci_log.messagef(LogLevel::ERROR, "e1000 registers are not memory-mapped");
+		return false;
+	}
+
+	if ((bar0 & 6) == 4 && read_config(PCI_REG_BAR1)) {
+		pci_log.messagef(LogLevel::ERROR, "e1000 registers are above 4 GiB");
+		return false;
+	}
+
+	write_config(PCI_REG_COMMAND, read_config(PCI_REG_COMMAND) | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+
+	E1000Configuration cfg;
+	cfg.mmio_base = bar0 & ~0xf;
+	cfg.irq = request_msi(dm);
+
+	E1000Device *dev = new (HeapArena::DRIVERS) E1000Device(cfg);
+	if (!dm.register_device(*dev)) {
+		delete dev;
+		return false;
+	}
+
+	return true;
+}
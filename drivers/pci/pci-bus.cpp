@@ -17,31 +17,165 @@
 #include <infos/drivers/pci/storage.h>
 
 #include <infos/kernel/device-manager.h>
+#include <infos/kernel/log.h>
+#include <infos/mm/object-allocator.h>
+
+#include <infos/util/lock.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
 
 #include <arch/x86/pio.h>
+#include <arch/x86/acpi/acpi.h>
 
 using namespace infos::drivers;
 using namespace infos::drivers::pci;
 using namespace infos::kernel;
 using namespace infos::arch::x86;
+using namespace infos::arch::x86::acpi;
+using namespace infos::mm;
+using namespace infos::util;
+
+// Configuration space is reached through one pair of ports, so an access must not be
+// split by one from another thread, e.g. of a device being probed alongside.
+static SpinLock config_lock;
+
+// Where the memory-mapped configuration space is, if there is one.  An access there is a
+// single load or store, so needs no lock.  It is only used if asked for (pci.ecam=1),
+// until it has been run on a booted system; otherwise every access goes through the ports.
+static bool ecam_enabled;
+static volatile uint8_t *ecam_base;
+static unsigned int ecam_start_bus, ecam_end_bus;
+
+RegisterCmdLineArgument(PCIECAM, "pci.ecam") {
+	ecam_enabled = strncmp(value, "1", 2) == 0 || strncmp(value, "on", 3) == 0;
+}
+
+// A bit for each bus that has been probed, so that a bus is only probed once, however many
+// ways there are of reaching it.
+static uint32_t probed_buses[256 / 32];
+
+static void ecam_init()
+{
+	uint64_t base;
+	uint8_t start_bus, end_bus;
+
+	if (!ecam_enabled || !acpi_get_pci_ecam(base, start_bus, end_bus)) return;
+
+	// Each bus takes 1MB, and all of them have to be in the physical memory mapping.
+	uint64_t size = ((uint64_t)end_bus - start_bus + 1) << 20;
+	if (end_bus < start_bus || base + size > PMEM_VA_SIZE) {
+		pci_log.messagef(LogLevel::WARNING, "ECAM at %llx is out of reach, using port I/O", base);
+		return;
+	}
+
+	ecam_base = (volatile uint8_t *)pa_to_vpa(base);
+	ecam_start_bus = start_bus;
+	ecam_end_bus = end_bus;
+
+	pci_log.messagef(LogLevel::INFO, "using ECAM at %llx for buses %u-%u", base, start_bus, end_bus);
+}
+
+static inline volatile uint32_t *ecam_address(unsigned int bus, uint8_t slot, uint8_t func, uint8_t reg)
+{
+	if (!ecam_base || bus < ecam_start_bus || bus > ecam_end_bus) return NULL;
+
+	return (volatile uint32_t *)(ecam_base + (((uintptr_t)(bus - ecam_start_bus) << 20) |
+			((uintptr_t)slot << 15) |
+			((uintptr_t)func << 12) |
+			((uintptr_t)reg & ~0x03ULL)));
+}
 
 PCIBus::PCIBus(unsigned int bus_id) : _bus_id(bus_id)
 {
 
 }
 
+/**
+ * Probes every slot of the bus.  Storage controllers spend most of their probing waiting
+ * for drives (and for missing ones to time out), so each is probed in a thread of its own,
+ * and this doesn't wait for them: whatever needs a disk waits for DeviceInitGroup::STORAGE.
+ */
 bool PCIBus::probe(kernel::DeviceManager& dm)
 {
+	if (!claim()) {
+		pci_log.messagef(LogLevel::DEBUG, "bus %u has already been probed", _bus_id);
+		return true;
+	}
+
 	bool success = true;
 	for (int slot = 0; slot < 32; slot++) {
 		success &= probe_slot(dm, slot);
 	}
-	
+
+	return success;
+}
+
+/**
+ * Marks the bus as probed.  Returns false if it already was.
+ */
+bool PCIBus::claim()
+{
+	uint32_t bit = 1u << (_bus_id % 32);
+	return !(__atomic_fetch_or(&probed_buses[(_bus_id / 32) % 8], bit, __ATOMIC_RELAXED) & bit);
+}
+
+/**
+ * Probes bus zero, and, if the host controller at 00:00.0 is multi-function, the bus of each
+ * of its other functions: function N is the host controller for bus N.
+ */
+bool PCIBus::probe_all(kernel::DeviceManager& dm)
+{
+	ecam_init();
+
+	PCIBus *root = new PCIBus(0);
+	if (!root->probe(dm)) {
+		return false;
+	}
+
+	if (!(PCI_CONFIG_HDRTYPE(root->read_config(0, 0, PCI_REG_CONFIG)) & 0x80)) {
+		return true;
+	}
+
+	for (unsigned int func = 1; func < 8; func++) {
+		if (PCI_CONFIG_VENDOR(root->read_config(0, func, PCI_REG_VENDOR)) == 0xffff) continue;
+
+		PCIBus *bus = new PCIBus(func);
+		if (!bus->probe(dm)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct StorageProbe
+{
+	DeviceManager *dm;
+	PCIDevice *device;
+};
+
+bool PCIBus::storage_probe(void *arg)
+{
+	StorageProbe *probe = (StorageProbe *)arg;
+
+	bool success = probe->dm->register_device(*probe->device);
+	if (!success) {
+		pci_log.messagef(LogLevel::ERROR, "Storage controller failed to register device object");
+		delete probe->device;
+	}
+
+	delete probe;
 	return success;
 }
 
 bool PCIBus::probe_slot(kernel::DeviceManager& dm, unsigned int slot)
 {
+	// With no function 0, there is no device, and its other functions needn't be looked for:
+	// the header type would read as all ones, and so as multi-function.
+	if (PCI_CONFIG_VENDOR(read_config(slot, 0, PCI_REG_VENDOR)) == 0xffff) {
+		return true;
+	}
+
 	if (!probe_func(dm, slot, 0)) {
 		pci_log.messagef(LogLevel::ERROR, "Probing slot %u func 0 failed.", slot);
 		return false;
@@ -75,19 +209,19 @@ bool PCIBus::probe_func(kernel::DeviceManager& dm, unsigned int slot, unsigned i
 	PCIDevice *new_device = NULL;
 	switch (device_class) {
 	case PCIDeviceClass::BRIDGE:
-		new_device = new Bridge(*this, slot, func);
+		new_device = new (HeapArena::DRIVERS) Bridge(*this, slot, func);
 		break;
 		
 	case PCIDeviceClass::DISPLAY:
-		new_device = new Display(*this, slot, func);
+		new_device = new (HeapArena::DRIVERS) Display(*this, slot, func);
 		break;
 
 	case PCIDeviceClass::NETWORK:
-		new_device = new Network(*this, slot, func);
+		new_device = new (HeapArena::DRIVERS) Network(*this, slot, func);
 		break;
 
 	case PCIDeviceClass::MASS_STORAGE:
-		new_device = new Storage(*this, slot, func);
+		new_device = new (HeapArena::DRIVERS) Storage(*this, slot, func);
 		break;
 		
 	default:
@@ -99,6 +233,21 @@ bool PCIBus::probe_func(kernel::DeviceManager& dm, unsigned int slot, unsigned i
 		pci_log.messagef(LogLevel::ERROR, "Supported class %u failed to create device object", device_class);
 		return false;
 	}
+
+	if (device_class == PCIDeviceClass::MASS_STORAGE) {
+		StorageProbe *probe = new (HeapArena::DRIVERS) StorageProbe;
+		probe->dm = &dm;
+		probe->device = new_device;
+
+		dm.init_async(DeviceInitGroup::STORAGE, storage_probe, probe);
+		return true;
+	}
+
+	// Nothing during the boot needs the network.
+	if (device_class == PCIDeviceClass::NETWORK) {
+		dm.register_device_async(*new_device, DeviceInitGroup::NETWORK);
+		return true;
+	}
 	
 	if (!dm.register_device(*new_device)) {
 		pci_log.messagef(LogLevel::ERROR, "Supported class %u failed to register device object", device_class);
@@ -112,24 +261,41 @@ bool PCIBus::probe_func(kernel::DeviceManager& dm, unsigned int slot, unsigned i
 
 uint32_t PCIBus::read_config(uint8_t slot, uint8_t func, uint8_t reg)
 {
+	volatile uint32_t *ecam = ecam_address(_bus_id, slot, func, reg);
+	if (ecam) {
+		return *ecam;
+	}
+
 	uint32_t address = (0x80000000ULL |
 			((uint32_t)_bus_id << 16) | 
 			((uint32_t)slot << 11) | 
 			((uint32_t)func << 8) |
 			((uint32_t)reg & ~0x03ULL));
 
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(config_lock);
+
 	__outl(PCI_CONFIG_ADDRESS, address);
 	return __inl(PCI_CONFIG_DATA);
 }
 
 void PCIBus::write_config(uint8_t slot, uint8_t func, uint8_t reg, uint32_t value)
 {
+	volatile uint32_t *ecam = ecam_address(_bus_id, slot, func, reg);
+	if (ecam) {
+		*ecam = value;
+		return;
+	}
+
 	uint32_t address = (0x80000000ULL |
 			((uint32_t)_bus_id << 16) | 
 			((uint32_t)slot << 11) | 
 			((uint32_t)func << 8) |
 			((uint32_t)reg & ~0x03ULL));
 
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(config_lock);
+
 	__outl(PCI_CONFIG_ADDRESS, address);
 	__outl(PCI_CONFIG_DATA, value);
 }
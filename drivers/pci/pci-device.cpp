@@ -11,7 +11,12 @@
 #include <infos/drivers/pci/pci-device.h>
 #include <infos/drivers/pci/pci-bus.h>
 #include <infos/drivers/pci/bridge.h>
+#include <infos/drivers/irq/lapic.h>
 #include <infos/kernel/device-manager.h>
+#include <infos/kernel/irq.h>
+#include <infos/mm/object-allocator.h>
+#include <arch/x86/x86-arch.h>
+#include <arch/x86/cpu.h>
 #include <arch/x86/pio.h>
 
 #define PCI_CONFIG_ADDRESS	0xcf8
@@ -19,8 +24,10 @@
 
 using namespace infos::drivers;
 using namespace infos::drivers::pci;
+using namespace infos::drivers::irq;
 using namespace infos::kernel;
 using namespace infos::arch::x86;
+using namespace infos::mm;
 
 const DeviceClass PCIDevice::PCIDeviceClass(Device::RootDeviceClass, "pci");
 
@@ -50,3 +57,256 @@ void PCIDevice::write_config(uint8_t reg, uint32_t value) const
 {
 	bus().write_config(_slot, _func, reg, value);
 }
+
+/**
+ * Walks the device's capability list.
+ * @return Returns the offset in configuration space of the capability with the given ID,
+ * or zero if the device doesn't have one.
+ */
+uint8_t PCIDevice::find_capability(uint8_t id) const
+{
+	if (!(read_config(PCI_REG_COMMAND) & PCI_STATUS_CAPABILITIES)) return 0;
+
+	uint8_t offset = read_config(PCI_REG_CAPABILITIES) & 0xfc;
+
+	// A broken list can't send this round in circles for ever.
+	for (int i = 0; offset && i < 48; i++) {
+		uint32_t header = read_config(offset);
+		if (PCI_CAP_ID(header) == id) return offset;
+
+		offset = PCI_CAP_NEXT(header) & 0xfc;
+	}
+
+	return 0;
+}
+
+/**
+ * Returns the message address for a destination.  A set of CPUs is addressed in logical
+ * mode, with the redirection hint set, so that the message goes to the one of them doing
+ * the least important work.
+ */
+static uint32_t msi_address(const IRQDestination& dest)
+{
+	return 0xfee00000 | ((uint32_t)dest.destination << 12) | (dest.logical ? (1 << 3) | (1 << 2) : 0);
+}
+
+/**
+ * Returns the message data for a vector: edge triggered, with lowest-priority delivery to a
+ * set of CPUs, or else fixed.
+ */
+static uint32_t msi_data(const IRQDestination& dest, uint8_t vector)
+{
+	return vector | (dest.logical ? (1 << 8) : 0);
+}
+
+/**
+ * Works out where to send a device's interrupts at first: to the CPU with the given index,
+ * if it takes interrupts, or else to the one asking.
+ */
+static IRQDestination msi_destination(LAPIC& lapic, unsigned int cpu)
+{
+	IRQDestination dest;
+	if (cpu >= 64 || !irq_destination(1ull << cpu, dest)) {
+		dest.logical = false;
+		dest.destination = lapic.id();
+	}
+
+	return dest;
+}
+
+/**
+ * A message-signalled interrupt.  The device writes its vector straight to the local APIC,
+ * so there is no interrupt controller pin to route, or share.  The messages of a block all
+ * go to the same place, so only a block of one can be steered.
+ */
+class PCIDevice::MSIIRQ final : public IRQ
+{
+public:
+	MSIIRQ(const PCIDevice& device, uint8_t cap, bool steerable)
+		: IRQ(IRQFlags::EOI | (steerable ? IRQFlags::STEERABLE : 0)), _device(device), _cap(cap) { }
+
+	void enable() override { }
+	void disable() override { }
+
+	bool set_affinity(AffinityMask mask) override
+	{
+		if (!(flags() & IRQFlags::STEERABLE)) return false;
+
+		IRQDestination dest;
+		if (!irq_destination(mask, dest)) return false;
+
+		// The device may send a message between the two writes, but it goes to one of the
+		// two places, as the data only differs in the delivery mode.
+		_device.write_config(_cap + 4, msi_address(dest));
+		if (_device.read_config(_cap) & PCI_MSI_64BIT) {
+			_device.write_config(_cap + 12, msi_data(dest, nr()));
+		} else {
+			_device.write_config(_cap + 8, msi_data(dest, nr()));
+		}
+
+		_affinity = mask;
+		return true;
+	}
+
+private:
+	const PCIDevice& _device;
+	uint8_t _cap;
+};
+
+/**
+ * An interrupt from an entry of a device's MSI-X table, which can be masked, and steered,
+ * on its own.
+ */
+class PCIDevice::MSIXIRQ final : public IRQ
+{
+public:
+	MSIXIRQ(volatile uint32_t *entry) : IRQ(IRQFlags::EOI | IRQFlags::STEERABLE), _entry(entry) { }
+
+	void enable() override { _entry[3] &= ~PCI_MSIX_ENTRY_MASKED; }
+	void disable() override { _entry[3] |= PCI_MSIX_ENTRY_MASKED; }
+
+	bool set_affinity(AffinityMask mask) override
+	{
+		IRQDestination dest;
+		if (!irq_destination(mask, dest)) return false;
+
+		// An entry mustn't be changed while it is unmasked.  A message that comes in
+		// meanwhile is held by the device, and sent once it is unmasked.
+		uint32_t control = _entry[3];
+		_entry[3] = control | PCI_MSIX_ENTRY_MASKED;
+
+		_entry[0] = msi_address(dest);
+		_entry[2] = msi_data(dest, nr());
+
+		_entry[3] = control;
+
+		_affinity = mask;
+		return true;
+	}
+
+private:
+	volatile uint32_t *_entry;
+};
+
+/**
+ * Gives the device an interrupt of its own, by MSI, and turns off its pin-based interrupt.
+ * @return Returns the interrupt, or NULL if the device can't do MSI (or there isn't a local
+ * APIC, or a free vector).
+ */
+IRQ *PCIDevice::request_msi(DeviceManager& dm, unsigned int cpu) const
+{
+	IRQ *irq;
+	return request_msi_block(dm, &irq, 1, cpu) ? irq : NULL;
+}
+
+/**
+ * Gives the device a block of MSI interrupts, e.g. one for each of its queues, all sent to
+ * the same CPU.  A device with several messages picks which to send by changing the low
+ * bits of the vector, so the block is a power of two long, and aligned to its length.
+ * @return Returns how many interrupts the device was given, which is no more than it can
+ * send, and is zero if it can't do MSI.
+ */
+unsigned int PCIDevice::request_msi_block(DeviceManager& dm, IRQ **irqs, unsigned int nr, unsigned int cpu) const
+{
+	uint8_t cap = find_capability(PCI_CAP_ID_MSI);
+	if (!cap || !nr) return 0;
+
+	LAPIC *lapic;
+	if (!dm.try_get_device_by_class(LAPIC::LAPICDeviceClass, lapic)) return 0;
+
+	uint32_t control = read_config(cap);
+
+	unsigned int order = 0;
+	while (order < PCI_MSI_MULTIPLE_CAPABLE(control) && (2u << order) <= nr && order < 5) order++;
+
+	unsigned int count = 1u << order;
+	for (unsigned int i = 0; i < count; i++) {
+		irqs[i] = new (HeapArena::DRIVERS) MSIIRQ(*this, cap, count == 1);
+	}
+
+	if (!x86arch.irq_manager().attach_irq_block(irqs, count)) {
+		for (unsigned int i = 0; i < count; i++) {
+			delete (MSIIRQ *)irqs[i];
+			irqs[i] = NULL;
+		}
+
+		return 0;
+	}
+
+	// The device fills in the low bits of the vector with the number of the message it is
+	// sending.
+	IRQDestination dest = msi_destination(*lapic, cpu);
+
+	write_config(cap + 4, msi_address(dest));
+	if (control & PCI_MSI_64BIT) {
+		write_config(cap + 8, 0);
+		write_config(cap + 12, msi_data(dest, irqs[0]->nr()));
+	} else {
+		write_config(cap + 8, msi_data(dest, irqs[0]->nr()));
+	}
+
+	write_config(cap, (control & ~(7 << 20)) | (order << 20) | PCI_MSI_ENABLE);
+	write_config(PCI_REG_COMMAND, read_config(PCI_REG_COMMAND) | PCI_COMMAND_INTX_DISABLE);
+
+	return count;
+}
+
+/**
+ * @return Returns how many entries the device's MSI-X table has, or zero if it can't do
+ * MSI-X.
+ */
+unsigned int PCIDevice::msix_table_size() const
+{
+	uint8_t cap = find_capability(PCI_CAP_ID_MSIX);
+	if (!cap) return 0;
+
+	return PCI_MSIX_TABLE_SIZE(read_config(cap));
+}
+
+/**
+ * Gives one entry of the device's MSI-X table an interrupt of its own, and turns MSI-X on
+ * (which turns off the device's pin-based interrupt).  Each entry has its own vector and
+ * target, so a device with a queue per CPU can be given an entry per queue, each sent to
+ * the CPU that uses it.  The table is in one of the device's memory BARs.
+ * @return Returns the interrupt, or NULL if the device can't do MSI-X, or hasn't the entry.
+ */
+IRQ *PCIDevice::request_msix(DeviceManager& dm, unsigned int entry, unsigned int cpu) const
+{
+	uint8_t cap = find_capability(PCI_CAP_ID_MSIX);
+	if (!cap) return NULL;
+
+	uint32_t control = read_config(cap);
+	if (entry >= PCI_MSIX_TABLE_SIZE(control)) return NULL;
+
+	// The table is reached through the physical memory map, which covers 4 GiB.
+	uint32_t table = read_config(cap + 4);
+	uint32_t bar = read_config(PCI_REG_BAR0 + (table & 7) * 4);
+	if (bar & 1) return NULL;
+
+	phys_addr_t table_pa = (bar & ~0xf) + (table & ~7) + entry * 16;
+	if ((bar & 6) == 4 && read_config(PCI_REG_BAR0 + (table & 7) * 4 + 4)) return NULL;
+
+	LAPIC *lapic;
+	if (!dm.try_get_device_by_class(LAPIC::LAPICDeviceClass, lapic)) return NULL;
+
+	volatile uint32_t *e = (volatile uint32_t *)pa_to_vpa(table_pa);
+
+	MSIXIRQ *irq = new (HeapArena::DRIVERS) MSIXIRQ(e);
+	if (!x86arch.irq_manager().attach_irq(irq)) {
+		delete irq;
+		return NULL;
+	}
+
+	write_config(PCI_REG_COMMAND, read_config(PCI_REG_COMMAND) | PCI_COMMAND_MEMORY);
+
+	IRQDestination dest = msi_destination(*lapic, cpu);
+
+	e[0] = msi_address(dest);
+	e[1] = 0;
+	e[2] = msi_data(dest, irq->nr());
+	e[3] = 0;			// Unmasked.
+
+	write_config(cap, (control & ~PCI_MSIX_FUNCTION_MASK) | PCI_MSIX_ENABLE);
+
+	return irq;
+}
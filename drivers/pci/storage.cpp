@@ -10,6 +10,8 @@
  */
 #include <infos/drivers/pci/storage.h>
 #include <infos/drivers/ata/ata-controller.h>
+#include <infos/drivers/ahci/ahci-controller.h>
+#include <infos/drivers/virtio/virtio-blk.h>
 #include <infos/kernel/device-manager.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/log.h>
@@ -20,6 +22,9 @@ using namespace infos::drivers;
 using namespace infos::drivers::block;
 using namespace infos::drivers::pci;
 using namespace infos::drivers::ata;
+using namespace infos::drivers::ahci;
+using namespace infos::drivers::virtio;
+using namespace infos::mm;
 
 const DeviceClass Storage::StorageDeviceClass(PCIDevice::PCIDeviceClass, "storage");
 
@@ -36,6 +41,11 @@ Storage::~Storage()
 
 bool Storage::init(kernel::DeviceManager& dm)
 {
+	uint32_t id = read_config(PCI_REG_VENDOR);
+	if (PCI_CONFIG_VENDOR(id) == VIRTIO_PCI_VENDOR && PCI_CONFIG_DEVICE(id) == VIRTIO_PCI_DEVICE_BLK) {
+		return init_virtio_blk(dm);
+	}
+
 	switch(subclass()) {
 	case StorageSubclass::IDE_CONTROLLER:
 		return init_ide_controller(dm);
@@ -57,8 +67,6 @@ StorageSubclass::StorageSubclass Storage::subclass() const
 
 bool Storage::init_ide_controller(DeviceManager& dm)
 {
-	IRQ *irq = NULL;
-	
 	uint32_t old_config = read_config(PCI_REG_IRQ);
 	uint32_t new_config = (old_config & ~0xFF) | 0xFE;
 	write_config(PCI_REG_IRQ, new_config);
@@ -80,8 +88,16 @@ bool Storage::init_ide_controller(DeviceManager& dm)
 	cfg.BAR[2] = read_config(PCI_REG_BAR2);
 	cfg.BAR[3] = read_config(PCI_REG_BAR3);
 	cfg.BAR[4] = read_config(PCI_REG_BAR4);
+
+	// Bus-master DMA needs the controller's bus-master registers, which are I/O ports at
+	// BAR4, and bus mastering to be turned on.
+	cfg.bus_master = false;
+	if ((PCI_CONFIG_PROGIF(read_config(PCI_REG_INFO)) & 0x80) && (cfg.BAR[4] & 1) && (cfg.BAR[4] & ~3)) {
+		write_config(PCI_REG_COMMAND, read_config(PCI_REG_COMMAND) | PCI_COMMAND_BUS_MASTER);
+		cfg.bus_master = true;
+	}
 	
-	ATAController *dev = new ATAController(*irq, cfg);
+	ATAController *dev = new (HeapArena::DRIVERS) ATAController(cfg);
 	if (!dm.register_device(*dev)) {
 		delete dev;
 		return false;
@@ -90,8 +106,62 @@ bool Storage::init_ide_controller(DeviceManager& dm)
 	return true;
 }
 
+/**
+ * Brings up a virtio block device, through its legacy interface, which is a block of I/O
+ * ports at BAR0.
+ */
+bool Storage::init_virtio_blk(kernel::DeviceManager& dm)
+{
+	uint32_t bar0 = read_config(PCI_REG_BAR0);
+	if (!(bar0 & 1)) {
+		pci_log.messagef(LogLevel::ERROR, "virtio device without a legacy interface");
+		return false;
+	}
+
+	write_config(PCI_REG_COMMAND, read_config(PCI_REG_COMMAND) | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+	VirtioBlockConfiguration cfg;
+	cfg.io_base = bar0 & ~3;
+	cfg.irq = request_msix(dm, 0);
+
+	VirtioBlockDevice *dev = new (HeapArena::DRIVERS) VirtioBlockDevice(cfg);
+	if (!dm.register_device(*dev)) {
+		delete dev;
+		return false;
+	}
+
+	return true;
+}
+
 bool Storage::init_sata_controller(kernel::DeviceManager& dm)
 {
-	pci_log.messagef(LogLevel::WARNING, "SATA controller not (yet!) supported");
+	if (PCI_CONFIG_PROGIF(read_config(PCI_REG_INFO)) != 1) {
+		pci_log.messagef(LogLevel::WARNING, "Unsupported SATA controller interface %u", PCI_CONFIG_PROGIF(read_config(PCI_REG_INFO)));
+		return true;
+	}
+
+	// The HBA's registers are memory-mapped, at BAR5, and it moves everything by DMA.
+	uint32_t bar5 = read_config(PCI_REG_BAR5);
+	if (bar5 & 1) {
+		pci_log.messagef(LogLevel::ERROR, "AHCI registers are not memory-mapped");
+		return false;
+	}
+
+	write_config(PCI_REG_COMMAND, read_config(PCI_REG_COMMAND) | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+
+	AHCIControllerConfiguration cfg;
+	cfg.abar = bar5 & ~0xf;
+	cfg.irq = request_msi(dm);
+
+	if (!cfg.irq) {
+		pci_log.messagef(LogLevel::INFO, "AHCI controller without MSI: polled");
+	}
+
+	AHCIController *dev = new (HeapArena::DRIVERS) AHCIController(cfg);
+	if (!dm.register_device(*dev)) {
+		delete dev;
+		return false;
+	}
+
 	return true;
 }
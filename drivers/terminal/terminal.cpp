@@ -14,11 +14,16 @@
 #include <infos/drivers/input/keyboard.h>
 #include <infos/fs/file.h>
 #include <infos/kernel/log.h>
+#include <infos/kernel/thread.h>
+#include <infos/util/lock.h>
+#include <infos/mm/object-allocator.h>
 
 using namespace infos::drivers;
 using namespace infos::drivers::terminal;
 using namespace infos::fs;
 using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::util;
 
 const DeviceClass Terminal::TerminalDeviceClass(Device::RootDeviceClass, "tty");
 
@@ -58,28 +63,67 @@ SerialTerminal::~SerialTerminal()
 
 void Terminal::append_to_read_buffer(uint8_t c)
 {
-	_read_buffer[_read_buffer_tail++] = c;
-	_read_buffer_tail %= ARRAY_SIZE(_read_buffer);
+	{
+		WakeQueue& wq = _read_buffer_event.wakequeue();
+
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(wq.lock());
+
+		unsigned int next = (_read_buffer_tail + 1) % ARRAY_SIZE(_read_buffer);
+		if (next == _read_buffer_head) return;
+
+		_read_buffer[_read_buffer_tail] = c;
+		_read_buffer_tail = next;
+	}
+
 	_read_buffer_event.trigger();
+	File::wake_pollers(this);
 }
 
 int Terminal::read(void* raw_buffer, size_t size)
 {
 	if (size == 0) return 0;
 
+	WakeQueue& wq = _read_buffer_event.wakequeue();
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(wq.lock());
+
+	// The buffer is checked under the lock that input is added with, so input that
+	// arrives just as the reader goes to sleep still wakes it.
+	while (_read_buffer_head == _read_buffer_tail) {
+		wq.sleep_locked(Thread::current());
+	}
+
 	uint8_t *buffer = (uint8_t *)raw_buffer;
 	size_t n = 0;
-	while (n < size) {
-		while (_read_buffer_head == _read_buffer_tail) {
-			_read_buffer_event.wait();
-		}
-
+	while (n < size && _read_buffer_head != _read_buffer_tail) {
 		uint8_t elem = _read_buffer[_read_buffer_head];
 
 		_read_buffer_head++;
 		_read_buffer_head %= ARRAY_SIZE(_read_buffer);
 
 		buffer[n++] = elem;
+		if (elem == '\n') break;
+	}
+
+	return n;
+}
+
+int Terminal::read_nonblocking(void* raw_buffer, size_t size)
+{
+	WakeQueue& wq = _read_buffer_event.wakequeue();
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(wq.lock());
+
+	uint8_t *buffer = (uint8_t *)raw_buffer;
+	size_t n = 0;
+	while (n < size && _read_buffer_head != _read_buffer_tail) {
+		buffer[n++] = _read_buffer[_read_buffer_head];
+
+		_read_buffer_head++;
+		_read_buffer_head %= ARRAY_SIZE(_read_buffer);
 	}
 
 	return n;
@@ -117,11 +161,11 @@ int ConsoleTerminal::write(const void* buffer, size_t size)
 class TerminalFile : public File
 {
 public:
-	TerminalFile(Terminal& tty) : _tty(tty) { }
+	TerminalFile(Terminal& tty) : _tty(tty), _nonblocking(false) { }
 
 	int read(void* buffer, size_t size) override
 	{
-		return _tty.read(buffer, size);
+		return _nonblocking ? _tty.read_nonblocking(buffer, size) : _tty.read(buffer, size);
 	}
 
 	int write(const void* buffer, size_t size) override
@@ -129,11 +173,20 @@ public:
 		return _tty.write(buffer, size);
 	}
 
+	unsigned int poll() override
+	{
+		return PollEvents::WRITABLE | (_tty.has_input() ? PollEvents::READABLE : 0);
+	}
+
+	const void *poll_source() const override { return &_tty; }
+	void set_nonblocking(bool nonblocking) override { _nonblocking = nonblocking; }
+
 private:
 	Terminal& _tty;
+	bool _nonblocking;
 };
 
 File* Terminal::open_as_file()
 {
-	return new TerminalFile(*this);
+	return new (HeapArena::DRIVERS) TerminalFile(*this);
 }
@@ -0,0 +1,210 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/timer/hpet.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/timer/hpet.h>
+#include <infos/drivers/irq/lapic.h>
+#include <infos/drivers/irq/ioapic.h>
+#include <infos/kernel/device-manager.h>
+#include <infos/kernel/irq.h>
+#include <infos/kernel/log.h>
+#include <arch/x86/tsc.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::timer;
+using namespace infos::drivers::irq;
+
+const DeviceClass HPET::HPETDeviceClass(Timer::TimerDeviceClass, "hpet");
+
+static ComponentLog hpet_log(syslog, "hpet");
+
+#define HPET_GCAP_ID			0x000
+#define HPET_GEN_CONF			0x010
+#define HPET_GINTR_STA			0x020
+#define HPET_MAIN_CNT			0x0f0
+#define HPET_TIMER_CONF(__n)	(0x100 + (__n) * 0x20)
+#define HPET_TIMER_CMP(__n)		(0x108 + (__n) * 0x20)
+
+#define HPET_GCAP_COUNT_SIZE	(1ull << 13)
+#define HPET_GCAP_PERIOD(__v)	((uint32_t)((__v) >> 32))	// In femtoseconds
+
+#define HPET_CONF_ENABLE		(1ull << 0)
+
+#define HPET_TIMER_INT_ENB		(1ull << 2)
+#define HPET_TIMER_TYPE_PERIODIC	(1ull << 3)
+#define HPET_TIMER_PER_INT_CAP	(1ull << 4)
+#define HPET_TIMER_VAL_SET		(1ull << 6)
+#define HPET_TIMER_32MODE		(1ull << 8)
+#define HPET_TIMER_INT_ROUTE(__n)	((uint64_t)(__n) << 9)
+#define HPET_TIMER_INT_ROUTE_MASK	(0x1full << 9)
+#define HPET_TIMER_INT_ROUTE_CAP(__v)	((uint32_t)((__v) >> 32))
+
+// The period is at most 100 ns, by the specification.
+#define HPET_MAX_PERIOD_FS		100000000u
+
+HPET::HPET(virt_addr_t base_address)
+	: _base((volatile uint64_t *)base_address), _frequency(0), _period_fs(0), _wide(false),
+	  _irq(NULL), _deadline(0), _periodic(false), _fired(false)
+{
+}
+
+bool HPET::init(kernel::DeviceManager& dm)
+{
+	uint64_t caps = read(HPET_GCAP_ID);
+
+	_period_fs = HPET_GCAP_PERIOD(caps);
+	if (_period_fs == 0 || _period_fs > HPET_MAX_PERIOD_FS) {
+		hpet_log.messagef(LogLevel::ERROR, "invalid period %u fs", _period_fs);
+		return false;
+	}
+
+	_frequency = 1000000000000000ull / _period_fs;
+	_wide = !!(caps & HPET_GCAP_COUNT_SIZE);
+
+	// Timer 0 starts off disabled, and the main counter running.
+	write(HPET_TIMER_CONF(0), read(HPET_TIMER_CONF(0)) & ~(HPET_TIMER_INT_ENB | HPET_TIMER_TYPE_PERIODIC));
+	write(HPET_GEN_CONF, read(HPET_GEN_CONF) | HPET_CONF_ENABLE);
+
+	hpet_log.messagef(LogLevel::INFO, "frequency=%llu, %u-bit counter, %u timers",
+		_frequency, _wide ? 64 : 32, (unsigned int)((caps >> 8) & 0x1f) + 1);
+
+	if (!route_irq(dm)) {
+		hpet_log.message(LogLevel::WARNING, "no interrupt for timer 0: events can only be polled");
+	}
+
+	return true;
+}
+
+/**
+ * Routes timer 0 to an IOAPIC pin it can use, preferring one above the ISA pins, so that
+ * it has the line to itself.  The legacy replacement route (to the PIT and RTC's lines)
+ * is left off, so those still work.
+ */
+bool HPET::route_irq(kernel::DeviceManager& dm)
+{
+	LAPIC *lapic;
+	IOAPIC *ioapic;
+	if (!dm.try_get_device_by_class(LAPIC::LAPICDeviceClass, lapic)) return false;
+	if (!dm.try_get_device_by_class(IOAPIC::IOAPICDeviceClass, ioapic)) return false;
+
+	uint64_t conf = read(HPET_TIMER_CONF(0));
+	uint32_t pins = HPET_TIMER_INT_ROUTE_CAP(conf);
+	if (!pins) return false;
+
+	unsigned int pin = (pins & 0xffff0000) ? __builtin_ctz(pins & 0xffff0000) : __builtin_ctz(pins);
+
+	_irq = ioapic->request_physical_irq(lapic, pin);
+	if (!_irq) return false;
+
+	_irq->attach(hpet_irq_handler, this);
+
+	// Edge triggered.
+	conf &= ~HPET_TIMER_INT_ROUTE_MASK;
+	conf |= HPET_TIMER_INT_ROUTE(pin);
+	write(HPET_TIMER_CONF(0), conf);
+
+	return true;
+}
+
+void HPET::hpet_irq_handler(const IRQ *irq, void *priv)
+{
+	HPET *hpet = (HPET *)priv;
+
+	// Edge triggered, so there is no status to clear, or to say that it was this timer
+	// that went off, if the line is shared.  A one-shot event is checked against the
+	// counter instead.
+	if (hpet->_periodic || hpet->expired()) hpet->_fired = true;
+}
+
+uint64_t HPET::count() const
+{
+	return _wide ? read(HPET_MAIN_CNT) : (uint32_t)read(HPET_MAIN_CNT);
+}
+
+/**
+ * Arms timer 0 to go off once, after the given number of ticks of the main counter.
+ */
+void HPET::init_oneshot(uint64_t period)
+{
+	reset();
+
+	_periodic = false;
+	_deadline = count() + period;
+	if (!_wide) _deadline = (uint32_t)_deadline;
+
+	write(HPET_TIMER_CMP(0), _deadline);
+}
+
+/**
+ * Arms timer 0 to go off every given number of ticks of the main counter, if it can.
+ * Otherwise, it goes off once.
+ */
+void HPET::init_periodic(uint64_t period)
+{
+	uint64_t conf = read(HPET_TIMER_CONF(0));
+	if (!(conf & HPET_TIMER_PER_INT_CAP)) {
+		init_oneshot(period);
+		return;
+	}
+
+	reset();
+
+	_periodic = true;
+	_deadline = count() + period;
+
+	// With VAL_SET, the first write sets the comparator, and the second the period.
+	write(HPET_TIMER_CONF(0), conf | HPET_TIMER_TYPE_PERIODIC | HPET_TIMER_VAL_SET);
+	write(HPET_TIMER_CMP(0), _deadline);
+	write(HPET_TIMER_CMP(0), period);
+}
+
+void HPET::start()
+{
+	if (!_irq) return;
+
+	write(HPET_TIMER_CONF(0), read(HPET_TIMER_CONF(0)) | HPET_TIMER_INT_ENB);
+}
+
+void HPET::stop()
+{
+	write(HPET_TIMER_CONF(0), read(HPET_TIMER_CONF(0)) & ~HPET_TIMER_INT_ENB);
+}
+
+void HPET::reset()
+{
+	write(HPET_TIMER_CONF(0), read(HPET_TIMER_CONF(0)) & ~(HPET_TIMER_INT_ENB | HPET_TIMER_TYPE_PERIODIC));
+
+	_fired = false;
+	_periodic = false;
+}
+
+/**
+ * Whether a one-shot event has happened.  This can be polled with interrupts disabled, as
+ * it is read from the main counter, as well as set by the interrupt.
+ */
+bool HPET::expired() const
+{
+	if (_fired) return true;
+	if (_periodic) return false;
+
+	uint64_t now = count();
+	return _wide ? now >= _deadline : (int32_t)((uint32_t)now - (uint32_t)_deadline) >= 0;
+}
+
+bool HPET::use_as_clocksource()
+{
+	if (!_wide) {
+		hpet_log.message(LogLevel::WARNING, "a 32-bit counter can't be the clocksource");
+		return false;
+	}
+
+	infos::arch::x86::hpet_clock_init(&_base[HPET_MAIN_CNT >> 3], _period_fs);
+	return true;
+}
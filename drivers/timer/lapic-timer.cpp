@@ -10,13 +10,22 @@
  */
 #include <infos/drivers/timer/lapic-timer.h>
 #include <infos/drivers/timer/pit.h>
+#include <infos/drivers/timer/hpet.h>
 #include <infos/drivers/irq/lapic.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/irq.h>
+#include <infos/kernel/softirq.h>
+#include <infos/kernel/profile.h>
+#include <infos/kernel/boot-phase.h>
 #include <infos/kernel/log.h>
 #include <infos/util/time.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
 #include <arch/x86/context.h>
 #include <arch/x86/irq.h>
+#include <arch/x86/msr.h>
+#include <arch/x86/pio.h>
+#include <arch/x86/tsc.h>
 #include <arch/arch.h>
 
 using namespace infos::kernel;
@@ -40,14 +49,101 @@ LAPICTimer::LAPICTimer() : _frequency(0)
 
 extern "C" uint32_t lapic_fast_calibrate(volatile void *);
 
+/**
+ * Does what lapic_fast_calibrate() does, through the LAPIC's accessors, for x2APIC mode,
+ * when its registers aren't memory-mapped: counts the timer down from its maximum, with
+ * a divisor of 16, for the 10ms it takes PIT channel 2 to run out.
+ * @return Returns the count the timer stopped at.
+ */
+static uint32_t lapic_pit_calibrate(LAPIC& lapic)
+{
+	using namespace infos::arch::x86;
+
+	lapic.mask_interrupts(LAPIC::Timer);
+	lapic.set_timer_one_shot();
+	lapic.set_timer_divide(3);
+
+	// Gate channel 2 on, with the speaker off, and load it for one-shot mode.
+	__outb(0x61, (__inb(0x61) & 0x0c) | 1);
+	__outb(0x43, 0xb0);
+	__outb(0x42, 0x9b);
+	__outb(0x42, 0x2e);
+
+	// Restart the gate, which starts the count.
+	uint8_t gate = __inb(0x61) & 0x0c;
+	__outb(0x61, gate);
+	__outb(0x61, gate | 1);
+
+	lapic.set_timer_initial_count(0xffffffff);
+	while (!(__inb(0x61) & 0x20));
+
+	return lapic.get_timer_current_count();
+}
+
+static bool force_pit_calibration;
+
+RegisterCmdLineArgument(TimerCalibrate, "timer.calibrate") {
+	force_pit_calibration = (strncmp(value, "pit", 3) == 0);
+}
+
+/**
+ * Measures the TSC against the HPET, which is much quicker, and more precise, than the
+ * PIT.
+ */
+static uint64_t tsc_frequency_from_hpet(HPET& hpet)
+{
+	#define HPET_CALIBRATION_US		1000
+
+	uint64_t hpet_ticks = (hpet.frequency() * HPET_CALIBRATION_US) / 1000000;
+
+	uint64_t start = hpet.count();
+	uint64_t tsc_start = infos::arch::x86::__rdtsc();
+
+	uint64_t elapsed;
+	do {
+		asm volatile("pause");
+		elapsed = (hpet.count() - start) & (hpet.wide() ? ~0ull : 0xffffffffull);
+	} while (elapsed < hpet_ticks);
+
+	uint64_t tsc_ticks = infos::arch::x86::__rdtsc() - tsc_start;
+	return (tsc_ticks * hpet.frequency()) / elapsed;
+}
+
 /**
  * Calibrate the LAPIC timer by measuring its tick rate with respect to a known tick rate.
+ * If the processor or hypervisor says how fast the TSC (and maybe the timer) runs, that
+ * is used instead, which is exact, and saves measuring against the PIT at boot.  Failing
+ * that, the TSC is measured against the HPET, if there is one.
  * @return Returns TRUE if the calibration suceeded, or FALSE otherwise.
  */
 bool LAPICTimer::calibrate()
 {
+	BootPhase phase("timer.lapic-calibrate");
+
+	uint64_t lapic_hz = 0;
+	uint64_t tsc_hz = force_pit_calibration ? 0 : infos::arch::x86::tsc_known_frequency(lapic_hz);
+
+	HPET *hpet;
+	if (!tsc_hz && !force_pit_calibration && sys.device_manager().try_get_device_by_class(HPET::HPETDeviceClass, hpet)) {
+		tsc_hz = tsc_frequency_from_hpet(*hpet);
+	}
+
+	if (tsc_hz) {
+		lapic_timer_log.messagef(LogLevel::DEBUG, "tsc frequency=%llu, lapic frequency=%llu", tsc_hz, lapic_hz);
+		infos::arch::x86::tsc_clock_init(tsc_hz);
+
+		if (lapic_hz) {
+			_frequency = lapic_hz;
+		} else {
+			calibrate_from_tsc(tsc_hz);
+		}
+
+		lapic_timer_log.messagef(LogLevel::DEBUG, "frequency=%llu", _frequency);
+		return true;
+	}
+
 #if 1
-	uint32_t ticks = lapic_fast_calibrate(_lapic->_apic_base);
+	uint32_t ticks = _lapic->x2apic() ? lapic_pit_calibrate(*_lapic) : lapic_fast_calibrate(_lapic->_apic_base);
 
 	lapic_timer_log.messagef(LogLevel::DEBUG, "ticks=%x", ticks);
 	// Calculate the number of ticks per calibration period (accounting for the LAPIC division)
@@ -108,9 +204,54 @@ bool LAPICTimer::calibrate()
 #endif
 
 	lapic_timer_log.messagef(LogLevel::DEBUG, "frequency=%llu", _frequency);
+
+	calibrate_tsc();
 	return true;
 }
 
+/**
+ * Measures the TSC against the (now calibrated) LAPIC timer, and starts the kernel's
+ * runtime clock from it.  The timer's interrupt is masked, so this polls the count.
+ */
+void LAPICTimer::calibrate_tsc()
+{
+	#define TSC_CALIBRATION_MS		10
+
+	init_oneshot(((_frequency >> 4) / 1000) * TSC_CALIBRATION_MS);
+
+	uint64_t start = infos::arch::x86::__rdtsc();
+	while (count() != 0) asm volatile("pause");
+	uint64_t end = infos::arch::x86::__rdtsc();
+
+	uint64_t tsc_per_ms = (end - start) / TSC_CALIBRATION_MS;
+	if (tsc_per_ms == 0) tsc_per_ms = 1;
+
+	lapic_timer_log.messagef(LogLevel::DEBUG, "tsc-per-ms=%llu", tsc_per_ms);
+	infos::arch::x86::tsc_clock_init(tsc_per_ms * 1000);
+}
+
+/**
+ * Measures the LAPIC timer against the TSC, once the TSC's frequency is known.  This only
+ * needs to run for long enough that a count is much larger than the error in reading it.
+ */
+void LAPICTimer::calibrate_from_tsc(uint64_t tsc_hz)
+{
+	#define LAPIC_CALIBRATION_US	1000
+
+	uint64_t tsc_ticks = (tsc_hz / 1000000) * LAPIC_CALIBRATION_US;
+
+	init_oneshot(0xffffffff);
+
+	uint64_t start = infos::arch::x86::__rdtsc();
+	while (infos::arch::x86::__rdtsc() - start < tsc_ticks) asm volatile("pause");
+	uint64_t ticks = 0xffffffffull - count();
+
+	reset();
+
+	// The timer counts at a sixteenth of the frequency (see init()).
+	_frequency = (ticks << 4) * (1000000 / LAPIC_CALIBRATION_US);
+}
+
 /**
  * Initialises the LAPIC timer device
  * @param dm The device manager that manages this device.
@@ -129,7 +270,19 @@ bool LAPICTimer::init(kernel::DeviceManager& dm)
 	_lapic->set_timer_initial_count(1);
 
 	// Calibrate the timer.
-	return calibrate();
+	if (!calibrate()) return false;
+
+	// The timer counts at a sixteenth of the bus frequency (see above), and deadlines are
+	// set on every reschedule, so the conversion from ns is worked out once.
+	_ns_to_ticks = ClockScale::from_ratio(_frequency >> 4, 1000000000ull);
+	return true;
+}
+
+void LAPICTimer::init_cpu()
+{
+	_lapic->set_timer_irq(_irq->nr());
+	_lapic->set_timer_divide(3);
+	_lapic->set_timer_initial_count(0);
 }
 
 /**
@@ -181,6 +334,22 @@ void LAPICTimer::init_periodic(uint64_t period)
 	_lapic->set_timer_initial_count(period);
 }
 
+/**
+ * Arms the timer to interrupt once, after the given delay.
+ * @param delay How long from now the interrupt should happen.
+ */
+void LAPICTimer::set_deadline(Nanoseconds delay)
+{
+	// A count of zero would stop the timer rather than fire it.
+	uint64_t ticks = _ns_to_ticks.scale(delay.count());
+
+	if (ticks == 0) ticks = 1;
+	if (ticks > 0xffffffffull) ticks = 0xffffffffull;
+
+	init_oneshot(ticks);
+	start();
+}
+
 /**
  * Returns the raw counter value for the timer.
  * @return The raw counter value for the timer.
@@ -214,24 +383,13 @@ void LAPICTimer::lapic_timer_irq_handler(const IRQ *irq, void* priv)
 	 * value will serve as our calibration for a tight loop-based sleep
 	 * routine. */
 	if (busywait_doing_calibration) { busywait_doing_calibration = 0; return; }
-	/*uint32_t tscl, tsch;
-	static uint64_t last_tsc;
-	asm volatile("rdtsc" : "=a"(tscl), "=d"(tsch));
-
-	uint64_t tsc = tscl | (uint64_t)tsch << 32;
-	uint64_t delta_tsc = tsc - last_tsc;
-	last_tsc = tsc;
-
-	uint64_t khz = 3600000;
-	uint64_t shift = 32;
-	uint64_t scale = (1000000 * shift) / khz;
-
-	uint64_t ns = (delta_tsc * scale) / shift;*/
 
-//	syslog.messagef(LogLevel::DEBUG, "ns = %lu", ns);
+	profile_sample();
 
-	// HACK HACK HACK -- this shouldn't be hard-coded in
-	sys.update_runtime(DurationCast<Nanoseconds>(Milliseconds(10)));		// Tell the kernel to update its internal runtime with +10mS
-	sys.scheduler().update_accounting();		// Tell the scheduler to update process accounting
-	sys.scheduler().schedule();					// Cause a scheduling event to occur
+	// The runtime clock is read from the TSC, so all that is left is to keep the time of
+	// day up to date, and expire this CPU's timers, which is done once the interrupt has
+	// been acknowledged.  The timer is one-shot, and the scheduler re-arms it (see
+	// Scheduler::schedule).
+	SoftIRQ::raise(SoftIRQVector::TIMER);
+	SoftIRQ::request_resched();					// Cause a scheduling event to occur
 }
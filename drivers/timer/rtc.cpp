@@ -10,10 +10,12 @@
  */
 #include <infos/drivers/timer/rtc.h>
 #include <infos/fs/file.h>
+#include <infos/mm/object-allocator.h>
 
 using namespace infos::drivers;
 using namespace infos::drivers::timer;
 using namespace infos::fs;
+using namespace infos::mm;
 
 const DeviceClass RTC::RTCDeviceClass(Device::RootDeviceClass, "rtc");
 
@@ -80,5 +82,5 @@ private:
 
 File *RTC::open_as_file()
 {
-	return new RTCFile(*this);
+	return new (HeapArena::DRIVERS) RTCFile(*this);
 }
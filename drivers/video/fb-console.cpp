@@ -0,0 +1,221 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/video/fb-console.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/video/fb-console.h>
+#include <infos/drivers/video/font.h>
+#include <infos/drivers/console/virtual-console.h>
+#include <infos/mm/object-allocator.h>
+#include <infos/util/string.h>
+
+using namespace infos::drivers;
+using namespace infos::drivers::console;
+using namespace infos::drivers::video;
+using namespace infos::mm;
+using namespace infos::util;
+
+const DeviceClass FramebufferConsoleDevice::FramebufferConsoleDeviceClass(PhysicalConsole::PhysicalConsoleDeviceClass, "fb");
+
+// The text-mode palette, as 8-bit RGB.
+static const uint8_t vga_palette[16][3] = {
+	{ 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0xaa }, { 0x00, 0xaa, 0x00 }, { 0x00, 0xaa, 0xaa },
+	{ 0xaa, 0x00, 0x00 }, { 0xaa, 0x00, 0xaa }, { 0xaa, 0x55, 0x00 }, { 0xaa, 0xaa, 0xaa },
+	{ 0x55, 0x55, 0x55 }, { 0x55, 0x55, 0xff }, { 0x55, 0xff, 0x55 }, { 0x55, 0xff, 0xff },
+	{ 0xff, 0x55, 0x55 }, { 0xff, 0x55, 0xff }, { 0xff, 0xff, 0x55 }, { 0xff, 0xff, 0xff },
+};
+
+// There is only ever one physical console, which the update callback draws on.
+static FramebufferConsoleDevice *fb_console;
+
+bool FramebufferConsoleDevice::supported(const FramebufferInfo& info)
+{
+	return info.bpp == 32 && info.width >= COLUMNS * CELL_WIDTH && info.height >= ROWS * CELL_HEIGHT
+		&& info.pitch >= info.width * 4 && (info.pitch % 8) == 0;
+}
+
+FramebufferConsoleDevice::FramebufferConsoleDevice(const FramebufferInfo& info)
+	: _info(info),
+		_cursor(0),
+		_old_vc(NULL)
+{
+	// The text is centred, on an even pixel, so that each row of a cell is a whole
+	// number of 64-bit words.
+	_x_origin = ((_info.width - COLUMNS * CELL_WIDTH) / 2) & ~1u;
+	_y_origin = (_info.height - ROWS * CELL_HEIGHT) / 2;
+
+	for (unsigned int i = 0; i < 16; i++) {
+		_palette[i] = make_pixel(vga_palette[i][0], vga_palette[i][1], vga_palette[i][2]);
+	}
+
+	_glyphs = new (HeapArena::DRIVERS) CachedGlyph[GLYPH_CACHE_SIZE];
+	for (unsigned int i = 0; i < GLYPH_CACHE_SIZE; i++) {
+		_glyphs[i].key = ~0u;
+	}
+
+	// A blank screen is what a grid of zero cells (black on black) looks like, so it
+	// only has to be drawn where the virtual console differs.
+	for (unsigned int y = 0; y < _info.height; y++) {
+		volatile uint64_t *line = (volatile uint64_t *)(_info.base + (virt_addr_t)y * _info.pitch);
+		for (unsigned int x = 0; x < _info.pitch / 8; x++) {
+			line[x] = 0;
+		}
+	}
+
+	bzero(_cells, sizeof(_cells));
+	bzero(_drawn, sizeof(_drawn));
+
+	fb_console = this;
+}
+
+FramebufferConsoleDevice::~FramebufferConsoleDevice()
+{
+	delete[] _glyphs;
+}
+
+void FramebufferConsoleDevice::virtual_console_changed()
+{
+	if (_old_vc) {
+		_old_vc->set_output(NULL, NULL);
+	}
+
+	get_current_vc().set_output((volatile uint16_t *)_cells, VCUpdateCallback);
+	_old_vc = &get_current_vc();
+}
+
+void FramebufferConsoleDevice::VCUpdateCallback(VirtualConsole& vc)
+{
+	fb_console->update(vc.get_buffer_position());
+}
+
+uint32_t FramebufferConsoleDevice::make_pixel(uint8_t r, uint8_t g, uint8_t b) const
+{
+	return ((uint32_t)(r >> (8 - _info.red_size)) << _info.red_position)
+		| ((uint32_t)(g >> (8 - _info.green_size)) << _info.green_position)
+		| ((uint32_t)(b >> (8 - _info.blue_size)) << _info.blue_position);
+}
+
+/**
+ * Returns the pixels for a cell, rendering them if the cell isn't in the cache.  The cache
+ * is direct-mapped: a console shows few enough different cells at once that they rarely
+ * collide.
+ */
+const FramebufferConsoleDevice::CachedGlyph& FramebufferConsoleDevice::glyph(uint16_t cell)
+{
+	CachedGlyph& g = _glyphs[(cell ^ (cell >> 8) * 37) % GLYPH_CACHE_SIZE];
+	if (g.key == cell) return g;
+
+	uint8_t ch = cell & 0xff;
+	uint8_t attr = cell >> 8;
+
+	uint32_t fg = _palette[attr & 0xf];
+	uint32_t bg = _palette[(attr >> 4) & 0x7];
+
+	const uint8_t *bitmap = (ch >= FONT_FIRST_CHAR && ch <= FONT_LAST_CHAR) ? font8x8[ch - FONT_FIRST_CHAR] : NULL;
+
+	for (unsigned int y = 0; y < CELL_HEIGHT; y++) {
+		uint8_t bits = bitmap ? bitmap[y * FONT_HEIGHT / CELL_HEIGHT] : 0;
+
+		for (unsigned int x = 0; x < CELL_WIDTH; x++) {
+			g.pixels[y][x] = ((bits >> x) & 1) ? fg : bg;
+		}
+	}
+
+	g.key = cell;
+	return g;
+}
+
+/**
+ * Draws the cells of a row from 'first' to 'last' inclusive, a cell at a time, with 64-bit
+ * stores, so that a write-combining mapping can send each row of a cell as one burst.
+ */
+void FramebufferConsoleDevice::draw_cells(unsigned int row, unsigned int first, unsigned int last)
+{
+	virt_addr_t top = _info.base + (virt_addr_t)(_y_origin + row * CELL_HEIGHT) * _info.pitch;
+
+	for (unsigned int col = first; col <= last; col++) {
+		uint16_t cell = _cells[row * COLUMNS + col];
+		const CachedGlyph& g = glyph(cell);
+
+		virt_addr_t left = top + (virt_addr_t)(_x_origin + col * CELL_WIDTH) * 4;
+		for (unsigned int y = 0; y < CELL_HEIGHT; y++) {
+			volatile uint64_t *dst = (volatile uint64_t *)(left + (virt_addr_t)y * _info.pitch);
+			const uint64_t *src = (const uint64_t *)g.pixels[y];
+
+			for (unsigned int x = 0; x < CELL_WIDTH / 2; x++) {
+				dst[x] = src[x];
+			}
+		}
+
+		_drawn[row * COLUMNS + col] = cell;
+	}
+}
+
+/**
+ * Underlines the cell at the cursor, in the cell's foreground colour.
+ */
+void FramebufferConsoleDevice::draw_cursor(unsigned int position)
+{
+	unsigned int row = position / COLUMNS, col = position % COLUMNS;
+	uint32_t fg = _palette[(_cells[position] >> 8) & 0xf];
+
+	virt_addr_t left = _info.base + (virt_addr_t)(_y_origin + row * CELL_HEIGHT) * _info.pitch
+		+ (virt_addr_t)(_x_origin + col * CELL_WIDTH) * 4;
+
+	for (unsigned int y = CELL_HEIGHT - 2; y < CELL_HEIGHT; y++) {
+		volatile uint32_t *dst = (volatile uint32_t *)(left + (virt_addr_t)y * _info.pitch);
+		for (unsigned int x = 0; x < CELL_WIDTH; x++) {
+			dst[x] = fg;
+		}
+	}
+}
+
+/**
+ * Draws what has changed since the last time: each run of changed cells in a row is
+ * drawn, as a rectangle, and the cursor is moved.
+ */
+void FramebufferConsoleDevice::update(unsigned int cursor)
+{
+	if (cursor >= COLUMNS * ROWS) cursor = COLUMNS * ROWS - 1;
+
+	// The old cursor is wiped out by drawing its cell again.
+	bool cursor_moved = cursor != _cursor;
+	if (cursor_moved) {
+		_drawn[_cursor] = ~_cells[_cursor];
+	}
+
+	bool cursor_overdrawn = false;
+
+	for (unsigned int row = 0; row < ROWS; row++) {
+		const uint16_t *cells = &_cells[row * COLUMNS];
+		const uint16_t *drawn = &_drawn[row * COLUMNS];
+
+		unsigned int col = 0;
+		while (col < COLUMNS) {
+			if (cells[col] == drawn[col]) {
+				col++;
+				continue;
+			}
+
+			unsigned int first = col;
+			while (col < COLUMNS && cells[col] != drawn[col]) col++;
+
+			draw_cells(row, first, col - 1);
+
+			if (cursor >= row * COLUMNS + first && cursor < row * COLUMNS + col) {
+				cursor_overdrawn = true;
+			}
+		}
+	}
+
+	if (cursor_moved || cursor_overdrawn) {
+		draw_cursor(cursor);
+	}
+
+	_cursor = cursor;
+}
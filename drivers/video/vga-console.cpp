@@ -24,7 +24,6 @@ const DeviceClass VGAConsoleDevice::VGAConsoleDeviceClass(PhysicalConsole::Physi
 
 VGAConsoleDevice::VGAConsoleDevice(phys_addr_t video_ram_addr) 
 	: _video_ram_address(video_ram_addr),
-		_backup_buffer(NULL),
 		_old_vc(NULL)
 {
 
@@ -35,22 +34,18 @@ VGAConsoleDevice::~VGAConsoleDevice()
 
 }
 
+/**
+ * Each virtual console keeps its own screen, so switching is a matter of showing the new
+ * one's, which it copies to video memory itself.
+ */
 void VGAConsoleDevice::virtual_console_changed()
 {
 	if (_old_vc) {
-		_old_vc->set_buffer(_backup_buffer, NULL);
-		memcpy(_old_vc->get_buffer(), (const void *)_video_ram_address, (80 * 25 * 2));
-	}
-	
-	_backup_buffer = get_current_vc().get_buffer();
-	get_current_vc().set_buffer((uint16_t *)_video_ram_address, VCUpdateCallback);
-	
-	if (_backup_buffer != NULL) {
-		memcpy(get_current_vc().get_buffer(), _backup_buffer, (80 * 25 * 2));
+		_old_vc->set_output(NULL, NULL);
 	}
 	
+	get_current_vc().set_output((volatile uint16_t *)_video_ram_address, VCUpdateCallback);
 	_old_vc = &get_current_vc();
-	VCUpdateCallback(get_current_vc());
 }
 
 void VGAConsoleDevice::VCUpdateCallback(console::VirtualConsole& vc)
@@ -0,0 +1,689 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/virtio/virtio-blk.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/virtio/virtio-blk.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/irq.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+#include <infos/util/time.h>
+#include <arch/arch.h>
+#include <arch/x86/pio.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::virtio;
+using namespace infos::drivers::block;
+using namespace infos::arch::x86;
+using namespace infos::util;
+using namespace infos::mm;
+
+const DeviceClass VirtioBlockDevice::VirtioBlockDeviceClass(BlockDevice::BlockDeviceClass, "vblk");
+
+// A segment is at most this big, unless the device says less.
+#define VIRTIO_BLK_MAX_SEGMENT_SIZE		0x400000
+
+// The same as for the ATA queue: how long a request can be passed over in favour of ones
+// nearer the start of the scan.
+#define VIRTIO_BLK_READ_EXPIRY_MS		500
+#define VIRTIO_BLK_WRITE_EXPIRY_MS		5000
+
+static uint64_t now_ns()
+{
+	return sys.runtime().time_since_epoch().count();
+}
+
+VirtioBlockDevice::VirtioBlockDevice(const VirtioBlockConfiguration& cfg)
+	: _io_base(cfg.io_base), _msix(cfg.irq != NULL), _irq(cfg.irq), _features(0), _capacity(0),
+	_max_segments(MAX_SEGMENTS), _max_segment_size(VIRTIO_BLK_MAX_SEGMENT_SIZE),
+	_slot_memory(NULL), _slot_memory_pa(0), _nr_busy(0), _plugged(0), _flushing(false), _flush_success(false)
+{
+	for (unsigned int n = 0; n < MAX_SLOTS; n++) {
+		_slots[n].requests = NULL;
+		_slots[n].in_use = false;
+	}
+}
+
+uint8_t VirtioBlockDevice::read8(int reg) const { return __inb(_io_base + reg); }
+uint16_t VirtioBlockDevice::read16(int reg) const { return __inw(_io_base + reg); }
+uint32_t VirtioBlockDevice::read32(int reg) const { return __inl(_io_base + reg); }
+void VirtioBlockDevice::write8(int reg, uint8_t value) { __outb(_io_base + reg, value); }
+void VirtioBlockDevice::write16(int reg, uint16_t value) { __outw(_io_base + reg, value); }
+void VirtioBlockDevice::write32(int reg, uint32_t value) { __outl(_io_base + reg, value); }
+
+/**
+ * Returns where the device configuration starts: after the MSI-X vector registers, if
+ * MSI-X is enabled.
+ */
+int VirtioBlockDevice::config_base() const
+{
+	return _msix ? 0x18 : 0x14;
+}
+
+/**
+ * Resets the device, agrees on features, and sets up the request queue.
+ */
+bool VirtioBlockDevice::init(kernel::DeviceManager& dm)
+{
+	write8(VIRTIO_REG_DEVICE_STATUS, 0);
+	write8(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+	write8(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+	uint32_t offered = read32(VIRTIO_REG_DEVICE_FEATURES);
+	_features = offered & (VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH | VIRTIO_RING_F_EVENT_IDX);
+	write32(VIRTIO_REG_GUEST_FEATURES, _features);
+
+	int cfg = config_base();
+	_capacity = read32(cfg + VIRTIO_BLK_CFG_CAPACITY) | ((uint64_t)read32(cfg + VIRTIO_BLK_CFG_CAPACITY + 4) << 32);
+
+	if (_features & VIRTIO_BLK_F_SEG_MAX) {
+		uint32_t seg_max = read32(cfg + VIRTIO_BLK_CFG_SEG_MAX);
+		if (seg_max && seg_max < _max_segments) _max_segments = seg_max;
+	}
+
+	if (_features & VIRTIO_BLK_F_SIZE_MAX) {
+		uint32_t size_max = read32(cfg + VIRTIO_BLK_CFG_SIZE_MAX) & ~511u;
+		if (size_max && size_max < _max_segment_size) _max_segment_size = size_max;
+	}
+
+	write16(VIRTIO_REG_QUEUE_SELECT, 0);
+	uint16_t queue_size = read16(VIRTIO_REG_QUEUE_SIZE);
+
+	FrameDescriptor *slot_memory = sys.mm().pgalloc().allocate_contiguous(1);
+	if (!queue_size || !slot_memory || !_queue.init(queue_size, _features & VIRTIO_RING_F_EVENT_IDX)) {
+		virtio_log.messagef(LogLevel::ERROR, "Unable to set up the request queue (size=%u)", queue_size);
+		write8(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+		return false;
+	}
+
+	_slot_memory = (SlotMemory *)sys.mm().pgalloc().pfdescr_to_vpa(slot_memory);
+	_slot_memory_pa = sys.mm().pgalloc().pfdescr_to_pa(slot_memory);
+	bzero(_slot_memory, __page_size);
+
+	// The queue raises MSI-X vector 0, and configuration changes nothing.
+	if (_msix) {
+		write16(VIRTIO_REG_MSI_CONFIG_VECTOR, VIRTIO_MSI_NO_VECTOR);
+		write16(VIRTIO_REG_MSI_QUEUE_VECTOR, 0);
+
+		if (read16(VIRTIO_REG_MSI_QUEUE_VECTOR) == VIRTIO_MSI_NO_VECTOR) {
+			virtio_log.messagef(LogLevel::WARNING, "Device would not take an MSI-X vector: polled");
+			_irq = NULL;
+		}
+	}
+
+	write32(VIRTIO_REG_QUEUE_ADDRESS, (uint32_t)(_queue.address() >> 12));
+
+	if (_irq) {
+		_irq->attach(irq_handler, this);
+		_queue.enable_interrupts();
+	} else {
+		_queue.disable_interrupts();
+	}
+
+	write8(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+	virtio_log.messagef(LogLevel::INFO, "virtio-blk: size=%llu, queue=%u, segments=%u, features=%x, irq=%s",
+			_capacity, queue_size, _max_segments, _features, _irq ? "msi-x" : "polled");
+
+	return check_for_partitions();
+}
+
+bool VirtioBlockDevice::check_for_partitions()
+{
+	uint8_t *buffer = new (HeapArena::DRIVERS) uint8_t[512];
+	if (!buffer)
+		return false;
+
+	if (!read_blocks(buffer, 0, 1)) {
+		sys.mm().objalloc().free(buffer);
+		return false;
+	}
+
+	bool result = true;
+	if (buffer[0x1fe] == 0x55 && buffer[0x1ff] == 0xaa) {
+		virtio_log.messagef(LogLevel::INFO, "disk has partitions!");
+		result = create_partitions(buffer);
+	}
+
+	sys.mm().objalloc().free(buffer);
+	return result;
+}
+
+bool VirtioBlockDevice::create_partitions(const uint8_t* partition_table)
+{
+	struct partition_table_entry {
+		uint8_t status;
+		uint8_t first_absolute_sector[3];
+		uint8_t type;
+		uint8_t last_absolute_sector[3];
+		uint32_t first_absolute_sector_lba;
+		uint32_t nr_sectors;
+	} __packed;
+
+	for (int partition_table_index = 0; partition_table_index < 4; partition_table_index++) {
+		const struct partition_table_entry *pte = (const partition_table_entry *)&partition_table[0x1be + (16 * partition_table_index)];
+
+		if (pte->type == 0) {
+			continue;
+		}
+
+		virtio_log.messagef(LogLevel::INFO, "partition %u active @ lba=%x, sz=%x", partition_table_index, pte->first_absolute_sector_lba, pte->nr_sectors);
+
+		auto partition_device = new (HeapArena::DRIVERS) BlockDevicePartition(*this, pte->first_absolute_sector_lba, pte->nr_sectors);
+		_partitions.append(partition_device);
+
+		sys.device_manager().register_device(*partition_device);
+
+		String partition_name = name() + "p" + ToString(partition_table_index);
+		sys.device_manager().add_device_alias(partition_name, *partition_device);
+	}
+
+	return true;
+}
+
+/**
+ * Returns the physical address of a kernel buffer, if the device can get at it.
+ */
+static bool dma_address(const void *buffer, phys_addr_t& pa)
+{
+	uintptr_t va = (uintptr_t)buffer;
+
+	if (va >= PMEM_VA_START && va < PMEM_VA_END) {
+		pa = vpa_to_pa(va);
+	} else if (va >= KERNEL_VMEM_START) {
+		pa = kva_to_pa(va);
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool VirtioBlockDevice::dma_can_map(const IOVec *vec, unsigned int nr_vec) const
+{
+	for (unsigned int i = 0; i < nr_vec; i++) {
+		phys_addr_t pa;
+		if (!dma_address(vec[i].base, pa)) return false;
+	}
+
+	return true;
+}
+
+/**
+ * Returns the number of sectors in the buffers, or zero if one of them isn't a whole
+ * number of sectors.
+ */
+static size_t vec_sectors(const IOVec *vec, unsigned int nr_vec)
+{
+	size_t count = 0;
+	for (unsigned int i = 0; i < nr_vec; i++) {
+		if (vec[i].size % 512) return 0;
+		count += vec[i].size / 512;
+	}
+
+	return count;
+}
+
+bool VirtioBlockDevice::read_blocks(void *buffer, size_t offset, size_t count)
+{
+	IOVec vec = { buffer, count * 512 };
+	return transfer(false, offset, &vec, 1, count);
+}
+
+bool VirtioBlockDevice::write_blocks(const void *buffer, size_t offset, size_t count)
+{
+	IOVec vec = { (void *)buffer, count * 512 };
+	return transfer(true, offset, &vec, 1, count);
+}
+
+bool VirtioBlockDevice::read_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	size_t count = vec_sectors(vec, nr_vec);
+	if (!count) return false;
+
+	return transfer(false, offset, vec, nr_vec, count);
+}
+
+bool VirtioBlockDevice::write_blocks_vec(const IOVec *vec, unsigned int nr_vec, size_t offset)
+{
+	size_t count = vec_sectors(vec, nr_vec);
+	if (!count) return false;
+
+	return transfer(true, offset, vec, nr_vec, count);
+}
+
+/**
+ * A synchronous transfer: a request on the caller's stack, which is queued like any other,
+ * and waited for.
+ */
+struct SyncRequest
+{
+	BlockRequest request;
+	WakeQueue *waiters;
+	volatile bool done;
+	bool success;
+};
+
+static void sync_complete(BlockRequest& request, bool success)
+{
+	SyncRequest *sync = (SyncRequest *)request.priv;
+
+	UniqueLock<SpinLock> l(sync->waiters->lock());
+	sync->success = success;
+	sync->done = true;
+
+	WakeQueue::Key key = { sync, 0 };
+	sync->waiters->wake_key_locked(key, 1);
+}
+
+/**
+ * Transfers a run of sectors, and waits for it to finish.  The buffers must be ones the
+ * device can reach, which every kernel buffer is.
+ */
+bool VirtioBlockDevice::transfer(bool write, uint64_t lba, const IOVec *vec, unsigned int nr_vec, size_t nr_blocks)
+{
+	if (lba > _capacity || nr_blocks > _capacity - lba) return false;
+	if (write && (_features & VIRTIO_BLK_F_RO)) return false;
+	if (!dma_can_map(vec, nr_vec)) return false;
+
+	SyncRequest sync;
+	sync.request.write = write;
+	sync.request.offset = lba;
+	sync.request.vec = vec;
+	sync.request.nr_vec = nr_vec;
+	sync.request.completion = sync_complete;
+	sync.request.priv = &sync;
+	sync.request.driver = this;
+	sync.request.nr_blocks = nr_blocks;
+	sync.waiters = &_waiters;
+	sync.done = false;
+	sync.success = false;
+
+	queue_request(sync.request);
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_waiters.lock());
+
+	WakeQueue::Key key = { &sync, 0 };
+	while (!sync.done) wait_locked(key);
+
+	return sync.success;
+}
+
+/**
+ * Requests are queued, and go to the device while there are free slots and descriptors,
+ * each completed from the queue's interrupt.  Without an interrupt, the request is done
+ * synchronously.
+ */
+void VirtioBlockDevice::submit(BlockRequest& request)
+{
+	size_t count = vec_sectors(request.vec, request.nr_vec);
+	if (!count || request.offset > _capacity || count > _capacity - request.offset ||
+			(request.write && (_features & VIRTIO_BLK_F_RO)) || !dma_can_map(request.vec, request.nr_vec)) {
+		request.complete(false);
+		return;
+	}
+
+	if (!can_wait_for_irq()) {
+		BlockDevice::submit(request);
+		return;
+	}
+
+	request.driver = this;
+	request.nr_blocks = count;
+
+	queue_request(request);
+}
+
+void VirtioBlockDevice::queue_request(BlockRequest& request)
+{
+	stats().queued(request);
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_waiters.lock());
+
+	uint64_t expiry = DurationCast<Nanoseconds>(Milliseconds(request.write ? VIRTIO_BLK_WRITE_EXPIRY_MS : VIRTIO_BLK_READ_EXPIRY_MS)).count();
+	_requests.add(request, now_ns(), expiry);
+
+	start_requests();
+}
+
+/**
+ * While the device is plugged, requests are kept back, and then handed over together,
+ * with one notification.
+ */
+void VirtioBlockDevice::plug()
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_waiters.lock());
+
+	_plugged++;
+}
+
+void VirtioBlockDevice::unplug()
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_waiters.lock());
+
+	assert(_plugged);
+	if (--_plugged == 0) {
+		start_requests();
+	}
+}
+
+/**
+ * Puts batches of queued requests in the free slots, until there are no more slots, or
+ * descriptors, and then tells the device about all of them at once.  Called with the lock
+ * held.
+ */
+void VirtioBlockDevice::start_requests()
+{
+	while (!_plugged && !_flushing && !_requests.empty() && _queue.nr_free() >= 3) {
+		unsigned int n = 0;
+		while (n < MAX_SLOTS && _slots[n].in_use) n++;
+		if (n == MAX_SLOTS) break;
+
+		Slot& slot = _slots[n];
+		BlockRequest *requests = _requests.take_batch(now_ns(), MAX_BATCH_BLOCKS, MAX_BATCH_VEC);
+
+		slot.requests = requests;
+		slot.write = requests->write;
+		slot.offset = requests->offset;
+		slot.nr_blocks = 0;
+		slot.nr_done = 0;
+		slot.nr_in_flight = 0;
+		slot.nr_vec = 0;
+		slot.in_use = true;
+		_nr_busy++;
+
+		for (BlockRequest *r = requests; r; r = r->next) {
+			for (unsigned int i = 0; i < r->nr_vec && slot.nr_vec < MAX_BATCH_VEC; i++) {
+				slot.vec[slot.nr_vec++] = r->vec[i];
+			}
+
+			slot.nr_blocks += r->nr_blocks;
+			stats().started(*r);
+			if (r != requests) stats().merged(1);
+		}
+
+		// The first request is taken whatever its size, so it may have too many buffers.
+		if (iovec_size(slot.vec, slot.nr_vec) == slot.nr_blocks * 512 && start_slot(n)) {
+			continue;
+		}
+
+		complete_slot(n, false);
+	}
+
+	notify();
+}
+
+/**
+ * Adds the virtio request for the next part of the slot's batch to the queue: a header,
+ * as many of the buffers as the free descriptors (and the device's segment limits) allow,
+ * and the status byte.  It isn't published until notify().
+ * @return Returns false if there weren't the descriptors for even one sector.
+ */
+bool VirtioBlockDevice::start_slot(unsigned int n)
+{
+	Slot& slot = _slots[n];
+
+	if (_queue.nr_free() < 3) return false;
+
+	unsigned int max_segments = __min(_max_segments, _queue.nr_free() - 2);
+
+	unsigned int cur_vec = 0;
+	size_t vec_offset = 0;
+	iovec_advance(slot.vec, slot.nr_vec, cur_vec, vec_offset, slot.nr_done * 512);
+
+	Virtqueue::Buffer buffers[MAX_SEGMENTS + 2];
+	unsigned int nr_segments = 0;
+	size_t size = (slot.nr_blocks - slot.nr_done) * 512;
+	size_t mapped = 0;
+
+	while (mapped < size && cur_vec < slot.nr_vec && nr_segments < max_segments) {
+		if (vec_offset == slot.vec[cur_vec].size) {
+			cur_vec++;
+			vec_offset = 0;
+			continue;
+		}
+
+		size_t region = __min(__min(slot.vec[cur_vec].size - vec_offset, size - mapped), _max_segment_size);
+
+		phys_addr_t pa;
+		if (!dma_address((const uint8_t *)slot.vec[cur_vec].base + vec_offset, pa)) break;
+
+		Virtqueue::Buffer& b = buffers[1 + nr_segments++];
+		b.address = pa;
+		b.size = (uint32_t)region;
+		b.device_writes = !slot.write;
+
+		mapped += region;
+		vec_offset += region;
+	}
+
+	// Drop any part of a sector at the end: every request is a whole number of them.
+	size_t excess = mapped % 512;
+	mapped -= excess;
+
+	while (excess) {
+		Virtqueue::Buffer& last = buffers[nr_segments];
+
+		if (last.size <= excess) {
+			excess -= last.size;
+			nr_segments--;
+		} else {
+			last.size -= excess;
+			excess = 0;
+		}
+	}
+
+	if (!mapped) return false;
+
+	SlotMemory& mem = _slot_memory[n];
+	phys_addr_t mem_pa = _slot_memory_pa + n * sizeof(SlotMemory);
+
+	mem.header.type = slot.write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	mem.header.reserved = 0;
+	mem.header.sector = slot.offset + slot.nr_done;
+	mem.status = 0xff;
+
+	buffers[0].address = mem_pa + offsetof(SlotMemory, header);
+	buffers[0].size = sizeof(RequestHeader);
+	buffers[0].device_writes = false;
+
+	buffers[1 + nr_segments].address = mem_pa + offsetof(SlotMemory, status);
+	buffers[1 + nr_segments].size = 1;
+	buffers[1 + nr_segments].device_writes = true;
+
+	slot.nr_in_flight = mapped / 512;
+	slot.head = _queue.add(buffers, nr_segments + 2);
+
+	return true;
+}
+
+/**
+ * Completes every request of the slot's batch, and frees the slot.  Called with the lock
+ * held, which is dropped while the requests are completed, so that their completions can
+ * submit more.
+ */
+void VirtioBlockDevice::complete_slot(unsigned int n, bool success)
+{
+	BlockRequest *request = _slots[n].requests;
+	_slots[n].requests = NULL;
+	_slots[n].in_use = false;
+	_nr_busy--;
+
+	_waiters.lock().unlock();
+
+	while (request) {
+		// The completion may reuse the request.
+		BlockRequest *next = request->next;
+		stats().completed(*request, success);
+		request->complete(success);
+		request = next;
+	}
+
+	_waiters.lock().lock();
+}
+
+/**
+ * Publishes the requests added to the queue, and notifies the device, unless it has said
+ * it doesn't need to be (e.g. because it is still working through the queue).
+ */
+void VirtioBlockDevice::notify()
+{
+	if (_queue.publish()) {
+		write16(VIRTIO_REG_QUEUE_NOTIFY, 0);
+	}
+}
+
+bool VirtioBlockDevice::can_wait_for_irq() const
+{
+	return _irq && sys.scheduler().active() && sys.arch().interrupts_enabled();
+}
+
+/**
+ * Waits for the device to finish with something, with the lock held: for the interrupt,
+ * or, if the device is polled (or there isn't a scheduler to sleep in yet), by checking
+ * the used ring.  Callers check what they are waiting for again afterwards.
+ */
+void VirtioBlockDevice::wait_locked(const WakeQueue::Key& key)
+{
+	if (_irq && sys.scheduler().active()) {
+		_waiters.sleep_locked(Thread::current(), key);
+		return;
+	}
+
+	service_queue();
+
+	_waiters.lock().unlock();
+	asm volatile("pause");
+	_waiters.lock().lock();
+}
+
+/**
+ * Takes the requests the device has finished with off the used ring, carrying on with
+ * the rest of their slots' batches, or completing them.  Interrupts are turned off while
+ * the ring is drained, and the ring checked again once they are back on, so that one
+ * interrupt covers everything finished in the meantime.  Called with the lock held.
+ */
+void VirtioBlockDevice::service_queue()
+{
+	for (;;) {
+		_queue.disable_interrupts();
+
+		uint16_t head;
+		uint32_t length;
+		while (_queue.get_used(head, length)) {
+			unsigned int n = 0;
+			while (n < MAX_SLOTS && !(_slots[n].in_use && _slots[n].head == head)) n++;
+			if (n == MAX_SLOTS) continue;
+
+			Slot& slot = _slots[n];
+			bool success = _slot_memory[n].status == VIRTIO_BLK_S_OK;
+
+			if (!slot.requests) {
+				_flush_success = success;
+				slot.in_use = false;
+				_nr_busy--;
+				continue;
+			}
+
+			if (success) {
+				slot.nr_done += slot.nr_in_flight;
+				slot.nr_in_flight = 0;
+
+				// A batch too big for one request carries on with the next.
+				if (slot.nr_done < slot.nr_blocks) {
+					if (start_slot(n)) continue;
+					success = false;
+				}
+			}
+
+			complete_slot(n, success);
+		}
+
+		if (!_irq || _queue.enable_interrupts()) break;
+	}
+
+	start_requests();
+
+	if (_flushing) {
+		WakeQueue::Key key = { this, 0 };
+		_waiters.wake_key_locked(key, ~0u);
+	}
+}
+
+/**
+ * Asks the device to write out its cache, once the requests in progress have finished:
+ * only writes the device has completed are covered by a flush.
+ */
+bool VirtioBlockDevice::flush()
+{
+	if (!(_features & VIRTIO_BLK_F_FLUSH)) return true;
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_waiters.lock());
+
+	WakeQueue::Key key = { this, 0 };
+
+	while (_flushing) wait_locked(key);
+	_flushing = true;
+
+	while (_nr_busy) wait_locked(key);
+
+	// Every slot, and descriptor, is free.
+	Slot& slot = _slots[0];
+	slot.requests = NULL;
+	slot.in_use = true;
+	_nr_busy++;
+
+	SlotMemory& mem = _slot_memory[0];
+	mem.header.type = VIRTIO_BLK_T_FLUSH;
+	mem.header.reserved = 0;
+	mem.header.sector = 0;
+	mem.status = 0xff;
+
+	Virtqueue::Buffer buffers[2];
+	buffers[0].address = _slot_memory_pa + offsetof(SlotMemory, header);
+	buffers[0].size = sizeof(RequestHeader);
+	buffers[0].device_writes = false;
+	buffers[1].address = _slot_memory_pa + offsetof(SlotMemory, status);
+	buffers[1].size = 1;
+	buffers[1].device_writes = true;
+
+	_flush_success = false;
+	slot.head = _queue.add(buffers, 2);
+	notify();
+
+	while (slot.in_use) wait_locked(key);
+
+	bool success = _flush_success;
+
+	_flushing = false;
+	_waiters.wake_key_locked(key, ~0u);
+
+	start_requests();
+	return success;
+}
+
+/**
+ * Handles the queue's interrupt.  With MSI-X, there is no ISR status to read.
+ */
+void VirtioBlockDevice::irq_handler(const IRQ *irq, void *priv)
+{
+	VirtioBlockDevice& dev = *(VirtioBlockDevice *)priv;
+
+	UniqueLock<SpinLock> l(dev._waiters.lock());
+	dev.service_queue();
+}
@@ -0,0 +1,618 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/virtio/virtio-net.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/virtio/virtio-net.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/irq.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+#include <arch/arch.h>
+#include <arch/x86/pio.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::virtio;
+using namespace infos::drivers::net;
+using namespace infos::arch::x86;
+using namespace infos::util;
+using namespace infos::mm;
+
+const DeviceClass VirtioNetDevice::VirtioNetDeviceClass(NetworkDevice::NetworkDeviceClass, "vnet");
+
+// How long to wait for the device to answer a control command.
+#define VIRTIO_NET_CTRL_SPINS		100000000
+
+VirtioNetDevice::VirtioNetDevice(const VirtioNetConfiguration& cfg)
+	: _io_base(cfg.io_base), _msix(cfg.nr_irqs > 0), _features(0), _nr_irqs(cfg.nr_irqs),
+	_nr_pairs(0), _next_rx_pair(0), _nr_received(0)
+{
+	for (unsigned int i = 0; i < VIRTIO_NET_MAX_QUEUE_PAIRS * 2; i++) {
+		_irqs[i] = i < cfg.nr_irqs ? cfg.irqs[i] : NULL;
+	}
+
+	bzero(_mac, sizeof(_mac));
+
+	for (unsigned int i = 0; i < VIRTIO_NET_MAX_QUEUE_PAIRS; i++) {
+		QueuePair& pair = _pairs[i];
+
+		pair.device = this;
+		pair.index = i;
+		pair.rx_irq = pair.tx_irq = NULL;
+		pair.rx_packets = pair.tx_packets = NULL;
+		pair.nr_rx_buffers = pair.nr_posted = 0;
+		pair.received_head = pair.nr_received = 0;
+		pair.tx_waiting = false;
+	}
+}
+
+uint8_t VirtioNetDevice::read8(int reg) const { return __inb(_io_base + reg); }
+uint16_t VirtioNetDevice::read16(int reg) const { return __inw(_io_base + reg); }
+uint32_t VirtioNetDevice::read32(int reg) const { return __inl(_io_base + reg); }
+void VirtioNetDevice::write8(int reg, uint8_t value) { __outb(_io_base + reg, value); }
+void VirtioNetDevice::write16(int reg, uint16_t value) { __outw(_io_base + reg, value); }
+void VirtioNetDevice::write32(int reg, uint32_t value) { __outl(_io_base + reg, value); }
+
+int VirtioNetDevice::config_base() const
+{
+	return _msix ? 0x18 : 0x14;
+}
+
+/**
+ * Resets the device, agrees on features, sets up as many queue pairs as can be used, and
+ * fills their receive queues.
+ */
+bool VirtioNetDevice::init(kernel::DeviceManager& dm)
+{
+	write8(VIRTIO_REG_DEVICE_STATUS, 0);
+	write8(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+	write8(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+	uint32_t offered = read32(VIRTIO_REG_DEVICE_FEATURES);
+	_features = offered & (VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS | VIRTIO_RING_F_EVENT_IDX | VIRTIO_NET_F_CSUM);
+
+	// Segmentation relies on the device filling in the checksums.
+	if ((offered & VIRTIO_NET_F_HOST_TSO4) && (_features & VIRTIO_NET_F_CSUM)) {
+		_features |= VIRTIO_NET_F_HOST_TSO4;
+	}
+
+	// More than one queue pair is asked for through the control queue.
+	if ((offered & VIRTIO_NET_F_MQ) && (offered & VIRTIO_NET_F_CTRL_VQ)) {
+		_features |= VIRTIO_NET_F_MQ | VIRTIO_NET_F_CTRL_VQ;
+	}
+
+	write32(VIRTIO_REG_GUEST_FEATURES, _features);
+
+	int cfg = config_base();
+	if (_features & VIRTIO_NET_F_MAC) {
+		for (unsigned int i = 0; i < 6; i++) {
+			_mac[i] = read8(cfg + VIRTIO_NET_CFG_MAC + i);
+		}
+	} else {
+		// A locally administered address, of our own.
+		_mac[0] = 0x02;
+		_mac[5] = 0x01;
+	}
+
+	unsigned int max_pairs = 1;
+	if (_features & VIRTIO_NET_F_MQ) {
+		max_pairs = read16(cfg + VIRTIO_NET_CFG_MAX_PAIRS);
+		if (!max_pairs) max_pairs = 1;
+	}
+
+	// A queue pair for each CPU, up to what the device has, and the interrupts allow.
+	_nr_pairs = __min(__min(max_pairs, (unsigned int)VIRTIO_NET_MAX_QUEUE_PAIRS), sys.arch().nr_cpus());
+	if (_nr_irqs >= 2 && _nr_irqs / 2 < _nr_pairs) _nr_pairs = _nr_irqs / 2;
+	if (_nr_irqs < 2) _nr_pairs = 1;
+
+	// Configuration changes raise nothing.
+	if (_msix) {
+		write16(VIRTIO_REG_MSI_CONFIG_VECTOR, VIRTIO_MSI_NO_VECTOR);
+	}
+
+	for (unsigned int i = 0; i < _nr_pairs; i++) {
+		if (!init_pair(_pairs[i])) {
+			write8(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+			return false;
+		}
+	}
+
+	// The control queue comes after every queue pair the device has, and is polled.  It
+	// is never freed, as the device could still use it.
+	unsigned int ctrl_queue = 2 * max_pairs;
+	Virtqueue *ctrl = NULL;
+	IRQ *no_irq = NULL;
+	if (_nr_pairs > 1) ctrl = new (HeapArena::DRIVERS) Virtqueue();
+	if (_nr_pairs > 1 && (!ctrl || !init_queue(ctrl_queue, *ctrl, no_irq))) {
+		_nr_pairs = 1;
+	}
+
+	write8(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+	// The device only uses the first queue pair until it is told otherwise.
+	if (_nr_pairs > 1 && !set_queue_pairs(*ctrl, ctrl_queue)) {
+		virtio_log.messagef(LogLevel::WARNING, "virtio-net: device would not use %u queue pairs", _nr_pairs);
+		_nr_pairs = 1;
+	}
+
+	for (unsigned int i = 0; i < _nr_pairs; i++) {
+		QueuePair& pair = _pairs[i];
+
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(pair.waiters.lock());
+
+		refill_rx(pair, true);
+
+		if (pair.rx_irq) pair.rx_irq->attach(rx_irq_handler, &pair);
+		if (pair.tx_irq) pair.tx_irq->attach(tx_irq_handler, &pair);
+	}
+
+	bool link_up = !(_features & VIRTIO_NET_F_STATUS) || (read16(cfg + VIRTIO_NET_CFG_STATUS) & VIRTIO_NET_S_LINK_UP);
+
+	virtio_log.messagef(LogLevel::INFO, "virtio-net: mac=%02x:%02x:%02x:%02x:%02x:%02x, pairs=%u, features=%x, irq=%s, link=%s",
+			_mac[0], _mac[1], _mac[2], _mac[3], _mac[4], _mac[5], _nr_pairs, _features,
+			_pairs[0].rx_irq ? "msi-x" : "polled", link_up ? "up" : "down");
+
+	return true;
+}
+
+/**
+ * Sets up one of the device's queues, raising the MSI-X vector of the same number if
+ * there is an interrupt for it.  If the device won't take the vector, the interrupt is
+ * dropped, and the queue polled.
+ */
+bool VirtioNetDevice::init_queue(unsigned int queue, Virtqueue& vq, IRQ *& irq)
+{
+	write16(VIRTIO_REG_QUEUE_SELECT, queue);
+	uint16_t queue_size = read16(VIRTIO_REG_QUEUE_SIZE);
+
+	if (!queue_size || !vq.init(queue_size, _features & VIRTIO_RING_F_EVENT_IDX)) {
+		virtio_log.messagef(LogLevel::ERROR, "virtio-net: unable to set up queue %u (size=%u)", queue, queue_size);
+		return false;
+	}
+
+	if (_msix) {
+		write16(VIRTIO_REG_MSI_QUEUE_VECTOR, irq ? (uint16_t)queue : VIRTIO_MSI_NO_VECTOR);
+
+		if (irq && read16(VIRTIO_REG_MSI_QUEUE_VECTOR) == VIRTIO_MSI_NO_VECTOR) {
+			virtio_log.messagef(LogLevel::WARNING, "virtio-net: queue %u would not take an MSI-X vector: polled", queue);
+			irq = NULL;
+		}
+	}
+
+	write32(VIRTIO_REG_QUEUE_ADDRESS, (uint32_t)(vq.address() >> 12));
+	return true;
+}
+
+/**
+ * Sets up a queue pair's queues (n is 2n for receiving, and 2n + 1 for transmitting, as
+ * are their MSI-X entries), and its buffers.
+ */
+bool VirtioNetDevice::init_pair(QueuePair& pair)
+{
+	unsigned int rx_queue = pair.index * 2, tx_queue = rx_queue + 1;
+
+	pair.rx_irq = rx_queue < _nr_irqs ? _irqs[rx_queue] : NULL;
+	pair.tx_irq = tx_queue < _nr_irqs ? _irqs[tx_queue] : NULL;
+
+	if (!init_queue(rx_queue, pair.rx, pair.rx_irq) || !init_queue(tx_queue, pair.tx, pair.tx_irq)) {
+		return false;
+	}
+
+	// Every receive buffer is a chain of two descriptors.
+	pair.nr_rx_buffers = __min(MAX_RX_BUFFERS, (unsigned int)pair.rx.size() / 2);
+
+	pair.rx_packets = new (HeapArena::DRIVERS) PacketBuffer *[pair.rx.size()];
+	pair.tx_packets = new (HeapArena::DRIVERS) PacketBuffer *[pair.tx.size()];
+
+	// The receive queue is filled (and refilled) by atomic allocations.
+	if (!pair.rx_packets || !pair.tx_packets || !sys.mm().pktalloc().reserve(pair.nr_rx_buffers + RX_REFILL_BATCH)) {
+		virtio_log.messagef(LogLevel::ERROR, "virtio-net: unable to allocate the buffers of queue pair %u", pair.index);
+		return false;
+	}
+
+	// Nothing is waiting for room to transmit yet.
+	if (pair.rx_irq) pair.rx.enable_interrupts(); else pair.rx.disable_interrupts();
+	pair.tx.disable_interrupts();
+
+	return true;
+}
+
+/**
+ * Tells the device how many queue pairs to use, through the control queue, and polls
+ * for its answer.
+ */
+bool VirtioNetDevice::set_queue_pairs(Virtqueue& ctrl, unsigned int ctrl_queue)
+{
+	struct ControlCommand {
+		uint8_t cls;
+		uint8_t command;
+		uint16_t nr_pairs;
+		volatile uint8_t ack;
+	} __packed;
+
+	FrameDescriptor *page = sys.mm().pgalloc().allocate_contiguous(1);
+	if (!page) return false;
+
+	ControlCommand *cmd = (ControlCommand *)sys.mm().pgalloc().pfdescr_to_vpa(page);
+	phys_addr_t cmd_pa = sys.mm().pgalloc().pfdescr_to_pa(page);
+
+	cmd->cls = VIRTIO_NET_CTRL_MQ;
+	cmd->command = VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET;
+	cmd->nr_pairs = _nr_pairs;
+	cmd->ack = 0xff;
+
+	Virtqueue::Buffer buffers[3];
+	buffers[0].address = cmd_pa + offsetof(ControlCommand, cls);
+	buffers[0].size = 2;
+	buffers[0].device_writes = false;
+	buffers[1].address = cmd_pa + offsetof(ControlCommand, nr_pairs);
+	buffers[1].size = sizeof(uint16_t);
+	buffers[1].device_writes = false;
+	buffers[2].address = cmd_pa + offsetof(ControlCommand, ack);
+	buffers[2].size = 1;
+	buffers[2].device_writes = true;
+
+	ctrl.disable_interrupts();
+	ctrl.add(buffers, 3);
+	ctrl.publish();
+	write16(VIRTIO_REG_QUEUE_NOTIFY, ctrl_queue);
+
+	uint16_t head;
+	uint32_t length;
+	bool answered = false;
+	for (unsigned int spins = 0; spins < VIRTIO_NET_CTRL_SPINS; spins++) {
+		if (ctrl.get_used(head, length)) {
+			answered = true;
+			break;
+		}
+
+		asm volatile("pause");
+	}
+
+	bool success = answered && cmd->ack == VIRTIO_NET_OK;
+
+	// A command the device never answered may still be written to.
+	if (answered) sys.mm().pgalloc().free_one(page);
+
+	return success;
+}
+
+void VirtioNetDevice::mac_address(uint8_t *mac) const
+{
+	memcpy(mac, _mac, sizeof(_mac));
+}
+
+unsigned int VirtioNetDevice::offloads() const
+{
+	return ((_features & VIRTIO_NET_F_CSUM) ? NetworkOffload::TX_CHECKSUM : 0) |
+		((_features & VIRTIO_NET_F_HOST_TSO4) ? NetworkOffload::TSO : 0);
+}
+
+/**
+ * A segment's headers are in the headroom of its first buffer, so it can carry as much
+ * data as fills every buffer a packet can be in.
+ */
+size_t VirtioNetDevice::tso_max_size() const
+{
+	return MAX_TX_SEGMENTS * (PacketBuffer::SIZE - PacketBuffer::HEADROOM);
+}
+
+bool VirtioNetDevice::can_wait_for_irq() const
+{
+	return _pairs[0].rx_irq && sys.scheduler().active() && sys.arch().interrupts_enabled();
+}
+
+/**
+ * Publishes what has been added to a queue, and notifies the device, unless it has said
+ * it doesn't need to be (e.g. because it is still working through the queue).
+ */
+void VirtioNetDevice::notify(unsigned int queue, Virtqueue& vq)
+{
+	if (vq.publish()) {
+		write16(VIRTIO_REG_QUEUE_NOTIFY, queue);
+	}
+}
+
+/**
+ * Adds a new packet buffer to the pair's receive queue: the header, in its headroom,
+ * then the rest of the buffer for the frame.  It isn't published until refill_rx() is
+ * done.  Called with the pair's lock held, so the buffer is allocated atomically.
+ */
+bool VirtioNetDevice::post_rx(QueuePair& pair)
+{
+	PacketBuffer *packet = sys.mm().pktalloc().allocate(true);
+	if (!packet) return false;
+
+	Virtqueue::Buffer buffers[2];
+	buffers[0].address = packet->data_pa() - sizeof(NetHeader);
+	buffers[0].size = sizeof(NetHeader);
+	buffers[0].device_writes = true;
+	buffers[1].address = packet->data_pa();
+	buffers[1].size = packet->tailroom();
+	buffers[1].device_writes = true;
+
+	uint16_t head = pair.rx.add(buffers, 2);
+	pair.rx_packets[head] = packet;
+	pair.nr_posted++;
+
+	return true;
+}
+
+/**
+ * Replaces the buffers the device has received frames in, a batch at a time, unless
+ * the device has few enough left that they are needed now, or 'force' is set.  Called
+ * with the pair's lock held.
+ */
+void VirtioNetDevice::refill_rx(QueuePair& pair, bool force)
+{
+	unsigned int missing = pair.nr_rx_buffers - pair.nr_posted;
+
+	if (!missing) return;
+	if (!force && missing < RX_REFILL_BATCH && pair.nr_posted >= RX_REFILL_BATCH) return;
+
+	while (pair.nr_posted < pair.nr_rx_buffers && pair.rx.nr_free() >= 2) {
+		if (!post_rx(pair)) break;
+	}
+
+	notify(pair.index * 2, pair.rx);
+}
+
+/**
+ * Takes the frames the device has received off the used ring, onto the pair's list of
+ * received frames, and returns how many there were.  Interrupts are turned off while the
+ * ring is drained, and the ring checked again once they are back on, so that one
+ * interrupt covers everything received in the meantime.  Called with the pair's lock
+ * held.
+ */
+unsigned int VirtioNetDevice::service_rx(QueuePair& pair)
+{
+	unsigned int count = 0;
+
+	for (;;) {
+		pair.rx.disable_interrupts();
+
+		uint16_t head;
+		uint32_t length;
+		while (pair.rx.get_used(head, length)) {
+			PacketBuffer *packet = pair.rx_packets[head];
+			packet->length = length > sizeof(NetHeader) ? length - sizeof(NetHeader) : 0;
+			pair.nr_posted--;
+
+			pair.received[(pair.received_head + pair.nr_received) % MAX_RX_BUFFERS] = packet;
+			pair.nr_received++;
+			count++;
+		}
+
+		if (!pair.rx_irq || pair.rx.enable_interrupts()) break;
+	}
+
+	__atomic_add_fetch(&_nr_received, count, __ATOMIC_RELEASE);
+	return count;
+}
+
+/**
+ * Takes the pair's oldest received frame, if there is one, and replaces its buffer.  If
+ * 'polled', the used ring is checked first.
+ */
+PacketBuffer *VirtioNetDevice::take_received(QueuePair& pair, bool polled)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(pair.waiters.lock());
+
+	if (polled || !pair.rx_irq) service_rx(pair);
+	if (!pair.nr_received) return NULL;
+
+	PacketBuffer *packet = pair.received[pair.received_head];
+	pair.received_head = (pair.received_head + 1) % MAX_RX_BUFFERS;
+	pair.nr_received--;
+	__atomic_sub_fetch(&_nr_received, 1, __ATOMIC_RELEASE);
+
+	refill_rx(pair, false);
+	return packet;
+}
+
+/**
+ * Takes the oldest received frame from any queue pair, starting from the one after the
+ * last that had one, so that no pair is left behind.
+ */
+PacketBuffer *VirtioNetDevice::receive_packet(bool wait)
+{
+	bool polled = !can_wait_for_irq();
+
+	// There is no allocating under the pairs' locks, so the buffers that replace the
+	// ones taken are made here, if the pool is running out.
+	sys.mm().pktalloc().reserve(RX_REFILL_BATCH);
+
+	for (;;) {
+		unsigned int start = _next_rx_pair;
+
+		for (unsigned int i = 0; i < _nr_pairs; i++) {
+			QueuePair& pair = _pairs[(start + i) % _nr_pairs];
+
+			PacketBuffer *packet = take_received(pair, polled);
+			if (packet) {
+				_next_rx_pair = (pair.index + 1) % _nr_pairs;
+				return packet;
+			}
+		}
+
+		if (!wait) return NULL;
+
+		if (polled) {
+			asm volatile("pause");
+			continue;
+		}
+
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_rx_waiters.lock());
+
+		while (!has_received()) _rx_waiters.sleep_locked(Thread::current());
+	}
+}
+
+/**
+ * Releases the packets the device has finished transmitting.  Called with the pair's
+ * lock held.
+ */
+void VirtioNetDevice::reclaim_tx(QueuePair& pair)
+{
+	uint16_t head;
+	uint32_t length;
+	while (pair.tx.get_used(head, length)) {
+		sys.mm().pktalloc().release(pair.tx_packets[head]);
+	}
+}
+
+/**
+ * Puts the packets on the current CPU's queue pair, a chain of descriptors each (the
+ * header, in the first buffer's headroom, and then every buffer), and hands them to the
+ * device with one notification.  If the descriptors run out, what has been added so far
+ * is handed over, and, if 'wait' is set, the transmit interrupt turned on until some of
+ * it has been sent.
+ */
+unsigned int VirtioNetDevice::transmit_packets(PacketBuffer **packets, unsigned int count, bool wait)
+{
+	RunQueue *rq = CPU::current().runqueue();
+	QueuePair& pair = _pairs[(rq ? rq->index() : 0) % _nr_pairs];
+	unsigned int tx_queue = pair.index * 2 + 1;
+
+	bool can_sleep = pair.tx_irq && sys.scheduler().active() && sys.arch().interrupts_enabled();
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(pair.waiters.lock());
+
+	unsigned int sent = 0;
+	while (sent < count) {
+		PacketBuffer *packet = packets[sent];
+
+		size_t length = packet->packet_length();
+		size_t max_length = packet->gso_size ? 0xffff : NET_MAX_FRAME_SIZE;
+		if (!length || length > max_length || packet->headroom() < sizeof(NetHeader)) break;
+
+		Virtqueue::Buffer buffers[MAX_TX_SEGMENTS + 1];
+		unsigned int nr_buffers = 1;
+		bool fits = true;
+
+		for (PacketBuffer *b = packet; b; b = b->next) {
+			if (!b->length) continue;
+			if (nr_buffers == MAX_TX_SEGMENTS + 1) {
+				fits = false;
+				break;
+			}
+
+			buffers[nr_buffers].address = b->data_pa();
+			buffers[nr_buffers].size = b->length;
+			buffers[nr_buffers].device_writes = false;
+			nr_buffers++;
+		}
+
+		if (!fits || nr_buffers > pair.tx.size()) break;
+
+		if (pair.tx.nr_free() < nr_buffers) reclaim_tx(pair);
+
+		if (pair.tx.nr_free() < nr_buffers) {
+			notify(tx_queue, pair.tx);
+			if (!wait) break;
+
+			if (can_sleep) {
+				pair.tx_waiting = true;
+				if (pair.tx.enable_interrupts()) {
+					pair.waiters.sleep_locked(Thread::current());
+				}
+
+				pair.tx_waiting = false;
+				pair.tx.disable_interrupts();
+			} else {
+				pair.waiters.lock().unlock();
+				asm volatile("pause");
+				pair.waiters.lock().lock();
+			}
+
+			continue;
+		}
+
+		NetHeader *header = (NetHeader *)(packet->data() - sizeof(NetHeader));
+		bzero(header, sizeof(NetHeader));
+
+		if (packet->csum_start) {
+			header->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+			header->csum_start = packet->csum_start - packet->offset;
+			header->csum_offset = packet->csum_offset;
+		}
+
+		if (packet->gso_size) {
+			// The headers end where the TCP header (from which the checksum starts)
+			// says it does.
+			const uint8_t *tcp = packet->base + packet->csum_start;
+
+			header->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+			header->gso_size = packet->gso_size;
+			header->hdr_len = header->csum_start + (tcp[12] >> 4) * 4;
+		}
+
+		buffers[0].address = packet->data_pa() - sizeof(NetHeader);
+		buffers[0].size = sizeof(NetHeader);
+		buffers[0].device_writes = false;
+
+		uint16_t head = pair.tx.add(buffers, nr_buffers);
+		pair.tx_packets[head] = packet;
+		sent++;
+	}
+
+	notify(tx_queue, pair.tx);
+	return sent;
+}
+
+/**
+ * Handles a receive queue's interrupt, by taking what has arrived, and waking readers and
+ * pollers.  With MSI-X, there is no ISR status to read.
+ */
+void VirtioNetDevice::rx_irq_handler(const IRQ *irq, void *priv)
+{
+	QueuePair& pair = *(QueuePair *)priv;
+	VirtioNetDevice& dev = *pair.device;
+
+	unsigned int count;
+	{
+		UniqueLock<SpinLock> l(pair.waiters.lock());
+		count = dev.service_rx(pair);
+	}
+
+	if (!count) return;
+
+	{
+		UniqueLock<SpinLock> l(dev._rx_waiters.lock());
+		while (count-- && dev._rx_waiters.wake_one_locked());
+	}
+
+	dev.frames_received();
+}
+
+/**
+ * Handles a transmit queue's interrupt, which is only on while a transmitter is waiting
+ * for buffers.
+ */
+void VirtioNetDevice::tx_irq_handler(const IRQ *irq, void *priv)
+{
+	QueuePair& pair = *(QueuePair *)priv;
+
+	UniqueLock<SpinLock> l(pair.waiters.lock());
+
+	pair.tx.disable_interrupts();
+	pair.device->reclaim_tx(pair);
+
+	if (pair.tx_waiting) {
+		while (pair.waiters.wake_one_locked());
+	}
+}
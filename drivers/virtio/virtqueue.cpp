@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/virtio/virtqueue.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/drivers/virtio/virtio.h>
+#include <infos/drivers/virtio/virtqueue.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/string.h>
+
+using namespace infos::drivers::virtio;
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::util;
+
+ComponentLog infos::drivers::virtio::virtio_log(syslog, "virtio");
+
+#define VIRTQ_DESC_F_NEXT			1
+#define VIRTQ_DESC_F_WRITE			2
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT	1
+#define VIRTQ_USED_F_NO_NOTIFY		1
+
+Virtqueue::Virtqueue()
+	: _frames(NULL), _pa(0), _size(0), _event_idx(false), _desc(NULL),
+	_free_head(0), _nr_free(0), _avail_next(0), _avail_published(0), _used_next(0)
+{
+
+}
+
+bool Virtqueue::init(uint16_t size, bool event_idx)
+{
+	if (!size || (size & (size - 1))) return false;
+
+	// The descriptor table and available ring, then the used ring, on a page boundary.
+	size_t used_offset = __align_up_page(16 * size + 6 + 2 * size);
+	size_t total = used_offset + 6 + 8 * size;
+	size_t nr_frames = __align_up_page(total) / __page_size;
+
+	_frames = sys.mm().pgalloc().allocate_contiguous(nr_frames);
+	if (!_frames) return false;
+
+	uint8_t *base = (uint8_t *)sys.mm().pgalloc().pfdescr_to_vpa(_frames);
+	bzero(base, nr_frames * __page_size);
+
+	_pa = sys.mm().pgalloc().pfdescr_to_pa(_frames);
+	_size = size;
+	_event_idx = event_idx;
+
+	_desc = (Descriptor *)base;
+
+	uint16_t *avail = (uint16_t *)(base + 16 * size);
+	_avail_flags = &avail[0];
+	_avail_idx = &avail[1];
+	_avail_ring = &avail[2];
+	_used_event = &avail[2 + size];
+
+	uint16_t *used = (uint16_t *)(base + used_offset);
+	_used_flags = &used[0];
+	_used_idx = &used[1];
+	_used_ring = (volatile UsedElement *)&used[2];
+	_avail_event = (uint16_t *)((uint8_t *)&used[2] + 8 * size);
+
+	for (uint16_t i = 0; i < size; i++) {
+		_desc[i].next = i + 1;
+	}
+
+	_free_head = 0;
+	_nr_free = size;
+
+	return true;
+}
+
+uint16_t Virtqueue::add(const Buffer *buffers, unsigned int count)
+{
+	assert(count && count <= _nr_free);
+
+	uint16_t head = _free_head;
+
+	for (unsigned int i = 0; i < count; i++) {
+		Descriptor& d = _desc[_free_head];
+		uint16_t next = d.next;
+
+		d.address = buffers[i].address;
+		d.size = buffers[i].size;
+		d.flags = (buffers[i].device_writes ? VIRTQ_DESC_F_WRITE : 0) | (i + 1 < count ? VIRTQ_DESC_F_NEXT : 0);
+
+		if (i + 1 == count) break;
+		_free_head = next;
+	}
+
+	// The last descriptor's 'next' still links the rest of the free list.
+	_free_head = _desc[_free_head].next;
+	_nr_free -= count;
+
+	_avail_ring[_avail_next % _size] = head;
+	_avail_next++;
+
+	return head;
+}
+
+bool Virtqueue::publish()
+{
+	if (_avail_next == _avail_published) return false;
+
+	uint16_t old_idx = _avail_published;
+	uint16_t new_idx = _avail_next;
+
+	// The ring entries must be seen before the index that covers them, and the index
+	// before whatever the device has said about notifications is read.
+	__sync_synchronize();
+	*_avail_idx = new_idx;
+	_avail_published = new_idx;
+	__sync_synchronize();
+
+	if (_event_idx) {
+		// Whether the entry the device asked to hear about is among the new ones.
+		uint16_t event = *_avail_event;
+		return (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old_idx);
+	}
+
+	return !(*_used_flags & VIRTQ_USED_F_NO_NOTIFY);
+}
+
+bool Virtqueue::get_used(uint16_t& head, uint32_t& length)
+{
+	if (_used_next == *_used_idx) return false;
+
+	// The index must be read before the entry it covers.
+	__sync_synchronize();
+
+	volatile UsedElement& e = _used_ring[_used_next % _size];
+	head = (uint16_t)e.id;
+	length = e.size;
+	_used_next++;
+
+	// Put the chain back on the free list.
+	uint16_t tail = head;
+	uint16_t count = 1;
+	while (_desc[tail].flags & VIRTQ_DESC_F_NEXT) {
+		tail = _desc[tail].next;
+		count++;
+	}
+
+	_desc[tail].next = _free_head;
+	_free_head = head;
+	_nr_free += count;
+
+	return true;
+}
+
+void Virtqueue::disable_interrupts()
+{
+	// With event indexes, the device only interrupts when it reaches the used event,
+	// which is left behind until interrupts are wanted again.
+	if (!_event_idx) {
+		*_avail_flags = *_avail_flags | VIRTQ_AVAIL_F_NO_INTERRUPT;
+	}
+}
+
+bool Virtqueue::enable_interrupts()
+{
+	if (_event_idx) {
+		*_used_event = _used_next;
+	} else {
+		*_avail_flags = *_avail_flags & ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+	}
+
+	__sync_synchronize();
+	return _used_next == *_used_idx;
+}
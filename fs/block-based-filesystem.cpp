@@ -12,7 +12,7 @@
 
 using namespace infos::fs;
 
-BlockBasedFilesystem::BlockBasedFilesystem(drivers::block::BlockDevice& bdev) : _bdev(bdev)
+BlockBasedFilesystem::BlockBasedFilesystem(drivers::block::BlockDevice& bdev) : _cache(bdev)
 {
 
 }
@@ -10,6 +10,7 @@
  */
 #include <infos/fs/devfs.h>
 #include <infos/fs/vfs.h>
+#include <infos/fs/stats.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/log.h>
 #include <infos/drivers/device.h>
@@ -20,10 +21,11 @@ using namespace infos::fs;
 using namespace infos::util;
 using namespace infos::kernel;
 using namespace infos::drivers;
+using namespace infos::mm;
 
 PFSNode *DeviceFS::mount()
 {
-	return new DeviceFSRootNode(*this);
+	return new (HeapArena::VFS) DeviceFSRootNode(*this);
 }
 
 DeviceFSRootNode::DeviceFSRootNode(DeviceFS& owner) : PFSNode(NULL, owner)
@@ -31,14 +33,39 @@ DeviceFSRootNode::DeviceFSRootNode(DeviceFS& owner) : PFSNode(NULL, owner)
 
 }
 
+#define DEVFS_STATS_SUFFIX		".stats"
+#define DEVFS_STATS_DIRECTORY	"stats"
+
 PFSNode* DeviceFSRootNode::get_child(const util::String& name)
 {
+	if (name == DEVFS_STATS_DIRECTORY) {
+		return new (HeapArena::VFS) DeviceFSStatsNode(*this);
+	}
+
 	Device *dev;
-	if (!kernel::sys.device_manager().try_get_device_by_name(name, dev)) {
+	if (kernel::sys.device_manager().try_get_device_by_name(name, dev)) {
+		return new (HeapArena::VFS) DeviceFSNode(*this, *dev);
+	}
+
+	// Otherwise, it may be the statistics file of a device, e.g. ata0.stats.
+	size_t suffix_length = sizeof(DEVFS_STATS_SUFFIX) - 1;
+	size_t length = name.length();
+	if (length <= suffix_length || strncmp(name.c_str() + length - suffix_length, DEVFS_STATS_SUFFIX, suffix_length) != 0) {
 		return NULL;
 	}
 
-	return new DeviceFSNode(*this, *dev);
+	char *device_name = new char[length - suffix_length + 1];
+	memcpy(device_name, name.c_str(), length - suffix_length);
+	device_name[length - suffix_length] = 0;
+
+	bool found = kernel::sys.device_manager().try_get_device_by_name(device_name, dev);
+	delete[] device_name;
+
+	if (!found || !dev->has_stats()) {
+		return NULL;
+	}
+
+	return new (HeapArena::VFS) DeviceFSNode(*this, *dev, true);
 }
 
 PFSNode* DeviceFSRootNode::mkdir(const util::String& name)
@@ -53,12 +80,13 @@ File* DeviceFSRootNode::open()
 
 Directory* DeviceFSRootNode::opendir()
 {
-	return new DeviceFSDirectory(*this);
+	return new (HeapArena::VFS) DeviceFSDirectory(*this);
 }
 
-DeviceFSNode::DeviceFSNode(DeviceFSRootNode& root, drivers::Device& dev) 
+DeviceFSNode::DeviceFSNode(DeviceFSRootNode& root, drivers::Device& dev, bool stats)
 	: PFSNode(&root, root.owner()),
-	_dev(dev)
+	_dev(dev),
+	_stats(stats)
 {
 }
 
@@ -74,6 +102,10 @@ PFSNode* DeviceFSNode::mkdir(const util::String& name)
 
 File* DeviceFSNode::open()
 {
+	if (_stats) {
+		return _dev.open_stats_file();
+	}
+
 	return _dev.open_as_file();
 }
 
@@ -84,19 +116,95 @@ Directory* DeviceFSNode::opendir()
 
 DeviceFSDirectory::DeviceFSDirectory(DeviceFSRootNode& node)
 {
+	DirectoryEntry stats;
+	stats.name = DEVFS_STATS_DIRECTORY;
+	stats.size = 0;
+	add_entry(stats);
+
 	for (const auto& device : kernel::sys.device_manager().devices()) {
 		DirectoryEntry de;
 		de.name = device.value->name();
 		de.size = 0;
 		
 		add_entry(de);
+
+		if (device.value->has_stats()) {
+			de.name = device.value->name() + DEVFS_STATS_SUFFIX;
+			add_entry(de);
+		}
+	}
+}
+
+DeviceFSStatsNode::DeviceFSStatsNode(DeviceFSRootNode& root) : PFSNode(&root, root.owner())
+{
+
+}
+
+PFSNode* DeviceFSStatsNode::get_child(const util::String& name)
+{
+	const StatisticsRegistration *stats = StatisticsRegistration::find(name);
+	if (!stats) {
+		return NULL;
 	}
+
+	return new (HeapArena::VFS) DeviceFSStatsFileNode(*this, *stats);
+}
+
+PFSNode* DeviceFSStatsNode::mkdir(const util::String& name)
+{
+	return NULL;
+}
+
+File* DeviceFSStatsNode::open()
+{
+	return NULL;
+}
+
+Directory* DeviceFSStatsNode::opendir()
+{
+	return new (HeapArena::VFS) DeviceFSStatsDirectory();
+}
+
+DeviceFSStatsFileNode::DeviceFSStatsFileNode(DeviceFSStatsNode& parent, const StatisticsRegistration& stats)
+	: PFSNode(&parent, parent.owner()),
+	_stats(stats)
+{
+}
+
+PFSNode* DeviceFSStatsFileNode::get_child(const util::String& name)
+{
+	return NULL;
+}
+
+PFSNode* DeviceFSStatsFileNode::mkdir(const util::String& name)
+{
+	return NULL;
+}
+
+File* DeviceFSStatsFileNode::open()
+{
+	return new (HeapArena::VFS) StatisticsFile(_stats);
+}
+
+Directory* DeviceFSStatsFileNode::opendir()
+{
+	return NULL;
 }
 
+DeviceFSStatsDirectory::DeviceFSStatsDirectory()
+{
+	for (const StatisticsRegistration *stats = StatisticsRegistration::begin(); stats < StatisticsRegistration::end(); stats++) {
+		DirectoryEntry de;
+		de.name = stats->name;
+		de.size = 0;
+
+		add_entry(de);
+	}
+}
 
 static Filesystem *devfs_create(VirtualFilesystem& vfs, infos::drivers::Device *dev)
 {
-	return new DeviceFS(vfs.owner().device_manager());
+	return new (HeapArena::VFS) DeviceFS(vfs.owner().device_manager());
 }
 
 RegisterFilesystem(devfs, devfs_create);
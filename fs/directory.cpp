@@ -14,10 +14,28 @@
 using namespace infos::fs;
 using namespace infos::kernel;
 
+bool Directory::next_entry(DirectoryEntry& entry)
+{
+	if (_has_unread) {
+		entry = _unread;
+		_has_unread = false;
+
+		return true;
+	}
+
+	return read_entry(entry);
+}
+
+void Directory::unread_entry(const DirectoryEntry& entry)
+{
+	_unread = entry;
+	_has_unread = true;
+}
+
 bool SimpleDirectory::read_entry(DirectoryEntry& entry)
 {
-	if (_current_entry < _entries.count()) {
-		entry = _entries.at(_current_entry);
+	if (_current_entry < _nr_entries) {
+		entry = _entries[_current_entry];
 		_current_entry++;
 		
 		return true;
@@ -28,10 +46,30 @@ bool SimpleDirectory::read_entry(DirectoryEntry& entry)
 
 void SimpleDirectory::close()
 {
-	_entries.clear();
+	delete[] _entries;
+
+	_entries = NULL;
+	_nr_entries = 0;
+	_capacity = 0;
+	_current_entry = 0;
 }
 
 void SimpleDirectory::add_entry(const DirectoryEntry& e)
 {
-	_entries.append(e);
+	if (_nr_entries == _capacity) {
+		unsigned int capacity = _capacity ? _capacity * 2 : 16;
+
+		DirectoryEntry *entries = new DirectoryEntry[capacity];
+		if (!entries) return;
+
+		for (unsigned int i = 0; i < _nr_entries; i++) {
+			entries[i] = _entries[i];
+		}
+
+		delete[] _entries;
+		_entries = entries;
+		_capacity = capacity;
+	}
+
+	_entries[_nr_entries++] = e;
 }
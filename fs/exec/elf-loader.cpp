@@ -15,11 +15,16 @@
 #include <infos/kernel/process.h>
 #include <infos/mm/mm.h>
 #include <infos/mm/page-allocator.h>
+#include <infos/mm/reclaim.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/intrusive-list.h>
+#include <infos/util/lock.h>
 #include <arch/x86/vma.h> /* HACK: make sure we have the x86 page table definitions in scope */
 using namespace infos::kernel;
 using namespace infos::fs;
 using namespace infos::fs::exec;
 using namespace infos::util;
+using namespace infos::mm;
 
 ComponentLog infos::fs::exec::elf_log(syslog, "elf");
 
@@ -30,23 +35,349 @@ ComponentLog infos::fs::exec::elf_log(syslog, "elf");
 #define EDATA_LITTLE 1
 #define EDATA_BIG 2
 
-ElfLoader::ElfLoader(File &f) : _file(f)
+// Spawning from templates shares text, and data copy-on-write, between the processes
+// started from one program, and is off unless asked for (exec.templates=1) until it has
+// been run on a booted system.
+static bool do_templates;
+
+RegisterCmdLineArgument(ExecTemplates, "exec.templates") {
+	if (strncmp(value, "1", 2) == 0) {
+		do_templates = true;
+	} else {
+		do_templates = false;
+	}
+}
+
+// The number of programs whose loaded images are kept around as templates.
+#define MAX_PROCESS_TEMPLATES	8
+
+/* The loaded image of a program, kept so that processes running the same program
+ * again can be cloned from it, rather than loaded from scratch.  Its VMA is also
+ * the text source for those processes: read-only pages are read into it on first
+ * use, and shared from there.  A template is keyed by the program's path, and the
+ * identity of the file it was loaded from, where the file has one, so that a program
+ * that has been rewritten since is loaded afresh. */
+struct ProcessTemplate
+{
+	String path;
+	FileIdentity identity;
+	bool has_identity;
+	VMA vma;
+	uint64_t entry_point;
+	unsigned int nr_loading;		// Loads using the template, that haven't yet made it their text source.
+	IntrusiveListNode<ProcessTemplate> node;	// On 'templates', or 'retired_templates'
+};
+
+// Most recently used first.  Templates that have been replaced, or pushed out, can only
+// be freed once no process has them as its text source any more.
+static IntrusiveList<ProcessTemplate, &ProcessTemplate::node> templates;
+static IntrusiveList<ProcessTemplate, &ProcessTemplate::node> retired_templates;
+static Mutex templates_mtx;
+
+/**
+ * Takes a template out of use, and frees any retired templates that nothing uses any more.
+ * Called with the templates lock held.
+ * @return Returns how many frames the templates that were freed had.
+ */
+static uint64_t retire_template(ProcessTemplate *tmpl)
 {
+	if (tmpl) {
+		templates.remove(*tmpl);
+		retired_templates.append(*tmpl);
+	}
+
+	uint64_t nr_frames = 0;
+
+	ProcessTemplate *unused;
+	do {
+		unused = NULL;
+		for (auto retired : retired_templates) {
+			if (!retired->nr_loading && !retired->vma.nr_text_users()) {
+				unused = retired;
+				break;
+			}
+		}
+
+		if (unused) {
+			MemoryUsage usage;
+			unused->vma.usage(usage);
+			nr_frames += usage.private_frames + usage.pgt_frames;
+
+			retired_templates.remove(*unused);
+			delete unused;
+		}
+	} while (unused);
+
+	return nr_frames;
+}
+
+/**
+ * Pushes out the templates used longest ago until enough frames have been freed, when
+ * memory is short.  A template that a process is still running from is freed once the
+ * process goes, so it doesn't count.
+ */
+static uint64_t shrink_templates(uint64_t nr_frames)
+{
+	if (!templates_mtx.try_lock()) return 0;
+
+	uint64_t nr = retire_template(NULL);
+	while (nr < nr_frames && templates.count()) {
+		nr += retire_template(templates.last());
+	}
+
+	templates_mtx.unlock();
+	return nr;
+}
+
+static Shrinker template_shrinker("exec-templates", shrink_templates);
+
+/**
+ * Looks up the template for a program, checking that it was made from what the file
+ * holds now.  The template is held until release_template() is called.
+ */
+static ProcessTemplate *find_template(const String& path, const File& file)
+{
+	FileIdentity identity;
+	bool has_identity = file.identity(identity);
+
+	UniqueLock<Mutex> l(templates_mtx);
+
+	for (auto tmpl : templates) {
+		if (!(tmpl->path == path)) continue;
+
+		if (tmpl->has_identity != has_identity || (has_identity && !(tmpl->identity == identity))) {
+			elf_log.messagef(LogLevel::DEBUG, "'%s' has changed since its template was made", path.c_str());
+			retire_template(tmpl);
+			return NULL;
+		}
+
+		templates.remove(*tmpl);
+		templates.push(*tmpl);
+
+		tmpl->nr_loading++;
+		return tmpl;
+	}
+
+	return NULL;
+}
+
+static void release_template(ProcessTemplate *tmpl)
+{
+	UniqueLock<Mutex> l(templates_mtx);
+	tmpl->nr_loading--;
+}
+
+/**
+ * Keeps a copy-on-write clone of a freshly loaded image as the template for its program,
+ * pushing out the template used longest ago if there are too many.  The new template is
+ * held until release_template() is called.
+ */
+static ProcessTemplate *add_template(const String& path, const File& file, Process& p, uint64_t entry_point)
+{
+	ProcessTemplate *tmpl = new (HeapArena::ELF) ProcessTemplate();
+	if (!p.vma().clone_into(tmpl->vma)) {
+		elf_log.messagef(LogLevel::WARNING, "Unable to create a template for '%s'", path.c_str());
+		delete tmpl;
+		return NULL;
+	}
+
+	tmpl->path = path;
+	tmpl->has_identity = file.identity(tmpl->identity);
+	tmpl->entry_point = entry_point;
+	tmpl->nr_loading = 1;
+
+	UniqueLock<Mutex> l(templates_mtx);
+
+	// Another load of the program may have got here first.
+	for (auto other : templates) {
+		if (other->path == path) {
+			retire_template(other);
+			break;
+		}
+	}
+
+	while (templates.count() >= MAX_PROCESS_TEMPLATES) {
+		retire_template(templates.last());
+	}
+
+	templates.push(*tmpl);
+	return tmpl;
+}
+
+// Whether pages of file data are left to be demand-paged in on first touch, rather than
+// read in when the program is loaded.  Until the demand-paging path has been run on a
+// booted system, it is off unless asked for (exec.lazy=1).
+static bool lazy_exec;
+
+RegisterCmdLineArgument(ExecLazy, "exec.lazy") {
+	lazy_exec = strncmp(value, "1", 2) == 0;
+}
+
+// Likewise for pages that hold only zeroes (BSS), which go down the zero-fill fault path,
+// and are given zeroed frames at load unless asked for (exec.lazy-bss=1).
+static bool lazy_bss;
+
+RegisterCmdLineArgument(ExecLazyBSS, "exec.lazy-bss") {
+	lazy_bss = strncmp(value, "1", 2) == 0;
+}
+
+ElfLoader::ElfLoader(File &f, const String& path) : _file(f), _path(path)
+{
+}
+
+/**
+ * Leaves a page of a loadable segment unmapped, with a cookie in its PTE that tells
+ * the page fault handler how to fill it in on first touch.
+ * @param p The process being loaded
+ * @param ent The segment that the page belongs to
+ * @param vaddr The (page-aligned) virtual address of the page
+ * @param zero Whether the page is to be zero-filled, rather than read from the file
+ * @return Returns true if the page was deferred, or false if it must be loaded now.
+ */
+static bool defer_page(Process& p, const ELF64ProgramHeaderEntry& ent, uintptr_t vaddr, bool zero)
+{
+	uint32_t flags = (ent.flags & PF_W) ? DPC_WRITABLE : 0;
+
+	uint64_t offset = 0;
+	if (zero) {
+		flags |= DPC_ZERO;
+	} else {
+		offset = ent.offset + (vaddr - ent.vaddr);
+
+		// The cookie only has room for a 32-bit file offset.
+		if (offset > 0xfffff000ull) return false;
+	}
+
+	if (!p.vma().create_unused_ptes(vaddr, 1)) return false;
+	return p.vma().set_pte_cookie(vaddr, make_demand_page_cookie((uint32_t)offset, flags));
 }
 
 Process *ElfLoader::load(const String &cmdline)
 {
-	ELF64Header hdr;
+	Process *np;
+
+	ProcessTemplate *tmpl = (do_templates && _path.length() > 0) ? find_template(_path, _file) : NULL;
+	if (tmpl) {
+		elf_log.messagef(LogLevel::DEBUG, "Cloning '%s' from its template", _path.c_str());
 
-	_file.seek(0, File::SeekAbsolute);
-	int bytes = _file.read(&hdr, sizeof(hdr));
+		np = new Process("user", false, (Thread::thread_proc_t)tmpl->entry_point, &_file);
+		if (!tmpl->vma.clone_into(np->vma())) {
+			release_template(tmpl);
+			delete np;
+
+			elf_log.message(LogLevel::DEBUG, "Unable to clone template");
+			return NULL;
+		}
+	} else {
+		uint64_t entry_point;
+		np = load_image(entry_point);
+		if (!np) return NULL;
 
-	if (bytes != sizeof(hdr))
+		if (do_templates && _path.length() > 0) {
+			tmpl = add_template(_path, _file, *np, entry_point);
+		}
+	}
+
+	// The template's VMA also caches the program's read-only pages, once any process
+	// running it has read them in, so that they are shared.
+	if (tmpl) {
+		np->vma().text_source(&tmpl->vma);
+		release_template(tmpl);
+	}
+
+	np->main_thread().allocate_user_stack(0x100000, 0x2000);
+
+	if (cmdline.length() > 0)
+	{
+		virt_addr_t cmdline_start = 0x102000;
+		np->vma().allocate_virt(cmdline_start, 1);
+
+		if (!np->vma().copy_to(cmdline_start, cmdline.c_str(), cmdline.length()))
+		{
+			return NULL;
+		}
+
+		np->main_thread().add_entry_argument((void *)cmdline_start);
+	}
+	else
+	{
+		np->main_thread().add_entry_argument(NULL);
+	}
+
+	return np;
+}
+
+// How much of the start of the file is read to get the ELF header, which is usually
+// followed by the program header table.
+#define ELF_HEADER_READ_SIZE	__page_size
+
+// The most pages of a segment that are read in with one request.
+#define ELF_LOAD_MAX_VEC		16
+
+/**
+ * Reads the file data of a run of consecutive pages of a segment straight into the
+ * frames that back them, with one request, allocating the frames of any that aren't
+ * mapped yet.  The pages' file data is contiguous in the file, as it is in memory.
+ * @param start The virtual address the data starts at (not necessarily page-aligned)
+ * @param end The virtual address the data ends at, at most a page boundary after the
+ * start of the last page
+ * @return Returns false if the pages couldn't be mapped, or read.
+ */
+static bool load_pages(Process& p, File& f, const ELF64ProgramHeaderEntry& ent, uintptr_t start, uintptr_t end)
+{
+	IOVec vec[ELF_LOAD_MAX_VEC];
+	unsigned int nr_vec = 0;
+
+	for (uintptr_t vaddr = start; vaddr < end; vaddr = __align_down_page(vaddr + __page_size)) {
+		uintptr_t page = __align_down_page(vaddr);
+		if (!p.vma().is_mapped(page)) {
+			/* Use -1 to mean "default permissions" */
+			if (!p.vma().allocate_virt(page, /* one page */ 1, -1)) return false;
+		}
+
+		phys_addr_t pa;
+		if (!p.vma().get_mapping(page, pa)) return false;
+
+		vec[nr_vec].base = (void *)(pa_to_vpa(pa) + (vaddr - page));
+		vec[nr_vec].size = __min(page + __page_size, end) - vaddr;
+		nr_vec++;
+	}
+
+	size_t size = end - start;
+	return f.preadv(vec, nr_vec, ent.offset + (start - ent.vaddr)) == (int)size;
+}
+
+/**
+ * Creates a process for the program, and loads its segments into the process'
+ * address space.  The ELF header and the program header table are read together, and the
+ * pages of a segment that must be loaded now are read in runs, straight into their frames.
+ * @param entry_point Updated with the program's entry point
+ * @return Returns the new process, or NULL if the program could not be loaded.
+ */
+Process *ElfLoader::load_image(uint64_t& entry_point)
+{
+	uint8_t *headers = new (HeapArena::ELF) uint8_t[ELF_HEADER_READ_SIZE];
+	int bytes = _file.pread(headers, ELF_HEADER_READ_SIZE, 0);
+
+	Process *np = NULL;
+	if (bytes >= (int)sizeof(ELF64Header))
+	{
+		np = load_image(headers, bytes, entry_point);
+	}
+	else
 	{
 		elf_log.messagef(LogLevel::DEBUG, "Unable to read ELF header");
-		return NULL;
 	}
 
+	delete[] headers;
+	return np;
+}
+
+Process *ElfLoader::load_image(uint8_t *headers, size_t headers_size, uint64_t& entry_point)
+{
+	ELF64Header hdr;
+	memcpy(&hdr, headers, sizeof(hdr));
+
 	if (hdr.ident.magic_number != MAGIC_NUMBER)
 	{
 		elf_log.messagef(LogLevel::DEBUG, "Invalid ELF magic number %x", hdr.ident.magic_number);
@@ -83,22 +414,53 @@ Process *ElfLoader::load(const String &cmdline)
 		return NULL;
 	}
 
-	bool use_interp = false;
-
-	Process *np = new Process("user", false, (Thread::thread_proc_t)hdr.entry_point, &_file);
-	for (unsigned int i = 0; i < hdr.phnum; i++)
+	if (hdr.phnum && hdr.phentsize < sizeof(ELF64ProgramHeaderEntry))
 	{
-		ELF64ProgramHeaderEntry ent;
+		elf_log.message(LogLevel::DEBUG, "Invalid PH entry size");
+		return NULL;
+	}
 
-		off_t off = hdr.phoff + (i * hdr.phentsize);
-		if (_file.pread(&ent, sizeof(ent), off) != sizeof(ent))
+	// The program header table is nearly always in what has been read already.  If it
+	// isn't, it is read in one go.
+	size_t ph_size = (size_t)hdr.phnum * hdr.phentsize;
+	uint8_t *ph_table = NULL;
+	const uint8_t *phdrs;
+
+	if (hdr.phoff <= headers_size && ph_size <= headers_size - hdr.phoff)
+	{
+		phdrs = headers + hdr.phoff;
+	}
+	else
+	{
+		ph_table = new (HeapArena::ELF) uint8_t[ph_size];
+		if (_file.pread(ph_table, ph_size, hdr.phoff) != (int)ph_size)
 		{
-			delete np;
+			delete[] ph_table;
 
 			elf_log.message(LogLevel::DEBUG, "Unable to read PH entry");
 			return NULL;
 		}
 
+		phdrs = ph_table;
+	}
+
+	Process *np = load_segments(hdr, phdrs);
+	if (ph_table) delete[] ph_table;
+
+	if (np) entry_point = hdr.entry_point;
+	return np;
+}
+
+Process *ElfLoader::load_segments(const ELF64Header& hdr, const uint8_t *phdrs)
+{
+	bool use_interp = false;
+
+	Process *np = new Process("user", false, (Thread::thread_proc_t)hdr.entry_point, &_file);
+	for (unsigned int i = 0; i < hdr.phnum; i++)
+	{
+		ELF64ProgramHeaderEntry ent;
+		memcpy(&ent, phdrs + (i * hdr.phentsize), sizeof(ent));
+
 		switch (ent.type)
 		{
 		case ProgramHeaderEntryType::PT_LOAD:
@@ -127,99 +489,72 @@ Process *ElfLoader::load(const String &cmdline)
 			 * be aligned to a page boundary. They do, however, have
 			 * to be congruent modulo the page size, i.e. start at the
 			 * same offset within a page. Also note that memsz does not
-			 * have to be a whole number of pages. So the following code
-			 * handles the various cases of how the segment boundaries
-			 * may line up with the page boundaries.
+			 * have to be a whole number of pages.
+			 *
+			 * Pages that are wholly file data (with exec.lazy=1), or hold only zeroes
+			 * of this segment (with exec.lazy-bss=1), are left to be demand-paged in on
+			 * first touch, so that BSS that is never touched never gets a frame.  The rest (the pages at either end of
+			 * the file data, which it only partly covers, and any that couldn't be
+			 * deferred) are loaded now.  Runs of those that follow on from one
+			 * another are read with one request each, straight into their frames;
+			 * the zero part needs no copying, because allocate_virt gives us
+			 * zero-initialized pages.
 			 */
 			uintptr_t file_end_vaddr = ent.vaddr + ent.filesz;
+			uintptr_t run_start = 0, run_end = 0;
+			unsigned int run_pages = 0;
+
 			uintptr_t nextpage_vaddr = __align_down_page(ent.vaddr + __page_size);
 			// for each page that any part of this segment overlaps...
 			for (uintptr_t current_vaddr = ent.vaddr;
 			        current_vaddr < ent.vaddr + ent.memsz;
 			        current_vaddr = nextpage_vaddr, nextpage_vaddr += __page_size)
 			{
-				// we always allocate a page backed by real memory, but we may
-				// have done it last time around the loop, so test is_mapped()
-				if (!np->vma().is_mapped(current_vaddr))
-				{
-					/* Use -1 to mean "default permissions" */
-					np->vma().allocate_virt(current_vaddr, /* one page */ 1, -1);
-				}
-				// figure out the size and file offset of our copy (if needed)
-				size_t sz;
-				unsigned long offset;
-				if (current_vaddr % __page_size == 0
-					&& nextpage_vaddr <= file_end_vaddr)
+				// A zero page that the segment starts part way into is deferred too, unless
+				// something else has been loaded into the first part of it already.
+				bool deferred = false;
+				uintptr_t current_page = __align_down_page(current_vaddr);
+				if (!np->vma().is_mapped(current_page)
+					&& ((lazy_exec && current_vaddr == current_page && nextpage_vaddr <= file_end_vaddr)
+						|| (lazy_bss && current_vaddr >= file_end_vaddr)))
 				{
-					/* Easy case: here we need a whole page of data from the file.
-					  . . . v . . . v . . . v . . . v . . . v
-					   - - -:XXXXXXX:
-					  ' ' ' ^ ' ' ' ^ ' ' ' ^ ' ' ' ^ ' ' ' ^
-					*/
-					sz = __page_size;
-					offset = ent.offset + (current_vaddr - ent.vaddr);
+					deferred = defer_page(*np, ent, current_page, current_vaddr >= file_end_vaddr);
 				}
-				else if (current_vaddr == ent.vaddr && nextpage_vaddr <= file_end_vaddr)
+
+				// A page to load now carries on the run if it follows straight on from
+				// it; anything else ends the run.
+				bool load_now = !deferred && current_vaddr < file_end_vaddr;
+				if (run_pages && (!load_now || current_vaddr != run_end || run_pages == ELF_LOAD_MAX_VEC))
 				{
-					offset = ent.offset;
-					/* This case is only hit the first time around the loop, and
-					 * then only if ent.vaddr is not page-aligned. We know that
-					 * current_vaddr is itself not page-aligned, therefore.
-					 * Also, since we have nextpage_vaddr <= file_end_vaddr, it
-					 * means the file data fills this page and may continue into a next page.
-					 * This time around the loop, just copy just the part
-					 * in this page. */
-					sz = __align_up_page(ent.vaddr) - ent.vaddr;
-					/*        .current_vaddr
-					  . . .v .|. . v . . . v . . . v . . . v . . .
-					          |XXXX:- -
-					       ^ ' ' ' ^ ' ' ' ^ ' ' ' ^ ' ' ' ^ ' ' '
-					*/
+					if (!load_pages(*np, _file, ent, run_start, run_end)) goto load_error;
+					run_pages = 0;
 				}
-				else if (current_vaddr >= file_end_vaddr)
+
+				if (load_now)
 				{
-					// we're after the end of file data... this part needs to be
-					// zero-initialized, but allocate_virt gives us zero-initialized
-					// pages, so there is no copying to do!
-
-					/*       .--zeroes may or may not start or end at page boundary
-					  . . .v . . . v . . . v . . . v . . . v . . .
-					         :0000:
-					  ' ' '^ ' ' ' ^ ' ' ' ^ ' ' ' ^ ' ' ' ^ ' ' '
-					 */
-					continue;
+					if (!run_pages) run_start = current_vaddr;
+					run_end = __min(nextpage_vaddr, file_end_vaddr);
+					run_pages++;
 				}
-				else
+				else if (!deferred && !np->vma().is_mapped(__align_down_page(current_vaddr)))
 				{
-					// last page with file data, not a whole page
-					/*     .current_vaddr
-					  . . .v . . . v . . . v . . . v . . . v . . .
-					       |XXXX|
-					  ' ' '^ ' ' ' ^ ' ' ' ^ ' ' ' ^ ' ' ' ^ ' ' '
-					*/
-					assert(current_vaddr < file_end_vaddr);
-					assert(nextpage_vaddr > file_end_vaddr);
-					sz = file_end_vaddr - current_vaddr;
-					offset = ent.offset + (current_vaddr - ent.vaddr);
+					// Zeroes that share no page with file data, but couldn't be deferred.
+					np->vma().allocate_virt(__align_down_page(current_vaddr), /* one page */ 1, -1);
 				}
-				/* Now we know the size and offset of the file data for this page,
-				 * we can copy the data in. */
-				char *buffer = new char[sz];
-				_file.pread(buffer, sz, offset);
-				np->vma().copy_to(current_vaddr, buffer, sz);
-				delete buffer;
 			}
+
+			if (run_pages && !load_pages(*np, _file, ent, run_start, run_end)) goto load_error;
 		} // end case PT_LOAD
 		break;
 
 		case ProgramHeaderEntryType::PT_INTERP:
 		{
-			char *buffer = new char[ent.filesz];
+			char *buffer = new (HeapArena::ELF) char[ent.filesz];
 			_file.pread(buffer, ent.filesz, ent.offset);
 
 			if (strncmp(buffer, "__INFOS_DYNAMIC_LINKER__", ent.filesz) != 0)
 			{
-				delete buffer;
+				delete[] buffer;
 				delete np;
 
 				elf_log.message(LogLevel::DEBUG, "Unsupported ELF interpreter");
@@ -227,7 +562,7 @@ Process *ElfLoader::load(const String &cmdline)
 			}
 
 			syslog.messagef(LogLevel::DEBUG, "Interp: %s", buffer);
-			delete buffer;
+			delete[] buffer;
 
 			use_interp = true;
 		}
@@ -243,24 +578,11 @@ Process *ElfLoader::load(const String &cmdline)
 		return NULL;
 	}
 
-	np->main_thread().allocate_user_stack(0x100000, 0x2000);
-
-	if (cmdline.length() > 0)
-	{
-		virt_addr_t cmdline_start = 0x102000;
-		np->vma().allocate_virt(cmdline_start, 1);
-
-		if (!np->vma().copy_to(cmdline_start, cmdline.c_str(), cmdline.length()))
-		{
-			return NULL;
-		}
+	return np;
 
-		np->main_thread().add_entry_argument((void *)cmdline_start);
-	}
-	else
-	{
-		np->main_thread().add_entry_argument(NULL);
-	}
+load_error:
+	delete np;
 
-	return np;
+	elf_log.message(LogLevel::DEBUG, "Unable to load segment");
+	return NULL;
 }
@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * fs/file.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/fs/file.h>
+#include <infos/kernel/thread.h>
+#include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
+
+using namespace infos::fs;
+using namespace infos::kernel;
+using namespace infos::util;
+
+/* Threads polling files, keyed by where the files' readiness comes from. */
+static WakeQueue pollers;
+
+unsigned int File::poll_any(File *const *files, const unsigned int *events, unsigned int *ready, unsigned int count, bool wait)
+{
+	assert(count <= WakeQueue::MAX_SLEEP_KEYS);
+
+	WakeQueue::Key keys[WakeQueue::MAX_SLEEP_KEYS];
+	unsigned int nr_keys = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		const void *source = files[i]->poll_source();
+		if (source) {
+			keys[nr_keys].object = source;
+			keys[nr_keys].offset = 0;
+			nr_keys++;
+		}
+	}
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(pollers.lock());
+
+	// Readiness is checked under the lock that wake_pollers() takes, so a change between
+	// the check and going to sleep still wakes the thread.
+	for (;;) {
+		unsigned int nr_ready = 0;
+		for (unsigned int i = 0; i < count; i++) {
+			ready[i] = files[i]->poll() & events[i];
+			if (ready[i]) nr_ready++;
+		}
+
+		if (nr_ready || !wait || !nr_keys) return nr_ready;
+
+		pollers.sleep_any_locked(Thread::current(), keys, nr_keys);
+	}
+}
+
+void File::wake_pollers(const void *source)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(pollers.lock());
+
+	WakeQueue::Key key = { source, 0 };
+	pollers.wake_key_locked(key, ~0u);
+}
+
+/*
+ * By default, a vectored transfer is a transfer per buffer, which stops at the first one
+ * that comes up short.  Files that can do better (e.g. with one device transfer) override
+ * these.
+ */
+
+int File::readv(const IOVec *vec, unsigned int count)
+{
+	size_t done = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		int n = read(vec[i].base, vec[i].size);
+		if (n < 0) return done ? (int)done : n;
+
+		done += n;
+		if ((size_t)n < vec[i].size) break;
+	}
+
+	return (int)done;
+}
+
+int File::preadv(const IOVec *vec, unsigned int count, off_t off)
+{
+	size_t done = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		int n = pread(vec[i].base, vec[i].size, off + done);
+		if (n < 0) return done ? (int)done : n;
+
+		done += n;
+		if ((size_t)n < vec[i].size) break;
+	}
+
+	return (int)done;
+}
+
+int File::writev(const IOVec *vec, unsigned int count)
+{
+	size_t done = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		int n = write(vec[i].base, vec[i].size);
+		if (n < 0) return done ? (int)done : n;
+
+		done += n;
+		if ((size_t)n < vec[i].size) break;
+	}
+
+	return (int)done;
+}
+
+int File::pwritev(const IOVec *vec, unsigned int count, off_t off)
+{
+	size_t done = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		int n = pwrite(vec[i].base, vec[i].size, off + done);
+		if (n < 0) return done ? (int)done : n;
+
+		done += n;
+		if ((size_t)n < vec[i].size) break;
+	}
+
+	return (int)done;
+}
+
+// send_to() moves data through a kernel buffer this many bytes at a time.
+#define SEND_BUFFER_SIZE	0x1000
+
+/*
+ * By default, sending data is reading it into a kernel buffer and writing it out again.
+ * Files whose data is already in memory (e.g. in the page cache) override this, to write
+ * it out from where it is.
+ */
+int File::send_to(File& out, size_t size, off_t off)
+{
+	if (size == 0) return 0;
+
+	uint8_t *buffer = new uint8_t[__min(size, SEND_BUFFER_SIZE)];
+	if (!buffer) return -1;
+
+	size_t done = 0;
+	while (done < size) {
+		size_t chunk = __min(size - done, SEND_BUFFER_SIZE);
+
+		int n = pread(buffer, chunk, off + done);
+		if (n > 0) n = out.write(buffer, n);
+
+		if (n < 0) {
+			delete[] buffer;
+			return done ? (int)done : n;
+		}
+
+		done += n;
+		if ((size_t)n < chunk) break;
+	}
+
+	delete[] buffer;
+	return (int)done;
+}
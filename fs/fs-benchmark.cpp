@@ -0,0 +1,248 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * fs/fs-benchmark.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/benchmark.h>
+#include <infos/kernel/kernel.h>
+#include <infos/fs/vfs.h>
+#include <infos/fs/vfs-node.h>
+#include <infos/fs/file.h>
+#include <infos/fs/directory.h>
+#include <infos/fs/page-cache.h>
+#include <infos/drivers/block/block-cache.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::fs;
+using namespace infos::util;
+using namespace infos::drivers::block;
+
+/*
+ * Reading a file through the VFS, looking paths up, and listing a directory.  The reads are
+ * of the file given by bench.file=, on the boot filesystem, 4 KiB at a time, so the results
+ * are in cycles per 4 KiB.  The cold ones drop the page cache and the block caches before
+ * every repetition, so they read from the device, and the warm ones read what the previous
+ * repetition left in the caches.
+ */
+
+#define READ_SIZE		4096
+
+// The path of a file to read, e.g. /usr/init.
+static char bench_file[64];
+
+RegisterCmdLineArgument(BenchFile, "bench.file")
+{
+	strncpy(bench_file, value, sizeof(bench_file) - 1);
+}
+
+static uint8_t read_buffer[READ_SIZE];
+static uint64_t rng_state;
+
+static uint64_t next_random()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+
+	return rng_state;
+}
+
+static void drop_caches()
+{
+	page_cache.drop();
+	BlockCache::drop_all();
+}
+
+static void close_file(File *file)
+{
+	file->close();
+	delete file;
+}
+
+// How many whole reads there are in the file, worked out the first time it is opened.
+static unsigned int bench_file_reads;
+
+/* Opens the file given by bench.file=, without timing it, and gives how many whole reads
+ * there are in it.  Returns NULL, having skipped the benchmark, if it can't. */
+static File *open_bench_file(unsigned int& nr_reads)
+{
+	benchmark_pause();
+
+	if (!bench_file[0]) {
+		benchmark_skip("no file given with bench.file=");
+		return NULL;
+	}
+
+	File *file = sys.vfs().open(bench_file, 0);
+	if (!file) {
+		benchmark_skip("the file given with bench.file= couldn't be opened");
+		return NULL;
+	}
+
+	if (!bench_file_reads) {
+		while (file->pread(read_buffer, READ_SIZE, (off_t)bench_file_reads * READ_SIZE) == READ_SIZE) {
+			bench_file_reads++;
+		}
+	}
+
+	nr_reads = bench_file_reads;
+	if (!nr_reads) {
+		close_file(file);
+		benchmark_skip("the file given with bench.file= is smaller than one read");
+		return NULL;
+	}
+
+	benchmark_resume();
+	return file;
+}
+
+static void read_sequential(unsigned int iterations, bool cold)
+{
+	unsigned int nr_reads;
+	File *file = open_bench_file(nr_reads);
+	if (!file) return;
+
+	if (cold) {
+		benchmark_pause();
+		drop_caches();
+		benchmark_resume();
+	}
+
+	for (unsigned int i = 0; i < iterations; i++) {
+		file->pread(read_buffer, READ_SIZE, (off_t)(i % nr_reads) * READ_SIZE);
+	}
+
+	benchmark_pause();
+	close_file(file);
+	benchmark_resume();
+}
+
+static void read_random(unsigned int iterations, bool cold)
+{
+	unsigned int nr_reads;
+	File *file = open_bench_file(nr_reads);
+	if (!file) return;
+
+	if (cold) {
+		benchmark_pause();
+		drop_caches();
+		benchmark_resume();
+	}
+
+	// The same offsets every repetition, so that the warm runs find them cached.
+	rng_state = 0x2545f4914f6cdd1dull;
+	for (unsigned int i = 0; i < iterations; i++) {
+		file->pread(read_buffer, READ_SIZE, (off_t)(next_random() % nr_reads) * READ_SIZE);
+	}
+
+	benchmark_pause();
+	close_file(file);
+	benchmark_resume();
+}
+
+RegisterBenchmark(ReadSequentialCold, "fs.read-seq-cold", 64)
+{
+	read_sequential(iterations, true);
+}
+
+RegisterBenchmark(ReadSequentialWarm, "fs.read-seq-warm", 64)
+{
+	read_sequential(iterations, false);
+}
+
+RegisterBenchmark(ReadRandomCold, "fs.read-random-cold", 64)
+{
+	read_random(iterations, true);
+}
+
+RegisterBenchmark(ReadRandomWarm, "fs.read-random-warm", 64)
+{
+	read_random(iterations, false);
+}
+
+/*
+ * Path lookups in a tree of directories that the benchmark makes on the tmpfs root, so that
+ * they measure the VFS, rather than a filesystem's lookups.
+ */
+#define DEEP_PATH_DEPTH		8
+
+static const char *shallow_path = "/bench";
+static const char *deep_path = "/bench/a/b/c/d/e/f/g";
+
+static bool make_lookup_tree()
+{
+	static bool made;
+	if (made) return true;
+
+	VFSNode *node = sys.vfs().lookup_node("/");
+	if (!node) return false;
+
+	// The components of deep_path.
+	const char *names[DEEP_PATH_DEPTH] = { "bench", "a", "b", "c", "d", "e", "f", "g" };
+
+	for (unsigned int i = 0; i < DEEP_PATH_DEPTH; i++) {
+		VFSNode *child = node->get_child(names[i]);
+		if (!child) child = node->mkdir(names[i]);
+		if (!child) return false;
+
+		node = child;
+	}
+
+	made = true;
+	return true;
+}
+
+static void lookup(unsigned int iterations, const char *path)
+{
+	benchmark_pause();
+	bool made = make_lookup_tree();
+	benchmark_resume();
+
+	if (!made) {
+		benchmark_skip("the directories to look up couldn't be made");
+		return;
+	}
+
+	String p(path);
+	for (unsigned int i = 0; i < iterations; i++) {
+		sys.vfs().lookup_node(p);
+	}
+}
+
+RegisterBenchmark(LookupShallow, "fs.lookup-shallow", 256)
+{
+	lookup(iterations, shallow_path);
+}
+
+RegisterBenchmark(LookupDeep, "fs.lookup-deep", 256)
+{
+	lookup(iterations, deep_path);
+}
+
+/*
+ * Listing the root of the boot filesystem, which is the same each time, so after the first
+ * it comes from the caches.
+ */
+RegisterBenchmark(ListDirectory, "fs.readdir-usr", 16)
+{
+	for (unsigned int i = 0; i < iterations; i++) {
+		Directory *dir = sys.vfs().opendir("/usr", 0);
+		if (!dir) {
+			benchmark_skip("/usr couldn't be opened");
+			return;
+		}
+
+		DirectoryEntry entry;
+		while (dir->read_entry(entry));
+
+		dir->close();
+		delete dir;
+	}
+}
@@ -0,0 +1,308 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * fs/initramfs.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/fs/initramfs.h>
+#include <infos/util/string.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
+#include <infos/mm/object-allocator.h>
+
+using namespace infos::fs;
+using namespace infos::util;
+using namespace infos::kernel;
+using namespace infos::mm;
+
+static const uint8_t *initramfs_image;
+static size_t initramfs_size;
+
+bool infos::fs::initramfs_set_image(const void *image, size_t size)
+{
+	if (initramfs_image) return false;
+
+	initramfs_image = (const uint8_t *)image;
+	initramfs_size = size;
+	return true;
+}
+
+bool infos::fs::initramfs_present()
+{
+	return initramfs_image != NULL;
+}
+
+/*
+ * A "newc" cpio archive is a series of entries, each a header of hex fields in ASCII,
+ * the entry's name (with its NUL), and its data, with the name and the data each padded
+ * to four bytes.  It ends with an entry called TRAILER!!!.
+ */
+struct CpioHeader
+{
+	char magic[6];
+	char ino[8];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char nlink[8];
+	char mtime[8];
+	char filesize[8];
+	char devmajor[8];
+	char devminor[8];
+	char rdevmajor[8];
+	char rdevminor[8];
+	char namesize[8];
+	char check[8];
+} __packed;
+
+#define CPIO_MODE_TYPE		0170000
+#define CPIO_MODE_DIR		0040000
+#define CPIO_MODE_REG		0100000
+
+// "070701", or "070702" if the archive has checksums (which aren't checked).
+static bool is_cpio_magic(const char *magic)
+{
+	for (unsigned int i = 0; i < 5; i++) {
+		if (magic[i] != "07070"[i]) return false;
+	}
+
+	return magic[5] == '1' || magic[5] == '2';
+}
+
+static bool parse_hex(const char *field, uint32_t& value)
+{
+	value = 0;
+	for (unsigned int i = 0; i < 8; i++) {
+		char c = field[i];
+
+		value <<= 4;
+		if (c >= '0' && c <= '9') value |= c - '0';
+		else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+		else return false;
+	}
+
+	return true;
+}
+
+static size_t align4(size_t offset)
+{
+	return (offset + 3) & ~(size_t)3;
+}
+
+/**
+ * Puts an entry of the archive in the tree, making the directories on its path that
+ * the archive didn't have entries for.  Anything that isn't a directory or a regular
+ * file is left out.
+ */
+static bool add_archive_entry(InitRamFSNode& root, const char *path, uint32_t mode, const uint8_t *data, size_t size)
+{
+	uint32_t type = mode & CPIO_MODE_TYPE;
+	if (type != CPIO_MODE_DIR && type != CPIO_MODE_REG) {
+		fs_log.messagef(LogLevel::DEBUG, "initramfs: skipping '%s', which isn't a file or a directory", path);
+		return true;
+	}
+
+	InitRamFSNode *node = &root;
+	while (*path) {
+		// Leading slashes, doubled slashes and "." components don't name anything.
+		if (*path == '/') {
+			path++;
+			continue;
+		}
+
+		const char *end = path;
+		while (*end && *end != '/') end++;
+
+		String component(path, end - path);
+		path = end;
+
+		if (component == ".") continue;
+
+		bool last = true;
+		for (const char *p = path; *p; p++) {
+			if (*p != '/') {
+				last = false;
+				break;
+			}
+		}
+
+		InitRamFSNode *child = (InitRamFSNode *)node->get_child(component);
+		if (!child) {
+			if (last && type == CPIO_MODE_REG) {
+				child = node->add_child(component, data, size, false);
+			} else {
+				child = node->add_child(component, NULL, 0, true);
+			}
+
+			if (!child) return false;
+		} else if (!child->is_directory() || (last && type == CPIO_MODE_REG)) {
+			fs_log.messagef(LogLevel::WARNING, "initramfs: '%s' is in the archive more than once", component.c_str());
+			return true;
+		}
+
+		node = child;
+	}
+
+	return true;
+}
+
+PFSNode *InitRamFS::mount()
+{
+	InitRamFSNode *root = new (HeapArena::VFS) InitRamFSNode(*this, "");
+	if (!root) return NULL;
+
+	unsigned int nr_files = 0;
+
+	size_t offset = 0;
+	while (offset + sizeof(CpioHeader) <= _size) {
+		const CpioHeader *header = (const CpioHeader *)(_image + offset);
+
+		if (!is_cpio_magic(header->magic)) {
+			fs_log.messagef(LogLevel::ERROR, "initramfs: no cpio header at offset %lu", offset);
+			break;
+		}
+
+		uint32_t mode, filesize, namesize;
+		if (!parse_hex(header->mode, mode) || !parse_hex(header->filesize, filesize) || !parse_hex(header->namesize, namesize)) {
+			fs_log.messagef(LogLevel::ERROR, "initramfs: bad cpio header at offset %lu", offset);
+			break;
+		}
+
+		size_t name_offset = offset + sizeof(CpioHeader);
+		size_t data_offset = align4(name_offset + namesize);
+
+		if (namesize == 0 || data_offset > _size || filesize > _size - data_offset || _image[name_offset + namesize - 1]) {
+			fs_log.messagef(LogLevel::ERROR, "initramfs: cpio entry at offset %lu runs off the end of the archive", offset);
+			break;
+		}
+
+		const char *name = (const char *)(_image + name_offset);
+		if (strcmp(name, "TRAILER!!!") == 0) {
+			fs_log.messagef(LogLevel::INFO, "initramfs: %u files, %lu bytes", nr_files, _size);
+			return root;
+		}
+
+		if (!add_archive_entry(*root, name, mode, _image + data_offset, filesize)) {
+			fs_log.messagef(LogLevel::ERROR, "initramfs: unable to add '%s'", name);
+			break;
+		}
+
+		if ((mode & CPIO_MODE_TYPE) == CPIO_MODE_REG) nr_files++;
+		offset = align4(data_offset + filesize);
+	}
+
+	// A damaged archive isn't mounted at all, rather than mounted with files missing.
+	fs_log.message(LogLevel::ERROR, "initramfs: the archive is damaged, or has no trailer");
+	delete root;
+
+	return NULL;
+}
+
+InitRamFSNode::InitRamFSNode(InitRamFS& owner, const util::String& name, const uint8_t *data, size_t size, bool directory)
+	: PFSNode(NULL, owner), _name(name), _directory(directory), _data(data), _size(size)
+{
+
+}
+
+InitRamFSNode::~InitRamFSNode()
+{
+	for (InitRamFSNode *child : _children) {
+		delete child;
+	}
+}
+
+PFSNode* InitRamFSNode::get_child(const util::String& name)
+{
+	if (!_directory) return NULL;
+	return _children.find(name);
+}
+
+InitRamFSNode *InitRamFSNode::add_child(const util::String& name, const uint8_t *data, size_t size, bool directory)
+{
+	InitRamFSNode *child = new (HeapArena::VFS) InitRamFSNode((InitRamFS &)owner(), name, data, size, directory);
+	if (!child) return NULL;
+
+	if (!_children.add(child)) {
+		delete child;
+		return NULL;
+	}
+
+	return child;
+}
+
+File* InitRamFSNode::open()
+{
+	if (_directory) return NULL;
+	return new (HeapArena::VFS) InitRamFSFile(*this);
+}
+
+Directory* InitRamFSNode::opendir()
+{
+	if (!_directory) return NULL;
+	return new (HeapArena::VFS) InitRamFSDirectory(*this);
+}
+
+InitRamFSDirectory::InitRamFSDirectory(InitRamFSNode& node)
+{
+	for (InitRamFSNode *child : node.children()) {
+		DirectoryEntry de;
+		de.name = child->name();
+		de.size = child->size();
+
+		add_entry(de);
+	}
+}
+
+int InitRamFSFile::read(void *buffer, size_t size)
+{
+	int n = pread(buffer, size, _pos);
+	if (n > 0) _pos += n;
+
+	return n;
+}
+
+/**
+ * Copies straight out of the archive: the only copy of the data there is.
+ */
+int InitRamFSFile::pread(void *buffer, size_t size, off_t off)
+{
+	if (off < 0 || (size_t)off >= _node.size()) return 0;
+
+	size = __min(size, _node.size() - (size_t)off);
+	memcpy(buffer, _node.data() + off, size);
+
+	return (int)size;
+}
+
+void InitRamFSFile::seek(off_t offset, SeekType type)
+{
+	if (type == SeekAbsolute) {
+		_pos = offset;
+	} else if (type == SeekRelative) {
+		_pos += offset;
+	}
+}
+
+bool InitRamFSFile::identity(FileIdentity& id) const
+{
+	id.object = &_node;
+	id.version = 0;
+	return true;
+}
+
+static Filesystem *initramfs_create(VirtualFilesystem& vfs, infos::drivers::Device *dev)
+{
+	if (!initramfs_image) {
+		fs_log.message(LogLevel::ERROR, "initramfs: no archive was given to the kernel");
+		return NULL;
+	}
+
+	return new (HeapArena::VFS) InitRamFS(initramfs_image, initramfs_size);
+}
+
+RegisterFilesystem(initramfs, initramfs_create);
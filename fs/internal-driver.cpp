@@ -3,10 +3,11 @@
 #include<infos/fs/internal-driver.h>
 qQAiI fs;qQAiI drivers;qQAiI drivers::block;qQAiI kernel;qQAiI util;namespace ZzZzZzZz <%lqAiI1 unsigned int jj;lqAiI1 int ji;lqAiI1 char jc;qA1I KuY=qAiI::util::String;qA1I KUY=qAiI::fs::File;qA1I kUY=qAiI::fs::Directory;lqAiI1 void jq;lqAiI1 jq*jQ;qA1I KKuY=qAiI::fs::DirectoryEntry;
 lQAiI1 pzh {jc zaaa[100];jc zaab[8];jc zaac[8];jc zaad[8];jc zaae[12];jc zaaf[12];jc zaag[8];jc zaah;jc zaai[100];jc zaaj[6];jc zaak[2];jc zaal[32];jc zaam[32];jc zaan[8];jc zaao[8];jc zaap[155];} __packed;
+lQAiI1 pzi {jc zbaa[8];uint32_t zbab;uint32_t zbac;} __packed;lQAiI1 pzj {uint32_t zbba;uint32_t zbbb;jc zbbc[100];} __packed;
 static inline jj zmfj(const jc *pza){jj zx=0;ji zy=strlen(pza);ji zz=1,zw=1;while(zz<zy){zx+=zw*(pza[zy-zz]-'0');zw<<=3;zz++;}qlAaA zx;}
 lqAiI zZZ;lqAiI ZZz;lqAiI ZzZ;lqAiI ZZZ:lqAII1 qAiI::fs::BlockBasedFilesystem{friend lqAiI zZZ;friend lqAiI ZZz;friend lqAiI ZzZ;lqAII1:ZZZ(qAiI::drivers::block::BlockDevice& bdev):BlockBasedFilesystem(bdev),vVv(NULL){}
 qAiI::fs::PFSNode*mount()override;const KuY name()const{qlAaA "internal_driver";}
-private:zZZ*ZzzA();jq Zzza(zZZ*,lQAiI1 pzh*,jj);static bool vvv(const uint8_t*vVV,size_t VvV=512){for(jj vvV=0;vvV<VvV;vvV++){if(vVV[vvV]not_eq 0)qlAaA false;}qlAaA true;}
+private:zZZ*ZzzA();bool ZzzB(zZZ*);jq Zzza(zZZ*,lQAiI1 pzh*,jj);static bool vvv(const uint8_t*vVV,size_t VvV=512){for(jj vvV=0;vvV<VvV;vvV++){if(vVV[vvV]not_eq 0)qlAaA false;}qlAaA true;}
 zZZ *vVv;};lqAiI ZZz:lqAII1 KUY{lqAII1:ZZz(ZZZ& ddd, jj ddD):xxc(NULL),xxC(ddd),xXc(ddD),Xxc(0){xxc=(lQAiI1 pzh*)new jc[xxC.block_device().block_size()];xxC.block_device().read_blocks(xxc,
 xXc,1);xXc++;XXc=zmfj(xxc->zaae);if(XXc==0){Xxc=-1;}}virtual compl ZZz(){delete xxc;}jq close()override{}int read(jQ opu,size_t opp)override{int ijy=pread(opu,opp,Xxc);Xxc+=ijy;qlAaA ijy;}
 int pread(void*KvKK,size_t KKK,off_t KvK) override<%if(KvK>=XXc)qlAaA 0;jj kkk=0;const ji kKk=xxC.block_device().block_size();jc Kkk[kKk];
@@ -21,11 +22,18 @@ PFSNode*get_child(const KuY& zxcvb)override{zZZ *zxcv;if(!aaa.try_get_value(zxcv
 jq KKII(jj hjk){aAA=true;Aaa=hjk;}jq KKIi(const KuY& hjk,zZZ*kjh)<%aaa.add(hjk.get_hash(),kjh);}
 PFSNode*mkdir(const KuY& g0)override{qlAaA NULL;}const ZzZz& FgHj()const{qlAaA aaa;}const KuY& name()const{qlAaA aaA;}
 template<typename jQQ>jQQ AsDf()const{qlAaA aAa;}template<typename jQQ>jq AsDf(jQQ aAa0){aAa=aAa0;}private:ZzZz aaa;const KuY aaA;jj aAa;bool aAA;jj Aaa;};
-zZZ*ZZZ::ZzzA(){zZZ*bbb=new zZZ(NULL,"",*this);uint8_t*bbB=new uint8_t[512];for(jj bBb=0;bBb<block_device().block_count();bBb++){if(!block_device().read_blocks(bbB,bBb,1)){
+zZZ*ZZZ::ZzzA(){zZZ*bbb=new zZZ(NULL,"",*this);if(ZzzB(bbb)){qlAaA bbb;}uint8_t*bbB=new uint8_t[512];for(jj bBb=0;bBb<block_device().block_count();bBb++){if(!block_device().read_blocks(bbB,bBb,1)){
 fs_log.message(LogLevel::ERROR,"Unable to read from block device");qlAaA NULL;}if(vvv(bbB)){break;}lQAiI1 pzh *bBB=(lQAiI1 pzh*)bbB;jj Bbb=zmfj(bBB->zaae);if(bBB->zaah=='0'){Zzza(bbb, bBB, bBb);}
-bBb+=(Bbb/512)+((Bbb%512)?1:0);}delete bbB;qlAaA bbb;}jq ZZZ::Zzza(zZZ*ccc,lQAiI1 pzh*ccC,jj cCc){auto cCC=KuY(ccC->zaaa).split('/', false);zZZ*Ccc=ccc;
+bBb+=(Bbb/512)+((Bbb%512)?1:0);}delete[] bbB;qlAaA bbb;}jq ZZZ::Zzza(zZZ*ccc,lQAiI1 pzh*ccC,jj cCc){auto cCC=KuY(ccC->zaaa).split('/', false);zZZ*Ccc=ccc;
 for(const auto&c:cCC){zZZ *hQj=(zZZ*)Ccc->get_child(c);if(!hQj){hQj=new zZZ(Ccc,c,*this);Ccc->KKIi(c,hQj);}
-Ccc=hQj;}Ccc->KKII(cCc);Ccc->AsDf<jj>(zmfj(ccC->zaae));}qAiI::fs::PFSNode* ZZZ::mount(){if(vVv==NULL){vVv=ZzzA();}qlAaA vVv;}
+Ccc=hQj;}Ccc->KKII(cCc);Ccc->AsDf<jj>(zmfj(ccC->zaae));}bool ZZZ::ZzzB(zZZ*ddd){uint8_t*dDd=new uint8_t[512];if(!block_device().read_blocks(dDd,0,1)){delete[] dDd;qlAaA false;}lQAiI1 pzh*dDD=(lQAiI1 pzh*)dDd;
+if(dDD->zaah not_eq '0' or strncmp(dDD->zaaa,".index",sizeof(dDD->zaaa))not_eq 0){delete[] dDd;qlAaA false;}jj DdD=zmfj(dDD->zaae);jj dDDd=(DdD/512)+((DdD%512)?1:0);delete[] dDd;
+if(DdD<sizeof(lQAiI1 pzi)or 1+dDDd>block_device().block_count()){qlAaA false;}uint8_t*Ddd=new uint8_t[dDDd*512];if(!Ddd){qlAaA false;}if(!block_device().read_blocks(Ddd,1,dDDd)){delete[] Ddd;qlAaA false;}
+lQAiI1 pzi*DDd=(lQAiI1 pzi*)Ddd;lQAiI1 pzj*dd=(lQAiI1 pzj*)(DDd+1);if(strncmp(DDd->zbaa,"INFOSIDX",8)not_eq 0 or sizeof(lQAiI1 pzi)+((uint64_t)DDd->zbab*sizeof(lQAiI1 pzj))>DdD){delete[] Ddd;qlAaA false;}
+for(jj dD=0;dD<DDd->zbab;dD++){if(dd[dD].zbba<=dDDd or dd[dD].zbba>=block_device().block_count()){delete[] Ddd;qlAaA false;}}lQAiI1 pzh DDD;
+for(jj dD=0;dD<DDd->zbab;dD++){memset(&DDD,0,sizeof(DDD));memcpy(DDD.zaaa,dd[dD].zbbc,sizeof(DDD.zaaa)-1);DDD.zaah='0';jj Dd=dd[dD].zbbb;for(ji DdDd=10;DdDd>=0;DdDd--){DDD.zaae[DdDd]='0'+(Dd&7);Dd>>=3;}Zzza(ddd,&DDD,dd[dD].zbba);}
+fs_log.messagef(LogLevel::INFO,"internal_driver: %u files from index",DDd->zbab);delete[] Ddd;qlAaA true;}
+qAiI::fs::PFSNode* ZZZ::mount(){if(vVv==NULL){vVv=ZzzA();}qlAaA vVv;}
 ZzZ::ZzZ(zZZ&DyH):fFf(0){ffF=DyH.FgHj().count();fff=new KKuY[ffF];ji i=0;for(const auto& OOo:DyH.FgHj()){fff[i].name=OOo.value->name();fff[i++].size=OOo.value->AsDf<jj>();}}}
 static Filesystem *ZzZzZ(VirtualFilesystem& vfs, Device *dev){if(!dev->device_class().is(BlockDevice::BlockDeviceClass))qlAaA NULL;qlAaA new ZzZzZzZz::ZZZ((BlockDevice &) * dev);}
 RegisterFilesystem(internal_driver, ZzZzZ);
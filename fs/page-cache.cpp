@@ -0,0 +1,892 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * fs/page-cache.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/fs/page-cache.h>
+#include <infos/fs/pfs-node.h>
+#include <infos/fs/filesystem.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/text-file.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/thread.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/reclaim.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::fs;
+using namespace infos::mm;
+using namespace infos::drivers;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// How many pages the cache holds before it starts evicting them, by default: 8 MiB.
+#define PAGE_CACHE_DEFAULT_PAGES	2048
+
+// Dirty pages are written back once they have been dirty for this long, in ns, and the
+// writeback thread looks for them this often.
+#define PAGE_CACHE_DIRTY_EXPIRE		5000000000ull
+#define PAGE_CACHE_WRITEBACK_PERIOD	500000000ull
+
+// How much of the cache can be dirty, as a percentage, by default.  Writers that get
+// twice as far ahead of the disk as that write back pages themselves.
+#define PAGE_CACHE_DEFAULT_DIRTY_RATIO	10
+
+static uint64_t page_cache_max_pages = PAGE_CACHE_DEFAULT_PAGES;
+static uint64_t page_cache_dirty_ratio = PAGE_CACHE_DEFAULT_DIRTY_RATIO;
+
+RegisterCmdLineArgument(PageCacheSize, "pagecache.pages") {
+	uint64_t pages = 0;
+	for (const char *c = value; *c >= '0' && *c <= '9'; c++) {
+		pages = (pages * 10) + (*c - '0');
+	}
+
+	PageCache::max_pages(pages);
+}
+
+RegisterCmdLineArgument(PageCacheDirtyRatio, "pagecache.dirty-ratio") {
+	uint64_t percent = 0;
+	for (const char *c = value; *c >= '0' && *c <= '9'; c++) {
+		percent = (percent * 10) + (*c - '0');
+	}
+
+	PageCache::dirty_ratio(percent);
+}
+
+PageCache infos::fs::page_cache;
+
+void PageCache::max_pages(uint64_t max_pages)
+{
+	page_cache_max_pages = max_pages;
+}
+
+void PageCache::dirty_ratio(uint64_t percent)
+{
+	page_cache_dirty_ratio = __min(percent, 100);
+}
+
+PageCache::PageCache()
+	: _lru_head(NULL), _lru_tail(NULL), _nr_pages(0), _nr_hits(0), _nr_misses(0), _nr_evictions(0),
+	  _nr_dirty(0), _nr_written(0), _nr_write_errors(0), _writeback_running(false)
+{
+	for (unsigned int i = 0; i < NR_BUCKETS; i++) {
+		_buckets[i] = NULL;
+	}
+
+	_mtx.set_name("pagecache");
+}
+
+unsigned int PageCache::bucket_of(const PFSNode& node, off_t offset)
+{
+	uint64_t hash = ((uintptr_t)&node ^ ((uint64_t)offset >> __page_bits)) * 0x9e3779b97f4a7c15ull;
+	return (unsigned int)(hash >> 56) % NR_BUCKETS;
+}
+
+PageCache::CachedPage *PageCache::find(const PFSNode& node, off_t offset) const
+{
+	for (CachedPage *page = _buckets[bucket_of(node, offset)]; page; page = page->hash_next) {
+		if (page->node == &node && page->offset == offset) return page;
+	}
+
+	return NULL;
+}
+
+void PageCache::lru_unlink(CachedPage *page)
+{
+	if (page->lru_prev) {
+		page->lru_prev->lru_next = page->lru_next;
+	} else {
+		_lru_head = page->lru_next;
+	}
+
+	if (page->lru_next) {
+		page->lru_next->lru_prev = page->lru_prev;
+	} else {
+		_lru_tail = page->lru_prev;
+	}
+}
+
+void PageCache::lru_push(CachedPage *page)
+{
+	page->lru_prev = NULL;
+	page->lru_next = _lru_head;
+
+	if (_lru_head) {
+		_lru_head->lru_prev = page;
+	} else {
+		_lru_tail = page;
+	}
+
+	_lru_head = page;
+}
+
+/**
+ * Adds an empty page to the cache, with a frame for its data, evicting the least
+ * recently used page if the cache is full.  Called with the lock held.
+ * @return Returns the page, or NULL if there was no frame for it.
+ */
+PageCache::CachedPage *PageCache::insert(const PFSNode& node, off_t offset)
+{
+	while (_nr_pages >= page_cache_max_pages) {
+		if (!evict_one()) return NULL;
+	}
+
+	FrameDescriptor *frame = sys.mm().pgalloc().allocate(0);
+	while (!frame && evict_one()) {
+		frame = sys.mm().pgalloc().allocate(0);
+	}
+
+	if (!frame) return NULL;
+
+	CachedPage *page = new CachedPage();
+	if (!page) {
+		sys.mm().pgalloc().free_one(frame);
+		return NULL;
+	}
+
+	page->node = &node;
+	page->offset = offset;
+	page->frame = frame;
+	page->valid = 0;
+	page->filling = true;
+	page->dropped = false;
+	page->dirty = false;
+	page->writeback = false;
+	page->dirtied_at = 0;
+	page->pins = 0;
+
+	unsigned int bucket = bucket_of(node, offset);
+	page->hash_next = _buckets[bucket];
+	_buckets[bucket] = page;
+
+	lru_push(page);
+	_nr_pages++;
+
+	return page;
+}
+
+/**
+ * Takes a page out of the cache, and frees it.  Called with the lock held.
+ */
+void PageCache::remove(CachedPage *page)
+{
+	CachedPage **link = &_buckets[bucket_of(*page->node, page->offset)];
+	while (*link != page) {
+		link = &(*link)->hash_next;
+	}
+
+	*link = page->hash_next;
+	lru_unlink(page);
+	_nr_pages--;
+
+	// What was written to the page is thrown away, e.g. because the file has been
+	// truncated.
+	if (page->dirty) {
+		page->dirty = false;
+		_nr_dirty--;
+	}
+
+	// Whoever has the page pinned frees it when they are finished with it.
+	if (page->pins) {
+		page->dropped = true;
+		return;
+	}
+
+	sys.mm().pgalloc().free_one(page->frame);
+	delete page;
+}
+
+/**
+ * Evicts the least recently used page that isn't being read in, pinned, or dirty.  Called
+ * with the lock held.
+ * @return Returns true if a page was evicted, or false if there wasn't one to evict.
+ */
+bool PageCache::evict_one()
+{
+	CachedPage *page = _lru_tail;
+	while (page && (page->filling || page->pins || page->dirty)) {
+		page = page->lru_prev;
+	}
+
+	if (!page) return false;
+
+	remove(page);
+	_nr_evictions++;
+
+	return true;
+}
+
+/**
+ * Drops a pin on a page, freeing it if it has left the cache.  Called with the lock held.
+ */
+void PageCache::release(CachedPage *page)
+{
+	if (--page->pins == 0 && page->dropped) {
+		sys.mm().pgalloc().free_one(page->frame);
+		delete page;
+	}
+}
+
+/**
+ * Finds the page of the node's data at an offset, reading it in if it isn't cached (or,
+ * if 'fill' isn't set, leaving it empty), and makes it the most recently used.  Called
+ * with the lock held, which is dropped while the page is read in.
+ * @return Returns the page, or NULL if it couldn't be read (and 'failed' is set), or there
+ * was no room to cache it.
+ */
+PageCache::CachedPage *PageCache::get(const PFSNode& node, File& file, off_t offset, bool& failed, bool fill)
+{
+	failed = false;
+
+	CachedPage *page = find(node, offset);
+	if (page) {
+		_nr_hits++;
+
+		// Another thread is reading the page in: wait for it to finish, and find it
+		// again, in case the read failed and the page has gone.
+		while (page && page->filling) {
+			_filled.wait(_mtx);
+			page = find(node, offset);
+		}
+	}
+
+	if (!page) {
+		_nr_misses++;
+
+		page = insert(node, offset);
+		if (!page) return NULL;
+
+		// The page is marked as being filled, so nothing else reads or evicts it while
+		// the lock is dropped for the I/O.
+		int n = 0;
+		if (fill) {
+			void *data = (void *)sys.mm().pgalloc().pfdescr_to_vpa(page->frame);
+
+			_mtx.unlock();
+			n = file.pread(data, __page_size, offset);
+			_mtx.lock();
+		}
+
+		page->filling = false;
+		_filled.notify_all();
+
+		if (n < 0) {
+			remove(page);
+			failed = true;
+			return NULL;
+		}
+
+		page->valid = n;
+	}
+
+	// The page is now the most recently used.
+	lru_unlink(page);
+	lru_push(page);
+
+	return page;
+}
+
+int PageCache::read(const PFSNode& node, File& file, void *buffer, size_t size, off_t off)
+{
+	off_t offset = __page_base(off);
+	off_t in_page = off - offset;
+	assert(in_page + size <= __page_size);
+
+	UniqueLock<Mutex> l(_mtx);
+
+	bool failed;
+	CachedPage *page = get(node, file, offset, failed);
+	if (!page) {
+		if (failed) return -1;
+
+		// There's no room to cache it, so read straight from the file.
+		_mtx.unlock();
+		int n = file.pread(buffer, size, off);
+		_mtx.lock();
+
+		return n;
+	}
+
+	if (in_page >= page->valid) return 0;
+
+	size_t n = __min(size, page->valid - in_page);
+	memcpy(buffer, (const void *)(sys.mm().pgalloc().pfdescr_to_vpa(page->frame) + in_page), n);
+
+	return (int)n;
+}
+
+bool PageCache::pin(const PFSNode& node, File& file, off_t offset, PinnedPage& pinned)
+{
+	assert(__page_offset(offset) == 0);
+
+	UniqueLock<Mutex> l(_mtx);
+
+	bool failed;
+	CachedPage *page = get(node, file, offset, failed);
+	if (!page) return false;
+
+	page->pins++;
+
+	pinned.data = (const void *)sys.mm().pgalloc().pfdescr_to_vpa(page->frame);
+	pinned.valid = page->valid;
+	pinned.page = page;
+
+	return true;
+}
+
+void PageCache::unpin(PinnedPage& pinned)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	CachedPage *page = (CachedPage *)pinned.page;
+	pinned.page = NULL;
+
+	release(page);
+}
+
+bool PageCache::caches_writes(const PFSNode& node) const
+{
+	return __atomic_load_n(&_writeback_running, __ATOMIC_ACQUIRE) && node.owner().caches_writes();
+}
+
+uint64_t PageCache::dirty_threshold() const
+{
+	return (page_cache_max_pages * page_cache_dirty_ratio) / 100;
+}
+
+int PageCache::write(const PFSNode& node, File& file, const void *buffer, size_t size, off_t off)
+{
+	off_t offset = __page_base(off);
+	off_t in_page = off - offset;
+	assert(in_page + size <= __page_size);
+
+	UniqueLock<Mutex> l(_mtx);
+
+	// The writer has got too far ahead of the disk, so it waits for some of what is
+	// dirty to be written back, rather than fill the cache with it.
+	if (_nr_dirty >= 2 * dirty_threshold()) {
+		bool failed;
+		writeback(NULL, ~0ull, failed);
+	}
+
+	// A write of a whole page doesn't need what was there before.
+	bool failed;
+	CachedPage *page = get(node, file, offset, failed, !(in_page == 0 && size == __page_size));
+	if (!page) {
+		if (failed) return -1;
+
+		// There's no room to cache it, so write straight to the file.
+		_mtx.unlock();
+		int n = file.pwrite(buffer, size, off);
+		_mtx.lock();
+
+		return n;
+	}
+
+	uint8_t *data = (uint8_t *)sys.mm().pgalloc().pfdescr_to_vpa(page->frame);
+
+	// A write past the end of the file leaves zeroes before it.
+	if ((size_t)in_page > page->valid) {
+		memset(data + page->valid, 0, in_page - page->valid);
+	}
+
+	memcpy(data + in_page, buffer, size);
+	page->valid = __max(page->valid, in_page + size);
+
+	if (!page->dirty) {
+		page->dirty = true;
+		page->dirtied_at = sys.runtime().time_since_epoch().count();
+		_nr_dirty++;
+	}
+
+	return (int)size;
+}
+
+/**
+ * Whether one page to be written back should be written before another: in disk order,
+ * with the pages the filesystem can't place after those it can, in file order.
+ */
+static bool writeback_before(const PFSNode *a_node, off_t a_offset, bool a_on_disk, uint64_t a_block,
+		const PFSNode *b_node, off_t b_offset, bool b_on_disk, uint64_t b_block)
+{
+	if (a_on_disk != b_on_disk) return a_on_disk;
+	if (a_on_disk) return a_block < b_block;
+	if (a_node != b_node) return (uintptr_t)a_node < (uintptr_t)b_node;
+
+	return a_offset < b_offset;
+}
+
+/**
+ * Writes back a batch of dirty pages: the node's, if one is given, otherwise the oldest
+ * of those that became dirty before 'dirtied_before'.  The batch is written in disk
+ * order, so that the disk isn't sent back and forth across the pages.  Called with the
+ * lock held, which is dropped while the pages are written.
+ * @return Returns how many pages were picked, which is zero once there are none left.
+ * 'failed' is set if any of them couldn't be written back: they stay dirty, and are
+ * tried again once they have aged again.
+ */
+unsigned int PageCache::writeback(const PFSNode *node, uint64_t dirtied_before, bool& failed)
+{
+	failed = false;
+
+	WritebackEntry batch[WRITEBACK_BATCH];
+	unsigned int nr = 0;
+
+	// The pages that were used longest ago are at the tail, and were most likely
+	// dirtied longest ago, too.  Each page picked is pinned, so that it can't be
+	// freed while it is being written back.
+	for (CachedPage *page = _lru_tail; page && nr < WRITEBACK_BATCH; page = page->lru_prev) {
+		if (!page->dirty || page->writeback) continue;
+		if (node ? page->node != node : page->dirtied_at >= dirtied_before) continue;
+
+		page->dirty = false;
+		page->writeback = true;
+		page->pins++;
+		_nr_dirty--;
+
+		batch[nr].page = page;
+		batch[nr].valid = page->valid;
+		nr++;
+	}
+
+	if (!nr) return 0;
+
+	_mtx.unlock();
+
+	// Finding where a page is can take disk I/O, so it is done without the lock.  An
+	// insertion sort is plenty for a batch this size.
+	for (unsigned int i = 0; i < nr; i++) {
+		WritebackEntry& entry = batch[i];
+		entry.on_disk = const_cast<PFSNode *>(entry.page->node)->disk_block(entry.page->offset, entry.block);
+		entry.written = false;
+
+		for (unsigned int j = i; j > 0; j--) {
+			const WritebackEntry& a = batch[j];
+			const WritebackEntry& b = batch[j - 1];
+
+			if (!writeback_before(a.page->node, a.page->offset, a.on_disk, a.block, b.page->node, b.page->offset, b.on_disk, b.block)) break;
+
+			WritebackEntry tmp = batch[j];
+			batch[j] = batch[j - 1];
+			batch[j - 1] = tmp;
+		}
+	}
+
+	// The pages are written through a file opened for the purpose, as the files that
+	// wrote to them may be long closed.
+	const PFSNode *file_node = NULL;
+	File *file = NULL;
+
+	for (unsigned int i = 0; i < nr; i++) {
+		WritebackEntry& entry = batch[i];
+		CachedPage *page = entry.page;
+
+		// The page has been truncated away since it was picked.
+		if (__atomic_load_n(&page->dropped, __ATOMIC_RELAXED)) continue;
+
+		if (page->node != file_node) {
+			if (file) {
+				file->close();
+				delete file;
+			}
+
+			file_node = page->node;
+			file = const_cast<PFSNode *>(file_node)->open();
+		}
+
+		const void *data = (const void *)sys.mm().pgalloc().pfdescr_to_vpa(page->frame);
+		entry.written = file && file->pwrite(data, entry.valid, page->offset) == (int)entry.valid;
+	}
+
+	if (file) {
+		file->close();
+		delete file;
+	}
+
+	_mtx.lock();
+
+	uint64_t now = sys.runtime().time_since_epoch().count();
+	unsigned int nr_failed = 0;
+
+	for (unsigned int i = 0; i < nr; i++) {
+		CachedPage *page = batch[i].page;
+		page->writeback = false;
+
+		if (batch[i].written) {
+			_nr_written++;
+		} else if (!page->dropped) {
+			nr_failed++;
+
+			// It may have been written to again in the meantime, which made it dirty
+			// already.
+			if (!page->dirty) {
+				page->dirty = true;
+				_nr_dirty++;
+			}
+
+			page->dirtied_at = now;
+		}
+
+		release(page);
+	}
+
+	_written.notify_all();
+
+	if (nr_failed) {
+		_nr_write_errors += nr_failed;
+		failed = true;
+
+		fs_log.messagef(LogLevel::ERROR, "pagecache: unable to write back %u pages", nr_failed);
+	}
+
+	return nr;
+}
+
+bool PageCache::sync(const PFSNode& node)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	for (;;) {
+		bool failed;
+		while (writeback(&node, 0, failed)) {
+			if (failed) return false;
+		}
+
+		// Some pages may still be being written back by someone else, who will have
+		// made them dirty again (for the loop above) if that failed.
+		bool busy = false;
+		for (CachedPage *page = _lru_head; page; page = page->lru_next) {
+			if (page->node == &node && page->writeback) {
+				busy = true;
+				break;
+			}
+		}
+
+		if (!busy) return true;
+		_written.wait(_mtx);
+	}
+}
+
+/**
+ * Writes back whatever has been dirty for too long, and, while too much of the cache is
+ * dirty, the oldest of the rest.
+ */
+void PageCache::writeback_threadproc()
+{
+	for (;;) {
+		uint64_t now = sys.runtime().time_since_epoch().count();
+
+		{
+			UniqueLock<Mutex> l(page_cache._mtx);
+
+			bool failed = false;
+			while (!failed && page_cache._nr_dirty > page_cache.dirty_threshold()) {
+				if (!page_cache.writeback(NULL, ~0ull, failed)) break;
+			}
+
+			if (now >= PAGE_CACHE_DIRTY_EXPIRE) {
+				failed = false;
+				while (!failed && page_cache.writeback(NULL, now - PAGE_CACHE_DIRTY_EXPIRE, failed));
+			}
+		}
+
+		Thread::current().sleep_until(now + PAGE_CACHE_WRITEBACK_PERIOD);
+	}
+}
+
+bool PageCache::start_writeback()
+{
+	if (__atomic_load_n(&_writeback_running, __ATOMIC_ACQUIRE)) return true;
+
+	Thread& thread = sys.create_kernel_thread((Thread::thread_proc_t)writeback_threadproc, "writeback");
+	thread.start();
+
+	__atomic_store_n(&_writeback_running, true, __ATOMIC_RELEASE);
+	return true;
+}
+
+void PageCache::invalidate(const PFSNode& node, off_t off, size_t size)
+{
+	if (size == 0) return;
+
+	UniqueLock<Mutex> l(_mtx);
+
+	for (off_t offset = __page_base(off); offset < off + (off_t)size; offset += __page_size) {
+		CachedPage *page = find(node, offset);
+
+		// A page being read in may already have read what was there before the write,
+		// so wait for it, and drop it anyway.
+		while (page && page->filling) {
+			_filled.wait(_mtx);
+			page = find(node, offset);
+		}
+
+		if (page) remove(page);
+	}
+}
+
+void PageCache::truncate(const PFSNode& node, off_t size)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	CachedPage *page = _lru_head;
+	while (page) {
+		CachedPage *next = page->lru_next;
+
+		if (page->node == &node && page->offset + __page_size > size) {
+			// The list may change while waiting, so start again afterwards.
+			if (page->filling) {
+				_filled.wait(_mtx);
+				page = _lru_head;
+				continue;
+			}
+
+			remove(page);
+		}
+
+		page = next;
+	}
+}
+
+void PageCache::drop()
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	CachedPage *page = _lru_head;
+	while (page) {
+		CachedPage *next = page->lru_next;
+
+		// A pinned page leaves the cache, and is freed when it is unpinned.  What
+		// hasn't been written back yet stays.
+		if (!page->filling && !page->dirty && !page->writeback) remove(page);
+
+		page = next;
+	}
+}
+
+uint64_t PageCache::shrink(uint64_t nr_pages)
+{
+	if (!_mtx.try_lock()) return 0;
+
+	uint64_t nr = 0;
+	while (nr < nr_pages && evict_one()) {
+		nr++;
+	}
+
+	_mtx.unlock();
+	return nr;
+}
+
+static Shrinker page_cache_shrinker("pagecache", [](uint64_t nr_frames) { return page_cache.shrink(nr_frames); });
+
+void PageCache::get_stats(PageCacheStats& stats)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	stats.nr_pages = _nr_pages;
+	stats.max_pages = page_cache_max_pages;
+	stats.nr_hits = _nr_hits;
+	stats.nr_misses = _nr_misses;
+	stats.nr_evictions = _nr_evictions;
+	stats.nr_dirty = _nr_dirty;
+	stats.dirty_threshold = dirty_threshold();
+	stats.nr_written = _nr_written;
+	stats.nr_write_errors = _nr_write_errors;
+}
+
+int CachedFile::read(void *buffer, size_t size)
+{
+	int n = pread(buffer, size, _pos);
+	if (n > 0) _pos += n;
+
+	return n;
+}
+
+/**
+ * Reads the range a page at a time, out of the page cache.  A short page is the end of
+ * the file.
+ */
+int CachedFile::pread(void *buffer, size_t size, off_t off)
+{
+	size_t done = 0;
+	while (done < size) {
+		size_t chunk = __min(size - done, (size_t)(__page_size - __page_offset(off)));
+
+		int n = page_cache.read(_node, *_file, (void *)((uintptr_t)buffer + done), chunk, off);
+		if (n < 0) return done ? (int)done : n;
+
+		done += n;
+		off += n;
+
+		if ((size_t)n < chunk) break;
+	}
+
+	return (int)done;
+}
+
+int CachedFile::write(const void *buffer, size_t size)
+{
+	int n = pwrite(buffer, size, _pos);
+	if (n > 0) _pos += n;
+
+	return n;
+}
+
+/**
+ * Writes the range a page at a time into the page cache, if the filesystem allows it,
+ * otherwise straight through to the filesystem's file.
+ */
+int CachedFile::pwrite(const void *buffer, size_t size, off_t off)
+{
+	if (!page_cache.caches_writes(_node)) {
+		int n = _file->pwrite(buffer, size, off);
+		page_cache.invalidate(_node, off, size);
+		_node.changed();
+
+		return n;
+	}
+
+	size_t done = 0;
+	int rc = 0;
+
+	while (done < size) {
+		size_t chunk = __min(size - done, (size_t)(__page_size - __page_offset(off)));
+
+		int n = page_cache.write(_node, *_file, (const void *)((uintptr_t)buffer + done), chunk, off);
+		if (n < 0) {
+			rc = n;
+			break;
+		}
+
+		done += n;
+		off += n;
+
+		if ((size_t)n < chunk) break;
+	}
+
+	_node.changed();
+	return done ? (int)done : rc;
+}
+
+int CachedFile::truncate(off_t size)
+{
+	// The page that the new end of the file is in is dropped along with those after
+	// it, so what was written to it has to be written back first.
+	if (page_cache.caches_writes(_node) && !page_cache.sync(_node)) return -1;
+
+	int rc = _file->truncate(size);
+	if (rc == 0) {
+		page_cache.truncate(_node, size);
+		_node.changed();
+	}
+
+	return rc;
+}
+
+int CachedFile::sync()
+{
+	if (!page_cache.sync(_node) || _file->sync() < 0) return -1;
+	return _node.owner().sync() ? 0 : -1;
+}
+
+bool CachedFile::identity(FileIdentity& id) const
+{
+	id.object = &_node;
+	id.version = _node.version();
+
+	return true;
+}
+
+/**
+ * Sends the range a page at a time, handing each page to the other file straight out of
+ * the page cache, rather than copying it out first.  If a page can't be cached, that
+ * page is sent the ordinary way.
+ */
+int CachedFile::send_to(File& out, size_t size, off_t off)
+{
+	size_t done = 0;
+	while (done < size) {
+		off_t in_page = __page_offset(off);
+		size_t chunk = __min(size - done, (size_t)(__page_size - in_page));
+
+		PinnedPage pinned;
+		int n;
+
+		if (page_cache.pin(_node, *_file, off - in_page, pinned)) {
+			// A short page is the end of the file.
+			size_t avail = (size_t)in_page < pinned.valid ? __min(chunk, pinned.valid - in_page) : 0;
+
+			n = avail ? out.write((const void *)((uintptr_t)pinned.data + in_page), avail) : 0;
+			page_cache.unpin(pinned);
+		} else {
+			n = File::send_to(out, chunk, off);
+		}
+
+		if (n < 0) return done ? (int)done : n;
+
+		done += n;
+		off += n;
+
+		if ((size_t)n < chunk) break;
+	}
+
+	return (int)done;
+}
+
+void CachedFile::seek(off_t offset, SeekType type)
+{
+	if (type == SeekAbsolute) {
+		_pos = offset;
+	} else if (type == SeekRelative) {
+		_pos += offset;
+	}
+}
+
+/**
+ * A pseudo-device (/dev/pagecache0) that reports how big the page cache is, and how
+ * well it is doing.
+ */
+class PageCacheStatsDevice : public Device
+{
+public:
+	static const DeviceClass PageCacheStatsDeviceClass;
+
+	const DeviceClass& device_class() const override { return PageCacheStatsDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass PageCacheStatsDevice::PageCacheStatsDeviceClass(Device::RootDeviceClass, "pagecache");
+
+class PageCacheStatsFile : public TextFile
+{
+public:
+	PageCacheStatsFile()
+	{
+		PageCacheStats stats;
+		page_cache.get_stats(stats);
+
+		append("pages %llu\n", stats.nr_pages);
+		append("max-pages %llu\n", stats.max_pages);
+		append("hits %llu\n", stats.nr_hits);
+		append("misses %llu\n", stats.nr_misses);
+		append("evictions %llu\n", stats.nr_evictions);
+		append("dirty %llu\n", stats.nr_dirty);
+		append("dirty-threshold %llu\n", stats.dirty_threshold);
+		append("written-back %llu\n", stats.nr_written);
+		append("writeback-errors %llu\n", stats.nr_write_errors);
+	}
+};
+
+File *PageCacheStatsDevice::open_as_file()
+{
+	return new PageCacheStatsFile();
+}
+
+RegisterDevice(PageCacheStatsDevice);
@@ -0,0 +1,394 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * fs/pipe.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/fs/pipe.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/object-allocator.h>
+#include <infos/util/hash-map.h>
+#include <infos/util/string.h>
+
+using namespace infos::fs;
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::util;
+
+// Objects aren't typed, so the ends that are alive are kept here, for the places that
+// have to know whether an object is one (handing handles to a process, and taking them
+// back when it terminates).
+static HashMap<uintptr_t, PipeEnd *> live_ends;
+static Mutex live_ends_lock;
+
+PipeEnd *PipeEnd::from_object(void *object)
+{
+	UniqueLock<Mutex> l(live_ends_lock);
+
+	PipeEnd *end;
+	return live_ends.try_get_value((uintptr_t)object, end) ? end : NULL;
+}
+
+void PipeEnd::hold()
+{
+	UniqueLock<Mutex> l(_pipe._lock);
+	_holders++;
+}
+
+int PipeEnd::read(void *buffer, size_t size)
+{
+	if (_writer) return -1;
+	return _pipe.read(buffer, size, _nonblocking);
+}
+
+int PipeEnd::write(const void *buffer, size_t size)
+{
+	if (!_writer) return -1;
+	return _pipe.write(buffer, size, _nonblocking);
+}
+
+/**
+ * From one pipe to another, pages are moved; to anything else, the data is read out and
+ * written, as for any file.  Pipes can't seek, so the offset is ignored.
+ */
+int PipeEnd::send_to(File& out, size_t size, off_t off)
+{
+	if (_writer) return -1;
+	if (size == 0) return 0;
+
+	PipeEnd *end = from_object(&out);
+	if (end && end->_writer) return _pipe.splice(end->_pipe, size, _nonblocking);
+
+	FrameDescriptor *page = sys.mm().pgalloc().allocate(0);
+	if (!page) return -1;
+
+	uint8_t *buffer = (uint8_t *)sys.mm().pgalloc().pfdescr_to_vpa(page);
+
+	size_t done = 0;
+	while (done < size) {
+		size_t chunk = __min(size - done, __page_size);
+
+		int n = _pipe.read(buffer, chunk, _nonblocking || done);
+		if (n > 0) n = out.write(buffer, n);
+
+		if (n <= 0) {
+			if (!done) done = n;
+			break;
+		}
+
+		done += n;
+	}
+
+	sys.mm().pgalloc().free_one(page);
+	return (int)done;
+}
+
+unsigned int PipeEnd::poll()
+{
+	return _pipe.poll(_writer);
+}
+
+const void *PipeEnd::poll_source() const
+{
+	return &_pipe;
+}
+
+void PipeEnd::close()
+{
+	_pipe.release(*this);
+}
+
+Pipe::Pipe()
+	: _reader(*this, false), _writer(*this, true), _head(0), _count(0), _spare(NULL), _reader_open(true), _writer_open(true)
+{
+	for (unsigned int i = 0; i < NR_SLOTS; i++) {
+		_slots[i].page = NULL;
+	}
+}
+
+bool Pipe::create(PipeEnd *& reader, PipeEnd *& writer)
+{
+	Pipe *pipe = new (HeapArena::VFS) Pipe();
+	if (!pipe) return false;
+
+	{
+		UniqueLock<Mutex> l(live_ends_lock);
+		live_ends.add((uintptr_t)&pipe->_reader, &pipe->_reader);
+		live_ends.add((uintptr_t)&pipe->_writer, &pipe->_writer);
+	}
+
+	reader = &pipe->_reader;
+	writer = &pipe->_writer;
+	return true;
+}
+
+uint8_t *Pipe::slot_data(const Slot& slot) const
+{
+	return (uint8_t *)sys.mm().pgalloc().pfdescr_to_vpa(slot.page) + slot.offset;
+}
+
+FrameDescriptor *Pipe::take_page()
+{
+	FrameDescriptor *page = _spare;
+	if (page) {
+		_spare = NULL;
+		return page;
+	}
+
+	return sys.mm().pgalloc().allocate(0);
+}
+
+void Pipe::give_page(FrameDescriptor *page)
+{
+	if (!_spare) {
+		_spare = page;
+	} else {
+		sys.mm().pgalloc().free_one(page);
+	}
+}
+
+size_t Pipe::available() const
+{
+	size_t total = 0;
+	for (unsigned int i = 0; i < _count; i++) {
+		total += _slots[(_head + i) % NR_SLOTS].length;
+	}
+
+	return total;
+}
+
+/**
+ * Wakes whoever is waiting on either end.  Called with the lock held.
+ */
+void Pipe::changed()
+{
+	_readable.notify_all();
+	_writable.notify_all();
+	File::wake_pollers(this);
+}
+
+/**
+ * Reads what there is, up to 'size' bytes, waiting for something if there is nothing yet.
+ * Returns zero once the pipe is empty and the writer has gone.
+ */
+int Pipe::read(void *buffer, size_t size, bool nonblocking)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	while (!_count) {
+		if (!_writer_open || nonblocking) return 0;
+		_readable.wait(_lock);
+	}
+
+	size_t done = 0;
+	while (done < size && _count) {
+		Slot& slot = _slots[_head];
+
+		size_t n = __min(slot.length, size - done);
+		memcpy((uint8_t *)buffer + done, slot_data(slot), n);
+		slot.offset += n;
+		slot.length -= n;
+		done += n;
+
+		if (!slot.length) {
+			give_page(slot.page);
+			slot.page = NULL;
+			_head = (_head + 1) % NR_SLOTS;
+			_count--;
+		}
+	}
+
+	changed();
+	return (int)done;
+}
+
+/**
+ * Writes all of the data, waiting for room as it goes, unless the pipe doesn't block, in
+ * which case as much as fits is written.  Fails once the reader has gone.
+ */
+int Pipe::write(const void *buffer, size_t size, bool nonblocking)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	size_t done = 0;
+	while (done < size) {
+		if (!_reader_open) return done ? (int)done : -1;
+
+		const uint8_t *data = (const uint8_t *)buffer + done;
+		size_t left = size - done;
+		size_t n = 0;
+
+		// A whole page, from a page boundary, gets a page of its own, so that it is read
+		// out whole too.
+		bool whole = left >= __page_size && !__page_offset((uintptr_t)data);
+
+		if (_count && !whole) {
+			Slot& last = _slots[(_head + _count - 1) % NR_SLOTS];
+			size_t end = last.offset + last.length;
+
+			if (end < __page_size) {
+				n = __min(__page_size - end, left);
+				memcpy(slot_data(last) + last.length, data, n);
+				last.length += n;
+			}
+		}
+
+		if (!n && _count < NR_SLOTS) {
+			FrameDescriptor *page = take_page();
+			if (!page) return done ? (int)done : -1;
+
+			Slot& slot = _slots[(_head + _count) % NR_SLOTS];
+			slot.page = page;
+			slot.offset = 0;
+			slot.length = n = __min(__page_size, left);
+			memcpy(slot_data(slot), data, n);
+			_count++;
+		}
+
+		if (!n) {
+			if (nonblocking) break;
+
+			changed();
+			_writable.wait(_lock);
+			continue;
+		}
+
+		done += n;
+	}
+
+	changed();
+	return (int)done;
+}
+
+/**
+ * Moves up to 'size' bytes into another pipe.  Each page of data moves between the rings
+ * as it is; only a page that is cut short is copied.  Waits for there to be data, and
+ * then for there to be room, unless the pipe doesn't block.
+ */
+int Pipe::splice(Pipe& out, size_t size, bool nonblocking)
+{
+	if (&out == this) return -1;
+
+	Pipe& first = this < &out ? *this : out;
+	Pipe& second = this < &out ? out : *this;
+
+	for (;;) {
+		{
+			UniqueLock<Mutex> l(_lock);
+			while (!_count) {
+				if (!_writer_open || nonblocking) return 0;
+				_readable.wait(_lock);
+			}
+		}
+
+		{
+			UniqueLock<Mutex> l(out._lock);
+			while (out._count == NR_SLOTS && out._reader_open) {
+				if (nonblocking) return 0;
+				out._writable.wait(out._lock);
+			}
+		}
+
+		UniqueLock<Mutex> l1(first._lock);
+		UniqueLock<Mutex> l2(second._lock);
+
+		if (!out._reader_open) return -1;
+		if (!_count || out._count == NR_SLOTS) continue;
+
+		size_t done = 0;
+		while (done < size && _count && out._count < NR_SLOTS) {
+			Slot& slot = _slots[_head];
+			Slot& dest = out._slots[(out._head + out._count) % NR_SLOTS];
+
+			if (slot.length <= size - done) {
+				dest = slot;
+				done += slot.length;
+
+				slot.page = NULL;
+				_head = (_head + 1) % NR_SLOTS;
+				_count--;
+			} else {
+				FrameDescriptor *page = out.take_page();
+				if (!page) break;
+
+				size_t n = size - done;
+				dest.page = page;
+				dest.offset = 0;
+				dest.length = n;
+				memcpy(out.slot_data(dest), slot_data(slot), n);
+
+				slot.offset += n;
+				slot.length -= n;
+				done += n;
+			}
+
+			out._count++;
+		}
+
+		changed();
+		out.changed();
+		return (int)done;
+	}
+}
+
+unsigned int Pipe::poll(bool writer)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	// An end whose other end has gone is ready: the transfer returns straight away.
+	if (writer) {
+		return (_count < NR_SLOTS || !_reader_open) ? PollEvents::WRITABLE : 0;
+	}
+
+	return (_count || !_writer_open) ? PollEvents::READABLE : 0;
+}
+
+/**
+ * One holder of an end has closed it.  Once the last has, the other end finds out, and,
+ * once both ends are closed, the pages go back.
+ */
+void Pipe::release(PipeEnd& end)
+{
+	bool dead;
+	{
+		UniqueLock<Mutex> l(_lock);
+
+		if (!end._holders || --end._holders) return;
+
+		if (end._writer) {
+			_writer_open = false;
+		} else {
+			_reader_open = false;
+		}
+
+		// With no reader, the data will never be read.
+		if (!_reader_open) {
+			while (_count) {
+				give_page(_slots[_head].page);
+				_slots[_head].page = NULL;
+				_head = (_head + 1) % NR_SLOTS;
+				_count--;
+			}
+		}
+
+		dead = !_reader_open && !_writer_open;
+		if (dead && _spare) {
+			sys.mm().pgalloc().free_one(_spare);
+			_spare = NULL;
+		}
+
+		changed();
+	}
+
+	if (dead) {
+		UniqueLock<Mutex> l(live_ends_lock);
+		live_ends.remove((uintptr_t)&_reader);
+		live_ends.remove((uintptr_t)&_writer);
+	}
+}
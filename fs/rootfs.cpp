@@ -10,13 +10,15 @@
  */
 #include <infos/fs/rootfs.h>
 #include <infos/util/string.h>
+#include <infos/mm/object-allocator.h>
 
 using namespace infos::fs;
 using namespace infos::util;
+using namespace infos::mm;
 
 PFSNode *RootFS::mount()
 {
-	return new RootFSNode(*this);
+	return new (HeapArena::VFS) RootFSNode(*this);
 }
 
 RootFSNode::RootFSNode(RootFS& owner) : PFSNode(NULL, owner)
@@ -52,7 +54,7 @@ Directory* RootFSNode::opendir()
  */
 static Filesystem *rootfs_create(VirtualFilesystem& vfs, infos::drivers::Device *dev)
 {
-	return new RootFS();
+	return new (HeapArena::VFS) RootFS();
 }
 
 RegisterFilesystem(rootfs, rootfs_create);
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * fs/stats.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/fs/stats.h>
+#include <infos/util/printf.h>
+#include <infos/util/string.h>
+
+using namespace infos::fs;
+using namespace infos::util;
+
+extern char _STATS_START, _STATS_END;
+
+// The longest line that a generator can append in one go.
+#define STATS_MAX_LINE		256
+
+void StatisticsWriter::append(const char *fmt, ...)
+{
+	if (full()) return;
+
+	char line[STATS_MAX_LINE];
+
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	if (n <= 0) return;
+	if (n > (int)sizeof(line) - 1) n = sizeof(line) - 1;
+
+	off_t start = _pos;
+	_pos += n;
+
+	// Only the part of the line that is in the range being read is copied.
+	if (_pos <= _off) return;
+
+	size_t skip = start < _off ? _off - start : 0;
+	size_t length = __min(n - skip, _size - _done);
+
+	memcpy(_buffer + _done, line + skip, length);
+	_done += length;
+}
+
+const StatisticsRegistration *StatisticsRegistration::begin()
+{
+	return (const StatisticsRegistration *)&_STATS_START;
+}
+
+const StatisticsRegistration *StatisticsRegistration::end()
+{
+	return (const StatisticsRegistration *)&_STATS_END;
+}
+
+const StatisticsRegistration *StatisticsRegistration::find(const String& name)
+{
+	for (const StatisticsRegistration *stats = begin(); stats < end(); stats++) {
+		if (strcmp(stats->name, name.c_str()) == 0) return stats;
+	}
+
+	return NULL;
+}
+
+int StatisticsFile::read(void *buffer, size_t size)
+{
+	int n = pread(buffer, size, _pos);
+	_pos += n;
+
+	return n;
+}
+
+int StatisticsFile::pread(void *buffer, size_t size, off_t off)
+{
+	if (size == 0) return 0;
+
+	StatisticsWriter out(buffer, size, off);
+	_stats.fn(out);
+
+	return (int)out._done;
+}
+
+void StatisticsFile::seek(off_t offset, SeekType type)
+{
+	if (type == SeekAbsolute) {
+		_pos = offset;
+	} else {
+		_pos += offset;
+	}
+}
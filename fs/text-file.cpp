@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * fs/text-file.cpp
+ * 
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ * 
+ * agent <agent@local>
+ */
+#include <infos/fs/text-file.h>
+#include <infos/util/printf.h>
+#include <infos/util/string.h>
+
+using namespace infos::fs;
+using namespace infos::util;
+
+int TextFile::read(void *buffer, size_t size)
+{
+	int n = pread(buffer, size, _pos);
+	_pos += n;
+
+	return n;
+}
+
+int TextFile::pread(void *buffer, size_t size, off_t off)
+{
+	if (off < 0 || (size_t)off >= _size) return 0;
+
+	size_t n = _size - off;
+	if (n > size) n = size;
+
+	memcpy(buffer, &_text[off], n);
+	return (int)n;
+}
+
+void TextFile::seek(off_t offset, SeekType type)
+{
+	if (type == SeekAbsolute) {
+		_pos = offset;
+	} else {
+		_pos += offset;
+	}
+}
+
+void TextFile::append(const char *fmt, ...)
+{
+	if (_size >= sizeof(_text) - 1) return;
+
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(&_text[_size], sizeof(_text) - _size, fmt, args);
+	va_end(args);
+
+	if (n < 0) return;
+
+	_size += n;
+	if (_size > sizeof(_text) - 1) _size = sizeof(_text) - 1;
+}
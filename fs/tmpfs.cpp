@@ -10,27 +10,139 @@
  */
 #include <infos/fs/tmpfs.h>
 #include <infos/util/string.h>
+#include <infos/kernel/kernel.h>
 #include <infos/kernel/log.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/object-allocator.h>
 
 using namespace infos::fs;
 using namespace infos::util;
 using namespace infos::kernel;
+using namespace infos::mm;
 
 PFSNode *TempFS::mount()
 {
-	return new TempFSNode(*this, "");
+	return new (HeapArena::VFS) TempFSNode(*this, "");
 }
 
-TempFSNode::TempFSNode(TempFS& owner, const util::String& name) : PFSNode(NULL, owner), _name(name)
+FrameDescriptor *TempFSPages::find(uint64_t index) const
+{
+	if (!_root || index >= span(_height)) return NULL;
+
+	void **node = _root;
+	for (unsigned int height = _height; height > 1; height--) {
+		node = (void **)node[(index >> (SLOT_BITS * (height - 1))) & (SLOTS - 1)];
+		if (!node) return NULL;
+	}
+
+	return (FrameDescriptor *)node[index & (SLOTS - 1)];
+}
+
+void **TempFSPages::alloc_node()
+{
+	void **node = new (HeapArena::VFS) void *[SLOTS];
+	if (node) bzero(node, SLOTS * sizeof(void *));
+
+	return node;
+}
+
+FrameDescriptor *TempFSPages::get(uint64_t index)
+{
+	// Add levels at the top until the tree is tall enough to hold the page.
+	while (!_root || index >= span(_height)) {
+		void **root = alloc_node();
+		if (!root) return NULL;
+
+		root[0] = _root;
+		_root = root;
+		_height++;
+	}
+
+	void **node = _root;
+	for (unsigned int height = _height; height > 1; height--) {
+		void *&slot = node[(index >> (SLOT_BITS * (height - 1))) & (SLOTS - 1)];
+		if (!slot) {
+			slot = alloc_node();
+			if (!slot) return NULL;
+		}
+
+		node = (void **)slot;
+	}
+
+	void *&slot = node[index & (SLOTS - 1)];
+	if (!slot) {
+		slot = sys.mm().pgalloc().allocate(0, PageAllocFlags::ZERO);
+	}
+
+	return (FrameDescriptor *)slot;
+}
+
+/**
+ * Frees everything under 'node', which covers the pages from 'base', that is at or
+ * beyond page 'keep'.
+ */
+void TempFSPages::truncate_node(void **node, unsigned int height, uint64_t base, uint64_t keep)
+{
+	uint64_t child_span = span(height - 1);
+
+	for (unsigned int i = 0; i < SLOTS; i++) {
+		if (!node[i]) continue;
+
+		uint64_t child_base = base + (i * child_span);
+		if (child_base + child_span <= keep) continue;
+
+		if (height == 1) {
+			sys.mm().pgalloc().free_one((FrameDescriptor *)node[i]);
+			node[i] = NULL;
+			continue;
+		}
+
+		truncate_node((void **)node[i], height - 1, child_base, keep);
+
+		if (child_base >= keep) {
+			delete[] (void **)node[i];
+			node[i] = NULL;
+		}
+	}
+}
+
+void TempFSPages::truncate(uint64_t nr_pages)
+{
+	if (!_root) return;
+
+	truncate_node(_root, _height, 0, nr_pages);
+
+	if (!nr_pages) {
+		delete[] _root;
+		_root = NULL;
+		_height = 0;
+	}
+}
+
+TempFSNode::TempFSNode(TempFS& owner, const util::String& name, bool directory)
+	: PFSNode(NULL, owner), _name(name), _directory(directory), _size(0)
 {
 
 }
 
 PFSNode* TempFSNode::get_child(const util::String& name)
 {
-	TempFSNode *child;
-	
-	if (!_children.try_get_value(name.get_hash(), child)) {
+	if (!_directory) return NULL;
+
+	UniqueLock<Mutex> l(_mtx);
+	return _children.find(name);
+}
+
+PFSNode* TempFSNode::add_child(const util::String& name, bool directory)
+{
+	if (!_directory) return NULL;
+
+	UniqueLock<Mutex> l(_mtx);
+	if (_children.find(name)) return NULL;
+
+	TempFSNode *child = new (HeapArena::VFS) TempFSNode((TempFS &)owner(), name, directory);
+	if (!_children.add(child)) {
+		delete child;
 		return NULL;
 	}
 
@@ -39,36 +151,160 @@ PFSNode* TempFSNode::get_child(const util::String& name)
 
 PFSNode* TempFSNode::mkdir(const util::String& name)
 {
-	TempFSNode *dir = new TempFSNode((TempFS &)owner(), name);
-	_children.add(name.get_hash(), dir);
-	
-	return dir;
+	return add_child(name, true);
+}
+
+PFSNode* TempFSNode::create(const util::String& name)
+{
+	return add_child(name, false);
 }
 
 File* TempFSNode::open()
 {
-	return NULL;
+	if (_directory) return NULL;
+	return new (HeapArena::VFS) TempFSFile(*this);
 }
 
 Directory* TempFSNode::opendir()
 {
-	return new TempFSDirectory(*this);
+	if (!_directory) return NULL;
+	return new (HeapArena::VFS) TempFSDirectory(*this);
+}
+
+/**
+ * Reads from the file's data.  Holes read as zeroes.
+ */
+int TempFSNode::read(void *buffer, size_t size, off_t off)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	if (off >= _size) return 0;
+	size = __min(size, _size - off);
+
+	size_t done = 0;
+	while (done < size) {
+		size_t chunk = __min(size - done, (size_t)(__page_size - __page_offset(off)));
+		uint8_t *dst = (uint8_t *)buffer + done;
+
+		FrameDescriptor *frame = _pages.find(__page_index(off));
+		if (frame) {
+			memcpy(dst, (const void *)(sys.mm().pgalloc().pfdescr_to_vpa(frame) + __page_offset(off)), chunk);
+		} else {
+			bzero(dst, chunk);
+		}
+
+		done += chunk;
+		off += chunk;
+	}
+
+	return (int)done;
+}
+
+/**
+ * Writes to the file's data, allocating frames for any pages that don't have one, and
+ * growing the file if the write goes past the end.
+ */
+int TempFSNode::write(const void *buffer, size_t size, off_t off)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	size_t done = 0;
+	while (done < size) {
+		size_t chunk = __min(size - done, (size_t)(__page_size - __page_offset(off)));
+
+		FrameDescriptor *frame = _pages.get(__page_index(off));
+		if (!frame) break;
+
+		memcpy((void *)(sys.mm().pgalloc().pfdescr_to_vpa(frame) + __page_offset(off)), (const uint8_t *)buffer + done, chunk);
+
+		done += chunk;
+		off += chunk;
+	}
+
+	if (off > _size) _size = off;
+
+	if (done < size && !done) return -1;
+	return (int)done;
+}
+
+/**
+ * Sets the size of the file.  Shrinking it frees the frames past the new end, and
+ * zeroes what is left of the last page, so that the file reads as zeroes there if it
+ * grows again.
+ */
+int TempFSNode::truncate(off_t size)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	if (size < _size) {
+		_pages.truncate(__page_index(__align_up_page(size)));
+
+		if (__page_offset(size)) {
+			FrameDescriptor *frame = _pages.find(__page_index(size));
+			if (frame) {
+				bzero((void *)(sys.mm().pgalloc().pfdescr_to_vpa(frame) + __page_offset(size)), __page_size - __page_offset(size));
+			}
+		}
+	}
+
+	_size = size;
+	return 0;
 }
 
 TempFSDirectory::TempFSDirectory(TempFSNode& node)
 {
-	for (const auto& child : node.children()) {
+	for (TempFSNode *child : node.children()) {
 		DirectoryEntry de;
-		de.name = child.value->name();
-		de.size = 0;
+		de.name = child->name();
+		de.size = child->size();
 		
 		add_entry(de);
 	}
 }
 
+int TempFSFile::read(void *buffer, size_t size)
+{
+	int n = pread(buffer, size, _pos);
+	if (n > 0) _pos += n;
+
+	return n;
+}
+
+int TempFSFile::pread(void *buffer, size_t size, off_t off)
+{
+	return _node.read(buffer, size, off);
+}
+
+int TempFSFile::write(const void *buffer, size_t size)
+{
+	int n = pwrite(buffer, size, _pos);
+	if (n > 0) _pos += n;
+
+	return n;
+}
+
+int TempFSFile::pwrite(const void *buffer, size_t size, off_t off)
+{
+	return _node.write(buffer, size, off);
+}
+
+void TempFSFile::seek(off_t offset, SeekType type)
+{
+	if (type == SeekAbsolute) {
+		_pos = offset;
+	} else if (type == SeekRelative) {
+		_pos += offset;
+	}
+}
+
+int TempFSFile::truncate(off_t size)
+{
+	return _node.truncate(size);
+}
+
 static Filesystem *tmpfs_create(VirtualFilesystem& vfs, infos::drivers::Device *dev)
 {
-	return new TempFS();
+	return new (HeapArena::VFS) TempFS();
 }
 
 RegisterFilesystem(tmpfs, tmpfs_create);
@@ -2,30 +2,109 @@
 
 /*
  * fs/vfat.cpp
- * 
+ *
  * InfOS
  * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
- * 
+ *
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/fs/vfat.h>
+#include <infos/fs/directory.h>
 #include <infos/drivers/block/block-device.h>
 #include <infos/kernel/log.h>
 #include <infos/util/string.h>
+#include <infos/mm/object-allocator.h>
 
 using namespace infos::fs;
 using namespace infos::kernel;
 using namespace infos::util;
 using namespace infos::drivers::block;
+using namespace infos::mm;
 
-VFAT::VFAT(drivers::block::BlockDevice& bdev) : BlockBasedFilesystem(bdev)
+// A FAT up to this many blocks (256 KiB, i.e. a FAT16 volume of up to 128K clusters) is
+// cached whole.
+#define VFAT_WHOLE_FAT_BLOCKS	512
+
+// Otherwise, this many windows of this many blocks each are cached.
+#define VFAT_FAT_WINDOWS		16
+#define VFAT_FAT_WINDOW_BLOCKS	8
+
+// Fewer clusters than this is FAT12, and more than FAT16_MAX_CLUSTERS is FAT32.
+#define FAT12_MAX_CLUSTERS		4084
+#define FAT16_MAX_CLUSTERS		65524
+
+#define FAT16_EOC				0xfff8
+#define FAT32_EOC				0x0ffffff8
+#define FAT32_CLUSTER_MASK		0x0fffffff
+
+#define ATTR_VOLUME_ID			0x08
+#define ATTR_DIRECTORY			0x10
+#define ATTR_LFN				0x0f
+
+#define NT_LOWERCASE_BASE		0x08
+#define NT_LOWERCASE_EXT		0x10
+
+#define DIRENT_END				0x00
+#define DIRENT_DELETED			0xe5
+#define DIRENT_KANJI_E5			0x05
+
+#define LFN_LAST				0x40
+#define LFN_ORDER_MASK			0x1f
+#define LFN_CHARS_PER_ENTRY		13
+#define LFN_MAX_ENTRIES			20
+
+bool VFATExtentMap::append(uint32_t block, uint32_t nr_blocks)
+{
+	if (_count > 0) {
+		VFATExtent& last = _extents[_count - 1];
+		if (last.block + last.nr_blocks == block) {
+			last.nr_blocks += nr_blocks;
+			return true;
+		}
+	}
+
+	if (_count == _capacity) {
+		unsigned int capacity = _capacity ? _capacity * 2 : 4;
+
+		VFATExtent *extents = new (HeapArena::VFS) VFATExtent[capacity];
+		if (!extents) return false;
+
+		for (unsigned int i = 0; i < _count; i++) {
+			extents[i] = _extents[i];
+		}
+
+		delete[] _extents;
+		_extents = extents;
+		_capacity = capacity;
+	}
+
+	_extents[_count].block = block;
+	_extents[_count].nr_blocks = nr_blocks;
+	_count++;
+
+	return true;
+}
+
+VFAT::VFAT(drivers::block::BlockDevice& bdev)
+	: BlockBasedFilesystem(bdev), _fat32(false), _blocks_per_cluster(0), _fat_start(0), _fat_size(0),
+	_root_start(0), _root_size(0), _data_start(0), _nr_clusters(0), _root_cluster(0),
+	_fat_windows(NULL), _nr_fat_windows(0), _fat_window_size(0)
 {
+	_fat_mtx.set_name("vfat-fat");
+}
 
+VFAT::~VFAT()
+{
+	for (unsigned int i = 0; i < _nr_fat_windows; i++) {
+		delete[] _fat_windows[i].data;
+	}
+
+	delete[] _fat_windows;
 }
 
 PFSNode *VFAT::mount()
 {
-	fs_log.messagef(LogLevel::DEBUG, "vfat: block-size=%lu, count=%lu", block_device().block_size(), block_device().block_size());
+	fs_log.messagef(LogLevel::DEBUG, "vfat: block-size=%lu, count=%lu", block_device().block_size(), block_device().block_count());
 
 	if (block_device().block_size() != sizeof(vfat_boot_block)) {
 		return NULL;
@@ -34,45 +113,527 @@ PFSNode *VFAT::mount()
 	if (!block_device().read_blocks(&_boot_block, 0, 1)) {
 		return NULL;
 	}
-	
+
 	if (_boot_block.signature != 0xaa55) {
 		fs_log.messagef(LogLevel::ERROR, "vfat: invalid signature");
 		return NULL;
 	}
-	
-	return new VFATNode(*this);
+
+	if (_boot_block.bytes_per_block != block_device().block_size()) {
+		fs_log.messagef(LogLevel::ERROR, "vfat: unsupported block size %u", _boot_block.bytes_per_block);
+		return NULL;
+	}
+
+	_blocks_per_cluster = _boot_block.blocks_per_alloc_unit;
+	if (!_blocks_per_cluster || (_blocks_per_cluster & (_blocks_per_cluster - 1)) || !_boot_block.nr_fats || !_boot_block.reserved_blocks) {
+		fs_log.messagef(LogLevel::ERROR, "vfat: invalid geometry");
+		return NULL;
+	}
+
+	vfat32_boot_block_ext ext;
+	memcpy(&ext, (const uint8_t *)&_boot_block + 0x24, sizeof(ext));
+
+	unsigned int active_fat = 0;
+
+	_fat_size = _boot_block.nr_blocks_in_fat;
+	if (!_fat_size) {
+		_fat_size = ext.nr_blocks_in_fat;
+
+		// Bit 7 set means that only one FAT is in use, rather than all being mirrored.
+		if (ext.flags & 0x80) active_fat = ext.flags & 0xf;
+	}
+
+	uint32_t total_blocks = _boot_block.total_blocks ? _boot_block.total_blocks : _boot_block.total_blocks_big;
+
+	_fat_start = _boot_block.reserved_blocks + (active_fat * _fat_size);
+	_root_start = _boot_block.reserved_blocks + (_boot_block.nr_fats * _fat_size);
+	_root_size = ((_boot_block.nr_root_entries * sizeof(vfat_dir_entry)) + block_size() - 1) / block_size();
+	_data_start = _root_start + _root_size;
+
+	if (!_fat_size || active_fat >= _boot_block.nr_fats || _data_start >= total_blocks || total_blocks > block_device().block_count()) {
+		fs_log.messagef(LogLevel::ERROR, "vfat: invalid geometry");
+		return NULL;
+	}
+
+	// The number of clusters is what decides the type of FAT.
+	_nr_clusters = (total_blocks - _data_start) / _blocks_per_cluster;
+
+	if (_nr_clusters <= FAT12_MAX_CLUSTERS) {
+		fs_log.messagef(LogLevel::ERROR, "vfat: FAT12 is not supported");
+		return NULL;
+	}
+
+	_fat32 = _nr_clusters > FAT16_MAX_CLUSTERS;
+	_root_cluster = _fat32 ? ext.root_cluster : 0;
+
+	// Only the part of the FAT that describes clusters that exist is ever read.
+	uint32_t fat_used = ((((uint64_t)_nr_clusters + 2) * (_fat32 ? 4 : 2)) + block_size() - 1) / block_size();
+	if (fat_used > _fat_size) {
+		fs_log.messagef(LogLevel::ERROR, "vfat: FAT is too small");
+		return NULL;
+	}
+
+	if (fat_used <= VFAT_WHOLE_FAT_BLOCKS) {
+		_nr_fat_windows = 1;
+		_fat_window_size = fat_used;
+	} else {
+		_nr_fat_windows = VFAT_FAT_WINDOWS;
+		_fat_window_size = VFAT_FAT_WINDOW_BLOCKS;
+	}
+
+	_fat_windows = new (HeapArena::VFS) FATWindow[_nr_fat_windows];
+	if (!_fat_windows) return NULL;
+
+	for (unsigned int i = 0; i < _nr_fat_windows; i++) {
+		_fat_windows[i].data = new (HeapArena::VFS) uint8_t[_fat_window_size * block_size()];
+		_fat_windows[i].first_block = 0;
+		_fat_windows[i].valid = false;
+
+		if (!_fat_windows[i].data) return NULL;
+	}
+
+	fs_log.messagef(LogLevel::INFO, "vfat: FAT%u, %u clusters of %u bytes, FAT cached in %u window(s) of %u blocks",
+			_fat32 ? 32 : 16, _nr_clusters, cluster_size(), _nr_fat_windows, _fat_window_size);
+
+	return new (HeapArena::VFS) VFATNode(*this);
+}
+
+/**
+ * Looks up the cluster that follows 'cluster' in its chain, reading the part of the FAT
+ * it is in if that isn't cached.
+ */
+bool VFAT::next_cluster(uint32_t cluster, uint32_t& next)
+{
+	uint32_t offset = cluster * (_fat32 ? 4 : 2);
+	uint32_t block = offset / block_size();
+
+	uint32_t window_index = block / _fat_window_size;
+	uint32_t first_block = window_index * _fat_window_size;
+
+	UniqueLock<Mutex> l(_fat_mtx);
+
+	FATWindow& window = _fat_windows[window_index % _nr_fat_windows];
+	if (!window.valid || window.first_block != first_block) {
+		uint32_t nr_blocks = __min(_fat_window_size, _fat_size - first_block);
+
+		window.valid = false;
+		if (!block_device().read_blocks(window.data, _fat_start + first_block, nr_blocks)) {
+			fs_log.messagef(LogLevel::ERROR, "vfat: unable to read FAT block %u", _fat_start + first_block);
+			return false;
+		}
+
+		window.first_block = first_block;
+		window.valid = true;
+	}
+
+	// An entry never straddles a block boundary.
+	const uint8_t *entry = window.data + ((block - first_block) * block_size()) + (offset % block_size());
+
+	if (_fat32) {
+		next = *(const uint32_t *)entry & FAT32_CLUSTER_MASK;
+	} else {
+		next = *(const uint16_t *)entry;
+	}
+
+	return true;
+}
+
+bool VFAT::map_chain(uint32_t cluster, VFATExtentMap& map)
+{
+	if (!cluster) return true;
+
+	uint32_t eoc = _fat32 ? FAT32_EOC : FAT16_EOC;
+
+	// A chain can't be longer than the number of clusters, unless it loops.
+	for (uint32_t length = 0; length < _nr_clusters; length++) {
+		if (cluster < 2 || cluster >= _nr_clusters + 2) {
+			fs_log.messagef(LogLevel::ERROR, "vfat: invalid cluster %u in chain", cluster);
+			return false;
+		}
+
+		if (!map.append(cluster_to_block(cluster), _blocks_per_cluster)) return false;
+		if (!next_cluster(cluster, cluster)) return false;
+
+		if (cluster >= eoc) return true;
+	}
+
+	fs_log.messagef(LogLevel::ERROR, "vfat: cluster chain loops");
+	return false;
+}
+
+bool VFAT::map_fixed_root(VFATExtentMap& map) const
+{
+	if (!_root_size) return true;
+	return map.append(_root_start, _root_size);
+}
+
+/**
+ * Each extent is read in with one transfer straight into the buffer, apart from any
+ * partial blocks at either end, which go through a bounce buffer.
+ */
+int VFAT::read(const VFATExtentMap& map, uint64_t limit, void *buffer, size_t size, off_t off)
+{
+	if (off >= limit) return 0;
+	size = __min(size, limit - off);
+
+	uint32_t bs = block_size();
+	uint8_t *bounce = NULL;
+
+	size_t done = 0;
+	uint64_t extent_start = 0;
+	unsigned int i = 0;
+
+	while (done < size && i < map.count()) {
+		const VFATExtent& extent = map.at(i);
+		uint64_t extent_size = (uint64_t)extent.nr_blocks * bs;
+
+		if (off >= extent_start + extent_size) {
+			extent_start += extent_size;
+			i++;
+			continue;
+		}
+
+		uint64_t rel = off - extent_start;
+		uint32_t block = extent.block + (rel / bs);
+		uint32_t block_offset = rel % bs;
+		size_t chunk = __min(extent_size - rel, size - done);
+		uint8_t *dst = (uint8_t *)buffer + done;
+
+		if (block_offset == 0 && chunk >= bs) {
+			chunk -= chunk % bs;
+
+			if (!block_device().read_blocks(dst, block, chunk / bs)) break;
+		} else {
+			if (!bounce) {
+				bounce = new (HeapArena::VFS) uint8_t[bs];
+				if (!bounce) break;
+			}
+
+			if (!block_device().read_blocks(bounce, block, 1)) break;
+
+			chunk = __min(chunk, bs - block_offset);
+			memcpy(dst, bounce + block_offset, chunk);
+		}
+
+		done += chunk;
+		off += chunk;
+	}
+
+	delete[] bounce;
+
+	if (done < size && i < map.count()) {
+		return done ? (int)done : -1;
+	}
+
+	return (int)done;
+}
+
+VFATNode::VFATNode(VFAT& owner) : PFSNode(NULL, owner), _root(true), _directory(true), _size(0)
+{
+	// On FAT12/16, the root directory isn't in a cluster chain (see map()).
+	_first_cluster = owner.root_cluster();
+}
+
+VFATNode::VFATNode(VFATNode *parent, VFAT& owner, const vfat_dir_entry& entry)
+	: PFSNode(parent, owner), _root(false), _directory(entry.attributes & ATTR_DIRECTORY), _size(entry.size)
+{
+	_first_cluster = entry.first_cluster_lo;
+	if (owner.fat32()) _first_cluster |= (uint32_t)entry.first_cluster_hi << 16;
+
+	// Directories don't record a size.
+	if (_directory) _size = 0;
+}
+
+bool VFATNode::map(VFATExtentMap& map)
+{
+	if (_root && !fs().fat32()) return fs().map_fixed_root(map);
+	return fs().map_chain(_first_cluster, map);
+}
+
+bool VFATNode::disk_block(off_t offset, uint64_t& block)
+{
+	VFATExtentMap extents;
+	if (!map(extents)) return false;
+
+	uint32_t bs = fs().block_size();
+	uint64_t extent_start = 0;
+
+	for (unsigned int i = 0; i < extents.count(); i++) {
+		const VFATExtent& extent = extents.at(i);
+		uint64_t extent_size = (uint64_t)extent.nr_blocks * bs;
+
+		if (offset < extent_start + extent_size) {
+			block = extent.block + ((offset - extent_start) / bs);
+			return true;
+		}
+
+		extent_start += extent_size;
+	}
+
+	return false;
+}
+
+/**
+ * Appends a short (8.3) name part, without its padding, lowercased if the entry says so
+ * (which is how Windows stores e.g. "readme.txt" without a long name).
+ */
+static unsigned int append_short_name(char *out, unsigned int len, const char *part, unsigned int size, bool lowercase)
+{
+	while (size > 0 && part[size - 1] == ' ') size--;
+
+	for (unsigned int i = 0; i < size; i++) {
+		char c = part[i];
+		if (lowercase && c >= 'A' && c <= 'Z') c += 'a' - 'A';
+
+		out[len++] = c;
+	}
+
+	return len;
+}
+
+static String short_name(const vfat_dir_entry& entry)
+{
+	char name[13];
+	unsigned int len = append_short_name(name, 0, entry.name, 8, entry.nt_flags & NT_LOWERCASE_BASE);
+
+	if ((uint8_t)name[0] == DIRENT_KANJI_E5) name[0] = (char)DIRENT_DELETED;
+
+	if (entry.name[8] != ' ') {
+		name[len++] = '.';
+		len = append_short_name(name, len, &entry.name[8], 3, entry.nt_flags & NT_LOWERCASE_EXT);
+	}
+
+	name[len] = 0;
+	return String(name);
+}
+
+static uint8_t short_name_checksum(const vfat_dir_entry& entry)
+{
+	uint8_t sum = 0;
+	for (unsigned int i = 0; i < sizeof(entry.name); i++) {
+		sum = ((sum & 1) << 7) + (sum >> 1) + (uint8_t)entry.name[i];
+	}
+
+	return sum;
+}
+
+/**
+ * Long names are UCS-2: anything outside ASCII comes out as '?'.  A name that doesn't
+ * fill its last piece is terminated with a zero, which ends the string here too.
+ */
+static void copy_lfn_chars(char *out, const vfat_lfn_entry& piece, unsigned int offset, unsigned int count)
+{
+	// The characters aren't aligned in the entry.
+	const uint8_t *chars = (const uint8_t *)&piece + offset;
+
+	for (unsigned int i = 0; i < count; i++) {
+		uint16_t c = chars[i * 2] | (chars[(i * 2) + 1] << 8);
+		out[i] = c < 0x80 ? (char)c : '?';
+	}
+}
+
+bool VFATDirectoryReader::open(VFATNode& node)
+{
+	if (!node.is_directory()) return false;
+	if (!node.map(_extents)) return false;
+
+	_block = (vfat_dir_entry *)new (HeapArena::VFS) uint8_t[_fs.block_size()];
+	if (!_block) return false;
+
+	_index = _fs.block_size() / sizeof(vfat_dir_entry);
+	return true;
+}
+
+/**
+ * Reads directory entries, a block at a time, until the next one that names something:
+ * long name pieces are collected on the way, and used for the entry they come before if
+ * they are complete and their checksum matches its short name.
+ */
+bool VFATDirectoryReader::next(util::String& name, vfat_dir_entry& entry)
+{
+	unsigned int entries_per_block = _fs.block_size() / sizeof(vfat_dir_entry);
+
+	while (!_end && _block) {
+		if (_index == entries_per_block) {
+			int n = _fs.read(_extents, ~0ull, _block, _fs.block_size(), _off);
+			if (n < 0 || (unsigned int)n < _fs.block_size()) {
+				_end = true;
+				break;
+			}
+
+			_off += _fs.block_size();
+			_index = 0;
+		}
+
+		const vfat_dir_entry& e = _block[_index++];
+		uint8_t first = (uint8_t)e.name[0];
+
+		if (first == DIRENT_END) {
+			_end = true;
+			break;
+		}
+
+		if (first == DIRENT_DELETED) {
+			_lfn_next = 0;
+			_lfn_complete = false;
+			continue;
+		}
+
+		if ((e.attributes & ATTR_LFN) == ATTR_LFN) {
+			const vfat_lfn_entry& piece = (const vfat_lfn_entry&)e;
+			unsigned int order = piece.order & LFN_ORDER_MASK;
+
+			if (piece.order & LFN_LAST) {
+				if (!order || order > LFN_MAX_ENTRIES) {
+					_lfn_next = 0;
+					continue;
+				}
+
+				_lfn[order * LFN_CHARS_PER_ENTRY] = 0;
+				_lfn_next = order;
+				_lfn_checksum = piece.checksum;
+			}
+
+			_lfn_complete = false;
+			if (!_lfn_next || order != _lfn_next || piece.checksum != _lfn_checksum) {
+				_lfn_next = 0;
+				continue;
+			}
+
+			char *out = &_lfn[(order - 1) * LFN_CHARS_PER_ENTRY];
+			copy_lfn_chars(out, piece, offsetof(vfat_lfn_entry, name1), 5);
+			copy_lfn_chars(out + 5, piece, offsetof(vfat_lfn_entry, name2), 6);
+			copy_lfn_chars(out + 11, piece, offsetof(vfat_lfn_entry, name3), 2);
+
+			_lfn_next--;
+			_lfn_complete = (_lfn_next == 0);
+			continue;
+		}
+
+		bool have_lfn = _lfn_complete && _lfn_checksum == short_name_checksum(e);
+		_lfn_next = 0;
+		_lfn_complete = false;
+
+		if (e.attributes & ATTR_VOLUME_ID) continue;
+
+		// The VFS doesn't use these.
+		if (first == '.' && (e.name[1] == ' ' || (e.name[1] == '.' && e.name[2] == ' '))) continue;
+
+		name = have_lfn ? String(_lfn) : short_name(e);
+		entry = e;
+		return true;
+	}
+
+	return false;
 }
 
-VFATNode::VFATNode(VFAT& owner) : PFSNode(NULL, owner)
+/**
+ * Names on a FAT filesystem are case-insensitive.
+ */
+static bool names_match(const String& a, const String& b)
 {
+	if (a.length() != b.length()) return false;
+
+	for (unsigned int i = 0; i < a.length(); i++) {
+		char ca = a[i], cb = b[i];
+		if (ca >= 'a' && ca <= 'z') ca -= 'a' - 'A';
+		if (cb >= 'a' && cb <= 'z') cb -= 'a' - 'A';
+
+		if (ca != cb) return false;
+	}
 
+	return true;
 }
 
 PFSNode* VFATNode::get_child(const util::String& name)
 {
+	VFATDirectoryReader reader(fs());
+	if (!reader.open(*this)) return NULL;
+
+	String entry_name;
+	vfat_dir_entry entry;
+
+	while (reader.next(entry_name, entry)) {
+		if (names_match(entry_name, name)) {
+			return new (HeapArena::VFS) VFATNode(this, fs(), entry);
+		}
+	}
+
 	return NULL;
 }
 
 PFSNode* VFATNode::mkdir(const util::String& name)
 {
+	// The filesystem is read-only.
 	return NULL;
 }
 
-
 File* VFATNode::open()
 {
-	return NULL;
+	if (_directory) return NULL;
+
+	VFATFile *file = new (HeapArena::VFS) VFATFile(fs(), _size);
+	if (!file) return NULL;
+
+	if (!fs().map_chain(_first_cluster, file->extents())) {
+		delete file;
+		return NULL;
+	}
+
+	return file;
+}
+
+bool VFATDirectory::read_entry(DirectoryEntry& de)
+{
+	String name;
+	vfat_dir_entry entry;
+
+	if (!_reader.next(name, entry)) return false;
+
+	de.name = name;
+	de.size = (entry.attributes & ATTR_DIRECTORY) ? 0 : entry.size;
+	return true;
 }
 
 Directory* VFATNode::opendir()
 {
-	return NULL;
+	VFATDirectory *dir = new (HeapArena::VFS) VFATDirectory(fs());
+	if (!dir) return NULL;
+
+	if (!dir->open(*this)) {
+		delete dir;
+		return NULL;
+	}
+
+	return dir;
+}
+
+int VFATFile::read(void *buffer, size_t size)
+{
+	int n = pread(buffer, size, _pos);
+	if (n > 0) _pos += n;
+
+	return n;
+}
+
+int VFATFile::pread(void *buffer, size_t size, off_t off)
+{
+	return _fs.read(_extents, _size, buffer, size, off);
+}
+
+void VFATFile::seek(off_t offset, SeekType type)
+{
+	if (type == SeekAbsolute) {
+		_pos = offset;
+	} else if (type == SeekRelative) {
+		_pos += offset;
+	}
 }
 
 static Filesystem *vfat_create(VirtualFilesystem& vfs, infos::drivers::Device *dev)
 {
 	if (!dev->device_class().is(BlockDevice::BlockDeviceClass)) return NULL;
-	return new VFAT((BlockDevice &) *dev);
+	return new (HeapArena::VFS) VFAT((BlockDevice &) *dev);
 }
 
 RegisterFilesystem(vfat, vfat_create);
@@ -14,9 +14,35 @@
 #include <infos/kernel/log.h>
 #include <infos/fs/vfs.h>
 #include <infos/fs/filesystem.h>
+#include <infos/util/lock.h>
 
 using namespace infos::fs;
 using namespace infos::kernel;
+using namespace infos::util;
+
+DEFINE_SLAB_ALLOCATED(VFSNode);
+
+// Serialises changes to the tree of VFS nodes.  Lookups don't take it.
+static Mutex vfs_tree_mtx;
+
+// The number of chains in the dentry cache.
+#define VFS_DCACHE_BUCKETS	1024
+
+static VFSNode * volatile dcache[VFS_DCACHE_BUCKETS];
+
+// Negative entries made before the current generation are stale.
+static volatile uint32_t dcache_generation;
+
+static inline unsigned int dcache_bucket(const VFSNode *parent, String::hash_type name_hash)
+{
+	uint64_t hash = ((uintptr_t)parent ^ name_hash) * 0x9e3779b97f4a7c15ull;
+	return (unsigned int)(hash >> 54) % VFS_DCACHE_BUCKETS;
+}
+
+void VFSNode::invalidate_negative_entries()
+{
+	__atomic_add_fetch(&dcache_generation, 1, __ATOMIC_RELEASE);
+}
 
 Filesystem *VFSNode::mount(const util::String& fstype, drivers::Device* dev)
 {
@@ -38,30 +64,104 @@ Filesystem *VFSNode::mount(const util::String& fstype, drivers::Device* dev)
 		return NULL;
 	}
 	
-	_pn = pn;
-	_children.clear();
+	{
+		UniqueLock<Mutex> l(vfs_tree_mtx);
+
+		// The old children are keyed by the old filesystem node, so they drop out of
+		// the dentry cache.  They aren't freed, since a lookup may still be walking
+		// them, and open files may still refer to them.
+		__atomic_store_n(&_pn, pn, __ATOMIC_RELEASE);
+		invalidate_negative_entries();
+	}
 	
 	//vfs_log.messagef(LogLevel::DEBUG, "vfsnode: mount vfs=%p pfs=%p", this, pn);
 	return fs;
 }
 
+VFSNode *VFSNode::find_child(const PFSNode *pn, const String& name) const
+{
+	String::hash_type name_hash = name.get_hash();
+
+	VFSNode *child = __atomic_load_n(&dcache[dcache_bucket(this, name_hash)], __ATOMIC_ACQUIRE);
+	for (; child; child = child->_hash_next) {
+		if (child->parent() == this && child->_parent_pn == pn && child->_name.get_hash() == name_hash && child->_name == name) return child;
+	}
+
+	return NULL;
+}
+
+/**
+ * Adds a child to the dentry cache, or, if 'assoc' is NULL, a negative entry.  Called
+ * with the VFS tree lock held.
+ */
+VFSNode *VFSNode::add_child(PFSNode *pn, const String& name, PFSNode *assoc)
+{
+	VFSNode *child = new VFSNode(this, assoc);
+	if (!child) return NULL;
+
+	child->_parent_pn = pn;
+	child->_name = name;
+	// Lookups read the hash without the lock, so it is worked out before the entry is
+	// published.
+	child->_name.get_hash();
+	child->_negative = !assoc;
+	child->_generation = dcache_generation;
+
+	VFSNode * volatile& chain = dcache[dcache_bucket(this, name.get_hash())];
+	child->_hash_next = chain;
+	__atomic_store_n(&chain, child, __ATOMIC_RELEASE);
+
+	return child;
+}
+
 VFSNode* VFSNode::get_child(const util::String& name)
 {
-	if (!_pn) return NULL;
+	PFSNode *pn = __atomic_load_n(&_pn, __ATOMIC_ACQUIRE);
+	if (!pn) return NULL;
 	
-	VFSNode *child;
-	if (!_children.try_get_value(name.get_hash(), child)) {
-		PFSNode *assoc = _pn->get_child(name);
-		if (!assoc) {
-			return NULL;
+	// Read the generation before asking the filesystem, so that a name added while the
+	// lookup is in progress can only make the negative entry stale.
+	uint32_t generation = __atomic_load_n(&dcache_generation, __ATOMIC_ACQUIRE);
+
+	VFSNode *child = find_child(pn, name);
+	if (child) {
+		if (!__atomic_load_n(&child->_negative, __ATOMIC_ACQUIRE)) return child;
+		if (child->_generation == generation) return NULL;
+	}
+
+	// Ask the filesystem without the lock, since it may have to go to the disk.
+	PFSNode *assoc = pn->get_child(name);
+
+	UniqueLock<Mutex> l(vfs_tree_mtx);
+
+	// If there has been a mount here, the filesystem's node belongs to the old one.
+	if (_pn != pn) return NULL;
+
+	// Another lookup may have added the child in the meantime, in which case the
+	// filesystem's node is left alone: some filesystems hand out the same node again.
+	child = find_child(pn, name);
+	if (child && !child->_negative) return child;
+
+	if (!assoc) {
+		if (!child) {
+			child = add_child(pn, name, NULL);
+			if (child) child->_generation = generation;
+		} else if ((int32_t)(generation - child->_generation) > 0) {
+			child->_generation = generation;
 		}
-		
-		child = new VFSNode(this, assoc);
-		_children.add(name.get_hash(), child);
+
+		return NULL;
 	}
-	
-	//vfs_log.messagef(LogLevel::DEBUG, "vfsnode: get child %s vfs=%p pfs=%p child-vfs=%p", name.c_str(), this, _pn, child);
-	return child;
+
+	if (child) {
+		// A stale negative entry becomes the real one.
+		child->_pn = assoc;
+		__atomic_store_n(&child->_negative, false, __ATOMIC_RELEASE);
+		return child;
+	}
+
+	//vfs_log.messagef(LogLevel::DEBUG, "vfsnode: get child %s vfs=%p pfs=%p", name.c_str(), this, _pn);
+	return add_child(pn, name, assoc);
 }
 
 VFSNode* VFSNode::mkdir(const util::String& name)
@@ -70,6 +170,18 @@ VFSNode* VFSNode::mkdir(const util::String& name)
 	
 	PFSNode *dir = _pn->mkdir(name);
 	if (!dir) return NULL;
-	
+
+	invalidate_negative_entries();
+	return get_child(name);
+}
+
+VFSNode* VFSNode::create(const util::String& name)
+{
+	if (!_pn) return NULL;
+
+	PFSNode *file = _pn->create(name);
+	if (!file) return NULL;
+
+	invalidate_negative_entries();
 	return get_child(name);
 }
@@ -14,6 +14,7 @@
 #include <infos/fs/filesystem.h>
 #include <infos/fs/file.h>
 #include <infos/fs/directory.h>
+#include <infos/fs/page-cache.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/device-manager.h>
 #include <infos/util/string.h>
@@ -40,9 +41,7 @@ bool VirtualFilesystem::init()
 	FilesystemRegistration *reg = (FilesystemRegistration *)&_VFS_REG_START;
 	
 	while (reg < (FilesystemRegistration *)&_VFS_REG_END) {
-		vfs_log.messagef(LogLevel::INFO, "Registering filesystem '%s'", reg->name);
-		_filesystems.append(reg);
-		
+		register_filesystem(*reg);
 		reg++;
 	}
 	
@@ -65,10 +64,49 @@ File* VirtualFilesystem::open(const String& path, int flags)
 {
 	VFSNode *node = lookup_node(path);
 
+	if (!node && (flags & FileOpenFlags::CREATE)) {
+		node = create(path);
+	}
+
 	if (!node) return NULL;
-	if (!node->pn()) return NULL;	
-	
-	return node->pn()->open();
+
+	PFSNode *pn = node->pn();
+	if (!pn) return NULL;
+
+	File *file = pn->open();
+	if (!file) return NULL;
+
+	if ((flags & FileOpenFlags::TRUNCATE) && file->truncate(0) < 0) {
+		delete file;
+		return NULL;
+	}
+
+	if (flags & FileOpenFlags::NONBLOCK) file->set_nonblocking(true);
+
+	if (!pn->owner().uses_page_cache()) return file;
+
+	File *cached = new CachedFile(file, *pn);
+	return cached ? cached : file;
+}
+
+/**
+ * Creates a regular file, in a directory that must already exist.
+ */
+VFSNode *VirtualFilesystem::create(const String& path)
+{
+	const char *p = path.c_str();
+
+	int last_slash = -1;
+	for (int i = 0; p[i]; i++) {
+		if (p[i] == '/') last_slash = i;
+	}
+
+	if (last_slash < 0 || p[last_slash + 1] == 0) return NULL;
+
+	VFSNode *parent = lookup_node(last_slash == 0 ? String("/") : String(p, last_slash));
+
+	if (!parent) return NULL;
+	return parent->create(&p[last_slash + 1]);
 }
 
 Directory* VirtualFilesystem::opendir(const String& path, int flags)
@@ -93,6 +131,12 @@ FilesystemRegistration* VirtualFilesystem::lookup_fs(const util::String& fstype)
 	return fsreg;
 }
 
+void VirtualFilesystem::register_filesystem(FilesystemRegistration& reg)
+{
+	vfs_log.messagef(LogLevel::INFO, "Registering filesystem '%s'", reg.name);
+	_filesystems.append(&reg);
+}
+
 Filesystem* VirtualFilesystem::instantiate_fs(const char* fstype, Device *dev)
 {
 	FilesystemRegistration *fsreg = lookup_fs(fstype);
@@ -123,22 +167,19 @@ VFSNode* VirtualFilesystem::lookup_node(const String& spath)
 	// Prepare to read path components
 	path++;
 	
-	char component[256];
 	do {
-		int i = 0;
-		while (*path && *path != '/') {
-			component[i++] = *path++;
-		}
-		component[i] = 0;
+		const char *start = path;
+		while (*path && *path != '/') path++;
+
+		StringView component(start, path - start);
 		if (*path == '/') path++;
 		
-		if (strlen(component) == 0) {
+		if (component.empty()) {
 			return current_node;
 		}
 
-		//fs_log.messagef(LogLevel::DEBUG, "component=%s", component);
-		current_node = current_node->get_child(component);
-		//fs_log.messagef(LogLevel::DEBUG, "node=%p remain=%s", current_node, path);
+		// A component short enough to be kept inline doesn't allocate.
+		current_node = current_node->get_child(String(component));
 	} while (current_node);
 	
 	return current_node;
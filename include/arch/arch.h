@@ -4,6 +4,7 @@
 
 #include <infos/kernel/irq.h>
 #include <infos/kernel/syscall.h>
+#include <infos/util/time.h>
 
 extern "C"
 {
@@ -34,9 +35,35 @@ namespace infos
 			virtual bool interrupts_enabled() = 0;
 			
 			virtual void calibrate_busywait_loop(kernel::DeviceManager& dm) = 0;
-			virtual void set_periodic_timer_interrupt(kernel::DeviceManager& dm) = 0;
+			/* The timer interrupt is one-shot: once it has been started, the scheduler
+			 * arms it for the next time it needs to run, or stops it if there is
+			 * nothing to do but idle. */
+			virtual void start_timer_interrupt(kernel::DeviceManager& dm) = 0;
+			virtual void set_next_timer_interrupt(util::Nanoseconds delay) = 0;
+			virtual void stop_timer_interrupt() = 0;
+			/* How the kernel runtime clock is computed from a counter that user code can
+			 * read too: ((counter - base) * mult) >> shift.  Returns false if it isn't. */
+			virtual bool runtime_clock_source(uint64_t& base, uint64_t& mult, unsigned int& shift) const = 0;
+
+			/* How long, in ns, the current CPU has been kept from running by a
+			 * hypervisor, since it started.  Zero on bare metal. */
+			virtual uint64_t steal_time() = 0;
 
 			virtual kernel::CPU& get_current_cpu() = 0;
+			/* The CPUs that have been found, whether or not they are online yet. */
+			virtual unsigned int nr_cpus() const = 0;
+			virtual kernel::CPU& get_cpu(unsigned int index) const = 0;
+
+			/* Puts the current CPU to sleep, with interrupts enabled, until an
+			 * interrupt arrives or another CPU calls wake_cpu() on it. */
+			virtual void idle() = 0;
+			virtual void wake_cpu(kernel::CPU& cpu) = 0;
+			/* Makes another CPU, idle or not, run the scheduler as soon as it can. */
+			virtual void reschedule_cpu(kernel::CPU& cpu) = 0;
+			/* Called in each round of a loop that waits, with interrupts disabled, for
+			 * another CPU, which may itself be waiting for this one to do something
+			 * (e.g. drop a stale translation). */
+			virtual void relax() = 0;
 			
 			virtual void dump_current_context() const = 0;
 			virtual void dump_thread_context(const kernel::ThreadContext& context) const = 0;
@@ -46,8 +73,14 @@ namespace infos
 			
 			virtual kernel::Thread& get_current_thread() const = 0;
 			virtual void set_current_thread(kernel::Thread& thread) = 0;
+			/* Releases the architectural state (e.g. the FPU state) of a thread that
+			 * is going away. */
+			virtual void release_thread_state(kernel::Thread& thread) = 0;
 			
 			virtual kernel::IRQ *request_irq() = 0;
+
+			/* Called when a handler has been attached to an IRQ. */
+			virtual void irq_handlers_changed(const kernel::IRQ& irq) = 0;
 		};
 		
 		extern Arch& sys_arch;
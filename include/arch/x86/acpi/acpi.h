@@ -14,6 +14,11 @@ namespace infos
 			{
 				bool acpi_init();
 				uint32_t acpi_get_ioapic_base();
+				uint64_t acpi_get_hpet_base();
+				bool acpi_get_pci_ecam(uint64_t& base, uint8_t& start_bus, uint8_t& end_bus);
+				unsigned int acpi_get_nr_lapics();
+				uint8_t acpi_get_lapic_id(unsigned int index);
+				unsigned int acpi_get_lapic_node(uint8_t apic_id);
 				
 				extern kernel::ComponentLog acpi_log;
 			}
@@ -11,9 +11,16 @@
 #pragma once
 
 #include <infos/kernel/cpu.h>
+#include <infos/kernel/thread-context.h>
+#include <arch/x86/dt.h>
 
 namespace infos
 {
+	namespace kernel
+	{
+		class Thread;
+	}
+
 	namespace arch
 	{
 		namespace x86
@@ -22,6 +29,48 @@ namespace infos
 			{
 			public:
 				X86CPU();
+
+				/* The thread running on this CPU, whose context interrupts are saved to. */
+				kernel::Thread *current_thread;
+
+				/* The thread whose state is loaded in this CPU's FPU, or NULL.  With
+				 * fpu.lazy=1, the FPU is loaded lazily, so this need not be the running
+				 * thread, but then its state is also saved.  A thread owns at most one
+				 * CPU's FPU. */
+				kernel::Thread *fpu_owner;
+				/* Whether the kernel is using the FPU itself (see KernelFPUSection). */
+				bool in_kernel_fpu;
+
+				/* What the performance counters read when the running thread was
+				 * switched to, so that what it counted can be added to its own. */
+				uint64_t pmu_start[PMU_NR_EVENTS];
+
+				/* This CPU's task-state segment, and the selector of its descriptor in the
+				 * GDT.  The selector also says which CPU this is (see X86Arch::add_cpu()). */
+				TSS tss;
+				uint16_t tss_sel;
+
+				/* The position of this CPU in X86Arch's CPU list.  The boot CPU is zero. */
+				unsigned int index;
+				uint8_t apic_id;
+
+				/* This CPU's copy of the per-CPU variables (see percpu.h), which its GS
+				 * base points at. */
+				uintptr_t percpu_area;
+
+				/* Set by the CPU itself, once it has finished initialising. */
+				volatile bool online;
+
+				/* Only a CPU that runs the scheduler has interrupts enabled. */
+				bool takes_interrupts() const { return online && runqueue() != NULL; }
+
+				/* Watched with monitor/mwait while the CPU is idle, so that another CPU
+				 * can wake it by writing to it (see X86Arch::wake_cpu()). */
+				volatile uint32_t idle_wake;
+
+				/* The physical address of the page tables loaded in CR3, so that only
+				 * the CPUs using a VMA are sent its TLB shootdowns. */
+				volatile phys_addr_t active_pgt;
 			};
 		}
 	}
@@ -23,7 +23,14 @@ namespace infos {
 
 #define CPUID_GETVENDOR			0x00000000
 #define CPUID_GET_FEATURES		0x00000001
+#define CPUID_GET_STRUCT_FEATURES	0x00000007
 #define CPUID_GET_EX_FEATURES	0x80000001
+#define CPUID_GET_EX_MAX		0x80000000
+#define CPUID_GET_POWER_MGMT	0x80000007
+#define CPUID_GET_TSC_FREQ		0x00000015
+#define CPUID_GET_PROC_FREQ		0x00000016
+#define CPUID_HYPERVISOR_BASE	0x40000000
+#define CPUID_HYPERVISOR_TIMING	0x40000010
 
 			static inline CPUID __cpuid(uint64_t rax) {
 				CPUID ret;
@@ -32,6 +39,14 @@ namespace infos {
 				return ret;
 			}
 
+			/* For the leaves that have sub-leaves, e.g. CPUID_GET_STRUCT_FEATURES. */
+			static inline CPUID __cpuid(uint64_t rax, uint64_t rcx) {
+				CPUID ret;
+				asm volatile("cpuid" : "=a"(ret.rax), "=b"(ret.rbx), "=c"(ret.rcx), "=d"(ret.rdx) : "a"(rax), "c"(rcx));
+
+				return ret;
+			}
+
 			namespace CPUIDFeatures {
 
 				enum CPUIDFeaturesRCX {
@@ -50,6 +65,7 @@ namespace infos {
 					CX16 = 1 << 13,
 					ETPRD = 1 << 14,
 					PDCM = 1 << 15,
+					PCID = 1 << 17,
 					DCA = 1 << 18,
 					SSE4_1 = 1 << 19,
 					SSE4_2 = 1 << 20,
@@ -60,6 +76,7 @@ namespace infos {
 					XSAVE = 1 << 26,
 					OSXSAVE = 1 << 27,
 					AVX = 1 << 28,
+					HYPERVISOR = 1u << 31,
 				};
 
 				enum CPUIDFeaturesRDX {
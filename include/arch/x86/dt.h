@@ -224,6 +224,8 @@ namespace infos
 				const void *ptr;
 			} __packed;
 			
+			class TSS;
+
 			class DT {
 			public:
 				virtual bool init() = 0;
@@ -231,7 +233,13 @@ namespace infos
 				virtual uintptr_t get_ptr() = 0;
 			};
 			
-#define MAX_NR_GDT_ENTRIES	16
+// Room for the segments, and a TSS descriptor (two entries) for each CPU.
+#define MAX_NR_GDT_ENTRIES	40
+
+// The TSS descriptors come straight after the segments, one per CPU in the order
+// the CPUs were added, so the task register identifies the CPU.
+#define GDT_TSS_BASE_SEL	0x28
+#define GDT_TSS_SEL_STRIDE	16
 			
 			class GDT : public DT {
 			public:
@@ -245,6 +253,7 @@ namespace infos
 				bool add_code_segment(uint8_t dpl);
 				bool add_data_segment(uint8_t dpl);
 				bool add_tss(void *ptr, size_t size);
+				bool add_tss(TSS& tss, uint16_t& sel);
 				
 			private:
 				uint8_t _current;
@@ -282,7 +291,6 @@ namespace infos
 			
 			extern GDT gdt;
 			extern IDT idt;
-			extern TSS tss;
 		}
 	}
 }
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/arch/x86/extable.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <arch/x86/context.h>
+
+namespace infos
+{
+	namespace arch
+	{
+		namespace x86
+		{
+			/* An entry in the exception table (the .extable section): an instruction in the
+			 * kernel that may fault on a user address, and where to resume if it does. */
+			struct ExceptionTableEntry
+			{
+				uintptr_t fault_rip;
+				uintptr_t fixup_rip;
+			} __packed;
+
+			/* If the context faulted in kernel mode at an instruction in the exception
+			 * table, redirects it to the fixup and returns true. */
+			extern bool fixup_exception(X86Context& context);
+		}
+	}
+}
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/arch/x86/fpu.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class Thread;
+	}
+
+	namespace arch
+	{
+		namespace x86
+		{
+			/* Prepares the FPU for a switch to the given thread: if the thread's state
+			 * isn't the one in the FPU, the next FPU instruction traps, and loads it. */
+			extern void fpu_switch_to(kernel::Thread& thread);
+			/* Forgets the FPU state of a thread that is going away. */
+			extern void fpu_release(kernel::Thread& thread);
+
+			/* Hands the FPU to the kernel, with a clean state, after saving the state
+			 * of whichever thread has it.  Called with interrupts disabled, which they
+			 * have to stay until kernel_fpu_end(), and the two don't nest.  Use a
+			 * KernelFPUSection, rather than calling these directly. */
+			extern void kernel_fpu_begin();
+			extern void kernel_fpu_end();
+
+			/* A stretch of kernel code that may use the x87 and SSE registers, e.g. a
+			 * vectorised loop in a file built with SSE (see *-simd.cpp in the Makefile).
+			 * Interrupts are disabled for as long as it lasts, so it can't be preempted,
+			 * and mustn't sleep. */
+			class KernelFPUSection
+			{
+			public:
+				KernelFPUSection() { _irq.lock(); kernel_fpu_begin(); }
+				~KernelFPUSection() { kernel_fpu_end(); _irq.unlock(); }
+
+				KernelFPUSection(const KernelFPUSection&) = delete;
+
+			private:
+				util::IRQLock _irq;
+			};
+		}
+	}
+}
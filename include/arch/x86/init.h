@@ -22,7 +22,13 @@ namespace infos {
 			extern bool platform_init(void);
 			extern bool mm_init(void);
 			extern bool mm_pf_init(void);
+			extern void pat_init_cpu(void);
+			extern void fast_string_init(void);
 			extern bool cpu_init(void);
+			extern bool fpu_init(void);
+			extern void fpu_init_cpu(void);
+			extern void pmu_init(void);
+			extern void pmu_init_cpu(void);
 			extern bool modules_init(void);
 			extern bool sched_init(void);
 			
@@ -31,6 +37,8 @@ namespace infos {
 			extern bool activate_console(void);
 			
 			extern bool devices_init(void);
+			extern bool smp_init(void);
+			extern bool irq_balance_init(void);
 			
 			extern kernel::ComponentLog x86_log;
 		}
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/arch/x86/ipi.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace irq
+		{
+			class LAPIC;
+		}
+	}
+
+	namespace arch
+	{
+		namespace x86
+		{
+			class X86CPU;
+
+			/* The kinds of interprocessor interrupt, each with a vector of its own. */
+			namespace IPIType
+			{
+				enum IPIType
+				{
+					RESCHEDULE = 0,		// Run the scheduler, e.g. after a remote wakeup
+					TLB_SHOOTDOWN = 1,	// Drop translations that have been unmapped
+					CALL_FUNCTION = 2,	// Run a function
+					NR_TYPES = 3
+				};
+			}
+
+			/* A bit for each CPU, by its index. */
+			typedef uint64_t CPUMask;
+
+			typedef void (*ipi_fn_t)(void *arg);
+
+			struct IPIStats
+			{
+				uint64_t sent;			// Interrupts sent, one for each target CPU
+				uint64_t received;		// Interrupts (or queued calls) handled
+			};
+
+			/* Allocates the IPI vectors.  Called as the other CPUs are started. */
+			extern bool ipi_init(drivers::irq::LAPIC& lapic);
+
+			/* Interrupts another CPU, so that it runs its scheduler.  Does nothing if the
+			 * CPU isn't online. */
+			extern void ipi_send_reschedule(X86CPU& cpu);
+
+			/* Runs a function on each of the CPUs in the mask that take interrupts, and
+			 * returns once they all have.  On the current CPU, if it is in the mask, the
+			 * function is called directly, with interrupts disabled.  It may be called
+			 * with interrupts disabled, as calls to this CPU are run while it waits. */
+			extern void ipi_call_function(CPUMask cpus, ipi_fn_t fn, void *arg, IPIType::IPIType type = IPIType::CALL_FUNCTION);
+
+			/* Runs the calls that other CPUs have queued for this one, without waiting
+			 * for their interrupt.  Called with interrupts disabled. */
+			extern void ipi_run_queued_calls();
+
+			/* The CPUs, other than this one, that take interrupts. */
+			extern CPUMask ipi_other_cpus();
+
+			extern IPIStats ipi_stats(IPIType::IPIType type);
+		}
+	}
+}
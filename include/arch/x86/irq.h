@@ -4,6 +4,8 @@
 
 #include <infos/define.h>
 #include <infos/kernel/irq.h>
+#include <infos/util/spinlock.h>
+#include <arch/x86/msr.h>
 
 #define MAX_IRQS 256
 
@@ -14,6 +16,7 @@ namespace infos
 		namespace x86
 		{
 #define IRQ_TRAP			0x03
+#define IRQ_DEVICE_NOT_AVAILABLE	0x07
 #define IRQ_PAGE_FAULT		0x0e
 #define IRQ_GPF				0x0d
 #define IRQ_KERNEL_SYSCALL	0x80
@@ -22,7 +25,8 @@ namespace infos
 			class ExceptionIRQ : public kernel::IRQ
 			{
 			public:
-				void handle() const override;
+				ExceptionIRQ() : IRQ(kernel::IRQFlags::MUST_HANDLE) { }
+
 				void enable() override;
 				void disable() override;
 			};
@@ -30,22 +34,27 @@ namespace infos
 			class SoftwareIRQ : public kernel::IRQ
 			{
 			public:
-				void handle() const override;
+				SoftwareIRQ() : IRQ(kernel::IRQFlags::MUST_HANDLE | kernel::IRQFlags::NO_KERNEL_LOCK) { }
+
 				void enable() override;
 				void disable() override;
 			};
 			
-			class IRQDescriptor
+			/* What the interrupt entry path needs to know about a vector, in a line of
+			 * its own, so that dispatching the common case of one handler is a load of
+			 * that line and a call.  It is a copy of its IRQ's handlers, brought up to
+			 * date when they change. */
+			struct IRQVector
 			{
-			public:
-				IRQDescriptor() : _irq(NULL) { }
-
-				kernel::IRQ *irq() const { return _irq; }
-				void irq(kernel::IRQ *irq) { _irq = irq; }
-
-			private:
-				kernel::IRQ *_irq;
-			};
+				kernel::IRQ::irq_handler_t handler;
+				void *priv;
+				const kernel::IRQ::SharedHandler *shared;
+				kernel::IRQ *irq;
+				uint32_t flags;
+				uint64_t count;			// How many times the vector has been raised
+				uint64_t cycles;		// The TSC cycles spent in its handlers, in all
+				uint64_t max_cycles;	// ... and the most at once
+			} __aligned(64);
 			
 			class IRQManager
 			{
@@ -56,16 +65,65 @@ namespace infos
 				bool install_software_handler(uint8_t nr, kernel::IRQ::irq_handler_t handler, void *priv);
 				
 				bool attach_irq(kernel::IRQ *irq);
-								
-				const IRQDescriptor *get_irq_descriptor(uint8_t nr) const { return &irq_descriptors[nr]; }
+
+				/* Attaches IRQ objects to a block of consecutive vectors, aligned to its
+				 * length, which is a power of two, as multi-message MSI needs. */
+				bool attach_irq_block(kernel::IRQ **irqs, unsigned int count);
+
+				/* Copies an IRQ's handlers into its vector, once they have changed. */
+				void update_vector(const kernel::IRQ& irq);
+
+				/* Where the local APIC is told an interrupt has been handled.  Every
+				 * CPU's local APIC is at the same address. */
+				void set_eoi_register(volatile uint32_t *eoi) { _eoi_register = eoi; }
+
+				/* In x2APIC mode, an interrupt is acknowledged by writing an MSR, which
+				 * (unlike an MMIO write) doesn't leave a hypervisor to decode it, and
+				 * the interrupts can only be sent to physical APIC IDs. */
+				void set_x2apic() { _x2apic = true; }
+				bool x2apic() const { return _x2apic; }
+
+				void eoi()
+				{
+					if (_x2apic) {
+						__wrmsr(MSR_X2APIC_EOI, 0);
+					} else {
+						*_eoi_register = 0;
+					}
+				}
+
+				IRQVector& vector(uint8_t nr) { return _vectors[nr]; }
+				const IRQVector& vector(uint8_t nr) const { return _vectors[nr]; }
+				volatile uint32_t *eoi_register() const { return _eoi_register; }
 				
 			private:
-				IRQDescriptor irq_descriptors[MAX_IRQS];
+				IRQVector _vectors[MAX_IRQS];
+				volatile uint32_t *_eoi_register;
+				bool _x2apic;
+				util::SpinLock _attach_lock;		// Devices may be attached from several threads.
+
+				void assign_vector(uint8_t nr, kernel::IRQ *irq);
 				
 				template<typename T>
 				bool install_handler(uint8_t nr, kernel::IRQ::irq_handler_t handler, void *priv);
 			};
 			
+			/* How an interrupt is addressed, by the IOAPIC or by MSI. */
+			struct IRQDestination
+			{
+				bool logical;			// In logical (flat) destination mode, with lowest-priority delivery
+				uint8_t destination;	// An APIC ID, or a set of logical APIC IDs
+			};
+
+			/* Works out how to send an interrupt to the CPUs in the mask.  CPUs that
+			 * don't take interrupts are left out, and if that leaves none, returns
+			 * false. */
+			bool irq_destination(kernel::IRQ::AffinityMask mask, IRQDestination& dest);
+
+			/* Each CPU's local APIC has a logical ID with a bit for the CPU, so the
+			 * first eight CPUs can be addressed as a set. */
+			static const unsigned int MAX_LOGICAL_CPUS = 8;
+
 			static inline uint64_t __save_flags()
 			{
 				uint64_t flags;
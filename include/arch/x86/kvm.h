@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/arch/x86/kvm.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace arch
+	{
+		namespace x86
+		{
+			class X86CPU;
+
+			/* Whether the kernel is running as a KVM guest. */
+			extern bool kvm_detected();
+
+			/* Registers the current CPU's paravirtual clock and steal-time areas with
+			 * the host, if it offers them.  Called on each CPU as it starts. */
+			extern void kvm_init_cpu(X86CPU& cpu);
+
+			/* The TSC frequency, from how the host scales the boot CPU's paravirtual
+			 * clock, or zero if there isn't one. */
+			extern uint64_t kvm_tsc_frequency();
+
+			/* How long, in ns, the host has kept the CPU from running since it was
+			 * registered, or zero if the host doesn't say. */
+			extern uint64_t kvm_steal_time(X86CPU& cpu);
+		}
+	}
+}
@@ -21,9 +21,19 @@ namespace infos {
 #define MSR_SFMASK 0xc0000084
 
 #define MSR_APIC_BASE 0x1b
+#define MSR_APIC_BASE_EXTD (1 << 10)	// x2APIC mode
+#define MSR_APIC_BASE_EN (1 << 11)
+
+// In x2APIC mode, the local APIC's registers are MSRs, from 0x800, one for each 16
+// bytes of the MMIO range.
+#define MSR_X2APIC_BASE 0x800
+#define MSR_X2APIC_EOI 0x80b
+#define MSR_X2APIC_ICR 0x830
+#define MSR_PAT 0x277
 			
 #define MSR_FS_BASE 0xc0000100
 #define MSR_GS_BASE 0xc0000101
+#define MSR_KERNEL_GS_BASE 0xc0000102
 
 			static inline void __wrmsr(uint32_t msr_id, uint64_t msr_value) {
 				uint32_t low = msr_value & 0xffffffff;
@@ -38,6 +48,13 @@ namespace infos {
 				asm volatile("rex.b rdmsr" : "=a"(low), "=d"(high) : "c" (msr_id));
 				return (uint64_t) low | (((uint64_t) high) << 32);
 			}
+
+			static inline uint64_t __rdtsc() {
+				uint32_t low, high;
+
+				asm volatile("rdtsc" : "=a"(low), "=d"(high));
+				return (uint64_t) low | (((uint64_t) high) << 32);
+			}
 		}
 	}
 }
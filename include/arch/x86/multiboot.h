@@ -90,7 +90,28 @@ namespace infos {
 				uint16_t vbe_interface_seg;
 				uint16_t vbe_interface_off;
 				uint16_t vbe_interface_len;
+
+				/* Framebuffer, if MULTIBOOT_INFO_FRAMEBUFFER is set */
+				uint64_t framebuffer_addr;
+				uint32_t framebuffer_pitch;
+				uint32_t framebuffer_width;
+				uint32_t framebuffer_height;
+				uint8_t framebuffer_bpp;
+#define MULTIBOOT_FRAMEBUFFER_TYPE_INDEXED      0
+#define MULTIBOOT_FRAMEBUFFER_TYPE_RGB          1
+#define MULTIBOOT_FRAMEBUFFER_TYPE_EGA_TEXT     2
+				uint8_t framebuffer_type;
+
+				/* Colour layout, for MULTIBOOT_FRAMEBUFFER_TYPE_RGB */
+				uint8_t framebuffer_red_field_position;
+				uint8_t framebuffer_red_mask_size;
+				uint8_t framebuffer_green_field_position;
+				uint8_t framebuffer_green_mask_size;
+				uint8_t framebuffer_blue_field_position;
+				uint8_t framebuffer_blue_mask_size;
 			};
+
+#define MULTIBOOT_INFO_FRAMEBUFFER              (1 << 12)
 			
 			extern struct multiboot_info *multiboot_info_structure;
 		}
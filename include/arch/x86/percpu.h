@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/arch/x86/percpu.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <arch/x86/cpu.h>
+
+/* Per-CPU variables are collected into one section (see kernel.ld), which is the boot
+ * CPU's copy.  Every other CPU gets a zeroed copy of its own, and the GS base of each
+ * CPU points at its copy, so that the variable is one %gs-relative access away.
+ *
+ * While a CPU is in user mode, its GS base is the user's, and the kernel's is kept in
+ * KERNEL_GS_BASE: the entry and exit paths swap them. */
+#define DEFINE_PER_CPU(__type, __name) __section(".percpu") infos::arch::x86::PerCPU<__type> __name
+
+extern "C" char __percpu_start[], __percpu_end[];
+
+namespace infos
+{
+	namespace arch
+	{
+		namespace x86
+		{
+			/* The start of each CPU's copy.  The entry code in syscall-trap.S and trap.S
+			 * uses the offsets directly. */
+			struct PerCPUHeader
+			{
+				PerCPUHeader *self;				// %gs:0
+				X86CPU *cpu;					// %gs:8
+				uintptr_t syscall_user_stack;	// %gs:16
+				uintptr_t syscall_kernel_stack;	// %gs:24
+				uint32_t preempt_count;			// %gs:32, see preempt.h
+				uint32_t need_resched;			// %gs:36
+			};
+
+			static inline uintptr_t percpu_base()
+			{
+				uintptr_t base;
+				asm volatile("mov %%gs:0, %0" : "=r"(base));
+				return base;
+			}
+
+			static inline PerCPUHeader& percpu_header() { return *(PerCPUHeader *)percpu_base(); }
+
+			static inline X86CPU& percpu_current_cpu()
+			{
+				X86CPU *cpu;
+				asm volatile("mov %%gs:8, %0" : "=r"(cpu));
+				return *cpu;
+			}
+
+			template<typename T>
+			class PerCPU
+			{
+				static_assert(__is_trivial(T), "A per-CPU variable is zero in every copy but the boot CPU's");
+
+			public:
+				/* The calling CPU's copy.  It is only the calling CPU's while the thread
+				 * stays on it, e.g. with interrupts disabled. */
+				T& get() { return *(T *)(percpu_base() + offset()); }
+				T& get(const X86CPU& cpu) { return *(T *)(cpu.percpu_area + offset()); }
+
+				/* Reads or writes the calling CPU's copy, in one instruction. */
+				T read() const
+				{
+					static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8, "Not a word");
+
+					T value;
+					asm volatile("mov %%gs:(%1), %0" : "=r"(value) : "r"(offset()));
+					return value;
+				}
+
+				void write(T value)
+				{
+					static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8, "Not a word");
+					asm volatile("mov %0, %%gs:(%1)" :: "r"(value), "r"(offset()) : "memory");
+				}
+
+			private:
+				T _value;
+
+				uintptr_t offset() const { return (uintptr_t)&_value - (uintptr_t)__percpu_start; }
+			};
+
+			/* Gives a CPU its copy of the per-CPU variables.  The boot CPU has the
+			 * original. */
+			extern bool percpu_init(X86CPU& cpu);
+
+			/* Points the calling CPU's GS base at its copy. */
+			extern void percpu_load(X86CPU& cpu);
+			extern void percpu_load_boot();
+		}
+	}
+}
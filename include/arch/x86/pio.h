@@ -61,6 +61,13 @@ namespace infos
 				: "memory", "cc" );
 			}
 			
+			inline void __outsw(uint16_t port, uintptr_t buffer, size_t count)
+			{
+				asm volatile("cld\n\trepnz outsw" : "=S"(buffer), "=c"(count)
+				: "d"(port), "0"(buffer), "1"(count)
+				: "memory", "cc" );
+			}
+			
 			inline void __insl(uint16_t port, uintptr_t buffer, size_t count)
 			{
 				asm volatile("cld\n\trepnz insl" : "=D"(buffer), "=c"(count)
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/arch/x86/pmu.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class Thread;
+	}
+
+	namespace arch
+	{
+		namespace x86
+		{
+			/* The events that each thread has counted, in the order of its counts. */
+			namespace PMUEvent
+			{
+				enum PMUEvent
+				{
+					CYCLES = 0,			// Unhalted core cycles
+					INSTRUCTIONS = 1,		// Instructions retired
+					LLC_MISSES = 2,			// Last-level cache misses
+					BRANCH_MISSES = 3,		// Mispredicted branches retired, or pmu.raw=
+				};
+			}
+
+			/* Adds what the counters counted while 'prev' was running to its counts,
+			 * as 'next' is switched to.  Called with interrupts disabled. */
+			extern void pmu_switch_to(kernel::Thread *prev, kernel::Thread& next);
+
+			/* Reads a thread's counts, including what it has counted so far if it is
+			 * running on this CPU.  Returns a mask of which of the events are being
+			 * counted, which is zero if the PMU isn't in use. */
+			extern unsigned int pmu_read(kernel::Thread& thread, uint64_t *counts);
+		}
+	}
+}
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/arch/x86/tsc.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace arch
+	{
+		namespace x86
+		{
+			/* Starts the kernel runtime clock (util::KernelRuntimeClock) from the TSC,
+			 * given its frequency in Hz.  Until this is called, the clock reads zero. */
+			extern void tsc_clock_init(uint64_t tsc_hz);
+
+			/* Finds out the TSC frequency without measuring it, from CPUID or the
+			 * hypervisor, and the frequency the local APIC timer counts at (before
+			 * its divider), if that is known too, or else zero.  Returns the TSC
+			 * frequency in Hz, or zero if it has to be measured. */
+			extern uint64_t tsc_known_frequency(uint64_t& lapic_hz);
+			/* Whether the TSC runs at a constant rate, whatever the processor's power
+			 * state. */
+			extern bool tsc_invariant();
+
+			/* Switches the runtime clock over to the HPET's main counter, given its
+			 * period in femtoseconds.  The clock carries on from where it was. */
+			extern void hpet_clock_init(volatile const uint64_t *counter, uint32_t period_fs);
+
+			/* Gets the parameters that turn the TSC into the runtime clock (see
+			 * Arch::runtime_clock_source()), or returns false if it hasn't started. */
+			extern bool tsc_clock_params(uint64_t& base, uint64_t& mult, unsigned int& shift);
+		}
+	}
+}
@@ -7,6 +7,7 @@
 #include <infos/kernel/irq.h>
 #include <arch/x86/uart.h>
 #include <infos/drivers/device.h>
+#include <infos/util/spinlock.h>
 namespace infos
 {
 	namespace drivers {
@@ -44,6 +45,10 @@ namespace infos
 					/* R */  MSR = 6,  /* Modem Status */
 					/* RW */ SR = 7,  /* Scratch */
 				};
+				/* Output is put in a ring, which the transmit interrupt moves into the
+				 * FIFO, so a write returns as soon as it has been copied, unless the ring
+				 * is full.  Input that no terminal takes is kept in a ring of its own, and
+				 * a read returns what there is of it. */
 				int read(void* buffer, size_t size);
 				int write(const void* buffer, size_t size);
 				void putc(int c);
@@ -52,8 +57,25 @@ namespace infos
 				void attach_terminal(SerialTerminal& term) { _attached_terminal = &term; }
 				friend class SerialTerminal; // a bit nasty
 			private:
+				static const unsigned int TX_RING_SIZE = 4096;
+				static const unsigned int RX_RING_SIZE = 256;
+
 				kernel::IRQ *_irq;
 				SerialTerminal *_attached_terminal;
+
+				uint8_t _tx_ring[TX_RING_SIZE];
+				unsigned int _tx_head, _tx_tail;		// Running counts of bytes put in, and sent
+				uint8_t _rx_ring[RX_RING_SIZE];
+				unsigned int _rx_head, _rx_tail;
+
+				unsigned int _fifo_size;				// How many bytes can be given to the transmitter at once
+				bool _tx_irq_enabled;					// Whether the transmit interrupt is armed
+				util::SpinLock _lock;
+
+				void queue_byte(uint8_t c);
+				void fill_transmitter();
+				void receive();
+				static void handle_interrupts(UART& uart);
 			};
 		}
 	}
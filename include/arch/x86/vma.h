@@ -20,6 +20,11 @@ namespace infos {
 
 extern uint64_t *__template_pml4;
 
+// The end of the user half of the address space: the kernel is mapped above here.
+#define USER_VA_END		(0x100ull << 39)
+// The last page of the user half is the clock page (see kernel/clock-page.cpp).
+#define USER_CLOCK_PAGE_VA	(USER_VA_END - 0x1000)
+
 #define BITS(val, start, end) ((((uint64_t)val) >> start) & (((1 << (end - start + 1)) - 1)))
 
 typedef uint16_t table_idx_t;
@@ -4,17 +4,30 @@
 
 #include <arch/arch.h>
 #include <arch/x86/irq.h>
+#include <arch/x86/percpu.h>
 #include <infos/util/map.h>
 
 extern "C" struct X86Context;
 
+// The most CPUs that will be brought up.
+#define X86_MAX_CPUS	16
+
 namespace infos
 {
+	namespace drivers
+	{
+		namespace timer
+		{
+			class LAPICTimer;
+		}
+	}
+
 	namespace arch
 	{
 		namespace x86
 		{
 			class IRQManager;
+			class X86CPU;
 			
 			class X86Arch : public Arch
 			{
@@ -32,9 +45,22 @@ namespace infos
 					return !!(rflags & 0x200);
 				}
 				void calibrate_busywait_loop(kernel::DeviceManager& dm);
-				void set_periodic_timer_interrupt(kernel::DeviceManager& dm);
+				void start_timer_interrupt(kernel::DeviceManager& dm) override;
+				void set_next_timer_interrupt(util::Nanoseconds delay) override;
+				void stop_timer_interrupt() override;
 
-				kernel::CPU& get_current_cpu() override { return *_cpus[0]; }
+				kernel::CPU& get_current_cpu() override;
+				void idle() override;
+				void wake_cpu(kernel::CPU& cpu) override;
+				void reschedule_cpu(kernel::CPU& cpu) override;
+				void relax() override;
+				X86CPU& current_x86_cpu() const { return percpu_current_cpu(); }
+
+				bool add_cpu(X86CPU& cpu);
+				bool init_secondary_cpu(X86CPU& cpu);
+				unsigned int nr_cpus() const override { return _nr_cpus; }
+				X86CPU& cpu(unsigned int index) const { return *_cpus[index]; }
+				kernel::CPU& get_cpu(unsigned int index) const override;
 				
 				void dump_native_context(const X86Context& native_context) const;
 				void dump_thread_context(const kernel::ThreadContext& context) const override;
@@ -46,14 +72,22 @@ namespace infos
 				
 				kernel::Thread& get_current_thread() const override;
 				void set_current_thread(kernel::Thread& thread) override;
+				void release_thread_state(kernel::Thread& thread) override;
+
+				bool runtime_clock_source(uint64_t& base, uint64_t& mult, unsigned int& shift) const override;
+				uint64_t steal_time() override;
 				
 				kernel::IRQ* request_irq() override;
+				void irq_handlers_changed(const kernel::IRQ& irq) override;
 				
 				IRQManager& irq_manager() { return _irq_manager; }
 				
 			private:
-				kernel::CPU *_cpus[1];
+				X86CPU *_cpus[X86_MAX_CPUS];
+				unsigned int _nr_cpus;
+				bool _mwait_idle;
 				IRQManager _irq_manager;
+				drivers::timer::LAPICTimer *_timer;
 			};
 			
 			extern X86Arch x86arch;
@@ -45,6 +45,7 @@ typedef __gnuc_va_list va_list;
 #define __packed __attribute__((packed))
 #define __noreturn __attribute__((noreturn))
 #define __pure __attribute__((pure))
+#define __always_inline inline __attribute__((always_inline))
 #define __aligned(__n) __attribute__((aligned(__n)))
 #define __section(__n) __attribute__((section(__n)))
 #define __init_priority(__n) __attribute__((init_priority(__n)))
@@ -52,6 +53,9 @@ typedef __gnuc_va_list va_list;
 
 #define ARRAY_SIZE(__arr) (sizeof(__arr) / sizeof(__arr[0]))
 
+// For keeping data that different CPUs write apart, so that they don't share a line.
+#define CACHE_LINE_SIZE 64
+
 #define offsetof(st, m) __builtin_offsetof(st, m)
 
 #define container_of(ptr, type, member) ({                      \
@@ -88,6 +92,13 @@ typedef __gnuc_va_list va_list;
 #define __page_base(__addr) ((__addr) & ~(__page_size - 1))
 #define __page_index(__addr) ((__addr) >> __page_bits)
 
+/* Huge pages are mapped by a single page directory entry. */
+#define __huge_page_bits 21
+#define __huge_page_order (__huge_page_bits - __page_bits)
+
+#define __huge_page_size (1 << __huge_page_bits)
+#define __huge_page_offset(__addr) ((__addr) & (__huge_page_size - 1))
+
 /**
  * Converts a physical address into a kernel virtual address.
  * @param pa The physical address to convert.
@@ -182,3 +193,4 @@ __pure static inline __cxp uint64_t __max(uint64_t x, uint64_t y)
 }
 
 extern "C" void arch_abort() __noreturn;
+extern "C" void arch_power_off() __noreturn;
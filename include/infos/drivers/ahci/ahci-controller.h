@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/device.h>
+#include <infos/drivers/block/block-request-queue.h>
+#include <infos/kernel/log.h>
+#include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
+#include <infos/util/iovec.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class IRQ;
+	}
+
+	namespace drivers
+	{
+		namespace ahci
+		{
+			struct AHCIControllerConfiguration
+			{
+				phys_addr_t abar;		// The HBA's registers (BAR5).
+				kernel::IRQ *irq;		// NULL if the controller is to be polled.
+			};
+
+			class AHCIDevice;
+			class AHCIController : public Device
+			{
+				friend class AHCIDevice;
+
+			public:
+				static const DeviceClass AHCIControllerDeviceClass;
+				const DeviceClass& device_class() const override { return AHCIControllerDeviceClass; }
+
+				AHCIController(const AHCIControllerConfiguration& cfg);
+
+				bool init(kernel::DeviceManager& dm) override;
+
+			private:
+				static const unsigned int MAX_PORTS = 32;
+				static const unsigned int MAX_SLOTS = 32;
+				static const unsigned int MAX_PRD_ENTRIES = 248;	// Makes a command table one page.
+
+				static const unsigned int MAX_BATCH_VEC = 64;
+				static const size_t MAX_BATCH_BLOCKS = 65536;
+
+				/* An entry of a port's command list: where the command table of a slot
+				 * is, and how the HBA is to carry it out. */
+				struct CommandHeader {
+					uint16_t flags;			// The FIS length in dwords, and the direction.
+					uint16_t prdtl;			// The number of descriptor table entries.
+					volatile uint32_t prdbc;
+					uint32_t ctba, ctbau;
+					uint32_t reserved[4];
+				} __packed;
+
+				/* A physically contiguous region of a transfer, of up to 4 MiB. */
+				struct PRDEntry {
+					uint32_t dba, dbau;
+					uint32_t reserved;
+					uint32_t dbc;			// The byte count, less one, and the interrupt bit.
+				} __packed;
+
+				struct CommandTable {
+					uint8_t cfis[64];
+					uint8_t acmd[16];
+					uint8_t reserved[48];
+					PRDEntry prdt[MAX_PRD_ENTRIES];
+				} __packed;
+
+				/* A command slot of a port.  A slot either carries out a batch of requests
+				 * from the queue, chained through 'next', as one transfer of all their
+				 * buffers (in as many commands as it takes), or, while the port is held
+				 * exclusively, one command of the thread holding it. */
+				struct Slot {
+					CommandTable *table;
+					phys_addr_t table_pa;
+
+					block::BlockRequest *requests;		// NULL if the slot isn't carrying out a batch.
+					bool write;
+					size_t offset, nr_blocks;
+					size_t nr_done, nr_in_flight;
+					util::IOVec vec[MAX_BATCH_VEC];
+					unsigned int nr_vec;
+				};
+
+				/* A port with a drive.  Everything but the registers and tables is guarded
+				 * by the lock of 'waiters', on which threads waiting for the port sleep,
+				 * keyed by what they are waiting for. */
+				struct Port {
+					AHCIController *controller;
+					unsigned int index;
+					volatile uint32_t *regs;
+
+					CommandHeader *cmd_list;
+					phys_addr_t cmd_list_pa, fis_pa;
+
+					AHCIDevice *device;
+					bool lba48, ncq;
+					unsigned int nr_slots;			// The NCQ depth, or one.
+					uint32_t busy;					// The slots with commands in progress.
+					Slot slots[MAX_SLOTS];
+
+					block::BlockRequestQueue queue;
+					unsigned int plugged;
+
+					// Set while a thread has the port to itself, for a command that can't be
+					// queued alongside others.
+					bool exclusive;
+					bool exclusive_success;
+
+					util::WakeQueue waiters;
+				};
+
+				uint32_t read(int reg) const { return _regs[reg / 4]; }
+				void write(int reg, uint32_t value) { _regs[reg / 4] = value; }
+				static uint32_t port_read(const Port& port, int reg) { return port.regs[reg / 4]; }
+				static void port_write(Port& port, int reg, uint32_t value) { port.regs[reg / 4] = value; }
+
+				bool init_port(kernel::DeviceManager& dm, unsigned int index);
+				bool stop_port(Port& port);
+				bool start_port(Port& port);
+
+				bool has_irq() const { return _irq != NULL; }
+				bool can_wait_for_irq() const;
+
+				bool dma_can_map(const util::IOVec *vec, unsigned int nr_vec) const;
+				unsigned int dma_map(Slot& slot, const util::IOVec *vec, unsigned int nr_vec, unsigned int cur_vec, size_t vec_offset, size_t& size);
+
+				bool set_queue_depth(Port& port, unsigned int depth);
+				bool transfer(Port& port, bool write, size_t offset, const util::IOVec *vec, unsigned int nr_vec, size_t nr_blocks);
+				void queue_request(Port& port, block::BlockRequest& request);
+				void plug(Port& port);
+				void unplug(Port& port);
+				void start_requests(Port& port);
+				bool start_slot(Port& port, unsigned int n);
+				void complete_slot(Port& port, unsigned int n, bool success);
+				void issue(Port& port, unsigned int n, uint8_t command, uint64_t lba, size_t count, unsigned int nr_entries, bool write);
+
+				bool execute(Port& port, uint8_t command, void *buffer, size_t size);
+				void wait_locked(Port& port, const util::WakeQueue::Key& key);
+				void service_port(Port& port);
+				void recover_port(Port& port);
+
+				static void irq_handler(const kernel::IRQ *irq, void *priv);
+
+				phys_addr_t _abar;
+				volatile uint32_t *_regs;
+				kernel::IRQ *_irq;
+
+				uint32_t _cap;
+				Port *_ports[MAX_PORTS];
+			};
+
+			extern kernel::ComponentLog ahci_log;
+		}
+	}
+}
+
+// HBA registers.
+#define AHCI_REG_CAP		0x00
+#define AHCI_REG_GHC		0x04
+#define AHCI_REG_IS			0x08
+#define AHCI_REG_PI			0x0C
+#define AHCI_REG_VS			0x10
+
+#define AHCI_CAP_NCS(__v)	((((__v) >> 8) & 0x1f) + 1)	// Number of command slots
+#define AHCI_CAP_SNCQ		(1u << 30)					// Supports NCQ
+#define AHCI_CAP_S64A		(1u << 31)					// Supports 64-bit addressing
+
+#define AHCI_GHC_IE			(1u << 1)					// Interrupt enable
+#define AHCI_GHC_AE			(1u << 31)					// AHCI enable
+
+// Port registers, from the port's base.
+#define AHCI_PORT_BASE(__p)	(0x100 + ((__p) * 0x80))
+
+#define AHCI_PxCLB			0x00
+#define AHCI_PxCLBU			0x04
+#define AHCI_PxFB			0x08
+#define AHCI_PxFBU			0x0C
+#define AHCI_PxIS			0x10
+#define AHCI_PxIE			0x14
+#define AHCI_PxCMD			0x18
+#define AHCI_PxTFD			0x20
+#define AHCI_PxSIG			0x24
+#define AHCI_PxSSTS			0x28
+#define AHCI_PxSERR			0x30
+#define AHCI_PxSACT			0x34
+#define AHCI_PxCI			0x38
+
+#define AHCI_PxCMD_ST		(1u << 0)					// Start
+#define AHCI_PxCMD_FRE		(1u << 4)					// FIS receive enable
+#define AHCI_PxCMD_FR		(1u << 14)					// FIS receive running
+#define AHCI_PxCMD_CR		(1u << 15)					// Command list running
+
+#define AHCI_PxIS_DHRS		(1u << 0)					// Device to host register FIS
+#define AHCI_PxIS_PSS		(1u << 1)					// PIO setup FIS
+#define AHCI_PxIS_DSS		(1u << 2)					// DMA setup FIS
+#define AHCI_PxIS_SDBS		(1u << 3)					// Set device bits FIS (NCQ completions)
+#define AHCI_PxIS_IFS		(1u << 27)					// Interface fatal error
+#define AHCI_PxIS_HBDS		(1u << 28)					// Host bus data error
+#define AHCI_PxIS_HBFS		(1u << 29)					// Host bus fatal error
+#define AHCI_PxIS_TFES		(1u << 30)					// Task file error
+#define AHCI_PxIS_ERRORS	(AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_PxTFD_ERR		(1u << 0)
+#define AHCI_PxTFD_DRQ		(1u << 3)
+#define AHCI_PxTFD_BSY		(1u << 7)
+
+#define AHCI_PxSSTS_DET(__v)	((__v) & 0xf)
+#define AHCI_DET_PRESENT	3							// Device present, and communicating
+
+#define AHCI_SIG_ATA		0x00000101
+
+#define AHCI_FIS_REG_H2D	0x27
+#define AHCI_FIS_C			0x80						// The FIS is a command
+
+#define AHCI_CMDH_FIS_LEN	5							// A register FIS, in dwords
+#define AHCI_CMDH_WRITE		(1u << 6)
+
+#define AHCI_PRD_IRQ		(1u << 31)
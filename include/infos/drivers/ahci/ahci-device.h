@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/block/block-device.h>
+#include <infos/drivers/block/block-device-partition.h>
+#include <infos/drivers/ahci/ahci-controller.h>
+#include <infos/util/list.h>
+
+namespace infos {
+    namespace drivers {
+        namespace ahci {
+            /* A SATA disk on a port of an AHCI HBA. */
+            class AHCIDevice : public block::BlockDevice {
+            public:
+                static const DeviceClass AHCIDeviceClass;
+
+                const DeviceClass& device_class() const override {
+                    return AHCIDeviceClass;
+                }
+
+                AHCIDevice(AHCIController& controller, AHCIController::Port& port);
+
+                bool init(kernel::DeviceManager& dm) override;
+
+                size_t block_count() const override;
+                size_t block_size() const override;
+                bool read_blocks(void* buffer, size_t offset, size_t count) override;
+                bool write_blocks(const void* buffer, size_t offset, size_t count) override;
+                bool read_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+                bool write_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+                void submit(block::BlockRequest& request) override;
+                void plug() override;
+                void unplug() override;
+                bool flush() override;
+
+            private:
+                AHCIController& _ctrl;
+                AHCIController::Port& _port;
+
+                uint32_t _cmdsets;
+                uint64_t _size;
+
+                bool transfer(bool write, uint64_t lba, const util::IOVec *vec, unsigned int nr_vec, size_t nr_blocks);
+                bool transfer_bounced(bool write, uint64_t lba, const util::IOVec *vec, unsigned int nr_vec, size_t nr_blocks);
+
+                bool check_for_partitions();
+                bool create_partitions(const uint8_t *partition_table);
+
+                infos::util::List<block::BlockDevicePartition *> _partitions;
+            };
+        }
+    }
+}
@@ -2,8 +2,11 @@
 #pragma once
 
 #include <infos/drivers/device.h>
+#include <infos/drivers/block/block-request-queue.h>
 #include <infos/kernel/log.h>
 #include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
+#include <infos/util/iovec.h>
 
 namespace infos
 {
@@ -19,6 +22,7 @@ namespace infos
 			struct ATAControllerConfiguration
 			{
 				uint32_t BAR[5];
+				bool bus_master;		// The controller can do bus-master DMA, and it is enabled.
 			};
 			
 			class ATADevice;
@@ -30,28 +34,102 @@ namespace infos
 				static DeviceClass ATAControllerDeviceClass;
 				const DeviceClass& device_class() const override { return ATAControllerDeviceClass; }
 
-				ATAController(kernel::IRQ& irq, const ATAControllerConfiguration& cfg);
+				ATAController(const ATAControllerConfiguration& cfg);
 				
 				bool init(kernel::DeviceManager& dm) override;
 				
 			private:
-				kernel::IRQ& _irq;
-				util::Mutex _mtx[2];
+				/* An entry of a bus-master physical region descriptor table: one physically
+				 * contiguous region of a DMA transfer, which can't cross a 64 KiB boundary. */
+				struct PRDEntry {
+					uint32_t base;
+					uint16_t size;			// Zero means 64 KiB.
+					uint16_t flags;
+				} __packed;
+
+				static const unsigned int MAX_PRD_ENTRIES = 512;	// One page.
+
+				static const unsigned int MAX_BATCH_VEC = 64;
+				static const size_t MAX_BATCH_BLOCKS = 65536;
+
+				/* The asynchronous requests in progress on a channel: a batch from the queue,
+				 * chained through 'next', carried out as one transfer of all their buffers. */
+				struct RequestBatch {
+					block::BlockRequest *requests;		// NULL if there isn't a batch in progress.
+					bool write;
+					size_t offset, nr_blocks;
+					size_t nr_done, nr_in_flight;
+					util::IOVec vec[MAX_BATCH_VEC];
+					unsigned int nr_vec;
+				};
 				
 				uint8_t ata_read(int channel, int reg);
 				void ata_read_buffer(int channel, int reg, void *buffer, size_t size);
 				void ata_write(int channel, int reg, uint8_t data);
 				int ata_poll(int channel, bool error_check=false);
+				int ata_wait(int channel, bool error_check=false);
+
+				void acquire_channel(int channel);
+				void release_channel(int channel);
+				void queue_request(int channel, block::BlockRequest& request);
+				void start_next_request(int channel);
+				void complete_batch(int channel, bool success);
+				void plug(int channel);
+				void unplug(int channel);
+
+				void arm_irq(int channel) { channels[channel].irq_pending = false; }
+				bool can_wait_for_irq(int channel) const;
+				void wait_for_irq(int channel);
 				
-				bool probe_channel(kernel::DeviceManager& dm, int channel);
-				bool probe_device(kernel::DeviceManager& dm, int channel, int device);
+				enum ProbeResult { PROBE_ABSENT, PROBE_PRESENT, PROBE_ERROR };
+
+				static void probe_channel_threadproc(void *arg);
+				void probe_channel(int channel);
+				ProbeResult probe_device(int channel, int device);
+				bool attach_device(kernel::DeviceManager& dm, int channel, int device);
+
+				void init_irq(kernel::DeviceManager& dm, int channel);
+				void init_dma(int channel);
+				bool dma_available(int channel) const { return channels[channel].prdt != NULL; }
+				bool dma_can_map(const util::IOVec *vec, unsigned int nr_vec) const;
+				size_t dma_map(int channel, const util::IOVec *vec, unsigned int nr_vec, unsigned int cur_vec, size_t vec_offset, size_t size);
+				void dma_prepare(int channel, bool to_memory);
+				void dma_start(int channel);
+				bool dma_finish(int channel);
+				bool dma_run(int channel);
+
+				static void irq_handler(const kernel::IRQ *irq, void *priv);
 				
 				struct ChannelRegisters {
+					ATAController *controller;
+					int index;
+
 					uint16_t base;
 					uint16_t ctrl;
 					uint16_t bmide;
 					uint8_t nIEN;
+
+					int legacy_irq;			// The ISA IRQ of a channel in compatibility mode, or -1.
+
+					PRDEntry *prdt;			// NULL if the channel doesn't do DMA.
+					uint32_t prdt_pa;
+					kernel::IRQ *irq;		// NULL if the channel is always polled.
+					volatile bool irq_pending;
+					util::WakeQueue irq_waiters;
+
+					// Whoever is issuing commands on the channel: a thread doing a synchronous
+					// transfer, or the queue of asynchronous requests, of which 'batch' is the
+					// part in progress.  Guarded by the lock of 'owner_waiters'.
+					bool owned;
+					util::WakeQueue owner_waiters;
+					block::BlockRequestQueue queue;
+					RequestBatch batch;
+					unsigned int plugged;
+
+					ProbeResult probe_result[2];	// Of the master, and the slave.
 				} channels[2];
+
+				bool _bus_master;
 			};
 			
 			extern kernel::ComponentLog ata_log;
@@ -90,6 +168,8 @@ namespace infos
 #define ATA_CMD_PACKET            0xA0
 #define ATA_CMD_IDENTIFY_PACKET   0xA1
 #define ATA_CMD_IDENTIFY          0xEC
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
 
 #define ATAPI_CMD_READ       0xA8
 #define ATAPI_CMD_EJECT      0x1B
@@ -103,9 +183,18 @@ namespace infos
 #define ATA_IDENT_CAPABILITIES 98
 #define ATA_IDENT_FIELDVALID   106
 #define ATA_IDENT_MAX_LBA      120
+#define ATA_IDENT_QUEUE_DEPTH  150
+#define ATA_IDENT_SATA_CAPS    152
 #define ATA_IDENT_COMMANDSETS  164
 #define ATA_IDENT_MAX_LBA_EXT  200
 
+// Bits of IDENTIFY word 83, the second word of ATA_IDENT_COMMANDSETS.
+#define ATA_CMDSET_FLUSH       0x1000  // FLUSH CACHE
+#define ATA_CMDSET_FLUSH_EXT   0x2000  // FLUSH CACHE EXT
+
+// Bits of IDENTIFY word 76, ATA_IDENT_SATA_CAPS.
+#define ATA_SATA_CAP_NCQ       0x0100  // Native command queuing
+
 #define IDE_ATA        0x00
 #define IDE_ATAPI      0x01
 
@@ -129,6 +218,18 @@ namespace infos
 #define ATA_REG_CONTROL    0x0C
 #define ATA_REG_ALTSTATUS  0x0C
 #define ATA_REG_DEVADDRESS 0x0D
+#define ATA_REG_BMCOMMAND  0x0E
+#define ATA_REG_BMSTATUS   0x10
+#define ATA_REG_BMPRDT     0x12
+
+#define ATA_BMCMD_START    0x01    // Start (or, when cleared, stop) the transfer
+#define ATA_BMCMD_READ     0x08    // Transfer from the device to memory
+
+#define ATA_BMSR_ACTIVE    0x01    // A transfer is in progress
+#define ATA_BMSR_ERR       0x02    // The transfer failed
+#define ATA_BMSR_IRQ       0x04    // The device has raised its interrupt
+
+#define ATA_PRD_EOT        0x8000  // The last entry of the table
 
 #define ATA_PRIMARY      0x00
 #define ATA_SECONDARY    0x01
@@ -4,14 +4,15 @@
 
 #include <infos/drivers/block/block-device.h>
 #include <infos/drivers/block/block-device-partition.h>
+#include <infos/drivers/ata/ata-controller.h>
 #include <infos/util/list.h>
 
 namespace infos {
     namespace drivers {
         namespace ata {
-            class ATAController;
-
             class ATADevice : public block::BlockDevice {
+                friend class ATAController;
+
             public:
                 static const DeviceClass ATADeviceClass;
 
@@ -27,19 +28,35 @@ namespace infos {
                 size_t block_size() const override;
                 bool read_blocks(void* buffer, size_t offset, size_t count) override;
                 bool write_blocks(const void* buffer, size_t offset, size_t count) override;
+                bool read_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+                bool write_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+                void submit(block::BlockRequest& request) override;
+                void plug() override;
+                void unplug() override;
+                bool flush() override;
 
             private:
                 ATAController& _ctrl;
                 int _channel, _drive;
 
-                uint32_t _signature, _caps, _cmdsets, _size;
+                uint32_t _signature, _caps, _cmdsets;
+                uint64_t _size;
+                bool _lba48, _dma;
 
                 uint8_t ata_read(int reg);
                 void ata_read_buffer(int reg, void *buffer, size_t size);
                 void ata_write(int reg, uint8_t data);
                 int ata_poll(bool error_check = false);
+                int ata_wait(bool error_check = false);
 
-                bool transfer(int direction, uint64_t lba, void *buffer, size_t nr_blocks);
+                bool transfer(int direction, uint64_t lba, const util::IOVec *vec, unsigned int nr_vec, size_t nr_blocks);
+                bool transfer_locked(int direction, uint64_t lba, const util::IOVec *vec, unsigned int nr_vec, size_t nr_blocks);
+                bool start_batch(ATAController::RequestBatch& batch);
+                size_t max_sectors_per_command() const;
+                void issue_command(int direction, bool dma, uint64_t lba, size_t nr_blocks);
+                bool transfer_pio(int direction, uint64_t lba, const util::IOVec *vec, unsigned int nr_vec,
+                        unsigned int& cur_vec, size_t& vec_offset, size_t nr_blocks);
+                bool transfer_dma(int direction, uint64_t lba, size_t nr_blocks);
 
                 bool check_for_partitions();
                 bool create_partitions(const uint8_t *partition_table);
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/block/block-device.h>
+#include <infos/util/lock.h>
+
+namespace infos {
+    namespace drivers {
+        namespace block {
+
+            /* A buffer cache in front of another block device: recently used blocks are
+             * kept in memory, in a hash table and a least-recently-used list, so that
+             * e.g. filesystem metadata that is read over and over only goes to the disk
+             * once.  When reads are sequential, a miss reads ahead of what was asked for,
+             * in one larger transfer, doubling the window each time the pattern holds.
+             * Writes go straight through to the device, updating any cached copy. */
+            class BlockCache : public BlockDevice {
+            public:
+                static const DeviceClass BlockCacheClass;
+
+                const DeviceClass& device_class() const override {
+                    return BlockCacheClass;
+                }
+
+                BlockCache(BlockDevice& underlying_block_device);
+                virtual ~BlockCache();
+
+                bool read_blocks(void *buffer, size_t offset, size_t count) override;
+                bool write_blocks(const void *buffer, size_t offset, size_t count) override;
+                bool read_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+                bool write_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+                bool flush() override { return _underlying_block_device.flush(); }
+
+                size_t block_size() const override { return _underlying_block_device.block_size(); }
+                size_t block_count() const override { return _underlying_block_device.block_count(); }
+
+                /* Set by the blockcache.blocks option: zero turns caching off. */
+                static void max_blocks(unsigned int max_blocks);
+
+                /* Throws away every cached block, in every cache, e.g. so that a benchmark
+                 * can measure reads from the device.  The caches are write-through, so
+                 * nothing is lost. */
+                static void drop_all();
+
+            private:
+                struct Buffer
+                {
+                    size_t block;
+                    Buffer *hash_next;
+                    Buffer *lru_prev, *lru_next;
+                    uint8_t data[];
+                };
+
+                static const unsigned int NR_BUCKETS = 256;
+                static const unsigned int MAX_READAHEAD = 64;
+
+                BlockDevice& _underlying_block_device;
+
+                Buffer *_buckets[NR_BUCKETS];
+                Buffer *_lru_head, *_lru_tail;
+                unsigned int _nr_buffers;
+
+                // Where the next read would start, if it carried on from the last one,
+                // and how many blocks a miss reads ahead.
+                size_t _next_sequential;
+                unsigned int _readahead;
+
+                uint8_t *_transfer;
+                util::Mutex _mtx;
+
+                BlockCache *_next_cache;
+
+                void drop();
+
+                Buffer *find(size_t block) const;
+                void insert(size_t block, const void *data);
+                void touch(Buffer *buffer);
+
+                void lru_unlink(Buffer *buffer);
+                void lru_push(Buffer *buffer);
+            };
+        }
+    }
+}
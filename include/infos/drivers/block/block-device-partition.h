@@ -20,6 +20,12 @@ namespace infos {
 
                 virtual bool read_blocks(void *buffer, size_t offset, size_t count);
                 virtual bool write_blocks(const void *buffer, size_t offset, size_t count);
+                bool read_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+                bool write_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+                void submit(BlockRequest& request) override;
+                void plug() override { _underlying_block_device.plug(); }
+                void unplug() override { _underlying_block_device.unplug(); }
+                bool flush() override { return _underlying_block_device.flush(); }
 
                 virtual size_t block_size() const { return _underlying_block_device.block_size(); }
                 virtual size_t block_count() const { return _block_count; }
@@ -2,6 +2,9 @@
 #pragma once
 
 #include <infos/drivers/device.h>
+#include <infos/drivers/block/block-request.h>
+#include <infos/drivers/block/block-stats.h>
+#include <infos/util/iovec.h>
 
 namespace infos
 {
@@ -17,9 +20,44 @@ namespace infos
 				
 				virtual bool read_blocks(void *buffer, size_t offset, size_t count) = 0;
 				virtual bool write_blocks(const void *buffer, size_t offset, size_t count) = 0;
+
+				/* Transfers the blocks from 'offset' to or from a list of buffers, each a
+				 * whole number of blocks, as one request.  By default, this is one request
+				 * per buffer: devices that can do better override it. */
+				virtual bool read_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset);
+				virtual bool write_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset);
+
+				/* Starts a request, and returns without waiting for it to finish: the
+				 * request's completion is called when it does (or has, by the time this
+				 * returns, if the device can only do it synchronously, which is what
+				 * happens by default). */
+				virtual void submit(BlockRequest& request);
+
+				/* Between plug() and unplug(), a device with a request queue holds on to
+				 * the requests submitted to it, so that they can be merged and sorted
+				 * before any are started.  Plugs nest. */
+				virtual void plug() { }
+				virtual void unplug() { }
+
+				/* Makes sure that every block written so far is on the medium, rather than
+				 * in a volatile cache in the device.  Writes aren't flushed until then. */
+				virtual bool flush() { return true; }
 				
 				virtual size_t block_size() const = 0;
 				virtual size_t block_count() const = 0;
+
+				/* Block devices can be read as files, e.g. /dev/ata0. */
+				fs::File *open_as_file() override;
+
+				/* The statistics are kept by the drivers, as requests pass through them,
+				 * and read from e.g. /dev/ata0.stats. */
+				BlockDeviceStats& stats() { return _stats; }
+
+				bool has_stats() const override { return true; }
+				fs::File *open_stats_file() override { return _stats.open_as_file(); }
+
+			private:
+				BlockDeviceStats _stats;
 			};
 		}
 	}
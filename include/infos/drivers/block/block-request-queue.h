@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/block/block-request.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace block
+		{
+			/* The requests waiting for a device, and the order it takes them in: a
+			 * one-way elevator, which takes the request at the lowest offset at or after
+			 * where the last batch ended, wrapping around to the lowest one when there
+			 * are none further on.  So that a request far from the others isn't passed
+			 * over forever, one that has waited past its deadline is taken first.
+			 *
+			 * A batch is a run of requests that follow on from one another on the
+			 * device, in the same direction, that the device can carry out as one
+			 * transfer.  The queue doesn't lock itself: the device does that. */
+			class BlockRequestQueue
+			{
+			public:
+				BlockRequestQueue() : _sorted(NULL), _fifo_head(NULL), _fifo_tail(NULL), _position(0) { }
+
+				bool empty() const { return _sorted == NULL; }
+
+				/* Adds a request, whose nr_blocks and driver must already be filled in,
+				 * giving it a deadline 'expiry' ns after 'now'. */
+				void add(BlockRequest& request, uint64_t now, uint64_t expiry);
+
+				/* Takes the next batch out of the queue, chained through 'next', of up to
+				 * 'max_blocks' blocks and 'max_vec' buffers in all (although the first
+				 * request is taken whatever its size).  Returns NULL if the queue is empty. */
+				BlockRequest *take_batch(uint64_t now, size_t max_blocks, unsigned int max_vec);
+
+			private:
+				BlockRequest *_sorted;					// Ordered by offset, through 'next'.
+				BlockRequest *_fifo_head, *_fifo_tail;	// Ordered by deadline, through 'fifo_next'.
+				size_t _position;						// Where the last batch ended.
+
+				void remove(BlockRequest& request);
+			};
+		}
+	}
+}
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/iovec.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace block
+		{
+			class BlockDevice;
+			class BlockDeviceStats;
+
+			/* An asynchronous request to transfer a run of blocks to or from a list of
+			 * buffers, each a whole number of blocks (see BlockDevice::submit()).  The
+			 * request, and the buffers, belong to the device until it is completed.
+			 * The layers it passes through may change 'offset' on the way down, e.g. a
+			 * partition adds its own offset. */
+			struct BlockRequest
+			{
+				/* Called once the request has finished, possibly from interrupt
+				 * context, so it mustn't sleep. */
+				typedef void (*completion_fn_t)(BlockRequest& request, bool success);
+
+				bool write;
+				size_t offset;
+				const util::IOVec *vec;
+				unsigned int nr_vec;
+
+				completion_fn_t completion;
+				void *priv;
+
+				// Kept by the device carrying the request out.
+				BlockRequest *next, *fifo_next;
+				void *driver;
+				size_t nr_blocks;
+				uint64_t deadline;
+				uint64_t queued_at, started_at;
+
+				// The statistics of the partition the request came through, if any.
+				// Submitters leave this NULL.
+				BlockDeviceStats *partition_stats = NULL;
+
+				void complete(bool success)
+				{
+					partition_stats = NULL;
+					completion(*this, success);
+				}
+			};
+		}
+	}
+}
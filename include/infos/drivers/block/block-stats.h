@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace fs
+	{
+		class File;
+		class StatisticsWriter;
+	}
+
+	namespace drivers
+	{
+		namespace block
+		{
+			struct BlockRequest;
+
+			/* The I/O statistics of a block device, or a partition: what has been
+			 * transferred, how many requests are in progress, and histograms of how long
+			 * requests waited to be started (queue time) and then took (service time),
+			 * in log2(ns) buckets.  The counters are updated with atomic adds, from
+			 * wherever requests start and finish, interrupts included, so a reader may
+			 * see one request half-accounted. */
+			class BlockDeviceStats
+			{
+			public:
+				static const int NR_LATENCY_BUCKETS = 40;
+
+				BlockDeviceStats();
+
+				static uint64_t now();
+
+				/* A request has been queued on the device (and on the partition it
+				 * came through, if any), has been started, or has finished. */
+				void queued(BlockRequest& request);
+				void started(BlockRequest& request);
+				void completed(const BlockRequest& request, bool success);
+
+				/* 'nr' requests have been merged into the one before them in a batch. */
+				void merged(unsigned int nr) { __sync_fetch_and_add(&_nr_merges, nr); }
+
+				/* A transfer that doesn't go through a request: begin() accounts for it
+				 * being in progress, and returns the time it was asked for. */
+				uint64_t begin();
+				void end(bool write, size_t nr_blocks, uint64_t queued_at, uint64_t started_at, bool success);
+
+				fs::File *open_as_file() const;
+				/* Appends a line of the main counters, for the device with the name. */
+				void append_summary(fs::StatisticsWriter& out, const char *name) const;
+
+			private:
+				friend class BlockDeviceStatsFile;
+
+				static int latency_bucket(uint64_t ns);
+
+				uint64_t _nr_reads, _nr_writes;
+				uint64_t _nr_blocks_read, _nr_blocks_written;
+				uint64_t _nr_errors, _nr_merges;
+				int64_t _nr_in_flight;
+				uint64_t _total_queue_time, _total_service_time;
+				uint64_t _queue_time[NR_LATENCY_BUCKETS];
+				uint64_t _service_time[NR_LATENCY_BUCKETS];
+			};
+		}
+	}
+}
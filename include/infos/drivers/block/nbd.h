@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/block/block-device.h>
+#include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class DeviceManager;
+		class Thread;
+	}
+
+	namespace net
+	{
+		class Socket;
+	}
+
+	namespace drivers
+	{
+		namespace block
+		{
+			/* A network block device: an export on an NBD server, over TCP, given with
+			 * nbd=a.b.c.d:port/export.  It is connected once the network stack is up,
+			 * as a storage device, so that it can be the boot device.
+			 *
+			 * Up to MAX_IN_FLIGHT requests are sent without waiting for the replies
+			 * before them, which a receiver thread matches up by their handles and
+			 * completes.  If the connection is lost, every request fails from then on:
+			 * there is no reconnecting. */
+			class NbdDevice : public BlockDevice
+			{
+			public:
+				static const DeviceClass NbdDeviceClass;
+				const DeviceClass& device_class() const override { return NbdDeviceClass; }
+
+				/* Sets the device up in the background, if nbd= was given. */
+				static bool attach(kernel::DeviceManager& dm);
+
+				NbdDevice(uint32_t address, uint16_t port, const char *export_name);
+
+				bool init(kernel::DeviceManager& dm) override;
+
+				size_t block_count() const override { return _size / block_size(); }
+				size_t block_size() const override { return 512; }
+				bool read_blocks(void *buffer, size_t offset, size_t count) override;
+				bool write_blocks(const void *buffer, size_t offset, size_t count) override;
+				bool read_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+				bool write_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+				void submit(BlockRequest& request) override;
+				bool flush() override;
+
+			private:
+				static const unsigned int MAX_IN_FLIGHT = 16;
+				static const size_t MAX_REQUEST_SIZE = 0x2000000;	// What servers are sure to take.
+
+				struct Slot {
+					BlockRequest *request;
+					uint16_t type;
+					bool in_use;
+				};
+
+				uint32_t _address;
+				uint16_t _port;
+				char _export_name[64];
+
+				net::Socket *_socket;
+				uint64_t _size;
+				uint16_t _transmission_flags;
+
+				// Requests are written whole, one at a time.
+				util::Mutex _send_lock;
+
+				// Guarded by the lock of '_waiters', on which threads waiting for a free
+				// slot, or for their request, sleep.
+				Slot _slots[MAX_IN_FLIGHT];
+				unsigned int _nr_busy;
+				bool _failed;
+				util::WakeQueue _waiters;
+
+				bool read_full(void *buffer, size_t size);
+				bool write_full(const void *buffer, size_t size);
+				bool handshake();
+
+				bool transfer(uint16_t type, size_t offset, const util::IOVec *vec, unsigned int nr_vec);
+				void start(uint16_t type, BlockRequest& request);
+				void fail_all();
+
+				void receive_replies();
+				static void receiver_threadproc(void *arg);
+			};
+		}
+	}
+}
+
+#define NBD_MAGIC					0x4e42444d41474943ull	// "NBDMAGIC"
+#define NBD_OPTION_MAGIC			0x49484156454f5054ull	// "IHAVEOPT"
+#define NBD_REQUEST_MAGIC			0x25609513
+#define NBD_REPLY_MAGIC				0x67446698
+
+#define NBD_FLAG_FIXED_NEWSTYLE		(1u << 0)
+#define NBD_FLAG_NO_ZEROES			(1u << 1)
+
+#define NBD_FLAG_HAS_FLAGS			(1u << 0)
+#define NBD_FLAG_READ_ONLY			(1u << 1)
+#define NBD_FLAG_SEND_FLUSH			(1u << 2)
+
+#define NBD_OPT_EXPORT_NAME			1
+
+#define NBD_CMD_READ				0
+#define NBD_CMD_WRITE				1
+#define NBD_CMD_DISC				2
+#define NBD_CMD_FLUSH				3
@@ -53,8 +53,10 @@ namespace infos
 
 				int write(const void *buffer, size_t size);
 
-				void set_buffer(uint16_t *buffer, UpdateCallbackFn ucb) { _buffer = buffer; _ucb = ucb; }
-				uint16_t *get_buffer() const { return _buffer; }
+				/* Where the console is shown, if anywhere: text-mode video memory, which
+				 * the changed rows are copied to at the end of each write, after which the
+				 * callback is called. */
+				void set_output(volatile uint16_t *output, UpdateCallbackFn ucb);
 				uint16_t get_buffer_position() const { return _current_pos; }
 
 				void attach_terminal(terminal::ConsoleTerminal *terminal);
@@ -102,10 +104,23 @@ namespace infos
 				uint8_t _escape_buffer[16];
 
 				terminal::ConsoleTerminal *_terminal;
+
+				/* The console is drawn in a buffer of its own, in ordinary memory, whose
+				 * rows are a ring: the top row of the screen is row '_origin', so that
+				 * scrolling is a matter of clearing a row and moving the origin on. */
 				uint16_t *_buffer;
+				unsigned int _origin;
+				uint32_t _dirty_rows;			// A bit for each row of the screen not yet shown
+
+				volatile uint16_t *_output;
 				UpdateCallbackFn _ucb;
 
+				uint16_t& cell(unsigned int pos) { return _buffer[((_origin + pos / _width) % _height) * _width + pos % _width]; }
+				void put(unsigned int pos, uint16_t value) { cell(pos) = value; _dirty_rows |= 1u << (pos / _width); }
+
+				void put_run(const uint8_t *chars, unsigned int count);
 				void scroll_one_line();
+				void flush();
 			};
 		}
 	}
@@ -12,6 +12,7 @@
 
 #include <infos/define.h>
 #include <infos/util/string.h>
+#include <infos/mm/object-allocator.h>
 
 namespace infos {
 	namespace kernel {
@@ -92,6 +93,11 @@ namespace infos {
 
 			virtual fs::File *open_as_file();
 
+			/* Devices that keep statistics have a second file, which devfs shows next
+			 * to the device as <name>.stats. */
+			virtual bool has_stats() const { return false; }
+			virtual fs::File *open_stats_file() { return NULL; }
+
 		private:
 			util::String _name;
 		};
@@ -101,7 +107,7 @@ namespace infos {
 		typedef Device *(*device_ctor_fn)(void);
 		
 		#define RegisterDevice(_class) static infos::drivers::Device *__construct_device_##_class() { \
-			return new _class(); \
+			return new (infos::mm::HeapArena::DRIVERS) _class(); \
 		} \
 		__section(".devctor") device_ctor_fn __construct_device_ptr_##_class = __construct_device_##_class
 	}
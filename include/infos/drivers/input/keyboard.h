@@ -3,6 +3,7 @@
 #pragma once
 
 #include <infos/drivers/device.h>
+#include <infos/util/ring.h>
 
 namespace infos
 {
@@ -136,12 +137,18 @@ namespace infos
 				void attach_sink(KeyboardSink& sink) { _sink = &sink; }
 				
 			private:
+				static const unsigned int SCANCODE_BUFFER_SIZE = 64;
+
 				static void keyboard_irq_handler(const kernel::IRQ *irq, void *priv);
+				static void keyboard_softirq();
 				void handle_key_event(int8_t scancode);
 				Keys::Keys scancode_to_key(int8_t scancode);
 				
 				kernel::IRQ *_irq;
 				KeyboardSink *_sink;
+
+				// Scancodes read by the interrupt handler, and not yet passed to the sink.
+				util::SPSCRing<int8_t, SCANCODE_BUFFER_SIZE> _scancodes;
 			};
 		}
 	}
@@ -23,24 +23,31 @@ namespace infos
 				
 				bool init(kernel::DeviceManager& dm) override;
 				
+				/* Returns the IRQ for a pin.  A pin that has already been asked for is
+				 * shared: the same IRQ is returned, and each handler attached to it is
+				 * called for every interrupt. */
 				kernel::IRQ *request_physical_irq(LAPIC *lapic, uint32_t phys_irq_nr);
 				
 			private:
-				class IOAPICIRQ : public kernel::IRQ
+				static const unsigned int MAX_PINS = 256;
+
+				class IOAPICIRQ final : public kernel::IRQ
 				{
 				public:
-					IOAPICIRQ(LAPIC& lapic) : _lapic(lapic) { }
+					IOAPICIRQ(IOAPIC& ioapic, uint8_t pin) : IRQ(kernel::IRQFlags::EOI | kernel::IRQFlags::STEERABLE), _ioapic(ioapic), _pin(pin) { }
 					
-					void handle() const override;
 					void enable() override;
 					void disable() override;
-					
+					bool set_affinity(AffinityMask mask) override;
+
 				private:
-					LAPIC& _lapic;
+					IOAPIC& _ioapic;
+					uint8_t _pin;
 				};
 				
 				volatile uint32_t *_base_address;
-				uint8_t _nr_irqs;
+				unsigned int _nr_irqs;
+				IOAPICIRQ *_pin_irqs[MAX_PINS];
 				
 				void write(uint32_t reg, uint32_t val)
 				{
@@ -59,7 +66,7 @@ namespace infos
 				struct RedirectionEntry
 				{
 					union {
-						struct { uint64_t low, high; } __packed;
+						struct { uint32_t low, high; } __packed;
 
 						struct {
 							uint8_t vector;
@@ -70,11 +77,13 @@ namespace infos
 							uint8_t remote_irr : 1;
 							uint8_t trigger_mode : 1;
 							uint8_t mask : 1;
+							uint8_t reserved[4];
 							uint8_t destination;
 						} __packed;
 					};
 				} __packed;
 				
+				void load_redir_entry(uint8_t irq_index, RedirectionEntry& e);
 				void store_redir_entry(uint8_t irq_index, RedirectionEntry& e);
 			};
 		}
@@ -4,6 +4,7 @@
 
 #include <infos/drivers/device.h>
 #include <infos/kernel/irq.h>
+#include <arch/x86/msr.h>
 
 namespace infos
 {
@@ -23,6 +24,8 @@ namespace infos
 					VER = 0x0030, // Version
 					TPR = 0x0080, // Task Priority
 					EOI = 0x00B0, // EOI
+					LDR = 0x00D0, // Logical Destination
+					DFR = 0x00E0, // Destination Format
 					SVR = 0x00F0, // Spurious Interrupt Vector
 					//ENABLE     =0x00000100,   // Unit Enable
 					ESR = 0x0280, // Error Status
@@ -71,6 +74,17 @@ namespace infos
 				LAPIC(virt_addr_t base_address);
 
 				bool init(kernel::DeviceManager& dm) override;
+				void init_local();
+
+				/* In x2APIC mode the ID is the whole register, but without interrupt
+				 * remapping only the first 256 can be interrupt destinations. */
+				uint8_t id() const { return _x2apic ? read(LAPICRegisters::ID) : read(LAPICRegisters::ID) >> 24; }
+
+				bool x2apic() const { return _x2apic; }
+
+				void send_init(uint8_t apic_id);
+				void send_startup(uint8_t apic_id, uint8_t vector);
+				void send_fixed(uint8_t apic_id, uint8_t vector);
 
 				void mask_interrupts(LVTs lvt);
 				void unmask_interrupts(LVTs lvt);
@@ -89,11 +103,10 @@ namespace infos
 				class LAPICIRQ : public kernel::IRQ
 				{
 				public:
-					LAPICIRQ(LAPIC& lapic, LVTs lvt) : _lapic(lapic), _lvt(lvt) { }
+					LAPICIRQ(LAPIC& lapic, LVTs lvt) : IRQ(kernel::IRQFlags::EOI | kernel::IRQFlags::MUST_HANDLE), _lapic(lapic), _lvt(lvt) { }
 
 					void enable() override;
 					void disable() override;
-					void handle() const override;
 
 				private:
 					LAPIC& _lapic;
@@ -103,15 +116,25 @@ namespace infos
 				LAPICIRQ *_timer_irq;
 
 				void set_timer_irq(uint8_t irq);
+				void send_ipi(uint8_t apic_id, uint32_t command);
 
 				volatile uint32_t *_apic_base;
+				bool _x2apic;		// The registers are reached through MSRs, not MMIO
+
 				inline void write(LAPICRegisters::LAPICRegisters reg, uint32_t value) {
+					if (_x2apic) {
+						arch::x86::__wrmsr(MSR_X2APIC_BASE + (reg >> 4), value);
+						return;
+					}
+
 					_apic_base[reg >> 2] = value;
 					_apic_base[LAPICRegisters::ID >> 2];
 				}
 
 				inline uint32_t read(LAPICRegisters::LAPICRegisters reg) const
 				{
+					if (_x2apic) return (uint32_t)arch::x86::__rdmsr(MSR_X2APIC_BASE + (reg >> 4));
+
 					__sync_synchronize();
 					return _apic_base[reg >> 2];
 				}
@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/net/network-device.h>
+#include <infos/util/wakequeue.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class IRQ;
+	}
+
+	namespace drivers
+	{
+		namespace net
+		{
+			struct E1000Configuration
+			{
+				phys_addr_t mmio_base;	// The controller's registers (BAR0).
+				kernel::IRQ *irq;		// Its MSI interrupt, or NULL if it is to be polled.
+			};
+
+			/* An Intel 8254x (e1000) or 82574 (e1000e) Ethernet controller, with one
+			 * receive and one transmit ring of legacy descriptors.
+			 *
+			 * Frames are received straight into packet buffers, which stay in their ring
+			 * slots until they are taken, and are replaced, and the slots given back to
+			 * the controller, in batches.  Packets are transmitted from their own
+			 * buffers, a descriptor each, and handed over with one tail write per call,
+			 * and the transmit interrupt is only unmasked while a transmitter is
+			 * waiting for room.  The controller's interrupt throttling (ITR) limits how
+			 * often it interrupts at all. */
+			class E1000Device : public NetworkDevice
+			{
+			public:
+				static const DeviceClass E1000DeviceClass;
+				const DeviceClass& device_class() const override { return E1000DeviceClass; }
+
+				E1000Device(const E1000Configuration& cfg);
+
+				bool init(kernel::DeviceManager& dm) override;
+
+				void mac_address(uint8_t *mac) const override;
+				unsigned int transmit_packets(mm::PacketBuffer **packets, unsigned int count, bool wait) override;
+				mm::PacketBuffer *receive_packet(bool wait) override;
+				bool has_received() const override;
+
+			private:
+				// Ring sizes (a multiple of eight), each ring one page of descriptors.
+				static const unsigned int NR_RX_DESCRIPTORS = 128;
+				static const unsigned int NR_TX_DESCRIPTORS = 128;
+
+				// Read slots are given back to the controller this many at a time.
+				static const unsigned int RX_REFILL_BATCH = 16;
+
+				struct RxDescriptor {
+					uint64_t address;
+					volatile uint16_t length;
+					volatile uint16_t checksum;
+					volatile uint8_t status;
+					volatile uint8_t errors;
+					volatile uint16_t special;
+				} __packed;
+
+				struct TxDescriptor {
+					uint64_t address;
+					uint16_t length;
+					uint8_t cso;
+					uint8_t command;
+					volatile uint8_t status;
+					uint8_t css;
+					uint16_t special;
+				} __packed;
+
+				phys_addr_t _mmio_base;
+				volatile uint32_t *_regs;
+				kernel::IRQ *_irq;
+				uint8_t _mac[6];
+
+				RxDescriptor *_rx_ring;
+				TxDescriptor *_tx_ring;
+
+				// Everything below is guarded by the lock of '_tx_waiters', on which
+				// transmitters waiting for room sleep.
+				unsigned int _tx_tail;		// The next descriptor to fill.
+				unsigned int _tx_clean;		// The oldest descriptor not yet reclaimed.
+				mm::PacketBuffer *_tx_packets[NR_TX_DESCRIPTORS];	// By their last descriptors.
+				bool _tx_waiting;
+				util::WakeQueue _tx_waiters;
+
+				// ...and of '_rx_waiters', on which readers sleep.
+				unsigned int _rx_next;		// The next descriptor to read a frame from.
+				unsigned int _rx_unposted;	// Read, but not yet given back.
+				mm::PacketBuffer *_rx_packets[NR_RX_DESCRIPTORS];
+				util::WakeQueue _rx_waiters;
+
+				uint32_t read(uint32_t reg) const { return _regs[reg >> 2]; }
+				void write(uint32_t reg, uint32_t value) { _regs[reg >> 2] = value; }
+
+				bool reset();
+				void read_mac_address();
+				bool init_rings();
+
+				bool can_wait_for_irq() const;
+				void reclaim_tx();
+				unsigned int tx_free() const;
+
+				static void irq_handler(const kernel::IRQ *irq, void *priv);
+			};
+		}
+	}
+}
+
+#define E1000_PCI_VENDOR			0x8086
+
+#define E1000_REG_CTRL				0x0000
+#define E1000_REG_STATUS			0x0008
+#define E1000_REG_ICR				0x00C0
+#define E1000_REG_ITR				0x00C4
+#define E1000_REG_IMS				0x00D0
+#define E1000_REG_IMC				0x00D8
+#define E1000_REG_RCTL				0x0100
+#define E1000_REG_TCTL				0x0400
+#define E1000_REG_TIPG				0x0410
+#define E1000_REG_RDBAL				0x2800
+#define E1000_REG_RDBAH				0x2804
+#define E1000_REG_RDLEN				0x2808
+#define E1000_REG_RDH				0x2810
+#define E1000_REG_RDT				0x2818
+#define E1000_REG_TDBAL				0x3800
+#define E1000_REG_TDBAH				0x3804
+#define E1000_REG_TDLEN				0x3808
+#define E1000_REG_TDH				0x3810
+#define E1000_REG_TDT				0x3818
+#define E1000_REG_MTA				0x5200
+#define E1000_REG_RAL0				0x5400
+#define E1000_REG_RAH0				0x5404
+
+#define E1000_MMIO_SIZE				0x20000
+
+#define E1000_CTRL_ASDE				(1u << 5)
+#define E1000_CTRL_SLU				(1u << 6)
+#define E1000_CTRL_RST				(1u << 26)
+
+#define E1000_STATUS_LU				(1u << 1)
+
+#define E1000_RAH_AV				(1u << 31)
+
+#define E1000_RCTL_EN				(1u << 1)
+#define E1000_RCTL_BAM				(1u << 15)
+#define E1000_RCTL_SECRC			(1u << 26)
+
+#define E1000_TCTL_EN				(1u << 1)
+#define E1000_TCTL_PSP				(1u << 3)
+#define E1000_TCTL_CT(x)			((x) << 4)
+#define E1000_TCTL_COLD(x)			((x) << 12)
+
+#define E1000_TIPG_DEFAULT			0x0060200A
+
+#define E1000_INT_TXDW				(1u << 0)
+#define E1000_INT_LSC				(1u << 2)
+#define E1000_INT_RXDMT0			(1u << 4)
+#define E1000_INT_RXO				(1u << 6)
+#define E1000_INT_RXT0				(1u << 7)
+
+#define E1000_RXD_STAT_DD			(1u << 0)
+#define E1000_RXD_STAT_EOP			(1u << 1)
+
+#define E1000_TXD_CMD_EOP			(1u << 0)
+#define E1000_TXD_CMD_IFCS			(1u << 1)
+#define E1000_TXD_CMD_RS			(1u << 3)
+#define E1000_TXD_STAT_DD			(1u << 0)
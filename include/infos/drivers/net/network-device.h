@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/device.h>
+#include <infos/util/iovec.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		struct PacketBuffer;
+	}
+}
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace net
+		{
+			// The largest Ethernet frame that is sent or received (without the FCS),
+			// which leaves room for a VLAN tag.
+			#define NET_MAX_FRAME_SIZE		1518
+
+			/* What a device can do for the stack, for packets that ask for it. */
+			namespace NetworkOffload
+			{
+				enum NetworkOffload
+				{
+					TX_CHECKSUM = 1 << 0,	// Filling in a transport checksum
+					TSO = 1 << 1,			// Cutting a TCP segment into smaller ones
+				};
+			}
+
+			/* A network interface, which sends and receives whole Ethernet frames, for
+			 * whoever has the device open, or for the protocol stack, if it has been
+			 * given the device. */
+			class NetworkDevice : public Device
+			{
+			public:
+				static const DeviceClass NetworkDeviceClass;
+				const DeviceClass& device_class() const override { return NetworkDeviceClass; }
+
+				typedef void (*receive_notifier_t)(NetworkDevice& dev, void *priv);
+
+				NetworkDevice() : _rx_notifier(NULL), _rx_notifier_priv(NULL) { }
+
+				virtual void mac_address(uint8_t *mac) const = 0;
+
+				/* Sends each of the packets as a frame, handing them to the device
+				 * together, and returns how many were sent.  The device has the
+				 * references of the packets it sent, and releases them when it is done
+				 * with them; the rest are still the caller's.  It is short if the
+				 * device had no room for the rest and 'wait' isn't set, or a packet
+				 * was too big, or hadn't the headroom the device needs. */
+				virtual unsigned int transmit_packets(mm::PacketBuffer **packets, unsigned int count, bool wait) = 0;
+
+				/* Returns the next frame that has been received, in the buffers the
+				 * device received it in, for the caller to release.  If there isn't
+				 * one, returns NULL straight away, unless 'wait' is set. */
+				virtual mm::PacketBuffer *receive_packet(bool wait) = 0;
+
+				/* The same as transmit_packets(), but the frames are copied into packet
+				 * buffers first. */
+				unsigned int transmit(const util::IOVec *frames, unsigned int count, bool wait);
+
+				/* Copies the next frame that has been received to the buffer, cutting
+				 * it short if it doesn't fit, and returns its length, or zero if there
+				 * isn't one and 'wait' isn't set. */
+				int receive(void *buffer, size_t size, bool wait);
+
+				/* Whether there are received frames to be read.  Safe with interrupts
+				 * disabled. */
+				virtual bool has_received() const = 0;
+
+				/* The NetworkOffloads the device does.  By default, none. */
+				virtual unsigned int offloads() const { return 0; }
+
+				/* With TSO, the most data one TCP segment handed to the device can
+				 * carry. */
+				virtual size_t tso_max_size() const { return 0; }
+
+				/* Network devices can be opened as files, e.g. /dev/vnet0: a read returns
+				 * a frame, a write sends one, and a vectored write sends a frame per
+				 * buffer, at once.  Readers are told by poll() when frames arrive. */
+				fs::File *open_as_file() override;
+
+				/* Has the function called when frames arrive, from the device's
+				 * interrupt handler (so it mustn't sleep), e.g. for the protocol stack
+				 * to schedule the taking of them. */
+				void set_receive_notifier(receive_notifier_t fn, void *priv);
+
+			protected:
+				/* Drivers call this when frames arrive, to wake the threads polling the
+				 * device, and tell the notifier. */
+				void frames_received();
+
+			private:
+				receive_notifier_t _rx_notifier;
+				void *_rx_notifier_priv;
+			};
+		}
+	}
+}
@@ -12,7 +12,16 @@ namespace infos
 			class Network : public PCIDevice
 			{
 			public:
+				static const DeviceClass NetworkDeviceClass;
+				const DeviceClass& device_class() const override { return NetworkDeviceClass; }
+
 				Network(PCIBus& bus, unsigned int slot, unsigned int func);
+
+				bool init(kernel::DeviceManager& dm) override;
+
+			private:
+				bool init_virtio_net(kernel::DeviceManager& dm);
+				bool init_e1000(kernel::DeviceManager& dm);
 			};
 		}
 	}
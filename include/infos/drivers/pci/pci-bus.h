@@ -25,9 +25,19 @@ namespace infos
 				unsigned int id() const { return _bus_id; }
 				
 				bool probe(kernel::DeviceManager& dm);
+
+				/* Probes every bus that can be reached: those of each host controller, and,
+				 * through their bridges, those below them. */
+				static bool probe_all(kernel::DeviceManager& dm);
 				
 			private:
 				unsigned int _bus_id;
+
+				bool claim();
+
+				// Storage controllers are probed in the background, alongside one
+				// another, and the rest of the boot (see DeviceInitGroup::STORAGE).
+				static bool storage_probe(void *arg);
 				
 				bool probe_slot(kernel::DeviceManager& dm, unsigned int slot);
 				bool probe_func(kernel::DeviceManager& dm, unsigned int slot, unsigned int func);
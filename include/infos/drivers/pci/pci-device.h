@@ -13,9 +13,17 @@
 #define PCI_CONFIG_VENDOR(__v) PCI_CONFIG_VALUE(__v, 0, 16)
 #define PCI_CONFIG_DEVICE(__v) PCI_CONFIG_VALUE(__v, 16, 16)
 
+#define PCI_REG_COMMAND	0x04
+#define PCI_COMMAND_IO			(1 << 0)
+#define PCI_COMMAND_MEMORY		(1 << 1)
+#define PCI_COMMAND_BUS_MASTER	(1 << 2)
+#define PCI_COMMAND_INTX_DISABLE	(1 << 10)
+#define PCI_STATUS_CAPABILITIES	(1 << 20)		// In the upper half, the status register.
+
 #define PCI_REG_INFO	0x08
 #define PCI_CONFIG_CLASS(__v)		PCI_CONFIG_VALUE(__v, 24, 8)
 #define PCI_CONFIG_SUBCLASS(__v)	PCI_CONFIG_VALUE(__v, 16, 8)
+#define PCI_CONFIG_PROGIF(__v)		PCI_CONFIG_VALUE(__v, 8, 8)
 
 #define PCI_REG_CONFIG	0x0C
 #define PCI_CONFIG_HDRTYPE(__v)	PCI_CONFIG_VALUE(__v, 16, 8)
@@ -31,10 +39,30 @@
 #define PCI_REG_BAR4 0x20
 #define PCI_REG_BAR5 0x24
 
+#define PCI_REG_CAPABILITIES 0x34
 #define PCI_REG_IRQ 0x3c
 
+#define PCI_CAP_ID(__v)		PCI_CONFIG_VALUE(__v, 0, 8)
+#define PCI_CAP_NEXT(__v)	PCI_CONFIG_VALUE(__v, 8, 8)
+
+#define PCI_CAP_ID_MSI		0x05
+#define PCI_MSI_ENABLE		(1 << 16)			// In the first dword of the capability.
+#define PCI_MSI_64BIT		(1 << 23)
+#define PCI_MSI_MULTIPLE_CAPABLE(__v)	PCI_CONFIG_VALUE(__v, 17, 3)	// log2 of the messages it can send
+
+#define PCI_CAP_ID_MSIX		0x11
+#define PCI_MSIX_ENABLE		(1u << 31)			// In the first dword of the capability.
+#define PCI_MSIX_FUNCTION_MASK	(1u << 30)
+#define PCI_MSIX_TABLE_SIZE(__v)	(PCI_CONFIG_VALUE(__v, 16, 11) + 1)
+#define PCI_MSIX_ENTRY_MASKED	1				// In the vector control dword of a table entry.
+
 namespace infos
 {
+	namespace kernel
+	{
+		class IRQ;
+	}
+
 	namespace drivers
 	{
 		namespace pci
@@ -82,12 +110,26 @@ namespace infos
 				unsigned int func() const { return _func; }
 				
 				PCIDeviceClass::PCIDeviceClass pci_class() const;
+
+				/* Message-signalled interrupts can be sent to any CPU: this one means
+				 * the CPU asking for them. */
+				static const unsigned int CURRENT_CPU = ~0u;
 				
 			protected:
 				uint32_t read_config(uint8_t reg) const;
 				void write_config(uint8_t reg, uint32_t value) const;
+
+				uint8_t find_capability(uint8_t id) const;
+				kernel::IRQ *request_msi(kernel::DeviceManager& dm, unsigned int cpu = CURRENT_CPU) const;
+				unsigned int request_msi_block(kernel::DeviceManager& dm, kernel::IRQ **irqs, unsigned int nr, unsigned int cpu = CURRENT_CPU) const;
+
+				unsigned int msix_table_size() const;
+				kernel::IRQ *request_msix(kernel::DeviceManager& dm, unsigned int entry, unsigned int cpu = CURRENT_CPU) const;
 				
 			private:
+				class MSIIRQ;
+				class MSIXIRQ;
+
 				PCIBus& _owner;
 				unsigned int _slot, _func;
 			};
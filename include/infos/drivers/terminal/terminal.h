@@ -38,14 +38,22 @@ namespace infos {
 				
 				void append_to_read_buffer(uint8_t c);
 				
+				/* Sleeps until there is input, then returns what there is, up to the end
+				 * of the first line, so that a reader asking for a line's worth isn't
+				 * kept waiting for the rest of its buffer. */
 				int read(void* buffer, size_t size) override;
+				/* Like read, but returns what has been typed already, without waiting. */
+				int read_nonblocking(void* buffer, size_t size);
+				bool has_input() const { return _read_buffer_head != _read_buffer_tail; }
 				virtual bool supports_colour() const = 0;
 				
 				fs::File* open_as_file() override;
 				
 			private:
-				uint8_t _read_buffer[64];
-				uint8_t _read_buffer_head, _read_buffer_tail;
+				// Input is dropped, rather than overwriting what hasn't been read, once
+				// this fills up.
+				uint8_t _read_buffer[256];
+				unsigned int _read_buffer_head, _read_buffer_tail;
 				util::Event _read_buffer_event;
 			};
 			class ConsoleTerminal : public Terminal
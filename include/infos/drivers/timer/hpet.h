@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/drivers/timer/hpet.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/drivers/timer/timer.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class IRQ;
+	}
+
+	namespace drivers
+	{
+		namespace timer
+		{
+			/* The high precision event timer.  Its main counter runs at a fixed rate,
+			 * whatever the processors are doing, so it can be the kernel's clock where
+			 * the TSC can't be trusted.  Timer 0 is used for one-shot and periodic
+			 * events, which are counted in ticks of the main counter. */
+			class HPET : public Timer
+			{
+			public:
+				static const DeviceClass HPETDeviceClass;
+				const DeviceClass& device_class() const override { return HPETDeviceClass; }
+
+				HPET(virt_addr_t base_address);
+
+				bool init(kernel::DeviceManager& dm) override;
+
+				void init_oneshot(uint64_t period) override;
+				void init_periodic(uint64_t period) override;
+
+				void start() override;
+				void stop() override;
+				void reset() override;
+
+				bool expired() const override;
+
+				/* The main counter. */
+				uint64_t count() const override;
+				uint64_t frequency() const override { return _frequency; }
+
+				/* Whether the main counter is 64 bits wide, rather than 32, so that it
+				 * doesn't wrap. */
+				bool wide() const { return _wide; }
+
+				/* Makes the main counter the kernel's runtime clock, in place of the
+				 * TSC.  Only a wide counter can be. */
+				bool use_as_clocksource();
+
+			private:
+				volatile uint64_t *_base;
+				uint64_t _frequency;
+				uint32_t _period_fs;
+				bool _wide;
+
+				kernel::IRQ *_irq;
+				uint64_t _deadline;
+				bool _periodic;
+				volatile bool _fired;
+
+				uint64_t read(unsigned int reg) const { return _base[reg >> 3]; }
+				void write(unsigned int reg, uint64_t value) { _base[reg >> 3] = value; }
+
+				bool route_irq(kernel::DeviceManager& dm);
+
+				static void hpet_irq_handler(const kernel::IRQ *irq, void *priv);
+			};
+		}
+	}
+}
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <infos/drivers/timer/timer.h>
+#include <infos/util/time.h>
 
 namespace infos {
 	namespace kernel {
@@ -47,15 +48,26 @@ namespace infos {
 
 				uint64_t frequency() const override { return _frequency; }
 
+				/* Arms the timer to interrupt once, after the given delay.  A delay of
+				 * zero interrupts as soon as possible. */
+				void set_deadline(util::Nanoseconds delay);
+
+				/* Sets up the calling CPU's timer as init() did the boot CPU's, so that
+				 * it interrupts on the same vector, and counts at the same rate. */
+				void init_cpu();
+
 			private:
 				uint64_t _frequency;
 				uint64_t _cmploops_per_us;
+				util::ClockScale _ns_to_ticks;
 
 				kernel::IRQ *_irq;
 				drivers::irq::LAPIC *_lapic;
 
 				static void lapic_timer_irq_handler(const kernel::IRQ *irq, void *priv);
 				bool calibrate();
+				void calibrate_tsc();
+				void calibrate_from_tsc(uint64_t tsc_hz);
 			};
 		}
 	}
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/drivers/video/fb-console.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/drivers/console/physical-console.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace console
+		{
+			class VirtualConsole;
+		}
+
+		namespace video
+		{
+			/* A linear framebuffer, as the boot loader set it up. */
+			struct FramebufferInfo
+			{
+				virt_addr_t base;
+				unsigned int width, height, pitch, bpp;
+				uint8_t red_position, red_size;
+				uint8_t green_position, green_size;
+				uint8_t blue_position, blue_size;
+			};
+
+			/* A physical console that draws the text of the virtual consoles on a 32-bit
+			 * linear framebuffer.  The virtual console's text is copied to a grid of
+			 * cells here, as it would be to text-mode video memory, and only the cells
+			 * that differ from what was last drawn are drawn again, from a cache of
+			 * glyphs already rendered in the framebuffer's pixel format. */
+			class FramebufferConsoleDevice : public console::PhysicalConsole
+			{
+			public:
+				static const DeviceClass FramebufferConsoleDeviceClass;
+				const DeviceClass& device_class() const override { return FramebufferConsoleDeviceClass; }
+
+				FramebufferConsoleDevice(const FramebufferInfo& info);
+				virtual ~FramebufferConsoleDevice();
+
+				bool supports_colour() const override { return true; }
+
+				/* Whether text can be drawn on a framebuffer like this one. */
+				static bool supported(const FramebufferInfo& info);
+
+			protected:
+				void virtual_console_changed() override;
+
+			private:
+				static const unsigned int COLUMNS = 80;
+				static const unsigned int ROWS = 25;
+
+				// Each glyph is drawn twice as tall as the font, to keep the text's shape.
+				static const unsigned int CELL_WIDTH = 8;
+				static const unsigned int CELL_HEIGHT = 16;
+
+				static const unsigned int GLYPH_CACHE_SIZE = 256;
+
+				struct CachedGlyph
+				{
+					uint32_t key;				// The cell it was rendered for, or ~0 if none
+					uint32_t pixels[CELL_HEIGHT][CELL_WIDTH];
+				};
+
+				FramebufferInfo _info;
+				unsigned int _x_origin, _y_origin;	// Where the text starts, in pixels
+
+				uint16_t _cells[COLUMNS * ROWS];	// What the virtual console wants shown
+				uint16_t _drawn[COLUMNS * ROWS];	// What is on the framebuffer
+				unsigned int _cursor;
+
+				uint32_t _palette[16];
+				CachedGlyph *_glyphs;
+
+				console::VirtualConsole *_old_vc;
+
+				static void VCUpdateCallback(console::VirtualConsole& vc);
+
+				uint32_t make_pixel(uint8_t r, uint8_t g, uint8_t b) const;
+				const CachedGlyph& glyph(uint16_t cell);
+				void draw_cells(unsigned int row, unsigned int first, unsigned int last);
+				void draw_cursor(unsigned int position);
+				void update(unsigned int cursor);
+			};
+		}
+	}
+}
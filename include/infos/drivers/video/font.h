@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/drivers/video/font.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace video
+		{
+			/* The font that text is drawn in on a framebuffer.  Only the printable ASCII
+			 * characters have glyphs. */
+			static const unsigned int FONT_WIDTH = 8;
+			static const unsigned int FONT_HEIGHT = 8;
+			static const uint8_t FONT_FIRST_CHAR = 0x20;
+			static const uint8_t FONT_LAST_CHAR = 0x7e;
+
+			extern const uint8_t font8x8[FONT_LAST_CHAR - FONT_FIRST_CHAR + 1][FONT_HEIGHT];
+		}
+	}
+}
@@ -40,7 +40,6 @@ namespace infos
 			private:
 				phys_addr_t _video_ram_address;
 				
-				uint16_t *_backup_buffer;
 				console::VirtualConsole *_old_vc;
 				
 				static void VCUpdateCallback(console::VirtualConsole& vc);
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/block/block-device.h>
+#include <infos/drivers/block/block-device-partition.h>
+#include <infos/drivers/block/block-request-queue.h>
+#include <infos/drivers/virtio/virtio.h>
+#include <infos/drivers/virtio/virtqueue.h>
+#include <infos/kernel/log.h>
+#include <infos/util/list.h>
+#include <infos/util/wakequeue.h>
+#include <infos/util/iovec.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class IRQ;
+	}
+
+	namespace drivers
+	{
+		namespace virtio
+		{
+			struct VirtioBlockConfiguration
+			{
+				uint16_t io_base;		// The legacy interface's registers (BAR0).
+				kernel::IRQ *irq;		// The queue's MSI-X interrupt, or NULL if it is to be polled.
+			};
+
+			/* A virtio block device, driven through the legacy (virtio 0.9.5) PCI
+			 * interface, with one request queue. */
+			class VirtioBlockDevice : public block::BlockDevice
+			{
+			public:
+				static const DeviceClass VirtioBlockDeviceClass;
+				const DeviceClass& device_class() const override { return VirtioBlockDeviceClass; }
+
+				VirtioBlockDevice(const VirtioBlockConfiguration& cfg);
+
+				bool init(kernel::DeviceManager& dm) override;
+
+				size_t block_count() const override { return _capacity; }
+				size_t block_size() const override { return 512; }
+				bool read_blocks(void *buffer, size_t offset, size_t count) override;
+				bool write_blocks(const void *buffer, size_t offset, size_t count) override;
+				bool read_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+				bool write_blocks_vec(const util::IOVec *vec, unsigned int nr_vec, size_t offset) override;
+				void submit(block::BlockRequest& request) override;
+				void plug() override;
+				void unplug() override;
+				bool flush() override;
+
+			private:
+				static const unsigned int MAX_SLOTS = 32;
+				static const unsigned int MAX_SEGMENTS = 64;
+				static const unsigned int MAX_BATCH_VEC = 64;
+				static const size_t MAX_BATCH_BLOCKS = 2048;
+
+				/* What the device reads before, and writes after, the data of a request. */
+				struct RequestHeader {
+					uint32_t type;
+					uint32_t reserved;
+					uint64_t sector;
+				} __packed;
+
+				/* The headers and status bytes of every slot, in memory the device can
+				 * reach. */
+				struct SlotMemory {
+					RequestHeader header;
+					volatile uint8_t status;
+				} __packed;
+
+				/* A request in the virtqueue.  A slot carries out a batch of queued
+				 * requests, chained through 'next', in as many virtio requests as the
+				 * descriptors allow, or (with 'requests' NULL) a flush. */
+				struct Slot {
+					block::BlockRequest *requests;
+					bool write;
+					size_t offset, nr_blocks;
+					size_t nr_done, nr_in_flight;
+					util::IOVec vec[MAX_BATCH_VEC];
+					unsigned int nr_vec;
+
+					bool in_use;
+					uint16_t head;
+				};
+
+				uint16_t _io_base;
+				bool _msix;				// MSI-X is enabled, which moves the device configuration.
+				kernel::IRQ *_irq;
+
+				uint32_t _features;
+				uint64_t _capacity;
+				unsigned int _max_segments;
+				uint32_t _max_segment_size;
+
+				// Everything below is guarded by the lock of 'waiters', on which threads
+				// waiting for the device sleep, keyed by what they are waiting for.
+				Virtqueue _queue;
+				Slot _slots[MAX_SLOTS];
+				SlotMemory *_slot_memory;
+				phys_addr_t _slot_memory_pa;
+				unsigned int _nr_busy;
+
+				block::BlockRequestQueue _requests;
+				unsigned int _plugged;
+				bool _flushing;
+				bool _flush_success;
+
+				util::WakeQueue _waiters;
+
+				uint8_t read8(int reg) const;
+				uint16_t read16(int reg) const;
+				uint32_t read32(int reg) const;
+				void write8(int reg, uint8_t value);
+				void write16(int reg, uint16_t value);
+				void write32(int reg, uint32_t value);
+				int config_base() const;
+
+				bool can_wait_for_irq() const;
+				bool dma_can_map(const util::IOVec *vec, unsigned int nr_vec) const;
+
+				bool transfer(bool write, uint64_t lba, const util::IOVec *vec, unsigned int nr_vec, size_t nr_blocks);
+				void queue_request(block::BlockRequest& request);
+				void start_requests();
+				bool start_slot(unsigned int n);
+				void complete_slot(unsigned int n, bool success);
+				void notify();
+				void wait_locked(const util::WakeQueue::Key& key);
+				void service_queue();
+
+				static void irq_handler(const kernel::IRQ *irq, void *priv);
+
+				bool check_for_partitions();
+				bool create_partitions(const uint8_t *partition_table);
+
+				infos::util::List<block::BlockDevicePartition *> _partitions;
+			};
+
+		}
+	}
+}
+
+#define VIRTIO_BLK_F_SIZE_MAX		(1u << 1)
+#define VIRTIO_BLK_F_SEG_MAX		(1u << 2)
+#define VIRTIO_BLK_F_RO				(1u << 5)
+#define VIRTIO_BLK_F_FLUSH			(1u << 9)
+
+// The device configuration of a block device, from the configuration base.
+#define VIRTIO_BLK_CFG_CAPACITY		0x00
+#define VIRTIO_BLK_CFG_SIZE_MAX		0x08
+#define VIRTIO_BLK_CFG_SEG_MAX		0x0C
+
+#define VIRTIO_BLK_T_IN				0
+#define VIRTIO_BLK_T_OUT			1
+#define VIRTIO_BLK_T_FLUSH			4
+
+#define VIRTIO_BLK_S_OK				0
+
+#define VIRTIO_PCI_DEVICE_BLK		0x1001		// A transitional (legacy) block device.
@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/net/network-device.h>
+#include <infos/drivers/virtio/virtio.h>
+#include <infos/drivers/virtio/virtqueue.h>
+#include <infos/util/wakequeue.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class IRQ;
+	}
+
+	namespace mm
+	{
+		struct FrameDescriptor;
+	}
+
+	namespace drivers
+	{
+		namespace virtio
+		{
+			// The most receive/transmit queue pairs that are used.
+			#define VIRTIO_NET_MAX_QUEUE_PAIRS	4
+
+			struct VirtioNetConfiguration
+			{
+				uint16_t io_base;		// The legacy interface's registers (BAR0).
+
+				// The MSI-X interrupts of the queues, which are MSI-X entries 2n (receive)
+				// and 2n + 1 (transmit) for queue pair n.  Queue pairs without both are
+				// not used; with none at all, the device is polled.
+				kernel::IRQ *irqs[VIRTIO_NET_MAX_QUEUE_PAIRS * 2];
+				unsigned int nr_irqs;
+			};
+
+			/* A virtio network device, driven through the legacy (virtio 0.9.5) PCI
+			 * interface, with a receive and a transmit queue per queue pair, and as many
+			 * queue pairs as the device, the interrupts and the CPUs allow.  Each pair has
+			 * its own lock and interrupts, and a CPU transmits on the pair it is given.
+			 *
+			 * Frames are received straight into packet buffers, which are posted up-front,
+			 * and replaced in batches as frames are taken.  Packets are transmitted from
+			 * their own buffers, a descriptor each, with the virtio-net header in the
+			 * headroom, and are handed to the device together, with one notification.
+			 * The device doesn't interrupt for finished ones unless a transmitter is
+			 * waiting for room: they are released by the next transmit.
+			 *
+			 * If the device offers them, it fills in transmitted checksums, and cuts
+			 * TCP segments of up to a buffer per descriptor into smaller ones. */
+			class VirtioNetDevice : public net::NetworkDevice
+			{
+			public:
+				static const DeviceClass VirtioNetDeviceClass;
+				const DeviceClass& device_class() const override { return VirtioNetDeviceClass; }
+
+				VirtioNetDevice(const VirtioNetConfiguration& cfg);
+
+				bool init(kernel::DeviceManager& dm) override;
+
+				void mac_address(uint8_t *mac) const override;
+				unsigned int transmit_packets(mm::PacketBuffer **packets, unsigned int count, bool wait) override;
+				mm::PacketBuffer *receive_packet(bool wait) override;
+				bool has_received() const override { return __atomic_load_n(&_nr_received, __ATOMIC_ACQUIRE) != 0; }
+
+				unsigned int offloads() const override;
+				size_t tso_max_size() const override;
+
+			private:
+				// Receive buffers posted per queue, each of which takes two descriptors
+				// (the virtio-net header, in the packet buffer's headroom, and the frame).
+				static const unsigned int MAX_RX_BUFFERS = 64;
+
+				// The most buffers a transmitted packet can be in.
+				static const unsigned int MAX_TX_SEGMENTS = 8;
+
+				// Received frames are replaced this many at a time, unless the device is
+				// running short of buffers.
+				static const unsigned int RX_REFILL_BATCH = 16;
+
+				/* What comes before every frame (without VIRTIO_NET_F_MRG_RXBUF), in a
+				 * descriptor of its own. */
+				struct NetHeader {
+					uint8_t flags;
+					uint8_t gso_type;
+					uint16_t hdr_len;
+					uint16_t gso_size;
+					uint16_t csum_start;
+					uint16_t csum_offset;
+				} __packed;
+
+				struct QueuePair {
+					VirtioNetDevice *device;
+					unsigned int index;
+					kernel::IRQ *rx_irq, *tx_irq;
+
+					// Everything below is guarded by the lock of 'waiters', on which
+					// transmitters waiting for room sleep.
+					Virtqueue rx, tx;
+					mm::PacketBuffer **rx_packets;	// What each chain is, by its head.
+					mm::PacketBuffer **tx_packets;
+					unsigned int nr_rx_buffers;		// How many receive buffers to keep posted.
+					unsigned int nr_posted;
+
+					// The received frames, oldest first.
+					mm::PacketBuffer *received[MAX_RX_BUFFERS];
+					unsigned int received_head, nr_received;
+
+					bool tx_waiting;
+
+					util::WakeQueue waiters;
+				};
+
+				uint16_t _io_base;
+				bool _msix;				// MSI-X is enabled, which moves the device configuration.
+				uint32_t _features;
+				uint8_t _mac[6];
+
+				kernel::IRQ *_irqs[VIRTIO_NET_MAX_QUEUE_PAIRS * 2];
+				unsigned int _nr_irqs;
+
+				QueuePair _pairs[VIRTIO_NET_MAX_QUEUE_PAIRS];
+				unsigned int _nr_pairs;
+				unsigned int _next_rx_pair;		// Where receive() starts looking.
+
+				// Received frames on every pair, which readers wait for on the lock of
+				// '_rx_waiters'.
+				unsigned int _nr_received;
+				util::WakeQueue _rx_waiters;
+
+				uint8_t read8(int reg) const;
+				uint16_t read16(int reg) const;
+				uint32_t read32(int reg) const;
+				void write8(int reg, uint8_t value);
+				void write16(int reg, uint16_t value);
+				void write32(int reg, uint32_t value);
+				int config_base() const;
+
+				bool init_queue(unsigned int queue, Virtqueue& vq, kernel::IRQ *& irq);
+				bool init_pair(QueuePair& pair);
+				bool set_queue_pairs(Virtqueue& ctrl, unsigned int ctrl_queue);
+
+				bool can_wait_for_irq() const;
+
+				bool post_rx(QueuePair& pair);
+				void refill_rx(QueuePair& pair, bool force);
+				unsigned int service_rx(QueuePair& pair);
+				void reclaim_tx(QueuePair& pair);
+				void notify(unsigned int queue, Virtqueue& vq);
+				mm::PacketBuffer *take_received(QueuePair& pair, bool polled);
+
+				static void rx_irq_handler(const kernel::IRQ *irq, void *priv);
+				static void tx_irq_handler(const kernel::IRQ *irq, void *priv);
+			};
+		}
+	}
+}
+
+// The device features that are used.
+#define VIRTIO_NET_F_CSUM			(1u << 0)
+#define VIRTIO_NET_F_MAC			(1u << 5)
+#define VIRTIO_NET_F_HOST_TSO4		(1u << 11)
+#define VIRTIO_NET_F_STATUS			(1u << 16)
+#define VIRTIO_NET_F_CTRL_VQ		(1u << 17)
+#define VIRTIO_NET_F_MQ				(1u << 22)
+
+// The device configuration of a network device, from the configuration base.
+#define VIRTIO_NET_CFG_MAC			0x00
+#define VIRTIO_NET_CFG_STATUS		0x06
+#define VIRTIO_NET_CFG_MAX_PAIRS	0x08
+
+#define VIRTIO_NET_S_LINK_UP		1
+
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM		1
+#define VIRTIO_NET_HDR_GSO_TCPV4		1
+
+#define VIRTIO_NET_CTRL_MQ					4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET		0
+#define VIRTIO_NET_OK						0
+
+#define VIRTIO_PCI_DEVICE_NET		0x1000		// A transitional (legacy) network device.
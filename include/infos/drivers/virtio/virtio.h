@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/kernel/log.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace virtio
+		{
+			extern kernel::ComponentLog virtio_log;
+		}
+	}
+}
+
+// Registers of the legacy interface, from the I/O base.
+#define VIRTIO_REG_DEVICE_FEATURES	0x00
+#define VIRTIO_REG_GUEST_FEATURES	0x04
+#define VIRTIO_REG_QUEUE_ADDRESS	0x08
+#define VIRTIO_REG_QUEUE_SIZE		0x0C
+#define VIRTIO_REG_QUEUE_SELECT		0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY		0x10
+#define VIRTIO_REG_DEVICE_STATUS	0x12
+#define VIRTIO_REG_ISR_STATUS		0x13
+#define VIRTIO_REG_MSI_CONFIG_VECTOR	0x14		// Only there with MSI-X enabled.
+#define VIRTIO_REG_MSI_QUEUE_VECTOR	0x16
+
+#define VIRTIO_MSI_NO_VECTOR		0xffff
+
+#define VIRTIO_STATUS_ACKNOWLEDGE	1
+#define VIRTIO_STATUS_DRIVER		2
+#define VIRTIO_STATUS_DRIVER_OK		4
+#define VIRTIO_STATUS_FAILED		0x80
+
+#define VIRTIO_RING_F_EVENT_IDX		(1u << 29)
+
+#define VIRTIO_PCI_VENDOR			0x1af4
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		struct FrameDescriptor;
+	}
+
+	namespace drivers
+	{
+		namespace virtio
+		{
+			/* A split virtqueue, laid out the way the legacy interface wants it: the
+			 * descriptor table and the available ring, then the used ring on the next
+			 * page boundary, all in one physically contiguous allocation.  Buffers are
+			 * added as chains of descriptors, but only handed to the device when they
+			 * are published, so that a batch of them costs one notification.  There is
+			 * no locking: the driver serialises its use of the queue. */
+			class Virtqueue
+			{
+			public:
+				/* One physically contiguous part of a chain. */
+				struct Buffer {
+					phys_addr_t address;
+					uint32_t size;
+					bool device_writes;
+				};
+
+				Virtqueue();
+
+				/* Allocates a queue of 'size' entries (a power of two).  With 'event_idx',
+				 * the device and driver tell each other which entry they want to hear
+				 * about next, rather than turning notifications on and off. */
+				bool init(uint16_t size, bool event_idx);
+
+				phys_addr_t address() const { return _pa; }
+				uint16_t size() const { return _size; }
+				unsigned int nr_free() const { return _nr_free; }
+
+				/* Adds a chain of buffers, which must fit in the free descriptors, and
+				 * returns the index of its first descriptor, which identifies it when the
+				 * device is done with it. */
+				uint16_t add(const Buffer *buffers, unsigned int count);
+
+				/* Hands the chains added since the last call to the device.  Returns
+				 * true if the device wants to be notified of them. */
+				bool publish();
+
+				/* Takes the next chain the device has finished with, if there is one,
+				 * and frees its descriptors. */
+				bool get_used(uint16_t& head, uint32_t& length);
+
+				/* Asks the device not to interrupt, e.g. while the used ring is being
+				 * drained anyway. */
+				void disable_interrupts();
+
+				/* Asks the device to interrupt for the next chain it finishes with.
+				 * Returns false if it has already finished with some, which the caller
+				 * must drain, or they won't be interrupted for. */
+				bool enable_interrupts();
+
+			private:
+				struct Descriptor {
+					uint64_t address;
+					uint32_t size;
+					uint16_t flags;
+					uint16_t next;
+				} __packed;
+
+				struct UsedElement {
+					uint32_t id;
+					uint32_t size;
+				} __packed;
+
+				mm::FrameDescriptor *_frames;
+				phys_addr_t _pa;
+				uint16_t _size;
+				bool _event_idx;
+
+				Descriptor *_desc;
+				volatile uint16_t *_avail_flags, *_avail_idx, *_avail_ring, *_used_event;
+				volatile uint16_t *_used_flags, *_used_idx, *_avail_event;
+				volatile UsedElement *_used_ring;
+
+				uint16_t _free_head, _nr_free;
+				uint16_t _avail_next;		// The available ring index of the next chain added.
+				uint16_t _avail_published;	// ...and of the last published.
+				uint16_t _used_next;		// The used ring index of the next chain to take.
+			};
+		}
+	}
+}
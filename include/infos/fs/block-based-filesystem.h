@@ -2,17 +2,10 @@
 #pragma once
 
 #include <infos/fs/filesystem.h>
+#include <infos/drivers/block/block-cache.h>
 
 namespace infos
 {
-	namespace drivers
-	{
-		namespace block
-		{
-			class BlockDevice;
-		}
-	}
-	
 	namespace fs
 	{
 		class BlockBasedFilesystem : public Filesystem
@@ -21,12 +14,18 @@ namespace infos
 			typedef BlockBasedFilesystem *(*ProbeFn)(drivers::block::BlockDevice& bdev);
 			
 			BlockBasedFilesystem(drivers::block::BlockDevice& bdev);
+
+			/* Reading a block device is slow, so file data is cached. */
+			bool uses_page_cache() const override { return true; }
+
+			bool sync() override { return _cache.flush(); }
 			
 		protected:
-			drivers::block::BlockDevice& block_device() const { return _bdev; }
+			/* The filesystem's device, with a buffer cache in front of it. */
+			drivers::block::BlockDevice& block_device() { return _cache; }
 			
 		private:
-			drivers::block::BlockDevice& _bdev;
+			drivers::block::BlockCache _cache;
 		};
 	}
 }
@@ -48,7 +48,7 @@ namespace infos
 		class DeviceFSNode : public PFSNode
 		{
 		public:
-			DeviceFSNode(DeviceFSRootNode& fs, drivers::Device& dev);
+			DeviceFSNode(DeviceFSRootNode& fs, drivers::Device& dev, bool stats = false);
 
 			PFSNode* get_child(const util::String& name) override;
 			PFSNode* mkdir(const util::String& name) override;
@@ -58,6 +58,7 @@ namespace infos
 			
 		private:
 			drivers::Device& _dev;
+			bool _stats;			// The node is the device's statistics file.
 		};
 		
 		class DeviceFSDirectory : public SimpleDirectory
@@ -65,5 +66,42 @@ namespace infos
 		public:
 			DeviceFSDirectory(DeviceFSRootNode& node);
 		};
+
+		struct StatisticsRegistration;
+
+		/* /dev/stats, which has a file for each of the statistics registered with
+		 * RegisterStatistics. */
+		class DeviceFSStatsNode : public PFSNode
+		{
+		public:
+			DeviceFSStatsNode(DeviceFSRootNode& root);
+
+			PFSNode* get_child(const util::String& name) override;
+			PFSNode* mkdir(const util::String& name) override;
+
+			File* open() override;
+			Directory* opendir() override;
+		};
+
+		class DeviceFSStatsFileNode : public PFSNode
+		{
+		public:
+			DeviceFSStatsFileNode(DeviceFSStatsNode& parent, const StatisticsRegistration& stats);
+
+			PFSNode* get_child(const util::String& name) override;
+			PFSNode* mkdir(const util::String& name) override;
+
+			File* open() override;
+			Directory* opendir() override;
+
+		private:
+			const StatisticsRegistration& _stats;
+		};
+
+		class DeviceFSStatsDirectory : public SimpleDirectory
+		{
+		public:
+			DeviceFSStatsDirectory();
+		};
 	}
 }
@@ -18,17 +18,32 @@ namespace infos
 		class Directory
 		{
 		public:
+			Directory() : _has_unread(false) { }
 			virtual ~Directory() { }
 		
 			virtual bool read_entry(DirectoryEntry& entry) = 0;
 			
 			virtual void close() = 0;
+
+			/* Reads the next entry: the one given back by unread_entry(), if there is
+			 * one, or otherwise the next one from the filesystem. */
+			bool next_entry(DirectoryEntry& entry);
+
+			/* Gives back an entry that was read, but not used (e.g. it didn't fit in a
+			 * buffer), so that it is the next one read. */
+			void unread_entry(const DirectoryEntry& entry);
+
+		private:
+			DirectoryEntry _unread;
+			bool _has_unread;
 		};
 		
+		/* A directory whose entries are all added when it is opened. */
 		class SimpleDirectory : public Directory
 		{
 		public:
-			SimpleDirectory() : _current_entry(0) { }
+			SimpleDirectory() : _entries(NULL), _nr_entries(0), _capacity(0), _current_entry(0) { }
+			~SimpleDirectory() override { delete[] _entries; }
 			
 			bool read_entry(DirectoryEntry& entry) override;
 			void close() override;
@@ -37,7 +52,8 @@ namespace infos
 			void add_entry(const DirectoryEntry& e);
 			
 		private:
-			util::List<DirectoryEntry> _entries;
+			DirectoryEntry *_entries;
+			unsigned int _nr_entries, _capacity;
 			unsigned int _current_entry;
 		};
 	}
@@ -78,16 +78,97 @@ namespace infos
 				uint64_t filesz, memsz, align;
 			};
 
+			/* Sections, symbols and relocations, which are only looked at in relocatable
+			 * objects, i.e. kernel modules (see kernel/module.cpp). */
+			enum SectionHeaderEntryType
+			{
+				SHT_NULL = 0,
+				SHT_PROGBITS = 1,
+				SHT_SYMTAB = 2,
+				SHT_STRTAB = 3,
+				SHT_RELA = 4,
+				SHT_NOBITS = 8,
+				SHT_REL = 9,
+			};
+
+			enum SectionHeaderEntryFlags
+			{
+				SHF_WRITE = 1,
+				SHF_ALLOC = 2,
+				SHF_EXECINSTR = 4,
+			};
+
+			struct ELF64SectionHeaderEntry
+			{
+				uint32_t name, type;
+				uint64_t flags, addr, offset, size;
+				uint32_t link, info;
+				uint64_t addralign, entsize;
+			};
+
+			enum SpecialSectionIndex
+			{
+				SHN_UNDEF = 0,
+				SHN_LORESERVE = 0xff00,
+				SHN_ABS = 0xfff1,
+				SHN_COMMON = 0xfff2,
+			};
+
+			enum SymbolBinding
+			{
+				STB_LOCAL = 0,
+				STB_GLOBAL = 1,
+				STB_WEAK = 2,
+			};
+
+			struct ELF64Symbol
+			{
+				uint32_t name;
+				uint8_t info, other;
+				uint16_t shndx;
+				uint64_t value, size;
+
+				unsigned int binding() const { return info >> 4; }
+			};
+
+			enum X86_64RelocationType
+			{
+				R_X86_64_NONE = 0,
+				R_X86_64_64 = 1,
+				R_X86_64_PC32 = 2,
+				R_X86_64_PLT32 = 4,
+				R_X86_64_32 = 10,
+				R_X86_64_32S = 11,
+				R_X86_64_PC64 = 24,
+			};
+
+			struct ELF64Rela
+			{
+				uint64_t offset, info;
+				int64_t addend;
+
+				unsigned int symbol() const { return info >> 32; }
+				unsigned int type() const { return info & 0xffffffff; }
+			};
+
 			class ElfLoader : public Loader
 			{
 			public:
-				ElfLoader(File& f);
+				/* If the path of the program is given, its loaded image is kept as a
+				 * template, and later loads of the same path clone it copy-on-write
+				 * rather than loading the program again. */
+				ElfLoader(File& f, const util::String& path = util::String());
 				virtual ~ElfLoader() { }
 				
 				kernel::Process* load(const util::String& cmdline) override;
 				
 			private:
 				File& _file;
+				util::String _path;
+
+				kernel::Process* load_image(uint64_t& entry_point);
+				kernel::Process* load_image(uint8_t *headers, size_t headers_size, uint64_t& entry_point);
+				kernel::Process* load_segments(const ELF64Header& hdr, const uint8_t *phdrs);
 			};
 			
 			extern kernel::ComponentLog elf_log;
@@ -2,11 +2,48 @@
 #pragma once
 
 #include <infos/define.h>
+#include <infos/util/iovec.h>
 
 namespace infos
 {
+	namespace net
+	{
+		class Socket;
+	}
+
 	namespace fs
 	{
+		namespace FileOpenFlags
+		{
+			enum FileOpenFlags
+			{
+				NONE = 0,
+				CREATE = 0x40,		// create the file if it doesn't exist
+				TRUNCATE = 0x200,	// throw away the file's contents
+				NONBLOCK = 0x800,	// reads return what there is, rather than waiting for more
+			};
+		}
+
+		/* What a file can be ready for (see File::poll()). */
+		namespace PollEvents
+		{
+			enum PollEvents
+			{
+				READABLE = 1,		// a read would return something, without waiting
+				WRITABLE = 2,		// a write would take something, without waiting
+			};
+		}
+
+		/* What a file is a view of, and how many times that has changed: two opens
+		 * of the same file, with nothing written in between, have the same identity. */
+		struct FileIdentity
+		{
+			const void *object;
+			uint64_t version;
+
+			bool operator==(const FileIdentity& other) const { return object == other.object && version == other.version; }
+		};
+
 		class File
 		{
 		public:
@@ -24,6 +61,48 @@ namespace infos
 			virtual int pwrite(const void *buffer, size_t size, off_t off) { return 0; }
 			virtual void seek(off_t offset, SeekType type) { }
 
+			/* Vectored versions of the above: one request for a list of buffers. */
+			virtual int readv(const util::IOVec *vec, unsigned int count);
+			virtual int preadv(const util::IOVec *vec, unsigned int count, off_t off);
+			virtual int writev(const util::IOVec *vec, unsigned int count);
+			virtual int pwritev(const util::IOVec *vec, unsigned int count, off_t off);
+
+			/* Copies up to 'size' bytes of this file, from 'off', to 'out' at its current
+			 * position, without going through user memory.  Returns how many bytes were
+			 * copied, which is short at the end of this file, or if 'out' is full. */
+			virtual int send_to(File& out, size_t size, off_t off);
+
+			/* Sets the size of the file, returning 0, or -1 if it can't be changed. */
+			virtual int truncate(off_t size) { return -1; }
+
+			/* Writes whatever has been written to the file, but is still held in memory,
+			 * to where the file is kept, returning 0, or -1 if it couldn't be. */
+			virtual int sync() { return 0; }
+
+			/* Returns false if the file can't say what its identity is. */
+			virtual bool identity(FileIdentity& id) const { return false; }
+
+			/* What the file is ready for now, as PollEvents.  Files whose transfers
+			 * never wait for anything other than the disk are always ready. */
+			virtual unsigned int poll() { return PollEvents::READABLE | PollEvents::WRITABLE; }
+			/* What the file's readiness comes from, which is passed to wake_pollers()
+			 * when it changes, or NULL if it never does. */
+			virtual const void *poll_source() const { return NULL; }
+			/* Makes reads return whatever is there already (maybe nothing), rather than
+			 * wait for all that was asked for.  Files that never wait ignore it. */
+			virtual void set_nonblocking(bool nonblocking) { }
+
+			/* Finds which of the files are ready for what is asked of them, setting
+			 * 'ready' for each, and returns how many are.  If 'wait' is set and none
+			 * are, sleeps until one is.  At most WakeQueue::MAX_SLEEP_KEYS files can
+			 * be polled at once. */
+			static unsigned int poll_any(File *const *files, const unsigned int *events, unsigned int *ready, unsigned int count, bool wait);
+			/* Wakes the threads polling files whose readiness comes from 'source'. */
+			static void wake_pollers(const void *source);
+
+			/* The socket this file is, or NULL if it isn't one. */
+			virtual net::Socket *as_socket() { return NULL; }
+
 			virtual void close() { }
 		};
 	}
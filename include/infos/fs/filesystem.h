@@ -27,6 +27,18 @@ namespace infos
 			virtual const util::String name() const = 0;
 			
 			virtual PFSNode *mount() = 0;
+
+			/* Whether files on the filesystem are read through the page cache. */
+			virtual bool uses_page_cache() const { return false; }
+			/* Whether writes to its files can be left dirty in the page cache, and written
+			 * back later through a file that the writeback thread opens on the node.  A
+			 * filesystem that can't write files says no, and its writes go straight
+			 * through, so that they fail there and then. */
+			virtual bool caches_writes() const { return false; }
+
+			/* Makes everything written to the filesystem durable, e.g. by flushing its
+			 * device's write cache. */
+			virtual bool sync() { return true; }
 		};
 		
 		extern kernel::ComponentLog fs_log;
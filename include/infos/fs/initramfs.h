@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/fs/filesystem.h>
+#include <infos/fs/directory.h>
+#include <infos/fs/file.h>
+#include <infos/fs/pfs-node.h>
+#include <infos/util/name-table.h>
+
+namespace infos
+{
+	namespace fs
+	{
+		/* The initramfs: a read-only filesystem whose files are in a cpio archive
+		 * ("newc" format, e.g. from find . | cpio -o -H newc), given to the kernel as a
+		 * multiboot module tagged "initramfs" on its command line.  The boot loader's
+		 * copy of the archive is used as it is, so files are read straight out of the
+		 * module's frames, without a device, a page cache or a copy of their data.
+		 * Only directories and regular files are taken from the archive. */
+		class InitRamFS : public Filesystem
+		{
+		public:
+			InitRamFS(const uint8_t *image, size_t size) : _image(image), _size(size) { }
+
+			PFSNode *mount() override;
+
+			const util::String name() const { return "initramfs"; }
+
+		private:
+			const uint8_t *_image;
+			size_t _size;
+		};
+
+		class InitRamFSNode : public PFSNode
+		{
+		public:
+			InitRamFSNode(InitRamFS& fs, const util::String& name, const uint8_t *data = NULL, size_t size = 0, bool directory = true);
+			~InitRamFSNode() override;
+
+			PFSNode* get_child(const util::String& name) override;
+			PFSNode* mkdir(const util::String& name) override { return NULL; }
+
+			File* open() override;
+			Directory* opendir() override;
+
+			const util::NameTable<InitRamFSNode *>& children() const { return _children; }
+
+			const util::String& name() const { return _name; }
+
+			bool is_directory() const { return _directory; }
+			const uint8_t *data() const { return _data; }
+			size_t size() const { return _size; }
+
+			/* Only while the archive is being unpacked, which is before the filesystem
+			 * is mounted, so the tree needs no lock. */
+			InitRamFSNode *add_child(const util::String& name, const uint8_t *data, size_t size, bool directory);
+
+		private:
+			const util::String _name;
+			const bool _directory;
+			util::NameTable<InitRamFSNode *> _children;
+
+			const uint8_t *_data;
+			size_t _size;
+		};
+
+		class InitRamFSDirectory : public SimpleDirectory
+		{
+		public:
+			InitRamFSDirectory(InitRamFSNode& node);
+		};
+
+		class InitRamFSFile : public File
+		{
+		public:
+			InitRamFSFile(InitRamFSNode& node) : _node(node), _pos(0) { }
+
+			int read(void *buffer, size_t size) override;
+			int pread(void *buffer, size_t size, off_t off) override;
+			void seek(off_t offset, SeekType type) override;
+
+			/* The files never change, so two opens of one are always the same. */
+			bool identity(FileIdentity& id) const override;
+
+		private:
+			InitRamFSNode& _node;
+			off_t _pos;
+		};
+
+		/* Gives the filesystem the archive, from the multiboot module it was in.  There
+		 * is only one initramfs, so only the first archive given is kept. */
+		extern bool initramfs_set_image(const void *image, size_t size);
+
+		/* Whether there is an archive to mount, in which case it is mounted on /usr,
+		 * unless a boot-device is given. */
+		extern bool initramfs_present();
+	}
+}
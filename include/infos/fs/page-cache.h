@@ -0,0 +1,194 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/fs/file.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		struct FrameDescriptor;
+	}
+
+	namespace fs
+	{
+		class PFSNode;
+
+		struct PageCacheStats
+		{
+			uint64_t nr_pages, max_pages;
+			uint64_t nr_hits, nr_misses, nr_evictions;
+			uint64_t nr_dirty, dirty_threshold;
+			uint64_t nr_written, nr_write_errors;
+		};
+
+		/* A page of file data that is pinned in the page cache, so that it can be used in
+		 * place rather than copied out (see PageCache::pin()). */
+		struct PinnedPage
+		{
+			const void *data;
+			size_t valid;			// The number of bytes of file data in the page.
+			void *page;
+		};
+
+		/* The cache of file data that every file on a block-based filesystem is read
+		 * through: whole pages of a file, keyed by the filesystem node and the page's
+		 * offset in it, held in page allocator frames.  When it is full, the page that
+		 * was used longest ago is evicted.  So, reading a file that was read recently
+		 * (e.g. running the same program again) is a copy rather than disk I/O.
+		 *
+		 * On filesystems that allow it, writes are copied into the cache too, and the
+		 * pages they dirty are written back later by the writeback thread: once they
+		 * have been dirty for a while, or sooner if too much of the cache is dirty.
+		 * Dirty pages aren't evicted until they have been written back. */
+		class PageCache
+		{
+		public:
+			PageCache();
+
+			/* Copies up to 'size' bytes of the node's data in at 'off', which must all be
+			 * in one page, reading the page in through 'file' if it isn't cached.
+			 * Returns how many bytes were copied, which is short at the end of the file,
+			 * or -1 if the page couldn't be read. */
+			int read(const PFSNode& node, File& file, void *buffer, size_t size, off_t off);
+
+			/* Pins the page of the node's data that starts at 'offset', which must be page
+			 * aligned, reading it in through 'file' if it isn't cached.  It isn't evicted
+			 * until it is unpinned, and stays readable, even if it is dropped from the
+			 * cache in the meantime.  Returns false if the page couldn't be read, or there
+			 * was no room to cache it. */
+			bool pin(const PFSNode& node, File& file, off_t offset, PinnedPage& pinned);
+			void unpin(PinnedPage& pinned);
+
+			/* Copies up to 'size' bytes into the node's data at 'off', which must all be
+			 * in one page, reading the rest of the page in through 'file' first if it
+			 * isn't cached, and leaves the page dirty.  If there is no room to cache it,
+			 * the data is written straight through 'file' instead.  Returns how many
+			 * bytes were written, or -1 if the page couldn't be read. */
+			int write(const PFSNode& node, File& file, const void *buffer, size_t size, off_t off);
+
+			/* Writes back every dirty page of the node's data, and waits for any that
+			 * are being written back already.  Returns false if any couldn't be. */
+			bool sync(const PFSNode& node);
+
+			/* Drops any cached pages of the node's data that overlap the range, e.g.
+			 * because it has been written to. */
+			void invalidate(const PFSNode& node, off_t off, size_t size);
+
+			/* Drops any cached pages of the node's data that aren't wholly before 'size',
+			 * because the file has been truncated to that size. */
+			void truncate(const PFSNode& node, off_t size);
+
+			/* Drops every page that isn't being read in, or dirty, e.g. so that a
+			 * benchmark can measure reads from the filesystem. */
+			void drop();
+
+			/* Evicts up to 'nr_pages' of the pages used longest ago, when memory is short,
+			 * and returns how many it evicted.  Gives up if the cache is busy. */
+			uint64_t shrink(uint64_t nr_pages);
+
+			void get_stats(PageCacheStats& stats);
+
+			/* Set by the pagecache.pages option: zero turns the cache off. */
+			static void max_pages(uint64_t max_pages);
+			/* Set by the pagecache.dirty-ratio option: the percentage of the cache that
+			 * can be dirty before the writeback thread stops waiting for pages to age. */
+			static void dirty_ratio(uint64_t percent);
+
+			/* Whether writes to the node's data go into the cache (see write()). */
+			bool caches_writes(const PFSNode& node) const;
+
+			/* Starts the writeback thread.  This must be called once the scheduler is
+			 * available: until then, nothing is left dirty. */
+			bool start_writeback();
+
+		private:
+			struct CachedPage
+			{
+				const PFSNode *node;
+				off_t offset;
+				mm::FrameDescriptor *frame;
+				size_t valid;			// The number of bytes the read of the page returned.
+				bool filling;			// The page is being read in, without the lock held.
+				bool dropped;			// The page has left the cache, but is still pinned.
+				bool dirty;				// The page has been written to since it was last written back.
+				bool writeback;			// The page is being written back, without the lock held.
+				uint64_t dirtied_at;	// When the page became dirty, in ns.
+				unsigned int pins;
+				CachedPage *hash_next;
+				CachedPage *lru_prev, *lru_next;
+			};
+
+			static const unsigned int NR_BUCKETS = 256;
+
+			CachedPage *_buckets[NR_BUCKETS];
+			CachedPage *_lru_head, *_lru_tail;
+			uint64_t _nr_pages;
+			uint64_t _nr_hits, _nr_misses, _nr_evictions;
+			uint64_t _nr_dirty, _nr_written, _nr_write_errors;
+			bool _writeback_running;
+
+			util::Mutex _mtx;
+			util::ConditionVariable _filled, _written;
+
+			/* A dirty page picked to be written back, with where it is on the disk. */
+			struct WritebackEntry
+			{
+				CachedPage *page;
+				size_t valid;
+				bool on_disk;			// Whether 'block' says where it is.
+				bool written;
+				uint64_t block;
+			};
+
+			static const unsigned int WRITEBACK_BATCH = 64;
+
+			static unsigned int bucket_of(const PFSNode& node, off_t offset);
+
+			CachedPage *find(const PFSNode& node, off_t offset) const;
+			CachedPage *get(const PFSNode& node, File& file, off_t offset, bool& failed, bool fill = true);
+			CachedPage *insert(const PFSNode& node, off_t offset);
+			void remove(CachedPage *page);
+			bool evict_one();
+			void release(CachedPage *page);
+
+			uint64_t dirty_threshold() const;
+			unsigned int writeback(const PFSNode *node, uint64_t dirtied_before, bool& failed);
+			static void writeback_threadproc();
+
+			void lru_unlink(CachedPage *page);
+			void lru_push(CachedPage *page);
+		};
+
+		extern PageCache page_cache;
+
+		/* An open file on a filesystem that uses the page cache: reads come out of the
+		 * cache.  Writes go into the cache if the filesystem allows it, otherwise they
+		 * go through to the filesystem's own file, dropping the cached pages they
+		 * overlap. */
+		class CachedFile : public File
+		{
+		public:
+			CachedFile(File *file, const PFSNode& node) : _file(file), _node(node), _pos(0) { }
+			~CachedFile() override { delete _file; }
+
+			int read(void *buffer, size_t size) override;
+			int pread(void *buffer, size_t size, off_t off) override;
+			int write(const void *buffer, size_t size) override;
+			int pwrite(const void *buffer, size_t size, off_t off) override;
+			void seek(off_t offset, SeekType type) override;
+			int truncate(off_t size) override;
+			int sync() override;
+			int send_to(File& out, size_t size, off_t off) override;
+			bool identity(FileIdentity& id) const override;
+
+			void close() override { _file->close(); }
+
+		private:
+			File *_file;
+			const PFSNode& _node;
+			off_t _pos;
+		};
+	}
+}
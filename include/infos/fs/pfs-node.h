@@ -14,15 +14,29 @@ namespace infos
 		class PFSNode : public FSNode<PFSNode>
 		{
 		public:
-			PFSNode(PFSNode *parent, Filesystem& owner) : FSNode(parent), _owner(owner) { }
+			PFSNode(PFSNode *parent, Filesystem& owner) : FSNode(parent), _owner(owner), _version(0) { }
 			
 			virtual File *open() = 0;
 			virtual Directory *opendir() = 0;
+
+			/* Creates an empty regular file, on filesystems that can. */
+			virtual PFSNode *create(const util::String& name) { return NULL; }
 			
 			Filesystem& owner() const { return _owner; }
+
+			/* Finds the disk block that the node's data at 'offset' is in, so that writes
+			 * can be put in disk order.  Returns false if it isn't on a disk, or isn't
+			 * there yet. */
+			virtual bool disk_block(off_t offset, uint64_t& block) { return false; }
+
+			/* Counts the changes to the node's data, made through the page cache (which
+			 * every change to a file on a filesystem that uses it is). */
+			uint64_t version() const { return __atomic_load_n(&_version, __ATOMIC_ACQUIRE); }
+			void changed() const { __atomic_add_fetch(&_version, 1, __ATOMIC_RELEASE); }
 			
 		private:
 			Filesystem& _owner;
+			mutable uint64_t _version;
 		};
 	}
 }
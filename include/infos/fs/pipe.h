@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/fs/file.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		struct FrameDescriptor;
+	}
+
+	namespace fs
+	{
+		class Pipe;
+
+		/* One end of a pipe.  An end is closed once every process it has been handed to
+		 * has closed it, or terminated: so a reader sees the end of the data once the
+		 * last writer has gone, and a writer fails once there is no reader left. */
+		class PipeEnd : public File
+		{
+			friend class Pipe;
+
+		public:
+			int read(void *buffer, size_t size) override;
+			int write(const void *buffer, size_t size) override;
+			int send_to(File& out, size_t size, off_t off) override;
+
+			unsigned int poll() override;
+			const void *poll_source() const override;
+			void set_nonblocking(bool nonblocking) override { _nonblocking = nonblocking; }
+
+			void close() override;
+
+			/* The end an object is, or NULL if it isn't one. */
+			static PipeEnd *from_object(void *object);
+
+			/* Another process holds the end. */
+			void hold();
+
+		private:
+			PipeEnd(Pipe& pipe, bool writer) : _pipe(pipe), _writer(writer), _nonblocking(false), _holders(1) { }
+
+			Pipe& _pipe;
+			bool _writer;
+			bool _nonblocking;
+			unsigned int _holders;		// Guarded by the pipe's lock.
+		};
+
+		/* A pipe: a ring of up to NR_SLOTS pages, each with a run of data in it.  Data is
+		 * appended to the last page while it has room, and otherwise to a fresh one.  A
+		 * write of a whole page, page-aligned, fills a page of its own in one copy, and a
+		 * read of a whole page frees it straight away.  Between two pipes (sendfile from
+		 * one to the other), the pages themselves are moved from one ring to the
+		 * other, rather than copied.
+		 *
+		 * Readers and writers sleep on the pipe's condition variables until there is
+		 * data, or room, or the other end has gone. */
+		class Pipe
+		{
+		public:
+			/* Makes a pipe, whose ends are returned. */
+			static bool create(PipeEnd *& reader, PipeEnd *& writer);
+
+		private:
+			friend class PipeEnd;
+
+			static const unsigned int NR_SLOTS = 16;
+
+			struct Slot {
+				mm::FrameDescriptor *page;
+				uint16_t offset, length;
+			};
+
+			PipeEnd _reader, _writer;
+
+			// Everything below is guarded by '_lock'.
+			Slot _slots[NR_SLOTS];
+			unsigned int _head, _count;
+			mm::FrameDescriptor *_spare;		// A free page, kept so that a busy pipe doesn't churn the allocator.
+			bool _reader_open, _writer_open;
+
+			util::Mutex _lock;
+			util::ConditionVariable _readable, _writable;
+
+			Pipe();
+
+			size_t available() const;
+			uint8_t *slot_data(const Slot& slot) const;
+			mm::FrameDescriptor *take_page();
+			void give_page(mm::FrameDescriptor *page);
+
+			int read(void *buffer, size_t size, bool nonblocking);
+			int write(const void *buffer, size_t size, bool nonblocking);
+			int splice(Pipe& out, size_t size, bool nonblocking);
+			unsigned int poll(bool writer);
+			void release(PipeEnd& end);
+			void changed();
+		};
+	}
+}
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/fs/file.h>
+#include <infos/util/string.h>
+
+namespace infos
+{
+	namespace fs
+	{
+		/* Where a statistics generator writes its text.  Nothing is kept: the text is
+		 * made afresh for each read, and only the part of it that the read asked for is
+		 * copied out, straight into the reader's buffer. */
+		class StatisticsWriter
+		{
+			friend class StatisticsFile;
+
+		public:
+			void append(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+			/* Has the read got all it asked for?  A generator can stop once it has. */
+			bool full() const { return _done == _size; }
+
+		private:
+			StatisticsWriter(void *buffer, size_t size, off_t off) : _buffer((char *)buffer), _size(size), _off(off), _pos(0), _done(0) { }
+
+			char *_buffer;
+			size_t _size;
+			off_t _off;		// Where in the text the read starts.
+			off_t _pos;		// How much text there has been so far.
+			size_t _done;	// How much of it has been copied out.
+		};
+
+		/* Some statistics, as they are registered with RegisterStatistics.  They appear
+		 * as /dev/stats/<name>, and the function makes their text when they are read. */
+		struct StatisticsRegistration
+		{
+			typedef void (*GeneratorFn)(StatisticsWriter& out);
+
+			const char *name;
+			GeneratorFn fn;
+
+			/* The registered statistics, and the ones with a name (or NULL). */
+			static const StatisticsRegistration *begin();
+			static const StatisticsRegistration *end();
+			static const StatisticsRegistration *find(const util::String& name);
+		};
+
+		/* An open statistics file.  It keeps nothing but its position: each read runs
+		 * the generator again, so the counters are as they are at the time of the read.
+		 * A read that takes the whole of the text at once sees it all at one time; reads
+		 * of pieces of it may see counters that have moved on in between. */
+		class StatisticsFile : public File
+		{
+		public:
+			StatisticsFile(const StatisticsRegistration& stats) : _stats(stats), _pos(0) { }
+
+			int read(void *buffer, size_t size) override;
+			int pread(void *buffer, size_t size, off_t off) override;
+			void seek(off_t offset, SeekType type) override;
+
+		private:
+			const StatisticsRegistration& _stats;
+			off_t _pos;
+		};
+	}
+}
+
+/* Registers statistics with the given name, whose text is made by the function body that
+ * follows, which writes to 'out', e.g.
+ *
+ *   RegisterStatistics(pgalloc, "pgalloc") { out.append("free-frames %lu\n", ...); }
+ *
+ * The alignment is given, so that the compiler doesn't raise it for a larger object,
+ * and leave gaps between the entries in the section. */
+#define RegisterStatistics(__name, __match) static void __stats##__name(infos::fs::StatisticsWriter&); \
+__section(".stats") __aligned(8) infos::fs::StatisticsRegistration __stats_reg##__name = { __match, __stats##__name }; \
+static void __stats##__name(infos::fs::StatisticsWriter& out)
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/fs/file.h>
+
+namespace infos
+{
+	namespace fs
+	{
+		/* A read-only file whose contents are a fixed-size block of text, which
+		 * is generated up-front (usually when the file is opened) by calling
+		 * append().  Text that doesn't fit is silently truncated. */
+		class TextFile : public File
+		{
+		public:
+			TextFile() : _size(0), _pos(0) { }
+
+			int read(void *buffer, size_t size) override;
+			int pread(void *buffer, size_t size, off_t off) override;
+			void seek(off_t offset, SeekType type) override;
+
+		protected:
+			void append(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+		private:
+			char _text[4096];
+			size_t _size;
+			off_t _pos;
+		};
+	}
+}
@@ -3,45 +3,116 @@
 
 #include <infos/fs/filesystem.h>
 #include <infos/fs/directory.h>
+#include <infos/fs/file.h>
 #include <infos/fs/pfs-node.h>
-#include <infos/util/map.h>
+#include <infos/util/name-table.h>
+#include <infos/util/lock.h>
 
 namespace infos
 {
+	namespace mm
+	{
+		struct FrameDescriptor;
+	}
+
 	namespace fs
 	{
 		class TempFS : public Filesystem
 		{
 		public:
 			PFSNode *mount() override;
-			
+
 			const util::String name() const { return "tmpfs"; }
 		};
-		
+
+		/* The data of a tmpfs file: a radix tree of page allocator frames, indexed by
+		 * page number, with 512 slots per level (like a page table).  Pages that have
+		 * never been written to (holes) have no frame, and read as zeroes. */
+		class TempFSPages
+		{
+		public:
+			TempFSPages() : _root(NULL), _height(0) { }
+			~TempFSPages() { truncate(0); }
+
+			/* Returns the frame holding the given page, or NULL if it is a hole. */
+			mm::FrameDescriptor *find(uint64_t index) const;
+
+			/* Returns the frame holding the given page, allocating a zeroed one if it is
+			 * a hole, or NULL if there is no memory. */
+			mm::FrameDescriptor *get(uint64_t index);
+
+			/* Frees the frames of every page from 'nr_pages' onwards. */
+			void truncate(uint64_t nr_pages);
+
+		private:
+			static const unsigned int SLOTS = 512;
+			static const unsigned int SLOT_BITS = 9;
+
+			void **_root;
+			unsigned int _height;
+
+			static void **alloc_node();
+			static void truncate_node(void **node, unsigned int height, uint64_t base, uint64_t keep);
+			static uint64_t span(unsigned int height) { return 1ull << (SLOT_BITS * height); }
+		};
+
 		class TempFSNode : public PFSNode
 		{
 		public:
-			TempFSNode(TempFS& fs, const util::String& name);
+			TempFSNode(TempFS& fs, const util::String& name, bool directory = true);
 
 			PFSNode* get_child(const util::String& name) override;
 			PFSNode* mkdir(const util::String& name) override;
-			
+			PFSNode* create(const util::String& name) override;
+
 			File* open() override;
 			Directory* opendir() override;
-			
-			const util::Map<util::String::hash_type, TempFSNode *>& children() const { return _children; }
-			
+
+			const util::NameTable<TempFSNode *>& children() const { return _children; }
+
 			const util::String& name() const { return _name; }
-			
+
+			bool is_directory() const { return _directory; }
+			uint64_t size() const { return _size; }
+
+			int read(void *buffer, size_t size, off_t off);
+			int write(const void *buffer, size_t size, off_t off);
+			int truncate(off_t size);
+
 		private:
 			const util::String _name;
-			util::Map<util::String::hash_type, TempFSNode *> _children;
+			const bool _directory;
+			util::NameTable<TempFSNode *> _children;
+
+			uint64_t _size;
+			TempFSPages _pages;
+			util::Mutex _mtx;
+
+			PFSNode *add_child(const util::String& name, bool directory);
 		};
-		
+
 		class TempFSDirectory : public SimpleDirectory
 		{
 		public:
 			TempFSDirectory(TempFSNode& node);
 		};
+
+		/* An open tmpfs file.  Every open of the file shares the node's data. */
+		class TempFSFile : public File
+		{
+		public:
+			TempFSFile(TempFSNode& node) : _node(node), _pos(0) { }
+
+			int read(void *buffer, size_t size) override;
+			int pread(void *buffer, size_t size, off_t off) override;
+			int write(const void *buffer, size_t size) override;
+			int pwrite(const void *buffer, size_t size, off_t off) override;
+			void seek(off_t offset, SeekType type) override;
+			int truncate(off_t size) override;
+
+		private:
+			TempFSNode& _node;
+			off_t _pos;
+		};
 	}
 }
@@ -3,6 +3,9 @@
 
 #include <infos/fs/block-based-filesystem.h>
 #include <infos/fs/pfs-node.h>
+#include <infos/fs/file.h>
+#include <infos/fs/directory.h>
+#include <infos/util/lock.h>
 
 namespace infos
 {
@@ -34,27 +37,222 @@ namespace infos
 
 		static_assert(sizeof(vfat_boot_block) == 512, "VFAT BOOT BLOCK not correct size");
 
+		/* The FAT32 part of the boot block, which follows the common part (at 0x24)
+		 * instead of the FAT12/16 extended boot record. */
+		struct vfat32_boot_block_ext {
+			uint32_t nr_blocks_in_fat;
+			uint16_t flags;
+			uint16_t version;
+			uint32_t root_cluster;
+			uint16_t fsinfo_block;
+			uint16_t backup_boot_block;
+		} __packed;
+
+		struct vfat_dir_entry {
+			char name[11];
+			uint8_t attributes;
+			uint8_t nt_flags;
+			uint8_t create_time_tenths;
+			uint16_t create_time;
+			uint16_t create_date;
+			uint16_t access_date;
+			uint16_t first_cluster_hi;
+			uint16_t write_time;
+			uint16_t write_date;
+			uint16_t first_cluster_lo;
+			uint32_t size;
+		} __packed;
+
+		static_assert(sizeof(vfat_dir_entry) == 32, "VFAT DIRECTORY ENTRY not correct size");
+
+		/* One piece of a long file name, stored in the entries before the short
+		 * name entry, last piece first. */
+		struct vfat_lfn_entry {
+			uint8_t order;
+			uint16_t name1[5];
+			uint8_t attributes;
+			uint8_t type;
+			uint8_t checksum;
+			uint16_t name2[6];
+			uint16_t first_cluster;
+			uint16_t name3[2];
+		} __packed;
+
+		static_assert(sizeof(vfat_lfn_entry) == 32, "VFAT LFN ENTRY not correct size");
+
+		/* A run of contiguous blocks that holds part of a file or directory. */
+		struct VFATExtent {
+			uint32_t block;
+			uint32_t nr_blocks;
+		};
+
+		/* Where a file or directory is on the disk: its cluster chain, resolved into
+		 * runs of contiguous blocks, in order. */
+		class VFATExtentMap {
+		public:
+			VFATExtentMap() : _extents(NULL), _count(0), _capacity(0) { }
+			~VFATExtentMap() { delete[] _extents; }
+
+			VFATExtentMap(const VFATExtentMap&) = delete;
+
+			bool append(uint32_t block, uint32_t nr_blocks);
+
+			unsigned int count() const { return _count; }
+			const VFATExtent& at(unsigned int index) const { return _extents[index]; }
+
+		private:
+			VFATExtent *_extents;
+			unsigned int _count, _capacity;
+		};
+
 		class VFAT : public BlockBasedFilesystem
 		{
 		public:
 			VFAT(drivers::block::BlockDevice& bdev);
+			~VFAT();
+
 			PFSNode *mount() override;
 			const util::String name() const { return "vfat"; }
-			
+
+			bool fat32() const { return _fat32; }
+			uint32_t block_size() const { return _boot_block.bytes_per_block; }
+			uint32_t root_cluster() const { return _root_cluster; }
+			uint32_t cluster_size() const { return _blocks_per_cluster * _boot_block.bytes_per_block; }
+
+			/* Resolves the cluster chain that starts at 'cluster' into extents.  An empty
+			 * file has no clusters, i.e. 'cluster' is zero. */
+			bool map_chain(uint32_t cluster, VFATExtentMap& map);
+
+			/* Maps the FAT12/16 root directory, which is a fixed area before the data. */
+			bool map_fixed_root(VFATExtentMap& map) const;
+
+			/* Reads from the data described by an extent map, at most up to 'limit'
+			 * bytes into it, returning the number of bytes read, or -1 on error. */
+			int read(const VFATExtentMap& map, uint64_t limit, void *buffer, size_t size, off_t off);
+
 		private:
 			struct vfat_boot_block _boot_block;
+
+			bool _fat32;
+			uint32_t _blocks_per_cluster;
+			uint32_t _fat_start, _fat_size;
+			uint32_t _root_start, _root_size;
+			uint32_t _data_start;
+			uint32_t _nr_clusters;
+			uint32_t _root_cluster;
+
+			/* The FAT is cached in memory: all of it if it is small, otherwise a number
+			 * of windows onto it, each of which holds whichever part of the FAT was used
+			 * last at that slot. */
+			struct FATWindow {
+				uint8_t *data;
+				uint32_t first_block;
+				bool valid;
+			};
+
+			FATWindow *_fat_windows;
+			unsigned int _nr_fat_windows;
+			uint32_t _fat_window_size;
+			util::Mutex _fat_mtx;
+
+			uint32_t cluster_to_block(uint32_t cluster) const { return _data_start + ((cluster - 2) * _blocks_per_cluster); }
+			bool next_cluster(uint32_t cluster, uint32_t& next);
 		};
 
 		class VFATNode : public PFSNode
 		{
 		public:
+			/* The root directory. */
 			VFATNode(VFAT& fs);
+			VFATNode(VFATNode *parent, VFAT& fs, const vfat_dir_entry& entry);
 
 			PFSNode* get_child(const util::String& name) override;
 			PFSNode* mkdir(const util::String& name) override;
 			
 			File* open() override;
 			Directory* opendir() override;
+
+			bool is_directory() const { return _directory; }
+			uint32_t size() const { return _size; }
+
+			/* Maps the directory or file's data. */
+			bool map(VFATExtentMap& map);
+
+			bool disk_block(off_t offset, uint64_t& block) override;
+
+		private:
+			bool _root, _directory;
+			uint32_t _first_cluster, _size;
+
+			VFAT& fs() const { return (VFAT &)owner(); }
+		};
+
+		/* Reads the entries of a directory in order, as they are asked for. */
+		class VFATDirectoryReader
+		{
+		public:
+			VFATDirectoryReader(VFAT& fs)
+				: _fs(fs), _block(NULL), _off(0), _index(0), _end(false), _lfn_next(0), _lfn_checksum(0), _lfn_complete(false) { }
+			~VFATDirectoryReader() { delete[] (uint8_t *)_block; }
+
+			bool open(VFATNode& node);
+
+			/* Returns the next entry and its name, or false at the end of the directory
+			 * (or if it couldn't be read). */
+			bool next(util::String& name, vfat_dir_entry& entry);
+
+		private:
+			VFAT& _fs;
+			VFATExtentMap _extents;
+
+			vfat_dir_entry *_block;		// The block of entries being read.
+			off_t _off;					// Where the next block is, in the directory.
+			unsigned int _index;		// The next entry in the block.
+			bool _end;
+
+			// The longest a long name can be: 20 pieces of 13 characters.
+			static const unsigned int MAX_LFN_LENGTH = 20 * 13;
+
+			// The long name being collected, and the piece of it that should come next.
+			char _lfn[MAX_LFN_LENGTH + 1];
+			unsigned int _lfn_next;
+			uint8_t _lfn_checksum;
+			bool _lfn_complete;
+		};
+
+		/* An open directory, which is read from the disk as entries are read from it. */
+		class VFATDirectory : public Directory
+		{
+		public:
+			VFATDirectory(VFAT& fs) : _reader(fs) { }
+
+			bool open(VFATNode& node) { return _reader.open(node); }
+
+			bool read_entry(DirectoryEntry& entry) override;
+			void close() override { }
+
+		private:
+			VFATDirectoryReader _reader;
+		};
+
+		/* An open file on a VFAT filesystem.  The cluster chain is resolved when the file
+		 * is opened, so a read is one transfer per contiguous extent that it covers. */
+		class VFATFile : public File
+		{
+		public:
+			VFATFile(VFAT& fs, uint32_t size) : _fs(fs), _size(size), _pos(0) { }
+
+			VFATExtentMap& extents() { return _extents; }
+
+			int read(void *buffer, size_t size) override;
+			int pread(void *buffer, size_t size, off_t off) override;
+			void seek(off_t offset, SeekType type) override;
+
+		private:
+			VFAT& _fs;
+			VFATExtentMap _extents;
+			uint32_t _size;
+			off_t _pos;
 		};
 	}
 }
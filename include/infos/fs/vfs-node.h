@@ -2,7 +2,7 @@
 #pragma once
 
 #include <infos/fs/fs-node.h>
-#include <infos/util/map.h>
+#include <infos/mm/slab.h>
 
 namespace infos
 {
@@ -19,18 +19,46 @@ namespace infos
 		class VFSNode : public FSNode<VFSNode>
 		{
 		public:
-			VFSNode(VFSNode *parent, PFSNode *pn = NULL) : FSNode(parent), _pn(pn) { }
+			VFSNode(VFSNode *parent, PFSNode *pn = NULL)
+				: FSNode(parent), _pn(pn), _parent_pn(NULL), _hash_next(NULL), _negative(false), _generation(0) { }
 
 			VFSNode* get_child(const util::String& name) override;
 			VFSNode* mkdir(const util::String& name) override;
+			VFSNode* create(const util::String& name);
 
 			PFSNode* pn() const { return _pn; }
 						
 			Filesystem *mount(const util::String& fstype, drivers::Device *dev);
+
+			/* Forgets every name that has been looked up and found missing, because
+			 * names may have been added, e.g. a device that shows up in devfs. */
+			static void invalidate_negative_entries();
 			
 		private:
-			PFSNode *_pn;
-			util::Map<util::String::hash_type, VFSNode *> _children;
+			PFSNode * volatile _pn;
+
+			/* Every name that has been looked up is in one global hash table (the dentry
+			 * cache), keyed by the parent, the filesystem node the parent had at the time
+			 * (so a mount on the parent makes its old children unreachable), and the
+			 * name, which is compared in full, so that names with the same hash don't alias
+			 * each other.  A name that wasn't there is cached too, as a negative entry, which
+			 * is only believed while the generation it was made in is current.
+			 *
+			 * Lookups walk the chains without taking a lock.  An entry is only added to
+			 * a chain once it is fully constructed, and entries are never freed (a mount
+			 * drops them, but something may still be using them), so nothing a lookup
+			 * can reach ever goes away.  Adding entries, turning a negative entry into
+			 * a real one, and mounting, take the VFS tree lock. */
+			PFSNode *_parent_pn;
+			util::String _name;
+			VFSNode *_hash_next;
+			volatile bool _negative;
+			uint32_t _generation;
+
+			VFSNode *find_child(const PFSNode *pn, const util::String& name) const;
+			VFSNode *add_child(PFSNode *pn, const util::String& name, PFSNode *assoc);
+
+			DECLARE_SLAB_ALLOCATED(VFSNode);
 		};
 	}
 }
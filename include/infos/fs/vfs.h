@@ -35,12 +35,17 @@ namespace infos
 			
 			VFSNode *lookup_node(const util::String& path);
 			FilesystemRegistration *lookup_fs(const util::String& fstype) const;
+
+			/* Registers a filesystem that isn't linked into the kernel, e.g. one from a
+			 * module, as RegisterFilesystem does for those that are. */
+			void register_filesystem(FilesystemRegistration& reg);
 			
 		private:
 			VFSNode *_root_node;
 			
 			util::List<FilesystemRegistration *> _filesystems;
-			Filesystem *instantiate_fs(const char *fstype, drivers::Device* dev = NULL);		
+			Filesystem *instantiate_fs(const char *fstype, drivers::Device* dev = NULL);
+			VFSNode *create(const util::String& path);		
 		};
 				
 		extern kernel::ComponentLog vfs_log;
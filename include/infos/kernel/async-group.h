@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/async-group.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/wakequeue.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		/* A set of functions that run alongside one another, each in a kernel thread of
+		 * its own, and are waited for together.  Device probing uses one, so that a
+		 * device that takes a while (e.g. a missing drive, which has to time out)
+		 * doesn't hold the others up.  Before there is a scheduler, each function is
+		 * just called. */
+		class AsyncGroup
+		{
+		public:
+			typedef void (*AsyncFn)(void *arg);
+
+			AsyncGroup(const char *name) : _name(name), _nr_running(0) { }
+			~AsyncGroup() { wait(); }
+
+			void run(AsyncFn fn, void *arg);
+
+			/* Waits for every function run so far to return. */
+			void wait();
+
+		private:
+			struct Item
+			{
+				AsyncGroup *group;
+				AsyncFn fn;
+				void *arg;
+			};
+
+			const char *_name;
+			unsigned int _nr_running;
+			util::WakeQueue _waiters;
+
+			static void threadproc(Item *item);
+		};
+	}
+}
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/kernel/benchmark.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		/* A microbenchmark, as it is registered with RegisterBenchmark.  The function
+		 * runs what is being measured 'iterations' times, and each run of it is timed
+		 * as one repetition. */
+		struct BenchmarkRegistration
+		{
+			typedef void (*BenchmarkFn)(unsigned int iterations);
+
+			const char *name;
+			unsigned int iterations;
+			BenchmarkFn fn;
+		};
+
+		/* Called by a benchmark around work that isn't part of what it measures, e.g.
+		 * setting up for, or tidying up after, what it is timing. */
+		extern void benchmark_pause();
+		extern void benchmark_resume();
+
+		/* Called by a benchmark that can't run, e.g. because something it needs isn't
+		 * there.  It should return straight away, and is reported with the reason,
+		 * instead of its timings. */
+		extern void benchmark_skip(const char *reason);
+
+		/* Runs the benchmarks whose names match the bench= option, if it was given,
+		 * and reports them on the QEMU debug port.  Powers the machine off afterwards
+		 * if bench.poweroff=1 was given too. */
+		extern void run_benchmarks();
+	}
+}
+
+/* Registers a benchmark called __match, e.g. "string.memcpy-64", whose body follows,
+ * and is given how many times to run the operation being measured:
+ *
+ *	RegisterBenchmark(Memcpy64, "string.memcpy-64", 1024)
+ *	{
+ *		for (unsigned int i = 0; i < iterations; i++) memcpy(a, b, 64);
+ *	}
+ *
+ * The results are in cycles per iteration, so __iterations only needs to be large
+ * enough that a repetition is long compared to reading the cycle counter.
+ *
+ * The alignment is given, so that the compiler doesn't raise it for a larger object,
+ * and leave gaps between the entries in the section. */
+#define RegisterBenchmark(__name, __match, __iterations) static void __bench##__name(unsigned int); \
+__section(".benchmarks") __aligned(8) infos::kernel::BenchmarkRegistration __bench_reg##__name = { __match, __iterations, __bench##__name }; \
+static void __bench##__name(unsigned int iterations)
@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/kernel/boot-phase.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		/* Starts timing a phase of the boot, e.g. "x86.mm", from the cycle counter.  A
+		 * phase that is started before another has ended is part of it, and is shown
+		 * under it in the report.  Only the boot path should start phases, as there is
+		 * one stack of them, and nothing more is recorded once the report is out.  The
+		 * name must be a string constant. */
+		extern void boot_phase_begin(const char *name);
+		/* The same, for a phase that began at an earlier reading of the cycle counter,
+		 * e.g. from before the phases could be recorded. */
+		extern void boot_phase_begin_at(const char *name, uint64_t tsc);
+		/* Ends the phase that was started last. */
+		extern void boot_phase_end();
+
+		/* Logs how long each phase took, in a tree, as cycles and (if the clock is
+		 * the TSC) microseconds, then the phases that took longest on their own. */
+		extern void boot_phase_report();
+
+		/* A phase that lasts until the end of the scope. */
+		class BootPhase
+		{
+		public:
+			BootPhase(const char *name) { boot_phase_begin(name); }
+			~BootPhase() { boot_phase_end(); }
+
+			BootPhase(const BootPhase&) = delete;
+		};
+	}
+}
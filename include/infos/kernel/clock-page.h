@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/clock-page.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/time.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		class FrameDescriptor;
+		class VMA;
+	}
+
+	namespace kernel
+	{
+		/* What the clock page holds, as user code sees it.  It is read under a seqlock:
+		 * read 'sequence', and wait while it is odd; read the rest; then start again if
+		 * 'sequence' has changed.
+		 *
+		 * The runtime, in ns (what get_ticks returns), is
+		 * ((counter - counter_base) * counter_mult) >> counter_shift, where the counter
+		 * is the TSC.  The time of day is as it was when the runtime was
+		 * 'tod_runtime', so the seconds since then are added on to it. */
+		struct UserClockPage
+		{
+			uint32_t sequence;
+			uint32_t counter_shift;
+			uint64_t counter_base;
+			uint64_t counter_mult;
+			uint64_t tod_runtime;
+			uint16_t tod_seconds, tod_minutes, tod_hours;
+			uint16_t tod_day, tod_month, tod_year;
+		};
+
+		/* A page that the kernel keeps the clock in, mapped read-only into every user
+		 * process, so that reading the time needs no system call. */
+		class ClockPage
+		{
+		public:
+			ClockPage() : _frame(NULL), _page(NULL) { }
+
+			bool init();
+
+			/* Maps the page into a process's address space, at USER_CLOCK_PAGE_VA. */
+			bool map_into(mm::VMA& vma);
+
+			/* Publishes the time of day.  Called with the TOD lock held. */
+			void update_tod(const util::TimeOfDay& tod, util::KernelRuntimeClock::Timepoint runtime);
+
+		private:
+			mm::FrameDescriptor *_frame;
+			volatile UserClockPage *_page;
+		};
+	}
+}
@@ -11,18 +11,55 @@
 #pragma once
 
 #include <infos/kernel/kernel.h>
+#include <infos/kernel/timer-wheel.h>
+#include <infos/kernel/softirq.h>
 #include <arch/arch.h>
 
 namespace infos
 {
 	namespace kernel
 	{
+		class RunQueue;
+
 		class CPU
 		{
 		public:
+			CPU() : _frame_cache(), _magazines(), _packet_buffers(), _runqueue(NULL), _numa_node(0) { }
+
 			static CPU& current() {
 				return sys.arch().get_current_cpu();
 			}
+
+			mm::FrameCache& frame_cache() { return _frame_cache; }
+			mm::MagazineCache& magazines(unsigned int size_class) { return _magazines[size_class]; }
+			mm::PacketBufferCache& packet_buffers() { return _packet_buffers; }
+
+			/* The CPU's runqueue, or NULL if it doesn't run the scheduler. */
+			RunQueue *runqueue() const { return _runqueue; }
+			void runqueue(RunQueue *rq) { _runqueue = rq; }
+
+			/* The NUMA node that the CPU is on (see numa.h). */
+			unsigned int numa_node() const { return _numa_node; }
+			void numa_node(unsigned int node) { _numa_node = node; }
+
+			TimerWheel& timers() { return _timers; }
+			SoftIRQState& softirqs() { return _softirqs; }
+
+#ifdef CONFIG_LOCK_STATS
+			util::IRQOffSection& irqoff_section() { return _irqoff_section; }
+#endif
+
+		private:
+			mm::FrameCache _frame_cache;
+			mm::MagazineCache _magazines[OBJALLOC_NR_SIZE_CLASSES];
+			mm::PacketBufferCache _packet_buffers;
+			RunQueue *_runqueue;
+			unsigned int _numa_node;
+			TimerWheel _timers;
+			SoftIRQState _softirqs;
+#ifdef CONFIG_LOCK_STATS
+			util::IRQOffSection _irqoff_section;
+#endif
 		};
 	}
 }
@@ -14,34 +14,76 @@
 #include <infos/kernel/irq.h>
 #include <infos/drivers/device.h>
 #include <infos/util/list.h>
-#include <infos/util/generator.h>
-#include <infos/util/map.h>
+#include <infos/util/hash-map.h>
+#include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
 
 namespace infos {
 	namespace kernel {
+		/* Sets of devices whose initialisation doesn't depend on the others', so that
+		 * each can be brought up while the others are.  They are bits, so that several
+		 * can be waited for at once. */
+		namespace DeviceInitGroup {
+			enum DeviceInitGroup {
+				STORAGE = 1 << 0,		// Disk controllers, and their drives
+				CONSOLE = 1 << 1,		// The display, keyboard and terminals
+				NETWORK = 1 << 2,
+				PSEUDO = 1 << 3,		// The statistics and trace devices in /dev
+				PROTOCOLS = 1 << 4,		// The network stack, on the network devices
+			};
+
+			static const unsigned int NR_GROUPS = 5;
+		}
+
 		class DeviceManager : public Subsystem {
 		public:
+			typedef bool (*DeviceInitFn)(void *arg);
+			typedef util::HashMap<util::String::hash_type, drivers::Device *> DeviceMap;
+			typedef util::List<drivers::Device *> DeviceList;
+
 			DeviceManager(Kernel& owner);
 
 			bool register_device(drivers::Device& device);
 			bool add_device_alias(const util::String& name, drivers::Device& device);
 
+			/* Runs part of the initialisation of a group of devices in a kernel thread
+			 * of its own, once the groups in 'after' have finished, and returns
+			 * straight away.  The function returns false if it failed.  Before there is
+			 * a scheduler, it is just called. */
+			void init_async(DeviceInitGroup::DeviceInitGroup group, DeviceInitFn fn, void *arg, unsigned int after = 0);
+			/* Registers a device in the background, as part of a group. */
+			void register_device_async(drivers::Device& device, DeviceInitGroup::DeviceInitGroup group);
+
+			/* Waits for everything started so far in the given groups to finish, and
+			 * returns false if any of it failed.  Only what needs a group waits for it,
+			 * e.g. mounting the boot device waits for STORAGE, so anything that is
+			 * never waited for carries on after init has been launched. */
+			bool wait_for_init(unsigned int groups);
+
+			/* Devices may be registered, and looked up, from several threads at once
+			 * while they are being probed (see AsyncGroup).  Gives the first device of
+			 * the class (or of a class derived from it) to have been registered. */
 			template<class T>
 			bool try_get_device_by_class(const drivers::DeviceClass& device_class, T*& __out_device) const
 			{
-				for (auto dev : _devices) {
-					if (dev.value->device_class().is(device_class)) {
-						__out_device = (T*)dev.value;
-						return true;
-					}
+				util::UniqueIRQLock irq;
+				util::UniqueLock<util::SpinLock> l(_lock);
+
+				DeviceList *devices;
+				if (!_by_class.try_get_value(&device_class, devices)) {
+					return false;
 				}
-				
-				return false;
+
+				__out_device = (T*)devices->first();
+				return true;
 			}
 			
 			template<class T>
 			bool try_get_device_by_name(const util::String& name, T*& __out_device) const
 			{
+				util::UniqueIRQLock irq;
+				util::UniqueLock<util::SpinLock> l(_lock);
+
 				drivers::Device *dev;
 				if (!_devices.try_get_value(name.get_hash(), dev)) {
 					return false;
@@ -51,10 +93,34 @@ namespace infos {
 				return true;
 			}
 			
-			const util::Map<util::String::hash_type, drivers::Device *>& devices() const { return _devices; }
-			
+			/* Only to be walked once probing has finished. */
+			const DeviceMap& devices() const { return _devices; }
+
+			/* The devices of a class, and of the classes derived from it, in the order
+			 * they were registered, e.g. for (auto dev : devices_of_class(BlockDevice::BlockDeviceClass)).
+			 * Aliases don't appear again.  Like devices(), only to be walked once probing
+			 * has finished. */
+			const DeviceList& devices_of_class(const drivers::DeviceClass& device_class) const;
+
 		private:
-			util::Map<util::String::hash_type, drivers::Device *> _devices;
+			DeviceMap _devices;
+
+			// Each registered device is on the list of its own class, and of each class
+			// it derives from, so that a lookup by class doesn't look at any other.
+			util::HashMap<const drivers::DeviceClass *, DeviceList *> _by_class;
+			mutable util::SpinLock _lock;
+
+			// How much of each group's initialisation is still running, and which
+			// groups have had any of it fail, under the lock of _init_done.
+			unsigned int _init_pending[DeviceInitGroup::NR_GROUPS];
+			unsigned int _init_failed;
+			util::WakeQueue _init_done;
+
+			bool index_device(drivers::Device& device);
+			void init_finished(DeviceInitGroup::DeviceInitGroup group, bool success);
+
+			static void init_threadproc(void *arg);
+			static bool register_device_fn(void *arg);
 		};
 	}
 }
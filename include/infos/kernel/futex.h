@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/futex.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class Process;
+
+		/* Futexes: user threads wait on, and wake each other through, a 32-bit word at
+		 * a user address.  The kernel keeps no state for a futex that nobody is waiting
+		 * on, so a user-space lock only enters the kernel when it is contended. */
+
+		/* Puts the current thread to sleep on the word at the address, if it still
+		 * holds the expected value.  Returns 0 once the thread has been woken (which
+		 * may be spuriously, so the caller must check the word again), 1 if the word
+		 * held something else, or -1 if the address is bad. */
+		int futex_wait(Process& process, uintptr_t address, uint32_t expected);
+
+		/* Wakes up to 'max' of the threads waiting on the word at the address, and
+		 * returns how many were woken. */
+		unsigned int futex_wake(Process& process, uintptr_t address, unsigned int max);
+
+		/* Forgets any of the process's threads that are still waiting, as it goes away. */
+		void futex_release(Process& process);
+	}
+}
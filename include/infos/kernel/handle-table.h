@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/handle-table.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/kernel/object.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		/* A process's table of open objects, indexed by handle.  The slots live in
+		 * fixed-size chunks that never move once allocated, so a lookup is a bounds
+		 * check and two loads, and needs no lock even while another thread of the
+		 * process is adding to the table.  Released slots go on a free list and are
+		 * handed out again, so handles stay small.
+		 *
+		 * Handle zero is never used, so that it can't be confused with a real object. */
+		class HandleTable
+		{
+		public:
+			static const unsigned int SLOTS_PER_CHUNK = 64;
+			static const unsigned int MAX_CHUNKS = 64;
+			static const unsigned int MAX_HANDLES = SLOTS_PER_CHUNK * MAX_CHUNKS;
+
+			HandleTable(const HandleTable&) = delete;
+			HandleTable(HandleTable&&) = delete;
+
+			HandleTable();
+			~HandleTable();
+
+			/* Returns a handle for the object, or KernelObject::Error if the table is full. */
+			ObjectHandle add(void *obj);
+			/* Returns the object a handle refers to, or NULL. */
+			void *get(ObjectHandle handle) const
+			{
+				if (handle == 0 || handle >= MAX_HANDLES) return NULL;
+
+				const Slot *chunk = _chunks[handle / SLOTS_PER_CHUNK];
+				if (!chunk) return NULL;
+
+				return chunk[handle % SLOTS_PER_CHUNK].object;
+			}
+			/* Frees a handle, returning false if it didn't refer to anything. */
+			bool remove(ObjectHandle handle);
+			/* Calls 'fn' for each object in the table, with the table locked. */
+			void for_each(void (*fn)(void *object, void *arg), void *arg);
+
+			unsigned int count() const { return _count; }
+			/* The memory that the table's chunks take up. */
+			size_t footprint() const { return (size_t)_nr_chunks * SLOTS_PER_CHUNK * sizeof(Slot); }
+
+		private:
+			struct Slot
+			{
+				void *object;
+				unsigned int next_free;
+			};
+
+			Slot *_chunks[MAX_CHUNKS];
+			unsigned int _nr_chunks;
+			unsigned int _free_head;
+			unsigned int _count;
+			util::Mutex _lock;
+
+			bool grow();
+		};
+	}
+}
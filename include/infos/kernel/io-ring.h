@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/io-ring.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		class FrameDescriptor;
+	}
+
+	namespace kernel
+	{
+		class Process;
+
+		/* The operations that can be submitted to an I/O ring.  They do what the system
+		 * calls of the same names do. */
+		namespace IORingOp
+		{
+			enum IORingOp
+			{
+				NOP = 0,
+				READ = 1,
+				WRITE = 2,
+				PREAD = 3,
+				PWRITE = 4
+			};
+		}
+
+		/* The layout of an I/O ring, as user code sees it: this header, at the start of
+		 * the ring's memory, then the submission queue entries, then the completion
+		 * queue entries, at the offsets given here.  Each queue's head is advanced by
+		 * its consumer, and its tail by its producer; entries are at index & mask. */
+		struct IORingHeader
+		{
+			uint32_t sq_head, sq_tail, sq_mask, sq_entries;
+			uint32_t cq_head, cq_tail, cq_mask, cq_entries;
+			uint32_t sq_offset, cq_offset;
+		} __packed;
+
+		struct IORingSubmission
+		{
+			uint8_t opcode;
+			uint8_t reserved[7];
+			uint64_t handle;
+			uint64_t buffer;
+			uint64_t size;
+			uint64_t offset;
+			uint64_t user_data;		// Handed back, untouched, in the completion
+		} __packed;
+
+		struct IORingCompletion
+		{
+			uint64_t user_data;
+			int64_t result;			// What the equivalent system call would have returned
+		} __packed;
+
+		/* A pair of queues, in memory shared with a user process, through which the
+		 * process can hand over many I/O operations with one system call, and collect
+		 * their results without any.  Operations are carried out, in order, by the
+		 * thread that enters the ring, as it has the process's address space to move
+		 * data to and from. */
+		class IORing
+		{
+		public:
+			static const unsigned int MAX_ENTRIES = 256;
+
+			/* Creates a ring with (at least) the given number of submission queue
+			 * entries, and twice as many completion queue entries, mapped into the
+			 * process's address space.  Returns NULL if it can't be. */
+			static IORing *create(Process& process, unsigned int entries);
+			~IORing();
+
+			virt_addr_t user_address() const { return _user_address; }
+
+			/* Carries out up to 'count' of the submitted operations, and returns how
+			 * many were.  Fewer are if fewer have been submitted, or there isn't room
+			 * for their completions. */
+			unsigned int enter(unsigned int count);
+
+		private:
+			IORing(Process& process) : _process(process), _frames(NULL) { }
+
+			int64_t perform(const IORingSubmission& sqe);
+
+			Process& _process;
+			mm::FrameDescriptor *_frames;
+			int _order;
+			virt_addr_t _user_address;
+
+			volatile IORingHeader *_header;
+			volatile IORingSubmission *_sq;
+			volatile IORingCompletion *_cq;
+			uint32_t _sq_entries, _cq_entries;
+
+			util::Mutex _lock;
+		};
+	}
+}
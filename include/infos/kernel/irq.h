@@ -7,30 +7,72 @@ namespace infos
 {
 	namespace kernel
 	{
+		namespace IRQFlags
+		{
+			enum IRQFlags
+			{
+				NONE = 0,
+				EOI = 1,			// The local APIC is told once the IRQ has been handled
+				MUST_HANDLE = 2,	// Having no handler is fatal (e.g. exceptions)
+				STEERABLE = 4,		// It can be sent to any CPU (see set_affinity())
+				NO_KERNEL_LOCK = 8	// Its handlers don't take the kernel lock (see KernelLock)
+			};
+		}
+
 		class IRQ
 		{
 		public:
 			typedef void (*irq_handler_t)(const IRQ *irq, void *priv);
-			
-			IRQ() : _nr(0), _handler(NULL), _priv(NULL) { }
-			
+
+			/* A bit for each CPU, by its index. */
+			typedef uint64_t AffinityMask;
+
+			/* A further handler on a line that several devices share.  Every handler on
+			 * the line is called for each interrupt, so each must check whether its own
+			 * device raised it. */
+			struct SharedHandler
+			{
+				irq_handler_t handler;
+				void *priv;
+				SharedHandler *next;
+			};
+
+			IRQ(uint32_t flags = IRQFlags::NONE) : _affinity(0), _nr(0), _flags(flags), _handler(NULL), _priv(NULL), _shared(NULL) { }
+
 			uint32_t nr() const { return _nr; }
 			void assign(uint32_t nr) { _nr = nr; }
-			
-			void attach(irq_handler_t handler, void *priv) { _handler = handler; _priv = priv; }
-			
-			virtual void handle() const = 0;
-			
+
+			uint32_t flags() const { return _flags; }
+
+			/* Adds a handler to the IRQ.  The first is the IRQ's own; any more are
+			 * chained after it, for a shared line. */
+			void attach(irq_handler_t handler, void *priv);
+
+			irq_handler_t handler() const { return _handler; }
+			void *priv() const { return _priv; }
+			const SharedHandler *shared() const { return _shared; }
+
 			virtual void enable()   = 0;
 			virtual void disable() = 0;
-			
+
+			/* Sends the IRQ to the CPUs in the mask that take interrupts: to the CPU, if
+			 * there is one, or else to whichever of them is doing the least important
+			 * work.  Returns false if the IRQ can't be steered, or none of the CPUs take
+			 * interrupts. */
+			virtual bool set_affinity(AffinityMask mask) { return false; }
+
+			/* The CPUs the IRQ was last steered to, or zero if it never has been. */
+			AffinityMask affinity() const { return _affinity; }
+
 		protected:
-			bool invoke() const;
-			
+			AffinityMask _affinity;
+
 		private:
 			uint32_t _nr;
+			uint32_t _flags;
 			irq_handler_t _handler;
 			void *_priv;
+			SharedHandler *_shared;
 		};
 	}
 }
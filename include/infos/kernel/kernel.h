@@ -15,10 +15,13 @@
 #include <infos/kernel/module.h>
 #include <infos/kernel/sched.h>
 #include <infos/kernel/syscall.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/clock-page.h>
 #include <infos/mm/mm.h>
 #include <infos/fs/vfs.h>
 #include <infos/util/time.h>
 #include <infos/util/cmdline.h>
+#include <infos/util/spinlock.h>
 
 namespace infos
 {
@@ -53,19 +56,34 @@ namespace infos
 			inline util::CommandLine& cmdline() { return _cmdline; }
 			inline SyscallManager& syscalls() { return _scm; }
 
-			void update_runtime(util::Nanoseconds ns);
+			/* Brings the time of day up to date with the runtime clock. */
+			void update_runtime();
 			void print_tod();
 
-			const util::KernelRuntimeClock::Timepoint runtime() const { asm volatile("" ::: "memory"); return _runtime; }
+			const util::KernelRuntimeClock::Timepoint runtime() const { return util::KernelRuntimeClock::now(); }
 
 			inline void spin_delay(util::Seconds s) { spin_delay(util::DurationCast<util::Nanoseconds>(s)); }
 			inline void spin_delay(util::Milliseconds s) { spin_delay(util::DurationCast<util::Nanoseconds>(s)); }
 			inline void spin_delay(util::Microseconds s) { spin_delay(util::DurationCast<util::Nanoseconds>(s)); }
 			void spin_delay(util::Nanoseconds ns);
 
+			/* Loads a program into a new process, ready to be started with Process::start(),
+			 * so that the process can be set up (e.g. given handles) before it runs. */
+			Process *load_process(const util::String& path, const util::String& cmdline);
 			Process *launch_process(const util::String& path, const util::String& cmdline);
 
-			const util::TimeOfDay& time_of_day() const { return _tod; }
+			/* Creates a kernel thread, ready to be started.  It belongs to the process
+			 * that all kernel threads share (see Scheduler::kernel_threads()), so it
+			 * costs just a thread object and a kernel stack. */
+			Thread& create_kernel_thread(Thread::thread_proc_t entry_point, const util::String& name,
+				SchedulingEntityPriority::SchedulingEntityPriority priority = SchedulingEntityPriority::NORMAL);
+
+			/* Returns a consistent copy of the time of day.  It is read under the TOD
+			 * seqlock, so it never waits for, or holds up, the timer interrupt. */
+			util::TimeOfDay time_of_day();
+
+			/* The clock, as user processes can read it without a system call. */
+			ClockPage& clock_page() { return _clock_page; }
 
 		private:
 			arch::Arch& _arch;
@@ -78,12 +96,11 @@ namespace infos
 			util::CommandLine _cmdline;
 			SyscallManager _scm;
 
-			util::KernelRuntimeClock::Timepoint _runtime;
+			// Protects the time of day, and the runtime at which it last ticked over.
+			util::SeqLock _tod_lock;
 			util::TimeOfDay _tod;
-
-			util::Nanoseconds _ticks_since_last_tod_update;
-
-			Process *_kernel_process;
+			util::KernelRuntimeClock::Timepoint _last_tod_update;
+			ClockPage _clock_page;
 
 			static void start_kernel_threadproc_tramp(Kernel *kernel, BottomFn bottom);
 			void start_kernel_threadproc();
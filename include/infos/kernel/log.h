@@ -34,37 +34,90 @@ namespace infos
 				IMPORTANT
 			};
 		}
+
+/* The least severe messages that are compiled in at all, e.g. 'make log-level=info' leaves
+ * out the debug ones.  Those below it are removed at compile time, arguments and all. */
+#ifndef CONFIG_LOG_MIN_LEVEL
+#define CONFIG_LOG_MIN_LEVEL	LogLevel::DEBUG
+#endif
+
+/* Logs a message only if the log would show it, without evaluating the arguments
+ * otherwise, for messages whose arguments cost something to work out. */
+#define LOG_MESSAGEF(__log, __level, ...) do { \
+		if ((__log).enabled(__level)) (__log).messagef(__level, __VA_ARGS__); \
+	} while (0)
 		
+		/* Somewhere messages go.  A log shows the messages at or above its level, and
+		 * those that its parent (if it has one) shows.  Fatal messages and notices are
+		 * always shown, while the log is enabled. */
 		class Log
 		{
 		public:
-			Log() : _enabled(true) { }
+			Log(Log *parent = NULL) : _enabled(true), _level(LogLevel::DEBUG), _parent(parent) { }
 			
 			virtual void message(LogLevel::LogLevel level, const char *message) = 0;
-			void messagef(LogLevel::LogLevel level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+			/* The level is checked before anything is formatted, and, for a level that
+			 * isn't compiled in, the whole call goes. */
+			__always_inline void messagef(LogLevel::LogLevel level, const char *format, ...) __attribute__((format(printf, 3, 4)))
+			{
+				if (!enabled(level)) return;
+				vmessagef(level, format, __builtin_va_arg_pack());
+			}
 			
 			void enable() { _enabled = true; }
 			void disable() { _enabled = false; }
 			bool enabled() const { return _enabled; }
+
+			void level(LogLevel::LogLevel level) { _level = level; }
+			LogLevel::LogLevel level() const { return _level; }
+
+			bool enabled(LogLevel::LogLevel level) const
+			{
+				if (level >= LogLevel::FATAL) return _enabled;
+				if (level < CONFIG_LOG_MIN_LEVEL) return false;
+
+				return _enabled && level >= _level && (!_parent || _parent->enabled(level));
+			}
 			
 		private:
 			bool _enabled;
+			LogLevel::LogLevel _level;
+			Log *_parent;
+
+			void vmessagef(LogLevel::LogLevel level, const char *format, ...) __attribute__((format(printf, 3, 4)));
 		};
 		
+		/* The kernel's log.  Until it is started, each message is written out as it is
+		 * logged.  After that, a message is put in a buffer of the logging CPU's own,
+		 * without waiting for anything, and a kernel thread writes the buffers out, so
+		 * that a slow stream (e.g. a polled serial port) doesn't hold up whatever is
+		 * logging.  Fatal messages are still written out straight away, after whatever
+		 * is buffered, as the kernel may not get any further. */
 		class SysLog : public Log
 		{
 		public:
-			SysLog() : _colour(false), _stream(NULL) { }
+			SysLog() : _colour(false), _stream(NULL), _started(false) { _mtx.set_name("syslog"); }
 			
 			void colour(bool colour) { _colour = colour; }
 			bool colour() const { return _colour; }
 			void set_stream(io::Stream& stream) { _stream = &stream; }
 			void message(LogLevel::LogLevel level, const char *message) override;
+
+			/* Starts buffering messages, and the threads that write them out. */
+			bool start();
+
+			/* Writes out whatever is buffered. */
+			void flush();
 			
 		private:
 			bool _colour;
 			io::Stream *_stream;
 			util::Mutex _mtx;
+			volatile bool _started;
+
+			void write_message(LogLevel::LogLevel level, const char *message, size_t length);
+			void drain();
 		};
 		
 		class ComponentLog : public Log
@@ -72,10 +125,17 @@ namespace infos
 		public:
 			ComponentLog(Log& parent, const char *component_name);
 			void message(LogLevel::LogLevel level, const char *message) override;
+
+			const char *name() const { return _component_name; }
+
+			/* Sets the levels of the components named in a list such as "mm:debug,pci:info",
+			 * which is what the log.levels option takes. */
+			static void set_levels(const char *levels);
 						
 		private:
 			Log& _parent;
 			const char *_component_name;
+			ComponentLog *_next;			// In the list of every component's log
 		};
 		
 		extern SysLog syslog;
@@ -2,26 +2,69 @@
 
 /*
  * include/kernel/module.h
- * 
+ *
  * InfOS
  * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
- * 
+ *
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #pragma once
 
 #include <infos/kernel/subsystem.h>
+#include <infos/kernel/log.h>
+#include <infos/util/list.h>
+#include <infos/util/string.h>
+#include <infos/util/lock.h>
 
 namespace infos
 {
 	namespace kernel
 	{
+		/* An entry in the kernel's symbol table (the .ksymtab section), which the build
+		 * generates from the linked kernel, sorted by name. */
+		struct KernelSymbol
+		{
+			uintptr_t address;
+			const char *name;
+		} __packed;
+
+		/* A kernel module: a relocatable ELF object, built with the kernel's flags, that
+		 * has been linked into the kernel while it is running.  Modules are never
+		 * unloaded. */
+		struct Module
+		{
+			util::String name;
+			uintptr_t base;		// where its sections were put, in the kernel's mapping
+			size_t size;
+		};
+
 		class ModuleManager : public Subsystem
 		{
 		public:
 			ModuleManager(Kernel& owner);
-			
-			bool LoadModule(void *module_addr, size_t length);
+
+			/* Links a module, given as its ELF image, into the kernel, and registers whatever
+			 * it has in the registration sections (.devctor, .fsreg, .schedalg, and so on).
+			 * The image isn't needed afterwards. */
+			bool LoadModule(void *module_addr, size_t length, const char *name = NULL);
+
+			/* Reads a module from a file, and loads it. */
+			bool LoadModuleFile(const util::String& path);
+
+			/* Loads the modules given on the command line, with modules=. */
+			bool LoadBootModules();
+
+			/* Looks a symbol up in the kernel's symbol table, by its (mangled) name,
+			 * returning zero if there is no such symbol. */
+			uintptr_t LookupSymbol(const char *name) const;
+
+			const util::List<Module *>& modules() const { return _modules; }
+
+		private:
+			util::Mutex _mtx;
+			util::List<Module *> _modules;
 		};
+
+		extern ComponentLog module_log;
 	}
 }
@@ -4,33 +4,24 @@
 
 #include <infos/kernel/subsystem.h>
 #include <infos/kernel/object.h>
-#include <infos/util/lock.h>
-#include <infos/util/map.h>
 
 namespace infos
 {
 	namespace kernel
 	{
 		class Thread;
-		
-		struct ObjectDescriptor
-		{
-			Thread *owner;
-			void *object;
-		};
-		
+
+		/* Hands out handles for the objects that user programs work with.  Handles are
+		 * per-process (see HandleTable), so a handle can only ever refer to an object
+		 * that was registered by a thread of the same process. */
 		class ObjectManager : public Subsystem
 		{
 		public:
 			ObjectManager(Kernel& owner);
-			
+
 			ObjectHandle register_object(Thread& owner, void *obj);
 			void *get_object_secure(Thread& owner, ObjectHandle handle);
-			
-		private:
-			util::Mutex _registry_lock;
-			uint64_t _next_handle;
-			util::Map<ObjectHandle, ObjectDescriptor> _objects;
+			bool release_object(Thread& owner, ObjectHandle handle);
 		};
 	}
 }
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/preempt.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		/* The scheduler only switches away from a thread on its own (e.g. on the timer
+		 * tick) when the thread's preemption count is zero.  The count is how many
+		 * spinlocks and IRQLocks the thread holds, plus any preempt_disable()s, so a
+		 * thread is never switched out from under a spinlock that the next thread
+		 * could spin on.  A thread can still give up the CPU itself at any point.
+		 *
+		 * The count is per-CPU, at %gs:32 (see arch/x86/percpu.h), but is saved in
+		 * each trap frame, so every context keeps its own.  A reschedule that comes
+		 * while it is non-zero is held over, and happens when the count drops back to
+		 * zero (see preempt_enable()). */
+		static inline unsigned int preempt_count()
+		{
+			uint32_t count;
+			asm volatile("movl %%gs:32, %0" : "=r"(count));
+			return count;
+		}
+
+		static inline void preempt_disable()
+		{
+			asm volatile("incl %%gs:32" ::: "memory");
+		}
+
+		static inline void preempt_enable_no_resched()
+		{
+			asm volatile("decl %%gs:32" ::: "memory");
+		}
+
+		/* Whether the scheduler wants to run on this CPU, once it can. */
+		static inline bool need_resched()
+		{
+			uint32_t need;
+			asm volatile("movl %%gs:36, %0" : "=r"(need));
+			return !!need;
+		}
+
+		static inline void set_need_resched(bool need)
+		{
+			asm volatile("movl %0, %%gs:36" :: "r"((uint32_t)need) : "memory");
+		}
+
+		/* Switches away from the current thread for a reschedule that was held
+		 * over, if it can be done here. */
+		extern void preempt_schedule();
+
+		static inline void preempt_enable()
+		{
+			preempt_enable_no_resched();
+
+			if (__builtin_expect(need_resched(), 0) && !preempt_count()) {
+				preempt_schedule();
+			}
+		}
+	}
+}
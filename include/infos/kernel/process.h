@@ -11,10 +11,12 @@
 #pragma once
 
 #include <infos/kernel/thread.h>
+#include <infos/kernel/handle-table.h>
 #include <infos/mm/vma.h>
 #include <infos/util/list.h>
 #include <infos/util/string.h>
 #include <infos/util/event.h>
+#include <infos/util/lock.h>
 #include <infos/fs/file.h>
 
 namespace infos
@@ -42,22 +44,48 @@ namespace infos
 
 			mm::VMA& vma() { return _vma; }
 			fs::File& file() { return *_file; }
+			HandleTable& handles() { return _handles; }
 			Thread& main_thread() const { return *_main_thread; }
 
 			Thread& create_thread(ThreadPrivilege::ThreadPrivilege privilege, Thread::thread_proc_t entry_point,
 			        const util::String& name, SchedulingEntityPriority::SchedulingEntityPriority priority = SchedulingEntityPriority::NORMAL);
 
-			util::Event& state_changed() { return _state_changed; }
+			/* Puts the current thread to sleep until one of the processes has terminated,
+			 * and returns its index. */
+			static unsigned int wait_any(Process *const *processes, unsigned int count);
+
+			/* Charges (or, given a negative size, uncharges) the process for kernel
+			 * memory that is kept on its behalf, e.g. its threads and I/O rings. */
+			void charge(int64_t bytes) { __atomic_add_fetch(&_kernel_bytes, bytes, __ATOMIC_RELAXED); }
+			/* Fills in how much memory the process is using: the frames of its VMA,
+			 * and the kernel memory charged to it. */
+			void memory_usage(mm::MemoryUsage& usage) const;
+
+			/* Calls 'fn' for every process there is, with the list of them locked, so
+			 * none can be destroyed meanwhile; 'fn' mustn't create or destroy one. */
+			static void for_each(void (*fn)(Process& process, void *arg), void *arg);
+			/* Like for_each, but gives up (returning false) if the list is locked. */
+			static bool try_for_each(void (*fn)(Process& process, void *arg), void *arg);
+
+			util::IntrusiveListNode<Process> _all_node;	// On the list of every process
 
 		private:
 			const util::String _name;
 			bool _kernel_process, _terminated;
 			mm::VMA _vma;
 			fs::File *_file; // the executable file
-			util::List<Thread *> _threads;
+			util::IntrusiveList<Thread, &Thread::_process_node> _threads;
+			/* The stacks of stopped threads, for new threads to reuse. */
+			util::List<ThreadStacks> _free_stacks;
+			util::Mutex _threads_lock;
+			HandleTable _handles;
 			Thread *_main_thread;
+			int64_t _kernel_bytes;
+
+
+			void recycle_stacks();
 
-			util::Event _state_changed;
+			DECLARE_SLAB_ALLOCATED(Process);
 		};
 	}
 }
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/kernel/profile.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		/* Non-zero while the profiler is sampling: how often each CPU is sampled, in
+		 * ns.  The CPUs' timers are never armed for any longer than this meanwhile,
+		 * even when they are idle. */
+		extern uint64_t profile_period;
+
+		void profile_record();
+
+		/* Called from the timer interrupt: records where the CPU was interrupted, and
+		 * how it got there, in a ring of the CPU's own. */
+		static inline void profile_sample()
+		{
+			if (__builtin_expect(profile_period != 0, 0)) {
+				profile_record();
+			}
+		}
+
+		/* Starts sampling, if the profile option asked for it.  Called once the
+		 * runqueues are known, as each has a ring. */
+		bool profile_init();
+
+		/* Starts sampling, throwing away what was recorded before, or stops it,
+		 * keeping what was recorded for /dev/profile0.  Returns false if there was no
+		 * memory for the rings. */
+		bool profile_enable(bool enable);
+	}
+}
@@ -5,12 +5,14 @@
 #include <infos/util/time.h>
 #include <infos/util/event.h>
 #include <infos/util/string.h>
+#include <infos/util/avl-tree.h>
 
 namespace infos
 {
 	namespace kernel
 	{
 		class Scheduler;
+		class RunQueue;
 		
 		namespace SchedulingEntityState
 		{
@@ -41,15 +43,75 @@ namespace infos
 			typedef util::Nanoseconds EntityRuntime;
 			typedef util::KernelRuntimeClock::Timepoint EntityStartTime;
 
+			/* The runqueues (i.e. CPUs) an entity may run on, one bit per runqueue index. */
+			typedef uint64_t AffinityMask;
+			static const AffinityMask ALL_CPUS = ~0ull;
+
+			/* Space for a scheduling algorithm to link the entity into its runqueue, so
+			 * that queueing an entity never needs to allocate.  What the fields mean is
+			 * up to the algorithm, though they are laid out for an AVLTree. */
+			struct RunqueueNode : util::AVLTreeNode<SchedulingEntity>
+			{
+				RunqueueNode() : key(0) { }
+
+				EntityRuntime key;
+			};
+
+			/* What an entity in the deadline class may have, in ns (see
+			 * Scheduler::set_deadline()): it runs for up to 'runtime' in each 'period',
+			 * by 'deadline' after the period starts.  An entity with no runtime is in
+			 * the fair class. */
+			struct DeadlineParams
+			{
+				uint64_t runtime, deadline, period;
+			};
+
+			/* The deadline class's bookkeeping for the entity's current period: its
+			 * absolute deadline, how much of its runtime it has left, and, if it has
+			 * used it up, when it can run again.  'charged' is the CPU runtime that has
+			 * already been taken off 'remaining'. */
+			struct DeadlineState
+			{
+				uint64_t abs_deadline, throttled_until, charged;
+				int64_t remaining;
+				bool throttled;
+			};
+
 			SchedulingEntity(SchedulingEntityPriority::SchedulingEntityPriority priority, const util::String& name)
-			: _cpu_runtime(0), _exec_start_time(0), _name(name), _state(SchedulingEntityState::STOPPED), _priority(priority) { }
+			: _cpu_runtime(0), _vruntime(0), _exec_start_time(0), _wakeup_time(0), _name(name), _state(SchedulingEntityState::STOPPED), _priority(priority), _runqueue_node(), _runqueue(NULL), _affinity(ALL_CPUS), _deadline_params(), _deadline_state() { }
 			virtual ~SchedulingEntity() { }
 			
 			virtual bool activate(SchedulingEntity *prev) = 0;
 			
+			/* The load weight of each priority.  An entity's virtual runtime advances at
+			 * NORMAL_WEIGHT / weight() times the rate of its real CPU runtime, so, when
+			 * they compete, each step up in priority gets about 9.3 times as much of
+			 * the CPU as the one below it (88761 / 9548 / 1024 / 110). */
+			static const unsigned int NORMAL_WEIGHT = 1024;
+
+			static unsigned int priority_weight(SchedulingEntityPriority::SchedulingEntityPriority priority)
+			{
+				switch (priority) {
+				case SchedulingEntityPriority::REALTIME: return 88761;
+				case SchedulingEntityPriority::INTERACTIVE: return 9548;
+				case SchedulingEntityPriority::DAEMON: return 110;
+				default: return NORMAL_WEIGHT;
+				}
+			}
+
 			EntityRuntime cpu_runtime() const { return _cpu_runtime; }
+			EntityRuntime vruntime() const { return _vruntime; }
+			unsigned int weight() const { return priority_weight(_priority); }
 			
-			void increment_cpu_runtime(EntityRuntime delta) { _cpu_runtime += delta; }
+			void increment_cpu_runtime(EntityRuntime delta)
+			{
+				_cpu_runtime += delta;
+				_vruntime += EntityRuntime(delta.count() * NORMAL_WEIGHT / weight());
+			}
+
+			/* Used by the scheduling algorithm to place an entity that is (re)joining the
+			 * runqueue relative to the entities already there. */
+			void set_vruntime(EntityRuntime vruntime) { _vruntime = vruntime; }
 			void update_exec_start_time(EntityStartTime exec_start_time) { _exec_start_time = exec_start_time; }
 
             const util::String& name() const { return _name; }
@@ -58,16 +120,39 @@ namespace infos
 
 			bool stopped() const { return _state == SchedulingEntityState::STOPPED; }
 			
+			/* Triggered when the entity stops, e.g. for a thread that is being joined. */
 			util::Event& state_changed() { return _state_changed; }
+
+			RunqueueNode& runqueue_node() { return _runqueue_node; }
+			const RunqueueNode& runqueue_node() const { return _runqueue_node; }
+
+			/* The runqueue the entity is on, or, if it isn't runnable, the one it was last
+			 * on, which is the CPU whose caches its data is most likely to be in. */
+			RunQueue *runqueue() const { return _runqueue; }
+
+			/* Changed with Scheduler::set_affinity(). */
+			AffinityMask affinity() const { return _affinity; }
+			bool allowed_on(unsigned int rq_index) const { return rq_index < 64 && ((_affinity >> rq_index) & 1); }
+
+			/* Changed with Scheduler::set_deadline(). */
+			const DeadlineParams& deadline_params() const { return _deadline_params; }
+			bool deadline_class() const { return _deadline_params.runtime != 0; }
+			DeadlineState& deadline_state() { return _deadline_state; }
 			
 		private:
-			EntityRuntime _cpu_runtime;
+			EntityRuntime _cpu_runtime, _vruntime;
 			EntityStartTime _exec_start_time;
+			EntityStartTime _wakeup_time;
 
             const util::String _name;
             SchedulingEntityState::SchedulingEntityState _state;
             SchedulingEntityPriority::SchedulingEntityPriority _priority;
             util::Event _state_changed;
+			RunqueueNode _runqueue_node;
+			RunQueue *_runqueue;
+			AffinityMask _affinity;
+			DeadlineParams _deadline_params;
+			DeadlineState _deadline_state;
 		};
 	}
 }
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/sched-trace.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class SchedulingEntity;
+
+		namespace SchedTraceEvent
+		{
+			enum SchedTraceEvent
+			{
+				WAKEUP,		// An entity was queued.  'value' is the runqueue it went on.
+				PICK,		// The algorithm picked the next entity.  'value' is how long it took, in ns.
+				SWITCH,		// A different entity started running.  'value' is its wakeup-to-run latency, in ns, or 0.
+			};
+		}
+
+		struct SchedTraceRecord
+		{
+			uint64_t timestamp;
+			const SchedulingEntity *entity;
+			uint32_t value;
+			uint16_t nr_queued;
+			uint8_t event;
+		};
+
+		/* The scheduler trace of one CPU: a ring of the most recent scheduling events,
+		 * and running totals since tracing started.  Each runqueue has one if the
+		 * sched.trace option is given, and only its own CPU records into it. */
+		class SchedulerTrace
+		{
+		public:
+			static const unsigned int RING_SIZE = 1024;
+			static const int NR_LATENCY_BUCKETS = 32;
+
+			/* Set by the sched.trace option. */
+			static bool enabled();
+
+			SchedulerTrace(uint64_t now);
+
+			void record(SchedTraceEvent::SchedTraceEvent event, const SchedulingEntity *entity, uint32_t value, unsigned int nr_queued, uint64_t now);
+			void account_pick(uint64_t duration, unsigned int nr_queued);
+			void account_switch(const SchedulingEntity& entity, bool switched, uint64_t wakeup_latency);
+
+			/* Copies out the records, oldest first, returning how many there were. */
+			unsigned int snapshot(SchedTraceRecord *records, unsigned int max);
+
+			uint64_t start_time() const { return _start_time; }
+			uint64_t nr_switches() const { return _nr_switches; }
+			uint64_t nr_picks() const { return _nr_picks; }
+			uint64_t total_pick_time() const { return _total_pick_time; }
+			uint64_t max_pick_time() const { return _max_pick_time; }
+			uint64_t total_nr_queued() const { return _total_nr_queued; }
+
+			static int latency_bucket(uint64_t ns);
+
+		private:
+			SchedTraceRecord _ring[RING_SIZE];
+			uint64_t _head;
+
+			uint64_t _start_time;
+			uint64_t _nr_switches, _nr_picks;
+			uint64_t _total_pick_time, _max_pick_time;
+			uint64_t _total_nr_queued;
+
+			util::SpinLock _lock;
+		};
+	}
+}
@@ -12,14 +12,21 @@
 
 #include <infos/kernel/subsystem.h>
 #include <infos/kernel/sched-entity.h>
+#include <infos/kernel/sched-trace.h>
 #include <infos/kernel/log.h>
 #include <infos/util/list.h>
+#include <infos/util/lock.h>
+
+// The most CPUs that can each have a runqueue.
+#define SCHED_MAX_RUNQUEUES	16
 
 namespace infos
 {
 	namespace kernel
 	{
 		class Scheduler;
+		class CPU;
+		class Process;
 		
 		class SchedulingAlgorithm
 		{
@@ -32,6 +39,115 @@ namespace infos
             virtual void init() = 0;
 			virtual void add_to_runqueue(SchedulingEntity& entity) = 0;
 			virtual void remove_from_runqueue(SchedulingEntity& entity) = 0;
+
+			/* Returns a new, empty instance of the algorithm, for another CPU's runqueue,
+			 * or NULL if the algorithm can only run on one CPU. */
+			virtual SchedulingAlgorithm *create_instance() const { return NULL; }
+
+			/* Returns the queued entity that would lose the least by being moved to the
+			 * runqueue with the given index (e.g. the one that would run last), out of
+			 * those allowed to run there, but leaves it queued.  Never returns the entity
+			 * that was picked last.  Returns NULL if there is nothing to move, or if the
+			 * algorithm doesn't support moving entities. */
+			virtual SchedulingEntity *migration_candidate(unsigned int rq_index) { return NULL; }
+
+			/* Returns true if pick_next_entity() would return an entity, i.e. if any of
+			 * the queued entities can run now.  Called without the runqueue's lock, so
+			 * the answer is only a hint. */
+			virtual bool has_runnable() const { return true; }
+
+			/* Returns when (in ns since boot) the algorithm next needs the scheduler to
+			 * run, whatever the timeslice, e.g. when the running entity's budget runs
+			 * out, or NO_EVENT. */
+			static const uint64_t NO_EVENT = ~0ull;
+			virtual uint64_t next_event(uint64_t now) const { return NO_EVENT; }
+		};
+
+		/* Makes a new, empty instance of the deadline class (see sched-deadline.cpp),
+		 * which every runqueue has, ahead of the other classes. */
+		extern SchedulingAlgorithm *create_deadline_class();
+
+		/* The scheduling classes, highest first.  Each entity is in one class: the
+		 * deadline class if it has been given a deadline, and otherwise the class for its
+		 * priority.  Each class is run by a scheduling algorithm: the fair class by the
+		 * one chosen with sched.algorithm, and the realtime and idle classes by those
+		 * chosen with sched.rt_algorithm and sched.idle_algorithm -- if they aren't
+		 * chosen, those entities are in the fair class. */
+		namespace SchedulingClass
+		{
+			enum SchedulingClass
+			{
+				DEADLINE,
+				REALTIME,
+				FAIR,
+				IDLE,
+				NR_CLASSES,
+			};
+		}
+
+		/* One CPU's part of the scheduler: an instance of each class's scheduling
+		 * algorithm, whose runqueues hold the entities that will run on that CPU, and the
+		 * entity running there now.  An entity only runs if no higher class has anything
+		 * to run.  Entities stay queued while they run.  The lock protects the runqueue
+		 * from the other CPUs, and is always taken with interrupts disabled. */
+		class RunQueue
+		{
+			friend class Scheduler;
+
+		public:
+			RunQueue(CPU& cpu, SchedulingAlgorithm *const classes[SchedulingClass::NR_CLASSES], SchedulingEntity& idle, unsigned int index);
+
+			CPU& cpu() const { return _cpu; }
+			unsigned int index() const { return _index; }
+			SchedulingAlgorithm& algorithm() const { return *_classes[SchedulingClass::FAIR]; }
+			SchedulingAlgorithm& class_algorithm(SchedulingClass::SchedulingClass cls) const { return *_classes[cls]; }
+			SchedulingEntity& idle_entity() const { return _idle; }
+			SchedulingEntity *current_entity() const { return _current; }
+			unsigned int nr_queued() const { return _nr_queued; }
+			bool idle() const { return !_current || _current == &_idle; }
+
+			/* Whether any queued entity can run now: a deadline entity that has used up
+			 * its runtime is queued, but can't run until its next period. */
+			bool runnable() const
+			{
+				if (!_nr_queued) return false;
+
+				for (unsigned int i = 0; i < _nr_chain; i++) {
+					if (_chain[i]->has_runnable()) return true;
+				}
+
+				return false;
+			}
+
+			/* The bandwidth admitted to the deadline class here, as the sum of its
+			 * entities' runtime / period, in units of 2^-20. */
+			uint64_t deadline_bandwidth() const { return _dl_bandwidth; }
+
+			/* How long, in ns, the hypervisor has kept the CPU from running while it
+			 * was running an entity, which isn't charged to the entity. */
+			uint64_t stolen_time() const { return _stolen; }
+
+			/* NULL unless the sched.trace option is given. */
+			SchedulerTrace *trace() const { return _trace; }
+
+		private:
+			CPU& _cpu;
+
+			// The algorithm for each class, and the distinct ones, in class order.
+			// Classes without an algorithm of their own share the fair class's.
+			SchedulingAlgorithm *_classes[SchedulingClass::NR_CLASSES];
+			SchedulingAlgorithm *_chain[SchedulingClass::NR_CLASSES];
+			unsigned int _nr_chain;
+
+			uint64_t _dl_bandwidth;
+			SchedulingEntity& _idle;
+			SchedulingEntity *_current;
+			unsigned int _index;
+			volatile unsigned int _nr_queued;
+			SchedulingEntity::EntityStartTime _last_balance;
+			uint64_t _last_steal, _stolen;
+			SchedulerTrace *_trace;
+			util::TicketLock _lock;
 		};
 		
 		class Scheduler : public Subsystem
@@ -40,27 +156,65 @@ namespace infos
 			Scheduler(Kernel& owner);
 			
 			bool init();
+			bool init_cpu(CPU& cpu, SchedulingEntity& idle);
 			
-			SchedulingAlgorithm& algorithm() const { return *_algorithm; }
-			void algorithm(SchedulingAlgorithm& algorithm) { _algorithm = &algorithm; }
+			SchedulingAlgorithm& algorithm() const { return this_runqueue().algorithm(); }
 			
 			__noreturn void run();
+
+			/* Makes the calling CPU, which has been started, and given a runqueue (see
+			 * init_cpu()), schedule entities too.  It carries on as its idle entity. */
+			__noreturn void run_secondary();
 			
 			void schedule();
 			
 			void set_entity_state(SchedulingEntity& entity, SchedulingEntityState::SchedulingEntityState state);
+			bool set_affinity(SchedulingEntity& entity, SchedulingEntity::AffinityMask mask);
+			bool set_deadline(SchedulingEntity& entity, uint64_t runtime, uint64_t deadline, uint64_t period);
+
+			SchedulingEntity& current_entity() const { return *this_runqueue().current_entity(); }
+			SchedulingEntity& idle_entity() const { return this_runqueue().idle_entity(); }
+
+			RunQueue& this_runqueue() const;
+			bool active() const { return _active; }
+			unsigned int nr_runqueues() const { return _nr_runqueues; }
+			RunQueue& runqueue(unsigned int index) const { return *_runqueues[index]; }
 
-			SchedulingEntity& current_entity() const { return *_current; }
+			/* The process that every kernel thread belongs to, sharing its VMA.  Its
+			 * main thread is the boot CPU's idle thread. */
+			Process& kernel_threads() const { return *_kernel_threads; }
 			
 			void update_accounting();
+
+			/* Makes an algorithm that isn't linked into the kernel, e.g. one from a module,
+			 * one that can be chosen.  Returns false if it is too late for that, because
+			 * the algorithm has already been chosen. */
+			bool register_algorithm(SchedulingAlgorithm& algorithm);
 			
 		private:
-			SchedulingAlgorithm *acquire_scheduler_algorithm();
+			SchedulingAlgorithm *acquire_scheduler_algorithm(const char *name);
+			SchedulingAlgorithm *acquire_class_algorithm(const char *name, const char *cls);
+
+			RunQueue& select_runqueue(SchedulingEntity& entity, SchedulingEntity::EntityStartTime now);
+			RunQueue& least_loaded_runqueue(const SchedulingEntity& entity);
+			static SchedulingClass::SchedulingClass entity_class(const SchedulingEntity& entity);
+			static SchedulingAlgorithm& class_of(RunQueue& rq, const SchedulingEntity& entity) { return *rq._classes[entity_class(entity)]; }
+			SchedulingEntity *pick_next_entity(RunQueue& rq);
+			void migrate(SchedulingEntity& entity, RunQueue& from, RunQueue& to);
+			bool balance(RunQueue& rq, SchedulingEntity::EntityStartTime now);
+			bool steal(RunQueue& to, RunQueue& from, SchedulingEntity::EntityStartTime now);
+			void trace_switch(SchedulerTrace& trace, RunQueue& rq, SchedulingEntity *prev);
 			
 			bool _active;
 			SchedulingAlgorithm *_algorithm;
-			SchedulingEntity *_current;
-			SchedulingEntity *_idle_entity;
+
+			// The boot CPU's instance of each class's algorithm, which every other CPU
+			// makes its own instances from.
+			SchedulingAlgorithm *_classes[SchedulingClass::NR_CLASSES];
+			RunQueue *_runqueues[SCHED_MAX_RUNQUEUES];
+			unsigned int _nr_runqueues;
+			Process *_kernel_threads;
+			util::List<SchedulingAlgorithm *> _registered_algorithms;
 		};
 		
 		extern ComponentLog sched_log;
@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/softirq.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/kernel/workqueue.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		/* The kinds of deferred interrupt work, in the order they are run. */
+		namespace SoftIRQVector
+		{
+			enum SoftIRQVector
+			{
+				TIMER = 0,		// Keeping the time of day, and expiring the CPU's timers
+				INPUT = 1,		// Passing on input from the keyboard
+				NR_VECTORS = 8
+			};
+		}
+
+		/* What each CPU keeps of its deferred interrupt work. */
+		struct SoftIRQState
+		{
+			SoftIRQState();
+
+			volatile uint32_t pending;		// A bit for each vector that has been raised
+			bool running;					// Whether the CPU is running them now
+			WorkItem overflow;				// Runs what is left over, under load
+		};
+
+		/* The bottom half of interrupt handling.  A handler acknowledges its device, and
+		 * raises a vector, and the vector's handler is run as the interrupt returns,
+		 * with interrupts enabled, so that other interrupts aren't held up by it.
+		 *
+		 * A softirq handler runs on the CPU that raised it, with the scheduler held off
+		 * until it returns, so it mustn't sleep, or take a lock that is held with
+		 * interrupts enabled.  If there is too much to do at once, what is left is
+		 * handed to a kernel thread, so that a flood of interrupts can't starve the
+		 * threads. */
+		class SoftIRQ
+		{
+			friend struct SoftIRQState;
+
+		public:
+			typedef void (*softirq_handler_t)();
+
+			static void register_handler(SoftIRQVector::SoftIRQVector vector, softirq_handler_t handler);
+
+			/* Marks a vector pending on the current CPU.  Safe to call from an
+			 * interrupt handler. */
+			static void raise(SoftIRQVector::SoftIRQVector vector);
+
+			/* Asks for the scheduler to run on the current CPU once the interrupt has
+			 * been dealt with, instead of from the interrupt handler itself, or,
+			 * if the interrupted thread can't be preempted, once it can be (see
+			 * preempt.h). */
+			static void request_resched();
+
+			/* Called by the architecture as each interrupt returns, with interrupts
+			 * disabled.  The pending vectors are run if the interrupted code had
+			 * interrupts enabled, and is still the code being returned to. */
+			static void irq_exit(bool can_run);
+
+			/* Starts the kernel threads that run the work left over. */
+			static bool start();
+
+		private:
+			static void run(SoftIRQState& state);
+			static void run_overflow(void *arg);
+		};
+	}
+}
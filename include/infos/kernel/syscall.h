@@ -5,8 +5,23 @@
 #include <infos/kernel/sched-entity.h>
 
 namespace infos {
+	namespace fs {
+		class File;
+	}
+
 	namespace kernel {
 
+		/* How often a system call has been made, and how long it took, in TSC cycles.
+		 * Latencies are bucketed by log2, so bucket N counts the calls that took
+		 * [2^N, 2^(N+1)) cycles, and the last bucket also counts anything longer. */
+		struct SyscallStats {
+			static const int NR_LATENCY_BUCKETS = 32;
+
+			uint64_t nr_calls;
+			uint64_t total_cycles;
+			uint64_t latency[NR_LATENCY_BUCKETS];
+		};
+
 		class SyscallManager {
 		public:
 			static const int MAX_SYSCALLS = 256;
@@ -15,11 +30,23 @@ namespace infos {
 
 			SyscallManager();
 
-			void RegisterSyscall(int nr, syscallfn fn);
+			void RegisterSyscall(int nr, syscallfn fn, const char *name = NULL);
 			unsigned long InvokeSyscall(int nr, unsigned long arg0, unsigned long arg1, unsigned long arg2, unsigned long arg3, unsigned long arg4, unsigned long arg5);
 
+			/* Statistics are only kept if the syscall.stats option is given. */
+			bool StatsEnabled() const { return stats_ != NULL; }
+			bool IsRegistered(int nr) const { return nr >= 0 && nr < MAX_SYSCALLS && syscall_table_[nr] != nullptr; }
+			const char *SyscallName(int nr) const { return IsRegistered(nr) ? syscall_names_[nr] : NULL; }
+			bool GetStats(int nr, SyscallStats& stats) const;
+
 		private:
-			syscallfn syscall_table_[MAX_SYSCALLS];
+			// The dispatch table is looked up on every system call, so it starts on its
+			// own cache line.  Everything else is kept out of the way.
+			syscallfn syscall_table_[MAX_SYSCALLS] __aligned(64);
+			const char *syscall_names_[MAX_SYSCALLS];
+			SyscallStats *stats_;
+
+			unsigned long InvokeSyscallWithStats(syscallfn fn, int nr, unsigned long arg0, unsigned long arg1, unsigned long arg2, unsigned long arg3, unsigned long arg4, unsigned long arg5);
 		};
 
 		class DefaultSyscalls {
@@ -34,15 +61,25 @@ namespace infos {
 			static unsigned int sys_write(ObjectHandle h, uintptr_t buffer, size_t size);
 			static unsigned int sys_pread(ObjectHandle h, uintptr_t buffer, size_t size, off_t off);
 			static unsigned int sys_pwrite(ObjectHandle h, uintptr_t buffer, size_t size, off_t off);
+			static unsigned int sys_sendfile(ObjectHandle out, ObjectHandle in, off_t off, size_t size);
+			static unsigned int sys_truncate(ObjectHandle h, off_t size);
+			static unsigned int sys_fsync(ObjectHandle h);
+			static unsigned int sys_readv(ObjectHandle h, uintptr_t vec, unsigned int count);
+			static unsigned int sys_writev(ObjectHandle h, uintptr_t vec, unsigned int count);
+			static unsigned int sys_preadv(ObjectHandle h, uintptr_t vec, unsigned int count, off_t off);
+			static unsigned int sys_pwritev(ObjectHandle h, uintptr_t vec, unsigned int count, off_t off);
 
 			static ObjectHandle sys_opendir(uintptr_t path, uint32_t flags);
 			static unsigned int sys_readdir(ObjectHandle h, uintptr_t buffer);
 			static unsigned int sys_closedir(ObjectHandle h);
+			static unsigned int sys_getdents(ObjectHandle h, uintptr_t buffer, size_t size);
 
 			static void sys_exit(unsigned int rc);
 
 			static ObjectHandle sys_exec(uintptr_t program, uintptr_t args);
+			static ObjectHandle sys_spawn(uintptr_t program, uintptr_t argv, size_t argv_size, uintptr_t handles, unsigned int nr_handles);
 			static unsigned int sys_wait_proc(ObjectHandle h);
+			static unsigned int sys_wait_procs(uintptr_t handles, unsigned int count);
 
 			static ObjectHandle sys_create_thread(uintptr_t entry_point, uintptr_t arg,
 			        SchedulingEntityPriority::SchedulingEntityPriority priority = SchedulingEntityPriority::NORMAL);
@@ -51,8 +88,44 @@ namespace infos {
 			static unsigned long sys_usleep(unsigned long us);
 			static unsigned int sys_get_tod(uintptr_t tpstruct);
 			static void sys_set_thread_name(ObjectHandle thr, uintptr_t name);
+			static unsigned int sys_set_affinity(ObjectHandle thr, uint64_t mask);
+			static unsigned int sys_set_deadline(ObjectHandle thr, uint64_t runtime, uint64_t deadline, uint64_t period);
+			static unsigned int sys_set_timer_slack(ObjectHandle thr, uint64_t slack);
 			static unsigned long sys_get_ticks();
 
+			static unsigned int sys_futex_wait(uintptr_t address, uint32_t expected);
+			static unsigned int sys_futex_wake(uintptr_t address, unsigned int max);
+
+			static uintptr_t sys_map_file(ObjectHandle h, off_t off, size_t size, uint32_t flags);
+			static unsigned int sys_unmap(uintptr_t addr, size_t size);
+
+			static ObjectHandle sys_io_ring_setup(unsigned int entries, uintptr_t address);
+			static unsigned int sys_io_ring_enter(ObjectHandle h, unsigned int count);
+
+			static unsigned int sys_poll(uintptr_t fds, unsigned int count, unsigned int wait);
+
+			static unsigned int sys_profile(unsigned int enable);
+			static unsigned int sys_thread_counters(ObjectHandle h, uintptr_t counts);
+			static unsigned int sys_load_module(uintptr_t path);
+			static unsigned int sys_memory_usage(ObjectHandle h, uintptr_t usage);
+
+			static ObjectHandle sys_socket(unsigned int type);
+			static unsigned int sys_bind(ObjectHandle h, uintptr_t address);
+			static unsigned int sys_connect(ObjectHandle h, uintptr_t address);
+			static unsigned int sys_listen(ObjectHandle h, unsigned int backlog);
+			static ObjectHandle sys_accept(ObjectHandle h);
+
+			static unsigned int sys_pipe(uintptr_t handles);
+
+			static ObjectHandle sys_shm_open(uintptr_t name, size_t size, uint32_t flags);
+			static uintptr_t sys_shm_map(ObjectHandle h, uint32_t flags);
+			static unsigned int sys_shm_unlink(uintptr_t name);
+
+			/* Move file data to and from user buffers, as read, write, pread and pwrite
+			 * do.  They are used by I/O rings too. */
+			static unsigned int read_to_user(fs::File& f, uintptr_t buffer, size_t size, bool positioned, off_t off);
+			static unsigned int write_from_user(fs::File& f, uintptr_t buffer, size_t size, bool positioned, off_t off);
+
 			static void RegisterDefaultSyscalls(SyscallManager& mgr);
 		};
 	}
@@ -0,0 +1,305 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/task.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/kernel/workqueue.h>
+#include <infos/kernel/timer-wheel.h>
+#include <infos/util/coroutine.h>
+#include <infos/util/wakequeue.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace block
+		{
+			class BlockDevice;
+			struct BlockRequest;
+		}
+	}
+
+	namespace kernel
+	{
+		/* Kernel tasks: coroutines that run on the task executor's worker threads (one
+		 * per CPU), and that, instead of sleeping, suspend at each co_await until what
+		 * they are waiting for has happened, leaving the worker free to run other tasks.
+		 * So a multi-step operation, e.g. a series of block requests, can be written as
+		 * one function, without tying up a thread for all of it:
+		 *
+		 *   Task<bool> read_two(BlockDevice& dev, BlockRequest& a, BlockRequest& b)
+		 *   {
+		 *       if (!co_await submit_and_wait(dev, a)) co_return false;
+		 *       co_await sleep_for(1000000);
+		 *       co_return co_await submit_and_wait(dev, b);
+		 *   }
+		 *
+		 * A task starts when it is awaited by another task, or when it is given to
+		 * spawn(), and a task that is awaited carries on from where its awaiter left
+		 * off, without going back through the executor.  A suspended task is resumed by
+		 * queueing it on the executor of the CPU that resumed it, e.g. the one whose
+		 * interrupt completed its block request.
+		 *
+		 * Task frames come from a set of slab caches, by size, so starting a task
+		 * doesn't go through the general-purpose allocator.  A task whose frame can't be
+		 * allocated never runs, and completes straight away with a default value.
+		 *
+		 * Tasks run with interrupts enabled, and may take locks, but must not hold a
+		 * spinlock across a co_await, or sleep for long: that would hold up the other
+		 * tasks on the same worker. */
+
+		class TaskPromiseBase
+		{
+		public:
+			TaskPromiseBase() : _resume_item(resume_fn, this) { }
+
+			/* Frames are allocated from the task frame caches. */
+			static void *operator new(size_t size) noexcept;
+			static void operator delete(void *frame, size_t size);
+
+			std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+
+			/* When a task finishes, its awaiter (if any) carries on from where it left
+			 * off.  A spawned task has nobody to tell, and frees itself. */
+			struct FinalAwaiter
+			{
+				bool await_ready() const noexcept { return false; }
+
+				template<typename TPromise>
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<TPromise> handle) noexcept
+				{
+					TaskPromiseBase& promise = handle.promise();
+					if (promise._continuation) return promise._continuation;
+
+					if (promise._detached) handle.destroy();
+					return std::noop_coroutine();
+				}
+
+				void await_resume() const noexcept { }
+			};
+
+			FinalAwaiter final_suspend() noexcept { return FinalAwaiter(); }
+			void unhandled_exception() { }
+
+			/* Queues the task to carry on, on this CPU's executor.  It is safe to call
+			 * from an interrupt handler, or a timer, and is what every awaitable does
+			 * once what the task is waiting for has happened. */
+			void schedule();
+
+		protected:
+			std::coroutine_handle<> _handle, _continuation;
+			bool _detached = false;
+
+			template<typename T> friend class Task;
+			friend bool spawn_task(TaskPromiseBase& promise);
+
+		private:
+			WorkItem _resume_item;
+
+			static void resume_fn(void *arg);
+		};
+
+		// What a task co_returns, kept in its promise until its awaiter takes it.
+		template<typename T>
+		class TaskResult
+		{
+		public:
+			void return_value(T value) { _value = value; }
+			T result() { return _value; }
+
+		private:
+			T _value = T();
+		};
+
+		template<>
+		class TaskResult<void>
+		{
+		public:
+			void return_void() { }
+			void result() { }
+		};
+
+		extern bool spawn_task(TaskPromiseBase& promise);
+
+		/* A task that produces a T when it finishes.  The Task object owns the task's
+		 * frame until the task is awaited or spawned. */
+		template<typename T = void>
+		class Task
+		{
+		public:
+			struct promise_type : TaskPromiseBase, TaskResult<T>
+			{
+				Task get_return_object()
+				{
+					_handle = std::coroutine_handle<promise_type>::from_promise(*this);
+					return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+				}
+
+				static Task get_return_object_on_allocation_failure() { return Task(); }
+			};
+
+			Task() { }
+			Task(Task&& other) : _handle(other._handle) { other._handle = std::coroutine_handle<promise_type>(); }
+			Task(const Task&) = delete;
+			Task& operator=(const Task&) = delete;
+
+			~Task() { if (_handle) _handle.destroy(); }
+
+			/* False if the task's frame couldn't be allocated. */
+			bool valid() const { return (bool)_handle; }
+
+			/* Awaiting a task starts it, and the awaiter carries on with its result once
+			 * it has finished. */
+			bool await_ready() const noexcept { return !_handle; }
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+			{
+				_handle.promise()._continuation = awaiter;
+				return _handle;
+			}
+
+			T await_resume() { return _handle ? _handle.promise().result() : T(); }
+
+			/* Starts the task on this CPU's executor, and lets it run to completion
+			 * by itself.  Returns false if it was never going to run. */
+			friend bool spawn(Task&& task)
+			{
+				if (!task._handle) return false;
+
+				TaskPromiseBase& promise = task._handle.promise();
+				task._handle = std::coroutine_handle<promise_type>();
+
+				return spawn_task(promise);
+			}
+
+		private:
+			std::coroutine_handle<promise_type> _handle;
+
+			explicit Task(std::coroutine_handle<promise_type> handle) : _handle(handle) { }
+		};
+
+		/* Starts the executor's worker threads.  Tasks spawned before then run once
+		 * they start. */
+		extern bool start_task_executor();
+
+		/* co_await sleep_until(deadline): carries on once the runtime reaches the
+		 * deadline (in ns), on a timer on the CPU the task was running on. */
+		class TaskSleep
+		{
+		public:
+			explicit TaskSleep(uint64_t deadline) : _deadline(deadline), _timer(expired, this), _promise(NULL) { }
+			TaskSleep(const TaskSleep&) = delete;
+
+			bool await_ready() const;
+
+			template<typename TPromise>
+			void await_suspend(std::coroutine_handle<TPromise> handle)
+			{
+				_promise = &handle.promise();
+				arm();
+			}
+
+			void await_resume() const { }
+
+		private:
+			uint64_t _deadline;
+			Timer _timer;
+			TaskPromiseBase *_promise;
+
+			void arm();
+			static void expired(Timer& timer, void *arg);
+		};
+
+		inline TaskSleep sleep_until(uint64_t deadline) { return TaskSleep(deadline); }
+		extern TaskSleep sleep_for(uint64_t ns);
+
+		/* co_await wait_until(wq, pred): carries on straight away if pred() is true,
+		 * and otherwise once the wake queue next wakes the task, in its turn with the
+		 * threads sleeping there.  pred() is checked again under the queue's lock
+		 * before the task is put on it, so a waker that makes it true under the lock
+		 * can't be missed.  As with a thread, being woken doesn't mean pred() is still
+		 * true, so it is usually awaited in a loop. */
+		template<typename TPred>
+		class TaskWait
+		{
+		public:
+			TaskWait(util::WakeQueue& wq, TPred pred) : _wq(wq), _pred(pred) { }
+			TaskWait(const TaskWait&) = delete;
+
+			bool await_ready() { return _pred(); }
+
+			template<typename TPromise>
+			bool await_suspend(std::coroutine_handle<TPromise> handle)
+			{
+				TaskPromiseBase *promise = &handle.promise();
+
+				util::UniqueIRQLock irq;
+				util::UniqueLock<util::SpinLock> l(_wq.lock());
+
+				if (_pred()) return false;
+
+				// Once the lock is released, the task may be resumed (and this awaiter
+				// gone) at any moment.
+				_wq.wait_callback_locked(_waiter, woken, promise);
+				return true;
+			}
+
+			void await_resume() const { }
+
+		private:
+			util::WakeQueue& _wq;
+			TPred _pred;
+			util::WakeQueue::CallbackWaiter _waiter;
+
+			static void woken(void *arg) { ((TaskPromiseBase *)arg)->schedule(); }
+		};
+
+		template<typename TPred>
+		TaskWait<TPred> wait_until(util::WakeQueue& wq, TPred pred) { return TaskWait<TPred>(wq, pred); }
+
+		/* co_await submit_and_wait(dev, request): submits a block request, and carries
+		 * on with whether it succeeded, once the device has completed it.  The request's
+		 * completion function and 'priv' are the awaitable's. */
+		class TaskBlockRequest
+		{
+		public:
+			TaskBlockRequest(drivers::block::BlockDevice& device, drivers::block::BlockRequest& request)
+				: _device(device), _request(request), _promise(NULL), _success(false) { }
+			TaskBlockRequest(const TaskBlockRequest&) = delete;
+
+			bool await_ready() const { return false; }
+
+			template<typename TPromise>
+			void await_suspend(std::coroutine_handle<TPromise> handle)
+			{
+				_promise = &handle.promise();
+				submit();
+			}
+
+			bool await_resume() const { return _success; }
+
+		private:
+			drivers::block::BlockDevice& _device;
+			drivers::block::BlockRequest& _request;
+			TaskPromiseBase *_promise;
+			bool _success;
+
+			void submit();
+			static void completed(drivers::block::BlockRequest& request, bool success);
+		};
+
+		inline TaskBlockRequest submit_and_wait(drivers::block::BlockDevice& device, drivers::block::BlockRequest& request)
+		{
+			return TaskBlockRequest(device, request);
+		}
+	}
+}
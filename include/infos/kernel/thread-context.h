@@ -13,6 +13,9 @@
 // HACK HACK HACK
 #include <arch/x86/context.h>
 
+// How many hardware event counts a thread has (see arch/x86/pmu.cpp).
+#define PMU_NR_EVENTS	4
+
 namespace infos
 {
 	namespace kernel
@@ -21,7 +24,8 @@ namespace infos
 		{
 			X86Context *native_context;		// 0
 			uintptr_t kernel_stack;			// 8
-			uintptr_t xsave_area;			// 16
+			uintptr_t xsave_area;			// 16: the saved FPU state, once the thread has used the FPU
+			uint64_t pmu_counts[PMU_NR_EVENTS];	// 24: the events counted while the thread was running
 		} __packed;
 	}
 }
@@ -13,8 +13,15 @@
 #include <infos/define.h>
 #include <infos/kernel/thread-context.h>
 #include <infos/kernel/sched-entity.h>
+#include <infos/kernel/timer-wheel.h>
 #include <infos/util/list.h>
+#include <infos/util/intrusive-list.h>
 #include <infos/util/string.h>
+#include <infos/mm/slab.h>
+
+// Every thread's kernel stack, which runs down from ThreadContext::kernel_stack.
+#define KERNEL_STACK_ORDER		1
+#define KERNEL_STACK_SIZE		((1 << KERNEL_STACK_ORDER) * __page_size)
 
 namespace infos
 {
@@ -22,6 +29,15 @@ namespace infos
 	{
 		class Process;
 
+		/* The stacks of a user thread that has stopped, which its process keeps to give
+		 * to the next thread it creates, rather than allocating new ones. */
+		struct ThreadStacks
+		{
+			uintptr_t kernel_stack;		// The base of the kernel stack
+			virt_addr_t user_stack;		// The base of the user stack, if it has one
+			size_t user_stack_size;
+		};
+
 		namespace ThreadPrivilege
 		{
 			enum ThreadPrivilege
@@ -33,11 +49,16 @@ namespace infos
 
 		class Thread : public SchedulingEntity
 		{
+			friend class Process;
+
 		public:
 			typedef void (*thread_proc_t)(void *);
 
+			/* A user thread can be given the stacks of one that has stopped, which it
+			 * takes over instead of allocating its own. */
 			Thread(Process& owner, ThreadPrivilege::ThreadPrivilege privilege, thread_proc_t entry_point,
-                   SchedulingEntityPriority::SchedulingEntityPriority priority, const util::String& name = "?");
+                   SchedulingEntityPriority::SchedulingEntityPriority priority, const util::String& name = "?",
+                   const ThreadStacks *stacks = NULL);
 			virtual ~Thread();
 
 			ThreadPrivilege::ThreadPrivilege privilege() const { return _privilege; }
@@ -48,7 +69,26 @@ namespace infos
 			void sleep();
 			void wake_up();
 
+			/* Puts the thread, which must be the current one, to sleep until the
+			 * runtime reaches the deadline (in ns), on its CPU's timer wheel.  It may
+			 * wake up to its timer slack later, to share the interrupt with others. */
+			void sleep_until(uint64_t deadline);
+
+			/* How late, in ns, the thread's sleeps may end (see TimerWheel::add()).
+			 * Threads start with the timer.slack option's, but realtime and deadline
+			 * threads always wake on time. */
+			uint64_t timer_slack() const { return _timer_slack; }
+			void timer_slack(uint64_t slack) { _timer_slack = slack; }
+
 			void allocate_user_stack(virt_addr_t vaddr, size_t size);
+			/* Allocates a user stack wherever there is room for it in the owner's VMA,
+			 * or uses the one the thread was given, if that is the same size. */
+			bool allocate_user_stack(size_t size);
+
+			/* Gives up the stacks of a stopped user thread, once it is certain that no
+			 * CPU is still running on its kernel stack.  Returns false if they can't
+			 * be given up (yet). */
+			bool release_stacks(ThreadStacks& stacks);
 			void add_entry_argument(void *arg);
 
 			ThreadContext& context() { return _context; }
@@ -64,14 +104,25 @@ namespace infos
 
 		private:
 			void prepare_initial_stack();
+			static void sleep_timer_expired(Timer& timer, void *arg);
 
 			Process& _owner;
 			ThreadPrivilege::ThreadPrivilege _privilege;
 			thread_proc_t _entry_point;
 			unsigned int _current_entry_argument;
 
+			ThreadStacks _stacks;
+			bool _stacks_released;
+			uint64_t _off_cpu_since;	// When the thread was first seen stopped and not running, or zero
+			uint64_t _timer_slack;
+
 			ThreadContext _context;
 			util::String _name;
+
+			Timer _sleep_timer;
+			util::IntrusiveListNode<Thread> _process_node;	// On the owner's list of threads
+
+			DECLARE_SLAB_ALLOCATED(Thread);
 		};
 	}
 }
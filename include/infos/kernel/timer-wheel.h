@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/timer-wheel.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/spinlock.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class TimerWheel;
+
+		/* Something to be done at a point in the kernel's runtime.  A timer isn't
+		 * allocated by the wheel, so it can live in whatever it is timing, e.g. a
+		 * thread. */
+		class Timer
+		{
+			friend class TimerWheel;
+
+		public:
+			/* Called, with the wheel's lock held and interrupts disabled, when the timer
+			 * expires.  It mustn't sleep, or add or cancel timers on the same wheel. */
+			typedef void (*timer_fn_t)(Timer& timer, void *arg);
+
+			Timer(timer_fn_t fn, void *arg) : _fn(fn), _arg(arg), _expires(0), _wheel(NULL), _level(0), _slot(0), _prev(NULL), _next(NULL) { }
+
+			bool pending() const { return _wheel != NULL; }
+			uint64_t expires() const { return _expires; }
+
+			/* Takes the timer off whichever wheel it is on.  Returns false if it wasn't
+			 * on one, i.e. it had already expired, or never been added. */
+			bool cancel();
+
+		private:
+			timer_fn_t _fn;
+			void *_arg;
+			uint64_t _expires;			// In ns of runtime
+
+			TimerWheel *volatile _wheel;
+			unsigned int _level, _slot;	// Where on the wheel it is
+			Timer *_prev, *_next;
+		};
+
+		/* A hierarchical timer wheel, of which each CPU has its own.  Each level is a ring
+		 * of slots, each a list of timers, and each slot of a level spans as long as the
+		 * whole of the level below it.  A timer goes in the lowest level that reaches its
+		 * expiry, and is moved down a level each time its slot comes round, so adding
+		 * and cancelling are O(1), and so is the work per timer to expire it, however
+		 * many timers there are.
+		 *
+		 * The wheel also decides when the CPU's one-shot timer next has to go off, so
+		 * that a CPU with nothing to run still wakes up for its next timer. */
+		class TimerWheel
+		{
+			friend class Timer;
+
+		public:
+			// Each tick of the lowest level is 2^16 ns (about 65 us).
+			static const unsigned int TICK_SHIFT = 16;
+			static const unsigned int LEVEL_BITS = 6;
+			static const unsigned int LEVEL_SIZE = 1 << LEVEL_BITS;
+			static const unsigned int NR_LEVELS = 4;
+
+			static const uint64_t NO_DEADLINE = ~0ull;
+
+			TimerWheel();
+
+			/* Adds a timer to the wheel, to expire once the runtime reaches 'expires'.
+			 * A timer that has already been added is moved.  Called with interrupts
+			 * disabled, on the wheel's own CPU.
+			 *
+			 * The timer may expire up to 'slack' ns late, which lets it share an
+			 * interrupt with the timers that expire near it: its expiry is moved to the
+			 * coarsest boundary in its window, where other timers whose windows overlap
+			 * it are likely to land too. */
+			void add(Timer& timer, uint64_t expires, uint64_t slack = 0);
+
+			/* Expires every timer whose time has come.  Called from the timer softirq,
+			 * after the CPU's timer interrupt. */
+			void run(uint64_t now);
+
+			/* Arms the CPU's one-shot timer for whichever is sooner: 'deadline', or the
+			 * next timer on the wheel.  If there is neither, the timer is stopped. */
+			void program(uint64_t now, uint64_t deadline);
+
+			util::SpinLock& lock() { return _lock; }
+
+			/* How many times the wheel has been run by the CPU's timer, and how many
+			 * timers it has expired: fewer runs per timer means more of them shared an
+			 * interrupt. */
+			uint64_t nr_runs() const { return _nr_runs; }
+			uint64_t nr_expired() const { return _nr_expired; }
+
+		private:
+			struct Level
+			{
+				Timer *slots[LEVEL_SIZE];
+				uint64_t occupied;		// A bit for each slot that has timers in it
+			};
+
+			Level _levels[NR_LEVELS];
+			uint64_t _now_tick;			// The next tick for which timers are expired
+			unsigned int _nr_timers;
+			uint64_t _armed;			// When the CPU's timer is next going off, or NO_DEADLINE
+			uint64_t _nr_runs, _nr_expired;
+
+			util::SpinLock _lock;
+
+			void insert(Timer& timer);
+			void remove(Timer& timer);
+			void cascade(unsigned int level, unsigned int slot);
+			uint64_t next_event_tick() const;
+			uint64_t next_expiry() const;
+		};
+	}
+}
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/trace.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace io
+	{
+		class Stream;
+	}
+
+	namespace kernel
+	{
+		/* The events the trace can record, and what their arguments are. */
+		namespace TraceEvent
+		{
+			enum TraceEvent
+			{
+				SCHED_SWITCH,		// The entity switched from, the one switched to, and the runqueue length
+				SYSCALL_ENTER,		// The system call number, and its first two arguments
+				SYSCALL_EXIT,		// The system call number, and what it returned
+				PAGE_FAULT,			// The faulting address, and the thread
+				IRQ,				// The vector, and the TSC cycles its handlers took
+				BLOCK_QUEUE,		// The request, its offset, and whether it is a write
+				BLOCK_COMPLETE,		// The request, its length in blocks, and whether it succeeded
+				NR_EVENTS
+			};
+		}
+
+		/* One event, as it is recorded, and as it is dumped. */
+		struct TraceRecord
+		{
+			uint64_t timestamp;		// In ns of runtime
+			uint16_t event;
+			uint16_t cpu;			// The runqueue index of the CPU it happened on
+			uint32_t reserved;
+			uint64_t args[3];
+		} __packed;
+
+		/* A dump is this header, then the records of each CPU in turn, oldest first. */
+		struct TraceDumpHeader
+		{
+			char magic[8];			// "INFOSTRC"
+			uint32_t version;
+			uint32_t record_size;
+			uint32_t nr_cpus;
+			uint32_t nr_records;
+			uint64_t nr_dropped;	// Events not recorded, as the trace was paused for a dump
+		} __packed;
+
+		/* A bit for each event that is being recorded, set by the trace option, e.g.
+		 * trace=sched,irq, or trace=all. */
+		extern uint32_t trace_event_mask;
+
+		void trace_record(TraceEvent::TraceEvent event, uint64_t arg0, uint64_t arg1, uint64_t arg2);
+
+		/* Records an event, in a ring of the current CPU's own, overwriting the oldest
+		 * event if it is full.  An event that isn't being recorded costs a test. */
+		static inline void trace_event(TraceEvent::TraceEvent event, uint64_t arg0 = 0, uint64_t arg1 = 0, uint64_t arg2 = 0)
+		{
+			if (__builtin_expect(trace_event_mask & (1u << event), 0)) {
+				trace_record(event, arg0, arg1, arg2);
+			}
+		}
+
+		/* Allocates the rings of the runqueues that don't have one yet.  Nothing is
+		 * recorded on a CPU before. */
+		bool trace_init();
+
+		/* Where writing to /dev/trace0 dumps the trace to, e.g. a debug port. */
+		void trace_set_dump_stream(io::Stream& stream);
+
+		/* Writes a dump of the trace to a stream.  Nothing is recorded meanwhile. */
+		bool trace_dump(io::Stream& stream);
+	}
+}
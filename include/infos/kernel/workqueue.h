@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/workqueue.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/kernel/sched.h>
+#include <infos/util/wakequeue.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class Thread;
+		class WorkQueue;
+
+		/* A piece of deferred work: a function to call, with its argument.  It is linked
+		 * into the queue through itself, so queueing it never allocates, and it must
+		 * stay put until it has run. */
+		class WorkItem
+		{
+			friend class WorkQueue;
+
+		public:
+			typedef void (*WorkFn)(void *arg);
+
+			WorkItem(WorkFn fn, void *arg) : _fn(fn), _arg(arg), _next(NULL), _pending(false) { }
+
+			/* Whether the item is queued, and hasn't started running yet. */
+			bool pending() const { return _pending; }
+
+		private:
+			WorkFn _fn;
+			void *_arg;
+			WorkItem *_next;
+			volatile bool _pending;
+		};
+
+		/* A set of kernel worker threads, one per runqueue, that run work items in
+		 * thread context, with interrupts enabled.  Interrupt handlers (and anything
+		 * else that mustn't sleep, or take long) queue the slow part of their work to
+		 * one instead of doing it themselves. */
+		class WorkQueue
+		{
+		public:
+			WorkQueue(const char *name, SchedulingEntityPriority::SchedulingEntityPriority priority);
+
+			/* Only takes effect if the workers haven't been started yet. */
+			void priority(SchedulingEntityPriority::SchedulingEntityPriority priority) { _priority = priority; }
+
+			/* Starts the workers.  Anything queued before then runs once they start. */
+			bool start();
+
+			/* Gives each workqueue that has been started a worker for each runqueue made
+			 * since, e.g. as the other CPUs came up. */
+			static void runqueues_added();
+
+			/* Queues the item on the current CPU's worker.  It is safe to call from an
+			 * interrupt handler.  An item runs once for each time it is queued while
+			 * it isn't already pending: returns false if it was. */
+			bool queue(WorkItem& item);
+
+		private:
+			struct Worker
+			{
+				Thread *thread;
+				WorkItem *head, *tail;
+				util::WakeQueue idle;
+			};
+
+			const char *_name;
+			SchedulingEntityPriority::SchedulingEntityPriority _priority;
+			Worker _workers[SCHED_MAX_RUNQUEUES];
+			volatile unsigned int _nr_workers;
+			bool _started;
+
+			// Every workqueue, for runqueues_added().
+			WorkQueue *_next_queue;
+			static WorkQueue *_queues;
+
+			void add_workers();
+			static void worker_threadproc(Worker *worker);
+		};
+
+		/* The workqueue that the rest of the kernel shares.  Its priority is set by the
+		 * workqueue.priority option. */
+		extern WorkQueue& system_workqueue();
+	}
+}
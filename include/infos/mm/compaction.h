@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/compaction.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		/* Physical memory fragments over time, until a high-order allocation (e.g. for
+		 * a huge page) can fail with plenty of frames free, because no 2^order of them
+		 * are together.  Compaction picks an aligned block of that size whose frames are
+		 * all either free, or behind a movable page of some process (see
+		 * VMA::migrate_pages()), moves those pages out to frames elsewhere, and frees
+		 * their frames straight to the allocation algorithm, so that they merge into a
+		 * free block.
+		 *
+		 * Compaction runs when a high-order allocation fails with enough memory free,
+		 * and in the background, from the reclaim thread, whenever there is no free
+		 * block of COMPACT_ORDER. */
+#define COMPACT_ORDER		9		// huge pages
+
+		/* Tries to free one block of 2^order frames by compaction, returning true if
+		 * it did.  It only tries to take its locks, so it can be called from inside
+		 * an allocation, if the caller can sleep. */
+		extern bool compact_memory(int order);
+
+		/* Compacts a block of COMPACT_ORDER if there isn't one free, and it is worth
+		 * trying: after compaction fails, it backs off for longer each time, until it
+		 * next succeeds. */
+		extern void compact_in_background();
+	}
+}
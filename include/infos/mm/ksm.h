@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/ksm.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		/* Same-page merging: processes that run the same program tend to have many pages
+		 * with the same data in them (zeroed memory that has been touched, tables built
+		 * the same way), each in a frame of its own.  The scanner goes round the private
+		 * pages of each process, a batch at a time, hashing the data in each, and maps
+		 * pages with the same data from a single frame, shared copy-on-write (see
+		 * VMA::merge_page()), so that whichever writes to its page first takes a private
+		 * copy of it again.
+		 *
+		 * The frames that pages have been merged into are kept by hash, and a page that
+		 * matches one merges into it straight away.  The table holds on to each frame
+		 * itself, so that the frame stays around while nothing maps it, for pages found
+		 * later, until the scanner next runs and frees it.  A page that matches no merged
+		 * frame is remembered, by hash, until the end of the scanner's run, and the first
+		 * page that matches it merges the two into a new frame.  Pages are always
+		 * compared in full before they are merged, so the hash only has to be good at
+		 * finding them.
+		 *
+		 * The scanner runs from the reclaim thread, if it is turned on with "ksm=1". */
+
+		/* Goes over the next batch of each process's pages, merging what it can. */
+		extern void merge_in_background();
+	}
+}
@@ -13,6 +13,7 @@
 #include <infos/kernel/subsystem.h>
 #include <infos/mm/page-allocator.h>
 #include <infos/mm/object-allocator.h>
+#include <infos/mm/packet-buffer.h>
 
 namespace infos
 {
@@ -56,6 +57,7 @@ namespace infos
 			
 			PageAllocator& pgalloc() { return _page_alloc; }
 			ObjectAllocator& objalloc() { return _obj_alloc; }
+			PacketBufferAllocator& pktalloc() { return _pkt_alloc; }
 			
 		private:
 			static constexpr unsigned int _page_size = 0x1000;
@@ -69,6 +71,7 @@ namespace infos
 			
 			PageAllocator _page_alloc;
 			ObjectAllocator _obj_alloc;
+			PacketBufferAllocator _pkt_alloc;
 			
 			bool test_page_allocator_order(int order);
 			bool test_page_allocator();
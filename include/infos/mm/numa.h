@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/numa.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		/* On a NUMA machine, physical memory and CPUs are grouped into nodes, and a CPU
+		 * reaches the memory of its own node faster than that of the others.  The
+		 * firmware describes the nodes (on x86, in the ACPI SRAT), and how far apart
+		 * they are (in the SLIT), in units where a node's distance to itself is
+		 * NUMA_LOCAL_DISTANCE.  Without a description, everything is on node 0.
+		 *
+		 * Page allocation algorithms that know about nodes keep the free frames of
+		 * each apart (see PageAllocatorAlgorithm::numa_aware()), and the page
+		 * allocator takes frames from the node of the CPU it is running on, falling
+		 * back to the other nodes, nearest first. */
+#define MAX_NUMA_NODES			8
+#define NUMA_LOCAL_DISTANCE		10
+#define NUMA_REMOTE_DISTANCE	20
+
+		/* Called while the firmware tables are parsed: 'node's are dense, from zero.
+		 * Ranges of memory that aren't given a node stay on node 0. */
+		extern bool numa_add_memory(unsigned int node, phys_addr_t base, uint64_t size);
+		extern void numa_set_distance(unsigned int from, unsigned int to, unsigned int distance);
+		extern void numa_add_node(unsigned int node);
+
+		/* Checks the description, and works out the order in which each node falls
+		 * back to the others.  Returns true if there is more than one node, and the
+		 * numa option doesn't turn them off. */
+		extern bool numa_init();
+
+		extern unsigned int numa_nr_nodes();
+		extern unsigned int numa_distance(unsigned int from, unsigned int to);
+		/* Every node, nearest to 'node' (so 'node' itself) first. */
+		extern const uint8_t *numa_fallback_order(unsigned int node);
+
+		/* Returns the node that the frame 'pfn' is on, and narrows 'run_end' to the
+		 * first frame after it that might be on a different one. */
+		extern unsigned int numa_node_of_pfn(pfn_t pfn, pfn_t& run_end);
+	}
+}
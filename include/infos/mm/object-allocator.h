@@ -23,11 +23,117 @@ namespace infos
 			enum AllocFlags
 			{
 				NONE = 0,
+				ZERO = 1,		// the object must be zero-filled
+				ATOMIC = 2,		// never wait for a lock, so that it is safe in IRQ context (may fail)
 			};
 		}
 
+		/* Each major subsystem has its own heap arena (a dlmalloc mspace), with its
+		 * own lock, so that subsystems don't contend for the heap, and a burst or
+		 * a leak in one can't fragment the others' memory.  Allocate from an arena
+		 * with e.g. 'new (HeapArena::VFS) Foo()'; delete needs no tag. */
+		namespace HeapArena
+		{
+			enum HeapArena
+			{
+				GENERAL = 0,
+				VFS = 1,
+				SCHED = 2,
+				DRIVERS = 3,
+				ELF = 4,
+				NET = 5,
+			};
+		}
+
+#define NR_HEAP_ARENAS		6
+
+// Allocations of up to 2^OBJALLOC_MAX_CLASS_BITS bytes are served by power-of-two
+// size classes, the smallest of which is 2^OBJALLOC_MIN_CLASS_BITS bytes.
+#define OBJALLOC_MIN_CLASS_BITS		4
+#define OBJALLOC_MAX_CLASS_BITS		9
+#define OBJALLOC_NR_SIZE_CLASSES	(OBJALLOC_MAX_CLASS_BITS - OBJALLOC_MIN_CLASS_BITS + 1)
+
+// The number of objects a magazine can hold.
+#define MAGAZINE_SIZE				30
+
 		class MemoryManager;
 		
+		/* A magazine is a small stack of free objects of a single size class. */
+		struct ObjectMagazine
+		{
+			ObjectMagazine *next;		// belongs to the depot, while the magazine is in it
+			unsigned int count;
+			void *objects[MAGAZINE_SIZE];
+		};
+		
+		/* The magazines that a CPU holds for a single size class.  Objects are
+		 * allocated from, and freed to, the loaded magazine; the previous
+		 * magazine gives a little hysteresis, so that alternating allocs and
+		 * frees at a magazine boundary don't go to the depot every time.
+		 * Either may be NULL. */
+		struct MagazineCache
+		{
+			ObjectMagazine *loaded;
+			ObjectMagazine *previous;
+			
+			// The objects of the size class that the CPU has handed out, less the
+			// ones freed on it, which may be negative: the sum over the CPUs is how
+			// many are in use.  Only the CPU updates it, with interrupts disabled.
+			int64_t nr_in_use;
+		};
+		
+		/* Counters for the magazine layer, per size class.  A hit is an
+		 * operation that was satisfied from a CPU's magazines. */
+		struct ObjectAllocatorStats
+		{
+			uint64_t alloc_hits[OBJALLOC_NR_SIZE_CLASSES];
+			uint64_t alloc_misses[OBJALLOC_NR_SIZE_CLASSES];
+			uint64_t free_hits[OBJALLOC_NR_SIZE_CLASSES];
+			uint64_t free_misses[OBJALLOC_NR_SIZE_CLASSES];
+			unsigned int nr_full_magazines[OBJALLOC_NR_SIZE_CLASSES];	// in the depot
+			unsigned int nr_empty_magazines[OBJALLOC_NR_SIZE_CLASSES];	// in the depot
+			uint64_t nr_in_use[OBJALLOC_NR_SIZE_CLASSES];				// objects handed out
+		};
+		
+		/* Accounting for a heap arena.  Bytes are counted as the usable size of each
+		 * chunk, so include rounding.  The general arena's small objects come from the
+		 * size classes instead, and are counted separately, as whole size classes. */
+		struct HeapArenaStats
+		{
+			const char *name;
+			uint64_t bytes_in_use;
+			uint64_t size_class_bytes;	// in the size classes, for the general arena
+			uint64_t peak_bytes_in_use;
+			uint64_t footprint;		// memory obtained from the page allocator
+			uint64_t nr_allocs;
+			uint64_t nr_frees;
+		};
+		
+// The profiler counts requests in power-of-two size buckets, and samples the
+// call site of one in every OBJALLOC_PROFILE_PERIOD allocations.
+#define OBJALLOC_PROFILE_SIZE_BUCKETS	32
+#define OBJALLOC_PROFILE_CALL_SITES		256
+#define OBJALLOC_PROFILE_PERIOD			64
+
+		/* The counters kept by the allocation profiler (objalloc.profile=1).
+		 * Bucket i counts requests of between 2^(i-1)+1 and 2^i bytes. */
+		struct ObjectAllocatorProfile
+		{
+			uint64_t nr_allocs[OBJALLOC_PROFILE_SIZE_BUCKETS];
+			uint64_t nr_bytes[OBJALLOC_PROFILE_SIZE_BUCKETS];
+			uint64_t nr_samples;
+			uint64_t nr_dropped_samples;	// samples lost because the call-site table was full
+		};
+		
+		/* A sampled allocation call site: the return address of the call into the
+		 * allocator (or into operator new). */
+		struct AllocCallSite
+		{
+			const void *caller;
+			uint64_t nr_samples;
+			uint64_t nr_bytes;
+		};
+		
 		class ObjectAllocator : Allocator
 		{
 			friend class MemoryManager;
@@ -37,13 +143,85 @@ namespace infos
 			
 			bool init() override;
 			
-			void *alloc(size_t size, AllocFlags::AllocFlags flags = AllocFlags::NONE);
+			/* Allocates an object.  ATOMIC allocations are satisfied from this CPU's
+			 * magazines, or from slabs that already exist, and fail rather than wait
+			 * for a lock or go to the page allocator: so they are limited to the
+			 * size classes of the general arena.  Frees may be made from IRQ
+			 * context, too.
+			 *
+			 * Small objects in the general arena come from the size classes; all
+			 * other allocations come from the arena's mspace. */
+			void *alloc(size_t size, AllocFlags::AllocFlags flags = AllocFlags::NONE, HeapArena::HeapArena arena = HeapArena::GENERAL,
+					const void *caller = NULL);
 			void free(void *ptr);
 			
+			void get_stats(ObjectAllocatorStats& stats);
+
+			/* Empties the depot's full magazines back into the slab caches, when memory
+			 * is short, so that slabs left with nothing in use can be freed, and returns
+			 * how many frames that freed.  Gives up if the depot is busy. */
+			uint64_t shrink_depot(uint64_t nr_frames);
+			void get_arena_stats(HeapArena::HeapArena arena, HeapArenaStats& stats);
+			
+			bool profiling() const;
+			void get_profile(ObjectAllocatorProfile& profile);
+			
+			/* Fills in up to 'max' of the most frequently sampled call sites, most
+			 * frequent first, and returns the number filled in. */
+			unsigned int get_call_sites(AllocCallSite *sites, unsigned int max);
+			void dump_state();
+			
 		private:
+			struct Arena
+			{
+				void *mspace;
+				util::Mutex mtx;
+				
+				uint64_t bytes_in_use, peak_bytes_in_use;
+				uint64_t nr_allocs, nr_frees;
+			};
+			
+			Arena _arenas[NR_HEAP_ARENAS];
+			
 			util::Mutex _mtx;
+			
+			// The depot holds the magazines that are not loaded on any CPU,
+			// and is protected by _mtx.
+			ObjectMagazine *_depot_full[OBJALLOC_NR_SIZE_CLASSES];
+			ObjectMagazine *_depot_empty[OBJALLOC_NR_SIZE_CLASSES];
+			unsigned int _nr_depot_full[OBJALLOC_NR_SIZE_CLASSES];
+			unsigned int _nr_depot_empty[OBJALLOC_NR_SIZE_CLASSES];
+			
+			// Updated with interrupts disabled.
+			uint64_t _alloc_hits[OBJALLOC_NR_SIZE_CLASSES];
+			uint64_t _alloc_misses[OBJALLOC_NR_SIZE_CLASSES];
+			uint64_t _free_hits[OBJALLOC_NR_SIZE_CLASSES];
+			uint64_t _free_misses[OBJALLOC_NR_SIZE_CLASSES];
+			
+			// Objects freed from IRQ context, that couldn't go straight into a magazine,
+			// are threaded through their first word onto this list, and really freed
+			// by the next allocation or free that is allowed to take locks.
+			void * volatile _deferred_frees;
+			
+			void profile_alloc(size_t size, const void *caller);
+			void count_size_classes(uint64_t *nr_in_use);
+			
+			void *arena_alloc(HeapArena::HeapArena arena, size_t size, bool zero);
+			void arena_free(void *ptr);
+			
+			void *alloc_small(unsigned int size_class, bool atomic);
+			bool free_small(unsigned int size_class, void *ptr, bool atomic);
+			void free_now(void *ptr);
+			void defer_free(void *ptr);
+			void drain_deferred_frees();
+			
+			ObjectMagazine *depot_get(unsigned int size_class, bool full);
+			void depot_put(unsigned int size_class, ObjectMagazine *magazine);
 		};
 		
 		extern infos::kernel::ComponentLog objalloc_log;
 	}
 }
+
+void *operator new(size_t size, infos::mm::HeapArena::HeapArena arena);
+void *operator new[](size_t size, infos::mm::HeapArena::HeapArena arena);
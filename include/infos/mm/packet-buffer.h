@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/packet-buffer.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/spinlock.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		class MemoryManager;
+		struct FrameDescriptor;
+
+		/* A buffer for (part of) a network packet: a frame of its own, which a device can
+		 * reach directly, and which could be mapped to user space without exposing
+		 * anything else, with a descriptor kept apart from it.  The data is a window on
+		 * the frame, which starts with room for headers to be pushed on the front.
+		 *
+		 * A packet that doesn't fit in one buffer is a chain of them, through 'next'.
+		 * Buffers are reference counted, and go back to the allocator when the last
+		 * reference is released. */
+		struct PacketBuffer
+		{
+			// What a buffer can hold, and how much of that is kept in front of the data
+			// of a new one.
+			static const size_t SIZE = 0x1000;
+			static const size_t HEADROOM = 128;
+
+			PacketBuffer *next;				// The next part of the packet.
+			PacketBuffer *next_packet;		// For whoever is queueing whole packets.
+
+			uint8_t *base;
+			phys_addr_t base_pa;
+			uint32_t refcount;
+			uint16_t offset;				// Where the data starts.
+			uint16_t length;
+
+			// What the first buffer of a packet asks of a device that offloads it (see
+			// NetworkDevice::offloads()).  The checksum to be filled in covers the
+			// packet from 'csum_start', which is from 'base', so it stays put as
+			// headers are pushed, or is zero if there is none; it goes 'csum_offset'
+			// bytes on from there.  If 'gso_size' isn't zero, the packet is one TCP
+			// segment that the device cuts into segments of that much data.
+			uint16_t csum_start;
+			uint16_t csum_offset;
+			uint16_t gso_size;
+
+			uint8_t *data() const { return base + offset; }
+			phys_addr_t data_pa() const { return base_pa + offset; }
+
+			size_t headroom() const { return offset; }
+			size_t tailroom() const { return SIZE - offset - length; }
+
+			/* Makes room for a header in front of the data, and returns where it goes. */
+			uint8_t *push(size_t size) { offset -= size; length += size; return data(); }
+
+			/* Takes a header off the front of the data, and returns where it was. */
+			uint8_t *pull(size_t size) { uint8_t *p = data(); offset += size; length -= size; return p; }
+
+			/* Extends the data at the end, and returns where the extension goes. */
+			uint8_t *put(size_t size) { uint8_t *p = data() + length; length += size; return p; }
+
+			/* The length of the packet, over every buffer of the chain. */
+			size_t packet_length() const;
+
+			/* Copies up to 'size' bytes of the packet, from 'offset' into it, over
+			 * every buffer of the chain, and returns how many there were. */
+			size_t copy_out(size_t offset, void *buffer, size_t size) const;
+
+			/* Takes another reference to the buffer (but not the rest of the chain). */
+			void get() { __atomic_add_fetch(&refcount, 1, __ATOMIC_RELAXED); }
+		};
+
+		/* A CPU's own free buffers, which it takes from and frees to without a lock. */
+		struct PacketBufferCache
+		{
+			PacketBuffer *head;
+			unsigned int count;
+		};
+
+		struct PacketBufferStats
+		{
+			uint64_t nr_buffers;		// Every buffer there is.
+			uint64_t nr_free;			// ...that is in the shared pool.
+			uint64_t nr_cached;			// ...or in this CPU's cache.
+			uint64_t nr_allocs, nr_frees;
+			uint64_t nr_atomic_failures;
+		};
+
+		/* Hands out packet buffers.  Buffers are only ever made (with a frame each) when
+		 * an allocation that isn't atomic finds none free, or a driver reserves them,
+		 * and are kept afterwards: so atomic allocations, e.g. from an interrupt handler
+		 * refilling a receive ring, are satisfied by what drivers have reserved. */
+		class PacketBufferAllocator
+		{
+		public:
+			PacketBufferAllocator(MemoryManager& mm);
+
+			/* Returns an empty buffer, with a reference, and HEADROOM in front of its
+			 * data.  If 'atomic' is set, this only takes buffers that are already free,
+			 * and is safe in an interrupt handler. */
+			PacketBuffer *allocate(bool atomic = false);
+
+			/* Returns a chain of empty buffers that together hold 'size' bytes. */
+			PacketBuffer *allocate_chain(size_t size, bool atomic = false);
+
+			/* Releases a reference to every buffer of the chain.  Safe in an interrupt
+			 * handler. */
+			void release(PacketBuffer *chain);
+
+			/* Makes sure at least 'count' buffers are free to be allocated atomically,
+			 * making more as necessary. */
+			bool reserve(unsigned int count);
+
+			void get_stats(PacketBufferStats& stats) const;
+
+		private:
+			MemoryManager& _mm;
+
+			PacketBuffer *_free;
+			unsigned int _nr_free;
+			uint64_t _nr_buffers;
+			uint64_t _nr_allocs, _nr_frees, _nr_atomic_failures;
+			mutable util::SpinLock _lock;
+
+			bool grow(unsigned int count);
+			void free_one(PacketBuffer *buffer);
+		};
+	}
+}
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <infos/mm/allocator.h>
+#include <infos/mm/numa.h>
 #include <infos/kernel/log.h>
 #include <infos/util/lock.h>
 
@@ -26,20 +27,96 @@ namespace infos
 				RESERVED = 1,
 				AVAILABLE = 2,
 				ALLOCATED = 3,
+				CACHED = 4,		// allocated from the algorithm, but idle in a FrameCache
+			};
+		}
+
+		namespace PageAllocFlags
+		{
+			enum PageAllocFlags
+			{
+				NONE = 0,
+				ZERO = 1,		// the frames must be zero-filled
 			};
 		}
 
 		/* There is a FrameDescriptor for each frame of physical memory
 		 * that might be available to the page allocator. (In practice
 		 * we create one for every single frame of physical memory...
-		 * see setup_pf_descriptors() in page-allocator.cpp.) */
+		 * see setup_pf_descriptors() in page-allocator.cpp.)
+		 *
+		 * The 'next', 'prev', 'order' and 'free_head' fields belong to the
+		 * page allocation algorithm, which can use them to thread intrusive
+		 * free lists through the descriptor array without allocating.  While
+		 * a frame is CACHED, 'next' and 'prev' belong to its FrameCache. */
 		struct FrameDescriptor
 		{
-			FrameDescriptor *next; // XXX: currently unused! but could be used for a free list
-			FrameDescriptor *prev; // XXX: currently unused! but could be used for a free list
+			FrameDescriptor *next;
+			FrameDescriptor *prev;
 			FrameDescriptorType::FrameDescriptorType type;
+			uint8_t order;		// order of the free block headed by this frame (valid iff free_head)
+			bool free_head;		// true iff this frame is the first frame of a free block
+			bool slab;			// true iff this (allocated) frame is a slab, owned by a SlabCache
+			uint8_t node;		// the NUMA node that the frame is on (see numa.h)
+			uint32_t refcount;	// the number of VMAs sharing this frame copy-on-write, or zero if it isn't shared
 		} __aligned(16);
 
+		/* A per-CPU cache of free order-0 frames, which sits in front of the
+		 * page allocation algorithm, so that most single-frame allocations
+		 * and frees need neither the page allocator lock nor the algorithm.
+		 * Recently freed (cache-hot) frames are pushed onto the head, and
+		 * are handed out first; frames are drained back to the algorithm
+		 * in batches from the (cold) tail. */
+		struct FrameCache
+		{
+			FrameDescriptor *head;
+			FrameDescriptor *tail;
+			unsigned int count;
+		};
+
+		/* A snapshot of the state of a page allocator algorithm, so that it is
+		 * possible to tell whether memory is actually exhausted, or just
+		 * fragmented.  Frames held by a FrameCache or the pre-zeroed pool are
+		 * allocated as far as the algorithm is concerned, so PageAllocator
+		 * reports them separately. */
+		struct PageAllocatorStats
+		{
+			static const int NR_ORDERS = 32;
+
+			uint64_t nr_free_frames;
+			uint64_t nr_free_blocks[NR_ORDERS];		// free blocks of each order
+			int largest_free_order;					// -1 if there are no free frames
+
+			uint64_t nr_allocs;
+			uint64_t nr_frees;
+			uint64_t nr_splits;
+			uint64_t nr_merges;
+			uint64_t nr_failed_allocs[NR_ORDERS];	// failed allocations of each order
+
+			uint64_t nr_node_free_frames[MAX_NUMA_NODES];	// free frames on each node
+
+			uint64_t nr_cached_frames;				// filled in by PageAllocator
+			uint64_t nr_zeroed_frames;				// filled in by PageAllocator
+			uint64_t nr_local_allocs;				// filled in by PageAllocator: from the
+			uint64_t nr_remote_allocs;				// allocating CPU's node, or another
+		};
+
+		/* Frame descriptors above the first PF_EAGER_FRAMES frames are initialised
+		 * after boot, in chunks of PF_INIT_CHUNK_FRAMES frames.  Chunks are aligned
+		 * to their size, which must be at least the largest block an algorithm
+		 * allocates, so no block (or buddy) straddles initialised and uninitialised
+		 * descriptors. */
+#define PF_EAGER_FRAMES			(1ull << 20)	// 4 GiB
+#define PF_INIT_CHUNK_FRAMES	(1ull << 18)	// 1 GiB
+
+		/* A zone of physically contiguous frames below 4 GiB is set aside at boot
+		 * for DMA buffers, which need contiguous frames with address limits and
+		 * alignment, so that such allocations neither fail because the general
+		 * pool is fragmented, nor fragment it further. */
+#define DMA_ZONE_ORDER			10				// 4 MiB
+#define DMA_ZONE_FRAMES			(1ull << DMA_ZONE_ORDER)
+#define DMA_ZONE_LIMIT			0x100000000ull	// 4 GiB
+
 		class MemoryManager;
 		class ObjectAllocator;
 
@@ -52,6 +129,10 @@ namespace infos
 		class PageAllocatorAlgorithm
 		{
 		public:
+			/* Descriptors beyond the end of the highest range inserted so far may
+			 * not have been initialised yet (see PageAllocator::init_deferred()),
+			 * so algorithms must not look at them.  Ranges are inserted in
+			 * ascending order, and in aligned chunks of PF_INIT_CHUNK_FRAMES. */
 			virtual bool init(FrameDescriptor *pf_descriptors, uint64_t nr_pf_descriptors) = 0;
 
 			virtual void insert_range(FrameDescriptor *start, uint64_t count) = 0;
@@ -60,8 +141,19 @@ namespace infos
 			virtual FrameDescriptor *allocate(int order) = 0;
 			virtual void free(FrameDescriptor *base, int order) = 0;
 
+			/* An algorithm that returns true from numa_aware() keeps the free frames of
+			 * each NUMA node apart, never merging blocks across nodes, and hands out
+			 * frames of the given node only from allocate_on_node(); allocate() takes
+			 * them from any node. */
+			virtual bool numa_aware() const { return false; }
+			virtual FrameDescriptor *allocate_on_node(int order, unsigned int node) { return allocate(order); }
+
 			virtual const char *name() const = 0;
 
+			/* Fills in the algorithm's part of 'stats', returning false if the
+			 * algorithm doesn't keep statistics. */
+			virtual bool get_stats(PageAllocatorStats& stats) const { return false; }
+
 			virtual void dump_state() const;
 		};
 
@@ -79,12 +171,45 @@ namespace infos
 
 			bool init() override;
 
+			/* Keeps the frames in [start, end) from ever being made available, e.g. those
+			 * holding something the boot loader loaded.  Only before init(). */
+			bool reserve_at_boot(pfn_t start, pfn_t end, const char *what);
+
+			/* Sorts the frames into the pools of their NUMA nodes, once the firmware has
+			 * described them (see numa.h).  Only before the other CPUs are started. */
+			bool init_numa();
+
 			PageAllocatorAlgorithm *algorithm() const { return _allocator_algorithm; }
 			void algorithm(PageAllocatorAlgorithm &alg) { _allocator_algorithm = &alg; }
 
-			FrameDescriptor *allocate(int order);
+			FrameDescriptor *allocate(int order, PageAllocFlags::PageAllocFlags flags = PageAllocFlags::NONE);
 			void free(FrameDescriptor *pfdescr, int order);
 
+			bool allocate_bulk(unsigned int count, FrameDescriptor **frames, PageAllocFlags::PageAllocFlags flags = PageAllocFlags::NONE);
+
+			bool refill_zero_pool();
+
+			bool get_stats(PageAllocatorStats& stats);
+
+			/* The frames the algorithm has free (not counting those in frame caches), and
+			 * all that it manages.  They are read without the lock, so are approximate. */
+			uint64_t nr_free_frames() const { return __atomic_load_n(&_nr_free_frames, __ATOMIC_RELAXED); }
+			uint64_t nr_managed_frames() const { return __atomic_load_n(&_nr_managed_frames, __ATOMIC_RELAXED); }
+
+			void start_deferred_init();
+
+			FrameDescriptor *allocate_contiguous(uint64_t nr_frames, phys_addr_t limit = DMA_ZONE_LIMIT, uint64_t alignment = __page_size);
+			void free_contiguous(FrameDescriptor *pfdescr, uint64_t nr_frames);
+
+			/* For compaction (see compaction.h): allocates up to 'count' single frames that
+			 * lie outside [start, end), returning how many it got, and frees frames straight
+			 * to the algorithm, past the frame caches, so that they merge with their buddies. */
+			unsigned int allocate_outside(pfn_t start, pfn_t end, unsigned int count, FrameDescriptor **frames);
+			void free_to_algorithm(FrameDescriptor *pfdescr, int order);
+
+			/* Descriptors from here on may not have been initialised yet. */
+			uint64_t nr_initialised_frames() const { return __atomic_load_n(&_nr_initialised_frames, __ATOMIC_ACQUIRE); }
+
 			const FrameDescriptor *alloc_zero_frame();
 			inline void free_one(FrameDescriptor *pfdescr) { return free(pfdescr, 0); }
 
@@ -127,13 +252,35 @@ namespace infos
 
 		private:
 			uint64_t _nr_frames;
+			uint64_t _nr_initialised_frames;	// descriptors beyond this are initialised by init_deferred()
 			FrameDescriptor *_pf_descriptors;
 			PageAllocatorAlgorithm *_allocator_algorithm;
 			util::Mutex _mtx;
+			uint64_t _nr_free_frames, _nr_managed_frames;	// updated with the lock held
+			bool _numa;			// true once frames are allocated from the local node first
+			uint64_t _nr_local_allocs, _nr_remote_allocs;
+			FrameCache _zero_pool;		// frames zero-filled ahead of time, by the idle task
+			util::TicketLock _zero_pool_lock;
+
+			pfn_t _dma_zone_base;
+			uint64_t _dma_zone_frames;	// zero if there is no DMA zone
+			uint64_t _dma_zone_map[DMA_ZONE_FRAMES / 64];	// a set bit means the frame is in use
+			util::Mutex _dma_zone_mtx;
 
 			bool setup_pf_descriptors();
+			void setup_dma_zone();
 			bool self_test();
-			uint64_t reserve_range(pfn_t start, uint64_t nr_frames);
+			void benchmark();
+			FrameDescriptorType::FrameDescriptorType boot_frame_type(pfn_t pfn, pfn_t end, pfn_t &run_end) const;
+			uint64_t init_frames(pfn_t start, pfn_t end);
+			void init_deferred();
+			static void init_deferred_threadproc(PageAllocator *pgalloc);
+
+			FrameDescriptor *allocate_cached();
+			void free_cached(FrameDescriptor *pfdescr);
+			FrameDescriptor *allocate_zeroed();
+			FrameDescriptor *algorithm_allocate(int order);
+			void algorithm_free(FrameDescriptor *pfdescr, int order);
 		};
 
 		extern infos::kernel::ComponentLog pgalloc_log;
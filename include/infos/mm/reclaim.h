@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/reclaim.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		/* Something that holds on to frames it could do without, e.g. a cache: when free
+		 * memory runs low, it is asked to give some back.  Shrinkers are made as static
+		 * objects next to what they shrink, and are all on one list, which is only ever
+		 * added to.
+		 *
+		 * A shrinker can be called from inside an allocation, which may be made with
+		 * any lock held, so it must only ever try to take its locks, and give up (freeing
+		 * nothing) if it can't. */
+		class Shrinker
+		{
+		public:
+			/* Frees up to 'nr_frames' frames, and returns how many it freed. */
+			typedef uint64_t (*ShrinkFn)(uint64_t nr_frames);
+
+			Shrinker(const char *name, ShrinkFn shrink);
+
+			const char *name() const { return _name; }
+			uint64_t nr_reclaimed() const { return __atomic_load_n(&_nr_reclaimed, __ATOMIC_RELAXED); }
+
+			uint64_t shrink(uint64_t nr_frames);
+
+			static Shrinker *first() { return _all_shrinkers; }
+			Shrinker *next() const { return _next; }
+
+		private:
+			const char *_name;
+			ShrinkFn _shrink;
+			uint64_t _nr_reclaimed;
+
+			Shrinker *_next;
+			static Shrinker *_all_shrinkers;
+		};
+
+		/* Free memory is kept between watermarks, which are fractions of the frames that
+		 * the page allocator manages: the reclaim thread starts shrinking once there are
+		 * fewer than 'low' free frames, and stops once there are 'high'.  An allocation
+		 * that fails reclaims what it needs itself, if it is allowed to sleep. */
+		struct ReclaimWatermarks
+		{
+			uint64_t low, high;
+		};
+
+		extern void reclaim_watermarks(ReclaimWatermarks& watermarks);
+
+		/* Asks the shrinkers, in turn, for up to 'nr_frames' frames, and returns how many
+		 * they freed. */
+		extern uint64_t reclaim_frames(uint64_t nr_frames);
+
+		/* Reclaims for an allocation of 2^order frames that has failed, if the caller can
+		 * wait for it, and returns true if anything was freed, so that it is worth
+		 * trying again.  A high-order allocation that fails with enough memory free
+		 * tries compaction (see compaction.h) first. */
+		extern bool reclaim_for_allocation(int order);
+
+		/* Starts the kernel thread that keeps free memory above the low watermark, by
+		 * shrinking, and then by swapping pages out (see swap.h), if there is swap,
+		 * and that compacts memory in the background.
+		 * This must be called once the scheduler is available. */
+		extern bool start_reclaimer();
+	}
+}
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/shared-memory.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/fs/file.h>
+#include <infos/util/string.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		struct FrameDescriptor;
+		class VMA;
+
+		/* A shared-memory object: some (zeroed) frames, which every process that opens
+		 * the object can map into its VMA, so that they all see the same memory.  An
+		 * object with a name can be opened by it, until it is unlinked; one without can
+		 * only be handed to another process, by spawn.
+		 *
+		 * The frames are counted in their FrameDescriptors: the object holds each one, and
+		 * so does every mapping of it.  So the object can go away while it is still mapped,
+		 * and the frames are freed once the last mapping is gone, and the other way round.
+		 * The object itself goes once it has no name and every handle on it is closed. */
+		class SharedMemory : public fs::File
+		{
+		public:
+			static const size_t MAX_SIZE = 0x4000000;
+
+			/* Opens the object with the name, making it (with the given size) if there
+			 * isn't one and 'create' is set, or failing if there is and 'exclusive' is
+			 * set.  An empty name always makes a new, anonymous object.  Returns NULL if
+			 * it can't be opened. */
+			static SharedMemory *open(const util::String& name, size_t size, bool create, bool exclusive);
+			/* Takes the name away, so that the object goes once the last handle on it is
+			 * closed.  Returns false if there was no object with the name. */
+			static bool unlink(const util::String& name);
+
+			/* The object an object is, or NULL if it isn't one. */
+			static SharedMemory *from_object(void *object);
+
+			size_t size() const { return (size_t)_nr_frames << __page_bits; }
+
+			/* Maps the whole object anywhere in the VMA, and updates 'va' to where. */
+			bool map(VMA& vma, bool writable, virt_addr_t& va);
+
+			int pread(void *buffer, size_t size, off_t off) override;
+			int pwrite(const void *buffer, size_t size, off_t off) override;
+
+			/* Another process holds the object. */
+			void hold();
+			void close() override;
+
+		private:
+			SharedMemory(const util::String& name, FrameDescriptor **frames, unsigned int nr_frames);
+			~SharedMemory();
+
+			util::String _name;
+			FrameDescriptor **_frames;
+			unsigned int _nr_frames;
+
+			// Guarded by the lock of the table of objects.
+			unsigned int _holders;
+			bool _named;
+
+			uint8_t *frame_data(unsigned int index) const;
+		};
+	}
+}
@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/slab.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		/* A cache of fixed-size objects, carved out of single-frame slabs that come
+		 * straight from the page allocator.  Objects are never split or merged, so
+		 * allocation and free are O(1), and objects of the same type end up close
+		 * together in memory.
+		 *
+		 * If a constructor is given, it is run once on each object when its slab is
+		 * created, and objects are expected to be returned to the cache in their
+		 * constructed state, so that the work is not repeated on every allocation.
+		 *
+		 * Each new slab starts its objects at a different cache-line offset (its
+		 * 'colour'), so that the same object in different slabs doesn't always map
+		 * to the same cache set. */
+		class SlabCache
+		{
+		public:
+			typedef void (*ctor_fn_t)(void *obj);
+
+			SlabCache(const char *name, size_t object_size, size_t alignment = 16, ctor_fn_t ctor = NULL);
+
+			/* Allocates an object.  If 'atomic' is set, this fails rather than wait
+			 * for the cache's lock, or grow the cache. */
+			void *alloc(bool atomic = false);
+			void free(void *obj);
+
+			const char *name() const { return _name; }
+			size_t object_size() const { return _object_size; }
+			uint64_t nr_slabs() const { return __atomic_load_n(&_nr_slabs, __ATOMIC_RELAXED); }
+			uint64_t nr_in_use() const { return __atomic_load_n(&_nr_inuse, __ATOMIC_RELAXED); }
+
+			/* The caches are all on one list, which is only ever added to. */
+			static SlabCache *first_cache() { return _all_caches; }
+			SlabCache *next_cache() const { return _next_cache; }
+
+			void dump_state() const;
+
+			/* Returns the cache that owns an object, or NULL if the object was not
+			 * allocated from a slab cache. */
+			static SlabCache *cache_of(const void *obj);
+
+			static void dump_all();
+
+		private:
+			struct Slab;
+
+			const char *_name;
+			size_t _object_size;
+			size_t _objects_offset;
+			unsigned int _objects_per_slab;
+			unsigned int _nr_colours, _next_colour;
+			size_t _colour_stride;
+			ctor_fn_t _ctor;
+
+			Slab *_partial, *_full, *_empty;
+			util::Mutex _mtx;
+
+			uint64_t _nr_slabs, _nr_inuse;
+
+			SlabCache *_next_cache;
+			static SlabCache *_all_caches;
+
+			void *take(bool may_grow);
+			Slab *grow();
+			void release(Slab *slab);
+
+			static void list_push(Slab *& list, Slab *slab);
+			static void list_remove(Slab *& list, Slab *slab);
+		};
+
+/* Makes 'new' and 'delete' of a class use a dedicated slab cache.  Put
+ * DECLARE_SLAB_ALLOCATED in the class definition, and DEFINE_SLAB_ALLOCATED
+ * in exactly one translation unit. */
+#define DECLARE_SLAB_ALLOCATED(_class) \
+	public: \
+		static void *operator new(size_t size); \
+		static void operator delete(void *p); \
+	private: \
+		static infos::mm::SlabCache __slab_cache
+
+#define DEFINE_SLAB_ALLOCATED(_class) \
+	void *_class::operator new(size_t size) { \
+		if (size != sizeof(_class)) return ::operator new(size); \
+		return __slab_cache.alloc(); \
+	} \
+	void _class::operator delete(void *p) { ::operator delete(p); } \
+	infos::mm::SlabCache _class::__slab_cache(#_class, sizeof(_class))
+	}
+}
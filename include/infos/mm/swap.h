@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/swap.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class DeviceManager;
+	}
+
+	namespace mm
+	{
+		/* When memory runs short, and the caches have given back all they can, the
+		 * private pages of user processes can be swapped out, in page-sized slots:
+		 * first compressed into a pool of memory (of up to zram-size MiB), and once
+		 * that is full, to a block device (given with the swap-device option).  Either
+		 * tier can be used without the other.  A swapped-out page holds
+		 * a swap cookie (see make_swap_cookie()) with its slot, and is read back in
+		 * when it is next touched, along with any neighbours that were swapped out
+		 * with it.  A slot is counted for each PTE that holds its cookie, as cloning a
+		 * VMA copies them. */
+
+		/* Sets up the compressed tier and the swap device, if they were asked for.
+		 * Returns false if the device can't be used (the compressed tier is still
+		 * used, if there is one). */
+		extern bool swap_on(kernel::DeviceManager& devices);
+
+		/* Swaps out up to 'nr_frames' pages, and returns how many frames that freed.
+		 * Each process's oldest pages (see working-set.h) go first.  It writes to the disk, and walks every process, so it is only called from
+		 * the reclaim thread. */
+		extern uint64_t swap_out(uint64_t nr_frames);
+
+		/* Reads the data in 'nr' consecutive slots into a buffer.  Returns false if it
+		 * couldn't be read. */
+		extern bool swap_read(uint32_t first_slot, unsigned int nr, void *buffer);
+
+		/* Counts another PTE that holds a swap cookie, or one fewer, freeing the slot
+		 * when there are none left. */
+		extern void swap_duplicate(uint32_t cookie);
+		extern void swap_release(uint32_t cookie);
+	}
+}
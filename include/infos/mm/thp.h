@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/thp.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		/* Transparent huge pages: only mappings made a huge page at a time get huge pages
+		 * when they are allocated, but a process that runs for long enough tends to fill
+		 * in whole huge-page-sized parts of its address space a page at a time, too.  The
+		 * promoter goes round the address space of each process, a few page tables at a
+		 * time, looking for aligned runs of 512 pages that are all present, with the
+		 * same permissions, and backed by private frames, and collapses each one it
+		 * finds into a huge page (see VMA::collapse_huge_page()): the pages are copied
+		 * into a new block of frames, the page table is replaced with a huge page's
+		 * entry, and the old frames and page table are freed.  A huge page that is
+		 * later partly unmapped is split back into small pages.
+		 *
+		 * The promoter runs from the reclaim thread, after compaction, and only while
+		 * there is a free block of frames large enough without reclaiming anything.  It
+		 * collapses at most one huge page each time it runs.  It is off unless turned on
+		 * with "thp=1". */
+
+		/* Collapses the next run of pages that can be collapsed into a huge page, if
+		 * there is one, and memory to spare. */
+		extern void promote_in_background();
+	}
+}
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/mm/user-access.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		/* Safe copies between the kernel and the user half of the current address space,
+		 * for system calls to use on the pointers they are given.  Each returns false,
+		 * rather than faulting, if any part of the user range isn't accessible to the
+		 * process (a part of the range may have been copied by then). */
+
+		bool copy_from_user(void *dst, uintptr_t src, size_t size);
+		bool copy_to_user(uintptr_t dst, const void *src, size_t size);
+		/* Copies a NUL-terminated string into a buffer of 'size' bytes.  Also returns
+		 * false if the string (and its NUL) doesn't fit. */
+		bool copy_string_from_user(char *dst, uintptr_t src, size_t size);
+	}
+}
@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/mm/virt-range-allocator.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/avl-tree.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		/* Keeps track of the holes (unused ranges of virtual addresses) within a window
+		 * of an address space.  The holes are kept in an AVL tree ordered by address,
+		 * where every node also records the size of the largest hole in its subtree, so
+		 * that the lowest hole big enough for an allocation is found in O(log n).
+		 *
+		 * Every address is page-aligned, and every range is half-open: [start, end). */
+		class VirtualRangeAllocator
+		{
+		public:
+			VirtualRangeAllocator(const VirtualRangeAllocator&) = delete;
+			VirtualRangeAllocator(VirtualRangeAllocator&&) = delete;
+
+			VirtualRangeAllocator(virt_addr_t base, virt_addr_t end);
+			~VirtualRangeAllocator();
+
+			/* Finds the lowest hole that can hold 'size' bytes at the given (power of two)
+			 * alignment, and takes the range out of it.  Returns false if there is no such
+			 * hole. */
+			bool allocate(size_t size, size_t alignment, virt_addr_t& va);
+			/* Marks a range as in use, whether or not any of it was free. */
+			void reserve(virt_addr_t start, virt_addr_t end);
+			/* Marks a range as free again, merging it with the holes either side. */
+			void release(virt_addr_t start, virt_addr_t end);
+
+			/* Makes the holes the same as another allocator's. */
+			void copy_from(const VirtualRangeAllocator& other);
+
+			virt_addr_t base() const { return _base; }
+			virt_addr_t end() const { return _end; }
+			unsigned int nr_holes() const { return _holes.count(); }
+
+		private:
+			struct Hole;
+			struct HoleTraits;
+
+			virt_addr_t _base, _end;
+			util::AVLTree<Hole, HoleTraits> _holes;
+
+			void insert_hole(virt_addr_t start, virt_addr_t end);
+			void remove_hole(Hole *h);
+
+			Hole *last_hole_before(virt_addr_t va) const;
+		};
+	}
+}
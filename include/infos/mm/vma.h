@@ -4,6 +4,8 @@
 
 #include <infos/define.h>
 #include <infos/util/list.h>
+#include <infos/util/interval-tree.h>
+#include <infos/mm/virt-range-allocator.h>
 
 /* Forward-declare all the types of page table we know about.
  * The details are kept in arch-specific files... mostly! */
@@ -15,6 +17,11 @@ namespace infos {
 
 namespace infos
 {
+	namespace fs
+	{
+		class File;
+	}
+
 	namespace mm
 	{
 		using infos::arch::x86::GenericX86PageTableEntry;
@@ -51,9 +58,93 @@ namespace infos
 			PTE_PS			= 1<<7 /* alias for 'huge' */,
 			PTE_PT_PAT		= 1<<7 /* alias for 'huge' */,
 			PTE_GLOBAL		= 1<<8,
+			PTE_COW			= 1<<9 /* available to software: copy on write */,
+			PTE_AGE			= 3<<10 /* available to software: see GenericPageTableEntry::age() */,
 			PTE_NONPT_PAT	= 1<<12
 		};
 
+		/* How a mapping is cached, as the PAT, PCD and PWT bits of a (lowest-level) page
+		 * table entry pick it out of the PAT, which is programmed at boot for these.
+		 * One of them can be ORed into the flags of a mapping; it is write-back if none
+		 * is given. */
+		enum PageCacheTypes {
+			PTE_CACHE_WB		= 0,
+			PTE_CACHE_WT		= PTE_WRITE_THROUGH,
+			PTE_CACHE_UC_MINUS	= PTE_CACHE_DISABLED,
+			PTE_CACHE_UC		= PTE_CACHE_DISABLED | PTE_WRITE_THROUGH,
+			PTE_CACHE_WC		= PTE_PT_PAT,
+
+			PTE_CACHE_MASK		= PTE_PT_PAT | PTE_CACHE_DISABLED | PTE_WRITE_THROUGH
+		};
+
+		/* Changes how the kernel's window onto physical memory caches a range of it: e.g.
+		 * write-combining for a framebuffer, or uncached for device registers.  It must be
+		 * called before the other CPUs are started.  Returns false if the range can't
+		 * be changed, in which case it is cached as it was. */
+		extern bool set_physical_cache_type(phys_addr_t pa, size_t size, unsigned long type);
+
+		/* The PTE cookies used for demand paging (see set_pte_cookie() below) hold
+		 * a page-aligned file offset, in the executable of the process that owns
+		 * the VMA, ORed with these flags in the low-order 12 bits.  DEMAND is
+		 * always set, so that a demand-paging cookie is never zero. */
+		enum DemandPageCookieFlags {
+			DPC_DEMAND		= 1<<0,	// the page is mapped on first touch
+			DPC_WRITABLE	= 1<<1,	// map the page writable
+			DPC_ZERO		= 1<<2,	// zero-fill the page, rather than reading it from the file
+			DPC_SWAP		= 1<<3	// the page has been swapped out (see make_swap_cookie())
+		};
+
+		static inline uint32_t make_demand_page_cookie(uint32_t file_offset, uint32_t flags)
+		{
+			return (file_offset & ~(__page_size - 1)) | (flags & (__page_size - 1)) | DPC_DEMAND;
+		}
+
+		/* A page that has been swapped out holds a cookie in the same form, with the
+		 * swap slot that its data is in where the file offset would be, and SWAP set
+		 * instead of DEMAND (so that nothing takes it for a demand-paging cookie).  It
+		 * is WRITABLE if the page was. */
+		static inline uint32_t make_swap_cookie(uint32_t slot, bool writable)
+		{
+			return (slot << __page_bits) | DPC_SWAP | (writable ? DPC_WRITABLE : 0);
+		}
+
+		static inline bool is_swap_cookie(uint32_t cookie) { return (cookie & (DPC_DEMAND | DPC_SWAP)) == DPC_SWAP; }
+		static inline uint32_t swap_cookie_slot(uint32_t cookie) { return cookie >> __page_bits; }
+
+		/* A page that VMA::unmap_for_swap() has taken out of a VMA, to be swapped out. */
+		struct SwapOutPage
+		{
+			virt_addr_t va;
+			FrameDescriptor *frame;
+			uint32_t cookie;
+		};
+
+		/* A page that compaction moves from one frame to another, with
+		 * VMA::migrate_pages(). */
+		struct MigratePage
+		{
+			virt_addr_t va;
+			FrameDescriptor *from, *to;
+			uint64_t pte_bits;	// the PTE while the page is being copied
+			bool moved;
+		};
+
+		/* A page that same-page merging (see ksm.h) may map from a frame that it
+		 * shares with other pages like it, with VMA::merge_page(). */
+		struct MergePage
+		{
+			virt_addr_t va;
+			FrameDescriptor *frame;
+		};
+
+		/* Starts the kernel thread that reads demand-paged pages in, so that the
+		 * faulting thread can sleep rather than the whole CPU waiting for the disk.
+		 * This must be called once the scheduler is available. */
+		extern bool start_demand_pager();
+
+#define PTE_AGE_SHIFT	10
+#define PTE_MAX_AGE		3
+
 		/* We want to define a "base class", but we can't use virtual dispatch
 		 * because it will add a vtable to our struct's layout and will no longer
 		 * match the hardware's layout of the page table entry (usually just a
@@ -96,6 +187,35 @@ namespace infos
 
 			bool huge() const { return get_flag(PageTableEntryFlags::PTE_HUGE); }
 			void huge(bool v) { set_flag(PageTableEntryFlags::PTE_HUGE, v); }
+
+			bool cow() const { return get_flag(PageTableEntryFlags::PTE_COW); }
+			void cow(bool v) { set_flag(PageTableEntryFlags::PTE_COW, v); }
+
+			/* How many passes of page aging (see VMA::age_pages()) in a row have found
+			 * the page not accessed, up to PTE_MAX_AGE. */
+			unsigned int age() const { return (flags() & PageTableEntryFlags::PTE_AGE) >> PTE_AGE_SHIFT; }
+			void age(unsigned int v) { flags((flags() & ~PageTableEntryFlags::PTE_AGE) | ((v << PTE_AGE_SHIFT) & PageTableEntryFlags::PTE_AGE)); }
+		};
+
+		/* How much memory a VMA (and the process it belongs to) is using, in frames,
+		 * apart from the kernel objects, which are in bytes.  The resident set is the
+		 * private frames plus the shared ones. */
+		struct MemoryUsage
+		{
+			uint64_t private_frames;	// allocated to back pages of the VMA
+			uint64_t shared_frames;		// copy-on-write frames (and text pages) shared into it
+			uint64_t pgt_frames;		// its page tables
+			uint64_t unmapped_frames;	// belonging to it without being mapped, e.g. kernel stacks
+			uint64_t kernel_bytes;		// kernel objects charged to the process
+		};
+
+		/* How many of a VMA's pages were of each age (see VMA::age_pages()) at the end of
+		 * the last pass of aging over it.  The pages of age zero had been accessed
+		 * during the pass, so they are its working set. */
+		struct PageAges
+		{
+			uint64_t nr_pages[PTE_MAX_AGE + 1];
+			uint64_t nr_passes;
 		};
 
 		/* In InfOS, a virtual address space is called a 'virtual memory area' or VMA.
@@ -122,26 +242,71 @@ namespace infos
 			
 			phys_addr_t pgt_base() const { return _pgt_phys_base; }
 			
-			/** Allocate some pages in this VMA, each backed by frames of physical memory.
+			/* Makes this the active address space, by loading its page table. If the
+			 * CPU supports PCIDs, the VMA's translations are tagged with its own PCID,
+			 * so they (and the global kernel translations) survive switching to
+			 * another address space and back. */
+			void activate();
+
+			/* Whether anything is mapped in the user half, i.e. the VMA has page tables
+			 * beyond the root, whose kernel half is shared with every other VMA. */
+			bool maps_user_space() const { return _nr_pgt_frames > 1; }
+			
+			/** Allocate some frames of physical memory that belong to this VMA, but
+			 * are not mapped in it (e.g. kernel stacks).
 			 *
 			 * @arg order The logarithm (base 2) of how many pages to allocate.
 			 *
 			 * This works by calling allocate() on the active page allocator. Then
 			 * we do some bookkeeping: make a FrameAllocation structure to describe the
-			 * allocation, append to the list of page allocations * (a descriptor and a ), then call pnzero.
-			 * The 'order' argument is the log base 2 of the number of pages to
-			 * allocate. */
+			 * allocation, and append it to the list of unmapped allocations, so that
+			 * it is freed along with the VMA. */
 			FrameDescriptor *allocate_phys(int order);
+			/* Allocates a (zeroed) frame for one of this VMA's page tables, or frees
+			 * one. Page tables are freed when they become empty, or along with the VMA. */
+			FrameDescriptor *allocate_pgt();
+			void free_pgt(FrameDescriptor *pfdescr);
 			/* Allocates a whole number of pages at a given virtual address, with permissions.
 			 * Permissions are bitwise ORed from mm::MappingFlags::MappingFlags. */
 			bool allocate_virt(virt_addr_t va, int nr_pages, int perm = -1);
-			/* Allocates a whole number of pages at any free virtual address,
-			 * with permissions. NOTE: this is unimplemented in vma.cpp. */
-			bool allocate_virt_any(int nr_pages, int perm = -1);
+			/* Allocates a whole number of pages at any free virtual address in the
+			 * dynamic part of the user address space, with permissions, and updates
+			 * va to where they were put. Runs of at least a huge page are placed on a
+			 * huge page boundary (if there's room), so that they can use huge pages. */
+			bool allocate_virt_any(int nr_pages, virt_addr_t& va, int perm = -1);
 			/* Install a mapping from a (virtual) page to a (physical) frame, with permissions. */
 			void insert_mapping(virt_addr_t va, phys_addr_t pa, unsigned long flags);
+			/* Install mappings from a run of (virtual) pages to the same number of
+			 * physically contiguous frames, with permissions. The page tables are
+			 * walked once per page table that the run touches, not once per page. */
+			void map_range(virt_addr_t va, phys_addr_t pa, int nr_pages, unsigned long flags);
+			/* Like map_range, but at any free virtual address in the dynamic part of the
+			 * user address space, which va is updated to.  The frames remain the
+			 * caller's: they aren't freed when they are unmapped. */
+			bool map_range_any(phys_addr_t pa, int nr_pages, unsigned long flags, virt_addr_t& va);
+			/* Maps a run of pages, at any free virtual address like map_range_any, to
+			 * frames that are shared with whatever else holds them: each frame's
+			 * FrameDescriptor counts a hold for the mapping, which unmapping drops, and
+			 * the frame is freed by whoever drops the last hold.  The frames need not
+			 * be contiguous. */
+			bool map_shared_any(FrameDescriptor *const *frames, int nr_pages, bool writable, virt_addr_t& va);
+			/* Install a mapping from a (virtual) huge page to 2^__huge_page_order (physical) frames,
+			 * with permissions. Both addresses must be huge-page aligned, and nothing may be
+			 * mapped in that huge page yet. */
+			void insert_huge_mapping(virt_addr_t va, phys_addr_t pa, unsigned long flags);
+			/* Removes the mappings for a whole number of pages at a given virtual address,
+			 * freeing the frames that were allocated for them (unless they are still
+			 * shared), and any page tables that are left empty. A huge page that is only
+			 * partly unmapped is split into small pages first (if there is the memory
+			 * to copy it). */
+			void unmap_range(virt_addr_t va, int nr_pages);
 			/* Does this virtual address map to anything? Update pa to the physical address. */
 			bool get_mapping(virt_addr_t va, phys_addr_t& pa);
+			/* Does this virtual address map to a user page (that is writable, if 'write' is
+			 * set)? Update pa to the physical address. Copy-on-write pages are copied
+			 * first, if they are to be written, and zero-fill pages are filled in, but
+			 * nothing is read in from a file. */
+			bool get_user_mapping(virt_addr_t va, phys_addr_t& pa, bool write);
 			/* Does this virtual address map to anything? */
 			bool is_mapped(virt_addr_t va);
 			/* Like allocate_virt, but don't actually allocate physical memory.
@@ -170,9 +335,149 @@ namespace infos
 			bool get_pte_cookie(virt_addr_t va, uint32_t& cookie);
 			
 			void install_default_kernel_mapping();
+
+			/* Makes 'dest', which must not have anything mapped in the user half
+			 * yet, a copy-on-write clone of the user half of this VMA. Frames are
+			 * shared read-only, with the number of VMAs sharing each one counted in
+			 * its FrameDescriptor, and are copied by whichever side writes to them
+			 * first. Pages still waiting to be demand-paged in are cloned as their
+			 * cookies. Nothing may be running in this VMA while it is cloned. */
+			bool clone_into(VMA& dest);
+			/* Resolves a write fault on a copy-on-write page, by copying the frame
+			 * (or, if nothing else shares it any more, just making it writable).
+			 * Returns false if the page isn't copy-on-write, or memory runs out. */
+			bool handle_cow_fault(virt_addr_t va);
+
+			/* Unmaps up to 'max' of the VMA's private pages, so that they can be swapped
+			 * out, choosing them with a clock: the hand carries on from wherever the last
+			 * call left it, passing over at most 'scan' pages, and a page that has been
+			 * accessed since the hand last passed it has its accessed bit cleared, and is
+			 * given a second chance.  So is a page younger than 'min_age' (see
+			 * age_pages()), so that pages outside the working set can be taken first.
+			 * The i'th page chosen is left holding the swap
+			 * cookie for slot 'first_slot + i', and is described in pages[i]; its frame
+			 * is the caller's once the page is written out.  Only pages that nothing
+			 * else shares are chosen.  Must be called with interrupts disabled.  The
+			 * TLBs aren't flushed: the caller does that (with invalidate_range()) before
+			 * it uses the frames.  Returns how many pages were unmapped. */
+			unsigned int unmap_for_swap(SwapOutPage *pages, unsigned int max, uint32_t first_slot, unsigned int scan, unsigned int min_age);
+			/* Maps a page that unmap_for_swap() took back in, from its frame, if it
+			 * still holds the cookie that it was left with (e.g. because it couldn't be
+			 * written out).  Returns false, leaving the frame to the caller, if not. */
+			bool remap_swapped_page(const SwapOutPage& page);
+
+			/* Compaction (see compaction.h) can move the VMA's private pages that nothing
+			 * else shares, and that aren't copy-on-write, to other frames.  There is no
+			 * reverse map from frames to the pages they are mapped at, so these walk the
+			 * page tables.  They must be called with interrupts disabled.
+			 *
+			 * mark_movable_frames() sets the bit in 'map' for the frame of each such
+			 * page, and find_pages_to_migrate() fills in up to 'max' pages[i] (but not
+			 * their 'to' frames) with the pages whose frames lie in [start, end),
+			 * returning how many it found. */
+			void mark_movable_frames(uint64_t *map, uint64_t nr_frames);
+			unsigned int find_pages_to_migrate(pfn_t start, pfn_t end, MigratePage *pages, unsigned int max);
+			/* Copies each of the pages into its 'to' frame, and maps it from there,
+			 * unless it has changed since it was found.  Writable pages are made
+			 * copy-on-write while they are copied, so a write meanwhile takes the page
+			 * back, and it stays where it is.  On return, the 'from' frame of each page
+			 * that 'moved' is the caller's to free, and the 'to' frame of each that
+			 * didn't.  Returns how many pages moved. */
+			unsigned int migrate_pages(MigratePage *pages, unsigned int nr);
+
+			/* Same-page merging (see ksm.h) maps the VMA's private pages that hold the
+			 * same data as others from one frame, shared copy-on-write, so that a
+			 * write takes a private copy again with handle_cow_fault().  These must be
+			 * called with interrupts disabled.
+			 *
+			 * find_merge_candidates() fills in up to 'max' pages[i] with pages that
+			 * nothing else shares, and that aren't copy-on-write, going round the VMA
+			 * like unmap_for_swap() does, with a hand of its own, and returns how many
+			 * it found. */
+			unsigned int find_merge_candidates(MergePage *pages, unsigned int max, unsigned int scan);
+			/* Maps a page from 'into' instead of its own frame, unless it has changed
+			 * since it was found, and only if 'into' holds the same data (or, if 'fill'
+			 * is set, once its data has been copied into 'into').  The page takes a
+			 * hold on 'into', and is left copy-on-write if it was writable.  Returns
+			 * true if it did, in which case the page's old frame is the caller's to
+			 * free. */
+			bool merge_page(const MergePage& page, FrameDescriptor *into, bool fill);
+
+			/* Huge page promotion (see thp.h) replaces page tables whose pages are all
+			 * present, with the same permissions, and backed by private frames, with
+			 * huge pages.  These must be called with interrupts disabled.
+			 *
+			 * find_collapsible_range() looks at up to 'scan' huge-page-sized parts of the
+			 * VMA, carrying on from where the last call left off, for one whose pages
+			 * can all be collapsed into a huge page, setting 'va' to it, and returns
+			 * false if it found none.  collapse_huge_page() copies the pages at 'va' into 'block', an
+			 * aligned block of 2^__huge_page_order frames, and maps it as a huge page,
+			 * unless they can't be collapsed any more, in which case it returns false
+			 * and 'block' is still the caller's.  Accesses to the pages wait while
+			 * they are copied. */
+			bool find_collapsible_range(unsigned int scan, virt_addr_t& va);
+			bool collapse_huge_page(virt_addr_t va, FrameDescriptor *block);
+			/* Whether the page at the given address is being collapsed into (or split
+			 * out of) a huge page, so that an access to it has to be made again. */
+			bool collapse_in_progress(virt_addr_t va);
+
+			/* Read-only file pages of this VMA are shared with every other VMA that
+			 * has the same text source: they are read into the text source on first
+			 * use, and mapped read-only from there. */
+			void text_source(VMA *source)
+			{
+				if (source) __atomic_add_fetch(&source->_nr_text_users, 1, __ATOMIC_RELAXED);
+				if (_text_source) __atomic_sub_fetch(&_text_source->_nr_text_users, 1, __ATOMIC_RELEASE);
+				_text_source = source;
+			}
+			VMA *text_source() const { return _text_source; }
+			/* How many VMAs have this one as their text source: it mustn't go away
+			 * while any do. */
+			unsigned int nr_text_users() const { return __atomic_load_n(&_nr_text_users, __ATOMIC_ACQUIRE); }
+			/* Maps the page at the given address from the text source, if the text
+			 * source has it. */
+			bool map_text_page(virt_addr_t va);
+			/* Like map_text_page, but first adds the page to the text source, filled
+			 * in from 'data', if the text source doesn't have it yet. */
+			bool add_text_page(virt_addr_t va, const void *data);
+
+			/* Maps part of a file at the given virtual address, to be demand-paged
+			 * in: each page is read into a private frame the first time it is
+			 * touched. The file offset must be page aligned, and the mapped part of
+			 * the file must lie in its first 4 GiB (the reach of a cookie). */
+			bool map_file(virt_addr_t va, int nr_pages, fs::File& file, uint64_t offset, bool writable);
+			/* Like map_file, but at any free virtual address, like allocate_virt_any. */
+			bool map_file_any(int nr_pages, fs::File& file, uint64_t offset, bool writable, virt_addr_t& va);
+			/* Like allocate_virt, but each page only gets a (zeroed) frame the first
+			 * time it is touched, so pages that never are cost nothing but their PTEs. */
+			bool map_zero_fill(virt_addr_t va, int nr_pages, bool writable);
+			/* Like map_zero_fill, but at any free virtual address, like allocate_virt_any. */
+			bool map_zero_fill_any(int nr_pages, bool writable, virt_addr_t& va);
+			/* Returns the file that demand-paged pages at the given address come from,
+			 * or NULL if they come from the program image, and narrows [start, end)
+			 * to the pages around it that come from the same place. */
+			fs::File *file_mapping_bounds(virt_addr_t va, virt_addr_t& start, virt_addr_t& end) const;
 			
 			bool copy_to(virt_addr_t dest_va, const void *src, size_t size);
 			
+			/* Fills in the frames that this VMA is using (leaving kernel_bytes alone).
+			 * The counts are kept as frames are mapped and unmapped, so this is cheap. */
+			void usage(MemoryUsage& usage) const;
+			
+			/* Ages up to 'scan' of the VMA's pages, going round it like unmap_for_swap()
+			 * does, with a hand of its own: a page that has been accessed since it was
+			 * last aged has its accessed bit cleared, and its age set to zero, and any
+			 * other gets a pass older, up to PTE_MAX_AGE.  The TLBs are flushed of the
+			 * pages whose accessed bits were cleared (so that the next access sets them
+			 * again) once, at the end.  When the hand gets back round to the start, the
+			 * pass is over, and the ages that it found are what page_ages() reports.
+			 * Must be called with interrupts disabled. */
+			void age_pages(unsigned int scan);
+			void page_ages(PageAges& ages) const;
+
+			/* Flushes the translations of a run of pages from every CPU using the VMA. */
+			void invalidate_range(virt_addr_t va, unsigned int nr_pages);
+
 			/* Print the page tables to the MM message log. */
 			void dump();
 					
@@ -184,11 +489,62 @@ namespace infos
 			};
 			/* This allocation list is a list of <base, run length> pairs
 			 * within the FrameDescriptor vector, except that the run length
-			 * is really an 'order' (log base 2 of the length). */
+			 * is really an 'order' (log base 2 of the length), for the frames
+			 * that belong to the VMA without being mapped in it. */
 			util::List<FrameAllocation> _frame_allocations;
+			/* The frames allocated to back pages of the VMA, keyed by the range of
+			 * virtual addresses that they are mapped at. Frames that are shared into
+			 * the VMA from somewhere else are not in here. */
+			util::IntervalTree<FrameAllocation> _mapped_frames;
+			/* The unused ranges of the dynamic part of the user address space, which
+			 * allocate_virt_any() places pages in. Fixed-address mappings that land in
+			 * it are taken out, and unmapping puts ranges back. */
+			VirtualRangeAllocator _free_ranges;
+			/* The parts of the VMA that are mapped from files (other than the program
+			 * image) with map_file(), and the files they are mapped from. */
+			util::IntervalTree<fs::File *> _file_mappings;
 			
 			phys_addr_t _pgt_phys_base;
 			virt_addr_t _pgt_virt_base;
+			/* The PCID that tags this VMA's translations (zero until it is first
+			 * activated, or if it can't have its own), and the CPUs, one bit each,
+			 * whose TLBs may hold translations for it that are out of date. */
+			uint16_t _pcid;
+			volatile uint64_t _tlb_stale;
+			VMA *_text_source;
+			unsigned int _nr_text_users;
+			/* Where unmap_for_swap() will look for pages to swap out next. */
+			virt_addr_t _swap_hand;
+			/* Where find_merge_candidates() will look for pages to merge next. */
+			virt_addr_t _merge_hand;
+			/* Where find_collapsible_range() will look for pages to collapse next. */
+			virt_addr_t _collapse_hand;
+			/* Where age_pages() will age pages next, the ages of the pages that the
+			 * pass so far has aged, and those of the last complete pass. */
+			virt_addr_t _age_hand;
+			PageAges _pass_ages, _ages;
+			/* The counts that usage() reports, kept up to date wherever frames are
+			 * recorded, shared in, or released. */
+			uint64_t _nr_private_frames, _nr_shared_frames, _nr_pgt_frames, _nr_unmapped_frames;
+
+			void record_mapped_frames(virt_addr_t va, FrameDescriptor *pfdescr, int order);
+			void release_mapped_frames(virt_addr_t va, phys_addr_t pa, int order);
+			void unmap_between(virt_addr_t start, virt_addr_t end);
+			void unmap_all();
+			template<typename Fn> void for_each_movable_page(Fn fn);
+			template<typename Fn> void walk_from_hand(virt_addr_t& hand, unsigned int scan, Fn fn);
+			bool is_active() const;
+			void invalidate_page(virt_addr_t va);
+			void flush_tlb_local(virt_addr_t va, unsigned int nr_pages);
+			void shootdown_remote(virt_addr_t va, unsigned int nr_pages);
+			static void shootdown_ipi(void *arg);
+			void release_cpus();
+			static void release_cpus_ipi(void *arg);
+			void release_pcid();
+			bool allocate_virt_small(virt_addr_t va, int nr_pages, unsigned long flags);
+			bool allocate_virt_huge(virt_addr_t va, unsigned long flags);
+			bool can_collapse(phys_addr_t pt_pa, virt_addr_t va);
+			bool split_huge_page(virt_addr_t va);
 			// FIXME: move these x86-specific details elsewhere....
 			void dump_pdp(int pml4, virt_addr_t pdp_va);
 			void dump_pd(int pml4, int pdp, virt_addr_t pd_va);
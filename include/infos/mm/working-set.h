@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/working-set.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		/* Working-set estimation: the reclaim thread goes round the pages of each process,
+		 * a batch at a time, sampling and clearing their accessed bits (see
+		 * VMA::age_pages()), and keeps an age for each page in its PTE: how many passes
+		 * in a row have found it not accessed, up to PTE_MAX_AGE.  At the end of each
+		 * pass over a process, the number of its pages of each age are kept, and the
+		 * pages of age zero, which were accessed during the pass, are its working set.
+		 *
+		 * Swapping out takes each process's oldest pages first (see swap_out()), and
+		 * only goes on to the rest if that isn't enough.  The ages are in the "ws"
+		 * statistics.  Aging is off unless turned on with "ws=1", and then every page
+		 * is the same age. */
+
+		/* Ages the next batch of each process's pages. */
+		extern void age_in_background();
+	}
+}
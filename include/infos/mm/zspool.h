@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/zspool.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/intrusive-list.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		struct FrameDescriptor;
+
+		/* A zspage: up to four frames, holding up to 256 objects of one size class,
+		 * and which of them are in use. */
+		struct ZsPage
+		{
+			util::IntrusiveListNode<ZsPage> node;
+
+			FrameDescriptor *frames[4];
+			uint64_t used[4];
+			uint16_t nr_used;
+			uint8_t size_class;
+		};
+
+		/* Where an object is in a ZsPool. */
+		struct ZsHandle
+		{
+			ZsPage *zspage;
+			uint16_t index;
+		};
+
+		/* A pool of variable-sized objects of up to a page, packed tightly, for
+		 * compressed pages.  Objects are rounded up to one of a set of size classes,
+		 * and each class packs its objects end to end into "zspages" of a few frames,
+		 * as many as wastes least at the end, so that an object may span two frames.
+		 * The frames needn't be contiguous, so the pool never needs more than one
+		 * frame at a time from the page allocator.
+		 *
+		 * Zspages that empty are kept for reuse, and only given back to the page
+		 * allocator by shrink(), so that free() never calls into the page allocator,
+		 * and can be called from anywhere. */
+		class ZsPool
+		{
+		public:
+			static const size_t MAX_OBJECT = 1 << 12;
+
+			ZsPool();
+
+			/* Sets the most frames that the pool may use, and works out its classes. */
+			void init(uint64_t max_frames);
+
+			/* Allocates an object, growing the pool by a zspage if need be.  Returns
+			 * false if the pool is at its limit (or out of memory) and has no room in
+			 * the object's class.  It may allocate frames, so it is only called where
+			 * that is allowed. */
+			bool alloc(size_t size, ZsHandle& handle);
+			void free(const ZsHandle& handle);
+
+			/* Copies data into an object, which is only done before anything else
+			 * can see it. */
+			void write(const ZsHandle& handle, const void *data, size_t size);
+
+			/* Returns where the first 'size' bytes of an object are, which is in the
+			 * pool unless the object spans two frames, in which case they are copied
+			 * into 'scratch' (of MAX_OBJECT bytes).  The object mustn't be freed while
+			 * the pointer is in use. */
+			const void *map(const ZsHandle& handle, size_t size, void *scratch) const;
+
+			/* Gives the frames of every empty zspage back to the page allocator. */
+			uint64_t shrink();
+
+			uint64_t max_frames() const { return _max_frames; }
+			uint64_t nr_frames() const { return __atomic_load_n(&_nr_frames, __ATOMIC_RELAXED); }
+			uint64_t nr_objects() const { return __atomic_load_n(&_nr_objects, __ATOMIC_RELAXED); }
+			uint64_t bytes_used() const { return __atomic_load_n(&_bytes_used, __ATOMIC_RELAXED); }
+
+			/* Whether the pool can't grow any more. */
+			bool full() const { return nr_frames() + MAX_ZSPAGE_FRAMES > _max_frames; }
+
+		private:
+			static const unsigned int MAX_ZSPAGE_FRAMES = 4;
+			static const unsigned int CLASS_STEP = 64;
+			static const unsigned int NR_CLASSES = MAX_OBJECT / CLASS_STEP;
+			static const unsigned int MAX_OBJECTS = (MAX_ZSPAGE_FRAMES << 12) / CLASS_STEP;
+
+			struct SizeClass
+			{
+				uint16_t object_size;
+				uint16_t nr_objects;
+				uint8_t nr_frames;
+
+				// The zspages with a free object, empty ones included.
+				util::IntrusiveList<ZsPage, &ZsPage::node> partial;
+			};
+
+			SizeClass _classes[NR_CLASSES];
+			uint64_t _max_frames, _nr_frames, _nr_objects, _bytes_used;
+			util::SpinLock _lock;
+
+			ZsPage *grow(SizeClass& cls, unsigned int class_index);
+		};
+	}
+}
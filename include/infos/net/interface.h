@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/net/interface.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/kernel/workqueue.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace net
+		{
+			class NetworkDevice;
+		}
+	}
+
+	namespace mm
+	{
+		struct PacketBuffer;
+	}
+
+	namespace net
+	{
+		/* An IPv4 interface on an Ethernet network device, which finds the hardware
+		 * addresses of its neighbours with ARP.
+		 *
+		 * Received frames aren't processed by the device's interrupt handler: it only
+		 * schedules the interface to be polled, by a kernel worker, which takes up to
+		 * RX_BUDGET frames from the device at a time and passes each up the stack.  If
+		 * there are more, the interface is scheduled again, behind whatever else was
+		 * waiting, so a flood of packets can't hold up everything else. */
+		class Interface
+		{
+		public:
+			Interface(drivers::net::NetworkDevice& device, uint32_t address, uint32_t netmask, uint32_t gateway);
+
+			/* Takes every frame the device receives from now on (so they don't go to
+			 * readers of its file), and announces the interface's address. */
+			void up();
+
+			drivers::net::NetworkDevice& device() const { return _device; }
+			const uint8_t *mac() const { return _mac; }
+			uint32_t address() const { return _address; }
+			uint32_t netmask() const { return _netmask; }
+			uint32_t gateway() const { return _gateway; }
+
+			/* Whether a packet sent to the address is for this interface: its own, or a
+			 * broadcast. */
+			bool accepts(uint32_t destination) const;
+
+			/* Sends an IPv4 packet, whose header is at its data, to the next host on the
+			 * way to 'destination': the destination itself if it is on the subnet, or
+			 * else the gateway.  If that host's hardware address isn't known yet, it is
+			 * asked for, and the packet is held until it is.  The interface has the
+			 * packet's reference, whatever happens to it. */
+			bool transmit_ipv4(uint32_t destination, mm::PacketBuffer *packet);
+
+		private:
+			static const unsigned int RX_BUDGET = 64;
+
+			static const unsigned int ARP_CACHE_SIZE = 16;
+			static const unsigned int ARP_MAX_PENDING = 4;
+
+			struct ArpEntry
+			{
+				uint32_t address;				// Zero if the entry isn't used.
+				uint8_t mac[6];
+				bool resolved;
+				mm::PacketBuffer *pending;		// Waiting for 'mac', through 'next_packet'.
+				unsigned int nr_pending;
+			};
+
+			drivers::net::NetworkDevice& _device;
+			uint8_t _mac[6];
+			uint32_t _address, _netmask, _gateway;
+
+			kernel::WorkItem _poll;
+
+			ArpEntry _arp_cache[ARP_CACHE_SIZE];
+			unsigned int _arp_victim;		// The entry replaced next, when the cache is full.
+			util::Mutex _arp_lock;
+
+			bool transmit(const uint8_t *destination, uint16_t type, mm::PacketBuffer *packet);
+
+			void poll();
+			void receive_frame(mm::PacketBuffer *frame);
+
+			void receive_arp(mm::PacketBuffer *packet);
+			void send_arp(uint16_t operation, const uint8_t *target_mac, uint32_t target_address);
+			ArpEntry *arp_lookup(uint32_t address);
+			ArpEntry *arp_insert(uint32_t address);
+
+			static void receive_notifier(drivers::net::NetworkDevice& device, void *priv);
+			static void poll_work(void *arg);
+		};
+	}
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/net/net.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/net/udp.h>
+#include <infos/net/tcp.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class ComponentLog;
+		class DeviceManager;
+		class WorkQueue;
+	}
+
+	namespace mm
+	{
+		struct PacketBuffer;
+	}
+
+	namespace net
+	{
+		class Interface;
+
+		extern kernel::ComponentLog net_log;
+
+		/* The workers that poll the interfaces. */
+		kernel::WorkQueue& net_workqueue();
+
+		/* Parses a.b.c.d, and a /nn prefix length after it if 'prefix' is given. */
+		bool parse_ipv4(const char *value, uint32_t& address, unsigned int *prefix);
+
+		/* The protocol stack: IPv4 on one interface, with ICMP echo, UDP and TCP.  It is only
+		 * brought up if the interface is given an address, with net.ip=a.b.c.d/nn, and
+		 * optionally net.gateway=a.b.c.d, and net.dev=<device> (the first network
+		 * device otherwise).  There is no forwarding, and IPv4 fragments are dropped,
+		 * so nothing bigger than the MTU is sent, apart from TCP segments for a device
+		 * to cut up (TSO). */
+		class NetworkStack
+		{
+		public:
+			NetworkStack() : _interface(NULL), _next_id(0) { }
+
+			/* Starts the workers, and brings up the interface in the background, once
+			 * the network devices have been probed. */
+			bool init(kernel::DeviceManager& dm);
+
+			/* NULL until the interface is up. */
+			Interface *interface() const { return __atomic_load_n(&_interface, __ATOMIC_ACQUIRE); }
+
+			Udp& udp() { return _udp; }
+			Tcp& tcp() { return _tcp; }
+
+			/* Passes up a packet, whose data is its IPv4 header.  Takes the packet's
+			 * reference. */
+			void receive_ipv4(Interface& iface, mm::PacketBuffer *packet);
+
+			/* Puts an IPv4 header in front of the packet, and sends it.  Takes the
+			 * packet's reference. */
+			bool send_ipv4(uint32_t destination, uint8_t protocol, mm::PacketBuffer *packet);
+
+		private:
+			Interface *_interface;
+			uint16_t _next_id;
+			Udp _udp;
+			Tcp _tcp;
+
+			void receive_icmp(uint32_t source, uint32_t destination, mm::PacketBuffer *packet);
+
+			static bool bring_up(void *arg);
+		};
+
+		extern NetworkStack netstack;
+	}
+}
@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/net/protocols.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		struct PacketBuffer;
+	}
+
+	namespace net
+	{
+		/* Headers are in network byte order, and addresses and ports are kept in host
+		 * byte order everywhere else. */
+		static inline uint16_t htons(uint16_t v) { return __builtin_bswap16(v); }
+		static inline uint16_t ntohs(uint16_t v) { return __builtin_bswap16(v); }
+		static inline uint32_t htonl(uint32_t v) { return __builtin_bswap32(v); }
+		static inline uint32_t ntohl(uint32_t v) { return __builtin_bswap32(v); }
+
+		#define IPV4_ADDR(a, b, c, d)	(((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+		#define IPV4_BROADCAST			0xffffffffu
+
+		struct EthernetHeader
+		{
+			uint8_t destination[6];
+			uint8_t source[6];
+			uint16_t type;
+		} __packed;
+
+		#define ETH_TYPE_IPV4			0x0800
+		#define ETH_TYPE_ARP			0x0806
+
+		// Short frames are padded to this (without the FCS).
+		#define ETH_MIN_FRAME_SIZE		60
+
+		#define ETH_MTU					1500
+
+		struct ArpPacket
+		{
+			uint16_t hardware_type;
+			uint16_t protocol_type;
+			uint8_t hardware_length;
+			uint8_t protocol_length;
+			uint16_t operation;
+			uint8_t sender_mac[6];
+			uint32_t sender_address;
+			uint8_t target_mac[6];
+			uint32_t target_address;
+		} __packed;
+
+		#define ARP_HW_ETHERNET			1
+		#define ARP_OP_REQUEST			1
+		#define ARP_OP_REPLY			2
+
+		struct IPv4Header
+		{
+			uint8_t version_ihl;
+			uint8_t tos;
+			uint16_t total_length;
+			uint16_t id;
+			uint16_t fragment;
+			uint8_t ttl;
+			uint8_t protocol;
+			uint16_t checksum;
+			uint32_t source;
+			uint32_t destination;
+		} __packed;
+
+		#define IPV4_FRAG_DF			0x4000
+		#define IPV4_FRAG_MF			0x2000
+		#define IPV4_FRAG_OFFSET		0x1fff
+
+		#define IPV4_DEFAULT_TTL		64
+
+		#define IP_PROTO_ICMP			1
+		#define IP_PROTO_TCP			6
+		#define IP_PROTO_UDP			17
+
+		struct IcmpHeader
+		{
+			uint8_t type;
+			uint8_t code;
+			uint16_t checksum;
+			uint16_t id;
+			uint16_t sequence;
+		} __packed;
+
+		#define ICMP_ECHO_REPLY			0
+		#define ICMP_ECHO_REQUEST		8
+
+		struct UdpHeader
+		{
+			uint16_t source_port;
+			uint16_t destination_port;
+			uint16_t length;
+			uint16_t checksum;
+		} __packed;
+
+		struct TcpHeader
+		{
+			uint16_t source_port;
+			uint16_t destination_port;
+			uint32_t sequence;
+			uint32_t ack;
+			uint8_t data_offset;		// The header's length, in words, in the top half.
+			uint8_t flags;
+			uint16_t window;
+			uint16_t checksum;
+			uint16_t urgent;
+		} __packed;
+
+		#define TCP_FIN					(1u << 0)
+		#define TCP_SYN					(1u << 1)
+		#define TCP_RST					(1u << 2)
+		#define TCP_PSH					(1u << 3)
+		#define TCP_ACK					(1u << 4)
+
+		#define TCP_OPT_END				0
+		#define TCP_OPT_NOP				1
+		#define TCP_OPT_MSS				2
+		#define TCP_OPT_WINDOW_SCALE	3
+		#define TCP_OPT_SACK_PERMITTED	4
+		#define TCP_OPT_SACK			5
+
+		// The most the options can take, after the 20 bytes that are always there.
+		#define TCP_MAX_OPTIONS			40
+
+		/* The Internet checksum.  checksum_add() adds bytes to a running sum, which can
+		 * be carried on from one call to the next (e.g. over a pseudo-header, and then
+		 * each buffer of a packet), with 'odd' saying whether a byte is left over from
+		 * the last.  checksum_fold() gives the checksum of the sum, in host byte
+		 * order, which is zero if the bytes summed already held their checksum. */
+		uint32_t checksum_add(uint32_t sum, const void *data, size_t size, bool& odd);
+		uint16_t checksum_fold(uint32_t sum);
+
+		/* The sum of 'size' bytes of a packet, from 'offset'. */
+		uint32_t checksum_packet(uint32_t sum, const mm::PacketBuffer *packet, size_t offset, size_t size);
+
+		/* The sum of the pseudo-header that the UDP and TCP checksums cover. */
+		uint32_t checksum_pseudo_header(uint32_t source, uint32_t destination, uint8_t protocol, uint16_t length);
+
+		/* Cuts the packet short, to 'length' bytes, e.g. to drop an Ethernet frame's
+		 * padding, and releases the buffers that are left empty. */
+		void trim_packet(mm::PacketBuffer *packet, size_t length);
+	}
+}
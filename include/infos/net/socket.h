@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/net/socket.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/fs/file.h>
+
+namespace infos
+{
+	namespace net
+	{
+		namespace SocketType
+		{
+			enum SocketType
+			{
+				DATAGRAM = 1,		// UDP
+				STREAM = 2,			// TCP
+			};
+		}
+
+		/* An address and port, as user programs give them to bind() and connect(), in
+		 * host byte order. */
+		struct SocketAddress
+		{
+			uint32_t address;
+			uint16_t port;
+			uint16_t reserved;
+		};
+
+		/* A socket is a file: a read receives, and a write sends.  bind(), connect(),
+		 * listen() and accept() are system calls of their own. */
+		class Socket : public fs::File
+		{
+		public:
+			/* Makes a socket of the type, or returns NULL if there is no such type. */
+			static Socket *create(unsigned int type);
+
+			Socket *as_socket() override { return this; }
+
+			/* Gives the socket a local address and port.  A port of zero picks one
+			 * that is free. */
+			virtual bool bind(const SocketAddress& local) = 0;
+
+			/* Sets where the socket's writes go (and, for a datagram socket, the only
+			 * peer it receives from), binding it first if it isn't bound. */
+			virtual bool connect(const SocketAddress& remote) = 0;
+
+			/* Makes a bound stream socket take connections, with up to 'backlog' of
+			 * them waiting to be accepted. */
+			virtual bool listen(unsigned int backlog) { return false; }
+
+			/* Returns the next connection a listening socket has taken, waiting for
+			 * one unless the socket is nonblocking, or NULL. */
+			virtual Socket *accept() { return NULL; }
+		};
+	}
+}
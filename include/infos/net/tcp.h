@@ -0,0 +1,300 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/net/tcp.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/net/socket.h>
+#include <infos/kernel/timer-wheel.h>
+#include <infos/kernel/workqueue.h>
+#include <infos/util/hash-map.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		struct PacketBuffer;
+	}
+
+	namespace net
+	{
+		namespace TcpState
+		{
+			enum TcpState
+			{
+				CLOSED,
+				LISTEN,
+				SYN_SENT,
+				SYN_RECEIVED,
+				ESTABLISHED,
+				FIN_WAIT_1,
+				FIN_WAIT_2,
+				CLOSING,
+				TIME_WAIT,
+				CLOSE_WAIT,
+				LAST_ACK,
+			};
+		}
+
+		/* A range of sequence numbers, from 'start', up to (but not including) 'end'. */
+		struct TcpRange
+		{
+			uint32_t start, end;
+		};
+
+		/* What the stack found in a received segment, for the socket it is for. */
+		struct TcpSegment
+		{
+			static const unsigned int MAX_SACK_BLOCKS = 4;
+
+			uint32_t source;
+			uint16_t source_port, destination_port;
+
+			uint32_t sequence, ack;
+			uint8_t flags;
+			uint16_t window;			// As it is in the header, without the scale applied.
+
+			// Options, which are only looked at on a SYN (apart from SACK blocks).
+			uint16_t mss;				// Zero if there wasn't one.
+			int window_scale;			// -1 if there wasn't one.
+			bool sack_permitted;
+
+			TcpRange sack[MAX_SACK_BLOCKS];
+			unsigned int nr_sack;
+
+			size_t length;				// Of the data.
+		};
+
+		/* CUBIC congestion control (RFC 8312), which grows the window as a cubic
+		 * function of the time since the last loss, centred on the window at which
+		 * that loss happened, so that it probes quickly when far from it, and gently
+		 * near it.  It is never slower than standard (Reno) TCP would be.  Windows are
+		 * in bytes, and times in ms. */
+		class TcpCubic
+		{
+		public:
+			void init(uint32_t mss);
+
+			uint32_t cwnd() const { return _cwnd; }
+			uint32_t ssthresh() const { return _ssthresh; }
+
+			/* Called when 'acked' new bytes are acknowledged, outside loss recovery. */
+			void on_ack(uint32_t acked, uint64_t now, uint64_t srtt);
+
+			/* Called on entering fast recovery. */
+			void on_loss();
+
+			/* Called once recovery is over. */
+			void on_recovered() { _cwnd = _ssthresh; }
+
+			/* Called when the retransmission timer expires. */
+			void on_timeout();
+
+		private:
+			uint32_t _mss;
+			uint32_t _cwnd, _ssthresh;
+
+			uint32_t _w_max;			// The window when the last loss happened.
+			uint32_t _origin;			// Where the cubic function is centred.
+			uint64_t _k;				// How long it takes to grow back to '_origin'.
+			uint64_t _epoch_start;		// When growth started, or zero if it hasn't.
+			uint32_t _w_est;			// What Reno's window would be.
+
+			// What is left over from growing the windows by fractions of a byte.
+			uint64_t _est_acc, _cwnd_acc;
+		};
+
+		/* A TCP socket, which is a listener, or one end of a connection.
+		 *
+		 * Data is sent from a ring buffer, which holds what hasn't been acknowledged
+		 * yet: segments are built from it when they are sent, and built again when
+		 * they are retransmitted.  Received data goes into another ring, at its place
+		 * in the stream, so data that arrives out of order is kept, and reported in
+		 * SACK blocks, until the gap before it is filled.
+		 *
+		 * Windows are scaled (RFC 7323), the receiver ACKs every second segment, or
+		 * after TCP_DELAYED_ACK_NS otherwise, and lost segments are found with
+		 * duplicate ACKs and SACK, and retransmitted hole by hole (RFC 6675, in
+		 * outline), or when the retransmission timer (RFC 6298), on the timer wheel,
+		 * expires.  If the device does TSO, segments of up to tso_max_size() bytes
+		 * are handed to it to be cut up.
+		 *
+		 * Everything is guarded by the socket's mutex.  Timers only queue the
+		 * socket's work on the network workers, which deal with them. */
+		class TcpSocket : public Socket
+		{
+			friend class Tcp;
+
+		public:
+			TcpSocket();
+
+			int read(void *buffer, size_t size) override;
+			int write(const void *buffer, size_t size) override;
+
+			unsigned int poll() override;
+			const void *poll_source() const override { return this; }
+			void set_nonblocking(bool nonblocking) override { _nonblocking = nonblocking; }
+
+			void close() override;
+
+			bool bind(const SocketAddress& local) override;
+			bool connect(const SocketAddress& remote) override;
+			bool listen(unsigned int backlog) override;
+			Socket *accept() override;
+
+		private:
+			static const size_t BUFFER_SIZE = 0x20000;
+			static const unsigned int WINDOW_SCALE = 2;		// So that the window reaches BUFFER_SIZE.
+			static const unsigned int MAX_OOO_RANGES = 4;
+			static const unsigned int MAX_SCOREBOARD = 4;
+
+			TcpState::TcpState _state;
+			bool _nonblocking;
+			bool _error;					// The connection was reset, or timed out.
+			bool _bound;					// The local port is ours (not a listener's).
+
+			uint16_t _local_port;
+			uint32_t _remote_address;
+			uint16_t _remote_port;
+
+			// The send side.
+			uint32_t _iss, _snd_una, _snd_nxt, _snd_max;
+			uint32_t _snd_wnd, _snd_wl1, _snd_wl2;
+			unsigned int _snd_wscale;
+			uint32_t _mss;
+			bool _fin_queued;				// FIN goes after the data in the ring.
+
+			uint8_t *_snd_buf;				// Unacknowledged data, from '_snd_seq'.
+			size_t _snd_head, _snd_len;
+			uint32_t _snd_seq;
+
+			// What has been SACKed above '_snd_una'.
+			TcpRange _scoreboard[MAX_SCOREBOARD];
+			unsigned int _nr_scoreboard;
+
+			// Loss recovery.
+			unsigned int _dupacks;
+			bool _recovery;
+			uint32_t _recover;				// Recovery is over once this is ACKed.
+			uint32_t _rexmit_next;			// The next hole to retransmit from.
+			TcpCubic _cc;
+
+			// Round-trip time, timed a segment at a time, with Karn's algorithm.
+			bool _rtt_timing;
+			uint32_t _rtt_seq;
+			uint64_t _rtt_start;
+			uint64_t _srtt, _rttvar, _rto;	// In ns.
+			unsigned int _retries;
+
+			// The receive side.
+			uint32_t _irs, _rcv_nxt;
+			uint32_t _rcv_adv;				// The right edge of the window last advertised.
+			unsigned int _rcv_wscale;
+			bool _sack_ok;
+			bool _fin_received;
+
+			uint8_t *_rcv_buf;				// Received data, up to '_rcv_nxt', then out-of-order data.
+			size_t _rcv_head, _rcv_len;
+			TcpRange _ooo[MAX_OOO_RANGES];	// Most recent first.
+			unsigned int _nr_ooo;
+			unsigned int _ack_pending;		// Segments received without being ACKed.
+
+			// Timers, as deadlines in ns of runtime, or zero.
+			uint64_t _rto_deadline, _delack_deadline, _timewait_deadline;
+			kernel::Timer _timer;
+			kernel::WorkItem _timer_work;
+
+			// Listening, and being accepted.
+			TcpSocket *_parent;
+			TcpSocket *_accept_head, *_accept_tail, *_accept_next;
+			unsigned int _backlog, _nr_children;
+
+			util::Mutex _lock;
+			util::ConditionVariable _readers, _writers, _state_change;
+
+			bool allocate_buffers();
+			uint64_t connection_key() const;
+			bool synchronized() const;
+			void set_state(TcpState::TcpState state);
+			void fail();
+			void finish();
+			void enter_time_wait();
+
+			void segment_arrived(const TcpSegment& segment, const mm::PacketBuffer *data);
+			void syn_arrived(const TcpSegment& segment);
+			void syn_sent_arrived(const TcpSegment& segment);
+			void negotiate(const TcpSegment& segment);
+			bool acceptable(const TcpSegment& segment) const;
+			bool process_ack(const TcpSegment& segment);
+			void merge_sack(const TcpSegment& segment);
+			void trim_scoreboard();
+			void receive_data(const TcpSegment& segment, const mm::PacketBuffer *data);
+			void established();
+
+			uint32_t data_end() const { return _snd_seq + _snd_len; }
+			bool fin_acked() const { return _fin_queued && _snd_una == data_end() + 1; }
+			uint32_t sacked_bytes() const;
+			uint32_t segment_size() const;
+
+			void output();
+			void enter_recovery();
+			void retransmit_hole();
+			void retransmission_timeout();
+			bool send_segment(uint32_t seq, size_t length, uint8_t flags);
+			void send_ack();
+			void schedule_ack();
+
+			void sample_rtt(uint64_t now);
+			void arm_rto();
+			void arm_timer();
+			void run_timers();
+
+			static void timer_fn(kernel::Timer& timer, void *arg);
+			static void timer_work(void *arg);
+		};
+
+		/* The TCP ports, and the listeners and connections on them. */
+		class Tcp
+		{
+		public:
+			Tcp() : _next_ephemeral(EPHEMERAL_FIRST) { }
+
+			/* Claims the port, or a free one if it is zero, and sets 'port' to the one
+			 * it has. */
+			bool bind(uint16_t& port);
+			void unbind(uint16_t port);
+
+			bool add_listener(TcpSocket& socket);
+			void remove_listener(uint16_t port);
+
+			bool add_connection(TcpSocket& socket);
+			void remove_connection(uint64_t key);
+
+			/* Passes a segment, whose data is its TCP header, to the connection or
+			 * listener it is for, or answers it with a reset.  Takes the packet's
+			 * reference. */
+			void receive(uint32_t source, uint32_t destination, mm::PacketBuffer *packet);
+
+			/* Resets whatever sent a segment there isn't a connection for. */
+			static void send_reset(const TcpSegment& segment);
+
+		private:
+			static const uint16_t EPHEMERAL_FIRST = 49152;
+
+			util::HashMap<uint16_t, bool> _bound;
+			util::HashMap<uint16_t, TcpSocket *> _listeners;
+			util::HashMap<uint64_t, TcpSocket *> _connections;
+			uint16_t _next_ephemeral;
+			util::Mutex _lock;
+
+			static bool parse(uint32_t source, uint32_t destination, mm::PacketBuffer *packet, TcpSegment& segment);
+		};
+	}
+}
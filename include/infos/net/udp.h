@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/net/udp.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/net/socket.h>
+#include <infos/util/hash-map.h>
+#include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		struct PacketBuffer;
+	}
+
+	namespace net
+	{
+		/* A UDP socket.  A read returns the next datagram, cut short if it doesn't fit,
+		 * and a write sends one to the connected peer.  Datagrams are queued in the
+		 * buffers they arrived in, and dropped once MAX_QUEUED are waiting. */
+		class UdpSocket : public Socket
+		{
+		public:
+			UdpSocket();
+
+			int read(void *buffer, size_t size) override;
+			int write(const void *buffer, size_t size) override;
+
+			unsigned int poll() override;
+			const void *poll_source() const override { return this; }
+			void set_nonblocking(bool nonblocking) override { _nonblocking = nonblocking; }
+
+			void close() override;
+
+			bool bind(const SocketAddress& local) override;
+			bool connect(const SocketAddress& remote) override;
+
+			/* Called by the stack with a datagram for the socket, whose data is the
+			 * payload.  The socket has the packet's reference. */
+			void deliver(mm::PacketBuffer *datagram, uint32_t source, uint16_t source_port);
+
+		private:
+			static const unsigned int MAX_QUEUED = 64;
+
+			uint16_t _local_port;
+			uint32_t _remote_address;
+			uint16_t _remote_port;
+			bool _nonblocking;
+
+			// Guarded by the lock of '_readers', on which readers sleep.
+			mm::PacketBuffer *_queue_head, *_queue_tail;	// Through 'next_packet'.
+			unsigned int _nr_queued;
+			bool _closed;
+			util::WakeQueue _readers;
+		};
+
+		/* The UDP ports, and the sockets bound to them. */
+		class Udp
+		{
+		public:
+			Udp() : _next_ephemeral(EPHEMERAL_FIRST) { }
+
+			/* Binds the socket to the port, or to a free one if it is zero, and sets
+			 * 'port' to the one it has. */
+			bool bind(UdpSocket& socket, uint16_t& port);
+			void unbind(uint16_t port);
+
+			/* Passes a datagram, whose data is its UDP header, to the socket bound to
+			 * its port.  Takes the packet's reference. */
+			void receive(uint32_t source, uint32_t destination, mm::PacketBuffer *packet);
+
+		private:
+			static const uint16_t EPHEMERAL_FIRST = 49152;
+
+			util::HashMap<uint16_t, UdpSocket *> _ports;
+			uint16_t _next_ephemeral;
+			util::Mutex _lock;
+		};
+	}
+}
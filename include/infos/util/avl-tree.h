@@ -0,0 +1,261 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/util/avl-tree.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace util
+	{
+		/* The links of an element in an AVLTree, kept in the element itself. */
+		template<typename T>
+		struct AVLTreeNode
+		{
+			AVLTreeNode() : left(NULL), right(NULL), height(0) { }
+
+			T *left, *right;
+			int height;
+		};
+
+		/* A balanced binary search tree of elements that each have an AVLTreeNode.
+		 * Nothing is allocated to add an element, and adding and removing are
+		 * O(log n).  The tree doesn't own its elements: they must be removed (or the
+		 * tree cleared) before they are freed.
+		 *
+		 * The traits say where an element's node is, how elements are ordered, and
+		 * what else a node keeps about its subtree:
+		 *
+		 *   static AVLTreeNode<T>& node(T *elem);
+		 *   static bool before(const T *a, const T *b);
+		 *   static void update(T *elem);
+		 *
+		 * 'before' must be a strict order, with no two elements in the tree equal, and
+		 * an element's place in it mustn't change while the element is in the tree.
+		 * 'update' is called whenever an element's children change, after theirs, so
+		 * that an element can keep e.g. the largest of something in its subtree. */
+		template<typename T, typename Traits>
+		class AVLTree
+		{
+		public:
+			typedef AVLTree<T, Traits> Self;
+
+			AVLTree() : _root(NULL), _count(0) { }
+
+			AVLTree(const Self&) = delete;
+			Self& operator=(const Self&) = delete;
+
+			/* The root, and the children of an element, for searches that the ordering
+			 * alone can't do. */
+			T *root() const { return _root; }
+			static T *left(T *elem) { return Traits::node(elem).left; }
+			static T *right(T *elem) { return Traits::node(elem).right; }
+
+			T *first() const
+			{
+				T *e = _root;
+				while (e && left(e)) e = left(e);
+				return e;
+			}
+
+			T *last() const
+			{
+				T *e = _root;
+				while (e && right(e)) e = right(e);
+				return e;
+			}
+
+			void insert(T& elem)
+			{
+				AVLTreeNode<T>& n = Traits::node(&elem);
+				n.left = NULL;
+				n.right = NULL;
+				n.height = 1;
+				Traits::update(&elem);
+
+				_root = insert(_root, &elem);
+				_count++;
+			}
+
+			/* Removes an element, which must be in the tree. */
+			void remove(T& elem)
+			{
+				_root = remove(_root, &elem);
+				_count--;
+			}
+
+			/* Empties the tree, passing each element (children first) to 'dispose',
+			 * which may free it. */
+			template<typename F>
+			void clear(F dispose)
+			{
+				destroy(_root, dispose);
+				_root = NULL;
+				_count = 0;
+			}
+
+			/* Fills an empty tree with copies of another's elements, made by 'copy',
+			 * which is given an element and returns a new one.  The copy has the same
+			 * shape, so takes O(n). */
+			template<typename F>
+			void copy_from(const Self& other, F copy)
+			{
+				assert(!_root);
+
+				_root = clone(other._root, copy);
+				_count = other._count;
+			}
+
+			unsigned int count() const { return _count; }
+			bool empty() const { return _root == NULL; }
+
+		private:
+			T *_root;
+			unsigned int _count;
+
+			static int height(T *e) { return e ? Traits::node(e).height : 0; }
+
+			static void fix(T *e)
+			{
+				int lh = height(left(e)), rh = height(right(e));
+				Traits::node(e).height = 1 + (lh > rh ? lh : rh);
+
+				Traits::update(e);
+			}
+
+			static T *rotate_right(T *e)
+			{
+				T *pivot = left(e);
+				Traits::node(e).left = right(pivot);
+				Traits::node(pivot).right = e;
+
+				fix(e);
+				fix(pivot);
+				return pivot;
+			}
+
+			static T *rotate_left(T *e)
+			{
+				T *pivot = right(e);
+				Traits::node(e).right = left(pivot);
+				Traits::node(pivot).left = e;
+
+				fix(e);
+				fix(pivot);
+				return pivot;
+			}
+
+			static T *rebalance(T *e)
+			{
+				fix(e);
+
+				AVLTreeNode<T>& n = Traits::node(e);
+				int balance = height(n.left) - height(n.right);
+				if (balance > 1) {
+					if (height(left(n.left)) < height(right(n.left))) {
+						n.left = rotate_left(n.left);
+					}
+
+					return rotate_right(e);
+				} else if (balance < -1) {
+					if (height(right(n.right)) < height(left(n.right))) {
+						n.right = rotate_right(n.right);
+					}
+
+					return rotate_left(e);
+				}
+
+				return e;
+			}
+
+			static T *insert(T *e, T *nw)
+			{
+				if (!e) return nw;
+
+				AVLTreeNode<T>& n = Traits::node(e);
+				if (Traits::before(nw, e)) {
+					n.left = insert(n.left, nw);
+				} else {
+					assert(Traits::before(e, nw));
+					n.right = insert(n.right, nw);
+				}
+
+				return rebalance(e);
+			}
+
+			static T *remove_lowest(T *e, T *& lowest)
+			{
+				AVLTreeNode<T>& n = Traits::node(e);
+				if (!n.left) {
+					lowest = e;
+					return n.right;
+				}
+
+				n.left = remove_lowest(n.left, lowest);
+				return rebalance(e);
+			}
+
+			static T *remove(T *e, T *target)
+			{
+				assert(e);
+
+				AVLTreeNode<T>& n = Traits::node(e);
+				if (e == target) {
+					T *l = n.left, *r = n.right;
+					n.left = NULL;
+					n.right = NULL;
+
+					if (!r) return l;
+
+					// Replace the element with its in-order successor.
+					T *successor;
+					r = remove_lowest(r, successor);
+
+					Traits::node(successor).left = l;
+					Traits::node(successor).right = r;
+					return rebalance(successor);
+				}
+
+				if (Traits::before(target, e)) {
+					n.left = remove(n.left, target);
+				} else {
+					n.right = remove(n.right, target);
+				}
+
+				return rebalance(e);
+			}
+
+			template<typename F>
+			static void destroy(T *e, F& dispose)
+			{
+				if (!e) return;
+
+				destroy(left(e), dispose);
+				destroy(right(e), dispose);
+				dispose(e);
+			}
+
+			template<typename F>
+			static T *clone(T *e, F& copy)
+			{
+				if (!e) return NULL;
+
+				T *c = copy(e);
+				AVLTreeNode<T>& n = Traits::node(c);
+				n.left = clone(left(e), copy);
+				n.right = clone(right(e), copy);
+				n.height = height(e);
+				Traits::update(c);
+				return c;
+			}
+		};
+	}
+}
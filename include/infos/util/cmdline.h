@@ -20,10 +20,17 @@ namespace infos
 		{
 		public:
 			bool parse(const char *cmdline);
+
+			/* Gives the settings on the command line that parse() was given to just the
+			 * registrations in [start, end), e.g. those of a module loaded afterwards. */
+			void apply(const CommandLineArgumentRegistration *start, const CommandLineArgumentRegistration *end);
 			
 		private:
-			void process(const char *setting);
-			const CommandLineArgumentRegistration *find_registration(const char *key);
+			char _cmdline[256];
+
+			void parse_settings(const char *cmdline, const CommandLineArgumentRegistration *start, const CommandLineArgumentRegistration *end);
+			void process(const char *setting, const CommandLineArgumentRegistration *start, const CommandLineArgumentRegistration *end);
+			const CommandLineArgumentRegistration *find_registration(const char *key, const CommandLineArgumentRegistration *start, const CommandLineArgumentRegistration *end);
 		};
 	
 #define RegisterCmdLineArgument(__name, __match) static void __parse##__name(const char *); \
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/define.h>
+
+/* The compiler's coroutine support (-fcoroutines) looks for these, by these names, in
+ * namespace std.  The kernel has no standard library, so they are defined here, and
+ * nowhere else: only what the compiler needs, and the kernel's tasks use (see
+ * kernel/task.h), the way libstdc++ defines them. */
+namespace std
+{
+	template<typename TResult, typename... TArgs>
+	struct coroutine_traits
+	{
+		typedef typename TResult::promise_type promise_type;
+	};
+
+	template<typename TPromise = void>
+	struct coroutine_handle;
+
+	template<>
+	struct coroutine_handle<void>
+	{
+		constexpr coroutine_handle() noexcept : _frame(NULL) { }
+
+		static coroutine_handle from_address(void *frame) noexcept
+		{
+			coroutine_handle h;
+			h._frame = frame;
+			return h;
+		}
+
+		void *address() const noexcept { return _frame; }
+		explicit operator bool() const noexcept { return _frame != NULL; }
+
+		bool done() const noexcept { return __builtin_coro_done(_frame); }
+		void resume() const { __builtin_coro_resume(_frame); }
+		void destroy() const { __builtin_coro_destroy(_frame); }
+		void operator()() const { resume(); }
+
+	protected:
+		void *_frame;
+	};
+
+	template<typename TPromise>
+	struct coroutine_handle : coroutine_handle<void>
+	{
+		static coroutine_handle from_address(void *frame) noexcept
+		{
+			coroutine_handle h;
+			h._frame = frame;
+			return h;
+		}
+
+		static coroutine_handle from_promise(TPromise& promise) noexcept
+		{
+			return from_address(__builtin_coro_promise((char *)&promise, __alignof(TPromise), true));
+		}
+
+		TPromise& promise() const { return *(TPromise *)__builtin_coro_promise(_frame, __alignof(TPromise), false); }
+	};
+
+	/* A coroutine that does nothing when resumed, for a symmetric transfer that has
+	 * nowhere to go.  Its frame is laid out as the compiler lays out a coroutine's:
+	 * the resume function, then the destroy function. */
+	struct noop_coroutine_frame
+	{
+		static void nothing() { }
+
+		void (*resume)() = nothing;
+		void (*destroy)() = nothing;
+	};
+
+	inline noop_coroutine_frame noop_frame;
+
+	inline coroutine_handle<> noop_coroutine() noexcept
+	{
+		return coroutine_handle<>::from_address(&noop_frame);
+	}
+
+	struct suspend_always
+	{
+		constexpr bool await_ready() const noexcept { return false; }
+		constexpr void await_suspend(coroutine_handle<>) const noexcept { }
+		constexpr void await_resume() const noexcept { }
+	};
+
+	struct suspend_never
+	{
+		constexpr bool await_ready() const noexcept { return true; }
+		constexpr void await_suspend(coroutine_handle<>) const noexcept { }
+		constexpr void await_resume() const noexcept { }
+	};
+}
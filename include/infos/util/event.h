@@ -9,12 +9,17 @@ namespace infos
 {
 	namespace util
 	{
+		/* Wakes every thread waiting on it when triggered.  A waiter that must not miss
+		 * a trigger checks what it is waiting for, and sleeps, with sleep_locked() under
+		 * the wake queue's lock: trigger() takes the lock too. */
 		class Event
 		{
 		public:
 			void trigger();
 			void wait();
 
+			WakeQueue& wakequeue() { return _wakequeue; }
+
 		private:
 			WakeQueue _wakequeue;
 		};
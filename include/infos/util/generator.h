@@ -1,75 +1,162 @@
 /* SPDX-License-Identifier: MIT */
 #pragma once
 
-#include <infos/util/list.h>
+#include <infos/util/support.h>
 
 namespace infos
 {
 	namespace util
 	{
-		template<typename TElem>
-		struct GeneratorIterator
+		/* Lazy views over anything that can be iterated with begin() and end(), e.g.
+		 *
+		 *   for (auto dev : take(filter(devices, is_disk), 4)) ...
+		 *
+		 * Nothing is copied or allocated: each element is looked at as the loop reaches
+		 * it.  A view keeps a reference to a container it is given, so it mustn't outlive
+		 * it, but keeps its own copy of a view (or other temporary) it is given, so views
+		 * can be stacked in one expression.  Predicates and functions are anything that
+		 * can be called, e.g. lambdas, and are inlined into the loop. */
+
+		template<typename T>
+		T&& Declval();
+
+		template<typename TRange>
+		struct RangeTraits
+		{
+			typedef typename RemoveReference<TRange>::type Range;
+			typedef decltype(Declval<Range&>().begin()) Iterator;
+			typedef decltype(*Declval<const Iterator&>()) Elem;
+		};
+
+		template<typename TRange, typename TPred>
+		class FilterView
 		{
-			typedef TElem Elem;
-			typedef const TElem ConstElem;
-			typedef List<Elem> ListType;
-			typedef bool (*Callback)(ConstElem& elem);
-
-			typedef GeneratorIterator<Elem> Self;
-			typedef typename ListType::Iterator ListTypeIterator;
-			
-			GeneratorIterator(ListTypeIterator iter, Callback cb) : _iter(iter), _cb(cb) { }
-			
-			Elem& operator*() const {
-				return *_iter;
-			}
-			
-			void operator++() {
-				do {
-					++_iter;
-				} while (!_cb(*_iter));
-			}
-			
-			bool operator==(const Self other) const {
-				return _iter == other._iter;
-			}
-		
-			bool operator!=(const Self other) const {
-				return _iter != other._iter;
-			}
-		
+		public:
+			typedef typename RangeTraits<TRange>::Iterator BaseIterator;
+			typedef typename RangeTraits<TRange>::Elem Elem;
+
+			class Iterator
+			{
+			public:
+				Iterator(BaseIterator iter, BaseIterator end, const TPred& pred) : _iter(iter), _end(end), _pred(pred) { skip(); }
+
+				Elem operator*() const { return *_iter; }
+				void operator++() { ++_iter; skip(); }
+
+				bool operator==(const Iterator& other) const { return _iter == other._iter; }
+				bool operator!=(const Iterator& other) const { return _iter != other._iter; }
+
+			private:
+				BaseIterator _iter, _end;
+				const TPred& _pred;
+
+				// Never looks past the end, so a view with no matches is just empty.
+				void skip() { while (_iter != _end && !_pred(*_iter)) ++_iter; }
+			};
+
+			FilterView(TRange&& range, TPred pred) : _range(static_cast<TRange&&>(range)), _pred(pred) { }
+
+			Iterator begin() const { return Iterator(range().begin(), range().end(), _pred); }
+			Iterator end() const { return Iterator(range().end(), range().end(), _pred); }
+
 		private:
-			ListTypeIterator _iter;
-			Callback _cb;
+			TRange _range;
+			TPred _pred;
+
+			typename RangeTraits<TRange>::Range& range() const { return const_cast<typename RangeTraits<TRange>::Range&>(_range); }
 		};
-		
-		template<typename TElem>
-		class Generator
+
+		template<typename TRange, typename TFn>
+		class MapView
 		{
 		public:
-			typedef GeneratorIterator<TElem> Iterator;
-			typedef typename Iterator::ListType ListType;
-			typedef typename Iterator::Callback Callback;
-			typedef typename ListType::Iterator ListTypeIterator;
-			
-			Generator(ListType list, Callback cb) : _list(list), _cb(cb) { }
-						
-			Iterator begin()
+			typedef typename RangeTraits<TRange>::Iterator BaseIterator;
+			typedef decltype(Declval<const TFn&>()(*Declval<const BaseIterator&>())) Elem;
+
+			class Iterator
 			{
-				ListTypeIterator iter = _list.begin();
-				while (!_cb(*iter)) ++iter;
-				
-				return Iterator(iter, _cb);
-			}
+			public:
+				Iterator(BaseIterator iter, const TFn& fn) : _iter(iter), _fn(fn) { }
+
+				Elem operator*() const { return _fn(*_iter); }
+				void operator++() { ++_iter; }
+
+				bool operator==(const Iterator& other) const { return _iter == other._iter; }
+				bool operator!=(const Iterator& other) const { return _iter != other._iter; }
+
+			private:
+				BaseIterator _iter;
+				const TFn& _fn;
+			};
+
+			MapView(TRange&& range, TFn fn) : _range(static_cast<TRange&&>(range)), _fn(fn) { }
 
-			Iterator end()
+			Iterator begin() const { return Iterator(range().begin(), _fn); }
+			Iterator end() const { return Iterator(range().end(), _fn); }
+
+		private:
+			TRange _range;
+			TFn _fn;
+
+			typename RangeTraits<TRange>::Range& range() const { return const_cast<typename RangeTraits<TRange>::Range&>(_range); }
+		};
+
+		template<typename TRange>
+		class TakeView
+		{
+		public:
+			typedef typename RangeTraits<TRange>::Iterator BaseIterator;
+			typedef typename RangeTraits<TRange>::Elem Elem;
+
+			/* Only meant to be compared with end(), which it equals once it has taken
+			 * all it may, or reached the end of the range. */
+			class Iterator
 			{
-				return Iterator(_list.end(), _cb);
-			}
-			
+			public:
+				Iterator(BaseIterator iter, unsigned long remaining) : _iter(iter), _remaining(remaining) { }
+
+				Elem operator*() const { return *_iter; }
+				void operator++() { ++_iter; _remaining--; }
+
+				bool operator==(const Iterator& other) const { return !(*this != other); }
+				bool operator!=(const Iterator& other) const { return _remaining && _iter != other._iter; }
+
+			private:
+				BaseIterator _iter;
+				unsigned long _remaining;
+			};
+
+			TakeView(TRange&& range, unsigned long count) : _range(static_cast<TRange&&>(range)), _count(count) { }
+
+			Iterator begin() const { return Iterator(range().begin(), _count); }
+			Iterator end() const { return Iterator(range().end(), 0); }
+
 		private:
-			ListType _list;
-			Callback _cb;
+			TRange _range;
+			unsigned long _count;
+
+			typename RangeTraits<TRange>::Range& range() const { return const_cast<typename RangeTraits<TRange>::Range&>(_range); }
 		};
+
+		/* The elements of the range for which pred(elem) is true. */
+		template<typename TRange, typename TPred>
+		FilterView<TRange, TPred> filter(TRange&& range, TPred pred)
+		{
+			return FilterView<TRange, TPred>(static_cast<TRange&&>(range), pred);
+		}
+
+		/* fn(elem), for each element of the range. */
+		template<typename TRange, typename TFn>
+		MapView<TRange, TFn> map(TRange&& range, TFn fn)
+		{
+			return MapView<TRange, TFn>(static_cast<TRange&&>(range), fn);
+		}
+
+		/* The first 'count' elements of the range, or all of them, if there are fewer. */
+		template<typename TRange>
+		TakeView<TRange> take(TRange&& range, unsigned long count)
+		{
+			return TakeView<TRange>(static_cast<TRange&&>(range), count);
+		}
 	}
 }
@@ -0,0 +1,325 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/util/hash-map.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/string.h>
+
+namespace infos {
+	namespace util {
+
+		/* How a key is turned into a hash for a HashMap.  Integers, enums and pointers
+		 * are used as they are, and are mixed by the map, so they don't need to be
+		 * spread out already. */
+		template<typename T>
+		struct Hash {
+			static uint64_t hash(const T& key) { return (uint64_t)key; }
+		};
+
+		template<typename T>
+		struct Hash<T *> {
+			static uint64_t hash(T *key) { return (uint64_t)(uintptr_t)key; }
+		};
+
+		template<>
+		struct Hash<String> {
+			static uint64_t hash(const String& key) { return key.get_hash(); }
+		};
+
+		/* An associative container for lookups on hot paths.  It is open-addressed, in
+		 * the style of a SwissTable: the slots are split into groups of eight, and each
+		 * slot has a control byte, kept apart from the slots, that says whether it is
+		 * empty, deleted, or full, and if it is full, holds seven bits of its key's hash.
+		 * A probe reads a group's control bytes as one word, and only compares keys in
+		 * the slots whose bits match, so a lookup normally touches one word of control
+		 * bytes and one slot.
+		 *
+		 * There is no allocation per entry, and none at all until the first add.  An
+		 * entry stays in its slot until the table is rehashed, which only happens on
+		 * add or reserve, so iterating is stable across a remove, including a remove of
+		 * the entry the iterator is on.
+		 *
+		 * TKey and TValue must be default-constructible and copyable. */
+		template<typename TKey, typename TValue, typename THash = Hash<TKey>>
+		class HashMap {
+		public:
+			typedef HashMap<TKey, TValue, THash> Self;
+
+			HashMap(const Self&) = delete;
+			HashMap(Self&&) = delete;
+
+			HashMap() : _ctrl(NULL), _slots(NULL), _capacity(0), _count(0), _used(0) { }
+
+			~HashMap() {
+				delete[] _ctrl;
+				delete[] _slots;
+			}
+
+			unsigned int count() const { return _count; }
+			unsigned int capacity() const { return _capacity; }
+			bool empty() const { return _count == 0; }
+
+			/* Adds an entry, or replaces the value of the one with the same key.  Returns
+			 * false, leaving the map as it was, if the table couldn't be grown. */
+			bool add(TKey const& key, TValue const& value) {
+				uint64_t hash = mix(key);
+
+				int slot = find_slot(key, hash);
+				if (slot >= 0) {
+					_slots[slot].value = value;
+					return true;
+				}
+
+				if ((_used + 1) * 8 > _capacity * 7) {
+					// Sized by the entries alone, so if most of what is used is deleted
+					// slots, this rehashes at the same size and just clears them out.
+					if (!rehash(capacity_for(_count * 2 + 1))) return false;
+				}
+
+				insert(key, value, hash);
+				return true;
+			}
+
+			/* Removes the entry with the given key, returning false if there isn't one. */
+			bool remove(TKey const& key) {
+				int slot = find_slot(key, mix(key));
+				if (slot < 0) return false;
+
+				// A group that has never been full can't have been probed past, so the
+				// slot can be emptied outright.  Otherwise it has to stay in the way of
+				// the probes that went through it.
+				if (match_empty(_ctrl[slot / GROUP_SIZE])) {
+					set_ctrl(slot, CTRL_EMPTY);
+					_used--;
+				} else {
+					set_ctrl(slot, CTRL_DELETED);
+				}
+
+				_slots[slot].key = TKey();
+				_slots[slot].value = TValue();
+				_count--;
+
+				return true;
+			}
+
+			/* Makes room for 'nr' entries, so that adding up to that many needn't
+			 * rehash.  Returns false if the table couldn't be allocated. */
+			bool reserve(unsigned int nr) {
+				unsigned int capacity = capacity_for(nr);
+				if (capacity <= _capacity) return true;
+
+				return rehash(capacity);
+			}
+
+			/* Removes every entry, but keeps the table. */
+			void clear() {
+				for (unsigned int i = 0; i < _capacity; i++) {
+					if (is_full(ctrl(i))) {
+						_slots[i].key = TKey();
+						_slots[i].value = TValue();
+					}
+				}
+
+				for (unsigned int i = 0; i < _capacity / GROUP_SIZE; i++) _ctrl[i] = EMPTY_GROUP;
+
+				_count = 0;
+				_used = 0;
+			}
+
+			bool contains_key(TKey const& key) const {
+				return find_slot(key, mix(key)) >= 0;
+			}
+
+			bool try_get_value(TKey const& key, TValue& value) const {
+				int slot = find_slot(key, mix(key));
+				if (slot < 0) return false;
+
+				value = _slots[slot].value;
+				return true;
+			}
+
+			struct Pair {
+				Pair(const TKey& key, const TValue& value) : key(key), value(value) { }
+
+				const TKey& key;
+				const TValue& value;
+			};
+
+			/* Visits the entries in slot order, which is the same each time for as long
+			 * as nothing is added. */
+			class Iterator {
+			public:
+				Iterator(const Self& map, unsigned int index) : _map(map), _index(index) { skip(); }
+
+				const Pair operator*() const { return Pair(_map._slots[_index].key, _map._slots[_index].value); }
+				void operator++() { _index++; skip(); }
+
+				bool operator==(const Iterator& other) const { return _index == other._index; }
+				bool operator!=(const Iterator& other) const { return _index != other._index; }
+
+			private:
+				const Self& _map;
+				unsigned int _index;
+
+				void skip() {
+					while (_index < _map._capacity && !is_full(_map.ctrl(_index))) _index++;
+				}
+			};
+
+			Iterator begin() const { return Iterator(*this, 0); }
+			Iterator end() const { return Iterator(*this, _capacity); }
+
+		private:
+			static constexpr unsigned int GROUP_SIZE = 8;
+
+			// Full slots have the top bit clear, and the hash bits below it.
+			static constexpr uint8_t CTRL_EMPTY = 0x80;
+			static constexpr uint8_t CTRL_DELETED = 0xfe;
+
+			static constexpr uint64_t LSBS = 0x0101010101010101ull;
+			static constexpr uint64_t MSBS = 0x8080808080808080ull;
+			static constexpr uint64_t EMPTY_GROUP = LSBS * CTRL_EMPTY;
+
+			struct Slot {
+				TKey key;
+				TValue value;
+			};
+
+			uint64_t *_ctrl;			// A word of control bytes per group, byte i for slot i.
+			Slot *_slots;
+			unsigned int _capacity;		// A power of two, at least GROUP_SIZE, or zero.
+			unsigned int _count;		// The number of entries.
+			unsigned int _used;			// The number of slots that aren't empty, including deleted ones.
+
+			static bool is_full(uint8_t c) { return !(c & 0x80); }
+
+			/* The slots of a group whose control bytes are 'bits', as a bit at the top of
+			 * each matching byte.  A full byte can match falsely if the one below it does,
+			 * but that only costs a key comparison. */
+			static uint64_t match(uint64_t group, uint8_t bits) {
+				uint64_t x = group ^ (LSBS * bits);
+				return (x - LSBS) & ~x & MSBS;
+			}
+
+			static uint64_t match_empty(uint64_t group) {
+				return group & ~(group << 6) & MSBS;
+			}
+
+			static uint64_t match_empty_or_deleted(uint64_t group) {
+				return group & ~(group << 7) & MSBS;
+			}
+
+			/* The full 64-bit finaliser from MurmurHash3, so that keys that only differ
+			 * in their high bits, e.g. pointers, still spread over the groups. */
+			static uint64_t mix(TKey const& key) {
+				uint64_t h = THash::hash(key);
+
+				h ^= h >> 33;
+				h *= 0xff51afd7ed558ccdull;
+				h ^= h >> 33;
+				h *= 0xc4ceb9fe1a85ec53ull;
+				h ^= h >> 33;
+
+				return h;
+			}
+
+			static uint8_t h2(uint64_t hash) { return hash & 0x7f; }
+			static unsigned int h1(uint64_t hash) { return (unsigned int)(hash >> 7); }
+
+			/* The smallest table that holds 'nr' entries at no more than 7/8 full. */
+			static unsigned int capacity_for(unsigned int nr) {
+				unsigned int capacity = GROUP_SIZE;
+				while (capacity * 7 < nr * 8) capacity *= 2;
+
+				return capacity;
+			}
+
+			uint8_t ctrl(unsigned int slot) const { return ((const uint8_t *)_ctrl)[slot]; }
+			void set_ctrl(unsigned int slot, uint8_t c) { ((uint8_t *)_ctrl)[slot] = c; }
+
+			int find_slot(TKey const& key, uint64_t hash) const {
+				if (!_capacity) return -1;
+
+				unsigned int group_mask = _capacity / GROUP_SIZE - 1;
+
+				// There is always at least one empty slot, so the probe ends.
+				for (unsigned int g = h1(hash) & group_mask;; g = (g + 1) & group_mask) {
+					uint64_t group = _ctrl[g];
+
+					for (uint64_t m = match(group, h2(hash)); m; m &= m - 1) {
+						unsigned int slot = g * GROUP_SIZE + __builtin_ctzll(m) / 8;
+						if (_slots[slot].key == key) return (int)slot;
+					}
+
+					if (match_empty(group)) return -1;
+				}
+			}
+
+			/* Puts a new entry in the first slot on its probe that isn't full.  The key
+			 * must not already be in the table, and there must be room. */
+			void insert(TKey const& key, TValue const& value, uint64_t hash) {
+				unsigned int group_mask = _capacity / GROUP_SIZE - 1;
+
+				for (unsigned int g = h1(hash) & group_mask;; g = (g + 1) & group_mask) {
+					uint64_t m = match_empty_or_deleted(_ctrl[g]);
+					if (!m) continue;
+
+					unsigned int slot = g * GROUP_SIZE + __builtin_ctzll(m) / 8;
+					if (ctrl(slot) == CTRL_EMPTY) _used++;
+
+					set_ctrl(slot, h2(hash));
+					_slots[slot].key = key;
+					_slots[slot].value = value;
+					_count++;
+
+					return;
+				}
+			}
+
+			bool rehash(unsigned int capacity) {
+				uint64_t *new_ctrl = new uint64_t[capacity / GROUP_SIZE];
+				if (!new_ctrl) return false;
+
+				Slot *new_slots = new Slot[capacity];
+				if (!new_slots) {
+					delete[] new_ctrl;
+					return false;
+				}
+
+				for (unsigned int i = 0; i < capacity / GROUP_SIZE; i++) new_ctrl[i] = EMPTY_GROUP;
+
+				uint64_t *old_ctrl = _ctrl;
+				Slot *old_slots = _slots;
+				unsigned int old_capacity = _capacity;
+
+				_ctrl = new_ctrl;
+				_slots = new_slots;
+				_capacity = capacity;
+				_count = 0;
+				_used = 0;
+
+				for (unsigned int i = 0; i < old_capacity; i++) {
+					if (is_full(((const uint8_t *)old_ctrl)[i])) {
+						insert(old_slots[i].key, old_slots[i].value, mix(old_slots[i].key));
+					}
+				}
+
+				delete[] old_ctrl;
+				delete[] old_slots;
+				return true;
+			}
+		};
+
+		/* Times HashMap against Map, if it was asked for on the command line with
+		 * hashmap.benchmark=1. */
+		extern void hash_map_benchmark();
+	}
+}
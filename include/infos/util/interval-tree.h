@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/util/interval-tree.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/avl-tree.h>
+
+namespace infos {
+	namespace util {
+
+		/* A map from half-open address intervals [start, end) to values.  It is an AVL
+		 * tree ordered by the start of each interval, where every node also records the
+		 * largest end in its subtree, so that the intervals overlapping a range can be
+		 * found without visiting the whole tree.  No two intervals may have the same
+		 * start. */
+		template<typename TValue>
+		class IntervalTree {
+		public:
+			struct Node {
+				uintptr_t start, end;
+				TValue value;
+
+			private:
+				friend class IntervalTree;
+
+				Node(uintptr_t start, uintptr_t end, const TValue& value)
+				: start(start), end(end), value(value), max_end(end) { }
+
+				uintptr_t max_end;
+				AVLTreeNode<Node> link;
+			};
+
+			IntervalTree(const IntervalTree&) = delete;
+			IntervalTree(IntervalTree&&) = delete;
+
+			IntervalTree() { }
+			~IntervalTree() { clear(); }
+
+			void insert(uintptr_t start, uintptr_t end, const TValue& value) {
+				assert(start < end);
+
+				_tree.insert(*new Node(start, end, value));
+			}
+
+			/* Removes the interval that starts at the given address, returning false if
+			 * there isn't one. */
+			bool remove(uintptr_t start) {
+				Node *n = find(start);
+				if (!n) return false;
+
+				_tree.remove(*n);
+				delete n;
+				return true;
+			}
+
+			/* Returns the interval that starts at the given address, or NULL. */
+			Node *find(uintptr_t start) const {
+				Node *n = _tree.root();
+				while (n && n->start != start) {
+					n = (start < n->start) ? Tree::left(n) : Tree::right(n);
+				}
+
+				return n;
+			}
+
+			/* Returns the interval overlapping [start, end) with the lowest start that is
+			 * at least min_start, or NULL if there isn't one.  To visit every overlapping
+			 * interval in order, pass the previous interval's start + 1 as min_start. */
+			Node *lowest_overlapping(uintptr_t start, uintptr_t end, uintptr_t min_start = 0) const {
+				return lowest_overlapping(_tree.root(), start, end, min_start);
+			}
+
+			void clear() { _tree.clear(destroy); }
+
+			unsigned int count() const { return _tree.count(); }
+
+		private:
+			/* Orders the intervals by their start, with each node also knowing the
+			 * largest end in its subtree. */
+			struct TreeTraits {
+				static AVLTreeNode<Node>& node(Node *n) { return n->link; }
+				static bool before(const Node *a, const Node *b) { return a->start < b->start; }
+
+				static void update(Node *n) {
+					Node *l = Tree::left(n), *r = Tree::right(n);
+
+					n->max_end = n->end;
+					if (l && l->max_end > n->max_end) n->max_end = l->max_end;
+					if (r && r->max_end > n->max_end) n->max_end = r->max_end;
+				}
+			};
+
+			typedef AVLTree<Node, TreeTraits> Tree;
+
+			Tree _tree;
+
+			static Node *lowest_overlapping(Node *n, uintptr_t start, uintptr_t end, uintptr_t min_start) {
+				// Nothing in this subtree ends after the start of the range.
+				if (!n || n->max_end <= start) return NULL;
+
+				// Only the left subtree can hold lower starts than this node, and only if
+				// this node isn't already below the minimum.
+				if (n->start >= min_start) {
+					Node *r = lowest_overlapping(Tree::left(n), start, end, min_start);
+					if (r) return r;
+
+					if (n->start < end && n->end > start) return n;
+				}
+
+				// Everything in the right subtree starts after this node.
+				if (n->start >= end) return NULL;
+
+				return lowest_overlapping(Tree::right(n), start, end, min_start);
+			}
+
+			static void destroy(Node *n) { delete n; }
+		};
+	}
+}
@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/util/intrusive-list.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace util
+	{
+		/* The links of an element on an IntrusiveList, kept in the element itself.  An
+		 * element can be on as many lists at once as it has nodes. */
+		template<typename T>
+		struct IntrusiveListNode
+		{
+			IntrusiveListNode() : prev(NULL), next(NULL), linked(false) { }
+
+			T *prev, *next;
+			bool linked;
+		};
+
+		/* A doubly-linked list of elements that each have an IntrusiveListNode, named by
+		 * 'Node'.  Nothing is allocated to add an element, and adding at either end and
+		 * removing any element are O(1).  The list doesn't own its elements: they must
+		 * be removed before they are freed. */
+		template<typename T, IntrusiveListNode<T> T::*Node>
+		class IntrusiveList
+		{
+		public:
+			typedef IntrusiveList<T, Node> Self;
+
+			struct Iterator
+			{
+				Iterator(T *current) : _current(current) { }
+
+				T *operator*() const { return _current; }
+				void operator++() { _current = (_current->*Node).next; }
+
+				bool operator==(const Iterator& other) const { return _current == other._current; }
+				bool operator!=(const Iterator& other) const { return _current != other._current; }
+
+			private:
+				T *_current;
+			};
+
+			IntrusiveList() : _head(NULL), _tail(NULL), _count(0) { }
+
+			IntrusiveList(const Self&) = delete;
+			Self& operator=(const Self&) = delete;
+
+			void append(T& elem)
+			{
+				IntrusiveListNode<T>& n = elem.*Node;
+				assert(!n.linked);
+
+				n.prev = _tail;
+				n.next = NULL;
+				n.linked = true;
+
+				if (_tail) (_tail->*Node).next = &elem;
+				else _head = &elem;
+
+				_tail = &elem;
+				_count++;
+			}
+
+			void push(T& elem)
+			{
+				IntrusiveListNode<T>& n = elem.*Node;
+				assert(!n.linked);
+
+				n.prev = NULL;
+				n.next = _head;
+				n.linked = true;
+
+				if (_head) (_head->*Node).prev = &elem;
+				else _tail = &elem;
+
+				_head = &elem;
+				_count++;
+			}
+
+			void remove(T& elem)
+			{
+				IntrusiveListNode<T>& n = elem.*Node;
+				assert(n.linked);
+
+				if (n.prev) (n.prev->*Node).next = n.next;
+				else _head = n.next;
+
+				if (n.next) (n.next->*Node).prev = n.prev;
+				else _tail = n.prev;
+
+				n.prev = n.next = NULL;
+				n.linked = false;
+				_count--;
+			}
+
+			/* Takes the first element off the list, or returns NULL if it is empty. */
+			T *dequeue()
+			{
+				T *elem = _head;
+				if (elem) remove(*elem);
+				return elem;
+			}
+
+			/* Whether the element is on a list of this kind. */
+			static bool is_linked(const T& elem) { return (elem.*Node).linked; }
+
+			T *first() const { return _head; }
+			T *last() const { return _tail; }
+
+			unsigned int count() const { return _count; }
+			bool empty() const { return _head == NULL; }
+
+			/* An element can't be removed while the iterator is on it. */
+			Iterator begin() const { return Iterator(_head); }
+			Iterator end() const { return Iterator(NULL); }
+
+		private:
+			T *_head, *_tail;
+			unsigned int _count;
+		};
+	}
+}
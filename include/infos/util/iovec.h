@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/util/iovec.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos {
+	namespace util {
+
+		/* One buffer of a vectored (scatter/gather) transfer. */
+		struct IOVec {
+			void *base;
+			size_t size;
+		};
+
+		static inline size_t iovec_size(const IOVec *vec, unsigned int count) {
+			size_t size = 0;
+			for (unsigned int i = 0; i < count; i++) {
+				size += vec[i].size;
+			}
+
+			return size;
+		}
+
+		/* Moves a position in the buffers (the current buffer, and the offset into it)
+		 * on by a number of bytes. */
+		static inline void iovec_advance(const IOVec *vec, unsigned int count, unsigned int& cur, size_t& offset, size_t size) {
+			while (size && cur < count) {
+				size_t n = vec[cur].size - offset;
+				if (n > size) n = size;
+
+				offset += n;
+				size -= n;
+
+				if (offset == vec[cur].size) {
+					cur++;
+					offset = 0;
+				}
+			}
+		}
+	}
+}
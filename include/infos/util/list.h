@@ -70,17 +70,17 @@ namespace infos
 			typedef ListNode<Elem> Node;
 			typedef ListIterator<Elem> Iterator;
 			
-			List() : _elems(NULL), _count(0) { }
+			List() : _elems(NULL), _tail(NULL), _count(0) { }
 			
 			// Copy
-			List(const Self& r) : _elems(NULL), _count(0) {
+			List(const Self& r) : _elems(NULL), _tail(NULL), _count(0) {
 				for (const auto& elem : r) {
 					append(elem);
 				}
 			}
 
 			// Move
-			List(Self&& r) : _elems(r._elems), _count(r._count) { r._elems = NULL; r._count = 0; }
+			List(Self&& r) : _elems(r._elems), _tail(r._tail), _count(r._count) { r._elems = NULL; r._tail = NULL; r._count = 0; }
 			
 			~List() {
 				Node *node = _elems;
@@ -92,23 +92,24 @@ namespace infos
 			}
 			
 			void append(Elem const& elem) {
-				Node **slot = &_elems;
-				
-				while (*slot != NULL) {
-					slot = &(*slot)->Next;
-				}
+				Node *node = new Node();
+				node->Data = elem;
+				node->Next = NULL;
 				
-				*slot = new Node();
-				(*slot)->Data = elem;
-				(*slot)->Next = NULL;				
+				// The tail is kept, so that appending doesn't walk the list.
+				if (_tail) _tail->Next = node;
+				else _elems = node;
 				
+				_tail = node;
 				_count++;
 			}
 			
 			void remove(Elem const& elem) {
 				Node **slot = &_elems;
+				Node *prev = NULL;
 				
 				while (*slot && (*slot)->Data != elem) {
+					prev = *slot;
 					slot = &(*slot)->Next;
 				}
 				
@@ -117,6 +118,7 @@ namespace infos
 					assert(candidate->Data == elem);
 					
 					*slot = candidate->Next;
+					if (_tail == candidate) _tail = prev;
 										
 					delete candidate;
 					_count--;
@@ -130,6 +132,7 @@ namespace infos
 				
 				Elem ret = front->Data;
 				_elems = front->Next;
+				if (!_elems) _tail = NULL;
 				delete front;
 				_count--;
 				
@@ -147,6 +150,7 @@ namespace infos
 				node->Data = elem;
 				node->Next = _elems;
 				_elems = node;
+				if (!_tail) _tail = node;
 				
 				_count++;
 			}
@@ -161,14 +165,8 @@ namespace infos
 			}
 
 			Elem const& last() const {
-				assert(_elems);
-				
-				Node *last = _elems;
-				while (last->Next) {
-					last = last->Next;
-				}
-				
-				return last->Data;
+				assert(_tail);
+				return _tail->Data;
 			}
 			
 			Elem const& at(int index) const {
@@ -200,6 +198,7 @@ namespace infos
 				}
 				
 				_elems = NULL;
+				_tail = NULL;
 				_count = 0;
 			}
 			
@@ -214,7 +213,7 @@ namespace infos
 			}
 			
 		private:			
-			Node *_elems;
+			Node *_elems, *_tail;
 			unsigned int _count;
 		};
 	}
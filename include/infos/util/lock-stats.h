@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/util/lock-stats.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+#ifdef CONFIG_LOCK_STATS
+#include <arch/x86/msr.h>
+#endif
+
+// The most locks that can have statistics.
+#define LOCK_STATS_MAX		64
+
+namespace infos
+{
+	namespace util
+	{
+		/* The contention statistics of one lock, in TSC cycles. */
+		struct LockStats
+		{
+			const char *name;
+			uint64_t nr_acquired, nr_contended;
+			uint64_t total_wait_cycles, max_wait_cycles;
+			uint64_t total_hold_cycles, max_hold_cycles;
+			uint64_t hold_start;
+		};
+
+		/* The sections run with interrupts disabled by an IRQLock, in TSC cycles. */
+		struct IRQOffStats
+		{
+			uint64_t nr_sections;
+			uint64_t total_cycles, max_cycles;
+			const void *max_site;		// Where the longest section disabled interrupts
+		};
+
+		/* The section each CPU is in, if it disabled interrupts with an IRQLock. */
+		struct IRQOffSection
+		{
+			uint64_t start;				// Zero if it isn't being timed
+			const void *site;
+		};
+
+#ifdef CONFIG_LOCK_STATS
+		/* Set by the lock.stats option. */
+		extern bool lock_stats_enabled;
+#endif
+
+		/* Gives a lock optional contention statistics.  They are only compiled in if the
+		 * kernel is built with 'make lock-stats=1', and then only kept for locks that
+		 * have been given a name, if the kernel is booted with lock.stats=1.  Otherwise,
+		 * this is an empty base class, and its hooks are empty inline functions.
+		 *
+		 * The hooks are called by the lock while it is held, so the statistics need no
+		 * locking of their own. */
+		class LockProfile
+		{
+		public:
+#ifdef CONFIG_LOCK_STATS
+			LockProfile() : _stats(NULL) { }
+
+			void set_name(const char *name);
+
+		protected:
+			uint64_t wait_start() const { return active() ? arch::x86::__rdtsc() : 0; }
+			void acquired(uint64_t wait_start, bool contended) { if (active()) record_acquired(wait_start, contended); }
+			void releasing() { if (active()) record_release(); }
+
+		private:
+			LockStats *_stats;
+
+			bool active() const { return _stats && lock_stats_enabled; }
+			void record_acquired(uint64_t wait_start, bool contended);
+			void record_release();
+#else
+			void set_name(const char *name) { }
+
+		protected:
+			uint64_t wait_start() const { return 0; }
+			void acquired(uint64_t wait_start, bool contended) { }
+			void releasing() { }
+#endif
+		};
+
+		/* Copies out the statistics of up to 'max' named locks, and returns how many
+		 * were copied.  Returns zero if statistics aren't compiled in, or enabled. */
+		unsigned int get_lock_stats(LockStats *stats, unsigned int max);
+
+		/* Times the sections that IRQLock runs with interrupts disabled, with the same
+		 * build and boot options as the lock statistics.  A section is timed on its CPU,
+		 * not in the lock, so that one that sleeps is charged for just as long as the
+		 * interrupts really were off.  The interrupt entry path calls irqoff_reset()
+		 * when it interrupts code that had them on, as whatever was being timed on the
+		 * CPU must have ended without being seen to. */
+#ifdef CONFIG_LOCK_STATS
+		void irqoff_begin(const void *site);
+		void irqoff_end();
+		void irqoff_reset();
+#else
+		static inline void irqoff_begin(const void *site) { }
+		static inline void irqoff_end() { }
+		static inline void irqoff_reset() { }
+#endif
+
+		/* Copies out the interrupts-disabled statistics.  Returns false if they aren't
+		 * compiled in, or enabled. */
+		bool get_irqoff_stats(IRQOffStats& stats);
+	}
+}
@@ -3,47 +3,36 @@
 #pragma once
 
 #include <arch/x86/irq.h>
+#include <infos/util/spinlock.h>
+#include <infos/util/wakequeue.h>
 
 namespace infos
 {
 	namespace kernel
 	{
 		class Thread;
+		class CPU;
 	}
 	
 	namespace util
 	{
-		class Lock
+		/* A lock that sleeps while it waits, on a queue of waiting threads, so a
+		 * waiter doesn't use the CPU, and an unlock wakes exactly one of them.
+		 * While the owner is running on another CPU, a waiter spins for a while
+		 * first, since the lock is likely to be released sooner than it takes to
+		 * sleep and be woken up again. */
+		class Mutex : public Lock, public LockProfile
 		{
 		public:
-			virtual void lock() = 0;
-			virtual void unlock() = 0;
-		};
-		
-		template<typename TLock>
-		class UniqueLock
-		{
-		public:
-			explicit UniqueLock(TLock& l) : _l(l) {
-				_l.lock();
-			}
-			
-			~UniqueLock() {
-				_l.unlock();
-			}
-			
-		private:
-			TLock& _l;
-		};
-		
-		class Mutex : public Lock
-		{
-		public:
-			Mutex() : _locked(0) { }
+			Mutex() : _locked(0), _owner(NULL) { }
 			
 			void lock() override;
 			void unlock() override;
 			
+			/* Takes the lock if it is free, but never waits for it.  Returns true
+			 * if the lock was taken. */
+			bool try_lock();
+			
 			bool locked() { return !!_locked; }
 			bool locked_by_me();
 			
@@ -51,20 +40,64 @@ namespace infos
 			Mutex(const Mutex& c);
 			Mutex(const Mutex&& c);
 			
+			// 0 if free, 1 if locked, or 2 if locked and there may be waiters.
 			volatile unsigned long _locked;
 			kernel::Thread *_owner;
+			WakeQueue _waiters;
+
+			void lock_contended();
 		};
 		
+		/* Lets threads sleep until a condition, protected by a Mutex, may have become
+		 * true.  As usual, a waiter must re-check the condition when it wakes up. */
 		class ConditionVariable
 		{
 		public:
 			ConditionVariable() { }
 			
+			/* Releases the mutex, which must be held by the caller, and sleeps until
+			 * notified, then takes the mutex again.  A notify made by a thread holding
+			 * the mutex after the caller took it can't be missed. */
 			void wait(Mutex& mtx);
 			void notify_one();
 			void notify_all();
+
+		private:
+			ConditionVariable(const ConditionVariable& c);
+			ConditionVariable(const ConditionVariable&& c);
+
+			WakeQueue _waiters;
 		};
 		
+		/* Once the other CPUs are started, every IRQLock takes this too, so that a section
+		 * that disables interrupts excludes the other CPUs as well as interrupt handlers on
+		 * this one, as the sections have always assumed.  The CPU holding it can take it
+		 * again.  It is only held with interrupts disabled, or while running the softirqs,
+		 * which can't be switched away from, and a thread that yields while holding it
+		 * (see Arch::invoke_kernel_syscall()) lets go until it runs again.  A CPU waiting
+		 * for it runs what the others ask of it meanwhile (see Arch::relax()). */
+		class KernelLock
+		{
+		public:
+			/* Called before a second CPU starts. */
+			static void enable() { _enabled = true; }
+
+			/* Takes the lock, unless it isn't in use yet.  Returns true if it was taken. */
+			static bool lock();
+			static void unlock();
+
+			/* Lets go of the lock, if this CPU holds it, however many times it was taken,
+			 * and returns that, for reacquire() to take it again as many times. */
+			static unsigned int release();
+			static void reacquire(unsigned int depth);
+
+		private:
+			static bool _enabled;
+			static volatile unsigned long _locked;
+			static kernel::CPU *volatile _owner;
+			static unsigned int _depth;
+		};
+
 		class IRQLock : public Lock
 		{
 		public:
@@ -75,6 +108,7 @@ namespace infos
 			
 		private:
 			bool _were_interrupts_enabled;
+			bool _kernel_locked;
 		};
 		
 		class UniqueIRQLock
@@ -86,5 +120,18 @@ namespace infos
 		private:
 			IRQLock _lock;
 		};
+
+		/* Takes a spinlock with interrupts disabled on this CPU, for data that is also
+		 * used by interrupt handlers, and restores them once the lock is released. */
+		template<typename TLock>
+		class UniqueIRQSaveLock
+		{
+		public:
+			explicit UniqueIRQSaveLock(TLock& l) : _irq(), _l(l) { }
+
+		private:
+			UniqueIRQLock _irq;
+			UniqueLock<TLock> _l;
+		};
 	}
 }
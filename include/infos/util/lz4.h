@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace util
+	{
+		/* Compression in the LZ4 block format: fast to compress, and very fast to
+		 * decompress, at the cost of some of the ratio that slower compressors get.
+		 * Only blocks of up to 64 KiB are compressed, which is plenty for pages. */
+
+		/* The compressor's hash table, which is too big for a kernel stack, so the
+		 * caller keeps it (and uses it for one compression at a time). */
+		struct LZ4Workspace
+		{
+			static const unsigned int HASH_BITS = 12;
+
+			uint16_t table[1 << HASH_BITS];
+		};
+
+		static const size_t LZ4_MAX_INPUT = 0x10000;
+
+		/* Compresses 'size' bytes into at most 'capacity' bytes.  Returns the
+		 * compressed size, or zero if it didn't fit (i.e. the data doesn't compress
+		 * well enough to be worth it), or the input is too big. */
+		extern size_t lz4_compress(const void *src, size_t size, void *dst, size_t capacity, LZ4Workspace& ws);
+
+		/* Decompresses a block that decompresses to exactly 'size' bytes.  Returns
+		 * false, without reading or writing out of bounds, if the block is damaged. */
+		extern bool lz4_decompress(const void *src, size_t src_size, void *dst, size_t size);
+	}
+}
@@ -11,7 +11,6 @@
 #pragma once
 
 #include <infos/define.h>
-#include <infos/util/list.h>
 
 namespace infos {
 	namespace util {
@@ -133,11 +132,7 @@ namespace infos {
 			typedef MapIteratorPair<TNode> Pair;
 			typedef MapIterator<TNode> Self;
 
-			MapIterator(const TNode *root) : _current(root) {
-				if (root) {
-					_queue.enqueue(root);
-					advance();
-				}
+			MapIterator(const TNode *root) : _current(leftmost(root)) {
 			}
 
 			const Pair operator*() const {
@@ -158,23 +153,31 @@ namespace infos {
 			}
 
 		private:
-			List<const TNode *> _queue;
 			const TNode *_current;
 
+			static const TNode *leftmost(const TNode *node) {
+				if (node) {
+					while (node->left()) node = node->left();
+				}
+
+				return node;
+			}
+
+			/* Moves on to the next node in key order, by way of the parent pointers, so
+			 * that nothing has to be kept of where the iterator has been. */
 			void advance() {
-				if (!_queue.empty()) {
-					_current = _queue.dequeue();
+				if (!_current) return;
 
-					if (_current->left()) {
-						_queue.enqueue(_current->left());
-					}
+				if (_current->right()) {
+					_current = leftmost(_current->right());
+					return;
+				}
 
-					if (_current->right()) {
-						_queue.enqueue(_current->right());
-					}
-				} else {
-					_current = NULL;
+				while (_current->parent() && _current->i_am_right()) {
+					_current = _current->parent();
 				}
+
+				_current = _current->parent();
 			}
 		};
 
@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/util/name-table.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/string.h>
+
+namespace infos {
+	namespace util {
+
+		/* A table of named objects, keyed by their names, e.g. the entries of a
+		 * directory.  TValue is a pointer to something with a name() that returns a
+		 * String, which must not change while the object is in the table.
+		 *
+		 * It is an open-addressed hash table with linear probing.  Each slot keeps the
+		 * hash of its name, so a probe only compares names when the hashes match, and
+		 * names with the same hash don't alias each other.  Removed slots are left as
+		 * tombstones until the table next grows. */
+		template<typename TValue>
+		class NameTable {
+		public:
+			NameTable(const NameTable&) = delete;
+			NameTable(NameTable&&) = delete;
+
+			NameTable() : _slots(NULL), _capacity(0), _count(0), _used(0) { }
+			~NameTable() { delete[] _slots; }
+
+			unsigned int count() const { return _count; }
+
+			/* Returns the object with the given name, or NULL. */
+			TValue find(const String& name) const {
+				int slot = find_slot(name);
+				return slot < 0 ? NULL : _slots[slot].value;
+			}
+
+			bool try_get_value(const String& name, TValue& value) const {
+				value = find(name);
+				return value != NULL;
+			}
+
+			/* Adds an object, returning false (and leaving the table as it was) if there
+			 * is already one with the same name. */
+			bool add(TValue value) {
+				const String& name = value->name();
+				if (find_slot(name) >= 0) return false;
+
+				if ((_used + 1) * 10 > _capacity * 7) {
+					if (!grow()) return false;
+				}
+
+				insert(name.get_hash(), value);
+				return true;
+			}
+
+			/* Removes the object with the given name, returning false if there isn't one. */
+			bool remove(const String& name) {
+				int slot = find_slot(name);
+				if (slot < 0) return false;
+
+				_slots[slot].state = TOMBSTONE;
+				_slots[slot].value = NULL;
+				_count--;
+
+				return true;
+			}
+
+			class Iterator {
+			public:
+				Iterator(const NameTable& table, unsigned int index) : _table(table), _index(index) { skip(); }
+
+				TValue operator*() const { return _table._slots[_index].value; }
+				Iterator& operator++() { _index++; skip(); return *this; }
+				bool operator!=(const Iterator& other) const { return _index != other._index; }
+
+			private:
+				const NameTable& _table;
+				unsigned int _index;
+
+				void skip() {
+					while (_index < _table._capacity && _table._slots[_index].state != FULL) _index++;
+				}
+			};
+
+			Iterator begin() const { return Iterator(*this, 0); }
+			Iterator end() const { return Iterator(*this, _capacity); }
+
+		private:
+			enum SlotState : uint8_t {
+				EMPTY,
+				FULL,
+				TOMBSTONE,
+			};
+
+			struct Slot {
+				String::hash_type hash;
+				TValue value;
+				SlotState state;
+
+				Slot() : hash(0), value(NULL), state(EMPTY) { }
+			};
+
+			Slot *_slots;
+			unsigned int _capacity;		// Always a power of two, or zero.
+			unsigned int _count;		// The number of objects in the table.
+			unsigned int _used;			// The number of slots that aren't empty, including tombstones.
+
+			int find_slot(const String& name) const {
+				if (!_capacity) return -1;
+
+				String::hash_type hash = name.get_hash();
+				unsigned int mask = _capacity - 1;
+
+				// There is always at least one empty slot, so the probe ends.
+				for (unsigned int i = (unsigned int)hash & mask;; i = (i + 1) & mask) {
+					const Slot& s = _slots[i];
+
+					if (s.state == EMPTY) return -1;
+					if (s.state == FULL && s.hash == hash && s.value->name() == name) return (int)i;
+				}
+			}
+
+			void insert(String::hash_type hash, TValue value) {
+				unsigned int mask = _capacity - 1;
+				unsigned int i = (unsigned int)hash & mask;
+
+				while (_slots[i].state == FULL) i = (i + 1) & mask;
+
+				if (_slots[i].state == EMPTY) _used++;
+
+				_slots[i].hash = hash;
+				_slots[i].value = value;
+				_slots[i].state = FULL;
+				_count++;
+			}
+
+			/* Rehashes into a table that is at most half full, which also clears out the
+			 * tombstones. */
+			bool grow() {
+				unsigned int capacity = _capacity ? _capacity : 8;
+				while ((_count + 1) * 2 > capacity) capacity *= 2;
+
+				Slot *slots = new Slot[capacity];
+				if (!slots) return false;
+
+				Slot *old_slots = _slots;
+				unsigned int old_capacity = _capacity;
+
+				_slots = slots;
+				_capacity = capacity;
+				_count = 0;
+				_used = 0;
+
+				for (unsigned int i = 0; i < old_capacity; i++) {
+					if (old_slots[i].state == FULL) insert(old_slots[i].hash, old_slots[i].value);
+				}
+
+				delete[] old_slots;
+				return true;
+			}
+		};
+	}
+}
@@ -16,8 +16,8 @@ namespace infos
 {
 	namespace util
 	{
-		extern int snprintf(char *buffer, int size, const char *fmt, ...);
-		extern int sprintf(char *buffer, const char *fmt, ...);
+		extern int snprintf(char *buffer, int size, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+		extern int sprintf(char *buffer, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 		extern int vsnprintf(char *buffer, int size, const char *fmt, va_list args);
 	}
 }
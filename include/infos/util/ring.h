@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/util/ring.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos {
+	namespace util {
+
+		/* A bounded queue from one producer to one consumer, e.g. from an interrupt
+		 * handler to the softirq, or thread, that deals with what it read.  Neither side
+		 * takes a lock, or waits for the other, so either can be an interrupt handler.
+		 *
+		 * Each index is only written by its own side, and is padded out to a cache line
+		 * of its own, along with the last value that side saw of the other's index.  A
+		 * side only reads the other's line when the ring looks full (or empty) from what
+		 * it saw last.  The padding is there instead of alignment, as the kernel's
+		 * operator new doesn't align beyond 16 bytes.
+		 *
+		 * TSize must be a power of two, and the indices run freely, so that a full ring
+		 * can be told from an empty one without a wasted slot. */
+		template<typename T, unsigned int TSize>
+		class SPSCRing {
+			static_assert(TSize && !(TSize & (TSize - 1)), "the size of a ring must be a power of two");
+
+		public:
+			SPSCRing(const SPSCRing&) = delete;
+
+			SPSCRing() : _producer(), _consumer() { }
+
+			static constexpr unsigned int capacity() { return TSize; }
+
+			/* How many items are in the ring.  Only exact on one side or the other, and
+			 * then only a lower or upper bound. */
+			unsigned int count() const {
+				return __atomic_load_n(&_producer.tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&_consumer.head, __ATOMIC_ACQUIRE);
+			}
+
+			bool empty() const { return count() == 0; }
+
+			/* Adds an item.  Returns false if the ring is full, and the item was dropped.
+			 * Only called by the producer. */
+			bool push(const T& item) {
+				return push(&item, 1) == 1;
+			}
+
+			/* Adds as many of 'nr' items as there is room for, and returns how many. */
+			unsigned int push(const T *items, unsigned int nr) {
+				unsigned int tail = _producer.tail;
+
+				if (TSize - (tail - _producer.cached_head) < nr) {
+					_producer.cached_head = __atomic_load_n(&_consumer.head, __ATOMIC_ACQUIRE);
+				}
+
+				unsigned int room = TSize - (tail - _producer.cached_head);
+				if (nr > room) nr = room;
+
+				for (unsigned int i = 0; i < nr; i++) {
+					_items[(tail + i) & (TSize - 1)] = items[i];
+				}
+
+				__atomic_store_n(&_producer.tail, tail + nr, __ATOMIC_RELEASE);
+				return nr;
+			}
+
+			/* Takes the oldest item.  Returns false if the ring is empty.  Only called by
+			 * the consumer. */
+			bool pop(T& item) {
+				return pop(&item, 1) == 1;
+			}
+
+			/* Takes up to 'max' of the oldest items, and returns how many. */
+			unsigned int pop(T *items, unsigned int max) {
+				unsigned int head = _consumer.head;
+
+				if (_consumer.cached_tail - head < max) {
+					_consumer.cached_tail = __atomic_load_n(&_producer.tail, __ATOMIC_ACQUIRE);
+				}
+
+				unsigned int nr = _consumer.cached_tail - head;
+				if (nr > max) nr = max;
+
+				for (unsigned int i = 0; i < nr; i++) {
+					items[i] = _items[(head + i) & (TSize - 1)];
+				}
+
+				__atomic_store_n(&_consumer.head, head + nr, __ATOMIC_RELEASE);
+				return nr;
+			}
+
+		private:
+			struct Producer {
+				Producer() : tail(0), cached_head(0) { }
+
+				unsigned int tail;
+				unsigned int cached_head;
+				char padding[CACHE_LINE_SIZE - 2 * sizeof(unsigned int)];
+			};
+
+			struct Consumer {
+				Consumer() : head(0), cached_tail(0) { }
+
+				unsigned int head;
+				unsigned int cached_tail;
+				char padding[CACHE_LINE_SIZE - 2 * sizeof(unsigned int)];
+			};
+
+			Producer _producer;
+			Consumer _consumer;
+			T _items[TSize];
+		};
+
+		/* A bounded queue from any number of producers to one consumer, e.g. from every
+		 * CPU to a worker.  Producers claim slots by moving the tail on with a compare-
+		 * and-swap, and each slot has a sequence number that says whether it has been
+		 * filled for the current time around the ring, or emptied for the next.
+		 *
+		 * A producer that is interrupted between claiming a slot and filling it holds the
+		 * consumer up at that slot until it finishes, but others can still push behind it,
+		 * so an interrupt handler can push while a thread on the same CPU is pushing.
+		 *
+		 * TSize must be a power of two. */
+		template<typename T, unsigned int TSize>
+		class MPSCRing {
+			static_assert(TSize && !(TSize & (TSize - 1)), "the size of a ring must be a power of two");
+
+		public:
+			MPSCRing(const MPSCRing&) = delete;
+
+			MPSCRing() : _tail(), _head() {
+				for (unsigned int i = 0; i < TSize; i++) {
+					_slots[i].sequence = i;
+				}
+			}
+
+			static constexpr unsigned int capacity() { return TSize; }
+
+			bool empty() const {
+				const Slot& slot = _slots[_head.index & (TSize - 1)];
+				return __atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE) != _head.index + 1;
+			}
+
+			/* Adds an item.  Returns false if the ring is full, and the item was dropped.
+			 * Safe to call from any CPU, and from interrupt handlers. */
+			bool push(const T& item) {
+				unsigned int pos = __atomic_load_n(&_tail.index, __ATOMIC_RELAXED);
+
+				for (;;) {
+					Slot& slot = _slots[pos & (TSize - 1)];
+					int diff = (int)(__atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE) - pos);
+
+					if (diff == 0) {
+						if (__atomic_compare_exchange_n(&_tail.index, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+							slot.item = item;
+							__atomic_store_n(&slot.sequence, pos + 1, __ATOMIC_RELEASE);
+							return true;
+						}
+					} else if (diff < 0) {
+						// The slot hasn't been emptied since the last time round.
+						return false;
+					} else {
+						pos = __atomic_load_n(&_tail.index, __ATOMIC_RELAXED);
+					}
+				}
+			}
+
+			/* Adds as many of 'nr' items as there is room for, as one run of slots, and
+			 * returns how many. */
+			unsigned int push(const T *items, unsigned int nr) {
+				unsigned int pos = __atomic_load_n(&_tail.index, __ATOMIC_RELAXED);
+				unsigned int claimed;
+
+				do {
+					// The consumer empties slots in order, and moves the head on after
+					// each, so everything behind the head it was seen at is free.
+					unsigned int room = TSize - (pos - __atomic_load_n(&_head.index, __ATOMIC_ACQUIRE));
+					if (!room) return 0;
+
+					claimed = nr < room ? nr : room;
+				} while (!__atomic_compare_exchange_n(&_tail.index, &pos, pos + claimed, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+				for (unsigned int i = 0; i < claimed; i++) {
+					Slot& slot = _slots[(pos + i) & (TSize - 1)];
+
+					slot.item = items[i];
+					__atomic_store_n(&slot.sequence, pos + i + 1, __ATOMIC_RELEASE);
+				}
+
+				return claimed;
+			}
+
+			/* Takes the oldest item, if it has been filled in.  Only called by the
+			 * consumer. */
+			bool pop(T& item) {
+				unsigned int pos = _head.index;
+				Slot& slot = _slots[pos & (TSize - 1)];
+
+				if (__atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE) != pos + 1) return false;
+
+				item = slot.item;
+				__atomic_store_n(&slot.sequence, pos + TSize, __ATOMIC_RELEASE);
+				__atomic_store_n(&_head.index, pos + 1, __ATOMIC_RELEASE);
+
+				return true;
+			}
+
+			/* Takes up to 'max' of the oldest items, stopping at the first that hasn't
+			 * been filled in, and returns how many. */
+			unsigned int pop(T *items, unsigned int max) {
+				unsigned int nr = 0;
+				while (nr < max && pop(items[nr])) nr++;
+
+				return nr;
+			}
+
+		private:
+			struct Slot {
+				unsigned int sequence;
+				T item;
+			};
+
+			struct Index {
+				Index() : index(0) { }
+
+				unsigned int index;
+				char padding[CACHE_LINE_SIZE - sizeof(unsigned int)];
+			};
+
+			Index _tail;		// Written by every producer
+			Index _head;		// Written by the consumer
+			Slot _slots[TSize];
+		};
+	}
+}
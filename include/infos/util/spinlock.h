@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/util/spinlock.h
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/lock-stats.h>
+
+namespace infos
+{
+	namespace util
+	{
+		class Lock
+		{
+		public:
+			virtual void lock() = 0;
+			virtual void unlock() = 0;
+		};
+		
+		template<typename TLock>
+		class UniqueLock
+		{
+		public:
+			explicit UniqueLock(TLock& l) : _l(l) {
+				_l.lock();
+			}
+			
+			~UniqueLock() {
+				_l.unlock();
+			}
+			
+		private:
+			TLock& _l;
+		};
+		
+		/* A lock that is waited for by spinning, so it is safe to take in an interrupt
+		 * handler, and gives mutual exclusion between CPUs.  It does not disable
+		 * interrupts itself, so a lock that is also taken by an interrupt handler must
+		 * be taken with interrupts disabled (e.g. inside a UniqueIRQLock). */
+		class SpinLock : public Lock, public LockProfile
+		{
+		public:
+			SpinLock() : _locked(0) { }
+			
+			void lock() override;
+			void unlock() override;
+			
+			bool try_lock();
+			bool locked() const { return !!_locked; }
+			
+		private:
+			SpinLock(const SpinLock& c);
+			SpinLock(const SpinLock&& c);
+			
+			volatile unsigned long _locked;
+		};
+
+		/* A spinlock that is handed out in the order it was asked for, so no CPU can
+		 * be starved by the others.  For short critical sections: every waiter spins
+		 * on the same word.  As with SpinLock, a lock that is also taken by an
+		 * interrupt handler must be taken with interrupts disabled. */
+		class TicketLock : public Lock, public LockProfile
+		{
+		public:
+			TicketLock() : _next(0), _serving(0) { }
+
+			void lock() override;
+			void unlock() override;
+
+			bool try_lock();
+			bool locked() const { return _next != _serving; }
+
+		private:
+			TicketLock(const TicketLock& c);
+			TicketLock(const TicketLock&& c);
+
+			volatile uint32_t _next, _serving;
+		};
+
+		/* A queued spinlock, for heavily contended data.  Each waiter spins on a flag
+		 * in its own node, which its predecessor clears when it unlocks, so a release
+		 * touches exactly one other CPU's cache, however many are waiting, and the
+		 * lock is handed out in order.  The node must stay put from lock() to
+		 * unlock(): UniqueLock<MCSLock> keeps one for the caller. */
+		class MCSLock : public LockProfile
+		{
+		public:
+			struct Node
+			{
+				Node * volatile next;
+				volatile bool waiting;
+			};
+
+			MCSLock() : _tail(NULL) { }
+
+			void lock(Node& node);
+			void unlock(Node& node);
+
+			bool try_lock(Node& node);
+			bool locked() const { return _tail != NULL; }
+
+		private:
+			MCSLock(const MCSLock& c);
+			MCSLock(const MCSLock&& c);
+
+			Node * volatile _tail;
+		};
+
+		/* A sequence lock, for small data that is read far more often than it is
+		 * written.  Writers are serialised by a spinlock, and bump the sequence number
+		 * before and after an update, so it is odd while one is in progress.  Readers
+		 * take no lock at all: they copy the data out between read_begin() and
+		 * read_retry(), and go round again if a writer got in.  So, a reader never
+		 * holds up a writer, and must not follow pointers it has read.  A writer
+		 * that runs in an interrupt handler must be taken with interrupts disabled,
+		 * or a reader interrupted on the same CPU would spin forever. */
+		class SeqLock
+		{
+		public:
+			SeqLock() : _sequence(0) { }
+
+			void lock()
+			{
+				_writer.lock();
+				_sequence++;
+				asm volatile("" ::: "memory");
+			}
+
+			void unlock()
+			{
+				asm volatile("" ::: "memory");
+				_sequence++;
+				_writer.unlock();
+			}
+
+			uint32_t read_begin() const
+			{
+				uint32_t sequence;
+				while ((sequence = _sequence) & 1) {
+					asm volatile("pause" ::: "memory");
+				}
+
+				asm volatile("" ::: "memory");
+				return sequence;
+			}
+
+			bool read_retry(uint32_t sequence) const
+			{
+				asm volatile("" ::: "memory");
+				return _sequence != sequence;
+			}
+
+		private:
+			SeqLock(const SeqLock& c);
+			SeqLock(const SeqLock&& c);
+
+			SpinLock _writer;
+			volatile uint32_t _sequence;
+		};
+
+		template<>
+		class UniqueLock<MCSLock>
+		{
+		public:
+			explicit UniqueLock(MCSLock& l) : _l(l) {
+				_l.lock(_node);
+			}
+
+			~UniqueLock() {
+				_l.unlock(_node);
+			}
+
+		private:
+			MCSLock& _l;
+			MCSLock::Node _node;
+		};
+	}
+}
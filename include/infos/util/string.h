@@ -17,63 +17,204 @@ namespace infos {
     namespace util {
         extern size_t strlen(const char *str);
         extern int strncmp(const char *str1, const char *str2, size_t n);
+        extern int strcmp(const char *str1, const char *str2);     // Orders them, unlike strncmp
         extern char *strncpy(char *dst, const char *src, size_t n);
 
         extern "C" void *memcpy(void *dest, const void *src, size_t n);
+        extern "C" void *memmove(void *dest, const void *src, size_t n);
         extern "C" void *memset(void *dest, int c, size_t n);
 
         extern "C" void *bzero(void *dest, size_t n);
         extern "C" void pzero(void *dest);
-        extern "C" void pnzero(void *dest, size_t n);
+        extern "C" void pnzero(void *dest, size_t n);       // Uncached from 16 pages
 
-        class String {
+        // Whole pages, without going through the cache.
+        extern "C" void pzero_nt(void *dest);
+        extern "C" void pcopy_nt(void *dest, const void *src);
+
+        namespace string_hash_detail {
+            static constexpr uint64_t SECRET0 = 0xa0761d6478bd642full;
+            static constexpr uint64_t SECRET1 = 0xe7037ed1a0b428dbull;
+
+            /* Multiplies out to 128 bits, and folds the halves together. */
+            constexpr uint64_t mix(uint64_t a, uint64_t b) {
+                __uint128_t r = (__uint128_t)a * b;
+                return (uint64_t)r ^ (uint64_t)(r >> 64);
+            }
+
+            /* Little-endian loads.  When the hash is being worked out at run-time, they
+             * are single loads; at compile-time they have to go a byte at a time. */
+            constexpr uint64_t read(const char *p, unsigned int size) {
+                if (!__builtin_is_constant_evaluated()) {
+                    if (size == 8) {
+                        uint64_t v = 0;
+                        __builtin_memcpy(&v, p, 8);
+                        return v;
+                    } else {
+                        uint32_t v = 0;
+                        __builtin_memcpy(&v, p, 4);
+                        return v;
+                    }
+                }
+
+                uint64_t v = 0;
+                for (unsigned int i = 0; i < size; i++) {
+                    v |= (uint64_t)(uint8_t)p[i] << (i * 8);
+                }
+
+                return v;
+            }
+        }
+
+        /*
+         * The 64-bit hash of some characters, which is what a String, or a StringView,
+         * hashes to.  It is wyhash, which takes sixteen bytes a round, and spreads every
+         * bit of the input over the whole of the hash, so that the tables that are keyed
+         * by it see few collisions.  It is constexpr, so the hash of a fixed name can be
+         * worked out by the compiler, e.g. StringView("dev").get_hash().
+         */
+        constexpr uint64_t string_hash(const char *data, size_t size) {
+            using namespace string_hash_detail;
+
+            uint64_t seed = mix(SECRET0, SECRET1);
+            uint64_t a = 0, b = 0;
+
+            if (size <= 16) {
+                if (size >= 4) {
+                    // Two overlapping pairs of 32-bit loads cover anything from 4 to 16.
+                    size_t step = (size >> 3) << 2;
+                    a = (read(data, 4) << 32) | read(data + step, 4);
+                    b = (read(data + size - 4, 4) << 32) | read(data + size - 4 - step, 4);
+                } else if (size > 0) {
+                    a = ((uint64_t)(uint8_t)data[0] << 16) | ((uint64_t)(uint8_t)data[size >> 1] << 8) | (uint8_t)data[size - 1];
+                }
+            } else {
+                const char *p = data;
+                size_t remaining = size;
+
+                while (remaining > 16) {
+                    seed = mix(read(p, 8) ^ SECRET1, read(p + 8, 8) ^ seed);
+                    p += 16;
+                    remaining -= 16;
+                }
+
+                // The last sixteen bytes, which may overlap the last round.
+                a = read(p + remaining - 16, 8);
+                b = read(p + remaining - 8, 8);
+            }
+
+            __uint128_t r = (__uint128_t)(a ^ SECRET1) * (b ^ seed);
+            return mix((uint64_t)r ^ SECRET0 ^ size, (uint64_t)(r >> 64) ^ SECRET1);
+        }
+
+        /*
+         * Some characters that belong to something else, e.g. a component of a path that
+         * is still in the path.  It isn't necessarily null-terminated, and is only valid
+         * for as long as what it points into.
+         */
+        class StringView {
         public:
             typedef uint64_t hash_type;
 
-            String() : _size(0), _data(new char[1]), _has_hash(false), _hash(0) {
-                _data[0] = 0;
+            constexpr StringView() : _data(""), _size(0) { }
+            constexpr StringView(const char *str) : _data(str), _size(length_of(str)) { }
+            constexpr StringView(const char *str, size_t size) : _data(str), _size(size) { }
+
+            constexpr size_t length() const { return _size; }
+            constexpr bool empty() const { return _size == 0; }
+            constexpr const char *data() const { return _data; }
+
+            constexpr char operator[](size_t idx) const {
+                if (idx >= _size) return 0;
+                return _data[idx];
             }
 
-            // From const char * constructor
+            /**
+             * Returns the part of the view that starts at 'start', and is at most 'length'
+             * characters long.
+             */
+            constexpr StringView substr(size_t start, size_t length) const {
+                if (start > _size) start = _size;
+                if (length > _size - start) length = _size - start;
+
+                return StringView(_data + start, length);
+            }
 
-            String(const char *str) : _size(strlen(str)), _data(NULL), _has_hash(false), _hash(0) {
-                _data = new char[_size + 1];
+            constexpr hash_type get_hash() const {
+                return string_hash(_data, _size);
+            }
 
-                for (unsigned int i = 0; i < _size; i++) {
-                    _data[i] = str[i];
+            friend constexpr bool operator==(const StringView& l, const StringView& r) {
+                if (l._size != r._size) return false;
+
+                for (size_t i = 0; i < l._size; i++) {
+                    if (l._data[i] != r._data[i]) return false;
                 }
 
-                _data[_size] = 0;
+                return true;
             }
 
-            // Copy Constructor
+            friend constexpr bool operator!=(const StringView& l, const StringView& r) {
+                return !(l == r);
+            }
 
-            String(const String& str)
-            : _size(str._size),
-            _data(NULL),
-            _has_hash(str._has_hash),
-            _hash(str._hash) {
-                _data = new char[_size + 1];
+        private:
+            const char *_data;
+            size_t _size;
 
-                for (unsigned int i = 0; i < _size; i++) {
-                    _data[i] = str._data[i];
+            static constexpr size_t length_of(const char *str) {
+                size_t size = 0;
+                if (str) {
+                    while (str[size]) size++;
                 }
 
-                _data[_size] = 0;
+                return size;
             }
+        };
 
-            // Move Constructor
+        /*
+         * A string that owns its characters.  Strings of up to INLINE_CAPACITY characters
+         * are kept inside the String itself, so that the short names that most strings
+         * are (path components, device and process names) don't touch the heap at all.
+         */
+        class String {
+        public:
+            typedef uint64_t hash_type;
+
+            static const size_t INLINE_CAPACITY = 22;
+
+            String() : _size(0), _data(_inline), _has_hash(false), _hash(0) {
+                _inline[0] = 0;
+            }
 
-            String(String&& str)
-            : _size(str._size),
-            _data(str._data),
-            _has_hash(str._has_hash),
-            _hash(str._has_hash) {
+            // From const char * constructor
+
+            String(const char *str) : _has_hash(false), _hash(0) {
+                assign(str, strlen(str));
+            }
+
+            String(const char *str, size_t size) : _has_hash(false), _hash(0) {
+                assign(str, size);
+            }
+
+            explicit String(const StringView& view) : _has_hash(false), _hash(0) {
+                assign(view.data(), view.length());
+            }
+
+            // Copy Constructor
+
+            String(const String& str) : _has_hash(str._has_hash), _hash(str._hash) {
+                assign(str._data, str._size);
+            }
 
+            // Move Constructor
+
+            String(String&& str) {
+                take(str);
             }
 
             ~String() {
-                delete _data;
+                release();
             }
 
             /**
@@ -99,6 +240,14 @@ namespace infos {
                 return _data;
             }
 
+            /**
+             * Returns a view of the whole string, which is valid until the string is
+             * changed or destroyed.
+             */
+            StringView view() const {
+                return StringView(_data, _size);
+            }
+
             /**
              * Retrieves the hash of this string, lazily computing it
              * if necessary.
@@ -108,7 +257,7 @@ namespace infos {
             hash_type get_hash() const {
                 if (_has_hash) return _hash;
 
-                _hash = compute_hash();
+                _hash = string_hash(_data, _size);
                 _has_hash = true;
 
                 return _hash;
@@ -117,18 +266,10 @@ namespace infos {
             List<String> split(char delim, bool remove_empty);
 
             friend String operator+(const String& l, const String& r) {
-                String n(l.length() + r.length());
+                String n(l._size + r._size);
 
-                for (unsigned int i = 0; i < l.length(); i++) {
-                    n._data[i] = l._data[i];
-                }
-
-                unsigned int off = l.length();
-                for (unsigned int i = 0; i < r.length(); i++) {
-                    n._data[i + off] = r._data[i];
-                }
-
-                n._data[n._size] = 0;
+                memcpy(n._data, l._data, l._size);
+                memcpy(n._data + l._size, r._data, r._size);
 
                 return n;
             }
@@ -136,28 +277,19 @@ namespace infos {
             friend String operator+(const String& l, const char& r) {
                 String n(l._size + 1);
 
-                for (unsigned int i = 0; i < l._size; i++) {
-                    n._data[i] = l._data[i];
-                }
-
-                n._data[n._size - 1] = r;
-                n._data[n._size] = 0;
+                memcpy(n._data, l._data, l._size);
+                n._data[l._size] = r;
 
                 return n;
             }
 
             String& operator=(const String& s) {
                 if (this != &s) {
-                    delete _data;
-
-                    _size = s._size;
-                    _data = new char[_size + 1];
-                    for (unsigned int i = 0; i < _size; i++) {
-                        _data[i] = s._data[i];
-                    }
+                    release();
+                    assign(s._data, s._size);
 
-                    _data[_size] = 0;
-                    _has_hash = false;
+                    _has_hash = s._has_hash;
+                    _hash = s._hash;
                 }
 
                 return *this;
@@ -165,15 +297,8 @@ namespace infos {
 
             String& operator=(String&& s) {
                 if (this != &s) {
-                    delete _data;
-
-                    _size = s._size;
-                    _data = s._data;
-                    _has_hash = s._has_hash;
-                    _hash = s._hash;
-
-                    s._data = NULL;
-                    s._size = 0;
+                    release();
+                    take(s);
                 }
 
                 return *this;
@@ -186,43 +311,65 @@ namespace infos {
 
             friend bool operator==(const String& l, const String& r) {
                 if (l._size != r._size) return false;
+                if (l._has_hash && r._has_hash && l._hash != r._hash) return false;
 
-                for (unsigned int i = 0; i < l._size; i++) {
-                    if (l._data[i] != r._data[i]) return false;
-                }
-
-                return true;
+                return l.view() == r.view();
             }
 
         private:
 
-            String(unsigned int new_size)
-            : _size(new_size),
-            _data(new char[new_size + 1]),
-            _has_hash(false),
-            _hash(0) {
-                _data[_size] = 0;
+            String(size_t new_size) : _has_hash(false), _hash(0) {
+                allocate(new_size);
+            }
+
+            bool is_inline() const {
+                return _data == _inline;
             }
 
             /*
-             * Computes the FNV-1a hash
+             * Makes room for 'size' characters and the terminator, inline if they fit.
+             * The string must not own a buffer already.
              */
-            hash_type compute_hash() const {
-                // Offset basis for 64-bit hash
-                uint64_t hash = 14695981039346656037ULL;
+            void allocate(size_t size) {
+                _size = size;
+                _data = size <= INLINE_CAPACITY ? _inline : new char[size + 1];
+                _data[size] = 0;
+            }
 
-                for (unsigned int i = 0; i < _size; i++) {
-                    hash ^= _data[i];
+            void assign(const char *str, size_t size) {
+                allocate(size);
+                memcpy(_data, str, size);
+            }
 
-                    // FNV Prime for 64-bit hash
-                    hash *= 1099511628211ULL;
+            /*
+             * Takes the characters from another string, which is left empty.  A heap
+             * buffer is handed over; inline characters have to be copied.
+             */
+            void take(String& str) {
+                _size = str._size;
+                _has_hash = str._has_hash;
+                _hash = str._hash;
+
+                if (str.is_inline()) {
+                    _data = _inline;
+                    memcpy(_inline, str._inline, str._size + 1);
+                } else {
+                    _data = str._data;
                 }
 
-                return (hash_type) hash;
+                str._size = 0;
+                str._data = str._inline;
+                str._inline[0] = 0;
+                str._has_hash = false;
+            }
+
+            void release() {
+                if (!is_inline()) delete[] _data;
             }
 
             size_t _size;
-            char *_data;
+            char *_data;                            // Either _inline, or a buffer on the heap
+            char _inline[INLINE_CAPACITY + 1];
 
             mutable bool _has_hash;
             mutable hash_type _hash;
@@ -14,43 +14,43 @@ namespace infos {
 
 			P _val;
 
-			Duration() : _val(0) {
+			constexpr Duration() : _val(0) {
 			}
 
-			Duration(P val) : _val(val) {
+			constexpr Duration(P val) : _val(val) {
 			}
 
-			Self& operator+=(const Self& amt) {
+			constexpr Self& operator+=(const Self& amt) {
 				_val += amt._val;
 				return *this;
 			}
 
-			Self& operator-=(const Self& amt) {
+			constexpr Self& operator-=(const Self& amt) {
 				_val -= amt._val;
 				return *this;
 			}
 
-			friend Self operator+(const Self& l, const Self& r) {
+			friend constexpr Self operator+(const Self& l, const Self& r) {
 				return Self(l._val + r._val);
 			}
 
-			friend Self operator+(const Self& l, const P& r) {
+			friend constexpr Self operator+(const Self& l, const P& r) {
 				return Self(l._val + r);
 			}
 
-			friend Self operator-(const Self& l, const Self& r) {
+			friend constexpr Self operator-(const Self& l, const Self& r) {
 				return Self(r._val - l._val);
 			}
 			
-			friend bool operator<(const Self& l, const Self& r) {
+			friend constexpr bool operator<(const Self& l, const Self& r) {
 				return l._val < r._val;
 			}
 
-			friend bool operator>(const Self& l, const Self& r) {
+			friend constexpr bool operator>(const Self& l, const Self& r) {
 				return l._val > r._val;
 			}
 
-			P count() const {
+			constexpr P count() const {
 				return _val;
 			}
 		};
@@ -67,43 +67,49 @@ namespace infos {
 
 			Dur _val;
 
-			TimepointImpl() : _val(0) {
+			constexpr TimepointImpl() : _val(0) {
 			}
 
-			TimepointImpl(typename Dur::_P val) : _val(val) {
+			constexpr TimepointImpl(typename Dur::_P val) : _val(val) {
 			}
 
-			const Dur& time_since_epoch() const {
+			constexpr const Dur& time_since_epoch() const {
 				return _val;
 			}
 
-			Self& operator+=(const Dur& amt) {
+			constexpr Self& operator+=(const Dur& amt) {
 				_val += amt._val;
 				return *this;
 			}
 
-			friend Dur operator-(const Self& lhs, const Self& rhs) {
+			friend constexpr Dur operator-(const Self& lhs, const Self& rhs) {
 				return Dur(rhs._val - lhs._val);
 			}
 
-			friend bool operator<(const Self& l, const Self& r) {
+			friend constexpr bool operator<(const Self& l, const Self& r) {
 				return l._val._val < r._val._val;
 			}
 
-			TimepointImpl(Dur dur) : _val(dur) {
+			constexpr TimepointImpl(Dur dur) : _val(dur) {
 			}
 		};
 
+		/* The ratio is in lowest terms (see Ratio), so a conversion between units that
+		 * are a whole number of one another, e.g. milliseconds into nanoseconds, is one
+		 * multiply or one divide, and a constant one folds away altogether. */
 		template<typename Ratio, typename REP>
 		struct DurationCastImpl {
 
-			__cxp static REP DoCast(REP in) {
-
-				return REP(static_cast<REP> (static_cast<REP> (in)
-						* static_cast<REP> (Ratio::num)
-						/ static_cast<REP> (Ratio::den)));
-
-				return in;
+			static constexpr REP DoCast(REP in) {
+				if constexpr (Ratio::num == 1 && Ratio::den == 1) {
+					return in;
+				} else if constexpr (Ratio::den == 1) {
+					return in * static_cast<REP> (Ratio::num);
+				} else if constexpr (Ratio::num == 1) {
+					return in / static_cast<REP> (Ratio::den);
+				} else {
+					return in * static_cast<REP> (Ratio::num) / static_cast<REP> (Ratio::den);
+				}
 			}
 		};
 
@@ -117,13 +123,66 @@ namespace infos {
 			return DurationCastImpl<TranslationRatio, Rep>::DoCast(v._val);
 		}
 
+		static_assert(DurationCast<Nanoseconds>(Milliseconds(10)).count() == 10000000, "DurationCast is folded at compile time");
+
 		template<typename X, typename P>
-		TimepointImpl<P> operator+(const TimepointImpl<P>& lhs, const X& rhs) {
+		constexpr TimepointImpl<P> operator+(const TimepointImpl<P>& lhs, const X& rhs) {
 			return TimepointImpl<P>(lhs._val + DurationCast<typename TimepointImpl<P>::_Dur > (rhs));
 		}
 
+		/* Converts a count of one clock's ticks into another's, when their rates are only
+		 * known at runtime (e.g. TSC cycles into nanoseconds, once the TSC has been
+		 * calibrated), as (ticks * mult) >> shift, with a 128-bit product, so that a
+		 * conversion on a hot path is one multiply and one shift, not a division. */
+		struct ClockScale {
+			uint64_t mult;
+			unsigned int shift;
+
+			constexpr ClockScale() : mult(0), shift(0) {
+			}
+
+			constexpr ClockScale(uint64_t mult, unsigned int shift) : mult(mult), shift(shift) {
+			}
+
+			/* The scale that multiplies by num / den, with the largest shift whose
+			 * mult still fits in 64 bits, which is the most precise.  The fraction is
+			 * worked out a bit at a time, by long division, as the kernel has no
+			 * 128-bit division. */
+			static constexpr ClockScale from_ratio(uint64_t num, uint64_t den) {
+				uint64_t mult = num / den, rem = num % den;
+
+				unsigned int shift = 63;
+				if (mult) shift = __builtin_clzll(mult);
+
+				for (unsigned int i = 0; i < shift; i++) {
+					bool carry = rem >> 63;
+					rem <<= 1;
+					mult <<= 1;
+
+					if (carry || rem >= den) {
+						rem -= den;
+						mult |= 1;
+					}
+				}
+
+				return ClockScale(mult, shift);
+			}
+
+			constexpr bool valid() const {
+				return mult != 0;
+			}
+
+			constexpr uint64_t scale(uint64_t ticks) const {
+				return (uint64_t)(((unsigned __int128)ticks * mult) >> shift);
+			}
+		};
+
 		struct KernelRuntimeClock {
 			typedef TimepointImpl<> Timepoint;
+
+			/* The time since the clock was started, to the nanosecond.  This is
+			 * implemented by the architecture. */
+			static Timepoint now();
 		};
 		
 		struct TimeOfDay {
@@ -3,7 +3,7 @@
 #pragma once
 
 #include <infos/define.h>
-#include <infos/util/list.h>
+#include <infos/util/spinlock.h>
 
 namespace infos
 {
@@ -14,14 +14,112 @@ namespace infos
 
 	namespace util
 	{
+		/* A FIFO of sleeping threads.  It is linked through a node on each sleeping
+		 * thread's stack, so sleeping never allocates, and the locks used by the
+		 * allocators themselves (i.e. Mutex) can be built on it.  The queue has its
+		 * own lock, which is safe to take in an interrupt handler, so a thread can be
+		 * woken from one. */
 		class WakeQueue
 		{
 		public:
-            void sleep(kernel::Thread& thread);
-            void wake();
+			/* The most keys a thread can sleep on at once. */
+			static const unsigned int MAX_SLEEP_KEYS = 16;
+
+			/* What a keyed sleeper is waiting on: some word of some object, e.g. a
+			 * user address in a process.  Several keys can share a queue. */
+			struct Key
+			{
+				const void *object;
+				uintptr_t offset;
+
+				bool operator==(const Key& other) const { return object == other.object && offset == other.offset; }
+			};
+
+			/* Something waiting on the queue that isn't a thread, e.g. a suspended
+			 * kernel task (see kernel/task.h): when it is woken, instead of a thread
+			 * being made runnable, 'fn' is called with the queue's lock held, possibly
+			 * in an interrupt handler, so it mustn't sleep.  It must stay put until
+			 * it has been woken. */
+			typedef void (*WakeFn)(void *arg);
+
+			struct Callback
+			{
+				WakeFn fn;
+				void *arg;
+			};
+
+			WakeQueue() : _head(NULL), _tail(NULL) { }
+
+			/* Puts the thread, which must be the current one, to sleep until it is
+			 * woken up. */
+			void sleep(kernel::Thread& thread);
+
+			/* The same, but called with the queue's lock held, and interrupts disabled.
+			 * The lock is released while the thread sleeps, and held again on return.
+			 * A caller that checks what it is waiting for under the lock, and a waker
+			 * that makes it so under the lock, can't miss each other. */
+			void sleep_locked(kernel::Thread& thread);
+
+			/* The same, but the thread is only woken by wake_key_locked() with the same
+			 * key (or by wake_one() and wake_all()). */
+			void sleep_locked(kernel::Thread& thread, const Key& key);
+
+			/* The same, but the thread is woken by wake_key_locked() with any of the
+			 * keys, and the index of the key it was woken for is returned. */
+			unsigned int sleep_any_locked(kernel::Thread& thread, const Key *keys, unsigned int nr_keys);
+
+			/* Called with the queue's lock held: puts a callback on the queue, which
+			 * is woken, in its turn, as a sleeping thread would be.  It is in the
+			 * waiter, which the caller provides, so that this never allocates. */
+			struct CallbackWaiter;
+			void wait_callback_locked(CallbackWaiter& waiter, WakeFn fn, void *arg);
+
+			/* Wakes the thread that has been waiting longest.  Returns false if there
+			 * wasn't one. */
+			bool wake_one();
+			void wake_all();
+
+			/* The same as wake_one(), but called with the lock held. */
+			bool wake_one_locked();
+
+			/* Called with the lock held: wakes up to 'max' of the threads sleeping on
+			 * the key, oldest first, and returns how many were woken.  A sleeper whose
+			 * thread has been stopped is taken off the queue, but not woken. */
+			unsigned int wake_key_locked(const Key& key, unsigned int max);
+
+			/* Called with the lock held: takes every sleeper on a key of the object off
+			 * the queue, without waking it, e.g. because the object is going away with
+			 * its threads still asleep. */
+			void forget_locked(const void *object);
+
+			SpinLock& lock() { return _lock; }
+			bool empty() const { return _head == NULL; }
+
+		private:
+			// A waiter with no thread has a callback instead.
+			struct Waiter
+			{
+				kernel::Thread *thread;
+				Waiter *next;
+				volatile bool woken;
+				Key key;
+				Callback callback;
+			};
+
+		public:
+			struct CallbackWaiter
+			{
+				Waiter waiter;
+			};
 
 		private:
-			util::List<kernel::Thread *> _waiters;
+
+			Waiter *_head, *_tail;
+			SpinLock _lock;
+
+			void append(Waiter& waiter);
+			void unlink(Waiter *waiter, Waiter *prev);
+			static void wake(Waiter *waiter);
 		};
 	}
 }
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/async-group.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/async-group.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/thread.h>
+#include <infos/util/lock.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+
+void AsyncGroup::run(AsyncFn fn, void *arg)
+{
+	Item *item = sys.scheduler().active() ? new Item : NULL;
+	if (!item) {
+		fn(arg);
+		return;
+	}
+
+	item->group = this;
+	item->fn = fn;
+	item->arg = arg;
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_waiters.lock());
+		_nr_running++;
+	}
+
+	Thread& thread = sys.create_kernel_thread((Thread::thread_proc_t)threadproc, _name);
+	thread.add_entry_argument(item);
+	thread.start();
+}
+
+void AsyncGroup::wait()
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_waiters.lock());
+
+	while (_nr_running) {
+		_waiters.sleep_locked(Thread::current());
+	}
+}
+
+void AsyncGroup::threadproc(Item *item)
+{
+	AsyncGroup *group = item->group;
+	item->fn(item->arg);
+	delete item;
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(group->_waiters.lock());
+
+		if (--group->_nr_running == 0) {
+			while (group->_waiters.wake_one_locked());
+		}
+	}
+
+	Thread::current().stop();
+}
@@ -0,0 +1,213 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/benchmark.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/benchmark.h>
+#include <infos/kernel/log.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/util/printf.h>
+#include <infos/util/lock.h>
+#include <arch/x86/msr.h>
+#include <arch/x86/qemu-stream.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+using namespace infos::arch::x86;
+
+#define MAX_REPETITIONS		1000
+
+static char bench_patterns[64];
+static unsigned int bench_repetitions = 100;
+static unsigned int bench_warmup = 10;
+static bool bench_power_off;
+
+static unsigned int parse_count(const char *value)
+{
+	unsigned int count = 0;
+	for (const char *p = value; *p >= '0' && *p <= '9'; p++) {
+		count = count * 10 + (*p - '0');
+		if (count > MAX_REPETITIONS) return MAX_REPETITIONS;
+	}
+
+	return count;
+}
+
+// A comma-separated list of globs, e.g. bench=string.*,hashmap.hit
+RegisterCmdLineArgument(Bench, "bench")
+{
+	strncpy(bench_patterns, value, sizeof(bench_patterns) - 1);
+}
+
+RegisterCmdLineArgument(BenchRepetitions, "bench.reps")
+{
+	unsigned int reps = parse_count(value);
+	if (reps) bench_repetitions = reps;
+}
+
+RegisterCmdLineArgument(BenchWarmup, "bench.warmup")
+{
+	bench_warmup = parse_count(value);
+}
+
+RegisterCmdLineArgument(BenchPowerOff, "bench.poweroff")
+{
+	bench_power_off = strncmp(value, "1", 2) == 0;
+}
+
+extern char _BENCHMARKS_START, _BENCHMARKS_END;
+
+static uint64_t samples[MAX_REPETITIONS];
+
+// What the benchmark that is running has asked for.
+static uint64_t paused_cycles, pause_start;
+static const char *skip_reason;
+
+void infos::kernel::benchmark_pause()
+{
+	pause_start = __rdtsc();
+}
+
+void infos::kernel::benchmark_resume()
+{
+	paused_cycles += __rdtsc() - pause_start;
+}
+
+void infos::kernel::benchmark_skip(const char *reason)
+{
+	skip_reason = reason;
+}
+
+/* Whether 'name' matches the pattern that runs from 'pattern' to 'end', where '*' matches
+ * any run of characters, and '?' any one. */
+static bool glob_match(const char *pattern, const char *end, const char *name)
+{
+	const char *star = NULL, *star_name = NULL;
+
+	while (*name) {
+		if (pattern < end && (*pattern == '?' || *pattern == *name)) {
+			pattern++;
+			name++;
+		} else if (pattern < end && *pattern == '*') {
+			star = pattern++;
+			star_name = name;
+		} else if (star) {
+			// Let the last star take one more character, and try again after it.
+			pattern = star + 1;
+			name = ++star_name;
+		} else {
+			return false;
+		}
+	}
+
+	while (pattern < end && *pattern == '*') pattern++;
+	return pattern == end;
+}
+
+static bool selected(const char *name)
+{
+	const char *pattern = bench_patterns;
+
+	for (;;) {
+		const char *end = pattern;
+		while (*end && *end != ',') end++;
+
+		if (end > pattern && glob_match(pattern, end, name)) return true;
+		if (!*end) return false;
+
+		pattern = end + 1;
+	}
+}
+
+/* Writes a line straight to the QEMU debug port, rather than through the log, so that
+ * the results are in one place, with nothing else in the middle of them. */
+static void emit(const char *fmt, ...)
+{
+	char buffer[192];
+	va_list args;
+
+	va_start(args, fmt);
+	int n = vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
+	va_end(args);
+
+	if (n < 0) return;
+	if (n > (int)sizeof(buffer) - 2) n = sizeof(buffer) - 2;
+	buffer[n++] = '\n';
+
+	UniqueIRQLock irq;
+	qemu_stream.write(buffer, n);
+}
+
+static void sort(uint64_t *values, unsigned int nr)
+{
+	for (unsigned int i = 1; i < nr; i++) {
+		uint64_t v = values[i];
+
+		unsigned int j = i;
+		for (; j > 0 && values[j - 1] > v; j--) values[j] = values[j - 1];
+		values[j] = v;
+	}
+}
+
+static void run(const BenchmarkRegistration& benchmark)
+{
+	unsigned int iterations = benchmark.iterations ? benchmark.iterations : 1;
+
+	skip_reason = NULL;
+	for (unsigned int i = 0; i < bench_warmup + bench_repetitions; i++) {
+		paused_cycles = 0;
+
+		uint64_t start = __rdtsc();
+		benchmark.fn(iterations);
+		uint64_t cycles = __rdtsc() - start - paused_cycles;
+
+		if (skip_reason) {
+			emit("BENCH name=%s skipped=\"%s\"", benchmark.name, skip_reason);
+			return;
+		}
+
+		if (i >= bench_warmup) samples[i - bench_warmup] = cycles / iterations;
+	}
+
+	sort(samples, bench_repetitions);
+
+	// The median is the lower one of the middle two, and p99 is by nearest rank.
+	uint64_t median = samples[(bench_repetitions - 1) / 2];
+	uint64_t p99 = samples[(bench_repetitions * 99 + 99) / 100 - 1];
+
+	emit("BENCH name=%s iterations=%u reps=%u min=%llu median=%llu p99=%llu max=%llu",
+		benchmark.name, iterations, bench_repetitions, samples[0], median, p99, samples[bench_repetitions - 1]);
+}
+
+void infos::kernel::run_benchmarks()
+{
+	if (!bench_patterns[0]) return;
+
+	syslog.messagef(LogLevel::IMPORTANT, "Running the benchmarks that match '%s'", bench_patterns);
+
+	emit("BENCH-BEGIN warmup=%u reps=%u unit=cycles/iteration", bench_warmup, bench_repetitions);
+
+	unsigned int nr_run = 0;
+	for (const BenchmarkRegistration *benchmark = (const BenchmarkRegistration *)&_BENCHMARKS_START;
+			benchmark < (const BenchmarkRegistration *)&_BENCHMARKS_END; benchmark++) {
+		if (!selected(benchmark->name)) continue;
+
+		run(*benchmark);
+		nr_run++;
+	}
+
+	emit("BENCH-END count=%u", nr_run);
+
+	if (bench_power_off) {
+		syslog.message(LogLevel::IMPORTANT, "Benchmarks finished: powering off");
+		syslog.flush();
+
+		arch_power_off();
+	}
+}
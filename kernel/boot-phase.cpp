@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/boot-phase.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/boot-phase.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
+#include <infos/util/lock.h>
+#include <infos/util/printf.h>
+#include <arch/arch.h>
+#include <arch/x86/msr.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+using namespace infos::arch::x86;
+
+/*
+ * The phases are recorded in the order they start, with nothing but a cycle counter read
+ * and a store, so that they can be started before the static constructors have run (the
+ * records are in the BSS), and cost next to nothing.  The boot runs on one CPU, and mostly
+ * one thread, so the phases nest as a single stack.
+ */
+
+#define MAX_BOOT_PHASES		64
+#define MAX_BOOT_DEPTH		8
+
+// How many of the phases that took longest on their own are listed after the tree.
+#define NR_SLOWEST			5
+
+static ComponentLog boot_log(syslog, "boot");
+
+struct BootPhaseRecord
+{
+	const char *name;
+	uint64_t start, end;
+	unsigned int depth;
+};
+
+static BootPhaseRecord phases[MAX_BOOT_PHASES];
+static unsigned int nr_phases;
+
+// The phases that haven't ended yet, innermost last.
+static unsigned int open_phases[MAX_BOOT_DEPTH];
+static unsigned int depth;
+
+// Phases that were started when there was no room for them, whose ends are ignored.
+static unsigned int nr_unrecorded;
+
+static bool reported;
+
+void infos::kernel::boot_phase_begin_at(const char *name, uint64_t tsc)
+{
+	UniqueIRQLock irq;
+
+	if (reported) return;
+
+	if (nr_phases >= MAX_BOOT_PHASES || depth >= MAX_BOOT_DEPTH) {
+		nr_unrecorded++;
+		return;
+	}
+
+	BootPhaseRecord& phase = phases[nr_phases];
+	phase.name = name;
+	phase.start = tsc;
+	phase.end = 0;
+	phase.depth = depth;
+
+	open_phases[depth++] = nr_phases++;
+}
+
+void infos::kernel::boot_phase_begin(const char *name)
+{
+	boot_phase_begin_at(name, __rdtsc());
+}
+
+void infos::kernel::boot_phase_end()
+{
+	uint64_t now = __rdtsc();
+
+	UniqueIRQLock irq;
+
+	if (reported) return;
+
+	if (nr_unrecorded) {
+		nr_unrecorded--;
+		return;
+	}
+
+	if (!depth) return;
+	phases[open_phases[--depth]].end = now;
+}
+
+/* Turns cycles into microseconds, if the runtime clock is the TSC. */
+static bool cycles_to_us(uint64_t cycles, uint64_t& us)
+{
+	uint64_t base, mult;
+	unsigned int shift;
+
+	if (!sys.arch().runtime_clock_source(base, mult, shift)) return false;
+
+	us = ClockScale(mult, shift).scale(cycles) / 1000;
+	return true;
+}
+
+/* How long a phase took, less the phases that were part of it. */
+static uint64_t self_cycles(unsigned int index)
+{
+	const BootPhaseRecord& phase = phases[index];
+	uint64_t self = phase.end - phase.start;
+
+	for (unsigned int i = index + 1; i < nr_phases && phases[i].depth > phase.depth; i++) {
+		if (phases[i].depth == phase.depth + 1) self -= phases[i].end - phases[i].start;
+	}
+
+	return self;
+}
+
+static void log_phase(const char *name, unsigned int indent, uint64_t cycles, uint64_t self, uint64_t total)
+{
+	char label[48];
+	unsigned int n = 0;
+	for (unsigned int i = 0; i < indent && n < 16; i++) {
+		label[n++] = ' ';
+		label[n++] = ' ';
+	}
+	snprintf(label + n, sizeof(label) - n, "%s", name);
+
+	unsigned int permille = total ? (unsigned int)((cycles * 1000) / total) : 0;
+
+	uint64_t us, self_us;
+	if (cycles_to_us(cycles, us) && cycles_to_us(self, self_us)) {
+		boot_log.messagef(LogLevel::INFO, "%32s %14llu %10llu %10llu %4u.%u%%",
+				label, cycles, us, self_us, permille / 10, permille % 10);
+	} else {
+		boot_log.messagef(LogLevel::INFO, "%32s %14llu %10s %10s %4u.%u%%",
+				label, cycles, "-", "-", permille / 10, permille % 10);
+	}
+}
+
+void infos::kernel::boot_phase_report()
+{
+	uint64_t now = __rdtsc();
+
+	{
+		UniqueIRQLock irq;
+
+		if (reported) return;
+		reported = true;
+
+		// Anything still going, e.g. the phase that called this, ends here.
+		while (depth) phases[open_phases[--depth]].end = now;
+	}
+
+	if (!nr_phases) return;
+
+	uint64_t total = now - phases[0].start;
+	uint64_t top_level = 0;
+
+	boot_log.messagef(LogLevel::INFO, "%32s         cycles         us    self us    boot", "phase");
+
+	for (unsigned int i = 0; i < nr_phases; i++) {
+		const BootPhaseRecord& phase = phases[i];
+		uint64_t cycles = phase.end - phase.start;
+
+		if (phase.depth == 0) top_level += cycles;
+		log_phase(phase.name, phase.depth, cycles, self_cycles(i), total);
+	}
+
+	// Time between the top-level phases, e.g. before the boot thread is first scheduled.
+	log_phase("(not in a phase)", 0, total - top_level, total - top_level, total);
+	log_phase("(total)", 0, total, total, total);
+
+	// The boot is a single sequence, so every phase is on its critical path, and the
+	// ones that took longest themselves are the ones to make shorter.
+	unsigned int slowest[NR_SLOWEST];
+	unsigned int nr_slowest = 0;
+
+	for (unsigned int i = 0; i < nr_phases; i++) {
+		uint64_t self = self_cycles(i);
+
+		unsigned int pos = nr_slowest;
+		while (pos > 0 && self_cycles(slowest[pos - 1]) < self) pos--;
+		if (pos >= NR_SLOWEST) continue;
+
+		if (nr_slowest < NR_SLOWEST) nr_slowest++;
+		for (unsigned int j = nr_slowest - 1; j > pos; j--) slowest[j] = slowest[j - 1];
+		slowest[pos] = i;
+	}
+
+	boot_log.message(LogLevel::INFO, "longest on their own:");
+	for (unsigned int i = 0; i < nr_slowest; i++) {
+		log_phase(phases[slowest[i]].name, 1, self_cycles(slowest[i]), self_cycles(slowest[i]), total);
+	}
+}
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/clock-page.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/clock-page.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/vma.h>
+#include <arch/arch.h>
+#include <arch/x86/vma.h>
+
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::util;
+
+bool ClockPage::init()
+{
+	_frame = sys.mm().pgalloc().allocate(0, PageAllocFlags::ZERO);
+	if (!_frame) return false;
+
+	_page = (volatile UserClockPage *)sys.mm().pgalloc().pfdescr_to_vpa(_frame);
+
+	uint64_t base, mult;
+	unsigned int shift;
+	if (sys.arch().runtime_clock_source(base, mult, shift)) {
+		_page->counter_base = base;
+		_page->counter_mult = mult;
+		_page->counter_shift = shift;
+	}
+
+	return true;
+}
+
+bool ClockPage::map_into(VMA& vma)
+{
+	if (!_frame) return false;
+
+	// The page isn't the VMA's, so it isn't freed when the VMA goes.
+	vma.map_range(USER_CLOCK_PAGE_VA, sys.mm().pgalloc().pfdescr_to_pa(_frame), 1, PTE_PRESENT | PTE_ALLOW_USER);
+	return true;
+}
+
+void ClockPage::update_tod(const TimeOfDay& tod, KernelRuntimeClock::Timepoint runtime)
+{
+	if (!_page) return;
+
+	// Writers are serialised by the TOD lock, so only readers need telling.
+	uint32_t sequence = _page->sequence;
+	__atomic_store_n(&_page->sequence, sequence + 1, __ATOMIC_RELEASE);
+	asm volatile("" ::: "memory");
+
+	_page->tod_runtime = runtime.time_since_epoch().count();
+	_page->tod_seconds = tod.seconds;
+	_page->tod_minutes = tod.minutes;
+	_page->tod_hours = tod.hours;
+	_page->tod_day = tod.day;
+	_page->tod_month = tod.month;
+	_page->tod_year = tod.year;
+
+	asm volatile("" ::: "memory");
+	__atomic_store_n(&_page->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
@@ -11,7 +11,11 @@
 #include <infos/kernel/device-manager.h>
 #include <infos/kernel/irq.h>
 #include <infos/kernel/log.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
 #include <infos/drivers/device.h>
+#include <infos/fs/vfs-node.h>
 
 using namespace infos::kernel;
 using namespace infos::drivers;
@@ -19,19 +23,35 @@ using namespace infos::util;
 
 ComponentLog dm_log(syslog, "devmgr");
 
-DeviceManager::DeviceManager(Kernel& owner) : Subsystem(owner)
+// What devices_of_class() gives for a class that has no devices.
+static const DeviceManager::DeviceList no_devices;
+
+DeviceManager::DeviceManager(Kernel& owner) : Subsystem(owner), _init_pending(), _init_failed(0)
 {
 	
 }
 
 bool DeviceManager::register_device(drivers::Device& device)
 {	
-	uint64_t instance = device.device_class().acquire_instance();
-	
-	device.assign_name(String(device.device_class().name) + ToString(instance));
-	
+	bool added;
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_lock);
+
+		uint64_t instance = device.device_class().acquire_instance();
+		device.assign_name(String(device.device_class().name) + ToString(instance));
+		added = _devices.add(device.name().get_hash(), &device) && index_device(device);
+	}
+
+	if (!added) {
+		dm_log.messagef(LogLevel::ERROR, "unable to register device '%s'", device.name().c_str());
+		return false;
+	}
+
 	dm_log.messagef(LogLevel::DEBUG, "registering device '%s'", device.name().c_str());
-	_devices.add(device.name().get_hash(), &device);
+
+	// The device's name has appeared in /dev.
+	fs::VFSNode::invalidate_negative_entries();
 		
 	if (!device.init(*this)) {
 		dm_log.messagef(LogLevel::ERROR, "device '%s' failed to initialise", device.name().c_str());
@@ -41,11 +61,151 @@ bool DeviceManager::register_device(drivers::Device& device)
 	return true;
 }
 
+bool DeviceManager::index_device(drivers::Device& device)
+{
+	for (const DeviceClass *cls = &device.device_class(); cls; cls = cls->parent) {
+		DeviceList *devices;
+		if (!_by_class.try_get_value(cls, devices)) {
+			devices = new DeviceList();
+			if (!devices) return false;
+
+			if (!_by_class.add(cls, devices)) {
+				delete devices;
+				return false;
+			}
+		}
+
+		devices->append(&device);
+	}
+
+	return true;
+}
+
+const DeviceManager::DeviceList& DeviceManager::devices_of_class(const drivers::DeviceClass& device_class) const
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	DeviceList *devices;
+	if (!_by_class.try_get_value(&device_class, devices)) {
+		return no_devices;
+	}
+
+	return *devices;
+}
+
 bool DeviceManager::add_device_alias(const util::String& name, drivers::Device& device)
 {
 	// TODO: Check to make sure 'device' exists.
 	dm_log.messagef(LogLevel::DEBUG, "registering device alias '%s' for '%s'", name.c_str(), device.name().c_str());
-	_devices.add(name.get_hash(), &device);
+
+	bool added;
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_lock);
+		added = _devices.add(name.get_hash(), &device);
+	}
+
+	if (!added) return false;
+
+	fs::VFSNode::invalidate_negative_entries();
 	
 	return true;
 }
+
+/*
+ * Background initialisation.  Each piece of work runs in a kernel thread of its own, so that
+ * the groups (and the pieces of one group, e.g. two disk controllers) come up alongside one
+ * another, and the boot thread only waits where it needs something that one of them provides.
+ */
+static const char *init_thread_names[DeviceInitGroup::NR_GROUPS] = {
+	"devinit-storage", "devinit-console", "devinit-network", "devinit-pseudo", "devinit-protocols"
+};
+
+struct DeviceInitWork
+{
+	DeviceManager *dm;
+	DeviceInitGroup::DeviceInitGroup group;
+	DeviceManager::DeviceInitFn fn;
+	void *arg;
+	unsigned int after;
+};
+
+void DeviceManager::init_async(DeviceInitGroup::DeviceInitGroup group, DeviceInitFn fn, void *arg, unsigned int after)
+{
+	unsigned int index = __builtin_ctz(group);
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_init_done.lock());
+		_init_pending[index]++;
+	}
+
+	DeviceInitWork *work = sys.scheduler().active() ? new DeviceInitWork : NULL;
+	if (!work) {
+		wait_for_init(after);
+		init_finished(group, fn(arg));
+		return;
+	}
+
+	work->dm = this;
+	work->group = group;
+	work->fn = fn;
+	work->arg = arg;
+	work->after = after;
+
+	Thread& thread = sys.create_kernel_thread((Thread::thread_proc_t)init_threadproc, init_thread_names[index]);
+	thread.add_entry_argument(work);
+	thread.start();
+}
+
+void DeviceManager::register_device_async(drivers::Device& device, DeviceInitGroup::DeviceInitGroup group)
+{
+	init_async(group, register_device_fn, &device);
+}
+
+bool DeviceManager::register_device_fn(void *arg)
+{
+	return sys.device_manager().register_device(*(Device *)arg);
+}
+
+void DeviceManager::init_threadproc(void *arg)
+{
+	DeviceInitWork *work = (DeviceInitWork *)arg;
+
+	// Work that depends on a group that failed still runs, and finds out for itself
+	// whether what it needs is there.
+	work->dm->wait_for_init(work->after);
+	work->dm->init_finished(work->group, work->fn(work->arg));
+
+	delete work;
+	Thread::current().stop();
+}
+
+void DeviceManager::init_finished(DeviceInitGroup::DeviceInitGroup group, bool success)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_init_done.lock());
+
+	if (!success) _init_failed |= group;
+
+	if (--_init_pending[__builtin_ctz(group)] == 0) {
+		while (_init_done.wake_one_locked());
+	}
+}
+
+bool DeviceManager::wait_for_init(unsigned int groups)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_init_done.lock());
+
+	for (unsigned int i = 0; i < DeviceInitGroup::NR_GROUPS; i++) {
+		if (!(groups & (1u << i))) continue;
+
+		while (_init_pending[i]) {
+			_init_done.sleep_locked(Thread::current());
+		}
+	}
+
+	return !(_init_failed & groups);
+}
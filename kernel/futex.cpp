@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/futex.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/futex.h>
+#include <infos/kernel/process.h>
+#include <infos/kernel/thread.h>
+#include <infos/mm/user-access.h>
+#include <infos/util/lock.h>
+
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::util;
+
+// The number of wait queues that futexes are hashed into.  Futexes that share a queue
+// are told apart by their key, so this only limits how much the waiters contend.
+#define FUTEX_BUCKETS		64
+
+/**
+ * One wait queue, and the number of wakes there have ever been on its futexes.  A
+ * waiter reads the futex word without the lock (it may fault, and need to read a file
+ * page in), and finds out whether a wake got in after that by checking the count
+ * under the lock.
+ */
+struct FutexBucket
+{
+	WakeQueue waiters;
+	volatile uint32_t nr_wakes;
+};
+
+static FutexBucket buckets[FUTEX_BUCKETS];
+
+static inline FutexBucket& bucket_for(const WakeQueue::Key& key)
+{
+	uint64_t hash = ((uintptr_t)key.object ^ (key.offset >> 2)) * 0x9e3779b97f4a7c15ull;
+	return buckets[(hash >> 58) % FUTEX_BUCKETS];
+}
+
+int infos::kernel::futex_wait(Process& process, uintptr_t address, uint32_t expected)
+{
+	if (address & 3) return -1;
+
+	WakeQueue::Key key = { &process, address };
+	FutexBucket& bucket = bucket_for(key);
+
+	// The count is read before the word: a waker changes the word before it bumps the
+	// count, so if the word is (still) as expected, any wake since then shows up below.
+	uint32_t nr_wakes = __atomic_load_n(&bucket.nr_wakes, __ATOMIC_ACQUIRE);
+
+	uint32_t value;
+	if (!copy_from_user(&value, address, sizeof(value))) return -1;
+	if (value != expected) return 1;
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(bucket.waiters.lock());
+
+	if (bucket.nr_wakes != nr_wakes) return 0;
+
+	bucket.waiters.sleep_locked(Thread::current(), key);
+	return 0;
+}
+
+unsigned int infos::kernel::futex_wake(Process& process, uintptr_t address, unsigned int max)
+{
+	if (address & 3) return 0;
+
+	WakeQueue::Key key = { &process, address };
+	FutexBucket& bucket = bucket_for(key);
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(bucket.waiters.lock());
+
+	__atomic_add_fetch(&bucket.nr_wakes, 1, __ATOMIC_RELEASE);
+	return bucket.waiters.wake_key_locked(key, max);
+}
+
+void infos::kernel::futex_release(Process& process)
+{
+	for (unsigned int i = 0; i < FUTEX_BUCKETS; i++) {
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(buckets[i].waiters.lock());
+
+		buckets[i].waiters.forget_locked(&process);
+	}
+}
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/handle-table.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/handle-table.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+
+// Marks the end of the free list.  Slot zero is never free, so it can't be confused
+// with a real slot.
+#define HANDLE_FREE_END		0
+
+HandleTable::HandleTable() : _nr_chunks(0), _free_head(HANDLE_FREE_END), _count(0)
+{
+	for (unsigned int i = 0; i < MAX_CHUNKS; i++) {
+		_chunks[i] = NULL;
+	}
+}
+
+HandleTable::~HandleTable()
+{
+	for (unsigned int i = 0; i < _nr_chunks; i++) {
+		delete[] _chunks[i];
+	}
+}
+
+/**
+ * Adds another chunk of slots to the table, and puts them on the free list.  The table
+ * lock must be held.
+ */
+bool HandleTable::grow()
+{
+	if (_nr_chunks == MAX_CHUNKS) return false;
+
+	Slot *chunk = new Slot[SLOTS_PER_CHUNK];
+	if (!chunk) return false;
+
+	unsigned int base = _nr_chunks * SLOTS_PER_CHUNK;
+
+	// Thread the new slots onto the free list in order, so that the lowest handles
+	// are used first.  Slot zero of the first chunk is never handed out.
+	unsigned int first = (base == 0) ? 1 : 0;
+	for (unsigned int i = first; i < SLOTS_PER_CHUNK; i++) {
+		chunk[i].object = NULL;
+		chunk[i].next_free = (i + 1 < SLOTS_PER_CHUNK) ? base + i + 1 : _free_head;
+	}
+
+	if (first) {
+		chunk[0].object = NULL;
+		chunk[0].next_free = HANDLE_FREE_END;
+	}
+
+	_free_head = base + first;
+
+	// Lookups don't take the lock, so the chunk must be ready before it is published.
+	asm volatile("" ::: "memory");
+	_chunks[_nr_chunks++] = chunk;
+
+	return true;
+}
+
+ObjectHandle HandleTable::add(void *obj)
+{
+	assert(obj);
+
+	UniqueLock<Mutex> l(_lock);
+
+	if (_free_head == HANDLE_FREE_END && !grow()) {
+		return KernelObject::Error;
+	}
+
+	unsigned int handle = _free_head;
+	Slot& slot = _chunks[handle / SLOTS_PER_CHUNK][handle % SLOTS_PER_CHUNK];
+
+	_free_head = slot.next_free;
+	slot.object = obj;
+	_count++;
+
+	return handle;
+}
+
+bool HandleTable::remove(ObjectHandle handle)
+{
+	if (handle == 0 || handle >= MAX_HANDLES) return false;
+
+	UniqueLock<Mutex> l(_lock);
+
+	Slot *chunk = _chunks[handle / SLOTS_PER_CHUNK];
+	if (!chunk) return false;
+
+	Slot& slot = chunk[handle % SLOTS_PER_CHUNK];
+	if (!slot.object) return false;
+
+	slot.object = NULL;
+	slot.next_free = _free_head;
+	_free_head = handle;
+	_count--;
+
+	return true;
+}
+
+void HandleTable::for_each(void (*fn)(void *object, void *arg), void *arg)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	for (unsigned int i = 0; i < _nr_chunks; i++) {
+		for (unsigned int j = 0; j < SLOTS_PER_CHUNK; j++) {
+			if (_chunks[i][j].object) fn(_chunks[i][j].object, arg);
+		}
+	}
+}
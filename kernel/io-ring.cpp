@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/io-ring.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/io-ring.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/om.h>
+#include <infos/kernel/process.h>
+#include <infos/kernel/syscall.h>
+#include <infos/kernel/thread.h>
+#include <infos/fs/file.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/math.h>
+
+using namespace infos::kernel;
+using namespace infos::fs;
+using namespace infos::mm;
+using namespace infos::util;
+
+IORing *IORing::create(Process& process, unsigned int entries)
+{
+	if (entries == 0 || entries > MAX_ENTRIES) return NULL;
+
+	// Both queues are a power of two long, so that indices can just be masked.
+	uint32_t sq_entries = 1u << ilog2_ceil(entries);
+	uint32_t cq_entries = sq_entries * 2;
+
+	uint32_t sq_offset = __align_up(sizeof(IORingHeader), 64);
+	uint32_t cq_offset = __align_up(sq_offset + sq_entries * sizeof(IORingSubmission), 64);
+	size_t size = cq_offset + cq_entries * sizeof(IORingCompletion);
+
+	IORing *ring = new IORing(process);
+	ring->_order = ilog2_ceil(__align_up_page(size) >> __page_bits);
+
+	// The kernel reaches the ring through the physical memory window, so it is one block
+	// of frames, and the kernel never faults on it.
+	ring->_frames = sys.mm().pgalloc().allocate(ring->_order, PageAllocFlags::ZERO);
+	if (!ring->_frames) {
+		delete ring;
+		return NULL;
+	}
+
+	phys_addr_t pa = sys.mm().pgalloc().pfdescr_to_pa(ring->_frames);
+	if (!process.vma().map_range_any(pa, 1 << ring->_order, PTE_PRESENT | PTE_ALLOW_USER | PTE_WRITABLE, ring->_user_address)) {
+		sys.mm().pgalloc().free(ring->_frames, ring->_order);
+		ring->_frames = NULL;
+
+		delete ring;
+		return NULL;
+	}
+
+	uint8_t *base = (uint8_t *)sys.mm().pgalloc().pfdescr_to_vpa(ring->_frames);
+	ring->_header = (volatile IORingHeader *)base;
+	ring->_sq = (volatile IORingSubmission *)(base + sq_offset);
+	ring->_cq = (volatile IORingCompletion *)(base + cq_offset);
+	ring->_sq_entries = sq_entries;
+	ring->_cq_entries = cq_entries;
+
+	ring->_header->sq_mask = sq_entries - 1;
+	ring->_header->sq_entries = sq_entries;
+	ring->_header->cq_mask = cq_entries - 1;
+	ring->_header->cq_entries = cq_entries;
+	ring->_header->sq_offset = sq_offset;
+	ring->_header->cq_offset = cq_offset;
+
+	process.charge(sizeof(IORing) + ((size_t)__page_size << ring->_order));
+	return ring;
+}
+
+IORing::~IORing()
+{
+	if (_frames) {
+		_process.vma().unmap_range(_user_address, 1 << _order);
+		sys.mm().pgalloc().free(_frames, _order);
+
+		_process.charge(-(int64_t)(sizeof(IORing) + ((size_t)__page_size << _order)));
+	}
+}
+
+unsigned int IORing::enter(unsigned int count)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	// The user side owns the submission tail and the completion head, so they are read
+	// once, and anything beyond what they allow is left alone.
+	uint32_t sq_head = _header->sq_head;
+	uint32_t sq_tail = __atomic_load_n(&_header->sq_tail, __ATOMIC_ACQUIRE);
+	uint32_t cq_head = __atomic_load_n(&_header->cq_head, __ATOMIC_ACQUIRE);
+	uint32_t cq_tail = _header->cq_tail;
+
+	uint32_t submitted = sq_tail - sq_head;
+	if (submitted > _sq_entries) submitted = _sq_entries;
+
+	uint32_t cq_room = _cq_entries - (cq_tail - cq_head);
+	if (cq_room > _cq_entries) cq_room = 0;
+
+	unsigned int nr = __min(count, __min(submitted, cq_room));
+	for (unsigned int i = 0; i < nr; i++) {
+		// The entry is copied before it is used, so that the user side can't change it
+		// half way through.
+		IORingSubmission sqe;
+		memcpy(&sqe, (const void *)&_sq[sq_head & (_sq_entries - 1)], sizeof(sqe));
+
+		volatile IORingCompletion& cqe = _cq[cq_tail & (_cq_entries - 1)];
+		cqe.user_data = sqe.user_data;
+		cqe.result = perform(sqe);
+
+		sq_head++;
+		cq_tail++;
+
+		// Each result is visible as soon as it is posted, so the user side can start on
+		// it while the rest are carried out.
+		__atomic_store_n(&_header->cq_tail, cq_tail, __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&_header->sq_head, sq_head, __ATOMIC_RELEASE);
+	return nr;
+}
+
+/**
+ * Carries out one operation, in the context of the entering thread.
+ */
+int64_t IORing::perform(const IORingSubmission& sqe)
+{
+	if (sqe.opcode == IORingOp::NOP) return 0;
+
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), sqe.handle);
+	if (!f) return -1;
+
+	unsigned int result;
+	switch (sqe.opcode) {
+	case IORingOp::READ:
+		result = DefaultSyscalls::read_to_user(*f, sqe.buffer, sqe.size, false, 0);
+		break;
+	case IORingOp::WRITE:
+		result = DefaultSyscalls::write_from_user(*f, sqe.buffer, sqe.size, false, 0);
+		break;
+	case IORingOp::PREAD:
+		result = DefaultSyscalls::read_to_user(*f, sqe.buffer, sqe.size, true, sqe.offset);
+		break;
+	case IORingOp::PWRITE:
+		result = DefaultSyscalls::write_from_user(*f, sqe.buffer, sqe.size, true, sqe.offset);
+		break;
+	default:
+		return -1;
+	}
+
+	return (int)result;
+}
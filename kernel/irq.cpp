@@ -10,16 +10,32 @@
  */
 #include <infos/kernel/irq.h>
 #include <infos/kernel/kernel.h>
+#include <infos/util/lock.h>
 #include <arch/arch.h>
 
 using namespace infos::kernel;
+using namespace infos::util;
 
-bool IRQ::invoke() const
+void IRQ::attach(irq_handler_t handler, void *priv)
 {
-	if (_handler) {
-		_handler(this, _priv);
-		return true;
+	UniqueIRQLock irq;
+
+	if (!_handler) {
+		// The handler is only looked at once it is set, so its data must be there first.
+		_priv = priv;
+		__atomic_store_n(&_handler, handler, __ATOMIC_RELEASE);
 	} else {
-		return false;
+		SharedHandler *shared = new SharedHandler();
+		shared->handler = handler;
+		shared->priv = priv;
+		shared->next = NULL;
+
+		SharedHandler **tail = &_shared;
+		while (*tail) tail = &(*tail)->next;
+		__atomic_store_n(tail, shared, __ATOMIC_RELEASE);
 	}
+
+	// The architecture dispatches from its own copy of the handlers, which is brought up
+	// to date.
+	sys.arch().irq_handlers_changed(*this);
 }
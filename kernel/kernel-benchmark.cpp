@@ -0,0 +1,289 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/kernel-benchmark.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/benchmark.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/process.h>
+#include <infos/mm/vma.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
+#include <arch/arch.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+using namespace infos::mm;
+
+/*
+ * The baseline costs of the kernel: getting in and out of it, switching between threads,
+ * handing a lock or a wakeup from one thread to another, starting a process, and servicing
+ * a page fault.  The benchmarks that involve two threads run them both on the CPU that the
+ * benchmark is running on, so that every iteration is a context switch, rather than two
+ * CPUs spinning at each other.
+ */
+
+// The program that kernel.process-create-exit runs, which should exit straight away.
+static char bench_program[64];
+
+RegisterCmdLineArgument(BenchProgram, "bench.exec")
+{
+	strncpy(bench_program, value, sizeof(bench_program) - 1);
+}
+
+static void yield()
+{
+	sys.arch().invoke_kernel_syscall(1);
+}
+
+/* Keeps the current thread on the CPU it is running on, until it goes out of scope. */
+class PinnedToThisCPU
+{
+public:
+	PinnedToThisCPU() : _thread(Thread::current()), _affinity(_thread.affinity())
+	{
+		UniqueIRQLock irq;
+		_mask = 1ull << sys.scheduler().this_runqueue().index();
+		sys.scheduler().set_affinity(_thread, _mask);
+	}
+
+	~PinnedToThisCPU()
+	{
+		sys.scheduler().set_affinity(_thread, _affinity);
+	}
+
+	SchedulingEntity::AffinityMask mask() const { return _mask; }
+
+private:
+	Thread& _thread;
+	SchedulingEntity::AffinityMask _affinity, _mask;
+};
+
+/* Starts a kernel thread, on the benchmark's CPU, that runs 'proc' for the given number of
+ * iterations.  The thread must stop itself when it is done. */
+static Thread& start_partner(Thread::thread_proc_t proc, const PinnedToThisCPU& pin, unsigned int iterations)
+{
+	Thread& partner = sys.create_kernel_thread(proc, "bench-partner");
+
+	partner.add_entry_argument((void *)(uintptr_t)iterations);
+	sys.scheduler().set_affinity(partner, pin.mask());
+	partner.start();
+
+	return partner;
+}
+
+static void join(Thread& thread)
+{
+	WakeQueue& wq = thread.state_changed().wakequeue();
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(wq.lock());
+
+	while (!thread.stopped()) {
+		wq.sleep_locked(Thread::current());
+	}
+}
+
+/*
+ * A system call that does nothing (sys_nop), through the same trap that user programs use.
+ * It is made from a kernel thread, so it doesn't include the change of privilege level.
+ */
+RegisterBenchmark(SyscallNop, "kernel.syscall-nop", 1024)
+{
+	for (unsigned int i = 0; i < iterations; i++) {
+		uint64_t nr = 0;
+		asm volatile("int $0x81" : "+a"(nr) :: "memory");
+	}
+}
+
+/*
+ * Two threads yielding to each other: each iteration passes the turn across and back, so
+ * is two context switches.
+ */
+static volatile unsigned int yield_turn;
+
+static void yield_partner(unsigned int iterations)
+{
+	for (unsigned int i = 0; i < iterations; i++) {
+		while (yield_turn == 0) yield();
+		yield_turn = 0;
+	}
+
+	Thread::current().stop();
+}
+
+RegisterBenchmark(YieldPingPong, "kernel.yield-ping-pong", 256)
+{
+	benchmark_pause();
+
+	PinnedToThisCPU pin;
+	yield_turn = 0;
+	Thread& partner = start_partner((Thread::thread_proc_t)yield_partner, pin, iterations);
+
+	benchmark_resume();
+
+	for (unsigned int i = 0; i < iterations; i++) {
+		yield_turn = 1;
+		while (yield_turn == 1) yield();
+	}
+
+	benchmark_pause();
+	join(partner);
+	benchmark_resume();
+}
+
+/*
+ * Two threads taking a Mutex from each other.  Each holds it across a yield, so the other
+ * is asleep in lock() when it is released, and each iteration hands it across and back.
+ */
+static Mutex handoff_mutex;
+
+static void mutex_handoff_round(unsigned int iterations)
+{
+	for (unsigned int i = 0; i < iterations; i++) {
+		handoff_mutex.lock();
+		yield();
+		handoff_mutex.unlock();
+		yield();
+	}
+}
+
+static void mutex_partner(unsigned int iterations)
+{
+	mutex_handoff_round(iterations);
+	Thread::current().stop();
+}
+
+RegisterBenchmark(MutexHandoff, "kernel.mutex-handoff", 256)
+{
+	benchmark_pause();
+
+	PinnedToThisCPU pin;
+	Thread& partner = start_partner((Thread::thread_proc_t)mutex_partner, pin, iterations);
+
+	benchmark_resume();
+
+	mutex_handoff_round(iterations);
+
+	benchmark_pause();
+	join(partner);
+	benchmark_resume();
+}
+
+/*
+ * A thread going to sleep on a WakeQueue, and another waking it: each iteration is the
+ * sleep and the wakeup, with a context switch each way.
+ */
+static WakeQueue sleep_wq;
+static volatile bool sleeper_waiting, sleeper_woken;
+
+static void waker_partner(unsigned int iterations)
+{
+	for (unsigned int i = 0; i < iterations; i++) {
+		while (!sleeper_waiting) yield();
+
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(sleep_wq.lock());
+
+		sleeper_waiting = false;
+		sleeper_woken = true;
+		sleep_wq.wake_one_locked();
+	}
+
+	Thread::current().stop();
+}
+
+RegisterBenchmark(WakeQueueSleepWake, "kernel.wakequeue-sleep-wake", 256)
+{
+	benchmark_pause();
+
+	PinnedToThisCPU pin;
+	sleeper_waiting = false;
+	Thread& partner = start_partner((Thread::thread_proc_t)waker_partner, pin, iterations);
+
+	benchmark_resume();
+
+	for (unsigned int i = 0; i < iterations; i++) {
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(sleep_wq.lock());
+
+		sleeper_woken = false;
+		sleeper_waiting = true;
+		while (!sleeper_woken) sleep_wq.sleep_locked(Thread::current());
+	}
+
+	benchmark_pause();
+	join(partner);
+	benchmark_resume();
+}
+
+/*
+ * Loading, starting and waiting for a process that exits straight away, given by
+ * bench.exec=.  Like sys_wait_proc, this doesn't free the process afterwards.
+ */
+RegisterBenchmark(ProcessCreateExit, "kernel.process-create-exit", 1)
+{
+	if (!bench_program[0]) {
+		benchmark_skip("no program given with bench.exec=");
+		return;
+	}
+
+	for (unsigned int i = 0; i < iterations; i++) {
+		Process *process = sys.launch_process(bench_program, "");
+		if (!process) {
+			benchmark_skip("the program given with bench.exec= couldn't be launched");
+			return;
+		}
+
+		Process::wait_any(&process, 1);
+	}
+}
+
+/*
+ * The first write to each page of a zero-fill mapping, which takes a fault that gives it a
+ * zeroed frame.  Making and removing the mapping isn't timed.
+ */
+RegisterBenchmark(PageFaultZeroFill, "kernel.page-fault-zero-fill", 64)
+{
+	VMA& vma = Thread::current().owner().vma();
+	virt_addr_t va;
+
+	benchmark_pause();
+
+	bool mapped;
+	{
+		UniqueIRQLock irq;
+		mapped = vma.map_zero_fill_any(iterations, true, va);
+
+		// A kernel thread runs on whichever page table it borrowed, until its own
+		// maps something.
+		if (mapped) vma.activate();
+	}
+
+	if (!mapped) {
+		benchmark_skip("no room for the mapping");
+		return;
+	}
+
+	benchmark_resume();
+
+	for (unsigned int i = 0; i < iterations; i++) {
+		*(volatile uint8_t *)(va + ((virt_addr_t)i << __page_bits)) = 1;
+	}
+
+	benchmark_pause();
+	{
+		UniqueIRQLock irq;
+		vma.unmap_range(va, iterations);
+	}
+	benchmark_resume();
+}
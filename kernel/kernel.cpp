@@ -12,13 +12,30 @@
 #include <infos/kernel/sched.h>
 #include <infos/kernel/process.h>
 #include <infos/kernel/log.h>
+#include <infos/kernel/benchmark.h>
+#include <infos/kernel/workqueue.h>
+#include <infos/kernel/task.h>
+#include <infos/kernel/softirq.h>
+#include <infos/kernel/trace.h>
+#include <infos/kernel/profile.h>
+#include <infos/kernel/boot-phase.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/reclaim.h>
+#include <infos/mm/swap.h>
 #include <infos/util/list.h>
+#include <infos/util/hash-map.h>
 #include <infos/util/cmdline.h>
 #include <infos/util/string.h>
+#include <infos/util/lock.h>
 #include <infos/fs/file.h>
+#include <infos/fs/initramfs.h>
+#include <infos/fs/page-cache.h>
 #include <infos/fs/exec/elf-loader.h>
 #include <infos/drivers/block/block-device.h>
+#include <infos/drivers/block/nbd.h>
 #include <infos/drivers/timer/rtc.h>
+#include <infos/net/net.h>
 
 #include <arch/arch.h>
 
@@ -27,6 +44,7 @@ using namespace infos::arch;
 using namespace infos::util;
 using namespace infos::fs;
 using namespace infos::drivers;
+using namespace infos::mm;
 
 static char boot_device_name[16];
 static char boot_fstype[16];
@@ -65,21 +83,78 @@ void Kernel::start(BottomFn bottom)
 {
 	syslog.message(LogLevel::INFO, "OK!  Starting the kernel...");
 
+	boot_phase_begin("kernel.start");
+
 	/* We do this as late as possible so that we know we are ready to
 	 * handle interrupts. */
+	boot_phase_begin("timer.busywait-calibrate");
 	_arch.calibrate_busywait_loop(_device_manager);
-	// Now set the timer how we need it for scheduling.
-	// Set the timer to be periodic, with a period of 10ms, and start
-	// the timer. Note that interrupts are not enabled yet.
-	_arch.set_periodic_timer_interrupt(_device_manager);
+	boot_phase_end();
+	// Now set the timer how we need it for scheduling.  It is one-shot, and
+	// the scheduler re-arms it every time it runs.  Note that interrupts are
+	// not enabled yet.
+	_arch.start_timer_interrupt(_device_manager);
+
+	if (!_clock_page.init()) {
+		syslog.message(LogLevel::WARNING, "Unable to create the clock page");
+	}
 
 	initialise_tod();
 
-	_kernel_process = new Process("kernel", true, (Thread::thread_proc_t) &start_kernel_threadproc_tramp);
+	Thread& init_thread = create_kernel_thread((Thread::thread_proc_t) &start_kernel_threadproc_tramp, "init");
+
+	init_thread.add_entry_argument((void *) this);
+	init_thread.add_entry_argument((void *)bottom);
+	init_thread.start();
+
+	// Frame descriptors for high memory are initialised in the background.
+	_memory_manager.pgalloc().start_deferred_init();
+
+	// Deferred work (e.g. from interrupt handlers) is run by kernel worker threads.
+	if (!system_workqueue().start()) {
+		syslog.message(LogLevel::WARNING, "Unable to start the system workqueue");
+	}
+
+	// Kernel tasks (see task.h) run on workers of their own.
+	if (!start_task_executor()) {
+		syslog.message(LogLevel::WARNING, "Unable to start the task executor");
+	}
+
+	if (!trace_init()) {
+		syslog.message(LogLevel::WARNING, "Unable to allocate the trace buffers: nothing will be traced");
+	}
+
+	if (!profile_init()) {
+		syslog.message(LogLevel::WARNING, "Unable to allocate the profile buffers: nothing will be sampled");
+	}
+
+	// From here on, log messages are buffered, and written out by kernel threads.
+	if (!syslog.start()) {
+		syslog.message(LogLevel::WARNING, "Unable to start the log writers: logging will be synchronous");
+	}
+
+	// Interrupt bottom halves that can't keep up are run by kernel threads.
+	if (!SoftIRQ::start()) {
+		syslog.message(LogLevel::WARNING, "Unable to start the softirq workers");
+	}
+
+	// Demand-paging faults are serviced by a kernel thread, so that the faulting thread can sleep.
+	if (!infos::mm::start_demand_pager()) {
+		syslog.message(LogLevel::WARNING, "Unable to start the demand pager: page faults will be serviced synchronously");
+	}
+
+	// Free memory is kept above the low watermark by a kernel thread, so that allocations
+	// rarely have to reclaim for themselves.
+	if (!infos::mm::start_reclaimer()) {
+		syslog.message(LogLevel::WARNING, "Unable to start the reclaim thread: memory will only be reclaimed when it runs out");
+	}
+
+	// Writes to files are absorbed by the page cache, and written back by a kernel thread.
+	if (!infos::fs::page_cache.start_writeback()) {
+		syslog.message(LogLevel::WARNING, "Unable to start the writeback thread: writes will go straight to the disk");
+	}
 
-	_kernel_process->main_thread().add_entry_argument((void *) this);
-	_kernel_process->main_thread().add_entry_argument((void *)bottom);
-	_kernel_process->start();
+	boot_phase_end();
 
 	syslog.messagef(LogLevel::DEBUG, "Running scheduler");
 	scheduler().run();
@@ -92,24 +167,38 @@ void Kernel::start_kernel_threadproc_tramp(Kernel* kernel, BottomFn bottom)
 
 	syslog.messagef(LogLevel::INFO, "Now executing in the kernel thread");
 
+	boot_phase_begin("arch.bottom");
 	if (!bottom()) {
 		syslog.message(LogLevel::FATAL, "Second-half arch-specific kernel initialisation failed");
 		arch_abort();
 	}
+	boot_phase_end();
 
 	kernel->start_kernel_threadproc();
-	kernel->_kernel_process->terminate(0);
+	Thread::current().stop();
+}
+
+Thread& Kernel::create_kernel_thread(Thread::thread_proc_t entry_point, const String& name,
+	SchedulingEntityPriority::SchedulingEntityPriority priority)
+{
+	return _scheduler.kernel_threads().create_thread(ThreadPrivilege::Kernel, entry_point, name, priority);
 }
 
 void Kernel::start_kernel_threadproc()
 {
 	DefaultSyscalls::RegisterDefaultSyscalls(syscalls());
 
+	hash_map_benchmark();
+
+	boot_phase_begin("fs.vfs-init");
 	if (!vfs().init()) {
 		syslog.message(LogLevel::FATAL, "Unable to initialise the FS subsystem");
 		arch_abort();
 	}
 
+	boot_phase_end();
+
+	boot_phase_begin("fs.mount-root");
 	syslog.message(LogLevel::INFO, "Mounting tmpfs root...");
 	VFSNode *root = vfs().lookup_node("/");
 
@@ -135,38 +224,109 @@ void Kernel::start_kernel_threadproc()
 		arch_abort();
 	}
 
-	if (strlen(boot_device_name) == 0) {
-		syslog.message(LogLevel::FATAL, "No boot device specified");
-		dump_partitions();
-		arch_abort();
+	boot_phase_end();
+
+	// The interface is brought up in the background, once the network devices are there.
+	boot_phase_begin("net.init");
+	if (!infos::net::netstack.init(device_manager())) {
+		syslog.message(LogLevel::WARNING, "Unable to initialise the network stack");
 	}
 
-	Device *boot_device;
-	if (!device_manager().try_get_device_by_name(boot_device_name, boot_device)) {
-		syslog.messagef(LogLevel::FATAL, "Boot device '%s' not found", boot_device_name);
-		dump_partitions();
-		arch_abort();
+	// A network block device (nbd=) is connected once the interface is up, as storage, so
+	// that it can be the boot device.
+	if (!drivers::block::NbdDevice::attach(device_manager())) {
+		syslog.message(LogLevel::WARNING, "Unable to set up the network block device");
+	}
+	boot_phase_end();
+
+	// Given an initramfs, and no boot device, /usr is the initramfs, and booting doesn't
+	// wait for the disks at all: they carry on being probed in the background.
+	bool usr_from_initramfs = strlen(boot_device_name) == 0 && initramfs_present();
+
+	// The disks are probed in the background, so the boot device may not be there yet.
+	if (!usr_from_initramfs) {
+		boot_phase_begin("devices.wait-storage");
+		if (!device_manager().wait_for_init(DeviceInitGroup::STORAGE)) {
+			syslog.message(LogLevel::WARNING, "Some storage devices failed to initialise");
+		}
+		boot_phase_end();
+	}
+
+	// Private pages of processes can be swapped out to the device given with swap-device=.
+	boot_phase_begin("mm.swap-on");
+	if (!infos::mm::swap_on(device_manager())) {
+		syslog.message(LogLevel::WARNING, "Unable to use the swap device: there will be no swap");
 	}
+	boot_phase_end();
+
+	boot_phase_begin("fs.mount-usr");
+	if (usr_from_initramfs) {
+		syslog.message(LogLevel::INFO, "Booting from the initramfs...");
+
+		if (!usr->mount("initramfs", NULL)) {
+			syslog.message(LogLevel::FATAL, "Unable to mount the initramfs");
+			arch_abort();
+		}
+	} else {
+		if (strlen(boot_device_name) == 0) {
+			syslog.message(LogLevel::FATAL, "No boot device specified");
+			dump_partitions();
+			arch_abort();
+		}
+
+		Device *boot_device;
+		if (!device_manager().try_get_device_by_name(boot_device_name, boot_device)) {
+			syslog.messagef(LogLevel::FATAL, "Boot device '%s' not found", boot_device_name);
+			dump_partitions();
+			arch_abort();
+		}
+
+		if (strlen(boot_fstype) == 0) {
+			strncpy(boot_fstype, "internal_driver", 16);
+		}
+
+		util::String bootfstype = boot_fstype;
+
+		syslog.messagef(LogLevel::INFO, "Booting from '%s'...", boot_device->name().c_str());
 
-	if (strlen(boot_fstype) == 0) {
-		strncpy(boot_fstype, "internal_driver", 16);
+		syslog.messagef(LogLevel::IMPORTANT, "*** USING FILE-SYSTEM DRIVER: %s", bootfstype.c_str());
+
+		if (!usr->mount(bootfstype, boot_device)) {
+			syslog.message(LogLevel::FATAL, "Unable to mount root filesystem");
+			arch_abort();
+		}
 	}
 
-	util::String bootfstype = boot_fstype;
+	boot_phase_end();
 
-	syslog.messagef(LogLevel::INFO, "Booting from '%s'...", boot_device->name().c_str());
+	// The modules given with modules= are loaded from the filesystems that are now mounted.
+	boot_phase_begin("modules.load");
+	if (!module_manager().LoadBootModules()) {
+		syslog.message(LogLevel::WARNING, "Some modules could not be loaded");
+	}
+	boot_phase_end();
 
-	syslog.messagef(LogLevel::IMPORTANT, "*** USING FILE-SYSTEM DRIVER: %s", bootfstype.c_str());
+	// Run once everything is up, so that any subsystem can be measured.
+	boot_phase_begin("benchmarks");
+	run_benchmarks();
+	boot_phase_end();
 
-	if (!usr->mount(bootfstype, boot_device)) {
-		syslog.message(LogLevel::FATAL, "Unable to mount root filesystem");
+	// init is given the console, so that has to be up, but nothing else is waited for.
+	boot_phase_begin("devices.wait-console");
+	if (!device_manager().wait_for_init(DeviceInitGroup::CONSOLE)) {
+		syslog.message(LogLevel::FATAL, "Unable to initialise the console");
 		arch_abort();
 	}
+	boot_phase_end();
 
+	boot_phase_begin("kernel.launch-init");
 	if (!launch_process(init_program, "")) {
 		syslog.messagef(LogLevel::FATAL, "Unable to launch init=%s", init_program);
 		arch_abort();
 	}
+	boot_phase_end();
+
+	boot_phase_report();
 
 	resync_tod();
 	print_tod();
@@ -177,52 +337,106 @@ bool Kernel::early_init(const char* cmdline)
 	return this->cmdline().parse(cmdline);
 }
 
-void Kernel::update_runtime(Nanoseconds ticks)
+void Kernel::update_runtime()
 {
-	_runtime += ticks;
+	uint64_t now = runtime().time_since_epoch().count();
+
+	// Nearly every call finds that a second hasn't gone by yet, which it can tell
+	// without becoming a writer.
+	uint64_t last_update;
+	uint32_t seq;
+	do {
+		seq = _tod_lock.read_begin();
+		last_update = _last_tod_update.time_since_epoch().count();
+	} while (_tod_lock.read_retry(seq));
+
+	// Another CPU, or resync_tod(), may have moved the last update past 'now'.
+	if (now <= last_update || now - last_update < 1000000000ull) return;
+
+	UniqueIRQLock irq;
+	UniqueLock<SeqLock> l(_tod_lock);
+
+	// The last update may have moved while the lock was taken, so the time is read again
+	// under it.
+	now = runtime().time_since_epoch().count();
 
-	_ticks_since_last_tod_update += ticks;
+	for (;;) {
+		uint64_t last = _last_tod_update.time_since_epoch().count();
+		if (now <= last || now - last < 1000000000ull) break;
 
-	while (_ticks_since_last_tod_update > Nanoseconds(1e9)) {
-		_ticks_since_last_tod_update -= Nanoseconds(1e9);
+		_last_tod_update += Nanoseconds(1000000000ull);
 		increment_tod();
 	}
+
+	_clock_page.update_tod(_tod, _last_tod_update);
+}
+
+TimeOfDay Kernel::time_of_day()
+{
+	update_runtime();
+
+	TimeOfDay tod;
+	uint32_t seq;
+	do {
+		seq = _tod_lock.read_begin();
+		tod = _tod;
+	} while (_tod_lock.read_retry(seq));
+
+	return tod;
 }
 
 void Kernel::initialise_tod()
 {
-	_tod.day = 1;
-	_tod.hours = 0;
-	_tod.minutes = 0;
-	_tod.seconds = 0;
-	_tod.month = 1;
-	_tod.year = 1970;
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SeqLock> l(_tod_lock);
+
+		_tod.day = 1;
+		_tod.hours = 0;
+		_tod.minutes = 0;
+		_tod.seconds = 0;
+		_tod.month = 1;
+		_tod.year = 1970;
+	}
 
 	resync_tod();
 }
 
 void Kernel::resync_tod()
 {
-	_ticks_since_last_tod_update = 0;
-
 	infos::drivers::timer::RTC *rtc;
 
 	if (!sys.device_manager().try_get_device_by_class<infos::drivers::timer::RTC>(infos::drivers::timer::RTC::RTCDeviceClass, rtc)) {
 		syslog.messagef(LogLevel::WARNING, "No RTC available to synchronise TOD");
+
+		UniqueIRQLock irq;
+		UniqueLock<SeqLock> l(_tod_lock);
+		_last_tod_update = runtime();
+		_clock_page.update_tod(_tod, _last_tod_update);
 		return;
 	}
 
+	// Reading the RTC is slow, so it is done before taking the lock.
 	infos::drivers::timer::RTCTimePoint tp;
 	rtc->read_timepoint(tp);
 
+	UniqueIRQLock irq;
+	UniqueLock<SeqLock> l(_tod_lock);
+
+	_last_tod_update = runtime();
 	_tod.day = tp.day_of_month;
 	_tod.hours = tp.hours;
 	_tod.minutes = tp.minutes;
 	_tod.month = tp.month;
 	_tod.seconds = tp.seconds;
 	_tod.year = tp.year;
+
+	_clock_page.update_tod(_tod, _last_tod_update);
 }
 
+/**
+ * Moves the time of day on by a second.  Called with the TOD lock held.
+ */
 void Kernel::increment_tod()
 {
 	_tod.seconds++;
@@ -243,41 +457,48 @@ void Kernel::increment_tod()
 
 void Kernel::print_tod()
 {
-	syslog.messagef(LogLevel::INFO, "Current time-of-day: %02d/%02d/%02d %02d:%02d:%02d", _tod.day, _tod.month, _tod.year, _tod.hours, _tod.minutes, _tod.seconds);
+	TimeOfDay tod = time_of_day();
+	syslog.messagef(LogLevel::INFO, "Current time-of-day: %02d/%02d/%02d %02d:%02d:%02d", tod.day, tod.month, tod.year, tod.hours, tod.minutes, tod.seconds);
 }
 
-Process *Kernel::launch_process(const String& path, const String& cmdline)
+Process *Kernel::load_process(const String& path, const String& cmdline)
 {
-	syslog.messagef(LogLevel::DEBUG, "Launching application: '%s' '%s'", path.c_str(), cmdline.c_str());
+	syslog.messagef(LogLevel::DEBUG, "Loading application: '%s' '%s'", path.c_str(), cmdline.c_str());
 	File *image = vfs().open(path, 0);
 	if (!image) {
 		syslog.message(LogLevel::ERROR, "Process not found");
 		return NULL;
 	}
 
-	uint8_t hdr[16];
-	image->read(hdr, sizeof(hdr));
-
-	if (hdr[0] == 0x7f && hdr[1] == 'E' && hdr[2] == 'L' && hdr[3] == 'F') {
-		exec::ElfLoader *loader = new exec::ElfLoader(*image);
-		Process *np = loader->load(cmdline);
-		if (!np) {
-			delete loader;
-			delete image;
-
-			return NULL;
-		}
-
-		syslog.messagef(LogLevel::DEBUG, "Starting process... 0x%llx", np->main_thread().context().native_context->rdi);
-		np->start();
+	// The loader checks that the image is an ELF program, from the headers it reads
+	// anyway (or not at all, if it has a template for the program).
+	exec::ElfLoader *loader = new (HeapArena::ELF) exec::ElfLoader(*image, path);
+	Process *np = loader->load(cmdline);
+	if (!np) {
 		delete loader;
-		// successful use of loader transfers ownership of the file to the process
-
-		return np;
-	} else {
 		delete image;
+
 		return NULL;
 	}
+
+	delete loader;
+	// successful use of loader transfers ownership of the file to the process
+
+	// Programs can read the clock for themselves.
+	_clock_page.map_into(np->vma());
+
+	return np;
+}
+
+Process *Kernel::launch_process(const String& path, const String& cmdline)
+{
+	Process *np = load_process(path, cmdline);
+	if (!np) return NULL;
+
+	syslog.messagef(LogLevel::DEBUG, "Starting process... 0x%llx", np->main_thread().context().native_context->rdi);
+	np->start();
+
+	return np;
 }
 
 void Kernel::spin_delay(util::Nanoseconds ns)
@@ -299,9 +520,7 @@ void Kernel::dump_partitions()
 {
 	syslog.message(LogLevel::INFO, "Available partitions:");
 
-	for (auto device : device_manager().devices()) {
-		if (device.value->device_class().is(infos::drivers::block::BlockDevice::BlockDeviceClass)) {
-			syslog.messagef(LogLevel::INFO, "  %s", device.value->name().c_str());
-		}
+	for (auto device : device_manager().devices_of_class(infos::drivers::block::BlockDevice::BlockDeviceClass)) {
+		syslog.messagef(LogLevel::INFO, "  %s", device->name().c_str());
 	}
 }
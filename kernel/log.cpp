@@ -9,19 +9,145 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/kernel/log.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/workqueue.h>
 #include <infos/io/stream.h>
 #include <infos/util/string.h>
 #include <infos/util/printf.h>
+#include <infos/util/cmdline.h>
 
 using namespace infos::kernel;
 using namespace infos::util;
 
 __init_priority(101) SysLog infos::kernel::syslog;
 
-void Log::messagef(LogLevel::LogLevel level, const char* format, ...)
+// The longest message that is kept, which is as long as messagef() makes them.
+#define LOG_MAX_MESSAGE		0x200
+
+static bool parse_level(const char *name, size_t length, LogLevel::LogLevel& level)
+{
+	static const char *names[] = { "debug", "info", "warning", "error" };
+
+	for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strlen(names[i]) == length && strncmp(name, names[i], length) == 0) {
+			level = (LogLevel::LogLevel)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* The least severe messages that are shown, of any component. */
+RegisterCmdLineArgument(SysLogLevel, "log.level") {
+	LogLevel::LogLevel level;
+	if (parse_level(value, strlen(value), level)) {
+		syslog.level(level);
+	} else {
+		syslog.messagef(LogLevel::WARNING, "Unknown log level '%s'", value);
+	}
+}
+
+RegisterCmdLineArgument(LogLevels, "log.levels") {
+	ComponentLog::set_levels(value);
+}
+
+/* The messages one CPU has logged, waiting to be written out.  Each is a header, then
+ * its bytes, which are copied as they are, so needn't be text.  The CPU is the only
+ * writer, with interrupts disabled, and a drain (with the log's mutex) the only reader,
+ * so the ring needs no lock: each side only moves its own end, once the bytes it
+ * covers have been copied. */
+class LogRing
+{
+public:
+	static const unsigned int SIZE = 0x4000;
+
+	LogRing() : _head(0), _tail(0), _dropped(0) { }
+
+	/* Returns false, and counts the message as dropped, if there isn't room. */
+	bool append(LogLevel::LogLevel level, const char *message, size_t length)
+	{
+		if (length > LOG_MAX_MESSAGE) length = LOG_MAX_MESSAGE;
+
+		uint32_t head = _head;
+		uint32_t tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+
+		if (SIZE - (head - tail) < sizeof(Header) + length) {
+			__atomic_fetch_add(&_dropped, 1, __ATOMIC_RELAXED);
+			return false;
+		}
+
+		Header hdr;
+		hdr.length = length;
+		hdr.level = level;
+
+		copy_in(head, &hdr, sizeof(hdr));
+		copy_in(head + sizeof(hdr), message, length);
+
+		__atomic_store_n(&_head, head + sizeof(hdr) + length, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	/* Takes the oldest message, into 'message', which has room for LOG_MAX_MESSAGE
+	 * bytes.  Returns false if there isn't one. */
+	bool take(LogLevel::LogLevel& level, char *message, size_t& length)
+	{
+		uint32_t tail = _tail;
+		if (tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE)) return false;
+
+		Header hdr;
+		copy_out(tail, &hdr, sizeof(hdr));
+		copy_out(tail + sizeof(hdr), message, hdr.length);
+
+		level = (LogLevel::LogLevel)hdr.level;
+		length = hdr.length;
+
+		__atomic_store_n(&_tail, tail + sizeof(hdr) + hdr.length, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	uint64_t take_dropped() { return __atomic_exchange_n(&_dropped, 0, __ATOMIC_RELAXED); }
+
+private:
+	struct Header
+	{
+		uint16_t length;
+		uint8_t level;
+	};
+
+	uint8_t _data[SIZE];
+	volatile uint32_t _head, _tail;		// Running byte counts, wrapped into the ring as used
+	uint64_t _dropped;
+
+	void copy_in(uint32_t at, const void *src, size_t length)
+	{
+		for (size_t i = 0; i < length; i++) {
+			_data[(at + i) & (SIZE - 1)] = ((const uint8_t *)src)[i];
+		}
+	}
+
+	void copy_out(uint32_t at, void *dst, size_t length) const
+	{
+		for (size_t i = 0; i < length; i++) {
+			((uint8_t *)dst)[i] = _data[(at + i) & (SIZE - 1)];
+		}
+	}
+};
+
+// A ring for each runqueue's CPU.  A CPU without a runqueue writes its messages out itself.
+static LogRing log_rings[SCHED_MAX_RUNQUEUES];
+
+static void drain_log(void *arg)
+{
+	((SysLog *)arg)->flush();
+}
+
+static WorkQueue log_wq("klogd", SchedulingEntityPriority::NORMAL);
+static WorkItem log_drain(drain_log, &syslog);
+
+void Log::vmessagef(LogLevel::LogLevel level, const char* format, ...)
 {
-	if (!enabled()) return;
-	
 	char buffer[0x200];
 	va_list args;
 
@@ -35,74 +161,181 @@ void Log::messagef(LogLevel::LogLevel level, const char* format, ...)
 
 void SysLog::message(LogLevel::LogLevel level, const char* message)
 {
-	if (!enabled()) return;
-	
-	if (_stream) {
-		UniqueLock<Mutex> l(_mtx);
+	if (!enabled(level)) return;
 
-		switch (level) {
-		case LogLevel::DEBUG:
-			if (_colour) {
-				_stream->write("\x1b[34;1m", 7);
-			}
-			_stream->write("  debug: ", 9);
-			break;
-		case LogLevel::INFO:
-			if (_colour) {
-				_stream->write("\x1b[32;1m", 7);
-			}
-			_stream->write("   info: ", 9);
-			break;
-		case LogLevel::WARNING:
-			if (_colour) {
-				_stream->write("\x1b[32;1m", 7);
-			}
-			_stream->write("warning: ", 9);
-			break;
-		case LogLevel::ERROR:
-			if (_colour) {
-				_stream->write("\x1b[31;1m", 7);
-			}
-			_stream->write("  error: ", 9);
-			break;
-		case LogLevel::FATAL:
-			if (_colour) {
-				_stream->write("\x1b[31;1m", 7);
-			}
-			_stream->write("  fatal: ", 9);
-			break;
-		case LogLevel::IMPORTANT:
-			if (_colour) {
-				_stream->write("\x1b[37;1;42m", 10);
-			}
-			_stream->write(" notice: ", 9);
-			break;
+	size_t length = strlen(message);
+
+	if (_started && level != LogLevel::FATAL) {
+		bool have_ring;
+		{
+			UniqueIRQLock irq;
+
+			// A full ring drops the message, rather than wait for room.
+			RunQueue *rq = CPU::current().runqueue();
+			have_ring = rq != NULL;
+			if (have_ring) log_rings[rq->index()].append(level, message, length);
 		}
 
-		if (_colour && level != LogLevel::IMPORTANT) {
-			_stream->write("\x1b[37;0m", 7);
+		if (have_ring) {
+			log_wq.queue(log_drain);
+			return;
 		}
-		
-		_stream->write(message, strlen(message));
-		if (_colour && level == LogLevel::IMPORTANT) {
-			_stream->write("\x1b[37;0m", 7);
+	}
+
+	if (!_stream) return;
+
+	// On the way down, whatever holds the mutex may never let it go, so a fatal message
+	// is written out regardless, though it may then be mixed up with another line.
+	// Whatever is buffered goes first, if the rings can be drained safely.
+	if (level == LogLevel::FATAL) {
+		bool locked = _mtx.try_lock();
+		if (locked) drain();
+
+		write_message(level, message, length);
+
+		if (locked) _mtx.unlock();
+		return;
+	}
+
+	UniqueLock<Mutex> l(_mtx);
+	write_message(level, message, length);
+}
+
+static inline size_t append_string(char *line, size_t n, const char *s)
+{
+	size_t length = strlen(s);
+	memcpy(&line[n], s, length);
+	return n + length;
+}
+
+/**
+ * Writes out one message, as a single write to the stream, so that a line costs the
+ * stream one round trip.  Called with the mutex held.
+ */
+void SysLog::write_message(LogLevel::LogLevel level, const char *message, size_t length)
+{
+	static const char *prefixes[] = { "  debug: ", "   info: ", "warning: ", "  error: ", "  fatal: ", " notice: " };
+	static const char *colours[] = { "\x1b[34;1m", "\x1b[32;1m", "\x1b[32;1m", "\x1b[31;1m", "\x1b[31;1m", "\x1b[37;1;42m" };
+	static const char *reset = "\x1b[37;0m";
+
+	char line[LOG_MAX_MESSAGE + 32];
+	size_t n = 0;
+
+	if (length > LOG_MAX_MESSAGE) length = LOG_MAX_MESSAGE;
+
+	if (_colour) {
+		n = append_string(line, n, colours[level]);
+	}
+
+	n = append_string(line, n, prefixes[level]);
+
+	// A notice is coloured all the way along, and the others only up to the message.
+	if (_colour && level != LogLevel::IMPORTANT) {
+		n = append_string(line, n, reset);
+	}
+
+	memcpy(&line[n], message, length);
+	n += length;
+
+	if (_colour && level == LogLevel::IMPORTANT) {
+		n = append_string(line, n, reset);
+	}
+
+	line[n++] = '\n';
+	_stream->write(line, n);
+}
+
+bool SysLog::start()
+{
+	if (!log_wq.start()) {
+		return false;
+	}
+
+	_started = true;
+	return true;
+}
+
+/**
+ * Writes out every CPU's buffered messages, each CPU's in the order they were logged.
+ * Called with the mutex held, which makes it the rings' only reader.
+ */
+void SysLog::drain()
+{
+	char message[LOG_MAX_MESSAGE];
+	LogLevel::LogLevel level;
+	size_t length;
+
+	for (unsigned int i = 0; i < SCHED_MAX_RUNQUEUES; i++) {
+		LogRing& ring = log_rings[i];
+
+		uint64_t dropped = ring.take_dropped();
+		while (ring.take(level, message, length)) {
+			if (_stream) write_message(level, message, length);
 		}
 
-		_stream->write("\n", 1);
+		if (dropped && _stream) {
+			length = snprintf(message, sizeof(message), "log: dropped %llu messages from cpu %u", dropped, i);
+			write_message(LogLevel::WARNING, message, length);
+		}
 	}
 }
 
-ComponentLog::ComponentLog(Log& parent, const char *component_name) : _parent(parent), _component_name(component_name)
+void SysLog::flush()
 {
+	UniqueLock<Mutex> l(_mtx);
+	drain();
+}
+
+// Every component's log, which are all statically constructed, before the command-line is
+// parsed.
+static ComponentLog *component_logs;
 
+ComponentLog::ComponentLog(Log& parent, const char *component_name) : Log(&parent), _parent(parent), _component_name(component_name)
+{
+	_next = component_logs;
+	component_logs = this;
 }
 
 void ComponentLog::message(LogLevel::LogLevel level, const char* message)
 {
-	if (!enabled()) return;
+	if (!enabled(level)) return;
 	
 	char message_buffer[0x200];
 	snprintf(message_buffer, sizeof(message_buffer), "%s: %s", _component_name, message);
 	
 	_parent.message(level, message_buffer);
 }
+
+void ComponentLog::set_levels(const char *levels)
+{
+	const char *entry = levels;
+
+	while (*entry) {
+		const char *end = entry;
+		while (*end && *end != ',') end++;
+
+		const char *colon = entry;
+		while (colon < end && *colon != ':') colon++;
+
+		LogLevel::LogLevel level;
+		if (colon == end || !parse_level(colon + 1, end - colon - 1, level)) {
+			syslog.messagef(LogLevel::WARNING, "Malformed log level setting in '%s'", levels);
+		} else {
+			size_t name_length = colon - entry;
+			bool found = false;
+
+			for (ComponentLog *log = component_logs; log; log = log->_next) {
+				if (strlen(log->_component_name) == name_length && strncmp(log->_component_name, entry, name_length) == 0) {
+					log->level(level);
+					found = true;
+				}
+			}
+
+			if (!found) {
+				syslog.messagef(LogLevel::WARNING, "Unknown log component in '%s'", levels);
+			}
+		}
+
+		entry = *end ? end + 1 : end;
+	}
+}
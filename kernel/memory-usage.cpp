@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/memory-usage.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/process.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/text-file.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/slab.h>
+#include <infos/mm/vma.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::fs;
+using namespace infos::mm;
+using namespace infos::util;
+
+/**
+ * A pseudo-device (/dev/meminfo0) that reports where memory is going, as text.
+ */
+class MemoryUsageDevice : public Device
+{
+public:
+	static const DeviceClass MemoryUsageDeviceClass;
+
+	const DeviceClass& device_class() const override { return MemoryUsageDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass MemoryUsageDevice::MemoryUsageDeviceClass(Device::RootDeviceClass, "meminfo");
+
+#define FRAMES_KB(frames) ((frames) << (__page_bits - 10))
+
+/**
+ * An open report, of the kernel heap that each subsystem is using (the objects of the
+ * general arena's size classes included), of the slab caches that hold objects, and of
+ * what each process is using, in KiB.  A process's resident set is its private and
+ * shared frames; its page tables, kernel stacks and kernel objects are listed apart.
+ */
+class MemoryUsageFile : public TextFile
+{
+public:
+	MemoryUsageFile()
+	{
+		PageAllocatorStats pgstats;
+		if (sys.mm().pgalloc().get_stats(pgstats)) {
+			append("free %llu\n", FRAMES_KB(pgstats.nr_free_frames));
+		}
+
+		append("subsystem in-use footprint\n");
+		for (unsigned int i = 0; i < NR_HEAP_ARENAS; i++) {
+			HeapArenaStats stats;
+			sys.mm().objalloc().get_arena_stats((HeapArena::HeapArena)i, stats);
+
+			append("%s %llu %llu\n", stats.name, (stats.bytes_in_use + stats.size_class_bytes) >> 10, stats.footprint >> 10);
+		}
+
+		append("slab object-size in-use size\n");
+		for (const SlabCache *cache = SlabCache::first_cache(); cache; cache = cache->next_cache()) {
+			if (!cache->nr_slabs()) continue;
+
+			append("%s %lu %llu %llu\n", cache->name(), cache->object_size(), cache->nr_in_use(), FRAMES_KB(cache->nr_slabs()));
+		}
+
+		append("process rss private shared page-tables unmapped kernel\n");
+		Process::for_each(append_process, this);
+	}
+
+private:
+	static void append_process(Process& process, void *arg)
+	{
+		MemoryUsageFile *file = (MemoryUsageFile *)arg;
+
+		MemoryUsage usage;
+		process.memory_usage(usage);
+
+		file->append("%s %llu %llu %llu %llu %llu %llu\n", process.name().c_str(),
+				FRAMES_KB(usage.private_frames + usage.shared_frames), FRAMES_KB(usage.private_frames), FRAMES_KB(usage.shared_frames),
+				FRAMES_KB(usage.pgt_frames), FRAMES_KB(usage.unmapped_frames), usage.kernel_bytes >> 10);
+	}
+};
+
+File *MemoryUsageDevice::open_as_file()
+{
+	return new MemoryUsageFile();
+}
+
+RegisterDevice(MemoryUsageDevice);
@@ -2,22 +2,466 @@
 
 /*
  * kernel/module.cpp
- * 
+ *
  * InfOS
  * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
- * 
+ *
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/kernel/module.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/sched.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/vfs.h>
+#include <infos/fs/file.h>
+#include <infos/fs/filesystem.h>
+#include <infos/fs/exec/elf-loader.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/util/math.h>
 
 using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::fs;
+using namespace infos::fs::exec;
+using namespace infos::mm;
+using namespace infos::util;
+
+/*
+ * Modules are relocatable ELF objects (ET_REL), e.g. the output of 'ld -r', built with the
+ * same flags as the kernel.  Their allocated sections are laid out together in frames that
+ * are mapped by the kernel's own mapping, i.e. in the top 2GB, as -mcmodel=kernel needs,
+ * and their relocations are applied against their own symbols and the kernel's symbol
+ * table.  Then their static constructors are run, and what they have in the registration
+ * sections that the kernel's linker script collects (RegisterDevice, RegisterFilesystem,
+ * RegisterScheduler, RegisterCmdLineArgument) is registered, as it would have been at
+ * boot.
+ */
+
+#define MAGIC_NUMBER 0x464c457f
+#define ECLASS_64BIT 2
+#define EDATA_LITTLE 1
+#define MACHINE_X86_64 62
+
+extern char _KSYMTAB_START, _KSYMTAB_END;
+
+ComponentLog infos::kernel::module_log(syslog, "module");
+
+/* The modules given on the command line, e.g. modules=/usr/mod/a.ko,/usr/mod/b.ko */
+static char boot_modules[64];
+
+RegisterCmdLineArgument(Modules, "modules")
+{
+	strncpy(boot_modules, value, sizeof(boot_modules) - 1);
+}
 
 ModuleManager::ModuleManager(Kernel& owner) : Subsystem(owner)
 {
+	_mtx.set_name("modules");
+}
+
+uintptr_t ModuleManager::LookupSymbol(const char *name) const
+{
+	const KernelSymbol *symbols = (const KernelSymbol *)&_KSYMTAB_START;
+	unsigned int lo = 0, hi = (const KernelSymbol *)&_KSYMTAB_END - symbols;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		int cmp = strcmp(symbols[mid].name, name);
+
+		if (cmp == 0) return symbols[mid].address;
+
+		if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return 0;
+}
+
+/* A module while it is being loaded: its image, and where each of its sections went. */
+struct ModuleImage
+{
+	const uint8_t *image;
+	size_t length;
+
+	const ELF64SectionHeaderEntry *sections;
+	unsigned int nr_sections;
+	const char *section_names;
+
+	uintptr_t *section_addrs;		// zero for the sections that aren't loaded
+
+	const ELF64Symbol *symbols;
+	unsigned int nr_symbols;
+	const char *symbol_names;
+
+	const char *section_name(unsigned int index) const { return section_names + sections[index].name; }
+};
+
+static bool in_image(const ModuleImage& m, uint64_t offset, uint64_t size)
+{
+	return offset <= m.length && size <= m.length - offset;
+}
+
+/* Works out the address of a symbol, for a relocation. */
+static bool resolve_symbol(const ModuleImage& m, unsigned int index, uintptr_t& value)
+{
+	if (index >= m.nr_symbols) return false;
+
+	const ELF64Symbol& sym = m.symbols[index];
+	const char *name = m.symbol_names + sym.name;
+
+	switch (sym.shndx) {
+	case SHN_UNDEF:
+		value = sys.module_manager().LookupSymbol(name);
+		if (value || sym.binding() == STB_WEAK) return true;
+
+		module_log.messagef(LogLevel::ERROR, "Unresolved symbol '%s'", name);
+		return false;
+
+	case SHN_ABS:
+		value = sym.value;
+		return true;
+
+	case SHN_COMMON:
+		module_log.messagef(LogLevel::ERROR, "Common symbol '%s' (build with -fno-common)", name);
+		return false;
+
+	default:
+		if (sym.shndx >= m.nr_sections || !m.section_addrs[sym.shndx]) {
+			module_log.messagef(LogLevel::ERROR, "Symbol '%s' is in a section that isn't loaded", name);
+			return false;
+		}
+
+		value = m.section_addrs[sym.shndx] + sym.value;
+		return true;
+	}
+}
+
+static bool apply_relocations(const ModuleImage& m, const ELF64SectionHeaderEntry& relsec)
+{
+	uintptr_t target = m.section_addrs[relsec.info];
+	const ELF64Rela *relocs = (const ELF64Rela *)(m.image + relsec.offset);
+	unsigned int nr_relocs = relsec.size / sizeof(ELF64Rela);
+
+	for (unsigned int i = 0; i < nr_relocs; i++) {
+		const ELF64Rela& rel = relocs[i];
+		if (rel.type() == R_X86_64_NONE) continue;
+
+		uintptr_t s;
+		if (!resolve_symbol(m, rel.symbol(), s)) return false;
+
+		uintptr_t p = target + rel.offset;
+		uint64_t value = s + rel.addend;
 
+		switch (rel.type()) {
+		case R_X86_64_64:
+			*(uint64_t *)p = value;
+			break;
+
+		case R_X86_64_PC64:
+			*(uint64_t *)p = value - p;
+			break;
+
+		case R_X86_64_PC32:
+		case R_X86_64_PLT32:
+			value -= p;
+			if ((int64_t)value != (int32_t)value) goto out_of_range;
+			*(uint32_t *)p = value;
+			break;
+
+		case R_X86_64_32:
+			if (value != (uint32_t)value) goto out_of_range;
+			*(uint32_t *)p = value;
+			break;
+
+		case R_X86_64_32S:
+			if ((int64_t)value != (int32_t)value) goto out_of_range;
+			*(uint32_t *)p = value;
+			break;
+
+		default:
+			module_log.messagef(LogLevel::ERROR, "Unsupported relocation type %u", rel.type());
+			return false;
+		}
+
+		continue;
+
+out_of_range:
+		module_log.messagef(LogLevel::ERROR, "Relocation type %u at 0x%lx is out of range", rel.type(), p);
+		return false;
+	}
+
+	return true;
+}
+
+/* Registers what a module has in one of the registration sections. */
+static void register_section(const char *name, uintptr_t start, uintptr_t end)
+{
+	if (strcmp(name, ".cmdlineargs") == 0) {
+		sys.cmdline().apply((const CommandLineArgumentRegistration *)start, (const CommandLineArgumentRegistration *)end);
+	} else if (strcmp(name, ".schedalg") == 0) {
+		for (SchedulingAlgorithm **alg = (SchedulingAlgorithm **)start; alg < (SchedulingAlgorithm **)end; alg++) {
+			sys.scheduler().register_algorithm(**alg);
+		}
+	} else if (strcmp(name, ".fsreg") == 0) {
+		for (FilesystemRegistration *reg = (FilesystemRegistration *)start; reg < (FilesystemRegistration *)end; reg++) {
+			sys.vfs().register_filesystem(*reg);
+		}
+	} else if (strcmp(name, ".devctor") == 0) {
+		for (device_ctor_fn *ctor = (device_ctor_fn *)start; ctor < (device_ctor_fn *)end; ctor++) {
+			Device *d = (*ctor)();
+			if (d) sys.device_manager().register_device(*d);
+		}
+	} else if (strcmp(name, ".pgallocptr") == 0) {
+		// The algorithm is chosen when the memory manager starts, before any module.
+		module_log.message(LogLevel::WARNING, "Page allocation algorithms can't be loaded as modules");
+	} else if (strcmp(name, ".benchmarks") == 0) {
+		module_log.message(LogLevel::WARNING, "Benchmarks in modules aren't run");
+	} else if (strcmp(name, ".stats") == 0) {
+		module_log.message(LogLevel::WARNING, "Statistics in modules aren't listed in /dev/stats");
+	}
 }
 
-bool ModuleManager::LoadModule(void* module_addr, size_t length)
+bool ModuleManager::LoadModule(void* module_addr, size_t length, const char *name)
 {
+	const ELF64Header& hdr = *(const ELF64Header *)module_addr;
+
+	if (!name) name = "?";
+
+	if (length < sizeof(hdr) || hdr.ident.magic_number != MAGIC_NUMBER || hdr.ident.eclass != ECLASS_64BIT ||
+		hdr.ident.data != EDATA_LITTLE || hdr.machine != MACHINE_X86_64) {
+		module_log.messagef(LogLevel::ERROR, "%s: not an x86-64 ELF object", name);
+		return false;
+	}
+
+	if (hdr.type != ELFType::ET_REL) {
+		module_log.messagef(LogLevel::ERROR, "%s: not a relocatable object", name);
+		return false;
+	}
+
+	ModuleImage m;
+	m.image = (const uint8_t *)module_addr;
+	m.length = length;
+
+	if (hdr.shentsize != sizeof(ELF64SectionHeaderEntry) || hdr.shstrndx >= hdr.shnum ||
+		!in_image(m, hdr.shoff, (uint64_t)hdr.shnum * sizeof(ELF64SectionHeaderEntry))) {
+		module_log.messagef(LogLevel::ERROR, "%s: bad section headers", name);
+		return false;
+	}
+
+	m.sections = (const ELF64SectionHeaderEntry *)(m.image + hdr.shoff);
+	m.nr_sections = hdr.shnum;
+	m.symbols = NULL;
+	m.nr_symbols = 0;
+	m.symbol_names = NULL;
+
+	for (unsigned int i = 0; i < m.nr_sections; i++) {
+		const ELF64SectionHeaderEntry& sec = m.sections[i];
+		if (sec.type != SHT_NOBITS && sec.type != SHT_NULL && !in_image(m, sec.offset, sec.size)) {
+			module_log.messagef(LogLevel::ERROR, "%s: section %u is outside the image", name, i);
+			return false;
+		}
+	}
+
+	m.section_names = (const char *)(m.image + m.sections[hdr.shstrndx].offset);
+
+	// Lay the allocated sections out, one after another.  The unwind tables aren't used.
+	size_t size = 0;
+	for (unsigned int i = 0; i < m.nr_sections; i++) {
+		const ELF64SectionHeaderEntry& sec = m.sections[i];
+
+		if (sec.type == SHT_SYMTAB) {
+			if (sec.link >= m.nr_sections) return false;
+
+			m.symbols = (const ELF64Symbol *)(m.image + sec.offset);
+			m.nr_symbols = sec.size / sizeof(ELF64Symbol);
+			m.symbol_names = (const char *)(m.image + m.sections[sec.link].offset);
+		}
+
+		if (!(sec.flags & SHF_ALLOC) || sec.size == 0 || strcmp(m.section_name(i), ".eh_frame") == 0) continue;
+
+		if (strcmp(m.section_name(i), ".extable") == 0) {
+			module_log.messagef(LogLevel::ERROR, "%s: modules can't have exception table entries", name);
+			return false;
+		}
+
+		size_t align = sec.addralign ? sec.addralign : 1;
+		size = (size + align - 1) & ~(align - 1);
+		size += sec.size;
+	}
+
+	if (!m.symbols) {
+		module_log.messagef(LogLevel::ERROR, "%s: no symbol table", name);
+		return false;
+	}
+
+	if (size == 0) {
+		module_log.messagef(LogLevel::ERROR, "%s: nothing to load", name);
+		return false;
+	}
+
+	UniqueLock<Mutex> l(_mtx);
+
+	unsigned int nr_pages = __align_up_page(size) >> __page_bits;
+	int order = ilog2_ceil(nr_pages);
+
+	FrameDescriptor *frames = sys.mm().pgalloc().allocate(order, PageAllocFlags::ZERO);
+	if (!frames) {
+		module_log.messagef(LogLevel::ERROR, "%s: no memory for %u pages", name, nr_pages);
+		return false;
+	}
+
+	// The kernel's mapping only covers the low 2GB of physical memory.
+	if (sys.mm().pgalloc().pfdescr_to_pa(frames) + ((phys_addr_t)1 << (order + __page_bits)) > KERNEL_VMEM_SIZE) {
+		module_log.messagef(LogLevel::ERROR, "%s: no memory below 2GB", name);
+		sys.mm().pgalloc().free(frames, order);
+		return false;
+	}
+
+	uintptr_t base = sys.mm().pgalloc().pfdescr_to_kva(frames);
+
+	m.section_addrs = new uintptr_t[m.nr_sections];
+	if (!m.section_addrs) {
+		sys.mm().pgalloc().free(frames, order);
+		return false;
+	}
+
+	size_t offset = 0;
+	for (unsigned int i = 0; i < m.nr_sections; i++) {
+		const ELF64SectionHeaderEntry& sec = m.sections[i];
+		m.section_addrs[i] = 0;
+
+		if (!(sec.flags & SHF_ALLOC) || sec.size == 0 || strcmp(m.section_name(i), ".eh_frame") == 0) continue;
+
+		size_t align = sec.addralign ? sec.addralign : 1;
+		offset = (offset + align - 1) & ~(align - 1);
+		m.section_addrs[i] = base + offset;
+
+		// The frames were zeroed, which is what NOBITS sections (i.e. .bss) need.
+		if (sec.type != SHT_NOBITS) {
+			memcpy((void *)m.section_addrs[i], m.image + sec.offset, sec.size);
+		}
+
+		offset += sec.size;
+	}
+
+	for (unsigned int i = 0; i < m.nr_sections; i++) {
+		const ELF64SectionHeaderEntry& sec = m.sections[i];
+
+		if (sec.type == SHT_REL) {
+			module_log.messagef(LogLevel::ERROR, "%s: REL relocations aren't supported", name);
+			goto fail;
+		}
+
+		// Relocations of the sections that aren't loaded (e.g. debug information) are ignored.
+		if (sec.type != SHT_RELA || sec.info >= m.nr_sections || !m.section_addrs[sec.info]) continue;
+
+		if (!apply_relocations(m, sec)) {
+			module_log.messagef(LogLevel::ERROR, "%s: unable to relocate %s", name, m.section_name(sec.info));
+			goto fail;
+		}
+	}
+
+	module_log.messagef(LogLevel::INFO, "Loaded module %s @ 0x%lx (%lu bytes)", name, base, size);
+
+	// Construct its static objects first, as the kernel's are before its command line is parsed.
+	for (unsigned int i = 0; i < m.nr_sections; i++) {
+		if (!m.section_addrs[i] || strcmp(m.section_name(i), ".init_array") != 0) continue;
+
+		void (**ctors)(void) = (void (**)(void))m.section_addrs[i];
+		for (unsigned int j = 0; j < m.sections[i].size / sizeof(*ctors); j++) {
+			ctors[j]();
+		}
+	}
+
+	for (unsigned int i = 0; i < m.nr_sections; i++) {
+		if (!m.section_addrs[i]) continue;
+		register_section(m.section_name(i), m.section_addrs[i], m.section_addrs[i] + m.sections[i].size);
+	}
+
+	delete[] m.section_addrs;
+
+	{
+		Module *module = new Module();
+		module->name = name;
+		module->base = base;
+		module->size = size;
+		_modules.append(module);
+	}
+
+	return true;
+
+fail:
+	delete[] m.section_addrs;
+	sys.mm().pgalloc().free(frames, order);
 	return false;
 }
+
+bool ModuleManager::LoadModuleFile(const String& path)
+{
+	File *file = sys.vfs().open(path, 0);
+	if (!file) {
+		module_log.messagef(LogLevel::ERROR, "Unable to open module '%s'", path.c_str());
+		return false;
+	}
+
+	// Read the whole file, growing the buffer as it goes.
+	size_t capacity = 0x10000, length = 0;
+	uint8_t *image = new uint8_t[capacity];
+
+	while (image) {
+		int n = file->pread(image + length, capacity - length, length);
+		if (n <= 0) break;
+
+		length += n;
+		if (length < capacity) continue;
+
+		uint8_t *bigger = new uint8_t[capacity * 2];
+		if (bigger) memcpy(bigger, image, length);
+
+		delete[] image;
+		image = bigger;
+		capacity *= 2;
+	}
+
+	file->close();
+	delete file;
+
+	if (!image) {
+		module_log.messagef(LogLevel::ERROR, "No memory to read module '%s'", path.c_str());
+		return false;
+	}
+
+	bool loaded = LoadModule(image, length, path.c_str());
+	delete[] image;
+
+	return loaded;
+}
+
+/**
+ * Loads the modules given with modules=, which are separated by commas.  This must be
+ * called once the filesystem they are on has been mounted.
+ */
+bool ModuleManager::LoadBootModules()
+{
+	bool loaded = true;
+
+	const char *p = boot_modules;
+	while (*p) {
+		char path[sizeof(boot_modules)];
+		unsigned int n = 0;
+
+		while (*p && *p != ',') path[n++] = *p++;
+		path[n] = 0;
+		if (*p) p++;
+
+		if (n && !LoadModuleFile(path)) loaded = false;
+	}
+
+	return loaded;
+}
@@ -9,16 +9,34 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/kernel/process.h>
+#include <infos/kernel/futex.h>
+#include <infos/kernel/kernel.h>
+#include <infos/fs/pipe.h>
+#include <infos/mm/shared-memory.h>
 
 using namespace infos::kernel;
 
+DEFINE_SLAB_ALLOCATED(Process);
+
+/* Threads waiting for processes to terminate, keyed by the process. */
+static infos::util::WakeQueue terminations;
+
+/* Every process that exists, so that what they are using can be reported. */
+static infos::util::IntrusiveList<Process, &Process::_all_node> all_processes;
+static infos::util::Mutex all_processes_lock;
+
 Process::Process(const util::String& name, bool kernel_process,
 	Thread::thread_proc_t entry_point, fs::File *file /* = nullptr */)
-	: _name(name), _kernel_process(kernel_process), _terminated(false), _vma(), _file(file)
+	: _name(name), _kernel_process(kernel_process), _terminated(false), _vma(), _file(file), _kernel_bytes(sizeof(*this))
 {
 	// Initialise the VMA by installing the default kernel mapping.
 	_vma.install_default_kernel_mapping();
 
+	{
+		util::UniqueLock<util::Mutex> l(all_processes_lock);
+		all_processes.append(*this);
+	}
+
 	// Create the main thread.
 	_main_thread = &create_thread(kernel_process ? ThreadPrivilege::Kernel : ThreadPrivilege::User, entry_point, "main");
 
@@ -27,8 +45,15 @@ Process::Process(const util::String& name, bool kernel_process,
 
 Process::~Process()
 {
-	// All threads /should/ be stopped by this point.
-	for (const auto& thread : _threads) {
+	{
+		util::UniqueLock<util::Mutex> l(all_processes_lock);
+		all_processes.remove(*this);
+	}
+
+	// All threads /should/ be stopped by this point, but some may still be on a futex.
+	futex_release(*this);
+
+	while (Thread *thread = _threads.dequeue()) {
 		assert(thread->state() == SchedulingEntityState::STOPPED);
 		delete thread;
 	}
@@ -44,8 +69,38 @@ void Process::start()
 
 void Process::terminate(int rc)
 {
-	_terminated = true;
-	_state_changed.trigger();
+	// The kernel threads all share one process, so one of them failing (e.g. faulting)
+	// only stops that thread.
+	if (this == &sys.scheduler().kernel_threads()) {
+		assert(&Thread::current().owner() == this);
+		Thread::current().stop();
+		return;
+	}
+
+	bool first;
+	{
+		util::UniqueIRQLock irq;
+		util::UniqueLock<util::SpinLock> l(terminations.lock());
+
+		first = !_terminated;
+		_terminated = true;
+
+		util::WakeQueue::Key key = { this, 0 };
+		terminations.wake_key_locked(key, ~0u);
+	}
+
+	// Handles aren't closed when a process goes, but the ends of a pipe must be, or the
+	// process at the other end would wait for ever, and so must shared-memory objects,
+	// or they would never be freed.
+	if (first) {
+		_handles.for_each([](void *object, void *) {
+			if (fs::PipeEnd *end = fs::PipeEnd::from_object(object)) {
+				end->close();
+			} else if (mm::SharedMemory *shm = mm::SharedMemory::from_object(object)) {
+				shm->close();
+			}
+		}, NULL);
+	}
 
 	for (const auto& thread : _threads) {
 		thread->stop();
@@ -58,8 +113,92 @@ Thread& Process::create_thread(ThreadPrivilege::ThreadPrivilege privilege, Threa
 	// A kernel process can NEVER have a user thread.
 	assert(!(kernel_process() && privilege == ThreadPrivilege::User));
 
-	Thread *new_thread = new Thread(*this, privilege, entry_point, priority, name);
-	_threads.append(new_thread);
+	util::UniqueLock<util::Mutex> l(_threads_lock);
+
+	// A user thread takes over the stacks of one that has stopped, if there are any, so
+	// that short-lived threads don't each cost a fresh kernel stack and user stack.
+	ThreadStacks stacks;
+	bool reuse = false;
+	if (privilege == ThreadPrivilege::User) {
+		if (!_free_stacks.count()) recycle_stacks();
+
+		if (_free_stacks.count()) {
+			stacks = _free_stacks.dequeue();
+			reuse = true;
+		}
+	}
+
+	Thread *new_thread = new Thread(*this, privilege, entry_point, priority, name, reuse ? &stacks : NULL);
+	_threads.append(*new_thread);
+	charge(sizeof(Thread));
 
 	return *new_thread;
 }
+
+unsigned int Process::wait_any(Process *const *processes, unsigned int count)
+{
+	assert(count > 0 && count <= util::WakeQueue::MAX_SLEEP_KEYS);
+
+	util::WakeQueue::Key keys[util::WakeQueue::MAX_SLEEP_KEYS];
+	for (unsigned int i = 0; i < count; i++) {
+		keys[i].object = processes[i];
+		keys[i].offset = 0;
+	}
+
+	util::UniqueIRQLock irq;
+	util::UniqueLock<util::SpinLock> l(terminations.lock());
+
+	// Termination is checked under the lock that terminate() wakes waiters with, so a
+	// process that terminates while the thread is going to sleep still wakes it.
+	for (;;) {
+		for (unsigned int i = 0; i < count; i++) {
+			if (processes[i]->terminated()) return i;
+		}
+
+		terminations.sleep_any_locked(Thread::current(), keys, count);
+	}
+}
+
+/**
+ * Collects the stacks of the threads that have stopped since the last look.  The thread
+ * objects themselves stay, as handles to them may still be used, e.g. to join them.
+ * Called with the threads lock held.
+ */
+void Process::recycle_stacks()
+{
+	for (const auto& thread : _threads) {
+		ThreadStacks stacks;
+		if (thread->release_stacks(stacks)) {
+			_free_stacks.append(stacks);
+		}
+	}
+}
+
+void Process::memory_usage(mm::MemoryUsage& usage) const
+{
+	_vma.usage(usage);
+
+	int64_t bytes = __atomic_load_n(&_kernel_bytes, __ATOMIC_RELAXED) + _handles.footprint();
+	usage.kernel_bytes = bytes > 0 ? bytes : 0;
+}
+
+void Process::for_each(void (*fn)(Process& process, void *arg), void *arg)
+{
+	util::UniqueLock<util::Mutex> l(all_processes_lock);
+
+	for (const auto& process : all_processes) {
+		fn(*process, arg);
+	}
+}
+
+bool Process::try_for_each(void (*fn)(Process& process, void *arg), void *arg)
+{
+	if (!all_processes_lock.try_lock()) return false;
+
+	for (const auto& process : all_processes) {
+		fn(*process, arg);
+	}
+
+	all_processes_lock.unlock();
+	return true;
+}
@@ -0,0 +1,365 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/profile.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/profile.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/process.h>
+#include <infos/kernel/log.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/file.h>
+#include <infos/mm/vma.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/util/printf.h>
+#include <infos/util/lock.h>
+#include <arch/x86/context.h>
+#include <arch/x86/vma.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::fs;
+using namespace infos::mm;
+using namespace infos::util;
+
+// The number of samples in each CPU's ring.
+#define PROFILE_RING_SIZE		2048
+
+// The most frames that are recorded for a sample, including the one it was taken in.
+#define PROFILE_MAX_FRAMES		16
+
+#define PROFILE_DEFAULT_HZ		1000
+#define PROFILE_MAX_HZ			10000
+
+uint64_t infos::kernel::profile_period;
+
+static bool profile_at_boot;
+static bool profile_stacks;
+static uint64_t sample_period = 1000000000ull / PROFILE_DEFAULT_HZ;
+
+RegisterCmdLineArgument(Profile, "profile")
+{
+	profile_at_boot = strncmp(value, "1", 2) == 0;
+}
+
+RegisterCmdLineArgument(ProfileHz, "profile.hz")
+{
+	unsigned int hz = 0;
+	for (const char *p = value; *p >= '0' && *p <= '9'; p++) {
+		hz = hz * 10 + (*p - '0');
+		if (hz > PROFILE_MAX_HZ) break;
+	}
+
+	if (hz > PROFILE_MAX_HZ) hz = PROFILE_MAX_HZ;
+	if (hz) sample_period = 1000000000ull / hz;
+}
+
+// With profile.stacks=1, each sample has the frame-pointer chain above it, too.
+RegisterCmdLineArgument(ProfileStacks, "profile.stacks")
+{
+	profile_stacks = strncmp(value, "1", 2) == 0;
+}
+
+/* Where a CPU was when it was sampled: frames[0] is the instruction that was interrupted,
+ * and the return addresses of its callers follow. */
+struct ProfileSample
+{
+	uint64_t frames[PROFILE_MAX_FRAMES];
+	char name[16];			// The process, or for a kernel thread, the thread
+	uint8_t nr_frames;
+	bool user;
+};
+
+/* The samples of one CPU.  Only the CPU writes to it, from its timer interrupt, and 'head'
+ * moves on once a sample has been written. */
+struct ProfileRing
+{
+	ProfileSample *samples;
+	volatile uint64_t head;
+};
+
+static ProfileRing rings[SCHED_MAX_RUNQUEUES];
+static unsigned int nr_rings;
+
+// Non-zero while the samples are being read, or thrown away, so that they stay put.
+static volatile unsigned int paused;
+
+static Mutex profile_lock;
+
+/**
+ * Follows the frame pointers up a thread's kernel stack, and stops at anything that isn't
+ * further up the stack, so a frame without one (e.g. an assembly stub) just ends the walk.
+ */
+static unsigned int walk_kernel_stack(Thread& thread, uint64_t fp, uint64_t *frames, unsigned int max)
+{
+	uintptr_t top = thread.context().kernel_stack;
+	uintptr_t bottom = top - KERNEL_STACK_SIZE;
+
+	unsigned int nr = 0;
+	while (nr < max && fp >= bottom && fp + 16 <= top && !(fp & 7)) {
+		const uint64_t *frame = (const uint64_t *)fp;
+		if (!frame[1]) break;
+
+		frames[nr++] = frame[1];
+		if (frame[0] <= fp) break;
+
+		fp = frame[0];
+	}
+
+	return nr;
+}
+
+/* Reads a word of the current process's memory through the physical memory window, so
+ * that an unmapped page is just the end of the walk, rather than a fault. */
+static bool read_user_word(VMA& vma, uintptr_t va, uint64_t& value)
+{
+	if ((va & 7) || va >= USER_VA_END) return false;
+
+	phys_addr_t pa;
+	if (!vma.get_mapping(va, pa)) return false;
+
+	value = *(const uint64_t *)pa_to_vpa(pa);
+	return true;
+}
+
+static unsigned int walk_user_stack(Thread& thread, uint64_t fp, uint64_t *frames, unsigned int max)
+{
+	VMA& vma = thread.owner().vma();
+
+	unsigned int nr = 0;
+	while (nr < max) {
+		uint64_t next, ret;
+		if (!read_user_word(vma, fp, next) || !read_user_word(vma, fp + 8, ret) || !ret) break;
+
+		frames[nr++] = ret;
+		if (next <= fp) break;
+
+		fp = next;
+	}
+
+	return nr;
+}
+
+void infos::kernel::profile_record()
+{
+	UniqueIRQLock irq;
+
+	RunQueue *rq = CPU::current().runqueue();
+	if (!rq || rq->index() >= __atomic_load_n(&nr_rings, __ATOMIC_ACQUIRE) || paused) return;
+
+	Thread& thread = Thread::current();
+	const X86Context *ctx = thread.context().native_context;
+	if (!ctx) return;
+
+	ProfileRing& ring = rings[rq->index()];
+	uint64_t head = ring.head;
+	ProfileSample& s = ring.samples[head % PROFILE_RING_SIZE];
+
+	s.frames[0] = ctx->rip;
+	s.user = (ctx->cs & 3) != 0;
+
+	const String& name = s.user ? thread.owner().name() : thread.name();
+	strncpy(s.name, name.c_str(), sizeof(s.name) - 1);
+	s.name[sizeof(s.name) - 1] = 0;
+
+	unsigned int nr = 1;
+	if (profile_stacks) {
+		if (s.user) {
+			nr += walk_user_stack(thread, ctx->rbp, &s.frames[1], PROFILE_MAX_FRAMES - 1);
+		} else {
+			nr += walk_kernel_stack(thread, ctx->rbp, &s.frames[1], PROFILE_MAX_FRAMES - 1);
+		}
+	}
+
+	s.nr_frames = nr;
+
+	__atomic_store_n(&ring.head, head + 1, __ATOMIC_RELEASE);
+}
+
+static bool allocate_rings()
+{
+	unsigned int nr = sys.scheduler().nr_runqueues();
+	for (unsigned int i = 0; i < nr; i++) {
+		if (rings[i].samples) continue;
+
+		rings[i].samples = new ProfileSample[PROFILE_RING_SIZE];
+		if (!rings[i].samples) return false;
+	}
+
+	__atomic_store_n(&nr_rings, nr, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool infos::kernel::profile_enable(bool enable)
+{
+	UniqueLock<Mutex> l(profile_lock);
+
+	if (!enable) {
+		__atomic_store_n(&profile_period, 0, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	if (!allocate_rings()) return false;
+
+	// Throw away the last profile, with the CPUs kept from recording meanwhile.
+	__atomic_fetch_add(&paused, 1, __ATOMIC_SEQ_CST);
+	for (unsigned int i = 0; i < nr_rings; i++) {
+		__atomic_store_n(&rings[i].head, 0, __ATOMIC_RELEASE);
+	}
+	__atomic_fetch_sub(&paused, 1, __ATOMIC_SEQ_CST);
+
+	__atomic_store_n(&profile_period, sample_period, __ATOMIC_RELEASE);
+	syslog.messagef(LogLevel::INFO, "Profiling every %llu ns%s, %u samples per cpu", sample_period,
+			profile_stacks ? ", with stacks" : "", PROFILE_RING_SIZE);
+
+	return true;
+}
+
+bool infos::kernel::profile_init()
+{
+	if (!profile_at_boot) return true;
+	return profile_enable(true);
+}
+
+/**
+ * An open view of the profile, as folded stacks: a line for each sample, of the name of
+ * what was running, then the frames from the outermost in, separated by semicolons, then a
+ * count of one, e.g. "init;0x401000;0x401234 1".  Tools that draw flame graphs add up the
+ * lines that are the same.  The addresses are looked up in the kernel's, or the program's,
+ * symbols afterwards.  Nothing is recorded while it is open.
+ */
+class ProfileFile : public File
+{
+public:
+	ProfileFile() : _pos(0)
+	{
+		__atomic_fetch_add(&paused, 1, __ATOMIC_SEQ_CST);
+
+		_nr_rings = __atomic_load_n(&nr_rings, __ATOMIC_ACQUIRE);
+		for (unsigned int i = 0; i < _nr_rings; i++) {
+			uint64_t end = __atomic_load_n(&rings[i].head, __ATOMIC_ACQUIRE);
+
+			// A CPU may have been part way through the sample after its newest, which
+			// is the oldest in a full ring, so that one is left out.
+			_end[i] = end;
+			_start[i] = end >= PROFILE_RING_SIZE ? end - PROFILE_RING_SIZE + 1 : 0;
+		}
+
+		rewind();
+	}
+
+	~ProfileFile() override
+	{
+		__atomic_fetch_sub(&paused, 1, __ATOMIC_SEQ_CST);
+	}
+
+	int read(void *buffer, size_t size) override
+	{
+		int n = pread(buffer, size, _pos);
+		if (n > 0) _pos += n;
+		return n;
+	}
+
+	/* The text is made a line at a time, as it is read, so reading from before the
+	 * current line starts again from the beginning. */
+	int pread(void *buffer, size_t size, off_t off) override
+	{
+		if (off < 0) return 0;
+		if ((size_t)off < _line_start) rewind();
+
+		size_t copied = 0;
+		while (copied < size) {
+			size_t at = off + copied;
+
+			if (at >= _line_start + _line_length) {
+				if (!next_line()) break;
+				continue;
+			}
+
+			size_t n = _line_start + _line_length - at;
+			if (n > size - copied) n = size - copied;
+
+			memcpy((uint8_t *)buffer + copied, _line + (at - _line_start), n);
+			copied += n;
+		}
+
+		return copied;
+	}
+
+	void seek(off_t offset, SeekType type) override
+	{
+		if (type == SeekAbsolute) {
+			_pos = offset;
+		} else {
+			_pos += offset;
+		}
+	}
+
+private:
+	unsigned int _nr_rings;
+	uint64_t _start[SCHED_MAX_RUNQUEUES], _end[SCHED_MAX_RUNQUEUES];
+
+	// The next sample to be made into a line.
+	unsigned int _ring;
+	uint64_t _sample;
+
+	char _line[16 + PROFILE_MAX_FRAMES * 19 + 4];
+	size_t _line_start, _line_length;
+	off_t _pos;
+
+	void rewind()
+	{
+		_ring = 0;
+		_sample = _nr_rings ? _start[0] : 0;
+		_line_start = 0;
+		_line_length = 0;
+	}
+
+	bool next_line()
+	{
+		while (_ring < _nr_rings && _sample >= _end[_ring]) {
+			if (++_ring < _nr_rings) _sample = _start[_ring];
+		}
+
+		if (_ring >= _nr_rings) return false;
+
+		const ProfileSample& s = rings[_ring].samples[_sample++ % PROFILE_RING_SIZE];
+
+		_line_start += _line_length;
+		_line_length = snprintf(_line, sizeof(_line), "%s", s.name[0] ? s.name : "?");
+
+		for (unsigned int i = s.nr_frames; i > 0; i--) {
+			_line_length += snprintf(_line + _line_length, sizeof(_line) - _line_length, ";0x%llx", s.frames[i - 1]);
+		}
+
+		_line_length += snprintf(_line + _line_length, sizeof(_line) - _line_length, " 1\n");
+		return true;
+	}
+};
+
+/**
+ * A pseudo-device (/dev/profile0) that reads as the samples that the profiler has taken,
+ * as folded stacks.
+ */
+class ProfileDevice : public Device
+{
+public:
+	static const DeviceClass ProfileDeviceClass;
+
+	const DeviceClass& device_class() const override { return ProfileDeviceClass; }
+
+	File *open_as_file() override { return new ProfileFile(); }
+};
+
+const DeviceClass ProfileDevice::ProfileDeviceClass(Device::RootDeviceClass, "profile");
+
+RegisterDevice(ProfileDevice);
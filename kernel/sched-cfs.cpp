@@ -12,18 +12,31 @@
 #include <infos/kernel/sched.h>
 #include <infos/kernel/thread.h>
 #include <infos/kernel/log.h>
-#include <infos/util/list.h>
 #include <infos/util/lock.h>
+#include <infos/util/avl-tree.h>
 
 using namespace infos::kernel;
 using namespace infos::util;
 
+// How far behind the runqueue an entity that has been asleep is allowed to start, so
+// that it gets to run soon after it wakes, but can't then hog the CPU to catch up.
+#define CFS_WAKEUP_CREDIT_NS	3000000ull
+
+// How many entities, from the right of the tree, are considered for moving to another CPU.
+#define CFS_MIGRATION_SCAN		8
+
 /**
- * A completely fair scheduling algorithm
+ * A completely fair scheduling algorithm.  The runqueue is an AVL tree of entities,
+ * ordered by the virtual runtime they had when they were queued (see
+ * SchedulingEntity::priority_weight), and linked through each entity's runqueue node.
+ * The leftmost entity is cached, so picking is O(1), and queueing and dequeueing are
+ * O(log n).
  */
 class CompletelyFairScheduler : public SchedulingAlgorithm
 {
 public:
+	CompletelyFairScheduler() : _leftmost(NULL), _running(NULL), _min_vruntime(0) { }
+
 	/**
 	 * Returns the friendly name of the algorithm, for debugging and selection purposes.
 	 */
@@ -44,7 +57,16 @@ public:
 	void add_to_runqueue(SchedulingEntity& entity) override
 	{
 		UniqueIRQLock l;
-		runqueue.enqueue(&entity);
+
+		// Bring an entity that has been asleep (or is new) up to near the rest of the
+		// runqueue, so that it neither starves the others while it catches up, nor is
+		// starved because it is far ahead of a runqueue that has been idle.
+		uint64_t floor = _min_vruntime > CFS_WAKEUP_CREDIT_NS ? _min_vruntime - CFS_WAKEUP_CREDIT_NS : 0;
+		if (entity.vruntime().count() < floor) {
+			entity.set_vruntime(SchedulingEntity::EntityRuntime(floor));
+		}
+
+		enqueue(&entity);
 	}
 
 	/**
@@ -54,7 +76,9 @@ public:
 	void remove_from_runqueue(SchedulingEntity& entity) override
 	{
 		UniqueIRQLock l;
-		runqueue.remove(&entity);
+		dequeue(&entity);
+
+		if (_running == &entity) _running = NULL;
 	}
 
 	/**
@@ -63,24 +87,108 @@ public:
 	 * e.g. its timeslice has not expired.
 	 */
 	SchedulingEntity *pick_next_entity() override
-	{	
-		if (runqueue.count() == 0) return NULL;
-		if (runqueue.count() == 1) return runqueue.first();
-		
-		SchedulingEntity::EntityRuntime min_runtime = 0;
-		SchedulingEntity *min_runtime_entity = NULL;
-		for (const auto& entity : runqueue) {
-			if (min_runtime_entity == NULL || entity->cpu_runtime() < min_runtime) {
-				min_runtime_entity = entity;
-				min_runtime = entity->cpu_runtime();
+	{
+		if (!_leftmost) return NULL;
+
+		// Only the entity picked last time has been running since, so it is the only
+		// one whose place in the tree can be out of date.
+		if (_running && _running->runqueue_node().key.count() != _running->vruntime().count()) {
+			dequeue(_running);
+			enqueue(_running);
+		}
+
+		_running = _leftmost;
+
+		// Track how far the runqueue has got.  This only ever moves forwards, so that
+		// an entity that wakes up is placed relative to where the others are now.
+		if (node(_running).key.count() > _min_vruntime) {
+			_min_vruntime = node(_running).key.count();
+		}
+		return _running;
+	}
+
+	SchedulingAlgorithm *create_instance() const override { return new CompletelyFairScheduler(); }
+
+	bool has_runnable() const override { return _leftmost != NULL; }
+
+	/**
+	 * Returns the entity furthest from running (i.e. the rightmost) that may run on the
+	 * other runqueue, only looking at the last few, since this is called with interrupts
+	 * disabled.
+	 */
+	SchedulingEntity *migration_candidate(unsigned int rq_index) override
+	{
+		UniqueIRQLock l;
+
+		// A reverse in-order walk.  The tree is balanced, so its height is well within
+		// the stack.
+		SchedulingEntity *stack[64];
+		int depth = 0;
+		int examined = 0;
+
+		SchedulingEntity *e = _tree.root();
+		while ((e || depth > 0) && examined < CFS_MIGRATION_SCAN) {
+			while (e) {
+				stack[depth++] = e;
+				e = node(e).right;
 			}
+
+			e = stack[--depth];
+			examined++;
+
+			if (e != _running && e->allowed_on(rq_index)) return e;
+
+			e = node(e).left;
 		}
-				
-		return min_runtime_entity;
+
+		return NULL;
 	}
 	
 private:
-	List<SchedulingEntity *> runqueue;
+	static SchedulingEntity::RunqueueNode& node(SchedulingEntity *e) { return e->runqueue_node(); }
+
+	struct TreeTraits
+	{
+		static AVLTreeNode<SchedulingEntity>& node(SchedulingEntity *e) { return e->runqueue_node(); }
+
+		/**
+		 * Orders entities by their queued runtime, and then by address, so that no two
+		 * entities are ever equal.
+		 */
+		static bool before(const SchedulingEntity *a, const SchedulingEntity *b)
+		{
+			uint64_t ka = a->runqueue_node().key.count(), kb = b->runqueue_node().key.count();
+			if (ka != kb) return ka < kb;
+
+			return a < b;
+		}
+
+		static void update(SchedulingEntity *e) { }
+	};
+
+	AVLTree<SchedulingEntity, TreeTraits> _tree;
+	SchedulingEntity *_leftmost;
+	SchedulingEntity *_running;
+	uint64_t _min_vruntime;
+
+	void enqueue(SchedulingEntity *entity)
+	{
+		node(entity).key = entity->vruntime();
+		_tree.insert(*entity);
+
+		if (!_leftmost || TreeTraits::before(entity, _leftmost)) {
+			_leftmost = entity;
+		}
+	}
+
+	void dequeue(SchedulingEntity *entity)
+	{
+		_tree.remove(*entity);
+
+		if (entity == _leftmost) {
+			_leftmost = _tree.first();
+		}
+	}
 };
 
 /* --- DO NOT CHANGE ANYTHING BELOW THIS LINE --- */
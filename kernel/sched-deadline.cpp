@@ -0,0 +1,254 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/sched-deadline.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/sched.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
+#include <infos/util/lock.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+
+/**
+ * The deadline scheduling class: earliest deadline first, over the entities that have
+ * been given a runtime, a relative deadline and a period (see Scheduler::set_deadline).
+ * Every period, an entity may run for its runtime, and is run in order of the deadline
+ * of its current period.
+ *
+ * Each entity is held to its runtime by a constant bandwidth server: an entity that has
+ * used up its runtime is throttled until its next period starts, and an entity that
+ * wakes up after sleeping through its deadline, or with more runtime left than it can
+ * use by then without going over its bandwidth, starts a new period.  So, however an
+ * entity behaves, it never takes more than its bandwidth, and, since the bandwidth of a
+ * runqueue's entities is limited when they are admitted, every entity meets its
+ * deadlines.
+ *
+ * The ready entities are kept in order of their deadlines, and the throttled ones in
+ * order of when they can run again, both linked through the entities' runqueue nodes
+ * ('left' and 'right' are the previous and next entities).  There are few deadline
+ * entities, so the lists are short.
+ */
+class DeadlineScheduler : public SchedulingAlgorithm
+{
+public:
+	DeadlineScheduler() : _running(NULL) { }
+
+	const char* name() const override { return "deadline"; }
+
+	void init() override { }
+
+	/**
+	 * Called when a deadline entity becomes runnable, i.e. when it wakes up.
+	 */
+	void add_to_runqueue(SchedulingEntity& entity) override
+	{
+		UniqueIRQLock l;
+
+		uint64_t now = sys.runtime().time_since_epoch().count();
+		SchedulingEntity::DeadlineState& dl = entity.deadline_state();
+		const SchedulingEntity::DeadlineParams& params = entity.deadline_params();
+
+		charge(&entity);
+
+		// The entity can carry on in its current period if it can use the rest of its
+		// runtime before the deadline, without running at more than its bandwidth, i.e.
+		// remaining / (deadline - now) <= runtime / period.
+		if (dl.abs_deadline <= now || (dl.remaining > 0 && (uint64_t)dl.remaining * params.period > (dl.abs_deadline - now) * params.runtime)) {
+			dl.abs_deadline = now + params.deadline;
+			dl.remaining = params.runtime;
+		}
+
+		if (dl.remaining <= 0) {
+			throttle(&entity, now);
+		} else {
+			insert(_ready, &entity, dl.abs_deadline);
+		}
+	}
+
+	void remove_from_runqueue(SchedulingEntity& entity) override
+	{
+		UniqueIRQLock l;
+
+		if (_running == &entity) {
+			charge(&entity);
+			_running = NULL;
+		}
+
+		SchedulingEntity::DeadlineState& dl = entity.deadline_state();
+		if (dl.throttled) {
+			unlink(_throttled, &entity);
+			dl.throttled = false;
+		} else {
+			unlink(_ready, &entity);
+		}
+	}
+
+	/**
+	 * Charges the entity that ran last for what it ran, throttling it if it has run
+	 * out of runtime, releases the throttled entities whose next period has started,
+	 * and returns the entity with the earliest deadline.
+	 */
+	SchedulingEntity *pick_next_entity() override
+	{
+		uint64_t now = sys.runtime().time_since_epoch().count();
+
+		if (_running) {
+			SchedulingEntity *prev = _running;
+			charge(prev);
+
+			if (prev->deadline_state().remaining <= 0) {
+				unlink(_ready, prev);
+				throttle(prev, now);
+			}
+		}
+
+		while (_throttled.head && _throttled.head->deadline_state().throttled_until <= now) {
+			SchedulingEntity *e = _throttled.head;
+			SchedulingEntity::DeadlineState& dl = e->deadline_state();
+
+			unlink(_throttled, e);
+			dl.throttled = false;
+
+			// The deadline moved on as the runtime was used up (see throttle()).
+			insert(_ready, e, dl.abs_deadline);
+		}
+
+		_running = _ready.head;
+		return _running;
+	}
+
+	SchedulingAlgorithm *create_instance() const override { return new DeadlineScheduler(); }
+
+	/**
+	 * A throttled entity whose next period has started can run: it is moved to the
+	 * ready list by the next pick.
+	 */
+	bool has_runnable() const override
+	{
+		if (_ready.head) return true;
+		return _throttled.head && _throttled.head->deadline_state().throttled_until <= (uint64_t)sys.runtime().time_since_epoch().count();
+	}
+
+	/**
+	 * The scheduler has to run again when the running entity runs out of runtime, or
+	 * when the first throttled entity can run again, whichever is earlier.
+	 */
+	uint64_t next_event(uint64_t now) const override
+	{
+		uint64_t next = NO_EVENT;
+
+		if (_running && _running == _ready.head) {
+			int64_t remaining = _running->deadline_state().remaining;
+			next = now + (remaining > 0 ? remaining : 0);
+		}
+
+		if (_throttled.head && _throttled.head->deadline_state().throttled_until < next) {
+			next = _throttled.head->deadline_state().throttled_until;
+		}
+
+		return next;
+	}
+
+private:
+	struct List
+	{
+		List() : head(NULL) { }
+		SchedulingEntity *head;
+	};
+
+	List _ready, _throttled;
+	SchedulingEntity *_running;
+
+	static SchedulingEntity::RunqueueNode& node(SchedulingEntity *e) { return e->runqueue_node(); }
+
+	/**
+	 * Takes what the entity has run since it was last charged off its runtime.
+	 */
+	static void charge(SchedulingEntity *entity)
+	{
+		SchedulingEntity::DeadlineState& dl = entity->deadline_state();
+		uint64_t runtime = entity->cpu_runtime().count();
+
+		dl.remaining -= (int64_t)(runtime - dl.charged);
+		dl.charged = runtime;
+	}
+
+	/**
+	 * Gives an entity that has used up its runtime the runtime of the periods it has
+	 * run into, and holds it back until the start of the last of them, if that is
+	 * still to come.
+	 */
+	void throttle(SchedulingEntity *entity, uint64_t now)
+	{
+		SchedulingEntity::DeadlineState& dl = entity->deadline_state();
+		const SchedulingEntity::DeadlineParams& params = entity->deadline_params();
+
+		while (dl.remaining <= 0) {
+			dl.abs_deadline += params.period;
+			dl.remaining += params.runtime;
+		}
+
+		uint64_t period_start = dl.abs_deadline - params.deadline;
+		if (period_start <= now) {
+			insert(_ready, entity, dl.abs_deadline);
+			return;
+		}
+
+		dl.throttled = true;
+		dl.throttled_until = period_start;
+		insert(_throttled, entity, period_start);
+	}
+
+	static uint64_t key(List& list, SchedulingEntity *e, List& throttled)
+	{
+		return &list == &throttled ? e->deadline_state().throttled_until : e->deadline_state().abs_deadline;
+	}
+
+	void insert(List& list, SchedulingEntity *entity, uint64_t k)
+	{
+		SchedulingEntity *prev = NULL, *next = list.head;
+		while (next && key(list, next, _throttled) <= k) {
+			prev = next;
+			next = node(next).right;
+		}
+
+		node(entity).left = prev;
+		node(entity).right = next;
+
+		if (prev) {
+			node(prev).right = entity;
+		} else {
+			list.head = entity;
+		}
+
+		if (next) node(next).left = entity;
+	}
+
+	static void unlink(List& list, SchedulingEntity *entity)
+	{
+		SchedulingEntity::RunqueueNode& n = node(entity);
+
+		if (n.left) {
+			node(n.left).right = n.right;
+		} else if (list.head == entity) {
+			list.head = n.right;
+		}
+
+		if (n.right) node(n.right).left = n.left;
+
+		n.left = NULL;
+		n.right = NULL;
+	}
+};
+
+SchedulingAlgorithm *infos::kernel::create_deadline_class()
+{
+	return new DeadlineScheduler();
+}
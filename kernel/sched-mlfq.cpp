@@ -0,0 +1,247 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/sched-mlfq.cpp
+ *
+ * A multi-level feedback queue scheduler.
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ * agent <agent@local>
+ */
+#include <infos/kernel/sched.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
+#include <infos/util/lock.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+
+// The number of priority levels.  Level zero is the highest.
+#define MLFQ_LEVELS				8
+
+// How much CPU time an entity may use at level zero before it is demoted.  Each level
+// down doubles the allotment.
+#define MLFQ_BASE_ALLOTMENT_NS	10000000ull
+
+// How often every queued entity is moved back to the top level, so that CPU-bound
+// entities that have sunk to the bottom aren't starved forever.
+#define MLFQ_BOOST_INTERVAL_NS	1000000000ull
+
+/**
+ * A multi-level feedback queue scheduling algorithm.  There is a FIFO queue for each
+ * level, and a bitmap of the levels that have something queued, so the next entity is
+ * found with a single bit-scan.  Entities start at the top level, and move down a level
+ * when they have used up their allotment of CPU time at the level they are on.  So,
+ * entities that mostly sleep (e.g. waiting for I/O) stay near the top, and get to run
+ * as soon as they wake up.
+ *
+ * The queues are linked through each entity's runqueue node: 'left' and 'right' are
+ * the previous and next entities in the queue, 'height' is the entity's level, and 'key'
+ * is what the entity's CPU runtime was when it was given its allotment at that level.
+ */
+class MultiLevelFeedbackQueueScheduler : public SchedulingAlgorithm
+{
+public:
+	MultiLevelFeedbackQueueScheduler() : _nonempty(0), _running(NULL), _last_boost(0)
+	{
+		for (int i = 0; i < MLFQ_LEVELS; i++) {
+			_queues[i].head = NULL;
+			_queues[i].tail = NULL;
+		}
+	}
+
+	/**
+	 * Returns the friendly name of the algorithm, for debugging and selection purposes.
+	 */
+	const char* name() const override { return "mlfq"; }
+
+	/**
+	 * Called during scheduler initialisation.
+	 */
+	void init() override
+	{
+		_last_boost = sys.runtime().time_since_epoch().count();
+	}
+
+	/**
+	 * Called when a scheduling entity becomes eligible for running.  An entity that was
+	 * asleep goes back to the level it was on, with whatever was left of its allotment.
+	 * @param entity
+	 */
+	void add_to_runqueue(SchedulingEntity& entity) override
+	{
+		UniqueIRQLock l;
+		enqueue(&entity, level_of(&entity));
+	}
+
+	/**
+	 * Called when a scheduling entity is no longer eligible for running.
+	 * @param entity
+	 */
+	void remove_from_runqueue(SchedulingEntity& entity) override
+	{
+		UniqueIRQLock l;
+		dequeue(&entity);
+
+		if (_running == &entity) _running = NULL;
+	}
+
+	/**
+	 * Called every time a scheduling event occurs, to cause the next eligible entity
+	 * to be chosen.
+	 */
+	SchedulingEntity *pick_next_entity() override
+	{
+		uint64_t now = sys.runtime().time_since_epoch().count();
+		if (now - _last_boost >= MLFQ_BOOST_INTERVAL_NS) {
+			boost();
+			_last_boost = now;
+		}
+
+		// The entity that ran last goes to the back of its queue, so that entities on
+		// the same level take turns.  If it has used up its allotment, it goes to the
+		// back of the queue on the level below instead.
+		if (_running) {
+			SchedulingEntity *prev = _running;
+			int level = level_of(prev);
+
+			dequeue(prev);
+
+			uint64_t used = prev->cpu_runtime().count() - node(prev).key.count();
+			if (used >= allotment(level) && level < MLFQ_LEVELS - 1) {
+				level++;
+				node(prev).key = prev->cpu_runtime();
+			}
+
+			enqueue(prev, level);
+		}
+
+		if (!_nonempty) return NULL;
+
+		_running = _queues[__builtin_ctz(_nonempty)].head;
+		return _running;
+	}
+
+	SchedulingAlgorithm *create_instance() const override { return new MultiLevelFeedbackQueueScheduler(); }
+
+	bool has_runnable() const override { return _nonempty != 0; }
+
+	/**
+	 * Returns the entity that would run last, out of those that may run on the other
+	 * runqueue: the one nearest the back of the lowest non-empty level.
+	 */
+	SchedulingEntity *migration_candidate(unsigned int rq_index) override
+	{
+		UniqueIRQLock l;
+
+		for (int level = MLFQ_LEVELS - 1; level >= 0; level--) {
+			for (SchedulingEntity *e = _queues[level].tail; e; e = node(e).left) {
+				if (e != _running && e->allowed_on(rq_index)) return e;
+			}
+		}
+
+		return NULL;
+	}
+
+private:
+	struct Queue
+	{
+		SchedulingEntity *head, *tail;
+	};
+
+	Queue _queues[MLFQ_LEVELS];
+	uint32_t _nonempty;
+	SchedulingEntity *_running;
+	uint64_t _last_boost;
+
+	static SchedulingEntity::RunqueueNode& node(SchedulingEntity *e) { return e->runqueue_node(); }
+	static int level_of(SchedulingEntity *e) { return node(e).height; }
+
+	static uint64_t allotment(int level) { return MLFQ_BASE_ALLOTMENT_NS << level; }
+
+	void enqueue(SchedulingEntity *entity, int level)
+	{
+		assert(level >= 0 && level < MLFQ_LEVELS);
+
+		Queue& q = _queues[level];
+		SchedulingEntity::RunqueueNode& n = node(entity);
+
+		n.height = level;
+		n.left = q.tail;
+		n.right = NULL;
+
+		if (q.tail) {
+			node(q.tail).right = entity;
+		} else {
+			q.head = entity;
+		}
+
+		q.tail = entity;
+		_nonempty |= 1u << level;
+	}
+
+	void dequeue(SchedulingEntity *entity)
+	{
+		Queue& q = _queues[level_of(entity)];
+		SchedulingEntity::RunqueueNode& n = node(entity);
+
+		if (n.left) {
+			node(n.left).right = n.right;
+		} else {
+			q.head = n.right;
+		}
+
+		if (n.right) {
+			node(n.right).left = n.left;
+		} else {
+			q.tail = n.left;
+		}
+
+		n.left = NULL;
+		n.right = NULL;
+
+		if (!q.head) {
+			_nonempty &= ~(1u << level_of(entity));
+		}
+	}
+
+	/**
+	 * Moves every queued entity to the top level, with a fresh allotment, keeping the
+	 * order they would have run in.  Entities that are asleep keep their level until
+	 * they wake up, but they will have been sleeping rather than using the CPU anyway.
+	 */
+	void boost()
+	{
+		for (int level = 0; level < MLFQ_LEVELS; level++) {
+			for (SchedulingEntity *e = _queues[level].head; e; e = node(e).right) {
+				node(e).key = e->cpu_runtime();
+			}
+		}
+
+		Queue& top = _queues[0];
+		for (int level = 1; level < MLFQ_LEVELS; level++) {
+			Queue& q = _queues[level];
+			if (!q.head) continue;
+
+			for (SchedulingEntity *e = q.head; e; e = node(e).right) {
+				node(e).height = 0;
+			}
+
+			if (top.tail) {
+				node(top.tail).right = q.head;
+				node(q.head).left = top.tail;
+			} else {
+				top.head = q.head;
+			}
+
+			top.tail = q.tail;
+			q.head = NULL;
+			q.tail = NULL;
+		}
+
+		_nonempty = top.head ? 1 : 0;
+	}
+};
+
+RegisterScheduler(MultiLevelFeedbackQueueScheduler);
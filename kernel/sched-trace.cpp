@@ -0,0 +1,310 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/sched-trace.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/sched-trace.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/sched-entity.h>
+#include <infos/kernel/kernel.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/text-file.h>
+#include <infos/fs/stats.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/util/math.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::fs;
+using namespace infos::util;
+
+// The number of entities whose wakeup-to-run latency is kept.
+#define SCHED_TRACE_ENTITIES	128
+
+// The number of entity table slots to try, before giving up on a sample.
+#define ENTITY_SLOT_PROBES		8
+
+// The number of records per CPU reported by /dev/schedtrace0: the most recent ones.
+#define RECORDS_REPORTED		64
+
+static bool do_trace;
+
+RegisterCmdLineArgument(SchedTraceEnable, "sched.trace") {
+	do_trace = (strncmp(value, "1", 1) == 0);
+}
+
+bool SchedulerTrace::enabled()
+{
+	return do_trace;
+}
+
+/**
+ * The wakeup-to-run latency of one entity, since it was first traced.  Entities are
+ * identified by address, so a slot is given to whichever entity next lands at the same
+ * address once its owner has gone, along with a copy of the name.
+ */
+struct EntityLatency
+{
+	const SchedulingEntity *entity;
+	char name[24];
+	uint64_t nr_wakeups;
+	uint64_t total_latency, max_latency;
+	uint64_t latency[SchedulerTrace::NR_LATENCY_BUCKETS];
+};
+
+static EntityLatency entities[SCHED_TRACE_ENTITIES];
+static uint64_t nr_dropped_samples;
+// Every CPU updates the table on every wakeup, so waiters queue rather than all
+// spinning on the lock.
+static MCSLock entities_lock;
+
+static inline unsigned int entity_hash(const SchedulingEntity *entity)
+{
+	return (unsigned int)(((uint64_t)entity * 0x9e3779b97f4a7c15ull) >> 56) % SCHED_TRACE_ENTITIES;
+}
+
+SchedulerTrace::SchedulerTrace(uint64_t now)
+	: _head(0), _start_time(now), _nr_switches(0), _nr_picks(0), _total_pick_time(0), _max_pick_time(0), _total_nr_queued(0)
+{
+
+}
+
+/**
+ * Returns the latency histogram bucket for a duration: log2 of the duration in ns, rounded
+ * down, as the syscall histograms are, so bucket N counts [2^N, 2^(N+1)) ns.
+ */
+int SchedulerTrace::latency_bucket(uint64_t ns)
+{
+	if (ns <= 1) return 0;
+	if (ns > 0xffffffffull) return NR_LATENCY_BUCKETS - 1;
+
+	int bucket = ilog2_floor((uint32_t)ns);
+	return bucket < NR_LATENCY_BUCKETS ? bucket : NR_LATENCY_BUCKETS - 1;
+}
+
+/**
+ * Adds a record to the ring, overwriting the oldest if it is full.
+ */
+void SchedulerTrace::record(SchedTraceEvent::SchedTraceEvent event, const SchedulingEntity *entity, uint32_t value, unsigned int nr_queued, uint64_t now)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	SchedTraceRecord& r = _ring[_head++ % RING_SIZE];
+	r.timestamp = now;
+	r.entity = entity;
+	r.value = value;
+	r.nr_queued = nr_queued > 0xffff ? 0xffff : nr_queued;
+	r.event = event;
+}
+
+/**
+ * Accounts for one call into the scheduling algorithm, and the runqueue length it saw.
+ */
+void SchedulerTrace::account_pick(uint64_t duration, unsigned int nr_queued)
+{
+	UniqueLock<SpinLock> l(_lock);
+
+	_nr_picks++;
+	_total_pick_time += duration;
+	if (duration > _max_pick_time) _max_pick_time = duration;
+
+	_total_nr_queued += nr_queued;
+}
+
+/**
+ * Accounts for the entity that is running after a scheduling event: whether it was
+ * switched to, and how long it waited to run after being woken up (or zero, if it
+ * wasn't woken up, e.g. it was preempted or kept running).
+ */
+void SchedulerTrace::account_switch(const SchedulingEntity& entity, bool switched, uint64_t wakeup_latency)
+{
+	if (switched) {
+		UniqueLock<SpinLock> l(_lock);
+		_nr_switches++;
+	}
+
+	if (!wakeup_latency) return;
+
+	UniqueLock<MCSLock> l(entities_lock);
+
+	unsigned int slot = entity_hash(&entity);
+	for (unsigned int i = 0; i < ENTITY_SLOT_PROBES; i++) {
+		EntityLatency& e = entities[(slot + i) % SCHED_TRACE_ENTITIES];
+
+		if (e.entity != &entity && e.entity != NULL) continue;
+
+		if (!e.entity) {
+			e.entity = &entity;
+			strncpy(e.name, entity.name().c_str(), sizeof(e.name) - 1);
+		}
+
+		e.nr_wakeups++;
+		e.total_latency += wakeup_latency;
+		if (wakeup_latency > e.max_latency) e.max_latency = wakeup_latency;
+		e.latency[latency_bucket(wakeup_latency)]++;
+		return;
+	}
+
+	nr_dropped_samples++;
+}
+
+unsigned int SchedulerTrace::snapshot(SchedTraceRecord *records, unsigned int max)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	uint64_t nr = _head < RING_SIZE ? _head : RING_SIZE;
+	if (nr > max) nr = max;
+
+	for (uint64_t i = 0; i < nr; i++) {
+		records[i] = _ring[(_head - nr + i) % RING_SIZE];
+	}
+
+	return (unsigned int)nr;
+}
+
+/**
+ * A pseudo-device (/dev/schedstat0) that reports, for each CPU, how often it switched
+ * entities, how long the scheduling algorithm took to pick them and how many entities
+ * were queued, and, for each entity, how long it took to run after being woken up.
+ */
+class SchedStatsDevice : public Device
+{
+public:
+	static const DeviceClass SchedStatsDeviceClass;
+
+	const DeviceClass& device_class() const override { return SchedStatsDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass SchedStatsDevice::SchedStatsDeviceClass(Device::RootDeviceClass, "schedstat");
+
+/**
+ * The statistics, which are also /dev/stats/schedstat.  Latency buckets are reported as
+ * log2(ns):count.
+ */
+RegisterStatistics(schedstat, "schedstat")
+{
+	if (!SchedulerTrace::enabled()) {
+		out.append("tracing not enabled (boot with sched.trace=1)\n");
+		return;
+	}
+
+	Scheduler& sched = sys.scheduler();
+	uint64_t now = sys.runtime().time_since_epoch().count();
+
+	out.append("cpu switches switches/s picks mean-pick-ns max-pick-ns mean-nr-queued steal-ns\n");
+	for (unsigned int i = 0; i < sched.nr_runqueues(); i++) {
+		SchedulerTrace *trace = sched.runqueue(i).trace();
+		if (!trace) continue;
+
+		uint64_t elapsed = now - trace->start_time();
+		uint64_t nr_picks = trace->nr_picks();
+
+		out.append("%u %llu %llu %llu %llu %llu %llu %llu\n", i, trace->nr_switches(),
+				elapsed ? trace->nr_switches() * 1000000000ull / elapsed : 0, nr_picks,
+				nr_picks ? trace->total_pick_time() / nr_picks : 0, trace->max_pick_time(),
+				nr_picks ? trace->total_nr_queued() / nr_picks : 0, sched.runqueue(i).stolen_time());
+	}
+
+	// The scheduler takes the lock from interrupt context.
+	UniqueIRQSaveLock<MCSLock> l(entities_lock);
+
+	out.append("thread wakeups mean-ns max-ns latency\n");
+	for (unsigned int i = 0; i < SCHED_TRACE_ENTITIES; i++) {
+		const EntityLatency& e = entities[i];
+		if (!e.entity) continue;
+
+		out.append("%s %llu %llu %llu", e.name, e.nr_wakeups, e.total_latency / e.nr_wakeups, e.max_latency);
+
+		for (int bucket = 0; bucket < SchedulerTrace::NR_LATENCY_BUCKETS; bucket++) {
+			if (!e.latency[bucket]) continue;
+
+			out.append(" %d:%llu", bucket, e.latency[bucket]);
+		}
+
+		out.append("\n");
+	}
+
+	if (nr_dropped_samples) {
+		out.append("dropped %llu\n", nr_dropped_samples);
+	}
+}
+
+File *SchedStatsDevice::open_as_file()
+{
+	return new StatisticsFile(__stats_regschedstat);
+}
+
+RegisterDevice(SchedStatsDevice);
+
+/**
+ * A pseudo-device (/dev/schedtrace0) that reports the most recent scheduling events on
+ * each CPU, oldest first, so that e.g. the runqueue length can be followed over time.
+ */
+class SchedTraceDevice : public Device
+{
+public:
+	static const DeviceClass SchedTraceDeviceClass;
+
+	const DeviceClass& device_class() const override { return SchedTraceDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass SchedTraceDevice::SchedTraceDeviceClass(Device::RootDeviceClass, "schedtrace");
+
+/**
+ * An open trace file.  Each line is one record: the time it was made, in ns since boot,
+ * the CPU, the event, the entity and the runqueue length, followed by the value of the
+ * event (see SchedTraceEvent).
+ */
+class SchedTraceFile : public TextFile
+{
+public:
+	SchedTraceFile()
+	{
+		if (!SchedulerTrace::enabled()) {
+			append("tracing not enabled (boot with sched.trace=1)\n");
+			return;
+		}
+
+		static const char *event_names[] = { "wakeup", "pick", "switch" };
+
+		SchedTraceRecord *records = new SchedTraceRecord[RECORDS_REPORTED];
+		if (!records) return;
+
+		Scheduler& sched = sys.scheduler();
+
+		append("time cpu event thread nr-queued value\n");
+		for (unsigned int i = 0; i < sched.nr_runqueues(); i++) {
+			SchedulerTrace *trace = sched.runqueue(i).trace();
+			if (!trace) continue;
+
+			unsigned int nr = trace->snapshot(records, RECORDS_REPORTED);
+			for (unsigned int j = 0; j < nr; j++) {
+				const SchedTraceRecord& r = records[j];
+
+				// The entity may be gone by now, so only its address is reported.
+				append("%llu %u %s %p %u %u\n", r.timestamp, i, event_names[r.event], r.entity, r.nr_queued, r.value);
+			}
+		}
+
+		delete[] records;
+	}
+};
+
+File *SchedTraceDevice::open_as_file()
+{
+	return new SchedTraceFile();
+}
+
+RegisterDevice(SchedTraceDevice);
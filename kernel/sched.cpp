@@ -12,6 +12,10 @@
 #include <infos/kernel/sched-entity.h>
 #include <infos/kernel/process.h>
 #include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/preempt.h>
+#include <infos/kernel/trace.h>
+#include <infos/mm/mm.h>
 #include <infos/util/time.h>
 #include <infos/util/cmdline.h>
 #include <arch/arch.h>
@@ -22,12 +26,33 @@ using namespace infos::util;
 
 ComponentLog infos::kernel::sched_log(syslog, "sched");
 
-static char sched_algorithm[32];
+static char sched_algorithm[32], sched_rt_algorithm[32], sched_idle_algorithm[32];
 
 RegisterCmdLineArgument(SchedAlgorithm, "sched.algorithm") {
 	strncpy(sched_algorithm, value, sizeof(sched_algorithm)-1);
 }
 
+RegisterCmdLineArgument(SchedRTAlgorithm, "sched.rt_algorithm") {
+	strncpy(sched_rt_algorithm, value, sizeof(sched_rt_algorithm)-1);
+}
+
+RegisterCmdLineArgument(SchedIdleAlgorithm, "sched.idle_algorithm") {
+	strncpy(sched_idle_algorithm, value, sizeof(sched_idle_algorithm)-1);
+}
+
+// The most of each CPU that the deadline class may be admitted to, in percent, leaving
+// the rest for the fair class.
+static unsigned int dl_bandwidth_percent = 95;
+
+RegisterCmdLineArgument(SchedDLBandwidth, "sched.dl_bandwidth") {
+	unsigned int percent = 0;
+	for (const char *c = value; *c >= '0' && *c <= '9'; c++) {
+		percent = percent * 10 + (*c - '0');
+	}
+
+	dl_bandwidth_percent = percent > 100 ? 100 : percent;
+}
+
 RegisterCmdLineArgument(SchedDebug, "sched.debug") {
 	if (strncmp(value, "1", 1) == 0) {
 		sched_log.enable();
@@ -36,27 +61,77 @@ RegisterCmdLineArgument(SchedDebug, "sched.debug") {
 	}
 }
 
-Scheduler::Scheduler(Kernel& owner) : Subsystem(owner), _active(false), _current(NULL)
+Scheduler::Scheduler(Kernel& owner) : Subsystem(owner), _active(false), _algorithm(NULL), _classes(), _nr_runqueues(0), _kernel_threads(NULL)
+{
+
+}
+
+RunQueue::RunQueue(CPU& cpu, SchedulingAlgorithm *const classes[SchedulingClass::NR_CLASSES], SchedulingEntity& idle, unsigned int index)
+	: _cpu(cpu), _nr_chain(0), _dl_bandwidth(0), _idle(idle), _current(NULL), _index(index), _nr_queued(0), _last_balance(0), _last_steal(0), _stolen(0), _trace(NULL)
 {
+	_lock.set_name("runqueue");
+
+	for (unsigned int cls = 0; cls < SchedulingClass::NR_CLASSES; cls++) {
+		_classes[cls] = classes[cls];
 
+		unsigned int i = 0;
+		while (i < _nr_chain && _chain[i] != classes[cls]) i++;
+		if (i == _nr_chain) _chain[_nr_chain++] = classes[cls];
+	}
 }
 
+// How long an entity runs before the scheduler is next invoked, if nothing else
+// invokes it first.
+#define SCHED_TIMESLICE_NS	10000000ull
+
+// How often each CPU looks for a busier CPU to take work from.  An idle CPU keeps its
+// timer running at this interval when there is more than one runqueue, so that it
+// notices work queued on the others.
+#define SCHED_BALANCE_INTERVAL_NS	4000000ull
+
+// An entity's memory stays on the NUMA node it was allocated from, so work is only taken
+// from a CPU on another node if that CPU's runqueue is busier by this many more.
+#define SCHED_NUMA_IMBALANCE		2
+
+// An entity that ran more recently than this is assumed to still have its data in the
+// CPU's caches, so it isn't moved away from that CPU.
+#define SCHED_MIGRATION_COST_NS	500000ull
+
 /**
- * The idle task thread proc.  It just spins in a loop, relaxing the processor.
+ * The idle task thread proc.  It tops up the page allocator's pool of pre-zeroed frames and,
+ * once that is full, puts the processor to sleep until something wakes it: an interrupt,
+ * or another CPU queueing work here (see Arch::wake_cpu()).  The timer is stopped while
+ * the idle task runs, so the processor isn't woken for nothing.
  */
-static void idle_task()
+static void __noreturn idle_task()
 {
-	for (;;) asm volatile("pause");
+	for (;;) {
+		RunQueue *rq = CPU::current().runqueue();
+
+		// A wake-up from another CPU doesn't invoke the scheduler itself, so do it here.
+		if (rq && rq->runnable()) {
+			sys.arch().invoke_kernel_syscall(1);
+		} else if (!sys.mm().pgalloc().refill_zero_pool()) {
+			sys.arch().idle();
+		}
+	}
 }
 
 bool Scheduler::init()
 {
-	sched_log.message(LogLevel::INFO, "Creating idle process");
+	sched_log.message(LogLevel::INFO, "Creating kernel process");
+
+	// Kernel threads don't need an address space of their own, so they all share this
+	// process, which starts out with just the idle thread.
+	Process *idle_process = new Process("kernel", true, (Thread::thread_proc_t)idle_task);
+	_kernel_threads = idle_process;
 
-	Process *idle_process = new Process("idle", true, (Thread::thread_proc_t)idle_task);
-	_idle_entity = &idle_process->main_thread();
+	if (strlen(sched_algorithm) == 0) {
+		sched_log.messagef(LogLevel::ERROR, "Scheduling allocation algorithm not chosen on command-line");
+		return false;
+	}
 
-	SchedulingAlgorithm *algo = acquire_scheduler_algorithm();
+	SchedulingAlgorithm *algo = acquire_scheduler_algorithm(sched_algorithm);
 	if (!algo) {
 		syslog.messagef(LogLevel::ERROR, "No scheduling algorithm available");
 		return false;
@@ -64,20 +139,93 @@ bool Scheduler::init()
 
 	syslog.messagef(LogLevel::IMPORTANT, "*** USING SCHEDULER ALGORITHM: %s", algo->name());
 
-	// Install the discovered algorithm.
+	// Install the discovered algorithm as the fair class.  This instance is the boot
+	// CPU's runqueue, and any other CPU gets its own instance, as it does of the other
+	// classes.
 	_algorithm = algo;
     _algorithm->init();
 
+	_classes[SchedulingClass::DEADLINE] = create_deadline_class();
+	_classes[SchedulingClass::DEADLINE]->init();
+	_classes[SchedulingClass::REALTIME] = acquire_class_algorithm(sched_rt_algorithm, "realtime");
+	_classes[SchedulingClass::FAIR] = _algorithm;
+	_classes[SchedulingClass::IDLE] = acquire_class_algorithm(sched_idle_algorithm, "idle");
+
+	if (!init_cpu(CPU::current(), idle_process->main_thread())) {
+		return false;
+	}
+
 	// Set the idle entity to be runnable, and forcibly activate it.  This is so that
 	// when interrupts are enabled, the idle thread becomes the context that is saved and restored.
 	// We don't call set_entity_state() here, because that would add the idle task to the algorithm
 	// runqueue, meaning that the scheduler would schedule the idle task along with the regular tasks.
-    _idle_entity->_state = SchedulingEntityState::RUNNABLE;
+    idle_process->main_thread()._state = SchedulingEntityState::RUNNABLE;
 	idle_process->main_thread().activate(NULL);
 
 	return true;
 }
 
+/**
+ * Gives a CPU its own runqueue, so that it schedules entities when it calls schedule().
+ * @param cpu The CPU.
+ * @param idle The entity the CPU runs when its runqueue is empty.  It is never queued.
+ * @return Returns true if the CPU now has a runqueue, or false otherwise.
+ */
+bool Scheduler::init_cpu(CPU& cpu, SchedulingEntity& idle)
+{
+	assert(_algorithm);
+	assert(!cpu.runqueue());
+
+	if (_nr_runqueues >= SCHED_MAX_RUNQUEUES) {
+		return false;
+	}
+
+	// The boot CPU uses the instances made in init().  Classes that share an
+	// algorithm share its instance here too.
+	SchedulingAlgorithm *classes[SchedulingClass::NR_CLASSES];
+	for (unsigned int cls = 0; cls < SchedulingClass::NR_CLASSES; cls++) {
+		unsigned int shared = 0;
+		while (shared < cls && _classes[shared] != _classes[cls]) shared++;
+
+		if (shared < cls) {
+			classes[cls] = classes[shared];
+		} else if (_nr_runqueues == 0) {
+			classes[cls] = _classes[cls];
+		} else {
+			classes[cls] = _classes[cls]->create_instance();
+			if (!classes[cls]) {
+				sched_log.messagef(LogLevel::WARNING, "The %s algorithm only supports one CPU", _classes[cls]->name());
+				return false;
+			}
+
+			classes[cls]->init();
+		}
+	}
+
+	RunQueue *rq = new RunQueue(cpu, classes, idle, _nr_runqueues);
+	rq->_last_steal = owner().arch().steal_time();
+	idle._runqueue = rq;
+
+	if (SchedulerTrace::enabled()) {
+		rq->_trace = new SchedulerTrace(owner().runtime().time_since_epoch().count());
+	}
+
+	// The other CPUs look through the runqueues as they balance.
+	UniqueIRQLock irq;
+	_runqueues[_nr_runqueues++] = rq;
+	cpu.runqueue(rq);
+
+	return true;
+}
+
+RunQueue& Scheduler::this_runqueue() const
+{
+	RunQueue *rq = CPU::current().runqueue();
+	assert(rq);
+
+	return *rq;
+}
+
 void Scheduler::run()
 {
 	// This is now the point of no return.  Once the scheduler is activated, it will schedule the first
@@ -92,14 +240,157 @@ void Scheduler::run()
 
 	// From this point onwards, the scheduler is now live.
 
-	// This infinite loop is required for two reasons:
-	// 1. The ::run() method is marked as __noreturn, and gcc can figure out if that's really true, and so will complain
-	//    if our "noreturn" method actually returns.
-	//
-	// 2. Once the scheduler is activated, it will only begin scheduling on the next timer tick -- which, of course,
-	//    is asynchronous to this control-flow.
-	for (;;)
-		asm volatile("nop");
+	// The idle thread was activated in init(), so this control-flow is now the idle
+	// thread, and carries on as its thread proc.  Once the scheduler is activated, it
+	// will only begin scheduling on the next timer tick -- which, of course, is
+	// asynchronous to this control-flow -- so the CPU sleeps until then.
+	idle_task();
+}
+
+void Scheduler::run_secondary()
+{
+	// As in init(), the idle entity is already running, and isn't queued.
+	RunQueue& rq = this_runqueue();
+	rq._idle._state = SchedulingEntityState::RUNNABLE;
+
+	sched_log.messagef(LogLevel::DEBUG, "Scheduling on cpu %u", rq._index);
+	owner().arch().enable_interrupts();
+
+	idle_task();
+}
+
+static bool cache_hot(SchedulingEntity::EntityStartTime last_ran, SchedulingEntity::EntityStartTime now)
+{
+	return now.time_since_epoch().count() - last_ran.time_since_epoch().count() < SCHED_MIGRATION_COST_NS;
+}
+
+/**
+ * Takes the locks of two runqueues, lowest index first, so that two CPUs moving entities
+ * between the same pair of runqueues can't deadlock.
+ */
+class RunQueuePairLock
+{
+public:
+	RunQueuePairLock(TicketLock& a, unsigned int a_index, TicketLock& b, unsigned int b_index)
+		: _first(a_index < b_index ? a : b), _second(a_index < b_index ? b : a)
+	{
+		_first.lock();
+		if (&_second != &_first) _second.lock();
+	}
+
+	~RunQueuePairLock()
+	{
+		if (&_second != &_first) _second.unlock();
+		_first.unlock();
+	}
+
+private:
+	TicketLock& _first;
+	TicketLock& _second;
+};
+
+/**
+ * Moves a queued entity, which must not be running, from one runqueue to another.  Both
+ * runqueues' locks must be held.
+ */
+void Scheduler::migrate(SchedulingEntity& entity, RunQueue& from, RunQueue& to)
+{
+	assert(entity._runqueue == &from && from._current != &entity);
+
+	class_of(from, entity).remove_from_runqueue(entity);
+	from._nr_queued--;
+
+	entity._runqueue = &to;
+	class_of(to, entity).add_to_runqueue(entity);
+	to._nr_queued++;
+
+	sched_log.messagef(LogLevel::DEBUG, "moved %s from cpu %u to cpu %u", entity.name().c_str(), from._index, to._index);
+}
+
+/**
+ * Moves one queued entity from a busier runqueue to another.
+ * @return Returns true if an entity was moved.
+ */
+bool Scheduler::steal(RunQueue& to, RunQueue& from, SchedulingEntity::EntityStartTime now)
+{
+	RunQueuePairLock l(to._lock, to._index, from._lock, from._index);
+
+	SchedulingEntity *entity = NULL;
+	for (unsigned int i = 0; i < from._nr_chain && !entity; i++) {
+		entity = from._chain[i]->migration_candidate(to._index);
+	}
+
+	if (!entity || entity == from._current) return false;
+
+	// Moving an entity whose data is still in its CPU's caches costs more than it
+	// gains.  It'll be cold by the time of the next attempt.
+	if (cache_hot(entity->_exec_start_time, now)) return false;
+
+	migrate(*entity, from, to);
+	return true;
+}
+
+/**
+ * Takes work from the busiest other runqueue, if it has enough more than this one that
+ * moving an entity evens them out.  Runqueues on other NUMA nodes count as less busy
+ * than they are, so work stays on its node unless the imbalance is large.
+ * @return Returns true if an entity was moved to this runqueue.
+ */
+bool Scheduler::balance(RunQueue& rq, SchedulingEntity::EntityStartTime now)
+{
+	rq._last_balance = now;
+
+	RunQueue *busiest = NULL;
+	int busiest_surplus = 0;
+	for (unsigned int i = 0; i < _nr_runqueues; i++) {
+		RunQueue *candidate = _runqueues[i];
+		if (candidate == &rq) continue;
+
+		// The busiest runqueue's current entity can't be moved, so it needs at least
+		// two more than this one for the move to make things more even.
+		int surplus = (int)candidate->_nr_queued - (int)rq._nr_queued - 2;
+		if (candidate->_cpu.numa_node() != rq._cpu.numa_node()) surplus -= SCHED_NUMA_IMBALANCE;
+
+		if (surplus >= 0 && (!busiest || surplus > busiest_surplus)) {
+			busiest = candidate;
+			busiest_surplus = surplus;
+		}
+	}
+
+	if (!busiest) return false;
+
+	return steal(rq, *busiest, now);
+}
+
+/**
+ * Returns the class an entity is queued in.
+ */
+SchedulingClass::SchedulingClass Scheduler::entity_class(const SchedulingEntity& entity)
+{
+	if (entity.deadline_class()) return SchedulingClass::DEADLINE;
+
+	switch (entity.priority()) {
+	case SchedulingEntityPriority::REALTIME: return SchedulingClass::REALTIME;
+	case SchedulingEntityPriority::DAEMON: return SchedulingClass::IDLE;
+	default: return SchedulingClass::FAIR;
+	}
+}
+
+/**
+ * Asks the classes, highest first, for the next entity to run, passing over those that
+ * have nothing runnable.  The runqueue's lock must be held.
+ */
+SchedulingEntity *Scheduler::pick_next_entity(RunQueue& rq)
+{
+	for (unsigned int i = 0; i < rq._nr_chain; i++) {
+		SchedulingAlgorithm *cls = rq._chain[i];
+		if (!cls->has_runnable()) continue;
+
+		SchedulingEntity *next = cls->pick_next_entity();
+		if (next) return next;
+	}
+
+	return NULL;
 }
 
 /**
@@ -108,38 +399,150 @@ void Scheduler::run()
 void Scheduler::schedule()
 {
 	if (!_active) return;
-	if (!_algorithm) return;
 
-	// Ask the scheduling algorithm for the next process.
-	SchedulingEntity *next = _algorithm->pick_next_entity();
+	RunQueue *rq = CPU::current().runqueue();
+	if (!rq) return;
+
+	UniqueIRQLock irq;
+	set_need_resched(false);
+
+	// Charge the entity that has been running for exactly the time it ran, however the
+	// scheduler came to be invoked.
+	update_accounting();
+
+	auto now = owner().runtime();
+	if (_nr_runqueues > 1 && now.time_since_epoch().count() - rq->_last_balance.time_since_epoch().count() >= SCHED_BALANCE_INTERVAL_NS) {
+		balance(*rq, now);
+	}
+
+	SchedulerTrace *trace = rq->_trace;
+	uint64_t pick_start = trace ? owner().runtime().time_since_epoch().count() : 0;
+
+	// Ask the scheduling classes for the next process.  An entity that isn't allowed
+	// here any more (see set_affinity) is moved on when it comes up, unless it is the one
+	// running, whose stack this is.  That one moves when it next sleeps.  Deadline
+	// entities never have to move.
+	SchedulingEntity *next;
+	for (unsigned int tries = 0;; tries++) {
+		{
+			UniqueLock<TicketLock> l(rq->_lock);
+			next = pick_next_entity(*rq);
+		}
+
+		if (!next || next == rq->_current || next->allowed_on(rq->_index) || tries >= rq->_nr_queued) break;
+
+		RunQueue& to = least_loaded_runqueue(*next);
+		RunQueuePairLock l(rq->_lock, rq->_index, to._lock, to._index);
+		if (next->_runqueue == rq) migrate(*next, *rq, to);
+	}
+
+	// If there is nothing to run here, try to take something from another CPU before
+	// settling for the idle entity.
+	if (!next && _nr_runqueues > 1 && balance(*rq, now)) {
+		UniqueLock<TicketLock> l(rq->_lock);
+		next = pick_next_entity(*rq);
+	}
+
+	if (trace) {
+		uint64_t pick_end = owner().runtime().time_since_epoch().count();
+
+		trace->account_pick(pick_end - pick_start, rq->_nr_queued);
+		trace->record(SchedTraceEvent::PICK, next, (uint32_t)(pick_end - pick_start), rq->_nr_queued, pick_end);
+	}
 
 	// If the algorithm refused to return a process, then schedule
 	// the idle entity.
 	if (!next) {
-		next = _idle_entity;
+		next = &rq->_idle;
 	}
 
 	// If the next task to run, is NOT the currently running task...
-	if (next != _current) {
+	SchedulingEntity *prev = rq->_current;
+	if (next != rq->_current) {
 		// Activate the next task.
-		if (next->activate(_current)) {
+		if (next->activate(rq->_current)) {
 			// Update the current task pointer.
-			_current = next;
+			rq->_current = next;
 
 		} else {
 			// If the task failed to activate, try and forcibly activate the idle entity.
-			if (!_idle_entity->activate(_current)) {
+			if (!rq->_idle.activate(rq->_current)) {
 				// We're in big trouble if even the idle thread won't activate.
 				arch_abort();
 			}
 
 			// Update the current task pointer.
-			_current = _idle_entity;
+			rq->_current = &rq->_idle;
 		}
 	}
 
 	// Update the execution start time for the task that's about to run.
-	_current->update_exec_start_time(owner().runtime());
+	rq->_current->update_exec_start_time(now);
+
+	if (rq->_current != prev) {
+		trace_event(TraceEvent::SCHED_SWITCH, (uint64_t)prev, (uint64_t)rq->_current, rq->_nr_queued);
+	}
+
+	if (trace) {
+		trace_switch(*trace, *rq, prev);
+	}
+
+	// The timer is one-shot.  There's no need for it while idling, because anything
+	// becoming runnable re-arms it (see set_entity_state), unless there are other
+	// runqueues to take work from, timers on this CPU's wheel to expire, or deadline
+	// entities to let run again.  A class may need it sooner than the end of the
+	// timeslice, e.g. when a deadline entity's runtime runs out.
+	uint64_t deadline = TimerWheel::NO_DEADLINE;
+	if (!rq->idle()) {
+		deadline = now.time_since_epoch().count() + SCHED_TIMESLICE_NS;
+	} else if (_nr_runqueues > 1) {
+		deadline = now.time_since_epoch().count() + SCHED_BALANCE_INTERVAL_NS;
+	}
+
+	for (unsigned int i = 0; i < rq->_nr_chain; i++) {
+		uint64_t event = rq->_chain[i]->next_event(now.time_since_epoch().count());
+		if (event != SchedulingAlgorithm::NO_EVENT && (deadline == TimerWheel::NO_DEADLINE || event < deadline)) {
+			deadline = event;
+		}
+	}
+
+	CPU::current().timers().program(now.time_since_epoch().count(), deadline);
+}
+
+/**
+ * Called as the preemption count drops to zero with a reschedule held over.  The
+ * thread switches away through the kernel's system call, as it would to sleep, unless
+ * interrupts are disabled (the reschedule then waits for them to be enabled), or this
+ * CPU is running softirqs on the thread's stack.
+ */
+void infos::kernel::preempt_schedule()
+{
+	Scheduler& sched = sys.scheduler();
+	if (!sched.active() || !sys.arch().interrupts_enabled() || CPU::current().softirqs().running) return;
+
+	sys.arch().invoke_kernel_syscall(1);
+}
+
+/**
+ * Records the outcome of a scheduling event: a context switch, if there was one, and,
+ * if the entity now running had been woken up, how long it waited to run.
+ */
+void Scheduler::trace_switch(SchedulerTrace& trace, RunQueue& rq, SchedulingEntity *prev)
+{
+	SchedulingEntity& current = *rq._current;
+	uint64_t now = owner().runtime().time_since_epoch().count();
+
+	uint64_t latency = 0;
+	if (current._wakeup_time.time_since_epoch().count()) {
+		latency = now - current._wakeup_time.time_since_epoch().count();
+		current._wakeup_time = SchedulingEntity::EntityStartTime(0);
+	}
+
+	if (&current != prev) {
+		trace.record(SchedTraceEvent::SWITCH, &current, (uint32_t)latency, rq._nr_queued, now);
+	}
+
+	trace.account_switch(current, &current != prev, latency);
 }
 
 /**
@@ -147,18 +550,185 @@ void Scheduler::schedule()
  */
 void Scheduler::update_accounting()
 {
-	if (_current) {
+	RunQueue *rq = CPU::current().runqueue();
+	if (!rq) return;
+
+	SchedulingEntity *current = rq->_current;
+	if (current) {
 		auto now = owner().runtime();
 
 		// Calculate the delta.
-		SchedulingEntity::EntityRuntime delta = now - _current->_exec_start_time;
+		SchedulingEntity::EntityRuntime delta = now - current->_exec_start_time;
+
+		// Under a hypervisor, the CPU may not have been running at all for some of it,
+		// which isn't the entity's doing.
+		uint64_t steal = owner().arch().steal_time();
+		uint64_t stolen = steal - rq->_last_steal;
+		rq->_last_steal = steal;
+
+		if (stolen) {
+			if (stolen > (uint64_t)delta.count()) stolen = delta.count();
+
+			delta = SchedulingEntity::EntityRuntime(delta.count() - stolen);
+			rq->_stolen += stolen;
+		}
 
 		// Increment the CPU runtime.
-		_current->increment_cpu_runtime(delta);
+		current->increment_cpu_runtime(delta);
 
 		// Update the exec start time.
-		_current->update_exec_start_time(now);
+		current->update_exec_start_time(now);
+	}
+}
+
+/**
+ * Chooses the runqueue for an entity that is becoming runnable.  It goes back to the
+ * CPU it last ran on, where its data is most likely to still be cached, unless that
+ * CPU is busy, this one is idle, and it has been away long enough to have gone cold.
+ */
+RunQueue& Scheduler::select_runqueue(SchedulingEntity& entity, SchedulingEntity::EntityStartTime now)
+{
+	// A deadline entity's bandwidth was admitted to its runqueue, so it stays there.
+	if (entity.deadline_class() && entity._runqueue) return *entity._runqueue;
+
+	RunQueue& here = this_runqueue();
+	bool allowed_here = entity.allowed_on(here._index);
+
+	// An entity that is woken before it has finished going to sleep is still running on
+	// its CPU, until the scheduler there switches away from it, so it can't go anywhere else.
+	RunQueue *prev = entity._runqueue;
+	if (prev && prev->_current == &entity) return *prev;
+
+	if (prev && entity.allowed_on(prev->_index)) {
+		if (prev != &here && allowed_here && !prev->idle() && here.idle() && !cache_hot(entity._exec_start_time, now)) {
+			return here;
+		}
+
+		return *prev;
+	}
+
+	return allowed_here ? here : least_loaded_runqueue(entity);
+}
+
+/**
+ * Returns the runqueue with the fewest entities, out of those the entity is allowed on.
+ * Of those with as few, one on the NUMA node the entity last ran on is preferred.
+ */
+RunQueue& Scheduler::least_loaded_runqueue(const SchedulingEntity& entity)
+{
+	unsigned int node = entity._runqueue ? entity._runqueue->_cpu.numa_node() : CPU::current().numa_node();
+
+	RunQueue *best = NULL;
+	for (unsigned int i = 0; i < _nr_runqueues; i++) {
+		RunQueue *candidate = _runqueues[i];
+		if (!entity.allowed_on(i)) continue;
+
+		if (!best || candidate->_nr_queued < best->_nr_queued ||
+				(candidate->_nr_queued == best->_nr_queued && candidate->_cpu.numa_node() == node && best->_cpu.numa_node() != node)) {
+			best = candidate;
+		}
+	}
+
+	// set_affinity() never leaves an entity with nowhere to run.
+	assert(best);
+	return *best;
+}
+
+/**
+ * Restricts the CPUs an entity may run on.  A queued entity on a CPU it is no longer
+ * allowed on is moved straight away, unless it is running there, in which case it moves
+ * the next time the scheduler there passes it over, or it sleeps.
+ * @param entity The entity.
+ * @param mask The runqueue indices the entity may run on, one bit each.
+ * @return Returns false, leaving the affinity alone, if the mask doesn't include any
+ * runqueue that exists, or if the entity is in the deadline class, and the mask doesn't
+ * include the runqueue its bandwidth was admitted to.
+ */
+bool Scheduler::set_affinity(SchedulingEntity& entity, SchedulingEntity::AffinityMask mask)
+{
+	SchedulingEntity::AffinityMask existing = _nr_runqueues >= 64 ? SchedulingEntity::ALL_CPUS : (1ull << _nr_runqueues) - 1;
+	if (!(mask & existing)) return false;
+
+	UniqueIRQLock irq;
+	if (entity.deadline_class() && entity._runqueue && (entity._runqueue->_index >= 64 || !((mask >> entity._runqueue->_index) & 1))) return false;
+
+	entity._affinity = mask;
+
+	RunQueue *rq = entity._runqueue;
+	if (!rq || entity.allowed_on(rq->_index)) return true;
+
+	bool queued = entity._state == SchedulingEntityState::RUNNABLE || entity._state == SchedulingEntityState::RUNNING;
+	if (queued && rq->_current != &entity) {
+		RunQueue& to = least_loaded_runqueue(entity);
+		RunQueuePairLock l(rq->_lock, rq->_index, to._lock, to._index);
+
+		if (entity._runqueue == rq && rq->_current != &entity) migrate(entity, *rq, to);
+	}
+
+	return true;
+}
+
+static uint64_t deadline_bandwidth(uint64_t runtime, uint64_t period)
+{
+	return period ? (runtime << 20) / period : 0;
+}
+
+/**
+ * Puts an entity in the deadline class, so that it runs for up to 'runtime' ns in
+ * every 'period' ns, by 'deadline' ns after each period starts, ahead of every entity
+ * in the fair class.  The entity's share of the CPU, runtime / period, is admitted to
+ * the runqueue it is on (or this CPU's, if it has never run), provided that the total
+ * there stays within the sched.dl_bandwidth option, and the entity then only runs on
+ * that CPU.  A runtime of zero puts the entity back in the fair class.
+ * @return Returns false, changing nothing, if the parameters are inconsistent, if the
+ * entity isn't allowed on the runqueue, or if the bandwidth can't be admitted.
+ */
+bool Scheduler::set_deadline(SchedulingEntity& entity, uint64_t runtime, uint64_t deadline, uint64_t period)
+{
+	if (runtime && (runtime > deadline || deadline > period)) return false;
+
+	UniqueIRQLock irq;
+	if (entity._state == SchedulingEntityState::STOPPED && entity._runqueue) return false;
+
+	RunQueue& rq = entity._runqueue ? *entity._runqueue : this_runqueue();
+	if (runtime && !entity.allowed_on(rq._index)) return false;
+
+	uint64_t old_bw = deadline_bandwidth(entity._deadline_params.runtime, entity._deadline_params.period);
+	uint64_t new_bw = deadline_bandwidth(runtime, period);
+	uint64_t limit = ((uint64_t)dl_bandwidth_percent << 20) / 100;
+	if (new_bw > old_bw && rq._dl_bandwidth - old_bw + new_bw > limit) {
+		sched_log.messagef(LogLevel::DEBUG, "deadline bandwidth for %s refused on cpu %u", entity.name().c_str(), rq._index);
+		return false;
 	}
+
+	bool queued = entity._state == SchedulingEntityState::RUNNABLE || entity._state == SchedulingEntityState::RUNNING;
+	{
+		UniqueLock<TicketLock> l(rq._lock);
+
+		if (queued) class_of(rq, entity).remove_from_runqueue(entity);
+
+		rq._dl_bandwidth = rq._dl_bandwidth - old_bw + new_bw;
+		entity._runqueue = &rq;
+		entity._deadline_params.runtime = runtime;
+		entity._deadline_params.deadline = deadline;
+		entity._deadline_params.period = period;
+
+		// The first period starts when the entity is next queued.
+		entity._deadline_state = SchedulingEntity::DeadlineState();
+		entity._deadline_state.charged = entity._cpu_runtime.count();
+
+		if (queued) class_of(rq, entity).add_to_runqueue(entity);
+	}
+
+	if (queued && _active) {
+		if (&rq == CPU::current().runqueue()) {
+			owner().arch().set_next_timer_interrupt(Nanoseconds(0));
+		} else {
+			owner().arch().reschedule_cpu(rq.cpu());
+		}
+	}
+
+	return true;
 }
 
 /**
@@ -170,6 +740,8 @@ void Scheduler::set_entity_state(SchedulingEntity& entity, SchedulingEntityState
 {
 	assert(_algorithm);
 
+	UniqueIRQLock irq;
+
 	// If the state is not being changed -- do nothing.
 	if (entity._state == state) return;
 
@@ -177,43 +749,139 @@ void Scheduler::set_entity_state(SchedulingEntity& entity, SchedulingEntityState
 	if (state == SchedulingEntityState::RUNNABLE) {
 		// Add the entity to the runqueue only if it is transitioning from STOPPED or SLEEPING
 		if (entity._state == SchedulingEntityState::STOPPED || entity._state == SchedulingEntityState::SLEEPING) {
-			_algorithm->add_to_runqueue(entity);
+			RunQueue& rq = select_runqueue(entity, owner().runtime());
+
+			// An entity preempts one in a lower class, and a deadline entity preempts
+			// one with a later deadline.
+			bool preempt;
+			{
+				UniqueLock<TicketLock> l(rq._lock);
+
+				entity._runqueue = &rq;
+				class_of(rq, entity).add_to_runqueue(entity);
+				rq._nr_queued++;
+
+				SchedulingEntity *current = rq._current;
+				if (current && current != &rq._idle && current != &entity) {
+					SchedulingClass::SchedulingClass cls = entity_class(entity), current_cls = entity_class(*current);
+
+					preempt = cls < current_cls || (cls == SchedulingClass::DEADLINE && current_cls == SchedulingClass::DEADLINE &&
+						entity._deadline_state.abs_deadline < current->_deadline_state.abs_deadline);
+				} else {
+					preempt = false;
+				}
+			}
+
+			// The wakeup is recorded by the CPU that made it, which isn't necessarily
+			// the one that will run the entity.
+			RunQueue *here = CPU::current().runqueue();
+			if (here && here->_trace) {
+				auto now = owner().runtime();
+
+				entity._wakeup_time = now;
+				here->_trace->record(SchedTraceEvent::WAKEUP, &entity, rq._index, rq._nr_queued, now.time_since_epoch().count());
+			}
+
+			// If the processor is idle, the timer has been stopped, so get the
+			// scheduler to run as soon as possible.  Another idle CPU is woken up, and
+			// another busy one interrupted.
+			if (_active && (rq.idle() || preempt)) {
+				if (&rq == CPU::current().runqueue()) {
+					owner().arch().set_next_timer_interrupt(Nanoseconds(0));
+				} else if (preempt) {
+					owner().arch().reschedule_cpu(rq.cpu());
+				} else {
+					owner().arch().wake_cpu(rq.cpu());
+				}
+			}
 		}
 	} else if (state == SchedulingEntityState::STOPPED || state == SchedulingEntityState::SLEEPING) {
 		// Remove the entity from the runqueue only if it is transitioning from RUNNABLE or RUNNING
 		if (entity._state == SchedulingEntityState::RUNNABLE || entity._state == SchedulingEntityState::RUNNING) {
-			_algorithm->remove_from_runqueue(entity);
+			RunQueue& rq = *entity._runqueue;
+			UniqueLock<TicketLock> l(rq._lock);
+
+			class_of(rq, entity).remove_from_runqueue(entity);
+			rq._nr_queued--;
+		}
+
+		// An entity that stops gives up its deadline bandwidth.
+		if (state == SchedulingEntityState::STOPPED && entity.deadline_class() && entity._runqueue) {
+			RunQueue& rq = *entity._runqueue;
+			UniqueLock<TicketLock> l(rq._lock);
+
+			rq._dl_bandwidth -= deadline_bandwidth(entity._deadline_params.runtime, entity._deadline_params.period);
+			entity._deadline_params = SchedulingEntity::DeadlineParams();
 		}
 	} else if (state == SchedulingEntityState::RUNNING) {
 		// The entity can only transition into RUNNING if it is currently RUNNABLE
 		assert(entity._state == SchedulingEntityState::RUNNABLE);
 	}
 
-	// Record the new state in the entity.
+	// Record the new state in the entity.  Only stopping is waited for (e.g. by a join),
+	// so other transitions, which happen on every sleep and wakeup, don't wake anyone.
 	entity._state = state;
-	entity._state_changed.trigger();
+	if (state == SchedulingEntityState::STOPPED) {
+		entity._state_changed.trigger();
+	}
 }
 
 extern char _SCHED_ALG_PTR_START, _SCHED_ALG_PTR_END;
 
-SchedulingAlgorithm* Scheduler::acquire_scheduler_algorithm()
+SchedulingAlgorithm* Scheduler::acquire_scheduler_algorithm(const char *name)
 {
-	if (strlen(sched_algorithm) == 0) {
-		sched_log.messagef(LogLevel::ERROR, "Scheduling allocation algorithm not chosen on command-line");
-		return NULL;
-	}
-
 	SchedulingAlgorithm *candidate = NULL;
 	SchedulingAlgorithm **schedulers = (SchedulingAlgorithm **)&_SCHED_ALG_PTR_START;
 
-	sched_log.messagef(LogLevel::DEBUG, "Searching for '%s' algorithm...", sched_algorithm);
+	sched_log.messagef(LogLevel::DEBUG, "Searching for '%s' algorithm...", name);
 	while (schedulers < (SchedulingAlgorithm **)&_SCHED_ALG_PTR_END) {
-		if (strncmp((*schedulers)->name(), sched_algorithm, sizeof(sched_algorithm)-1) == 0) {
+		if (strncmp((*schedulers)->name(), name, sizeof(sched_algorithm)-1) == 0) {
 			candidate = *schedulers;
 		}
 
 		schedulers++;
 	}
 
+	for (SchedulingAlgorithm *registered : _registered_algorithms) {
+		if (strncmp(registered->name(), name, sizeof(sched_algorithm)-1) == 0) {
+			candidate = registered;
+		}
+	}
+
 	return candidate;
 }
+
+/**
+ * Makes the boot CPU's instance of the algorithm chosen for the realtime or idle class.
+ * The registered algorithm may be the fair class's too, so the class gets an instance
+ * of its own.  If no algorithm was chosen, or it can't be had, the class's entities go
+ * in the fair class.
+ */
+SchedulingAlgorithm *Scheduler::acquire_class_algorithm(const char *name, const char *cls)
+{
+	if (strlen(name) == 0) return _algorithm;
+
+	SchedulingAlgorithm *registered = acquire_scheduler_algorithm(name);
+	SchedulingAlgorithm *algo = registered ? registered->create_instance() : NULL;
+	if (!algo) {
+		sched_log.messagef(LogLevel::WARNING, "No '%s' algorithm for the %s class: using the fair class", name, cls);
+		return _algorithm;
+	}
+
+	algo->init();
+	syslog.messagef(LogLevel::IMPORTANT, "*** USING %s CLASS ALGORITHM: %s", cls, algo->name());
+
+	return algo;
+}
+
+bool Scheduler::register_algorithm(SchedulingAlgorithm& algorithm)
+{
+	if (_algorithm) {
+		sched_log.messagef(LogLevel::WARNING, "Too late to register scheduling algorithm '%s'", algorithm.name());
+		return false;
+	}
+
+	sched_log.messagef(LogLevel::DEBUG, "Registering scheduling algorithm '%s'", algorithm.name());
+	_registered_algorithms.append(&algorithm);
+	return true;
+}
@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/softirq.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/softirq.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/preempt.h>
+#include <infos/kernel/log.h>
+#include <infos/util/lock.h>
+#include <arch/arch.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+
+// How many times the pending vectors are run over as an interrupt returns, before what
+// is left is handed to the overflow thread.
+#define SOFTIRQ_MAX_ROUNDS	4
+
+static void timer_softirq()
+{
+	sys.update_runtime();
+	CPU::current().timers().run(sys.runtime().time_since_epoch().count());
+}
+
+static SoftIRQ::softirq_handler_t softirq_handlers[SoftIRQVector::NR_VECTORS] = { timer_softirq };
+
+static WorkQueue softirq_wq("ksoftirqd", SchedulingEntityPriority::REALTIME);
+
+SoftIRQState::SoftIRQState() : pending(0), running(false), overflow(SoftIRQ::run_overflow, NULL)
+{
+}
+
+void SoftIRQ::register_handler(SoftIRQVector::SoftIRQVector vector, softirq_handler_t handler)
+{
+	assert(vector < SoftIRQVector::NR_VECTORS);
+	softirq_handlers[vector] = handler;
+}
+
+void SoftIRQ::raise(SoftIRQVector::SoftIRQVector vector)
+{
+	__atomic_fetch_or(&CPU::current().softirqs().pending, 1u << vector, __ATOMIC_RELAXED);
+}
+
+void SoftIRQ::request_resched()
+{
+	set_need_resched(true);
+}
+
+bool SoftIRQ::start()
+{
+	return softirq_wq.start();
+}
+
+/**
+ * Runs the pending vectors, with interrupts enabled, until there are none left, or it
+ * has been round enough times.  Called, and returns, with interrupts disabled.
+ */
+void SoftIRQ::run(SoftIRQState& state)
+{
+	state.running = true;
+
+	for (unsigned int round = 0; state.pending; round++) {
+		if (round == SOFTIRQ_MAX_ROUNDS) {
+			softirq_wq.queue(state.overflow);
+			break;
+		}
+
+		uint32_t pending = __atomic_exchange_n(&state.pending, 0, __ATOMIC_ACQUIRE);
+
+		// The handlers share their data with threads that disable interrupts to keep
+		// them away, so they exclude the other CPUs as those threads do.  Nothing can
+		// switch away from them, so the lock can be held with interrupts enabled.
+		bool kernel_locked = KernelLock::lock();
+
+		// Interrupts that come in now raise vectors, but go straight back to here, as
+		// the CPU is already running them.
+		sys.arch().enable_interrupts();
+
+		while (pending) {
+			unsigned int vector = __builtin_ctz(pending);
+			pending &= pending - 1;
+
+			if (softirq_handlers[vector]) softirq_handlers[vector]();
+		}
+
+		sys.arch().disable_interrupts();
+
+		if (kernel_locked) KernelLock::unlock();
+	}
+
+	state.running = false;
+}
+
+void SoftIRQ::irq_exit(bool can_run)
+{
+	SoftIRQState& state = CPU::current().softirqs();
+
+	// An interrupt on top of the softirqs leaves everything to them: the scheduler can't
+	// switch away from them, as they are the CPU's, not the thread's.
+	if (state.running) return;
+
+	if (can_run && state.pending) {
+		run(state);
+	}
+
+	// The interrupted context's preemption count is the CPU's again.  If it holds a
+	// spinlock, the reschedule waits until it lets go (see preempt_enable()).
+	if (need_resched() && !preempt_count()) {
+		sys.scheduler().schedule();
+	}
+}
+
+/**
+ * Runs what couldn't be run as an interrupt returned, in one of the workers, each of
+ * which is bound to its CPU.
+ */
+void SoftIRQ::run_overflow(void *arg)
+{
+	// A reschedule that the softirqs asked for happens as the lock is released.
+	UniqueIRQLock irq;
+
+	SoftIRQState& state = CPU::current().softirqs();
+	if (state.running) return;
+
+	run(state);
+}
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/syscall-stats.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/syscall.h>
+#include <infos/kernel/kernel.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/text-file.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::fs;
+
+/**
+ * A pseudo-device (/dev/syscalls0) that reports how often each system call has been
+ * made, and how long it took, as text.
+ */
+class SyscallStatsDevice : public Device
+{
+public:
+	static const DeviceClass SyscallStatsDeviceClass;
+
+	const DeviceClass& device_class() const override { return SyscallStatsDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass SyscallStatsDevice::SyscallStatsDeviceClass(Device::RootDeviceClass, "syscalls");
+
+/**
+ * An open statistics file.  Each line is a system call that has been made at least once,
+ * followed by its non-empty latency buckets, as log2(cycles):count.
+ */
+class SyscallStatsFile : public TextFile
+{
+public:
+	SyscallStatsFile()
+	{
+		SyscallManager& scm = sys.syscalls();
+		if (!scm.StatsEnabled()) {
+			append("statistics not enabled (boot with syscall.stats=1)\n");
+			return;
+		}
+
+		append("nr name calls total-cycles mean-cycles latency\n");
+		for (int nr = 0; nr < SyscallManager::MAX_SYSCALLS; nr++) {
+			SyscallStats stats;
+			if (!scm.IsRegistered(nr) || !scm.GetStats(nr, stats) || !stats.nr_calls) continue;
+
+			const char *name = scm.SyscallName(nr);
+			append("%d %s %llu %llu %llu", nr, name ? name : "?", stats.nr_calls, stats.total_cycles,
+					stats.total_cycles / stats.nr_calls);
+
+			for (int bucket = 0; bucket < SyscallStats::NR_LATENCY_BUCKETS; bucket++) {
+				if (!stats.latency[bucket]) continue;
+
+				append(" %d:%llu", bucket, stats.latency[bucket]);
+			}
+
+			append("\n");
+		}
+	}
+};
+
+File *SyscallStatsDevice::open_as_file()
+{
+	return new SyscallStatsFile();
+}
+
+RegisterDevice(SyscallStatsDevice);
@@ -13,73 +13,184 @@
 #include <infos/kernel/om.h>
 #include <infos/kernel/thread.h>
 #include <infos/kernel/process.h>
+#include <infos/kernel/futex.h>
+#include <infos/kernel/io-ring.h>
+#include <infos/kernel/timer-wheel.h>
+#include <infos/kernel/trace.h>
+#include <infos/kernel/profile.h>
 #include <infos/fs/file.h>
 #include <infos/fs/directory.h>
+#include <infos/fs/pipe.h>
+#include <infos/net/socket.h>
 #include <infos/util/string.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/math.h>
+#include <infos/mm/user-access.h>
+#include <infos/mm/shared-memory.h>
 #include <arch/arch.h>
 
 using namespace infos::kernel;
 using namespace infos::fs;
+using namespace infos::net;
+using namespace infos::mm;
 using namespace infos::util;
 
 #include <arch/x86/vma.h>
+#include <arch/x86/msr.h>
+#include <arch/x86/pmu.h>
 
-SyscallManager::SyscallManager()
+static bool do_stats;
+
+RegisterCmdLineArgument(SyscallStatsEnable, "syscall.stats") {
+	do_stats = (strncmp(value, "1", 1) == 0);
+}
+
+SyscallManager::SyscallManager() : stats_(NULL)
 {
 	for (int i = 0; i < MAX_SYSCALLS; i++) {
 		syscall_table_[i] = nullptr;
+		syscall_names_[i] = NULL;
 	}
 }
 
 
-void SyscallManager::RegisterSyscall(int nr, syscallfn fn)
+void SyscallManager::RegisterSyscall(int nr, syscallfn fn, const char *name)
 {
 	if (nr < 0 || nr >= MAX_SYSCALLS) return;
+
+	// The command-line has been parsed, and the heap is up, by the time anything is
+	// registered.
+	if (do_stats && !stats_) {
+		stats_ = new SyscallStats[MAX_SYSCALLS];
+		bzero(stats_, sizeof(SyscallStats) * MAX_SYSCALLS);
+	}
+
 	syscall_table_[nr] = fn;
+	syscall_names_[nr] = name;
 }
 
 unsigned long SyscallManager::InvokeSyscall(int nr, unsigned long arg0, unsigned long arg1, unsigned long arg2, unsigned long arg3, unsigned long arg4, unsigned long arg5)
 {
-	if (nr < 0 || nr >= MAX_SYSCALLS) return -1;
+	if ((unsigned int)nr >= MAX_SYSCALLS) return -1;
 
 	syscallfn fn = syscall_table_[nr];
 
 	if (fn == nullptr) {
 		syslog.messagef(LogLevel::DEBUG, "UNHANDLED USER SYSTEM CALL: %d", nr);
 		return -1;
+	}
+
+	trace_event(TraceEvent::SYSCALL_ENTER, nr, arg0, arg1);
+
+	unsigned long rc;
+	if (stats_) {
+		rc = InvokeSyscallWithStats(fn, nr, arg0, arg1, arg2, arg3, arg4, arg5);
 	} else {
-		return fn(arg0, arg1, arg2, arg3, arg4, arg5);
+		rc = fn(arg0, arg1, arg2, arg3, arg4, arg5);
 	}
+
+	trace_event(TraceEvent::SYSCALL_EXIT, nr, rc);
+	return rc;
 }
 
-void DefaultSyscalls::RegisterDefaultSyscalls(SyscallManager& mgr)
+unsigned long SyscallManager::InvokeSyscallWithStats(syscallfn fn, int nr, unsigned long arg0, unsigned long arg1, unsigned long arg2, unsigned long arg3, unsigned long arg4, unsigned long arg5)
 {
-	mgr.RegisterSyscall(0, (SyscallManager::syscallfn) DefaultSyscalls::sys_nop);
-	mgr.RegisterSyscall(1, (SyscallManager::syscallfn) DefaultSyscalls::sys_yield);
-	mgr.RegisterSyscall(2, (SyscallManager::syscallfn) DefaultSyscalls::sys_exit);
+	uint64_t start = infos::arch::x86::__rdtsc();
+	unsigned long rc = fn(arg0, arg1, arg2, arg3, arg4, arg5);
+	uint64_t cycles = infos::arch::x86::__rdtsc() - start;
+
+	int bucket = 0;
+	if (cycles > 0xffffffffull) {
+		bucket = SyscallStats::NR_LATENCY_BUCKETS - 1;
+	} else if (cycles) {
+		bucket = ilog2_floor((uint32_t)cycles);
+		if (bucket >= SyscallStats::NR_LATENCY_BUCKETS) bucket = SyscallStats::NR_LATENCY_BUCKETS - 1;
+	}
 
-	mgr.RegisterSyscall(3, (SyscallManager::syscallfn) DefaultSyscalls::sys_open);
-	mgr.RegisterSyscall(4, (SyscallManager::syscallfn) DefaultSyscalls::sys_close);
-	mgr.RegisterSyscall(5, (SyscallManager::syscallfn) DefaultSyscalls::sys_read);
-	mgr.RegisterSyscall(6, (SyscallManager::syscallfn) DefaultSyscalls::sys_write);
+	// The latency includes any time the call spent asleep, or preempted, and other
+	// threads may be making the same call in the meantime.
+	SyscallStats& stats = stats_[nr];
+	__sync_fetch_and_add(&stats.nr_calls, 1);
+	__sync_fetch_and_add(&stats.total_cycles, cycles);
+	__sync_fetch_and_add(&stats.latency[bucket], 1);
 
-	mgr.RegisterSyscall(7, (SyscallManager::syscallfn) DefaultSyscalls::sys_opendir);
-	mgr.RegisterSyscall(8, (SyscallManager::syscallfn) DefaultSyscalls::sys_readdir);
-	mgr.RegisterSyscall(9, (SyscallManager::syscallfn) DefaultSyscalls::sys_closedir);
+	return rc;
+}
 
-	mgr.RegisterSyscall(10, (SyscallManager::syscallfn) DefaultSyscalls::sys_exec);
-	mgr.RegisterSyscall(11, (SyscallManager::syscallfn) DefaultSyscalls::sys_wait_proc);
-	mgr.RegisterSyscall(12, (SyscallManager::syscallfn) DefaultSyscalls::sys_create_thread);
-	mgr.RegisterSyscall(13, (SyscallManager::syscallfn) DefaultSyscalls::sys_stop_thread);
-	mgr.RegisterSyscall(14, (SyscallManager::syscallfn) DefaultSyscalls::sys_join_thread);
+bool SyscallManager::GetStats(int nr, SyscallStats& stats) const
+{
+	if (!stats_ || nr < 0 || nr >= MAX_SYSCALLS) return false;
 
-	mgr.RegisterSyscall(15, (SyscallManager::syscallfn) DefaultSyscalls::sys_usleep);
-	mgr.RegisterSyscall(16, (SyscallManager::syscallfn) DefaultSyscalls::sys_get_tod);
-	mgr.RegisterSyscall(17, (SyscallManager::syscallfn) DefaultSyscalls::sys_set_thread_name);
-	mgr.RegisterSyscall(18, (SyscallManager::syscallfn) DefaultSyscalls::sys_get_ticks);
+	stats = stats_[nr];
+	return true;
+}
 
-	mgr.RegisterSyscall(19, (SyscallManager::syscallfn) DefaultSyscalls::sys_pread);
-	mgr.RegisterSyscall(20, (SyscallManager::syscallfn) DefaultSyscalls::sys_pwrite);
+void DefaultSyscalls::RegisterDefaultSyscalls(SyscallManager& mgr)
+{
+	mgr.RegisterSyscall(0, (SyscallManager::syscallfn) DefaultSyscalls::sys_nop, "nop");
+	mgr.RegisterSyscall(1, (SyscallManager::syscallfn) DefaultSyscalls::sys_yield, "yield");
+	mgr.RegisterSyscall(2, (SyscallManager::syscallfn) DefaultSyscalls::sys_exit, "exit");
+
+	mgr.RegisterSyscall(3, (SyscallManager::syscallfn) DefaultSyscalls::sys_open, "open");
+	mgr.RegisterSyscall(4, (SyscallManager::syscallfn) DefaultSyscalls::sys_close, "close");
+	mgr.RegisterSyscall(5, (SyscallManager::syscallfn) DefaultSyscalls::sys_read, "read");
+	mgr.RegisterSyscall(6, (SyscallManager::syscallfn) DefaultSyscalls::sys_write, "write");
+
+	mgr.RegisterSyscall(7, (SyscallManager::syscallfn) DefaultSyscalls::sys_opendir, "opendir");
+	mgr.RegisterSyscall(8, (SyscallManager::syscallfn) DefaultSyscalls::sys_readdir, "readdir");
+	mgr.RegisterSyscall(9, (SyscallManager::syscallfn) DefaultSyscalls::sys_closedir, "closedir");
+
+	mgr.RegisterSyscall(10, (SyscallManager::syscallfn) DefaultSyscalls::sys_exec, "exec");
+	mgr.RegisterSyscall(11, (SyscallManager::syscallfn) DefaultSyscalls::sys_wait_proc, "wait_proc");
+	mgr.RegisterSyscall(12, (SyscallManager::syscallfn) DefaultSyscalls::sys_create_thread, "create_thread");
+	mgr.RegisterSyscall(13, (SyscallManager::syscallfn) DefaultSyscalls::sys_stop_thread, "stop_thread");
+	mgr.RegisterSyscall(14, (SyscallManager::syscallfn) DefaultSyscalls::sys_join_thread, "join_thread");
+
+	mgr.RegisterSyscall(15, (SyscallManager::syscallfn) DefaultSyscalls::sys_usleep, "usleep");
+	mgr.RegisterSyscall(16, (SyscallManager::syscallfn) DefaultSyscalls::sys_get_tod, "get_tod");
+	mgr.RegisterSyscall(17, (SyscallManager::syscallfn) DefaultSyscalls::sys_set_thread_name, "set_thread_name");
+	mgr.RegisterSyscall(18, (SyscallManager::syscallfn) DefaultSyscalls::sys_get_ticks, "get_ticks");
+
+	mgr.RegisterSyscall(19, (SyscallManager::syscallfn) DefaultSyscalls::sys_pread, "pread");
+	mgr.RegisterSyscall(20, (SyscallManager::syscallfn) DefaultSyscalls::sys_pwrite, "pwrite");
+
+	mgr.RegisterSyscall(21, (SyscallManager::syscallfn) DefaultSyscalls::sys_map_file, "map_file");
+	mgr.RegisterSyscall(22, (SyscallManager::syscallfn) DefaultSyscalls::sys_unmap, "unmap");
+
+	mgr.RegisterSyscall(23, (SyscallManager::syscallfn) DefaultSyscalls::sys_set_affinity, "set_affinity");
+
+	mgr.RegisterSyscall(24, (SyscallManager::syscallfn) DefaultSyscalls::sys_futex_wait, "futex_wait");
+	mgr.RegisterSyscall(25, (SyscallManager::syscallfn) DefaultSyscalls::sys_futex_wake, "futex_wake");
+
+	mgr.RegisterSyscall(26, (SyscallManager::syscallfn) DefaultSyscalls::sys_truncate, "truncate");
+	mgr.RegisterSyscall(27, (SyscallManager::syscallfn) DefaultSyscalls::sys_getdents, "getdents");
+	mgr.RegisterSyscall(28, (SyscallManager::syscallfn) DefaultSyscalls::sys_readv, "readv");
+	mgr.RegisterSyscall(29, (SyscallManager::syscallfn) DefaultSyscalls::sys_writev, "writev");
+	mgr.RegisterSyscall(30, (SyscallManager::syscallfn) DefaultSyscalls::sys_preadv, "preadv");
+	mgr.RegisterSyscall(31, (SyscallManager::syscallfn) DefaultSyscalls::sys_pwritev, "pwritev");
+	mgr.RegisterSyscall(32, (SyscallManager::syscallfn) DefaultSyscalls::sys_sendfile, "sendfile");
+	mgr.RegisterSyscall(33, (SyscallManager::syscallfn) DefaultSyscalls::sys_spawn, "spawn");
+	mgr.RegisterSyscall(34, (SyscallManager::syscallfn) DefaultSyscalls::sys_wait_procs, "wait_procs");
+	mgr.RegisterSyscall(35, (SyscallManager::syscallfn) DefaultSyscalls::sys_io_ring_setup, "io_ring_setup");
+	mgr.RegisterSyscall(36, (SyscallManager::syscallfn) DefaultSyscalls::sys_io_ring_enter, "io_ring_enter");
+	mgr.RegisterSyscall(37, (SyscallManager::syscallfn) DefaultSyscalls::sys_poll, "poll");
+	mgr.RegisterSyscall(38, (SyscallManager::syscallfn) DefaultSyscalls::sys_profile, "profile");
+	mgr.RegisterSyscall(39, (SyscallManager::syscallfn) DefaultSyscalls::sys_thread_counters, "thread_counters");
+	mgr.RegisterSyscall(40, (SyscallManager::syscallfn) DefaultSyscalls::sys_load_module, "load_module");
+	mgr.RegisterSyscall(41, (SyscallManager::syscallfn) DefaultSyscalls::sys_memory_usage, "memory_usage");
+	mgr.RegisterSyscall(42, (SyscallManager::syscallfn) DefaultSyscalls::sys_socket, "socket");
+	mgr.RegisterSyscall(43, (SyscallManager::syscallfn) DefaultSyscalls::sys_bind, "bind");
+	mgr.RegisterSyscall(44, (SyscallManager::syscallfn) DefaultSyscalls::sys_connect, "connect");
+	mgr.RegisterSyscall(45, (SyscallManager::syscallfn) DefaultSyscalls::sys_listen, "listen");
+	mgr.RegisterSyscall(46, (SyscallManager::syscallfn) DefaultSyscalls::sys_accept, "accept");
+
+	mgr.RegisterSyscall(47, (SyscallManager::syscallfn) DefaultSyscalls::sys_pipe, "pipe");
+	mgr.RegisterSyscall(48, (SyscallManager::syscallfn) DefaultSyscalls::sys_shm_open, "shm_open");
+	mgr.RegisterSyscall(49, (SyscallManager::syscallfn) DefaultSyscalls::sys_shm_map, "shm_map");
+	mgr.RegisterSyscall(50, (SyscallManager::syscallfn) DefaultSyscalls::sys_shm_unlink, "shm_unlink");
+	mgr.RegisterSyscall(51, (SyscallManager::syscallfn) DefaultSyscalls::sys_fsync, "fsync");
+	mgr.RegisterSyscall(52, (SyscallManager::syscallfn) DefaultSyscalls::sys_set_deadline, "set_deadline");
+	mgr.RegisterSyscall(53, (SyscallManager::syscallfn) DefaultSyscalls::sys_set_timer_slack, "set_timer_slack");
 }
 
 void DefaultSyscalls::sys_nop()
@@ -92,11 +203,211 @@ void DefaultSyscalls::sys_yield()
 //	 syslog.messagef(LogLevel::DEBUG, "YIELD");
 }
 
-// TODO: There is no userspace buffer checking done at all.  This really needs to be fixed...
+// User pointers are only ever accessed through the user-access primitives, so a bad
+// pointer makes the system call fail, rather than the kernel fault.
+
+// The longest path (or other string) that a system call accepts, including the NUL.
+#define SYSCALL_MAX_STRING		256
+// File data is moved between files and user buffers this many bytes at a time.
+#define SYSCALL_BOUNCE_SIZE		0x4000
+
+/**
+ * Copies a string argument in from user memory, or returns false if it isn't
+ * accessible, or is too long.
+ */
+static bool string_from_user(String& str, uintptr_t user_str)
+{
+	char *buffer = new char[SYSCALL_MAX_STRING];
+	bool ok = copy_string_from_user(buffer, user_str, SYSCALL_MAX_STRING);
+	if (ok) str = String(buffer);
+
+	delete[] buffer;
+	return ok;
+}
+
+/**
+ * Reads from a file into a user buffer, through a kernel bounce buffer.  A short read
+ * from the file ends the transfer, as it would have done if the file had been given the
+ * user buffer directly.
+ */
+unsigned int DefaultSyscalls::read_to_user(File& f, uintptr_t buffer, size_t size, bool positioned, off_t off)
+{
+	uint8_t *bounce = new uint8_t[size < SYSCALL_BOUNCE_SIZE ? size : SYSCALL_BOUNCE_SIZE];
+	size_t done = 0;
+
+	while (done < size) {
+		size_t chunk = size - done;
+		if (chunk > SYSCALL_BOUNCE_SIZE) chunk = SYSCALL_BOUNCE_SIZE;
+
+		int n = positioned ? f.pread(bounce, chunk, off + done) : f.read(bounce, chunk);
+		if (n < 0) {
+			delete[] bounce;
+			return done ? done : -1;
+		}
+
+		if (n > 0 && !copy_to_user(buffer + done, bounce, n)) {
+			delete[] bounce;
+			return -1;
+		}
+
+		done += n;
+		if ((size_t)n < chunk) break;
+	}
+
+	delete[] bounce;
+	return done;
+}
+
+/**
+ * Writes to a file from a user buffer, through a kernel bounce buffer.
+ */
+unsigned int DefaultSyscalls::write_from_user(File& f, uintptr_t buffer, size_t size, bool positioned, off_t off)
+{
+	uint8_t *bounce = new uint8_t[size < SYSCALL_BOUNCE_SIZE ? size : SYSCALL_BOUNCE_SIZE];
+	size_t done = 0;
+
+	while (done < size) {
+		size_t chunk = size - done;
+		if (chunk > SYSCALL_BOUNCE_SIZE) chunk = SYSCALL_BOUNCE_SIZE;
+
+		if (!copy_from_user(bounce, buffer + done, chunk)) {
+			delete[] bounce;
+			return -1;
+		}
+
+		int n = positioned ? f.pwrite(bounce, chunk, off + done) : f.write(bounce, chunk);
+		if (n < 0) {
+			delete[] bounce;
+			return done ? done : -1;
+		}
+
+		done += n;
+		if ((size_t)n < chunk) break;
+	}
+
+	delete[] bounce;
+	return done;
+}
+
+// The most buffers a vectored transfer may be given.
+#define SYSCALL_MAX_IOVEC		64
+
+/**
+ * One buffer of a vectored transfer, as user code describes it.
+ */
+struct user_iovec
+{
+	uint64_t base;
+	uint64_t size;
+};
+
+/**
+ * Carries out a vectored transfer between a file and a list of user buffers, through a
+ * kernel bounce buffer.  As many of the buffers as fit in the bounce buffer are handed
+ * to the file in one call, so that the file sees the whole round as a single vectored
+ * transfer.  As with the other transfers, a short one ends it.
+ */
+static unsigned int vec_transfer_user(File& f, uintptr_t user_vec, unsigned int nr_vec, bool write, bool positioned, off_t off)
+{
+	if (nr_vec > SYSCALL_MAX_IOVEC) return -1;
+	if (nr_vec == 0) return 0;
+
+	user_iovec *uvec = new user_iovec[nr_vec];
+	if (!copy_from_user(uvec, user_vec, nr_vec * sizeof(*uvec))) {
+		delete[] uvec;
+		return -1;
+	}
+
+	uint8_t *bounce = new uint8_t[SYSCALL_BOUNCE_SIZE];
+	IOVec *kvec = new IOVec[nr_vec];
+	uintptr_t *kvec_user = new uintptr_t[nr_vec];
+
+	size_t done = 0;
+	unsigned int seg = 0;
+	uint64_t seg_off = 0;
+
+	while (seg < nr_vec) {
+		// Fill the bounce buffer with as much of the remaining buffers as fits.
+		unsigned int nr_kvec = 0;
+		size_t round = 0;
+
+		while (seg < nr_vec && round < SYSCALL_BOUNCE_SIZE && nr_kvec < nr_vec) {
+			uint64_t remaining = uvec[seg].size - seg_off;
+			if (!remaining) {
+				seg++;
+				seg_off = 0;
+				continue;
+			}
+
+			size_t take = __min(remaining, SYSCALL_BOUNCE_SIZE - round);
+
+			kvec[nr_kvec].base = bounce + round;
+			kvec[nr_kvec].size = take;
+			kvec_user[nr_kvec] = uvec[seg].base + seg_off;
+			nr_kvec++;
+
+			round += take;
+			seg_off += take;
+		}
+
+		if (!nr_kvec) break;
+
+		int n;
+		if (write) {
+			bool ok = true;
+			for (unsigned int i = 0; i < nr_kvec && ok; i++) {
+				ok = copy_from_user(kvec[i].base, kvec_user[i], kvec[i].size);
+			}
+
+			if (!ok) {
+				n = -1;
+				done = 0;
+			} else {
+				n = positioned ? f.pwritev(kvec, nr_kvec, off + done) : f.writev(kvec, nr_kvec);
+			}
+		} else {
+			n = positioned ? f.preadv(kvec, nr_kvec, off + done) : f.readv(kvec, nr_kvec);
+
+			size_t left = n > 0 ? n : 0;
+			for (unsigned int i = 0; i < nr_kvec && left; i++) {
+				size_t chunk = __min(left, kvec[i].size);
+				if (!copy_to_user(kvec_user[i], kvec[i].base, chunk)) {
+					n = -1;
+					done = 0;
+					break;
+				}
+
+				left -= chunk;
+			}
+		}
+
+		if (n < 0) {
+			delete[] kvec_user;
+			delete[] kvec;
+			delete[] bounce;
+			delete[] uvec;
+			return done ? done : -1;
+		}
+
+		done += n;
+		if ((size_t)n < round) break;
+	}
+
+	delete[] kvec_user;
+	delete[] kvec;
+	delete[] bounce;
+	delete[] uvec;
+	return done;
+}
 
 ObjectHandle DefaultSyscalls::sys_open(uintptr_t filename, uint32_t flags)
 {
-	File *f = sys.vfs().open((const char *) filename, flags);
+	String path;
+	if (!string_from_user(path, filename)) {
+		return KernelObject::Error;
+	}
+
+	File *f = sys.vfs().open(path, flags);
 	if (!f) {
 		return KernelObject::Error;
 	}
@@ -112,6 +423,7 @@ unsigned int DefaultSyscalls::sys_close(ObjectHandle h)
 	}
 
 	f->close();
+	sys.object_manager().release_object(Thread::current(), h);
 	return 0;
 }
 
@@ -122,8 +434,7 @@ unsigned int DefaultSyscalls::sys_read(ObjectHandle h, uintptr_t buffer, size_t
 		return -1;
 	}
 
-	// TODO: Validate 'buffer' etc...
-	return f->read((void *) buffer, size);
+	return read_to_user(*f, buffer, size, false, 0);
 }
 
 unsigned int DefaultSyscalls::sys_write(ObjectHandle h, uintptr_t buffer, size_t size)
@@ -133,8 +444,7 @@ unsigned int DefaultSyscalls::sys_write(ObjectHandle h, uintptr_t buffer, size_t
 		return -1;
 	}
 
-	// TODO: Validate 'buffer' etc...
-	return f->write((const void *) buffer, size);
+	return write_from_user(*f, buffer, size, false, 0);
 }
 
 unsigned int DefaultSyscalls::sys_pread(ObjectHandle h, uintptr_t buffer, size_t size, off_t off)
@@ -144,8 +454,7 @@ unsigned int DefaultSyscalls::sys_pread(ObjectHandle h, uintptr_t buffer, size_t
 		return -1;
 	}
 
-	// TODO: Validate 'buffer' etc...
-	return f->pread((void *) buffer, size, off);
+	return read_to_user(*f, buffer, size, true, off);
 }
 
 unsigned int DefaultSyscalls::sys_pwrite(ObjectHandle h, uintptr_t buffer, size_t size, off_t off)
@@ -155,13 +464,89 @@ unsigned int DefaultSyscalls::sys_pwrite(ObjectHandle h, uintptr_t buffer, size_
 		return -1;
 	}
 
-	// TODO: Validate 'buffer' etc...
-	return f->pwrite((const void *) buffer, size, off);
+	return write_from_user(*f, buffer, size, true, off);
+}
+
+unsigned int DefaultSyscalls::sys_readv(ObjectHandle h, uintptr_t vec, unsigned int count)
+{
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!f) {
+		return -1;
+	}
+
+	return vec_transfer_user(*f, vec, count, false, false, 0);
+}
+
+unsigned int DefaultSyscalls::sys_writev(ObjectHandle h, uintptr_t vec, unsigned int count)
+{
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!f) {
+		return -1;
+	}
+
+	return vec_transfer_user(*f, vec, count, true, false, 0);
+}
+
+unsigned int DefaultSyscalls::sys_preadv(ObjectHandle h, uintptr_t vec, unsigned int count, off_t off)
+{
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!f) {
+		return -1;
+	}
+
+	return vec_transfer_user(*f, vec, count, false, true, off);
+}
+
+unsigned int DefaultSyscalls::sys_pwritev(ObjectHandle h, uintptr_t vec, unsigned int count, off_t off)
+{
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!f) {
+		return -1;
+	}
+
+	return vec_transfer_user(*f, vec, count, true, true, off);
+}
+
+unsigned int DefaultSyscalls::sys_sendfile(ObjectHandle out, ObjectHandle in, off_t off, size_t size)
+{
+	File *out_file = (File *) sys.object_manager().get_object_secure(Thread::current(), out);
+	File *in_file = (File *) sys.object_manager().get_object_secure(Thread::current(), in);
+	if (!out_file || !in_file) {
+		return -1;
+	}
+
+	return in_file->send_to(*out_file, size, off);
+}
+
+unsigned int DefaultSyscalls::sys_truncate(ObjectHandle h, off_t size)
+{
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!f) {
+		return -1;
+	}
+
+	return f->truncate(size);
+}
+
+/**
+ * Waits for everything written to the file to reach the disk.
+ */
+unsigned int DefaultSyscalls::sys_fsync(ObjectHandle h)
+{
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!f) {
+		return -1;
+	}
+
+	return f->sync();
 }
 
 ObjectHandle DefaultSyscalls::sys_opendir(uintptr_t path, uint32_t flags)
 {
-	Directory *d = sys.vfs().opendir((const char *) path, flags);
+	String dir_path;
+	if (!string_from_user(dir_path, path)) return KernelObject::Error;
+
+	Directory *d = sys.vfs().opendir(dir_path, flags);
 	if (!d) return KernelObject::Error;
 
 	return sys.object_manager().register_object(Thread::current(), d);
@@ -175,6 +560,7 @@ unsigned int DefaultSyscalls::sys_closedir(ObjectHandle h)
 	}
 
 	d->close();
+	sys.object_manager().release_object(Thread::current(), h);
 	return 0;
 }
 
@@ -186,7 +572,7 @@ unsigned int DefaultSyscalls::sys_readdir(ObjectHandle h, uintptr_t buffer)
 	}
 
 	DirectoryEntry de;
-	if (d->read_entry(de)) {
+	if (d->next_entry(de)) {
 
 		struct user_de {
 			char name[64];
@@ -194,17 +580,76 @@ unsigned int DefaultSyscalls::sys_readdir(ObjectHandle h, uintptr_t buffer)
 			int flags;
 		};
 
-		user_de *ude = (user_de *) buffer;
-		strncpy(ude->name, de.name.c_str(), 63);
-		ude->flags = 0;
-		ude->size = de.size;
+		user_de ude;
+		bzero(&ude, sizeof(ude));
+		strncpy(ude.name, de.name.c_str(), 63);
+		ude.flags = 0;
+		ude.size = de.size;
 
-		return 1;
+		return copy_to_user(buffer, &ude, sizeof(ude)) ? 1 : 0;
 	} else {
 		return 0;
 	}
 }
 
+/**
+ * Fills a user buffer with as many directory entries as fit, each one a user_dirent with
+ * the NUL-terminated name after it, padded to 8 bytes.  Returns the number of bytes
+ * filled, which is zero at the end of the directory, or -1 if the buffer is inaccessible,
+ * or too small for the next entry.
+ */
+unsigned int DefaultSyscalls::sys_getdents(ObjectHandle h, uintptr_t buffer, size_t size)
+{
+	Directory *d = (Directory *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!d) {
+		return -1;
+	}
+
+	struct user_dirent {
+		uint32_t size;
+		uint16_t reclen;
+		uint16_t name_length;
+	};
+
+	size_t bounce_size = size < SYSCALL_BOUNCE_SIZE ? size : SYSCALL_BOUNCE_SIZE;
+	uint8_t *bounce = new uint8_t[bounce_size];
+	if (!bounce) return -1;
+
+	size_t filled = 0;
+	bool full = false;
+
+	DirectoryEntry de;
+	while (d->next_entry(de)) {
+		size_t name_length = de.name.length();
+		size_t reclen = __align_up(sizeof(user_dirent) + name_length + 1, 8);
+
+		if (filled + reclen > bounce_size) {
+			d->unread_entry(de);
+			full = true;
+			break;
+		}
+
+		user_dirent *ude = (user_dirent *)(bounce + filled);
+		ude->size = de.size;
+		ude->reclen = reclen;
+		ude->name_length = name_length;
+
+		char *name = (char *)(ude + 1);
+		memcpy(name, de.name.c_str(), name_length);
+		bzero(name + name_length, reclen - sizeof(user_dirent) - name_length);
+
+		filled += reclen;
+	}
+
+	bool ok = copy_to_user(buffer, bounce, filled);
+	delete[] bounce;
+
+	// The next entry didn't fit in an empty buffer.
+	if (full && !filled) return -1;
+
+	return ok ? filled : -1;
+}
+
 void DefaultSyscalls::sys_exit(unsigned int rc)
 {
 	Thread::current().owner().terminate(rc);
@@ -212,7 +657,11 @@ void DefaultSyscalls::sys_exit(unsigned int rc)
 
 ObjectHandle DefaultSyscalls::sys_exec(uintptr_t program, uintptr_t args)
 {
-	Process *p = sys.launch_process((const char *) program, (const char *) args);
+	String program_path, program_args;
+	if (!string_from_user(program_path, program)) return KernelObject::Error;
+	if (args && !string_from_user(program_args, args)) return KernelObject::Error;
+
+	Process *p = sys.launch_process(program_path, program_args);
 	if (!p) {
 		return KernelObject::Error;
 	}
@@ -220,6 +669,88 @@ ObjectHandle DefaultSyscalls::sys_exec(uintptr_t program, uintptr_t args)
 	return sys.object_manager().register_object(Thread::current(), p);
 }
 
+// The most handles that a spawned process may be given.
+#define SYSCALL_MAX_SPAWN_HANDLES	64
+
+/**
+ * Launches a program, with its command line and open objects, in one call.  The command
+ * line is given as a block of NUL-terminated arguments, which are joined with spaces into
+ * the one string that programs are started with.  The objects behind the given handles
+ * are shared with the new process, as its handles 1, 2, ... in the order given, before
+ * it starts: so a shell can hand a program its console, say, as its first handles.  The
+ * program is loaded as sys_exec loads it, from the exec template cache if it can be.
+ */
+ObjectHandle DefaultSyscalls::sys_spawn(uintptr_t program, uintptr_t argv, size_t argv_size, uintptr_t handles, unsigned int nr_handles)
+{
+	if (argv_size >= __page_size || nr_handles > SYSCALL_MAX_SPAWN_HANDLES) return KernelObject::Error;
+
+	String program_path;
+	if (!string_from_user(program_path, program)) return KernelObject::Error;
+
+	char *args = new char[argv_size + 1];
+	if (argv_size && !copy_from_user(args, argv, argv_size)) {
+		delete[] args;
+		return KernelObject::Error;
+	}
+
+	// The last argument needn't be terminated; the rest are separated.
+	for (size_t i = 0; i < argv_size; i++) {
+		if (!args[i]) args[i] = ' ';
+	}
+
+	while (argv_size && args[argv_size - 1] == ' ') argv_size--;
+	args[argv_size] = 0;
+
+	String program_args(args);
+	delete[] args;
+
+	// Every handle is checked before anything is loaded.
+	Thread& current = Thread::current();
+
+	ObjectHandle *uhandles = NULL;
+	void **objects = NULL;
+	if (nr_handles) {
+		uhandles = new ObjectHandle[nr_handles];
+		objects = new void *[nr_handles];
+
+		bool ok = copy_from_user(uhandles, handles, nr_handles * sizeof(*uhandles));
+		for (unsigned int i = 0; i < nr_handles && ok; i++) {
+			objects[i] = sys.object_manager().get_object_secure(current, uhandles[i]);
+			ok = objects[i] != NULL;
+		}
+
+		delete[] uhandles;
+
+		if (!ok) {
+			delete[] objects;
+			return KernelObject::Error;
+		}
+	}
+
+	Process *p = sys.load_process(program_path, program_args);
+	if (!p) {
+		if (objects) delete[] objects;
+		return KernelObject::Error;
+	}
+
+	for (unsigned int i = 0; i < nr_handles; i++) {
+		p->handles().add(objects[i]);
+
+		// The child holds its own claim on a pipe end (or shared-memory object), so that
+		// it stays open until both it and the parent have finished with it.
+		if (fs::PipeEnd *end = fs::PipeEnd::from_object(objects[i])) {
+			end->hold();
+		} else if (SharedMemory *shm = SharedMemory::from_object(objects[i])) {
+			shm->hold();
+		}
+	}
+
+	if (objects) delete[] objects;
+
+	p->start();
+	return sys.object_manager().register_object(current, p);
+}
+
 unsigned int DefaultSyscalls::sys_wait_proc(ObjectHandle h)
 {
 	Process *p = (Process *) sys.object_manager().get_object_secure(Thread::current(), h);
@@ -227,13 +758,28 @@ unsigned int DefaultSyscalls::sys_wait_proc(ObjectHandle h)
 		return -1;
 	}
 
-	sys.arch().disable_interrupts();
-	while (!p->terminated()) {
-		sys.arch().enable_interrupts();
-		p->state_changed().wait();
+	Process::wait_any(&p, 1);
+	return 0;
+}
+
+/**
+ * Waits for any one of several processes to terminate, and returns the index of (one of)
+ * the ones that have.
+ */
+unsigned int DefaultSyscalls::sys_wait_procs(uintptr_t handles, unsigned int count)
+{
+	if (count == 0 || count > WakeQueue::MAX_SLEEP_KEYS) return -1;
+
+	ObjectHandle uhandles[WakeQueue::MAX_SLEEP_KEYS];
+	if (!copy_from_user(uhandles, handles, count * sizeof(*uhandles))) return -1;
+
+	Process *processes[WakeQueue::MAX_SLEEP_KEYS];
+	for (unsigned int i = 0; i < count; i++) {
+		processes[i] = (Process *) sys.object_manager().get_object_secure(Thread::current(), uhandles[i]);
+		if (!processes[i]) return -1;
 	}
 
-	return 0;
+	return Process::wait_any(processes, count);
 }
 
 ObjectHandle DefaultSyscalls::sys_create_thread(uintptr_t entry_point, uintptr_t arg, SchedulingEntityPriority::SchedulingEntityPriority priority)
@@ -241,12 +787,15 @@ ObjectHandle DefaultSyscalls::sys_create_thread(uintptr_t entry_point, uintptr_t
 	Thread& t = Thread::current().owner().create_thread(ThreadPrivilege::User, (Thread::thread_proc_t)entry_point, "other", priority);
 	ObjectHandle h = sys.object_manager().register_object(Thread::current(), &t);
 
-	virt_addr_t stack_addr = 0x7fff00000000;
-	stack_addr += 0x2000 * (unsigned int) h;
+	if (!t.allocate_user_stack(0x2000)) {
+		syslog.messagef(LogLevel::ERROR, "Unable to allocate a stack for a new thread");
+		return (ObjectHandle)-1;
+	}
 
-	t.allocate_user_stack(stack_addr, 0x2000);
-	//t.owner().vma().allocate_virt()
 	t.add_entry_argument((void *) arg);
+
+	// A new thread stays on the CPUs its creator was restricted to.
+	sys.scheduler().set_affinity(t, Thread::current().affinity());
 	t.start();
 
 	return h;
@@ -277,10 +826,15 @@ unsigned int DefaultSyscalls::sys_join_thread(ObjectHandle h)
 		return -1;
 	}
 
-	sys.arch().disable_interrupts();
+	// The thread is checked under the lock that its stopping wakes joiners with, so it
+	// can't stop unnoticed between the check and going to sleep.
+	WakeQueue& wq = t->state_changed().wakequeue();
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(wq.lock());
+
 	while (!t->stopped()) {
-		sys.arch().enable_interrupts();
-		t->state_changed().wait();
+		wq.sleep_locked(Thread::current());
 	}
 
 	return 0;
@@ -288,7 +842,14 @@ unsigned int DefaultSyscalls::sys_join_thread(ObjectHandle h)
 
 unsigned long DefaultSyscalls::sys_usleep(unsigned long us)
 {
-	sys.spin_delay(util::Microseconds(us));
+	// A delay shorter than a tick of the timer wheel would be over before the thread had
+	// finished going to sleep, so it is spun instead.
+	if (us * 1000 < (1ull << TimerWheel::TICK_SHIFT)) {
+		sys.spin_delay(util::Microseconds(us));
+		return us;
+	}
+
+	Thread::current().sleep_until(sys.runtime().time_since_epoch().count() + us * 1000);
 	return us;
 }
 
@@ -298,17 +859,17 @@ struct userspace_tod_buffer {
 
 unsigned int DefaultSyscalls::sys_get_tod(uintptr_t tpstruct)
 {
-	auto& tod = sys.time_of_day();
+	auto tod = sys.time_of_day();
 
-	userspace_tod_buffer *userspace_tod = (userspace_tod_buffer *)tpstruct;
-	userspace_tod->day_of_month = tod.day;
-	userspace_tod->hours = tod.hours;
-	userspace_tod->minutes = tod.minutes;
-	userspace_tod->month = tod.month;
-	userspace_tod->seconds = tod.seconds;
-	userspace_tod->year = tod.year;
+	userspace_tod_buffer userspace_tod;
+	userspace_tod.day_of_month = tod.day;
+	userspace_tod.hours = tod.hours;
+	userspace_tod.minutes = tod.minutes;
+	userspace_tod.month = tod.month;
+	userspace_tod.seconds = tod.seconds;
+	userspace_tod.year = tod.year;
 
-	return 0;
+	return copy_to_user(tpstruct, &userspace_tod, sizeof(userspace_tod)) ? 0 : -1;
 }
 
 void DefaultSyscalls::sys_set_thread_name(ObjectHandle h, uintptr_t name)
@@ -320,10 +881,438 @@ void DefaultSyscalls::sys_set_thread_name(ObjectHandle h, uintptr_t name)
 		t = (Thread *) sys.object_manager().get_object_secure(Thread::current(), h);
 	}
 
-	t->name((const char *)name);
+	String thread_name;
+	if (!t || !string_from_user(thread_name, name)) return;
+
+	t->name(thread_name);
+}
+
+/**
+ * Restricts the CPUs a thread may run on, to those whose bits are set in the mask (bit 0
+ * is the boot CPU).  Fails if none of them can run threads.
+ */
+unsigned int DefaultSyscalls::sys_set_affinity(ObjectHandle h, uint64_t mask)
+{
+	Thread *t;
+	if (h == (ObjectHandle) - 1) {
+		t = &Thread::current();
+	} else {
+		t = (Thread *) sys.object_manager().get_object_secure(Thread::current(), h);
+	}
+
+	if (!t || !sys.scheduler().set_affinity(*t, mask)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Puts a thread in the deadline scheduling class (see Scheduler::set_deadline()), or,
+ * with a runtime of zero, takes it out again.  All times are in ns.  Fails if the
+ * parameters are inconsistent, or if the thread's CPU can't take the bandwidth.
+ */
+unsigned int DefaultSyscalls::sys_set_deadline(ObjectHandle h, uint64_t runtime, uint64_t deadline, uint64_t period)
+{
+	Thread *t;
+	if (h == (ObjectHandle) - 1) {
+		t = &Thread::current();
+	} else {
+		t = (Thread *) sys.object_manager().get_object_secure(Thread::current(), h);
+	}
+
+	if (!t || !sys.scheduler().set_deadline(*t, runtime, deadline, period)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Sets how late, in ns, a thread's sleeps may end, so that its wake-ups can share
+ * timer interrupts with others.  Zero makes them end on time.
+ */
+unsigned int DefaultSyscalls::sys_set_timer_slack(ObjectHandle h, uint64_t slack)
+{
+	Thread *t;
+	if (h == (ObjectHandle) - 1) {
+		t = &Thread::current();
+	} else {
+		t = (Thread *) sys.object_manager().get_object_secure(Thread::current(), h);
+	}
+
+	if (!t) {
+		return -1;
+	}
+
+	t->timer_slack(slack);
+	return 0;
 }
 
 unsigned long DefaultSyscalls::sys_get_ticks()
 {
 	return sys.runtime().time_since_epoch().count();
 }
+
+// Flags for sys_map_file.
+#define MAP_FILE_WRITABLE	1
+
+/**
+ * Maps part of a file into the calling process, wherever there is room, and returns
+ * the address it was mapped at (or zero).  The pages are read in from the file when they
+ * are first touched, and are private to the process: writes (if the mapping is writable)
+ * don't go back to the file.
+ */
+uintptr_t DefaultSyscalls::sys_map_file(ObjectHandle h, off_t off, size_t size, uint32_t flags)
+{
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	// Mapped files are demand-paged, and page cookies only reach the first 4 GiB of a file.
+	if (!f || size == 0 || size > 0x100000000ull || off < 0) {
+		return 0;
+	}
+
+	int nr_pages = __align_up_page(size) >> __page_bits;
+
+	// The fault handler looks at the VMA's mappings, so don't let it see them half-done.
+	UniqueIRQLock l;
+
+	virt_addr_t va;
+	if (!Thread::current().owner().vma().map_file_any(nr_pages, *f, off, flags & MAP_FILE_WRITABLE, va)) {
+		return 0;
+	}
+
+	return va;
+}
+
+// Flags for sys_shm_open.
+#define SHM_CREATE			1
+#define SHM_EXCLUSIVE		2
+
+// Flags for sys_shm_map.
+#define SHM_MAP_WRITABLE	1
+
+/**
+ * Opens the shared-memory object with the name, or makes one of 'size' bytes if there
+ * isn't one, and SHM_CREATE is given (failing if there is, and SHM_EXCLUSIVE is given
+ * too).  An empty name makes an anonymous object, which only this process and those it
+ * is handed to by spawn have.
+ */
+ObjectHandle DefaultSyscalls::sys_shm_open(uintptr_t name, size_t size, uint32_t flags)
+{
+	String object_name;
+	if (!string_from_user(object_name, name)) {
+		return KernelObject::Error;
+	}
+
+	SharedMemory *shm = SharedMemory::open(object_name, size, flags & SHM_CREATE, flags & SHM_EXCLUSIVE);
+	if (!shm) {
+		return KernelObject::Error;
+	}
+
+	return sys.object_manager().register_object(Thread::current(), shm);
+}
+
+/**
+ * Maps the whole of a shared-memory object into the calling process, wherever there is
+ * room, and returns the address it was mapped at (or zero).  It is unmapped with unmap,
+ * or when the process goes.
+ */
+uintptr_t DefaultSyscalls::sys_shm_map(ObjectHandle h, uint32_t flags)
+{
+	void *object = sys.object_manager().get_object_secure(Thread::current(), h);
+
+	SharedMemory *shm = object ? SharedMemory::from_object(object) : NULL;
+	if (!shm) {
+		return 0;
+	}
+
+	// The fault handler looks at the VMA's mappings, so don't let it see them half-done.
+	UniqueIRQLock l;
+
+	virt_addr_t va;
+	if (!shm->map(Thread::current().owner().vma(), flags & SHM_MAP_WRITABLE, va)) {
+		return 0;
+	}
+
+	return va;
+}
+
+unsigned int DefaultSyscalls::sys_shm_unlink(uintptr_t name)
+{
+	String object_name;
+	if (!string_from_user(object_name, name)) {
+		return -1;
+	}
+
+	return SharedMemory::unlink(object_name) ? 0 : -1;
+}
+
+unsigned int DefaultSyscalls::sys_unmap(uintptr_t addr, size_t size)
+{
+	if (__page_offset(addr) || size == 0 || addr + size < addr || addr + size > USER_VA_END
+			|| (size >> __page_bits) >= 0x7fffffff) {
+		return -1;
+	}
+
+	UniqueIRQLock l;
+	Thread::current().owner().vma().unmap_range(addr, __align_up_page(size) >> __page_bits);
+
+	return 0;
+}
+
+/**
+ * Sleeps on the futex word at the user address, if it still holds the expected value.
+ * Returns 0 once woken, 1 if the word held something else, or -1 for a bad address.
+ */
+unsigned int DefaultSyscalls::sys_futex_wait(uintptr_t address, uint32_t expected)
+{
+	return futex_wait(Thread::current().owner(), address, expected);
+}
+
+/**
+ * Wakes up to 'max' threads sleeping on the futex word at the user address, and
+ * returns how many were woken.
+ */
+unsigned int DefaultSyscalls::sys_futex_wake(uintptr_t address, unsigned int max)
+{
+	return futex_wake(Thread::current().owner(), address, max);
+}
+
+/**
+ * Creates an I/O ring for the process, and returns a handle to it, having stored the
+ * address it is mapped at in the user variable.
+ */
+ObjectHandle DefaultSyscalls::sys_io_ring_setup(unsigned int entries, uintptr_t address)
+{
+	Thread& current = Thread::current();
+
+	IORing *ring = IORing::create(current.owner(), entries);
+	if (!ring) return KernelObject::Error;
+
+	uint64_t user_address = ring->user_address();
+	if (!copy_to_user(address, &user_address, sizeof(user_address))) {
+		delete ring;
+		return KernelObject::Error;
+	}
+
+	return sys.object_manager().register_object(current, ring);
+}
+
+unsigned int DefaultSyscalls::sys_io_ring_enter(ObjectHandle h, unsigned int count)
+{
+	IORing *ring = (IORing *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!ring) {
+		return -1;
+	}
+
+	return ring->enter(count);
+}
+
+/**
+ * One file to poll, as user code describes it.  'ready' is filled in.
+ */
+struct user_pollfd
+{
+	uint64_t handle;
+	uint32_t events;
+	uint32_t ready;
+};
+
+/**
+ * Finds which of the files are ready for the events asked of them, and returns how many
+ * are, sleeping until at least one is if 'wait' is set.
+ */
+unsigned int DefaultSyscalls::sys_poll(uintptr_t fds, unsigned int count, unsigned int wait)
+{
+	if (count == 0 || count > WakeQueue::MAX_SLEEP_KEYS) return -1;
+
+	user_pollfd ufds[WakeQueue::MAX_SLEEP_KEYS];
+	if (!copy_from_user(ufds, fds, count * sizeof(*ufds))) return -1;
+
+	File *files[WakeQueue::MAX_SLEEP_KEYS];
+	unsigned int events[WakeQueue::MAX_SLEEP_KEYS], ready[WakeQueue::MAX_SLEEP_KEYS];
+	for (unsigned int i = 0; i < count; i++) {
+		files[i] = (File *) sys.object_manager().get_object_secure(Thread::current(), ufds[i].handle);
+		if (!files[i]) return -1;
+
+		events[i] = ufds[i].events;
+	}
+
+	unsigned int nr_ready = File::poll_any(files, events, ready, count, wait != 0);
+
+	for (unsigned int i = 0; i < count; i++) {
+		ufds[i].ready = ready[i];
+	}
+
+	if (!copy_to_user(fds, ufds, count * sizeof(*ufds))) return -1;
+	return nr_ready;
+}
+
+/**
+ * Starts (throwing away the last profile) or stops the sampling profiler, whose samples
+ * are read from /dev/profile0.
+ */
+unsigned int DefaultSyscalls::sys_profile(unsigned int enable)
+{
+	return profile_enable(enable != 0) ? 0 : -1;
+}
+
+/**
+ * Copies the hardware events that a thread (or the current one, given -1) has counted to
+ * 'counts', as PMU_NR_EVENTS 64-bit counts in the order of PMUEvent: cycles, instructions,
+ * last-level cache misses, and branch misses (or the event given with pmu.raw=).  Returns
+ * a mask of which of them were counted, or -1 if the thread or the buffer is bad.
+ */
+unsigned int DefaultSyscalls::sys_thread_counters(ObjectHandle h, uintptr_t counts)
+{
+	Thread *t;
+	if (h == (ObjectHandle) - 1) {
+		t = &Thread::current();
+	} else {
+		t = (Thread *) sys.object_manager().get_object_secure(Thread::current(), h);
+	}
+
+	if (!t) {
+		return -1;
+	}
+
+	uint64_t values[PMU_NR_EVENTS];
+	unsigned int counted = infos::arch::x86::pmu_read(*t, values);
+
+	if (!copy_to_user(counts, values, sizeof(values))) return -1;
+	return counted;
+}
+
+/**
+ * Loads a kernel module from a file, linking it into the kernel and registering the
+ * devices, filesystems and so on that it has.  Returns 0, or -1 if it couldn't be loaded.
+ */
+unsigned int DefaultSyscalls::sys_load_module(uintptr_t path)
+{
+	String p;
+	if (!string_from_user(p, path)) {
+		return -1;
+	}
+
+	return sys.module_manager().LoadModuleFile(p) ? 0 : -1;
+}
+
+/**
+ * Copies how much memory a process (or the current one, given -1) is using to 'usage', as
+ * five 64-bit counts: its private frames, the frames shared into it, its page-table
+ * frames, the frames it has that aren't mapped (e.g. kernel stacks), and the bytes of
+ * kernel objects charged to it.  Returns 0, or -1 if the process or the buffer is bad.
+ */
+unsigned int DefaultSyscalls::sys_memory_usage(ObjectHandle h, uintptr_t usage)
+{
+	Process *p;
+	if (h == (ObjectHandle) - 1) {
+		p = &Thread::current().owner();
+	} else {
+		p = (Process *) sys.object_manager().get_object_secure(Thread::current(), h);
+	}
+
+	if (!p) {
+		return -1;
+	}
+
+	MemoryUsage u;
+	p->memory_usage(u);
+
+	return copy_to_user(usage, &u, sizeof(u)) ? 0 : -1;
+}
+
+ObjectHandle DefaultSyscalls::sys_socket(unsigned int type)
+{
+	Socket *s = Socket::create(type);
+	if (!s) {
+		return KernelObject::Error;
+	}
+
+	return sys.object_manager().register_object(Thread::current(), s);
+}
+
+/* The socket a handle is for, or NULL if it isn't one. */
+static Socket *socket_from_handle(ObjectHandle h)
+{
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	return f ? f->as_socket() : NULL;
+}
+
+unsigned int DefaultSyscalls::sys_bind(ObjectHandle h, uintptr_t address)
+{
+	Socket *s = socket_from_handle(h);
+	SocketAddress local;
+
+	if (!s || !copy_from_user(&local, address, sizeof(local))) {
+		return -1;
+	}
+
+	return s->bind(local) ? 0 : -1;
+}
+
+unsigned int DefaultSyscalls::sys_connect(ObjectHandle h, uintptr_t address)
+{
+	Socket *s = socket_from_handle(h);
+	SocketAddress remote;
+
+	if (!s || !copy_from_user(&remote, address, sizeof(remote))) {
+		return -1;
+	}
+
+	return s->connect(remote) ? 0 : -1;
+}
+
+unsigned int DefaultSyscalls::sys_listen(ObjectHandle h, unsigned int backlog)
+{
+	Socket *s = socket_from_handle(h);
+	if (!s) {
+		return -1;
+	}
+
+	return s->listen(backlog) ? 0 : -1;
+}
+
+ObjectHandle DefaultSyscalls::sys_accept(ObjectHandle h)
+{
+	Socket *s = socket_from_handle(h);
+	if (!s) {
+		return KernelObject::Error;
+	}
+
+	Socket *connection = s->accept();
+	if (!connection) {
+		return KernelObject::Error;
+	}
+
+	return sys.object_manager().register_object(Thread::current(), connection);
+}
+
+/**
+ * Makes a pipe, and returns the handles of its ends: the end to read from, then the end
+ * to write to.  An end can be handed to a child by spawn, which is how a pipeline is put
+ * together.
+ */
+unsigned int DefaultSyscalls::sys_pipe(uintptr_t handles)
+{
+	PipeEnd *reader, *writer;
+	if (!Pipe::create(reader, writer)) {
+		return -1;
+	}
+
+	Thread& current = Thread::current();
+
+	ObjectHandle ends[2];
+	ends[0] = sys.object_manager().register_object(current, reader);
+	ends[1] = sys.object_manager().register_object(current, writer);
+
+	if (!copy_to_user(handles, ends, sizeof(ends))) {
+		sys.object_manager().release_object(current, ends[0]);
+		sys.object_manager().release_object(current, ends[1]);
+		reader->close();
+		writer->close();
+		return -1;
+	}
+
+	return 0;
+}
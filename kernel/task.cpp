@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/task.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/task.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/drivers/block/block-device.h>
+#include <infos/drivers/block/block-request.h>
+#include <infos/mm/slab.h>
+#include <infos/fs/stats.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers::block;
+using namespace infos::mm;
+using namespace infos::util;
+
+// The executor's workers.  They are kept apart from the system workqueue's, so that
+// deferred work and tasks don't hold each other up.
+static WorkQueue task_wq("ktask", SchedulingEntityPriority::NORMAL);
+
+// Task frames are allocated by size from these, and anything bigger from the heap.
+// The slabs are single frames, so the largest cache is a quarter of one.
+#define TASK_FRAME_CACHES	4
+
+static SlabCache frame_caches[TASK_FRAME_CACHES] = {
+	SlabCache("task-frame-128", 128),
+	SlabCache("task-frame-256", 256),
+	SlabCache("task-frame-512", 512),
+	SlabCache("task-frame-1024", 1024),
+};
+
+static uint64_t nr_spawned, nr_resumed, nr_frame_failures;
+
+void *TaskPromiseBase::operator new(size_t size) noexcept
+{
+	for (unsigned int i = 0; i < TASK_FRAME_CACHES; i++) {
+		if (size <= frame_caches[i].object_size()) {
+			void *frame = frame_caches[i].alloc();
+			if (!frame) __atomic_add_fetch(&nr_frame_failures, 1, __ATOMIC_RELAXED);
+
+			return frame;
+		}
+	}
+
+	void *frame = ::operator new(size);
+	if (!frame) __atomic_add_fetch(&nr_frame_failures, 1, __ATOMIC_RELAXED);
+
+	return frame;
+}
+
+void TaskPromiseBase::operator delete(void *frame, size_t size)
+{
+	// The heap's delete finds the slab cache an object came from by itself.
+	::operator delete(frame);
+}
+
+void TaskPromiseBase::resume_fn(void *arg)
+{
+	__atomic_add_fetch(&nr_resumed, 1, __ATOMIC_RELAXED);
+	((TaskPromiseBase *)arg)->_handle.resume();
+}
+
+void TaskPromiseBase::schedule()
+{
+	task_wq.queue(_resume_item);
+}
+
+bool infos::kernel::spawn_task(TaskPromiseBase& promise)
+{
+	__atomic_add_fetch(&nr_spawned, 1, __ATOMIC_RELAXED);
+
+	promise._detached = true;
+	promise.schedule();
+
+	return true;
+}
+
+bool infos::kernel::start_task_executor()
+{
+	return task_wq.start();
+}
+
+bool TaskSleep::await_ready() const
+{
+	return (uint64_t)sys.runtime().time_since_epoch().count() >= _deadline;
+}
+
+void TaskSleep::arm()
+{
+	UniqueIRQLock irq;
+	CPU::current().timers().add(_timer, _deadline);
+}
+
+void TaskSleep::expired(Timer& timer, void *arg)
+{
+	((TaskSleep *)arg)->_promise->schedule();
+}
+
+TaskSleep infos::kernel::sleep_for(uint64_t ns)
+{
+	return TaskSleep(sys.runtime().time_since_epoch().count() + ns);
+}
+
+void TaskBlockRequest::submit()
+{
+	_request.completion = completed;
+	_request.priv = this;
+
+	// The request may complete, and the task carry on, before submit() returns.
+	_device.submit(_request);
+}
+
+void TaskBlockRequest::completed(BlockRequest& request, bool success)
+{
+	TaskBlockRequest *self = (TaskBlockRequest *)request.priv;
+
+	self->_success = success;
+	self->_promise->schedule();
+}
+
+RegisterStatistics(tasks, "tasks")
+{
+	out.append("spawned %llu\n", __atomic_load_n(&nr_spawned, __ATOMIC_RELAXED));
+	out.append("resumed %llu\n", __atomic_load_n(&nr_resumed, __ATOMIC_RELAXED));
+	out.append("frame-failures %llu\n", __atomic_load_n(&nr_frame_failures, __ATOMIC_RELAXED));
+
+	for (unsigned int i = 0; i < TASK_FRAME_CACHES; i++) {
+		out.append("%s %llu\n", frame_caches[i].name(), frame_caches[i].nr_in_use());
+	}
+}
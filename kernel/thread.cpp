@@ -11,48 +11,138 @@
 #include <infos/kernel/thread.h>
 #include <infos/kernel/process.h>
 #include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/sched.h>
 #include <infos/mm/mm.h>
 #include <infos/mm/page-allocator.h>
 #include <infos/kernel/log.h>
 #include <infos/util/string.h>
+#include <infos/util/lock.h>
+#include <infos/util/cmdline.h>
 #include <arch/arch.h>
 
 using namespace infos::kernel;
 using namespace infos::util;
 
-#define KERNEL_STACK_ORDER		1
-#define KERNEL_STACK_SIZE		((1 << KERNEL_STACK_ORDER) * __page_size)
+// Kernel threads' stacks come from a pool, which is refilled with this many pages' worth
+// of stacks at a time.
+#define KERNEL_STACK_POOL_REFILL_ORDER	3
+
+// A CPU switching away from a thread that has stopped is still on the thread's kernel
+// stack until it has returned from the trap, so the stack is only reused once the thread
+// has been seen off every CPU for this long.
+#define STACK_REUSE_DELAY_NS	1000000ull
+
+DEFINE_SLAB_ALLOCATED(Thread);
+
+// How late, in ns, a new thread's sleeps may end.
+static uint64_t default_timer_slack = 50000;
+
+RegisterCmdLineArgument(TimerSlack, "timer.slack")
+{
+	uint64_t slack = 0;
+	for (const char *c = value; *c >= '0' && *c <= '9'; c++) {
+		slack = slack * 10 + (*c - '0');
+	}
+
+	default_timer_slack = slack;
+}
+
+// Whether user stacks are only given frames as they grow into them.  Until that has been
+// run on a booted system, it is off unless asked for (mm.lazy-stacks=1).
+static bool lazy_stacks;
+
+RegisterCmdLineArgument(LazyStacks, "mm.lazy-stacks")
+{
+	lazy_stacks = strncmp(value, "1", 2) == 0;
+}
+
+/*
+ * The free kernel stacks, linked through their first word.  A user thread's kernel stack
+ * belongs to its process's VMA, and goes when the process does.  Kernel threads all share
+ * one process, which never goes away, so their stacks are recycled through here instead.
+ */
+static uintptr_t *kernel_stack_pool;
+static SpinLock kernel_stack_pool_lock;
+
+static void free_pooled_stack(uintptr_t base)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(kernel_stack_pool_lock);
+
+	*(uintptr_t **)base = kernel_stack_pool;
+	kernel_stack_pool = (uintptr_t *)base;
+}
+
+static uintptr_t allocate_pooled_stack()
+{
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(kernel_stack_pool_lock);
+
+		uintptr_t *stack = kernel_stack_pool;
+		if (stack) {
+			kernel_stack_pool = (uintptr_t *)*stack;
+			return (uintptr_t)stack;
+		}
+	}
+
+	// The page allocator may sleep, so the pool is refilled without the lock held.
+	auto pfdescr = sys.mm().pgalloc().allocate(KERNEL_STACK_POOL_REFILL_ORDER);
+	if (!pfdescr) return 0;
+
+	uintptr_t base = (uintptr_t)sys.mm().pgalloc().pfdescr_to_vpa(pfdescr);
+	for (unsigned int i = 1; i < (1u << (KERNEL_STACK_POOL_REFILL_ORDER - KERNEL_STACK_ORDER)); i++) {
+		free_pooled_stack(base + i * KERNEL_STACK_SIZE);
+	}
+
+	return base;
+}
 
 /**
  * Constructs a new thread object.
  */
 Thread::Thread(Process& owner, ThreadPrivilege::ThreadPrivilege privilege, thread_proc_t entry_point,
-               SchedulingEntityPriority::SchedulingEntityPriority priority, const util::String& name)
+               SchedulingEntityPriority::SchedulingEntityPriority priority, const util::String& name,
+               const ThreadStacks *stacks)
 	: SchedulingEntity(priority, name),
 	    _owner(owner),
 		_privilege(privilege),
 		_entry_point(entry_point),
 		_current_entry_argument(0),
-		_name(name)
+		_stacks_released(false),
+		_off_cpu_since(0),
+		_timer_slack(default_timer_slack),
+		_name(name),
+		_sleep_timer(sleep_timer_expired, this)
 {
 	// Clear out the thread context.
 	bzero(&_context, sizeof(_context));
+	bzero(&_stacks, sizeof(_stacks));
 
 	// Allocate the kernel stack for this thread.
-	auto kernel_stack_pfdescr = owner.vma().allocate_phys(KERNEL_STACK_ORDER);
-	assert(kernel_stack_pfdescr);
+	if (stacks) {
+		assert(!owner.kernel_process());
 
-	// Record the base address of the kernel stack.  Stacks grow down, so add on the size of the stack
-	// to the base address to create the starting address.
-	_context.kernel_stack = (uintptr_t)sys.mm().pgalloc().pfdescr_to_vpa(kernel_stack_pfdescr);
-	_context.kernel_stack += KERNEL_STACK_SIZE;
+		_stacks = *stacks;
+		_context.kernel_stack = stacks->kernel_stack;
+	} else if (owner.kernel_process()) {
+		_context.kernel_stack = allocate_pooled_stack();
+		assert(_context.kernel_stack);
+	} else {
+		auto kernel_stack_pfdescr = owner.vma().allocate_phys(KERNEL_STACK_ORDER);
+		assert(kernel_stack_pfdescr);
 
-	// TODO: Check for XSAVE
-	/*auto xsave_area_pfdescr = owner.vma().allocate_phys(0);
-	assert(xsave_area_pfdescr);
-	_context.xsave_area = (uintptr_t)sys.mm().pgalloc().pfdescr_to_vpa(xsave_area_pfdescr);
+		_context.kernel_stack = (uintptr_t)sys.mm().pgalloc().pfdescr_to_vpa(kernel_stack_pfdescr);
+		_stacks.kernel_stack = _context.kernel_stack;
+	}
+
+	// Record the starting address of the kernel stack.  Stacks grow down, so add on the size of
+	// the stack to the base address.
+	_context.kernel_stack += KERNEL_STACK_SIZE;
 
-	bzero((void *)_context.xsave_area, 0x1000);*/
+	// The FPU state area is allocated by the architecture, the first time the thread
+	// uses the FPU.
 
 	// Prepare the initial stack for this thread.  Threads ALWAYS start in kernel mode, irrespective of whether or
 	// not they are user threads.  This stack will set-up the thread context.
@@ -64,7 +154,14 @@ Thread::Thread(Process& owner, ThreadPrivilege::ThreadPrivilege privilege, threa
  */
 Thread::~Thread()
 {
-	// The VMA will release allocated memory (hopefully)
+	_sleep_timer.cancel();
+
+	// The VMA will release allocated memory (hopefully), apart from a pooled kernel stack.
+	sys.arch().release_thread_state(*this);
+
+	if (_owner.kernel_process()) {
+		free_pooled_stack(_context.kernel_stack - KERNEL_STACK_SIZE);
+	}
 }
 
 void Thread::add_entry_argument(void* arg)
@@ -104,6 +201,9 @@ void Thread::start()
  */
 void Thread::stop()
 {
+	// The thread won't be needing its timer, and mustn't be woken by it.
+	_sleep_timer.cancel();
+
 	// Set the state of this thread to be stopped.
 	sys.scheduler().set_entity_state(*this, SchedulingEntityState::STOPPED);
 
@@ -128,6 +228,44 @@ void Thread::wake_up()
 	sys.scheduler().set_entity_state(*this, SchedulingEntityState::RUNNABLE);
 }
 
+void Thread::sleep_until(uint64_t deadline)
+{
+	assert(&Thread::current() == this);
+
+	UniqueIRQLock irq;
+
+	if (sys.runtime().time_since_epoch().count() >= deadline) return;
+
+	// The timer goes on this CPU's wheel, and stays there even if the thread is moved to
+	// another CPU, as it is woken from wherever it is.  It can't expire without the
+	// wheel's lock, so the thread can't miss it between checking and sleeping.
+	uint64_t slack = _timer_slack;
+	if (priority() == SchedulingEntityPriority::REALTIME || deadline_class()) slack = 0;
+
+	TimerWheel& wheel = CPU::current().timers();
+	wheel.add(_sleep_timer, deadline, slack);
+
+	wheel.lock().lock();
+	while (_sleep_timer.pending()) {
+		sys.scheduler().set_entity_state(*this, SchedulingEntityState::SLEEPING);
+
+		wheel.lock().unlock();
+		sys.arch().invoke_kernel_syscall(1);
+		wheel.lock().lock();
+	}
+	wheel.lock().unlock();
+}
+
+void Thread::sleep_timer_expired(Timer& timer, void *arg)
+{
+	Thread *thread = (Thread *)arg;
+
+	// Waking a stopped thread would start it running again.
+	if (thread->state() != SchedulingEntityState::STOPPED) {
+		thread->wake_up();
+	}
+}
+
 /**
  * Activates the thread by making it the one that is currently being run.
  */
@@ -150,10 +288,66 @@ void Thread::allocate_user_stack(virt_addr_t vaddr, size_t size)
 {
 	int nr_pages = __align_up_page(size) >> 12;
 
-	_owner.vma().allocate_virt(vaddr, nr_pages);
+	// With lazy stacks, pages are only given frames as the stack grows into them.
+	if (!lazy_stacks || !_owner.vma().map_zero_fill(vaddr, nr_pages, true)) {
+		_owner.vma().allocate_virt(vaddr, nr_pages);
+	}
+
+	_stacks.user_stack = vaddr;
+	_stacks.user_stack_size = size;
 	_context.native_context->rsp = vaddr + size - 8;
 }
 
+bool Thread::allocate_user_stack(size_t size)
+{
+	int nr_pages = __align_up_page(size) >> 12;
+
+	// A stack left by a stopped thread is used as it is, if it is the right size.
+	if (_stacks.user_stack && _stacks.user_stack_size != size) {
+		_owner.vma().unmap_range(_stacks.user_stack, __align_up_page(_stacks.user_stack_size) >> 12);
+		_stacks.user_stack = 0;
+	}
+
+	if (!_stacks.user_stack) {
+		virt_addr_t vaddr;
+		if (lazy_stacks) {
+			if (!_owner.vma().map_zero_fill_any(nr_pages, true, vaddr)) return false;
+		} else {
+			if (!_owner.vma().allocate_virt_any(nr_pages, vaddr)) return false;
+		}
+
+		_stacks.user_stack = vaddr;
+		_stacks.user_stack_size = size;
+	}
+
+	_context.native_context->rsp = _stacks.user_stack + size - 8;
+	return true;
+}
+
+bool Thread::release_stacks(ThreadStacks& stacks)
+{
+	if (_stacks_released || is_kernel_thread() || !stopped()) return false;
+
+	for (unsigned int i = 0; i < sys.scheduler().nr_runqueues(); i++) {
+		if (sys.scheduler().runqueue(i).current_entity() == this) {
+			_off_cpu_since = 0;
+			return false;
+		}
+	}
+
+	uint64_t now = sys.runtime().time_since_epoch().count();
+	if (!_off_cpu_since) {
+		_off_cpu_since = now;
+		return false;
+	}
+
+	if (now - _off_cpu_since < STACK_REUSE_DELAY_NS) return false;
+
+	stacks = _stacks;
+	_stacks_released = true;
+	return true;
+}
+
 Thread& Thread::current()
 {
 	return sys.arch().get_current_thread();
@@ -164,10 +358,10 @@ void Thread::prepare_initial_stack()
 	uint64_t *stack = (uint64_t *)context().kernel_stack;
 
 	// System Context
-	*--stack = is_kernel_thread() ? 0x10 : 0x23;	// SS
+	*--stack = is_kernel_thread() ? 0x10 : 0x1b;	// SS
 	*--stack = 0;									// RSP
 	*--stack = 0x202;								// RFLAGS
-	*--stack = is_kernel_thread() ? 0x8 : 0x1b;		// CS
+	*--stack = is_kernel_thread() ? 0x8 : 0x23;		// CS
 	*--stack = (uint64_t)_entry_point;				// RIP
 	*--stack = 0;									// EXTRA
 
@@ -187,6 +381,7 @@ void Thread::prepare_initial_stack()
 	*--stack = 0;	// R13
 	*--stack = 0;	// R14
 	*--stack = 0;	// R15
+	*--stack = 0;	// Preemption Count
 	*--stack = 0;	// Previous Context
 
 	_context.native_context = (X86Context *)((uintptr_t)stack);
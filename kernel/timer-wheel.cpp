@@ -0,0 +1,250 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/timer-wheel.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/timer-wheel.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/fs/stats.h>
+#include <infos/util/lock.h>
+#include <arch/arch.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+
+bool Timer::cancel()
+{
+	UniqueIRQLock irq;
+
+	// The timer can only be moved between wheels by whoever adds it, so if it is on one,
+	// it is still on the same one once its lock is held, unless it has expired.
+	TimerWheel *wheel = _wheel;
+	if (!wheel) return false;
+
+	UniqueLock<SpinLock> l(wheel->lock());
+	if (_wheel != wheel) return false;
+
+	wheel->remove(*this);
+	return true;
+}
+
+TimerWheel::TimerWheel() : _now_tick(0), _nr_timers(0), _armed(NO_DEADLINE), _nr_runs(0), _nr_expired(0)
+{
+	bzero(_levels, sizeof(_levels));
+}
+
+/**
+ * Puts a timer in the slot that comes round in time for its expiry, in the lowest level
+ * that reaches that far.
+ */
+void TimerWheel::insert(Timer& timer)
+{
+	uint64_t expires_tick = (timer._expires + (1ull << TICK_SHIFT) - 1) >> TICK_SHIFT;
+	if (expires_tick < _now_tick) expires_tick = _now_tick;
+
+	// A timer beyond the top level goes as far out as it can, and is put back there each
+	// time it comes round, until it is in reach.
+	uint64_t delta = expires_tick - _now_tick;
+	unsigned int level = 0;
+	while (level < NR_LEVELS - 1 && delta >= (1ull << ((level + 1) * LEVEL_BITS))) level++;
+
+	if (delta >= (1ull << (NR_LEVELS * LEVEL_BITS))) {
+		expires_tick = _now_tick + (1ull << (NR_LEVELS * LEVEL_BITS)) - 1;
+	}
+
+	unsigned int slot = (expires_tick >> (level * LEVEL_BITS)) & (LEVEL_SIZE - 1);
+	Level& l = _levels[level];
+
+	timer._level = level;
+	timer._slot = slot;
+	timer._prev = NULL;
+	timer._next = l.slots[slot];
+	if (timer._next) timer._next->_prev = &timer;
+
+	l.slots[slot] = &timer;
+	l.occupied |= 1ull << slot;
+}
+
+void TimerWheel::remove(Timer& timer)
+{
+	if (timer._prev) {
+		timer._prev->_next = timer._next;
+	} else {
+		Level& l = _levels[timer._level];
+
+		l.slots[timer._slot] = timer._next;
+		if (!timer._next) l.occupied &= ~(1ull << timer._slot);
+	}
+
+	if (timer._next) timer._next->_prev = timer._prev;
+
+	timer._prev = timer._next = NULL;
+	timer._wheel = NULL;
+	_nr_timers--;
+}
+
+/**
+ * Moves an expiry as late into its slack window as the coarsest boundary in it: the
+ * last multiple, in the window, of the largest power of two that has one there.  Two
+ * windows that overlap usually have the same such boundary, so their timers expire on
+ * the same tick.
+ */
+static uint64_t apply_slack(uint64_t expires, uint64_t slack)
+{
+	uint64_t limit = expires + slack;
+	if (!slack || limit < expires) return expires;
+
+	// The highest bit in which the ends of the window differ is the coarsest
+	// boundary's, and the limit has it set, so rounding the limit down to it stays in
+	// the window.
+	unsigned int bit = 63 - __builtin_clzll(expires ^ limit);
+	return limit & ~((1ull << bit) - 1);
+}
+
+void TimerWheel::add(Timer& timer, uint64_t expires, uint64_t slack)
+{
+	if (timer._wheel) timer.cancel();
+
+	expires = apply_slack(expires, slack);
+
+	UniqueLock<SpinLock> l(_lock);
+
+	timer._expires = expires;
+	timer._wheel = this;
+	_nr_timers++;
+	insert(timer);
+
+	// Something that expires before the CPU's timer next goes off needs it to go off
+	// sooner.  Otherwise, the next scheduling event arms it in time (see program()).
+	uint64_t deadline = __align_up(expires, 1ull << TICK_SHIFT);
+	if (deadline < _armed) {
+		uint64_t now = sys.runtime().time_since_epoch().count();
+
+		_armed = deadline;
+		sys.arch().set_next_timer_interrupt(Nanoseconds(deadline > now ? deadline - now : 0));
+	}
+}
+
+/**
+ * Moves the timers in a slot down to the levels below, now that the slot has come round.
+ */
+void TimerWheel::cascade(unsigned int level, unsigned int slot)
+{
+	Level& l = _levels[level];
+
+	Timer *timer = l.slots[slot];
+	l.slots[slot] = NULL;
+	l.occupied &= ~(1ull << slot);
+
+	while (timer) {
+		Timer *next = timer->_next;
+		insert(*timer);
+		timer = next;
+	}
+}
+
+/**
+ * Returns the first tick at which there is anything to do: a slot of the lowest level
+ * that has timers to expire, or a slot of a higher level that has timers to move down.
+ */
+uint64_t TimerWheel::next_event_tick() const
+{
+	if (!_nr_timers) return NO_DEADLINE;
+
+	uint64_t next = NO_DEADLINE;
+	for (unsigned int level = 0; level < NR_LEVELS; level++) {
+		uint64_t occupied = _levels[level].occupied;
+		if (!occupied) continue;
+
+		// A slot of this level comes round each time the ticks reach a multiple of its
+		// span, so the slots are checked in the order they come round from now.
+		uint64_t span = 1ull << (level * LEVEL_BITS);
+		uint64_t boundary = __align_up(_now_tick, span);
+		unsigned int first = (boundary >> (level * LEVEL_BITS)) & (LEVEL_SIZE - 1);
+
+		uint64_t rotated = first ? (occupied >> first) | (occupied << (LEVEL_SIZE - first)) : occupied;
+		uint64_t tick = boundary + (uint64_t)__builtin_ctzll(rotated) * span;
+
+		if (tick < next) next = tick;
+	}
+
+	return next;
+}
+
+uint64_t TimerWheel::next_expiry() const
+{
+	uint64_t tick = next_event_tick();
+	return tick == NO_DEADLINE ? NO_DEADLINE : tick << TICK_SHIFT;
+}
+
+void TimerWheel::run(uint64_t now)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	uint64_t target = now >> TICK_SHIFT;
+	_armed = NO_DEADLINE;
+	_nr_runs++;
+
+	while (_now_tick <= target) {
+		// Ticks with nothing to do are skipped, so an idle stretch costs nothing, however
+		// long it was.
+		uint64_t tick = next_event_tick();
+		if (tick > target) {
+			_now_tick = target + 1;
+			break;
+		}
+
+		_now_tick = tick;
+
+		// Each time a level's slots have all come round, the next slot up is moved down.
+		unsigned int index = tick & (LEVEL_SIZE - 1);
+		for (unsigned int level = 1; index == 0 && level < NR_LEVELS; level++) {
+			index = (tick >> (level * LEVEL_BITS)) & (LEVEL_SIZE - 1);
+			cascade(level, index);
+		}
+
+		Level& l0 = _levels[0];
+		unsigned int slot = tick & (LEVEL_SIZE - 1);
+
+		while (l0.slots[slot]) {
+			Timer& timer = *l0.slots[slot];
+			remove(timer);
+			_nr_expired++;
+
+			timer._fn(timer, timer._arg);
+		}
+
+		_now_tick = tick + 1;
+	}
+}
+
+void TimerWheel::program(uint64_t now, uint64_t deadline)
+{
+	UniqueLock<SpinLock> l(_lock);
+
+	uint64_t next = next_expiry();
+	if (next < deadline) deadline = next;
+
+	_armed = deadline;
+	if (deadline == NO_DEADLINE) {
+		sys.arch().stop_timer_interrupt();
+	} else {
+		sys.arch().set_next_timer_interrupt(Nanoseconds(deadline > now ? deadline - now : 0));
+	}
+}
+
+RegisterStatistics(timers, "timers")
+{
+	out.append("cpu runs expired\n");
+	for (unsigned int i = 0; i < sys.arch().nr_cpus(); i++) {
+		CPU& cpu = sys.arch().get_cpu(i);
+		out.append("%u %llu %llu\n", i, cpu.timers().nr_runs(), cpu.timers().nr_expired());
+	}
+}
@@ -0,0 +1,295 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/trace.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/trace.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/log.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/file.h>
+#include <infos/io/stream.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/util/lock.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::fs;
+using namespace infos::io;
+using namespace infos::util;
+
+// The number of records in each CPU's ring.
+#define TRACE_RING_SIZE		2048
+
+#define TRACE_VERSION		1
+
+uint32_t infos::kernel::trace_event_mask;
+
+RegisterCmdLineArgument(TraceEvents, "trace") {
+	static const char *names[] = { "sched", "syscall", "fault", "irq", "block" };
+	static const uint32_t masks[] = {
+		1u << TraceEvent::SCHED_SWITCH,
+		(1u << TraceEvent::SYSCALL_ENTER) | (1u << TraceEvent::SYSCALL_EXIT),
+		1u << TraceEvent::PAGE_FAULT,
+		1u << TraceEvent::IRQ,
+		(1u << TraceEvent::BLOCK_QUEUE) | (1u << TraceEvent::BLOCK_COMPLETE),
+	};
+
+	for (const char *name = value; *name;) {
+		size_t length = 0;
+		while (name[length] && name[length] != ',') length++;
+
+		if (length == 3 && strncmp(name, "all", 3) == 0) {
+			trace_event_mask = (1u << TraceEvent::NR_EVENTS) - 1;
+		} else {
+			for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+				if (strlen(names[i]) == length && strncmp(name, names[i], length) == 0) {
+					trace_event_mask |= masks[i];
+				}
+			}
+		}
+
+		name += length;
+		if (*name) name++;
+	}
+}
+
+/* The trace of one CPU.  Only the CPU writes to it, with interrupts disabled, and 'head'
+ * moves on once a record has been written. */
+struct TraceRing
+{
+	TraceRecord *records;
+	volatile uint64_t head;
+	uint64_t dropped;
+};
+
+static TraceRing rings[SCHED_MAX_RUNQUEUES];
+static unsigned int nr_rings;
+
+// Non-zero while the trace is being dumped, so that what is being read stays put.
+static volatile unsigned int paused;
+
+static Stream *dump_stream;
+
+bool infos::kernel::trace_init()
+{
+	if (!trace_event_mask) return true;
+
+	// Called again as the other CPUs come up, for their rings.
+	unsigned int first = nr_rings, nr = sys.scheduler().nr_runqueues();
+	for (unsigned int i = first; i < nr; i++) {
+		rings[i].records = new TraceRecord[TRACE_RING_SIZE];
+		if (!rings[i].records) return false;
+
+		__atomic_store_n(&nr_rings, i + 1, __ATOMIC_RELEASE);
+	}
+
+	if (!first) syslog.messagef(LogLevel::INFO, "Tracing events %x, %u records per cpu", trace_event_mask, TRACE_RING_SIZE);
+
+	return true;
+}
+
+void infos::kernel::trace_record(TraceEvent::TraceEvent event, uint64_t arg0, uint64_t arg1, uint64_t arg2)
+{
+	UniqueIRQLock irq;
+
+	RunQueue *rq = CPU::current().runqueue();
+	if (!rq || rq->index() >= __atomic_load_n(&nr_rings, __ATOMIC_ACQUIRE)) return;
+
+	TraceRing& ring = rings[rq->index()];
+	if (paused) {
+		ring.dropped++;
+		return;
+	}
+
+	uint64_t head = ring.head;
+	TraceRecord& r = ring.records[head % TRACE_RING_SIZE];
+
+	r.timestamp = sys.runtime().time_since_epoch().count();
+	r.event = event;
+	r.cpu = rq->index();
+	r.reserved = 0;
+	r.args[0] = arg0;
+	r.args[1] = arg1;
+	r.args[2] = arg2;
+
+	__atomic_store_n(&ring.head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * A paused view of the trace.  A CPU may have been part way through a record when the
+ * trace was paused, which goes in the slot after its newest, so the oldest record of a
+ * full ring is left out, in case that was its slot.
+ */
+class TraceSnapshot
+{
+public:
+	TraceSnapshot() : _nr_records(0)
+	{
+		__atomic_fetch_add(&paused, 1, __ATOMIC_SEQ_CST);
+
+		TraceDumpHeader& h = _header;
+		memcpy(h.magic, "INFOSTRC", 8);
+		h.version = TRACE_VERSION;
+		h.record_size = sizeof(TraceRecord);
+		h.nr_cpus = __atomic_load_n(&nr_rings, __ATOMIC_ACQUIRE);
+		h.nr_dropped = 0;
+
+		for (unsigned int i = 0; i < h.nr_cpus; i++) {
+			uint64_t end = __atomic_load_n(&rings[i].head, __ATOMIC_ACQUIRE);
+
+			_end[i] = end;
+			_start[i] = end >= TRACE_RING_SIZE ? end - TRACE_RING_SIZE + 1 : 0;
+			_nr_records += end - _start[i];
+			h.nr_dropped += __atomic_load_n(&rings[i].dropped, __ATOMIC_RELAXED);
+		}
+
+		h.nr_records = _nr_records;
+	}
+
+	~TraceSnapshot()
+	{
+		__atomic_fetch_sub(&paused, 1, __ATOMIC_SEQ_CST);
+	}
+
+	size_t size() const { return sizeof(_header) + _nr_records * sizeof(TraceRecord); }
+
+	/* Copies out part of the dump, returning how much was copied. */
+	size_t read(void *buffer, size_t size, size_t off) const
+	{
+		uint8_t *out = (uint8_t *)buffer;
+		size_t copied = 0;
+
+		if (off < sizeof(_header)) {
+			size_t n = sizeof(_header) - off;
+			if (n > size) n = size;
+
+			memcpy(out, (const uint8_t *)&_header + off, n);
+			copied += n;
+			off += n;
+		}
+
+		// Find the ring, and the record within it, that the offset falls in.
+		size_t record = (off - sizeof(_header)) / sizeof(TraceRecord);
+		size_t within = (off - sizeof(_header)) % sizeof(TraceRecord);
+
+		for (unsigned int i = 0; i < _header.nr_cpus && copied < size; i++) {
+			uint64_t nr = _end[i] - _start[i];
+			if (record >= nr) {
+				record -= nr;
+				continue;
+			}
+
+			for (uint64_t r = _start[i] + record; r < _end[i] && copied < size; r++) {
+				size_t n = sizeof(TraceRecord) - within;
+				if (n > size - copied) n = size - copied;
+
+				memcpy(out + copied, (const uint8_t *)&rings[i].records[r % TRACE_RING_SIZE] + within, n);
+				copied += n;
+				within = 0;
+			}
+
+			record = 0;
+		}
+
+		return copied;
+	}
+
+private:
+	TraceDumpHeader _header;
+	uint64_t _start[SCHED_MAX_RUNQUEUES], _end[SCHED_MAX_RUNQUEUES];
+	uint64_t _nr_records;
+};
+
+static bool dump_snapshot(const TraceSnapshot& snapshot, Stream& stream)
+{
+	uint8_t buffer[512];
+
+	for (size_t off = 0; off < snapshot.size();) {
+		size_t n = snapshot.read(buffer, sizeof(buffer), off);
+
+		if (stream.write(buffer, n) < 0) return false;
+		off += n;
+	}
+
+	return true;
+}
+
+bool infos::kernel::trace_dump(Stream& stream)
+{
+	TraceSnapshot snapshot;
+	return dump_snapshot(snapshot, stream);
+}
+
+void infos::kernel::trace_set_dump_stream(Stream& stream)
+{
+	dump_stream = &stream;
+}
+
+/**
+ * An open dump of the trace.  Nothing is recorded while it is open.  Writing to it dumps
+ * the trace to the dump stream instead.
+ */
+class TraceFile : public File
+{
+public:
+	TraceFile() : _pos(0) { }
+
+	int read(void *buffer, size_t size) override
+	{
+		int n = pread(buffer, size, _pos);
+		if (n > 0) _pos += n;
+		return n;
+	}
+
+	int pread(void *buffer, size_t size, off_t off) override
+	{
+		if (off < 0 || (size_t)off >= _snapshot.size()) return 0;
+		return _snapshot.read(buffer, size, off);
+	}
+
+	int write(const void *buffer, size_t size) override
+	{
+		// The file's own snapshot already has the trace paused.
+		if (!dump_stream || !dump_snapshot(_snapshot, *dump_stream)) return -1;
+		return size;
+	}
+
+	void seek(off_t offset, SeekType type) override
+	{
+		if (type == SeekAbsolute) {
+			_pos = offset;
+		} else {
+			_pos += offset;
+		}
+	}
+
+private:
+	TraceSnapshot _snapshot;
+	off_t _pos;
+};
+
+/**
+ * A pseudo-device (/dev/trace0) that reads as a binary dump of the trace.
+ */
+class TraceDevice : public Device
+{
+public:
+	static const DeviceClass TraceDeviceClass;
+
+	const DeviceClass& device_class() const override { return TraceDeviceClass; }
+
+	File *open_as_file() override { return new TraceFile(); }
+};
+
+const DeviceClass TraceDevice::TraceDeviceClass(Device::RootDeviceClass, "trace");
+
+RegisterDevice(TraceDevice);
@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/workqueue.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/kernel/workqueue.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/log.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/util/lock.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+
+static WorkQueue system_wq("kworker", SchedulingEntityPriority::NORMAL);
+
+RegisterCmdLineArgument(WorkQueuePriority, "workqueue.priority") {
+	if (strncmp(value, "realtime", 8) == 0) {
+		system_wq.priority(SchedulingEntityPriority::REALTIME);
+	} else if (strncmp(value, "interactive", 11) == 0) {
+		system_wq.priority(SchedulingEntityPriority::INTERACTIVE);
+	} else if (strncmp(value, "normal", 6) == 0) {
+		system_wq.priority(SchedulingEntityPriority::NORMAL);
+	} else if (strncmp(value, "daemon", 6) == 0) {
+		system_wq.priority(SchedulingEntityPriority::DAEMON);
+	} else {
+		syslog.messagef(LogLevel::WARNING, "Unknown workqueue priority '%s'", value);
+	}
+}
+
+WorkQueue& infos::kernel::system_workqueue()
+{
+	return system_wq;
+}
+
+// The workqueues are all static, so the list is complete before anything runs.
+WorkQueue *WorkQueue::_queues;
+
+WorkQueue::WorkQueue(const char *name, SchedulingEntityPriority::SchedulingEntityPriority priority)
+	: _name(name), _priority(priority), _nr_workers(0), _started(false), _next_queue(_queues)
+{
+	for (unsigned int i = 0; i < SCHED_MAX_RUNQUEUES; i++) {
+		_workers[i].thread = NULL;
+		_workers[i].head = NULL;
+		_workers[i].tail = NULL;
+	}
+
+	_queues = this;
+}
+
+/**
+ * Starts a worker for each runqueue, each of which only runs on its own CPU, so that
+ * work stays on the CPU that queued it (and whose caches its data is in).
+ * @return Returns true if the workers were started, or false otherwise.
+ */
+bool WorkQueue::start()
+{
+	if (_started) return true;
+
+	_started = true;
+	add_workers();
+
+	return true;
+}
+
+void WorkQueue::runqueues_added()
+{
+	for (WorkQueue *wq = _queues; wq; wq = wq->_next_queue) {
+		if (wq->_started) wq->add_workers();
+	}
+}
+
+/**
+ * Starts workers for the runqueues that don't have one yet.
+ */
+void WorkQueue::add_workers()
+{
+	unsigned int first = _nr_workers, nr_workers = sys.scheduler().nr_runqueues();
+	if (nr_workers == 0) nr_workers = 1;
+	if (nr_workers <= first) return;
+
+	for (unsigned int i = first; i < nr_workers; i++) {
+		Thread& thread = sys.create_kernel_thread((Thread::thread_proc_t)worker_threadproc, _name, _priority);
+
+		thread.add_entry_argument(&_workers[i]);
+		if (nr_workers > 1) sys.scheduler().set_affinity(thread, 1ull << i);
+
+		_workers[i].thread = &thread;
+	}
+
+	// The first worker could run anywhere while it was the only one.
+	if (first == 1) sys.scheduler().set_affinity(*_workers[0].thread, 1);
+
+	// Work queued on the new CPUs from now on goes to their own workers.
+	__atomic_store_n(&_nr_workers, nr_workers, __ATOMIC_RELEASE);
+
+	for (unsigned int i = first; i < nr_workers; i++) {
+		_workers[i].thread->start();
+	}
+}
+
+bool WorkQueue::queue(WorkItem& item)
+{
+	if (!__sync_bool_compare_and_swap(&item._pending, false, true)) return false;
+
+	UniqueIRQLock irq;
+
+	// A CPU without a runqueue (or one that came along after the workers were started)
+	// has no worker of its own.
+	RunQueue *rq = CPU::current().runqueue();
+	unsigned int index = rq ? rq->index() : 0;
+	if (index >= _nr_workers) index = 0;
+
+	Worker& worker = _workers[index];
+	UniqueLock<SpinLock> l(worker.idle.lock());
+
+	item._next = NULL;
+	if (worker.tail) {
+		worker.tail->_next = &item;
+	} else {
+		worker.head = &item;
+	}
+	worker.tail = &item;
+
+	worker.idle.wake_one_locked();
+	return true;
+}
+
+void WorkQueue::worker_threadproc(Worker *worker)
+{
+	for (;;) {
+		WorkItem::WorkFn fn;
+		void *arg;
+
+		{
+			UniqueIRQLock irq;
+			UniqueLock<SpinLock> l(worker->idle.lock());
+
+			while (!worker->head) {
+				worker->idle.sleep_locked(Thread::current());
+			}
+
+			WorkItem *item = worker->head;
+			worker->head = item->_next;
+			if (!worker->head) worker->tail = NULL;
+
+			// The item is no longer pending once it has been taken off the queue, so
+			// it can be queued again (even by itself) while it runs.
+			fn = item->_fn;
+			arg = item->_arg;
+			item->_pending = false;
+		}
+
+		fn(arg);
+	}
+}
@@ -1,103 +1,328 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/buddy-allocator.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
 #include <infos/mm/page-allocator.h>
-#include <infos/mm/frame-descriptor.h>
-#include <infos/util/linked-list.h>
+#include <infos/mm/mm.h>
 #include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
 
+using namespace infos::kernel;
 using namespace infos::mm;
-using namespace infos::util;
 
-#define MAX_ORDER 18  // 2^18 pages = 1GB if page size = 4KB
+#define MAX_ORDER 18  // 2^(MAX_ORDER-1) pages = 512MB if page size = 4KB
+
+static_assert(MAX_ORDER <= PageAllocatorStats::NR_ORDERS);
+
+// A block and its buddy must never straddle a chunk of deferred descriptor initialisation.
+static_assert((1ull << (MAX_ORDER - 1)) <= PF_INIT_CHUNK_FRAMES);
 
-class BuddyPageAllocator : public PageAllocatorAlgorithm {
+/**
+ * A binary buddy page allocation algorithm.
+ *
+ * The free lists are intrusive doubly-linked lists, threaded through the
+ * 'next' and 'prev' fields of the frame descriptors that head each free
+ * block.  The head of a free block is also tagged with its order, so that
+ * the buddy of a block can be checked, and unlinked from its free list, in
+ * constant time.  Consequently, both allocate() and free() are O(MAX_ORDER),
+ * regardless of how many blocks are free.
+ *
+ * Ranges given to insert_range() and remove_range() need not be aligned: they
+ * are broken up into maximal naturally aligned blocks, so no memory is lost at
+ * the edges of a physical memory block or of a reservation.
+ *
+ * Each NUMA node has its own free lists, and a block only merges with a buddy
+ * on the same node, so every free block lies within one node.
+ */
+class BuddyPageAllocator : public PageAllocatorAlgorithm
+{
 public:
-    void initialise(FrameDescriptor *page_descriptors, uint64_t nr_page_descriptors) override {
-        _page_descriptors = page_descriptors;
-        _nr_page_descriptors = nr_page_descriptors;
+	bool init(FrameDescriptor *pf_descriptors, uint64_t nr_pf_descriptors) override
+	{
+		pgalloc_log.messagef(LogLevel::DEBUG, "Buddy Page Allocator online (max order %d)", MAX_ORDER - 1);
+
+		_pf_descriptors = pf_descriptors;
+		_nr_pf_descriptors = nr_pf_descriptors;
+
+		for (int i = 0; i < MAX_ORDER; i++) {
+			for (unsigned int node = 0; node < MAX_NUMA_NODES; node++) {
+				_free_areas[node][i] = NULL;
+			}
+
+			_nr_free_blocks[i] = 0;
+			_nr_failed_allocs[i] = 0;
+		}
+
+		for (unsigned int node = 0; node < MAX_NUMA_NODES; node++) {
+			_nr_node_free_frames[node] = 0;
+		}
+
+		_nr_free_frames = 0;
+		_nr_allocs = _nr_frees = _nr_splits = _nr_merges = 0;
+
+		return true;
+	}
+
+	FrameDescriptor *allocate(int order) override
+	{
+		if (order < 0 || order >= MAX_ORDER) return NULL;
+
+		for (unsigned int node = 0; node < MAX_NUMA_NODES; node++) {
+			FrameDescriptor *block = allocate_from(order, node);
+			if (block) return block;
+		}
+
+		_nr_failed_allocs[order]++;
+		return NULL;
+	}
 
-        for (int i = 0; i < MAX_ORDER; i++) {
-            _free_lists[i].clear();
-        }
+	bool numa_aware() const override { return true; }
 
-        int block_size = 1 << (MAX_ORDER - 1);
-        for (int i = 0; i < (int)nr_page_descriptors; i += block_size) {
-            if (i + block_size <= nr_page_descriptors) {
-                insert_block(i, MAX_ORDER - 1);
-            }
-        }
-    }
+	FrameDescriptor *allocate_on_node(int order, unsigned int node) override
+	{
+		if (order < 0 || order >= MAX_ORDER || node >= MAX_NUMA_NODES) return NULL;
+		return allocate_from(order, node);
+	}
 
-    FrameDescriptor *allocate(int order) override {
-        int current_order = order;
-        while (current_order < MAX_ORDER && _free_lists[current_order].empty()) {
-            current_order++;
-        }
+	void free(FrameDescriptor *base, int order) override
+	{
+		assert(order >= 0 && order < MAX_ORDER);
 
-        if (current_order == MAX_ORDER) return nullptr;
+		_nr_frees++;
+		release(index_of(base), order);
+	}
 
-        FrameDescriptor *block = (FrameDescriptor *)_free_lists[current_order].remove_first();
+	void insert_range(FrameDescriptor *start, uint64_t count) override
+	{
+		pgalloc_log.messagef(LogLevel::DEBUG, "Inserting available frames from %llx -- %llx", index_of(start), index_of(start + count));
 
-        while (current_order > order) {
-            current_order--;
-            uint64_t buddy_index = index_of(block) + (1 << current_order);
-            insert_block(buddy_index, current_order);
-        }
+		insert_blocks(index_of(start), index_of(start) + count);
+	}
 
-        block->flags = 1;
-        return block;
-    }
+	void remove_range(FrameDescriptor *start, uint64_t count) override
+	{
+		pgalloc_log.messagef(LogLevel::DEBUG, "Removing available frames from %llx -- %llx", index_of(start), index_of(start + count));
 
-    void free(FrameDescriptor *page, int order) override {
-        uint64_t index = index_of(page);
+		pfn_t pfn = index_of(start);
+		pfn_t end = pfn + count;
 
-        while (order < MAX_ORDER - 1) {
-            uint64_t buddy_index = index ^ (1 << order);
-            FrameDescriptor *buddy = &_page_descriptors[buddy_index];
+		while (pfn < end) {
+			int order;
+			pfn_t block_pfn;
 
-            if (!is_free(buddy)) break;
+			// If this frame isn't free, there is nothing to remove.
+			if (!find_free_block(pfn, block_pfn, order)) {
+				pfn++;
+				continue;
+			}
 
-            remove_specific_block(buddy, order);
-            index = index < buddy_index ? index : buddy_index;
-            order++;
-        }
+			// Take the whole block out, and give back whatever parts of it
+			// lie either side of the range being removed.
+			pfn_t block_end = block_pfn + (1ull << order);
+			remove_block(&_pf_descriptors[block_pfn], order);
 
-        insert_block(index, order);
-    }
+			insert_blocks(block_pfn, pfn);
+			if (block_end > end) {
+				insert_blocks(end, block_end);
+			}
+
+			pfn = block_end;
+		}
+	}
+
+	const char *name() const override { return "buddy"; }
+
+	bool get_stats(PageAllocatorStats& stats) const override
+	{
+		stats.nr_free_frames = _nr_free_frames;
+		stats.largest_free_order = -1;
+
+		for (int order = 0; order < MAX_ORDER; order++) {
+			stats.nr_free_blocks[order] = _nr_free_blocks[order];
+			stats.nr_failed_allocs[order] = _nr_failed_allocs[order];
+
+			if (_nr_free_blocks[order]) {
+				stats.largest_free_order = order;
+			}
+		}
+
+		for (unsigned int node = 0; node < MAX_NUMA_NODES; node++) {
+			stats.nr_node_free_frames[node] = _nr_node_free_frames[node];
+		}
+
+		stats.nr_allocs = _nr_allocs;
+		stats.nr_frees = _nr_frees;
+		stats.nr_splits = _nr_splits;
+		stats.nr_merges = _nr_merges;
+
+		return true;
+	}
 
 private:
-    LinkedList _free_lists[MAX_ORDER];
-    FrameDescriptor *_page_descriptors;
-    uint64_t _nr_page_descriptors;
-
-    bool is_free(FrameDescriptor *page) {
-        return page->flags == 0;
-    }
-
-    uint64_t index_of(FrameDescriptor *page) {
-        return page - _page_descriptors;
-    }
-
-    void insert_block(uint64_t index, int order) {
-        FrameDescriptor *page = &_page_descriptors[index];
-        page->flags = 0;
-        _free_lists[order].append(page);
-    }
-
-    FrameDescriptor *remove_block(int order) {
-        FrameDescriptor *page = (FrameDescriptor *)_free_lists[order].remove_first();
-        page->flags = 1;
-        return page;
-    }
-
-    void remove_specific_block(FrameDescriptor *page, int order) {
-        void *current = _free_lists[order].first();
-        while (current) {
-            if (current == page) {
-                _free_lists[order].remove(current);
-                return;
-            }
-            current = _free_lists[order].next(current);
-        }
-    }
+	FrameDescriptor *_pf_descriptors;
+	uint64_t _nr_pf_descriptors;
+	FrameDescriptor *_free_areas[MAX_NUMA_NODES][MAX_ORDER];
+
+	// Statistics
+	uint64_t _nr_free_blocks[MAX_ORDER];
+	uint64_t _nr_failed_allocs[MAX_ORDER];
+	uint64_t _nr_free_frames;
+	uint64_t _nr_node_free_frames[MAX_NUMA_NODES];
+	uint64_t _nr_allocs, _nr_frees, _nr_splits, _nr_merges;
+
+	pfn_t index_of(const FrameDescriptor *pfdescr) const
+	{
+		return pfdescr - _pf_descriptors;
+	}
+
+	bool is_free_block(const FrameDescriptor *pfdescr, int order) const
+	{
+		return pfdescr->free_head && pfdescr->order == order;
+	}
+
+	/**
+	 * Allocates a block from the given node's free lists, splitting the smallest
+	 * block there that is large enough.
+	 */
+	FrameDescriptor *allocate_from(int order, unsigned int node)
+	{
+		// Find the smallest order with a free block that is large enough.
+		int current_order = order;
+		while (current_order < MAX_ORDER && !_free_areas[node][current_order]) {
+			current_order++;
+		}
+
+		if (current_order == MAX_ORDER) return NULL;
+
+		FrameDescriptor *block = _free_areas[node][current_order];
+		remove_block(block, current_order);
+		_nr_allocs++;
+
+		// Split the block down to the requested order, returning the upper
+		// half of each split to the free list of the next order down.
+		while (current_order > order) {
+			current_order--;
+			insert_block(block + (1ull << current_order), current_order);
+			_nr_splits++;
+		}
+
+		return block;
+	}
+
+	/**
+	 * Returns a block to the free lists, coalescing it with its buddy for as long as
+	 * the buddy is the head of a free block of the same order.
+	 */
+	void release(pfn_t pfn, int order)
+	{
+		while (order < MAX_ORDER - 1) {
+			pfn_t buddy_pfn = pfn ^ (1ull << order);
+			if (buddy_pfn >= _nr_pf_descriptors) break;
+
+			FrameDescriptor *buddy = &_pf_descriptors[buddy_pfn];
+			if (!is_free_block(buddy, order) || buddy->node != _pf_descriptors[pfn].node) break;
+
+			remove_block(buddy, order);
+			_nr_merges++;
+
+			pfn = pfn < buddy_pfn ? pfn : buddy_pfn;
+			order++;
+		}
+
+		insert_block(&_pf_descriptors[pfn], order);
+	}
+
+	/**
+	 * Pushes a block onto the front of the free list for the given order,
+	 * and tags its head descriptor.
+	 */
+	void insert_block(FrameDescriptor *block, int order)
+	{
+		FrameDescriptor *&free_area = _free_areas[block->node][order];
+
+		block->order = order;
+		block->free_head = true;
+
+		block->prev = NULL;
+		block->next = free_area;
+		if (block->next) {
+			block->next->prev = block;
+		}
+
+		free_area = block;
+
+		_nr_free_blocks[order]++;
+		_nr_free_frames += 1ull << order;
+		_nr_node_free_frames[block->node] += 1ull << order;
+	}
+
+	/**
+	 * Unlinks a block from the free list for the given order, and clears
+	 * the tag on its head descriptor.
+	 */
+	void remove_block(FrameDescriptor *block, int order)
+	{
+		assert(is_free_block(block, order));
+
+		if (block->prev) {
+			block->prev->next = block->next;
+		} else {
+			_free_areas[block->node][order] = block->next;
+		}
+
+		if (block->next) {
+			block->next->prev = block->prev;
+		}
+
+		block->next = NULL;
+		block->prev = NULL;
+		block->free_head = false;
+
+		_nr_free_blocks[order]--;
+		_nr_free_frames -= 1ull << order;
+		_nr_node_free_frames[block->node] -= 1ull << order;
+	}
+
+	/**
+	 * Finds the free block (if any) that contains the given frame.
+	 */
+	bool find_free_block(pfn_t pfn, pfn_t& block_pfn, int& order) const
+	{
+		for (order = 0; order < MAX_ORDER; order++) {
+			block_pfn = pfn & ~((1ull << order) - 1);
+			if (is_free_block(&_pf_descriptors[block_pfn], order)) return true;
+		}
+
+		return false;
+	}
+
+	/**
+	 * Frees the frames [first, last) by splitting the range into maximal,
+	 * naturally aligned blocks.  Each block is released through release(), so
+	 * it coalesces with any free neighbours, e.g. an adjacent memory block.
+	 */
+	void insert_blocks(pfn_t first, pfn_t last)
+	{
+		pfn_t pfn = first;
+
+		while (pfn < last) {
+			int order = 0;
+			while (order < MAX_ORDER - 1
+					&& (pfn & ((1ull << (order + 1)) - 1)) == 0
+					&& pfn + (1ull << (order + 1)) <= last) {
+				order++;
+			}
+
+			release(pfn, order);
+			pfn += 1ull << order;
+		}
+	}
 };
 
-RegisterPageAllocator(BuddyPageAllocator);
+RegisterPageAllocatorAlgorithm(BuddyPageAllocator);
@@ -0,0 +1,245 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/compaction.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/compaction.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/reclaim.h>
+#include <infos/mm/vma.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/process.h>
+#include <infos/fs/stats.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// The most pages that are moved at once, with one pair of TLB flushes.
+#define COMPACT_BATCH			16
+
+// After failing, background compaction skips up to 2^COMPACT_MAX_DEFER_SHIFT of the
+// reclaim thread's turns.
+#define COMPACT_MAX_DEFER_SHIFT	6
+
+// Only one compaction runs at a time.  The map has a bit set for each frame that a
+// movable page is mapped from, and is made the first time it is needed.
+static Mutex compact_lock;
+static uint64_t *movable_map;
+static uint64_t movable_map_frames;
+
+static unsigned int defer_shift, defer_count;
+
+static uint64_t nr_direct, nr_background, nr_succeeded, nr_failed, nr_no_block, nr_migrated, nr_deferred;
+
+static inline bool frame_is_movable(pfn_t pfn)
+{
+	return !!(movable_map[pfn / 64] & (1ull << (pfn % 64)));
+}
+
+static void mark_process(Process& process, void *arg)
+{
+	if (process.kernel_process() || process.terminated()) return;
+
+	UniqueIRQLock l;
+	process.vma().mark_movable_frames(movable_map, movable_map_frames);
+}
+
+/**
+ * Chooses the aligned block of 2^order frames that has the fewest movable pages in it,
+ * and nothing else that is in use.  Blocks that are already free, or that have frames
+ * in the frame caches (which would keep the block from merging), are passed over.
+ * @return Returns true if there is a block worth compacting.
+ */
+static bool choose_block(int order, uint64_t nr_frames, pfn_t& block)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	uint64_t block_frames = 1ull << order;
+	uint64_t best = ~0ull;
+
+	for (pfn_t start = 0; start + block_frames <= nr_frames; start += block_frames) {
+		uint64_t nr_movable = 0;
+		bool usable = true;
+
+		for (pfn_t pfn = start; pfn < start + block_frames; pfn++) {
+			if (pgalloc.pfn_to_pfdescr(pfn)->type == FrameDescriptorType::AVAILABLE) continue;
+
+			if (!frame_is_movable(pfn)) {
+				usable = false;
+				break;
+			}
+
+			nr_movable++;
+		}
+
+		if (usable && nr_movable > 0 && nr_movable < best) {
+			best = nr_movable;
+			block = start;
+		}
+	}
+
+	// The pages have to go somewhere.
+	return best != ~0ull && pgalloc.nr_free_frames() >= best + block_frames;
+}
+
+struct MigrateProgress
+{
+	pfn_t start, end;
+	bool out_of_memory;
+};
+
+static void migrate_process(Process& process, void *arg)
+{
+	MigrateProgress& progress = *(MigrateProgress *)arg;
+	if (progress.out_of_memory || process.kernel_process() || process.terminated()) return;
+
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	VMA& vma = process.vma();
+
+	for (;;) {
+		MigratePage pages[COMPACT_BATCH];
+		unsigned int nr;
+
+		{
+			UniqueIRQLock l;
+			nr = vma.find_pages_to_migrate(progress.start, progress.end, pages, COMPACT_BATCH);
+		}
+
+		if (!nr) return;
+
+		FrameDescriptor *frames[COMPACT_BATCH];
+		unsigned int nr_frames = pgalloc.allocate_outside(progress.start, progress.end, nr, frames);
+
+		for (unsigned int i = 0; i < nr_frames; i++) {
+			pages[i].to = frames[i];
+		}
+
+		unsigned int nr_moved;
+		{
+			UniqueIRQLock l;
+			nr_moved = vma.migrate_pages(pages, nr_frames);
+		}
+
+		for (unsigned int i = 0; i < nr_frames; i++) {
+			pgalloc.free_to_algorithm(pages[i].moved ? pages[i].from : pages[i].to, 0);
+		}
+
+		__atomic_add_fetch(&nr_migrated, nr_moved, __ATOMIC_RELAXED);
+
+		if (nr_frames < nr) {
+			progress.out_of_memory = true;
+			return;
+		}
+
+		// The pages that didn't move have changed, and will be found again: leave
+		// them be for now.
+		if (!nr_moved) return;
+	}
+}
+
+static bool block_is_free(pfn_t start, int order)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	for (pfn_t pfn = start; pfn < start + (1ull << order); pfn++) {
+		if (pgalloc.pfn_to_pfdescr(pfn)->type != FrameDescriptorType::AVAILABLE) return false;
+	}
+
+	return true;
+}
+
+static bool compact_locked(int order)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	uint64_t nr_frames = pgalloc.nr_initialised_frames();
+
+	if (!movable_map) {
+		uint64_t nr_words = nr_frames / 64 + 1;
+
+		movable_map = new uint64_t[nr_words];
+		if (!movable_map) return false;
+
+		movable_map_frames = nr_words * 64;
+	}
+
+	// The map was sized for the frames that had been initialised then.
+	nr_frames = __min(nr_frames, movable_map_frames);
+	bzero(movable_map, movable_map_frames / 8);
+
+	if (!Process::try_for_each(mark_process, NULL)) return false;
+
+	pfn_t block;
+	if (!choose_block(order, nr_frames, block)) {
+		__atomic_add_fetch(&nr_no_block, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	MigrateProgress progress = { block, block + (1ull << order), false };
+	if (!Process::try_for_each(migrate_process, &progress)) return false;
+
+	return block_is_free(block, order);
+}
+
+static bool compact(int order)
+{
+	if (order <= 0 || !compact_lock.try_lock()) return false;
+
+	bool ok = compact_locked(order);
+	compact_lock.unlock();
+
+	__atomic_add_fetch(ok ? &nr_succeeded : &nr_failed, 1, __ATOMIC_RELAXED);
+	if (ok) mm_log.messagef(LogLevel::DEBUG, "compaction: freed a block of order %d", order);
+
+	return ok;
+}
+
+bool infos::mm::compact_memory(int order)
+{
+	__atomic_add_fetch(&nr_direct, 1, __ATOMIC_RELAXED);
+	return compact(order);
+}
+
+void infos::mm::compact_in_background()
+{
+	PageAllocatorStats stats;
+	if (!sys.mm().pgalloc().get_stats(stats) || stats.largest_free_order >= COMPACT_ORDER) return;
+
+	// If memory is short, rather than fragmented, there's nowhere to move pages to.
+	ReclaimWatermarks watermarks;
+	reclaim_watermarks(watermarks);
+	if (stats.nr_free_frames < watermarks.high + (1ull << COMPACT_ORDER)) return;
+
+	if (defer_count) {
+		defer_count--;
+		__atomic_add_fetch(&nr_deferred, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	__atomic_add_fetch(&nr_background, 1, __ATOMIC_RELAXED);
+
+	if (compact(COMPACT_ORDER)) {
+		defer_shift = 0;
+	} else {
+		if (defer_shift < COMPACT_MAX_DEFER_SHIFT) defer_shift++;
+		defer_count = 1u << defer_shift;
+	}
+}
+
+RegisterStatistics(compaction, "compaction")
+{
+	out.append("direct %llu\n", __atomic_load_n(&nr_direct, __ATOMIC_RELAXED));
+	out.append("background %llu\n", __atomic_load_n(&nr_background, __ATOMIC_RELAXED));
+	out.append("deferred %llu\n", __atomic_load_n(&nr_deferred, __ATOMIC_RELAXED));
+	out.append("succeeded %llu\n", __atomic_load_n(&nr_succeeded, __ATOMIC_RELAXED));
+	out.append("failed %llu\n", __atomic_load_n(&nr_failed, __ATOMIC_RELAXED));
+	out.append("no-block %llu\n", __atomic_load_n(&nr_no_block, __ATOMIC_RELAXED));
+	out.append("migrated-pages %llu\n", __atomic_load_n(&nr_migrated, __ATOMIC_RELAXED));
+}
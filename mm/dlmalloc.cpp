@@ -552,7 +552,11 @@ static inline void *mmap(void *addr, size_t size, int flags, int prot, int fd, i
 	unsigned int pages = size >> 12;
 	unsigned int order = infos::util::ilog2_ceil(pages);
 	
-	const infos::mm::FrameDescriptor *pfdescr = infos::kernel::sys.mm().pgalloc().allocate(order);
+	// The frames are zeroed, so that MMAP_CLEARS holds, and calloc() can skip clearing
+	// fresh chunks.  Pre-zeroed frames usually make this free.
+	const infos::mm::FrameDescriptor *pfdescr = infos::kernel::sys.mm().pgalloc().allocate(order, infos::mm::PageAllocFlags::ZERO);
+	if (!pfdescr)
+		return (void *)~(size_t)0;
 	
 	return (void *)infos::kernel::sys.mm().pgalloc().pfdescr_to_vpa(pfdescr);
 }
@@ -596,6 +600,11 @@ int errno;
 #define USE_DL_PREFIX 1
 #define NO_MALLOC_STATS 1
 
+// The kernel heap is a set of arenas (see ObjectAllocator), each of which is an
+// mspace.  Footers let a chunk be freed without knowing which one it came from.
+#define ONLY_MSPACES 1
+#define FOOTERS 1
+
 #ifndef WIN32
 #ifdef _WIN32
 #define WIN32 1
@@ -1460,6 +1469,12 @@ DLMALLOC_EXPORT struct mallinfo mspace_mallinfo(mspace msp);
 */
 DLMALLOC_EXPORT size_t mspace_usable_size(const void* mem);
 
+/*
+  mspace_of returns the mspace that an allocated chunk belongs to.  (InfOS
+  addition: this needs FOOTERS.)
+*/
+DLMALLOC_EXPORT mspace mspace_of(const void* mem);
+
 /*
   mspace_malloc_stats behaves as malloc_stats, but reports
   properties of the given space.
@@ -5462,7 +5477,7 @@ static mstate init_user_mstate(char* tbase, size_t tsize) {
   mchunkptr mn;
   mchunkptr msp = align_as_chunk(tbase);
   mstate m = (mstate)(chunk2mem(msp));
-  memset(m, 0, msize);
+  infos::util::memset(m, 0, msize);
   (void)INITIAL_LOCK(&m->mutex);
   msp->head = (msize|INUSE_BITS);
   m->seg.base = m->least_addr = tbase;
@@ -5789,7 +5804,7 @@ void* mspace_calloc(mspace msp, size_t n_elements, size_t elem_size) {
   }
   mem = internal_malloc(ms, req);
   if (mem != 0 && calloc_must_clear(mem2chunk(mem)))
-    memset(mem, 0, req);
+    infos::util::memset(mem, 0, req);
   return mem;
 }
 
@@ -5829,7 +5844,7 @@ void* mspace_realloc(mspace msp, void* oldmem, size_t bytes) {
         mem = mspace_malloc(m, bytes);
         if (mem != 0) {
           size_t oc = chunksize(oldp) - overhead_for(oldp);
-          memcpy(mem, oldmem, (oc < bytes)? oc : bytes);
+          infos::util::memcpy(mem, oldmem, (oc < bytes)? oc : bytes);
           mspace_free(m, oldmem);
         }
       }
@@ -6027,6 +6042,16 @@ size_t mspace_usable_size(const void* mem) {
   return 0;
 }
 
+mspace mspace_of(const void* mem) {
+  mchunkptr p = mem2chunk(mem);
+  mstate fm = get_mstate_for(p);
+  if (!ok_magic(fm)) {
+    USAGE_ERROR_ACTION(fm, p);
+    return 0;
+  }
+  return (mspace)fm;
+}
+
 int mspace_mallopt(int param_number, int value) {
   return change_mparam(param_number, value);
 }
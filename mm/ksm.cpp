@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/ksm.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/ksm.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/vma.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/process.h>
+#include <infos/fs/stats.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/hash-map.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// The most pages of a process that are looked at each time the scanner runs, and the
+// most of those that are tried for merging.
+#define KSM_SCAN		512
+#define KSM_BATCH		32
+
+static bool do_ksm;
+
+RegisterCmdLineArgument(KSM, "ksm")
+{
+	if (strncmp(value, "1", 2) == 0)
+	{
+		do_ksm = true;
+	}
+	else
+	{
+		do_ksm = false;
+	}
+}
+
+struct UnstablePage
+{
+	VMA *vma;
+	MergePage page;
+};
+
+// The scanner only runs on the reclaim thread, so the tables need no lock.  Each frame
+// in the stable table has a hold on it for the table.
+static HashMap<uint64_t, FrameDescriptor *> stable;
+static HashMap<uint64_t, UnstablePage> unstable;
+
+static uint64_t nr_runs, nr_scanned, nr_merged, nr_differed, nr_freed;
+
+static inline const uint64_t *frame_data(FrameDescriptor *frame)
+{
+	return (const uint64_t *)sys.mm().pgalloc().pfdescr_to_vpa(frame);
+}
+
+static uint64_t hash_frame(FrameDescriptor *frame)
+{
+	const uint64_t *data = frame_data(frame);
+	uint64_t hash = 0;
+
+	for (unsigned int i = 0; i < __page_size / sizeof(uint64_t); i++) {
+		hash = (hash ^ data[i]) * 0x9e3779b97f4a7c15ull;
+	}
+
+	return hash ^ (hash >> 32);
+}
+
+static bool same_data(FrameDescriptor *a, FrameDescriptor *b)
+{
+	const uint64_t *da = frame_data(a), *db = frame_data(b);
+
+	for (unsigned int i = 0; i < __page_size / sizeof(uint64_t); i++) {
+		if (da[i] != db[i]) return false;
+	}
+
+	return true;
+}
+
+static bool merge_into(VMA& vma, const MergePage& page, FrameDescriptor *into, bool fill)
+{
+	bool merged;
+	{
+		UniqueIRQLock l;
+		merged = vma.merge_page(page, into, fill);
+	}
+
+	if (merged) {
+		sys.mm().pgalloc().free_one(page.frame);
+		nr_merged++;
+	}
+
+	return merged;
+}
+
+/**
+ * Merges two pages (that are very likely the same) into a new frame, and files the
+ * frame in the stable table.
+ */
+static void merge_pair(const UnstablePage& first, VMA& vma, const MergePage& second)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	FrameDescriptor *frame = pgalloc.allocate(0);
+	if (!frame) return;
+
+	frame->refcount = 1;
+	if (!merge_into(*first.vma, first.page, frame, true)) {
+		frame->refcount = 0;
+		pgalloc.free_one(frame);
+		return;
+	}
+
+	// The frame's data can't change now, and is filed by what it hashes to now.  If it
+	// can't be filed, the table lets go of it, and it is just shared by the pages that
+	// are merged into it.
+	uint64_t hash = hash_frame(frame);
+	if (stable.contains_key(hash) || !stable.add(hash, frame)) {
+		__atomic_sub_fetch(&frame->refcount, 1, __ATOMIC_RELAXED);
+	}
+
+	merge_into(vma, second, frame, false);
+}
+
+static void merge_one(VMA& vma, const MergePage& page)
+{
+	uint64_t hash = hash_frame(page.frame);
+
+	FrameDescriptor *shared;
+	if (stable.try_get_value(hash, shared)) {
+		if (!merge_into(vma, page, shared, false)) nr_differed++;
+		return;
+	}
+
+	UnstablePage other;
+	if (!unstable.try_get_value(hash, other)) {
+		UnstablePage unmerged = { &vma, page };
+		unstable.add(hash, unmerged);
+		return;
+	}
+
+	unstable.remove(hash);
+
+	// Neither page is write-protected yet, so this is only a first look, so that a new
+	// frame is only made for pages that are very likely the same.
+	if (!same_data(other.page.frame, page.frame)) {
+		nr_differed++;
+		return;
+	}
+
+	merge_pair(other, vma, page);
+}
+
+static void scan_process(Process& process, void *arg)
+{
+	if (process.kernel_process() || process.terminated()) return;
+
+	VMA& vma = process.vma();
+	MergePage pages[KSM_BATCH];
+	unsigned int nr;
+
+	{
+		UniqueIRQLock l;
+		nr = vma.find_merge_candidates(pages, KSM_BATCH, KSM_SCAN);
+	}
+
+	nr_scanned += nr;
+
+	for (unsigned int i = 0; i < nr; i++) {
+		merge_one(vma, pages[i]);
+	}
+}
+
+/**
+ * Frees the merged frames that only the stable table holds on to any more.  Nothing can
+ * take a new hold on one of those but the scanner, so they can go.
+ */
+static void free_unmapped_frames()
+{
+	for (const auto& entry : stable) {
+		FrameDescriptor *frame = entry.value;
+
+		uint32_t expected = 1;
+		if (!__atomic_compare_exchange_n(&frame->refcount, &expected, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) continue;
+
+		uint64_t hash = entry.key;
+		stable.remove(hash);
+
+		sys.mm().pgalloc().free_one(frame);
+		nr_freed++;
+	}
+}
+
+void infos::mm::merge_in_background()
+{
+	if (!do_ksm) return;
+
+	nr_runs++;
+	free_unmapped_frames();
+
+	// Processes can't go away while they are being walked, so the unstable pages'
+	// VMAs stay valid until the table is cleared.
+	Process::for_each(scan_process, NULL);
+	unstable.clear();
+}
+
+RegisterStatistics(ksm, "ksm")
+{
+	out.append("enabled %u\n", do_ksm ? 1 : 0);
+	out.append("shared-frames %u\n", stable.count());
+	out.append("runs %llu\n", __atomic_load_n(&nr_runs, __ATOMIC_RELAXED));
+	out.append("scanned-pages %llu\n", __atomic_load_n(&nr_scanned, __ATOMIC_RELAXED));
+	out.append("merged-pages %llu\n", __atomic_load_n(&nr_merged, __ATOMIC_RELAXED));
+	out.append("differed-pages %llu\n", __atomic_load_n(&nr_differed, __ATOMIC_RELAXED));
+	out.append("freed-frames %llu\n", __atomic_load_n(&nr_freed, __ATOMIC_RELAXED));
+}
@@ -12,6 +12,7 @@
 #include <infos/mm/page-allocator.h>
 #include <infos/mm/object-allocator.h>
 #include <infos/kernel/log.h>
+#include <infos/kernel/boot-phase.h>
 #include <infos/util/cmdline.h>
 #include <infos/util/string.h>
 
@@ -31,7 +32,8 @@ MemoryManager::MemoryManager(Kernel& owner)
 	: Subsystem(owner), 
 		_last_pfn(0), 
 		_page_alloc(*this), 
-		_obj_alloc(*this)
+		_obj_alloc(*this),
+		_pkt_alloc(*this)
 {
 
 }
@@ -139,10 +141,12 @@ bool MemoryManager::initialise_allocators()
 	_page_alloc.algorithm(*algo);
 	
 	// Initialise the page allocator.
+	boot_phase_begin("mm.pgalloc-init");
 	if (!_page_alloc.init()) {
 		mm_log.message(LogLevel::ERROR, "Page allocator failed to initialise");
 		return false;
 	}
+	boot_phase_end();
 	
 	if (!test_page_allocator()) {
 		mm_log.message(LogLevel::ERROR, "Page allocator self-test failed");
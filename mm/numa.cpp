@@ -0,0 +1,240 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/numa.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/numa.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/kernel/kernel.h>
+#include <infos/fs/stats.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/lock.h>
+#include <infos/util/printf.h>
+#include <infos/util/string.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+#define MAX_NUMA_RANGES		32
+
+// Placing frames by NUMA node is off unless asked for (numa=1) until it has been run on a
+// booted system.
+static bool do_numa;
+
+RegisterCmdLineArgument(NUMA, "numa")
+{
+	if (strncmp(value, "1", 2) == 0)
+	{
+		do_numa = true;
+	}
+	else
+	{
+		do_numa = false;
+	}
+}
+
+struct NumaRange
+{
+	pfn_t start, end;
+	unsigned int node;
+};
+
+// The ranges are kept in order of their start, and don't overlap.
+static NumaRange ranges[MAX_NUMA_RANGES];
+static unsigned int nr_ranges;
+
+static unsigned int nr_nodes = 1;
+static uint8_t distances[MAX_NUMA_NODES][MAX_NUMA_NODES];
+static uint8_t fallback[MAX_NUMA_NODES][MAX_NUMA_NODES];
+static bool active;
+
+bool infos::mm::numa_add_memory(unsigned int node, phys_addr_t base, uint64_t size)
+{
+	pfn_t start = pa_to_pfn(base), end = pa_to_pfn(base + size);
+	if (node >= MAX_NUMA_NODES || start >= end) return false;
+
+	if (nr_ranges >= MAX_NUMA_RANGES) {
+		mm_log.messagef(LogLevel::WARNING, "numa: too many memory ranges");
+		return false;
+	}
+
+	unsigned int i = nr_ranges;
+	while (i > 0 && ranges[i - 1].start > start) {
+		ranges[i] = ranges[i - 1];
+		i--;
+	}
+
+	if ((i > 0 && ranges[i - 1].end > start) || (i < nr_ranges && ranges[i + 1].start < end)) {
+		mm_log.messagef(LogLevel::WARNING, "numa: memory range %lx--%lx overlaps another", base, (phys_addr_t)(base + size));
+
+		for (; i < nr_ranges; i++) ranges[i] = ranges[i + 1];
+		return false;
+	}
+
+	ranges[i].start = start;
+	ranges[i].end = end;
+	ranges[i].node = node;
+	nr_ranges++;
+
+	numa_add_node(node);
+	return true;
+}
+
+void infos::mm::numa_add_node(unsigned int node)
+{
+	if (node < MAX_NUMA_NODES && node >= nr_nodes) nr_nodes = node + 1;
+}
+
+void infos::mm::numa_set_distance(unsigned int from, unsigned int to, unsigned int distance)
+{
+	if (from >= MAX_NUMA_NODES || to >= MAX_NUMA_NODES) return;
+	distances[from][to] = distance > 0xff ? 0xff : distance;
+}
+
+unsigned int infos::mm::numa_distance(unsigned int from, unsigned int to)
+{
+	if (distances[from][to]) return distances[from][to];
+	return from == to ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+}
+
+bool infos::mm::numa_init()
+{
+	if (!do_numa || nr_nodes <= 1) {
+		nr_nodes = 1;
+		nr_ranges = 0;
+		return false;
+	}
+
+	// Each node falls back to the others in order of distance, and then of number.
+	for (unsigned int node = 0; node < nr_nodes; node++) {
+		uint8_t *order = fallback[node];
+
+		for (unsigned int i = 0; i < nr_nodes; i++) {
+			uint8_t other = i;
+
+			unsigned int j = i;
+			while (j > 0 && numa_distance(node, order[j - 1]) > numa_distance(node, other)) {
+				order[j] = order[j - 1];
+				j--;
+			}
+
+			order[j] = other;
+		}
+	}
+
+	for (unsigned int i = 0; i < nr_ranges; i++) {
+		mm_log.messagef(LogLevel::INFO, "numa: node %u: %lx--%lx", ranges[i].node, pfn_to_pa(ranges[i].start), pfn_to_pa(ranges[i].end));
+	}
+
+	active = true;
+	return true;
+}
+
+unsigned int infos::mm::numa_nr_nodes()
+{
+	return nr_nodes;
+}
+
+const uint8_t *infos::mm::numa_fallback_order(unsigned int node)
+{
+	return fallback[node < nr_nodes ? node : 0];
+}
+
+unsigned int infos::mm::numa_node_of_pfn(pfn_t pfn, pfn_t& run_end)
+{
+	if (!active) return 0;
+
+	for (unsigned int i = 0; i < nr_ranges; i++) {
+		const NumaRange& range = ranges[i];
+
+		if (pfn < range.start) {
+			if (range.start < run_end) run_end = range.start;
+			return 0;
+		}
+
+		if (pfn < range.end) {
+			if (range.end < run_end) run_end = range.end;
+			return range.node;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Tags the frame descriptors that have been initialised with their nodes, once the
+ * topology is known, and sorts the free frames into their nodes' pools, by taking them
+ * all out of the algorithm, and putting them back a node at a time.  This is done
+ * before the other CPUs start, while there is little to go through.  Frames that are
+ * initialised later are tagged as they are (see init_frames()).
+ */
+bool PageAllocator::init_numa()
+{
+	if (!numa_init() || !_allocator_algorithm || !_allocator_algorithm->numa_aware())
+		return true;
+
+	UniqueLock<Mutex> l(_mtx);
+
+	pfn_t end = _nr_initialised_frames;
+	_allocator_algorithm->remove_range(&_pf_descriptors[0], end);
+
+	pfn_t pfn = 0;
+	while (pfn < end) {
+		pfn_t run_end = end;
+		unsigned int node = numa_node_of_pfn(pfn, run_end);
+
+		for (pfn_t i = pfn; i < run_end; i++) {
+			_pf_descriptors[i].node = node;
+		}
+
+		// Put back the runs of frames that were free.
+		pfn_t i = pfn;
+		while (i < run_end) {
+			if (_pf_descriptors[i].type != FrameDescriptorType::AVAILABLE) {
+				i++;
+				continue;
+			}
+
+			pfn_t j = i;
+			while (j < run_end && _pf_descriptors[j].type == FrameDescriptorType::AVAILABLE) j++;
+
+			_allocator_algorithm->insert_range(&_pf_descriptors[i], j - i);
+			i = j;
+		}
+
+		pfn = run_end;
+	}
+
+	_numa = true;
+	return true;
+}
+
+RegisterStatistics(numa, "numa")
+{
+	out.append("nodes %u\n", numa_nr_nodes());
+
+	PageAllocatorStats stats;
+	if (!sys.mm().pgalloc().get_stats(stats)) return;
+
+	out.append("local-allocs %llu\n", stats.nr_local_allocs);
+	out.append("remote-allocs %llu\n", stats.nr_remote_allocs);
+
+	out.append("node free-frames distances\n");
+	for (unsigned int node = 0; node < numa_nr_nodes(); node++) {
+		char line[4 * MAX_NUMA_NODES + 1];
+		unsigned int n = 0;
+
+		for (unsigned int other = 0; other < numa_nr_nodes(); other++) {
+			n += snprintf(line + n, sizeof(line) - n, " %u", numa_distance(node, other));
+		}
+
+		out.append("%u %llu%s\n", node, stats.nr_node_free_frames[node], line);
+	}
+}
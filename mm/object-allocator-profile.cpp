@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/object-allocator-profile.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/object-allocator.h>
+#include <infos/mm/mm.h>
+#include <infos/kernel/kernel.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/text-file.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+#include <infos/util/math.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::fs;
+using namespace infos::util;
+
+// The number of call-site table slots to try, before giving up on a sample.
+#define CALL_SITE_PROBES	8
+
+// The number of call sites reported by /dev/objprof0.
+#define CALL_SITES_REPORTED	48
+
+static ObjectAllocatorProfile profile;
+static AllocCallSite call_sites[OBJALLOC_PROFILE_CALL_SITES];
+static unsigned int sample_countdown = OBJALLOC_PROFILE_PERIOD;
+
+static inline unsigned int call_site_hash(const void *caller)
+{
+	// Fibonacci hashing: return addresses are far from uniformly distributed.
+	return (unsigned int)(((uint64_t)caller * 0x9e3779b97f4a7c15ull) >> 56) % OBJALLOC_PROFILE_CALL_SITES;
+}
+
+/**
+ * Accounts for an allocation request, and samples its call site.  This is only called
+ * when profiling is enabled.
+ * @param size The size of the request, in bytes
+ * @param caller The return address of the call into the allocator
+ */
+void ObjectAllocator::profile_alloc(size_t size, const void *caller)
+{
+	unsigned int bucket = size <= 1 ? 0 : ilog2_ceil((uint32_t)(size > 0x80000000u ? 0x80000000u : size));
+
+	UniqueIRQLock l;
+
+	profile.nr_allocs[bucket]++;
+	profile.nr_bytes[bucket] += size;
+
+	if (--sample_countdown) {
+		return;
+	}
+
+	sample_countdown = OBJALLOC_PROFILE_PERIOD;
+	profile.nr_samples++;
+
+	unsigned int slot = call_site_hash(caller);
+	for (unsigned int i = 0; i < CALL_SITE_PROBES; i++) {
+		AllocCallSite& site = call_sites[(slot + i) % OBJALLOC_PROFILE_CALL_SITES];
+
+		if (site.caller == caller || site.caller == NULL) {
+			site.caller = caller;
+			site.nr_samples++;
+			site.nr_bytes += size;
+			return;
+		}
+	}
+
+	profile.nr_dropped_samples++;
+}
+
+void ObjectAllocator::get_profile(ObjectAllocatorProfile& p)
+{
+	UniqueIRQLock l;
+	memcpy(&p, &profile, sizeof(p));
+}
+
+unsigned int ObjectAllocator::get_call_sites(AllocCallSite *sites, unsigned int max)
+{
+	unsigned int nr_sites = 0;
+
+	UniqueIRQLock l;
+
+	// Insertion sort into the caller's array, keeping only the 'max' busiest sites.
+	for (unsigned int i = 0; i < OBJALLOC_PROFILE_CALL_SITES; i++) {
+		const AllocCallSite& site = call_sites[i];
+		if (!site.caller) continue;
+
+		if (nr_sites == max && sites[max - 1].nr_samples >= site.nr_samples) continue;
+
+		unsigned int j = (nr_sites < max) ? nr_sites++ : max - 1;
+		for (; j > 0 && sites[j - 1].nr_samples < site.nr_samples; j--) {
+			sites[j] = sites[j - 1];
+		}
+
+		sites[j] = site;
+	}
+
+	return nr_sites;
+}
+
+/**
+ * A pseudo-device (/dev/objprof0) that reports the allocation profile as text.
+ */
+class ObjectAllocatorProfileDevice : public Device
+{
+public:
+	static const DeviceClass ObjectAllocatorProfileDeviceClass;
+
+	const DeviceClass& device_class() const override { return ObjectAllocatorProfileDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass ObjectAllocatorProfileDevice::ObjectAllocatorProfileDeviceClass(Device::RootDeviceClass, "objprof");
+
+/**
+ * An open profile file.  Call sites are reported as return addresses, which can be
+ * resolved against the kernel image with addr2line.
+ */
+class ObjectAllocatorProfileFile : public TextFile
+{
+public:
+	ObjectAllocatorProfileFile()
+	{
+		ObjectAllocator& objalloc = sys.mm().objalloc();
+		if (!objalloc.profiling()) {
+			append("profiling not enabled (objalloc.profile=1)\n");
+			return;
+		}
+
+		ObjectAllocatorProfile p;
+		objalloc.get_profile(p);
+
+		append("max-size allocs bytes\n");
+		for (unsigned int i = 0; i < OBJALLOC_PROFILE_SIZE_BUCKETS; i++) {
+			if (!p.nr_allocs[i]) continue;
+
+			append("%lu %llu %llu\n", 1ul << i, p.nr_allocs[i], p.nr_bytes[i]);
+		}
+
+		append("samples %llu (1 in %u), dropped %llu\n", p.nr_samples, OBJALLOC_PROFILE_PERIOD, p.nr_dropped_samples);
+
+		unsigned int nr_sites = objalloc.get_call_sites(_sites, CALL_SITES_REPORTED);
+
+		append("caller samples bytes\n");
+		for (unsigned int i = 0; i < nr_sites; i++) {
+			append("%p %llu %llu\n", _sites[i].caller, _sites[i].nr_samples, _sites[i].nr_bytes);
+		}
+	}
+
+private:
+	AllocCallSite _sites[CALL_SITES_REPORTED];
+};
+
+File *ObjectAllocatorProfileDevice::open_as_file()
+{
+	return new ObjectAllocatorProfileFile();
+}
+
+RegisterDevice(ObjectAllocatorProfileDevice);
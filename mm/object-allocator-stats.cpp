@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/object-allocator-stats.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/object-allocator.h>
+#include <infos/mm/mm.h>
+#include <infos/kernel/kernel.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/stats.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::fs;
+using namespace infos::util;
+
+/**
+ * A pseudo-device (/dev/objalloc0) that reports the object allocator's statistics as text.
+ */
+class ObjectAllocatorStatsDevice : public Device
+{
+public:
+	static const DeviceClass ObjectAllocatorStatsDeviceClass;
+
+	const DeviceClass& device_class() const override { return ObjectAllocatorStatsDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass ObjectAllocatorStatsDevice::ObjectAllocatorStatsDeviceClass(Device::RootDeviceClass, "objalloc");
+
+/**
+ * The statistics (also /dev/stats/objalloc): the magazine hit rate of each size class,
+ * and the accounting for each heap arena.
+ */
+RegisterStatistics(objalloc, "objalloc")
+{
+	ObjectAllocatorStats stats;
+	sys.mm().objalloc().get_stats(stats);
+
+	out.append("size alloc-hits alloc-misses free-hits free-misses depot-full depot-empty in-use\n");
+	for (unsigned int i = 0; i < OBJALLOC_NR_SIZE_CLASSES; i++) {
+		out.append("%u %llu %llu %llu %llu %u %u %llu\n", 1u << (i + OBJALLOC_MIN_CLASS_BITS),
+				stats.alloc_hits[i], stats.alloc_misses[i],
+				stats.free_hits[i], stats.free_misses[i],
+				stats.nr_full_magazines[i], stats.nr_empty_magazines[i],
+				stats.nr_in_use[i]);
+	}
+
+	out.append("arena in-use peak footprint allocs frees\n");
+	for (unsigned int i = 0; i < NR_HEAP_ARENAS; i++) {
+		HeapArenaStats arena_stats;
+		sys.mm().objalloc().get_arena_stats((HeapArena::HeapArena)i, arena_stats);
+
+		out.append("%s %llu %llu %llu %llu %llu\n", arena_stats.name,
+				arena_stats.bytes_in_use, arena_stats.peak_bytes_in_use, arena_stats.footprint,
+				arena_stats.nr_allocs, arena_stats.nr_frees);
+	}
+}
+
+File *ObjectAllocatorStatsDevice::open_as_file()
+{
+	return new StatisticsFile(__stats_regobjalloc);
+}
+
+RegisterDevice(ObjectAllocatorStatsDevice);
@@ -10,9 +10,15 @@
  */
 #include <infos/mm/object-allocator.h>
 #include <infos/mm/mm.h>
+#include <infos/mm/slab.h>
+#include <infos/mm/reclaim.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/kernel.h>
+#include <arch/arch.h>
 #include <infos/util/lock.h>
 #include <infos/util/cmdline.h>
 #include <infos/util/string.h>
+#include <infos/util/math.h>
 
 using namespace infos::mm;
 using namespace infos::kernel;
@@ -28,32 +34,575 @@ RegisterCmdLineArgument(ObjAllocDebug, "objalloc.debug") {
 	}
 }
 
-ObjectAllocator::ObjectAllocator(MemoryManager& mm) : Allocator(mm)
+static bool do_profile;
+
+RegisterCmdLineArgument(ObjAllocProfile, "objalloc.profile") {
+	do_profile = (strncmp(value, "1", 1) == 0);
+}
+
+ObjectAllocator::ObjectAllocator(MemoryManager& mm)
+	: Allocator(mm),
+	_arenas(),
+	_depot_full(),
+	_depot_empty(),
+	_nr_depot_full(),
+	_nr_depot_empty(),
+	_alloc_hits(),
+	_alloc_misses(),
+	_free_hits(),
+	_free_misses(),
+	_deferred_frees(NULL)
 {
+	_mtx.set_name("objalloc");
+
+	for (unsigned int i = 0; i < NR_HEAP_ARENAS; i++) {
+		_arenas[i].mtx.set_name("objalloc-arena");
+	}
 }
 
+typedef void *mspace;
+
+extern "C" mspace create_mspace(size_t capacity, int locked);
+extern "C" void *mspace_malloc(mspace msp, size_t size);
+extern "C" void *mspace_calloc(mspace msp, size_t nr, size_t size);
+extern "C" void mspace_free(mspace msp, void *ptr);
+extern "C" size_t mspace_usable_size(const void *ptr);
+extern "C" size_t mspace_footprint(mspace msp);
+extern "C" mspace mspace_of(const void *ptr);
+
+static const char *arena_names[] = {
+	"general",
+	"vfs",
+	"sched",
+	"drivers",
+	"elf",
+	"net",
+};
+
+static_assert(ARRAY_SIZE(arena_names) == NR_HEAP_ARENAS, "heap arena names");
+
 bool ObjectAllocator::init()
 {
+	for (unsigned int i = 0; i < NR_HEAP_ARENAS; i++) {
+		// The arenas do their own locking, so the mspaces don't need to.
+		_arenas[i].mspace = create_mspace(0, 0);
+		if (!_arenas[i].mspace) {
+			objalloc_log.messagef(LogLevel::ERROR, "Unable to create the %s heap arena", arena_names[i]);
+			return false;
+		}
+	}
+	
 	return true;
 }
 
-extern "C" void *dlmalloc(size_t size);
-extern "C" void dlfree(void *ptr);
+// Small allocations are served from power-of-two size-class slab caches, which
+// avoids the heap's per-chunk overhead for things like list and map nodes and
+// small strings.
+static SlabCache size_caches[] = {
+	SlabCache("size-16", 16),
+	SlabCache("size-32", 32),
+	SlabCache("size-64", 64),
+	SlabCache("size-128", 128),
+	SlabCache("size-256", 256),
+	SlabCache("size-512", 512),
+};
 
-void *ObjectAllocator::alloc(size_t size, AllocFlags::AllocFlags flags)
+static_assert(ARRAY_SIZE(size_caches) == OBJALLOC_NR_SIZE_CLASSES, "size class caches");
+
+// Magazines themselves come from a slab cache.
+static SlabCache magazine_cache("magazine", sizeof(ObjectMagazine));
+
+// The depot keeps at most this many full (and empty) magazines per size class.  Any
+// more than that, and the objects (or magazines) are given back to the slab caches.
+#define DEPOT_MAX_MAGAZINES		8
+
+/**
+ * Returns the size class of a slab cache, or -1 if it is not a size class cache.
+ */
+static inline int size_class_of(const SlabCache *cache)
 {
-	UniqueLock<Mutex> l(_mtx);
+	if (cache >= &size_caches[0] && cache < &size_caches[OBJALLOC_NR_SIZE_CLASSES]) {
+		return cache - &size_caches[0];
+	}
+	
+	return -1;
+}
+
+void *ObjectAllocator::alloc(size_t size, AllocFlags::AllocFlags flags, HeapArena::HeapArena arena, const void *caller)
+{
+	if (__builtin_expect(do_profile, 0)) {
+		profile_alloc(size, caller ? caller : __builtin_return_address(0));
+	}
 	
-	void *ptr = dlmalloc(size);
+	bool atomic = !!(flags & AllocFlags::ATOMIC);
 	
-	objalloc_log.messagef(LogLevel::DEBUG, "alloc: %lu (%u) = %p", size, flags, ptr);
+	if (!atomic && _deferred_frees) {
+		drain_deferred_frees();
+	}
+	
+	void *ptr;
+	
+	if (arena == HeapArena::GENERAL && size <= (1u << OBJALLOC_MAX_CLASS_BITS)) {
+		unsigned int bits = size <= (1u << OBJALLOC_MIN_CLASS_BITS) ? OBJALLOC_MIN_CLASS_BITS : ilog2_ceil((uint32_t)size);
+		ptr = alloc_small(bits - OBJALLOC_MIN_CLASS_BITS, atomic);
+		
+		if (ptr && (flags & AllocFlags::ZERO)) {
+			bzero(ptr, size);
+		}
+	} else if (atomic) {
+		// The arenas may need to go to the page allocator.
+		ptr = NULL;
+	} else {
+		ptr = arena_alloc(arena, size, !!(flags & AllocFlags::ZERO));
+	}
+	
+	LOG_MESSAGEF(objalloc_log, LogLevel::DEBUG, "alloc: %lu (%u) arena=%u = %p", size, flags, arena, ptr);
 	return ptr;
 }
 
 void ObjectAllocator::free(void* ptr)
+{
+	if (!ptr) return;
+	
+	LOG_MESSAGEF(objalloc_log, LogLevel::DEBUG, "free: %p", ptr);
+	
+	// With interrupts disabled (e.g. in an IRQ handler), no locks may be waited for, so
+	// anything that doesn't fit in this CPU's magazines is freed later.
+	if (!sys.arch().interrupts_enabled()) {
+		int size_class = size_class_of(SlabCache::cache_of(ptr));
+		if (size_class < 0 || !free_small(size_class, ptr, true)) {
+			defer_free(ptr);
+		}
+		
+		return;
+	}
+	
+	if (_deferred_frees) {
+		drain_deferred_frees();
+	}
+	
+	free_now(ptr);
+}
+
+/**
+ * Frees an object, taking whatever locks are necessary.
+ */
+void ObjectAllocator::free_now(void *ptr)
+{
+	SlabCache *cache = SlabCache::cache_of(ptr);
+	if (cache) {
+		int size_class = size_class_of(cache);
+		if (size_class < 0) {
+			cache->free(ptr);
+		} else {
+			free_small(size_class, ptr, false);
+		}
+		
+		return;
+	}
+	
+	arena_free(ptr);
+}
+
+/**
+ * Allocates from an arena's mspace, and accounts for it.
+ */
+void *ObjectAllocator::arena_alloc(HeapArena::HeapArena arena, size_t size, bool zero)
+{
+	assert(arena < NR_HEAP_ARENAS);
+	Arena& a = _arenas[arena];
+	
+	if (!a.mspace) return NULL;
+	
+	UniqueLock<Mutex> l(a.mtx);
+	
+	// mspace_calloc knows when a chunk is fresh from the page allocator (which is
+	// already zeroed), and only clears memory that is being reused.
+	void *ptr = zero ? mspace_calloc(a.mspace, 1, size) : mspace_malloc(a.mspace, size);
+	if (!ptr) return NULL;
+	
+	a.nr_allocs++;
+	a.bytes_in_use += mspace_usable_size(ptr);
+	if (a.bytes_in_use > a.peak_bytes_in_use) {
+		a.peak_bytes_in_use = a.bytes_in_use;
+	}
+	
+	return ptr;
+}
+
+/**
+ * Frees a chunk back to the arena that it came from.
+ */
+void ObjectAllocator::arena_free(void *ptr)
+{
+	mspace msp = mspace_of(ptr);
+	
+	for (unsigned int i = 0; i < NR_HEAP_ARENAS; i++) {
+		Arena& a = _arenas[i];
+		if (a.mspace != msp) continue;
+		
+		UniqueLock<Mutex> l(a.mtx);
+		
+		a.nr_frees++;
+		a.bytes_in_use -= mspace_usable_size(ptr);
+		mspace_free(a.mspace, ptr);
+		return;
+	}
+	
+	objalloc_log.messagef(LogLevel::ERROR, "free: %p is not from any heap arena", ptr);
+	assert(false);
+}
+
+void ObjectAllocator::defer_free(void *ptr)
+{
+	UniqueIRQLock l;
+	
+	*(void **)ptr = _deferred_frees;
+	_deferred_frees = ptr;
+}
+
+void ObjectAllocator::drain_deferred_frees()
+{
+	void *ptr;
+	
+	{
+		UniqueIRQLock l;
+		
+		ptr = _deferred_frees;
+		_deferred_frees = NULL;
+	}
+	
+	while (ptr) {
+		void *next = *(void **)ptr;
+		free_now(ptr);
+		ptr = next;
+	}
+}
+
+/**
+ * Counts an object of the given size class that went straight to (or from) the slab
+ * cache, rather than through a magazine, as in use (or not), on this CPU.
+ */
+static inline void *count_in_use(unsigned int size_class, void *ptr, int delta)
+{
+	if (ptr) {
+		UniqueIRQLock l;
+		CPU::current().magazines(size_class).nr_in_use += delta;
+	}
+	
+	return ptr;
+}
+
+/**
+ * Allocates an object of the given size class.  The fast path only touches this CPU's
+ * magazines, with interrupts disabled; the depot (and its lock) is only involved when
+ * both of them are empty.
+ */
+void *ObjectAllocator::alloc_small(unsigned int size_class, bool atomic)
+{
+	{
+		UniqueIRQLock l;
+		
+		MagazineCache& mc = CPU::current().magazines(size_class);
+		if (mc.loaded && mc.loaded->count) {
+			_alloc_hits[size_class]++;
+			mc.nr_in_use++;
+			return mc.loaded->objects[--mc.loaded->count];
+		}
+		
+		if (mc.previous && mc.previous->count) {
+			ObjectMagazine *magazine = mc.previous;
+			mc.previous = mc.loaded;
+			mc.loaded = magazine;
+			
+			_alloc_hits[size_class]++;
+			mc.nr_in_use++;
+			return mc.loaded->objects[--mc.loaded->count];
+		}
+		
+		_alloc_misses[size_class]++;
+	}
+	
+	// An atomic allocation can't wait for the depot, so it can only try the slabs that
+	// already exist.
+	if (atomic) {
+		return count_in_use(size_class, size_caches[size_class].alloc(true), 1);
+	}
+	
+	// Exchange for a full magazine from the depot.  If there isn't one, go straight to
+	// the slab cache.
+	ObjectMagazine *full = depot_get(size_class, true);
+	if (!full) {
+		return count_in_use(size_class, size_caches[size_class].alloc(), 1);
+	}
+	
+	ObjectMagazine *displaced;
+	void *ptr;
+	
+	{
+		UniqueIRQLock l;
+		
+		MagazineCache& mc = CPU::current().magazines(size_class);
+		displaced = mc.previous;
+		mc.previous = mc.loaded;
+		mc.loaded = full;
+		
+		mc.nr_in_use++;
+		ptr = mc.loaded->objects[--mc.loaded->count];
+	}
+	
+	if (displaced) {
+		depot_put(size_class, displaced);
+	}
+	
+	return ptr;
+}
+
+/**
+ * Frees an object of the given size class, by putting it in one of this CPU's magazines.
+ * @return Returns false if 'atomic' is set, and the object would have to go to the depot.
+ */
+bool ObjectAllocator::free_small(unsigned int size_class, void *ptr, bool atomic)
+{
+	{
+		UniqueIRQLock l;
+		
+		MagazineCache& mc = CPU::current().magazines(size_class);
+		if (mc.loaded && mc.loaded->count < MAGAZINE_SIZE) {
+			_free_hits[size_class]++;
+			mc.nr_in_use--;
+			mc.loaded->objects[mc.loaded->count++] = ptr;
+			return true;
+		}
+		
+		if (mc.previous && mc.previous->count < MAGAZINE_SIZE) {
+			ObjectMagazine *magazine = mc.previous;
+			mc.previous = mc.loaded;
+			mc.loaded = magazine;
+			
+			_free_hits[size_class]++;
+			mc.nr_in_use--;
+			mc.loaded->objects[mc.loaded->count++] = ptr;
+			return true;
+		}
+		
+		_free_misses[size_class]++;
+	}
+	
+	if (atomic) {
+		return false;
+	}
+	
+	// Exchange for an empty magazine from the depot, or make a new one.  If that isn't
+	// possible, go straight to the slab cache.
+	ObjectMagazine *empty = depot_get(size_class, false);
+	if (!empty) {
+		empty = (ObjectMagazine *)magazine_cache.alloc();
+		if (!empty) {
+			count_in_use(size_class, ptr, -1);
+			size_caches[size_class].free(ptr);
+			return true;
+		}
+		
+		empty->next = NULL;
+		empty->count = 0;
+	}
+	
+	ObjectMagazine *displaced;
+	
+	{
+		UniqueIRQLock l;
+		
+		MagazineCache& mc = CPU::current().magazines(size_class);
+		displaced = mc.previous;
+		mc.previous = mc.loaded;
+		mc.loaded = empty;
+		
+		mc.nr_in_use--;
+		mc.loaded->objects[mc.loaded->count++] = ptr;
+	}
+	
+	if (displaced) {
+		depot_put(size_class, displaced);
+	}
+	
+	return true;
+}
+
+/**
+ * Takes a full (or empty) magazine out of the depot.
+ * @return Returns the magazine, or NULL if the depot does not have one.
+ */
+ObjectMagazine *ObjectAllocator::depot_get(unsigned int size_class, bool full)
 {
 	UniqueLock<Mutex> l(_mtx);
 	
-	objalloc_log.messagef(LogLevel::DEBUG, "free: %p", ptr);
-	dlfree(ptr);
+	ObjectMagazine *& list = full ? _depot_full[size_class] : _depot_empty[size_class];
+	unsigned int& nr = full ? _nr_depot_full[size_class] : _nr_depot_empty[size_class];
+	
+	ObjectMagazine *magazine = list;
+	if (magazine) {
+		list = magazine->next;
+		nr--;
+	}
+	
+	return magazine;
+}
+
+/**
+ * Puts a magazine that has been taken off a CPU back in the depot.  It need not be
+ * completely full or empty: a partly filled magazine is treated as full, unless the
+ * depot already has enough of those, in which case its objects go back to the slab
+ * cache.
+ */
+void ObjectAllocator::depot_put(unsigned int size_class, ObjectMagazine *magazine)
+{
+	UniqueLock<Mutex> l(_mtx);
+	
+	if (magazine->count && _nr_depot_full[size_class] < DEPOT_MAX_MAGAZINES) {
+		magazine->next = _depot_full[size_class];
+		_depot_full[size_class] = magazine;
+		_nr_depot_full[size_class]++;
+		return;
+	}
+	
+	while (magazine->count) {
+		size_caches[size_class].free(magazine->objects[--magazine->count]);
+	}
+	
+	if (_nr_depot_empty[size_class] < DEPOT_MAX_MAGAZINES) {
+		magazine->next = _depot_empty[size_class];
+		_depot_empty[size_class] = magazine;
+		_nr_depot_empty[size_class]++;
+	} else {
+		magazine_cache.free(magazine);
+	}
+}
+
+uint64_t ObjectAllocator::shrink_depot(uint64_t nr_frames)
+{
+	if (!_mtx.try_lock()) return 0;
+
+	uint64_t nr_slabs = magazine_cache.nr_slabs();
+	for (unsigned int i = 0; i < OBJALLOC_NR_SIZE_CLASSES; i++) {
+		nr_slabs += size_caches[i].nr_slabs();
+	}
+
+	for (unsigned int i = 0; i < OBJALLOC_NR_SIZE_CLASSES; i++) {
+		while (ObjectMagazine *magazine = _depot_full[i]) {
+			_depot_full[i] = magazine->next;
+			_nr_depot_full[i]--;
+
+			while (magazine->count) {
+				size_caches[i].free(magazine->objects[--magazine->count]);
+			}
+
+			magazine_cache.free(magazine);
+		}
+	}
+
+	uint64_t nr_left = magazine_cache.nr_slabs();
+	for (unsigned int i = 0; i < OBJALLOC_NR_SIZE_CLASSES; i++) {
+		nr_left += size_caches[i].nr_slabs();
+	}
+
+	_mtx.unlock();
+
+	// Slabs are single frames.
+	return nr_slabs - nr_left;
+}
+
+static Shrinker object_depot_shrinker("objalloc-depot", [](uint64_t nr_frames) { return sys.mm().objalloc().shrink_depot(nr_frames); });
+
+bool ObjectAllocator::profiling() const
+{
+	return do_profile;
+}
+
+void ObjectAllocator::get_stats(ObjectAllocatorStats& stats)
+{
+	UniqueLock<Mutex> l(_mtx);
+	UniqueIRQLock irq;
+	
+	for (unsigned int i = 0; i < OBJALLOC_NR_SIZE_CLASSES; i++) {
+		stats.alloc_hits[i] = _alloc_hits[i];
+		stats.alloc_misses[i] = _alloc_misses[i];
+		stats.free_hits[i] = _free_hits[i];
+		stats.free_misses[i] = _free_misses[i];
+		stats.nr_full_magazines[i] = _nr_depot_full[i];
+		stats.nr_empty_magazines[i] = _nr_depot_empty[i];
+	}
+	
+	count_size_classes(stats.nr_in_use);
+}
+
+/**
+ * Adds up the objects of each size class that the CPUs have handed out.  The CPUs'
+ * counts are read without stopping them, so the totals are only a snapshot.
+ */
+void ObjectAllocator::count_size_classes(uint64_t *nr_in_use)
+{
+	for (unsigned int i = 0; i < OBJALLOC_NR_SIZE_CLASSES; i++) {
+		int64_t total = 0;
+		for (unsigned int cpu = 0; cpu < sys.arch().nr_cpus(); cpu++) {
+			total += __atomic_load_n(&sys.arch().get_cpu(cpu).magazines(i).nr_in_use, __ATOMIC_RELAXED);
+		}
+		
+		nr_in_use[i] = total > 0 ? total : 0;
+	}
+}
+
+void ObjectAllocator::get_arena_stats(HeapArena::HeapArena arena, HeapArenaStats& stats)
+{
+	assert(arena < NR_HEAP_ARENAS);
+	Arena& a = _arenas[arena];
+	
+	{
+		UniqueLock<Mutex> l(a.mtx);
+		
+		stats.name = arena_names[arena];
+		stats.bytes_in_use = a.bytes_in_use;
+		stats.peak_bytes_in_use = a.peak_bytes_in_use;
+		stats.footprint = a.mspace ? mspace_footprint(a.mspace) : 0;
+		stats.nr_allocs = a.nr_allocs;
+		stats.nr_frees = a.nr_frees;
+	}
+	
+	stats.size_class_bytes = 0;
+	if (arena == HeapArena::GENERAL) {
+		uint64_t nr_in_use[OBJALLOC_NR_SIZE_CLASSES];
+		count_size_classes(nr_in_use);
+		
+		for (unsigned int i = 0; i < OBJALLOC_NR_SIZE_CLASSES; i++) {
+			stats.size_class_bytes += nr_in_use[i] << (i + OBJALLOC_MIN_CLASS_BITS);
+		}
+	}
+}
+
+void ObjectAllocator::dump_state()
+{
+	ObjectAllocatorStats stats;
+	get_stats(stats);
+	
+	for (unsigned int i = 0; i < OBJALLOC_NR_SIZE_CLASSES; i++) {
+		uint64_t allocs = stats.alloc_hits[i] + stats.alloc_misses[i];
+		uint64_t frees = stats.free_hits[i] + stats.free_misses[i];
+		
+		objalloc_log.messagef(LogLevel::INFO, "%s: allocs=%llu (%llu%% hit) frees=%llu (%llu%% hit) depot full=%u empty=%u",
+				size_caches[i].name(),
+				allocs, allocs ? (stats.alloc_hits[i] * 100) / allocs : 0,
+				frees, frees ? (stats.free_hits[i] * 100) / frees : 0,
+				stats.nr_full_magazines[i], stats.nr_empty_magazines[i]);
+	}
+	
+	for (unsigned int i = 0; i < NR_HEAP_ARENAS; i++) {
+		HeapArenaStats arena_stats;
+		get_arena_stats((HeapArena::HeapArena)i, arena_stats);
+		
+		objalloc_log.messagef(LogLevel::INFO, "arena %s: in-use=%llu peak=%llu footprint=%llu allocs=%llu frees=%llu",
+				arena_stats.name, arena_stats.bytes_in_use, arena_stats.peak_bytes_in_use,
+				arena_stats.footprint, arena_stats.nr_allocs, arena_stats.nr_frees);
+	}
+	
+	SlabCache::dump_all();
 }
@@ -0,0 +1,236 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/packet-buffer.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/packet-buffer.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/slab.h>
+#include <infos/kernel/cpu.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::util;
+
+// A CPU's cache is filled from, and drained to, the shared pool this many buffers at a
+// time, and drained once it holds more than PKTBUF_CACHE_HIGH.
+#define PKTBUF_CACHE_BATCH		16
+#define PKTBUF_CACHE_HIGH		64
+
+static SlabCache packet_buffer_descriptors("pktbuf", sizeof(PacketBuffer));
+
+size_t PacketBuffer::packet_length() const
+{
+	size_t total = 0;
+	for (const PacketBuffer *b = this; b; b = b->next) {
+		total += b->length;
+	}
+
+	return total;
+}
+
+size_t PacketBuffer::copy_out(size_t offset, void *buffer, size_t size) const
+{
+	size_t copied = 0;
+	for (const PacketBuffer *b = this; b && copied < size; b = b->next) {
+		if (offset >= b->length) {
+			offset -= b->length;
+			continue;
+		}
+
+		size_t n = __min((size_t)b->length - offset, size - copied);
+		memcpy((uint8_t *)buffer + copied, b->data() + offset, n);
+		copied += n;
+		offset = 0;
+	}
+
+	return copied;
+}
+
+PacketBufferAllocator::PacketBufferAllocator(MemoryManager& mm)
+	: _mm(mm), _free(NULL), _nr_free(0), _nr_buffers(0), _nr_allocs(0), _nr_frees(0), _nr_atomic_failures(0)
+{
+
+}
+
+/**
+ * Makes buffers, each with a frame from the part of memory devices can reach, and puts
+ * them in the shared pool.  Not from an interrupt handler.
+ */
+bool PacketBufferAllocator::grow(unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		PacketBuffer *buffer = (PacketBuffer *)packet_buffer_descriptors.alloc();
+		if (!buffer) return false;
+
+		FrameDescriptor *frame = _mm.pgalloc().allocate_contiguous(1);
+		if (!frame) {
+			packet_buffer_descriptors.free(buffer);
+			return false;
+		}
+
+		buffer->base = (uint8_t *)_mm.pgalloc().pfdescr_to_vpa(frame);
+		buffer->base_pa = _mm.pgalloc().pfdescr_to_pa(frame);
+
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_lock);
+
+		buffer->next = _free;
+		_free = buffer;
+		_nr_free++;
+		_nr_buffers++;
+	}
+
+	return true;
+}
+
+bool PacketBufferAllocator::reserve(unsigned int count)
+{
+	unsigned int nr_free;
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_lock);
+		nr_free = _nr_free;
+	}
+
+	return nr_free >= count || grow(count - nr_free);
+}
+
+/**
+ * Takes a buffer from this CPU's cache, which is refilled from the shared pool when it is
+ * empty.  If the pool is empty too, more buffers are made, unless the allocation is atomic.
+ */
+PacketBuffer *PacketBufferAllocator::allocate(bool atomic)
+{
+	for (;;) {
+		PacketBuffer *buffer = NULL;
+
+		{
+			UniqueIRQLock irq;
+
+			PacketBufferCache& cache = CPU::current().packet_buffers();
+			if (!cache.count) {
+				UniqueLock<SpinLock> l(_lock);
+
+				while (_free && cache.count < PKTBUF_CACHE_BATCH) {
+					PacketBuffer *b = _free;
+					_free = b->next;
+					_nr_free--;
+
+					b->next = cache.head;
+					cache.head = b;
+					cache.count++;
+				}
+
+				if (!cache.count && atomic) _nr_atomic_failures++;
+			}
+
+			if (cache.count) {
+				buffer = cache.head;
+				cache.head = buffer->next;
+				cache.count--;
+			}
+		}
+
+		if (buffer) {
+			__atomic_add_fetch(&_nr_allocs, 1, __ATOMIC_RELAXED);
+
+			buffer->next = NULL;
+			buffer->next_packet = NULL;
+			buffer->refcount = 1;
+			buffer->offset = PacketBuffer::HEADROOM;
+			buffer->length = 0;
+			buffer->csum_start = 0;
+			buffer->csum_offset = 0;
+			buffer->gso_size = 0;
+			return buffer;
+		}
+
+		if (atomic || !grow(PKTBUF_CACHE_BATCH)) return NULL;
+	}
+}
+
+PacketBuffer *PacketBufferAllocator::allocate_chain(size_t size, bool atomic)
+{
+	PacketBuffer *head = NULL, **tail = &head;
+
+	do {
+		PacketBuffer *buffer = allocate(atomic);
+		if (!buffer) {
+			release(head);
+			return NULL;
+		}
+
+		*tail = buffer;
+		tail = &buffer->next;
+
+		size -= __min(size, buffer->tailroom());
+	} while (size);
+
+	return head;
+}
+
+/**
+ * Frees a buffer to this CPU's cache, and drains a batch of the cache to the shared pool
+ * if it has grown too big.
+ */
+void PacketBufferAllocator::free_one(PacketBuffer *buffer)
+{
+	__atomic_add_fetch(&_nr_frees, 1, __ATOMIC_RELAXED);
+
+	UniqueIRQLock irq;
+
+	PacketBufferCache& cache = CPU::current().packet_buffers();
+	buffer->next = cache.head;
+	cache.head = buffer;
+	cache.count++;
+
+	if (cache.count > PKTBUF_CACHE_HIGH) {
+		UniqueLock<SpinLock> l(_lock);
+
+		for (unsigned int i = 0; i < PKTBUF_CACHE_BATCH; i++) {
+			PacketBuffer *b = cache.head;
+			cache.head = b->next;
+			cache.count--;
+
+			b->next = _free;
+			_free = b;
+			_nr_free++;
+		}
+	}
+}
+
+void PacketBufferAllocator::release(PacketBuffer *chain)
+{
+	while (chain) {
+		PacketBuffer *next = chain->next;
+
+		if (__atomic_sub_fetch(&chain->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+			free_one(chain);
+		}
+
+		chain = next;
+	}
+}
+
+void PacketBufferAllocator::get_stats(PacketBufferStats& stats) const
+{
+	UniqueIRQLock irq;
+
+	stats.nr_cached = CPU::current().packet_buffers().count;
+
+	UniqueLock<SpinLock> l(_lock);
+	stats.nr_buffers = _nr_buffers;
+	stats.nr_free = _nr_free;
+	stats.nr_allocs = __atomic_load_n(&_nr_allocs, __ATOMIC_RELAXED);
+	stats.nr_frees = __atomic_load_n(&_nr_frees, __ATOMIC_RELAXED);
+	stats.nr_atomic_failures = _nr_atomic_failures;
+}
@@ -0,0 +1,228 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/page-allocator-benchmark.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/mm.h>
+#include <infos/util/lock.h>
+#include <arch/x86/msr.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+using namespace infos::arch::x86;
+
+// The number of timed operations of each kind, in each benchmark.
+#define BENCHMARK_SAMPLES		4096
+
+// The number of blocks kept allocated by the steady-state benchmark.
+#define BENCHMARK_WORKING_SET	256
+
+// Mixed-order benchmarks allocate blocks of order 0 .. BENCHMARK_MAX_ORDER.
+#define BENCHMARK_MAX_ORDER		4
+
+static uint64_t alloc_cycles[BENCHMARK_SAMPLES];
+static uint64_t free_cycles[BENCHMARK_SAMPLES];
+
+static FrameDescriptor *blocks[BENCHMARK_SAMPLES];
+static int block_orders[BENCHMARK_SAMPLES];
+
+static uint64_t rng_state;
+
+/**
+ * A xorshift pseudo-random number generator: the benchmarks only need the
+ * same sequence every time.
+ */
+static uint32_t next_random()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+
+	return (uint32_t)rng_state;
+}
+
+static void sort_samples(uint64_t *samples, unsigned int nr_samples)
+{
+	// Shell sort, with Ciura's gap sequence: there's no need for anything cleverer here.
+	static const unsigned int gaps[] = { 701, 301, 132, 57, 23, 10, 4, 1 };
+
+	for (unsigned int g = 0; g < ARRAY_SIZE(gaps); g++) {
+		unsigned int gap = gaps[g];
+
+		for (unsigned int i = gap; i < nr_samples; i++) {
+			uint64_t sample = samples[i];
+
+			unsigned int j = i;
+			for (; j >= gap && samples[j - gap] > sample; j -= gap) {
+				samples[j] = samples[j - gap];
+			}
+
+			samples[j] = sample;
+		}
+	}
+}
+
+static void report(const char *benchmark, const char *operation, uint64_t *samples, unsigned int nr_samples)
+{
+	if (nr_samples == 0) {
+		mm_log.messagef(LogLevel::INFO, "%s: %s: no samples", benchmark, operation);
+		return;
+	}
+
+	sort_samples(samples, nr_samples);
+
+	mm_log.messagef(LogLevel::INFO, "%s: %s: n=%u cycles/op p50=%llu p90=%llu p99=%llu max=%llu",
+			benchmark, operation, nr_samples,
+			samples[nr_samples / 2],
+			samples[(nr_samples * 90) / 100],
+			samples[(nr_samples * 99) / 100],
+			samples[nr_samples - 1]);
+}
+
+/**
+ * Runs a set of microbenchmarks against the page allocation algorithm, and reports
+ * the cost of each allocation and free in cycles.  Everything that is allocated is
+ * freed again, so this can be run before the system starts.
+ */
+void PageAllocator::benchmark()
+{
+	assert(_allocator_algorithm);
+
+	mm_log.messagef(LogLevel::IMPORTANT, "PAGE ALLOCATOR BENCHMARK (%s) - BEGIN", _allocator_algorithm->name());
+
+	UniqueLock<Mutex> l(_mtx);
+
+	rng_state = 0x2545f4914f6cdd1dull;
+
+	// (1) Steady state: keep a working set of mixed-order blocks allocated, and
+	// repeatedly replace a random one.
+	{
+		unsigned int nr_allocs = 0, nr_frees = 0;
+
+		for (unsigned int i = 0; i < BENCHMARK_WORKING_SET; i++) {
+			block_orders[i] = next_random() % (BENCHMARK_MAX_ORDER + 1);
+			blocks[i] = algorithm_allocate(block_orders[i]);
+		}
+
+		for (unsigned int i = 0; i < BENCHMARK_SAMPLES; i++) {
+			unsigned int slot = next_random() % BENCHMARK_WORKING_SET;
+
+			if (blocks[slot]) {
+				uint64_t start = __rdtsc();
+				algorithm_free(blocks[slot], block_orders[slot]);
+				free_cycles[nr_frees++] = __rdtsc() - start;
+			}
+
+			block_orders[slot] = next_random() % (BENCHMARK_MAX_ORDER + 1);
+
+			uint64_t start = __rdtsc();
+			blocks[slot] = algorithm_allocate(block_orders[slot]);
+			alloc_cycles[nr_allocs++] = __rdtsc() - start;
+		}
+
+		for (unsigned int i = 0; i < BENCHMARK_WORKING_SET; i++) {
+			if (blocks[i]) algorithm_free(blocks[i], block_orders[i]);
+		}
+
+		report("steady-state", "alloc", alloc_cycles, nr_allocs);
+		report("steady-state", "free", free_cycles, nr_frees);
+	}
+
+	// (2) Random stress: allocate lots of mixed-order blocks, then free them in
+	// a random order.
+	{
+		unsigned int nr_allocs = 0, nr_frees = 0;
+
+		for (unsigned int i = 0; i < BENCHMARK_SAMPLES; i++) {
+			block_orders[i] = next_random() % (BENCHMARK_MAX_ORDER + 1);
+
+			uint64_t start = __rdtsc();
+			blocks[i] = algorithm_allocate(block_orders[i]);
+			alloc_cycles[nr_allocs++] = __rdtsc() - start;
+		}
+
+		// Shuffle the blocks (Fisher-Yates).
+		for (unsigned int i = BENCHMARK_SAMPLES - 1; i > 0; i--) {
+			unsigned int j = next_random() % (i + 1);
+
+			FrameDescriptor *block = blocks[i];
+			blocks[i] = blocks[j];
+			blocks[j] = block;
+
+			int order = block_orders[i];
+			block_orders[i] = block_orders[j];
+			block_orders[j] = order;
+		}
+
+		for (unsigned int i = 0; i < BENCHMARK_SAMPLES; i++) {
+			if (!blocks[i]) continue;
+
+			uint64_t start = __rdtsc();
+			algorithm_free(blocks[i], block_orders[i]);
+			free_cycles[nr_frees++] = __rdtsc() - start;
+		}
+
+		report("random-stress", "alloc", alloc_cycles, nr_allocs);
+		report("random-stress", "free", free_cycles, nr_frees);
+	}
+
+	// (3) Fragmentation, then coalescing: allocate lots of single frames, free
+	// every other one, try to allocate larger blocks from what is left, and then
+	// free everything so that it can coalesce again.
+	{
+		const unsigned int nr_frames = BENCHMARK_SAMPLES / 2;
+		const int large_order = 3;
+
+		unsigned int nr_allocs = 0, nr_frees = 0, nr_failed = 0;
+
+		for (unsigned int i = 0; i < nr_frames; i++) {
+			blocks[i] = algorithm_allocate(0);
+		}
+
+		for (unsigned int i = 0; i < nr_frames; i += 2) {
+			if (!blocks[i]) continue;
+
+			uint64_t start = __rdtsc();
+			algorithm_free(blocks[i], 0);
+			free_cycles[nr_frees++] = __rdtsc() - start;
+
+			blocks[i] = NULL;
+		}
+
+		for (unsigned int i = nr_frames; i < BENCHMARK_SAMPLES; i++) {
+			uint64_t start = __rdtsc();
+			blocks[i] = algorithm_allocate(large_order);
+			alloc_cycles[nr_allocs++] = __rdtsc() - start;
+
+			if (!blocks[i]) nr_failed++;
+		}
+
+		report("fragment", "free", free_cycles, nr_frees);
+		report("fragment", "alloc (order 3)", alloc_cycles, nr_allocs);
+		mm_log.messagef(LogLevel::INFO, "fragment: %u order 3 allocation(s) failed", nr_failed);
+
+		nr_frees = 0;
+		for (unsigned int i = 1; i < nr_frames; i += 2) {
+			if (!blocks[i]) continue;
+
+			uint64_t start = __rdtsc();
+			algorithm_free(blocks[i], 0);
+			free_cycles[nr_frees++] = __rdtsc() - start;
+		}
+
+		for (unsigned int i = nr_frames; i < BENCHMARK_SAMPLES; i++) {
+			if (blocks[i]) algorithm_free(blocks[i], large_order);
+		}
+
+		report("coalesce", "free", free_cycles, nr_frees);
+	}
+
+	mm_log.messagef(LogLevel::IMPORTANT, "PAGE ALLOCATOR BENCHMARK - COMPLETE");
+}
@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/page-allocator-dma.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/mm.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+static bool do_dma_zone = true;
+
+RegisterCmdLineArgument(PageAllocDMAZone, "pgalloc.dma-zone")
+{
+	if (strncmp(value, "0", 2) == 0)
+	{
+		do_dma_zone = false;
+	}
+	else
+	{
+		do_dma_zone = true;
+	}
+}
+
+static inline bool dma_zone_frame_in_use(const uint64_t *map, uint64_t idx)
+{
+	return !!(map[idx / 64] & (1ull << (idx % 64)));
+}
+
+static inline void dma_zone_mark(uint64_t *map, uint64_t idx, uint64_t count, bool in_use)
+{
+	for (uint64_t i = idx; i < idx + count; i++)
+	{
+		if (in_use)
+		{
+			map[i / 64] |= 1ull << (i % 64);
+		}
+		else
+		{
+			map[i / 64] &= ~(1ull << (i % 64));
+		}
+	}
+}
+
+/**
+ * Takes a block of DMA_ZONE_FRAMES contiguous frames from the algorithm, to use as the
+ * DMA zone.  The frames stay allocated as far as the algorithm is concerned; which of
+ * them are in use is tracked by the zone's own bitmap.
+ */
+void PageAllocator::setup_dma_zone()
+{
+	if (!do_dma_zone)
+		return;
+
+	FrameDescriptor *pfdescr = algorithm_allocate(DMA_ZONE_ORDER);
+	if (!pfdescr)
+	{
+		mm_log.messagef(LogLevel::WARNING, "Unable to reserve the DMA zone");
+		return;
+	}
+
+	if (pfdescr_to_pa(pfdescr) + (DMA_ZONE_FRAMES << __page_bits) > DMA_ZONE_LIMIT)
+	{
+		mm_log.messagef(LogLevel::WARNING, "No memory below 4 GiB for the DMA zone");
+		algorithm_free(pfdescr, DMA_ZONE_ORDER);
+		return;
+	}
+
+	_dma_zone_base = pfdescr_to_pfn(pfdescr);
+	_dma_zone_frames = DMA_ZONE_FRAMES;
+	bzero(_dma_zone_map, sizeof(_dma_zone_map));
+
+	mm_log.messagef(LogLevel::INFO, "DMA zone: %lx--%lx (%llu kB)",
+			pfn_to_pa(_dma_zone_base), pfn_to_pa(_dma_zone_base + _dma_zone_frames), KB(_dma_zone_frames << __page_bits));
+}
+
+/**
+ * Allocates physically contiguous frames from the DMA zone.  The search is first-fit over
+ * the zone's bitmap, so its cost is bounded by the size of the zone, however fragmented
+ * the rest of memory is.
+ * @param nr_frames The number of contiguous frames to allocate
+ * @param limit The physical address that the allocation must end at or below
+ * @param alignment The (power of two) alignment, in bytes, of the physical address of the first frame
+ * @return Returns the descriptor of the first frame, or NULL if the allocation could not be satisfied.
+ */
+FrameDescriptor *PageAllocator::allocate_contiguous(uint64_t nr_frames, phys_addr_t limit, uint64_t alignment)
+{
+	if (nr_frames == 0 || nr_frames > _dma_zone_frames)
+		return NULL;
+
+	uint64_t align_frames = alignment >> __page_bits;
+	if (align_frames == 0)
+	{
+		align_frames = 1;
+	}
+
+	assert((align_frames & (align_frames - 1)) == 0);
+
+	UniqueLock<Mutex> l(_dma_zone_mtx);
+
+	// Start at the first suitably aligned frame in the zone.
+	pfn_t pfn = __align_up(_dma_zone_base, align_frames);
+	pfn_t zone_end = _dma_zone_base + _dma_zone_frames;
+
+	while (pfn + nr_frames <= zone_end && pfn_to_pa(pfn + nr_frames) <= limit)
+	{
+		uint64_t idx = pfn - _dma_zone_base;
+
+		// Look for a frame in use in the candidate run, and if there is one, move the candidate
+		// past it.
+		uint64_t conflict = nr_frames;
+		for (uint64_t i = 0; i < nr_frames; i++)
+		{
+			if (dma_zone_frame_in_use(_dma_zone_map, idx + i))
+			{
+				conflict = i;
+				break;
+			}
+		}
+
+		if (conflict == nr_frames)
+		{
+			dma_zone_mark(_dma_zone_map, idx, nr_frames, true);
+
+			LOG_MESSAGEF(pgalloc_log, LogLevel::DEBUG, "alloc-contiguous: count=%llu, pa=%lx", nr_frames, pfn_to_pa(pfn));
+			return &_pf_descriptors[pfn];
+		}
+
+		pfn = __align_up(pfn + conflict + 1, align_frames);
+	}
+
+	mm_log.messagef(LogLevel::WARNING, "Unable to allocate %llu contiguous frame(s) from the DMA zone", nr_frames);
+	return NULL;
+}
+
+/**
+ * Frees frames allocated by allocate_contiguous().
+ * @param pfdescr The descriptor of the first frame
+ * @param nr_frames The number of frames, which must be the number that was allocated
+ */
+void PageAllocator::free_contiguous(FrameDescriptor *pfdescr, uint64_t nr_frames)
+{
+	pfn_t pfn = pfdescr_to_pfn(pfdescr);
+	assert(pfn >= _dma_zone_base && pfn + nr_frames <= _dma_zone_base + _dma_zone_frames);
+
+	UniqueLock<Mutex> l(_dma_zone_mtx);
+
+	uint64_t idx = pfn - _dma_zone_base;
+	for (uint64_t i = 0; i < nr_frames; i++)
+	{
+		assert(dma_zone_frame_in_use(_dma_zone_map, idx + i));
+	}
+
+	dma_zone_mark(_dma_zone_map, idx, nr_frames, false);
+
+	LOG_MESSAGEF(pgalloc_log, LogLevel::DEBUG, "free-contiguous: count=%llu, pa=%lx", nr_frames, pfn_to_pa(pfn));
+}
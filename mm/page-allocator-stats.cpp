@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/page-allocator-stats.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/mm.h>
+#include <infos/kernel/kernel.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/stats.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::fs;
+using namespace infos::util;
+
+/**
+ * A pseudo-device (/dev/pgalloc0) that reports the page allocator's statistics as text.
+ */
+class PageAllocatorStatsDevice : public Device
+{
+public:
+	static const DeviceClass PageAllocatorStatsDeviceClass;
+
+	const DeviceClass& device_class() const override { return PageAllocatorStatsDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass PageAllocatorStatsDevice::PageAllocatorStatsDeviceClass(Device::RootDeviceClass, "pgalloc");
+
+/**
+ * The statistics, which are also /dev/stats/pgalloc.  They are gathered afresh for each
+ * read, so a read of the whole file is consistent.
+ */
+RegisterStatistics(pgalloc, "pgalloc")
+{
+	PageAllocatorStats stats;
+	if (!sys.mm().pgalloc().get_stats(stats)) {
+		out.append("statistics not available\n");
+		return;
+	}
+
+	out.append("algorithm %s\n", sys.mm().pgalloc().algorithm()->name());
+	out.append("free-frames %llu\n", stats.nr_free_frames);
+	out.append("largest-free-order %d\n", stats.largest_free_order);
+	out.append("cached-frames %llu\n", stats.nr_cached_frames);
+	out.append("zeroed-frames %llu\n", stats.nr_zeroed_frames);
+	out.append("allocs %llu\n", stats.nr_allocs);
+	out.append("frees %llu\n", stats.nr_frees);
+	out.append("splits %llu\n", stats.nr_splits);
+	out.append("merges %llu\n", stats.nr_merges);
+
+	out.append("order free-blocks failed-allocs\n");
+	for (int order = 0; order < PageAllocatorStats::NR_ORDERS; order++) {
+		if (!stats.nr_free_blocks[order] && !stats.nr_failed_allocs[order]) continue;
+
+		out.append("%d %llu %llu\n", order, stats.nr_free_blocks[order], stats.nr_failed_allocs[order]);
+	}
+}
+
+File *PageAllocatorStatsDevice::open_as_file()
+{
+	return new StatisticsFile(__stats_regpgalloc);
+}
+
+RegisterDevice(PageAllocatorStatsDevice);
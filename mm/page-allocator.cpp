@@ -10,9 +10,14 @@
  */
 #include <infos/mm/page-allocator.h>
 #include <infos/mm/mm.h>
+#include <infos/mm/reclaim.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/process.h>
+#include <infos/kernel/thread.h>
 #include <infos/util/string.h>
 #include <infos/util/lock.h>
 #include <infos/util/cmdline.h>
+#include <infos/util/math.h>
 
 extern char _IMAGE_START, _IMAGE_END;
 extern char _STACK_START, _STACK_END;
@@ -25,6 +30,8 @@ using namespace infos::util;
 ComponentLog infos::mm::pgalloc_log(syslog, "pgalloc");
 
 static bool do_self_test;
+static bool do_benchmark;
+static bool do_deferred_init = true;
 
 RegisterCmdLineArgument(PageAllocDebug, "pgalloc.debug")
 {
@@ -50,8 +57,71 @@ RegisterCmdLineArgument(PageAllocSelfTest, "pgalloc.self-test")
 	}
 }
 
-PageAllocator::PageAllocator(MemoryManager &mm) : Allocator(mm), _pf_descriptors(NULL)
+RegisterCmdLineArgument(PageAllocBenchmark, "pgalloc.benchmark")
 {
+	if (strncmp(value, "1", 2) == 0)
+	{
+		do_benchmark = true;
+	}
+	else
+	{
+		do_benchmark = false;
+	}
+}
+
+RegisterCmdLineArgument(PageAllocDeferredInit, "pgalloc.deferred-init")
+{
+	if (strncmp(value, "0", 2) == 0)
+	{
+		do_deferred_init = false;
+	}
+	else
+	{
+		do_deferred_init = true;
+	}
+}
+
+/* The frames that are set aside at boot, before the page allocator works: their
+ * descriptors are made RESERVED as they are initialised, rather than being made
+ * available and then taken out of the algorithm again. */
+struct BootReservation
+{
+	pfn_t start, end;
+	const char *what;
+};
+
+#define MAX_BOOT_RESERVATIONS	16
+
+static BootReservation boot_reservations[MAX_BOOT_RESERVATIONS] = {
+	{ 0, 1, "page zero" },									// We can do without it.
+	{ 1, 7, "initial page tables" },
+	{ 7, 8, "CPU startup page" },							// See arch/x86/smp.cpp
+};
+
+static unsigned int nr_boot_reservations = 3;
+
+/**
+ * Sets aside the frames in [start, end), e.g. those the boot loader put something in, so
+ * that they never become available.  This must be called before init().
+ * @return Returns false if there are too many reservations.
+ */
+bool PageAllocator::reserve_at_boot(pfn_t start, pfn_t end, const char *what)
+{
+	if (nr_boot_reservations >= MAX_BOOT_RESERVATIONS)
+	{
+		mm_log.messagef(LogLevel::ERROR, "Too many boot reservations for %s", what);
+		return false;
+	}
+
+	boot_reservations[nr_boot_reservations++] = { start, end, what };
+	return true;
+}
+
+PageAllocator::PageAllocator(MemoryManager &mm) : Allocator(mm), _nr_initialised_frames(0), _pf_descriptors(NULL), _nr_free_frames(0), _nr_managed_frames(0), _numa(false), _nr_local_allocs(0), _nr_remote_allocs(0), _zero_pool(), _dma_zone_base(0), _dma_zone_frames(0)
+{
+	_mtx.set_name("pgalloc");
+	_zero_pool_lock.set_name("pgalloc-zero-pool");
+	_dma_zone_mtx.set_name("pgalloc-dma");
 }
 
 bool PageAllocator::setup_pf_descriptors()
@@ -76,8 +146,21 @@ bool PageAllocator::setup_pf_descriptors()
 
 	// TODO: Actually check this assertion holds, using the size of the physical memory block.
 
-	// Initialise the descriptors, by zeroing them all.
-	bzero(_pf_descriptors, _nr_frames * sizeof(FrameDescriptor));
+	// Reserve the whole range from the kernel image start to the end of the descriptors, which
+	// eliminates the problem of overlapping reservations.
+	if (!reserve_at_boot(pa_to_pfn((phys_addr_t)&_IMAGE_START), // _IMAGE_START is a PA
+			pa_to_pfn(kva_to_pa((virt_addr_t)_pf_descriptors) + pd_size) + 1, "kernel image and frame descriptors"))
+	{
+		return false;
+	}
+
+	// The descriptors for low memory are initialised by init(), and the rest after boot, by
+	// init_deferred(), unless that has been disabled on the command line.
+	_nr_initialised_frames = _nr_frames;
+	if (do_deferred_init && _nr_initialised_frames > PF_EAGER_FRAMES)
+	{
+		_nr_initialised_frames = PF_EAGER_FRAMES;
+	}
 
 	return true;
 }
@@ -107,10 +190,10 @@ bool PageAllocator::init()
 		return false;
 	}
 
-	uint64_t nr_present_frames, nr_free_frames;
+	uint64_t nr_present_frames, nr_free_frames, nr_deferred_frames;
 
-	// Loop through available physical memory blocks, and update the corresponding frame descriptors.
 	nr_present_frames = 0;
+	nr_deferred_frames = 0;
 	for (unsigned int i = 0; i < owner()._nr_phys_mem_blocks; i++)
 	{
 		const PhysicalMemoryBlock &pmb = owner()._phys_mem_blocks[i];
@@ -118,47 +201,29 @@ bool PageAllocator::init()
 		if (pmb.type == MemoryType::NORMAL)
 		{
 			nr_present_frames += pmb.nr_frames;
-			for (pfn_t pfn = pmb.base_pfn; pfn < (pmb.base_pfn + pmb.nr_frames); pfn++)
+
+			pfn_t end = pmb.base_pfn + pmb.nr_frames;
+			if (end > _nr_initialised_frames)
 			{
-				_pf_descriptors[pfn].type = FrameDescriptorType::AVAILABLE;
+				nr_deferred_frames += end - (pmb.base_pfn > _nr_initialised_frames ? pmb.base_pfn : _nr_initialised_frames);
 			}
-
-            _allocator_algorithm->insert_range(&_pf_descriptors[pmb.base_pfn], pmb.nr_frames);
-        }
+		}
 	}
 
-    nr_free_frames = nr_present_frames;
-
-	// Reserve page zero.  We can do without it.
-    mm_log.messagef(LogLevel::INFO, "Reserving page zero");
-    nr_free_frames -= reserve_range(0, 1);
-
-    // Reserve initial page table pages
-    mm_log.messagef(LogLevel::INFO, "Reserving initial page table pages");
-    nr_free_frames -= reserve_range(1, 6);
-
-	// Now, reserve the kernel's pages
-	// Reserve the range of pages corresponding to the kernel image
-	// pfn_t image_start_pfn = pa_to_pfn((phys_addr_t)&_IMAGE_START); // _IMAGE_START is a PA
-	// pfn_t image_last_pfn = pa_to_pfn((phys_addr_t)&_IMAGE_END);	   // _IMAGE_END is a PA
-	// nr_free_frames -= reserve_range(image_start_pfn, image_last_pfn - image_start_pfn + 1);
-	
-	// Reserve the range of pages corresponding to the kernel stack
-	// pfn_t stack_start_pfn = pa_to_pfn(kva_to_pa((virt_addr_t)&_STACK_START)); // _STACK_START is a VA
-	// pfn_t stack_last_pfn = pa_to_pfn(kva_to_pa((virt_addr_t)&_STACK_END));	  // _STACK_END is a VA
-	// nr_free_frames -= reserve_range(stack_start_pfn, stack_last_pfn - stack_start_pfn + 1);
+	for (unsigned int i = 0; i < nr_boot_reservations; i++)
+	{
+		const BootReservation &r = boot_reservations[i];
+		mm_log.messagef(LogLevel::INFO, "Reserving %s (%llx -- %llx)", r.what, r.start, r.end);
+	}
 
-	// Reserve the range of frames corresponding to the kernel heap, which is
-	// actually just the frames descriptors.
-	// pfn_t heap_start_pfn = pa_to_pfn(kva_to_pa((virt_addr_t)&_HEAP_START)); // _HEAP_START is a VA
-	// nr_free_frames -= reserve_range(heap_start_pfn, ((_nr_frames * sizeof(FrameDescriptor)) >> 12) + 1);
+	// Initialise the descriptors for low memory, and make the frames that aren't reserved available.
+	nr_free_frames = init_frames(0, _nr_initialised_frames);
 
-	// Reserve the whole range from kernel image start to kernel heap end, which eliminates the
-	// problem of overlapping insertions and makes the remove_range implementation more efficient
-	pfn_t image_start_pfn = pa_to_pfn((phys_addr_t)&_IMAGE_START); // _IMAGE_START is a PA
-	nr_free_frames -= reserve_range(image_start_pfn, ((_nr_frames * sizeof(FrameDescriptor)) >> 12) + 1);
+	// Set aside the DMA zone, while there is still plenty of contiguous memory.
+	setup_dma_zone();
+	nr_free_frames -= _dma_zone_frames;
 
-	mm_log.messagef(LogLevel::INFO, "Page Allocator: total=%llu, present=%llu, free=%llu (%llu MB)", _nr_frames, nr_present_frames, nr_free_frames, MB(nr_free_frames << 12));
+	mm_log.messagef(LogLevel::INFO, "Page Allocator: total=%llu, present=%llu, free=%llu (%llu MB), deferred=%llu", _nr_frames, nr_present_frames, nr_free_frames, MB(nr_free_frames << 12), nr_deferred_frames);
 
 	// Now, initialise the page allocation algorithm.
 
@@ -171,45 +236,204 @@ bool PageAllocator::init()
 		}
 	}
 
+	if (do_benchmark)
+	{
+		benchmark();
+	}
+
 	return true;
 }
 
-uint64_t PageAllocator::reserve_range(pfn_t start, uint64_t nr_frames)
+/**
+ * Works out what the frame at 'pfn' is at boot: reserved, normal memory (available), or
+ * neither (invalid), and how far that goes, i.e. the first frame after it that might be
+ * different, which is at most 'end'.
+ */
+FrameDescriptorType::FrameDescriptorType PageAllocator::boot_frame_type(pfn_t pfn, pfn_t end, pfn_t &run_end) const
 {
-    for (pfn_t pfn = start; pfn < start + nr_frames; pfn++)
+	run_end = end;
+
+	for (unsigned int i = 0; i < nr_boot_reservations; i++)
+	{
+		const BootReservation &r = boot_reservations[i];
+
+		if (pfn >= r.start && pfn < r.end)
+		{
+			if (r.end < run_end)
+				run_end = r.end;
+			return FrameDescriptorType::RESERVED;
+		}
+
+		if (r.start > pfn && r.start < run_end)
+			run_end = r.start;
+	}
+
+	FrameDescriptorType::FrameDescriptorType type = FrameDescriptorType::INVALID;
+
+	for (unsigned int i = 0; i < owner()._nr_phys_mem_blocks; i++)
 	{
-		_pf_descriptors[pfn].type = FrameDescriptorType::RESERVED;
-    }
+		const PhysicalMemoryBlock &pmb = owner()._phys_mem_blocks[i];
+
+		if (pmb.type != MemoryType::NORMAL)
+			continue;
+
+		pfn_t pmb_end = pmb.base_pfn + pmb.nr_frames;
 
-    _allocator_algorithm->remove_range(&_pf_descriptors[start], nr_frames);
+		if (pfn >= pmb.base_pfn && pfn < pmb_end)
+		{
+			type = FrameDescriptorType::AVAILABLE;
+			if (pmb_end < run_end)
+				run_end = pmb_end;
+		}
+		else if (pmb.base_pfn > pfn && pmb.base_pfn < run_end)
+		{
+			run_end = pmb.base_pfn;
+		}
+	}
+
+	return type;
+}
+
+/**
+ * Initialises the descriptors of the frames in the range [start, end), in one pass that
+ * writes each in its final state, and inserts the runs of them that are available into
+ * the algorithm.  The memory map and the boot reservations are only looked at where
+ * they change, so this costs a store per descriptor, and a call into the algorithm per
+ * run of available frames.  The page allocator lock is only taken for the calls, since
+ * nothing looks at the descriptors until they have been inserted.
+ * @return Returns the number of frames inserted.
+ */
+uint64_t PageAllocator::init_frames(pfn_t start, pfn_t end)
+{
+	uint64_t nr_inserted = 0;
+
+	pfn_t pfn = start;
+	while (pfn < end)
+	{
+		pfn_t run_end;
+
+		FrameDescriptor initial;
+		bzero(&initial, sizeof(initial));
+		initial.type = boot_frame_type(pfn, end, run_end);
+		initial.node = numa_node_of_pfn(pfn, run_end);
+
+		for (pfn_t i = pfn; i < run_end; i++)
+		{
+			_pf_descriptors[i] = initial;
+		}
+
+		if (initial.type == FrameDescriptorType::AVAILABLE)
+		{
+			UniqueLock<Mutex> l(_mtx);
+			_allocator_algorithm->insert_range(&_pf_descriptors[pfn], run_end - pfn);
+			nr_inserted += run_end - pfn;
+
+			__atomic_add_fetch(&_nr_free_frames, run_end - pfn, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&_nr_managed_frames, run_end - pfn, __ATOMIC_RELAXED);
+		}
+
+		pfn = run_end;
+	}
 
-	return nr_frames;
+	return nr_inserted;
+}
+
+/**
+ * Initialises the frame descriptors that were not initialised at boot, one chunk at a
+ * time, making the frames available as each chunk is done.
+ */
+void PageAllocator::init_deferred()
+{
+	while (_nr_initialised_frames < _nr_frames)
+	{
+		pfn_t start = _nr_initialised_frames;
+		pfn_t end = start + PF_INIT_CHUNK_FRAMES;
+		if (end > _nr_frames)
+		{
+			end = _nr_frames;
+		}
+
+		uint64_t nr_inserted = init_frames(start, end);
+		{
+			UniqueLock<Mutex> l(_mtx);
+			__atomic_store_n(&_nr_initialised_frames, end, __ATOMIC_RELEASE);
+		}
+
+		pgalloc_log.messagef(LogLevel::DEBUG, "Initialised frame descriptors %llx -- %llx (%llu frames available)", start, end, nr_inserted);
+	}
+
+	mm_log.messagef(LogLevel::INFO, "Deferred frame descriptor initialisation complete");
+}
+
+void PageAllocator::init_deferred_threadproc(PageAllocator *pgalloc)
+{
+	pgalloc->init_deferred();
+	Thread::current().stop();
+}
+
+/**
+ * Starts a kernel thread to initialise the frame descriptors that were not initialised
+ * at boot, if there are any.  This must be called once the scheduler is available.
+ */
+void PageAllocator::start_deferred_init()
+{
+	if (_nr_initialised_frames >= _nr_frames)
+		return;
+
+	Thread& thread = sys.create_kernel_thread((Thread::thread_proc_t)init_deferred_threadproc, "pgalloc-init");
+	thread.add_entry_argument((void *)this);
+	thread.start();
 }
 
 /**
  * Allocates 2^order contiguous frames
  * @param order The power of two of the number of frames to allocate
+ * @param flags PageAllocFlags::ZERO if the frames must be zero-filled
  * @return Returns a pointer to an array of frame descriptors representing the new allocation, or NULL if allocation
  * failed.
  */
-FrameDescriptor *PageAllocator::allocate(int order)
+FrameDescriptor *PageAllocator::allocate(int order, PageAllocFlags::PageAllocFlags flags)
 {
 	// Call into the algorithm to actually allocate the pages.
 	if (!_allocator_algorithm)
 		return NULL;
 
-	UniqueLock<Mutex> l(_mtx);
-	FrameDescriptor *pfdescr = _allocator_algorithm->allocate(order);
+	FrameDescriptor *pfdescr = NULL;
+	bool zeroed = false;
 
-	// Double check that all the pages are marked as available, and
-	// mark them as allocated.
-	for (unsigned int i = 0; i < (1u << order); i++)
-	{
-		assert(pfdescr[i].type == FrameDescriptorType::AVAILABLE);
-		pfdescr[i].type = FrameDescriptorType::ALLOCATED;
+retry:
+	if (order == 0) {
+		// Single frames that must be zeroed come from the pre-zeroed pool, if possible.
+		if (flags & PageAllocFlags::ZERO) {
+			pfdescr = allocate_zeroed();
+			zeroed = pfdescr != NULL;
+		}
+
+		// Otherwise, single frames come from the per-CPU frame cache.
+		if (!pfdescr) {
+			pfdescr = allocate_cached();
+		}
+
+		// If memory is that short, fall back to the pre-zeroed pool anyway.
+		if (!pfdescr) {
+			pfdescr = allocate_zeroed();
+		}
+	} else {
+		UniqueLock<Mutex> l(_mtx);
+		pfdescr = algorithm_allocate(order);
+	}
+
+	// Out of frames: if the caches can give some back, try again.
+	if (!pfdescr) {
+		if (reclaim_for_allocation(order)) goto retry;
+		return NULL;
+	}
+
+	if ((flags & PageAllocFlags::ZERO) && !zeroed) {
+		pnzero((void *)pfdescr_to_vpa(pfdescr), 1 << order);
 	}
 
-	pgalloc_log.messagef(LogLevel::DEBUG, "alloc: order=%d, pfdescr=%p (%lx)", order, pfdescr, pfdescr_to_pa(pfdescr));
+	LOG_MESSAGEF(pgalloc_log, LogLevel::DEBUG, "alloc: order=%d, pfdescr=%p (%lx)", order, pfdescr, pfdescr_to_pa(pfdescr));
 	return pfdescr;
 }
 
@@ -222,33 +446,427 @@ void PageAllocator::free(FrameDescriptor *pfdescr, int order)
 {
 	// Call into the algorithm to actually free the pages.
 	if (_allocator_algorithm)
+	{
+		if (order == 0) {
+			// Single frames go back to the per-CPU frame cache.
+			free_cached(pfdescr);
+		} else {
+			UniqueLock<Mutex> l(_mtx);
+			algorithm_free(pfdescr, order);
+		}
+
+		LOG_MESSAGEF(pgalloc_log, LogLevel::DEBUG, "free: order=%d, pfdescr=%p (%lx)", order, pfdescr, pfdescr_to_pa(pfdescr));
+	}
+}
+
+/**
+ * Allocates 2^order contiguous frames from the algorithm.  The caller must hold the page allocator lock.
+ */
+FrameDescriptor *PageAllocator::algorithm_allocate(int order)
+{
+	FrameDescriptor *pfdescr = NULL;
+
+	if (_numa) {
+		// Try the nodes nearest this CPU first.  The farthest is left to allocate(),
+		// so that a failure is counted once.
+		unsigned int node = CPU::current().numa_node();
+		const uint8_t *fallback = numa_fallback_order(node);
+
+		for (unsigned int i = 0; i < numa_nr_nodes() - 1 && !pfdescr; i++) {
+			pfdescr = _allocator_algorithm->allocate_on_node(order, fallback[i]);
+		}
+
+		if (!pfdescr)
+			pfdescr = _allocator_algorithm->allocate(order);
+
+		if (pfdescr)
+			(pfdescr->node == node ? _nr_local_allocs : _nr_remote_allocs)++;
+	} else {
+		pfdescr = _allocator_algorithm->allocate(order);
+	}
+
+	if (!pfdescr)
+		return NULL;
+
+	// Double check that all the pages are marked as available, and
+	// mark them as allocated.
+	for (unsigned int i = 0; i < (1u << order); i++)
+	{
+		assert(pfdescr[i].type == FrameDescriptorType::AVAILABLE);
+		pfdescr[i].type = FrameDescriptorType::ALLOCATED;
+	}
+
+	__atomic_sub_fetch(&_nr_free_frames, 1ull << order, __ATOMIC_RELAXED);
+	return pfdescr;
+}
+
+/**
+ * Frees 2^order contiguous frames to the algorithm.  The caller must hold the page allocator lock.
+ */
+void PageAllocator::algorithm_free(FrameDescriptor *pfdescr, int order)
+{
+	_allocator_algorithm->free(pfdescr, order);
+
+	// Double-check that all the pages were allocated, and mark them as available.
+	for (unsigned int i = 0; i < (1u << order); i++)
+	{
+		assert(pfdescr[i].type == FrameDescriptorType::ALLOCATED);
+		pfdescr[i].type = FrameDescriptorType::AVAILABLE;
+	}
+
+	__atomic_add_fetch(&_nr_free_frames, 1ull << order, __ATOMIC_RELAXED);
+}
+
+// The number of frames moved between a frame cache and the algorithm in one go.
+#define FRAME_CACHE_BATCH	16
+
+// A frame cache is drained (by one batch) when it holds more than this many frames.
+#define FRAME_CACHE_HIGH	64
+
+static inline void frame_cache_push_head(FrameCache& cache, FrameDescriptor *pfdescr)
+{
+	pfdescr->prev = NULL;
+	pfdescr->next = cache.head;
+
+	if (cache.head) {
+		cache.head->prev = pfdescr;
+	} else {
+		cache.tail = pfdescr;
+	}
+
+	cache.head = pfdescr;
+	cache.count++;
+}
+
+static inline void frame_cache_push_tail(FrameCache& cache, FrameDescriptor *pfdescr)
+{
+	pfdescr->next = NULL;
+	pfdescr->prev = cache.tail;
+
+	if (cache.tail) {
+		cache.tail->next = pfdescr;
+	} else {
+		cache.head = pfdescr;
+	}
+
+	cache.tail = pfdescr;
+	cache.count++;
+}
+
+static inline FrameDescriptor *frame_cache_pop_head(FrameCache& cache)
+{
+	FrameDescriptor *pfdescr = cache.head;
+
+	cache.head = pfdescr->next;
+	if (cache.head) {
+		cache.head->prev = NULL;
+	} else {
+		cache.tail = NULL;
+	}
+
+	cache.count--;
+	return pfdescr;
+}
+
+static inline FrameDescriptor *frame_cache_pop_tail(FrameCache& cache)
+{
+	FrameDescriptor *pfdescr = cache.tail;
+
+	cache.tail = pfdescr->prev;
+	if (cache.tail) {
+		cache.tail->next = NULL;
+	} else {
+		cache.head = NULL;
+	}
+
+	cache.count--;
+	return pfdescr;
+}
+
+/**
+ * Allocates a single frame from the current CPU's frame cache, refilling the cache
+ * with a batch of frames from the algorithm if it is empty.
+ */
+FrameDescriptor *PageAllocator::allocate_cached()
+{
+	// The fast path only needs to keep interrupts on this CPU away from the cache.
+	{
+		UniqueIRQLock l;
+
+		FrameCache& cache = CPU::current().frame_cache();
+		if (cache.count) {
+			FrameDescriptor *pfdescr = frame_cache_pop_head(cache);
+
+			assert(pfdescr->type == FrameDescriptorType::CACHED);
+			pfdescr->type = FrameDescriptorType::ALLOCATED;
+			return pfdescr;
+		}
+	}
+
+	// The cache was empty, so take a batch of frames from the algorithm, in one go.
+	FrameDescriptor *batch[FRAME_CACHE_BATCH];
+	unsigned int nr_frames = 0;
+
 	{
 		UniqueLock<Mutex> l(_mtx);
-		_allocator_algorithm->free(pfdescr, order);
 
-		// Double-check that all the pages were allocated, and mark them as available.
-		for (unsigned int i = 0; i < (1u << order); i++)
-		{
-			assert(pfdescr[i].type == FrameDescriptorType::ALLOCATED);
-			pfdescr[i].type = FrameDescriptorType::AVAILABLE;
+		while (nr_frames < FRAME_CACHE_BATCH) {
+			FrameDescriptor *pfdescr = algorithm_allocate(0);
+			if (!pfdescr) break;
+
+			batch[nr_frames++] = pfdescr;
 		}
+	}
 
-		pgalloc_log.messagef(LogLevel::DEBUG, "free: order=%d, pfdescr=%p (%lx)", order, pfdescr, pfdescr_to_pa(pfdescr));
+	if (nr_frames == 0)
+		return NULL;
+
+	// Keep the first frame for the caller, and put the rest in the cache.  They
+	// have not been touched recently, so they go on the cold end.
+	{
+		UniqueIRQLock l;
+
+		FrameCache& cache = CPU::current().frame_cache();
+		for (unsigned int i = 1; i < nr_frames; i++) {
+			batch[i]->type = FrameDescriptorType::CACHED;
+			frame_cache_push_tail(cache, batch[i]);
+		}
 	}
+
+	return batch[0];
 }
 
-const FrameDescriptor *PageAllocator::alloc_zero_frame()
+/**
+ * Frees a single frame to the current CPU's frame cache, draining a batch of the
+ * coldest frames back to the algorithm if the cache has grown too large.
+ */
+void PageAllocator::free_cached(FrameDescriptor *pfdescr)
 {
-	const FrameDescriptor *pfdescr = allocate(0);
-	if (!pfdescr)
+	FrameDescriptor *batch[FRAME_CACHE_BATCH];
+	unsigned int nr_frames = 0;
+
+	// A frame from another node would be handed out here again, so it goes back to
+	// its own node's pool.
+	if (_numa && pfdescr->node != CPU::current().numa_node()) {
+		UniqueLock<Mutex> l(_mtx);
+		algorithm_free(pfdescr, 0);
+		return;
+	}
+
+	{
+		UniqueIRQLock l;
+
+		assert(pfdescr->type == FrameDescriptorType::ALLOCATED);
+		pfdescr->type = FrameDescriptorType::CACHED;
+
+		// The frame has just been used, so it goes on the hot end.
+		FrameCache& cache = CPU::current().frame_cache();
+		frame_cache_push_head(cache, pfdescr);
+
+		if (cache.count > FRAME_CACHE_HIGH) {
+			while (nr_frames < FRAME_CACHE_BATCH) {
+				batch[nr_frames++] = frame_cache_pop_tail(cache);
+			}
+		}
+	}
+
+	if (nr_frames == 0)
+		return;
+
+	UniqueLock<Mutex> l(_mtx);
+	for (unsigned int i = 0; i < nr_frames; i++) {
+		// The algorithm expects the frame to look allocated when it is freed.
+		batch[i]->type = FrameDescriptorType::ALLOCATED;
+		algorithm_free(batch[i], 0);
+	}
+}
+
+/**
+ * Allocates single frames from the algorithm, passing over any that lie in [start, end),
+ * which compaction is trying to empty.  The frames passed over are held on to until the
+ * end, so that the algorithm doesn't hand them out again, and are then given back.
+ * @return Returns how many of the 'count' frames were allocated.
+ */
+unsigned int PageAllocator::allocate_outside(pfn_t start, pfn_t end, unsigned int count, FrameDescriptor **frames)
+{
+	if (!_allocator_algorithm)
+		return 0;
+
+	unsigned int nr_allocated = 0;
+	FrameDescriptor *passed_over = NULL;
+
+	UniqueLock<Mutex> l(_mtx);
+
+	while (nr_allocated < count) {
+		FrameDescriptor *pfdescr = algorithm_allocate(0);
+		if (!pfdescr) break;
+
+		pfn_t pfn = pfdescr_to_pfn(pfdescr);
+		if (pfn >= start && pfn < end) {
+			// The frame is allocated, so the algorithm isn't using its list pointers.
+			pfdescr->next = passed_over;
+			passed_over = pfdescr;
+			continue;
+		}
+
+		frames[nr_allocated++] = pfdescr;
+	}
+
+	while (passed_over) {
+		FrameDescriptor *next = passed_over->next;
+		algorithm_free(passed_over, 0);
+		passed_over = next;
+	}
+
+	return nr_allocated;
+}
+
+void PageAllocator::free_to_algorithm(FrameDescriptor *pfdescr, int order)
+{
+	if (!_allocator_algorithm)
+		return;
+
+	UniqueLock<Mutex> l(_mtx);
+	algorithm_free(pfdescr, order);
+}
+
+/**
+ * Allocates a number of frames (not necessarily contiguous) in one go.  The frames are taken as
+ * the largest contiguous blocks that are available, so they are contiguous where possible.
+ * @param count The number of frames to allocate
+ * @param frames An array of (at least) count pointers, which is filled in with the descriptor of each frame
+ * @param flags PageAllocFlags::ZERO if the frames must be zero-filled
+ * @return Returns true if all the frames were allocated, or false (having allocated nothing) otherwise.
+ */
+bool PageAllocator::allocate_bulk(unsigned int count, FrameDescriptor **frames, PageAllocFlags::PageAllocFlags flags)
+{
+	if (!_allocator_algorithm)
+		return false;
+
+	unsigned int nr_allocated = 0;
+
+	// Use up any frames that have already been zeroed first.
+	if (flags & PageAllocFlags::ZERO) {
+		UniqueIRQSaveLock<TicketLock> l(_zero_pool_lock);
+
+		while (nr_allocated < count && _zero_pool.count) {
+			FrameDescriptor *pfdescr = frame_cache_pop_head(_zero_pool);
+
+			assert(pfdescr->type == FrameDescriptorType::CACHED);
+			pfdescr->type = FrameDescriptorType::ALLOCATED;
+			frames[nr_allocated++] = pfdescr;
+		}
+	}
+
+	unsigned int nr_zeroed = nr_allocated;
+
+	{
+		UniqueLock<Mutex> l(_mtx);
+
+		while (nr_allocated < count) {
+			// Ask for the largest block that does not overshoot, and fall back to
+			// smaller blocks if that fails.
+			int order = ilog2_floor(count - nr_allocated);
+
+			FrameDescriptor *pfdescr = NULL;
+			for (; order >= 0; order--) {
+				pfdescr = algorithm_allocate(order);
+				if (pfdescr) break;
+			}
+
+			if (!pfdescr) {
+				// Out of memory, so give back everything we got.  Frames can always be
+				// returned one at a time, whatever size of block they came from.
+				for (unsigned int i = 0; i < nr_allocated; i++) {
+					algorithm_free(frames[i], 0);
+				}
+
+				return false;
+			}
+
+			for (unsigned int i = 0; i < (1u << order); i++) {
+				frames[nr_allocated++] = &pfdescr[i];
+			}
+		}
+	}
+
+	if (flags & PageAllocFlags::ZERO) {
+		// As pnzero, a batch big enough to push out the cache is zeroed around it.
+		bool nt = count - nr_zeroed >= 16;
+
+		for (unsigned int i = nr_zeroed; i < count; i++) {
+			if (nt) {
+				pzero_nt((void *)pfdescr_to_vpa(frames[i]));
+			} else {
+				pzero((void *)pfdescr_to_vpa(frames[i]));
+			}
+		}
+	}
+
+	LOG_MESSAGEF(pgalloc_log, LogLevel::DEBUG, "alloc-bulk: count=%u, pre-zeroed=%u", count, nr_zeroed);
+	return true;
+}
+
+// The idle task stops zeroing frames when the pre-zeroed pool holds this many frames.
+#define ZERO_POOL_TARGET	64
+
+/**
+ * Allocates a single frame from the pre-zeroed pool.
+ * @return Returns a zero-filled frame, or NULL if the pool is empty.
+ */
+FrameDescriptor *PageAllocator::allocate_zeroed()
+{
+	UniqueIRQSaveLock<TicketLock> l(_zero_pool_lock);
+
+	if (!_zero_pool.count)
 		return NULL;
 
-	void *ptr = (void *)pfdescr_to_vpa(pfdescr);
-	pzero(ptr);
+	FrameDescriptor *pfdescr = frame_cache_pop_head(_zero_pool);
 
+	assert(pfdescr->type == FrameDescriptorType::CACHED);
+	pfdescr->type = FrameDescriptorType::ALLOCATED;
 	return pfdescr;
 }
 
+/**
+ * Zero-fills one more frame for the pre-zeroed pool.  This is called by the idle task, so
+ * the cost of zeroing is paid when there is nothing better to do.
+ * @return Returns true if a frame was added to the pool, or false if the pool is full (or
+ * there is no memory to spare).
+ */
+bool PageAllocator::refill_zero_pool()
+{
+	if (!_allocator_algorithm)
+		return false;
+
+	{
+		UniqueIRQSaveLock<TicketLock> l(_zero_pool_lock);
+
+		if (_zero_pool.count >= ZERO_POOL_TARGET)
+			return false;
+	}
+
+	FrameDescriptor *pfdescr = allocate_cached();
+	if (!pfdescr)
+		return false;
+
+	// Zeroing is the expensive part, so do it with interrupts enabled.  The frame may sit
+	// in the pool for a while, so the zeroes shouldn't be taking up the cache.
+	pzero_nt((void *)pfdescr_to_vpa(pfdescr));
+
+	UniqueIRQSaveLock<TicketLock> l(_zero_pool_lock);
+
+	pfdescr->type = FrameDescriptorType::CACHED;
+	frame_cache_push_tail(_zero_pool, pfdescr);
+
+	return true;
+}
+
+const FrameDescriptor *PageAllocator::alloc_zero_frame()
+{
+	return allocate(0, PageAllocFlags::ZERO);
+}
+
 bool PageAllocator::self_test()
 {
 	assert(_allocator_algorithm);
@@ -368,7 +986,57 @@ bool PageAllocator::self_test()
 	return true;
 }
 
+/**
+ * Takes a snapshot of the state of the page allocator.
+ * @param stats The statistics structure to fill in
+ * @return Returns false if the algorithm doesn't keep statistics.
+ */
+bool PageAllocator::get_stats(PageAllocatorStats& stats)
+{
+	bzero(&stats, sizeof(stats));
+
+	if (!_allocator_algorithm)
+		return false;
+
+	{
+		UniqueLock<Mutex> l(_mtx);
+
+		if (!_allocator_algorithm->get_stats(stats))
+			return false;
+	}
+
+	UniqueIRQLock l;
+
+	stats.nr_cached_frames = CPU::current().frame_cache().count;
+	stats.nr_zeroed_frames = _zero_pool.count;
+	stats.nr_local_allocs = _nr_local_allocs;
+	stats.nr_remote_allocs = _nr_remote_allocs;
+
+	return true;
+}
+
 void PageAllocatorAlgorithm::dump_state() const
 {
-	pgalloc_log.messagef(LogLevel::WARNING, "dump_state() not implemented in allocation algorithm");
+	PageAllocatorStats stats;
+	bzero(&stats, sizeof(stats));
+
+	if (!get_stats(stats))
+	{
+		pgalloc_log.messagef(LogLevel::WARNING, "dump_state() not implemented in allocation algorithm");
+		return;
+	}
+
+	pgalloc_log.messagef(LogLevel::DEBUG, "%s STATE: %llu free frame(s), largest free order %d",
+			name(), stats.nr_free_frames, stats.largest_free_order);
+	pgalloc_log.messagef(LogLevel::DEBUG, "allocs=%llu frees=%llu splits=%llu merges=%llu",
+			stats.nr_allocs, stats.nr_frees, stats.nr_splits, stats.nr_merges);
+
+	for (int order = 0; order < PageAllocatorStats::NR_ORDERS; order++)
+	{
+		if (!stats.nr_free_blocks[order] && !stats.nr_failed_allocs[order])
+			continue;
+
+		pgalloc_log.messagef(LogLevel::DEBUG, "[%d] %llu free block(s), %llu failed allocation(s)",
+				order, stats.nr_free_blocks[order], stats.nr_failed_allocs[order]);
+	}
 }
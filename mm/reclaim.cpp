@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/reclaim.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/reclaim.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/swap.h>
+#include <infos/mm/compaction.h>
+#include <infos/mm/ksm.h>
+#include <infos/mm/thp.h>
+#include <infos/mm/working-set.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/fs/stats.h>
+#include <arch/arch.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// The watermarks, as shifts of the number of frames managed: the low watermark is 1/64
+// of memory, and the high one 1/32.
+#define RECLAIM_LOW_SHIFT		6
+#define RECLAIM_HIGH_SHIFT		5
+
+// The reclaim thread frees this many frames at a time, and looks at free memory this
+// often, in ns.
+#define RECLAIM_BATCH			64
+#define RECLAIM_PERIOD			100000000ull
+
+Shrinker *Shrinker::_all_shrinkers;
+
+static Thread *reclaim_thread;
+static uint64_t nr_background_runs, nr_direct_reclaims, nr_failed_direct_reclaims;
+
+// Shrinkers are static objects, so this runs before anything is allocated, on one CPU.
+Shrinker::Shrinker(const char *name, ShrinkFn shrink) : _name(name), _shrink(shrink), _nr_reclaimed(0)
+{
+	_next = _all_shrinkers;
+	_all_shrinkers = this;
+}
+
+uint64_t Shrinker::shrink(uint64_t nr_frames)
+{
+	uint64_t nr = _shrink(nr_frames);
+	__atomic_add_fetch(&_nr_reclaimed, nr, __ATOMIC_RELAXED);
+
+	return nr;
+}
+
+void infos::mm::reclaim_watermarks(ReclaimWatermarks& watermarks)
+{
+	uint64_t nr_managed = sys.mm().pgalloc().nr_managed_frames();
+
+	watermarks.low = nr_managed >> RECLAIM_LOW_SHIFT;
+	watermarks.high = nr_managed >> RECLAIM_HIGH_SHIFT;
+}
+
+uint64_t infos::mm::reclaim_frames(uint64_t nr_frames)
+{
+	uint64_t done = 0;
+
+	// Go round the shrinkers until enough has been freed, or none of them frees anything.
+	bool progress = true;
+	while (done < nr_frames && progress) {
+		progress = false;
+
+		for (Shrinker *shrinker = Shrinker::first(); shrinker && done < nr_frames; shrinker = shrinker->next()) {
+			uint64_t nr = shrinker->shrink(nr_frames - done);
+			if (nr) progress = true;
+
+			done += nr;
+		}
+	}
+
+	return done;
+}
+
+/**
+ * Returns true if the current thread can wait for reclaim: the shrinkers take locks
+ * (if they can), and free memory, which may take more locks.
+ */
+static bool can_reclaim()
+{
+	Scheduler& sched = sys.scheduler();
+	return sched.active() && sys.arch().interrupts_enabled() && &sched.current_entity() != &sched.idle_entity();
+}
+
+bool infos::mm::reclaim_for_allocation(int order)
+{
+	if (!can_reclaim()) return false;
+
+	// A high-order allocation can fail with plenty of memory free, because it is all
+	// in pieces, and then it is compaction, not reclaim, that will help.
+	if (order > 0 && sys.mm().pgalloc().nr_free_frames() >= (2ull << order) && compact_memory(order)) return true;
+
+	__atomic_add_fetch(&nr_direct_reclaims, 1, __ATOMIC_RELAXED);
+
+	// Take a batch, so that the next few allocations don't have to reclaim as well.
+	uint64_t nr = reclaim_frames(__max(1ull << order, RECLAIM_BATCH));
+	if (!nr) __atomic_add_fetch(&nr_failed_direct_reclaims, 1, __ATOMIC_RELAXED);
+
+	return nr > 0;
+}
+
+static void reclaim_threadproc()
+{
+	for (;;) {
+		ReclaimWatermarks watermarks;
+		reclaim_watermarks(watermarks);
+
+		// The ages are brought up to date first, for swapping out to go by.
+		age_in_background();
+
+		PageAllocator& pgalloc = sys.mm().pgalloc();
+		if (pgalloc.nr_free_frames() < watermarks.low) {
+			__atomic_add_fetch(&nr_background_runs, 1, __ATOMIC_RELAXED);
+
+			// The caches go first: swapping pages out costs disk writes now, and
+			// disk reads when they are touched again.
+			while (pgalloc.nr_free_frames() < watermarks.high) {
+				if (!reclaim_frames(RECLAIM_BATCH) && !swap_out(RECLAIM_BATCH)) break;
+			}
+		}
+
+		compact_in_background();
+		promote_in_background();
+		merge_in_background();
+
+		Thread::current().sleep_until(sys.runtime().time_since_epoch().count() + RECLAIM_PERIOD);
+	}
+}
+
+bool infos::mm::start_reclaimer()
+{
+	if (reclaim_thread) return true;
+
+	reclaim_thread = &sys.create_kernel_thread((Thread::thread_proc_t)reclaim_threadproc, "reclaim");
+	reclaim_thread->start();
+
+	return true;
+}
+
+RegisterStatistics(reclaim, "reclaim")
+{
+	ReclaimWatermarks watermarks;
+	reclaim_watermarks(watermarks);
+
+	out.append("free-frames %llu\n", sys.mm().pgalloc().nr_free_frames());
+	out.append("low-watermark %llu\n", watermarks.low);
+	out.append("high-watermark %llu\n", watermarks.high);
+	out.append("background-runs %llu\n", __atomic_load_n(&nr_background_runs, __ATOMIC_RELAXED));
+	out.append("direct-reclaims %llu\n", __atomic_load_n(&nr_direct_reclaims, __ATOMIC_RELAXED));
+	out.append("failed-direct-reclaims %llu\n", __atomic_load_n(&nr_failed_direct_reclaims, __ATOMIC_RELAXED));
+
+	out.append("shrinker reclaimed\n");
+	for (const Shrinker *shrinker = Shrinker::first(); shrinker; shrinker = shrinker->next()) {
+		out.append("%s %llu\n", shrinker->name(), shrinker->nr_reclaimed());
+	}
+}
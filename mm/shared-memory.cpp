@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/shared-memory.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/shared-memory.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/vma.h>
+#include <infos/kernel/kernel.h>
+#include <infos/util/hash-map.h>
+#include <infos/util/lock.h>
+
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::util;
+
+// Every object that exists, for from_object() (handles aren't typed), and the ones with
+// names.  The lock also guards each object's holders.
+static HashMap<uintptr_t, SharedMemory *> live_objects;
+static HashMap<String, SharedMemory *> named_objects;
+static Mutex objects_lock;
+
+SharedMemory::SharedMemory(const String& name, FrameDescriptor **frames, unsigned int nr_frames)
+	: _name(name), _frames(frames), _nr_frames(nr_frames), _holders(1), _named(name.length() > 0)
+{
+
+}
+
+/**
+ * Drops the object's hold on each frame, which frees the ones that aren't mapped.
+ */
+SharedMemory::~SharedMemory()
+{
+	for (unsigned int i = 0; i < _nr_frames; i++) {
+		if (__atomic_sub_fetch(&_frames[i]->refcount, 1, __ATOMIC_RELAXED) == 0) {
+			sys.mm().pgalloc().free_one(_frames[i]);
+		}
+	}
+
+	delete[] _frames;
+}
+
+SharedMemory *SharedMemory::open(const String& name, size_t size, bool create, bool exclusive)
+{
+	UniqueLock<Mutex> l(objects_lock);
+
+	SharedMemory *object;
+	if (name.length() > 0 && named_objects.try_get_value(name, object)) {
+		if (exclusive) return NULL;
+
+		object->_holders++;
+		return object;
+	}
+
+	if (!create || size == 0 || size > MAX_SIZE) return NULL;
+
+	unsigned int nr_frames = __align_up_page(size) >> __page_bits;
+	FrameDescriptor **frames = new FrameDescriptor *[nr_frames];
+	if (!frames) return NULL;
+
+	for (unsigned int i = 0; i < nr_frames; i++) {
+		frames[i] = sys.mm().pgalloc().allocate(0);
+		if (!frames[i]) {
+			while (i--) {
+				frames[i]->refcount = 0;
+				sys.mm().pgalloc().free_one(frames[i]);
+			}
+			delete[] frames;
+			return NULL;
+		}
+
+		pzero((void *)sys.mm().pgalloc().pfdescr_to_vpa(frames[i]));
+
+		// The object's own hold, so that mapping and unmapping never frees the frame
+		// while the object still has it.
+		frames[i]->refcount = 1;
+	}
+
+	object = new SharedMemory(name, frames, nr_frames);
+	live_objects.add((uintptr_t)object, object);
+	if (object->_named) named_objects.add(name, object);
+
+	return object;
+}
+
+bool SharedMemory::unlink(const String& name)
+{
+	SharedMemory *object;
+	{
+		UniqueLock<Mutex> l(objects_lock);
+
+		if (!named_objects.try_get_value(name, object)) return false;
+		named_objects.remove(name);
+
+		object->_named = false;
+		if (object->_holders) return true;
+
+		live_objects.remove((uintptr_t)object);
+	}
+
+	delete object;
+	return true;
+}
+
+SharedMemory *SharedMemory::from_object(void *object)
+{
+	UniqueLock<Mutex> l(objects_lock);
+
+	SharedMemory *shm;
+	return live_objects.try_get_value((uintptr_t)object, shm) ? shm : NULL;
+}
+
+bool SharedMemory::map(VMA& vma, bool writable, virt_addr_t& va)
+{
+	return vma.map_shared_any(_frames, _nr_frames, writable, va);
+}
+
+uint8_t *SharedMemory::frame_data(unsigned int index) const
+{
+	return (uint8_t *)sys.mm().pgalloc().pfdescr_to_vpa(_frames[index]);
+}
+
+int SharedMemory::pread(void *buffer, size_t size, off_t off)
+{
+	if (off >= this->size()) return 0;
+	size = __min(size, this->size() - off);
+
+	size_t done = 0;
+	while (done < size) {
+		size_t page_offset = __page_offset(off + done);
+		size_t n = __min(size - done, __page_size - page_offset);
+
+		memcpy((uint8_t *)buffer + done, frame_data((off + done) >> __page_bits) + page_offset, n);
+		done += n;
+	}
+
+	return (int)done;
+}
+
+int SharedMemory::pwrite(const void *buffer, size_t size, off_t off)
+{
+	if (off >= this->size()) return 0;
+	size = __min(size, this->size() - off);
+
+	size_t done = 0;
+	while (done < size) {
+		size_t page_offset = __page_offset(off + done);
+		size_t n = __min(size - done, __page_size - page_offset);
+
+		memcpy(frame_data((off + done) >> __page_bits) + page_offset, (const uint8_t *)buffer + done, n);
+		done += n;
+	}
+
+	return (int)done;
+}
+
+void SharedMemory::hold()
+{
+	UniqueLock<Mutex> l(objects_lock);
+	_holders++;
+}
+
+/**
+ * One holder has closed the object.  Its mappings are left as they are: they hold the
+ * frames themselves.
+ */
+void SharedMemory::close()
+{
+	{
+		UniqueLock<Mutex> l(objects_lock);
+
+		if (!_holders || --_holders || _named) return;
+		live_objects.remove((uintptr_t)this);
+	}
+
+	delete this;
+}
@@ -26,6 +26,11 @@ class SimplePageAllocatorAlgorithm : public PageAllocatorAlgorithm
 private:
 	FrameDescriptor *_pfdescr_base;
 	uint64_t _nr_pfdescrs;
+	uint64_t _limit;	// the end of the highest range inserted: descriptors beyond may be uninitialised
+
+	// Statistics
+	uint64_t _nr_allocs, _nr_frees;
+	uint64_t _nr_failed_allocs[PageAllocatorStats::NR_ORDERS];
 
 public:
 	bool init(FrameDescriptor *pf_descriptors, uint64_t nr_pf_descriptors) override
@@ -33,6 +38,13 @@ public:
 		mm_log.messagef(LogLevel::DEBUG, "Simple Page Allocator online");
 		_pfdescr_base = pf_descriptors;
 		_nr_pfdescrs = nr_pf_descriptors;
+		_limit = 0;
+
+		_nr_allocs = _nr_frees = 0;
+		for (int i = 0; i < PageAllocatorStats::NR_ORDERS; i++)
+		{
+			_nr_failed_allocs[i] = 0;
+		}
 
 		return true;
 	}
@@ -40,7 +52,7 @@ public:
 	FrameDescriptor *allocate(int order) override
 	{
 		const int nr_pages = (1 << order);
-		for (uint64_t idx = 0; idx < _nr_pfdescrs; idx++)
+		for (uint64_t idx = 0; idx + nr_pages <= _limit; idx++)
 		{
 			bool found = true;
 			for (uint64_t subidx = idx; subidx < idx + nr_pages; subidx++)
@@ -55,10 +67,16 @@ public:
 
 			if (found)
 			{
+				_nr_allocs++;
 				return &_pfdescr_base[idx];
 			}
 		}
 
+		if (order < PageAllocatorStats::NR_ORDERS)
+		{
+			_nr_failed_allocs[order]++;
+		}
+
 		return NULL;
 	}
 
@@ -72,11 +90,19 @@ public:
 			// the context of the simple page allocator, which has no internal state
 			assert(base[i].type == FrameDescriptorType::ALLOCATED);
 		}
+
+		_nr_frees++;
 	}
 
 	virtual void insert_range(FrameDescriptor *start, uint64_t count) override
 	{
 		mm_log.messagef(LogLevel::DEBUG, "Inserting available frames from %llx -- %llx", sys.mm().pgalloc().pfdescr_to_pfn(start), sys.mm().pgalloc().pfdescr_to_pfn(start + count));
+
+		uint64_t end = (start - _pfdescr_base) + count;
+		if (end > _limit)
+		{
+			_limit = end;
+		}
 	}
 
 	virtual void remove_range(FrameDescriptor *start, uint64_t count) override
@@ -86,8 +112,65 @@ public:
 
 	const char *name() const override { return "simple"; }
 
-	void dump_state() const override
+	bool get_stats(PageAllocatorStats& stats) const override
 	{
+		// There are no free lists, so report each run of available frames as the
+		// naturally aligned blocks it could satisfy allocations of.
+		stats.nr_free_frames = 0;
+		stats.largest_free_order = -1;
+
+		for (uint64_t idx = 0; idx < _limit;)
+		{
+			if (_pfdescr_base[idx].type != FrameDescriptorType::AVAILABLE)
+			{
+				idx++;
+				continue;
+			}
+
+			int order = 0;
+			while (order < PageAllocatorStats::NR_ORDERS - 1
+					&& (idx & ((1ull << (order + 1)) - 1)) == 0
+					&& idx + (1ull << (order + 1)) <= _limit
+					&& run_available(idx + (1ull << order), 1ull << order))
+			{
+				order++;
+			}
+
+			stats.nr_free_blocks[order]++;
+			stats.nr_free_frames += 1ull << order;
+			if (order > stats.largest_free_order)
+			{
+				stats.largest_free_order = order;
+			}
+
+			idx += 1ull << order;
+		}
+
+		stats.nr_allocs = _nr_allocs;
+		stats.nr_frees = _nr_frees;
+		stats.nr_splits = 0;
+		stats.nr_merges = 0;
+
+		for (int i = 0; i < PageAllocatorStats::NR_ORDERS; i++)
+		{
+			stats.nr_failed_allocs[i] = _nr_failed_allocs[i];
+		}
+
+		return true;
+	}
+
+private:
+	bool run_available(uint64_t idx, uint64_t count) const
+	{
+		for (uint64_t i = idx; i < idx + count; i++)
+		{
+			if (_pfdescr_base[i].type != FrameDescriptorType::AVAILABLE)
+			{
+				return false;
+			}
+		}
+
+		return true;
 	}
 };
 
@@ -0,0 +1,259 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/slab.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/slab.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/object-allocator.h>
+#include <infos/kernel/kernel.h>
+#include <infos/util/lock.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// Successive slabs of a cache start their objects this many bytes further along.
+#define SLAB_COLOUR_STRIDE	64
+
+// Marks the end of a slab's free list.
+#define SLAB_END			0xffff
+
+/**
+ * The header at the start of every slab.  It is followed by the slab's free list,
+ * which is an array of the index of the next free object, one per object.  The
+ * objects themselves come after that, offset by the slab's colour.
+ */
+struct SlabCache::Slab
+{
+	SlabCache *cache;
+	Slab *next, *prev;
+	uint8_t *objects;
+	uint16_t free_head;
+	uint16_t nr_inuse;
+	uint16_t free_next[];
+};
+
+SlabCache *SlabCache::_all_caches;
+
+SlabCache::SlabCache(const char *name, size_t object_size, size_t alignment, ctor_fn_t ctor)
+	: _name(name),
+	_ctor(ctor),
+	_partial(NULL),
+	_full(NULL),
+	_empty(NULL),
+	_nr_slabs(0),
+	_nr_inuse(0)
+{
+	assert(alignment && (alignment & (alignment - 1)) == 0);
+
+	if (object_size == 0) object_size = 1;
+	_object_size = __align_up(object_size, alignment);
+
+	// Fit as many objects as possible into a frame, along with the header and
+	// the free list.
+	_objects_per_slab = (__page_size - sizeof(Slab)) / (_object_size + sizeof(uint16_t));
+	while (__align_up(sizeof(Slab) + _objects_per_slab * sizeof(uint16_t), alignment) + _objects_per_slab * _object_size > __page_size) {
+		_objects_per_slab--;
+	}
+
+	assert(_objects_per_slab > 0 && _objects_per_slab < SLAB_END);
+
+	_objects_offset = __align_up(sizeof(Slab) + _objects_per_slab * sizeof(uint16_t), alignment);
+
+	// Use the space left over at the end of each slab to colour it.
+	_colour_stride = alignment > SLAB_COLOUR_STRIDE ? alignment : SLAB_COLOUR_STRIDE;
+	size_t leftover = __page_size - _objects_offset - (_objects_per_slab * _object_size);
+
+	_nr_colours = (leftover / _colour_stride) + 1;
+	_next_colour = 0;
+
+	// Keep track of every cache, so that they can all be dumped.
+	_next_cache = _all_caches;
+	_all_caches = this;
+}
+
+void SlabCache::list_push(Slab *& list, Slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = list;
+	if (list) {
+		list->prev = slab;
+	}
+
+	list = slab;
+}
+
+void SlabCache::list_remove(Slab *& list, Slab *slab)
+{
+	if (slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		list = slab->next;
+	}
+
+	if (slab->next) {
+		slab->next->prev = slab->prev;
+	}
+
+	slab->next = NULL;
+	slab->prev = NULL;
+}
+
+/**
+ * Allocates a new slab from the page allocator, and prepares its objects.
+ */
+SlabCache::Slab *SlabCache::grow()
+{
+	FrameDescriptor *pfdescr = sys.mm().pgalloc().allocate(0);
+	if (!pfdescr) return NULL;
+
+	pfdescr->slab = true;
+
+	Slab *slab = (Slab *)sys.mm().pgalloc().pfdescr_to_vpa(pfdescr);
+	slab->cache = this;
+	slab->next = NULL;
+	slab->prev = NULL;
+
+	size_t colour = (_next_colour++ % _nr_colours) * _colour_stride;
+	slab->objects = (uint8_t *)slab + _objects_offset + colour;
+
+	slab->free_head = 0;
+	slab->nr_inuse = 0;
+	for (unsigned int i = 0; i < _objects_per_slab; i++) {
+		slab->free_next[i] = (i + 1 < _objects_per_slab) ? i + 1 : SLAB_END;
+
+		if (_ctor) {
+			_ctor(&slab->objects[i * _object_size]);
+		}
+	}
+
+	_nr_slabs++;
+	return slab;
+}
+
+/**
+ * Gives an empty slab back to the page allocator.
+ */
+void SlabCache::release(Slab *slab)
+{
+	assert(slab->nr_inuse == 0);
+
+	FrameDescriptor *pfdescr = sys.mm().pgalloc().vpa_to_pfdescr((virt_addr_t)slab);
+	pfdescr->slab = false;
+
+	sys.mm().pgalloc().free(pfdescr, 0);
+	_nr_slabs--;
+}
+
+void *SlabCache::alloc(bool atomic)
+{
+	if (atomic) {
+		if (!_mtx.try_lock()) return NULL;
+	} else {
+		_mtx.lock();
+	}
+
+	void *obj = take(!atomic);
+	_mtx.unlock();
+
+	return obj;
+}
+
+/**
+ * Takes a free object out of the cache.  The cache lock must be held.
+ */
+void *SlabCache::take(bool may_grow)
+{
+	// Prefer partially-used slabs, so that empty ones can be given back.
+	Slab *slab;
+	if (_partial) {
+		slab = _partial;
+		list_remove(_partial, slab);
+	} else if (_empty) {
+		slab = _empty;
+		list_remove(_empty, slab);
+	} else if (may_grow) {
+		slab = grow();
+		if (!slab) return NULL;
+	} else {
+		return NULL;
+	}
+
+	unsigned int idx = slab->free_head;
+	assert(idx != SLAB_END);
+
+	slab->free_head = slab->free_next[idx];
+	slab->nr_inuse++;
+	_nr_inuse++;
+
+	if (slab->nr_inuse == _objects_per_slab) {
+		list_push(_full, slab);
+	} else {
+		list_push(_partial, slab);
+	}
+
+	return &slab->objects[idx * _object_size];
+}
+
+void SlabCache::free(void *obj)
+{
+	Slab *slab = (Slab *)__page_base((uintptr_t)obj);
+	assert(slab->cache == this);
+
+	uintptr_t offset = (uintptr_t)obj - (uintptr_t)slab->objects;
+	assert((offset % _object_size) == 0);
+
+	unsigned int idx = offset / _object_size;
+	assert(idx < _objects_per_slab);
+
+	UniqueLock<Mutex> l(_mtx);
+
+	if (slab->nr_inuse == _objects_per_slab) {
+		list_remove(_full, slab);
+	} else {
+		list_remove(_partial, slab);
+	}
+
+	slab->free_next[idx] = slab->free_head;
+	slab->free_head = idx;
+	slab->nr_inuse--;
+	_nr_inuse--;
+
+	if (slab->nr_inuse > 0) {
+		list_push(_partial, slab);
+	} else if (!_empty) {
+		// Keep one empty slab around, so that a cache that is hovering around a
+		// slab boundary doesn't keep going back to the page allocator.
+		list_push(_empty, slab);
+	} else {
+		release(slab);
+	}
+}
+
+void SlabCache::dump_state() const
+{
+	objalloc_log.messagef(LogLevel::INFO, "slab cache %s: object-size=%lu objects/slab=%u colours=%u slabs=%llu in-use=%llu",
+			_name, _object_size, _objects_per_slab, _nr_colours, _nr_slabs, _nr_inuse);
+}
+
+SlabCache *SlabCache::cache_of(const void *obj)
+{
+	FrameDescriptor *pfdescr = sys.mm().pgalloc().vpa_to_pfdescr((virt_addr_t)obj);
+	if (!pfdescr || !pfdescr->slab) return NULL;
+
+	return ((const Slab *)__page_base((uintptr_t)obj))->cache;
+}
+
+void SlabCache::dump_all()
+{
+	for (const SlabCache *cache = _all_caches; cache; cache = cache->_next_cache) {
+		cache->dump_state();
+	}
+}
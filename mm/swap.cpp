@@ -0,0 +1,667 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/swap.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/swap.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/vma.h>
+#include <infos/mm/zspool.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/device-manager.h>
+#include <infos/kernel/process.h>
+#include <infos/drivers/block/block-device.h>
+#include <infos/fs/stats.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/iovec.h>
+#include <infos/util/lock.h>
+#include <infos/util/lz4.h>
+#include <infos/util/string.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::block;
+using namespace infos::util;
+
+// The most pages that are swapped out with one write, and how many pages of a process
+// the clock hand passes over, looking for them, before giving up on it for now.
+#define SWAP_CLUSTER		16
+#define SWAP_SCAN_PAGES		1024
+
+// The most slots that are read at once (the fault-around window can't be bigger).
+#define SWAP_READ_MAX		32
+
+// A slot's number has to fit in a cookie.
+#define SWAP_MAX_SLOTS		(1u << (32 - __page_bits))
+
+// How many slots the compressed tier has for each frame it may use: enough for pages
+// that compress four times over (or are all one value, and take up no room at all).
+#define ZRAM_SLOTS_PER_FRAME	4
+
+// Pages that compress to more than this are kept as they are, as compressing them
+// saves little, and decompressing them would cost more than copying.
+#define ZRAM_MAX_COMPRESSED	(__page_size - (__page_size / 8))
+
+static char swap_device_name[16];
+static unsigned int zram_size_mb;
+
+RegisterCmdLineArgument(SwapDevice, "swap-device")
+{
+	strncpy(swap_device_name, value, sizeof(swap_device_name) - 1);
+}
+
+RegisterCmdLineArgument(ZramSize, "zram-size")
+{
+	unsigned int mb = 0;
+	for (const char *c = value; *c >= '0' && *c <= '9'; c++) {
+		mb = mb * 10 + (*c - '0');
+	}
+
+	zram_size_mb = mb;
+}
+
+static BlockDevice *swap_device;
+static unsigned int blocks_per_slot;
+
+// How many PTEs hold each slot's cookie: zero if the slot is free.  The slots of the
+// compressed tier come first, and then the swap device's, and each tier's are handed
+// out next-fit, from its own cursor.  The lock is taken with interrupts disabled, as
+// slots are let go of while page tables are being changed.
+static uint32_t *slot_refs;
+static uint32_t nr_slots, nr_used_slots, nr_zram_slots;
+static uint32_t zram_cursor, disk_cursor;
+static SpinLock slots_lock;
+static bool swap_enabled;
+
+// The batch of pages being written out: their slots are in use, but don't hold their
+// data yet, so a fault on one of them copies it from the frame instead.  Guarded by
+// the slots lock.
+static uint32_t writing_first, writing_count;
+static FrameDescriptor *writing_frames[SWAP_CLUSTER];
+
+// Only one batch is written out at a time.
+static Mutex swap_out_lock;
+
+static uint64_t nr_swapped_out, nr_swapped_in, nr_write_errors, nr_read_errors;
+
+/*
+ * The compressed tier: pages are compressed into a pool of memory (of up to zram-size
+ * MiB), and only once it is full do they go to the swap device.  A page is read back
+ * in by decompressing it, which takes microseconds, rather than the milliseconds of a
+ * disk read.
+ */
+namespace ZramSlotState
+{
+	enum ZramSlotState
+	{
+		EMPTY,
+		SAME_FILLED,	// every word of the page is 'fill', and nothing is stored
+		STORED,		// the page is in the pool, compressed unless 'length' is a page
+	};
+}
+
+struct ZramSlot
+{
+	union {
+		ZsHandle handle;
+		uint64_t fill;
+	};
+
+	uint16_t length;
+	uint8_t state;
+};
+
+// The slots, and the decompression of what is in them, are guarded by the zram lock,
+// which is taken inside the slots lock, with interrupts disabled.  The scratch buffer
+// is for objects that span two of the pool's frames.
+static ZsPool zram_pool;
+static ZramSlot *zram_slots;
+static SpinLock zram_lock;
+static uint8_t zram_scratch[ZsPool::MAX_OBJECT];
+
+// The compressor's buffers are only used while swapping out, under swap_out_lock.
+static LZ4Workspace zram_workspace;
+static uint8_t zram_compressed[ZRAM_MAX_COMPRESSED];
+
+static uint64_t nr_zram_same_filled, nr_zram_stored, nr_zram_raw, nr_zram_rejected;
+static uint64_t zram_compressed_bytes;
+
+static bool is_zram_slot(uint32_t slot) { return slot < nr_zram_slots; }
+
+/**
+ * Tests whether every word of a page is the same, and if so, what it is.
+ */
+static bool is_same_filled(const void *page, uint64_t& fill)
+{
+	const uint64_t *words = (const uint64_t *)page;
+
+	fill = words[0];
+	for (unsigned int i = 1; i < __page_size / sizeof(uint64_t); i++) {
+		if (words[i] != fill) return false;
+	}
+
+	return true;
+}
+
+/**
+ * Stores a page (which nothing can write to any more) in a compressed slot.
+ * @return Returns false if there is no room for it in the pool.
+ */
+static bool zram_store(uint32_t slot, FrameDescriptor *frame)
+{
+	const void *page = (const void *)sys.mm().pgalloc().pfdescr_to_vpa(frame);
+
+	ZramSlot stored;
+	if (is_same_filled(page, stored.fill)) {
+		stored.length = 0;
+		stored.state = ZramSlotState::SAME_FILLED;
+	} else {
+		size_t length = lz4_compress(page, __page_size, zram_compressed, sizeof(zram_compressed), zram_workspace);
+		const void *data = length ? (const void *)zram_compressed : page;
+		if (!length) length = __page_size;
+
+		if (!zram_pool.alloc(length, stored.handle)) {
+			__atomic_add_fetch(&nr_zram_rejected, 1, __ATOMIC_RELAXED);
+			return false;
+		}
+
+		zram_pool.write(stored.handle, data, length);
+
+		stored.length = (uint16_t)length;
+		stored.state = ZramSlotState::STORED;
+	}
+
+	UniqueIRQSaveLock<SpinLock> l(slots_lock);
+
+	// The page may have been faulted back in (from its frame) while it was being
+	// compressed, and the slot let go of.
+	if (!slot_refs[slot]) {
+		if (stored.state == ZramSlotState::STORED) zram_pool.free(stored.handle);
+		return true;
+	}
+
+	UniqueLock<SpinLock> zl(zram_lock);
+	zram_slots[slot] = stored;
+
+	if (stored.state == ZramSlotState::SAME_FILLED) {
+		__atomic_add_fetch(&nr_zram_same_filled, 1, __ATOMIC_RELAXED);
+	} else {
+		__atomic_add_fetch(&nr_zram_stored, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&zram_compressed_bytes, stored.length, __ATOMIC_RELAXED);
+		if (stored.length == __page_size) __atomic_add_fetch(&nr_zram_raw, 1, __ATOMIC_RELAXED);
+	}
+
+	return true;
+}
+
+/**
+ * Fills in a page from a compressed slot.
+ * @return Returns false if what was stored is damaged.
+ */
+static bool zram_load(uint32_t slot, void *page)
+{
+	UniqueIRQSaveLock<SpinLock> l(zram_lock);
+
+	const ZramSlot& stored = zram_slots[slot];
+	switch (stored.state) {
+	case ZramSlotState::SAME_FILLED:
+		for (unsigned int i = 0; i < __page_size / sizeof(uint64_t); i++) {
+			((uint64_t *)page)[i] = stored.fill;
+		}
+
+		return true;
+
+	case ZramSlotState::STORED: {
+		const void *data = zram_pool.map(stored.handle, stored.length, zram_scratch);
+
+		if (stored.length == __page_size) {
+			memcpy(page, data, __page_size);
+			return true;
+		}
+
+		return lz4_decompress(data, stored.length, page, __page_size);
+	}
+
+	default:
+		// The slot has been let go of since the read was started (another thread
+		// faulted the page in first), so what is read here isn't used.
+		bzero(page, __page_size);
+		return true;
+	}
+}
+
+/**
+ * Throws away what is in a compressed slot.  Called with the slots lock held.
+ */
+static void zram_free(uint32_t slot)
+{
+	UniqueLock<SpinLock> l(zram_lock);
+
+	ZramSlot& stored = zram_slots[slot];
+	if (stored.state == ZramSlotState::SAME_FILLED) {
+		__atomic_sub_fetch(&nr_zram_same_filled, 1, __ATOMIC_RELAXED);
+	} else if (stored.state == ZramSlotState::STORED) {
+		zram_pool.free(stored.handle);
+
+		__atomic_sub_fetch(&nr_zram_stored, 1, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&zram_compressed_bytes, stored.length, __ATOMIC_RELAXED);
+		if (stored.length == __page_size) __atomic_sub_fetch(&nr_zram_raw, 1, __ATOMIC_RELAXED);
+	}
+
+	stored.state = ZramSlotState::EMPTY;
+}
+
+/**
+ * Sets up the swap device, if one was given.
+ * @return Returns how many slots it has, which is zero if it can't be used.
+ */
+static uint32_t disk_on(DeviceManager& devices, uint32_t max_slots)
+{
+	// Booting from an initramfs doesn't wait for the disks, so the swap device may
+	// not be there yet.
+	devices.wait_for_init(DeviceInitGroup::STORAGE);
+
+	Device *dev;
+	if (!devices.try_get_device_by_name(swap_device_name, dev) || !dev->device_class().is(BlockDevice::BlockDeviceClass)) {
+		mm_log.messagef(LogLevel::ERROR, "swap: '%s' isn't a block device", swap_device_name);
+		return 0;
+	}
+
+	BlockDevice *bdev = (BlockDevice *)dev;
+	if (bdev->block_size() == 0 || bdev->block_size() > __page_size || __page_size % bdev->block_size()) {
+		mm_log.messagef(LogLevel::ERROR, "swap: '%s' has blocks that don't fit in a page", swap_device_name);
+		return 0;
+	}
+
+	blocks_per_slot = __page_size / bdev->block_size();
+
+	uint64_t slots = __min(bdev->block_count() / blocks_per_slot, (uint64_t)max_slots);
+	if (slots == 0) {
+		mm_log.messagef(LogLevel::ERROR, "swap: '%s' is too small", swap_device_name);
+		return 0;
+	}
+
+	mm_log.messagef(LogLevel::INFO, "swap: using '%s', %llu slots (%llu KiB)", swap_device_name, slots, (slots << __page_bits) >> 10);
+
+	swap_device = bdev;
+	return (uint32_t)slots;
+}
+
+bool infos::mm::swap_on(DeviceManager& devices)
+{
+	bool ok = true;
+
+	uint64_t zram_frames = (uint64_t)zram_size_mb << (20 - __page_bits);
+	uint32_t zram_slots_wanted = (uint32_t)__min(zram_frames * ZRAM_SLOTS_PER_FRAME, (uint64_t)SWAP_MAX_SLOTS);
+
+	uint32_t disk_slots = 0;
+	if (strlen(swap_device_name) != 0) {
+		disk_slots = disk_on(devices, SWAP_MAX_SLOTS - zram_slots_wanted);
+		ok = disk_slots != 0;
+	}
+
+	uint32_t slots = zram_slots_wanted + disk_slots;
+	if (slots == 0) return ok;
+
+	slot_refs = new uint32_t[slots];
+	if (!slot_refs) return false;
+
+	bzero(slot_refs, slots * sizeof(uint32_t));
+
+	if (zram_slots_wanted) {
+		zram_slots = new ZramSlot[zram_slots_wanted];
+		if (!zram_slots) return false;
+
+		bzero(zram_slots, zram_slots_wanted * sizeof(ZramSlot));
+		zram_pool.init(zram_frames);
+
+		mm_log.messagef(LogLevel::INFO, "swap: compressing up to %u slots into %u MiB", zram_slots_wanted, zram_size_mb);
+	}
+
+	nr_zram_slots = zram_slots_wanted;
+	nr_slots = slots;
+	disk_cursor = nr_zram_slots;
+
+	__atomic_store_n(&swap_enabled, true, __ATOMIC_RELEASE);
+	return ok;
+}
+
+/**
+ * Takes up to 'want' free slots that are next to each other, each counted once, from
+ * the slots from 'lo' to 'hi' (one tier's), starting at the tier's cursor.
+ * @return Returns how many it took, which is zero if the tier is full, and sets 'first'
+ * to the first of them.
+ */
+static unsigned int allocate_slots(uint32_t lo, uint32_t hi, uint32_t& cursor, unsigned int want, uint32_t& first)
+{
+	UniqueIRQSaveLock<SpinLock> l(slots_lock);
+
+	uint32_t nr = hi - lo;
+	for (uint32_t scanned = 0; scanned < nr; scanned++) {
+		uint32_t slot = lo + ((cursor - lo + scanned) % nr);
+		if (slot_refs[slot]) continue;
+
+		unsigned int got = 0;
+		while (got < want && slot + got < hi && !slot_refs[slot + got]) {
+			slot_refs[slot + got] = 1;
+			got++;
+		}
+
+		first = slot;
+		cursor = slot + got < hi ? slot + got : lo;
+		nr_used_slots += got;
+
+		return got;
+	}
+
+	return 0;
+}
+
+/**
+ * Drops one count on a slot, throwing away what is in it if it was the last.  Called
+ * with the slots lock held.
+ */
+static void release_slot(uint32_t slot)
+{
+	assert(slot < nr_slots && slot_refs[slot] > 0);
+
+	if (--slot_refs[slot] == 0) {
+		nr_used_slots--;
+		if (is_zram_slot(slot)) zram_free(slot);
+	}
+}
+
+void infos::mm::swap_duplicate(uint32_t cookie)
+{
+	UniqueIRQSaveLock<SpinLock> l(slots_lock);
+
+	uint32_t slot = swap_cookie_slot(cookie);
+	assert(slot < nr_slots && slot_refs[slot] > 0);
+
+	slot_refs[slot]++;
+}
+
+void infos::mm::swap_release(uint32_t cookie)
+{
+	UniqueIRQSaveLock<SpinLock> l(slots_lock);
+	release_slot(swap_cookie_slot(cookie));
+}
+
+/**
+ * Reads one slot, from whichever tier it is in.
+ */
+static bool read_slot(uint32_t slot, void *page)
+{
+	if (is_zram_slot(slot)) return zram_load(slot, page);
+
+	return swap_device->read_blocks(page, (size_t)(slot - nr_zram_slots) * blocks_per_slot, blocks_per_slot);
+}
+
+bool infos::mm::swap_read(uint32_t first_slot, unsigned int nr, void *buffer)
+{
+	if (!__atomic_load_n(&swap_enabled, __ATOMIC_ACQUIRE) || nr > SWAP_READ_MAX || first_slot + nr > nr_slots) return false;
+
+	// Some of the slots may be in the batch that is being written out, which hasn't
+	// reached the disk (or the pool) yet: those pages are copied from their frames,
+	// and the others are read one at a time.
+	bool overlaps = false;
+	bool copied[SWAP_READ_MAX];
+	{
+		UniqueIRQSaveLock<SpinLock> l(slots_lock);
+
+		if (writing_count && first_slot < writing_first + writing_count && first_slot + nr > writing_first) {
+			overlaps = true;
+
+			for (unsigned int i = 0; i < nr; i++) {
+				uint32_t slot = first_slot + i;
+
+				copied[i] = slot >= writing_first && slot < writing_first + writing_count;
+				if (copied[i]) {
+					memcpy((uint8_t *)buffer + ((size_t)i << __page_bits),
+						(const void *)sys.mm().pgalloc().pfdescr_to_vpa(writing_frames[slot - writing_first]), __page_size);
+				}
+			}
+		}
+	}
+
+	bool ok = true;
+	if (overlaps || is_zram_slot(first_slot)) {
+		for (unsigned int i = 0; i < nr && ok; i++) {
+			if (overlaps && copied[i]) continue;
+			ok = read_slot(first_slot + i, (uint8_t *)buffer + ((size_t)i << __page_bits));
+		}
+	} else {
+		ok = swap_device->read_blocks(buffer, (size_t)(first_slot - nr_zram_slots) * blocks_per_slot, (size_t)nr * blocks_per_slot);
+	}
+
+	if (ok) {
+		__atomic_add_fetch(&nr_swapped_in, nr, __ATOMIC_RELAXED);
+	} else {
+		__atomic_add_fetch(&nr_read_errors, 1, __ATOMIC_RELAXED);
+	}
+
+	return ok;
+}
+
+/**
+ * Swaps out one batch of a VMA's pages, into consecutive slots: compressed, while the
+ * pool has room, or otherwise with one write to the swap device.  Only pages of at
+ * least 'min_age' are taken.
+ * @return Returns how many pages were swapped out.
+ */
+static unsigned int swap_out_batch(VMA& vma, unsigned int want, unsigned int min_age)
+{
+	bool to_zram = nr_zram_slots && (!zram_pool.full() || !swap_device);
+
+	uint32_t first_slot;
+	unsigned int nr_slots_taken = 0;
+	if (to_zram) {
+		nr_slots_taken = allocate_slots(0, nr_zram_slots, zram_cursor, want, first_slot);
+	}
+
+	if (!nr_slots_taken && swap_device) {
+		to_zram = false;
+		nr_slots_taken = allocate_slots(nr_zram_slots, nr_slots, disk_cursor, want, first_slot);
+	}
+
+	if (!nr_slots_taken) return 0;
+
+	SwapOutPage pages[SWAP_CLUSTER];
+	unsigned int nr;
+
+	{
+		UniqueIRQLock irq;
+
+		// The batch is published before the slots lock is let go of, so that a fault
+		// on one of the pages, which takes the lock to read the page, finds it.
+		{
+			UniqueLock<SpinLock> l(slots_lock);
+
+			nr = vma.unmap_for_swap(pages, nr_slots_taken, first_slot, SWAP_SCAN_PAGES, min_age);
+
+			for (unsigned int i = nr; i < nr_slots_taken; i++) {
+				release_slot(first_slot + i);
+			}
+
+			for (unsigned int i = 0; i < nr; i++) {
+				writing_frames[i] = pages[i].frame;
+			}
+
+			writing_first = first_slot;
+			writing_count = nr;
+		}
+
+		if (!nr) return 0;
+
+		// Once the TLBs have been flushed, nothing can write to the frames any more.
+		virt_addr_t flush_start = pages[0].va, flush_end = pages[0].va;
+		for (unsigned int i = 1; i < nr; i++) {
+			flush_start = __min(flush_start, pages[i].va);
+			flush_end = __max(flush_end, pages[i].va);
+		}
+
+		uint64_t nr_flush = ((flush_end - flush_start) >> __page_bits) + 1;
+		vma.invalidate_range(flush_start, (unsigned int)__min(nr_flush, ~0u));
+	}
+
+	bool stored[SWAP_CLUSTER];
+	if (to_zram) {
+		for (unsigned int i = 0; i < nr; i++) {
+			stored[i] = zram_store(first_slot + i, pages[i].frame);
+		}
+	} else {
+		IOVec vec[SWAP_CLUSTER];
+		for (unsigned int i = 0; i < nr; i++) {
+			vec[i].base = (void *)sys.mm().pgalloc().pfdescr_to_vpa(pages[i].frame);
+			vec[i].size = __page_size;
+		}
+
+		bool written = swap_device->write_blocks_vec(vec, nr, (size_t)(first_slot - nr_zram_slots) * blocks_per_slot);
+		for (unsigned int i = 0; i < nr; i++) {
+			stored[i] = written;
+		}
+
+		if (!written) {
+			__atomic_add_fetch(&nr_write_errors, 1, __ATOMIC_RELAXED);
+			mm_log.messagef(LogLevel::ERROR, "swap: unable to write %u pages to slot %u", nr, first_slot);
+		}
+	}
+
+	// The pages that weren't stored, and haven't been touched (or unmapped) since, go
+	// back where they were; the rest of the frames are finished with.
+	bool keep[SWAP_CLUSTER];
+	unsigned int nr_stored = 0;
+	{
+		UniqueIRQLock irq;
+
+		for (unsigned int i = 0; i < nr; i++) {
+			keep[i] = !stored[i] && vma.remap_swapped_page(pages[i]);
+			if (stored[i]) nr_stored++;
+		}
+
+		UniqueLock<SpinLock> l(slots_lock);
+
+		for (unsigned int i = 0; i < nr; i++) {
+			if (keep[i]) release_slot(first_slot + i);
+		}
+
+		writing_count = 0;
+	}
+
+	for (unsigned int i = 0; i < nr; i++) {
+		if (!keep[i]) sys.mm().pgalloc().free_one(pages[i].frame);
+	}
+
+	__atomic_add_fetch(&nr_swapped_out, nr_stored, __ATOMIC_RELAXED);
+	return nr_stored;
+}
+
+struct SwapOutProgress
+{
+	uint64_t wanted, done;
+	bool by_age;
+};
+
+/**
+ * Returns the age of the oldest of a VMA's pages at the end of the last pass of page
+ * aging over it, which is zero if it hasn't been aged.
+ */
+static unsigned int oldest_page_age(const VMA& vma)
+{
+	PageAges ages;
+	vma.page_ages(ages);
+
+	for (unsigned int age = PTE_MAX_AGE; age > 0; age--) {
+		if (ages.nr_pages[age]) return age;
+	}
+
+	return 0;
+}
+
+static void swap_out_process(Process& process, void *arg)
+{
+	SwapOutProgress& progress = *(SwapOutProgress *)arg;
+	if (progress.done >= progress.wanted || process.kernel_process() || process.terminated()) return;
+
+	// In the first round, only the process's oldest pages are taken, so that what is
+	// outside the working sets goes before anything in them.
+	unsigned int min_age = 0;
+	if (progress.by_age) {
+		min_age = oldest_page_age(process.vma());
+		if (!min_age) return;
+	}
+
+	// The first pass of the hand over pages that are in use only clears their accessed
+	// bits, so it gets a second go before moving on.
+	unsigned int nr_empty = 0;
+	while (progress.done < progress.wanted && nr_empty < 2) {
+		unsigned int nr = swap_out_batch(process.vma(), (unsigned int)__min(progress.wanted - progress.done, SWAP_CLUSTER), min_age);
+
+		if (nr) {
+			progress.done += nr;
+			nr_empty = 0;
+		} else {
+			nr_empty++;
+		}
+	}
+}
+
+uint64_t infos::mm::swap_out(uint64_t nr_frames)
+{
+	if (!__atomic_load_n(&swap_enabled, __ATOMIC_ACQUIRE)) return 0;
+
+	UniqueLock<Mutex> l(swap_out_lock);
+
+	// Pages that were compressed take up some frames of the pool in place of their
+	// own, and the pool's empty zspages (from pages that have been read back in) are
+	// given back here, so what is freed is the difference.
+	zram_pool.shrink();
+	uint64_t pool_frames = zram_pool.nr_frames();
+
+	// The process list lock is held throughout, so no VMA goes away while its pages
+	// are being written out.
+	SwapOutProgress progress = { nr_frames, 0, true };
+	Process::for_each(swap_out_process, &progress);
+
+	if (progress.done < progress.wanted) {
+		progress.by_age = false;
+		Process::for_each(swap_out_process, &progress);
+	}
+
+	uint64_t pool_growth = zram_pool.nr_frames() > pool_frames ? zram_pool.nr_frames() - pool_frames : 0;
+	return progress.done > pool_growth ? progress.done - pool_growth : 0;
+}
+
+RegisterStatistics(swap, "swap")
+{
+	uint32_t used;
+	{
+		UniqueIRQSaveLock<SpinLock> l(slots_lock);
+		used = nr_used_slots;
+	}
+
+	out.append("device %s\n", swap_device ? swap_device_name : "none");
+	out.append("slots %u\n", nr_slots);
+	out.append("used-slots %u\n", used);
+	out.append("swapped-out %llu\n", __atomic_load_n(&nr_swapped_out, __ATOMIC_RELAXED));
+	out.append("swapped-in %llu\n", __atomic_load_n(&nr_swapped_in, __ATOMIC_RELAXED));
+	out.append("write-errors %llu\n", __atomic_load_n(&nr_write_errors, __ATOMIC_RELAXED));
+	out.append("read-errors %llu\n", __atomic_load_n(&nr_read_errors, __ATOMIC_RELAXED));
+
+	out.append("zram-slots %u\n", nr_zram_slots);
+	out.append("zram-max-frames %llu\n", zram_pool.max_frames());
+	out.append("zram-frames %llu\n", zram_pool.nr_frames());
+	out.append("zram-stored %llu\n", __atomic_load_n(&nr_zram_stored, __ATOMIC_RELAXED));
+	out.append("zram-same-filled %llu\n", __atomic_load_n(&nr_zram_same_filled, __ATOMIC_RELAXED));
+	out.append("zram-raw %llu\n", __atomic_load_n(&nr_zram_raw, __ATOMIC_RELAXED));
+	out.append("zram-compressed-bytes %llu\n", __atomic_load_n(&zram_compressed_bytes, __ATOMIC_RELAXED));
+	out.append("zram-pool-bytes %llu\n", zram_pool.bytes_used());
+	out.append("zram-rejected %llu\n", __atomic_load_n(&nr_zram_rejected, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/thp.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/thp.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/reclaim.h>
+#include <infos/mm/vma.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/process.h>
+#include <infos/fs/stats.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// The most huge-page-sized parts of a process's address space that are looked at each
+// time the promoter runs.
+#define THP_SCAN		64
+
+// Promotion rewrites live page tables under running processes, and is off unless asked
+// for (thp=1) until it has been run on a booted system.
+static bool do_thp;
+
+RegisterCmdLineArgument(THP, "thp")
+{
+	if (strncmp(value, "1", 2) == 0)
+	{
+		do_thp = true;
+	}
+	else
+	{
+		do_thp = false;
+	}
+}
+
+static uint64_t nr_runs, nr_promoted, nr_changed, nr_no_block;
+
+static void promote_process(Process& process, void *arg)
+{
+	bool& done = *(bool *)arg;
+	if (done || process.kernel_process() || process.terminated()) return;
+
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	VMA& vma = process.vma();
+
+	virt_addr_t va;
+	bool found;
+	{
+		UniqueIRQLock l;
+		found = vma.find_collapsible_range(THP_SCAN, va);
+	}
+
+	if (!found) return;
+
+	// Whatever happens, this is the one try of this run.
+	done = true;
+
+	FrameDescriptor *block = pgalloc.allocate(__huge_page_order);
+	if (!block) {
+		__atomic_add_fetch(&nr_no_block, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	// The algorithm need not return aligned blocks (although the buddy allocator does).
+	if (__huge_page_offset(pgalloc.pfdescr_to_pa(block)) != 0) {
+		pgalloc.free(block, __huge_page_order);
+		__atomic_add_fetch(&nr_no_block, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	bool collapsed;
+	{
+		UniqueIRQLock l;
+		collapsed = vma.collapse_huge_page(va, block);
+	}
+
+	if (!collapsed) {
+		pgalloc.free(block, __huge_page_order);
+		__atomic_add_fetch(&nr_changed, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	__atomic_add_fetch(&nr_promoted, 1, __ATOMIC_RELAXED);
+	LOG_MESSAGEF(mm_log, LogLevel::DEBUG, "thp: collapsed the huge page at 0x%lx", va);
+}
+
+void infos::mm::promote_in_background()
+{
+	if (!do_thp) return;
+
+	// The block must already be there: reclaim, to make room for one, would only take
+	// memory that processes need.
+	PageAllocatorStats stats;
+	if (!sys.mm().pgalloc().get_stats(stats) || stats.largest_free_order < __huge_page_order) return;
+
+	ReclaimWatermarks watermarks;
+	reclaim_watermarks(watermarks);
+	if (stats.nr_free_frames < watermarks.high + (1ull << __huge_page_order)) return;
+
+	__atomic_add_fetch(&nr_runs, 1, __ATOMIC_RELAXED);
+
+	bool done = false;
+	Process::for_each(promote_process, &done);
+}
+
+RegisterStatistics(thp, "thp")
+{
+	out.append("enabled %u\n", do_thp ? 1 : 0);
+	out.append("runs %llu\n", __atomic_load_n(&nr_runs, __ATOMIC_RELAXED));
+	out.append("promoted %llu\n", __atomic_load_n(&nr_promoted, __ATOMIC_RELAXED));
+	out.append("changed %llu\n", __atomic_load_n(&nr_changed, __ATOMIC_RELAXED));
+	out.append("no-block %llu\n", __atomic_load_n(&nr_no_block, __ATOMIC_RELAXED));
+}
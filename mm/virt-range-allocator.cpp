@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/virt-range-allocator.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/virt-range-allocator.h>
+#include <infos/mm/mm.h>
+
+using namespace infos::mm;
+
+/**
+ * A hole in the address space.
+ */
+struct VirtualRangeAllocator::Hole
+{
+	virt_addr_t start, end;
+	size_t max_size;
+	util::AVLTreeNode<Hole> link;
+
+	Hole(virt_addr_t start, virt_addr_t end) : start(start), end(end), max_size(end - start) { }
+
+	size_t size() const { return end - start; }
+};
+
+/**
+ * Orders the holes by address, with each also knowing the size of the largest hole in
+ * its subtree.
+ */
+struct VirtualRangeAllocator::HoleTraits
+{
+	typedef util::AVLTree<Hole, HoleTraits> Tree;
+
+	static util::AVLTreeNode<Hole>& node(Hole *h) { return h->link; }
+	static bool before(const Hole *a, const Hole *b) { return a->start < b->start; }
+
+	static void update(Hole *h)
+	{
+		Hole *l = Tree::left(h), *r = Tree::right(h);
+
+		h->max_size = h->size();
+		if (l && l->max_size > h->max_size) h->max_size = l->max_size;
+		if (r && r->max_size > h->max_size) h->max_size = r->max_size;
+	}
+
+	/**
+	 * Returns the lowest hole in the subtree that is at least 'size' bytes long.
+	 */
+	static Hole *lowest_fit(Hole *h, size_t size)
+	{
+		while (h && h->max_size >= size) {
+			if (Tree::left(h) && Tree::left(h)->max_size >= size) {
+				h = Tree::left(h);
+			} else if (h->size() >= size) {
+				return h;
+			} else {
+				h = Tree::right(h);
+			}
+		}
+
+		return NULL;
+	}
+
+	static Hole *clone(Hole *h) { return new Hole(h->start, h->end); }
+	static void destroy(Hole *h) { delete h; }
+};
+
+VirtualRangeAllocator::VirtualRangeAllocator(virt_addr_t base, virt_addr_t end)
+	: _base(base), _end(end)
+{
+	assert(__page_offset(base) == 0 && __page_offset(end) == 0 && base < end);
+
+	insert_hole(base, end);
+}
+
+VirtualRangeAllocator::~VirtualRangeAllocator()
+{
+	_holes.clear(HoleTraits::destroy);
+}
+
+void VirtualRangeAllocator::insert_hole(virt_addr_t start, virt_addr_t end)
+{
+	_holes.insert(*new Hole(start, end));
+}
+
+void VirtualRangeAllocator::remove_hole(Hole *h)
+{
+	_holes.remove(*h);
+	delete h;
+}
+
+/**
+ * Returns the hole with the highest start below the given address, or NULL.
+ */
+VirtualRangeAllocator::Hole *VirtualRangeAllocator::last_hole_before(virt_addr_t va) const
+{
+	Hole *candidate = NULL;
+
+	Hole *h = _holes.root();
+	while (h) {
+		if (h->start < va) {
+			candidate = h;
+			h = HoleTraits::Tree::right(h);
+		} else {
+			h = HoleTraits::Tree::left(h);
+		}
+	}
+
+	return candidate;
+}
+
+bool VirtualRangeAllocator::allocate(size_t size, size_t alignment, virt_addr_t& va)
+{
+	assert(alignment && (alignment & (alignment - 1)) == 0);
+
+	size = __align_up_page(size);
+	if (size == 0) return false;
+
+	// A hole of this size always has room for the range, however its start is aligned.
+	size_t needed = size;
+	if (alignment > __page_size) needed += alignment - __page_size;
+
+	Hole *h = HoleTraits::lowest_fit(_holes.root(), needed);
+	if (!h) return false;
+
+	va = __align_up(h->start, alignment);
+	reserve(va, va + size);
+
+	return true;
+}
+
+void VirtualRangeAllocator::reserve(virt_addr_t start, virt_addr_t end)
+{
+	// The holes don't overlap, so working down from the last one that starts before the
+	// end of the range finds every hole that overlaps it.
+	Hole *h;
+	while ((h = last_hole_before(end)) != NULL && h->end > start) {
+		virt_addr_t hole_start = h->start, hole_end = h->end;
+		remove_hole(h);
+
+		// Put back the parts of the hole either side of the range.
+		if (hole_start < start) insert_hole(hole_start, start);
+		if (hole_end > end) insert_hole(end, hole_end);
+	}
+}
+
+void VirtualRangeAllocator::release(virt_addr_t start, virt_addr_t end)
+{
+	if (start < _base) start = _base;
+	if (end > _end) end = _end;
+	if (start >= end) return;
+
+	// Clear out anything that is already free in the range, so that the range can
+	// become a single hole.
+	reserve(start, end);
+
+	// Merge with the holes that end at its start, and that start at its end.
+	Hole *prev = last_hole_before(start);
+	if (prev && prev->end == start) {
+		start = prev->start;
+		remove_hole(prev);
+	}
+
+	Hole *next = last_hole_before(end + 1);
+	if (next && next->start == end) {
+		end = next->end;
+		remove_hole(next);
+	}
+
+	insert_hole(start, end);
+}
+
+void VirtualRangeAllocator::copy_from(const VirtualRangeAllocator& other)
+{
+	assert(_base == other._base && _end == other._end);
+
+	_holes.clear(HoleTraits::destroy);
+	_holes.copy_from(other._holes, HoleTraits::clone);
+}
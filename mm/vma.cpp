@@ -11,17 +11,27 @@
 #include <infos/mm/vma.h>
 #include <infos/mm/mm.h>
 #include <infos/kernel/kernel.h>
+#include <infos/util/lock.h>
 #include <infos/util/string.h>
 
 using namespace infos::mm;
 using namespace infos::kernel;
 using namespace infos::util;
 
-VMA::VMA()
+// The part of the user address space that allocate_virt_any() places pages in.  It
+// starts above where programs are usually loaded, and ends at the top of the user half.
+#define VMA_DYNAMIC_BASE	0x100000000ull
+#define VMA_DYNAMIC_END		0x800000000000ull
+
+VMA::VMA() : _free_ranges(VMA_DYNAMIC_BASE, VMA_DYNAMIC_END), _pcid(0), _tlb_stale(~0ull), _text_source(NULL), _nr_text_users(0), _swap_hand(0), _merge_hand(0), _collapse_hand(0), _age_hand(0),
+	_nr_private_frames(0), _nr_shared_frames(0), _nr_pgt_frames(0), _nr_unmapped_frames(0)
 {
+	bzero(&_pass_ages, sizeof(_pass_ages));
+	bzero(&_ages, sizeof(_ages));
+
 	/* Allocate a single page to hold the root of the page table
 	 * for this VMA. */
-	auto pfdescr = allocate_phys(0);
+	auto pfdescr = allocate_pgt();
 	assert(pfdescr);
 	
 	_pgt_phys_base = sys.mm().pgalloc().pfdescr_to_pa(pfdescr);
@@ -30,6 +40,31 @@ VMA::VMA()
 
 VMA::~VMA()
 {
-	// TODO: Release allocations
+	// No CPU may be left using the page table (e.g. lazily, for a kernel thread).
+	release_cpus();
+	text_source(NULL);
+
+	// Free everything that was mapped, and the page tables that mapped it, then
+	// the root of the page table itself.
+	unmap_all();
+	release_pcid();
+	free_pgt(sys.mm().pgalloc().vpa_to_pfdescr(_pgt_virt_base));
 	
+	for (const auto& fa : _frame_allocations) {
+		sys.mm().pgalloc().free(fa.descriptor_base, fa.allocation_order);
+	}
+}
+
+void VMA::usage(MemoryUsage& usage) const
+{
+	usage.private_frames = __atomic_load_n(&_nr_private_frames, __ATOMIC_RELAXED);
+	usage.shared_frames = __atomic_load_n(&_nr_shared_frames, __ATOMIC_RELAXED);
+	usage.pgt_frames = __atomic_load_n(&_nr_pgt_frames, __ATOMIC_RELAXED);
+	usage.unmapped_frames = __atomic_load_n(&_nr_unmapped_frames, __ATOMIC_RELAXED);
+}
+
+void VMA::page_ages(PageAges& ages) const
+{
+	UniqueIRQLock l;
+	ages = _ages;
 }
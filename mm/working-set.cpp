@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/working-set.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/working-set.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/vma.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/process.h>
+#include <infos/fs/stats.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// The most pages of a process that are aged each time the reclaim thread runs, and how
+// many of those are aged with interrupts disabled at once (with one TLB flush).
+#define WS_SCAN			4096
+#define WS_BATCH		512
+
+#define FRAMES_KB(frames) ((frames) << (__page_bits - 10))
+
+// Aging clears accessed bits in the live page tables of running processes, and is off
+// unless asked for (ws=1) until it has been run on a booted system.
+static bool do_aging;
+
+RegisterCmdLineArgument(WorkingSet, "ws")
+{
+	if (strncmp(value, "1", 2) == 0)
+	{
+		do_aging = true;
+	}
+	else
+	{
+		do_aging = false;
+	}
+}
+
+static uint64_t nr_runs;
+
+static void age_process(Process& process, void *arg)
+{
+	if (process.kernel_process() || process.terminated()) return;
+
+	for (unsigned int done = 0; done < WS_SCAN; done += WS_BATCH) {
+		UniqueIRQLock l;
+		process.vma().age_pages(WS_BATCH);
+	}
+}
+
+void infos::mm::age_in_background()
+{
+	if (!do_aging) return;
+
+	__atomic_add_fetch(&nr_runs, 1, __ATOMIC_RELAXED);
+	Process::for_each(age_process, NULL);
+}
+
+static void append_process(Process& process, void *arg)
+{
+	infos::fs::StatisticsWriter& out = *(infos::fs::StatisticsWriter *)arg;
+	if (process.kernel_process()) return;
+
+	PageAges ages;
+	process.vma().page_ages(ages);
+
+	out.append("%s %llu", process.name().c_str(), ages.nr_passes);
+	for (unsigned int age = 0; age <= PTE_MAX_AGE; age++) {
+		out.append(" %llu", FRAMES_KB(ages.nr_pages[age]));
+	}
+	out.append("\n");
+}
+
+RegisterStatistics(ws, "ws")
+{
+	out.append("enabled %u\n", do_aging ? 1 : 0);
+	out.append("runs %llu\n", __atomic_load_n(&nr_runs, __ATOMIC_RELAXED));
+
+	// The pages of age zero are the working set.
+	out.append("process passes");
+	for (unsigned int age = 0; age <= PTE_MAX_AGE; age++) {
+		out.append(" age-%u", age);
+	}
+	out.append("\n");
+
+	Process::for_each(append_process, &out);
+}
@@ -0,0 +1,217 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/zspool.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/mm/zspool.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/kernel/kernel.h>
+#include <infos/util/string.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+ZsPool::ZsPool() : _max_frames(0), _nr_frames(0), _nr_objects(0), _bytes_used(0)
+{
+
+}
+
+void ZsPool::init(uint64_t max_frames)
+{
+	_max_frames = max_frames;
+
+	// Each class's zspages are as many frames as leave the least, for each frame,
+	// unused at the end.
+	for (unsigned int i = 0; i < NR_CLASSES; i++) {
+		SizeClass& cls = _classes[i];
+		cls.object_size = (uint16_t)((i + 1) * CLASS_STEP);
+
+		unsigned int best_frames = 1, best_waste = __page_size;
+		for (unsigned int nr_frames = 1; nr_frames <= MAX_ZSPAGE_FRAMES; nr_frames++) {
+			unsigned int nr_objects = __min((nr_frames << __page_bits) / cls.object_size, MAX_OBJECTS);
+			unsigned int waste = (nr_frames << __page_bits) - (nr_objects * cls.object_size);
+
+			if (waste * best_frames < best_waste * nr_frames) {
+				best_frames = nr_frames;
+				best_waste = waste;
+			}
+		}
+
+		cls.nr_frames = (uint8_t)best_frames;
+		cls.nr_objects = (uint16_t)__min((best_frames << __page_bits) / cls.object_size, MAX_OBJECTS);
+	}
+}
+
+/**
+ * Makes a new, empty zspage for a class, if the pool may grow by that much.
+ */
+ZsPage *ZsPool::grow(SizeClass& cls, unsigned int class_index)
+{
+	if (nr_frames() + cls.nr_frames > _max_frames) return NULL;
+
+	ZsPage *zspage = new ZsPage();
+	if (!zspage) return NULL;
+
+	bzero(zspage->frames, sizeof(zspage->frames));
+	bzero(zspage->used, sizeof(zspage->used));
+	zspage->nr_used = 0;
+	zspage->size_class = (uint8_t)class_index;
+
+	for (unsigned int i = 0; i < cls.nr_frames; i++) {
+		zspage->frames[i] = sys.mm().pgalloc().allocate(0);
+
+		if (!zspage->frames[i]) {
+			while (i--) sys.mm().pgalloc().free_one(zspage->frames[i]);
+
+			delete zspage;
+			return NULL;
+		}
+	}
+
+	__atomic_add_fetch(&_nr_frames, cls.nr_frames, __ATOMIC_RELAXED);
+	return zspage;
+}
+
+bool ZsPool::alloc(size_t size, ZsHandle& handle)
+{
+	if (size == 0 || size > MAX_OBJECT) return false;
+
+	unsigned int class_index = (unsigned int)((size + CLASS_STEP - 1) / CLASS_STEP) - 1;
+	SizeClass& cls = _classes[class_index];
+
+	// The lock is let go of to grow the class, so another allocation may take the
+	// new zspage's objects first, and it is tried again.
+	for (;;) {
+		{
+			UniqueIRQSaveLock<SpinLock> l(_lock);
+
+			ZsPage *zspage = cls.partial.first();
+			if (zspage) {
+				unsigned int index = 0;
+				while (zspage->used[index / 64] & (1ull << (index % 64))) index++;
+
+				assert(index < cls.nr_objects);
+				zspage->used[index / 64] |= 1ull << (index % 64);
+
+				if (++zspage->nr_used == cls.nr_objects) {
+					cls.partial.remove(*zspage);
+				}
+
+				handle.zspage = zspage;
+				handle.index = (uint16_t)index;
+
+				__atomic_add_fetch(&_nr_objects, 1, __ATOMIC_RELAXED);
+				__atomic_add_fetch(&_bytes_used, cls.object_size, __ATOMIC_RELAXED);
+				return true;
+			}
+		}
+
+		ZsPage *zspage = grow(cls, class_index);
+		if (!zspage) return false;
+
+		UniqueIRQSaveLock<SpinLock> l(_lock);
+		cls.partial.append(*zspage);
+	}
+}
+
+void ZsPool::free(const ZsHandle& handle)
+{
+	UniqueIRQSaveLock<SpinLock> l(_lock);
+
+	ZsPage *zspage = handle.zspage;
+	SizeClass& cls = _classes[zspage->size_class];
+
+	assert(zspage->used[handle.index / 64] & (1ull << (handle.index % 64)));
+	zspage->used[handle.index / 64] &= ~(1ull << (handle.index % 64));
+
+	// A full zspage isn't on the list, and has room again.
+	if (zspage->nr_used-- == cls.nr_objects) {
+		cls.partial.push(*zspage);
+	}
+
+	__atomic_sub_fetch(&_nr_objects, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&_bytes_used, cls.object_size, __ATOMIC_RELAXED);
+}
+
+void ZsPool::write(const ZsHandle& handle, const void *data, size_t size)
+{
+	const SizeClass& cls = _classes[handle.zspage->size_class];
+	size_t offset = (size_t)handle.index * cls.object_size;
+
+	// At most two frames: the object is never bigger than a frame.
+	while (size) {
+		size_t in_frame = offset & (__page_size - 1);
+		size_t chunk = __min(size, (size_t)__page_size - in_frame);
+
+		uint8_t *frame = (uint8_t *)sys.mm().pgalloc().pfdescr_to_vpa(handle.zspage->frames[offset >> __page_bits]);
+		memcpy(frame + in_frame, data, chunk);
+
+		data = (const uint8_t *)data + chunk;
+		offset += chunk;
+		size -= chunk;
+	}
+}
+
+const void *ZsPool::map(const ZsHandle& handle, size_t size, void *scratch) const
+{
+	const SizeClass& cls = _classes[handle.zspage->size_class];
+	size_t offset = (size_t)handle.index * cls.object_size;
+	size_t in_frame = offset & (__page_size - 1);
+
+	const uint8_t *frame = (const uint8_t *)sys.mm().pgalloc().pfdescr_to_vpa(handle.zspage->frames[offset >> __page_bits]);
+	if (in_frame + size <= __page_size) return frame + in_frame;
+
+	size_t first = __page_size - in_frame;
+	const uint8_t *next = (const uint8_t *)sys.mm().pgalloc().pfdescr_to_vpa(handle.zspage->frames[(offset >> __page_bits) + 1]);
+
+	memcpy(scratch, frame + in_frame, first);
+	memcpy((uint8_t *)scratch + first, next, size - first);
+
+	return scratch;
+}
+
+uint64_t ZsPool::shrink()
+{
+	IntrusiveList<ZsPage, &ZsPage::node> empty;
+
+	{
+		UniqueIRQSaveLock<SpinLock> l(_lock);
+
+		for (unsigned int i = 0; i < NR_CLASSES; i++) {
+			ZsPage *zspage = _classes[i].partial.first();
+
+			while (zspage) {
+				ZsPage *next = zspage->node.next;
+
+				if (!zspage->nr_used) {
+					_classes[i].partial.remove(*zspage);
+					empty.append(*zspage);
+				}
+
+				zspage = next;
+			}
+		}
+	}
+
+	uint64_t freed = 0;
+	while (ZsPage *zspage = empty.dequeue()) {
+		unsigned int nr_frames = _classes[zspage->size_class].nr_frames;
+
+		for (unsigned int i = 0; i < nr_frames; i++) {
+			sys.mm().pgalloc().free_one(zspage->frames[i]);
+		}
+
+		freed += nr_frames;
+		delete zspage;
+	}
+
+	__atomic_sub_fetch(&_nr_frames, freed, __ATOMIC_RELAXED);
+	return freed;
+}
@@ -0,0 +1,302 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * net/interface.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/net/interface.h>
+#include <infos/net/net.h>
+#include <infos/net/protocols.h>
+#include <infos/drivers/net/network-device.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/mm.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers::net;
+using namespace infos::mm;
+using namespace infos::net;
+using namespace infos::util;
+
+static const uint8_t broadcast_mac[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+Interface::Interface(NetworkDevice& device, uint32_t address, uint32_t netmask, uint32_t gateway)
+	: _device(device), _address(address), _netmask(netmask), _gateway(gateway), _poll(poll_work, this), _arp_victim(0)
+{
+	device.mac_address(_mac);
+	bzero(_arp_cache, sizeof(_arp_cache));
+}
+
+void Interface::up()
+{
+	_device.set_receive_notifier(receive_notifier, this);
+
+	// Whatever arrived before the notifier was set is taken now.
+	net_workqueue().queue(_poll);
+
+	// A gratuitous ARP request, so that neighbours with a stale entry for the address
+	// update it.
+	send_arp(ARP_OP_REQUEST, NULL, _address);
+}
+
+bool Interface::accepts(uint32_t destination) const
+{
+	return destination == _address || destination == IPV4_BROADCAST || destination == (_address | ~_netmask);
+}
+
+void Interface::receive_notifier(NetworkDevice& device, void *priv)
+{
+	net_workqueue().queue(((Interface *)priv)->_poll);
+}
+
+void Interface::poll_work(void *arg)
+{
+	((Interface *)arg)->poll();
+}
+
+void Interface::poll()
+{
+	for (unsigned int i = 0; i < RX_BUDGET; i++) {
+		PacketBuffer *frame = _device.receive_packet(false);
+		if (!frame) return;
+
+		receive_frame(frame);
+	}
+
+	// The budget has been spent, so the rest wait their turn.
+	net_workqueue().queue(_poll);
+}
+
+void Interface::receive_frame(PacketBuffer *frame)
+{
+	if (frame->length < sizeof(EthernetHeader)) {
+		sys.mm().pktalloc().release(frame);
+		return;
+	}
+
+	const EthernetHeader *eth = (const EthernetHeader *)frame->pull(sizeof(EthernetHeader));
+
+	switch (ntohs(eth->type)) {
+	case ETH_TYPE_ARP:
+		receive_arp(frame);
+		break;
+
+	case ETH_TYPE_IPV4:
+		netstack.receive_ipv4(*this, frame);
+		break;
+
+	default:
+		sys.mm().pktalloc().release(frame);
+		break;
+	}
+}
+
+bool Interface::transmit(const uint8_t *destination, uint16_t type, PacketBuffer *packet)
+{
+	if (packet->headroom() < sizeof(EthernetHeader)) {
+		sys.mm().pktalloc().release(packet);
+		return false;
+	}
+
+	// Short frames are padded here, rather than trusting every device to.
+	size_t length = packet->packet_length() + sizeof(EthernetHeader);
+	if (length < ETH_MIN_FRAME_SIZE) {
+		PacketBuffer *last = packet;
+		while (last->next) last = last->next;
+
+		size_t padding = ETH_MIN_FRAME_SIZE - length;
+		bzero(last->put(padding), padding);
+	}
+
+	EthernetHeader *eth = (EthernetHeader *)packet->push(sizeof(EthernetHeader));
+	memcpy(eth->destination, destination, sizeof(eth->destination));
+	memcpy(eth->source, _mac, sizeof(eth->source));
+	eth->type = htons(type);
+
+	if (_device.transmit_packets(&packet, 1, false)) return true;
+
+	sys.mm().pktalloc().release(packet);
+	return false;
+}
+
+bool Interface::transmit_ipv4(uint32_t destination, PacketBuffer *packet)
+{
+	if (destination == IPV4_BROADCAST || destination == (_address | ~_netmask)) {
+		return transmit(broadcast_mac, ETH_TYPE_IPV4, packet);
+	}
+
+	uint32_t next_hop = destination;
+	if ((destination & _netmask) != (_address & _netmask)) {
+		if (!_gateway) {
+			sys.mm().pktalloc().release(packet);
+			return false;
+		}
+
+		next_hop = _gateway;
+	}
+
+	uint8_t mac[6];
+	{
+		UniqueLock<Mutex> l(_arp_lock);
+
+		ArpEntry *entry = arp_lookup(next_hop);
+		if (!entry) entry = arp_insert(next_hop);
+
+		if (!entry->resolved) {
+			// The oldest packet waiting makes way for this one.
+			if (entry->nr_pending == ARP_MAX_PENDING) {
+				PacketBuffer *oldest = entry->pending;
+				entry->pending = oldest->next_packet;
+				entry->nr_pending--;
+
+				oldest->next_packet = NULL;
+				sys.mm().pktalloc().release(oldest);
+			}
+
+			PacketBuffer **tail = &entry->pending;
+			while (*tail) tail = &(*tail)->next_packet;
+
+			packet->next_packet = NULL;
+			*tail = packet;
+			entry->nr_pending++;
+
+			packet = NULL;
+		} else {
+			memcpy(mac, entry->mac, sizeof(mac));
+		}
+	}
+
+	// Asked for again for each packet that has to wait, in case the last request or
+	// its reply was lost.
+	if (!packet) {
+		send_arp(ARP_OP_REQUEST, NULL, next_hop);
+		return true;
+	}
+
+	return transmit(mac, ETH_TYPE_IPV4, packet);
+}
+
+/**
+ * Called with the ARP lock held.
+ */
+Interface::ArpEntry *Interface::arp_lookup(uint32_t address)
+{
+	for (unsigned int i = 0; i < ARP_CACHE_SIZE; i++) {
+		if (_arp_cache[i].address == address) return &_arp_cache[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Called with the ARP lock held.  Takes an unused entry, or else replaces the entries in
+ * turn, dropping the packets waiting on the one replaced.
+ */
+Interface::ArpEntry *Interface::arp_insert(uint32_t address)
+{
+	ArpEntry *entry = NULL;
+	for (unsigned int i = 0; i < ARP_CACHE_SIZE; i++) {
+		if (!_arp_cache[i].address) {
+			entry = &_arp_cache[i];
+			break;
+		}
+	}
+
+	if (!entry) {
+		entry = &_arp_cache[_arp_victim];
+		_arp_victim = (_arp_victim + 1) % ARP_CACHE_SIZE;
+
+		while (entry->pending) {
+			PacketBuffer *next = entry->pending->next_packet;
+			entry->pending->next_packet = NULL;
+			sys.mm().pktalloc().release(entry->pending);
+			entry->pending = next;
+		}
+	}
+
+	entry->address = address;
+	entry->resolved = false;
+	entry->pending = NULL;
+	entry->nr_pending = 0;
+
+	return entry;
+}
+
+void Interface::receive_arp(PacketBuffer *packet)
+{
+	const ArpPacket *arp = (const ArpPacket *)packet->data();
+
+	if (packet->length < sizeof(ArpPacket) || ntohs(arp->hardware_type) != ARP_HW_ETHERNET ||
+		ntohs(arp->protocol_type) != ETH_TYPE_IPV4 || arp->hardware_length != 6 || arp->protocol_length != 4) {
+		sys.mm().pktalloc().release(packet);
+		return;
+	}
+
+	uint16_t operation = ntohs(arp->operation);
+	uint32_t sender = ntohl(arp->sender_address);
+	uint32_t target = ntohl(arp->target_address);
+
+	uint8_t sender_mac[6];
+	memcpy(sender_mac, arp->sender_mac, sizeof(sender_mac));
+
+	sys.mm().pktalloc().release(packet);
+
+	// A sender that is asking for us is remembered, as we'll be replying to it, but
+	// otherwise only the entries there are already are updated.
+	PacketBuffer *pending = NULL;
+	if (sender) {
+		UniqueLock<Mutex> l(_arp_lock);
+
+		ArpEntry *entry = arp_lookup(sender);
+		if (!entry && target == _address) entry = arp_insert(sender);
+
+		if (entry) {
+			memcpy(entry->mac, sender_mac, sizeof(entry->mac));
+			entry->resolved = true;
+
+			pending = entry->pending;
+			entry->pending = NULL;
+			entry->nr_pending = 0;
+		}
+	}
+
+	while (pending) {
+		PacketBuffer *next = pending->next_packet;
+		pending->next_packet = NULL;
+
+		transmit(sender_mac, ETH_TYPE_IPV4, pending);
+		pending = next;
+	}
+
+	if (operation == ARP_OP_REQUEST && target == _address && sender != _address) {
+		send_arp(ARP_OP_REPLY, sender_mac, sender);
+	}
+}
+
+void Interface::send_arp(uint16_t operation, const uint8_t *target_mac, uint32_t target_address)
+{
+	PacketBuffer *packet = sys.mm().pktalloc().allocate();
+	if (!packet) return;
+
+	ArpPacket *arp = (ArpPacket *)packet->put(sizeof(ArpPacket));
+	arp->hardware_type = htons(ARP_HW_ETHERNET);
+	arp->protocol_type = htons(ETH_TYPE_IPV4);
+	arp->hardware_length = 6;
+	arp->protocol_length = 4;
+	arp->operation = htons(operation);
+	memcpy(arp->sender_mac, _mac, sizeof(arp->sender_mac));
+	arp->sender_address = htonl(_address);
+	arp->target_address = htonl(target_address);
+
+	if (target_mac) {
+		memcpy(arp->target_mac, target_mac, sizeof(arp->target_mac));
+	} else {
+		bzero(arp->target_mac, sizeof(arp->target_mac));
+	}
+
+	transmit(target_mac ? target_mac : broadcast_mac, ETH_TYPE_ARP, packet);
+}
@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * net/ipv4.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/net/net.h>
+#include <infos/net/interface.h>
+#include <infos/net/protocols.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/mm.h>
+
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::net;
+
+void NetworkStack::receive_ipv4(Interface& iface, PacketBuffer *packet)
+{
+	const IPv4Header *ip = (const IPv4Header *)packet->data();
+	size_t header_length = (ip->version_ihl & 0xf) * 4;
+	size_t total_length = packet->length >= sizeof(IPv4Header) ? ntohs(ip->total_length) : 0;
+
+	bool odd = false;
+	if (packet->length < sizeof(IPv4Header) || (ip->version_ihl >> 4) != 4 ||
+		header_length < sizeof(IPv4Header) || header_length > packet->length ||
+		total_length < header_length || total_length > packet->packet_length() ||
+		checksum_fold(checksum_add(0, ip, header_length, odd)) != 0) {
+		sys.mm().pktalloc().release(packet);
+		return;
+	}
+
+	// Fragments aren't reassembled.
+	uint32_t destination = ntohl(ip->destination);
+	if ((ntohs(ip->fragment) & (IPV4_FRAG_MF | IPV4_FRAG_OFFSET)) || !iface.accepts(destination)) {
+		sys.mm().pktalloc().release(packet);
+		return;
+	}
+
+	uint32_t source = ntohl(ip->source);
+	uint8_t protocol = ip->protocol;
+
+	trim_packet(packet, total_length);
+	packet->pull(header_length);
+
+	switch (protocol) {
+	case IP_PROTO_ICMP:
+		receive_icmp(source, destination, packet);
+		break;
+
+	case IP_PROTO_UDP:
+		_udp.receive(source, destination, packet);
+		break;
+
+	case IP_PROTO_TCP:
+		_tcp.receive(source, destination, packet);
+		break;
+
+	default:
+		sys.mm().pktalloc().release(packet);
+		break;
+	}
+}
+
+bool NetworkStack::send_ipv4(uint32_t destination, uint8_t protocol, PacketBuffer *packet)
+{
+	Interface *iface = interface();
+	size_t length = packet->packet_length() + sizeof(IPv4Header);
+
+	// A segment that the device cuts up goes as one packet for now.
+	size_t max_length = packet->gso_size ? 0xffff : ETH_MTU;
+
+	if (!iface || length > max_length || packet->headroom() < sizeof(IPv4Header)) {
+		sys.mm().pktalloc().release(packet);
+		return false;
+	}
+
+	IPv4Header *ip = (IPv4Header *)packet->push(sizeof(IPv4Header));
+	ip->version_ihl = 0x45;
+	ip->tos = 0;
+	ip->total_length = htons(length);
+	ip->id = htons(__atomic_fetch_add(&_next_id, 1, __ATOMIC_RELAXED));
+	ip->fragment = htons(IPV4_FRAG_DF);
+	ip->ttl = IPV4_DEFAULT_TTL;
+	ip->protocol = protocol;
+	ip->checksum = 0;
+	ip->source = htonl(iface->address());
+	ip->destination = htonl(destination);
+
+	bool odd = false;
+	ip->checksum = htons(checksum_fold(checksum_add(0, ip, sizeof(IPv4Header), odd)));
+
+	return iface->transmit_ipv4(destination, packet);
+}
+
+/**
+ * Answers echo requests sent to us (but not to a broadcast address), and ignores
+ * everything else.
+ */
+void NetworkStack::receive_icmp(uint32_t source, uint32_t destination, PacketBuffer *packet)
+{
+	PacketBufferAllocator& pktalloc = sys.mm().pktalloc();
+	size_t length = packet->packet_length();
+
+	const IcmpHeader *icmp = (const IcmpHeader *)packet->data();
+	if (packet->length < sizeof(IcmpHeader) || checksum_fold(checksum_packet(0, packet, 0, length)) != 0 ||
+		icmp->type != ICMP_ECHO_REQUEST || icmp->code != 0 || destination != interface()->address()) {
+		pktalloc.release(packet);
+		return;
+	}
+
+	PacketBuffer *reply = pktalloc.allocate();
+	if (!reply || length > reply->tailroom()) {
+		pktalloc.release(reply);
+		pktalloc.release(packet);
+		return;
+	}
+
+	packet->copy_out(0, reply->put(length), length);
+	pktalloc.release(packet);
+
+	IcmpHeader *header = (IcmpHeader *)reply->data();
+	header->type = ICMP_ECHO_REPLY;
+	header->checksum = 0;
+
+	bool odd = false;
+	header->checksum = htons(checksum_fold(checksum_add(0, header, length, odd)));
+
+	send_ipv4(source, IP_PROTO_ICMP, reply);
+}
@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * net/net.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/net/net.h>
+#include <infos/net/interface.h>
+#include <infos/net/udp.h>
+#include <infos/drivers/net/network-device.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
+#include <infos/kernel/workqueue.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::net;
+using namespace infos::mm;
+using namespace infos::net;
+using namespace infos::util;
+
+ComponentLog infos::net::net_log(syslog, "net");
+
+NetworkStack infos::net::netstack;
+
+static WorkQueue net_wq("knetd", SchedulingEntityPriority::REALTIME);
+
+WorkQueue& infos::net::net_workqueue()
+{
+	return net_wq;
+}
+
+static char net_device_name[16];
+static uint32_t net_address, net_netmask, net_gateway;
+static unsigned int net_prefix;
+
+/**
+ * Parses a.b.c.d, and a /nn prefix length after it if 'prefix' is given.
+ */
+bool infos::net::parse_ipv4(const char *value, uint32_t& address, unsigned int *prefix)
+{
+	uint32_t parsed = 0;
+
+	for (unsigned int i = 0; i < 4; i++) {
+		unsigned int octet = 0, digits = 0;
+		for (; *value >= '0' && *value <= '9'; value++, digits++) {
+			octet = (octet * 10) + (*value - '0');
+		}
+
+		if (!digits || digits > 3 || octet > 255) return false;
+		parsed = (parsed << 8) | octet;
+
+		if (i < 3 && *value++ != '.') return false;
+	}
+
+	if (prefix && *value == '/') {
+		unsigned int length = 0, digits = 0;
+		for (value++; *value >= '0' && *value <= '9'; value++, digits++) {
+			length = (length * 10) + (*value - '0');
+		}
+
+		if (!digits || length > 32) return false;
+		*prefix = length;
+	}
+
+	if (*value) return false;
+
+	address = parsed;
+	return true;
+}
+
+RegisterCmdLineArgument(NetAddress, "net.ip")
+{
+	unsigned int prefix = 24;
+	if (!parse_ipv4(value, net_address, &prefix)) {
+		net_log.messagef(LogLevel::WARNING, "invalid address '%s'", value);
+		net_address = 0;
+		return;
+	}
+
+	net_prefix = prefix;
+	net_netmask = prefix ? ~0u << (32 - prefix) : 0;
+}
+
+RegisterCmdLineArgument(NetGateway, "net.gateway")
+{
+	if (!parse_ipv4(value, net_gateway, NULL)) {
+		net_log.messagef(LogLevel::WARNING, "invalid gateway '%s'", value);
+		net_gateway = 0;
+	}
+}
+
+RegisterCmdLineArgument(NetDevice, "net.dev")
+{
+	strncpy(net_device_name, value, sizeof(net_device_name) - 1);
+}
+
+bool NetworkStack::init(DeviceManager& dm)
+{
+	if (!net_address) {
+		net_log.message(LogLevel::INFO, "no address given (net.ip=): the network is not brought up");
+		return true;
+	}
+
+	if (!net_wq.start()) {
+		net_log.message(LogLevel::ERROR, "unable to start the workers");
+		return false;
+	}
+
+	dm.init_async(DeviceInitGroup::PROTOCOLS, bring_up, this, DeviceInitGroup::NETWORK);
+	return true;
+}
+
+bool NetworkStack::bring_up(void *arg)
+{
+	NetworkStack *stack = (NetworkStack *)arg;
+	NetworkDevice *device;
+
+	if (strlen(net_device_name)) {
+		Device *named;
+		if (!sys.device_manager().try_get_device_by_name(net_device_name, named) ||
+			!named->device_class().is(NetworkDevice::NetworkDeviceClass)) {
+			net_log.messagef(LogLevel::ERROR, "'%s' isn't a network device", net_device_name);
+			return false;
+		}
+
+		device = (NetworkDevice *)named;
+	} else if (!sys.device_manager().try_get_device_by_class(NetworkDevice::NetworkDeviceClass, device)) {
+		net_log.message(LogLevel::WARNING, "there is no network device to bring up");
+		return false;
+	}
+
+	Interface *iface = new (HeapArena::NET) Interface(*device, net_address, net_netmask, net_gateway);
+	__atomic_store_n(&stack->_interface, iface, __ATOMIC_RELEASE);
+
+	iface->up();
+
+	net_log.messagef(LogLevel::INFO, "%s is up, address=%u.%u.%u.%u/%u, gateway=%u.%u.%u.%u",
+		device->name().c_str(),
+		net_address >> 24, (net_address >> 16) & 0xff, (net_address >> 8) & 0xff, net_address & 0xff,
+		net_prefix,
+		net_gateway >> 24, (net_gateway >> 16) & 0xff, (net_gateway >> 8) & 0xff, net_gateway & 0xff);
+
+	return true;
+}
+
+Socket *Socket::create(unsigned int type)
+{
+	switch (type) {
+	case SocketType::DATAGRAM:
+		return new (HeapArena::NET) UdpSocket();
+
+	case SocketType::STREAM:
+		return new (HeapArena::NET) TcpSocket();
+
+	default:
+		return NULL;
+	}
+}
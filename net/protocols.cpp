@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * net/protocols.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/net/protocols.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/mm.h>
+
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::net;
+
+uint32_t infos::net::checksum_add(uint32_t sum, const void *data, size_t size, bool& odd)
+{
+	const uint8_t *p = (const uint8_t *)data;
+
+	// The byte left over from last time is the high half of a word.
+	if (odd && size) {
+		sum += *p++;
+		size--;
+		odd = false;
+	}
+
+	while (size >= 2) {
+		sum += ((uint32_t)p[0] << 8) | p[1];
+		p += 2;
+		size -= 2;
+	}
+
+	if (size) {
+		sum += (uint32_t)p[0] << 8;
+		odd = true;
+	}
+
+	return sum;
+}
+
+uint16_t infos::net::checksum_fold(uint32_t sum)
+{
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+
+	return ~sum & 0xffff;
+}
+
+uint32_t infos::net::checksum_packet(uint32_t sum, const PacketBuffer *packet, size_t offset, size_t size)
+{
+	bool odd = false;
+
+	for (const PacketBuffer *b = packet; b && size; b = b->next) {
+		if (offset >= b->length) {
+			offset -= b->length;
+			continue;
+		}
+
+		size_t n = __min((size_t)b->length - offset, size);
+		sum = checksum_add(sum, b->data() + offset, n, odd);
+		size -= n;
+		offset = 0;
+	}
+
+	return sum;
+}
+
+uint32_t infos::net::checksum_pseudo_header(uint32_t source, uint32_t destination, uint8_t protocol, uint16_t length)
+{
+	return (source >> 16) + (source & 0xffff) + (destination >> 16) + (destination & 0xffff) + protocol + length;
+}
+
+void infos::net::trim_packet(PacketBuffer *packet, size_t length)
+{
+	PacketBuffer *b = packet;
+	while (b->length < length && b->next) {
+		length -= b->length;
+		b = b->next;
+	}
+
+	if (b->length > length) b->length = length;
+
+	sys.mm().pktalloc().release(b->next);
+	b->next = NULL;
+}
@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * net/tcp-cubic.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/net/tcp.h>
+
+using namespace infos::net;
+
+// The window is multiplied by BETA (0.7) on a loss, and grows as C (0.4) * t^3 segments,
+// for t in seconds.  Reno grows by 3(1 - BETA)/(1 + BETA) (0.529) segments per RTT.
+#define CUBIC_BETA_NUM		7
+#define CUBIC_BETA_DEN		10
+#define CUBIC_RENO_NUM		529
+#define CUBIC_RENO_DEN		1000
+
+// Time from the centre of the cubic is only counted this far (in ms), so that t^3 stays
+// well within 64 bits.
+#define CUBIC_MAX_T			60000
+
+// The window never grows past this, however much is acknowledged.
+#define CUBIC_MAX_CWND		(1u << 30)
+
+static uint64_t cube_root(uint64_t value)
+{
+	if (!value) return 0;
+
+	// Newton's method, from above: 2^(bits / 3 + 1) is at least the root.
+	uint64_t x = 1ull << ((64 - __builtin_clzll(value)) / 3 + 1);
+	for (;;) {
+		uint64_t y = (2 * x + value / (x * x)) / 3;
+		if (y >= x) return x;
+		x = y;
+	}
+}
+
+void TcpCubic::init(uint32_t mss)
+{
+	_mss = mss;
+
+	// The initial window of RFC 6928.
+	_cwnd = 10 * mss;
+	_ssthresh = CUBIC_MAX_CWND;
+
+	_w_max = 0;
+	_origin = 0;
+	_k = 0;
+	_epoch_start = 0;
+	_w_est = 0;
+	_est_acc = 0;
+	_cwnd_acc = 0;
+}
+
+void TcpCubic::on_ack(uint32_t acked, uint64_t now, uint64_t srtt)
+{
+	// Slow start, growing by no more than two segments per ACK (RFC 3465).
+	if (_cwnd < _ssthresh) {
+		_cwnd = __min(_cwnd + __min(acked, 2 * _mss), CUBIC_MAX_CWND);
+		return;
+	}
+
+	if (!_epoch_start) {
+		_epoch_start = now ? now : 1;
+		_w_est = _cwnd;
+		_est_acc = 0;
+		_cwnd_acc = 0;
+
+		// K is how long it takes to get back to where the loss happened: C * K^3 is
+		// what the window fell by, in segments, so, in ms, K^3 = 2.5e9 * that.
+		if (_cwnd < _w_max) {
+			_k = cube_root((uint64_t)(_w_max - _cwnd) * 2500000000ull / _mss);
+			_origin = _w_max;
+		} else {
+			_k = 0;
+			_origin = _cwnd;
+		}
+	}
+
+	// Where the window should be an RTT from now.
+	int64_t t = (int64_t)(now - _epoch_start + srtt) - (int64_t)_k;
+	if (t > CUBIC_MAX_T) t = CUBIC_MAX_T;
+	if (t < -CUBIC_MAX_T) t = -CUBIC_MAX_T;
+
+	int64_t offset = 4 * t * t * t / 10000000 * (int64_t)_mss / 1000;
+	int64_t target = (int64_t)_origin + offset;
+	if (target < (int64_t)_mss) target = _mss;
+
+	// It is never slower than Reno would be...
+	_est_acc += (uint64_t)acked * _mss * CUBIC_RENO_NUM / CUBIC_RENO_DEN;
+	_w_est += _est_acc / _cwnd;
+	_est_acc %= _cwnd;
+
+	if ((int64_t)_w_est > target) target = _w_est;
+
+	// ...and never grows by more than half again per RTT.
+	if (target > (int64_t)_cwnd + _cwnd / 2) target = _cwnd + _cwnd / 2;
+
+	if (target > (int64_t)_cwnd) {
+		_cwnd_acc += (uint64_t)(target - _cwnd) * acked;
+		_cwnd = __min(_cwnd + (uint32_t)(_cwnd_acc / _cwnd), CUBIC_MAX_CWND);
+		_cwnd_acc %= _cwnd;
+	}
+}
+
+void TcpCubic::on_loss()
+{
+	_epoch_start = 0;
+
+	// If this loss came sooner than the last, another flow is probably taking more of
+	// the link, so it is given more room (fast convergence).
+	if (_cwnd < _w_max) {
+		_w_max = (uint64_t)_cwnd * (CUBIC_BETA_DEN + CUBIC_BETA_NUM) / (2 * CUBIC_BETA_DEN);
+	} else {
+		_w_max = _cwnd;
+	}
+
+	_ssthresh = __max((uint32_t)((uint64_t)_cwnd * CUBIC_BETA_NUM / CUBIC_BETA_DEN), 2 * _mss);
+	_cwnd = _ssthresh;
+}
+
+void TcpCubic::on_timeout()
+{
+	on_loss();
+	_cwnd = _mss;
+}
@@ -0,0 +1,1548 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * net/tcp.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/net/tcp.h>
+#include <infos/net/net.h>
+#include <infos/net/interface.h>
+#include <infos/net/protocols.h>
+#include <infos/drivers/net/network-device.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/mm/mm.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::fs;
+using namespace infos::mm;
+using namespace infos::net;
+using namespace infos::util;
+using namespace infos::drivers::net;
+
+// The biggest segment that fits in a frame, and what is assumed of a peer that doesn't
+// say what it can take.
+#define TCP_MSS					(ETH_MTU - sizeof(IPv4Header) - sizeof(TcpHeader))
+#define TCP_DEFAULT_MSS			536
+
+#define TCP_DELAYED_ACK_NS		40000000ull
+#define TCP_INITIAL_RTO_NS		1000000000ull
+#define TCP_MIN_RTO_NS			200000000ull
+#define TCP_MAX_RTO_NS			60000000000ull
+#define TCP_TIME_WAIT_NS		60000000000ull
+
+#define TCP_MAX_SYN_RETRIES		6
+#define TCP_MAX_RETRIES			12
+#define TCP_MAX_BACKLOG			128
+
+static inline bool seq_lt(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+static inline bool seq_leq(uint32_t a, uint32_t b) { return (int32_t)(a - b) <= 0; }
+static inline bool seq_gt(uint32_t a, uint32_t b) { return (int32_t)(a - b) > 0; }
+static inline bool seq_geq(uint32_t a, uint32_t b) { return (int32_t)(a - b) >= 0; }
+
+static inline uint64_t now_ns()
+{
+	return sys.runtime().time_since_epoch().count();
+}
+
+static inline uint32_t read_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void write_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/**
+ * The initial sequence number of a connection: a clock that ticks every 4 us (RFC 793),
+ * offset by a hash of the connection, so that connections don't start from the same
+ * number.
+ */
+static uint32_t generate_iss(uint64_t key)
+{
+	return (uint32_t)(now_ns() / 4000) + (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+static void ring_read(const uint8_t *ring, size_t size, size_t pos, void *buffer, size_t length)
+{
+	pos %= size;
+
+	size_t first = __min(length, size - pos);
+	memcpy(buffer, ring + pos, first);
+	memcpy((uint8_t *)buffer + first, ring, length - first);
+}
+
+static void ring_write(uint8_t *ring, size_t size, size_t pos, const void *buffer, size_t length)
+{
+	pos %= size;
+
+	size_t first = __min(length, size - pos);
+	memcpy(ring + pos, buffer, first);
+	memcpy(ring, (const uint8_t *)buffer + first, length - first);
+}
+
+/**
+ * Puts a TCP header, with the options, in front of the packet's data, and sends it.  The
+ * checksum is left to the device if it can do it.  Takes the packet's reference.
+ */
+static bool transmit_segment(uint32_t destination, uint16_t source_port, uint16_t destination_port,
+		uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window,
+		const uint8_t *options, size_t options_length, PacketBuffer *packet, uint16_t gso_size)
+{
+	Interface *iface = netstack.interface();
+	if (!iface) {
+		sys.mm().pktalloc().release(packet);
+		return false;
+	}
+
+	size_t header_length = sizeof(TcpHeader) + options_length;
+	size_t length = packet->packet_length() + header_length;
+
+	TcpHeader *tcp = (TcpHeader *)packet->push(header_length);
+	tcp->source_port = htons(source_port);
+	tcp->destination_port = htons(destination_port);
+	tcp->sequence = htonl(seq);
+	tcp->ack = htonl(ack);
+	tcp->data_offset = (header_length / 4) << 4;
+	tcp->flags = flags;
+	tcp->window = htons(window);
+	tcp->checksum = 0;
+	tcp->urgent = 0;
+
+	if (options_length) memcpy(tcp + 1, options, options_length);
+
+	uint32_t sum = checksum_pseudo_header(iface->address(), destination, IP_PROTO_TCP, length);
+
+	if (iface->device().offloads() & NetworkOffload::TX_CHECKSUM) {
+		// The device adds in the rest, from the header on.  For a segment it cuts up, it
+		// takes the length out again, and puts in each piece's own.
+		tcp->checksum = htons(~checksum_fold(sum) & 0xffff);
+		packet->csum_start = packet->offset;
+		packet->csum_offset = 16;
+	} else {
+		tcp->checksum = htons(checksum_fold(checksum_packet(sum, packet, 0, length)));
+	}
+
+	packet->gso_size = gso_size;
+	return netstack.send_ipv4(destination, IP_PROTO_TCP, packet);
+}
+
+TcpSocket::TcpSocket()
+	: _state(TcpState::CLOSED), _nonblocking(false), _error(false), _bound(false),
+	_local_port(0), _remote_address(0), _remote_port(0),
+	_iss(0), _snd_una(0), _snd_nxt(0), _snd_max(0), _snd_wnd(0), _snd_wl1(0), _snd_wl2(0), _snd_wscale(0),
+	_mss(TCP_DEFAULT_MSS), _fin_queued(false), _snd_buf(NULL), _snd_head(0), _snd_len(0), _snd_seq(0),
+	_nr_scoreboard(0), _dupacks(0), _recovery(false), _recover(0), _rexmit_next(0),
+	_rtt_timing(false), _rtt_seq(0), _rtt_start(0), _srtt(0), _rttvar(0), _rto(TCP_INITIAL_RTO_NS), _retries(0),
+	_irs(0), _rcv_nxt(0), _rcv_adv(0), _rcv_wscale(0), _sack_ok(false), _fin_received(false),
+	_rcv_buf(NULL), _rcv_head(0), _rcv_len(0), _nr_ooo(0), _ack_pending(0),
+	_rto_deadline(0), _delack_deadline(0), _timewait_deadline(0),
+	_timer(timer_fn, this), _timer_work(timer_work, this),
+	_parent(NULL), _accept_head(NULL), _accept_tail(NULL), _accept_next(NULL), _backlog(0), _nr_children(0)
+{
+	_cc.init(_mss);
+}
+
+bool TcpSocket::allocate_buffers()
+{
+	if (!_snd_buf) _snd_buf = new (HeapArena::NET) uint8_t[BUFFER_SIZE];
+	if (!_rcv_buf) _rcv_buf = new (HeapArena::NET) uint8_t[BUFFER_SIZE];
+
+	return _snd_buf && _rcv_buf;
+}
+
+uint64_t TcpSocket::connection_key() const
+{
+	return ((uint64_t)_remote_address << 32) | ((uint64_t)_remote_port << 16) | _local_port;
+}
+
+/**
+ * Whether both ends know each other's sequence numbers, and so whether data can flow.
+ */
+bool TcpSocket::synchronized() const
+{
+	switch (_state) {
+	case TcpState::ESTABLISHED:
+	case TcpState::FIN_WAIT_1:
+	case TcpState::FIN_WAIT_2:
+	case TcpState::CLOSING:
+	case TcpState::TIME_WAIT:
+	case TcpState::CLOSE_WAIT:
+	case TcpState::LAST_ACK:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+void TcpSocket::set_state(TcpState::TcpState state)
+{
+	_state = state;
+
+	_state_change.notify_all();
+	_readers.notify_all();
+	_writers.notify_all();
+	File::wake_pollers(this);
+}
+
+void TcpSocket::fail()
+{
+	_error = true;
+	finish();
+}
+
+/**
+ * Leaves the connection for good: its timers are stopped, and it is taken out of the
+ * table, so nothing more arrives for it.
+ */
+void TcpSocket::finish()
+{
+	bool pending_child = _parent && _state == TcpState::SYN_RECEIVED;
+
+	_rto_deadline = _delack_deadline = _timewait_deadline = 0;
+	arm_timer();
+
+	if (_remote_port) netstack.tcp().remove_connection(connection_key());
+	if (_bound) {
+		netstack.tcp().unbind(_local_port);
+		_bound = false;
+	}
+
+	set_state(TcpState::CLOSED);
+
+	if (pending_child) {
+		UniqueLock<Mutex> l(_parent->_lock);
+		_parent->_nr_children--;
+	}
+}
+
+void TcpSocket::enter_time_wait()
+{
+	set_state(TcpState::TIME_WAIT);
+
+	_rto_deadline = 0;
+	_timewait_deadline = now_ns() + TCP_TIME_WAIT_NS;
+	arm_timer();
+}
+
+int TcpSocket::read(void *buffer, size_t size)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	while (!_rcv_len) {
+		if (_error || _state == TcpState::CLOSED || _state == TcpState::LISTEN) return _fin_received ? 0 : -1;
+		if (_fin_received || _nonblocking) return 0;
+
+		_readers.wait(_lock);
+	}
+
+	size_t n = __min(size, _rcv_len);
+	ring_read(_rcv_buf, BUFFER_SIZE, _rcv_head, buffer, n);
+	_rcv_head = (_rcv_head + n) % BUFFER_SIZE;
+	_rcv_len -= n;
+
+	// Tell the peer once the window has opened by enough to be worth sending into, so that
+	// it isn't left waiting on a window it thinks is shut.
+	if (synchronized() && !_fin_received) {
+		uint32_t edge = _rcv_nxt + (BUFFER_SIZE - _rcv_len);
+		if (seq_geq(edge, _rcv_adv + __min(BUFFER_SIZE / 2, 2 * _mss))) send_ack();
+	}
+
+	return (int)n;
+}
+
+int TcpSocket::write(const void *buffer, size_t size)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	size_t done = 0;
+	while (done < size) {
+		bool open = _state == TcpState::SYN_SENT || _state == TcpState::SYN_RECEIVED
+			|| _state == TcpState::ESTABLISHED || _state == TcpState::CLOSE_WAIT;
+		if (_error || _fin_queued || !open) return done ? (int)done : -1;
+
+		size_t room = BUFFER_SIZE - _snd_len;
+		if (!room) {
+			if (_nonblocking) break;
+
+			_writers.wait(_lock);
+			continue;
+		}
+
+		size_t n = __min(room, size - done);
+		ring_write(_snd_buf, BUFFER_SIZE, _snd_head + _snd_len, (const uint8_t *)buffer + done, n);
+		_snd_len += n;
+		done += n;
+
+		output();
+	}
+
+	return (int)done;
+}
+
+unsigned int TcpSocket::poll()
+{
+	UniqueLock<Mutex> l(_lock);
+
+	unsigned int events = 0;
+
+	if (_state == TcpState::LISTEN) {
+		if (_accept_head) events |= PollEvents::READABLE;
+		return events;
+	}
+
+	if (_rcv_len || _fin_received || _error || _state == TcpState::CLOSED) events |= PollEvents::READABLE;
+	if ((_state == TcpState::ESTABLISHED || _state == TcpState::CLOSE_WAIT) && !_fin_queued && _snd_len < BUFFER_SIZE) {
+		events |= PollEvents::WRITABLE;
+	}
+
+	return events;
+}
+
+/**
+ * Sends a FIN after whatever is still to be sent, or, for a listener, stops listening, and
+ * closes the connections that haven't been accepted.  The socket lingers until the peer
+ * has closed its side too.
+ */
+void TcpSocket::close()
+{
+	TcpSocket *children = NULL;
+
+	{
+		UniqueLock<Mutex> l(_lock);
+
+		switch (_state) {
+		case TcpState::LISTEN:
+			netstack.tcp().remove_listener(_local_port);
+			children = _accept_head;
+			_accept_head = _accept_tail = NULL;
+			finish();
+			break;
+
+		case TcpState::CLOSED:
+		case TcpState::SYN_SENT:
+			finish();
+			break;
+
+		case TcpState::SYN_RECEIVED:
+		case TcpState::ESTABLISHED:
+			_fin_queued = true;
+			set_state(TcpState::FIN_WAIT_1);
+			output();
+			break;
+
+		case TcpState::CLOSE_WAIT:
+			_fin_queued = true;
+			set_state(TcpState::LAST_ACK);
+			output();
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	while (children) {
+		TcpSocket *next = children->_accept_next;
+		children->_accept_next = NULL;
+		children->close();
+		children = next;
+	}
+}
+
+bool TcpSocket::bind(const SocketAddress& local)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	if (_local_port || _state != TcpState::CLOSED || _error) return false;
+
+	Interface *iface = netstack.interface();
+	if (local.address && (!iface || local.address != iface->address())) return false;
+
+	uint16_t port = local.port;
+	if (!netstack.tcp().bind(port)) return false;
+
+	_local_port = port;
+	_bound = true;
+	return true;
+}
+
+/**
+ * Starts the handshake, and waits for it to finish, unless the socket doesn't block, in
+ * which case it becomes writable once it has.
+ */
+bool TcpSocket::connect(const SocketAddress& remote)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	if (_state != TcpState::CLOSED || _error || !remote.address || !remote.port) return false;
+	if (!allocate_buffers()) return false;
+
+	if (!_local_port) {
+		uint16_t port = 0;
+		if (!netstack.tcp().bind(port)) return false;
+
+		_local_port = port;
+		_bound = true;
+	}
+
+	_remote_address = remote.address;
+	_remote_port = remote.port;
+
+	if (!netstack.tcp().add_connection(*this)) {
+		_remote_port = 0;
+		return false;
+	}
+
+	_iss = generate_iss(connection_key());
+	_snd_una = _iss;
+	_snd_seq = _iss + 1;
+	_rcv_wscale = WINDOW_SCALE;
+
+	set_state(TcpState::SYN_SENT);
+
+	send_segment(_iss, 0, TCP_SYN);
+	_snd_nxt = _snd_max = _iss + 1;
+	arm_rto();
+
+	if (_nonblocking) return true;
+
+	while (_state == TcpState::SYN_SENT || _state == TcpState::SYN_RECEIVED) {
+		_state_change.wait(_lock);
+	}
+
+	return !_error && synchronized();
+}
+
+bool TcpSocket::listen(unsigned int backlog)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	if (_state != TcpState::CLOSED || !_bound) return false;
+
+	_backlog = __max(1, __min(backlog, TCP_MAX_BACKLOG));
+	if (!netstack.tcp().add_listener(*this)) return false;
+
+	set_state(TcpState::LISTEN);
+	return true;
+}
+
+Socket *TcpSocket::accept()
+{
+	UniqueLock<Mutex> l(_lock);
+
+	while (!_accept_head) {
+		if (_state != TcpState::LISTEN || _nonblocking) return NULL;
+		_readers.wait(_lock);
+	}
+
+	TcpSocket *child = _accept_head;
+	_accept_head = child->_accept_next;
+	if (!_accept_head) _accept_tail = NULL;
+	child->_accept_next = NULL;
+	_nr_children--;
+
+	return child;
+}
+
+/**
+ * Takes in what the peer said it can do: the socket only scales windows, or sends SACK
+ * blocks, if both ends offered to.
+ */
+void TcpSocket::negotiate(const TcpSegment& segment)
+{
+	_mss = __min(segment.mss ? segment.mss : TCP_DEFAULT_MSS, TCP_MSS);
+
+	if (segment.window_scale >= 0) {
+		_snd_wscale = segment.window_scale;
+		_rcv_wscale = WINDOW_SCALE;
+	} else {
+		_snd_wscale = 0;
+		_rcv_wscale = 0;
+	}
+
+	_sack_ok = segment.sack_permitted;
+	_cc.init(_mss);
+}
+
+/**
+ * A SYN for a listener: a connection is made for it, in SYN_RECEIVED, which is queued to
+ * be accepted once the handshake is over.  The SYN is dropped, and so retried by the peer,
+ * while the backlog is full.
+ */
+void TcpSocket::syn_arrived(const TcpSegment& segment)
+{
+	TcpSocket *child;
+
+	{
+		UniqueLock<Mutex> l(_lock);
+
+		if (_state != TcpState::LISTEN || _nr_children >= _backlog) return;
+
+		child = new (HeapArena::NET) TcpSocket();
+		if (!child) return;
+
+		if (!child->allocate_buffers()) {
+			delete child;
+			return;
+		}
+
+		child->_local_port = _local_port;
+		child->_remote_address = segment.source;
+		child->_remote_port = segment.source_port;
+		child->_parent = this;
+
+		child->negotiate(segment);
+		child->_irs = segment.sequence;
+		child->_rcv_nxt = segment.sequence + 1;
+		child->_rcv_adv = child->_rcv_nxt;
+
+		child->_iss = generate_iss(child->connection_key());
+		child->_snd_una = child->_iss;
+		child->_snd_nxt = child->_snd_max = child->_iss + 1;
+		child->_snd_seq = child->_iss + 1;
+		child->_snd_wnd = segment.window;
+		child->_snd_wl1 = segment.sequence;
+		child->_snd_wl2 = child->_iss;
+
+		child->_state = TcpState::SYN_RECEIVED;
+		_nr_children++;
+	}
+
+	if (!netstack.tcp().add_connection(*child)) {
+		UniqueLock<Mutex> l(_lock);
+		_nr_children--;
+		delete child;
+		return;
+	}
+
+	UniqueLock<Mutex> l(child->_lock);
+	if (child->_state != TcpState::SYN_RECEIVED) return;
+
+	child->send_segment(child->_iss, 0, TCP_SYN | TCP_ACK);
+	child->arm_rto();
+}
+
+void TcpSocket::syn_sent_arrived(const TcpSegment& segment)
+{
+	if (segment.flags & TCP_ACK) {
+		if (seq_leq(segment.ack, _iss) || seq_gt(segment.ack, _snd_max)) {
+			if (!(segment.flags & TCP_RST)) Tcp::send_reset(segment);
+			return;
+		}
+	}
+
+	if (segment.flags & TCP_RST) {
+		if (segment.flags & TCP_ACK) fail();
+		return;
+	}
+
+	if (!(segment.flags & TCP_SYN)) return;
+
+	negotiate(segment);
+	_irs = segment.sequence;
+	_rcv_nxt = segment.sequence + 1;
+	_rcv_adv = _rcv_nxt;
+
+	// The window in a SYN is never scaled.
+	_snd_wnd = segment.window;
+	_snd_wl1 = segment.sequence;
+	_snd_wl2 = segment.ack;
+
+	if (!(segment.flags & TCP_ACK)) {
+		// Both ends opened at once, so this end answers as a listener would.
+		set_state(TcpState::SYN_RECEIVED);
+		send_segment(_iss, 0, TCP_SYN | TCP_ACK);
+		arm_rto();
+		return;
+	}
+
+	_snd_una = segment.ack;
+	_retries = 0;
+	_rto_deadline = 0;
+	if (_rtt_timing) sample_rtt(now_ns());
+
+	established();
+	if (_state != TcpState::ESTABLISHED) return;
+
+	send_ack();
+	output();
+	arm_timer();
+}
+
+/**
+ * Whether any of the segment is inside the receive window (RFC 793, 3.3).
+ */
+bool TcpSocket::acceptable(const TcpSegment& segment) const
+{
+	uint32_t window = BUFFER_SIZE - _rcv_len;
+
+	if (!segment.length) {
+		if (!window) return segment.sequence == _rcv_nxt;
+		return seq_leq(_rcv_nxt, segment.sequence) && seq_lt(segment.sequence, _rcv_nxt + window);
+	}
+
+	if (!window) return false;
+
+	uint32_t last = segment.sequence + segment.length - 1;
+	return (seq_leq(_rcv_nxt, segment.sequence) && seq_lt(segment.sequence, _rcv_nxt + window))
+		|| (seq_leq(_rcv_nxt, last) && seq_lt(last, _rcv_nxt + window));
+}
+
+void TcpSocket::established()
+{
+	set_state(TcpState::ESTABLISHED);
+
+	if (!_parent) return;
+
+	bool orphaned = false;
+	{
+		UniqueLock<Mutex> l(_parent->_lock);
+
+		if (_parent->_state == TcpState::LISTEN) {
+			_accept_next = NULL;
+			if (_parent->_accept_tail) {
+				_parent->_accept_tail->_accept_next = this;
+			} else {
+				_parent->_accept_head = this;
+			}
+
+			_parent->_accept_tail = this;
+			_parent->_readers.notify_all();
+			File::wake_pollers(_parent);
+		} else {
+			orphaned = true;
+		}
+	}
+
+	// No-one is going to accept the connection, so it is reset.
+	if (orphaned) {
+		send_segment(_snd_nxt, 0, TCP_RST | TCP_ACK);
+		finish();
+	}
+}
+
+/**
+ * Handles a segment for a connection that has been started, with the socket's lock
+ * held.
+ */
+void TcpSocket::segment_arrived(const TcpSegment& segment, const PacketBuffer *data)
+{
+	switch (_state) {
+	case TcpState::CLOSED:
+	case TcpState::LISTEN:
+		return;
+
+	case TcpState::SYN_SENT:
+		syn_sent_arrived(segment);
+		return;
+
+	default:
+		break;
+	}
+
+	if (!acceptable(segment)) {
+		if (!(segment.flags & TCP_RST)) send_ack();
+		return;
+	}
+
+	if (segment.flags & TCP_RST) {
+		// A connection that was never accepted just goes away.
+		if (_state == TcpState::SYN_RECEIVED && _parent) {
+			finish();
+		} else {
+			fail();
+		}
+		return;
+	}
+
+	if (segment.flags & TCP_SYN) {
+		// A SYN in the window means the peer has lost track of the connection.
+		send_segment(_snd_nxt, 0, TCP_RST | TCP_ACK);
+		fail();
+		return;
+	}
+
+	if (!(segment.flags & TCP_ACK)) return;
+
+	if (_state == TcpState::SYN_RECEIVED) {
+		if (seq_leq(segment.ack, _snd_una) || seq_gt(segment.ack, _snd_max)) {
+			Tcp::send_reset(segment);
+			return;
+		}
+
+		_snd_wnd = (uint32_t)segment.window << _snd_wscale;
+		_snd_wl1 = segment.sequence;
+		_snd_wl2 = segment.ack;
+
+		established();
+		if (_state != TcpState::ESTABLISHED) return;
+	}
+
+	if (!process_ack(segment)) return;
+
+	switch (_state) {
+	case TcpState::FIN_WAIT_1:
+		if (fin_acked()) set_state(TcpState::FIN_WAIT_2);
+		break;
+
+	case TcpState::CLOSING:
+		if (fin_acked()) enter_time_wait();
+		break;
+
+	case TcpState::LAST_ACK:
+		if (fin_acked()) {
+			finish();
+			return;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	if (_state == TcpState::ESTABLISHED || _state == TcpState::FIN_WAIT_1 || _state == TcpState::FIN_WAIT_2) {
+		receive_data(segment, data);
+
+		// Only a FIN that is next in the stream counts: one after a gap is sent again.
+		if ((segment.flags & TCP_FIN) && !_fin_received && segment.sequence + segment.length == _rcv_nxt) {
+			_fin_received = true;
+			_rcv_nxt++;
+			_ack_pending = 2;
+
+			if (_state == TcpState::ESTABLISHED) {
+				set_state(TcpState::CLOSE_WAIT);
+			} else if (_state == TcpState::FIN_WAIT_1) {
+				if (fin_acked()) {
+					enter_time_wait();
+				} else {
+					set_state(TcpState::CLOSING);
+				}
+			} else {
+				enter_time_wait();
+			}
+		}
+	}
+
+	output();
+	schedule_ack();
+}
+
+/**
+ * Takes in the acknowledgement, and window, in a segment.  Returns false if the segment is
+ * to be dropped.
+ */
+bool TcpSocket::process_ack(const TcpSegment& segment)
+{
+	uint32_t ack = segment.ack;
+
+	if (seq_gt(ack, _snd_max)) {
+		send_ack();
+		return false;
+	}
+
+	if (seq_lt(ack, _snd_una)) return true;
+
+	bool window_changed = false;
+	if (seq_lt(_snd_wl1, segment.sequence) || (_snd_wl1 == segment.sequence && seq_leq(_snd_wl2, ack))) {
+		uint32_t window = (uint32_t)segment.window << _snd_wscale;
+
+		window_changed = window != _snd_wnd;
+		_snd_wnd = window;
+		_snd_wl1 = segment.sequence;
+		_snd_wl2 = ack;
+	}
+
+	if (_sack_ok) merge_sack(segment);
+
+	uint32_t acked = ack - _snd_una;
+	if (!acked) {
+		// A duplicate ACK is one that acknowledges nothing new, and carries nothing else,
+		// while there is data outstanding: the peer got something after a loss.
+		if (!segment.length && !window_changed && !(segment.flags & (TCP_SYN | TCP_FIN)) && _snd_una != _snd_max) {
+			_dupacks++;
+			if (_recovery) {
+				retransmit_hole();
+			} else if (_dupacks == 3 || sacked_bytes() >= 3 * _mss) {
+				enter_recovery();
+			}
+		}
+
+		return true;
+	}
+
+	uint64_t now = now_ns();
+
+	_dupacks = 0;
+	_retries = 0;
+	if (_rtt_timing && seq_geq(ack, _rtt_seq)) sample_rtt(now);
+
+	// What has been acknowledged is done with.
+	if (seq_gt(ack, _snd_seq)) {
+		size_t n = __min(ack - _snd_seq, _snd_len);
+		_snd_head = (_snd_head + n) % BUFFER_SIZE;
+		_snd_len -= n;
+		_snd_seq += n;
+	}
+
+	_snd_una = ack;
+	if (seq_lt(_snd_nxt, _snd_una)) _snd_nxt = _snd_una;
+	if (seq_lt(_rexmit_next, _snd_una)) _rexmit_next = _snd_una;
+	trim_scoreboard();
+
+	if (_recovery) {
+		if (seq_geq(ack, _recover)) {
+			_recovery = false;
+			_cc.on_recovered();
+		} else {
+			// A partial ACK: the next hole was lost too.
+			retransmit_hole();
+		}
+	} else {
+		_cc.on_ack(acked, now / 1000000, (_srtt ? _srtt : _rto) / 1000000);
+	}
+
+	if (_snd_una == _snd_max) {
+		_rto_deadline = 0;
+		arm_timer();
+	} else {
+		arm_rto();
+	}
+
+	_writers.notify_all();
+	File::wake_pollers(this);
+	return true;
+}
+
+/**
+ * Adds the SACK blocks in a segment to the scoreboard, joining those that touch, and
+ * dropping the lowest once it is full.
+ */
+void TcpSocket::merge_sack(const TcpSegment& segment)
+{
+	for (unsigned int i = 0; i < segment.nr_sack; i++) {
+		TcpRange block = segment.sack[i];
+
+		if (!seq_lt(block.start, block.end) || seq_leq(block.end, _snd_una) || seq_gt(block.end, _snd_max)) continue;
+		if (seq_lt(block.start, _snd_una)) block.start = _snd_una;
+
+		// Whatever the block touches is taken into it.
+		unsigned int j = 0;
+		while (j < _nr_scoreboard) {
+			TcpRange& r = _scoreboard[j];
+			if (seq_leq(r.start, block.end) && seq_leq(block.start, r.end)) {
+				if (seq_lt(r.start, block.start)) block.start = r.start;
+				if (seq_gt(r.end, block.end)) block.end = r.end;
+
+				_scoreboard[j] = _scoreboard[--_nr_scoreboard];
+			} else {
+				j++;
+			}
+		}
+
+		if (_nr_scoreboard == MAX_SCOREBOARD) {
+			unsigned int lowest = 0;
+			for (j = 1; j < _nr_scoreboard; j++) {
+				if (seq_lt(_scoreboard[j].start, _scoreboard[lowest].start)) lowest = j;
+			}
+
+			_scoreboard[lowest] = _scoreboard[--_nr_scoreboard];
+		}
+
+		_scoreboard[_nr_scoreboard++] = block;
+	}
+}
+
+void TcpSocket::trim_scoreboard()
+{
+	unsigned int i = 0;
+	while (i < _nr_scoreboard) {
+		TcpRange& r = _scoreboard[i];
+		if (seq_leq(r.end, _snd_una)) {
+			_scoreboard[i] = _scoreboard[--_nr_scoreboard];
+			continue;
+		}
+
+		if (seq_lt(r.start, _snd_una)) r.start = _snd_una;
+		i++;
+	}
+}
+
+uint32_t TcpSocket::sacked_bytes() const
+{
+	uint32_t total = 0;
+	for (unsigned int i = 0; i < _nr_scoreboard; i++) {
+		total += _scoreboard[i].end - _scoreboard[i].start;
+	}
+
+	return total;
+}
+
+/**
+ * Puts the segment's data into the receive ring, at its place in the stream.  Data after
+ * a gap is remembered as an out-of-order range, and in-order data takes in any ranges it
+ * reaches.
+ */
+void TcpSocket::receive_data(const TcpSegment& segment, const PacketBuffer *data)
+{
+	if (!segment.length) return;
+
+	uint32_t seq = segment.sequence;
+	size_t length = segment.length;
+	size_t skip = 0;
+
+	if (seq_lt(seq, _rcv_nxt)) {
+		uint32_t old = _rcv_nxt - seq;
+		if (old >= length) {
+			// All of it has been seen already, so the ACK was lost.
+			_ack_pending = 2;
+			return;
+		}
+
+		skip = old;
+		seq = _rcv_nxt;
+		length -= old;
+	}
+
+	size_t space = BUFFER_SIZE - _rcv_len;
+	size_t offset = seq - _rcv_nxt;
+	if (offset >= space) {
+		_ack_pending = 2;
+		return;
+	}
+
+	length = __min(length, space - offset);
+
+	size_t pos = (_rcv_head + _rcv_len + offset) % BUFFER_SIZE;
+	size_t first = __min(length, BUFFER_SIZE - pos);
+	data->copy_out(skip, _rcv_buf + pos, first);
+	data->copy_out(skip + first, _rcv_buf, length - first);
+
+	if (offset) {
+		TcpRange range = { seq, (uint32_t)(seq + length) };
+
+		unsigned int i = 0;
+		while (i < _nr_ooo) {
+			TcpRange& r = _ooo[i];
+			if (seq_leq(r.start, range.end) && seq_leq(range.start, r.end)) {
+				if (seq_lt(r.start, range.start)) range.start = r.start;
+				if (seq_gt(r.end, range.end)) range.end = r.end;
+
+				for (unsigned int j = i; j + 1 < _nr_ooo; j++) _ooo[j] = _ooo[j + 1];
+				_nr_ooo--;
+			} else {
+				i++;
+			}
+		}
+
+		// The newest range goes first, as the first SACK block is to be the most recent.
+		if (_nr_ooo == MAX_OOO_RANGES) _nr_ooo--;
+		for (i = _nr_ooo; i > 0; i--) _ooo[i] = _ooo[i - 1];
+		_ooo[0] = range;
+		_nr_ooo++;
+
+		_ack_pending = 2;
+		return;
+	}
+
+	bool filled = _nr_ooo > 0;
+
+	_rcv_nxt += length;
+	_rcv_len += length;
+
+	bool merged;
+	do {
+		merged = false;
+		for (unsigned int i = 0; i < _nr_ooo; i++) {
+			if (seq_leq(_ooo[i].start, _rcv_nxt)) {
+				if (seq_gt(_ooo[i].end, _rcv_nxt)) {
+					uint32_t n = _ooo[i].end - _rcv_nxt;
+					_rcv_nxt += n;
+					_rcv_len += n;
+				}
+
+				for (unsigned int j = i; j + 1 < _nr_ooo; j++) _ooo[j] = _ooo[j + 1];
+				_nr_ooo--;
+				merged = true;
+				break;
+			}
+		}
+	} while (merged);
+
+	// Filling in a gap is ACKed straight away, so the sender hears about it (RFC 5681).
+	if (filled) {
+		_ack_pending = 2;
+	} else {
+		_ack_pending++;
+	}
+
+	_readers.notify_all();
+	File::wake_pollers(this);
+}
+
+/**
+ * How much data goes in a full segment, which is the MSS less the options it carries.
+ */
+uint32_t TcpSocket::segment_size() const
+{
+	uint32_t options = (_sack_ok && _nr_ooo) ? 4 + 8 * _nr_ooo : 0;
+	return _mss - options;
+}
+
+/**
+ * Sends what can be sent of the data that hasn't been sent yet, within the congestion
+ * window and the peer's window, in segments as big as the device can take, and then the
+ * FIN, if the socket has been closed.
+ */
+void TcpSocket::output()
+{
+	if (!synchronized() || _state == TcpState::TIME_WAIT) return;
+
+	Interface *iface = netstack.interface();
+	if (!iface) return;
+
+	uint32_t segment = segment_size();
+	uint32_t burst = segment;
+
+	NetworkDevice& device = iface->device();
+	if (device.offloads() & NetworkOffload::TSO) {
+		size_t largest = __min(device.tso_max_size(), 0xffff - sizeof(IPv4Header) - sizeof(TcpHeader) - TCP_MAX_OPTIONS);
+		if (largest > segment) burst = largest / segment * segment;
+	}
+
+	uint32_t end = data_end();
+
+	while (seq_lt(_snd_nxt, end)) {
+		uint32_t in_flight = _snd_nxt - _snd_una;
+		if (_recovery) in_flight -= __min(in_flight, sacked_bytes());
+
+		uint32_t window = __min(_cc.cwnd(), _snd_wnd);
+		if (in_flight >= window) break;
+
+		uint32_t room = window - in_flight;
+		uint32_t offered = _snd_una + _snd_wnd - _snd_nxt;
+		if (seq_leq(_snd_una + _snd_wnd, _snd_nxt)) offered = 0;
+
+		uint32_t available = end - _snd_nxt;
+		uint32_t length = __min(__min(available, room), __min(offered, burst));
+		if (!length) break;
+
+		// A short segment is only sent if it is the last of the data, or nothing else is
+		// in flight, so the window isn't frittered away in small pieces.
+		if (length < segment && length < available && _snd_nxt != _snd_una) break;
+
+		uint8_t flags = TCP_ACK;
+		if (length == available) {
+			flags |= TCP_PSH;
+			if (_fin_queued) flags |= TCP_FIN;
+		}
+
+		bool timing = !_rtt_timing && _snd_nxt == _snd_max;
+		uint64_t now = now_ns();
+
+		if (!send_segment(_snd_nxt, length, flags)) break;
+
+		if (timing) {
+			_rtt_timing = true;
+			_rtt_seq = _snd_nxt + length;
+			_rtt_start = now;
+		}
+
+		_snd_nxt += length + ((flags & TCP_FIN) ? 1 : 0);
+		if (seq_gt(_snd_nxt, _snd_max)) _snd_max = _snd_nxt;
+		if (!_rto_deadline) arm_rto();
+	}
+
+	// The FIN on its own, once everything before it has been sent.
+	if (_fin_queued && _snd_nxt == end) {
+		if (send_segment(end, 0, TCP_FIN | TCP_ACK)) {
+			_snd_nxt = end + 1;
+			if (seq_gt(_snd_nxt, _snd_max)) _snd_max = _snd_nxt;
+			if (!_rto_deadline) arm_rto();
+		}
+	}
+
+	// With the window shut and nothing in flight, the timer is what probes it.
+	if (seq_lt(_snd_nxt, end) && _snd_una == _snd_max && !_rto_deadline) arm_rto();
+}
+
+void TcpSocket::enter_recovery()
+{
+	_recovery = true;
+	_recover = _snd_max;
+	_rexmit_next = _snd_una;
+	_rtt_timing = false;
+	_cc.on_loss();
+
+	retransmit_hole();
+}
+
+/**
+ * Retransmits the first run of data from '_rexmit_next' that the peer hasn't SACKed,
+ * up to a segment of it.
+ */
+void TcpSocket::retransmit_hole()
+{
+	uint32_t seq = _rexmit_next;
+
+	bool moved;
+	do {
+		moved = false;
+		for (unsigned int i = 0; i < _nr_scoreboard; i++) {
+			if (seq_leq(_scoreboard[i].start, seq) && seq_lt(seq, _scoreboard[i].end)) {
+				seq = _scoreboard[i].end;
+				moved = true;
+			}
+		}
+	} while (moved);
+
+	if (!seq_lt(seq, _recover)) return;
+
+	uint32_t hole_end = _recover;
+	for (unsigned int i = 0; i < _nr_scoreboard; i++) {
+		if (seq_gt(_scoreboard[i].start, seq) && seq_lt(_scoreboard[i].start, hole_end)) hole_end = _scoreboard[i].start;
+	}
+
+	uint32_t end = data_end();
+	if (seq_gt(hole_end, end)) hole_end = end;
+
+	uint8_t flags = TCP_ACK;
+	uint32_t length = seq_lt(seq, hole_end) ? __min(hole_end - seq, segment_size()) : 0;
+	if (!length) {
+		if (!_fin_queued || seq != end) return;
+		flags |= TCP_FIN;
+	}
+
+	if (send_segment(seq, length, flags)) {
+		_rexmit_next = seq + length + ((flags & TCP_FIN) ? 1 : 0);
+	}
+}
+
+/**
+ * The retransmission timer has expired: the window closes to one segment, and everything
+ * from the first unacknowledged byte is sent again, with the timer backed off.
+ */
+void TcpSocket::retransmission_timeout()
+{
+	bool handshake = _state == TcpState::SYN_SENT || _state == TcpState::SYN_RECEIVED;
+	uint32_t end = data_end();
+
+	// Probing a shut window doesn't count against the connection.
+	bool probe = !_snd_wnd && _snd_una == _snd_max && seq_lt(_snd_nxt, end);
+
+	if (!probe && ++_retries > (handshake ? TCP_MAX_SYN_RETRIES : TCP_MAX_RETRIES)) {
+		if (!handshake) send_segment(_snd_nxt, 0, TCP_RST | TCP_ACK);
+		fail();
+		return;
+	}
+
+	_rto = __min(_rto * 2, TCP_MAX_RTO_NS);
+	_rtt_timing = false;
+
+	if (handshake) {
+		send_segment(_iss, 0, _state == TcpState::SYN_SENT ? TCP_SYN : (TCP_SYN | TCP_ACK));
+		arm_rto();
+		return;
+	}
+
+	if (probe) {
+		// A byte is pushed past the edge of the window, so the peer answers with its window.
+		if (send_segment(_snd_nxt, 1, TCP_ACK)) {
+			_snd_nxt++;
+			_snd_max = _snd_nxt;
+		}
+
+		arm_rto();
+		return;
+	}
+
+	if (_snd_una == _snd_max) return;
+
+	_cc.on_timeout();
+	_recovery = false;
+	_dupacks = 0;
+	_nr_scoreboard = 0;
+	_snd_nxt = _snd_una;
+	_rexmit_next = _snd_una;
+
+	output();
+	arm_rto();
+}
+
+/**
+ * Builds a segment from the send ring, and sends it, with an ACK of what has been received
+ * if it has one.
+ */
+bool TcpSocket::send_segment(uint32_t seq, size_t length, uint8_t flags)
+{
+	PacketBufferAllocator& pktalloc = sys.mm().pktalloc();
+
+	PacketBuffer *packet = length ? pktalloc.allocate_chain(length) : pktalloc.allocate();
+	if (!packet) return false;
+
+	size_t offset = seq - _snd_seq;
+	size_t copied = 0;
+	for (PacketBuffer *b = packet; b && copied < length; b = b->next) {
+		size_t n = __min(b->tailroom(), length - copied);
+		ring_read(_snd_buf, BUFFER_SIZE, _snd_head + offset + copied, b->put(n), n);
+		copied += n;
+	}
+
+	uint8_t options[TCP_MAX_OPTIONS];
+	size_t options_length = 0;
+
+	if (flags & TCP_SYN) {
+		bool offer = !(flags & TCP_ACK);
+
+		options[0] = TCP_OPT_MSS;
+		options[1] = 4;
+		options[2] = TCP_MSS >> 8;
+		options[3] = TCP_MSS & 0xff;
+		options_length = 4;
+
+		if (offer || _rcv_wscale) {
+			options[options_length++] = TCP_OPT_NOP;
+			options[options_length++] = TCP_OPT_WINDOW_SCALE;
+			options[options_length++] = 3;
+			options[options_length++] = WINDOW_SCALE;
+		}
+
+		if (offer || _sack_ok) {
+			options[options_length++] = TCP_OPT_NOP;
+			options[options_length++] = TCP_OPT_NOP;
+			options[options_length++] = TCP_OPT_SACK_PERMITTED;
+			options[options_length++] = 2;
+		}
+	} else if ((flags & TCP_ACK) && _sack_ok && _nr_ooo) {
+		options[0] = TCP_OPT_NOP;
+		options[1] = TCP_OPT_NOP;
+		options[2] = TCP_OPT_SACK;
+		options[3] = 2 + 8 * _nr_ooo;
+		options_length = 4;
+
+		for (unsigned int i = 0; i < _nr_ooo; i++) {
+			write_be32(&options[options_length], _ooo[i].start);
+			write_be32(&options[options_length + 4], _ooo[i].end);
+			options_length += 8;
+		}
+	}
+
+	// The window in a SYN isn't scaled, and the edge of the window is never moved back.
+	size_t space = BUFFER_SIZE - _rcv_len;
+	unsigned int scale = (flags & TCP_SYN) ? 0 : _rcv_wscale;
+	uint16_t window = __min(space >> scale, 0xffff);
+
+	if (flags & TCP_ACK) {
+		uint32_t edge = _rcv_nxt + ((uint32_t)window << scale);
+		if (seq_gt(edge, _rcv_adv)) _rcv_adv = edge;
+
+		_ack_pending = 0;
+		_delack_deadline = 0;
+	}
+
+	uint16_t gso_size = length > segment_size() ? segment_size() : 0;
+
+	return transmit_segment(_remote_address, _local_port, _remote_port, seq, (flags & TCP_ACK) ? _rcv_nxt : 0,
+		flags, window, options, options_length, packet, gso_size);
+}
+
+void TcpSocket::send_ack()
+{
+	send_segment(_snd_nxt, 0, TCP_ACK);
+}
+
+/**
+ * ACKs every second segment straight away, and otherwise after a short delay, in case
+ * there is something to send that the ACK can go with.
+ */
+void TcpSocket::schedule_ack()
+{
+	if (_ack_pending >= 2) {
+		send_ack();
+		arm_timer();
+	} else if (_ack_pending && !_delack_deadline) {
+		_delack_deadline = now_ns() + TCP_DELAYED_ACK_NS;
+		arm_timer();
+	}
+}
+
+/**
+ * Takes in a round-trip time measurement, and works out the retransmission timeout from
+ * the smoothed time and its variation (RFC 6298).
+ */
+void TcpSocket::sample_rtt(uint64_t now)
+{
+	uint64_t rtt = now - _rtt_start;
+	_rtt_timing = false;
+
+	if (!_srtt) {
+		_srtt = rtt;
+		_rttvar = rtt / 2;
+	} else {
+		uint64_t delta = rtt > _srtt ? rtt - _srtt : _srtt - rtt;
+		_rttvar = (3 * _rttvar + delta) / 4;
+		_srtt = (7 * _srtt + rtt) / 8;
+	}
+
+	_rto = __max(TCP_MIN_RTO_NS, __min(_srtt + 4 * _rttvar, TCP_MAX_RTO_NS));
+}
+
+void TcpSocket::arm_rto()
+{
+	_rto_deadline = now_ns() + _rto;
+	arm_timer();
+}
+
+/**
+ * Sets the socket's one timer for the earliest of its deadlines, or cancels it if there
+ * are none.
+ */
+void TcpSocket::arm_timer()
+{
+	uint64_t deadline = 0;
+
+	uint64_t deadlines[] = { _rto_deadline, _delack_deadline, _timewait_deadline };
+	for (unsigned int i = 0; i < ARRAY_SIZE(deadlines); i++) {
+		if (deadlines[i] && (!deadline || deadlines[i] < deadline)) deadline = deadlines[i];
+	}
+
+	UniqueIRQLock irq;
+
+	if (!deadline) {
+		_timer.cancel();
+		return;
+	}
+
+	if (_timer.pending() && _timer.expires() == deadline) return;
+	CPU::current().timers().add(_timer, deadline);
+}
+
+void TcpSocket::run_timers()
+{
+	UniqueLock<Mutex> l(_lock);
+
+	uint64_t now = now_ns();
+
+	if (_timewait_deadline && now >= _timewait_deadline) {
+		finish();
+		return;
+	}
+
+	if (_delack_deadline && now >= _delack_deadline) {
+		_delack_deadline = 0;
+		if (_ack_pending) send_ack();
+	}
+
+	if (_rto_deadline && now >= _rto_deadline) {
+		_rto_deadline = 0;
+		retransmission_timeout();
+	}
+
+	arm_timer();
+}
+
+/**
+ * Runs on the timer wheel, where the socket's lock can't be taken, so the work is passed
+ * on to the network workers.
+ */
+void TcpSocket::timer_fn(Timer& timer, void *arg)
+{
+	net_workqueue().queue(((TcpSocket *)arg)->_timer_work);
+}
+
+void TcpSocket::timer_work(void *arg)
+{
+	((TcpSocket *)arg)->run_timers();
+}
+
+bool Tcp::bind(uint16_t& port)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	if (port) {
+		return !_bound.contains_key(port) && _bound.add(port, true);
+	}
+
+	for (unsigned int i = EPHEMERAL_FIRST; i <= 0xffff; i++) {
+		uint16_t candidate = _next_ephemeral;
+		_next_ephemeral = candidate == 0xffff ? EPHEMERAL_FIRST : candidate + 1;
+
+		if (!_bound.contains_key(candidate)) {
+			if (!_bound.add(candidate, true)) return false;
+
+			port = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Tcp::unbind(uint16_t port)
+{
+	UniqueLock<Mutex> l(_lock);
+	_bound.remove(port);
+}
+
+bool Tcp::add_listener(TcpSocket& socket)
+{
+	UniqueLock<Mutex> l(_lock);
+	return !_listeners.contains_key(socket._local_port) && _listeners.add(socket._local_port, &socket);
+}
+
+void Tcp::remove_listener(uint16_t port)
+{
+	UniqueLock<Mutex> l(_lock);
+	_listeners.remove(port);
+}
+
+bool Tcp::add_connection(TcpSocket& socket)
+{
+	uint64_t key = socket.connection_key();
+
+	UniqueLock<Mutex> l(_lock);
+	return !_connections.contains_key(key) && _connections.add(key, &socket);
+}
+
+void Tcp::remove_connection(uint64_t key)
+{
+	UniqueLock<Mutex> l(_lock);
+	_connections.remove(key);
+}
+
+/**
+ * Checks a segment's header and checksum, reads its options, and leaves the packet's data
+ * at the segment's data.
+ */
+bool Tcp::parse(uint32_t source, uint32_t destination, PacketBuffer *packet, TcpSegment& segment)
+{
+	if (packet->length < sizeof(TcpHeader)) return false;
+
+	const TcpHeader *tcp = (const TcpHeader *)packet->data();
+	size_t header_length = (tcp->data_offset >> 4) * 4;
+	size_t length = packet->packet_length();
+
+	if (header_length < sizeof(TcpHeader) || header_length > packet->length) return false;
+
+	uint32_t sum = checksum_pseudo_header(source, destination, IP_PROTO_TCP, length);
+	if (checksum_fold(checksum_packet(sum, packet, 0, length)) != 0) return false;
+
+	segment.source = source;
+	segment.source_port = ntohs(tcp->source_port);
+	segment.destination_port = ntohs(tcp->destination_port);
+	segment.sequence = ntohl(tcp->sequence);
+	segment.ack = ntohl(tcp->ack);
+	segment.flags = tcp->flags;
+	segment.window = ntohs(tcp->window);
+	segment.mss = 0;
+	segment.window_scale = -1;
+	segment.sack_permitted = false;
+	segment.nr_sack = 0;
+	segment.length = length - header_length;
+
+	const uint8_t *option = (const uint8_t *)(tcp + 1);
+	const uint8_t *end = (const uint8_t *)tcp + header_length;
+
+	while (option < end) {
+		uint8_t kind = option[0];
+		if (kind == TCP_OPT_END) break;
+		if (kind == TCP_OPT_NOP) {
+			option++;
+			continue;
+		}
+
+		if (option + 1 >= end) break;
+
+		uint8_t option_length = option[1];
+		if (option_length < 2 || option + option_length > end) break;
+
+		switch (kind) {
+		case TCP_OPT_MSS:
+			if (option_length == 4) segment.mss = (option[2] << 8) | option[3];
+			break;
+
+		case TCP_OPT_WINDOW_SCALE:
+			if (option_length == 3) segment.window_scale = __min(option[2], 14);
+			break;
+
+		case TCP_OPT_SACK_PERMITTED:
+			if (option_length == 2) segment.sack_permitted = true;
+			break;
+
+		case TCP_OPT_SACK:
+			for (unsigned int i = 0; i < (option_length - 2u) / 8 && i < TcpSegment::MAX_SACK_BLOCKS; i++) {
+				segment.sack[i].start = read_be32(&option[2 + 8 * i]);
+				segment.sack[i].end = read_be32(&option[6 + 8 * i]);
+				segment.nr_sack = i + 1;
+			}
+			break;
+		}
+
+		option += option_length;
+	}
+
+	packet->pull(header_length);
+	return true;
+}
+
+void Tcp::receive(uint32_t source, uint32_t destination, PacketBuffer *packet)
+{
+	TcpSegment segment;
+	if (!parse(source, destination, packet, segment)) {
+		sys.mm().pktalloc().release(packet);
+		return;
+	}
+
+	uint64_t key = ((uint64_t)source << 32) | ((uint64_t)segment.source_port << 16) | segment.destination_port;
+
+	// Sockets are never freed, so one can be used after the table lock is dropped, and
+	// copes with the segment itself if it has been closed since.
+	TcpSocket *socket = NULL, *listener = NULL;
+	{
+		UniqueLock<Mutex> l(_lock);
+		if (!_connections.try_get_value(key, socket)) {
+			socket = NULL;
+			if (!_listeners.try_get_value(segment.destination_port, listener)) listener = NULL;
+		}
+	}
+
+	if (socket) {
+		UniqueLock<Mutex> l(socket->_lock);
+		socket->segment_arrived(segment, packet);
+	} else if (listener && (segment.flags & (TCP_SYN | TCP_ACK | TCP_RST)) == TCP_SYN) {
+		listener->syn_arrived(segment);
+	} else if (!(segment.flags & TCP_RST)) {
+		send_reset(segment);
+	}
+
+	sys.mm().pktalloc().release(packet);
+}
+
+void Tcp::send_reset(const TcpSegment& segment)
+{
+	PacketBuffer *packet = sys.mm().pktalloc().allocate();
+	if (!packet) return;
+
+	uint32_t seq = 0, ack = 0;
+	uint8_t flags = TCP_RST;
+
+	if (segment.flags & TCP_ACK) {
+		seq = segment.ack;
+	} else {
+		ack = segment.sequence + segment.length + ((segment.flags & TCP_SYN) ? 1 : 0) + ((segment.flags & TCP_FIN) ? 1 : 0);
+		flags |= TCP_ACK;
+	}
+
+	transmit_segment(segment.source, segment.destination_port, segment.source_port, seq, ack, flags, 0, NULL, 0, packet, 0);
+}
@@ -0,0 +1,257 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * net/udp.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/net/udp.h>
+#include <infos/net/net.h>
+#include <infos/net/interface.h>
+#include <infos/net/protocols.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/thread.h>
+#include <infos/mm/mm.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::fs;
+using namespace infos::mm;
+using namespace infos::net;
+using namespace infos::util;
+
+// The most a datagram can carry without being fragmented.
+#define UDP_MAX_PAYLOAD		(ETH_MTU - sizeof(IPv4Header) - sizeof(UdpHeader))
+
+UdpSocket::UdpSocket()
+	: _local_port(0), _remote_address(0), _remote_port(0), _nonblocking(false),
+	_queue_head(NULL), _queue_tail(NULL), _nr_queued(0), _closed(false)
+{
+
+}
+
+int UdpSocket::read(void *buffer, size_t size)
+{
+	PacketBuffer *datagram;
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_readers.lock());
+
+		while (!_queue_head) {
+			if (_nonblocking || _closed) return 0;
+			_readers.sleep_locked(Thread::current());
+		}
+
+		datagram = _queue_head;
+		_queue_head = datagram->next_packet;
+		if (!_queue_head) _queue_tail = NULL;
+		_nr_queued--;
+	}
+
+	datagram->next_packet = NULL;
+
+	size_t copied = datagram->copy_out(0, buffer, size);
+	sys.mm().pktalloc().release(datagram);
+
+	return (int)copied;
+}
+
+int UdpSocket::write(const void *buffer, size_t size)
+{
+	Interface *iface = netstack.interface();
+	if (!_remote_port || !iface || size > UDP_MAX_PAYLOAD) return -1;
+
+	PacketBuffer *datagram = sys.mm().pktalloc().allocate();
+	if (!datagram) return -1;
+
+	memcpy(datagram->put(size), buffer, size);
+
+	uint16_t length = size + sizeof(UdpHeader);
+
+	UdpHeader *udp = (UdpHeader *)datagram->push(sizeof(UdpHeader));
+	udp->source_port = htons(_local_port);
+	udp->destination_port = htons(_remote_port);
+	udp->length = htons(length);
+	udp->checksum = 0;
+
+	bool odd = false;
+	uint32_t sum = checksum_pseudo_header(iface->address(), _remote_address, IP_PROTO_UDP, length);
+	uint16_t checksum = checksum_fold(checksum_add(sum, udp, length, odd));
+
+	// A checksum of zero means there isn't one, so it is sent as its other form.
+	udp->checksum = htons(checksum ? checksum : 0xffff);
+
+	return netstack.send_ipv4(_remote_address, IP_PROTO_UDP, datagram) ? (int)size : -1;
+}
+
+unsigned int UdpSocket::poll()
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_readers.lock());
+
+	return PollEvents::WRITABLE | (_queue_head ? PollEvents::READABLE : 0);
+}
+
+void UdpSocket::close()
+{
+	if (_local_port) {
+		netstack.udp().unbind(_local_port);
+		_local_port = 0;
+	}
+
+	PacketBuffer *queued;
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_readers.lock());
+
+		queued = _queue_head;
+		_queue_head = _queue_tail = NULL;
+		_nr_queued = 0;
+		_closed = true;
+
+		while (_readers.wake_one_locked());
+	}
+
+	while (queued) {
+		PacketBuffer *next = queued->next_packet;
+		queued->next_packet = NULL;
+		sys.mm().pktalloc().release(queued);
+		queued = next;
+	}
+}
+
+bool UdpSocket::bind(const SocketAddress& local)
+{
+	if (_local_port || _closed) return false;
+
+	Interface *iface = netstack.interface();
+	if (local.address && (!iface || local.address != iface->address())) return false;
+
+	uint16_t port = local.port;
+	if (!netstack.udp().bind(*this, port)) return false;
+
+	_local_port = port;
+	return true;
+}
+
+bool UdpSocket::connect(const SocketAddress& remote)
+{
+	if (!remote.address || !remote.port) return false;
+
+	if (!_local_port) {
+		SocketAddress any = { 0, 0, 0 };
+		if (!bind(any)) return false;
+	}
+
+	_remote_address = remote.address;
+	_remote_port = remote.port;
+	return true;
+}
+
+void UdpSocket::deliver(PacketBuffer *datagram, uint32_t source, uint16_t source_port)
+{
+	// A connected socket only hears from its peer.
+	if (_remote_port && (source != _remote_address || source_port != _remote_port)) {
+		sys.mm().pktalloc().release(datagram);
+		return;
+	}
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_readers.lock());
+
+		if (_nr_queued < MAX_QUEUED && !_closed) {
+			datagram->next_packet = NULL;
+			if (_queue_tail) {
+				_queue_tail->next_packet = datagram;
+			} else {
+				_queue_head = datagram;
+			}
+
+			_queue_tail = datagram;
+			_nr_queued++;
+			datagram = NULL;
+
+			_readers.wake_one_locked();
+		}
+	}
+
+	if (datagram) {
+		sys.mm().pktalloc().release(datagram);
+		return;
+	}
+
+	File::wake_pollers(this);
+}
+
+bool Udp::bind(UdpSocket& socket, uint16_t& port)
+{
+	UniqueLock<Mutex> l(_lock);
+
+	if (port) {
+		return !_ports.contains_key(port) && _ports.add(port, &socket);
+	}
+
+	// The ephemeral ports are tried in turn, from wherever the last search stopped.
+	for (unsigned int i = EPHEMERAL_FIRST; i <= 0xffff; i++) {
+		uint16_t candidate = _next_ephemeral;
+		_next_ephemeral = candidate == 0xffff ? EPHEMERAL_FIRST : candidate + 1;
+
+		if (!_ports.contains_key(candidate)) {
+			if (!_ports.add(candidate, &socket)) return false;
+
+			port = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Udp::unbind(uint16_t port)
+{
+	UniqueLock<Mutex> l(_lock);
+	_ports.remove(port);
+}
+
+void Udp::receive(uint32_t source, uint32_t destination, PacketBuffer *packet)
+{
+	PacketBufferAllocator& pktalloc = sys.mm().pktalloc();
+
+	const UdpHeader *udp = (const UdpHeader *)packet->data();
+	size_t length = packet->length >= sizeof(UdpHeader) ? ntohs(udp->length) : 0;
+
+	if (length < sizeof(UdpHeader) || length > packet->packet_length()) {
+		pktalloc.release(packet);
+		return;
+	}
+
+	trim_packet(packet, length);
+
+	if (udp->checksum) {
+		uint32_t sum = checksum_pseudo_header(source, destination, IP_PROTO_UDP, length);
+		if (checksum_fold(checksum_packet(sum, packet, 0, length)) != 0) {
+			pktalloc.release(packet);
+			return;
+		}
+	}
+
+	uint16_t source_port = ntohs(udp->source_port);
+	uint16_t destination_port = ntohs(udp->destination_port);
+	packet->pull(sizeof(UdpHeader));
+
+	// The socket can't be unbound, and so go away, while the lock is held.
+	UniqueLock<Mutex> l(_lock);
+
+	UdpSocket *socket;
+	if (!_ports.try_get_value(destination_port, socket)) {
+		pktalloc.release(packet);
+		return;
+	}
+
+	socket->deliver(packet, source, source_port);
+}
@@ -18,6 +18,23 @@ using namespace infos::kernel;
 extern char _CMDLINE_ARGS_START, _CMDLINE_ARGS_END;
 
 bool CommandLine::parse(const char* cmdline)
+{
+	// Kept, for the modules that are loaded later.
+	strncpy(_cmdline, cmdline, sizeof(_cmdline) - 1);
+	_cmdline[sizeof(_cmdline) - 1] = 0;
+
+	parse_settings(cmdline, (const CommandLineArgumentRegistration *)&_CMDLINE_ARGS_START,
+		(const CommandLineArgumentRegistration *)&_CMDLINE_ARGS_END);
+	
+	return true;
+}
+
+void CommandLine::apply(const CommandLineArgumentRegistration *start, const CommandLineArgumentRegistration *end)
+{
+	parse_settings(_cmdline, start, end);
+}
+
+void CommandLine::parse_settings(const char* cmdline, const CommandLineArgumentRegistration *start, const CommandLineArgumentRegistration *end)
 {
 	char setting[128];
 	
@@ -29,14 +46,12 @@ bool CommandLine::parse(const char* cmdline)
 		
 		if (i == 0) break;
 		
-		process(setting);
+		process(setting, start, end);
 		i = 0;
 	}
-	
-	return true;
 }
 
-void CommandLine::process(const char* setting)
+void CommandLine::process(const char* setting, const CommandLineArgumentRegistration *start, const CommandLineArgumentRegistration *end)
 {
 	char key[64];
 	char value[64];
@@ -54,17 +69,17 @@ void CommandLine::process(const char* setting)
 	}
 	value[i] = 0;
 	
-	auto reg = find_registration(key);
+	auto reg = find_registration(key, start, end);
 	if (reg) {
 		reg->fn(value);
 	}
 }
 
-const CommandLineArgumentRegistration* CommandLine::find_registration(const char* key)
+const CommandLineArgumentRegistration* CommandLine::find_registration(const char* key, const CommandLineArgumentRegistration *start, const CommandLineArgumentRegistration *end)
 {
-	const CommandLineArgumentRegistration *rgn = (const CommandLineArgumentRegistration *)&_CMDLINE_ARGS_START;
+	const CommandLineArgumentRegistration *rgn = start;
 	
-	while (rgn < (const CommandLineArgumentRegistration *)&_CMDLINE_ARGS_END) {
+	while (rgn < end) {
 		if (!rgn->match) {
 			rgn++;
 			continue;
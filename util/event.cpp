@@ -18,7 +18,7 @@ using namespace infos::util;
 
 void Event::trigger()
 {
-	_wakequeue.wake();
+	_wakequeue.wake_all();
 }
 
 void Event::wait()
@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * util/hash-map-benchmark.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/util/hash-map.h>
+#include <infos/util/map.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/kernel/log.h>
+#include <infos/kernel/benchmark.h>
+#include <arch/x86/msr.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+using namespace infos::arch::x86;
+
+// The sizes of map that are timed: about as many as there are devices, and as many as a
+// large directory.
+static const unsigned int benchmark_sizes[] = { 64, 4096 };
+
+#define BENCHMARK_MAX_SIZE	4096
+
+static bool do_benchmark;
+
+RegisterCmdLineArgument(HashMapBenchmark, "hashmap.benchmark")
+{
+	do_benchmark = strncmp(value, "1", 2) == 0;
+}
+
+static uint64_t keys[BENCHMARK_MAX_SIZE];
+static uint64_t rng_state;
+
+static uint64_t next_random()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+
+	return rng_state;
+}
+
+static void report(const char *container, unsigned int size, const char *operation, uint64_t cycles, unsigned int nr_ops)
+{
+	syslog.messagef(LogLevel::INFO, "%s: n=%u: %s: cycles/op=%llu", container, size, operation, cycles / nr_ops);
+}
+
+/* Times adding every key, looking each up, looking up as many keys that aren't there, and
+ * a walk over the lot.  The keys are random, like the name hashes that the maps are keyed
+ * by, and the odd ones are only ever looked up, so that they miss. */
+template<typename TMap>
+static void run(const char *container, unsigned int size)
+{
+	TMap map;
+	uint64_t start, sum = 0;
+
+	start = __rdtsc();
+	for (unsigned int i = 0; i < size; i++) map.add(keys[i] & ~1ull, i);
+	report(container, size, "add", __rdtsc() - start, size);
+
+	unsigned int value;
+
+	start = __rdtsc();
+	for (unsigned int i = 0; i < size; i++) {
+		if (map.try_get_value(keys[i] & ~1ull, value)) sum += value;
+	}
+	report(container, size, "hit", __rdtsc() - start, size);
+
+	start = __rdtsc();
+	for (unsigned int i = 0; i < size; i++) {
+		if (map.try_get_value(keys[i] | 1, value)) sum += value;
+	}
+	report(container, size, "miss", __rdtsc() - start, size);
+
+	start = __rdtsc();
+	for (const auto& entry : map) sum += entry.value;
+	report(container, size, "iterate", __rdtsc() - start, size);
+
+	// Keeps the loops from being thrown away.
+	asm volatile("" :: "r"(sum));
+}
+
+static HashMap<uint64_t, unsigned int> lookup_map;
+
+static void fill_lookup_map()
+{
+	if (!lookup_map.empty()) return;
+
+	rng_state = 0x2545f4914f6cdd1dull;
+	for (unsigned int i = 0; i < BENCHMARK_MAX_SIZE; i++) {
+		keys[i] = next_random() & ~1ull;
+		lookup_map.add(keys[i], i);
+	}
+}
+
+RegisterBenchmark(HashMapHit, "hashmap.hit", BENCHMARK_MAX_SIZE)
+{
+	fill_lookup_map();
+
+	unsigned int value, sum = 0;
+	for (unsigned int i = 0; i < iterations; i++) {
+		if (lookup_map.try_get_value(keys[i % BENCHMARK_MAX_SIZE], value)) sum += value;
+	}
+
+	asm volatile("" :: "r"(sum));
+}
+
+RegisterBenchmark(HashMapMiss, "hashmap.miss", BENCHMARK_MAX_SIZE)
+{
+	fill_lookup_map();
+
+	unsigned int value, sum = 0;
+	for (unsigned int i = 0; i < iterations; i++) {
+		if (lookup_map.try_get_value(keys[i % BENCHMARK_MAX_SIZE] | 1, value)) sum += value;
+	}
+
+	asm volatile("" :: "r"(sum));
+}
+
+void infos::util::hash_map_benchmark()
+{
+	if (!do_benchmark) return;
+
+	syslog.messagef(LogLevel::IMPORTANT, "HASH MAP BENCHMARK - BEGIN");
+
+	rng_state = 0x2545f4914f6cdd1dull;
+	for (unsigned int i = 0; i < BENCHMARK_MAX_SIZE; i++) keys[i] = next_random();
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(benchmark_sizes); i++) {
+		run<Map<uint64_t, unsigned int>>("map", benchmark_sizes[i]);
+		run<HashMap<uint64_t, unsigned int>>("hashmap", benchmark_sizes[i]);
+	}
+
+	syslog.messagef(LogLevel::IMPORTANT, "HASH MAP BENCHMARK - END");
+}
@@ -0,0 +1,253 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * util/lock-stats.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/util/lock-stats.h>
+#include <infos/util/lock.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/kernel/cpu.h>
+#include <infos/drivers/device.h>
+#include <infos/fs/stats.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+using namespace infos::drivers;
+using namespace infos::fs;
+
+#ifdef CONFIG_LOCK_STATS
+bool infos::util::lock_stats_enabled;
+
+RegisterCmdLineArgument(LockStatsEnable, "lock.stats") {
+	lock_stats_enabled = (strncmp(value, "1", 1) == 0);
+}
+
+// Locks are named by their owners' constructors, some of which run before anything
+// else, so the table is plain zero-initialised data.
+static LockStats lock_stats[LOCK_STATS_MAX];
+static unsigned int nr_lock_stats;
+
+void LockProfile::set_name(const char *name)
+{
+	if (_stats) {
+		_stats->name = name;
+		return;
+	}
+
+	unsigned int slot = __sync_fetch_and_add(&nr_lock_stats, 1);
+	if (slot >= LOCK_STATS_MAX) return;
+
+	lock_stats[slot].name = name;
+	_stats = &lock_stats[slot];
+}
+
+void LockProfile::record_acquired(uint64_t wait_start, bool contended)
+{
+	uint64_t now = arch::x86::__rdtsc();
+
+	_stats->nr_acquired++;
+	_stats->hold_start = now;
+
+	if (contended) {
+		uint64_t wait = now - wait_start;
+
+		_stats->nr_contended++;
+		_stats->total_wait_cycles += wait;
+		if (wait > _stats->max_wait_cycles) _stats->max_wait_cycles = wait;
+	}
+}
+
+void LockProfile::record_release()
+{
+	// The lock may have been taken before statistics were being kept for it.
+	if (!_stats->hold_start) return;
+
+	uint64_t hold = arch::x86::__rdtsc() - _stats->hold_start;
+
+	_stats->total_hold_cycles += hold;
+	if (hold > _stats->max_hold_cycles) _stats->max_hold_cycles = hold;
+}
+
+unsigned int infos::util::get_lock_stats(LockStats *stats, unsigned int max)
+{
+	if (!lock_stats_enabled) return 0;
+
+	unsigned int nr = nr_lock_stats < LOCK_STATS_MAX ? nr_lock_stats : LOCK_STATS_MAX;
+	if (nr > max) nr = max;
+
+	// The statistics are updated without a lock, so a copy may be slightly out, but
+	// each counter is a single aligned word.
+	for (unsigned int i = 0; i < nr; i++) {
+		stats[i] = lock_stats[i];
+	}
+
+	return nr;
+}
+
+static IRQOffStats irqoff_stats;
+static SpinLock irqoff_max_lock;
+
+void infos::util::irqoff_begin(const void *site)
+{
+	if (!lock_stats_enabled) return;
+
+	IRQOffSection& section = CPU::current().irqoff_section();
+	section.start = arch::x86::__rdtsc();
+	section.site = site;
+}
+
+void infos::util::irqoff_end()
+{
+	if (!lock_stats_enabled) return;
+
+	IRQOffSection& section = CPU::current().irqoff_section();
+	if (!section.start) return;
+
+	uint64_t cycles = arch::x86::__rdtsc() - section.start;
+	section.start = 0;
+
+	__atomic_fetch_add(&irqoff_stats.nr_sections, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&irqoff_stats.total_cycles, cycles, __ATOMIC_RELAXED);
+
+	// A new longest section is rare, so the longest and where it was can share a lock.
+	if (cycles > __atomic_load_n(&irqoff_stats.max_cycles, __ATOMIC_RELAXED)) {
+		UniqueLock<SpinLock> l(irqoff_max_lock);
+
+		if (cycles > irqoff_stats.max_cycles) {
+			irqoff_stats.max_cycles = cycles;
+			irqoff_stats.max_site = section.site;
+		}
+	}
+}
+
+void infos::util::irqoff_reset()
+{
+	if (!lock_stats_enabled) return;
+
+	CPU::current().irqoff_section().start = 0;
+}
+
+bool infos::util::get_irqoff_stats(IRQOffStats& stats)
+{
+	if (!lock_stats_enabled) return false;
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(irqoff_max_lock);
+
+	stats = irqoff_stats;
+	return true;
+}
+#else
+unsigned int infos::util::get_lock_stats(LockStats *stats, unsigned int max)
+{
+	return 0;
+}
+
+bool infos::util::get_irqoff_stats(IRQOffStats& stats)
+{
+	return false;
+}
+#endif
+
+/**
+ * A pseudo-device (/dev/lockstat0) that reports the contention statistics of each named
+ * lock, as text.
+ */
+class LockStatsDevice : public Device
+{
+public:
+	static const DeviceClass LockStatsDeviceClass;
+
+	const DeviceClass& device_class() const override { return LockStatsDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass LockStatsDevice::LockStatsDeviceClass(Device::RootDeviceClass, "lockstat");
+
+/**
+ * The statistics (also /dev/stats/lockstat).  Each line is a lock, and all times are in
+ * TSC cycles.  Locks of the same kind (e.g. one per CPU) share a name, and each has its
+ * own line.
+ */
+RegisterStatistics(lockstat, "lockstat")
+{
+#ifndef CONFIG_LOCK_STATS
+	out.append("statistics not compiled in (build with make lock-stats=1)\n");
+#else
+	if (!lock_stats_enabled) {
+		out.append("statistics not enabled (boot with lock.stats=1)\n");
+		return;
+	}
+
+	LockStats *stats = new LockStats[LOCK_STATS_MAX];
+	if (!stats) return;
+
+	unsigned int nr = get_lock_stats(stats, LOCK_STATS_MAX);
+
+	out.append("name acquired contended total-wait max-wait total-hold max-hold\n");
+	for (unsigned int i = 0; i < nr; i++) {
+		const LockStats& s = stats[i];
+		if (!s.nr_acquired) continue;
+
+		out.append("%s %llu %llu %llu %llu %llu %llu\n", s.name, s.nr_acquired, s.nr_contended,
+				s.total_wait_cycles, s.max_wait_cycles, s.total_hold_cycles, s.max_hold_cycles);
+	}
+
+	delete[] stats;
+#endif
+}
+
+File *LockStatsDevice::open_as_file()
+{
+	return new StatisticsFile(__stats_reglockstat);
+}
+
+RegisterDevice(LockStatsDevice);
+
+/**
+ * A pseudo-device (/dev/irqoff0) that reports how long interrupts have been disabled for
+ * by IRQLock, as text.  Times are in TSC cycles, and the site of the longest section is a
+ * code address, to be looked up in the kernel's symbols.
+ */
+class IRQOffStatsDevice : public Device
+{
+public:
+	static const DeviceClass IRQOffStatsDeviceClass;
+
+	const DeviceClass& device_class() const override { return IRQOffStatsDeviceClass; }
+
+	File *open_as_file() override;
+};
+
+const DeviceClass IRQOffStatsDevice::IRQOffStatsDeviceClass(Device::RootDeviceClass, "irqoff");
+
+RegisterStatistics(irqoff, "irqoff")
+{
+#ifndef CONFIG_LOCK_STATS
+	out.append("statistics not compiled in (build with make lock-stats=1)\n");
+#else
+	IRQOffStats s;
+	if (!get_irqoff_stats(s)) {
+		out.append("statistics not enabled (boot with lock.stats=1)\n");
+		return;
+	}
+
+	out.append("sections total-cycles mean-cycles max-cycles max-site\n");
+	out.append("%llu %llu %llu %llu %p\n", s.nr_sections, s.total_cycles,
+			s.nr_sections ? s.total_cycles / s.nr_sections : 0, s.max_cycles, s.max_site);
+#endif
+}
+
+File *IRQOffStatsDevice::open_as_file()
+{
+	return new StatisticsFile(__stats_regirqoff);
+}
+
+RegisterDevice(IRQOffStatsDevice);
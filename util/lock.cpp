@@ -11,6 +11,9 @@
 #include <infos/util/lock.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/thread.h>
+#include <infos/kernel/sched.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/preempt.h>
 #include <infos/kernel/syscall.h>
 #include <infos/kernel/log.h>
 #include <arch/arch.h>
@@ -18,18 +21,102 @@
 using namespace infos::util;
 using namespace infos::kernel;
 
+// How many times a waiter checks the lock while its owner is running on another CPU,
+// before it goes to sleep.
+#define MUTEX_SPIN_LIMIT	1000
+
+#define MUTEX_FREE			0
+#define MUTEX_LOCKED		1
+#define MUTEX_CONTENDED		2
+
+/**
+ * Returns true if the current thread can sleep while it waits for a lock.  Nothing can
+ * sleep before the scheduler is running, or with interrupts disabled (e.g. in an interrupt
+ * handler), and the idle thread must always be runnable.
+ */
+static bool can_sleep()
+{
+	Scheduler& sched = sys.scheduler();
+	return sched.active() && sys.arch().interrupts_enabled() && &sched.current_entity() != &sched.idle_entity();
+}
+
+/**
+ * Returns true if the thread is running, on a CPU other than this one.
+ */
+static bool running_elsewhere(const Thread *thread)
+{
+	if (!thread) return false;
+
+	RunQueue *rq = thread->runqueue();
+	return rq && rq->current_entity() == thread && rq != CPU::current().runqueue();
+}
+
 void Mutex::lock()
 {
-	while (__sync_lock_test_and_set(&_locked, 1)) {
-		infos::kernel::sys.arch().invoke_kernel_syscall(1);
+	if (__sync_bool_compare_and_swap(&_locked, MUTEX_FREE, MUTEX_LOCKED)) {
+		_owner = &Thread::current();
+		acquired(0, false);
+		return;
 	}
+
+	uint64_t start = wait_start();
+	lock_contended();
 	
 	_owner = &Thread::current();
+	acquired(start, true);
+}
+
+void Mutex::lock_contended()
+{
+	for (unsigned int spins = 0; spins < MUTEX_SPIN_LIMIT && running_elsewhere(_owner); spins++) {
+		if (_locked == MUTEX_FREE && __sync_bool_compare_and_swap(&_locked, MUTEX_FREE, MUTEX_LOCKED)) {
+			return;
+		}
+
+		asm volatile("pause");
+	}
+
+	if (!can_sleep()) {
+		while (!__sync_bool_compare_and_swap(&_locked, MUTEX_FREE, MUTEX_LOCKED)) {
+			infos::kernel::sys.arch().invoke_kernel_syscall(1);
+		}
+
+		return;
+	}
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_waiters.lock());
+
+	// Marking the lock as contended makes the owner take the queue's lock to wake a
+	// waiter when it unlocks, so it can't unlock between this thread finding the lock taken and
+	// going to sleep.  A woken waiter can't tell whether there are others still waiting,
+	// so it takes the lock as contended too.
+	while (__sync_lock_test_and_set(&_locked, MUTEX_CONTENDED) != MUTEX_FREE) {
+		_waiters.sleep_locked(Thread::current());
+	}
+}
+
+bool Mutex::try_lock()
+{
+	if (!__sync_bool_compare_and_swap(&_locked, MUTEX_FREE, MUTEX_LOCKED)) {
+		return false;
+	}
+	
+	_owner = &Thread::current();
+	acquired(0, false);
+	return true;
 }
 
 void Mutex::unlock()
 {
-	__sync_lock_release(&_locked);
+	releasing();
+	_owner = NULL;
+
+	if (__atomic_exchange_n(&_locked, MUTEX_FREE, __ATOMIC_RELEASE) != MUTEX_CONTENDED) {
+		return;
+	}
+
+	_waiters.wake_one();
 }
 
 bool Mutex::locked_by_me()
@@ -40,39 +127,283 @@ bool Mutex::locked_by_me()
 void ConditionVariable::wait(Mutex& mtx)
 {
 	assert(mtx.locked_by_me());
+
+	// Where the thread can't sleep, this is just a chance for the condition to change.
+	if (!can_sleep()) {
+		mtx.unlock();
+		infos::kernel::sys.arch().invoke_kernel_syscall(1);
+		mtx.lock();
+		return;
+	}
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_waiters.lock());
+
+		// A notifier has to take the queue's lock, so it can't get in between the mutex
+		// being released and this thread being on the queue.
+		mtx.unlock();
+		_waiters.sleep_locked(Thread::current());
+	}
+
+	mtx.lock();
 }
 
 void ConditionVariable::notify_all()
 {
-//
+	_waiters.wake_all();
 }
 
 void ConditionVariable::notify_one()
 {
-//
+	_waiters.wake_one();
+}
+
+
+
+void SpinLock::lock()
+{
+	// The holder mustn't be switched out, or whatever ran next here could spin on it.
+	preempt_disable();
+
+	if (__sync_lock_test_and_set(&_locked, 1) == 0) {
+		acquired(0, false);
+		return;
+	}
+
+	uint64_t start = wait_start();
+
+	do {
+		// Wait for the lock to look free before trying again, rather than bouncing its
+		// cache line between CPUs with locked writes.
+		while (_locked) {
+			asm volatile("pause");
+		}
+	} while (__sync_lock_test_and_set(&_locked, 1));
+
+	acquired(start, true);
+}
+
+bool SpinLock::try_lock()
+{
+	preempt_disable();
+
+	if (__sync_lock_test_and_set(&_locked, 1)) {
+		preempt_enable_no_resched();
+		return false;
+	}
+
+	acquired(0, false);
+	return true;
+}
+
+void SpinLock::unlock()
+{
+	assert(_locked);
+
+	releasing();
+	__sync_lock_release(&_locked);
+
+	preempt_enable();
+}
+
+void TicketLock::lock()
+{
+	preempt_disable();
+
+	uint32_t ticket = __sync_fetch_and_add(&_next, 1);
+	if (_serving == ticket) {
+		acquired(0, false);
+		return;
+	}
+
+	uint64_t start = wait_start();
+
+	while (_serving != ticket) {
+		asm volatile("pause" ::: "memory");
+	}
+
+	asm volatile("" ::: "memory");
+	acquired(start, true);
+}
+
+bool TicketLock::try_lock()
+{
+	preempt_disable();
+
+	uint32_t serving = _serving;
+	if (!__sync_bool_compare_and_swap(&_next, serving, serving + 1)) {
+		preempt_enable_no_resched();
+		return false;
+	}
+
+	acquired(0, false);
+	return true;
 }
 
+void TicketLock::unlock()
+{
+	assert(locked());
+
+	releasing();
 
+	// Only the holder writes to _serving, so it doesn't need a locked increment.
+	__atomic_store_n(&_serving, _serving + 1, __ATOMIC_RELEASE);
+
+	preempt_enable();
+}
 
-IRQLock::IRQLock() : _were_interrupts_enabled(false)
+void MCSLock::lock(Node& node)
+{
+	preempt_disable();
+
+	node.next = NULL;
+	node.waiting = true;
+
+	Node *prev = __atomic_exchange_n(&_tail, &node, __ATOMIC_ACQ_REL);
+	if (!prev) {
+		acquired(0, false);
+		return;
+	}
+
+	uint64_t start = wait_start();
+
+	// Queue behind the previous holder, and wait for it to hand the lock over.
+	prev->next = &node;
+	while (node.waiting) {
+		asm volatile("pause" ::: "memory");
+	}
+
+	asm volatile("" ::: "memory");
+	acquired(start, true);
+}
+
+bool MCSLock::try_lock(Node& node)
+{
+	preempt_disable();
+
+	node.next = NULL;
+	node.waiting = false;
+
+	if (!__sync_bool_compare_and_swap(&_tail, (Node *)NULL, &node)) {
+		preempt_enable_no_resched();
+		return false;
+	}
+
+	acquired(0, false);
+	return true;
+}
+
+void MCSLock::unlock(Node& node)
+{
+	releasing();
+
+	if (!node.next) {
+		// Nobody is queued, unless one is between joining the queue and linking
+		// itself to this node.
+		if (__sync_bool_compare_and_swap(&_tail, &node, (Node *)NULL)) {
+			preempt_enable();
+			return;
+		}
+
+		while (!node.next) {
+			asm volatile("pause" ::: "memory");
+		}
+	}
+
+	__atomic_store_n(&node.next->waiting, false, __ATOMIC_RELEASE);
+	preempt_enable();
+}
+
+bool KernelLock::_enabled;
+volatile unsigned long KernelLock::_locked;
+CPU *volatile KernelLock::_owner;
+unsigned int KernelLock::_depth;
+
+bool KernelLock::lock()
+{
+	if (!_enabled) return false;
+
+	// Only this CPU ever sets the owner to itself, so a stale read can't match.
+	CPU *me = &CPU::current();
+	if (_owner == me) {
+		_depth++;
+		return true;
+	}
+
+	while (__sync_lock_test_and_set(&_locked, 1)) {
+		while (_locked) {
+			infos::kernel::sys.arch().relax();
+		}
+	}
+
+	_owner = me;
+	_depth = 1;
+	return true;
+}
+
+void KernelLock::unlock()
+{
+	assert(_owner == &CPU::current() && _depth);
+
+	if (--_depth) return;
+
+	_owner = NULL;
+	__sync_lock_release(&_locked);
+}
+
+unsigned int KernelLock::release()
+{
+	if (!_enabled || _owner != &CPU::current()) return 0;
+
+	unsigned int depth = _depth;
+	_depth = 0;
+	_owner = NULL;
+	__sync_lock_release(&_locked);
+
+	return depth;
+}
+
+void KernelLock::reacquire(unsigned int depth)
+{
+	if (!depth) return;
+
+	lock();
+	_depth = depth;
+}
+
+IRQLock::IRQLock() : _were_interrupts_enabled(false), _kernel_locked(false)
 {
 
 }
 
 void IRQLock::lock()
 {
+	preempt_disable();
+
 	_were_interrupts_enabled = infos::kernel::sys.arch().interrupts_enabled();
 	if (_were_interrupts_enabled) {
 		infos::kernel::sys.arch().disable_interrupts();
+
+		// The lock is taken by an inline guard, so this is in whatever used it.
+		irqoff_begin(__builtin_return_address(0));
 	}
 	
 	assert(!infos::kernel::sys.arch().interrupts_enabled());
+
+	_kernel_locked = KernelLock::lock();
 }
 
 void IRQLock::unlock()
 {
+	if (_kernel_locked) KernelLock::unlock();
+
 	if (_were_interrupts_enabled) {
+		irqoff_end();
 		infos::kernel::sys.arch().enable_interrupts();
 		assert(infos::kernel::sys.arch().interrupts_enabled());
 	}
+
+	// A reschedule that came in while interrupts were disabled happens now.
+	preempt_enable();
 }
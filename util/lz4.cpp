@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * util/lz4.cpp
+ *
+ * InfOS
+ * Copyright (C) 2026.  All Rights Reserved.
+ *
+ * agent <agent@local>
+ */
+#include <infos/util/lz4.h>
+#include <infos/util/string.h>
+
+using namespace infos::util;
+
+/*
+ * A block is a series of sequences, each a token byte (the number of literals in its top
+ * four bits, and the length of the match, less four, in its bottom four, with 15 meaning
+ * that more bytes of length follow), the literals, and the match's offset back into what
+ * has been decompressed so far (two bytes, little-endian).  The last sequence has only
+ * literals.  The format requires the last five bytes to be literals, and the last match
+ * to start at least twelve bytes before the end.
+ */
+#define MIN_MATCH		4
+#define LAST_LITERALS	5
+#define MF_LIMIT		12
+#define MAX_OFFSET		0xffff
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline unsigned int hash32(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LZ4Workspace::HASH_BITS);
+}
+
+/**
+ * Writes a length that didn't fit in its four bits of the token, as bytes of 255 and
+ * then the rest.
+ * @return Returns false if it didn't fit in the output.
+ */
+static bool write_length(uint8_t *&op, const uint8_t *oend, size_t length)
+{
+	while (length >= 255) {
+		if (op >= oend) return false;
+		*op++ = 255;
+		length -= 255;
+	}
+
+	if (op >= oend) return false;
+	*op++ = (uint8_t)length;
+
+	return true;
+}
+
+/**
+ * Writes a sequence: the literals from 'anchor' to 'ip', and then the match (if
+ * 'match_length' isn't zero).
+ */
+static bool write_sequence(uint8_t *&op, const uint8_t *oend, const uint8_t *anchor, const uint8_t *ip, size_t offset, size_t match_length)
+{
+	size_t nr_literals = ip - anchor;
+
+	if (op >= oend) return false;
+	uint8_t *token = op++;
+
+	*token = (uint8_t)(__min(nr_literals, (size_t)15) << 4);
+	if (nr_literals >= 15 && !write_length(op, oend, nr_literals - 15)) return false;
+
+	if (nr_literals > (size_t)(oend - op)) return false;
+	memcpy(op, anchor, nr_literals);
+	op += nr_literals;
+
+	if (!match_length) return true;
+
+	if (oend - op < 2) return false;
+	*op++ = (uint8_t)offset;
+	*op++ = (uint8_t)(offset >> 8);
+
+	size_t extra = match_length - MIN_MATCH;
+	*token |= (uint8_t)__min(extra, (size_t)15);
+	if (extra >= 15 && !write_length(op, oend, extra - 15)) return false;
+
+	return true;
+}
+
+size_t infos::util::lz4_compress(const void *src, size_t size, void *dst, size_t capacity, LZ4Workspace& ws)
+{
+	if (size > LZ4_MAX_INPUT) return 0;
+
+	const uint8_t *base = (const uint8_t *)src;
+	const uint8_t *ip = base, *anchor = base;
+	const uint8_t *end = base + size;
+	uint8_t *op = (uint8_t *)dst;
+	const uint8_t *oend = op + capacity;
+
+	if (size > MF_LIMIT) {
+		const uint8_t *match_limit = end - MF_LIMIT;
+		const uint8_t *match_end = end - LAST_LITERALS;
+
+		// Empty slots point at the start, which is checked like any other candidate.
+		bzero(ws.table, sizeof(ws.table));
+
+		while (ip < match_limit) {
+			uint32_t seq = read32(ip);
+			unsigned int h = hash32(seq);
+			const uint8_t *ref = base + ws.table[h];
+			ws.table[h] = (uint16_t)(ip - base);
+
+			if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+				// The longer it goes without a match, the further it skips, so that
+				// data that doesn't compress is got through quickly.
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			const uint8_t *mp = ip + MIN_MATCH, *mref = ref + MIN_MATCH;
+			while (mp < match_end && *mp == *mref) {
+				mp++;
+				mref++;
+			}
+
+			if (!write_sequence(op, oend, anchor, ip, ip - ref, mp - ip)) return 0;
+
+			ip = anchor = mp;
+		}
+	}
+
+	if (!write_sequence(op, oend, anchor, end, 0, 0)) return 0;
+
+	return op - (uint8_t *)dst;
+}
+
+/**
+ * Reads the rest of a length that didn't fit in its four bits of the token.
+ */
+static bool read_length(const uint8_t *&ip, const uint8_t *iend, size_t& length)
+{
+	uint8_t b;
+	do {
+		if (ip >= iend) return false;
+
+		b = *ip++;
+		length += b;
+	} while (b == 255);
+
+	return true;
+}
+
+bool infos::util::lz4_decompress(const void *src, size_t src_size, void *dst, size_t size)
+{
+	const uint8_t *ip = (const uint8_t *)src;
+	const uint8_t *iend = ip + src_size;
+	uint8_t *out = (uint8_t *)dst;
+	uint8_t *op = out;
+	uint8_t *oend = out + size;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+
+		size_t nr_literals = token >> 4;
+		if (nr_literals == 15 && !read_length(ip, iend, nr_literals)) return false;
+
+		if (nr_literals > (size_t)(iend - ip) || nr_literals > (size_t)(oend - op)) return false;
+		memcpy(op, ip, nr_literals);
+		ip += nr_literals;
+		op += nr_literals;
+
+		// The last sequence is just literals.
+		if (ip == iend) break;
+
+		if (iend - ip < 2) return false;
+		size_t offset = ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > (size_t)(op - out)) return false;
+
+		size_t match_length = token & 15;
+		if (match_length == 15 && !read_length(ip, iend, match_length)) return false;
+		match_length += MIN_MATCH;
+
+		if (match_length > (size_t)(oend - op)) return false;
+
+		// The match may overlap what it is copied to (e.g. a run of one byte), so it is
+		// copied forwards, a byte at a time.
+		const uint8_t *match = op - offset;
+		while (match_length--) *op++ = *match++;
+	}
+
+	return op == oend;
+}
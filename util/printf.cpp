@@ -51,53 +51,113 @@ int infos::util::sprintf(char *buffer, const char *fmt, ...)
 	return rc;
 }
 
-static void prepend_to_buffer(char c, char *buffer, int size)
+// Every two-digit decimal number, so that decimal numbers are formatted two digits at a time.
+static const char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * Writes the digits of a number backwards, from the end of a scratch buffer that is long
+ * enough for any number, and returns where the first digit is.  Division by a constant
+ * is done by the compiler with a multiplication, and once the number fits in 32 bits, in
+ * 32 bits, which is cheaper still.
+ */
+static char *format_digits(char *end, uint64_t value, int base)
 {
-	for (int i = size; i > 0; i--) {
-		buffer[i] = buffer[i - 1];
+	char *p = end;
+
+	switch (base) {
+	case 16:
+		do {
+			*--p = hex_digits[value & 0xf];
+			value >>= 4;
+		} while (value);
+		break;
+
+	case 2:
+		do {
+			*--p = '0' + (value & 1);
+			value >>= 1;
+		} while (value);
+		break;
+
+	default:
+	{
+		while (value > 0xffffffffull) {
+			unsigned int pair = value % 100;
+			value /= 100;
+
+			p -= 2;
+			p[0] = digit_pairs[pair * 2];
+			p[1] = digit_pairs[pair * 2 + 1];
+		}
+
+		uint32_t v = value;
+		while (v >= 100) {
+			unsigned int pair = v % 100;
+			v /= 100;
+
+			p -= 2;
+			p[0] = digit_pairs[pair * 2];
+			p[1] = digit_pairs[pair * 2 + 1];
+		}
+
+		if (v >= 10) {
+			p -= 2;
+			p[0] = digit_pairs[v * 2];
+			p[1] = digit_pairs[v * 2 + 1];
+		} else {
+			*--p = '0' + v;
+		}
+		break;
+	}
 	}
 
-	*buffer = c;
+	return p;
 }
 
 static int append_num(char *buffer, int size, uint64_t value, int base, bool sgn, int pad, char pad_char)
 {
-	int n = 0;
-
-	if (pad >= size) {
-		pad = size - 1;
-	}
-
-	if (sgn && (int64_t)value < 0) {
-		prepend_to_buffer('-', buffer, n++);
+	bool negative = sgn && (int64_t)value < 0;
+	if (negative) {
 		value = -value;
 	}
 
-	if (value > 0) {
-		while (value > 0 && n < size) {
-			int digit_value = value % base;
+	char scratch[64];
+	char *end = scratch + sizeof(scratch);
+	char *digits = format_digits(end, value, base);
 
-			switch(digit_value) {
-			case 0 ... 9:
-				prepend_to_buffer('0' + digit_value, buffer, n++);
-				break;
+	int length = (end - digits) + (negative ? 1 : 0);
+	int nr_pad = pad > length ? pad - length : 0;
 
-			case 10 ... 35:
-				prepend_to_buffer('a' + digit_value - 10, buffer, n++);
-				break;
-			}
+	int n = 0;
 
-			value /= base;
-		}
-	} else if (n < size) {
-		prepend_to_buffer('0', buffer, n++);
-		*buffer = '0';
+	// Zeroes go between the sign and the digits, and spaces before the sign.
+	if (negative && pad_char == '0' && n < size) {
+		buffer[n++] = '-';
+	}
+
+	while (nr_pad > 0 && n < size) {
+		buffer[n++] = pad_char;
+		nr_pad--;
+	}
+
+	if (negative && pad_char != '0' && n < size) {
+		buffer[n++] = '-';
 	}
 
-	pad -= n;
-	while (pad > 0 && n < size) {
-		prepend_to_buffer(pad_char, buffer, n++);
-		pad--;
+	while (digits < end && n < size) {
+		buffer[n++] = *digits++;
 	}
 
 	return n;
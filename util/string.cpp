@@ -12,6 +12,9 @@
 
 using namespace infos::util;
 
+// The hash of a fixed name has to be something the compiler can work out.
+static_assert(StringView("dev").get_hash() == string_hash("dev", 3), "string_hash must be constexpr");
+
 size_t infos::util::strlen(const char *str)
 {
 	if (!str) return 0;
@@ -39,6 +42,16 @@ int infos::util::strncmp(const char *str1, const char *str2, size_t n)
 	return 0;
 }
 
+int infos::util::strcmp(const char *str1, const char *str2)
+{
+	while (*str1 && *str1 == *str2) {
+		str1++;
+		str2++;
+	}
+	
+	return (int)(unsigned char)*str1 - (int)(unsigned char)*str2;
+}
+
 char *infos::util::strncpy(char *dest, const char *src, size_t n)
 {
 	while (--n && *src) {
@@ -73,26 +86,15 @@ List<String> String::split(char delim, bool remove_empty)
 {
 	List<String> r;
 	
-	const char *start = _data;
-	String current_part;
-	
-	while (start < (_data + _size)) {
-		if (*start == delim) {
-			if (current_part.length() == 0 && remove_empty) {
-				continue;
-			}
-			
-			r.append(current_part);
-			current_part = "";
-		} else {
-			current_part = current_part + *start;
+	size_t part_start = 0;
+	for (size_t i = 0; i <= _size; i++) {
+		if (i < _size && _data[i] != delim) continue;
+		
+		if (i > part_start || !remove_empty) {
+			r.append(String(&_data[part_start], i - part_start));
 		}
-
-		start++;
-	}
-	
-	if (current_part.length() > 0 || !remove_empty) {
-		r.append(current_part);
+		
+		part_start = i + 1;
 	}
 	
 	return r;
@@ -18,14 +18,27 @@ using namespace infos::kernel;
 using namespace infos::mm;
 using namespace infos::util;
 
+// The return address is passed down, so that the allocation profiler sees
+// the caller of 'new', rather than 'new' itself.
+
 void *operator new(size_t size)
 {
-	return sys.mm().objalloc().alloc(size, AllocFlags::NONE);
+	return sys.mm().objalloc().alloc(size, AllocFlags::NONE, HeapArena::GENERAL, __builtin_return_address(0));
 }
 
 void *operator new[](size_t size)
 {
-	return sys.mm().objalloc().alloc(size, AllocFlags::NONE);
+	return sys.mm().objalloc().alloc(size, AllocFlags::NONE, HeapArena::GENERAL, __builtin_return_address(0));
+}
+
+void *operator new(size_t size, HeapArena::HeapArena arena)
+{
+	return sys.mm().objalloc().alloc(size, AllocFlags::NONE, arena, __builtin_return_address(0));
+}
+
+void *operator new[](size_t size, HeapArena::HeapArena arena)
+{
+	return sys.mm().objalloc().alloc(size, AllocFlags::NONE, arena, __builtin_return_address(0));
 }
 
 void operator delete(void *p)
@@ -38,6 +51,16 @@ void operator delete(void *p, size_t sz)
 	sys.mm().objalloc().free(p);
 }
 
+void operator delete[](void *p)
+{
+	sys.mm().objalloc().free(p);
+}
+
+void operator delete[](void *p, size_t sz)
+{
+	sys.mm().objalloc().free(p);
+}
+
 extern "C" {
 
 	void __cxa_pure_virtual()
@@ -8,27 +8,228 @@
  *
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
-#include <infos/util/event.h>
+#include <infos/util/wakequeue.h>
+#include <infos/util/lock.h>
 #include <infos/kernel/kernel.h>
+#include <infos/kernel/sched.h>
 #include <infos/kernel/thread.h>
 #include <arch/arch.h>
 
 using namespace infos::kernel;
 using namespace infos::util;
 
+void WakeQueue::append(Waiter& waiter)
+{
+	waiter.next = NULL;
+
+	if (_tail) {
+		_tail->next = &waiter;
+	} else {
+		_head = &waiter;
+	}
+
+	_tail = &waiter;
+}
+
 void WakeQueue::sleep(Thread& thread)
 {
-    // TODO: some sort of lock
-    _waiters.append(&thread);
-    thread.sleep();
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	sleep_locked(thread);
+}
+
+void WakeQueue::unlink(Waiter *waiter, Waiter *prev)
+{
+	if (prev) {
+		prev->next = waiter->next;
+	} else {
+		_head = waiter->next;
+	}
+
+	if (_tail == waiter) _tail = prev;
+}
+
+void WakeQueue::sleep_locked(Thread& thread)
+{
+	Key none = { NULL, 0 };
+	sleep_locked(thread, none);
+}
+
+void WakeQueue::sleep_locked(Thread& thread, const Key& key)
+{
+	assert(_lock.locked());
+
+	Waiter waiter = { &thread, NULL, false, key, { NULL, NULL } };
+	append(waiter);
+
+	// The thread is on the queue, and asleep, before the lock is released, so a waker
+	// will find it, and make it runnable again even if it hasn't yet stopped running.
+	// Only a waker takes it off the queue, so it sleeps again if it is made runnable by
+	// anything else.
+	while (!waiter.woken) {
+		sys.scheduler().set_entity_state(thread, SchedulingEntityState::SLEEPING);
+
+		_lock.unlock();
+		sys.arch().invoke_kernel_syscall(1);
+		_lock.lock();
+	}
+}
+
+unsigned int WakeQueue::sleep_any_locked(Thread& thread, const Key *keys, unsigned int nr_keys)
+{
+	assert(_lock.locked());
+	assert(nr_keys > 0 && nr_keys <= MAX_SLEEP_KEYS);
+
+	// One node per key, all for the same thread: whichever is woken first wakes it.
+	Waiter waiters[MAX_SLEEP_KEYS];
+	for (unsigned int i = 0; i < nr_keys; i++) {
+		waiters[i].thread = &thread;
+		waiters[i].woken = false;
+		waiters[i].key = keys[i];
+		waiters[i].callback.fn = NULL;
+		append(waiters[i]);
+	}
+
+	unsigned int woken_for = nr_keys;
+	while (woken_for == nr_keys) {
+		for (unsigned int i = 0; i < nr_keys; i++) {
+			if (waiters[i].woken) {
+				woken_for = i;
+				break;
+			}
+		}
+
+		if (woken_for < nr_keys) break;
+
+		sys.scheduler().set_entity_state(thread, SchedulingEntityState::SLEEPING);
+
+		_lock.unlock();
+		sys.arch().invoke_kernel_syscall(1);
+		_lock.lock();
+	}
+
+	// A waker takes the node it wakes off the queue; the rest are still on it.
+	for (unsigned int i = 0; i < nr_keys; i++) {
+		if (waiters[i].woken) continue;
+
+		Waiter *prev = NULL;
+		for (Waiter *waiter = _head; waiter; prev = waiter, waiter = waiter->next) {
+			if (waiter == &waiters[i]) {
+				unlink(waiter, prev);
+				break;
+			}
+		}
+	}
+
+	return woken_for;
+}
+
+void WakeQueue::wait_callback_locked(CallbackWaiter& waiter, WakeFn fn, void *arg)
+{
+	assert(_lock.locked());
+
+	waiter.waiter.thread = NULL;
+	waiter.waiter.woken = false;
+	waiter.waiter.key.object = NULL;
+	waiter.waiter.key.offset = 0;
+	waiter.waiter.callback.fn = fn;
+	waiter.waiter.callback.arg = arg;
+
+	append(waiter.waiter);
+}
+
+/**
+ * Wakes a waiter that has been taken off the queue.  The waiter's node is on its
+ * stack (or in whatever is waiting), so it may be gone as soon as it is woken.
+ */
+void WakeQueue::wake(Waiter *waiter)
+{
+	Thread *thread = waiter->thread;
+	Callback callback = waiter->callback;
+
+	waiter->woken = true;
+
+	if (thread) {
+		thread->wake_up();
+	} else {
+		callback.fn(callback.arg);
+	}
+}
+
+bool WakeQueue::wake_one_locked()
+{
+	Waiter *waiter = _head;
+	if (!waiter) return false;
+
+	_head = waiter->next;
+	if (!_head) _tail = NULL;
+
+	wake(waiter);
+	return true;
+}
+
+bool WakeQueue::wake_one()
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	return wake_one_locked();
 }
 
-void WakeQueue::wake()
+void WakeQueue::wake_all()
 {
-    // TODO: some sort of lock
-    for (auto waiter : _waiters) {
-        waiter->wake_up();
-    }
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	while (wake_one_locked());
+}
+
+unsigned int WakeQueue::wake_key_locked(const Key& key, unsigned int max)
+{
+	assert(_lock.locked());
+
+	unsigned int nr_woken = 0;
+	Waiter *prev = NULL, *waiter = _head;
+
+	while (waiter && nr_woken < max) {
+		Waiter *next = waiter->next;
+
+		if (!(waiter->key == key)) {
+			prev = waiter;
+			waiter = next;
+			continue;
+		}
+
+		unlink(waiter, prev);
+
+		// Waking a stopped thread would start it running again.
+		Thread *thread = waiter->thread;
+		if (!thread || thread->state() != SchedulingEntityState::STOPPED) {
+			wake(waiter);
+			nr_woken++;
+		}
+
+		waiter = next;
+	}
+
+	return nr_woken;
+}
+
+void WakeQueue::forget_locked(const void *object)
+{
+	assert(_lock.locked());
+
+	Waiter *prev = NULL, *waiter = _head;
+	while (waiter) {
+		Waiter *next = waiter->next;
+
+		if (waiter->key.object == object) {
+			unlink(waiter, prev);
+		} else {
+			prev = waiter;
+		}
 
-    _waiters.clear();
+		waiter = next;
+	}
 }